@@ -0,0 +1,207 @@
+/*
+ * sd_async.h
+ *
+ * Asynchronous block I/O for FreeRTOS builds. Requests are queued to a single
+ * SD I/O task that schedules (sd_sched.h) and performs the transfers, so the
+ * submitting task does not wait for data transfers or card busy periods.
+ * Completion is reported through a callback or, when none is given, a
+ * direct-to-task notification.
+ */
+
+#ifndef __SD_ASYNC_H__
+#define __SD_ASYNC_H__
+
+#include "sd_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef USE_FREERTOS
+
+#include "FreeRTOS.h"
+#include "event_groups.h"
+
+/* Pending requests the queue can hold. */
+#ifndef SD_ASYNC_QUEUE_DEPTH
+#define SD_ASYNC_QUEUE_DEPTH 8U
+#endif
+
+/* I/O task stack depth in words. */
+#ifndef SD_ASYNC_TASK_STACK
+#define SD_ASYNC_TASK_STACK 256U
+#endif
+
+#ifndef SD_ASYNC_TASK_PRIORITY
+#define SD_ASYNC_TASK_PRIORITY (tskIDLE_PRIORITY + 2U)
+#endif
+
+/* How long a submit may wait for queue space (0 = fail with SD_BUSY at once). */
+#ifndef SD_ASYNC_SUBMIT_TIMEOUT_MS
+#define SD_ASYNC_SUBMIT_TIMEOUT_MS 0U
+#endif
+
+/*
+ * Completion barrier for a group of requests. Members complete into the batch
+ * instead of waking their submitter, and one event group bit is set when the
+ * last of them lands, so a waiter wakes once per batch.
+ */
+typedef struct {
+    EventGroupHandle_t group;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticEventGroup_t group_buffer;
+#endif
+    uint32_t pending;  // Members not yet complete, plus one until the batch is sealed
+    uint32_t members;  // Members submitted since SD_AsyncBatchBegin
+    SD_Status status;  // SD_OK, or the first member failure
+    bool sealed;
+} SD_AsyncBatch;
+
+/**
+ * @brief Create a batch's event group
+ * @param batch Batch to initialize; keep it in static or long-lived storage
+ * @return SD_OK, or SD_ERROR if the event group could not be created
+ *
+ * Note: Call once per batch object; SD_AsyncBatchBegin reuses it after that.
+ */
+SD_Status SD_AsyncBatchInit(SD_AsyncBatch *batch);
+
+/**
+ * @brief Open a new round of members on a batch
+ * @param batch Batch created with SD_AsyncBatchInit
+ * @return SD_OK, SD_BUSY if members of the previous round are still in flight,
+ *         SD_PARAM otherwise
+ */
+SD_Status SD_AsyncBatchBegin(SD_AsyncBatch *batch);
+
+/**
+ * @brief Queue a request as a member of a batch
+ * @param batch Open batch (SD_AsyncBatchBegin, not yet waited on)
+ * @param request Request to copy into the queue
+ * @return SD_Submit's result; a failed submit also fails the batch
+ *
+ * Note: The member's callback, if any, still runs in the I/O task before the
+ * batch counts it. Without a callback the submitter is not notified; the
+ * status is folded into the batch instead. Task context only.
+ */
+SD_Status SD_AsyncBatchSubmit(SD_AsyncBatch *batch, const SD_IoRequest *request);
+
+/**
+ * @brief Queue a block write as a member of a batch
+ * @param batch Open batch
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Source buffer; must stay valid until the batch completes
+ * @param sector Starting sector
+ * @param count Number of sectors
+ * @return As SD_AsyncBatchSubmit
+ */
+SD_Status SD_AsyncBatchWrite(SD_AsyncBatch *batch, SD_Handle_t *sd_handle, const uint8_t *buff,
+                             uint32_t sector, uint32_t count);
+
+/**
+ * @brief Seal a batch and wait for all of its members
+ * @param batch Batch to wait on
+ * @param timeout_ms Maximum time to wait
+ * @return SD_OK if every member succeeded, the first member failure, or
+ *         SD_TIMEOUT if members are still in flight (call again to keep waiting)
+ *
+ * Note: No members can be added once a batch has been waited on. A batch with
+ * no members completes at once.
+ */
+SD_Status SD_AsyncBatchWait(SD_AsyncBatch *batch, uint32_t timeout_ms);
+
+/**
+ * @brief Create the request queue and the SD I/O task
+ * @return SD_OK, or SD_ERROR if the queue or task could not be created
+ *
+ * Note: Call once after the scheduler objects can be created. Calling it
+ * again is a no-op.
+ */
+SD_Status SD_AsyncStart(void);
+
+/* The SD I/O task, or NULL before SD_AsyncStart (for vTaskGetInfo and run-time stats). */
+TaskHandle_t SD_AsyncTaskHandle(void);
+
+/**
+ * @brief Select the scheduler policy used by the SD I/O task
+ * @param policy Lead-selection policy, or NULL for SD_SchedElevator
+ *
+ * Note: Takes effect at SD_AsyncStart; call it before starting.
+ */
+void SD_AsyncSetPolicy(SD_SchedPolicy policy);
+
+/**
+ * @brief Queue a request with an explicit priority class
+ * @param request Request to copy into the queue (submitter is filled in)
+ * @return SD_OK if queued, SD_BUSY if the queue is full or the calling task
+ *         already has a callback-less request in flight, SD_PARAM/SD_ERROR otherwise
+ *
+ * Note: A request without callback or batch is reported through the submitting
+ * task's notification value, so each task may have only one in flight; collect
+ * it with SD_AsyncWait before queueing the next. Adjacent queued requests in the same direction are merged into one
+ * multi-block command; higher priority classes are dispatched first. A request
+ * with has_deadline set is moved ahead once it is due within
+ * SD_SCHED_URGENT_MS, and completes with SD_TIMEOUT without touching the card
+ * if its deadline passes while queued (counted in SD_Stats.deadline_misses).
+ */
+SD_Status SD_Submit(const SD_IoRequest *request);
+
+/**
+ * @brief Queue a request from an interrupt handler
+ * @param request Request to copy into the queue; callback is required
+ * @param higher_prio_woken Set to pdTRUE (never cleared) if the SD I/O task should
+ *        run on ISR exit (pass to portYIELD_FROM_ISR); may be NULL
+ * @return SD_OK if queued, SD_BUSY if the queue is full, SD_PARAM/SD_ERROR otherwise
+ *
+ * Note: Only the descriptor is copied; the buffer must stay valid until the
+ * callback runs in the SD I/O task, which is where it can go back to a pool.
+ */
+SD_Status SD_SubmitFromISR(const SD_IoRequest *request, BaseType_t *higher_prio_woken);
+
+/**
+ * @brief Queue a block read
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Destination buffer; must stay valid until completion
+ * @param sector Starting sector
+ * @param count Number of sectors
+ * @param callback Completion callback, or NULL to notify the submitting task
+ * @param context Passed to the callback
+ * @return SD_OK if queued, SD_BUSY if the queue is full, SD_PARAM/SD_ERROR otherwise
+ *
+ * Note: Queued at SD_IO_PRIO_NORMAL. Without a callback the status is sent to
+ * the submitting task as its notification value; collect it with SD_AsyncWait.
+ * Only one such request per task may be in flight (SD_BUSY otherwise).
+ */
+SD_Status SD_SubmitRead(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count,
+                        SD_AsyncCallback callback, void *context);
+
+/**
+ * @brief Queue a block write
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Source buffer; must stay valid until completion
+ * @param sector Starting sector
+ * @param count Number of sectors
+ * @param callback Completion callback, or NULL to notify the submitting task
+ * @param context Passed to the callback
+ * @return SD_OK if queued, SD_BUSY if the queue is full, SD_PARAM/SD_ERROR otherwise
+ */
+SD_Status SD_SubmitWrite(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
+                         uint32_t count, SD_AsyncCallback callback, void *context);
+
+/**
+ * @brief Wait for a notified completion of a request submitted without callback
+ * @param timeout_ms Maximum time to wait
+ * @return Request status, or SD_TIMEOUT if nothing completed in time
+ *
+ * Note: Each task has at most one such request in flight; SD_Submit refuses
+ * a second with SD_BUSY until the first completes.
+ */
+SD_Status SD_AsyncWait(uint32_t timeout_ms);
+
+#endif /* USE_FREERTOS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_ASYNC_H__ */
@@ -0,0 +1,181 @@
+/*
+ * sd_async.hpp
+ *
+ * C++20 coroutine layer over sd_async.h (FreeRTOS builds). co_await on
+ * sd::read/sd::write queues the request and suspends the coroutine; the
+ * completion callback resumes it in the SD I/O task, so one task can keep
+ * many transfers in flight without a blocked stack per transfer. The code
+ * between two co_awaits then runs in the I/O task: keep it short and do not
+ * block there (submitting more requests is fine).
+ *
+ * sd::Detached is a fire-and-forget coroutine type whose frames come from a
+ * fixed pool (SD_CORO_FRAMES x SD_CORO_FRAME_BYTES), never the heap. When the
+ * pool is empty the coroutine does not start and the returned object reports
+ * started() == false.
+ */
+
+#ifndef __SD_ASYNC_HPP__
+#define __SD_ASYNC_HPP__
+
+#include "sd_async.h"
+
+#if defined(USE_FREERTOS) && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Coroutine frames in the sd::Detached pool (at most 32). */
+#ifndef SD_CORO_FRAMES
+#define SD_CORO_FRAMES 4U
+#endif
+
+/* Bytes per frame: locals that live across a co_await are stored in it. */
+#ifndef SD_CORO_FRAME_BYTES
+#define SD_CORO_FRAME_BYTES 256U
+#endif
+
+#if (SD_CORO_FRAMES == 0U) || (SD_CORO_FRAMES > 32U)
+#error "SD_CORO_FRAMES must be between 1 and 32"
+#endif
+
+namespace sd {
+
+/*
+ * Awaiter for one queued request. The I/O task may finish the transfer before
+ * await_suspend returns, so the submitter and the completion race on a flag:
+ * whichever comes second resumes (or does not suspend at all).
+ */
+class BlockIo {
+public:
+    explicit BlockIo(const SD_IoRequest &request) noexcept : request_(request) {}
+
+    BlockIo(const BlockIo &) = delete;
+    BlockIo &operator=(const BlockIo &) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        handle_ = handle;
+        request_.callback = &BlockIo::complete;
+        request_.context = this;
+        SD_Status queued = SD_Submit(&request_);
+        if (queued != SD_OK) {
+            status_ = queued;
+            return false; // not queued: resume at once with the submit error
+        }
+        /* Suspended unless the completion already ran. */
+        return !__atomic_exchange_n(&raced_, true, __ATOMIC_ACQ_REL);
+    }
+
+    SD_Status await_resume() const noexcept { return status_; }
+
+private:
+    static void complete(SD_Status status, void *context) {
+        BlockIo *io = static_cast<BlockIo *>(context);
+        io->status_ = status;
+        if (__atomic_exchange_n(&io->raced_, true, __ATOMIC_ACQ_REL)) {
+            io->handle_.resume();
+        }
+    }
+
+    SD_IoRequest request_;
+    std::coroutine_handle<> handle_;
+    SD_Status status_ = SD_OK;
+    bool raced_ = false;
+};
+
+/* co_await sd::read(&g_sd_handle, lba, buf, n) -> SD_Status */
+inline BlockIo read(SD_Handle_t *sd_handle, uint32_t lba, uint8_t *buff, uint32_t count,
+                    SD_IoPriority priority = SD_IO_PRIO_NORMAL) noexcept {
+    SD_IoRequest request = {};
+    request.sd_handle = sd_handle;
+    request.buff = buff;
+    request.sector = lba;
+    request.count = count;
+    request.write = false;
+    request.priority = priority;
+    return BlockIo(request);
+}
+
+/* co_await sd::write(&g_sd_handle, lba, buf, n) -> SD_Status */
+inline BlockIo write(SD_Handle_t *sd_handle, uint32_t lba, const uint8_t *buff, uint32_t count,
+                     SD_IoPriority priority = SD_IO_PRIO_NORMAL) noexcept {
+    SD_IoRequest request = {};
+    request.sd_handle = sd_handle;
+    request.buff = const_cast<uint8_t *>(buff); // only read by SD_WriteBlocks
+    request.sector = lba;
+    request.count = count;
+    request.write = true;
+    request.priority = priority;
+    return BlockIo(request);
+}
+
+/* Fixed frame pool behind sd::Detached, claimed lock-free like sd_pool.c. */
+class CoroFrames {
+public:
+    static void *take(size_t bytes) noexcept {
+        if (bytes > SD_CORO_FRAME_BYTES) {
+            __atomic_fetch_add(&misses_, 1U, __ATOMIC_RELAXED);
+            return nullptr;
+        }
+        uint32_t free_bits = __atomic_load_n(&free_, __ATOMIC_RELAXED);
+        uint32_t bit;
+        do {
+            if (free_bits == 0U) {
+                __atomic_fetch_add(&misses_, 1U, __ATOMIC_RELAXED);
+                return nullptr;
+            }
+            bit = free_bits & (~free_bits + 1U);
+        } while (!__atomic_compare_exchange_n(&free_, &free_bits, free_bits & ~bit, true,
+                                              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+        return frames_[__builtin_ctz(bit)].bytes;
+    }
+
+    static void give(void *frame) noexcept {
+        uintptr_t off = reinterpret_cast<uintptr_t>(frame) - reinterpret_cast<uintptr_t>(frames_);
+        (void)__atomic_fetch_or(&free_, 1U << (off / sizeof(Frame)), __ATOMIC_RELEASE);
+    }
+
+    /* Coroutines that could not start: pool empty or frame too large. */
+    static uint32_t misses() noexcept { return __atomic_load_n(&misses_, __ATOMIC_RELAXED); }
+
+private:
+    struct Frame {
+        alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) unsigned char bytes[SD_CORO_FRAME_BYTES];
+    };
+    static inline Frame frames_[SD_CORO_FRAMES];
+    static inline uint32_t free_ =
+        (SD_CORO_FRAMES >= 32U) ? 0xFFFFFFFFU : ((1U << SD_CORO_FRAMES) - 1U);
+    static inline uint32_t misses_ = 0;
+};
+
+/* Fire-and-forget coroutine: runs to its first co_await in the caller, then in the I/O task. */
+class Detached {
+public:
+    struct promise_type {
+        static void *operator new(size_t bytes) noexcept { return CoroFrames::take(bytes); }
+        static void operator delete(void *frame) noexcept { CoroFrames::give(frame); }
+        static Detached get_return_object_on_allocation_failure() noexcept {
+            return Detached(false);
+        }
+
+        Detached get_return_object() noexcept { return Detached(true); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {}
+    };
+
+    bool started() const noexcept { return started_; }
+
+private:
+    explicit Detached(bool started) noexcept : started_(started) {}
+    bool started_;
+};
+
+} // namespace sd
+
+#endif /* USE_FREERTOS && __cpp_impl_coroutine */
+
+#endif /* __SD_ASYNC_HPP__ */
@@ -0,0 +1,89 @@
+/*
+ * sd_autotune.h
+ *
+ * Boot-time tuning of the transfer mode, bus clock and write size. The first
+ * time a card is seen, sd_autotune writes and reads back a scratch file
+ * (sd_benchmark_file) for polling and DMA, the negotiated SPI prescaler and
+ * SD_TUNE_CLOCK_STEPS - 1 slower ones, and 512 B, 4 KB and 16 KB calls (up
+ * to SD_BENCH_MAX_BUFFER). The fastest combination (write plus read time) is
+ * applied to g_sd_handle and saved as one text line in a small file; on later
+ * boots the line is read back and applied without running anything, as long
+ * as it names the same card.
+ *
+ * The card is identified by the CID's manufacturer and serial (SD_CARD_INFO
+ * 1) or else by the FAT volume serial (_USE_LABEL 1), plus the block count.
+ * A slower clock only wins when the fast one costs CRC retries; the saved
+ * prescaler is never applied faster than the one SD_Init negotiated.
+ */
+
+#ifndef __SD_AUTOTUNE_H__
+#define __SD_AUTOTUNE_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes written and read back per candidate. */
+#ifndef SD_TUNE_FILE_BYTES
+#define SD_TUNE_FILE_BYTES 131072U
+#endif
+
+/* Prescalers tried: the negotiated one and the next slower ones. */
+#ifndef SD_TUNE_CLOCK_STEPS
+#define SD_TUNE_CLOCK_STEPS 2U
+#endif
+
+/* Try DMA as well as polling (0 when the SPI has no DMA streams linked). */
+#ifndef SD_TUNE_DMA
+#define SD_TUNE_DMA 1
+#endif
+
+/* Scratch file, removed after tuning. */
+#ifndef SD_TUNE_SCRATCH
+#define SD_TUNE_SCRATCH "sdtune.tmp"
+#endif
+
+#if (SD_TUNE_CLOCK_STEPS < 1U) || (SD_TUNE_CLOCK_STEPS > 8U)
+#error "SD_TUNE_CLOCK_STEPS must be 1..8"
+#endif
+
+#if (SD_TUNE_FILE_BYTES < 512U)
+#error "SD_TUNE_FILE_BYTES must be at least 512"
+#endif
+
+typedef struct {
+    uint8_t mid;          // CID manufacturer (0 without a valid CID)
+    uint32_t psn;         // CID serial, or the volume serial without a valid CID
+    uint32_t blocks;      // Card capacity in blocks
+    bool use_dma;         // SD_XFER_DMA rather than SD_XFER_POLL
+    uint32_t prescaler;   // SPI_BAUDRATEPRESCALER_x
+    uint32_t chunk_bytes; // Fastest f_write/f_read size; use it for application writes
+    uint32_t kb_per_s;    // Write plus read throughput measured with it
+} SD_TuneConfig;
+
+/**
+ * @brief Apply the saved configuration for this card, or tune and save one
+ * @param path Configuration file on the mounted volume (e.g. "0:/sdtune.cfg")
+ * @param force Tune even if the file matches the card
+ * @param out Configuration applied (may be NULL)
+ * @return FR_OK, or the FatFs code of the first failing step
+ *
+ * Note: The volume must be mounted (sd_mount). Tuning writes and deletes
+ * SD_TUNE_SCRATCH and takes a few seconds; a file for another card or one
+ * that does not parse is replaced. On failure g_sd_handle keeps its settings.
+ */
+int sd_autotune(const char *path, bool force, SD_TuneConfig *out);
+
+/* Apply cfg's transfer mode and prescaler to g_sd_handle (no faster than negotiated). */
+int sd_autotune_apply(const SD_TuneConfig *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_AUTOTUNE_H__ */
@@ -2,13 +2,273 @@
  * sd_benchmark.h
  *
  * Optional throughput benchmark helpers.
+ *
+ * Timing uses the Cortex-M DWT cycle counter, so per-call latencies are
+ * resolved to one CPU cycle rather than one SysTick millisecond. Results are
+ * printed as comma-separated "SDBENCH," lines for scripted capture, and can
+ * also be appended to a CSV on the card (sd_benchmark_set_csv) so devices in
+ * the field can benchmark themselves at boot.
  */
 
 #ifndef __SD_BENCHMARK_H__
 #define __SD_BENCHMARK_H__
 
+#include <stdbool.h>
 #include <stdint.h>
+#include "sd_spi.h"
+
+/* Largest buffer swept by sd_benchmark_suite (sizes the static transfer buffer). */
+#ifndef SD_BENCH_MAX_BUFFER
+#define SD_BENCH_MAX_BUFFER 32768U
+#endif
+
+/* Per-call latencies kept for the p99 figure; min/avg/max always cover every call. */
+#ifndef SD_BENCH_MAX_SAMPLES
+#define SD_BENCH_MAX_SAMPLES 1024U
+#endif
+
+/* Log2 latency buckets per IOPS histogram: bucket i counts [2^i, 2^(i+1)) us, 0 is < 2 us. */
+#ifndef SD_BENCH_HIST_BUCKETS
+#define SD_BENCH_HIST_BUCKETS 16U
+#endif
+
+/* File size for the sd_benchmark_fsconf_suite workloads (the seek test reads inside it). */
+#ifndef SD_BENCH_FSCONF_BYTES
+#define SD_BENCH_FSCONF_BYTES 262144U
+#endif
+
+/* Files created and listed by the sd_benchmark_fsconf_suite directory test. */
+#ifndef SD_BENCH_FSCONF_FILES
+#define SD_BENCH_FSCONF_FILES 32U
+#endif
+
+/* Deepest queue sd_benchmark_iops keeps in flight (needs USE_FREERTOS above 1). */
+#ifndef SD_BENCH_MAX_QD
+#define SD_BENCH_MAX_QD 8U
+#endif
+
+typedef struct {
+    uint32_t file_bytes;   // Bytes transferred
+    uint32_t buf_bytes;    // Bytes per f_read/f_write call (raw mode: per command)
+    bool use_dma;          // Transfer mode the run used
+    uint32_t calls;        // f_read/f_write calls (raw mode: block-layer commands)
+    uint64_t total_cycles; // All calls plus the closing f_close (raw writes: SD_Sync)
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint32_t p99_cycles;   // Over the first SD_BENCH_MAX_SAMPLES calls
+    uint64_t bus_cycles;   // Of the run, SPI transfers in flight (SD_LATENCY_STATS, else 0)
+} SD_BenchResult;
+
+/* Block-layer entry point timed by sd_benchmark_raw. */
+typedef enum {
+    SD_BENCH_RAW_READ = 0,    // SD_ReadBlocks
+    SD_BENCH_RAW_WRITE,       // SD_WriteBlocks
+    SD_BENCH_RAW_READ_MULTI,  // SD_ReadMultiBlocks
+    SD_BENCH_RAW_WRITE_MULTI  // SD_WriteMultiBlocks
+} SD_BenchRawOp;
+
+typedef struct {
+    SD_BenchRawOp op;
+    bool random;             // Random command-aligned offsets instead of sequential
+    uint32_t first_lba;      // Reserved range; its contents are overwritten by writes
+    uint32_t span_blocks;    // Size of the reserved range in blocks
+    uint32_t blocks_per_cmd; // 1..SD_BENCH_MAX_BUFFER / 512
+    uint32_t total_blocks;   // Blocks to move in the run
+} SD_BenchRawConfig;
+
+typedef struct {
+    uint32_t first_lba;    // Reserved range; writes overwrite it
+    uint32_t span_blocks;  // Size of the reserved range in blocks
+    uint32_t io_blocks;    // Blocks per I/O (1 = 512 B, 8 = 4 KB)
+    uint32_t read_percent; // 0..100: share of I/Os that are reads
+    uint32_t ops;          // I/Os to issue
+    uint32_t queue_depth;  // I/Os in flight; >1 goes through the async queue
+} SD_BenchIopsConfig;
+
+typedef struct {
+    uint32_t io_blocks;
+    uint32_t read_percent;
+    uint32_t queue_depth;
+    bool use_dma;
+    uint32_t reads;
+    uint32_t writes;
+    uint64_t total_cycles; // Wall time of the whole run
+    uint64_t read_cycles;  // Sum of per-I/O latencies
+    uint64_t write_cycles;
+    uint32_t read_max_cycles;
+    uint32_t write_max_cycles;
+    uint32_t read_hist[SD_BENCH_HIST_BUCKETS];
+    uint32_t write_hist[SD_BENCH_HIST_BUCKETS];
+} SD_BenchIopsResult;
+
+/* Enable the DWT cycle counter (idempotent; called by the functions below). */
+void sd_benchmark_cycles_init(void);
+
+/**
+ * @brief Time writing or reading one file through FatFs
+ * @param filename File to create (write) or open (read)
+ * @param write true to write, false to read back
+ * @param file_bytes Bytes to transfer
+ * @param buf_bytes Bytes per call (1..SD_BENCH_MAX_BUFFER)
+ * @param out Result (filled on success)
+ * @return FR_OK, or the first failing FatFs code
+ *
+ * Note: The volume must be mounted. Uses g_sd_handle's current DMA setting.
+ */
+int sd_benchmark_file(const char *filename, bool write, uint32_t file_bytes,
+                      uint32_t buf_bytes, SD_BenchResult *out);
+
+/**
+ * @brief Time block-layer transfers directly, bypassing FatFs
+ * @param sd_handle Initialized SD handle
+ * @param cfg Operation, access pattern, LBA range and command size
+ * @param out Result (filled on success)
+ * @return SD_OK, SD_PARAM for a bad config, or the first failing transfer status
+ *
+ * Note: Gives the transport ceiling to compare with sd_benchmark_file. Writes
+ * destroy data in [first_lba, first_lba + span_blocks); keep that range
+ * outside any mounted partition.
+ */
+SD_Status sd_benchmark_raw(SD_Handle_t *sd_handle, const SD_BenchRawConfig *cfg,
+                           SD_BenchResult *out);
+
+/**
+ * @brief Sweep raw mode over every op, sequential/random and 1..64 blocks per command
+ * @param sd_handle Initialized SD handle
+ * @param first_lba Start of the reserved range
+ * @param span_blocks Size of the reserved range in blocks
+ *
+ * Note: Prints "SDBENCH,raw_<op>_<seq|rand>,..." lines in the same columns.
+ */
+void sd_benchmark_raw_suite(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks);
+
+/**
+ * @brief Compare DMA stream profiles on raw sequential reads and writes
+ * @param sd_handle Initialized SD handle
+ * @param first_lba Start of the reserved range
+ * @param span_blocks Size of the reserved range in blocks
+ *
+ * Note: Needs SD_DMA_PROFILE 1. Runs 1- and 8-block commands under the CubeMX
+ * settings (direct mode, low priority), then with FIFO, word packing, 4-beat
+ * bursts and higher priorities, printing "SDBENCH,dma_<profile>_<op><n>,..."
+ * lines. Run it while the other DMA users are active to see the effect of
+ * priority and bursts. Restores the handle's profile and DMA setting.
+ */
+void sd_benchmark_dma_suite(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks);
+
+/**
+ * @brief Random-offset IOPS workload with a read:write mix
+ * @param sd_handle Initialized SD handle
+ * @param cfg Range, I/O size, mix, op count and queue depth
+ * @param out Result with per-op latency histograms
+ * @return SD_OK, SD_PARAM for a bad config, or the first failing I/O status
+ *
+ * Note: Queue depth 1 calls SD_ReadBlocks/SD_WriteBlocks directly. Deeper
+ * queues submit through SD_SubmitRead/SD_SubmitWrite (starting the async task
+ * if needed) and time each request from submit to completion; this needs
+ * USE_FREERTOS and io_blocks * queue_depth * 512 <= SD_BENCH_MAX_BUFFER.
+ */
+SD_Status sd_benchmark_iops(SD_Handle_t *sd_handle, const SD_BenchIopsConfig *cfg,
+                            SD_BenchIopsResult *out);
+
+/**
+ * @brief Print an IOPS result as an "SDBENCH_IOPS," line and two "SDBENCH_HIST," lines
+ * @param tag Short workload name
+ * @param r Result to print
+ */
+void sd_benchmark_iops_print(const char *tag, const SD_BenchIopsResult *r);
+
+/**
+ * @brief Sweep 512 B / 4 KB random I/O over read-only, write-only and 70:30 mixes
+ * @param sd_handle Initialized SD handle
+ * @param first_lba Start of the reserved range
+ * @param span_blocks Size of the reserved range in blocks
+ *
+ * Note: Runs queue depth 1, and with USE_FREERTOS also queue depth 4.
+ */
+void sd_benchmark_iops_suite(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks);
+
+/**
+ * @brief Time FatFs-style byte loops against sd_mem and the C library
+ *
+ * Copies, fills and compares (equal buffers, so the whole length) 11 B to
+ * 512 B, with the source aligned and one byte off, and prints
+ * "SDBENCH_MEM,op,bytes,src_offset,byte_cycles,sd_mem_cycles,libc_cycles"
+ * lines (cycles per call). Needs no card. The byte loops are ff.c's; build
+ * this file with ff.c's optimization flags for a like-for-like figure.
+ */
+void sd_benchmark_mem_suite(void);
+
+/*
+ * Print an "SDBENCH_CARD,mid,oid,pnm,prv,psn,mdt,tran_kbps,class,uhs,video,au_kb,
+ * prescaler" line for the card behind sd_handle (SD_CARD_INFO; nothing
+ * otherwise). The suites print it first, so results can be grouped by model.
+ */
+void sd_benchmark_print_card(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Also append every sd_benchmark_print result to a CSV on the card
+ * @param sd_handle Card whose CID and bus clock go in each row
+ * @param path File on the mounted volume (e.g. "0:/bench.csv", kept by pointer); NULL stops
+ * @param tag Written in the first column, e.g. a device serial or boot count
+ *            (no commas; truncated to 31 characters)
+ *
+ * Note: The file is opened, appended to and closed once per result, between
+ * timed runs, and gets the column header when it is created:
+ * tag,mid,oid,pnm,prv,psn,mdt,prescaler,spi_khz,op,mode,file_bytes,buf_bytes,
+ * calls,min_us,avg_us,p99_us,max_us,kb_per_s. CID columns are empty without
+ * SD_CARD_INFO and spi_khz is 0 without SD_SPI_CLOCK_HZ. The raw suites only
+ * get rows if the caller keeps a volume mounted outside their LBA range.
+ */
+void sd_benchmark_set_csv(SD_Handle_t *sd_handle, const char *path, const char *tag);
+
+/**
+ * @brief Append one result row to the CSV set by sd_benchmark_set_csv
+ * @param op Short tag such as "write"
+ * @param r Result to record
+ * @return FR_OK, FR_INVALID_PARAMETER with no CSV set, or the failing FatFs code
+ */
+int sd_benchmark_csv_append(const char *op, const SD_BenchResult *r);
+
+/* Print the "SDBENCH,op,..." column header. */
+void sd_benchmark_print_header(void);
+
+/*
+ * Print one result as an "SDBENCH," line; op is a short tag such as "write".
+ * The last column, bus_permille, is the share of the run the SPI bus spent
+ * clocking (bus_cycles over total_cycles). With a CSV set, also appends it
+ * there, without bus_permille (an "SDBENCH,error,csv,<res>" line on failure).
+ */
+void sd_benchmark_print(const char *op, const SD_BenchResult *r);
+
+/**
+ * @brief Sweep buffer sizes, file sizes and DMA vs polling
+ *
+ * Mounts the card, writes then reads "bench.bin" for every combination,
+ * prints one line per run and removes the file. Blocking; intended for the
+ * default task. Restores g_sd_handle.use_dma afterwards.
+ */
+void sd_benchmark_suite(void);
+
+/**
+ * @brief Fixed FatFs workload for comparing ffconf.h / cache builds
+ *
+ * Mounts the card and prints one "SDBENCH_FSCONF,config,<label>,..." line
+ * with the build's FatFs options (_FS_TINY, _USE_LFN, _USE_FASTSEEK, the
+ * SD_CACHE_LINES in use) and the static RAM they cost (FATFS, FIL, LFN
+ * buffer, sector cache), then one "SDBENCH_FSCONF,<workload>,bytes,calls,us,
+ * kb_per_s,sect_rd,sect_wr,cmds" line per workload: sequential write and
+ * read with 4 KB calls, 64-byte appends and reads, 512-byte reads at random
+ * offsets (through a cluster link map with fast seek) and creating, listing
+ * and removing SD_BENCH_FSCONF_FILES files. The sector and command counts are
+ * the card traffic from SD_Stats, so a cache or _FS_TINY shows up there
+ * before it shows in time. The label is derived from the options, so logs of
+ * several builds, on target or in the host simulator, can be put side by
+ * side (tests/sd_fsconf_table.cmake does that).
+ */
+void sd_benchmark_fsconf_suite(void);
 
+/* Quick 500 KB write/read test with a 512-byte buffer. */
 void sd_benchmark(void);
 
 #endif // __SD_BENCHMARK_H__
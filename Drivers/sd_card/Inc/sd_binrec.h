@@ -0,0 +1,144 @@
+/*
+ * sd_binrec.h
+ *
+ * Binary record files: fixed-size records behind a one-sector header that
+ * describes their fields, as an alternative to CSV. A reader maps a record
+ * through an sd_mapwin window and uses it in place (typically as the same C
+ * struct that was logged), so reading costs a bounds check and, now and
+ * then, a window load, instead of a line split and an atoi per field.
+ *
+ * File layout (all fields little-endian):
+ *
+ *   bytes 0..511     header: "SDBR" magic @0, version 1 (u16) @4, field
+ *                    count (u16) @6, record size (u16) @8, header size 512
+ *                    (u16) @10, zero @12, field descriptors from @16 (16
+ *                    bytes each: name, NUL-padded, @0..11, type @12, size
+ *                    @13, offset in the record (u16) @14), CRC-32 (IEEE)
+ *                    of bytes 0..507 @508
+ *   record i         at 512 + i * record size
+ *
+ * A partial record at the end of the file (a cut power supply) is not
+ * counted. sd_binrec_logger_start writes the header through the streaming
+ * logger (sd_logger.h); sd_binrec_from_csv converts CSV files on the card.
+ */
+
+#ifndef __SD_BINREC_H__
+#define __SD_BINREC_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+#include "sd_mapwin.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest record sd_binrec_from_csv builds (one static buffer). */
+#ifndef SD_BINREC_MAX_RECORD
+#define SD_BINREC_MAX_RECORD 256U
+#endif
+
+#define SD_BINREC_HEADER_BYTES 512U
+#define SD_BINREC_NAME_LEN     12U
+#define SD_BINREC_MAX_FIELDS   30U
+
+/* Field types; size is the whole field (e.g. 8 for two F32s, 16 for a CHAR string). */
+typedef enum {
+    SD_BINREC_U8 = 1,
+    SD_BINREC_I8,
+    SD_BINREC_U16,
+    SD_BINREC_I16,
+    SD_BINREC_U32,
+    SD_BINREC_I32,
+    SD_BINREC_U64,
+    SD_BINREC_I64,
+    SD_BINREC_F32,
+    SD_BINREC_F64,
+    SD_BINREC_CHAR // Text, NUL-padded (not terminated when it fills the field)
+} SD_BinRecType;
+
+/* One field; also the descriptor's layout in the header. */
+typedef struct {
+    char name[SD_BINREC_NAME_LEN];
+    uint8_t type;    // SD_BinRecType
+    uint8_t size;    // Bytes: a multiple of the type's size (any length for CHAR)
+    uint16_t offset; // Position in the record, e.g. offsetof(struct sample, temp)
+} SD_BinRecField;
+
+typedef struct {
+    SD_MapWindow map;
+    uint32_t record_size;
+    uint32_t count;   // Whole records in the file when it was opened
+    uint32_t nfields;
+} SD_BinRecReader;
+
+typedef struct {
+    uint32_t records; // Rows written as records
+    uint32_t skipped; // Rows with too few columns or a value that did not parse
+} SD_BinRecConvertStats;
+
+/**
+ * @brief Build a header sector
+ * @param fields Field list (names unique, at most SD_BINREC_NAME_LEN - 1 characters)
+ * @param n 1..SD_BINREC_MAX_FIELDS
+ * @param record_size Bytes per record; every field must lie inside it
+ * @param header Receives SD_BINREC_HEADER_BYTES bytes
+ * @return FR_OK or FR_INVALID_PARAMETER
+ */
+int sd_binrec_header(const SD_BinRecField *fields, uint32_t n, uint32_t record_size,
+                     uint8_t *header);
+
+/**
+ * @brief Log records of this layout to path with the streaming logger
+ * @return As sd_logger_start; FR_INVALID_OBJECT if path already holds records
+ *         of another layout; FR_DENIED with SD_LOGGER_COMPRESS or
+ *         SD_LOGGER_CHANNELS (the records would not be readable in place,
+ *         being compressed or tagged); FR_INVALID_PARAMETER for a bad
+ *         layout or a record over SD_LOGGER_MAX_RECORD
+ *
+ * Note: A new file gets the header; an existing one is appended to. Log each
+ * record with sd_logger_write(&rec, record_size), and nothing else. With
+ * SD_LOGGER_PREALLOC_BYTES the file is recreated, and its size counts the
+ * reserve until sd_logger_stop. Task context only.
+ */
+int sd_binrec_logger_start(const char *path, const SD_BinRecField *fields, uint32_t n,
+                           uint32_t record_size);
+
+/**
+ * @brief Check the header of an open record file and attach a window
+ * @param fp File opened with FA_READ (ideally through sd_fastseek_open)
+ * @param buf, bytes Window buffer, as for sd_map_init; at least one record
+ *        and one sector
+ * @return FR_OK, FR_NO_FILESYSTEM for a missing or damaged header,
+ *         FR_INVALID_PARAMETER for a window smaller than a record, or a read error
+ */
+int sd_binrec_open(SD_BinRecReader *r, FIL *fp, void *buf, uint32_t bytes);
+
+/* Record index in place, valid until the next call on r; NULL past the end or on a read error. */
+const void *sd_binrec_get(SD_BinRecReader *r, uint32_t index);
+
+/* Descriptor of the field called name (exact match); FR_NO_FILE if the layout has none. */
+int sd_binrec_field(SD_BinRecReader *r, const char *name, SD_BinRecField *out);
+
+/**
+ * @brief Convert a CSV file to a record file
+ * @param csv Source; column i fills fields[i], through sd_csv_parse
+ * @param bin Destination; created or replaced
+ * @param stats Receives the counts (may be NULL)
+ * @return FR_OK, FR_INVALID_PARAMETER for a bad layout or a record over
+ *         SD_BINREC_MAX_RECORD, or the failing FRESULT
+ *
+ * Note: Integers take C prefixes (0x...); an array field gets the value in
+ * its first element. Rows that do not convert, such as a line of column
+ * names, are skipped and counted. Not reentrant.
+ */
+int sd_binrec_from_csv(const char *csv, const char *bin, const SD_BinRecField *fields,
+                       uint32_t n, uint32_t record_size, SD_BinRecConvertStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_BINREC_H__ */
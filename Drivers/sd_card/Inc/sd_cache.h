@@ -0,0 +1,376 @@
+/*
+ * sd_cache.h
+ *
+ * Optional write-back sector cache between the FatFs diskio glue and the
+ * SPI SD driver. Single-sector writes (FAT, directory and FIL buffer flushes)
+ * are absorbed in a small static pool and written back on CTRL_SYNC or
+ * eviction, with adjacent dirty sectors coalesced into one CMD25.
+ *
+ * With _FS_TINY 1 the pool also stands in for per-file sector buffers: FIL
+ * has no buf[], every partial-sector access goes through fs->win, and the
+ * window's write-backs and re-reads land here. SD_CacheHold keeps an open
+ * file's current sector resident, so switching between files and the FAT
+ * costs a memcpy instead of card I/O.
+ */
+
+#ifndef __SD_CACHE_H__
+#define __SD_CACHE_H__
+
+#include "sd_spi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Route diskio reads/writes through the cache (0 = direct driver calls). */
+#ifndef SD_CACHE_ENABLED
+#define SD_CACHE_ENABLED 0
+#endif
+
+/* Number of 512-byte cache lines (RAM cost: SD_CACHE_LINES * 512 bytes). */
+#ifndef SD_CACHE_LINES
+#define SD_CACHE_LINES 8U
+#endif
+
+/* Sectors that can be held resident at once (0 = off); always fewer than the lines. */
+#ifndef SD_CACHE_HOLD_LINES
+#define SD_CACHE_HOLD_LINES 0U
+#endif
+
+/*
+ * FreeRTOS: guard the pool with its own reader/writer lock instead of relying on
+ * the callers' serialization. Hits take it shared, so they run alongside each
+ * other and never wait for a card's bus lock; a miss reads the card with the
+ * lock released and installs the line afterwards. On by default when several
+ * diskio drives (SD_DISK_DRIVES) share the pool, since their volume locks are
+ * independent; sd_diskio_spi.h refuses that combination without it.
+ */
+#ifndef SD_CACHE_LOCK
+#if defined(USE_FREERTOS) && SD_CACHE_ENABLED && defined(SD_DISK_DRIVES) && (SD_DISK_DRIVES > 1U)
+#define SD_CACHE_LOCK 1
+#else
+#define SD_CACHE_LOCK 0
+#endif
+#endif
+
+/*
+ * Serve hits while a write-back is programming the card. SD_CacheFlush and
+ * SD_CacheFlushExcept claim their lines under the exclusive lock, then drop to
+ * shared for the card writes: nothing can change the lines meanwhile, so hits
+ * on any card keep being served, and misses (which need the lock exclusive)
+ * and writes queue behind the write-back. Once a writer waits, new readers
+ * wait behind it too. Eviction write-backs stay exclusive. Needs SD_CACHE_LOCK
+ * under FreeRTOS; with SD_SPLIT_BUSY the card is also left busy after the
+ * write-back returns, and hits meanwhile never touch it. Hits either way
+ * count as busy_hits.
+ */
+#ifndef SD_CACHE_BUSY_READS
+#define SD_CACHE_BUSY_READS 0
+#endif
+
+/*
+ * Metadata journal (needs a region attached with SD_CacheJournalAttach).
+ * Every write-back of a card's dirty lines (CTRL_SYNC, or an eviction, which
+ * then writes back all of them) first writes a record: one header block
+ * (sequence number, target sectors, checksum) and the line images, as one
+ * CMD25 into the next of two alternating slots. Only then are the lines
+ * written in place, and once they all land an empty record voids it. A power
+ * loss during the in-place writes leaves a complete record that
+ * SD_CacheJournalReplay (run by disk_initialize) applies, then voids, at the
+ * next mount; a loss during the record write leaves a torn record, and the
+ * previous one, empty or already applied, is harmless to replay. A multi-sector cache
+ * write over a sector of the newest record first voids it with an empty one.
+ */
+#ifndef SD_CACHE_JOURNAL
+#define SD_CACHE_JOURNAL 0
+#endif
+
+/*
+ * Partition the pool by sector class once a card's volume geometry is
+ * registered (SD_CacheSetRegions): FAT sectors, directory sectors (everything
+ * before the data area that is not FAT: boot sector, FSINFO and a FAT12/16
+ * root directory) and data sectors. Each class fills at most its own number
+ * of lines and replaces within them, so streaming a large file cannot push
+ * the FAT and directory out. A class given no lines is not cached: its
+ * single-sector reads and writes go to the card, refreshing any copy already
+ * held. Subdirectories and the FAT32 root live in the data area and count
+ * as data.
+ */
+#ifndef SD_CACHE_CLASSES
+#define SD_CACHE_CLASSES 0
+#endif
+
+/* Replacement policies: LRU refreshes a line on every hit, FIFO only when it is filled. */
+#define SD_CACHE_LRU  0
+#define SD_CACHE_FIFO 1
+
+/* Lines per class (SD_CACHE_CLASSES); together at most SD_CACHE_LINES. */
+#ifndef SD_CACHE_FAT_LINES
+#define SD_CACHE_FAT_LINES (SD_CACHE_LINES / 2U)
+#endif
+
+#ifndef SD_CACHE_DIR_LINES
+#define SD_CACHE_DIR_LINES (SD_CACHE_LINES - SD_CACHE_FAT_LINES)
+#endif
+
+/* 0 = streaming data bypasses the cache. */
+#ifndef SD_CACHE_DATA_LINES
+#define SD_CACHE_DATA_LINES 0U
+#endif
+
+#ifndef SD_CACHE_FAT_POLICY
+#define SD_CACHE_FAT_POLICY SD_CACHE_LRU
+#endif
+
+#ifndef SD_CACHE_DIR_POLICY
+#define SD_CACHE_DIR_POLICY SD_CACHE_LRU
+#endif
+
+#ifndef SD_CACHE_DATA_POLICY
+#define SD_CACHE_DATA_POLICY SD_CACHE_FIFO
+#endif
+
+/* Blocks of one record slot; an attached region is two slots. */
+#define SD_CACHE_JOURNAL_SLOT   (SD_CACHE_LINES + 1U)
+#define SD_CACHE_JOURNAL_BLOCKS (2U * SD_CACHE_JOURNAL_SLOT)
+
+#if (SD_CACHE_LINES < 1U) || (SD_CACHE_LINES > 32U)
+#error "SD_CACHE_LINES must be between 1 and 32"
+#endif
+
+#if (SD_CACHE_BUSY_READS == 1) && (SD_CACHE_LOCK == 0) && (SD_SPLIT_BUSY == 0)
+#error "SD_CACHE_BUSY_READS needs SD_CACHE_LOCK or SD_SPLIT_BUSY"
+#endif
+
+#if (SD_CACHE_HOLD_LINES >= SD_CACHE_LINES)
+#error "SD_CACHE_HOLD_LINES must leave at least one line for FAT/directory traffic"
+#endif
+
+#if (SD_CACHE_CLASSES == 1)
+#if ((SD_CACHE_FAT_LINES) + (SD_CACHE_DIR_LINES) + (SD_CACHE_DATA_LINES) > SD_CACHE_LINES)
+#error "SD_CACHE_FAT_LINES + SD_CACHE_DIR_LINES + SD_CACHE_DATA_LINES exceed SD_CACHE_LINES"
+#endif
+/* Held sectors are file data: they need data lines to stay in. */
+#if (SD_CACHE_HOLD_LINES > 0U) && (SD_CACHE_HOLD_LINES >= SD_CACHE_DATA_LINES)
+#error "SD_CACHE_HOLD_LINES must be below SD_CACHE_DATA_LINES with SD_CACHE_CLASSES"
+#endif
+#endif
+
+typedef struct {
+    uint32_t read_hits;    // Single-sector reads served from RAM
+    uint32_t read_misses;  // Single-sector reads that went to the card
+    uint32_t write_hits;   // Single-sector writes that landed on an existing line
+    uint32_t writebacks;   // Dirty sectors written to the card
+    uint32_t writeback_runs; // Writes they took (one CMD24 or CMD25 each)
+    uint32_t coalesced;    // Of the sectors, those written back in runs of two or more
+    uint32_t evictions;    // Valid lines replaced by another sector
+    uint32_t held;         // Sectors currently held
+    uint32_t hold_saves;   // Evictions that skipped a held line
+    uint32_t hold_refused; // SD_CacheHold calls refused (all hold slots busy)
+    uint32_t journal_commits;  // Records written ahead of a write-back (SD_CACHE_JOURNAL)
+    uint32_t journal_replayed; // Sectors restored from a record at mount
+    uint32_t journal_drops;    // Records voided because a direct write overlapped them
+    uint32_t journal_retired;  // Records voided after their write-back or replay landed
+    uint32_t bypassed;         // Single-sector accesses of a class without lines (SD_CACHE_CLASSES)
+    uint32_t busy_hits;        // Hits served while their card wrote back (SD_CACHE_BUSY_READS)
+    uint32_t filled;           // Lines installed by SD_CacheFill (warm-up)
+    uint32_t fat_lines;        // Lines now holding FAT sectors (filled in by SD_CacheGetStats)
+    uint32_t dir_lines;        // Lines now holding directory sectors
+    uint32_t data_lines;       // Lines now holding data sectors
+    uint32_t lines;            // Lines in use (SD_CacheSetLines)
+    uint32_t run_len_x10;      // Average write-back run, in tenths of a sector
+} SD_CacheStats;
+
+/*
+ * The pool is shared by all cards (lines are keyed by handle and sector). Without
+ * SD_CACHE_LOCK it is not locked: callers must serialize access. FatFs holds the
+ * volume lock around every disk_* call, which covers a single drive; with several
+ * drives the volume locks are independent, so under FreeRTOS SD_DISK_DRIVES > 1
+ * requires SD_CACHE_LOCK.
+ */
+
+/**
+ * @brief Drop every cached sector without writing anything back
+ *
+ * Use after (re)initializing or losing the card.
+ */
+void SD_CacheReset(void);
+
+/**
+ * @brief Read sectors, serving cached copies where present
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Destination buffer
+ * @param sector Starting sector
+ * @param count Number of sectors
+ * @return SD_Status
+ *
+ * Note: Single-sector reads are cached; longer reads go to the card and are
+ * patched with any newer cached copies.
+ */
+SD_Status SD_CacheRead(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Write sectors through the cache
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Source buffer
+ * @param sector Starting sector
+ * @param count Number of sectors
+ * @return SD_Status
+ *
+ * Note: Single-sector writes stay dirty in RAM until SD_CacheFlush or
+ * eviction; longer writes go straight to the card and refresh cached copies.
+ */
+SD_Status SD_CacheWrite(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
+                        uint32_t count);
+
+/**
+ * @brief Write back the card's dirty sectors, coalescing adjacent ones
+ * @param sd_handle Pointer to SD handle structure
+ * @return SD_Status (first failure; remaining lines stay dirty)
+ */
+SD_Status SD_CacheFlush(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Write back the card's dirty sectors outside one range
+ * @param sd_handle Pointer to SD handle structure
+ * @param keep_first First sector to leave dirty
+ * @param keep_count Sectors to leave dirty (0 = write back all, as SD_CacheFlush)
+ * @return SD_Status (first failure; remaining lines stay dirty)
+ *
+ * Note: Runs are split at the range, so none of its sectors reach the card.
+ */
+SD_Status SD_CacheFlushExcept(SD_Handle_t *sd_handle, uint32_t keep_first, uint32_t keep_count);
+
+/**
+ * @brief Forget a card's cached sectors in a range without writing them back
+ * @param sd_handle Pointer to SD handle structure
+ * @param sector Starting sector
+ * @param count Number of sectors
+ *
+ * Used for trimmed ranges whose contents are no longer needed.
+ */
+void SD_CacheDiscard(SD_Handle_t *sd_handle, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Install clean copies of sectors the caller has just read (cache warm-up)
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Contents of the sectors, as read through SD_CacheRead
+ * @param sector Starting sector
+ * @param count Number of sectors
+ *
+ * Sectors already cached, of a class without lines, or whose only free line
+ * would need a write-back are skipped.
+ */
+void SD_CacheFill(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Keep a sector resident while references to it remain
+ * @param sd_handle Pointer to SD handle structure
+ * @param sector Sector to hold (it need not be cached yet; it is kept once it is)
+ * @return true if held (reference counted); false if every hold slot is busy
+ *
+ * Held lines are skipped by LRU eviction. They still write back on flush.
+ */
+bool SD_CacheHold(SD_Handle_t *sd_handle, uint32_t sector);
+
+/* Drop one reference taken by SD_CacheHold. */
+void SD_CacheRelease(SD_Handle_t *sd_handle, uint32_t sector);
+
+/**
+ * @brief Give a card the volume geometry its sectors are classified by
+ * @param sd_handle Pointer to SD handle structure
+ * @param fat_first First FAT sector (fs->fatbase)
+ * @param dir_first First sector after the FATs (a FAT12/16 root directory,
+ *                  fs->dirbase; fs->database on FAT32/exFAT)
+ * @param data_first First data-area sector (fs->database); 0 forgets the card,
+ *                   whose sectors then share the whole pool unclassified
+ *
+ * Sector numbers are the ones SD_CacheRead/SD_CacheWrite see (blocks). Lines
+ * already held are reclassified. Does nothing unless SD_CACHE_CLASSES is 1;
+ * SD_DiskSetCacheRegions does this for a diskio drive.
+ */
+void SD_CacheSetRegions(SD_Handle_t *sd_handle, uint32_t fat_first, uint32_t dir_first,
+                        uint32_t data_first);
+
+void SD_CacheGetStats(SD_CacheStats *out);
+
+/* Zero the counters (not the cached sectors), e.g. between tuning runs. */
+void SD_CacheResetStats(void);
+
+/**
+ * @brief Change how many of the SD_CACHE_LINES lines the pool uses
+ * @param lines 0 (cache off: every access goes to the card) to SD_CACHE_LINES
+ * @return SD_OK; SD_PARAM above SD_CACHE_LINES; else the write-back error,
+ *         with the size unchanged
+ *
+ * Dirty sectors in the lines given up are written back first. The RAM stays
+ * reserved; this trades hit rate for eviction traffic at run time, so a
+ * product can find the size it needs before the build is fixed.
+ */
+SD_Status SD_CacheSetLines(uint32_t lines);
+
+uint32_t SD_CacheGetLines(void);
+
+/**
+ * @brief Change the per-class line quotas (SD_CACHE_CLASSES) at run time
+ * @return SD_OK; SD_PARAM if they add up to more than SD_CACHE_LINES or leave
+ *         data no more lines than SD_CACHE_HOLD_LINES; SD_UNSUPPORTED when
+ *         SD_CACHE_CLASSES is 0
+ *
+ * Nothing is written back or dropped: a class over its new quota gives up
+ * lines as it fills others. The build's SD_CACHE_*_LINES are the defaults.
+ */
+SD_Status SD_CacheSetClassLines(uint32_t fat_lines, uint32_t dir_lines, uint32_t data_lines);
+
+/* Quotas in effect; all 0 when SD_CACHE_CLASSES is 0. */
+void SD_CacheGetClassLines(uint32_t *fat_lines, uint32_t *dir_lines, uint32_t *data_lines);
+
+#if (SD_CACHE_JOURNAL == 1)
+/**
+ * @brief Give a card a journal region of SD_CACHE_JOURNAL_BLOCKS blocks
+ * @param sd_handle Pointer to SD handle structure
+ * @param first_block First block of the region, outside every FatFs volume
+ *                    (e.g. the gap between the MBR and the first partition,
+ *                    see SD_FormatInfo.partition_start); 0 detaches
+ * @return SD_OK, SD_PARAM, or SD_ERROR when every journal slot is taken
+ *
+ * Note: Call before mounting: the region is replayed by disk_initialize.
+ * Block API writes and erases that bypass the cache are not checked
+ * against the record; keep them off journaled sectors.
+ */
+SD_Status SD_CacheJournalAttach(SD_Handle_t *sd_handle, uint32_t first_block);
+
+/**
+ * @brief Apply the newest complete record of the card's journal
+ * @param sd_handle Pointer to SD handle structure (initialized)
+ * @param replayed Receives the sectors rewritten (those already in place are
+ *                 only compared); may be NULL
+ * @return SD_OK (also without a journal or a record), else the I/O error
+ *
+ * Note: Run before any other access to the card's volume.
+ */
+SD_Status SD_CacheJournalReplay(SD_Handle_t *sd_handle, uint32_t *replayed);
+
+/**
+ * @brief Void the card's journal so no replay follows
+ * @param sd_handle Pointer to SD handle structure (initialized)
+ * @return SD_OK (also without a journal or a record), else the I/O error
+ *
+ * Note: Call after flushing and before the card is written by anything
+ * else (a USB host, another machine): a record left on it would otherwise
+ * roll those writes back at the next mount.
+ */
+SD_Status SD_CacheJournalVoid(SD_Handle_t *sd_handle);
+#endif
+
+/**
+ * @brief Number of dirty sectors currently held
+ * @return Dirty line count
+ */
+uint32_t SD_CacheDirtyCount(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_CACHE_H__ */
@@ -0,0 +1,164 @@
+/*
+ * sd_cardprof.h
+ *
+ * Write-latency fingerprint of a card, kept per CID. sd_cardprof_measure
+ * writes a reserved raw range three ways:
+ *
+ * - across SD_CARDPROF_AU_ROUNDS allocation units in SD_CARDPROF_PROBE_BLOCKS
+ *   commands, each timed to the end of its busy, giving latency by offset
+ *   within the AU and the extra cost of the first write into an AU;
+ * - at random offsets with 1 to 64 blocks per command (write size);
+ * - sequentially in CMD25 runs of 1 to 64 blocks, with and without ACMD23
+ *   pre-erase hints (multi-block length).
+ *
+ * From these it derives the shortest run that gets within
+ * SD_CARDPROF_KNEE_PERCENT of the card's sequential speed and whether
+ * pre-erase hints help. sd_cardprof_apply hands the result to the driver
+ * (ACMD23 off when it does not help) and, with SD_LOGGER_CARD_PROFILE, to
+ * the logger's chunk sizing. The derived figures are saved as one line per
+ * card in a small file, so later boots apply them without measuring.
+ *
+ * The card is identified by the CID's manufacturer and serial (SD_CARD_INFO
+ * 1) plus the block count; without SD_CARD_INFO by the block count only.
+ */
+
+#ifndef __SD_CARDPROF_H__
+#define __SD_CARDPROF_H__
+
+#include "sd_benchmark.h"
+#include "sd_spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Latency bins across the AU. */
+#ifndef SD_CARDPROF_AU_POINTS
+#define SD_CARDPROF_AU_POINTS 16U
+#endif
+
+/* Blocks per command while walking the AU. */
+#ifndef SD_CARDPROF_PROBE_BLOCKS
+#define SD_CARDPROF_PROBE_BLOCKS 8U
+#endif
+
+/* AUs walked; the range must hold this many whole AUs. */
+#ifndef SD_CARDPROF_AU_ROUNDS
+#define SD_CARDPROF_AU_ROUNDS 2U
+#endif
+
+/* AU assumed when the card reports none (8192 blocks = 4 MiB). */
+#ifndef SD_CARDPROF_AU_BLOCKS
+#define SD_CARDPROF_AU_BLOCKS 8192U
+#endif
+
+/* Random writes per write size. */
+#ifndef SD_CARDPROF_SIZE_WRITES
+#define SD_CARDPROF_SIZE_WRITES 32U
+#endif
+
+/* Blocks written per run length. */
+#ifndef SD_CARDPROF_RUN_BLOCKS
+#define SD_CARDPROF_RUN_BLOCKS 2048U
+#endif
+
+/* A run length is good enough once it reaches this share of the fastest. */
+#ifndef SD_CARDPROF_KNEE_PERCENT
+#define SD_CARDPROF_KNEE_PERCENT 90U
+#endif
+
+/* Cards kept in the profile file; the oldest line goes first. */
+#ifndef SD_CARDPROF_MAX_CARDS
+#define SD_CARDPROF_MAX_CARDS 8U
+#endif
+
+/* Write sizes and run lengths: 1, 2, 4 ... 64 blocks. */
+#define SD_CARDPROF_SIZES 7U
+
+#if ((SD_BLOCK_SIZE << (SD_CARDPROF_SIZES - 1U)) > SD_BENCH_MAX_BUFFER)
+#error "sd_cardprof needs SD_BENCH_MAX_BUFFER of at least 32 KB"
+#endif
+
+#if (SD_CARDPROF_PROBE_BLOCKS == 0U) || (SD_CARDPROF_PROBE_BLOCKS > SD_BENCH_MAX_BUFFER / 512U)
+#error "SD_CARDPROF_PROBE_BLOCKS must be 1..SD_BENCH_MAX_BUFFER / 512"
+#endif
+
+typedef struct {
+    /* Identity */
+    uint8_t mid;             // CID manufacturer (0 without a valid CID)
+    uint32_t psn;            // CID serial (0 without a valid CID)
+    uint32_t blocks;         // Card capacity in blocks
+    /* Derived, saved */
+    uint32_t au_blocks;      // AU walked: AU_SIZE from ACMD13, else SD_CARDPROF_AU_BLOCKS
+    uint32_t au_entry_us;    // First write into an AU over the mean of the others
+    uint32_t write_blocks;   // Shortest CMD25 run within SD_CARDPROF_KNEE_PERCENT of the fastest
+    bool pre_erase;          // ACMD23 pre-erase hints made long runs at least 5 % faster
+    uint32_t small_write_us; // Mean random single-block write
+    uint32_t peak_kb_per_s;  // Fastest sequential run
+    /* Maps, from sd_cardprof_measure only (zero after a load) */
+    uint32_t au_mean_us[SD_CARDPROF_AU_POINTS]; // By offset: bin i covers i/POINTS of the AU
+    uint32_t au_max_us[SD_CARDPROF_AU_POINTS];
+    uint32_t size_mean_us[SD_CARDPROF_SIZES];   // Random writes of 512 B << i
+    uint32_t size_max_us[SD_CARDPROF_SIZES];
+    uint32_t run_kb_per_s[SD_CARDPROF_SIZES];   // Sequential runs of 1 << i blocks
+    uint32_t run_pre_kb_per_s[SD_CARDPROF_SIZES]; // The same with ACMD23 (0 if the card refuses it)
+} SD_CardProfile;
+
+/**
+ * @brief Fingerprint the card over a reserved range
+ * @param sd_handle Initialized SD handle
+ * @param first_lba Start of the reserved range
+ * @param span_blocks Size of the reserved range in blocks
+ * @param out Profile (identity, derived figures and maps)
+ * @return SD_OK, SD_PARAM if the range does not hold SD_CARDPROF_AU_ROUNDS
+ *         aligned AUs, or the first failing transfer status
+ *
+ * Note: Destroys the data in the range; keep it outside any mounted
+ * partition. Restores the handle's ACMD23 setting. Takes a few seconds per
+ * AU walked.
+ */
+SD_Status sd_cardprof_measure(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks,
+                              SD_CardProfile *out);
+
+/**
+ * @brief Apply the saved profile for this card, or measure, save and apply one
+ * @param path Profile file on a mounted volume (e.g. "0:/sdprof.cfg")
+ * @param sd_handle Initialized SD handle
+ * @param first_lba Reserved range for a measurement (see sd_cardprof_measure)
+ * @param span_blocks Its size; 0 = never measure (FR_NO_FILE when nothing is saved)
+ * @param force Measure even if the file has this card
+ * @param out Profile applied (may be NULL)
+ * @return FR_OK, FR_DISK_ERR if the measurement fails, or the FatFs code of
+ *         a failing load or save
+ */
+int sd_cardprof(const char *path, SD_Handle_t *sd_handle, uint32_t first_lba,
+                uint32_t span_blocks, bool force, SD_CardProfile *out);
+
+/* Read this card's line from path into out (maps zeroed); FR_NO_FILE if it has none. */
+int sd_cardprof_load(const char *path, SD_Handle_t *sd_handle, SD_CardProfile *out);
+
+/* Store prof's line in path, replacing the same card's and keeping up to SD_CARDPROF_MAX_CARDS. */
+int sd_cardprof_save(const char *path, const SD_CardProfile *prof);
+
+/**
+ * @brief Use prof for the card in sd_handle
+ * @return SD_OK, or SD_PARAM if prof names another card
+ *
+ * Note: Turns ACMD23 hints off when prof->pre_erase is false, and makes prof
+ * the one sd_cardprof_active returns. Apply again after SD_Reattach.
+ */
+SD_Status sd_cardprof_apply(SD_Handle_t *sd_handle, const SD_CardProfile *prof);
+
+/* The applied profile if it names the card now in sd_handle, else NULL. */
+const SD_CardProfile *sd_cardprof_active(SD_Handle_t *sd_handle);
+
+/* Print SDPROF lines: card, au, size, run and the derived profile. */
+void sd_cardprof_print(const SD_CardProfile *prof);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_CARDPROF_H__ */
@@ -0,0 +1,107 @@
+/*
+ * sd_commit.h
+ *
+ * Deferred directory-entry updates. f_sync (and f_close) on a modified file
+ * writes its data sector, then reads the sector holding its directory entry,
+ * updates size/start cluster/time and writes it back. sd_sync_data does
+ * only the first half: the file's dirty sector, the dirty FAT window (to
+ * every FAT copy) and CTRL_SYNC. The entry stays pending in the FIL until
+ * a full f_sync/f_close, sd_commit, or sd_commit_poll once SD_COMMIT_MS has
+ * passed.
+ *
+ * Tradeoff: after a power cut the card holds every synced data sector and
+ * cluster chain, but the directory entry still has the size (and, for a
+ * file created since the last commit, the start cluster) of the last
+ * commit. Bytes past that size are unreachable and a new file's clusters are
+ * lost until a disk check frees them. Commits therefore bound how much data
+ * a crash can hide; the data syncs in between bound how much can be lost
+ * from the card's cache. On exFAT the chain itself may only be written by
+ * f_sync, so sd_sync_data falls back to f_sync there.
+ *
+ * Task context. The pending list is not locked: keep the deferred files and
+ * the commit calls in one task.
+ */
+
+#ifndef __SD_COMMIT_H__
+#define __SD_COMMIT_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Files whose entry update sd_defer_sync can hold at once; beyond that it does a full f_sync. */
+#ifndef SD_COMMIT_FILES
+#define SD_COMMIT_FILES 4U
+#endif
+
+/* sd_commit_poll commits once the oldest pending update is this old (0 = only sd_commit). */
+#ifndef SD_COMMIT_MS
+#define SD_COMMIT_MS 10000U
+#endif
+
+#if (SD_COMMIT_FILES < 1U) || (SD_COMMIT_FILES > 32U)
+#error "SD_COMMIT_FILES must be 1..32"
+#endif
+
+typedef struct {
+    uint32_t data_syncs;   // sd_sync_data/sd_defer_sync calls that left the entry pending
+    uint32_t commits;      // Entries written by sd_commit/sd_commit_poll
+    uint32_t full_syncs;   // sd_defer_sync calls that fell back to f_sync (list full, exFAT)
+    uint32_t data_flushes; // sd_flush_data_only calls
+    uint32_t pending;      // Files currently in the pending list
+} SD_CommitStats;
+
+/**
+ * @brief Write a file's data and the FAT, leaving its directory entry pending
+ * @param fp Open file
+ * @return FR_OK, FR_INVALID_OBJECT, FR_DISK_ERR or FR_TIMEOUT
+ *
+ * Note: Does not track fp; the caller commits with f_sync or f_close. On
+ * exFAT this is a plain f_sync.
+ */
+int sd_sync_data(FIL *fp);
+
+/**
+ * @brief sd_sync_data, then remember fp for sd_commit / sd_commit_poll
+ * @param fp Open file; call sd_commit_forget before its storage goes away
+ * @return As sd_sync_data
+ *
+ * Note: When SD_COMMIT_FILES files are already pending, fp is synced in full.
+ */
+int sd_defer_sync(FIL *fp);
+
+/**
+ * @brief Put a file's data sectors on the card without touching the FAT
+ * @param fp Open file
+ * @return FR_OK, FR_INVALID_OBJECT, FR_DISK_ERR or FR_TIMEOUT
+ *
+ * Writes the file's dirty sector, then SD_CTRL_SYNC_DATA: cached data
+ * sectors reach the card, while the FAT window and cached metadata sectors
+ * stay dirty for the next f_sync or sd_sync_data. Only data inside clusters
+ * already linked on the card (a preallocated or rewritten file) survives a
+ * power cut; anything else is reachable once the chain is written. Any FAT
+ * type, exFAT included.
+ */
+int sd_flush_data_only(FIL *fp);
+
+/* f_sync every pending file and empty the list; returns the first error. */
+int sd_commit(void);
+
+/* sd_commit if SD_COMMIT_MS is non-zero and the oldest pending update is that old. */
+int sd_commit_poll(void);
+
+/* Drop fp from the pending list without committing (f_close commits by itself). */
+void sd_commit_forget(FIL *fp);
+
+void sd_commit_get_stats(SD_CommitStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_COMMIT_H__ */
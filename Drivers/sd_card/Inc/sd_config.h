@@ -0,0 +1,277 @@
+/*
+ * sd_config.h
+ *
+ * Named build profiles for the driver. Select one with SD_CONFIG_PROFILE
+ * (compiler flag or SD_CONFIG_USER_HEADER); it sets the defaults that the
+ * module headers would otherwise choose, so every knob still yields to an
+ * explicit -D. Included first by every module header.
+ *
+ *   SD_CONFIG_DEFAULT         the per-module defaults, unchanged
+ *   SD_CONFIG_LOW_RAM         one instance, no staging/bounce buffers, no
+ *                             cache or histograms, small rings; _FS_TINY 1
+ *   SD_CONFIG_MAX_THROUGHPUT  DMA pipelines with streamed CMD18 tokens,
+ *                             16-line cache, read-ahead, burst polling,
+ *                             large logger chunks
+ *   SD_CONFIG_LOW_LATENCY     register-level byte path, spin before backing
+ *                             off, small request merges, no read-ahead,
+ *                             init cache and fast mount
+ *   SD_CONFIG_COMPACT         smallest flash: no histograms, pipelines or
+ *                             cached write handles; FatFs without the
+ *                             minimized functions, string I/O, labels, mkfs
+ *
+ * FatFs options cannot be set from here because ffconf.h is read on its own;
+ * the profile publishes the values it was tuned for (SD_CONFIG_FS_*) and
+ * sd_config.c refuses to build when ffconf.h disagrees. The simplest way to
+ * keep them in step is to use them in ffconf.h:
+ *
+ *   #include "sd_config.h"
+ *   #define _FS_TINY     SD_CONFIG_FS_TINY
+ *   #define _FS_MINIMIZE SD_CONFIG_FS_MINIMIZE
+ *   #define _USE_STRFUNC SD_CONFIG_FS_STRFUNC
+ *   #define _USE_LABEL   SD_CONFIG_FS_LABEL
+ *   #define _USE_MKFS    SD_CONFIG_FS_MKFS
+ */
+
+#ifndef __SD_CONFIG_H__
+#define __SD_CONFIG_H__
+
+#ifdef SD_CONFIG_USER_HEADER
+#include SD_CONFIG_USER_HEADER
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_CONFIG_DEFAULT        0
+#define SD_CONFIG_LOW_RAM        1
+#define SD_CONFIG_MAX_THROUGHPUT 2
+#define SD_CONFIG_LOW_LATENCY    3
+#define SD_CONFIG_COMPACT        4
+
+#ifndef SD_CONFIG_PROFILE
+#define SD_CONFIG_PROFILE SD_CONFIG_DEFAULT
+#endif
+
+#if (SD_CONFIG_PROFILE < SD_CONFIG_DEFAULT) || (SD_CONFIG_PROFILE > SD_CONFIG_COMPACT)
+#error "SD_CONFIG_PROFILE must be one of the SD_CONFIG_* profiles"
+#endif
+
+#if (SD_CONFIG_PROFILE == SD_CONFIG_LOW_RAM)
+
+#ifndef SD_MAX_INSTANCES
+#define SD_MAX_INSTANCES 1U
+#endif
+#ifndef SD_READ_PIPELINE
+#define SD_READ_PIPELINE 0
+#endif
+#ifndef SD_WRITE_PIPELINE
+#define SD_WRITE_PIPELINE 0
+#endif
+#ifndef SD_DMA_BOUNCE
+#define SD_DMA_BOUNCE 0
+#endif
+#ifndef SD_LATENCY_STATS
+#define SD_LATENCY_STATS 0
+#endif
+#ifndef SD_CACHE_ENABLED
+#define SD_CACHE_ENABLED 0
+#endif
+#ifndef SD_READAHEAD_SECTORS
+#define SD_READAHEAD_SECTORS 0U
+#endif
+#ifndef SD_FAT_CACHE_GROUPS
+#define SD_FAT_CACHE_GROUPS 1U
+#endif
+#ifndef SD_FAT_CACHE_SPAN
+#define SD_FAT_CACHE_SPAN 1U
+#endif
+#ifndef SD_DISK_BATCH_SECTORS
+#define SD_DISK_BATCH_SECTORS 1U
+#endif
+#ifndef SD_SCHED_SLOTS
+#define SD_SCHED_SLOTS 4U
+#endif
+#ifndef SD_SCHED_MAX_MERGE
+#define SD_SCHED_MAX_MERGE 8U
+#endif
+#ifndef SD_ASYNC_QUEUE_DEPTH
+#define SD_ASYNC_QUEUE_DEPTH 4U
+#endif
+#ifndef SD_TRACE_ENTRIES
+#define SD_TRACE_ENTRIES 32U
+#endif
+#ifndef SD_PROFILE_DRIVES
+#define SD_PROFILE_DRIVES 1U
+#endif
+#ifndef SD_LOGGER_RING_BYTES
+#define SD_LOGGER_RING_BYTES 4096U
+#endif
+#ifndef SD_LOGGER_CHUNK_BYTES
+#define SD_LOGGER_CHUNK_BYTES 1024U
+#endif
+#ifndef SD_LOGGER_MAX_RECORD
+#define SD_LOGGER_MAX_RECORD 128U
+#endif
+#ifndef SD_BENCH_MAX_BUFFER
+#define SD_BENCH_MAX_BUFFER 4096U
+#endif
+#ifndef SD_BENCH_MAX_SAMPLES
+#define SD_BENCH_MAX_SAMPLES 128U
+#endif
+#ifndef SD_CONFIG_FS_TINY
+#define SD_CONFIG_FS_TINY 1
+#endif
+
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_MAX_THROUGHPUT)
+
+#ifndef SD_READ_PIPELINE
+#define SD_READ_PIPELINE 1
+#endif
+#ifndef SD_WRITE_PIPELINE
+#define SD_WRITE_PIPELINE 1
+#endif
+#ifndef SD_READ_STREAM_GAP
+#define SD_READ_STREAM_GAP 8U
+#endif
+#ifndef SD_DMA_BOUNCE
+#define SD_DMA_BOUNCE 1
+#endif
+#ifndef SD_LATENCY_STATS
+#define SD_LATENCY_STATS 0
+#endif
+#ifndef SD_BUSY_POLL_BURST
+#define SD_BUSY_POLL_BURST 8U
+#endif
+#ifndef SD_TOKEN_POLL_BURST
+#define SD_TOKEN_POLL_BURST 8U
+#endif
+#ifndef SD_ACMD23_MIN_BLOCKS
+#define SD_ACMD23_MIN_BLOCKS 4U
+#endif
+#ifndef SD_CACHE_ENABLED
+#define SD_CACHE_ENABLED 1
+#endif
+#ifndef SD_CACHE_LINES
+#define SD_CACHE_LINES 16U
+#endif
+#ifndef SD_READAHEAD_SECTORS
+#define SD_READAHEAD_SECTORS 8U
+#endif
+#ifndef SD_FAT_CACHE_GROUPS
+#define SD_FAT_CACHE_GROUPS 4U
+#endif
+#ifndef SD_FAT_CACHE_SPAN
+#define SD_FAT_CACHE_SPAN 4U
+#endif
+#ifndef SD_SCHED_MAX_MERGE
+#define SD_SCHED_MAX_MERGE 64U
+#endif
+#ifndef SD_LOGGER_RING_BYTES
+#define SD_LOGGER_RING_BYTES 32768U
+#endif
+#ifndef SD_LOGGER_CHUNK_BYTES
+#define SD_LOGGER_CHUNK_BYTES 8192U
+#endif
+#ifndef SD_CONFIG_FS_TINY
+#define SD_CONFIG_FS_TINY 0
+#endif
+
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_LOW_LATENCY)
+
+#ifndef SD_SPI_LL_FASTPATH
+#define SD_SPI_LL_FASTPATH 1
+#endif
+#ifndef SD_POLL_SPIN_COUNT
+#define SD_POLL_SPIN_COUNT 64U
+#endif
+#ifndef SD_BUSY_POLL_BURST
+#define SD_BUSY_POLL_BURST 4U
+#endif
+#ifndef SD_TOKEN_POLL_BURST
+#define SD_TOKEN_POLL_BURST 4U
+#endif
+#ifndef SD_INIT_CACHE
+#define SD_INIT_CACHE 1
+#endif
+#ifndef SD_FAST_MOUNT
+#define SD_FAST_MOUNT 1
+#endif
+#ifndef SD_IDLE_GATE_MS
+#define SD_IDLE_GATE_MS 0U
+#endif
+#ifndef SD_CACHE_ENABLED
+#define SD_CACHE_ENABLED 1
+#endif
+#ifndef SD_READAHEAD_SECTORS
+#define SD_READAHEAD_SECTORS 0U
+#endif
+#ifndef SD_SCHED_MAX_MERGE
+#define SD_SCHED_MAX_MERGE 8U
+#endif
+#ifndef SD_SCHED_STARVE_LIMIT
+#define SD_SCHED_STARVE_LIMIT 1U
+#endif
+#ifndef SD_CONFIG_FS_TINY
+#define SD_CONFIG_FS_TINY 0
+#endif
+
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT)
+
+#ifndef SD_READ_PIPELINE
+#define SD_READ_PIPELINE 0
+#endif
+#ifndef SD_WRITE_PIPELINE
+#define SD_WRITE_PIPELINE 0
+#endif
+#ifndef SD_LATENCY_STATS
+#define SD_LATENCY_STATS 0
+#endif
+#ifndef SD_FILE_CACHE_SLOTS
+#define SD_FILE_CACHE_SLOTS 0
+#endif
+#ifndef SD_CONFIG_FS_TINY
+#define SD_CONFIG_FS_TINY 0
+#endif
+#ifndef SD_CONFIG_FS_MINIMIZE
+#define SD_CONFIG_FS_MINIMIZE 1
+#endif
+#ifndef SD_CONFIG_FS_STRFUNC
+#define SD_CONFIG_FS_STRFUNC 0
+#endif
+#ifndef SD_CONFIG_FS_LABEL
+#define SD_CONFIG_FS_LABEL 0
+#endif
+#ifndef SD_CONFIG_FS_MKFS
+#define SD_CONFIG_FS_MKFS 0
+#endif
+
+#endif /* SD_CONFIG_PROFILE */
+
+/* The default profile takes ffconf.h as it is. */
+#if (SD_CONFIG_PROFILE == SD_CONFIG_DEFAULT) && !defined(SD_CONFIG_FS_TINY)
+#define SD_CONFIG_FS_TINY 0
+#endif
+
+/* FatFs feature set of the product ffconf.h; only SD_CONFIG_COMPACT trims it. */
+#ifndef SD_CONFIG_FS_MINIMIZE
+#define SD_CONFIG_FS_MINIMIZE 0
+#endif
+#ifndef SD_CONFIG_FS_STRFUNC
+#define SD_CONFIG_FS_STRFUNC 2
+#endif
+#ifndef SD_CONFIG_FS_LABEL
+#define SD_CONFIG_FS_LABEL 1
+#endif
+#ifndef SD_CONFIG_FS_MKFS
+#define SD_CONFIG_FS_MKFS 1
+#endif
+
+/* Name of the compiled-in profile ("default", "low-ram", ...), e.g. for a boot banner. */
+const char *SD_ConfigProfileName(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_CONFIG_H__ */
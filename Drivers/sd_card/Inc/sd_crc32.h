@@ -0,0 +1,93 @@
+/*
+ * sd_crc32.h
+ *
+ * CRC-32 of file contents, as the STM32 CRC unit computes it: polynomial
+ * 0x04C11DB7, initial value 0xFFFFFFFF, no reflection and no final XOR,
+ * over little-endian 32-bit words, with a 1-3 byte tail padded with zeros.
+ * SD_Crc32 is the software version, giving the same value on any host, so
+ * images can be stamped on a PC.
+ *
+ * A stream (SD_Crc32Begin/Update/End) takes any lengths. With SD_CRC32_HW=1
+ * and a unit registered by SD_Crc32SetUnit, it runs on the peripheral; with
+ * SD_CRC32_DMA=1 and a DMA handle as well, each Update of an aligned buffer
+ * starts a memory-to-peripheral transfer into the unit and returns, so the
+ * CPU can read the next buffer meanwhile. The unit serves one stream at a
+ * time; a stream begun while it is taken runs in software.
+ */
+
+#ifndef __SD_CRC32_H__
+#define __SD_CRC32_H__
+
+#include "sd_config.h"
+#include "main.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Run streams on the STM32 CRC peripheral (HAL_CRC_MODULE_ENABLED). */
+#ifndef SD_CRC32_HW
+#define SD_CRC32_HW 0
+#endif
+
+/* Feed the peripheral by memory-to-memory DMA (needs SD_CRC32_HW). */
+#ifndef SD_CRC32_DMA
+#define SD_CRC32_DMA 0
+#endif
+
+/* Longest wait for one DMA feed. */
+#ifndef SD_CRC32_DMA_TIMEOUT_MS
+#define SD_CRC32_DMA_TIMEOUT_MS 100U
+#endif
+
+#if (SD_CRC32_DMA == 1) && (SD_CRC32_HW != 1)
+#error "SD_CRC32_DMA needs SD_CRC32_HW=1"
+#endif
+
+#define SD_CRC32_INIT 0xFFFFFFFFU
+
+typedef struct {
+    uint32_t crc;     // Software register (unused while on the unit)
+    uint32_t tail;    // Bytes of an unfinished word, lowest first
+    uint8_t tail_len;
+    bool unit;        // Runs on the CRC peripheral
+    bool dma_pending; // A DMA feed may still be reading the last buffer
+} SD_Crc32Stream;
+
+/*
+ * CRC of len bytes, continuing from crc (SD_CRC32_INIT to start), in
+ * software. Only the last call may pass a length that is not a multiple of 4.
+ */
+uint32_t SD_Crc32(uint32_t crc, const void *data, uint32_t len);
+
+void SD_Crc32Begin(SD_Crc32Stream *s);
+
+/*
+ * Add len bytes to the stream. With a DMA feed the buffer is still being read
+ * when this returns: leave it unchanged until the next Update or End.
+ */
+void SD_Crc32Update(SD_Crc32Stream *s, const void *data, uint32_t len);
+
+/* Finish the stream (releasing the unit) and return its CRC. */
+uint32_t SD_Crc32End(SD_Crc32Stream *s);
+
+#if (SD_CRC32_HW == 1)
+/**
+ * @brief Register the CRC peripheral for streams (e.g. &hcrc from CubeMX)
+ * @param hcrc Initialized handle, or NULL for software streams
+ * @param hdma Memory-to-memory DMA stream with word transfers, source
+ *        increment and fixed destination (SD_CRC32_DMA), or NULL to write
+ *        the data register from the CPU
+ *
+ * Note: Streams own the unit's data register while they run.
+ */
+void SD_Crc32SetUnit(CRC_HandleTypeDef *hcrc, DMA_HandleTypeDef *hdma);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_CRC32_H__ */
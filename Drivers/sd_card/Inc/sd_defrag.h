@@ -0,0 +1,156 @@
+/*
+ * sd_defrag.h
+ *
+ * Background compaction of fragmented files. SD_DefragStart queues one
+ * directory, and each SD_DefragStep then does one bounded piece of work:
+ * it looks at the next directory entry, or copies one SD_DEFRAG_CHUNK of the
+ * file being moved. A file whose chain has at least SD_DEFRAG_MIN_FRAGMENTS
+ * runs (counted with the FatFs fast-seek link map) is moved as follows:
+ *   - a temporary file at the volume root gets one contiguous run of clusters
+ *     from f_expand, starting at the free-map hint when there is one
+ *   - its data is copied in with f_read on the source and one multi-block
+ *     disk_write per chunk on the run
+ *   - the source path is written to a journal file, then the source is
+ *     removed and the copy renamed into its place
+ * SD_DefragRecover finishes or undoes a move cut short by a reset, using the
+ * journal; call it after mounting, before anything else writes the volume.
+ *
+ * Steps wait for SD_DEFRAG_IDLE_MS with no other card I/O after the last
+ * step, and the copy is paced to SD_DEFRAG_KBPS. A file that is open, or that
+ * changes while it is copied, is left as it is and counted as busy. A file
+ * with no contiguous run of free clusters as large as itself is counted as
+ * having no space. The moved file carries the time of the copy, unless
+ * _USE_CHMOD lets the original's timestamp and attributes be restored.
+ * Subdirectories are not entered. Entries are counted from the start of the
+ * directory, so a rename into slots already passed can make a pass miss a
+ * file or look at one twice.
+ */
+
+#ifndef __SD_DEFRAG_H__
+#define __SD_DEFRAG_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef SD_DEFRAG_ENABLED
+#define SD_DEFRAG_ENABLED 0
+#endif
+
+/* Bytes copied per step; a multiple of 512 (one buffer of RAM). */
+#ifndef SD_DEFRAG_CHUNK
+#define SD_DEFRAG_CHUNK 4096U
+#endif
+
+/* Copy bandwidth cap in KiB/s (0 = no cap). */
+#ifndef SD_DEFRAG_KBPS
+#define SD_DEFRAG_KBPS 256U
+#endif
+
+/* Card I/O-free time needed before each step (0 = do not wait). */
+#ifndef SD_DEFRAG_IDLE_MS
+#define SD_DEFRAG_IDLE_MS 200U
+#endif
+
+/* Runs of clusters a file must have to be moved. */
+#ifndef SD_DEFRAG_MIN_FRAGMENTS
+#define SD_DEFRAG_MIN_FRAGMENTS 2U
+#endif
+
+/* Root-directory names of the copy and of the journal. */
+#ifndef SD_DEFRAG_TMP_NAME
+#define SD_DEFRAG_TMP_NAME "DEFRAG.TMP"
+#endif
+
+#ifndef SD_DEFRAG_JOURNAL_NAME
+#define SD_DEFRAG_JOURNAL_NAME "DEFRAG.JNL"
+#endif
+
+/* Longest path of a file moved, with its terminator; longer ones count as errors. */
+#ifndef SD_DEFRAG_PATH_MAX
+#define SD_DEFRAG_PATH_MAX 128U
+#endif
+
+#if (SD_DEFRAG_ENABLED == 1)
+#if (SD_DEFRAG_CHUNK < 512U) || ((SD_DEFRAG_CHUNK % 512U) != 0U) || \
+    (SD_DEFRAG_MIN_FRAGMENTS < 2U)
+#error "SD_DEFRAG_CHUNK must be a multiple of 512 and SD_DEFRAG_MIN_FRAGMENTS at least 2"
+#endif
+#if !_USE_EXPAND || !_USE_FASTSEEK || _FS_READONLY || (_FS_MINIMIZE != 0) || (_FS_EXFAT != 0)
+#error "SD_DEFRAG_ENABLED needs _USE_EXPAND 1, _USE_FASTSEEK 1, _FS_MINIMIZE 0 and no exFAT"
+#endif
+#endif
+
+#ifdef USE_FREERTOS
+/* Defrag task stack depth in words. */
+#ifndef SD_DEFRAG_TASK_STACK
+#define SD_DEFRAG_TASK_STACK 384U
+#endif
+
+#ifndef SD_DEFRAG_TASK_PRIORITY
+#define SD_DEFRAG_TASK_PRIORITY (tskIDLE_PRIORITY + 1U)
+#endif
+#endif
+
+typedef struct {
+    uint32_t files;          // Directory entries looked at
+    uint32_t fragmented;     // Of those, with SD_DEFRAG_MIN_FRAGMENTS runs or more
+    uint32_t moved;          // Files now in one run
+    uint32_t runs_removed;   // Runs the moves took away
+    uint32_t busy;           // Files left alone: open, or changed during the copy
+    uint32_t no_space;       // Files left alone: no contiguous run large enough
+    uint32_t errors;         // FatFs or disk errors; the file was left as it was
+    uint64_t bytes_copied;
+    uint32_t idle_waits;     // Steps put off because the card was in use
+    bool active;             // A pass is under way
+} SD_DefragStats;
+
+/**
+ * @brief Start a pass over the files of one directory
+ * @param dir Directory path (e.g. "0:/logs"), kept by reference
+ * @return FR_OK, or the f_opendir error; FR_DENIED when SD_DEFRAG_ENABLED is 0
+ *
+ * Note: Abandons a pass already under way, removing its partial copy.
+ */
+FRESULT SD_DefragStart(const char *dir);
+
+/**
+ * @brief Do one step of the pass (task context)
+ * @return true while work remains, including while a step is put off
+ */
+bool SD_DefragStep(void);
+
+/* Milliseconds until the next step may run (0 = now). */
+uint32_t SD_DefragWaitMs(void);
+
+/* Abandon the pass, removing a partial copy; call before unmounting. */
+void SD_DefragStop(void);
+
+/**
+ * @brief Finish or undo a move cut short by a reset
+ * @param vol Volume path prefix (e.g. "0:" or "")
+ * @return FR_OK if there was nothing to do or it was done
+ */
+FRESULT SD_DefragRecover(const char *vol);
+
+void SD_DefragGetStats(SD_DefragStats *out);
+
+#ifdef USE_FREERTOS
+/**
+ * @brief Run a pass from the sd_defrag task, which sleeps between steps
+ * @param dir Directory to compact, kept by reference
+ * @return false if the task cannot be created
+ */
+bool SD_DefragStartTask(const char *dir);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_DEFRAG_H__ */
@@ -10,18 +10,509 @@
 #include "diskio.h"
 #include "ff_gen_drv.h"
 #include "sd_spi.h"
+#include "sd_cache.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* Global SD handle for FatFs interface (single-card configuration). */
+/*
+ * Logical sector size presented to FatFs, in bytes: SD_BLOCK_SIZE times a
+ * power of two, up to 4096. A FatFs sector of 4096 bytes is eight card
+ * blocks moved by one CMD18/CMD25, so FatFs makes an eighth of the calls
+ * and the FATs of a volume shrink accordingly. ffconf.h must then set
+ * _MIN_SS and _MAX_SS to the same value (FatFs buffers grow with it). Every
+ * sector number and count in this header is a logical sector; SD_RaidDriver
+ * keeps 512-byte sectors.
+ */
+#ifndef SD_DISK_SECTOR_SIZE
+#define SD_DISK_SECTOR_SIZE 512U
+#endif
+
+#define SD_DISK_SECTOR_BLOCKS (SD_DISK_SECTOR_SIZE / SD_BLOCK_SIZE)
+
+#if (SD_DISK_SECTOR_SIZE < SD_BLOCK_SIZE) || (SD_DISK_SECTOR_SIZE > 4096U) || \
+    ((SD_DISK_SECTOR_SIZE & (SD_DISK_SECTOR_SIZE - 1U)) != 0U)
+#error "SD_DISK_SECTOR_SIZE must be a power of two from SD_BLOCK_SIZE to 4096"
+#endif
+
+#if defined(_MAX_SS) && (_MAX_SS < SD_DISK_SECTOR_SIZE)
+#error "_MAX_SS in ffconf.h must be at least SD_DISK_SECTOR_SIZE"
+#endif
+
+#if defined(_MIN_SS) && (SD_DISK_SECTOR_SIZE != SD_BLOCK_SIZE) && \
+    ((_MIN_SS != SD_DISK_SECTOR_SIZE) || (_MAX_SS != SD_DISK_SECTOR_SIZE))
+#error "SD_DISK_SECTOR_SIZE above SD_BLOCK_SIZE needs _MIN_SS and _MAX_SS equal to it"
+#endif
+
+/* Sector size of a mounted volume (SD_DISK_SECTOR_SIZE behind SD_Driver). */
+#if (_MAX_SS == _MIN_SS)
+#define SD_FS_SECTOR_SIZE(fs) ((uint32_t)_MAX_SS)
+#else
+#define SD_FS_SECTOR_SIZE(fs) ((uint32_t)(fs)->ssize)
+#endif
+
+/*
+ * Sequential read-ahead window in sectors (0 = off). Reads that continue the
+ * previous one and are shorter than the window prefetch it with one CMD18;
+ * later reads inside the window are served from RAM.
+ */
+#ifndef SD_READAHEAD_SECTORS
+#define SD_READAHEAD_SECTORS 0U
+#endif
+
+/*
+ * Dedicated FAT-sector cache: SD_FAT_CACHE_GROUPS groups (0 = off) of up to
+ * SD_FAT_CACHE_SPAN consecutive FAT sectors. A miss loads the sector plus the
+ * following ones in one read. Active once SD_DiskSetFatRegion has been called.
+ */
+#ifndef SD_FAT_CACHE_GROUPS
+#define SD_FAT_CACHE_GROUPS 2U
+#endif
+
+#ifndef SD_FAT_CACHE_SPAN
+#define SD_FAT_CACHE_SPAN 2U
+#endif
+
+#if (SD_FAT_CACHE_GROUPS > 0U) && (SD_FAT_CACHE_SPAN < 1U)
+#error "SD_FAT_CACHE_SPAN must be at least 1"
+#endif
+
+/*
+ * Unwritten-sector ranges per drive (0 = off). Sectors registered with
+ * SD_DiskMarkUnwritten (e.g. by sd_preallocate_file) have no defined contents
+ * until written, so a single-sector read of one returns zeros without card
+ * I/O. That removes the read that f_write does before a partial write inside
+ * a preallocated file. Any write to a sector removes it from its range.
+ */
+#ifndef SD_UNWRITTEN_RANGES
+#define SD_UNWRITTEN_RANGES 0U
+#endif
+
+/*
+ * Sector slots per drive for batch mode (0 = only defer CTRL_SYNC). Between
+ * SD_DiskBatchBegin and SD_DiskBatchEnd, single-sector writes are held in these
+ * slots (a rewrite of a held sector replaces it), single-sector reads outside
+ * the FAT region are kept in the free ones, and CTRL_SYNC does nothing. A run
+ * of f_unlink/f_rename calls in one directory then reads the path once and
+ * writes each changed directory, FAT and FSInfo sector once.
+ */
+#ifndef SD_DISK_BATCH_SECTORS
+#define SD_DISK_BATCH_SECTORS 4U
+#endif
+
+/*
+ * Deferred FAT mirroring: ranges of FAT sectors per drive (0 = off) whose
+ * copies in the second and later FATs are stale. FatFs writes each changed
+ * FAT sector to the first FAT and then once more per mirror; once
+ * SD_DiskSetFatMirror has registered the volume, those mirror writes only
+ * mark the sector here. CTRL_SYNC (f_sync, f_close), SD_CTRL_BARRIER,
+ * SD_DiskMirrorFlush and SD_DiskMirrorPoll copy the marked sectors from the
+ * first FAT, SD_FAT_MIRROR_CHUNK sectors per read and per mirror write. The
+ * first FAT stays authoritative meanwhile: a read of a stale mirror sector
+ * copies first. When every range is taken, the nearest one is widened over
+ * the gap (the clean sectors in it are copied too).
+ */
+#ifndef SD_FAT_MIRROR_RANGES
+#define SD_FAT_MIRROR_RANGES 0U
+#endif
+
+/* Sectors per copy step; one buffer of this size per drive. */
+#ifndef SD_FAT_MIRROR_CHUNK
+#define SD_FAT_MIRROR_CHUNK 4U
+#endif
+
+/* SD_DiskMirrorPoll copies once the oldest stale mirror sector is this old. */
+#ifndef SD_FAT_MIRROR_IDLE_MS
+#define SD_FAT_MIRROR_IDLE_MS 1000U
+#endif
+
+#if (SD_FAT_MIRROR_RANGES > 0U) && (SD_FAT_MIRROR_CHUNK < 1U)
+#error "SD_FAT_MIRROR_CHUNK must be at least 1"
+#endif
+
+/*
+ * Sector ranges per drive with a caching policy of their own (0 = off), set
+ * with SD_DiskSetPolicy: typically one per MBR partition when _MULTI_PARTITION
+ * mounts several volumes of one card, so a small configuration volume can be
+ * held in RAM while a large data volume streams past the caches.
+ */
+#ifndef SD_DISK_POLICY_RANGES
+#define SD_DISK_POLICY_RANGES 0U
+#endif
+
+/*
+ * Sectors per drive in the access histogram behind the cache warm-up list
+ * (0 = off; see SD_DiskWarmList). Every SD_WARM_SAMPLE-th single-sector read
+ * is counted; once the histogram is full, a new sector replaces the least
+ * counted one. Needs SD_CACHE_ENABLED to prefetch.
+ */
+#ifndef SD_WARM_SECTORS
+#define SD_WARM_SECTORS 0U
+#endif
+
+#ifndef SD_WARM_SAMPLE
+#define SD_WARM_SAMPLE 4U
+#endif
+
+/* Unlisted sectors a warm-up read may pass over to join two listed ones. */
+#ifndef SD_WARM_GAP
+#define SD_WARM_GAP 8U
+#endif
+
+#if (SD_WARM_SECTORS > 0U) && (SD_WARM_SAMPLE < 1U)
+#error "SD_WARM_SAMPLE must be at least 1"
+#endif
+
+/*
+ * I/O capture ring (0 = off; a power of two): the last SD_DISK_CAPTURE_ENTRIES
+ * disk_read, disk_write and disk_ioctl calls of every drive, with sector,
+ * count, DWT start time and duration (20 bytes each), between
+ * SD_DiskCaptureStart and SD_DiskCaptureStop. See SD_DiskCaptureReplay.
+ */
+#ifndef SD_DISK_CAPTURE_ENTRIES
+#define SD_DISK_CAPTURE_ENTRIES 0U
+#endif
+
+#if (SD_DISK_CAPTURE_ENTRIES & (SD_DISK_CAPTURE_ENTRIES - 1U)) != 0U
+#error "SD_DISK_CAPTURE_ENTRIES must be a power of two"
+#endif
+
+/*
+ * Fast mount (0 = off). disk_initialize keeps the current session when the
+ * card is still identified and answers CMD13, instead of rerunning the
+ * 400 kHz identification; sd_mount trusts the FSINFO free count and defers
+ * a full free-cluster count to the background (see sd_free_space_poll).
+ */
+#ifndef SD_FAST_MOUNT
+#define SD_FAST_MOUNT 0
+#endif
+
+/*
+ * Number of physical drives served by SD_Driver (pdrv 0..SD_DISK_DRIVES-1).
+ * Link each one with FATFS_LinkDriverEx(&SD_Driver, path, lun) using lun = pdrv.
+ */
+#ifndef SD_DISK_DRIVES
+#define SD_DISK_DRIVES 1U
+#endif
+
+#if (SD_DISK_DRIVES < 1U) || (SD_DISK_DRIVES > SD_MAX_INSTANCES)
+#error "SD_DISK_DRIVES must be between 1 and SD_MAX_INSTANCES"
+#endif
+
+#if defined(_VOLUMES) && (_VOLUMES < SD_DISK_DRIVES)
+#error "_VOLUMES in ffconf.h must be at least SD_DISK_DRIVES"
+#endif
+
+/* Independent volume locks would let two tasks into the shared cache pool at once. */
+#if (SD_DISK_DRIVES > 1U) && SD_CACHE_ENABLED && defined(USE_FREERTOS) && (SD_CACHE_LOCK == 0)
+#error "SD_DISK_DRIVES > 1 with the cache under FreeRTOS needs SD_CACHE_LOCK 1"
+#endif
+
+/*
+ * Driver ioctls (buff unused), above the codes diskio.h defines. With the
+ * write-back cache, CTRL_SYNC writes dirty sectors in cache order. These two
+ * split them at the metadata region (SD_DiskSetMetaRegion):
+ *   SD_CTRL_SYNC_DATA  writes back the sectors outside it and waits for the
+ *                      card; metadata stays dirty in the cache.
+ *   SD_CTRL_BARRIER    the same, then the metadata sectors: the card holds
+ *                      every data sector before any FAT or root-directory
+ *                      sector that may point at it.
+ * Without a region they behave as CTRL_SYNC; without the cache writes are
+ * already on the card in FatFs order and both only wait for it.
+ */
+#define SD_CTRL_SYNC_DATA 64U
+#define SD_CTRL_BARRIER   65U
+
+/* Global SD handle for FatFs interface (drive 0). */
 extern SD_Handle_t g_sd_handle;
 
+/* Handle behind a drive number (NULL when pdrv >= SD_DISK_DRIVES). */
+SD_Handle_t *SD_DiskHandle(BYTE pdrv);
+
 /* Initialize the global SD handle (call before mounting FatFs). */
 SD_Status SD_DiskIoInit(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin,
                         bool use_dma);
 
+/* Initialize the handle of one drive (SD_PARAM when pdrv >= SD_DISK_DRIVES). */
+SD_Status SD_DiskIoInitDrive(BYTE pdrv, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port,
+                             uint16_t cs_pin, bool use_dma);
+
+/*
+ * Keep FatFs on the first sectors of pdrv (0 = the whole card), e.g. in
+ * front of a raw logging region (SD_FormatFindRaw). GET_SECTOR_COUNT reports
+ * at most this many sectors and writes or trims past them fail with
+ * RES_PARERR; read-ahead stops there too. Kept across disk (re)initialization.
+ */
+void SD_DiskSetSectorLimit(BYTE pdrv, uint32_t sectors);
+
+/*
+ * Refuse every write and trim to pdrv with RES_WRPRT, and report STA_PROTECT
+ * from disk_status/disk_initialize so FatFs fails write operations with
+ * FR_WRITE_PROTECTED before it touches a buffer; CTRL_SYNC has nothing to do.
+ * Turning it on writes back the sector cache's dirty lines of the card first
+ * (their error is returned, with the flag unchanged). SD_PARAM in batch mode.
+ * Kept across disk (re)initialization.
+ */
+SD_Status SD_DiskSetReadOnly(BYTE pdrv, bool read_only);
+
+bool SD_DiskIsReadOnly(BYTE pdrv);
+
+/*
+ * Lend pdrv to another block user such as USB mass storage (external true),
+ * or take it back. Lending writes back the stale FAT mirrors and the sector
+ * cache's dirty lines and voids the metadata journal (SD_CACHE_JOURNAL; their
+ * error is returned, with the drive kept), then drops every RAM copy of the
+ * card; until it comes back disk_status and
+ * disk_initialize report STA_NOINIT and reads, writes and ioctls fail with
+ * RES_NOTRDY. Taking it back drops the RAM copies again, since the borrower
+ * may have changed any sector: mount afresh. SD_PARAM in batch mode.
+ */
+SD_Status SD_DiskSetExternal(BYTE pdrv, bool external);
+
+bool SD_DiskIsExternal(BYTE pdrv);
+
+/*
+ * Register the FAT region of the volume mounted on pdrv for the FAT-sector cache
+ * (fs->fatbase, fs->fsize * fs->n_fats; on exFAT the allocation bitmap at
+ * fs->database instead). Cleared by disk (re)initialization.
+ */
+void SD_DiskSetFatRegion(BYTE pdrv, uint32_t first_sector, uint32_t sector_count);
+
+/*
+ * Register the metadata region of the volume mounted on pdrv for
+ * SD_CTRL_SYNC_DATA and SD_CTRL_BARRIER: fs->volbase up to fs->database (boot
+ * sector, FSINFO, the FATs and a FAT12/16 root directory). Subdirectory
+ * sectors live in the data area and are written with the data. Cleared by
+ * disk (re)initialization.
+ */
+void SD_DiskSetMetaRegion(BYTE pdrv, uint32_t first_sector, uint32_t sector_count);
+
+/*
+ * Register the sector classes of the volume mounted on pdrv with the cache
+ * (SD_CACHE_CLASSES, see SD_CacheSetRegions): fs->fatbase, the first sector
+ * after the FATs (fs->dirbase on FAT12/16, else fs->database) and
+ * fs->database. Cleared by disk (re)initialization.
+ */
+void SD_DiskSetCacheRegions(BYTE pdrv, uint32_t fat_sector, uint32_t dir_sector,
+                            uint32_t data_sector);
+
+/*
+ * Register the FATs of the volume mounted on pdrv for deferred mirroring
+ * (SD_FAT_MIRROR_RANGES): fs->fatbase, fs->fsize and fs->n_fats. A volume
+ * with one FAT (or fat_count 0) has nothing to defer. Re-registering forgets
+ * stale sectors without copying them. Cleared by disk (re)initialization,
+ * which drops stale sectors too; the first FAT holds the volume's state.
+ */
+void SD_DiskSetFatMirror(BYTE pdrv, uint32_t fat_sector, uint32_t fat_sectors,
+                         uint32_t fat_count);
+
+/*
+ * Copy every stale FAT sector of pdrv to the mirrors now (SD_OK when there
+ * is none or the option is off). A failed copy keeps the sectors it did not
+ * finish marked. Call under the volume lock when other tasks use it.
+ */
+SD_Status SD_DiskMirrorFlush(BYTE pdrv);
+
+/* SD_DiskMirrorFlush once a mirror sector has been stale SD_FAT_MIRROR_IDLE_MS. */
+SD_Status SD_DiskMirrorPoll(BYTE pdrv);
+
+typedef struct {
+    uint32_t deferred; // Mirror sector writes from FatFs turned into marks
+    uint32_t copied;   // Mirror sectors written by copies
+    uint32_t copies;   // Copy runs (flushes that had work)
+    uint32_t stale;    // Sectors per mirror marked now (widened ranges included)
+} SD_DiskMirrorStats;
+
+void SD_DiskGetMirrorStats(BYTE pdrv, SD_DiskMirrorStats *out);
+
+/*
+ * Register sectors of pdrv that were allocated but never written (count 0 =
+ * forget every range of the drive). When all SD_UNWRITTEN_RANGES slots are
+ * busy, the smallest range is replaced. Cleared by disk (re)initialization.
+ */
+void SD_DiskMarkUnwritten(BYTE pdrv, uint32_t first_sector, uint32_t sector_count);
+
+/*
+ * Enter batch mode on pdrv (calls nest). While every slot holds a changed
+ * sector, the next write first writes them all back. Other FatFs calls on the
+ * drive are batched too, so their f_sync returns before the data is on the
+ * card. Call both functions under the volume lock when other tasks use it.
+ */
+SD_Status SD_DiskBatchBegin(BYTE pdrv);
+
+/* Leave batch mode; the outermost call writes held sectors, lowest first, and syncs once. */
+SD_Status SD_DiskBatchEnd(BYTE pdrv);
+
+/*
+ * Read sectors of pdrv through the sector cache (or straight from the card)
+ * without touching the drive's read-ahead window, FAT cache or batch slots,
+ * so it may run outside the volume lock (see sd_shared.h). Sectors held by
+ * batch mode are not seen. With the cache under FreeRTOS, needs SD_CACHE_LOCK=1.
+ */
+SD_Status SD_DiskReadShared(BYTE pdrv, uint8_t *buff, uint32_t sector, uint32_t count);
+
+/* RAM caches of the diskio layer, for SD_DiskSetCacheSize. */
+typedef enum {
+    SD_DISK_CACHE_SECTORS = 0, // Write-back sector cache lines (SD_CACHE_ENABLED; all drives)
+    SD_DISK_CACHE_READAHEAD,   // Read-ahead window sectors (SD_READAHEAD_SECTORS)
+    SD_DISK_CACHE_FAT,         // FAT-sector cache groups (SD_FAT_CACHE_GROUPS)
+} SD_DiskCache;
+
+typedef struct {
+    SD_CacheStats sectors;     // Sector cache, shared by every drive (zero when not built)
+    uint32_t readahead_window; // Sectors per prefetch now (0 = off)
+    uint32_t readahead_hits;   // Reads served from the window
+    uint32_t readahead_misses; // Reads that went past it
+    uint32_t fat_groups;       // FAT cache groups in use (0 = off)
+    uint32_t fat_hits;         // FAT sector reads served from a group
+    uint32_t fat_misses;       // FAT sector reads that loaded a group
+    uint32_t fat_evictions;    // Of those, loads that replaced a loaded group
+} SD_DiskCacheStats;
+
+/*
+ * Counters and current sizes of pdrv's caches, so RAM spend can be tuned per
+ * product: for the sector cache hits, misses, evictions, write-backs,
+ * coalesced sectors and the average write-back run (SD_CacheStats).
+ */
+void SD_DiskGetCacheStats(BYTE pdrv, SD_DiskCacheStats *out);
+
+/* Zero those counters; sizes and cached contents stay. */
+void SD_DiskResetCacheStats(BYTE pdrv);
+
+/*
+ * Resize one of pdrv's caches at run time, from 0 (off) up to the size it
+ * was built with; the RAM stays reserved. A smaller read-ahead window or
+ * fewer FAT groups drop what they held; the sector cache writes back the
+ * lines it gives up (SD_CacheSetLines). Returns SD_PARAM for a size above the
+ * build's. Call with the volume idle or under its lock. Kept across disk
+ * (re)initialization.
+ */
+SD_Status SD_DiskSetCacheSize(BYTE pdrv, SD_DiskCache cache, uint32_t size);
+
+/* Caching policies of a sector range, for SD_DiskSetPolicy. */
+typedef enum {
+    SD_DISK_POLICY_DEFAULT = 0, // The drive's caches as configured (removes the range)
+    SD_DISK_POLICY_RESIDENT,    // Whole range held in caller RAM, written through to the card
+    SD_DISK_POLICY_STREAM,      // Single-sector data I/O skips the sector cache; read-ahead here only
+} SD_DiskPolicy;
+
+typedef struct {
+    uint32_t resident_loads; // Resident ranges read in whole from the card
+    uint32_t resident_hits;  // Reads served from a resident range's RAM
+    uint32_t stream_direct;  // Single-sector accesses of a stream range that skipped the cache
+} SD_DiskPolicyStats;
+
+/*
+ * Give sectors [first_sector, first_sector + sector_count) of pdrv their own
+ * caching policy, e.g. a volume's fs->volbase and size. A range with the same
+ * first sector is replaced; SD_DISK_POLICY_DEFAULT removes it.
+ *
+ *   RESIDENT  ram (at least sector_count sectors) receives the whole range in
+ *             one multi-block read at its first access; reads inside it are
+ *             then copies from RAM and writes update RAM and go on to the card
+ *             as usual. A failed write, a trim or disk (re)initialization
+ *             reloads it.
+ *   STREAM    single-sector reads and writes outside the metadata region
+ *             (SD_DiskSetMetaRegion) go straight to the card instead of taking
+ *             sector cache lines; multi-sector transfers bypass it already.
+ *             Once any stream range exists, read-ahead only prefetches in
+ *             stream ranges.
+ *
+ * Setting a policy writes back the sector cache (its error is returned) and
+ * drops the range's RAM copies. SD_PARAM for a range overlapping another one,
+ * missing or short RAM, no free slot (SD_DISK_POLICY_RANGES) or batch mode.
+ * Kept across disk (re)initialization.
+ */
+SD_Status SD_DiskSetPolicy(BYTE pdrv, uint32_t first_sector, uint32_t sector_count,
+                           SD_DiskPolicy policy, void *ram, uint32_t ram_size);
+
+void SD_DiskGetPolicyStats(BYTE pdrv, SD_DiskPolicyStats *out);
+
+/*
+ * Copy up to max of pdrv's most read sectors (SD_WARM_SECTORS), most counted
+ * first, into sectors; returns how many. The histogram starts empty at each
+ * disk (re)initialization, so take it before unmounting.
+ */
+uint32_t SD_DiskWarmList(BYTE pdrv, uint32_t *sectors, uint32_t max);
+
+/*
+ * Prefetch the first of count ascending sectors into the sector cache: one
+ * multi-block read from sectors[0] over every following listed sector up to
+ * SD_WARM_GAP sectors apart that fits buff (buff_sectors sectors), after
+ * which each listed sector takes a clean cache line (SD_CacheFill). *used is
+ * the number of list entries done, also when they lie past the card's end
+ * and are skipped. SD_UNSUPPORTED without SD_CACHE_ENABLED or SD_WARM_SECTORS,
+ * SD_BUSY in batch mode or while lent out. Call under the volume lock.
+ */
+SD_Status SD_DiskWarmRun(BYTE pdrv, const uint32_t *sectors, uint32_t count, uint8_t *buff,
+                         uint32_t buff_sectors, uint32_t *used);
+
+/* Diskio calls as captured and replayed (SD_DiskCaptureRecord.op). */
+typedef enum {
+    SD_DISK_OP_READ = 0,
+    SD_DISK_OP_WRITE,  // disk_write and disk_writev
+    SD_DISK_OP_SYNC,   // disk_ioctl CTRL_SYNC
+    SD_DISK_OP_TRIM,   // disk_ioctl CTRL_TRIM; sector and count span the range
+    SD_DISK_OP_IOCTL,  // Any other ioctl (sector = command); not replayed
+} SD_DiskOp;
+
+typedef struct {
+    uint32_t time;     // DWT cycles at the call
+    uint32_t duration; // DWT cycles until it returned
+    uint32_t sector;
+    uint32_t count;    // Sectors (0 for SYNC and IOCTL)
+    uint8_t op;        // SD_DiskOp
+    uint8_t pdrv;
+    uint8_t result;    // DRESULT
+    uint8_t reserved;
+} SD_DiskCaptureRecord;
+
+/*
+ * Field traces (SD_DISK_CAPTURE_ENTRIES > 0). SD_DiskCaptureStart empties the
+ * ring and records every diskio call from then on, overwriting the oldest
+ * once full; SD_DiskCaptureStop ends recording. Times are DWT->CYCCNT, which
+ * must be running. Without the ring, Start does nothing and Read returns 0.
+ */
+void SD_DiskCaptureStart(void);
+void SD_DiskCaptureStop(void);
+
+/*
+ * Copy out the oldest unread records, oldest first; returns how many. Read
+ * after SD_DiskCaptureStop, or a record being written may come out torn.
+ */
+uint32_t SD_DiskCaptureRead(SD_DiskCaptureRecord *out, uint32_t max);
+
+/* Records overwritten before they were read, since SD_DiskCaptureStart. */
+uint32_t SD_DiskCaptureDropped(void);
+
+/*
+ * One record as an "SDCAP,op,pdrv,sector,count,result,time,duration" text
+ * line with "\r\n" (snprintf's return value). A trace is an
+ * "SDCAP,clock,<SystemCoreClock>" line followed by the records, as printed by
+ * SD_DiskCaptureDump or saved by sd_capture_save; tests/sd_host_replay.c
+ * replays one on the card emulator.
+ */
+int SD_DiskCaptureFormat(const SD_DiskCaptureRecord *rec, char *line, size_t len);
+
+/* Parse a record line (false for the clock line and anything else). */
+bool SD_DiskCaptureParse(const char *line, SD_DiskCaptureRecord *rec);
+
+/* Print the clock line and every unread record (UART or SWO via the printf retarget). */
+void SD_DiskCaptureDump(void);
+
+/*
+ * Issue recorded calls again, in order, through SD_Driver: reads into and
+ * writes from buff (buff_sectors sectors; longer transfers go in pieces of
+ * that size), CTRL_SYNC, and CTRL_TRIM over the recorded range; other
+ * ioctls are skipped. With gaps, the idle time between two recorded calls is
+ * waited out with HAL_Delay first. Each record's time, duration and result
+ * are replaced with the replay's. SD_ERROR if any call failed. Writes
+ * overwrite the card: replay on a scratch card.
+ */
+SD_Status SD_DiskCaptureReplay(SD_DiskCaptureRecord *records, uint32_t count, uint8_t *buff,
+                               uint32_t buff_sectors, bool gaps);
+
 extern const Diskio_drvTypeDef SD_Driver;
 DSTATUS SD_disk_status(BYTE drv);
 DSTATUS SD_disk_initialize(BYTE drv);
@@ -29,6 +520,15 @@ DRESULT SD_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
 DRESULT SD_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
 DRESULT SD_disk_ioctl(BYTE pdrv, BYTE cmd, void *buff);
 
+/*
+ * Write iovcnt segments, each a whole number of sectors, to consecutive
+ * sectors from sector as SD_WriteBlocksV does: one CMD25 per
+ * SD_IOV_MAX_BLOCKS blocks. Traced, profiled and kept coherent with the RAM
+ * copies like SD_disk_write; with the sector cache or in batch mode each
+ * segment is an SD_disk_write of its own. Call under the volume lock.
+ */
+DRESULT SD_disk_writev(BYTE pdrv, const SD_IoVec *iov, uint32_t iovcnt, DWORD sector);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,132 @@
+/*
+ * sd_energy.h
+ *
+ * Energy estimate of SD I/O from the driver's time split (SD_ENERGY_STATS):
+ * the card draws one current while it works its flash (write busy, read
+ * access), another while data is clocked, a smaller one while it sits
+ * selected with the clock stopped, and its standby current otherwise.
+ * Multiplying each share of the time by a model of those currents gives
+ * energy per operation and per KB, which compares configurations on battery
+ * life rather than KB/s.
+ *
+ * The defaults are typical microSD datasheet figures; measure the card in the
+ * product (a shunt on its supply, one state at a time) and put the currents
+ * in the model before drawing conclusions. The MCU's own draw is not counted.
+ */
+
+#ifndef __SD_ENERGY_H__
+#define __SD_ENERGY_H__
+
+#include "sd_spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if (SD_ENERGY_STATS != 1)
+#error "sd_energy needs SD_ENERGY_STATS 1"
+#endif
+
+typedef struct {
+    uint32_t supply_mv;   // Card supply
+    uint32_t card_ua;     // Card working its flash: write busy, read access (token wait)
+    uint32_t bus_ua;      // Commands and data being clocked
+    uint32_t selected_ua; // Selected, clock stopped
+    uint32_t standby_ua;  // Deselected
+} SD_EnergyModel;
+
+/* Card time counters at one instant (sd_energy_sample). */
+typedef struct {
+    uint32_t mark;     // DWT cycle count
+    uint64_t card;     // card_active_cycles
+    uint64_t bus;      // bus_data_cycles
+    uint64_t selected; // Selected time, an open selection included
+} SD_EnergySample;
+
+typedef struct {
+    uint64_t bytes;          // Payload the estimate is spread over
+    uint64_t total_cycles;   // Wall time
+    uint64_t card_cycles;
+    uint64_t bus_cycles;
+    uint64_t idle_cycles;    // Selected, neither card nor bus
+    uint64_t standby_cycles; // Deselected (0 for sd_energy_of_op)
+    uint64_t card_nj;        // Energy by state
+    uint64_t bus_nj;
+    uint64_t idle_nj;
+    uint64_t standby_nj;
+    uint64_t total_nj;
+    uint32_t nj_per_kb;      // total_nj per 1024 bytes (0 without bytes)
+} SD_EnergyReport;
+
+/* 3.3 V; 45 mA flash, 30 mA clocking, 2 mA selected, 0.2 mA standby. */
+void sd_energy_defaults(SD_EnergyModel *model);
+
+/* Read the handle's counters; take one before and one after the work to estimate. */
+void sd_energy_sample(SD_Handle_t *sd_handle, SD_EnergySample *out);
+
+/**
+ * @brief Estimate the energy used between two samples
+ * @param model Currents and supply
+ * @param from Earlier sample
+ * @param to Later sample of the same handle
+ * @param bytes Payload moved in between (for nj_per_kb)
+ * @param out Time split and energy
+ */
+void sd_energy_between(const SD_EnergyModel *model, const SD_EnergySample *from,
+                       const SD_EnergySample *to, uint64_t bytes, SD_EnergyReport *out);
+
+/* Estimate for one SD_Stats.energy entry: its operations only, no standby. */
+void sd_energy_of_op(const SD_EnergyModel *model, const SD_EnergyOp *op, SD_EnergyReport *out);
+
+/**
+ * @brief Write a file through FatFs and estimate the energy it took
+ * @param model Currents and supply
+ * @param path File to create on the mounted volume (g_sd_handle)
+ * @param file_bytes Bytes to write
+ * @param buf_bytes Bytes per f_write (1..SD_BENCH_MAX_BUFFER)
+ * @param out Estimate over the run, f_close included, per KB of file data
+ * @return FR_OK, or the first failing FatFs code
+ *
+ * Note: Uses the handle's transport and the cache as they are set.
+ */
+int sd_energy_write(const SD_EnergyModel *model, const char *path, uint32_t file_bytes,
+                    uint32_t buf_bytes, SD_EnergyReport *out);
+
+/*
+ * Print "SDENERGY,<tag>,kb,ms,card_us,bus_us,idle_us,standby_us,card_uj,bus_uj,
+ * idle_uj,standby_uj,uj,nj_per_kb".
+ */
+void sd_energy_print(const char *tag, const SD_EnergyReport *r);
+
+/*
+ * Print an "SDENERGY_OP,<cmd17|cmd18|cmd24|cmd25>,ops,..." line in the
+ * sd_energy_print columns for each of ops[SD_ENERGY_OPS] (e.g. SD_Stats.energy)
+ * that has operations.
+ */
+void sd_energy_print_ops(const SD_EnergyModel *model, const SD_EnergyOp *ops);
+
+/**
+ * @brief Energy per KB written for each transport and cache setting
+ * @param model Currents and supply (NULL = sd_energy_defaults)
+ * @param path Scratch file on the mounted volume; removed afterwards
+ * @param file_bytes Bytes written per run
+ * @param buf_bytes Bytes per f_write
+ * @return FR_OK, or the first failing FatFs code
+ *
+ * Note: Runs sd_energy_write under SD_XFER_POLL, SD_XFER_IRQ and SD_XFER_DMA,
+ * each with the cache off and at SD_CACHE_LINES (SD_CACHE_ENABLED), and
+ * prints an "SDENERGY,write_<transport>_cache<lines>,..." line per run
+ * followed by its SDENERGY_OP lines. A transport the handle refuses is
+ * reported as "SDENERGY,error,transport,<name>" and skipped. Restores the
+ * transport and the cache size.
+ */
+int sd_energy_suite(const SD_EnergyModel *model, const char *path, uint32_t file_bytes,
+                    uint32_t buf_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_ENERGY_H__ */
@@ -0,0 +1,165 @@
+/*
+ * sd_format.h
+ *
+ * FAT12/FAT16/FAT32 formatter laid out for SD cards, as an alternative to
+ * f_mkfs. The volume sits in one MBR partition that starts on an allocation
+ * unit (AU, from GET_BLOCK_SIZE), and the FAT region and the data region each
+ * start on an AU boundary as well: the FATs are padded rather than the data
+ * area shifted. Cluster sizes and FAT types follow the SD Association's File
+ * System Specification by card capacity. Above 32 GiB the table asks for
+ * exFAT with 128 KiB clusters; with _FS_EXFAT 0 (or _USE_MKFS 0) those cards
+ * get FAT32 with 64 KiB clusters instead.
+ *
+ * exFAT volumes are written by f_mkfs: the partition starts at sector 63 and
+ * the cluster heap on the GET_BLOCK_SIZE boundary, as f_mkfs lays them out.
+ *
+ * With raw_sectors set, the end of the card is kept out of the FAT volume
+ * and described by a second MBR entry of type SD_FORMAT_RAW_TYPE, for data
+ * written with the block API (e.g. sd_logger_start_raw).
+ *
+ * With config_sectors set, a second, small FAT12 volume follows the main one
+ * (before any raw region) in MBR entry 2, for settings kept apart from the
+ * data: with _MULTI_PARTITION 1 and a VolToPart entry {pdrv, 2} FatFs mounts
+ * it as a volume of its own. Its sectors are not aligned beyond its start.
+ *
+ * Everything goes through the diskio layer of the drive, so the diskio
+ * caches stay coherent and RAID drives work too. Unmount the volume first.
+ */
+
+#ifndef __SD_FORMAT_H__
+#define __SD_FORMAT_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest boundary unit used for alignment, in 512-byte sectors (capped at 1/64 of the card). */
+#ifndef SD_FORMAT_MAX_BOUNDARY
+#define SD_FORMAT_MAX_BOUNDARY 32768U
+#endif
+
+/* Sectors cleared per CTRL_TRIM during a full format. */
+#ifndef SD_FORMAT_ERASE_CHUNK
+#define SD_FORMAT_ERASE_CHUNK 65536U
+#endif
+
+/*
+ * Run between erase chunks and between the writes that clear the FATs, so a
+ * full format does not keep other tasks of its priority off the CPU and the
+ * card for its whole length. Define it to a hook of your own if needed.
+ */
+#ifndef SD_FORMAT_YIELD
+#if defined(USE_FREERTOS)
+#define SD_FORMAT_YIELD() taskYIELD()
+#else
+#define SD_FORMAT_YIELD() ((void)0)
+#endif
+#endif
+
+#if (SD_FORMAT_ERASE_CHUNK < 1U)
+#error "SD_FORMAT_ERASE_CHUNK must be at least 1"
+#endif
+
+/* MBR partition type of the raw region ("non-FS data"). */
+#define SD_FORMAT_RAW_TYPE 0xDAU
+
+typedef enum {
+    SD_FS_AUTO = 0, // By capacity, per the SD Association table
+    SD_FS_FAT12,
+    SD_FS_FAT16,
+    SD_FS_FAT32,
+    SD_FS_EXFAT // Needs _FS_EXFAT 1 and _USE_MKFS 1
+} SD_FsType;
+
+typedef struct {
+    SD_FsType fs_type;        // SD_FS_AUTO, or a type the cluster count must fit
+    uint32_t cluster_sectors; // Power of two up to 128 (exFAT: 16 MiB); 0 = SD recommendation
+    uint32_t boundary;        // Alignment in sectors (power of two); 0 = GET_BLOCK_SIZE.
+                              // exFAT always aligns to GET_BLOCK_SIZE
+    bool quick;               // Metadata only; otherwise the card is erased (CTRL_TRIM) first
+    uint32_t volume_id;       // Volume serial number written to the boot sector (FAT only)
+    uint32_t raw_sectors;     // Raw region at the end of the card, rounded up to the
+                              // boundary; 0 = none. FAT only
+    uint32_t config_sectors;  // FAT12 volume after the main one, rounded up to the
+                              // boundary; 0 = none. FAT only
+} SD_FormatOptions;
+
+/* Sector numbers and counts are in sectors of sector_size bytes (GET_SECTOR_SIZE). */
+typedef struct {
+    SD_FsType fs_type;
+    uint32_t sector_size;
+    uint32_t boundary;         // Alignment unit used
+    uint32_t partition_start;  // First sector of the volume (boot sector)
+    uint32_t partition_sectors;
+    uint32_t reserved_sectors; // Boot sector, FSInfo and backups, padded to the boundary
+    uint32_t fat_sectors;      // Sectors per FAT (two FATs; one on exFAT)
+    uint32_t root_sectors;     // FAT12/16 root directory (512 entries); 0 on FAT32/exFAT
+    uint32_t data_start;       // Absolute sector of cluster 2
+    uint32_t cluster_sectors;
+    uint32_t clusters;
+    uint32_t raw_start;        // Raw region after the volume (0 sectors = none)
+    uint32_t raw_sectors;
+    uint32_t config_start;     // Configuration volume after the main one (0 sectors = none)
+    uint32_t config_sectors;
+} SD_FormatLayout;
+
+/**
+ * @brief Compute the layout for a card with 512-byte sectors without writing anything
+ * @param card_sectors Card capacity in 512-byte sectors
+ * @param erase_block Card AU in sectors (GET_BLOCK_SIZE), used when boundary is 0;
+ *        1 or 0 selects the SD Association boundary for the capacity
+ * @param options Format options; NULL for the defaults (auto, recommended clusters)
+ * @param layout Receives the layout
+ * @return FR_OK, FR_INVALID_PARAMETER for bad options, or FR_MKFS_ABORTED if
+ *         the card is too small or the cluster count does not fit the requested type
+ *
+ * Note: For exFAT the layout is the one f_mkfs will write (volume at sector 63,
+ * cluster heap on the GET_BLOCK_SIZE boundary); options->boundary is not used.
+ */
+FRESULT SD_FormatPlan(uint32_t card_sectors, uint32_t erase_block,
+                      const SD_FormatOptions *options, SD_FormatLayout *layout);
+
+/**
+ * @brief Format a drive
+ * @param pdrv Physical drive number (as passed to disk_write)
+ * @param options Format options; NULL for a full format with the defaults
+ * @param work Scratch buffer of at least one sector; larger buffers write
+ *        zeroed FAT and directory sectors several at a time
+ * @param work_len Size of work in bytes
+ * @param layout Receives the layout written; may be NULL
+ * @return FR_OK, FR_NOT_READY, FR_DISK_ERR, or an SD_FormatPlan error
+ *
+ * Note: The drive's sector size (GET_SECTOR_SIZE when _MIN_SS != _MAX_SS)
+ * is used throughout; options count in those sectors, while the capacity
+ * table and SD_FORMAT_MAX_BOUNDARY stay in 512-byte units. A quick format
+ * writes the MBR, boot sector(s), FSInfo, both FATs and the root directory
+ * only. A full format also discards every sector of the card first; drives
+ * without CTRL_TRIM skip that step.
+ */
+FRESULT SD_FormatDrive(BYTE pdrv, const SD_FormatOptions *options, void *work, UINT work_len,
+                       SD_FormatLayout *layout);
+
+/**
+ * @brief Find the raw region in the MBR of a drive
+ * @param pdrv Physical drive number
+ * @param work Scratch buffer of at least one sector
+ * @param start Receives the first sector of the region
+ * @param sectors Receives its length in sectors
+ * @return FR_OK, FR_NO_FILE if the MBR has no SD_FORMAT_RAW_TYPE entry,
+ *         FR_NO_FILESYSTEM without an MBR, or FR_DISK_ERR
+ *
+ * Note: Sectors are the drive's (GET_SECTOR_SIZE). Pass start to
+ * SD_DiskSetSectorLimit before mounting so FatFs never writes the region.
+ */
+FRESULT SD_FormatFindRaw(BYTE pdrv, void *work, uint32_t *start, uint32_t *sectors);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_FORMAT_H__ */
@@ -0,0 +1,114 @@
+/*
+ * sd_freemap.h
+ *
+ * Coarse free-cluster map for the mounted FAT16/FAT32 volume. After mount
+ * the FAT is counted a few sectors per step in the background, holding the
+ * FatFs volume lock only for one slice; each group of FAT sectors keeps its
+ * free-cluster count. The finished scan seeds FatFs's free count, so
+ * f_getfree returns at once and FSINFO is rewritten on the next sync.
+ * SD_FreeMapHint points the FatFs allocator at a free run, so
+ * create_chain/f_expand start there instead of walking full FAT regions.
+ *
+ * With SD_FREEMAP_WEAR the hints follow a cursor that only moves forward
+ * through the volume and wraps at its end, instead of FatFs's allocation
+ * point, which a delete or truncate moves back into the freed hole. Logs
+ * rotated through the hinting helpers (sd_logger_start, sd_preallocate_file,
+ * sd_copy_file, the extent reserve) then land on fresh clusters each time
+ * rather than rewriting the same ones, spreading writes over cards with weak
+ * wear leveling and keeping them on blocks the card has not had to
+ * garbage-collect.
+ */
+
+#ifndef __SD_FREEMAP_H__
+#define __SD_FREEMAP_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Groups per volume (0 = off); 4 bytes of RAM each. FAT sectors are split evenly. */
+#ifndef SD_FREEMAP_GROUPS
+#define SD_FREEMAP_GROUPS 0U
+#endif
+
+/* FAT sectors read per SD_FreeMapStep while the first scan runs. */
+#ifndef SD_FREEMAP_SLICE
+#define SD_FREEMAP_SLICE 8U
+#endif
+
+/* Background step period once the map is built (recounts groups changed by FAT writes). */
+#ifndef SD_FREEMAP_IDLE_MS
+#define SD_FREEMAP_IDLE_MS 100U
+#endif
+
+/* Hint allocations from a forward-moving wear cursor (needs SD_FREEMAP_GROUPS). */
+#ifndef SD_FREEMAP_WEAR
+#define SD_FREEMAP_WEAR 0
+#endif
+
+#if (SD_FREEMAP_GROUPS > 0U) && (SD_FREEMAP_SLICE < 1U)
+#error "SD_FREEMAP_SLICE must be at least 1"
+#endif
+
+typedef struct {
+    uint32_t groups;          // Groups in use for this volume (0 = map inactive)
+    uint32_t group_clusters;  // Clusters covered by one group
+    uint32_t scanned_sectors; // FAT sectors counted by the first scan so far
+    uint32_t free_clusters;   // Sum of the group counts
+    uint32_t recounts;        // Groups recounted after FAT writes
+    bool done;                // First scan finished; counts cover the whole FAT
+    bool error;               // A FAT read failed; the map stopped
+    uint32_t wear_cursor;     // Cluster the next hint searches from (SD_FREEMAP_WEAR)
+    uint32_t wear_laps;       // Times the cursor wrapped since mount
+} SD_FreeMapStats;
+
+/* Start mapping a just-mounted volume (FAT12 and exFAT volumes are left unmapped). */
+void SD_FreeMapStart(FATFS *fs);
+
+/* Forget the volume; call before unmounting it. */
+void SD_FreeMapStop(void);
+
+/**
+ * @brief Do one slice of background work (task context)
+ * @return true while work remains (first scan, or groups changed by FAT writes)
+ *
+ * Note: Takes the FatFs volume lock for the duration of the slice only.
+ */
+bool SD_FreeMapStep(void);
+
+/* Diskio hook: marks the groups of FAT sectors written since they were counted. */
+void SD_FreeMapFatWritten(BYTE pdrv, DWORD sector, UINT count);
+
+/**
+ * @brief Find a run of whole free groups holding at least bytes
+ * @return First cluster of the run (searched from FatFs's last allocation), 0 if none
+ */
+DWORD SD_FreeMapFindRun(uint32_t bytes);
+
+/**
+ * @brief Point the FatFs allocator at free space for an allocation of bytes
+ * @return true if the hint was set (a whole-group run, else the next group with free clusters)
+ */
+bool SD_FreeMapHint(uint32_t bytes);
+
+void SD_FreeMapGetStats(SD_FreeMapStats *out);
+
+/*
+ * Wear cursor of the mapped volume (0 = none, or SD_FREEMAP_WEAR off). On
+ * FAT32 the mount picks it up from FSINFO's next-free field; FAT16 has no
+ * such field, so an application can keep it across mounts itself, e.g. in
+ * a backup register, and restore it after sd_mount.
+ */
+DWORD SD_FreeMapCursor(void);
+void SD_FreeMapSetCursor(DWORD clst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_FREEMAP_H__ */
@@ -0,0 +1,139 @@
+/*
+ * sd_fsck.h
+ *
+ * Incremental consistency check of the mounted FAT16/FAT32 volume. Each
+ * SD_FsckStep reads at most SD_FSCK_SLICE sectors, holding the FatFs volume
+ * lock for that slice only, so a logger on the same volume waits one slice at
+ * most. Reads go through disk_read, so the diskio FAT and sector caches serve
+ * them; a sector held in FatFs's window is taken from there.
+ *
+ * The clusters are checked a window of SD_FSCK_WINDOW_CLUSTERS at a time.
+ * For each window the directory tree and every chain in it are walked,
+ * marking the window's clusters they reach; then the window's FAT entries
+ * are read. Findings:
+ *   - cross-linked: a cluster reached twice (by two chains, or a loop)
+ *   - lost: allocated, but reached by no chain. Lost chains are the lost
+ *     clusters no lost cluster of the same window points to, so a chain that
+ *     spans windows counts once in each
+ *   - short chains: a file whose size needs more clusters than its chain has
+ *   - long chains: a chain holding clusters past the file's size, as left by
+ *     a crash before the size reached the directory, or by f_expand
+ *   - bad chains: a link to a free, reserved or bad cluster, past the end of
+ *     the FAT, or a chain longer than the FAT
+ * Sizes and links are judged on the first window's walk only.
+ *
+ * The volume may be written meanwhile. FAT sectors written while a window is
+ * being checked (disk_write reports them through SD_FsckFatWritten) are left
+ * out of that window's findings and counted as skipped clusters. A file open
+ * for writing shows as a long chain until it is synced. An entry moved between
+ * directories mid-check can show its chain as lost, so check again before
+ * acting on a finding. Nothing is repaired. FAT12 and exFAT are not checked.
+ */
+
+#ifndef __SD_FSCK_H__
+#define __SD_FSCK_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Clusters per window (0 = off); 3 bits of RAM each. A multiple of 256. */
+#ifndef SD_FSCK_WINDOW_CLUSTERS
+#define SD_FSCK_WINDOW_CLUSTERS 0U
+#endif
+
+/* Sectors read per SD_FsckStep. */
+#ifndef SD_FSCK_SLICE
+#define SD_FSCK_SLICE 4U
+#endif
+
+/* Directory levels below the root that are walked; deeper ones make the check partial. */
+#ifndef SD_FSCK_MAX_DEPTH
+#define SD_FSCK_MAX_DEPTH 8U
+#endif
+
+#if (SD_FSCK_WINDOW_CLUSTERS > 0U)
+#if (SD_FSCK_WINDOW_CLUSTERS % 256U) != 0U
+#error "SD_FSCK_WINDOW_CLUSTERS must be a multiple of 256"
+#endif
+#if (SD_FSCK_SLICE < 1U) || (SD_FSCK_MAX_DEPTH < 1U)
+#error "SD_FSCK_SLICE and SD_FSCK_MAX_DEPTH must be at least 1"
+#endif
+#endif
+
+#ifdef USE_FREERTOS
+/* Check task stack depth in words. */
+#ifndef SD_FSCK_TASK_STACK
+#define SD_FSCK_TASK_STACK 256U
+#endif
+
+#ifndef SD_FSCK_TASK_PRIORITY
+#define SD_FSCK_TASK_PRIORITY (tskIDLE_PRIORITY + 1U)
+#endif
+
+/* Pause between the task's steps, leaving the card to other work. */
+#ifndef SD_FSCK_STEP_MS
+#define SD_FSCK_STEP_MS 10U
+#endif
+#endif
+
+typedef struct {
+    uint32_t windows;       // Windows the volume's clusters fall into
+    uint32_t window;        // Windows finished
+    uint32_t steps;         // SD_FsckStep calls that did work
+    uint32_t sectors_read;  // disk_read calls
+    uint32_t files;         // Files and directories seen by the first walk
+    uint32_t dirs;
+    uint32_t cross_linked;  // Clusters reached more than once
+    uint32_t lost_clusters; // Allocated clusters no chain reaches
+    uint32_t lost_chains;
+    uint32_t short_chains;
+    uint32_t long_chains;
+    uint32_t bad_chains;
+    uint32_t skipped;       // Clusters left out because their FAT sector was written
+    bool done;              // Every window checked
+    bool partial;           // Directories too deep to walk: lost clusters not reported
+    bool error;             // A read failed; the check stopped
+} SD_FsckReport;
+
+/* Start checking a mounted volume (FAT12 and exFAT volumes are left alone). */
+void SD_FsckStart(FATFS *fs);
+
+/* Forget the volume, waiting out a running step; call before unmounting it. */
+void SD_FsckStop(void);
+
+/**
+ * @brief Do one slice of the check (task context)
+ * @return true while work remains
+ *
+ * Note: Takes the FatFs volume lock for the duration of the slice only.
+ */
+bool SD_FsckStep(void);
+
+/* Diskio hook: marks FAT sectors written while a window is checked. */
+void SD_FsckFatWritten(BYTE pdrv, DWORD sector, UINT count);
+
+void SD_FsckGetReport(SD_FsckReport *out);
+
+#ifdef USE_FREERTOS
+/**
+ * @brief Check a mounted volume from the sd_fsck task, one step every SD_FSCK_STEP_MS
+ * @param fs Volume to check
+ * @return false if the task cannot be created
+ *
+ * Note: The task starts the check itself, so it is safe to call while
+ * another check is running; that one is abandoned.
+ */
+bool SD_FsckStartTask(FATFS *fs);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_FSCK_H__ */
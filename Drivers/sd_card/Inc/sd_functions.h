@@ -12,6 +12,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Initialize SD card system (call before mounting or file operations). */
 int sd_system_init(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin, bool use_dma);
 
@@ -21,21 +25,509 @@ extern char sd_path[];
 int sd_mount(void);
 int sd_unmount(void);
 
+/*
+ * Mount with no write path: the drive refuses writes (SD_DiskSetReadOnly), so
+ * FatFs write operations fail with FR_WRITE_PROTECTED, and the sector cache,
+ * read-ahead window and FAT cache are raised to their build sizes, the data
+ * class taking the lines FAT and directories leave (SD_CACHE_CLASSES). No
+ * free-space scan, free map, defrag recovery or fsck runs, so FSINFO is never
+ * updated; the free count is reported only if FSINFO holds one. sd_unmount
+ * puts the cache sizes back and makes the drive writable again.
+ */
+int sd_mount_readonly(void);
+
+/*
+ * Lazy mount: register the volume without touching the card, so boot does
+ * not wait for identification and the card gets no clock or commands until
+ * storage is needed. The first FatFs call on the volume (an sd_* helper or a
+ * direct f_open) identifies the card and mounts it, then carries on as
+ * usual; it fails with FR_NOT_READY while there is no card and tries again
+ * on the next call. sd_mount_poll finishes the mount afterwards, outside any
+ * FatFs call: it tells the drive where FAT and directories are and starts
+ * the free-space count, defrag recovery and background checks sd_mount would
+ * have run. Call it from the main loop or a low-priority task; sd_hotplug_poll
+ * calls it too. It returns FR_OK once the volume is mounted and
+ * FR_NOT_READY before. sd_mount, sd_unmount and a hot-plug remount end a
+ * pending lazy mount.
+ */
+int sd_mount_lazy(void);
+int sd_mount_poll(void);
+
+/*
+ * First sector and length of the FAT volume at path (e.g. "1:"), mounting it
+ * if its FATFS is registered with f_mount, for a caching policy of its own
+ * (SD_DiskSetPolicy). With _MULTI_PARTITION 1 and a VolToPart table the
+ * volumes of one card are its MBR partitions: a small configuration volume
+ * can be held in RAM (SD_DISK_POLICY_RESIDENT) while the data volume at
+ * sd_path streams (SD_DISK_POLICY_STREAM). sd_mount registers FAT and
+ * directory regions for the volume at sd_path only. FR_DENIED with
+ * _FS_MINIMIZE above 1.
+ */
+int sd_volume_extent(const char *path, uint32_t *first_sector, uint32_t *sector_count);
+
+/*
+ * Cache warm-up across boots (SD_WARM_SECTORS in sd_diskio_spi.h, with the
+ * sector cache). The drive samples which sectors are read most; sd_unmount
+ * saves the hottest ones, topped up with the previous list, to SD_WARM_NAME
+ * in the root directory (not on a read-only mount). The next writable mount
+ * reads the list back, and sd_warm_poll, called from an idle task or the main
+ * loop, prefetches it into the sector cache: one multi-block read of up to
+ * SD_WARM_RUN_SECTORS sectors per call (SD_DiskWarmRun), so directories and
+ * FAT sectors in use before the reboot are hits from the first access.
+ * FR_NOT_ENABLED while nothing is mounted, FR_OK once done (or when not
+ * built), FR_TIMEOUT in batch mode. A list of another volume is ignored.
+ */
+typedef struct {
+    uint32_t loaded;     // Sectors in the list read at the last mount
+    uint32_t pending;    // Of those, left for sd_warm_poll
+    uint32_t prefetched; // Of those, done (past the card's end: skipped)
+    uint32_t reads;      // Multi-block reads they took
+    uint32_t saved;      // Sectors saved at the last unmount
+    uint32_t errors;     // Failed prefetch reads or saves
+} SD_WarmStats;
+
+int sd_warm_poll(void);
+void sd_warm_get_stats(SD_WarmStats *out);
+
+/*
+ * Stop the diskio capture (SD_DISK_CAPTURE_ENTRIES in sd_diskio_spi.h) and
+ * write its unread records to path as a text trace: the SDCAP clock line,
+ * then one SDCAP line per call (SD_DiskCaptureFormat). Copy the file to a
+ * PC and run tests/sd_host_replay on it, or read it back with
+ * SD_DiskCaptureParse and SD_DiskCaptureReplay on a scratch card. *records
+ * (optional) is the number of records written. FR_DENIED when the volume
+ * fills up or with _FS_READONLY.
+ */
+int sd_capture_save(const char *path, uint32_t *records);
+
+/*
+ * Unmount, format the card with an SD-aligned FAT12/16/32 layout (sd_format.h:
+ * SD Association cluster sizes, FAT and data regions on AU boundaries) and
+ * mount it again. quick writes the filesystem metadata only; otherwise the
+ * whole card is erased first. Everything on the card is lost.
+ */
+int sd_format(bool quick);
+
+/*
+ * Card hot-plug (SD_HOTPLUG). sd_hotplug_enable configures the card-detect
+ * pin in interrupt mode: presence is cached in the handle instead of read on
+ * every I/O. Route the pin's EXTI to SD_CardDetectIrq(&g_sd_handle). Under
+ * FreeRTOS an "sd_hotplug" task runs sd_hotplug_poll every SD_HOTPLUG_POLL_MS;
+ * otherwise call it from the main loop (or SD_CardDetectTick from a timer
+ * and sd_hotplug_poll when convenient). After a removal the volume is
+ * unmounted without writing cached data back; after an insertion the card is
+ * identified again and mounted. Returns FR_OK while mounted, FR_NOT_READY
+ * while no card is present, or the last mount error (retried every poll).
+ */
+int sd_hotplug_enable(GPIO_TypeDef *cd_port, uint16_t cd_pin, bool active_low);
+int sd_hotplug_poll(void);
+
 /* Basic file operations */
 int sd_write_file(const char *filename, const char *text);
 int sd_append_file(const char *filename, const char *text);
 int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_read);
 int sd_delete_file(const char *filename);
+
+/*
+ * Incremental delete, for files whose f_unlink would hold the volume for
+ * seconds. sd_delete_begin opens the file and maps its cluster chain once
+ * (fast seek, SD_DELETE_CLMT entries). Each sd_delete_step then frees the
+ * last SD_DELETE_STEP_CLUSTERS clusters with f_truncate and f_sync, and
+ * returns FR_NOT_READY. Every step is a few FatFs calls of its own, so
+ * other tasks' file operations get the volume in between. The file on the
+ * card is valid, only shorter, after every step. The step that finds it
+ * empty unlinks it and returns FR_OK. sd_delete_cancel stops a pending
+ * delete, leaving the file shortened. One delete at a time: a second
+ * sd_delete_begin returns FR_LOCKED.
+ */
+int sd_delete_begin(const char *filename);
+int sd_delete_step(void);
+int sd_delete_cancel(void);
+
+/*
+ * Rename or move a file or directory. newname may be in another directory of
+ * the same volume: FatFs then writes a new entry there and deletes the old
+ * one, so archiving a file this way touches two directory sectors and none
+ * of its data clusters, whatever its size.
+ */
 int sd_rename_file(const char *oldname, const char *newname);
 
+/*
+ * Batched deletes and renames inside one directory, e.g. a log rotation. The
+ * directory is opened once up front; then every op runs on dir/name with the
+ * drive in batch mode (SD_DiskBatchBegin), so after the first op the path is
+ * looked up from RAM, each changed directory, FAT and FSInfo sector is written
+ * once, and the card is synced once at the end. Ops run in array order (rename
+ * log.3 to log.4 before log.2 to log.3) and a failed op does not stop the rest.
+ * Each op gets its own result; the return value is the first error, or the
+ * write-back error of the final sync. Not reentrant: a nested call returns
+ * FR_LOCKED.
+ */
+typedef enum {
+    SD_BATCH_DELETE = 0, // f_unlink(dir/name)
+    SD_BATCH_RENAME      // f_rename(dir/name, dir/new_name)
+} SD_BatchOpType;
+
+typedef struct {
+    SD_BatchOpType type;
+    const char *name;     // Entry inside dir
+    const char *new_name; // SD_BATCH_RENAME: new name inside the same dir
+    FRESULT result;       // Set by sd_batch
+} SD_BatchOp;
+
+int sd_batch(const char *dir, SD_BatchOp *ops, uint32_t count);
+
+/* sd_batch with SD_BATCH_DELETE for each of names[0..count-1]. */
+int sd_delete_files(const char *dir, const char *const *names, uint32_t count);
+
+/*
+ * Move every file of dir_from whose name matches pattern ('*' and '?',
+ * case-insensitive, as sd_find; NULL = all) into dir_to under the same name,
+ * in batch mode as sd_batch: directory entries move, data stays. Directories
+ * are not moved. A file whose name already exists in dir_to stays where it
+ * is and the rest go ahead; the return value is the first failure, or the
+ * write-back error of the final sync. moved gets the number moved and may be
+ * NULL. dir_to must exist. Not reentrant with sd_batch: FR_LOCKED.
+ */
+int sd_move_files(const char *dir_from, const char *dir_to, const char *pattern, uint32_t *moved);
+
+/*
+ * sd_write_file/sd_append_file keep up to SD_FILE_CACHE_SLOTS write handles
+ * open (capped at _FS_LOCK - 1) so repeated writes skip the directory search;
+ * the least recently used handle is closed when a slot or lock entry is
+ * needed. Unless SD_FILE_CACHE_SYNC_WRITES is set, cached writes are committed
+ * by sd_file_cache_flush, by closing the handle, or by sd_unmount. Other
+ * helpers close a file's cached handle before touching that file.
+ *
+ * With SD_EXTENT_CLUSTERS, a cached handle allocates that many clusters ahead
+ * of its data, so files growing side by side get contiguous runs. Until the
+ * handle closes, the file's size on the card includes the unused extent
+ * (also after sd_file_cache_flush); closing truncates it to the data.
+ */
+int sd_file_cache_flush(void);
+
+/* Close the cached handle for filename (NULL = all of them). */
+int sd_file_cache_close(const char *filename);
+
+/*
+ * Create (or truncate) a file and allocate bytes of contiguous clusters to it
+ * with f_expand (_USE_EXPAND). The file's size becomes bytes with undefined
+ * contents; open it FA_OPEN_EXISTING | FA_WRITE, write from offset 0 and
+ * f_truncate at the end. Writes into it need no FAT chain allocation and go
+ * out as long CMD25 runs. Returns FR_DENIED if no contiguous area is free.
+ */
+int sd_preallocate_file(const char *filename, uint32_t bytes);
+
+/*
+ * Fast-seek reads (_USE_FASTSEEK). sd_fastseek_open opens a file read-only and
+ * attaches a cluster link map table from a static pool, so f_lseek and f_read
+ * jump straight to the cluster for any offset. Tables stay cached after
+ * sd_fastseek_close and are reused on the next open of the same file (same
+ * volume, start cluster and size), so the FAT chain is walked only once. If
+ * the pool is busy or the file is too fragmented for one table, the file is
+ * still opened, just without fast seek.
+ */
+int sd_fastseek_open(FIL *fp, const char *filename);
+int sd_fastseek_close(FIL *fp);
+
+/* Drop cached tables (called by the helpers that rewrite or delete files). */
+void sd_fastseek_invalidate(void);
+
+/* Read len bytes at offset through a fast-seek open; *bytes_read gets the count. */
+int sd_read_at(const char *filename, uint32_t offset, void *buffer, UINT len, UINT *bytes_read);
+
+/*
+ * CRC-32 of a whole file, as SD_Crc32 and the STM32 CRC unit compute it
+ * (sd_crc32.h). The file is read through SD_FwLoad in SD_FWLOAD_CHUNK pieces,
+ * one CMD18 per piece, and each piece is fed to the CRC unit when
+ * SD_Crc32SetUnit has registered one.
+ */
+int sd_file_crc32(const char *filename, uint32_t *crc);
+
+/*
+ * Read a file of any size in SD_FWLOAD_CHUNK pieces without a whole-file
+ * buffer. SD_FwLoad does the reading: each piece is one CMD18 of its
+ * cluster run into an aligned buffer of its own, not through the FIL
+ * buffer, and under FreeRTOS with SD_AsyncStart the next piece is read into
+ * the other buffer while the callback runs. Pieces arrive in order at their
+ * file offsets; all but the last are whole multiples of 512 bytes. data is
+ * valid only during the call. Return false to stop: the result is then
+ * FR_DENIED. The file must not be written while it streams.
+ */
+typedef bool (*sd_chunk_callback)(const uint8_t *data, uint32_t len, uint32_t offset,
+                                  void *context);
+
+int sd_read_file_stream(const char *filename, sd_chunk_callback callback, void *context);
+
+/*
+ * Copy src to dst (replaced if it exists) in SD_FWLOAD_CHUNK pieces read as
+ * for sd_read_file_stream and written with one f_write each, which FatFs
+ * passes to the card as a multi-block write without its FIL buffer. With
+ * _USE_EXPAND 1 the destination is first allocated as one contiguous run
+ * when the volume has one. A failed copy removes dst. Neither file may be
+ * open elsewhere. With _FS_LOCK a dst naming src (under any alias) fails
+ * with FR_LOCKED and leaves src alone; without it they must differ.
+ */
+int sd_copy_file(const char *src, const char *dst);
+
+/*
+ * Zero-copy transfers. When the file position is on a sector boundary,
+ * f_read/f_write move every whole sector straight between the caller's buffer
+ * and the card, one disk call per cluster run. If that buffer is
+ * SD_DMA_ALIGNMENT-aligned, the driver runs those calls as CMD18/CMD25 DMA
+ * into or out of it, with no bounce copy. sd_read_aligned/sd_write_aligned
+ * only issue transfers that stay on this path: buffer aligned, fp->fptr
+ * sector-aligned and len a multiple of 512, otherwise FR_INVALID_PARAMETER.
+ * When fp->fptr is also cluster-aligned, every disk call is a whole cluster.
+ * sd_dma_alloc returns buffers that satisfy this. Its size is rounded up to
+ * whole sectors, so D-cache maintenance never touches a neighbour.
+ */
+int sd_read_aligned(FIL *fp, void *buffer, UINT len, UINT *bytes_read);
+int sd_write_aligned(FIL *fp, const void *buffer, UINT len, UINT *bytes_written);
+
+/* SD_DMA_ALIGNMENT-aligned heap block of at least bytes (pvPortMalloc under FreeRTOS); NULL if none. */
+void *sd_dma_alloc(size_t bytes);
+void sd_dma_free(void *buffer);
+
+/*
+ * Directory index (SD_DIRINDEX_SLOTS > 0). The first lookup in a directory
+ * reads it once and records a hash of every name; later lookups of missing
+ * names return FR_NO_FILE without touching the card, which is what makes
+ * "find the next unused log name" loops cheap in large directories. Present
+ * names still go through f_stat/f_open. The helpers here keep the index
+ * coherent; files created or removed with FatFs directly must be reported
+ * with sd_dirindex_add or sd_dirindex_invalidate.
+ */
+int sd_stat(const char *path, FILINFO *fno);
+bool sd_file_exists(const char *path);
+
+/*
+ * Stat cache (SD_STAT_CACHE_SLOTS > 0). sd_stat keeps the FILINFO of the
+ * last SD_STAT_CACHE_SLOTS paths it found, so polling the same files' sizes
+ * costs no card access until something changes them. Paths are compared
+ * case-insensitively without the drive and leading '/'. Writes, appends,
+ * flushes and closes of cached handles, creates, deletes, renames, batches,
+ * mount and unmount through these helpers drop the affected entries (a
+ * directory drops everything under it). Missing names are not cached; see
+ * the directory index above. Changes made with FatFs directly are reported
+ * with sd_dirindex_invalidate(path).
+ */
+typedef struct {
+    uint32_t hits;          // sd_stat answered from RAM
+    uint32_t misses;        // sd_stat that went to f_stat
+    uint32_t invalidations; // Entries dropped by a change
+} SD_StatCacheStats;
+
+void sd_stat_cache_get_stats(SD_StatCacheStats *out);
+
+/*
+ * Small-file cache (SD_SMALLFILE_POOL > 0). sd_read_file keeps the whole
+ * contents of files of up to SD_SMALLFILE_MAX bytes that it read in full, in
+ * a pool of SD_SMALLFILE_POOL bytes, so configuration files read again and
+ * again skip the open, the directory search and the sector reads. The least
+ * recently read files make room. The helpers that change files drop the
+ * entry the same way as for the stat cache; changes made with FatFs
+ * directly are reported with sd_dirindex_invalidate(path).
+ */
+typedef struct {
+    uint32_t hits;      // sd_read_file answered from the pool
+    uint32_t misses;    // sd_read_file that read the card
+    uint32_t evictions; // Files dropped to make room
+    uint32_t files;     // Files held now
+    uint32_t bytes;     // Pool bytes in use now
+} SD_SmallFileStats;
+
+void sd_smallfile_get_stats(SD_SmallFileStats *out);
+void sd_dirindex_add(const char *path);
+
+/* Drop the index of directory path and everything below it (NULL = all). */
+void sd_dirindex_invalidate(const char *path);
+
+/*
+ * Sequence-numbered names (SD_SEQ_SLOTS > 0), e.g. LOG_0001.BIN, LOG_0002.BIN
+ * for log rotation. sd_seq_register claims a slot for prefix in dir: names
+ * prefix, digits, ext (case-insensitive) count, and new numbers are padded to
+ * digits (1..9). The directory is read once then, if mounted, and once at
+ * every sd_mount to find the highest number; sd_seq_next then writes the
+ * next path ("0:/dir/prefixNNNNext") to path with no card access and
+ * reserves its number. Creates, deletes and renames through these helpers,
+ * and the sd_dirindex_add/sd_dirindex_invalidate reports, keep the figure
+ * current: a higher name raises it, and removing the highest name or the
+ * directory has the next call read the directory again. sd_seq_next returns
+ * FR_NO_FILE for an unregistered prefix and FR_DENIED when the numbers at
+ * that width are used up.
+ */
+int sd_seq_register(const char *dir, const char *prefix, const char *ext, uint32_t digits);
+int sd_seq_next(const char *dir, const char *prefix, char *path, size_t len, uint32_t *number);
+
+/*
+ * Sharded flat name space for directories too large for FatFs's linear
+ * search. A file name lives in root/XX/name, XX being the hex bucket of its
+ * upper-cased FNV-1a hash modulo SD_SHARD_BUCKETS, so each physical
+ * directory holds about 1/SD_SHARD_BUCKETS of the files. The bucket count
+ * is part of the on-card layout: keep it fixed for a card. Names may not
+ * contain '/', '\\' or ':'. sd_shard_open creates root and the bucket on the
+ * first create; stat and delete of a name whose bucket does not exist
+ * return FR_NO_FILE. sd_shard_list visits the files of every bucket (no
+ * particular order) until the visitor returns false; count gets the number
+ * visited and may be NULL. Not reentrant.
+ */
+typedef bool (*sd_shard_visitor)(const char *name, const FILINFO *fno, void *context);
+
+int sd_shard_path(const char *root, const char *name, char *path, size_t len);
+int sd_shard_open(FIL *fp, const char *root, const char *name, BYTE mode);
+int sd_shard_stat(const char *root, const char *name, FILINFO *fno);
+int sd_shard_delete(const char *root, const char *name);
+int sd_shard_list(const char *root, sd_shard_visitor visitor, void *context, uint32_t *count);
+
+/*
+ * Directory preallocation (SD_DIRPRE_DIRS > 0). When a directory's last
+ * cluster is full, the next file created there waits while FatFs allocates a
+ * cluster and zero-fills it one sector at a time. For directories registered
+ * with sd_dirpre_add, sd_dirpre_poll (one directory per call, from an idle
+ * task or the main loop) does that ahead of time: once fewer than
+ * SD_DIRPRE_SLACK entries are left past the directory's end, it creates
+ * empty placeholder files until FatFs stretches the directory, then deletes
+ * them, leaving a cleared cluster for later creates. If the placeholders only
+ * fill deleted slots, the directory has room and is not tried again until
+ * its end moves. FatFs's fixed FAT12/16 root directory is never grown.
+ */
+typedef struct {
+    uint32_t checks; // Directories examined
+    uint32_t grown;  // Clusters added ahead of time
+    uint32_t holes;  // Attempts that found deleted slots to reuse instead
+    uint32_t errors; // Polls that failed
+} SD_DirPreStats;
+
+int sd_dirpre_add(const char *dir);
+int sd_dirpre_poll(void);
+void sd_dirpre_get_stats(SD_DirPreStats *out);
+
 /* Directory handling */
 FRESULT sd_create_directory(const char *path);
 void sd_list_directory_recursive(const char *path, int depth);
 void sd_list_files(void);
 
+typedef enum {
+    SD_WALK_CONTINUE = 0, // Keep going (descend into a directory)
+    SD_WALK_SKIP,         // Do not descend into this directory
+    SD_WALK_STOP          // End the walk
+} sd_walk_action;
+
+typedef struct {
+    uint32_t dirs;          // Directories visited
+    uint32_t files;         // Files passed to the visitor (after filtering)
+    uint32_t depth_limited; // Directories not entered because of max_depth
+    uint32_t skipped;       // Entries whose path exceeded SD_WALK_PATH_MAX
+    uint32_t errors;        // Subdirectories that could not be opened
+} SD_WalkStats;
+
+/*
+ * Visitor: path is the entry's full path, depth is 0 for entries of the root.
+ * Both pointers are valid only during the call.
+ */
+typedef sd_walk_action (*sd_walk_visitor)(const char *path, const FILINFO *fno, int depth,
+                                          void *context);
+
+/*
+ * Walk a directory tree depth-first without recursion. Directory state lives
+ * in a static stack of SD_DIR_MAX_DEPTH levels, so task stack use is constant.
+ * max_depth (<= 0 for SD_DIR_MAX_DEPTH) bounds descent. pattern (NULL = all)
+ * filters files by name with '*' and '?' (case-insensitive); every directory
+ * is still visited. Not reentrant: a nested call returns FR_LOCKED. stats may
+ * be NULL.
+ */
+int sd_walk(const char *root, int max_depth, const char *pattern, sd_walk_visitor visitor,
+            void *context, SD_WalkStats *stats);
+
+/*
+ * Files and directories of one directory whose long name matches pattern
+ * ('*' and '?', case-insensitive), no descent. With _USE_FIND in ffconf.h
+ * this is f_findfirst/f_findnext, which test each entry as it is read, so
+ * the visitor only sees matches and nothing is copied on the way; without
+ * it the same filter runs over f_readdir. The visitor returns false to stop;
+ * name and fno are valid only during the call. count gets the number of
+ * matches visited and may be NULL. Not reentrant: a nested call returns
+ * FR_LOCKED.
+ */
+typedef bool (*sd_find_visitor)(const char *name, const FILINFO *fno, void *context);
+
+int sd_find(const char *dir, const char *pattern, sd_find_visitor visitor, void *context,
+            uint32_t *count);
+
 /* Space information */
 int sd_get_space_kb(void);
 
+/*
+ * Free space without a FAT scan: true once FatFs holds a valid free-cluster
+ * count (from FSINFO at mount or after a scan). Either pointer may be NULL.
+ */
+bool sd_free_space_get(uint32_t *free_kb, uint32_t *total_kb);
+
+/*
+ * Background free-space work. With SD_FAST_MOUNT, sd_mount does not scan the
+ * FAT when FSINFO has no free count; this runs the deferred scan. With
+ * SD_FREEMAP_GROUPS it advances the free map one slice instead, and the
+ * finished map supplies the count. The "sd_free" task calls it under
+ * FreeRTOS; otherwise call it from the main loop. Cheap when idle.
+ */
+int sd_free_space_poll(void);
+
+typedef struct {
+    uint32_t free_kb;
+    uint32_t total_kb;
+    bool reconciled;  // The FAT recount after mount has confirmed free_kb
+    int32_t drift_kb; // What the recount corrected the mount's FSINFO figure by
+} SD_SpaceInfo;
+
+/*
+ * Free space in O(1), for periodic polling: no FAT access and no logging.
+ * FatFs keeps the free-cluster count live as it allocates and frees. With
+ * SD_SPACE_CACHE, sd_mount takes the FSINFO count without f_getfree and
+ * queues a FAT recount that sd_free_space_poll runs (the "sd_free" task
+ * under FreeRTOS); until it finishes the FSINFO figure is returned with
+ * reconciled false. FR_NOT_READY (total_kb still set) while no count is
+ * known, FR_NOT_ENABLED when not mounted.
+ */
+int sd_get_space_cached(SD_SpaceInfo *info);
+
+/*
+ * Line reader: f_gets without the byte-at-a-time f_read. The file is read a
+ * chunk at a time into a caller buffer and lines come back as slices of it,
+ * NUL-terminated in place with the newline (and a '\r' before it) removed.
+ * A line cut by the end of a chunk is moved to the carry area in front of
+ * the chunk, so lines of up to max_line bytes are always contiguous; longer
+ * ones are skipped and counted. Treat every field as private.
+ */
+typedef struct {
+    FIL *fp;
+    char *chunk;          // f_read target; the carry area is the max_line bytes before it
+    uint32_t chunk_bytes;
+    uint32_t max_line;
+    char *line;           // Start of the next line
+    char *end;            // End of the bytes read
+    bool eof;
+    bool skipping;        // Inside a line longer than max_line
+    uint32_t lines;       // Lines read so far, skipped ones included (the last one's number)
+    uint32_t long_lines;  // Lines skipped for being longer than max_line
+} SD_LineReader;
+
+/*
+ * Read fp (open with FA_READ) from its current position through buf. The
+ * chunk starts max_line bytes into buf: with an aligned buf and a max_line
+ * that is a multiple of SD_DMA_ALIGNMENT, and a chunk of whole sectors,
+ * FatFs reads straight into it. size must exceed max_line + 1.
+ */
+int sd_line_reader_init(SD_LineReader *lr, FIL *fp, char *buf, uint32_t size, uint32_t max_line);
+
+/*
+ * Next line: *line points into buf and stays valid until the next call;
+ * *len (may be NULL) is its length. At the end of the file *line is NULL
+ * and FR_OK is returned; a failing f_read is returned as it is. A last line
+ * without a newline is still returned. Blank lines are returned (len 0).
+ */
+int sd_line_read(SD_LineReader *lr, char **line, uint32_t *len);
+
 /* CSV Record structure */
 typedef struct CsvRecord {
     char field1[32];
@@ -43,7 +535,42 @@ typedef struct CsvRecord {
     int value;
 } CsvRecord;
 
-/* CSV reader (caller defines record array) */
+/* CSV reader (caller defines record array; built on sd_csv_parse) */
 int sd_read_csv(const char *filename, CsvRecord *records, int max_records, int *record_count);
 
+typedef struct {
+    uint32_t lines;      // Lines read, including blank and skipped ones
+    uint32_t records;    // Non-blank lines passed to the callback
+    uint32_t long_lines; // Lines longer than SD_CSV_MAX_LINE (skipped)
+} SD_CsvStats;
+
+/*
+ * Per-record callback: fields point into the parse buffer and are valid only
+ * for the duration of the call. line is 1-based. Return false to stop.
+ */
+typedef bool (*sd_csv_callback)(char **fields, int nfields, uint32_t line, void *context);
+
+/*
+ * Stream a CSV file through callback, one record per non-blank line. The file
+ * is read SD_CSV_CHUNK_BYTES at a time by an SD_LineReader and split in place
+ * (no per-line copy); lines may span chunks. Quoted fields ("a,b", "say ""hi""") are unquoted; a
+ * quoted field cannot contain a newline. Fields past SD_CSV_MAX_FIELDS are
+ * dropped. Uses one static buffer: not reentrant. stats may be NULL.
+ */
+int sd_csv_parse(const char *filename, char delim, sd_csv_callback callback, void *context,
+                 SD_CsvStats *stats);
+
+/*
+ * Print the FatFs operation profile (SD_PROFILE_ENABLED): one row per API with
+ * call count, time and the sectors it read/wrote in the FAT, directory and data
+ * regions, then with SD_PROFILE_FILES one "SDPROF,file," row per file opened
+ * by the helpers (bytes, sectors, syncs, time). reset clears the figures
+ * afterwards.
+ */
+void sd_profile_report(bool reset);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // __SD_FUNCTIONS_H__
@@ -0,0 +1,164 @@
+/*
+ * sd_functions.hpp
+ *
+ * Header-only C++ layer over ff.h and sd_functions.h. File and Dir own a FIL
+ * or DIR by value and close it on destruction; they can be moved but not
+ * copied, so a handle has exactly one owner. SectorBuffer<N> is N sectors on
+ * an SD_DMA_ALIGNMENT boundary, and File's SectorBuffer overloads go through
+ * sd_read_aligned/sd_write_aligned, so a transfer that compiles is one the
+ * zero-copy path accepts (the file position still has to be on a sector).
+ * Nothing here allocates or throws; calls return FatFs FRESULT codes.
+ */
+
+#ifndef __SD_FUNCTIONS_HPP__
+#define __SD_FUNCTIONS_HPP__
+
+#include "sd_functions.h"
+#include "sd_spi.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace sd {
+
+static const size_t kSectorBytes = 512U;
+
+/* N whole sectors, aligned for DMA and D-cache maintenance. */
+template <size_t Sectors>
+class SectorBuffer {
+    static_assert(Sectors > 0U, "SectorBuffer needs at least one sector");
+    static_assert((kSectorBytes % SD_DMA_ALIGNMENT) == 0U,
+                  "a sector must be a whole number of DMA alignment units");
+
+public:
+    static const size_t kSectors = Sectors;
+    static const size_t kBytes = Sectors * kSectorBytes;
+
+    uint8_t *data() noexcept { return bytes_; }
+    const uint8_t *data() const noexcept { return bytes_; }
+    static constexpr size_t size() noexcept { return kBytes; }
+    uint8_t &operator[](size_t i) noexcept { return bytes_[i]; }
+    const uint8_t &operator[](size_t i) const noexcept { return bytes_[i]; }
+    uint8_t *sector(size_t n) noexcept { return bytes_ + n * kSectorBytes; }
+    const uint8_t *sector(size_t n) const noexcept { return bytes_ + n * kSectorBytes; }
+
+private:
+    alignas(SD_DMA_ALIGNMENT) uint8_t bytes_[kBytes];
+};
+
+class File {
+public:
+    File() noexcept { memset(&fil_, 0, sizeof(fil_)); }
+    ~File() { (void)close(); }
+
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+
+    /* FatFs keeps no pointer to the FIL itself, so the object can be relocated. */
+    File(File &&other) noexcept {
+        fil_ = other.fil_;
+        other.fil_.obj.fs = nullptr;
+    }
+    File &operator=(File &&other) noexcept {
+        if (this != &other) {
+            (void)close();
+            fil_ = other.fil_;
+            other.fil_.obj.fs = nullptr;
+        }
+        return *this;
+    }
+
+    /* Open path with FA_* mode flags; a file already open here is closed first. */
+    FRESULT open(const char *path, BYTE mode) noexcept {
+        (void)close();
+        return f_open(&fil_, path, mode);
+    }
+
+    /* Close the file; a no-op returning FR_OK when nothing is open. */
+    FRESULT close() noexcept { return is_open() ? f_close(&fil_) : FR_OK; }
+
+    bool is_open() const noexcept { return fil_.obj.fs != nullptr; }
+
+    FRESULT read(void *buff, UINT len, UINT *br) noexcept { return f_read(&fil_, buff, len, br); }
+    FRESULT write(const void *buff, UINT len, UINT *bw) noexcept {
+        return f_write(&fil_, buff, len, bw);
+    }
+
+    /* Whole buffer straight between the card and buff (sd_read_aligned). */
+    template <size_t N>
+    FRESULT read(SectorBuffer<N> &buff, UINT *br) noexcept {
+        return static_cast<FRESULT>(
+            sd_read_aligned(&fil_, buff.data(), static_cast<UINT>(buff.size()), br));
+    }
+
+    /* The first sectors of buff (at most N) straight to the card (sd_write_aligned). */
+    template <size_t N>
+    FRESULT write(const SectorBuffer<N> &buff, size_t sectors, UINT *bw) noexcept {
+        if (sectors == 0U || sectors > N) {
+            return FR_INVALID_PARAMETER;
+        }
+        return static_cast<FRESULT>(sd_write_aligned(
+            &fil_, buff.data(), static_cast<UINT>(sectors * kSectorBytes), bw));
+    }
+    template <size_t N>
+    FRESULT write(const SectorBuffer<N> &buff, UINT *bw) noexcept {
+        return write(buff, N, bw);
+    }
+
+    FRESULT seek(FSIZE_t ofs) noexcept { return f_lseek(&fil_, ofs); }
+    FRESULT sync() noexcept { return f_sync(&fil_); }
+    FRESULT truncate() noexcept { return f_truncate(&fil_); }
+    FSIZE_t tell() const noexcept { return f_tell(&fil_); }
+    FSIZE_t size() const noexcept { return f_size(&fil_); }
+    bool eof() const noexcept { return f_eof(&fil_) != 0; }
+
+    /* The underlying FIL, for calls this class does not wrap. */
+    FIL *native() noexcept { return &fil_; }
+
+private:
+    FIL fil_;
+};
+
+class Dir {
+public:
+    Dir() noexcept { memset(&dir_, 0, sizeof(dir_)); }
+    ~Dir() { (void)close(); }
+
+    Dir(const Dir &) = delete;
+    Dir &operator=(const Dir &) = delete;
+
+    Dir(Dir &&other) noexcept {
+        dir_ = other.dir_;
+        other.dir_.obj.fs = nullptr;
+    }
+    Dir &operator=(Dir &&other) noexcept {
+        if (this != &other) {
+            (void)close();
+            dir_ = other.dir_;
+            other.dir_.obj.fs = nullptr;
+        }
+        return *this;
+    }
+
+    FRESULT open(const char *path) noexcept {
+        (void)close();
+        return f_opendir(&dir_, path);
+    }
+
+    FRESULT close() noexcept { return is_open() ? f_closedir(&dir_) : FR_OK; }
+
+    bool is_open() const noexcept { return dir_.obj.fs != nullptr; }
+
+    /* Next entry; fno.fname[0] == 0 at the end of the directory. */
+    FRESULT read(FILINFO &fno) noexcept { return f_readdir(&dir_, &fno); }
+    FRESULT rewind() noexcept { return f_readdir(&dir_, nullptr); }
+
+    DIR *native() noexcept { return &dir_; }
+
+private:
+    DIR dir_;
+};
+
+} // namespace sd
+
+#endif /* __SD_FUNCTIONS_HPP__ */
@@ -0,0 +1,111 @@
+/*
+ * sd_fwload.h
+ *
+ * Streaming loader for firmware and asset images: SD_FwLoad reads a file in
+ * SD_FWLOAD_CHUNK pieces into two aligned buffers and hands each one to a
+ * program callback (typically HAL_FLASH_Program into internal flash), with a
+ * CRC-32 over the image updated as each piece arrives.
+ *
+ * The file's cluster runs come from the FatFs fast-seek link map, so a piece
+ * is one multi-block read (CMD18) of its run, cut short where the run ends.
+ * Under FreeRTOS, with the SD I/O task started (SD_AsyncStart), the read of
+ * the next piece is queued to that task before the current one is
+ * programmed: the card streams it into the other buffer by DMA while the
+ * flash is busy. Without it the pieces are read and programmed in turn. A
+ * file with more runs than SD_FWLOAD_MAP_ENTRIES describes is read with
+ * f_read instead, one cluster per read.
+ *
+ * The CRC is a sd_crc32.h stream, so it runs on the STM32 CRC unit when one
+ * is registered with SD_Crc32SetUnit (and fed by DMA with SD_CRC32_DMA), and
+ * in software otherwise; SD_Crc32 gives the same value on a PC.
+ *
+ * The file must not be written while it loads: with the read-ahead queued
+ * to the I/O task, pieces are read from the card behind FatFs, after one
+ * CTRL_SYNC has written back the sector cache. One load runs at a time; the
+ * two buffers (2 * SD_FWLOAD_CHUNK bytes) are static.
+ */
+
+#ifndef __SD_FWLOAD_H__
+#define __SD_FWLOAD_H__
+
+#include "sd_config.h"
+#include "main.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes per piece; each of the two buffers is this large. A multiple of _MAX_SS. */
+#ifndef SD_FWLOAD_CHUNK
+#define SD_FWLOAD_CHUNK 8192U
+#endif
+
+/* DWORDs of the fast-seek link map: (SD_FWLOAD_MAP_ENTRIES - 2) / 2 runs. */
+#ifndef SD_FWLOAD_MAP_ENTRIES
+#define SD_FWLOAD_MAP_ENTRIES 32U
+#endif
+
+/* Longest wait for one queued read to complete. */
+#ifndef SD_FWLOAD_TIMEOUT_MS
+#define SD_FWLOAD_TIMEOUT_MS 1000U
+#endif
+
+#if (SD_FWLOAD_CHUNK < 512U) || ((SD_FWLOAD_CHUNK % 512U) != 0U) || (SD_FWLOAD_MAP_ENTRIES < 4U)
+#error "SD_FWLOAD_CHUNK must be a multiple of 512 and SD_FWLOAD_MAP_ENTRIES at least 4"
+#endif
+
+/* Where the expected CRC comes from. */
+typedef enum {
+    SD_FWLOAD_CRC_NONE = 0, // Computed and reported, not checked
+    SD_FWLOAD_CRC_GIVEN,    // SD_FwLoadConfig.crc
+    SD_FWLOAD_CRC_TRAILER,  // Last 4 bytes of the file, little-endian; not programmed
+} SD_FwCrcMode;
+
+/*
+ * Program len bytes of the image at offset (from 0). Pieces arrive in order;
+ * all but the last are whole multiples of 512 bytes. data stays valid until
+ * the callback returns. Return false to stop the load.
+ */
+typedef bool (*SD_FwProgram)(void *context, uint32_t offset, const uint8_t *data, uint32_t len);
+
+typedef struct {
+    SD_FwProgram program; // NULL = verify only: read and CRC, nothing programmed
+    void *context;        // Passed to program
+    SD_FwCrcMode crc_mode;
+    uint32_t crc;         // Expected CRC for SD_FWLOAD_CRC_GIVEN
+    uint32_t max_bytes;   // Largest image accepted, e.g. the flash region (0 = any)
+} SD_FwLoadConfig;
+
+typedef struct {
+    uint32_t image_bytes; // Bytes programmed (the file, less a CRC trailer)
+    uint32_t chunks;      // Pieces read
+    uint32_t overlapped;  // Of those, read by the I/O task while the previous was programmed
+    uint32_t runs;        // Cluster runs of the file (0 when read with f_read)
+    uint32_t crc;         // CRC computed over the image
+    uint32_t elapsed_ms;
+} SD_FwLoadStats;
+
+/**
+ * @brief Stream an image from a file through the program callback
+ * @param path File to load
+ * @param cfg Callback and CRC check
+ * @param stats Filled in as far as the load got; may be NULL
+ * @return FR_OK; FR_INVALID_PARAMETER for a bad cfg, a file larger than
+ *         cfg->max_bytes or a trailer-mode file under 4 bytes; FR_DENIED if
+ *         the callback stopped the load; FR_INT_ERR if the CRC does not
+ *         match (every piece has already gone to the callback); FR_TIMEOUT
+ *         if a queued read did not complete; else the FatFs or disk error
+ *
+ * Note: A mismatch is only known at the end, so check with program = NULL
+ * first when the flash must not be erased for a bad image.
+ */
+FRESULT SD_FwLoad(const char *path, const SD_FwLoadConfig *cfg, SD_FwLoadStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_FWLOAD_H__ */
@@ -0,0 +1,50 @@
+/*
+ * sd_lfn.h
+ *
+ * Faster case folding for FatFs long file names. With _USE_LFN, every name
+ * compare (cmp_lfn, and create_name for each path element) folds both sides
+ * one character at a time through ff_wtoupper. The ccsbcs.c version walks a
+ * compressed table of Unicode blocks on every call, even for ASCII. With
+ * SD_LFN_FAST_UPPER 1 this module supplies __wrap_ff_wtoupper: ASCII and
+ * Latin-1, which cover most of code page 850, are folded arithmetically and
+ * anything else goes to the original. Link with -Wl,--wrap=ff_wtoupper (Drivers/sd_card
+ * CMakeLists.txt adds it when SD_LFN_FAST_UPPER is set) so ff.c's calls
+ * resolve here without editing ff.c or ccsbcs.c.
+ *
+ * Numbered short names: a long name that is not valid 8.3 needs a unique
+ * "NAME~N" alias. ff.c's dir_register tries ~1 to ~5, then hashed tails
+ * (CRC of the long name), and scans the directory for each try. Once
+ * ~1..~5 are taken, a create reads the directory several times over (4-5x
+ * the sectors of an 8.3 create in tests/test_sd_lfn.c). Names that already
+ * are valid 8.3 (case may differ, e.g. "log01234.csv") skip alias generation
+ * and cost one scan. Prefer them in directories that collect many logs.
+ */
+
+#ifndef __SD_LFN_H__
+#define __SD_LFN_H__
+
+#include "sd_config.h"
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Provide __wrap_ff_wtoupper (needs -Wl,--wrap=ff_wtoupper; 0 = off). */
+#ifndef SD_LFN_FAST_UPPER
+#define SD_LFN_FAST_UPPER 0
+#endif
+
+#if SD_LFN_FAST_UPPER
+/* Same result as ff_wtoupper for every chr; U+0000..U+00FF without a table walk. */
+WCHAR __wrap_ff_wtoupper(WCHAR chr);
+
+/* The ccsbcs.c version, reached through the linker wrap. */
+WCHAR __real_ff_wtoupper(WCHAR chr);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_LFN_H__ */
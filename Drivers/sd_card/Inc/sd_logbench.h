@@ -0,0 +1,134 @@
+/*
+ * sd_logbench.h
+ *
+ * Tail-latency benchmark for sustained logging under contention. A producer
+ * writes fixed-size records to sd_logger at a fixed rate while competing
+ * loads share the card and the CPU: a UI reader pulling an asset file in
+ * chunks, a stat poller (f_stat of the log and the asset) and an LED task
+ * that only toggles a pin and measures how late it runs. Each record's
+ * latency runs from its scheduled production time to the moment the logger
+ * has written the bytes holding it to the card. The result gives
+ * percentiles, the maximum, the records the ring had to drop, and the worst
+ * delay each competing load saw.
+ *
+ * Under FreeRTOS every load is a task of its own next to the logger task,
+ * and commits are checked by the calling task once per tick. Without it the
+ * run is a cooperative loop calling sd_logger_poll every SD_LOGGER_POLL_MS:
+ * records that fall due while a competing call runs are stamped with their
+ * due time, as a preempting producer would have been, and commits are
+ * checked right after each poll. Time comes from the DWT cycle counter, so
+ * the host simulator (tests/sd_host_logbench.c) runs it in simulated time.
+ *
+ * Latency is tracked for uncompressed logs only (SD_LOGGER_COMPRESS 0); with
+ * compression every accepted record counts as unmeasured.
+ */
+
+#ifndef __SD_LOGBENCH_H__
+#define __SD_LOGBENCH_H__
+
+#include "sd_logger.h"
+#include "sd_spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Records awaiting their commit at once (power of two); later ones go unmeasured. */
+#ifndef SD_LOGBENCH_PENDING
+#define SD_LOGBENCH_PENDING 1024U
+#endif
+
+#if (SD_LOGBENCH_PENDING & (SD_LOGBENCH_PENDING - 1U)) != 0U
+#error "SD_LOGBENCH_PENDING must be a power of two"
+#endif
+
+/* Stack depth in words of each benchmark task (FreeRTOS builds). */
+#ifndef SD_LOGBENCH_TASK_STACK
+#define SD_LOGBENCH_TASK_STACK 384U
+#endif
+
+/* Producer and LED tasks run above the logger, the UI and stat tasks below it. */
+#ifndef SD_LOGBENCH_PRODUCER_PRIORITY
+#define SD_LOGBENCH_PRODUCER_PRIORITY (SD_LOGGER_TASK_PRIORITY + 2U)
+#endif
+
+#ifndef SD_LOGBENCH_LED_PRIORITY
+#define SD_LOGBENCH_LED_PRIORITY (SD_LOGGER_TASK_PRIORITY + 1U)
+#endif
+
+#ifndef SD_LOGBENCH_LOAD_PRIORITY
+#define SD_LOGBENCH_LOAD_PRIORITY (tskIDLE_PRIORITY + 1U)
+#endif
+
+/* Latency histogram: four buckets per power of two of microseconds. */
+#define SD_LOGBENCH_BUCKETS 128U
+
+typedef struct {
+    const char *path;          // Log file, appended to; the logger must be stopped
+    uint32_t duration_ms;      // Production time; the logger is flushed after it
+    uint32_t record_bytes;     // 8..SD_LOGGER_MAX_RECORD
+    uint32_t record_period_ms; // Producer period, >= 1
+    const char *ui_path;       // Asset file the UI reads; created when shorter than ui_file_bytes
+    uint32_t ui_file_bytes;    // Size of the asset file
+    uint32_t ui_period_ms;     // 0 = no UI reader
+    uint32_t ui_read_bytes;    // Per UI read, at most 4096
+    uint32_t stat_period_ms;   // 0 = no stat polling
+    uint32_t led_period_ms;    // 0 = no LED task
+    GPIO_TypeDef *led_port;    // Pin toggled by the LED task; NULL = timing only
+    uint16_t led_pin;
+} SD_LogBenchConfig;
+
+typedef struct {
+    uint32_t records;       // Records produced
+    uint32_t dropped;       // Rejected by sd_logger_write (ring full)
+    uint32_t committed;     // Measured: seen on the card
+    uint32_t unmeasured;    // Accepted but not timed (pending list full, or compressed log)
+    uint32_t p50_us;        // Percentiles are bucket upper bounds (within 25 %)
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t p999_us;
+    uint32_t max_us;        // Exact
+    uint32_t ui_reads;
+    uint32_t ui_max_us;     // Longest UI read
+    uint32_t stat_polls;
+    uint32_t stat_max_us;   // Longest stat poll
+    uint32_t led_toggles;
+    uint32_t led_late_max_us; // Latest LED wake-up past its period
+    uint32_t load_errors;   // Failed FatFs calls of the competing loads
+    uint32_t hist[SD_LOGBENCH_BUCKETS]; // Record latencies by sd_logbench_bucket_us
+    int logger_error;       // SD_LoggerStats.last_error at the end
+} SD_LogBenchResult;
+
+/* Defaults: 10 s, 64-byte records every 5 ms, 4 KB UI reads every 50 ms, stats every 200 ms, LED 10 ms. */
+void sd_logbench_defaults(SD_LogBenchConfig *cfg);
+
+/**
+ * @brief Run the benchmark
+ * @param cfg Configuration (the volume must be mounted)
+ * @param out Result
+ * @return FR_OK; FR_INVALID_PARAMETER for a bad configuration; FR_LOCKED if
+ *         the logger is running; the FRESULT of a failing logger start or of
+ *         creating the UI file; FR_NOT_ENOUGH_CORE if a task cannot be created
+ *
+ * Note: Blocks for duration_ms plus the final flush. Task context only; under
+ * FreeRTOS the calling task must not be one the benchmark tasks starve.
+ */
+int sd_logbench_run(const SD_LogBenchConfig *cfg, SD_LogBenchResult *out);
+
+/* Upper bound in microseconds of histogram bucket b. */
+uint32_t sd_logbench_bucket_us(uint32_t b);
+
+/*
+ * Print "SDLOGBENCH,records,dropped,committed,unmeasured,p50_us,p90_us,
+ * p99_us,p999_us,max_us" and "SDLOGBENCH,loads,ui_reads,ui_max_us,
+ * stat_polls,stat_max_us,led_toggles,led_late_max_us,load_errors" lines.
+ */
+void sd_logbench_print(const SD_LogBenchResult *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_LOGBENCH_H__ */
@@ -0,0 +1,531 @@
+/*
+ * sd_logger.h
+ *
+ * Streaming data logger. Producers in any task or ISR append records to a
+ * lock-free RAM ring; the logger (its own task under FreeRTOS, or
+ * sd_logger_poll from the main loop) moves the ring into an aligned chunk
+ * buffer and writes whole chunks with f_write, so the file stays open and
+ * every write is one cluster-aligned CMD25 run. f_sync runs on an interval.
+ *
+ * sd_logger_start_raw logs to a block region outside the FAT volume instead
+ * (see SD_FormatOptions.raw_sectors): chunks go to the card with
+ * SD_WriteMultiBlocks, and each sync rewrites the region's header block as the
+ * checkpoint. The region is a ring; the oldest data is overwritten. Layout,
+ * for host tools reading the card directly (all fields little-endian):
+ *
+ *   block first_block     header: "SDRL" magic @0, version 1 @4, first_block
+ *                         @8, blocks @12, stream bytes written (u64) @16,
+ *                         checkpoint count @24, CRC-32 (IEEE) of bytes 0..27 @28
+ *   blocks after it       stream byte p at block first_block + 1 +
+ *                         (p / 512) % (blocks - 1), offset p % 512
+ *
+ * Bytes from max(0, (p_block - (blocks - 1) + 1) * 512) up to the written
+ * count are valid, p_block being written / 512; data after the last
+ * checkpoint is lost on a power cut.
+ *
+ * With SD_LOGGER_COMPRESS 1 the logged bytes pass through an LZ compressor
+ * before the chunk buffer. Every SD_LOGGER_COMPRESS_BLOCK input bytes (fewer
+ * at a sync or stop) become one block that decodes on its own:
+ *
+ *   u16 stored length @0 (bit 15 set: payload stored uncompressed)
+ *   u16 raw length @2
+ *   payload: an LZ4 block (lz4 "block format", no frame) or the raw bytes
+ *
+ * sd_logger_unpack decodes one block; so does any LZ4 block decoder.
+ *
+ * sd_logger_set_index adds a sidecar index file to file-mode logs: one 8-byte
+ * entry for every Nth record, key (u32, e.g. the record's timestamp) @0 and
+ * the record's byte offset in the log (u32) @4, little-endian. Keys are
+ * expected not to decrease. Entries go to the index after the chunk that
+ * holds their record is written, and are synced after the log.
+ *
+ * With SD_LOGGER_CHANNELS > 0 every producer can have a channel of its own: a
+ * single-producer ring that needs no CAS, written with
+ * sd_logger_channel_write. The logger merges the shared ring and then each
+ * channel into the one log, and every record in the file gets a tag in front:
+ *
+ *   u32 tag: channel (0xFF for the shared ring) in bits 24..31, payload
+ *            length in bits 0..23; then the payload, unpadded
+ *
+ * Records keep their order within a channel, not across channels.
+ *
+ * With SD_LOGGER_INGRESS_BYTES > 0 (FreeRTOS builds) sd_logger_send queues
+ * records in a FreeRTOS message buffer whose trigger level is one chunk. The
+ * logger task then sleeps in the buffer instead of waking every
+ * SD_LOGGER_POLL_MS: it runs when a chunk's worth of messages is waiting, or
+ * after SD_LOGGER_INGRESS_WAIT_MS so syncs keep their interval.
+ *
+ * With SD_LOGGER_RESUME 1 and a backup store (sd_logger_set_backup, e.g. RTC
+ * backup registers), every full sync of a file leaves a checkpoint of
+ * SD_LOGGER_BACKUP_WORDS words: "SDLC" magic, CRC-32 of the path, start
+ * cluster, last cluster, file size, checkpoint sequence number and a CRC-32
+ * of the six words before it. sd_logger_start on the same file after a reset
+ * then appends from the checkpoint instead of following the cluster chain to
+ * the end, once the directory entry (start cluster, size) agrees and the
+ * FAT marks the checkpoint's cluster as the end of the chain (FAT16/FAT32).
+ */
+
+#ifndef __SD_LOGGER_H__
+#define __SD_LOGGER_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+#include "sd_spi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Producer ring capacity in bytes (power of two). */
+#ifndef SD_LOGGER_RING_BYTES
+#define SD_LOGGER_RING_BYTES 16384U
+#endif
+
+/* Bytes per f_write; set to the volume's cluster size (multiple of 512). */
+#ifndef SD_LOGGER_CHUNK_BYTES
+#define SD_LOGGER_CHUNK_BYTES 4096U
+#endif
+
+/*
+ * Size and align chunks to the card's recording unit (needs SD_CARD_INFO).
+ * Speed-class write performance is only specified for writes that fill
+ * whole units in order: 16 KiB for Class 2/4/6, 512 KiB for Class 10, UHS
+ * and video classes. At each start the chunk becomes the largest power of
+ * two no bigger than SD_LOGGER_CHUNK_BYTES, the unit and (file mode) the
+ * cluster, so whole chunks tile the unit; raw mode places chunk boundaries
+ * on card addresses rather than stream offsets. A card without a speed
+ * class keeps SD_LOGGER_CHUNK_BYTES.
+ */
+#ifndef SD_LOGGER_CARD_UNITS
+#define SD_LOGGER_CARD_UNITS 0
+#endif
+
+/*
+ * With SD_LOGGER_CARD_UNITS, take the unit from the card's applied
+ * sd_cardprof profile when there is one: its write_blocks, the shortest
+ * CMD25 run that reached the card's sequential speed. Cards without an
+ * applied profile keep the speed-class unit. Links sd_cardprof.c.
+ */
+#ifndef SD_LOGGER_CARD_PROFILE
+#define SD_LOGGER_CARD_PROFILE 0
+#endif
+
+/* Largest single record accepted by sd_logger_write. */
+#ifndef SD_LOGGER_MAX_RECORD
+#define SD_LOGGER_MAX_RECORD 256U
+#endif
+
+/* Maximum time between f_sync calls while data is pending (0 = only on flush/stop). */
+#ifndef SD_LOGGER_SYNC_MS
+#define SD_LOGGER_SYNC_MS 1000U
+#endif
+
+/*
+ * Shortest time between directory-entry commits (0 = every sync is a full
+ * f_sync). Syncs in between only write data and FAT with sd_sync_data
+ * (sd_commit.h, which describes what a power cut then leaves behind), or
+ * only data with sd_flush_data_only when the file was preallocated.
+ */
+#ifndef SD_LOGGER_COMMIT_MS
+#define SD_LOGGER_COMMIT_MS 0U
+#endif
+
+/* Contiguous space reserved with sd_preallocate_file at start (0 = append, no reservation). */
+#ifndef SD_LOGGER_PREALLOC_BYTES
+#define SD_LOGGER_PREALLOC_BYTES 0U
+#endif
+
+/* Logger task wake-up period (FreeRTOS builds). */
+#ifndef SD_LOGGER_POLL_MS
+#define SD_LOGGER_POLL_MS 10U
+#endif
+
+/* Message-buffer ingress for sd_logger_send (FreeRTOS builds; 0 = off, the task polls). */
+#ifndef SD_LOGGER_INGRESS_BYTES
+#define SD_LOGGER_INGRESS_BYTES 0U
+#endif
+
+/* Longest sleep of the logger task on the ingress before it syncs and drains anyway. */
+#ifndef SD_LOGGER_INGRESS_WAIT_MS
+#define SD_LOGGER_INGRESS_WAIT_MS SD_LOGGER_SYNC_MS
+#endif
+
+/* Checkpoint the append position in a backup store for O(1) restarts (0 = off). */
+#ifndef SD_LOGGER_RESUME
+#define SD_LOGGER_RESUME 0
+#endif
+
+/* Backup words one checkpoint takes. */
+#define SD_LOGGER_BACKUP_WORDS 7U
+
+/* Logger task stack depth in words. */
+#ifndef SD_LOGGER_TASK_STACK
+#define SD_LOGGER_TASK_STACK 512U
+#endif
+
+#ifndef SD_LOGGER_TASK_PRIORITY
+#define SD_LOGGER_TASK_PRIORITY (tskIDLE_PRIORITY + 1U)
+#endif
+
+/* Logger-owned buffers handed out by sd_logger_buf_get (0 = no pool, at most 32). */
+#ifndef SD_LOGGER_ISR_BUFS
+#define SD_LOGGER_ISR_BUFS 0U
+#endif
+
+#ifndef SD_LOGGER_ISR_BUF_BYTES
+#define SD_LOGGER_ISR_BUF_BYTES 512U
+#endif
+
+/* LZ compression stage between the ring and the chunk buffer (0 = off). */
+#ifndef SD_LOGGER_COMPRESS
+#define SD_LOGGER_COMPRESS 0
+#endif
+
+/* Input bytes per independently decodable block; also the match window. */
+#ifndef SD_LOGGER_COMPRESS_BLOCK
+#define SD_LOGGER_COMPRESS_BLOCK 2048U
+#endif
+
+/* Match finder: 2^bits two-byte entries. */
+#ifndef SD_LOGGER_COMPRESS_HASH_BITS
+#define SD_LOGGER_COMPRESS_HASH_BITS 10U
+#endif
+
+#if (SD_LOGGER_COMPRESS_BLOCK < 16U) || (SD_LOGGER_COMPRESS_BLOCK > 32767U)
+#error "SD_LOGGER_COMPRESS_BLOCK must be between 16 and 32767"
+#endif
+
+#if (SD_LOGGER_COMPRESS_HASH_BITS < 8U) || (SD_LOGGER_COMPRESS_HASH_BITS > 16U)
+#error "SD_LOGGER_COMPRESS_HASH_BITS must be between 8 and 16"
+#endif
+
+/* Index entries buffered before they are written to the sidecar file. */
+#ifndef SD_LOGGER_INDEX_ENTRIES
+#define SD_LOGGER_INDEX_ENTRIES 32U
+#endif
+
+/* Single-producer channels merged into the log as tagged records (0 = off, at most 255). */
+#ifndef SD_LOGGER_CHANNELS
+#define SD_LOGGER_CHANNELS 0U
+#endif
+
+/* Ring bytes per channel (power of two). */
+#ifndef SD_LOGGER_CHANNEL_BYTES
+#define SD_LOGGER_CHANNEL_BYTES 2048U
+#endif
+
+#if (SD_LOGGER_CHANNELS > 255U)
+#error "SD_LOGGER_CHANNELS must not exceed 255"
+#endif
+
+#if (SD_LOGGER_CHANNEL_BYTES & (SD_LOGGER_CHANNEL_BYTES - 1U)) != 0U
+#error "SD_LOGGER_CHANNEL_BYTES must be a power of two"
+#endif
+
+/* Channel of records from the shared ring in a tagged log. */
+#define SD_LOGGER_SHARED_CHANNEL 0xFFU
+
+/* Bytes in front of every compressed block. */
+#define SD_LOGGER_BLOCK_HEADER 4U
+
+#if (SD_LOGGER_ISR_BUFS > 32U)
+#error "SD_LOGGER_ISR_BUFS must not exceed 32"
+#endif
+
+#if (SD_LOGGER_RING_BYTES & (SD_LOGGER_RING_BYTES - 1U)) != 0U
+#error "SD_LOGGER_RING_BYTES must be a power of two"
+#endif
+
+#if (SD_LOGGER_CHUNK_BYTES == 0U) || ((SD_LOGGER_CHUNK_BYTES % 512U) != 0U)
+#error "SD_LOGGER_CHUNK_BYTES must be a non-zero multiple of 512"
+#endif
+
+#if SD_LOGGER_CARD_UNITS && (SD_CARD_INFO != 1)
+#error "SD_LOGGER_CARD_UNITS needs SD_CARD_INFO"
+#endif
+
+#if SD_LOGGER_CARD_PROFILE && !SD_LOGGER_CARD_UNITS
+#error "SD_LOGGER_CARD_PROFILE needs SD_LOGGER_CARD_UNITS"
+#endif
+
+typedef struct {
+    uint32_t records;         // Records accepted
+    uint32_t bytes;           // Payload bytes accepted
+    uint32_t dropped_records; // Records rejected because the ring was full
+    uint32_t dropped_bytes;
+    uint32_t ring_high_water; // Most ring bytes ever in use (including headers)
+    uint32_t chunks;          // f_write calls issued
+    uint32_t syncs;           // f_sync calls issued
+    uint32_t data_syncs;      // Of those, data/FAT-only syncs (SD_LOGGER_COMMIT_MS)
+    uint32_t file_bytes;      // Bytes written to the file
+    uint32_t buffers;         // Records queued by reference (sd_logger_push_from_isr)
+    uint32_t direct_bytes;    // Bytes written straight from producer buffers (no copy)
+    uint32_t pool_empty;      // sd_logger_buf_get calls that found no free buffer
+    uint32_t pool_high_water; // Most pool buffers ever out at once
+    uint32_t compress_blocks; // Blocks emitted by the compression stage
+    uint32_t compress_stored; // Blocks kept uncompressed because LZ did not shrink them
+    uint32_t compress_in;     // Bytes fed to the compressor
+    uint32_t compress_out;    // Bytes it emitted, block headers included (ratio = in / out)
+    uint64_t compress_cycles; // DWT cycles compressing (SD_PROFILE_ENABLED; throughput = in / time)
+    uint32_t index_entries;   // Entries written to the sidecar index
+    uint32_t checkpoint_seq;  // Sequence number of the last backup checkpoint (SD_LOGGER_RESUME)
+    uint32_t resumed;         // 1 if the start appended from a backup checkpoint
+    uint32_t chunk_bytes;     // Chunk size of this session
+    uint32_t unit_bytes;      // Recording unit it was sized to (SD_LOGGER_CARD_UNITS; 0 = none)
+    uint32_t unit_aligned;    // 1 if chunks start on card addresses that are chunk multiples (SD_LOGGER_CARD_UNITS)
+    int last_error;           // Last failing FRESULT (FR_OK if none)
+} SD_LoggerStats;
+
+/* Per-channel counters (sd_logger_get_channel_stats). */
+typedef struct {
+    uint32_t records;         // Records accepted
+    uint32_t bytes;           // Payload bytes accepted
+    uint32_t dropped_records; // Records rejected because the channel ring was full
+    uint32_t high_water;      // Most ring bytes ever in use (including headers)
+} SD_LoggerChannelStats;
+
+/* One sidecar index entry (sd_logger_set_index). */
+typedef struct {
+    uint32_t key;
+    uint32_t offset; // Byte offset of the record in the log file
+} SD_LoggerIndexEntry;
+
+/* Key of an indexed record, e.g. its timestamp; record is contiguous, len bytes. */
+typedef uint32_t (*sd_logger_key_fn)(const void *record, uint32_t len, void *context);
+
+/* Word storage that survives a reset (SD_LOGGER_RESUME); index 0..SD_LOGGER_BACKUP_WORDS - 1. */
+typedef struct {
+    uint32_t (*read)(uint32_t index, void *context);
+    void (*write)(uint32_t index, uint32_t value, void *context);
+    void *context;
+} SD_LoggerBackup;
+
+/* Header of a raw region (sd_logger_raw_info). */
+typedef struct {
+    uint64_t total;       // Stream bytes written up to the last checkpoint
+    uint64_t oldest;      // First stream byte not yet overwritten
+    uint32_t checkpoints; // Header writes since the region was started
+} SD_LoggerRawInfo;
+
+/**
+ * @brief Open the log file and start accepting records
+ * @param path File to log to; appended to (or preallocated, see SD_LOGGER_PREALLOC_BYTES)
+ * @return FR_OK, or the FRESULT of the failing open/seek; FR_LOCKED if already running
+ *
+ * Note: The volume must be mounted. Under FreeRTOS this also creates the
+ * logger task on first use. Task context only.
+ */
+int sd_logger_start(const char *path);
+
+/**
+ * @brief sd_logger_start, with a header at the start of a new file
+ * @param header Bytes written before the first record when the file is new,
+ *        empty or preallocated; an existing file is appended to as it is
+ * @param len Header bytes (0 = none, as sd_logger_start)
+ *
+ * Note: The header is one f_write before the logger runs; the chunks after
+ * it are shortened to get back onto chunk boundaries.
+ */
+int sd_logger_start_with_header(const char *path, const void *header, uint32_t len);
+
+/**
+ * @brief Keep a sidecar index for the logs started after this call
+ * @param index_path Index file (NULL = no index); kept by pointer, so it must stay valid
+ * @param every Index one record in every records (the first one included)
+ * @param key Key of an indexed record; NULL uses HAL_GetTick() when the logger
+ *        moves it (within SD_LOGGER_POLL_MS of when it was logged)
+ * @param context Passed to key
+ * @return FR_OK; FR_LOCKED while running; FR_INVALID_PARAMETER for every 0;
+ *         FR_DENIED with SD_LOGGER_COMPRESS (offsets would fall inside blocks)
+ *
+ * Note: A record queued with sd_logger_push_from_isr counts as one record.
+ * The index is recreated along with a new (or preallocated) log file and
+ * appended to otherwise. sd_logger_start_raw does not use it. Task context only.
+ */
+int sd_logger_set_index(const char *index_path, uint32_t every, sd_logger_key_fn key,
+                        void *context);
+
+/**
+ * @brief Seek a log to the last indexed record at or before key
+ * @param log Log file opened with FA_READ (ideally through sd_fastseek_open,
+ *        so the seek jumps straight to the cluster)
+ * @param index Its sidecar index, opened with FA_READ
+ * @param entry Receives the entry used (may be NULL)
+ * @return FR_OK, FR_NO_FILE if the index has no entry inside the log, or the
+ *         failing FRESULT
+ *
+ * Note: A binary search, one 8-byte read per step. A key before the first
+ * entry seeks to the first entry. Entries past the end of the log (a power
+ * cut between the two syncs) are ignored. Read forward from the new position
+ * to find the exact record. Task context only.
+ */
+int sd_logger_index_seek(FIL *log, FIL *index, uint32_t key, SD_LoggerIndexEntry *entry);
+
+/**
+ * @brief Keep the append position of file logs in a backup store
+ * @param backup Store (copied); NULL stops checkpointing
+ *
+ * Note: Without SD_LOGGER_RESUME this does nothing. Preallocated and raw
+ * logs are not checkpointed. A checkpoint that does not match the file is
+ * ignored, and the start seeks to the end as usual. Task context only.
+ */
+void sd_logger_set_backup(const SD_LoggerBackup *backup);
+
+#if defined(HAL_RTC_MODULE_ENABLED)
+/* Use RTC backup registers first_reg.. first_reg + SD_LOGGER_BACKUP_WORDS - 1 (backup access enabled). */
+void sd_logger_use_rtc_backup(RTC_HandleTypeDef *hrtc, uint32_t first_reg);
+#endif
+
+/**
+ * @brief Start accepting records for a raw block region
+ * @param sd Card handle (e.g. SD_DiskHandle(pdrv))
+ * @param first_block First 512-byte block of the region; holds the header
+ * @param blocks Blocks in the region, header included (at least 2)
+ * @return FR_OK, FR_INVALID_PARAMETER, FR_DISK_ERR, or FR_LOCKED if already running
+ *
+ * Note: A region with a valid header continues after its last checkpoint;
+ * otherwise a new header is written. Keep FatFs off the region with
+ * SD_DiskSetSectorLimit. The chunk size and sync interval are the file
+ * mode's; sd_logger_stop writes the final checkpoint. Task context only.
+ */
+int sd_logger_start_raw(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks);
+
+/* Read the header of a raw region; FR_NO_FILESYSTEM if it has none (task context). */
+int sd_logger_raw_info(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks,
+                       SD_LoggerRawInfo *info);
+
+/**
+ * @brief Read logged bytes back from a raw region (task context)
+ * @param offset Stream offset, from info.oldest to info.total
+ * @param buf Receives up to len bytes
+ * @param got Receives the bytes read (short at the last checkpoint)
+ * @return FR_OK, FR_NO_FILE if offset was overwritten or is past the end,
+ *         FR_NO_FILESYSTEM, or FR_DISK_ERR
+ *
+ * Note: Only data up to the last checkpoint is visible, also while the
+ * logger is running on the region.
+ */
+int sd_logger_raw_read(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks, uint64_t offset,
+                       void *buf, uint32_t len, uint32_t *got);
+
+/**
+ * @brief Append one record (any task or ISR)
+ * @param data Record bytes, written to the file unchanged
+ * @param len 1..SD_LOGGER_MAX_RECORD
+ * @return true if queued, false if the logger is stopped or the ring is full
+ *
+ * Note: Never blocks. Rejected records are counted in dropped_records.
+ */
+bool sd_logger_write(const void *data, uint32_t len);
+
+/**
+ * @brief Append one record to a channel (its one producer task or ISR only)
+ * @param channel 0..SD_LOGGER_CHANNELS - 1, each owned by a single producer
+ * @param data Record bytes, written to the file behind a tag
+ * @param len 1..SD_LOGGER_MAX_RECORD
+ * @return true if queued, false if stopped, the channel is full or out of range
+ *
+ * Note: Never blocks, and shares nothing with other producers: no CAS, no
+ * common counters. Two producers on one channel corrupt it.
+ */
+bool sd_logger_channel_write(uint32_t channel, const void *data, uint32_t len);
+
+/**
+ * @brief Split the next record off a tagged log
+ * @param buf, len Log bytes starting at a tag
+ * @param channel Receives the channel (SD_LOGGER_SHARED_CHANNEL for the shared ring)
+ * @param payload Receives the record's first byte
+ * @param payload_len Receives its length
+ * @return Bytes to step to the next tag, or 0 if the record is not all in buf
+ *
+ * Note: Any context; needs no other logger state.
+ */
+uint32_t sd_logger_tag_next(const uint8_t *buf, uint32_t len, uint32_t *channel,
+                            const uint8_t **payload, uint32_t *payload_len);
+
+/**
+ * @brief Append one record through the message-buffer ingress (any task or ISR)
+ * @param data Record bytes, written to the file unchanged (tagged as the shared ring's)
+ * @param len 1..SD_LOGGER_MAX_RECORD
+ * @return true if queued; false if stopped, the ingress is full, or the build
+ *         has no ingress (SD_LOGGER_INGRESS_BYTES 0 or no FreeRTOS)
+ *
+ * Note: Never blocks. Senders are serialised with a short critical section
+ * around the copy, as FreeRTOS requires for several writers; a send that
+ * reaches the trigger level wakes the logger task. Records sent this way and
+ * with sd_logger_write are not ordered against each other.
+ */
+bool sd_logger_send(const void *data, uint32_t len);
+
+/* Returns a buffer passed to sd_logger_push_from_isr once its bytes are in the file. */
+typedef void (*sd_logger_release_fn)(void *buf, void *context);
+
+/**
+ * @brief Queue a buffer by reference (any task or ISR, e.g. ADC DMA complete)
+ * @param buf Bytes to log; owned by the logger until released
+ * @param len Bytes in buf (any size)
+ * @param release Called from the logger task after the bytes are written;
+ *        NULL returns buf to the logger pool (it must come from sd_logger_buf_get)
+ * @param context Passed to release
+ * @return true if queued; false if stopped or the ring is full (caller keeps buf)
+ *
+ * Note: Never blocks or copies; only a small descriptor enters the ring, in
+ * order with sd_logger_write records. Chunk-aligned runs go to f_write
+ * straight from buf.
+ */
+bool sd_logger_push_from_isr(void *buf, uint32_t len, sd_logger_release_fn release,
+                             void *context);
+
+/* Take a free SD_LOGGER_ISR_BUF_BYTES pool buffer (any task or ISR); NULL if none. */
+void *sd_logger_buf_get(void);
+
+/* Give back a pool buffer that was not pushed (any task or ISR). */
+void sd_logger_buf_put(void *buf);
+
+/**
+ * @brief Move queued records to the file (task context)
+ * @return FR_OK or the failing FRESULT
+ *
+ * Note: Writes only whole chunks, plus a partial one when the sync interval
+ * has elapsed. Called by the logger task; without FreeRTOS call it from the
+ * main loop.
+ */
+int sd_logger_poll(void);
+
+/* Write everything queued so far and f_sync (task context). */
+int sd_logger_flush(void);
+
+/* Flush, then trim and close the file or checkpoint the raw region (task context). */
+int sd_logger_stop(void);
+
+/* True between a successful sd_logger_start and sd_logger_stop. */
+bool sd_logger_running(void);
+
+/**
+ * @brief Decode one block written by the compression stage
+ * @param in Block, starting at its header
+ * @param in_len Bytes available at in
+ * @param out Receives the raw bytes
+ * @param out_cap Size of out (SD_LOGGER_COMPRESS_BLOCK always suffices)
+ * @param used Receives the block's size in in (header included), to step to the next
+ * @param out_len Receives the raw length
+ * @return FR_OK, or FR_INT_ERR for a truncated or malformed block
+ *
+ * Note: Any context; needs no other logger state or SD_LOGGER_COMPRESS.
+ */
+int sd_logger_unpack(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_cap,
+                     uint32_t *used, uint32_t *out_len);
+
+/* Copy the counters; ring_high_water and drops persist until the next start. */
+void sd_logger_get_stats(SD_LoggerStats *out);
+
+/* Copy a channel's counters (kept until the next start); zeros for a channel out of range. */
+void sd_logger_get_channel_stats(uint32_t channel, SD_LoggerChannelStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_LOGGER_H__ */
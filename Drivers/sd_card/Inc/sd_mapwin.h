@@ -0,0 +1,78 @@
+/*
+ * sd_mapwin.h
+ *
+ * Memory-mapped style reads of large files (calibration tables, fonts,
+ * lookup data). A lookup of a few bytes with f_lseek + f_read costs a seek,
+ * a sector read into the FIL's buffer and a copy every time. sd_map_window
+ * instead returns a pointer straight into a RAM window of the file, up to
+ * one cluster long and starting on a sector boundary. Lookups that land in
+ * the window are a bounds check. One that does not reloads the window from
+ * the sector it starts in onwards, so the bytes after it are read ahead;
+ * when the new window overlaps the old one (a scan moving forward), the
+ * overlap is moved down and only the new sectors are read. Loads are one
+ * f_read of whole sectors, which FatFs sends straight into the window.
+ *
+ * The window belongs to one FIL and one task. Open the file with
+ * sd_fastseek_open (sd_functions.h) so jumps across the file do not walk the
+ * cluster chain. Its contents must not change while mapped: call
+ * sd_map_invalidate after writing to it through another FIL.
+ */
+
+#ifndef __SD_MAPWIN_H__
+#define __SD_MAPWIN_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t hits;       // Lookups served from the window
+    uint32_t loads;      // Lookups that read the card
+    uint32_t slides;     // Of those, loads that kept part of the previous window
+    uint32_t bytes_read; // Bytes read into the window
+} SD_MapStats;
+
+typedef struct {
+    FIL *fp;
+    uint8_t *buf;
+    uint32_t size;  // Window bytes: whole sectors, at most one cluster
+    FSIZE_t start;  // File offset of buf[0]
+    uint32_t valid; // Bytes of buf holding file data
+    FRESULT err;    // Why the last sd_map_window returned NULL (FR_OK otherwise)
+    SD_MapStats stats;
+} SD_MapWindow;
+
+/**
+ * @brief Attach a window buffer to an open file
+ * @param map Window state
+ * @param fp File opened with FA_READ (ideally through sd_fastseek_open)
+ * @param buf Window buffer; SD_DMA_ALIGNMENT-aligned for DMA straight into it
+ * @param bytes Buffer size; the window is this rounded down to whole sectors,
+ *        at most one cluster of the file's volume
+ * @return FR_OK, FR_INVALID_PARAMETER (NULL, or less than one sector), FR_INVALID_OBJECT
+ */
+int sd_map_init(SD_MapWindow *map, FIL *fp, void *buf, uint32_t bytes);
+
+/**
+ * @brief Pointer to len bytes of the file at offset
+ * @return Pointer into the window, valid until the next call on map; NULL
+ *         when the range passes the end of the file, does not fit in the
+ *         window from offset's sector or the read failed (map->err says which)
+ *
+ * Note: The window is read-only; it is reloaded, not written back.
+ */
+const void *sd_map_window(SD_MapWindow *map, uint32_t offset, uint32_t len);
+
+/* Drop the window; the next lookup reads the card. */
+void sd_map_invalidate(SD_MapWindow *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_MAPWIN_H__ */
@@ -0,0 +1,116 @@
+/*
+ * sd_mem.h
+ *
+ * Copy, fill and compare routines for FatFs's string helpers. ff.c moves
+ * every partial-sector f_read/f_write through its own mem_cpy and fills and
+ * compares directory entries with mem_set/mem_cmp, all one byte per loop
+ * iteration. These routines do the same with 32-bit words: the destination
+ * is aligned first, a source at a different alignment is read with unaligned
+ * loads (single LDRs on Cortex-M3/M4/M7, byte loads where the core has none),
+ * and the tail is finished bytewise.
+ *
+ * mem_cpy, mem_set and mem_cmp are static in ff.c, so they cannot be
+ * replaced from outside it; each body becomes a call to the routine here
+ * (see README). sd_benchmark_mem_suite measures the difference on the target.
+ *
+ * The driver's own sector copies between its RAM copies of the card (cache
+ * lines, read-ahead window) and caller buffers go through
+ * sd_mem_copy_start/sd_mem_copy_wait. With SD_MEM_DMA_THRESHOLD set and a
+ * memory-to-memory stream registered by sd_mem_set_dma, a copy that long
+ * runs on DMA while the driver moves the next run of blocks over SPI, and
+ * the wait collects it before the data is used; shorter copies, and every
+ * copy without a stream, stay on the CPU.
+ */
+
+#ifndef __SD_MEM_H__
+#define __SD_MEM_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Implementation behind sd_mem_copy/sd_mem_set/sd_mem_cmp:
+ * 0 = byte loops (FatFs's own), 1 = word-at-a-time, 2 = the C library's
+ * memcpy/memset/memcmp (newlib's are word-based unless it was built for size).
+ */
+#ifndef SD_MEM_ROUTINES
+#define SD_MEM_ROUTINES 1
+#endif
+
+#if (SD_MEM_ROUTINES < 0) || (SD_MEM_ROUTINES > 2)
+#error "SD_MEM_ROUTINES must be 0, 1 or 2"
+#endif
+
+/*
+ * Shortest driver copy, in bytes, handed to the DMA stream (0 = never; the
+ * copy helpers are then plain memcpy). Below about 256 bytes the stream
+ * setup costs more than the CPU copy.
+ */
+#ifndef SD_MEM_DMA_THRESHOLD
+#define SD_MEM_DMA_THRESHOLD 0U
+#endif
+
+/* Longest wait for one DMA copy. */
+#ifndef SD_MEM_DMA_TIMEOUT_MS
+#define SD_MEM_DMA_TIMEOUT_MS 10U
+#endif
+
+#if (SD_MEM_DMA_THRESHOLD > 0U)
+#include "main.h"
+#endif
+
+/* Copy cnt bytes; the regions must not overlap (as for FatFs's mem_cpy). */
+void sd_mem_copy(void *dst, const void *src, uint32_t cnt);
+
+/* Fill cnt bytes with (uint8_t)val. */
+void sd_mem_set(void *dst, int val, uint32_t cnt);
+
+/* 0 if the first cnt bytes match, else nonzero with the sign of the first difference. */
+int sd_mem_cmp(const void *a, const void *b, uint32_t cnt);
+
+#if (SD_MEM_DMA_THRESHOLD > 0U)
+/**
+ * @brief Register the stream driver copies run on
+ * @param hdma DMA2 stream (the only F4 controller that does memory-to-memory)
+ *        initialized for DMA_MEMORY_TO_MEMORY, word data on both sides and
+ *        both increments, polled (no interrupt); NULL to copy on the CPU
+ *
+ * Note: Buffers the stream cannot reach (CCM RAM on F4) must not be cached
+ * or read-ahead; with a data cache the copy also needs cache-line-aligned
+ * ends, and shorter or misaligned copies run on the CPU.
+ */
+void sd_mem_set_dma(DMA_HandleTypeDef *hdma);
+
+/**
+ * @brief Copy cnt bytes, on DMA when long and aligned enough
+ * @return true if the copy is still running: call sd_mem_copy_wait before
+ *         dst is read or src is changed. false once the CPU has copied.
+ *
+ * One copy runs at a time; one started while the stream is busy (another
+ * drive's task) is done on the CPU.
+ */
+bool sd_mem_copy_start(void *dst, const void *src, uint32_t cnt);
+
+/* Finish the copy the last true sd_mem_copy_start left running. */
+void sd_mem_copy_wait(void);
+#else
+static inline bool sd_mem_copy_start(void *dst, const void *src, uint32_t cnt) {
+    memcpy(dst, src, cnt);
+    return false;
+}
+
+static inline void sd_mem_copy_wait(void) {
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_MEM_H__ */
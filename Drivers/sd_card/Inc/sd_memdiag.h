@@ -0,0 +1,99 @@
+/*
+ * sd_memdiag.h
+ *
+ * RAM diagnostics for the SD stack, to size stacks, heap and caches from
+ * measurements. Under FreeRTOS it reports the stack high-water mark of every
+ * driver task that exists (sd_io, sd_log, sd_free, sd_hotplug, sd_raid, found
+ * by name) and of application tasks added with sd_memdiag_watch, plus the
+ * heap's free and minimum-ever-free size. In every build it lists the static
+ * pools: sd_pool's FIL/DIR/FILINFO/LFN blocks, the sector cache and the
+ * logger's ring and ISR buffers, with their peak use. A pool that never comes
+ * near its size, or a stack with hundreds of words never touched, is RAM that
+ * can go to SD_CACHE_LINES instead.
+ *
+ * Tasks are listed only with INCLUDE_uxTaskGetStackHighWaterMark 1, and
+ * without INCLUDE_xTaskGetHandle 1 only the watched ones. High-water marks are since task creation
+ * (stacks, heap) or the last sd_pool_reset_stats / logger start (pools).
+ */
+
+#ifndef __SD_MEMDIAG_H__
+#define __SD_MEMDIAG_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Application tasks sd_memdiag_watch can add. */
+#ifndef SD_MEMDIAG_WATCH_TASKS
+#define SD_MEMDIAG_WATCH_TASKS 4U
+#endif
+
+/* Report the FreeRTOS heap (heap_4/heap_5; 0 for heap_3, which has no counters). */
+#ifndef SD_MEMDIAG_HEAP
+#define SD_MEMDIAG_HEAP 1
+#endif
+
+/* Driver tasks plus watched tasks. */
+#define SD_MEMDIAG_MAX_TASKS (5U + SD_MEMDIAG_WATCH_TASKS)
+
+typedef struct {
+    const char *name;
+    uint32_t stack_free_min; // Least free stack ever, in words (uxTaskGetStackHighWaterMark)
+} SD_MemTask;
+
+typedef struct {
+    uint32_t total;    // configTOTAL_HEAP_SIZE (0 without SD_MEMDIAG_HEAP)
+    uint32_t free;     // xPortGetFreeHeapSize
+    uint32_t free_min; // xPortGetMinimumEverFreeHeapSize
+} SD_MemHeap;
+
+typedef struct {
+    const char *name;
+    uint32_t bytes; // Static RAM reserved
+    uint32_t peak;  // Most bytes ever in use (the cache is counted as full)
+} SD_MemPool;
+
+#define SD_MEMDIAG_POOLS 9U
+
+#ifdef USE_FREERTOS
+/**
+ * @brief Add an application task (e.g. defaultTask) to the stack report
+ * @param task Task handle; NULL or a task already watched is ignored
+ * @return false if SD_MEMDIAG_WATCH_TASKS are already watched
+ *
+ * Note: Call sd_memdiag_unwatch before deleting the task.
+ */
+bool sd_memdiag_watch(TaskHandle_t task);
+void sd_memdiag_unwatch(TaskHandle_t task);
+#endif
+
+/* Fill out with up to max tasks (none without FreeRTOS); returns the count. */
+uint32_t sd_memdiag_tasks(SD_MemTask *out, uint32_t max);
+
+/* Heap figures (all zero without FreeRTOS or SD_MEMDIAG_HEAP). */
+void sd_memdiag_heap(SD_MemHeap *out);
+
+/* Fill out with up to max pools (SD_MEMDIAG_POOLS in all); returns the count. */
+uint32_t sd_memdiag_pools(SD_MemPool *out, uint32_t max);
+
+/*
+ * Print everything as "SDMEM," lines (UART or SWO via the printf retarget):
+ * SDMEM,task,name,stack_free_min_words / SDMEM,heap,total,free,free_min /
+ * SDMEM,pool,name,bytes,peak
+ */
+void sd_memdiag_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_MEMDIAG_H__ */
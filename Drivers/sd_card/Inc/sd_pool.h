@@ -0,0 +1,168 @@
+/*
+ * sd_pool.h
+ *
+ * Fixed pools of FatFs objects. With _FS_TINY 0 every FIL carries a 512-byte
+ * sector buffer, so a FIL on the stack forces large task stacks. When a pool
+ * is sized, the sd_functions and sd_benchmark helpers take their FIL/DIR from
+ * it instead; applications can use the same pools. Acquire and release never
+ * block and are safe from any task or ISR. An exhausted pool returns NULL and
+ * the helpers fail with FR_TOO_MANY_OPEN_FILES.
+ *
+ * With _USE_LFN 3, FatFs takes its LFN working buffer from ff_memalloc on
+ * every call that handles names. Pointing ff_memalloc/ff_memfree in
+ * syscall.c at sd_pool_lfn_get/sd_pool_lfn_put serves it from fixed blocks
+ * instead of the heap.
+ *
+ * The async path has its own two pools: SD_IoRequest descriptors and
+ * DMA-aligned block buffers, so a producer (or an ISR feeding
+ * SD_SubmitFromISR) never reaches pvPortMalloc for a request in flight.
+ */
+
+#ifndef __SD_POOL_H__
+#define __SD_POOL_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+#include "sd_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Objects per pool (0 = off: helpers keep the object on the stack), at most 32 each. */
+#ifndef SD_POOL_FILS
+#define SD_POOL_FILS 0U
+#endif
+
+#ifndef SD_POOL_DIRS
+#define SD_POOL_DIRS 0U
+#endif
+
+#ifndef SD_POOL_FILINFOS
+#define SD_POOL_FILINFOS 0U
+#endif
+
+/*
+ * LFN working-buffer blocks (0 = off). FatFs allocates one per call while it
+ * holds the volume lock, so _VOLUMES blocks are enough with _FS_REENTRANT.
+ */
+#ifndef SD_POOL_LFN_BUFS
+#define SD_POOL_LFN_BUFS 0U
+#endif
+
+/* Block size: the LFN buffer, plus the exFAT directory buffer when exFAT is on. */
+#ifndef SD_POOL_LFN_BYTES
+#if defined(_MAX_LFN) && defined(_FS_EXFAT) && _FS_EXFAT
+#define SD_POOL_LFN_BYTES ((_MAX_LFN + 1U) * 2U + ((_MAX_LFN + 44U) / 15U * 32U))
+#elif defined(_MAX_LFN)
+#define SD_POOL_LFN_BYTES ((_MAX_LFN + 1U) * 2U)
+#else
+#define SD_POOL_LFN_BYTES 512U
+#endif
+#endif
+
+/* Async request descriptors and data buffers (0 = off). */
+#ifndef SD_POOL_IOREQS
+#define SD_POOL_IOREQS 0U
+#endif
+
+#ifndef SD_POOL_IOBUFS
+#define SD_POOL_IOBUFS 0U
+#endif
+
+/* Data buffer size, a whole number of blocks; each buffer starts on SD_DMA_ALIGNMENT. */
+#ifndef SD_POOL_IOBUF_BYTES
+#define SD_POOL_IOBUF_BYTES 512U
+#endif
+
+#if (SD_POOL_FILS > 32U) || (SD_POOL_DIRS > 32U) || (SD_POOL_FILINFOS > 32U) ||              \
+    (SD_POOL_LFN_BUFS > 32U) || (SD_POOL_IOREQS > 32U) || (SD_POOL_IOBUFS > 32U)
+#error "SD_POOL_FILS, SD_POOL_DIRS, SD_POOL_FILINFOS, SD_POOL_LFN_BUFS, SD_POOL_IOREQS and SD_POOL_IOBUFS must not exceed 32"
+#endif
+
+#if (SD_POOL_IOBUF_BYTES == 0U) || ((SD_POOL_IOBUF_BYTES % 512U) != 0U)
+#error "SD_POOL_IOBUF_BYTES must be a non-zero multiple of 512"
+#endif
+
+typedef enum {
+    SD_POOL_FIL = 0,
+    SD_POOL_DIR,
+    SD_POOL_FILINFO,
+    SD_POOL_LFN,
+    SD_POOL_IOREQ,
+    SD_POOL_IOBUF,
+    SD_POOL_KINDS
+} SD_PoolKind;
+
+typedef struct {
+    uint32_t size;       // Objects in the pool
+    uint32_t in_use;     // Objects currently acquired
+    uint32_t high_water; // Most objects ever acquired at once
+    uint32_t acquires;   // Successful acquires
+    uint32_t misses;     // Acquires that found the pool empty (or, for LFN, too-large requests)
+} SD_PoolStats;
+
+/* Take a free object (zeroed is not guaranteed); NULL if the pool is empty or off. */
+FIL *sd_pool_fil_get(void);
+DIR *sd_pool_dir_get(void);
+FILINFO *sd_pool_filinfo_get(void);
+
+/* Return an object; pointers that are not from the pool (e.g. NULL) are ignored. */
+void sd_pool_fil_put(FIL *fp);
+void sd_pool_dir_put(DIR *dp);
+void sd_pool_filinfo_put(FILINFO *fno);
+
+/**
+ * @brief ff_memalloc replacement: take an LFN block
+ * @param size Bytes FatFs asks for (at most SD_POOL_LFN_BYTES)
+ * @return Block (4-byte aligned), or NULL so the FatFs call fails with FR_NOT_ENOUGH_CORE
+ */
+void *sd_pool_lfn_get(UINT size);
+
+/* ff_memfree replacement. */
+void sd_pool_lfn_put(void *block);
+
+/* Take an async request descriptor (any task or ISR); NULL if the pool is empty or off. */
+SD_IoRequest *sd_pool_ioreq_get(void);
+
+/* Return a descriptor; pointers that are not from the pool are ignored. */
+void sd_pool_ioreq_put(SD_IoRequest *request);
+
+/**
+ * @brief Take a data buffer for an async request (any task or ISR)
+ * @return SD_POOL_IOBUF_BYTES bytes on an SD_DMA_ALIGNMENT boundary, or NULL
+ *         if the pool is empty or off
+ */
+uint8_t *sd_pool_iobuf_get(void);
+
+/* Return a buffer (typically from the request's completion callback). */
+void sd_pool_iobuf_put(void *buff);
+
+void sd_pool_get_stats(SD_PoolKind kind, SD_PoolStats *out);
+
+/* Zero acquires, misses and the high-water marks (in_use is kept). */
+void sd_pool_reset_stats(void);
+
+/*
+ * Declare name as a FIL / DIR pointer: from the pool when it is sized, else to
+ * an object on the stack. Check for NULL and release with the matching put.
+ */
+#if (SD_POOL_FILS > 0U)
+#define SD_POOL_FIL_DECL(name) FIL *name = sd_pool_fil_get()
+#else
+#define SD_POOL_FIL_DECL(name) FIL name##_obj; FIL *name = &name##_obj
+#endif
+
+#if (SD_POOL_DIRS > 0U)
+#define SD_POOL_DIR_DECL(name) DIR *name = sd_pool_dir_get()
+#else
+#define SD_POOL_DIR_DECL(name) DIR name##_obj; DIR *name = &name##_obj
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_POOL_H__ */
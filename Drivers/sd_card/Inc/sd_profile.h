@@ -0,0 +1,185 @@
+/*
+ * sd_profile.h
+ *
+ * Optional FatFs operation profiler. Profiled calls (f_open, f_read, f_write,
+ * f_lseek, f_sync, f_close) are timed with the DWT cycle counter, and every
+ * sector the diskio layer moves while one of them is running is charged to
+ * it, split by volume region: FAT, directory area and data.
+ *
+ * ff.c is third-party and stays unmodified: its internal move_window /
+ * sync_window traffic is seen at the diskio boundary and told apart by sector
+ * number. Wrap calls with SD_PROF_CALL; attribution assumes one profiled
+ * caller at a time (the sd_functions helpers run in a single task).
+ * SD_PROFILE_FILES adds the same figures per file, for calls on a FIL.
+ */
+
+#ifndef __SD_PROFILE_H__
+#define __SD_PROFILE_H__
+
+#include "sd_config.h"
+#include "main.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Profile FatFs calls wrapped in SD_PROF_CALL and the sector I/O under them. */
+#ifndef SD_PROFILE_ENABLED
+#define SD_PROFILE_ENABLED 0
+#endif
+
+/* Drives whose region layout is tracked (matches SD_DISK_DRIVES by default). */
+#ifndef SD_PROFILE_DRIVES
+#define SD_PROFILE_DRIVES 4U
+#endif
+
+/*
+ * Per-file accounting (0 = off; needs SD_PROFILE_ENABLED): up to this many
+ * files, by path, each with the bytes, sectors, syncs and time of the
+ * profiled calls made on it. Files are bound to their FIL when opened with
+ * SD_PROF_OPEN_CALL and unbound on close.
+ */
+#ifndef SD_PROFILE_FILES
+#define SD_PROFILE_FILES 0U
+#endif
+
+/* Path characters kept per file (the tail of longer paths), NUL included. */
+#ifndef SD_PROFILE_NAME
+#define SD_PROFILE_NAME 32U
+#endif
+
+typedef enum {
+    SD_PROF_OPEN = 0,
+    SD_PROF_READ,
+    SD_PROF_WRITE,
+    SD_PROF_LSEEK,
+    SD_PROF_SYNC,
+    SD_PROF_CLOSE,
+    SD_PROF_OTHER, // Sector I/O outside any profiled call (mount, unlink, ...)
+    SD_PROF_COUNT
+} SD_ProfApi;
+
+typedef enum {
+    SD_PROF_REGION_FAT = 0, // FAT copies
+    SD_PROF_REGION_DIR,     // Reserved area and the FAT12/16 root directory
+    SD_PROF_REGION_DATA,    // Cluster heap: file data and FAT32 directories
+    SD_PROF_REGION_COUNT
+} SD_ProfRegion;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t errors;       // Calls that returned anything but FR_OK
+    uint64_t cycles;       // Total time inside the call
+    uint32_t max_cycles;
+    uint64_t io_cycles;    // Part of cycles spent in disk_read / disk_write
+    uint32_t sectors_read[SD_PROF_REGION_COUNT];
+    uint32_t sectors_written[SD_PROF_REGION_COUNT];
+} SD_ProfStats;
+
+typedef struct {
+    char name[SD_PROFILE_NAME]; // Path as opened ("" = free slot)
+    uint32_t opens;
+    uint32_t open_now;          // Handles currently bound to the file
+    uint64_t bytes_read;        // Moved by f_read / f_write (file pointer advance)
+    uint64_t bytes_written;
+    uint32_t sectors_read;      // disk_read / disk_write sectors under calls on the file
+    uint32_t sectors_written;
+    uint32_t syncs;             // f_sync calls
+    uint64_t cycles;            // Time inside calls on the file, open and close included
+    uint64_t io_cycles;         // Part of cycles spent in disk_read / disk_write
+} SD_ProfFileStats;
+
+/**
+ * @brief Register a mounted volume's layout for region attribution
+ * @param pdrv Physical drive
+ * @param fat_first First FAT sector (FATFS.fatbase)
+ * @param fat_count Sectors in all FAT copies (fsize * n_fats)
+ * @param data_first First cluster-heap sector (FATFS.database)
+ *
+ * Note: Until called, every sector of the drive counts as data.
+ */
+void SD_ProfSetRegions(uint8_t pdrv, uint32_t fat_first, uint32_t fat_count,
+                       uint32_t data_first);
+
+/* Start timing a profiled call; nested calls are charged to the outermost. */
+void SD_ProfBegin(SD_ProfApi api);
+
+/* Stop timing the current call and return its FRESULT unchanged. */
+int SD_ProfEnd(int result);
+
+/**
+ * @brief Charge one disk_read / disk_write to the running call
+ * @param pdrv Physical drive
+ * @param write true for disk_write
+ * @param sector First sector
+ * @param count Sectors transferred
+ * @param start DWT cycle count when the transfer began
+ */
+void SD_ProfDiskIo(uint8_t pdrv, bool write, uint32_t sector, uint32_t count, uint32_t start);
+
+/* Accumulated figures for one API (NULL for an out-of-range api). */
+const SD_ProfStats *SD_ProfGet(SD_ProfApi api);
+
+/* Short lower-case name of an API ("open", "write", ...). */
+const char *SD_ProfName(SD_ProfApi api);
+
+/*
+ * Clear all figures and enable the DWT cycle counter (region layout is kept).
+ * Files that are still open keep their slot, with zeroed counters.
+ */
+void SD_ProfReset(void);
+
+/*
+ * Bind fp (a FIL) to path's file slot, taking a free slot or the closed file
+ * with the least I/O when path has none. The file goes untracked when every
+ * slot holds an open file. Called by SD_PROF_OPEN_CALL.
+ */
+void SD_ProfFileOpen(const void *fp, const char *path);
+
+/* Unbind fp; its counters stay until SD_ProfReset or the slot is reused. */
+void SD_ProfFileClose(const void *fp);
+
+/*
+ * Like SD_ProfBegin, also charging the call to fp's file. fptr is the file
+ * pointer before the call; SD_ProfFileEnd takes it after, and returns the
+ * result given to SD_ProfFileResult. Use SD_PROF_FCALL.
+ */
+void SD_ProfFileBegin(SD_ProfApi api, const void *fp, uint32_t fptr);
+void SD_ProfFileResult(int result);
+int SD_ProfFileEnd(uint32_t fptr);
+
+/* Slot index of the file (0 .. SD_PROFILE_FILES - 1; NULL when unused or out of range). */
+const SD_ProfFileStats *SD_ProfFileGet(uint32_t index);
+
+#if (SD_PROFILE_ENABLED == 1)
+#define SD_PROF_CALL(api, call) (SD_ProfBegin(api), SD_ProfEnd((int)(call)))
+#define SD_PROF_START()         (DWT->CYCCNT)
+#else
+#define SD_PROF_CALL(api, call) (call)
+#define SD_PROF_START()         0U
+#endif
+
+/*
+ * SD_PROF_CALL for a call on an open FIL *fp, charged to its file as well;
+ * SD_PROF_OPEN_CALL binds fp to path first (unbound again if the open fails).
+ * The comma operators order the file pointer reads around the call.
+ */
+#if (SD_PROFILE_ENABLED == 1) && (SD_PROFILE_FILES > 0U)
+#define SD_PROF_FCALL(api, fp, call)                                        \
+    (SD_ProfFileBegin((api), (fp), (uint32_t)(fp)->fptr),                   \
+     SD_ProfFileResult((int)(call)), SD_ProfFileEnd((uint32_t)(fp)->fptr))
+#define SD_PROF_OPEN_CALL(fp, path, call)                                   \
+    (SD_ProfFileOpen((fp), (path)), SD_ProfFileBegin(SD_PROF_OPEN, (fp), 0U), \
+     SD_ProfFileResult((int)(call)), SD_ProfFileEnd(0U))
+#else
+#define SD_PROF_FCALL(api, fp, call)      SD_PROF_CALL(api, call)
+#define SD_PROF_OPEN_CALL(fp, path, call) SD_PROF_CALL(SD_PROF_OPEN, call)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_PROFILE_H__ */
@@ -0,0 +1,120 @@
+/*
+ * sd_raid.h
+ *
+ * Virtual block device over two SD cards on separate SPI buses. Striped mode
+ * (RAID-0) spreads stripe units across both cards for twice the link
+ * bandwidth; mirrored mode (RAID-1) writes both cards and reads from whichever
+ * is idle. With FreeRTOS a worker task drives the second card so both DMA
+ * streams run concurrently; without it the halves run back to back.
+ */
+
+#ifndef __SD_RAID_H__
+#define __SD_RAID_H__
+
+#include "diskio.h"
+#include "ff_gen_drv.h"
+#include "sd_spi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Blocks queued per card for one concurrent transfer (larger requests loop). */
+#ifndef SD_RAID_MAX_BLOCKS
+#define SD_RAID_MAX_BLOCKS 32U
+#endif
+
+#if (SD_RAID_MAX_BLOCKS < 1U)
+#error "SD_RAID_MAX_BLOCKS must be at least 1"
+#endif
+
+#ifdef USE_FREERTOS
+/* Worker task stack depth in words. */
+#ifndef SD_RAID_TASK_STACK
+#define SD_RAID_TASK_STACK 256U
+#endif
+
+#ifndef SD_RAID_TASK_PRIORITY
+#define SD_RAID_TASK_PRIORITY (tskIDLE_PRIORITY + 2U)
+#endif
+#endif
+
+typedef enum {
+    SD_RAID_STRIPE = 0, // RAID-0: stripe units alternate between the cards
+    SD_RAID_MIRROR      // RAID-1: identical copies, reads balanced
+} SD_RaidMode;
+
+typedef struct {
+    SD_Handle_t *member[2];  // Initialized handles on different SPI buses
+    SD_RaidMode mode;
+    uint32_t stripe_sectors; // Stripe unit in sectors (striped mode)
+    uint8_t next_read;       // Mirrored mode: card for the next read when both are idle
+} SD_RaidDevice;
+
+/* Device behind SD_RaidDriver. */
+extern SD_RaidDevice g_sd_raid;
+
+/**
+ * @brief Bind two SD handles into a striped or mirrored device
+ * @param raid Device to set up
+ * @param mode SD_RAID_STRIPE or SD_RAID_MIRROR
+ * @param card_a First member (stripe units 0, 2, 4, ...)
+ * @param card_b Second member (stripe units 1, 3, 5, ...)
+ * @param stripe_sectors Stripe unit in sectors (ignored when mirrored)
+ * @return SD_OK, SD_PARAM for bad arguments, SD_ERROR if the worker task could not start
+ *
+ * Note: Call after SD_Init on both handles; they must use different SPI
+ * peripherals so their transfers can overlap.
+ */
+SD_Status SD_RaidInit(SD_RaidDevice *raid, SD_RaidMode mode, SD_Handle_t *card_a,
+                      SD_Handle_t *card_b, uint32_t stripe_sectors);
+
+/**
+ * @brief Read sectors from the virtual device
+ * @param raid Device
+ * @param buff Destination buffer
+ * @param sector Starting virtual sector
+ * @param count Number of sectors
+ * @return SD_Status
+ *
+ * Note: Mirrored reads of two or more sectors are split across both cards; a
+ * part that fails on one card is retried on the other.
+ */
+SD_Status SD_RaidRead(SD_RaidDevice *raid, uint8_t *buff, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Write sectors to the virtual device
+ * @param raid Device
+ * @param buff Source buffer
+ * @param sector Starting virtual sector
+ * @param count Number of sectors
+ * @return SD_Status (first failing card's status)
+ */
+SD_Status SD_RaidWrite(SD_RaidDevice *raid, const uint8_t *buff, uint32_t sector,
+                       uint32_t count);
+
+/**
+ * @brief Wait until both cards have finished programming
+ * @param raid Device
+ * @return SD_Status
+ */
+SD_Status SD_RaidSync(SD_RaidDevice *raid);
+
+/**
+ * @brief Capacity of the virtual device in sectors
+ * @param raid Device
+ * @return Sector count (0 if a member capacity is unknown)
+ *
+ * Note: Striped: twice the smaller card, rounded down to whole stripe units.
+ * Mirrored: the smaller card.
+ */
+uint32_t SD_RaidGetBlockCount(SD_RaidDevice *raid);
+
+/* FatFs driver for g_sd_raid; link it with FATFS_LinkDriverEx(..., lun = 0). */
+extern const Diskio_drvTypeDef SD_RaidDriver;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_RAID_H__ */
@@ -0,0 +1,142 @@
+/*
+ * sd_recstore.h
+ *
+ * Append-only store of fixed-size, timestamped records in one contiguous
+ * file. FatFs allocates the file once (f_expand); after that every page is
+ * written straight to its sector with disk_write, so appends never touch the
+ * FAT or the directory entry. Each page is one sector: a header with the
+ * store's epoch, a sequence number, the record count and the first/last
+ * timestamp, then the records, covered by a CRC-32. Page n of the store's
+ * life lives at data page n % pages, so a wrapping store overwrites its
+ * oldest page.
+ *
+ * Sector 0 of the file holds the store header with the write pointer (the
+ * sequence of the page being filled). It is rewritten every
+ * SD_RECSTORE_HEADER_PAGES pages and on close, so reopening after a crash
+ * scans at most that many pages forward from it. Records are located by
+ * timestamp with a binary search over page headers (log2(pages) reads),
+ * then inside the page.
+ *
+ * Timestamps must not decrease. Records are identified by their index since
+ * the store was created. Do not f_read/f_write the file; the store keeps it
+ * open so it cannot be deleted meanwhile. Task context only; one task per
+ * store.
+ */
+
+#ifndef __SD_RECSTORE_H__
+#define __SD_RECSTORE_H__
+
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+#include "sd_spi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pages written between store-header updates: the longest recovery scan. */
+#ifndef SD_RECSTORE_HEADER_PAGES
+#define SD_RECSTORE_HEADER_PAGES 64U
+#endif
+
+#if (SD_RECSTORE_HEADER_PAGES < 1U)
+#error "SD_RECSTORE_HEADER_PAGES must be at least 1"
+#endif
+
+/* Bytes in front of the records of every page. */
+#define SD_RECSTORE_PAGE_HEADER 28U
+
+typedef struct {
+    uint32_t records;     // Records held (oldest to newest)
+    uint32_t first_index; // Index of the oldest record held
+    uint32_t pages;       // Data pages in the file
+    uint32_t per_page;    // Records per page
+    uint32_t page_writes; // Data pages written since open
+    uint32_t header_writes;
+    uint32_t recovered_pages; // Pages scanned past the write pointer at open
+} SD_RecStoreStats;
+
+/* One store; treat every field as private. */
+typedef struct {
+    FIL fil;
+    FATFS *fs;
+    uint32_t first_sector; // Store header; data page i is first_sector + 1 + i
+    uint32_t pages;
+    uint32_t record_size;
+    uint32_t per_page;
+    uint32_t epoch; // Identifies this store's pages among stale ones
+    uint32_t head;  // Sequence of the page being filled
+    uint32_t fill;  // Records in page
+    uint32_t last_ts;
+    uint32_t cached; // Sequence held in rpage (UINT32_MAX = none)
+    bool wrap;
+    bool open;
+    SD_RecStoreStats stats;
+    uint8_t page[_MAX_SS] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    uint8_t rpage[_MAX_SS] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+} SD_RecStore;
+
+/**
+ * @brief Open a store, creating it if path does not hold one with this record size
+ * @param rs Store to initialize
+ * @param path File of the store
+ * @param record_size Payload bytes per record (1 .. sector size - 32)
+ * @param bytes File size used when the store is created (header sector included)
+ * @param wrap Overwrite the oldest page when full; otherwise appends return FR_DENIED
+ * @return FR_OK, FR_INVALID_PARAMETER, FR_DENIED if no contiguous area of
+ *         bytes is free, or the failing FRESULT
+ *
+ * Note: An existing store keeps its own size and wrap mode. Needs _USE_EXPAND 1.
+ */
+int sd_recstore_open(SD_RecStore *rs, const char *path, uint32_t record_size, uint32_t bytes,
+                     bool wrap);
+
+/**
+ * @brief Append one record
+ * @param rs Open store
+ * @param timestamp Not below the previous record's
+ * @param record record_size bytes
+ * @return FR_OK, FR_INVALID_PARAMETER for a decreasing timestamp, FR_DENIED
+ *         when a non-wrapping store is full, or FR_DISK_ERR
+ *
+ * Note: Records are buffered until their page is full (one disk_write) or
+ * sd_recstore_flush is called.
+ */
+int sd_recstore_append(SD_RecStore *rs, uint32_t timestamp, const void *record);
+
+/* Write the partial page and sync the card (the page is rewritten as it fills). */
+int sd_recstore_flush(SD_RecStore *rs);
+
+/* Flush, record the write pointer and close the file. */
+int sd_recstore_close(SD_RecStore *rs);
+
+/**
+ * @brief Find the first record with a timestamp of at least timestamp
+ * @param rs Open store
+ * @param timestamp Key
+ * @param index Receives the record index; the index past the newest record
+ *        if every record is older
+ * @return FR_OK or FR_DISK_ERR
+ */
+int sd_recstore_find(SD_RecStore *rs, uint32_t timestamp, uint32_t *index);
+
+/**
+ * @brief Read a record by index
+ * @param rs Open store
+ * @param index first_index .. first_index + records - 1 (see sd_recstore_get_stats)
+ * @param timestamp Receives the timestamp; may be NULL
+ * @param record Receives record_size bytes; may be NULL
+ * @return FR_OK, FR_NO_FILE if the record is not held (overwritten or not yet
+ *         written), or FR_DISK_ERR (also for a page that fails its CRC)
+ */
+int sd_recstore_read(SD_RecStore *rs, uint32_t index, uint32_t *timestamp, void *record);
+
+void sd_recstore_get_stats(const SD_RecStore *rs, SD_RecStoreStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_RECSTORE_H__ */
@@ -0,0 +1,110 @@
+/*
+ * sd_rtstats.h
+ *
+ * FreeRTOS run-time statistics for the SD subsystem. With
+ * configGENERATE_RUN_TIME_STATS 1, FreeRTOS charges each task the run-time
+ * counter ticks between its context switches, but it needs a time base 10 to
+ * 100 times faster than the tick. sd_rtstats_timer_init and
+ * sd_rtstats_counter give it one from the DWT cycle counter, or from a
+ * free-running TIM. Add to FreeRTOSConfig.h, inside its compiler guard:
+ *
+ *     #define configGENERATE_RUN_TIME_STATS 1
+ *     #define configUSE_TRACE_FACILITY      1
+ *     extern void sd_rtstats_timer_init(void);
+ *     extern uint32_t sd_rtstats_counter(void);
+ *     #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() sd_rtstats_timer_init()
+ *     #define portGET_RUN_TIME_COUNTER_VALUE()         sd_rtstats_counter()
+ *
+ * sd_rtstats_mark starts an interval and sd_rtstats_get/report measure it:
+ * the CPU share of the SD I/O task (or the task given), time blocked on DMA
+ * and IRQ completions, and time in SD_WaitReady, split into spinning and
+ * backoff sleeps. The driver figures come from SD_Stats (SD_LATENCY_STATS 1)
+ * and cover every caller of the handle, not only the task. Busy polling in
+ * bursts (SD_BUSY_POLL_BURST) may use DMA itself, so the two waits can overlap.
+ */
+
+#ifndef __SD_RTSTATS_H__
+#define __SD_RTSTATS_H__
+
+#include "sd_spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef USE_FREERTOS
+
+/* Run-time counter frequency. */
+#ifndef SD_RTSTATS_HZ
+#define SD_RTSTATS_HZ 100000U
+#endif
+
+#if (SD_RTSTATS_HZ < 1000U) || (SD_RTSTATS_HZ > 1000000U)
+#error "SD_RTSTATS_HZ must be 1000..1000000"
+#endif
+
+/*
+ * Define SD_RTSTATS_TIM as a TIM instance (e.g. TIM2) to count with that timer
+ * instead of DWT, for cores without one. It must already run at SD_RTSTATS_HZ
+ * with ARR at its maximum; SD_RTSTATS_TIM_BITS is its width.
+ */
+#ifndef SD_RTSTATS_TIM_BITS
+#define SD_RTSTATS_TIM_BITS 16U
+#endif
+
+#if (SD_RTSTATS_TIM_BITS != 16U) && (SD_RTSTATS_TIM_BITS != 32U)
+#error "SD_RTSTATS_TIM_BITS must be 16 or 32"
+#endif
+
+typedef struct {
+    uint32_t elapsed_us;     // Since sd_rtstats_mark (wraps after 71 minutes)
+    uint32_t task_us;        // Run time of the measured task
+    uint16_t task_permille;  // task_us / elapsed_us
+    uint32_t dma_waits;      // SD_LAT_DMA waits
+    uint32_t dma_wait_us;    // Time blocked on DMA/IRQ transfer completions
+    uint32_t ready_waits;    // SD_WaitReady calls
+    uint32_t ready_spin_us;  // Time in SD_WaitReady polling the card
+    uint32_t ready_sleep_us; // Time in SD_WaitReady backoff sleeps
+} SD_RtStats;
+
+/* portCONFIGURE_TIMER_FOR_RUN_TIME_STATS: start the time base. */
+void sd_rtstats_timer_init(void);
+
+/*
+ * portGET_RUN_TIME_COUNTER_VALUE: ticks at SD_RTSTATS_HZ since
+ * sd_rtstats_timer_init (task or ISR context). The hardware count is extended
+ * on each call, so it must be called at least once per wrap of the source
+ * (2^32 cycles, 23 s at 180 MHz, for DWT). Context switches normally do; with
+ * a single busy task, call it from the tick hook.
+ */
+uint32_t sd_rtstats_counter(void);
+
+/**
+ * @brief Start a measurement interval
+ * @param sd_handle Card whose waits are measured
+ * @param task Task to measure, or NULL for the SD I/O task (sd_async.h)
+ *
+ * Note: Copies the handle's wait figures; SD_ResetStats during the interval
+ * restarts them from zero.
+ */
+void sd_rtstats_mark(const SD_Handle_t *sd_handle, TaskHandle_t task);
+
+/* Figures since sd_rtstats_mark; false before a mark or without run-time stats. */
+bool sd_rtstats_get(SD_RtStats *out);
+
+/*
+ * Print sd_rtstats_get as one line (UART or SWO via the printf retarget):
+ * SDRTSTATS,elapsed_us,task_us,task_permille,dma_waits,dma_wait_us,
+ * ready_waits,ready_spin_us,ready_sleep_us
+ */
+void sd_rtstats_report(void);
+
+#endif /* USE_FREERTOS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_RTSTATS_H__ */
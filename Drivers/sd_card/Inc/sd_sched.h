@@ -0,0 +1,154 @@
+/*
+ * sd_sched.h
+ *
+ * I/O scheduler stage for the async request path. Pending block requests are
+ * held in a small pool; each dispatch picks a lead request through a pluggable
+ * policy and merges its sector-adjacent neighbours (same card, same direction)
+ * into one CMD18/CMD25 run. The default elevator policy serves the highest
+ * priority class first, in ascending LBA order within a class, and promotes
+ * any request that has been passed over SD_SCHED_STARVE_LIMIT times or whose
+ * deadline is less than SD_SCHED_URGENT_MS away.
+ *
+ * The scheduler itself has no RTOS dependency; sd_async.c drives it from the
+ * SD I/O task.
+ */
+
+#ifndef __SD_SCHED_H__
+#define __SD_SCHED_H__
+
+#include "sd_spi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pending requests held by the scheduler (at most 32). */
+#ifndef SD_SCHED_SLOTS
+#define SD_SCHED_SLOTS 8U
+#endif
+
+/* Upper bound on blocks merged into one CMD18/CMD25. */
+#ifndef SD_SCHED_MAX_MERGE
+#define SD_SCHED_MAX_MERGE 32U
+#endif
+
+/* Dispatches a request may be overtaken by before it is served next. */
+#ifndef SD_SCHED_STARVE_LIMIT
+#define SD_SCHED_STARVE_LIMIT 4U
+#endif
+
+/* Requests due within this many ms go ahead of every priority class, earliest first. */
+#ifndef SD_SCHED_URGENT_MS
+#define SD_SCHED_URGENT_MS 20U
+#endif
+
+#if (SD_SCHED_SLOTS < 1U) || (SD_SCHED_SLOTS > 32U)
+#error "SD_SCHED_SLOTS must be between 1 and 32"
+#endif
+
+#if (SD_SCHED_MAX_MERGE < 1U)
+#error "SD_SCHED_MAX_MERGE must be at least 1"
+#endif
+
+/* Completion callback; runs in the SD I/O task, so keep it short. */
+typedef void (*SD_AsyncCallback)(SD_Status status, void *context);
+
+typedef enum {
+    SD_IO_PRIO_BULK = 0, // Background traffic such as log appends
+    SD_IO_PRIO_NORMAL,
+    SD_IO_PRIO_HIGH      // Latency-sensitive reads such as config loads
+} SD_IoPriority;
+
+typedef struct {
+    SD_Handle_t *sd_handle;
+    uint8_t *buff;             // Source (write) or destination (read), count * 512 bytes
+    uint32_t sector;
+    uint32_t count;
+    bool write;
+    SD_IoPriority priority;
+    SD_AsyncCallback callback; // NULL: completion goes to submitter (see sd_async.h)
+    void *context;
+    void *submitter;           // Opaque completion target owned by the async layer
+    void *batch;               // SD_AsyncBatch the request belongs to, or NULL
+    bool has_deadline;
+    uint32_t deadline;         // HAL_GetTick() value to finish by (has_deadline)
+} SD_IoRequest;
+
+typedef struct SD_Scheduler SD_Scheduler;
+
+/* Policy hook: return the slot of the next lead request (a pending, eligible slot). */
+typedef uint32_t (*SD_SchedPolicy)(const SD_Scheduler *sched);
+
+struct SD_Scheduler {
+    SD_IoRequest req[SD_SCHED_SLOTS];
+    uint32_t seq[SD_SCHED_SLOTS];    // Arrival order
+    uint8_t skipped[SD_SCHED_SLOTS]; // Dispatches that overtook this request
+    uint32_t used;                   // Bitmap of occupied slots
+    uint32_t next_seq;
+    uint32_t head;                   // Sector after the last dispatched run
+    uint32_t now;                    // HAL_GetTick() at the current SD_SchedNext
+    SD_SchedPolicy policy;
+};
+
+/**
+ * @brief Reset a scheduler and select its policy
+ * @param sched Scheduler to initialize
+ * @param policy Lead-selection policy, or NULL for SD_SchedElevator
+ */
+void SD_SchedInit(SD_Scheduler *sched, SD_SchedPolicy policy);
+
+/**
+ * @brief Add a request to the pending pool
+ * @return SD_OK, SD_BUSY if every slot is taken, or SD_PARAM
+ */
+SD_Status SD_SchedAdd(SD_Scheduler *sched, const SD_IoRequest *request);
+
+/**
+ * @brief Number of pending requests
+ */
+uint32_t SD_SchedPending(const SD_Scheduler *sched);
+
+/**
+ * @brief Remove the next run of requests to dispatch
+ * @param sched Scheduler
+ * @param batch Receives the requests in ascending sector order
+ * @param max_batch Capacity of batch
+ * @return Number of requests in the run (0 if none pending); together they
+ *         cover one contiguous sector range in one direction on one card
+ */
+uint32_t SD_SchedNext(SD_Scheduler *sched, SD_IoRequest *batch, uint32_t max_batch);
+
+/**
+ * @brief Remove every pending request whose deadline has passed
+ * @param sched Scheduler
+ * @param now Current HAL_GetTick() value
+ * @param expired Receives the removed requests
+ * @param max_expired Capacity of expired
+ * @return Number of requests removed; the caller completes them (e.g. SD_TIMEOUT)
+ *
+ * Note: A request still held back by an older overlapping one is kept, so
+ * dropping it never reorders the data another request sees.
+ */
+uint32_t SD_SchedTakeExpired(SD_Scheduler *sched, uint32_t now, SD_IoRequest *expired,
+                             uint32_t max_expired);
+
+/**
+ * @brief Whether a pending slot may be dispatched now
+ *
+ * A request is held back while an older pending request overlaps it and
+ * either of the two is a write, so reordering never changes the data seen.
+ */
+bool SD_SchedEligible(const SD_Scheduler *sched, uint32_t slot);
+
+/**
+ * @brief Default policy: starved requests first, then urgent deadlines
+ *        (earliest first), then priority class, then ascending LBA from the
+ *        current head position (wrapping around)
+ */
+uint32_t SD_SchedElevator(const SD_Scheduler *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_SCHED_H__ */
@@ -0,0 +1,74 @@
+/*
+ * sd_shared.h
+ *
+ * Concurrent file reads. With _FS_REENTRANT 1 every FatFs call on a volume
+ * takes the volume mutex, so a logger's long f_write holds off a UI task's
+ * short f_read for its whole duration. sd_read_shared reads a file opened
+ * FA_READ without that mutex. It follows the cluster chain and reads the data
+ * through SD_DiskReadShared, which goes to the sector cache directly, and
+ * only the card's bus lock is shared with other I/O. Cache hits run in
+ * parallel (SD_CACHE_LOCK=1).
+ *
+ * This is safe because the FIL is the only state touched, besides the mount
+ * parameters in its FATFS, and because _FS_LOCK makes FatFs refuse opening
+ * the file for writing, or removing or renaming it, while it is open. Its
+ * chain and data therefore stay fixed. Allocation, directory and FAT updates
+ * stay serialized under the volume mutex as before. A FAT sector may hold
+ * entries of other files that have changed since; this file's entries are the
+ * same in every copy.
+ *
+ * Falls back to f_read, which takes the mutex, when the build lacks something
+ * this needs (SD_SHARED_READ 0) or the file does not qualify: opened for
+ * writing, on exFAT, or behind a driver other than SD_Driver. One task per
+ * FIL, as with f_read; calls may mix with f_read/f_lseek on it. Not while
+ * the volume is being unmounted, and not during SD_DiskBatchBegin/End
+ * (held sectors are not seen).
+ */
+
+#ifndef __SD_SHARED_H__
+#define __SD_SHARED_H__
+
+#include "sd_config.h"
+#include "sd_cache.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Needs a sector buffer in every FIL (_FS_TINY 0), file locking (_FS_LOCK)
+ * and, with the cache under FreeRTOS, the cache's own lock.
+ */
+#if !_FS_TINY && (_FS_LOCK > 0) && \
+    (!SD_CACHE_ENABLED || (SD_CACHE_LOCK == 1) || !defined(USE_FREERTOS))
+#define SD_SHARED_READ 1
+#else
+#define SD_SHARED_READ 0
+#endif
+
+typedef struct {
+    uint32_t reads;     // sd_read_shared calls served without the volume lock
+    uint32_t fallbacks; // Calls passed to f_read
+} SD_SharedStats;
+
+/**
+ * @brief f_read without the volume lock, for files opened read-only
+ * @param fp File opened with FA_READ and without FA_WRITE
+ * @param buff Destination
+ * @param btr Bytes to read
+ * @param br Receives the bytes read
+ * @return As f_read (FR_OK, FR_DISK_ERR, FR_INT_ERR, FR_INVALID_OBJECT, FR_DENIED)
+ */
+FRESULT sd_read_shared(FIL *fp, void *buff, UINT btr, UINT *br);
+
+/* Counters are updated without a lock; under contention they may miss a call. */
+void sd_shared_get_stats(SD_SharedStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_SHARED_H__ */
@@ -0,0 +1,125 @@
+/*
+ * sd_shell.h
+ *
+ * Line-oriented command shell for looking at the storage stack on a live
+ * unit over a serial console: driver counters, cache metrics and sizes, the
+ * trace ring, per-file I/O accounting, a short benchmark, directory listings, free space and a forced
+ * sync. Characters go in through sd_shell_input, one at a time, from any
+ * single task; replies go out through an output hook (printf by default).
+ * Under FreeRTOS with the HAL UART driver, sd_shell_start runs the shell in
+ * its own low-priority task fed by a one-byte interrupt receive.
+ *
+ * Commands run in the shell's task and take the volume lock like any other
+ * FatFs user, so they compete with the application for the card; bench
+ * writes a file on the mounted volume and removes it afterwards.
+ */
+
+#ifndef __SD_SHELL_H__
+#define __SD_SHELL_H__
+
+#include "sd_config.h"
+#include "sd_spi.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest command line in characters; the rest of a longer line is dropped. */
+#ifndef SD_SHELL_LINE_MAX
+#define SD_SHELL_LINE_MAX 96U
+#endif
+
+/* Words per command line, the command included. */
+#ifndef SD_SHELL_ARGS
+#define SD_SHELL_ARGS 6U
+#endif
+
+#ifndef SD_SHELL_PROMPT
+#define SD_SHELL_PROMPT "sd> "
+#endif
+
+/* Received characters the queue holds while a command runs. */
+#ifndef SD_SHELL_RX_DEPTH
+#define SD_SHELL_RX_DEPTH 64U
+#endif
+
+/* Shell task stack depth in words (bench and ls need FIL/DIR/FILINFO on it). */
+#ifndef SD_SHELL_TASK_STACK
+#define SD_SHELL_TASK_STACK 1024U
+#endif
+
+#ifndef SD_SHELL_TASK_PRIORITY
+#define SD_SHELL_TASK_PRIORITY (tskIDLE_PRIORITY + 1U)
+#endif
+
+/* Default bench file size and bytes per call. */
+#ifndef SD_SHELL_BENCH_KB
+#define SD_SHELL_BENCH_KB 256U
+#endif
+
+#ifndef SD_SHELL_BENCH_BUF
+#define SD_SHELL_BENCH_BUF 4096U
+#endif
+
+#if (SD_SHELL_LINE_MAX < 16U) || (SD_SHELL_ARGS < 2U)
+#error "SD_SHELL_LINE_MAX must be at least 16 and SD_SHELL_ARGS at least 2"
+#endif
+
+/* Where replies go: len bytes of text, not NUL-terminated. */
+typedef void (*sd_shell_write_fn)(const char *text, uint32_t len);
+
+/*
+ * Send replies to fn instead of stdout (NULL restores stdout). Output of the
+ * trace and bench commands comes from SD_TraceDump and sd_benchmark_print,
+ * which always use printf.
+ */
+void sd_shell_set_output(sd_shell_write_fn fn);
+
+/*
+ * Feed one received character: echoed, backspace or DEL erases, CR or LF
+ * runs the line and prints the prompt (an LF right after a CR is ignored).
+ */
+void sd_shell_input(char c);
+
+/**
+ * @brief Run one command line
+ * @param line Command and arguments separated by spaces; modified in place
+ * @return 0 when the command ran, 1 for an empty line, -1 for an unknown
+ *         command or bad arguments, otherwise the command's FRESULT/SD_Status
+ *
+ * Commands: help, stats [reset], cache [reset | sectors|readahead|fat <n>],
+ * trace [reset], bench [kb] [buf], ls [path], df, sync.
+ */
+int sd_shell_exec(char *line);
+
+/* Print the prompt (once at start-up; sd_shell_start does it). */
+void sd_shell_prompt(void);
+
+#if defined(USE_FREERTOS) && defined(HAL_UART_MODULE_ENABLED)
+/**
+ * @brief Start the shell task on a UART (e.g. &huart2)
+ * @return SD_OK, or SD_ERROR if the queue, task or first receive failed
+ *
+ * Note: Call once after the UART is initialized and before the scheduler
+ * starts or from a task; calling it again is a no-op. Route the HAL
+ * callbacks here:
+ *   HAL_UART_RxCpltCallback -> sd_shell_uart_rx_cplt(huart)
+ *   HAL_UART_ErrorCallback  -> sd_shell_uart_error(huart)
+ * Replies still go through the output hook (printf, which the board
+ * retargets to the same UART).
+ */
+SD_Status sd_shell_start(UART_HandleTypeDef *huart);
+
+/* HAL receive-complete callback hook: queue the byte, re-arm (ISR context). */
+void sd_shell_uart_rx_cplt(UART_HandleTypeDef *huart);
+
+/* HAL error callback hook: re-arm the receive after an overrun or framing error. */
+void sd_shell_uart_error(UART_HandleTypeDef *huart);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_SHELL_H__ */
@@ -9,7 +9,10 @@
 #ifndef __SD_SPI_H__
 #define __SD_SPI_H__
 
+#include "sd_config.h"
 #include "main.h"
+#include "sd_trace.h"
+#include "sd_logsink.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -60,6 +63,435 @@ typedef enum {
     SD_UNSUPPORTED
 } SD_Status;
 
+/*
+ * Handles that may be initialized at the same time. Each takes one slot with
+ * its own DMA staging buffers and (static allocation) semaphore storage; HAL
+ * SPI callbacks are dispatched to the slots whose hspi matches.
+ */
+#ifndef SD_MAX_INSTANCES
+#define SD_MAX_INSTANCES 2U
+#endif
+
+#if (SD_MAX_INSTANCES < 1U) || (SD_MAX_INSTANCES > 255U)
+#error "SD_MAX_INSTANCES must be between 1 and 255"
+#endif
+
+/*
+ * Shared SPI bus (SD_BusInit, SD_BusAttach): several cards, or a card and
+ * other SPI devices, on one hspi. Attached handles take the bus lock instead
+ * of their own, so requests of different devices interleave between
+ * commands, never inside one, and the SPI is re-clocked for each device
+ * when the bus changes hands. DMA callbacks go to the device holding the
+ * bus. 0 = each handle locks alone, which is only safe with one device per
+ * hspi.
+ */
+#ifndef SD_SHARED_BUS
+#define SD_SHARED_BUS 0
+#endif
+
+/*
+ * Split busy waits: the program busy after a CMD24 block or a CMD25 stop
+ * token is not waited out with the card selected. The write returns once
+ * the card has accepted the data, with the card deselected and the bus
+ * free for other devices and requests. DO shows busy again when the card
+ * is reselected, so the next command to it, SD_Sync or SD_PollBusy waits
+ * out the rest; a write that never finishes is reported there. The busy
+ * between the blocks of a CMD25 is still waited in place. 0 = every write
+ * returns once the card is ready again.
+ */
+#ifndef SD_SPLIT_BUSY
+#define SD_SPLIT_BUSY 0
+#endif
+
+/*
+ * Ready tracking: the handle remembers whether the card was last seen not
+ * busy with nothing sent since that could make it busy again: a completed
+ * CMD17 or register read, a command without busy or data (CMD8/16/55/58/59,
+ * ACMD41), or a ready wait that ended. The next command then goes out
+ * without its SD_WaitReady. Writes, erases, CMD12 (R1b), errors and
+ * re-initialization clear it. 0 = every command waits for ready first.
+ */
+#ifndef SD_READY_TRACKING
+#define SD_READY_TRACKING 1
+#endif
+
+/* Pipeline CMD18 reads through two DMA staging buffers when use_dma is set. */
+#ifndef SD_READ_PIPELINE
+#define SD_READ_PIPELINE 1
+#endif
+
+/*
+ * Streamed CMD18: each pipelined DMA also clocks SD_READ_STREAM_GAP bytes past
+ * the CRC, and the next block's data token is looked for there. When it is
+ * found the next DMA starts at once, without a polled token wait between
+ * blocks; otherwise the driver polls for it as usual. 0 disables.
+ */
+#ifndef SD_READ_STREAM_GAP
+#define SD_READ_STREAM_GAP 0U
+#endif
+
+#if (SD_READ_STREAM_GAP > 0U) && (SD_READ_PIPELINE != 1)
+#error "SD_READ_STREAM_GAP requires SD_READ_PIPELINE"
+#endif
+
+#if (SD_READ_STREAM_GAP > 64U)
+#error "SD_READ_STREAM_GAP must not exceed 64"
+#endif
+
+/*
+ * Read sessions: a CMD18 is left open after its last block, with the card
+ * still selected, and a read of the sector after it carries on with the
+ * blocks the card streams next instead of a new command. A single-block read
+ * that follows on from the previous read opens one too; other single-block
+ * reads stay CMD17. CMD12 stops the session at the first command of any
+ * other request (a write, a read elsewhere, a status query), in SD_Sync, and
+ * once it has been idle SD_READ_SESSION_IDLE_MS, at the next read or from
+ * SD_IdlePoll. The card keeps the bus while a session is open, so this needs
+ * one device per hspi. 0 = every read is a complete command.
+ */
+#ifndef SD_READ_SESSION
+#define SD_READ_SESSION 0
+#endif
+
+#ifndef SD_READ_SESSION_IDLE_MS
+#define SD_READ_SESSION_IDLE_MS 10U
+#endif
+
+#if (SD_READ_SESSION == 1) && (SD_SHARED_BUS == 1)
+#error "SD_READ_SESSION is not supported with SD_SHARED_BUS"
+#endif
+
+/*
+ * Write sessions, the same for CMD25: a run's last block is programmed but
+ * the stop token is held back, and a write of the sector after it sends its
+ * blocks on into the open command. A single-block write that follows on
+ * from the previous write opens one instead of a CMD24. The stop token (and
+ * its program busy) goes out at the first command of any other request, in
+ * SD_Sync, and once the session has been idle SD_WRITE_SESSION_IDLE_MS, at
+ * the next write or from SD_IdlePoll. Every block has finished programming
+ * before its write returns either way. One device per hspi, as above.
+ */
+#ifndef SD_WRITE_SESSION
+#define SD_WRITE_SESSION 0
+#endif
+
+#ifndef SD_WRITE_SESSION_IDLE_MS
+#define SD_WRITE_SESSION_IDLE_MS 50U
+#endif
+
+#if (SD_WRITE_SESSION == 1) && (SD_SHARED_BUS == 1)
+#error "SD_WRITE_SESSION is not supported with SD_SHARED_BUS"
+#endif
+
+/* Either kind of session is built in. */
+#define SD_SESSIONS ((SD_READ_SESSION == 1) || (SD_WRITE_SESSION == 1))
+
+/* Send CMD25 blocks as single DMA frames, staging block N+1 during card busy. */
+#ifndef SD_WRITE_PIPELINE
+#define SD_WRITE_PIPELINE 1
+#endif
+
+/*
+ * Keep DMA for blocks whose buffer is not SD_DMA_ALIGNMENT-aligned by copying
+ * them through an aligned per-instance buffer (costs SD_MAX_INSTANCES * 512 bytes).
+ * With 0 such blocks fall back to polled transfers.
+ */
+#ifndef SD_DMA_BOUNCE
+#define SD_DMA_BOUNCE 1
+#endif
+
+/*
+ * CRC mode: enable card-side CRC checking with CMD59, send CRC7 on every command
+ * and CRC16 on every data block, and verify the CRC16 of received blocks
+ * (mismatches return SD_CRC_ERROR). Table-driven; the CRC7 and CRC16 tables and
+ * the precomputed zero-argument command CRCs cost about 830 bytes of flash.
+ */
+#ifndef SD_CRC_ENABLED
+#define SD_CRC_ENABLED 0
+#endif
+
+/*
+ * Standard-capacity (SDSC, byte-addressed) card support. With 0 the driver
+ * accepts only SDHC/SDXC: block addresses go to the card unscaled, CMD16 and
+ * CSD v1 capacity decoding are left out, and identification of a v1 card or
+ * one without the CCS bit in its OCR fails with SD_UNSUPPORTED.
+ */
+#ifndef SD_SUPPORT_SDSC
+#define SD_SUPPORT_SDSC 1
+#endif
+
+/*
+ * Per-operation latency histograms in SD_Stats, timed with the DWT cycle
+ * counter (enabled by SD_Init). Bucket i counts latencies in [2^i, 2^(i+1))
+ * microseconds, bucket 0 anything under 2 us; the last bucket is open-ended.
+ */
+#ifndef SD_LATENCY_STATS
+#define SD_LATENCY_STATS 1
+#endif
+
+#ifndef SD_LAT_BUCKETS
+#define SD_LAT_BUCKETS 20U
+#endif
+
+/*
+ * Latency objectives (SD_SetLatencySlo): every SD_LatencyOp sample is also
+ * checked against a per-operation limit, and one over it calls the handle's
+ * SLO callback with a snapshot of the newest SD_SLO_TRACE_EVENTS trace events
+ * (with SD_TRACE_ENABLED). Needs SD_LATENCY_STATS.
+ */
+#ifndef SD_SLO_ENABLED
+#define SD_SLO_ENABLED 0
+#endif
+
+/*
+ * Tear-free SD_GetStats without the bus lock: every bus unlock publishes the
+ * counters into one of two copies behind a sequence number (a seqlock latch),
+ * and SD_GetStats reads whichever copy is not being written. Costs two
+ * SD_Stats copies of RAM per handle and one struct copy per bus operation.
+ */
+#ifndef SD_STATS_SNAPSHOT
+#define SD_STATS_SNAPSHOT 0
+#endif
+
+#ifndef SD_SLO_TRACE_EVENTS
+#define SD_SLO_TRACE_EVENTS 16U
+#endif
+
+#if (SD_SLO_ENABLED == 1) && (SD_LATENCY_STATS != 1)
+#error "SD_SLO_ENABLED needs SD_LATENCY_STATS"
+#endif
+
+/*
+ * Energy accounting: the time of every read and write operation is split
+ * into card-active (waiting out write busy or a read data token, while the
+ * card works its flash), bus-active (clocking commands and data) and
+ * selected-idle (card selected, neither), per SD_LatencyOp in SD_Stats.energy.
+ * sd_energy.h turns the split into an energy estimate. Needs SD_LATENCY_STATS.
+ */
+#ifndef SD_ENERGY_STATS
+#define SD_ENERGY_STATS 0
+#endif
+
+#if (SD_ENERGY_STATS == 1) && (SD_LATENCY_STATS != 1)
+#error "SD_ENERGY_STATS needs SD_LATENCY_STATS"
+#endif
+
+/* Send ACMD23 (pre-erase count) before CMD25 runs of at least this many blocks; 0 = never. */
+#ifndef SD_ACMD23_MIN_BLOCKS
+#define SD_ACMD23_MIN_BLOCKS 8U
+#endif
+
+/*
+ * Identification (SD_SPI_Init) ACMD41 polling: after a miss, clock this many
+ * idle bytes before the next poll (8 bytes = 160 us at 400 kHz), doubling per
+ * miss; once the gap passes SD_INIT_POLL_GAP_MAX, sleep 1 ms per retry. A
+ * re-identification also sleeps through most of the previous ACMD41 time.
+ * 0 = sleep 1 ms after every miss.
+ */
+#ifndef SD_INIT_POLL_GAP_BYTES
+#define SD_INIT_POLL_GAP_BYTES 8U
+#endif
+
+#ifndef SD_INIT_POLL_GAP_MAX
+#define SD_INIT_POLL_GAP_MAX 64U
+#endif
+
+#if (SD_INIT_POLL_GAP_MAX > 512U)
+#error "SD_INIT_POLL_GAP_MAX must not exceed 512"
+#endif
+
+/*
+ * Keep the OCR and CSD of the last identified card, keyed by its CID. A CID
+ * read then doubles as the fast-clock link check, and a matching card skips
+ * CMD58 and the CSD read. SD_GetInitCache/SD_SetInitCache carry the entry
+ * across power-down (e.g. in backup RAM).
+ */
+#ifndef SD_INIT_CACHE
+#define SD_INIT_CACHE 0
+#endif
+
+/*
+ * Decode the CID, CSD and SD Status (ACMD13) into SD_Handle_t.card_info at
+ * init, for one extra CMD10 (none with SD_INIT_CACHE) and one ACMD13. The
+ * CSD's access times then set the handle's data-token and write-busy
+ * timeouts, and its TRAN_SPEED caps the bus clock when SD_SPI_CLOCK_HZ is
+ * known. SD_GetCardInfo copies the result.
+ */
+#ifndef SD_CARD_INFO
+#define SD_CARD_INFO 0
+#endif
+
+/* Clock feeding the card's SPI (its APB clock), for the TRAN_SPEED cap; 0 = unknown. */
+#ifndef SD_SPI_CLOCK_HZ
+#define SD_SPI_CLOCK_HZ 0U
+#endif
+
+/*
+ * Tuned timeouts are the spec's worst-case access times (100 ms
+ * read / 250 ms write on SDHC, 500 ms write on SDXC, less on an SDSC card
+ * whose TAAC/NSAC/R2W_FACTOR say so) scaled by this percentage, and never
+ * longer than SD_DATA_TOKEN_TIMEOUT_MS / SD_WRITE_BUSY_TIMEOUT_MS.
+ */
+#ifndef SD_CARD_TIMEOUT_PCT
+#define SD_CARD_TIMEOUT_PCT 150U
+#endif
+
+#if (SD_CARD_TIMEOUT_PCT < 100U)
+#error "SD_CARD_TIMEOUT_PCT must be at least 100"
+#endif
+
+/*
+ * Adaptive data timeouts. Each handle keeps a decaying histogram of its
+ * successful data-token and write-busy waits. Once SD_ADAPT_MIN_SAMPLES are
+ * in, a wait gives up at SD_ADAPT_MARGIN_PCT of the SD_ADAPT_PERMILLE
+ * percentile, at least SD_ADAPT_FLOOR_MS. The limit is never later than the
+ * fixed one (with SD_CARD_INFO, the card's spec limit). A wait cut short
+ * this way drops that histogram, so the retry and later waits use the full
+ * limit until it has relearned.
+ */
+#ifndef SD_ADAPTIVE_TIMEOUTS
+#define SD_ADAPTIVE_TIMEOUTS 0
+#endif
+
+#ifndef SD_ADAPT_PERMILLE
+#define SD_ADAPT_PERMILLE 999U
+#endif
+
+#ifndef SD_ADAPT_MARGIN_PCT
+#define SD_ADAPT_MARGIN_PCT 400U
+#endif
+
+#ifndef SD_ADAPT_FLOOR_MS
+#define SD_ADAPT_FLOOR_MS 10U
+#endif
+
+#ifndef SD_ADAPT_MIN_SAMPLES
+#define SD_ADAPT_MIN_SAMPLES 64U
+#endif
+
+/* Counts are halved when this many samples are held, so old behaviour fades. */
+#ifndef SD_ADAPT_WINDOW
+#define SD_ADAPT_WINDOW 1024U
+#endif
+
+#if (SD_ADAPT_PERMILLE < 500U) || (SD_ADAPT_PERMILLE > 1000U) || (SD_ADAPT_MARGIN_PCT < 100U)
+#error "SD_ADAPT_PERMILLE must be 500..1000 and SD_ADAPT_MARGIN_PCT at least 100"
+#endif
+
+#if (SD_ADAPT_MIN_SAMPLES < 1U) || (SD_ADAPT_WINDOW < 2U * SD_ADAPT_MIN_SAMPLES) || \
+    (SD_ADAPT_WINDOW > 32768U)
+#error "SD_ADAPT_WINDOW must be 2 * SD_ADAPT_MIN_SAMPLES..32768"
+#endif
+
+/*
+ * Idle clock gating: once a handle has seen no I/O for this long, SD_IdlePoll
+ * deselects the card and de-initializes the SPI (HAL_SPI_DeInit, whose MSP
+ * hook gates the SPI clock and releases its pins and DMA streams). The next
+ * request re-initializes it transparently. 0 = off.
+ */
+#ifndef SD_IDLE_GATE_MS
+#define SD_IDLE_GATE_MS 0U
+#endif
+
+/* Gating de-initializes the SPI under one handle, while other devices may still use it. */
+#if (SD_SHARED_BUS == 1) && (SD_IDLE_GATE_MS > 0U)
+#error "SD_IDLE_GATE_MS is not supported with SD_SHARED_BUS"
+#endif
+
+/*
+ * Chunked long transfers: inside a CMD18 or CMD25 run, the hook set with
+ * SD_SetChunkHook is called after every SD_CHUNK_BLOCKS blocks (not after the
+ * last one), between two data blocks of the same command. Nothing goes to the
+ * card meanwhile, so a run of any length stays one command while the hook
+ * feeds a watchdog. 0 = off.
+ */
+#ifndef SD_CHUNK_BLOCKS
+#define SD_CHUNK_BLOCKS 0U
+#endif
+
+/*
+ * Busy/token polling policy. The first poll of every wait is a single byte;
+ * later polls clock SD_*_POLL_BURST bytes at once (DMA when enabled) and scan
+ * the window. The first SD_POLL_SPIN_COUNT misses retry immediately, after
+ * that each miss backs off one tick. Defaults keep one byte + 1 ms per poll.
+ */
+#ifndef SD_BUSY_POLL_BURST
+#define SD_BUSY_POLL_BURST 1U
+#endif
+
+#ifndef SD_TOKEN_POLL_BURST
+#define SD_TOKEN_POLL_BURST 1U
+#endif
+
+#ifndef SD_POLL_SPIN_COUNT
+#define SD_POLL_SPIN_COUNT 0U
+#endif
+
+#if (SD_BUSY_POLL_BURST < 1U) || (SD_TOKEN_POLL_BURST < 1U)
+#error "SD_BUSY_POLL_BURST and SD_TOKEN_POLL_BURST must be at least 1"
+#endif
+
+/* Token windows may spill into the data phase; it must fit the shortest (16-byte CSD). */
+#if (SD_TOKEN_POLL_BURST > 16U)
+#error "SD_TOKEN_POLL_BURST must not exceed 16"
+#endif
+
+/* SPI transfer backends (SD_SetTransport). */
+typedef enum {
+    SD_XFER_POLL = 0, // Blocking HAL_SPI_Transmit/TransmitReceive
+    SD_XFER_IRQ,      // HAL_SPI_*_IT, task sleeps until the completion callback
+    SD_XFER_DMA,      // HAL_SPI_*_DMA on SD_DMA_ALIGNMENT-aligned buffers
+    SD_XFER_COUNT
+} SD_XferMode;
+
+/* How far SD_RECOVERY had to go before a retry (SD_Stats.recoveries). */
+typedef enum {
+    SD_RECOVER_STATUS = 0, // CMD12 + CMD13: card answered ready, status read clears its errors
+    SD_RECOVER_DOWNCLOCK,  // as above after a CRC error, and the bus stepped down one notch
+    SD_RECOVER_REINIT,     // card silent, reset or in error: CMD0 and full re-identification
+    SD_RECOVER_FAILED,     // re-identification failed; the handle is left uninitialized
+    SD_RECOVER_COUNT
+} SD_RecoverStep;
+
+/* DMA stream settings owned by the driver (SD_DMA_PROFILE, SD_SetDmaProfile). */
+typedef struct {
+    uint32_t priority;  // DMA_PRIORITY_LOW .. DMA_PRIORITY_VERY_HIGH
+    bool fifo;          // FIFO mode with a full threshold; off = direct mode
+    bool word_mem;      // Pack 16-byte aligned transfers into words (needs fifo)
+    uint32_t mem_burst; // Burst for packed transfers: DMA_MBURST_SINGLE or DMA_MBURST_INC4
+} SD_DmaProfile;
+
+typedef enum {
+    SD_LAT_CMD17 = 0, // Single-block read, command to CRC
+    SD_LAT_CMD18,     // Multi-block read, command to CMD12
+    SD_LAT_CMD24,     // Single-block write, command to end of busy
+    SD_LAT_CMD25,     // Multi-block write, command to end of final busy
+    SD_LAT_BUSY,      // Each wait for DO to go high (card busy)
+    SD_LAT_TOKEN,     // Each wait for a read data token
+    SD_LAT_DMA,       // Each wait for a DMA or IRQ transfer to complete
+    SD_LAT_COUNT
+} SD_LatencyOp;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t hist[SD_LAT_BUCKETS];
+} SD_LatencyHist;
+
+/* Operations with an energy split: SD_LAT_CMD17 .. SD_LAT_CMD25. */
+#define SD_ENERGY_OPS 4U
+
+/* Time split of one kind of operation (SD_ENERGY_STATS), in DWT cycles. */
+typedef struct {
+    uint32_t ops;          // Operations counted (each retry is one)
+    uint64_t bytes;        // Payload they moved
+    uint64_t total_cycles; // Their wall time
+    uint64_t card_cycles;  // Waiting on the card: write busy and data tokens, polls included
+    uint64_t bus_cycles;   // Clocking commands and data, polls excluded
+    uint64_t idle_cycles;  // Card selected, neither of the above
+} SD_EnergyOp;
+
 typedef struct {
     uint32_t read_ops;
     uint32_t write_ops;
@@ -68,8 +500,165 @@ typedef struct {
     uint32_t init_attempts;
     uint32_t error_count;
     uint32_t timeout_count;
+    uint32_t readahead_hits;   // diskio reads served from the read-ahead window
+    uint32_t readahead_misses; // diskio reads that went to the card
+    uint32_t rmw_avoided;      // diskio reads of never-written sectors served as zeros
+    uint32_t dma_direct_blocks;  // blocks moved by DMA straight to/from the caller's buffer
+    uint32_t dma_bounced_blocks; // unaligned blocks moved by DMA via the bounce buffer
+    uint32_t xfers[SD_XFER_COUNT]; // SPI transfers issued per backend (indexed by SD_XferMode)
+    uint32_t frame16_blocks;     // blocks moved in 16-bit frames (SD_SPI_FRAME16)
+    uint32_t dma_packed;         // DMA transfers with a word-packed memory side (SD_DMA_PROFILE)
+    uint32_t dma_reconfigs;      // HAL_DMA_Init calls made to switch a stream's layout
+    uint32_t dma_desc_starts;    // DMA transfers started from stream descriptors (SD_DMA_DESCRIPTORS)
+    uint32_t dcache_ops;         // D-cache clean/invalidate calls made for DMA buffers
+    uint32_t dcache_skips;       // ones left out: non-cacheable buffer or covered by the request
+    uint32_t rx_stream_tokens;   // CMD18 tokens found in the previous block's DMA (SD_READ_STREAM_GAP)
+    uint32_t crc_errors;         // received blocks whose CRC16 did not match (CRC mode)
+    uint32_t deadline_requests;  // requests issued with a deadline (SD_*BlocksDeadline, async)
+    uint32_t deadline_misses;    // of those, given up or completed after their deadline
+    uint32_t idle_gates;         // times the SPI clock was gated after SD_IDLE_GATE_MS idle
+    uint32_t idle_gated_ms;      // total time spent gated (counted on wake-up)
+    uint32_t early_timeouts;     // waits cut short by a learned limit (SD_ADAPTIVE_TIMEOUTS)
+    uint32_t busy_deferred;      // write busy waits left to the next command (SD_SPLIT_BUSY)
+    uint32_t busy_deferred_idle; // of those, over by the time the card was selected again
+    uint32_t ready_skips;        // commands sent without a ready wait (SD_READY_TRACKING)
+    uint32_t session_reads;      // reads that carried on an open CMD18 (SD_READ_SESSION)
+    uint32_t session_writes;     // writes that carried on an open CMD25 (SD_WRITE_SESSION)
+    uint32_t session_stops;      // open sessions stopped by other I/O, a jump, sync or idling
+    uint32_t resumes;            // multi-block retries started from the first failed block
+    uint64_t resumed_bytes;      // bytes done before those failures and not transferred again
+    uint32_t recoveries[SD_RECOVER_COUNT]; // recovery runs by outcome (SD_RECOVERY)
+    uint32_t recovery_ms;        // total time spent recovering
+    uint32_t recovery_max_ms;    // longest single recovery
+    uint16_t last_card_status;   // CMD13 R1 << 8 | R2 of the last recovery (0xFFFF = silent)
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+#if (SD_LATENCY_STATS == 1)
+    SD_LatencyHist latency[SD_LAT_COUNT]; // Indexed by SD_LatencyOp, cycles per SystemCoreClock
+    uint64_t busy_sleep_cycles; // of SD_LAT_BUSY, time in backoff sleeps (the rest is spinning)
+    uint64_t bus_xfer_cycles;   // SPI transfers in flight: polled, or DMA/IRQ from arming to completion
+    uint64_t bus_gap_cycles;    // card selected, no transfer in flight (set-up, backoff sleeps in waits)
+    uint32_t bus_gap_max_cycles; // longest of those gaps
+    uint32_t bus_window_ms;     // time since the counters were reset (filled in by SD_GetStats)
+#endif
+#if (SD_ENERGY_STATS == 1)
+    SD_EnergyOp energy[SD_ENERGY_OPS]; // Indexed by SD_LatencyOp, CMD17 .. CMD25
+    uint64_t card_active_cycles; // every wait on the card, inside an operation or not
+    uint64_t bus_data_cycles;    // of bus_xfer_cycles, card selected and not one of those waits
+    uint64_t selected_cycles;    // card selected (CS low), open sessions included
+#endif
+#if (SD_SLO_ENABLED == 1)
+    uint32_t slo_violations[SD_LAT_COUNT]; // samples over their SD_SetLatencySlo limit
+#endif
 } SD_Stats;
 
+/* One segment of a vectored transfer (SD_ReadBlocksV/SD_WriteBlocksV). */
+typedef struct {
+    void *base;   // Segment start
+    uint32_t len; // Bytes, a non-zero multiple of SD_BLOCK_SIZE
+} SD_IoVec;
+
+/* One latency sample over its limit (SD_SetLatencySlo), with the trace leading up to it. */
+typedef struct {
+    SD_LatencyOp op;      // Operation that was too slow
+    uint32_t limit_us;    // Its limit when the sample was taken
+    uint32_t latency_us;  // The sample
+    uint32_t time;        // DWT cycles at the end of the sample
+    uint32_t count;       // Violations of this handle so far, this one included
+    uint32_t events;      // Valid entries in trace (0 without SD_TRACE_ENABLED)
+    SD_TraceEvent trace[SD_SLO_TRACE_EVENTS]; // Newest trace events, oldest first
+} SD_SloViolation;
+
+/* Called in the driver, with the bus held, for every violation; must not use the card. */
+typedef void (*SD_SloCallback)(void *context, const SD_SloViolation *violation);
+
+/* Extra clocks to gate with the SPI (e.g. a DMA controller only the card uses). */
+typedef void (*SD_ClockGateFn)(void *context, bool enable);
+
+/*
+ * Called between chunks of a long CMD18/CMD25 run with the blocks moved so far
+ * and the run length, card selected and bus held; must be short and must not
+ * use the card or the bus.
+ */
+typedef void (*SD_ChunkFn)(void *context, uint32_t done, uint32_t count);
+
+/* DMA/IRQ completion for a device other than an SD handle holding a shared bus. */
+typedef void (*SD_BusDoneFn)(void *owner, bool tx, bool rx, bool error);
+
+/* One SPI shared by several devices (SD_SHARED_BUS). */
+typedef struct {
+    SPI_HandleTypeDef *hspi; // The shared SPI; its DMA streams go with it
+    void *owner;             // Device the SPI is set up for, NULL until first taken
+    bool owner_is_sd;        // owner is an SD_Handle_t
+    SD_BusDoneFn done;       // Completion callback of a non-SD owner, NULL = none
+    uint32_t handoffs;       // Times the bus changed hands
+    uint32_t reclocks;       // Prescaler changes on a handoff
+#ifdef USE_FREERTOS
+    SemaphoreHandle_t mutex; // Taken by every device on the bus
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t mutex_buffer;
+#endif
+#endif
+} SD_Bus_t;
+
+/* Phase times of the last SD_SPI_Init, in microseconds (tick resolution without DWT). */
+typedef struct {
+    uint32_t cmd0_us;      // Power-up clocks and CMD0 until idle
+    uint32_t cmd8_us;      // CMD8 interface condition
+    uint32_t acmd41_us;    // First ACMD41 until the card left idle
+    uint32_t setup_us;     // CMD58 OCR and CMD16
+    uint32_t regs_us;      // Speed negotiation and CSD (CID with SD_INIT_CACHE)
+    uint32_t total_us;     // Whole call
+    uint32_t acmd41_polls; // CMD55+ACMD41 pairs sent
+    bool cache_hit;        // OCR/CSD taken from the init cache (CID matched)
+} SD_InitTiming;
+
+/* Registers of a previously identified card (SD_INIT_CACHE). */
+typedef struct {
+    uint8_t cid[16];
+    uint8_t csd[16];
+    uint8_t ocr[4];
+    bool valid;
+} SD_InitCache;
+
+/* Wait-time histogram behind one adaptive timeout (SD_ADAPTIVE_TIMEOUTS). */
+typedef struct {
+    uint16_t hist[16];   // Waits per millisecond band (see sd_spi.c), decaying
+    uint16_t count;      // Sum of hist
+    uint32_t timeout_ms; // Learned limit, 0 = use the fixed one
+} SD_AdaptTimer;
+
+/* Decoded card registers and the settings derived from them (SD_CARD_INFO). */
+typedef struct {
+    /* CID */
+    uint8_t manufacturer_id;   // MID (assigned by the SD-3C)
+    char oem_id[3];            // OID, two ASCII characters
+    char product_name[6];      // PNM, five ASCII characters
+    uint8_t revision;          // PRV, BCD major.minor (0x10 = 1.0)
+    uint32_t serial;           // PSN
+    uint16_t mfg_year;         // MDT year, 2000..2255
+    uint8_t mfg_month;         // MDT month, 1..12
+    /* CSD */
+    uint8_t csd_version;       // 1 (SDSC) or 2 (SDHC/SDXC)
+    uint16_t ccc;              // Supported command classes, bit n = class n
+    uint32_t taac_ns;          // TAAC: asynchronous read access time
+    uint8_t nsac;              // NSAC: clock-dependent access time, in 100-clock units
+    uint32_t tran_speed_kbps;  // TRAN_SPEED: maximum bus rate (25000 = 25 MHz)
+    uint8_t r2w_factor;        // R2W_FACTOR: log2 of write time / read time
+    uint8_t write_bl_len;      // WRITE_BL_LEN: log2 of the write block (9 = 512 B)
+    /* SD Status */
+    uint8_t speed_class;       // 0, 2, 4, 6 or 10 (Class 10)
+    uint8_t uhs_grade;         // 0, 1 or 3 (U1, U3)
+    uint8_t video_class;       // 0, 6, 10, 30, 60 or 90 (V6..V90)
+    uint32_t au_blocks;        // AU_SIZE in 512-byte blocks, 0 = not defined
+    /* Derived */
+    uint32_t read_timeout_ms;  // Data-token wait applied to reads
+    uint32_t write_timeout_ms; // Busy wait applied to writes
+    bool cid_valid;            // CID read with a matching CRC7
+    bool csd_valid;            // CSD fields above are set
+    bool status_valid;         // ACMD13 answered
+} SD_CardInfo;
+
 typedef struct {
     SPI_HandleTypeDef *hspi;   // SPI handle
     GPIO_TypeDef *cs_port;     // Chip select GPIO port
@@ -78,21 +667,124 @@ typedef struct {
     uint16_t cd_pin;           // Optional card-detect pin
     bool cd_active_low;        // Card-detect polarity
     bool has_cd;               // Card-detect enabled
+    bool cd_irq;               // Presence cached from EXTI edges (SD_SetCardDetectIrq)
+    volatile bool cd_present;  // Debounced presence (cd_irq mode)
+    volatile bool cd_pending;  // Edge seen, waiting out SD_CD_DEBOUNCE_MS
+    volatile uint32_t cd_edge_tick; // HAL tick of the last edge
+    volatile uint32_t cd_events;    // Debounced insert/remove events (cd_irq mode)
     bool initialized;          // Card initialization status
     bool is_sdhc;              // SDHC/SDXC card flag
     bool use_dma;              // DMA usage flag
+    bool use_irq;              // Interrupt-driven transfers when DMA is off (SD_XFER_IRQ)
+    uint16_t xfer_threshold;   // Transfers shorter than this are polled (SD_SetTransport)
+    bool acmd23_ok;            // Card accepts ACMD23 pre-erase hints
+    bool crc_on;               // CMD59 accepted: data CRC16 sent and checked
+    uint8_t instance;          // Registry slot assigned by SD_Init
     volatile bool dma_tx_done; // DMA TX completion flag
     volatile bool dma_rx_done; // DMA RX completion flag
     volatile bool dma_error;   // DMA transfer error flag
+#if (SD_TRACE_ENABLED == 1)
+    volatile uint32_t dma_start; // Cycle count at the last DMA start (trace durations)
+#endif
+#if (SD_DMA_PROFILE == 1)
+    SD_DmaProfile dma_profile; // Applied to both DMA streams
+#endif
+#if (SD_DMA_PROFILE == 1) || (SD_SPI_FRAME16 == 1) || (SD_DMA_FIXED_TX == 1)
+    uint8_t dma_layout[2];     // Current TX/RX stream layout, 0 = unknown (re-init first)
+#endif
+    const uint8_t *dcache_lo;  // Caller range maintained once for the running CMD18/CMD25
+    const uint8_t *dcache_hi;  // (end, exclusive; lo == hi: none)
+#if (SD_DMA_DESCRIPTORS == 1)
+    uint32_t dma_desc[3];      // Stream CR values: TX, RX into the buffer, RX discarded
+    bool dma_desc_ready;       // dma_desc matches the streams (captured since the last init)
+#endif
 #ifdef USE_FREERTOS
     SemaphoreHandle_t mutex;      // FreeRTOS mutex for thread safety
+#if (SD_DMA_NOTIFY == 1)
+    volatile TaskHandle_t xfer_task; // Task waiting for the armed DMA/IRQ transfer
+    volatile uint8_t xfer_gives;     // Notifications the callbacks sent to xfer_task
+#else
     SemaphoreHandle_t dma_tx_sem; // DMA TX completion semaphore
     SemaphoreHandle_t dma_rx_sem; // DMA RX completion semaphore
+#endif
+#endif
+#if (SD_TOKEN_POLL_BURST > 1U)
+    uint8_t rx_carry[SD_TOKEN_POLL_BURST]; // Data bytes clocked in behind a data token
+    uint8_t rx_carry_len;                  // Valid bytes in rx_carry
 #endif
     SD_Status last_status;    // Last operation status
     uint32_t capacity_blocks; // Card capacity in 512-byte blocks
+    uint32_t erase_sector;    // CSD erase sector in 512-byte blocks
+    uint32_t erase_block;     // AU from ACMD13, else erase_sector; 0 until first queried
     uint32_t block_size;      // Logical block size (bytes)
+    uint32_t bus_prescaler;   // Negotiated SPI baud-rate prescaler (SPI_BAUDRATEPRESCALER_x)
     SD_Stats stats;           // Driver statistics
+#if (SD_STATS_SNAPSHOT == 1)
+    SD_Stats stats_pub[2];    // Published copies; readers use stats_pub[stats_seq & 1]
+    uint32_t stats_seq;       // Bumped twice per publish (SD_STATS_SNAPSHOT)
+#endif
+#if (SD_LATENCY_STATS == 1)
+    uint32_t stats_tick;      // HAL tick of the last counter reset (bus_window_ms)
+    uint32_t bus_mark;        // Cycle count where the running transfer or gap began
+    bool bus_active;          // A transfer is in flight since bus_mark
+    bool bus_selected;        // CS asserted: time without a transfer counts as a gap
+#endif
+#if (SD_ENERGY_STATS == 1)
+    bool energy_wait;         // In a wait on the card: transfers are polls
+    uint32_t select_mark;     // Cycle count when the card was selected
+    struct {
+        uint32_t mark;        // Cycle count at the start of the running operation
+        uint64_t card;        // card_active_cycles then
+        uint64_t bus;         // bus_data_cycles then
+        uint64_t selected;    // selected_cycles then
+    } energy_start;
+#endif
+#if (SD_SLO_ENABLED == 1)
+    uint32_t slo_us[SD_LAT_COUNT]; // Latency limits by SD_LatencyOp, 0 = none
+    SD_SloCallback slo_fn;    // Called on each violation, NULL = none
+    void *slo_ctx;
+    SD_SloViolation slo_last; // Last violation, snapshot included
+#endif
+    SD_InitTiming init_timing; // Phase times of the last identification
+#if (SD_IDLE_GATE_MS > 0U)
+    volatile bool gated;      // SPI de-initialized by the idle manager
+    uint32_t last_io_tick;    // HAL tick when the last request released the bus
+    uint32_t gate_tick;       // HAL tick when the clocks were gated
+    SD_ClockGateFn clock_gate; // Optional hook for further clocks
+    void *clock_gate_ctx;
+#endif
+#if (SD_CHUNK_BLOCKS > 0U)
+    SD_ChunkFn chunk_fn;      // Called every SD_CHUNK_BLOCKS blocks of a run, NULL = none
+    void *chunk_ctx;
+#endif
+#if (SD_INIT_CACHE == 1)
+    SD_InitCache init_cache;  // Last identified card, reused when the CID matches
+#endif
+#if (SD_CARD_INFO == 1)
+    SD_CardInfo card_info;    // Decoded at init
+#endif
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+    SD_AdaptTimer adapt[2];   // Data-token (0) and write-busy (1) waits
+#endif
+#if (SD_SHARED_BUS == 1)
+    SD_Bus_t *bus;            // Shared bus (SD_BusAttach), NULL = the handle locks alone
+#endif
+#if (SD_HIGH_SPEED == 1)
+    uint16_t switch_support[6]; // CMD6 support bits by function group (index 0 = group 1)
+    bool high_speed;            // Card switched to high-speed timing at init
+#endif
+#if (SD_READY_TRACKING == 1)
+    bool card_ready;          // Card known not busy: the next command skips its ready wait
+#endif
+#if (SD_SPLIT_BUSY == 1)
+    bool busy_pending;        // Program busy of the last write not waited out yet
+    uint32_t busy_tick;       // HAL tick when that write was accepted
+#endif
+#if SD_SESSIONS
+    uint8_t session;          // Open multi-block command left running (SD_SESSION_x in sd_spi.c)
+    uint32_t session_next;    // Sector after the last transfer: where an open command goes on
+    uint32_t session_tick;    // HAL tick of the last block through the session
+#endif
 } SD_Handle_t;
 
 /* Configuration defaults (override in build system or before include). */
@@ -116,6 +808,10 @@ typedef struct {
 #define SD_WRITE_BUSY_TIMEOUT_MS 500U
 #endif
 
+#ifndef SD_ERASE_TIMEOUT_MS
+#define SD_ERASE_TIMEOUT_MS 30000U
+#endif
+
 #ifndef SD_INIT_TIMEOUT_MS
 #define SD_INIT_TIMEOUT_MS 1000U
 #endif
@@ -124,14 +820,218 @@ typedef struct {
 #define SD_DMA_TIMEOUT_MS 500U
 #endif
 
+/* Quiet time after the last card-detect edge before presence is updated. */
+#ifndef SD_CD_DEBOUNCE_MS
+#define SD_CD_DEBOUNCE_MS 50U
+#endif
+
 #ifndef SD_MUTEX_TIMEOUT_MS
 #define SD_MUTEX_TIMEOUT_MS 1000U
 #endif
 
+/*
+ * FreeRTOS: signal DMA/IRQ completion with a direct-to-task notification of the
+ * task that started the transfer instead of two binary semaphores per handle.
+ * The waiting task's notification value is used while a transfer is in flight;
+ * counting wake-ups (xTaskNotifyGive) that arrive meanwhile are handed back to
+ * it afterwards, but a task must not run SD I/O while a value-carrying
+ * notification (SD_AsyncWait) may be delivered to it.
+ */
+#ifndef SD_DMA_NOTIFY
+#define SD_DMA_NOTIFY 0
+#endif
+
+/*
+ * Register-level fast path: polled transfers of at most SD_SPI_LL_MAX_BYTES
+ * (command frames, R1, CRC and token/busy polls) drive SPI DR/SR directly
+ * instead of HAL_SPI_Transmit/TransmitReceive, skipping the HAL lock, state
+ * and timeout bookkeeping. For SPI peripherals with SR.TXE/RXNE and DR (STM32
+ * F0/F1/F2/F3/F4/F7/L0/L1/L4/G0/G4); SD_LL_* in sd_spi.c are the access hooks.
+ */
+#ifndef SD_SPI_LL_FASTPATH
+#define SD_SPI_LL_FASTPATH 0
+#endif
+
+#ifndef SD_SPI_LL_MAX_BYTES
+#define SD_SPI_LL_MAX_BYTES 32U
+#endif
+
+/* Flag polls per byte before the fast path gives up with SD_TIMEOUT. */
+#ifndef SD_SPI_LL_SPIN_LIMIT
+#define SD_SPI_LL_SPIN_LIMIT 100000U
+#endif
+
+/*
+ * Run the byte-level hot path from RAM: SD_SendCommand, SD_WaitReady and the
+ * token/busy polls, the byte exchange routines (the whole polled loop with
+ * SD_SPI_LL_FASTPATH) and the HAL SPI callbacks go to SD_RAMFUNC_SECTION
+ * instead of .text, so flash wait states and ART misses stop stretching each
+ * polled byte. The CubeMX linker scripts already copy ".RamFunc" into SRAM
+ * with .data at start-up; on parts with ITCM name its input section here.
+ */
+#ifndef SD_RAM_FUNCS
+#define SD_RAM_FUNCS 0
+#endif
+
+#ifndef SD_RAMFUNC_SECTION
+#define SD_RAMFUNC_SECTION ".RamFunc"
+#endif
+
+/*
+ * 16-bit frames for DMA data phases: each 512-byte block moves as 256
+ * half-word DMA requests instead of 512 byte requests, with the SPI switched
+ * to 16-bit around it (HAL_SPI_Init) and back to 8-bit for commands, tokens
+ * and CRC. The DMA streams are re-initialized for half-words on the first
+ * wide block and stay so until a byte-frame DMA transfer needs them back. Byte order is fixed up in the
+ * driver: blocks are pair-swapped through the bounce buffer on transmit and
+ * in place on receive. Single-block and non-pipelined DMA transfers only;
+ * pipelined CMD18/CMD25 keep byte frames.
+ */
+#ifndef SD_SPI_FRAME16
+#define SD_SPI_FRAME16 0
+#endif
+
+#if (SD_SPI_FRAME16 == 1) && (SD_DMA_BOUNCE != 1)
+#error "SD_SPI_FRAME16 needs SD_DMA_BOUNCE 1 (transmit blocks are swapped through the bounce buffer)"
+#endif
+
+/*
+ * Driver-owned DMA stream profile (STM32F2/F4/F7 stream DMA). SD_Init applies
+ * priority and FIFO mode to hspi->hdmatx/hdmarx instead of keeping the CubeMX
+ * settings; SD_SetDmaProfile changes them at run time. With SD_DMA_WORD_MEM,
+ * DMA transfers whose buffer is 16-byte aligned and a multiple of 16 bytes
+ * have the FIFO pack the memory side into words, in SD_DMA_MEM_BURST bursts:
+ * a quarter of the bus-matrix requests, so the streams keep up when other
+ * masters load the bus. Other transfers use byte beats; a stream is only
+ * re-initialized when a transfer needs the other layout.
+ */
+#ifndef SD_DMA_PROFILE
+#define SD_DMA_PROFILE 0
+#endif
+
+#ifndef SD_DMA_PRIORITY
+#define SD_DMA_PRIORITY DMA_PRIORITY_HIGH
+#endif
+
+#ifndef SD_DMA_FIFO
+#define SD_DMA_FIFO 1
+#endif
+
+#ifndef SD_DMA_WORD_MEM
+#define SD_DMA_WORD_MEM 1
+#endif
+
+/* DMA_MBURST_SINGLE or DMA_MBURST_INC4: four words fill the 16-byte FIFO. */
+#ifndef SD_DMA_MEM_BURST
+#define SD_DMA_MEM_BURST DMA_MBURST_INC4
+#endif
+
+#if (SD_DMA_PROFILE == 1) && (SD_DMA_WORD_MEM == 1) && (SD_DMA_FIFO != 1)
+#error "SD_DMA_WORD_MEM needs SD_DMA_FIFO 1 (direct mode cannot pack)"
+#endif
+
+/*
+ * Receive-only phases (data blocks, CRC, polls) clock out 0xFF. By default it
+ * comes from a 0xFF buffer as long as the longest such transfer (a block plus
+ * CRC, ~0.5 KB). With 1 the TX DMA stream re-reads one 0xFF beat with memory
+ * increment off instead, so the buffer shrinks to 16 bytes and a DMA receive
+ * is no longer limited by its length; polled and IRQ receives pre-fill the
+ * receive buffer with 0xFF and send it in place.
+ */
+#ifndef SD_DMA_FIXED_TX
+#define SD_DMA_FIXED_TX 0
+#endif
+
+/*
+ * DMA data phases without HAL_SPI_TransmitReceive_DMA/Transmit_DMA: the
+ * driver captures each stream's configuration once (as HAL_DMA_Init left
+ * it) and starts a transfer by writing the flag-clear, NDTR, M0AR and CR
+ * registers from those descriptors, then enabling the SPI DMA requests. A
+ * CMD18/CMD25 block therefore costs a handful of stores instead of the HAL's
+ * state checks, callback set-up and stream re-configuration. Transmits run
+ * full-duplex into a held discard byte, so the RX stream's completion also
+ * ends a write. STM32F2/F4/F7 stream DMA; completion still arrives through
+ * HAL_DMA_IRQHandler of the RX stream (CubeMX's DMA interrupt handlers), and
+ * the streams must be linked to the SPI handle (__HAL_LINKDMA). SD_DESC_* in
+ * sd_spi.c are the register hooks.
+ */
+#ifndef SD_DMA_DESCRIPTORS
+#define SD_DMA_DESCRIPTORS 0
+#endif
+
+/* Default SD_SetTransport threshold: shorter transfers skip DMA/IRQ set-up and poll. */
+#ifndef SD_XFER_THRESHOLD
+#define SD_XFER_THRESHOLD 32U
+#endif
+
 #ifndef SD_MAX_RETRIES
 #define SD_MAX_RETRIES 2U
 #endif
 
+/* Blocks per command of a vectored transfer (block pointers on the stack, 4 bytes each). */
+#ifndef SD_IOV_MAX_BLOCKS
+#define SD_IOV_MAX_BLOCKS 64U
+#endif
+
+#if (SD_IOV_MAX_BLOCKS < 2U)
+#error "SD_IOV_MAX_BLOCKS must be at least 2"
+#endif
+
+/*
+ * Sleep before retry n (0-based) of a transfer: SD_RETRY_BACKOFF_MS << n, at
+ * most SD_RETRY_BACKOFF_MAX_MS, and never past the request's deadline. A
+ * multi-block retry resumes at the first block that did not complete.
+ */
+#ifndef SD_RETRY_BACKOFF_MS
+#define SD_RETRY_BACKOFF_MS 1U
+#endif
+
+#ifndef SD_RETRY_BACKOFF_MAX_MS
+#define SD_RETRY_BACKOFF_MAX_MS 16U
+#endif
+
+#if (SD_RETRY_BACKOFF_MS < 1U) || (SD_RETRY_BACKOFF_MAX_MS < SD_RETRY_BACKOFF_MS)
+#error "SD_RETRY_BACKOFF_MS must be >= 1 and <= SD_RETRY_BACKOFF_MAX_MS"
+#endif
+
+/*
+ * Error recovery before each retry of a failed transfer. CMD12 ends a
+ * transfer the card may still be in, then CMD13 asks for its status. A card
+ * that answers ready is retried as is (one notch slower after a CRC error);
+ * one that stays silent, reports idle (power glitch) or an error it cannot
+ * clear is reset with CMD0 and re-identified under the same lock, so the
+ * caller sees a retry rather than a remount. 0 = retry without asking.
+ */
+#ifndef SD_RECOVERY
+#define SD_RECOVERY 0
+#endif
+
+/* SPI prescaler used during card identification (must give <= 400 kHz). */
+#ifndef SD_SPI_INIT_PRESCALER
+#define SD_SPI_INIT_PRESCALER SPI_BAUDRATEPRESCALER_256
+#endif
+
+/* Prescaler tried first after identification; stepped down on CSD errors. */
+#ifndef SD_SPI_FAST_PRESCALER
+#define SD_SPI_FAST_PRESCALER SPI_BAUDRATEPRESCALER_4
+#endif
+
+/*
+ * High-speed timing: after identification CMD6 checks whether the card has
+ * the high-speed access mode (group 1, function 1: 50 MHz) and switches to
+ * it, and the bus is then negotiated again from SD_SPI_HS_PRESCALER on a
+ * fresh CSD, whose TRAN_SPEED now reads 50 MHz. A card without command
+ * class 10 rejects CMD6 and stays at default speed. 0 = no CMD6.
+ */
+#ifndef SD_HIGH_SPEED
+#define SD_HIGH_SPEED 0
+#endif
+
+/* Prescaler tried first once the card runs high-speed timing. */
+#ifndef SD_SPI_HS_PRESCALER
+#define SD_SPI_HS_PRESCALER SPI_BAUDRATEPRESCALER_2
+#endif
+
 #if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
 #ifndef SD_DMA_ALIGNMENT
 #define SD_DMA_ALIGNMENT 32U
@@ -142,11 +1042,32 @@ typedef struct {
 #endif
 #endif
 
+/*
+ * Place the driver's own DMA buffers (idle 0xFF source, CMD18/CMD25 staging,
+ * bounce buffers) in SD_DMA_NOCACHE_SECTION. Map that section to RAM covered
+ * by a non-cacheable MPU region (SD_DmaSetNoCache) and the per-block cache
+ * clean/invalidate of those buffers goes away on F7/H7. On parts without a
+ * D-cache the section only moves them.
+ */
+#ifndef SD_DMA_NOCACHE
+#define SD_DMA_NOCACHE 0
+#endif
+
+#ifndef SD_DMA_NOCACHE_SECTION
+#define SD_DMA_NOCACHE_SECTION ".sd_nocache"
+#endif
+
+/* SD_DmaSetNoCache without an MPU region: the application's MPU set-up already covers it. */
+#define SD_MPU_REGION_NONE 0xFFU
+
 #ifndef SD_LOG_ENABLED
 #define SD_LOG_ENABLED 0
 #endif
 
-#if SD_LOG_ENABLED
+#if SD_LOG_ENABLED && SD_LOGSINK_ENABLED
+#define SD_LOG(...) SD_LOG_AT(SD_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define SD_LOG_ERROR(...) SD_LOG_AT(SD_LOG_LEVEL_ERROR, __VA_ARGS__)
+#elif SD_LOG_ENABLED
 #include <stdio.h>
 #define SD_LOG(fmt, ...) printf(fmt, ##__VA_ARGS__)
 #define SD_LOG_ERROR(fmt, ...) printf(fmt, ##__VA_ARGS__)
@@ -168,7 +1089,10 @@ typedef struct {
  * @param cs_port Chip select GPIO port
  * @param cs_pin Chip select GPIO pin
  * @param use_dma Whether to use DMA for transfers
- * @return SD_Status
+ * @return SD_Status (SD_ERROR when all SD_MAX_INSTANCES slots are taken)
+ *
+ * Note: Registers the handle in a free instance slot; re-initializing the same
+ * handle reuses its slot. SD_DeInit releases it.
  */
 SD_Status SD_Init(SD_Handle_t *sd_handle, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port,
                   uint16_t cs_pin, bool use_dma);
@@ -180,6 +1104,104 @@ SD_Status SD_Init(SD_Handle_t *sd_handle, SPI_HandleTypeDef *hspi, GPIO_TypeDef
  */
 SD_Status SD_SPI_Init(SD_Handle_t *sd_handle);
 
+/**
+ * @brief Identify a newly inserted card on an already set-up handle
+ * @param sd_handle Pointer to a handle registered by SD_Init
+ * @return SD_Status (SD_ERROR for a handle SD_Init has not registered,
+ *         SD_NO_MEDIA when card detect reports an empty socket)
+ *
+ * Note: For hot swap. Unlike SD_DeInit + SD_Init it keeps the RTOS mutex and
+ * semaphores, the instance slot, the transport and DMA settings, statistics,
+ * SLO limits and the cached card info, and only forgets the card-specific
+ * state before running identification under the bus lock. The same card
+ * re-inserted takes the SD_INIT_CACHE path.
+ */
+SD_Status SD_Reattach(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Set up a shared SPI bus
+ * @param bus Bus object; must outlive the devices using it
+ * @param hspi SPI handle the devices share
+ * @return SD_Status (SD_UNSUPPORTED when SD_SHARED_BUS is 0)
+ */
+SD_Status SD_BusInit(SD_Bus_t *bus, SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Share a bus with other devices
+ * @param sd_handle Handle initialized by SD_Init on bus->hspi, before SD_SPI_Init
+ * @param bus Bus set up by SD_BusInit
+ * @return SD_Status (SD_PARAM when the handle uses another SPI)
+ *
+ * Note: every device on the SPI must go through the bus. SD_Init detaches
+ * the handle again.
+ */
+SD_Status SD_BusAttach(SD_Handle_t *sd_handle, SD_Bus_t *bus);
+
+/**
+ * @brief Take a shared bus for a device that is not an SD handle (e.g. SPI flash)
+ * @param bus Bus set up by SD_BusInit
+ * @param owner The device, identifying it across handoffs
+ * @param prescaler SPI_BAUDRATEPRESCALER_x the device runs at
+ * @param done Called from the HAL SPI callbacks while owner holds the bus, or NULL
+ * @param timeout_ms Longest wait for the bus
+ * @return SD_Status (SD_BUSY when the bus stays taken or from an ISR)
+ *
+ * Note: the caller drives its own chip select and releases the bus with
+ * SD_BusRelease. Leave the other hspi->Init fields as the cards use them.
+ */
+SD_Status SD_BusAcquire(SD_Bus_t *bus, void *owner, uint32_t prescaler, SD_BusDoneFn done,
+                        uint32_t timeout_ms);
+
+/* Release a bus taken with SD_BusAcquire. */
+void SD_BusRelease(SD_Bus_t *bus);
+
+/**
+ * @brief Select the SPI transfer backend
+ * @param sd_handle Pointer to SD handle structure (SD_Init done)
+ * @param mode SD_XFER_POLL, SD_XFER_IRQ or SD_XFER_DMA (as use_dma in SD_Init)
+ * @param threshold Transfers shorter than this many bytes are polled whatever
+ *        the mode (command frames, R1/CRC bytes, poll bursts); 0 = never
+ * @return SD_Status (SD_PARAM for an unknown mode)
+ *
+ * Note: SD_Init selects SD_XFER_DMA or SD_XFER_POLL from use_dma with
+ * SD_XFER_THRESHOLD. In SD_XFER_DMA mode unaligned blocks without a bounce
+ * buffer are polled. SD_XFER_IRQ needs the SPI IRQ enabled in the NVIC.
+ */
+SD_Status SD_SetTransport(SD_Handle_t *sd_handle, SD_XferMode mode, uint16_t threshold);
+
+/**
+ * @brief Replace the DMA stream profile and apply it to both streams
+ * @param sd_handle Pointer to SD handle structure (SD_Init done)
+ * @param profile Priority, FIFO mode and memory-side packing
+ * @return SD_Status (SD_PARAM for an inconsistent profile, SD_UNSUPPORTED
+ *         when SD_DMA_PROFILE is 0)
+ *
+ * Note: word_mem needs fifo; mem_burst DMA_MBURST_INC4 needs word_mem.
+ * Streams not linked to the SPI handle yet are configured on first use.
+ */
+SD_Status SD_SetDmaProfile(SD_Handle_t *sd_handle, const SD_DmaProfile *profile);
+
+/* Current DMA stream profile (SD_UNSUPPORTED when SD_DMA_PROFILE is 0). */
+SD_Status SD_GetDmaProfile(SD_Handle_t *sd_handle, SD_DmaProfile *out);
+
+/**
+ * @brief Declare RAM that the D-cache does not cover
+ * @param base Start of the region (a power-of-two size, aligned to it, when
+ *        programming the MPU)
+ * @param size Bytes; 0 forgets the region
+ * @param mpu_region MPU region number to program as normal non-cacheable
+ *        memory, or SD_MPU_REGION_NONE when the application's MPU set-up
+ *        already does
+ * @return SD_Status (SD_PARAM for a region the MPU cannot describe,
+ *         SD_UNSUPPORTED for an MPU region on a part without an MPU)
+ *
+ * Note: DMA buffers wholly inside the region get no cache maintenance.
+ * Covering SD_DMA_NOCACHE_SECTION takes the driver's own buffers out of it;
+ * caller buffers placed there skip it too. Dirty lines of the region are
+ * written back before the MPU region is enabled. Call before I/O starts.
+ */
+SD_Status SD_DmaSetNoCache(void *base, size_t size, uint8_t mpu_region);
+
 /**
  * @brief Configure optional card-detect pin
  * @param sd_handle Pointer to SD handle structure
@@ -198,6 +1220,76 @@ SD_Status SD_SetCardDetect(SD_Handle_t *sd_handle, GPIO_TypeDef *cd_port, uint16
  */
 bool SD_IsCardPresent(SD_Handle_t *sd_handle);
 
+/**
+ * @brief Switch card detect to interrupt mode (or back to a GPIO read per call)
+ * @param sd_handle Pointer to SD handle structure (SD_SetCardDetect done)
+ * @param enable true to cache presence from SD_CardDetectIrq/SD_CardDetectTick
+ * @return SD_Status
+ *
+ * Note: Samples the pin once to seed the cached presence. Configure the CD pin
+ * as EXTI on both edges and call SD_CardDetectIrq from HAL_GPIO_EXTI_Callback.
+ */
+SD_Status SD_SetCardDetectIrq(SD_Handle_t *sd_handle, bool enable);
+
+/* EXTI hook for the CD pin (ISR-safe): records the edge, starts the debounce. */
+void SD_CardDetectIrq(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Debounce timer hook (ISR-safe); call every 1-10 ms from a timer
+ *
+ * Once the pin has been quiet for SD_CD_DEBOUNCE_MS, samples it, updates the
+ * cached presence and counts an event. Any settled edge ends the card session
+ * (the card may have been swapped), so I/O returns SD_NOT_READY until the card
+ * is initialized again.
+ */
+void SD_CardDetectTick(SD_Handle_t *sd_handle);
+
+/* Debounced card-detect events so far; a change means remount (cd_irq mode). */
+uint32_t SD_GetCardDetectEvents(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Register a hook called after the SPI is gated (false) and before it is restored (true)
+ * @param sd_handle Pointer to SD handle structure
+ * @param fn Hook, or NULL for none
+ * @param context Passed to fn
+ * @return SD_Status (SD_UNSUPPORTED when SD_IDLE_GATE_MS is 0)
+ */
+SD_Status SD_SetClockGateHook(SD_Handle_t *sd_handle, SD_ClockGateFn fn, void *context);
+
+/**
+ * @brief Gate the SPI clock if the handle has been idle for SD_IDLE_GATE_MS
+ * @param sd_handle Pointer to SD handle structure
+ * @return true if the clocks are gated after the call
+ *
+ * Note: Never blocks (skips a handle whose bus is in use). Call it from the
+ * main loop or the FreeRTOS idle hook. With SD_READ_SESSION or
+ * SD_WRITE_SESSION it also stops a session idle for its limit
+ * (SD_READ_SESSION_IDLE_MS, SD_WRITE_SESSION_IDLE_MS) and deselects the card.
+ */
+bool SD_IdlePoll(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Tickless idle hook: gate every handle whose idle window ends within expected_ms
+ * @param expected_ms Expected sleep time (from configPRE_SLEEP_PROCESSING)
+ */
+void SD_IdlePreSleep(uint32_t expected_ms);
+
+/* true while the idle manager has the SPI gated. */
+bool SD_IsClockGated(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Register a hook called every SD_CHUNK_BLOCKS blocks of a multi-block run
+ * @param sd_handle Pointer to SD handle structure
+ * @param fn Hook, or NULL for none
+ * @param context Passed to fn
+ * @return SD_Status (SD_UNSUPPORTED when SD_CHUNK_BLOCKS is 0)
+ *
+ * Note: The hook runs in the calling task, between two data blocks of the
+ * same CMD18/CMD25 (e.g. to refresh the IWDG). Its time counts towards the
+ * transfer's latency sample.
+ */
+SD_Status SD_SetChunkHook(SD_Handle_t *sd_handle, SD_ChunkFn fn, void *context);
+
 /**
  * @brief Read blocks from SD card
  * @param sd_handle Pointer to SD handle structure
@@ -210,6 +1302,19 @@ bool SD_IsCardPresent(SD_Handle_t *sd_handle);
  */
 SD_Status SD_ReadBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count);
 
+/**
+ * @brief Read consecutive sectors into separate block buffers
+ * @param sd_handle Pointer to SD handle structure
+ * @param blocks Array of count pointers, each to one 512-byte block
+ * @param sector Starting sector
+ * @param count Number of sectors to read
+ * @return SD_Status
+ *
+ * Note: Runs of two or more blocks are read with a single CMD18.
+ */
+SD_Status SD_ReadBlocksScatter(SD_Handle_t *sd_handle, uint8_t *const *blocks, uint32_t sector,
+                               uint32_t count);
+
 /**
  * @brief Write blocks to SD card
  * @param sd_handle Pointer to SD handle structure
@@ -223,6 +1328,74 @@ SD_Status SD_ReadBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector,
 SD_Status SD_WriteBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
                          uint32_t count);
 
+/**
+ * @brief Write blocks gathered from separate buffers to consecutive sectors
+ * @param sd_handle Pointer to SD handle structure
+ * @param blocks Array of count pointers, each to one 512-byte block
+ * @param sector Starting sector
+ * @param count Number of sectors to write
+ * @return SD_Status
+ *
+ * Note: Runs of two or more blocks go out as a single CMD25.
+ */
+SD_Status SD_WriteBlocksGather(SD_Handle_t *sd_handle, const uint8_t *const *blocks,
+                               uint32_t sector, uint32_t count);
+
+/**
+ * @brief Read consecutive sectors into a list of buffer segments
+ * @param sd_handle Pointer to SD handle structure
+ * @param iov Segments, filled in order; each len a multiple of SD_BLOCK_SIZE
+ * @param iovcnt Number of segments
+ * @param sector Starting sector
+ * @return SD_Status (SD_PARAM for a NULL, empty or partial-block segment)
+ *
+ * Note: Up to SD_IOV_MAX_BLOCKS blocks are read with a single CMD18; longer
+ * lists are read as consecutive runs of that many. No data is copied, so
+ * with DMA each segment should be SD_DMA_ALIGNMENT-aligned.
+ */
+SD_Status SD_ReadBlocksV(SD_Handle_t *sd_handle, const SD_IoVec *iov, uint32_t iovcnt,
+                         uint32_t sector);
+
+/**
+ * @brief Write a list of buffer segments (e.g. header + payload) to consecutive sectors
+ * @param sd_handle Pointer to SD handle structure
+ * @param iov Segments, sent in order; each len a multiple of SD_BLOCK_SIZE
+ * @param iovcnt Number of segments
+ * @param sector Starting sector
+ * @return SD_Status (SD_PARAM for a NULL, empty or partial-block segment)
+ *
+ * Note: Up to SD_IOV_MAX_BLOCKS blocks go out as a single CMD25; longer
+ * lists are written as consecutive runs of that many.
+ */
+SD_Status SD_WriteBlocksV(SD_Handle_t *sd_handle, const SD_IoVec *iov, uint32_t iovcnt,
+                          uint32_t sector);
+
+/**
+ * @brief Read blocks, giving up if the transfer cannot start before a deadline
+ * @param sd_handle Pointer to SD handle structure
+ * @param buff Buffer to store read data
+ * @param sector Starting sector
+ * @param count Number of sectors to read
+ * @param deadline Absolute HAL_GetTick() value the request should finish by
+ * @return SD_Status; SD_TIMEOUT without touching the card if the deadline
+ *         passes before the bus is free
+ *
+ * Note: The bus wait is bounded by the time left instead of SD_MUTEX_TIMEOUT_MS
+ * (under FreeRTOS the holder inherits the caller's priority meanwhile), and no
+ * retry starts after the deadline. Late completions keep their status and are
+ * counted in SD_Stats.deadline_misses.
+ */
+SD_Status SD_ReadBlocksDeadline(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector,
+                                uint32_t count, uint32_t deadline);
+
+/**
+ * @brief Write blocks, giving up if the transfer cannot start before a deadline
+ * @param deadline Absolute HAL_GetTick() value the request should finish by
+ * @return SD_Status (see SD_ReadBlocksDeadline)
+ */
+SD_Status SD_WriteBlocksDeadline(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
+                                 uint32_t count, uint32_t deadline);
+
 /**
  * @brief Read multiple blocks from SD card
  * @param sd_handle Pointer to SD handle structure
@@ -245,6 +1418,73 @@ SD_Status SD_ReadMultiBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sec
 SD_Status SD_WriteMultiBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
                               uint32_t count);
 
+/**
+ * @brief Erase a range of blocks (CMD32/CMD33/CMD38)
+ * @param sd_handle Pointer to SD handle structure
+ * @param sector First sector to erase
+ * @param count Number of sectors to erase
+ * @return SD_Status
+ *
+ * Note: Erased blocks read back as all 0x00 or all 0xFF depending on the card.
+ */
+SD_Status SD_EraseBlocks(SD_Handle_t *sd_handle, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Copy the phase timing of the last SD_SPI_Init
+ * @param sd_handle Pointer to SD handle structure
+ * @param out Destination
+ */
+void SD_GetInitTiming(SD_Handle_t *sd_handle, SD_InitTiming *out);
+
+/**
+ * @brief Export the init cache entry (SD_INIT_CACHE)
+ * @return true if out holds a valid entry
+ */
+bool SD_GetInitCache(SD_Handle_t *sd_handle, SD_InitCache *out);
+
+/**
+ * @brief Import an init cache entry saved by SD_GetInitCache (after SD_Init)
+ * @return SD_PARAM if the entry is invalid or its CID/CSD CRC7 does not match,
+ *         SD_UNSUPPORTED without SD_INIT_CACHE
+ */
+SD_Status SD_SetInitCache(SD_Handle_t *sd_handle, const SD_InitCache *cache);
+
+/**
+ * @brief Copy the CID/CSD/SD Status decoded by the last SD_SPI_Init
+ * @param sd_handle Pointer to SD handle structure
+ * @param out Destination
+ * @return SD_ERROR before a successful init, SD_UNSUPPORTED without SD_CARD_INFO
+ */
+SD_Status SD_GetCardInfo(SD_Handle_t *sd_handle, SD_CardInfo *out);
+
+/**
+ * @brief Get the limits the next data-token and write-busy waits will use
+ * @param sd_handle Pointer to SD handle structure
+ * @param read_ms Receives the data-token limit (may be NULL)
+ * @param write_ms Receives the write-busy limit (may be NULL)
+ */
+void SD_GetDataTimeouts(SD_Handle_t *sd_handle, uint32_t *read_ms, uint32_t *write_ms);
+
+/**
+ * @brief Get the SPI prescaler negotiated during SD_SPI_Init
+ * @param sd_handle Pointer to SD handle structure
+ * @return SPI_BAUDRATEPRESCALER_x value, or SD_SPI_INIT_PRESCALER before init
+ */
+uint32_t SD_GetBusPrescaler(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Change the SPI prescaler after SD_SPI_Init, e.g. to a tuned rate
+ * @param sd_handle Pointer to SD handle structure
+ * @param prescaler SPI_BAUDRATEPRESCALER_x from SD_SPI_FAST_PRESCALER to
+ *        SD_SPI_INIT_PRESCALER
+ * @return SD_PARAM out of range, SD_ERROR before init
+ *
+ * Note: A rate faster than the one negotiated at init was not proven by a
+ * CRC-checked read; prefer SD_GetBusPrescaler or slower. The next SD_Init
+ * negotiates again.
+ */
+SD_Status SD_SetBusPrescaler(SD_Handle_t *sd_handle, uint32_t prescaler);
+
 /**
  * @brief Check if card is SDHC/SDXC
  * @param sd_handle Pointer to SD handle structure
@@ -252,6 +1492,13 @@ SD_Status SD_WriteMultiBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint3
  */
 bool SD_IsSDHC(SD_Handle_t *sd_handle);
 
+/**
+ * @brief Check whether the card runs high-speed timing
+ * @param sd_handle Pointer to SD handle structure
+ * @return true if SD_HIGH_SPEED switched it at the last SD_SPI_Init
+ */
+bool SD_IsHighSpeed(SD_Handle_t *sd_handle);
+
 /**
  * @brief Check if card is initialized
  * @param sd_handle Pointer to SD handle structure
@@ -266,6 +1513,19 @@ bool SD_IsInitialized(SD_Handle_t *sd_handle);
  */
 uint32_t SD_GetBlockCount(SD_Handle_t *sd_handle);
 
+/**
+ * @brief Get the card's erase block (allocation unit) in 512-byte blocks
+ * @param sd_handle Pointer to SD handle structure
+ * @param blocks Receives the erase block size
+ * @return SD_Status
+ *
+ * Note: The first call after init reads the SD Status register (ACMD13) for
+ * AU_SIZE and caches the result in the handle. A card without a defined AU
+ * reports the CSD erase sector instead (64 KiB on SDHC/SDXC), and 1 if that
+ * is unknown too. SDXC AUs of 12 and 24 MiB are not powers of two.
+ */
+SD_Status SD_GetEraseBlockSize(SD_Handle_t *sd_handle, uint32_t *blocks);
+
 /**
  * @brief Ensure the card is not busy after a write
  * @param sd_handle Pointer to SD handle structure
@@ -273,10 +1533,33 @@ uint32_t SD_GetBlockCount(SD_Handle_t *sd_handle);
  */
 SD_Status SD_Sync(SD_Handle_t *sd_handle);
 
+/**
+ * @brief Check once, without waiting, whether a split busy is over
+ * @param sd_handle Pointer to SD handle structure
+ * @return SD_OK when the card is ready (or no write is pending), SD_BUSY
+ *         while it is still programming, SD_UNSUPPORTED unless SD_SPLIT_BUSY
+ *
+ * Note: Selects the card for one byte and releases it again, so a caller
+ * can share the bus with other devices until the write is done.
+ */
+SD_Status SD_PollBusy(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Check that an initialized card still answers (CMD13 SEND_STATUS)
+ * @param sd_handle Pointer to SD handle structure
+ * @return SD_OK if the card is still in transfer mode with a clean status
+ */
+SD_Status SD_CheckStatus(SD_Handle_t *sd_handle);
+
 /**
  * @brief Get a snapshot of driver statistics
  * @param sd_handle Pointer to SD handle structure
  * @param stats Output stats (must be non-NULL)
+ *
+ * Note: Never takes the bus lock. With SD_STATS_SNAPSHOT the copy is
+ * consistent as of the end of the last bus operation; the counters bumped
+ * outside the lock (errors, timeouts, deadlines, read-ahead) are read live.
+ * Without it, fields updated while the copy is made may tear.
  */
 void SD_GetStats(SD_Handle_t *sd_handle, SD_Stats *stats);
 
@@ -287,7 +1570,60 @@ void SD_GetStats(SD_Handle_t *sd_handle, SD_Stats *stats);
 void SD_ResetStats(SD_Handle_t *sd_handle);
 
 /**
- * @brief Deinitialize SD card handle (free resources)
+ * @brief Share of time the SPI bus spent clocking, from a stats snapshot
+ * @param stats Snapshot from SD_GetStats
+ * @return bus_xfer_cycles over bus_window_ms, in permille (0 without SD_LATENCY_STATS)
+ *
+ * Note: The rest splits into bus_gap_cycles, where the card was selected but
+ * the driver was setting up the next transfer, and time with no request at
+ * all. A transfer counts from its start, so DMA set-up and completion
+ * latency are inside bus_xfer_cycles; polled ready and token waits clock
+ * 0xFF bytes and count too.
+ */
+uint32_t SD_BusUtilization(const SD_Stats *stats);
+
+/**
+ * @brief Selected time so far, including a selection still open
+ * @param sd_handle Pointer to SD handle structure
+ * @return selected_cycles plus the running selection (0 without SD_ENERGY_STATS)
+ *
+ * Note: selected_cycles in a stats snapshot only grows when the card is
+ * deselected; a read or write session can keep it selected between requests.
+ */
+uint64_t SD_SelectedCycles(SD_Handle_t *sd_handle);
+
+/**
+ * @brief Set the latency objective of one operation
+ * @param sd_handle Pointer to SD handle structure
+ * @param op Operation (SD_LatencyOp), e.g. SD_LAT_CMD25 for multi-block writes
+ * @param limit_us Samples above this many microseconds are violations; 0 = no limit
+ * @return SD_Status (SD_UNSUPPORTED when SD_SLO_ENABLED is 0)
+ */
+SD_Status SD_SetLatencySlo(SD_Handle_t *sd_handle, SD_LatencyOp op, uint32_t limit_us);
+
+/**
+ * @brief Register the callback for latency objective violations
+ * @param sd_handle Pointer to SD handle structure
+ * @param fn Callback, or NULL for none
+ * @param context Passed to fn
+ * @return SD_Status (SD_UNSUPPORTED when SD_SLO_ENABLED is 0)
+ *
+ * Note: fn runs in the task that made the request, with the bus held, right
+ * after the slow operation. It must not call into the driver; note the
+ * violation (copy it, give a semaphore) and act on it elsewhere.
+ */
+SD_Status SD_SetSloCallback(SD_Handle_t *sd_handle, SD_SloCallback fn, void *context);
+
+/**
+ * @brief Copy the last latency objective violation
+ * @param sd_handle Pointer to SD handle structure
+ * @param out Destination
+ * @return SD_OK, SD_ERROR when there has been none, SD_UNSUPPORTED when SD_SLO_ENABLED is 0
+ */
+SD_Status SD_GetSloViolation(SD_Handle_t *sd_handle, SD_SloViolation *out);
+
+/**
+ * @brief Deinitialize SD card handle (free resources and its instance slot)
  * @param sd_handle Pointer to SD handle structure
  */
 void SD_DeInit(SD_Handle_t *sd_handle);
@@ -0,0 +1,166 @@
+/*
+ * sd_spill.h
+ *
+ * RAM spill buffer for block writes to one card. SD_SpillWrite copies the
+ * sectors into a ring of SD_SPILL_SECTORS buffers and returns; the copies
+ * go to the card as SD_IO_PRIO_BULK requests on the async I/O queue
+ * (sd_async.h) under FreeRTOS, or from SD_SpillPoll in the main loop
+ * otherwise. A producer therefore keeps running while the card sits in a
+ * long SD_WaitReady busy period, for as long as the ring lasts: a 250 ms
+ * stall at 100 KB/s needs 25 KiB, or 50 sectors. Sectors stay in the ring
+ * until the card has them, so the catch-up write after a stall can stall
+ * in turn while holding them; allow twice that for stalls back to back.
+ *
+ * Crossing the high watermark calls the watermark callback with
+ * SD_SPILL_HIGH so producers can throttle or shed low-value data. Falling
+ * back to the low watermark reports SD_SPILL_LOW. A write that does not fit
+ * is refused whole with SD_BUSY and reported as SD_SPILL_FULL; nothing of
+ * it is kept. A card error drops the extent it hit and reports
+ * SD_SPILL_ERROR. The callback runs with no lock held, in the producer's
+ * task or, for SD_SPILL_LOW and SD_SPILL_ERROR, in the SD I/O task.
+ *
+ * A write that wraps the ring becomes two extents. Consecutive sectors
+ * written back to back while an extent waits merge into it, and the
+ * scheduler merges adjacent queued extents further. A write that overlaps
+ * an older extent still in the ring waits for it, so the card always ends
+ * with the newest data. Producers may be several tasks, but not an ISR.
+ */
+
+#ifndef __SD_SPILL_H__
+#define __SD_SPILL_H__
+
+#include "sd_spi.h"
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sector buffers in the ring (SD_SPILL_SECTORS * 512 bytes of RAM). */
+#ifndef SD_SPILL_SECTORS
+#define SD_SPILL_SECTORS 64U
+#endif
+
+/* Extents (runs of sectors waiting for the card) tracked at once. */
+#ifndef SD_SPILL_MAX_EXTENTS
+#define SD_SPILL_MAX_EXTENTS 16U
+#endif
+
+#if (SD_SPILL_SECTORS < 1U) || (SD_SPILL_MAX_EXTENTS < 2U)
+#error "SD_SPILL_SECTORS must be at least 1 and SD_SPILL_MAX_EXTENTS at least 2"
+#endif
+
+typedef enum {
+    SD_SPILL_HIGH = 0, // Fill reached the high watermark
+    SD_SPILL_LOW,      // ...and has drained back to the low watermark
+    SD_SPILL_FULL,     // A write was refused for lack of space
+    SD_SPILL_ERROR     // The card failed an extent; its sectors were dropped
+} SD_SpillEvent;
+
+/* used_sectors is the ring's fill when the event happened. */
+typedef void (*SD_SpillWatermarkFn)(SD_SpillEvent event, uint32_t used_sectors, void *context);
+
+typedef struct {
+    uint32_t writes;        // SD_SpillWrite calls accepted
+    uint32_t sectors;       // Sectors accepted
+    uint32_t refused;       // Writes refused with SD_BUSY
+    uint32_t refused_sectors;
+    uint32_t card_writes;   // Extents sent to the card
+    uint32_t card_errors;   // Extents the card failed (sectors dropped)
+    uint32_t high_events;
+    uint32_t max_used;      // Most sectors in the ring at once
+} SD_SpillStats;
+
+/* One extent: a run of sectors, contiguous on the card and in the ring. */
+typedef struct {
+    struct SD_Spill *spill;
+    uint32_t sector;
+    uint32_t count;
+    uint32_t first;  // Ring index of the first sector
+    uint8_t state;   // Private
+    SD_Status status;
+} SD_SpillExtent;
+
+/* One spill buffer; treat every field as private. */
+typedef struct SD_Spill {
+    SD_Handle_t *sd;
+    SD_SpillWatermarkFn watermark;
+    void *context;
+    uint32_t high;         // Sectors
+    uint32_t low;
+    bool above;            // Past high, not yet back to low
+    bool failed;           // An extent was dropped since the last SD_SpillFlush
+    uint32_t used;         // Ring sectors held
+    uint32_t ring_head;    // Next free ring index
+    uint32_t ext_head;     // Next extent (counter)
+    uint32_t ext_tail;     // Oldest extent not yet released (counter)
+    SD_SpillExtent ext[SD_SPILL_MAX_EXTENTS];
+    SD_SpillStats stats;
+    uint8_t ring[SD_SPILL_SECTORS][SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+#if defined(USE_FREERTOS)
+    SemaphoreHandle_t lock;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t lock_buffer;
+#endif
+#endif
+} SD_Spill;
+
+/**
+ * @brief Set up a spill buffer in front of an initialized card
+ * @param spill Spill buffer to set up
+ * @param sd Card the sectors go to
+ * @param high_sectors Fill that reports SD_SPILL_HIGH (1..SD_SPILL_SECTORS)
+ * @param low_sectors Fill that reports SD_SPILL_LOW afterwards (below high)
+ * @param watermark Callback, may be NULL
+ * @param context Passed to the callback
+ * @return SD_OK, SD_PARAM, or SD_ERROR when the lock cannot be created
+ *
+ * Note: Under FreeRTOS, start the I/O task with SD_AsyncStart first.
+ */
+SD_Status SD_SpillInit(SD_Spill *spill, SD_Handle_t *sd, uint32_t high_sectors,
+                       uint32_t low_sectors, SD_SpillWatermarkFn watermark, void *context);
+
+/**
+ * @brief Copy sectors into the ring for writing to the card
+ * @param spill Spill buffer
+ * @param buff Source; free to reuse on return
+ * @param sector First sector
+ * @param count Sectors
+ * @return SD_OK, SD_BUSY if the ring has no room for all of them (nothing kept),
+ *         SD_PARAM for more sectors than the ring holds
+ */
+SD_Status SD_SpillWrite(SD_Spill *spill, const uint8_t *buff, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Move waiting extents to the card
+ * @param spill Spill buffer
+ * @return SD_OK, or the card's status for the extent it failed
+ *
+ * Note: Without FreeRTOS this writes the oldest extent that may go and
+ * returns; call it from the main loop. Under FreeRTOS it resubmits extents
+ * the async queue refused; the completion callbacks do the rest.
+ */
+SD_Status SD_SpillPoll(SD_Spill *spill);
+
+/**
+ * @brief Wait until every accepted sector has reached the card
+ * @param spill Spill buffer
+ * @param timeout_ms Maximum time to wait
+ * @return SD_OK, SD_TIMEOUT, or SD_ERROR if an extent was dropped since the last flush
+ */
+SD_Status SD_SpillFlush(SD_Spill *spill, uint32_t timeout_ms);
+
+/* Sectors currently held in the ring. */
+uint32_t SD_SpillUsed(const SD_Spill *spill);
+
+void SD_SpillGetStats(const SD_Spill *spill, SD_SpillStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_SPILL_H__ */
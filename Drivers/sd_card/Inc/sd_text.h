@@ -0,0 +1,115 @@
+/*
+ * sd_text.h
+ *
+ * Buffered text output for files written with f_printf/f_puts. FatFs's
+ * string functions (_USE_STRFUNC) pass every character through a 64-byte
+ * buffer on the stack, convert '\n' to "\r\n" one character at a time under
+ * _USE_STRFUNC 2, and hand each 64 bytes to f_write, which copies them into
+ * the FIL's sector buffer; a sector reaches the card only when that buffer
+ * fills, one CMD24 at a time.
+ *
+ * An SD_TextFile sits in front of an open FIL instead. sd_text_printf
+ * formats straight into its buffer with vsnprintf and sd_text_puts copies
+ * runs between newlines with memcpy; newline conversion works on whole runs
+ * (memchr), not characters. Once SD_TEXT_BUFFER bytes are queued they go to
+ * f_write cut so the file position ends on a sector boundary, so after the
+ * first write every f_write starts aligned and covers whole sectors, which
+ * FatFs sends straight from the buffer as one multi-block write. The bytes
+ * after the cut stay buffered for the next write.
+ *
+ * The file holds the same bytes f_printf would have written. Buffered text
+ * reaches the FIL only on sd_text_flush; call it before f_sync, f_close or
+ * any other f_write/f_lseek on the file. One task per SD_TextFile.
+ */
+
+#ifndef __SD_TEXT_H__
+#define __SD_TEXT_H__
+
+#include "sd_config.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include "ff.h"
+#include "sd_spi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes per f_write (a multiple of the sector size; two sectors or more for CMD25). */
+#ifndef SD_TEXT_BUFFER
+#define SD_TEXT_BUFFER 1024U
+#endif
+
+/* Longest sd_text_printf output plus one, after newline conversion; added to the buffer. */
+#ifndef SD_TEXT_LINE_MAX
+#define SD_TEXT_LINE_MAX 256U
+#endif
+
+/* Write "\r\n" for '\n' as f_printf does under _USE_STRFUNC 2 (1 = convert). */
+#ifndef SD_TEXT_CRLF
+#if defined(_USE_STRFUNC) && (_USE_STRFUNC == 2)
+#define SD_TEXT_CRLF 1
+#else
+#define SD_TEXT_CRLF 0
+#endif
+#endif
+
+#if (SD_TEXT_BUFFER == 0U) || ((SD_TEXT_BUFFER % _MAX_SS) != 0U)
+#error "SD_TEXT_BUFFER must be a non-zero multiple of _MAX_SS"
+#endif
+
+#if (SD_TEXT_LINE_MAX < 2U)
+#error "SD_TEXT_LINE_MAX must be at least 2"
+#endif
+
+typedef struct {
+    uint32_t writes;   // f_write calls
+    uint32_t aligned;  // Of those, calls that started on a sector boundary with whole sectors
+    uint32_t bytes;    // Bytes written by them
+    uint32_t newlines; // '\n' converted to "\r\n"
+} SD_TextStats;
+
+/* One buffered text stream; treat every field as private. */
+typedef struct {
+    FIL *fp;
+    uint32_t used;
+    int error; // First failing FRESULT; later calls fail with it
+    SD_TextStats stats;
+    uint8_t buf[SD_TEXT_BUFFER + SD_TEXT_LINE_MAX] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+} SD_TextFile;
+
+/* Attach tf to fp (open with FA_WRITE); text is written at fp's position. */
+void sd_text_begin(SD_TextFile *tf, FIL *fp);
+
+/**
+ * @brief f_printf into the buffer
+ * @return Bytes queued (after newline conversion), or -1 on an error
+ *
+ * Note: Output of SD_TEXT_LINE_MAX bytes or more after conversion returns
+ * -1 and queues nothing; the stream stays usable. Use sd_text_puts for text
+ * of any length.
+ */
+int sd_text_printf(SD_TextFile *tf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int sd_text_vprintf(SD_TextFile *tf, const char *fmt, va_list ap);
+
+/* f_puts into the buffer; bytes queued (after newline conversion), or -1 on an error. */
+int sd_text_puts(SD_TextFile *tf, const char *str);
+
+/**
+ * @brief Write everything buffered to the FIL
+ * @return FR_OK, or the first FRESULT that failed on this stream
+ *
+ * Note: Only f_write; the data is on the card after the caller's f_sync or
+ * f_close. A write that ran out of space returns FR_DENIED, as f_printf
+ * would return EOF.
+ */
+int sd_text_flush(SD_TextFile *tf);
+
+/* Copy the stream's counters. */
+void sd_text_get_stats(const SD_TextFile *tf, SD_TextStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_TEXT_H__ */
@@ -0,0 +1,186 @@
+/*
+ * sd_tier.h
+ *
+ * Flash write tier in front of the card. Sectors written through
+ * SD_TierDriver are appended to a ring of records on a flash device and
+ * the write returns once they are programmed there. The flash can be an
+ * external SPI NOR chip or spare internal flash, reached through
+ * SD_TierFlash callbacks. SD_TierDrain copies the oldest records to the
+ * card through SD_Driver; under FreeRTOS a low-priority task does this in
+ * the background. A card busy spike therefore stalls the drain, not the
+ * writer, until the ring fills up. Reads return the newest copy of each
+ * sector: the ring while the sector is pending, the card after that.
+ *
+ * Each record is a 32-byte header (magic, sequence, sector, CRC-32, done
+ * word) followed by the sector. The data is programmed first and the
+ * header last, so a torn record fails its CRC and is ignored. Once a record
+ * is on the card and CTRL_SYNC has returned, its done word is programmed
+ * to zero. This needs flash that can clear bits in a word already written,
+ * which NOR and the STM32F4 internal flash can. After a reset, SD_TierInit
+ * scans the ring and drains what was programmed but not yet done. Writing
+ * a sector again supersedes its pending record. Records never straddle an
+ * erase unit, and the drain pre-erases the unit the writer enters next.
+ *
+ * The flash callbacks are only ever called with the tier lock held, never
+ * concurrently. CTRL_SYNC returns as soon as the sectors are in flash.
+ * SD_TierFlush drains everything, e.g. before the card is ejected. Do not
+ * write the card around the tier while records are pending.
+ */
+
+#ifndef __SD_TIER_H__
+#define __SD_TIER_H__
+
+#include "diskio.h"
+#include "ff_gen_drv.h"
+#include "sd_spi.h"
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Record slots the RAM index tracks, 4 bytes each; caps the ring's capacity. */
+#ifndef SD_TIER_MAX_RECORDS
+#define SD_TIER_MAX_RECORDS 128U
+#endif
+
+/* Records copied to the card per CTRL_SYNC and done-mark pass. */
+#ifndef SD_TIER_DRAIN_BATCH
+#define SD_TIER_DRAIN_BATCH 8U
+#endif
+
+#if (SD_TIER_MAX_RECORDS < 2U) || (SD_TIER_DRAIN_BATCH < 1U)
+#error "SD_TIER_MAX_RECORDS must be at least 2 and SD_TIER_DRAIN_BATCH at least 1"
+#endif
+
+#ifdef USE_FREERTOS
+/* Drain task stack depth in words. */
+#ifndef SD_TIER_TASK_STACK
+#define SD_TIER_TASK_STACK 256U
+#endif
+
+#ifndef SD_TIER_TASK_PRIORITY
+#define SD_TIER_TASK_PRIORITY (tskIDLE_PRIORITY + 1U)
+#endif
+
+/* Longest the drain task sleeps between looks at the ring when no write wakes it. */
+#ifndef SD_TIER_DRAIN_IDLE_MS
+#define SD_TIER_DRAIN_IDLE_MS 100U
+#endif
+#endif
+
+/* Header in front of each sector in the ring. */
+#define SD_TIER_HEADER_SIZE 32U
+#define SD_TIER_RECORD_SIZE (SD_TIER_HEADER_SIZE + SD_BLOCK_SIZE)
+
+/* Flash behind the tier. Addresses are offsets into the ring area. */
+typedef struct {
+    bool (*read)(uint32_t addr, void *buf, uint32_t len, void *context);
+    bool (*program)(uint32_t addr, const void *buf, uint32_t len, void *context); // Any length
+    bool (*erase)(uint32_t addr, void *context); // The erase unit starting at addr
+    void *context;
+    uint32_t size;       // Bytes given to the ring, a multiple of erase_size
+    uint32_t erase_size; // Erase unit, at least SD_TIER_RECORD_SIZE
+} SD_TierFlash;
+
+typedef struct {
+    uint32_t writes;        // Sectors written through the tier
+    uint32_t drained;       // Records copied to the card
+    uint32_t superseded;    // Pending records replaced by a newer write of their sector
+    uint32_t full_stalls;   // Writes that drained first because the ring was full
+    uint32_t erases;        // Erase units cleared
+    uint32_t inline_erases; // ...of which by a writer, because none was erased ahead
+    uint32_t recovered;     // Pending records found by SD_TierInit
+    uint32_t flash_errors;  // Failed flash callbacks
+    uint32_t card_errors;   // Drain writes or syncs the card failed
+    uint32_t max_pending;   // Most sectors pending at once
+} SD_TierStats;
+
+/* One tier; treat every field as private. */
+typedef struct {
+    SD_TierFlash flash;
+    BYTE lun;              // SD_Driver drive behind the tier
+    uint32_t capacity;     // Record slots in the ring
+    uint32_t per_unit;     // Records per erase unit
+    uint32_t head;         // Sequence of the next record
+    uint32_t tail;         // Oldest sequence that may still be pending
+    uint32_t erased_next;  // Unit start (sequence) erased ahead, SD_TIER_NONE = none
+    uint32_t pending;      // Sectors waiting for the card
+    uint32_t drain_gen;    // Bumped whenever a drained record leaves the index
+    uint32_t slot_sector[SD_TIER_MAX_RECORDS]; // Pending sector per slot
+    SD_TierStats stats;
+    uint8_t buf[SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+#if defined(USE_FREERTOS)
+    SemaphoreHandle_t lock;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t lock_buffer;
+#endif
+#endif
+} SD_Tier;
+
+/* Tier behind SD_TierDriver. */
+extern SD_Tier g_sd_tier;
+
+/**
+ * @brief Set up a tier on a flash area and recover the records it still holds
+ * @param tier Tier to set up
+ * @param flash Flash callbacks and geometry (copied)
+ * @param lun SD_Driver drive the records drain to
+ * @return SD_OK, SD_PARAM for a bad geometry (fewer than two erase units),
+ *         SD_ERROR when the flash cannot be read or the drain task cannot start
+ *
+ * Note: Under FreeRTOS, setting up g_sd_tier also starts the drain task.
+ * Other tiers are drained by calling SD_TierDrain.
+ */
+SD_Status SD_TierInit(SD_Tier *tier, const SD_TierFlash *flash, BYTE lun);
+
+/**
+ * @brief Append sectors to the ring
+ * @param tier Tier
+ * @param buff Source
+ * @param sector First sector
+ * @param count Sectors
+ * @return SD_Status (a flash error, or the card's when a full ring cannot drain)
+ */
+SD_Status SD_TierWrite(SD_Tier *tier, const uint8_t *buff, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Read sectors, pending ones from the ring
+ * @param tier Tier
+ * @param buff Destination
+ * @param sector First sector
+ * @param count Sectors
+ * @return SD_Status
+ */
+SD_Status SD_TierRead(SD_Tier *tier, uint8_t *buff, uint32_t sector, uint32_t count);
+
+/**
+ * @brief Copy up to max_records of the oldest pending records to the card
+ * @param tier Tier
+ * @param max_records Records to drain at most
+ * @param drained Receives the records drained, may be NULL
+ * @return SD_Status (the card's or the flash's on failure; records stay pending)
+ */
+SD_Status SD_TierDrain(SD_Tier *tier, uint32_t max_records, uint32_t *drained);
+
+/* Drain until nothing is pending. */
+SD_Status SD_TierFlush(SD_Tier *tier);
+
+/* Sectors waiting for the card. */
+uint32_t SD_TierPending(const SD_Tier *tier);
+
+void SD_TierGetStats(const SD_Tier *tier, SD_TierStats *out);
+
+/* FatFs driver for g_sd_tier; link it with FATFS_LinkDriverEx(..., lun = 0). */
+extern const Diskio_drvTypeDef SD_TierDriver;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_TIER_H__ */
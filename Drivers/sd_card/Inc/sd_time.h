@@ -0,0 +1,107 @@
+/*
+ * sd_time.h
+ *
+ * Cached FAT timestamps for get_fattime. FatFs (with _FS_NORTC 0) calls
+ * get_fattime for every file create, f_sync/f_close of a modified file,
+ * f_mkdir and f_rename. Reading the HAL RTC from there means two HAL calls,
+ * BCD conversion and a wait for the shadow registers each time, inside the
+ * volume lock. Instead, sd_time_tick runs once per second from a timer
+ * callback (RTC wakeup, a TIM update or a FreeRTOS software timer), reads
+ * the clock source and stores the packed FAT value in one word;
+ * sd_time_fattime is a single load.
+ *
+ * Without a source (or when it fails) the tick advances the last time by a
+ * second, so a time given once with sd_time_set (GPS, NTP, the host) keeps
+ * running. Until any time is known, sd_time_fattime returns SD_TIME_DEFAULT.
+ *
+ * CubeMX's FATFS/App/fatfs.c defines get_fattime; its USER CODE block
+ * becomes `return sd_time_fattime();` (see README).
+ */
+
+#ifndef __SD_TIME_H__
+#define __SD_TIME_H__
+
+#include "main.h"
+#include "sd_config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* FAT date/time word: years since 1980, month, day, hour, minute, seconds / 2. */
+#define SD_TIME_FAT(y, mo, d, h, mi, s)                                           \
+    ((((uint32_t)(y) - 1980U) << 25) | ((uint32_t)(mo) << 21) | ((uint32_t)(d) << 16) | \
+     ((uint32_t)(h) << 11) | ((uint32_t)(mi) << 5) | ((uint32_t)(s) >> 1))
+
+/* Returned before the first successful sd_time_tick or sd_time_set. */
+#ifndef SD_TIME_DEFAULT
+#define SD_TIME_DEFAULT SD_TIME_FAT(2026, 1, 1, 0, 0, 0)
+#endif
+
+typedef struct {
+    uint16_t year;   // 1980..2107
+    uint8_t month;   // 1..12
+    uint8_t day;     // 1..31
+    uint8_t hour;    // 0..23
+    uint8_t minute;  // 0..59
+    uint8_t second;  // 0..59
+} SD_DateTime;
+
+/* Reads the current time; false if the clock is not set or not readable. */
+typedef bool (*SD_TimeSource)(SD_DateTime *now);
+
+/**
+ * @brief Select the clock sd_time_tick reads, and read it once now
+ * @param source Clock reader, or NULL to run from sd_time_set alone
+ *
+ * Note: Call before starting the 1 Hz timer.
+ */
+void sd_time_set_source(SD_TimeSource source);
+
+/**
+ * @brief Set the time without a source, or until the source can be read
+ * @param now Time to report from now on
+ * @return false if a field is out of range (nothing changed)
+ *
+ * Note: One writer at a time. sd_time_tick may interrupt it (ISR or a
+ * higher-priority timer task); the time is handed over at the next tick.
+ */
+bool sd_time_set(const SD_DateTime *now);
+
+/**
+ * @brief Refresh the cached timestamp; call once per second
+ *
+ * Note: ISR-safe as long as the source is (HAL_RTC_GetTime/GetDate are).
+ */
+void sd_time_tick(void);
+
+/* Cached FAT timestamp, for get_fattime. Any context. */
+uint32_t sd_time_fattime(void);
+
+/* Last time read or advanced; false while only SD_TIME_DEFAULT is known. */
+bool sd_time_now(SD_DateTime *out);
+
+/* Pack into the FAT word (out-of-range fields give a meaningless value). */
+uint32_t sd_time_pack(const SD_DateTime *t);
+
+#if defined(HAL_RTC_MODULE_ENABLED)
+/**
+ * @brief Use a HAL RTC (24-hour format) as the source
+ * @param hrtc Initialized RTC handle; RTC years 0..99 are taken as 2000..2099
+ *
+ * Note: Reads fail until the calendar has been set (RTC_ISR_INITS clear), so
+ * an RTC that lost its backup supply does not report 2000-01-01.
+ */
+void sd_time_use_hal_rtc(RTC_HandleTypeDef *hrtc);
+
+/* SD_TimeSource for the RTC given to sd_time_use_hal_rtc. */
+bool sd_time_hal_rtc(SD_DateTime *now);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_TIME_H__ */
@@ -0,0 +1,134 @@
+/*
+ * sd_trace.h
+ *
+ * Binary trace ring for driver events. Producers (tasks and ISRs) reserve a
+ * slot with one atomic increment and publish it with a sequence number, so
+ * recording never takes a lock or disables interrupts. The ring overwrites the
+ * oldest events; a single consumer drains it from a low-priority task or on
+ * demand. Timestamps and durations are DWT cycles.
+ */
+
+#ifndef __SD_TRACE_H__
+#define __SD_TRACE_H__
+
+#include "sd_config.h"
+#include "main.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Record driver events (commands, DMA completions, diskio calls). */
+#ifndef SD_TRACE_ENABLED
+#define SD_TRACE_ENABLED 0
+#endif
+
+/* Ring capacity in events (power of two, 24 bytes each). */
+#ifndef SD_TRACE_ENTRIES
+#define SD_TRACE_ENTRIES 128U
+#endif
+
+#if (SD_TRACE_ENTRIES < 2U) || ((SD_TRACE_ENTRIES & (SD_TRACE_ENTRIES - 1U)) != 0U)
+#error "SD_TRACE_ENTRIES must be a power of two"
+#endif
+
+typedef enum {
+    SD_TRACE_CMD = 1,     // code = command index, resp = R1
+    SD_TRACE_DMA,         // code = SD_TRACE_DMA_* flags, duration since DMA start
+    SD_TRACE_DISK_INIT,   // code = pdrv, status = DSTATUS
+    SD_TRACE_DISK_READ,   // code = pdrv, arg = sector, resp = count, status = DRESULT
+    SD_TRACE_DISK_WRITE,  // code = pdrv, arg = sector, resp = count, status = DRESULT
+    SD_TRACE_DISK_IOCTL   // code = pdrv, arg = ioctl command, status = DRESULT
+} SD_TraceType;
+
+/* SD_TRACE_DMA code bits. */
+#define SD_TRACE_DMA_TX    0x01U
+#define SD_TRACE_DMA_RX    0x02U
+#define SD_TRACE_DMA_ERROR 0x04U
+
+typedef struct {
+    uint32_t seq;       // Event number (consecutive unless events were dropped)
+    uint32_t timestamp; // DWT cycles at the start of the event
+    uint32_t duration;  // DWT cycles
+    uint32_t arg;       // Command argument, sector or ioctl code
+    uint8_t type;       // SD_TraceType
+    uint8_t code;
+    uint8_t status;     // SD_Status for driver events
+    uint8_t resp;
+    uint8_t instance;   // Handle registry slot (0 for diskio events)
+    uint8_t reserved[3];
+} SD_TraceEvent;
+
+/* Consumer callback for SD_TraceDrain. */
+typedef void (*SD_TraceSink)(const SD_TraceEvent *event, void *context);
+
+/* Current cycle count, for the start of a traced interval. */
+static inline uint32_t SD_TraceNow(void) {
+    return DWT->CYCCNT;
+}
+
+/**
+ * @brief Append one event (task or ISR context)
+ * @param type SD_TraceType
+ * @param instance Handle registry slot
+ * @param code Type-specific code (command index, drive, DMA flags)
+ * @param arg Type-specific argument
+ * @param status Outcome
+ * @param resp Type-specific response byte
+ * @param start SD_TraceNow() at the start of the event; duration runs to now
+ */
+void SD_TraceRecord(uint8_t type, uint8_t instance, uint8_t code, uint32_t arg, uint8_t status,
+                    uint8_t resp, uint32_t start);
+
+/**
+ * @brief Copy out the oldest unread events
+ * @param out Destination array
+ * @param max Capacity of out
+ * @return Events copied (in order)
+ *
+ * Note: Single consumer. Events overwritten before they were read are counted
+ * in SD_TraceDropped. An event still being written stops the read early.
+ */
+uint32_t SD_TraceRead(SD_TraceEvent *out, uint32_t max);
+
+/**
+ * @brief Copy the newest events without consuming them
+ * @param out Destination array
+ * @param max Capacity of out
+ * @return Events copied, oldest first
+ *
+ * Note: Safe from any context alongside producers and the consumer; the
+ * events stay in the ring for SD_TraceRead. Slots being written or
+ * overwritten during the copy are left out.
+ */
+uint32_t SD_TraceLatest(SD_TraceEvent *out, uint32_t max);
+
+/* Pass every unread event to sink; returns the number delivered. */
+uint32_t SD_TraceDrain(SD_TraceSink sink, void *context);
+
+/* Print every unread event as an "SDTRACE," line (UART or SWO via the printf retarget). */
+void SD_TraceDump(void);
+
+/* Events lost to overwrite since the last SD_TraceReset. */
+uint32_t SD_TraceDropped(void);
+
+/* Discard all events and clear the drop counter (no producers may be running). */
+void SD_TraceReset(void);
+
+#if (SD_TRACE_ENABLED == 1)
+#define SD_TRACE(type, instance, code, arg, status, resp, start)                                   \
+    SD_TraceRecord((uint8_t)(type), (uint8_t)(instance), (uint8_t)(code), (uint32_t)(arg),        \
+                   (uint8_t)(status), (uint8_t)(resp), (start))
+#define SD_TRACE_START() SD_TraceNow()
+#else
+/* Only start is evaluated, so locals that hold it do not trigger unused warnings. */
+#define SD_TRACE(type, instance, code, arg, status, resp, start) ((void)(start))
+#define SD_TRACE_START() 0U
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_TRACE_H__ */
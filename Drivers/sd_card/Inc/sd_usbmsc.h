@@ -0,0 +1,157 @@
+/*
+ * sd_usbmsc.h
+ *
+ * USB mass-storage bridge: the card as a USB drive, so logs come off over
+ * the cable instead of by pulling the card. The callbacks below form the
+ * storage interface of the ST USB device library's MSC class
+ * (USBD_StorageTypeDef; SD_UsbMscStorage with SD_USBMSC_CLASS 1). Each MSC
+ * packet is one SD_ReadMultiBlocks/SD_WriteMultiBlocks command; raise
+ * MSC_MEDIA_PACKET to SD_USBMSC_BUFFER_BLOCKS * 512 so a packet is a long
+ * CMD18/CMD25 rather than a block at a time.
+ *
+ * FatFs and the host never share the card. sd_usbmsc_attach unmounts the
+ * volume, writes back what the driver holds and lends the drive out
+ * (SD_DiskSetExternal): FatFs calls on it fail until sd_usbmsc_detach, which
+ * finishes the last transfer, drops every RAM copy of the card (the host
+ * may have changed any sector) and mounts again. Before attach the unit
+ * reports no medium, like a card reader without a card.
+ *
+ * Under FreeRTOS the card is only reachable from tasks, so sd_usbmsc_start
+ * moves the USB interrupt into a task (sd_usbmsc_irq in OTG_FS_IRQHandler in
+ * place of HAL_PCD_IRQHandler), and a second task moves the data through two
+ * buffers: while the host takes packet N of a sequential read, packet N + 1
+ * is read into the other buffer, and a written packet is acknowledged once
+ * copied and goes to the card while the next one arrives. The card and USB
+ * then overlap instead of taking turns. Without FreeRTOS the callbacks run in
+ * the USB interrupt and every transfer is synchronous.
+ */
+
+#ifndef __SD_USBMSC_H__
+#define __SD_USBMSC_H__
+
+#include "sd_config.h"
+#include "sd_spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Blocks per transfer buffer (two of them, FreeRTOS builds): the longest packet overlapped. */
+#ifndef SD_USBMSC_BUFFER_BLOCKS
+#define SD_USBMSC_BUFFER_BLOCKS 16U
+#endif
+
+/*
+ * Acknowledge a written packet once it is copied (1) or once it is on the
+ * card (0). A write-behind failure is reported on the next write or
+ * TEST UNIT READY, as a drive's write cache would; the failed packet itself
+ * has already been acknowledged.
+ */
+#ifndef SD_USBMSC_WRITE_BEHIND
+#define SD_USBMSC_WRITE_BEHIND 1
+#endif
+
+/* Longest wait for a buffered transfer before a command fails. */
+#ifndef SD_USBMSC_TIMEOUT_MS
+#define SD_USBMSC_TIMEOUT_MS 2000U
+#endif
+
+/* Build SD_UsbMscStorage for the ST MSC class (usbd_msc.h on the include path). */
+#ifndef SD_USBMSC_CLASS
+#define SD_USBMSC_CLASS 0
+#endif
+
+#ifdef USE_FREERTOS
+/* Stack depth in words of each of the two tasks. */
+#ifndef SD_USBMSC_TASK_STACK
+#define SD_USBMSC_TASK_STACK 256U
+#endif
+
+/* USB service task; above the I/O task so packets keep flowing while it waits for the card. */
+#ifndef SD_USBMSC_TASK_PRIORITY
+#define SD_USBMSC_TASK_PRIORITY (tskIDLE_PRIORITY + 3U)
+#endif
+
+#ifndef SD_USBMSC_IO_PRIORITY
+#define SD_USBMSC_IO_PRIORITY (tskIDLE_PRIORITY + 2U)
+#endif
+#endif
+
+typedef struct {
+    uint32_t read_blocks;
+    uint32_t write_blocks;
+    uint32_t prefetch_hits;   // Read packets already in RAM when the host asked
+    uint32_t prefetch_misses; // Read packets fetched on demand
+    uint32_t write_behind;    // Written packets acknowledged before reaching the card
+    uint32_t errors;          // Failed transfers, including late write-behind ones
+} SD_UsbMscStats;
+
+/**
+ * @brief Hand the card from FatFs to the USB host
+ * @return FR_OK (also when already attached), FR_NOT_READY without an
+ *         initialized card, FR_DISK_ERR if the write-back failed (the volume
+ *         is then mounted again)
+ *
+ * Note: Stop the logger and close files first; handles still open are dead
+ * after the unmount. Task context.
+ */
+int sd_usbmsc_attach(void);
+
+/**
+ * @brief Take the card back from the host and mount it
+ * @return As sd_mount; FR_DISK_ERR if the last write failed (still detached)
+ *
+ * Note: The host should have ejected the drive; a transfer it has started
+ * after this call fails. Task context.
+ */
+int sd_usbmsc_detach(void);
+
+bool sd_usbmsc_attached(void);
+
+void sd_usbmsc_get_stats(SD_UsbMscStats *out);
+
+/*
+ * USBD_StorageTypeDef callbacks, one LUN (0). They return 0 or -1 as the MSC
+ * class expects; blocks are SD_BLOCK_SIZE bytes.
+ */
+int8_t sd_usbmsc_init(uint8_t lun);
+int8_t sd_usbmsc_get_capacity(uint8_t lun, uint32_t *block_num, uint16_t *block_size);
+int8_t sd_usbmsc_is_ready(uint8_t lun);
+int8_t sd_usbmsc_is_write_protected(uint8_t lun);
+int8_t sd_usbmsc_read(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+int8_t sd_usbmsc_write(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+int8_t sd_usbmsc_get_max_lun(void);
+
+/* Standard INQUIRY data (36 bytes) for the storage interface's pInquiry. */
+extern int8_t sd_usbmsc_inquiry[];
+
+#if SD_USBMSC_CLASS
+#include "usbd_msc.h"
+
+/* Pass to USBD_MSC_RegisterStorage. */
+extern USBD_StorageTypeDef SD_UsbMscStorage;
+#endif
+
+#if defined(USE_FREERTOS) && defined(HAL_PCD_MODULE_ENABLED)
+/**
+ * @brief Start the USB service and card I/O tasks
+ * @param hpcd PCD handle of the MSC device (e.g. &hpcd_USB_OTG_FS)
+ * @param irq Its interrupt (OTG_FS_IRQn), masked while the task serves it
+ * @return SD_OK, or SD_ERROR if a task or semaphore could not be created
+ *
+ * Note: Required under FreeRTOS, where the callbacks must run in a task.
+ * Call once before USBD_Start; calling it again is a no-op.
+ */
+SD_Status sd_usbmsc_start(PCD_HandleTypeDef *hpcd, IRQn_Type irq);
+
+/* OTG_FS_IRQHandler body: mask the interrupt and wake the USB service task. */
+void sd_usbmsc_irq(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_USBMSC_H__ */
@@ -0,0 +1,90 @@
+/*
+ * sd_writev.h
+ *
+ * Vectored file writes. A record made of a header, a payload and a trailer
+ * in separate buffers otherwise needs either a copy into one buffer or three
+ * f_write calls, and f_write only sends whole sectors straight to the card
+ * from the sector the call starts in. sd_writev takes the list as it is: the
+ * bytes up to the first sector boundary and after the last one go through
+ * f_write (the FIL's sector buffer), and every whole sector in between is
+ * written by SD_disk_writev, one CMD25 per run of consecutive sectors, with
+ * the caller's buffers as DMA sources. A sector split between two buffers is
+ * copied into one of SD_WRITEV_BOUNCE stack sectors; nothing else is copied.
+ * Each cluster is looked up once, by an f_lseek that allocates it and
+ * continues from the one before.
+ *
+ * Falls back to one f_write per buffer, with the same result, when the build
+ * lacks something this needs (SD_WRITEV_DIRECT 0) or the file does not
+ * qualify: not open for writing, on exFAT, with a fast-seek table, or behind
+ * a driver other than SD_Driver. One task per FIL, as with f_write; calls may
+ * mix with f_write/f_lseek on it.
+ */
+
+#ifndef __SD_WRITEV_H__
+#define __SD_WRITEV_H__
+
+#include "sd_config.h"
+#include "sd_diskio_spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Segments per SD_disk_writev call (8 bytes of stack each). */
+#ifndef SD_WRITEV_SEGMENTS
+#define SD_WRITEV_SEGMENTS 8U
+#endif
+
+/* Sectors split between two buffers held per call (one sector of stack each). */
+#ifndef SD_WRITEV_BOUNCE
+#define SD_WRITEV_BOUNCE 2U
+#endif
+
+#if (SD_WRITEV_SEGMENTS < 2U)
+#error "SD_WRITEV_SEGMENTS must be at least 2"
+#endif
+
+#if (SD_WRITEV_BOUNCE < 1U)
+#error "SD_WRITEV_BOUNCE must be at least 1"
+#endif
+
+/* Needs a sector buffer in every FIL (_FS_TINY 0) and FatFs sectors of SD_DISK_SECTOR_SIZE. */
+#if !_FS_TINY && (_MIN_SS == _MAX_SS) && (_MAX_SS == SD_DISK_SECTOR_SIZE)
+#define SD_WRITEV_DIRECT 1
+#else
+#define SD_WRITEV_DIRECT 0
+#endif
+
+typedef struct {
+    uint32_t calls;     // sd_writev calls that wrote sectors directly
+    uint32_t fallbacks; // Calls passed to f_write
+    uint32_t runs;      // SD_disk_writev calls
+    uint32_t sectors;   // Sectors written by them
+    uint32_t bounced;   // Of those, sectors copied into a bounce sector
+} SD_WritevStats;
+
+/**
+ * @brief f_write of several buffers, in order, as one contiguous stretch of the file
+ * @param fp File opened with FA_WRITE
+ * @param iov Buffers; any length, zero-length ones are skipped (SD_IoVec from sd_spi.h)
+ * @param n Number of buffers
+ * @param bw Receives the bytes written
+ * @return As f_write; FR_INVALID_PARAMETER for a NULL buffer or a total over 4 GiB
+ *
+ * Note: As with f_write, a full volume ends the call early with FR_OK and
+ * *bw below the total. The direct sectors are on the card when the call
+ * returns; the edges stay in the FIL's buffer until the next f_sync.
+ */
+FRESULT sd_writev(FIL *fp, const SD_IoVec *iov, uint32_t n, UINT *bw);
+
+/* Counters are updated without a lock; under contention they may miss a call. */
+void sd_writev_get_stats(SD_WritevStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_WRITEV_H__ */
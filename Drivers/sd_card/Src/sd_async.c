@@ -0,0 +1,393 @@
+/*
+ * sd_async.c
+ *
+ * Request queue and SD I/O task behind SD_SubmitRead/SD_SubmitWrite. The task
+ * drains the queue into the scheduler and dispatches one merged run at a time.
+ */
+
+#include "sd_async.h"
+
+#include <string.h>
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "event_groups.h"
+#include "queue.h"
+#include "task.h"
+
+#define SD_ASYNC_BATCH_DONE ((EventBits_t)1U)
+
+/* Every request in flight: the queue plus what the scheduler holds. */
+#define SD_ASYNC_WAITERS (SD_ASYNC_QUEUE_DEPTH + SD_SCHED_SLOTS)
+
+static QueueHandle_t s_queue;
+static TaskHandle_t s_task;
+static SD_SchedPolicy s_policy;
+
+/* Owned by the SD I/O task. */
+static SD_Scheduler s_sched;
+static SD_IoRequest s_batch[SD_SCHED_SLOTS];
+static const uint8_t *s_tx_blocks[SD_SCHED_MAX_MERGE];
+static uint8_t *s_rx_blocks[SD_SCHED_MAX_MERGE];
+
+/*
+ * Tasks with a callback-less request in flight. The status comes back as the
+ * task's notification value, so a second such request would overwrite it.
+ */
+static TaskHandle_t s_waiters[SD_ASYNC_WAITERS];
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticQueue_t s_queue_buffer;
+static uint8_t s_queue_storage[SD_ASYNC_QUEUE_DEPTH * sizeof(SD_IoRequest)];
+static StaticTask_t s_task_buffer;
+static StackType_t s_task_stack[SD_ASYNC_TASK_STACK];
+#endif
+
+/* Register task as waiting on a notification; false if it already is (or no slot is free). */
+static bool SD_AsyncClaimWaiter(TaskHandle_t task) {
+    uint32_t slot = SD_ASYNC_WAITERS;
+    bool claimed = true;
+    taskENTER_CRITICAL();
+    for (uint32_t i = 0; i < SD_ASYNC_WAITERS; i++) {
+        if (s_waiters[i] == task) {
+            claimed = false;
+            break;
+        }
+        if (s_waiters[i] == NULL && slot == SD_ASYNC_WAITERS) {
+            slot = i;
+        }
+    }
+    claimed = claimed && (slot < SD_ASYNC_WAITERS);
+    if (claimed) {
+        s_waiters[slot] = task;
+    }
+    taskEXIT_CRITICAL();
+    return claimed;
+}
+
+static void SD_AsyncReleaseWaiter(TaskHandle_t task) {
+    taskENTER_CRITICAL();
+    for (uint32_t i = 0; i < SD_ASYNC_WAITERS; i++) {
+        if (s_waiters[i] == task) {
+            s_waiters[i] = NULL;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+/* Drop one reference; whoever takes the count to zero releases the waiter. */
+static void SD_AsyncBatchRelease(SD_AsyncBatch *batch, SD_Status status) {
+    taskENTER_CRITICAL();
+    if (status != SD_OK && batch->status == SD_OK) {
+        batch->status = status;
+    }
+    bool last = (--batch->pending == 0U);
+    taskEXIT_CRITICAL();
+    if (last) {
+        (void)xEventGroupSetBits(batch->group, SD_ASYNC_BATCH_DONE);
+    }
+}
+
+static void SD_AsyncComplete(const SD_IoRequest *request, SD_Status status) {
+    if (request->callback) {
+        request->callback(status, request->context);
+    }
+    if (request->batch) {
+        SD_AsyncBatchRelease((SD_AsyncBatch *)request->batch, status);
+    } else if (!request->callback) {
+        /* Released first: the woken task may submit its next request at once. */
+        SD_AsyncReleaseWaiter((TaskHandle_t)request->submitter);
+        (void)xTaskNotify((TaskHandle_t)request->submitter, (uint32_t)status,
+                          eSetValueWithOverwrite);
+    }
+}
+
+/* Run one scheduled batch: a single request, or adjacent requests as one command. */
+static void SD_AsyncDispatch(const SD_IoRequest *batch, uint32_t n) {
+    const SD_IoRequest *lead = &batch[0];
+    SD_Status status;
+
+    if (n == 1U && lead->has_deadline) {
+        if (lead->write) {
+            status = SD_WriteBlocksDeadline(lead->sd_handle, lead->buff, lead->sector,
+                                            lead->count, lead->deadline);
+        } else {
+            status = SD_ReadBlocksDeadline(lead->sd_handle, lead->buff, lead->sector,
+                                           lead->count, lead->deadline);
+        }
+    } else if (n == 1U) {
+        if (lead->write) {
+            status = SD_WriteBlocks(lead->sd_handle, lead->buff, lead->sector, lead->count);
+        } else {
+            status = SD_ReadBlocks(lead->sd_handle, lead->buff, lead->sector, lead->count);
+        }
+    } else {
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            for (uint32_t k = 0; k < batch[i].count; k++) {
+                s_rx_blocks[total] = batch[i].buff + (k * SD_BLOCK_SIZE);
+                s_tx_blocks[total] = s_rx_blocks[total];
+                total++;
+            }
+        }
+        if (lead->write) {
+            status = SD_WriteBlocksGather(lead->sd_handle, s_tx_blocks, lead->sector, total);
+        } else {
+            status = SD_ReadBlocksScatter(lead->sd_handle, s_rx_blocks, lead->sector, total);
+        }
+        /* Merged runs have no single deadline; account for each member here. */
+        uint32_t now = HAL_GetTick();
+        for (uint32_t i = 0; i < n; i++) {
+            if (batch[i].has_deadline) {
+                (void)__atomic_fetch_add(&lead->sd_handle->stats.deadline_requests, 1U,
+                                         __ATOMIC_RELAXED);
+                if ((int32_t)(now - batch[i].deadline) > 0) {
+                    (void)__atomic_fetch_add(&lead->sd_handle->stats.deadline_misses, 1U,
+                                             __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        SD_AsyncComplete(&batch[i], status);
+    }
+}
+
+static void SD_AsyncTask(void *argument) {
+    (void)argument;
+    SD_IoRequest request;
+
+    for (;;) {
+        /* Block only when idle; otherwise pull in whatever is queued so it can be merged. */
+        TickType_t wait = (SD_SchedPending(&s_sched) == 0U) ? portMAX_DELAY : 0;
+        while (SD_SchedPending(&s_sched) < SD_SCHED_SLOTS &&
+               xQueueReceive(s_queue, &request, wait) == pdTRUE) {
+            (void)SD_SchedAdd(&s_sched, &request);
+            wait = 0;
+        }
+
+        /* Requests already past their deadline are not worth the bus time. */
+        uint32_t n = SD_SchedTakeExpired(&s_sched, HAL_GetTick(), s_batch, SD_SCHED_SLOTS);
+        for (uint32_t i = 0; i < n; i++) {
+            /* Outside the bus lock: SD_GetStats reads these without it too. */
+            (void)__atomic_fetch_add(&s_batch[i].sd_handle->stats.deadline_requests, 1U,
+                                     __ATOMIC_RELAXED);
+            (void)__atomic_fetch_add(&s_batch[i].sd_handle->stats.deadline_misses, 1U,
+                                     __ATOMIC_RELAXED);
+            SD_AsyncComplete(&s_batch[i], SD_TIMEOUT);
+        }
+
+        n = SD_SchedNext(&s_sched, s_batch, SD_SCHED_SLOTS);
+        if (n > 0U) {
+            SD_AsyncDispatch(s_batch, n);
+        }
+    }
+}
+
+SD_Status SD_Submit(const SD_IoRequest *request) {
+    if (!request || !request->sd_handle || !request->buff || request->count == 0) {
+        return SD_PARAM;
+    }
+    if (s_queue == NULL) {
+        return SD_ERROR;
+    }
+
+    SD_IoRequest queued = *request;
+    queued.submitter = xTaskGetCurrentTaskHandle();
+    /* A completion callback resubmitting runs in the I/O task; it must not wait on itself. */
+    TickType_t wait = (queued.submitter == s_task) ? 0 : pdMS_TO_TICKS(SD_ASYNC_SUBMIT_TIMEOUT_MS);
+    bool notified = (queued.callback == NULL && queued.batch == NULL);
+    if (notified && !SD_AsyncClaimWaiter(queued.submitter)) {
+        return SD_BUSY; /* its earlier status would be overwritten */
+    }
+    if (xQueueSend(s_queue, &queued, wait) != pdTRUE) {
+        if (notified) {
+            SD_AsyncReleaseWaiter(queued.submitter);
+        }
+        return SD_BUSY;
+    }
+    return SD_OK;
+}
+
+SD_Status SD_SubmitFromISR(const SD_IoRequest *request, BaseType_t *higher_prio_woken) {
+    if (!request || !request->sd_handle || !request->buff || request->count == 0 ||
+        !request->callback) {
+        return SD_PARAM; /* no task to notify from an ISR */
+    }
+    if (s_queue == NULL) {
+        return SD_ERROR;
+    }
+
+    SD_IoRequest queued = *request;
+    queued.submitter = NULL;
+    BaseType_t woken = pdFALSE;
+    BaseType_t sent = xQueueSendFromISR(s_queue, &queued, &woken);
+    if (higher_prio_woken && woken == pdTRUE) {
+        *higher_prio_woken = pdTRUE;
+    }
+    return (sent == pdTRUE) ? SD_OK : SD_BUSY;
+}
+
+SD_Status SD_AsyncStart(void) {
+    if (s_task != NULL) {
+        return SD_OK;
+    }
+    SD_SchedInit(&s_sched, s_policy);
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_queue = xQueueCreateStatic(SD_ASYNC_QUEUE_DEPTH, sizeof(SD_IoRequest), s_queue_storage,
+                                 &s_queue_buffer);
+    if (s_queue == NULL) {
+        return SD_ERROR;
+    }
+    s_task = xTaskCreateStatic(SD_AsyncTask, "sd_io", SD_ASYNC_TASK_STACK, NULL,
+                               SD_ASYNC_TASK_PRIORITY, s_task_stack, &s_task_buffer);
+#else
+    s_queue = xQueueCreate(SD_ASYNC_QUEUE_DEPTH, sizeof(SD_IoRequest));
+    if (s_queue == NULL) {
+        return SD_ERROR;
+    }
+    if (xTaskCreate(SD_AsyncTask, "sd_io", SD_ASYNC_TASK_STACK, NULL, SD_ASYNC_TASK_PRIORITY,
+                    &s_task) != pdPASS) {
+        s_task = NULL;
+    }
+#endif
+    return (s_task != NULL) ? SD_OK : SD_ERROR;
+}
+
+TaskHandle_t SD_AsyncTaskHandle(void) {
+    return s_task;
+}
+
+void SD_AsyncSetPolicy(SD_SchedPolicy policy) {
+    s_policy = policy;
+}
+
+SD_Status SD_SubmitRead(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count,
+                        SD_AsyncCallback callback, void *context) {
+    SD_IoRequest request = {
+        .sd_handle = sd_handle,
+        .buff = buff,
+        .sector = sector,
+        .count = count,
+        .write = false,
+        .priority = SD_IO_PRIO_NORMAL,
+        .callback = callback,
+        .context = context,
+    };
+    return SD_Submit(&request);
+}
+
+SD_Status SD_SubmitWrite(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
+                         uint32_t count, SD_AsyncCallback callback, void *context) {
+    SD_IoRequest request = {
+        .sd_handle = sd_handle,
+        .buff = (uint8_t *)buff, // only read by SD_WriteBlocks
+        .sector = sector,
+        .count = count,
+        .write = true,
+        .priority = SD_IO_PRIO_NORMAL,
+        .callback = callback,
+        .context = context,
+    };
+    return SD_Submit(&request);
+}
+
+SD_Status SD_AsyncBatchInit(SD_AsyncBatch *batch) {
+    if (!batch) {
+        return SD_PARAM;
+    }
+    memset(batch, 0, sizeof(*batch));
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    batch->group = xEventGroupCreateStatic(&batch->group_buffer);
+#else
+    batch->group = xEventGroupCreate();
+#endif
+    if (batch->group == NULL) {
+        return SD_ERROR;
+    }
+    batch->sealed = true;
+    (void)xEventGroupSetBits(batch->group, SD_ASYNC_BATCH_DONE);
+    return SD_OK;
+}
+
+SD_Status SD_AsyncBatchBegin(SD_AsyncBatch *batch) {
+    if (!batch || batch->group == NULL) {
+        return SD_PARAM;
+    }
+    taskENTER_CRITICAL();
+    bool idle = (batch->pending == 0U);
+    if (idle) {
+        batch->pending = 1U; // held by the opener until SD_AsyncBatchWait
+        batch->members = 0;
+        batch->status = SD_OK;
+        batch->sealed = false;
+    }
+    taskEXIT_CRITICAL();
+    if (!idle) {
+        return SD_BUSY;
+    }
+    (void)xEventGroupClearBits(batch->group, SD_ASYNC_BATCH_DONE);
+    return SD_OK;
+}
+
+SD_Status SD_AsyncBatchSubmit(SD_AsyncBatch *batch, const SD_IoRequest *request) {
+    if (!batch || !request || batch->group == NULL || batch->sealed) {
+        return SD_PARAM;
+    }
+
+    SD_IoRequest member = *request;
+    member.batch = batch;
+    taskENTER_CRITICAL();
+    batch->pending++;
+    taskEXIT_CRITICAL();
+
+    SD_Status status = SD_Submit(&member);
+    if (status != SD_OK) {
+        SD_AsyncBatchRelease(batch, status);
+    } else {
+        batch->members++;
+    }
+    return status;
+}
+
+SD_Status SD_AsyncBatchWrite(SD_AsyncBatch *batch, SD_Handle_t *sd_handle, const uint8_t *buff,
+                             uint32_t sector, uint32_t count) {
+    SD_IoRequest request = {
+        .sd_handle = sd_handle,
+        .buff = (uint8_t *)buff, // only read by SD_WriteBlocks
+        .sector = sector,
+        .count = count,
+        .write = true,
+        .priority = SD_IO_PRIO_NORMAL,
+    };
+    return SD_AsyncBatchSubmit(batch, &request);
+}
+
+SD_Status SD_AsyncBatchWait(SD_AsyncBatch *batch, uint32_t timeout_ms) {
+    if (!batch || batch->group == NULL) {
+        return SD_PARAM;
+    }
+    if (!batch->sealed) {
+        batch->sealed = true;
+        SD_AsyncBatchRelease(batch, SD_OK);
+    }
+    EventBits_t bits = xEventGroupWaitBits(batch->group, SD_ASYNC_BATCH_DONE, pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    if ((bits & SD_ASYNC_BATCH_DONE) == 0U) {
+        return SD_TIMEOUT;
+    }
+    return batch->status;
+}
+
+SD_Status SD_AsyncWait(uint32_t timeout_ms) {
+    uint32_t value = 0;
+    if (xTaskNotifyWait(0, UINT32_MAX, &value, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return SD_TIMEOUT;
+    }
+    return (SD_Status)value;
+}
+
+#endif /* USE_FREERTOS */
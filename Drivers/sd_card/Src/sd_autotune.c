@@ -0,0 +1,221 @@
+/*
+ * sd_autotune.c
+ *
+ * Candidate sweep over sd_benchmark_file and the one-line configuration
+ * file: "SDTUNE,1,mid,psn,blocks,dma,prescaler,chunk_bytes,kb_per_s".
+ */
+
+#include "sd_autotune.h"
+#include "sd_benchmark.h"
+#include "sd_diskio_spi.h"
+#include "sd_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SD_TUNE_VERSION 1U
+#define SD_TUNE_LINE    96U
+
+static const uint32_t s_chunks[] = {512U, 4096U, 16384U};
+
+/* Card identity: CID manufacturer and serial, else the volume serial. */
+static void sd_tune_identify(const char *path, SD_TuneConfig *cfg) {
+    cfg->mid = 0U;
+    cfg->psn = 0U;
+    cfg->blocks = SD_GetBlockCount(&g_sd_handle);
+#if (SD_CARD_INFO == 1)
+    SD_CardInfo ci;
+    if (SD_GetCardInfo(&g_sd_handle, &ci) == SD_OK && ci.cid_valid) {
+        cfg->mid = ci.manufacturer_id;
+        cfg->psn = ci.serial;
+        return;
+    }
+#endif
+#if _USE_LABEL
+    DWORD vsn = 0;
+    if (f_getlabel(path, NULL, &vsn) == FR_OK) {
+        cfg->psn = (uint32_t)vsn;
+    }
+#else
+    (void)path;
+#endif
+}
+
+static int sd_tune_load(const char *path, SD_TuneConfig *cfg) {
+    char line[SD_TUNE_LINE];
+    uint32_t v[8];
+    UINT br = 0;
+
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_open(file, path, FA_READ);
+    if (res == FR_OK) {
+        res = f_read(file, line, sizeof(line) - 1U, &br);
+        (void)f_close(file);
+    }
+    sd_pool_fil_put(file);
+    if (res != FR_OK) {
+        return res;
+    }
+    line[br] = '\0';
+    if (strncmp(line, "SDTUNE,", 7) != 0) {
+        return FR_INVALID_OBJECT;
+    }
+    const char *p = line + 7;
+    for (uint32_t i = 0; i < 8U; i++) {
+        char *end;
+        v[i] = (uint32_t)strtoul(p, &end, 0);
+        if (end == p || (*end != ',' && i < 7U)) {
+            return FR_INVALID_OBJECT;
+        }
+        p = end + 1;
+    }
+    if (v[0] != SD_TUNE_VERSION || v[6] == 0U || v[6] > SD_BENCH_MAX_BUFFER) {
+        return FR_INVALID_OBJECT;
+    }
+    cfg->mid = (uint8_t)v[1];
+    cfg->psn = v[2];
+    cfg->blocks = v[3];
+    cfg->use_dma = (v[4] != 0U);
+    cfg->prescaler = v[5];
+    cfg->chunk_bytes = v[6];
+    cfg->kb_per_s = v[7];
+    return FR_OK;
+}
+
+static int sd_tune_save(const char *path, const SD_TuneConfig *cfg) {
+    char line[SD_TUNE_LINE];
+    UINT bw = 0;
+    int n = snprintf(line, sizeof(line), "SDTUNE,%u,0x%02X,0x%08lX,%lu,%u,0x%02lX,%lu,%lu\r\n",
+                     SD_TUNE_VERSION, (unsigned)cfg->mid, (unsigned long)cfg->psn,
+                     (unsigned long)cfg->blocks, cfg->use_dma ? 1U : 0U,
+                     (unsigned long)cfg->prescaler, (unsigned long)cfg->chunk_bytes,
+                     (unsigned long)cfg->kb_per_s);
+    if (n <= 0 || (size_t)n >= sizeof(line)) {
+        return FR_INT_ERR;
+    }
+
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_open(file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK) {
+        res = f_write(file, line, (UINT)n, &bw);
+        if (res == FR_OK && bw != (UINT)n) {
+            res = FR_DENIED; /* volume full */
+        }
+        FRESULT close_res = f_close(file);
+        if (res == FR_OK) {
+            res = close_res;
+        }
+    }
+    sd_pool_fil_put(file);
+    return res;
+}
+
+static SD_Status sd_tune_mode(bool use_dma) {
+    return SD_SetTransport(&g_sd_handle, use_dma ? SD_XFER_DMA : SD_XFER_POLL,
+                           g_sd_handle.xfer_threshold);
+}
+
+int sd_autotune_apply(const SD_TuneConfig *cfg) {
+    if (cfg == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    uint32_t prescaler = cfg->prescaler;
+    if (prescaler < SD_GetBusPrescaler(&g_sd_handle)) {
+        prescaler = SD_GetBusPrescaler(&g_sd_handle);
+    }
+    if (sd_tune_mode(cfg->use_dma) != SD_OK ||
+        SD_SetBusPrescaler(&g_sd_handle, prescaler) != SD_OK) {
+        return FR_DISK_ERR;
+    }
+    return FR_OK;
+}
+
+/* Write and read back the scratch file; cycles for both, or 0 on failure. */
+static uint64_t sd_tune_time(uint32_t chunk) {
+    SD_BenchResult w;
+    SD_BenchResult r;
+    if (sd_benchmark_file(SD_TUNE_SCRATCH, true, SD_TUNE_FILE_BYTES, chunk, &w) != FR_OK ||
+        sd_benchmark_file(SD_TUNE_SCRATCH, false, SD_TUNE_FILE_BYTES, chunk, &r) != FR_OK) {
+        return 0U;
+    }
+    return w.total_cycles + r.total_cycles;
+}
+
+static int sd_tune_run(SD_TuneConfig *best) {
+    const uint32_t step = SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2;
+    const uint32_t negotiated = SD_GetBusPrescaler(&g_sd_handle);
+    const bool saved_dma = g_sd_handle.use_dma;
+    const bool saved_irq = g_sd_handle.use_irq;
+    uint64_t best_cycles = 0U;
+
+    for (uint32_t i = 0; i < SD_TUNE_CLOCK_STEPS; i++) {
+        uint32_t prescaler = negotiated + i * step;
+        if (prescaler > SD_SPI_INIT_PRESCALER ||
+            SD_SetBusPrescaler(&g_sd_handle, prescaler) != SD_OK) {
+            break;
+        }
+        for (uint32_t mode = 0; mode < (SD_TUNE_DMA ? 2U : 1U); mode++) {
+            (void)sd_tune_mode(mode == 1U);
+            for (size_t c = 0; c < sizeof(s_chunks) / sizeof(s_chunks[0]); c++) {
+                if (s_chunks[c] > SD_BENCH_MAX_BUFFER) {
+                    continue;
+                }
+                uint64_t cycles = sd_tune_time(s_chunks[c]);
+                if (cycles != 0U && (best_cycles == 0U || cycles < best_cycles)) {
+                    best_cycles = cycles;
+                    best->use_dma = (mode == 1U);
+                    best->prescaler = prescaler;
+                    best->chunk_bytes = s_chunks[c];
+                }
+            }
+        }
+    }
+#if (_FS_MINIMIZE == 0)
+    (void)f_unlink(SD_TUNE_SCRATCH);
+#endif
+
+    (void)SD_SetBusPrescaler(&g_sd_handle, negotiated);
+    (void)SD_SetTransport(&g_sd_handle,
+                          saved_dma ? SD_XFER_DMA : (saved_irq ? SD_XFER_IRQ : SD_XFER_POLL),
+                          g_sd_handle.xfer_threshold);
+    if (best_cycles == 0U) {
+        return FR_DISK_ERR;
+    }
+    best->kb_per_s = (uint32_t)(((uint64_t)2U * SD_TUNE_FILE_BYTES * SystemCoreClock) /
+                                (1024U * best_cycles));
+    return FR_OK;
+}
+
+int sd_autotune(const char *path, bool force, SD_TuneConfig *out) {
+    SD_TuneConfig card;
+    SD_TuneConfig cfg;
+    if (path == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    sd_tune_identify(path, &card);
+
+    int res = force ? FR_NO_FILE : sd_tune_load(path, &cfg);
+    if (res != FR_OK || cfg.mid != card.mid || cfg.psn != card.psn ||
+        cfg.blocks != card.blocks) {
+        cfg = card;
+        res = sd_tune_run(&cfg);
+        if (res != FR_OK) {
+            return res;
+        }
+        res = sd_tune_save(path, &cfg);
+        if (res != FR_OK) {
+            return res;
+        }
+    }
+    res = sd_autotune_apply(&cfg);
+    if (res == FR_OK && out != NULL) {
+        *out = cfg;
+    }
+    return res;
+}
@@ -7,83 +7,987 @@
 #include "sd_benchmark.h"
 #include "fatfs.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "main.h"
+#include "sd_diskio_spi.h"
 #include "sd_functions.h"
+#include "sd_mem.h"
+#include "sd_pool.h"
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#include "sd_async.h"
+#endif
 
 #define TEST_SIZE 512000 /* 500 KB test file */
 
-uint32_t sd_benchmark_write(const char *filename, uint32_t size_bytes) {
-    FIL file;
-    UINT written;
-    uint8_t buffer[512];
-    memset(buffer, 0xAA, sizeof(buffer));
+/* Sweep tables for sd_benchmark_suite. */
+static const uint32_t s_buf_sizes[] = {512U, 1024U, 2048U, 4096U, 8192U, 16384U, 32768U};
+static const uint32_t s_file_sizes[] = {65536U, 524288U, 2097152U};
+/* SFN compare, directory entry, partial sectors, whole sector. */
+static const uint32_t s_mem_sizes[] = {11U, 32U, 100U, 256U, 511U, 512U};
+
+/* 16-byte aligned at least, so DMA profiles with word packing (SD_DMA_WORD_MEM) apply. */
+static uint8_t s_buffer[SD_BENCH_MAX_BUFFER]
+    __attribute__((aligned((SD_DMA_ALIGNMENT < 16U) ? 16U : SD_DMA_ALIGNMENT)));
+static uint32_t s_samples[SD_BENCH_MAX_SAMPLES];
+#if (SD_LATENCY_STATS == 1)
+static uint64_t s_bus_start; /* bus_xfer_cycles when the running result started */
+#endif
+
+/* CSV sink set by sd_benchmark_set_csv. */
+static SD_Handle_t *s_csv_sd;
+static const char *s_csv_path;
+static char s_csv_tag[32];
+static char s_csv_line[256];
+
+#ifdef USE_FREERTOS
+/* One in-flight IOPS request; completion is recorded by the SD I/O task. */
+typedef struct {
+    SD_BenchIopsResult *out;
+    uint32_t start;
+    bool write;
+    uint8_t index;
+} SD_BenchSlot;
 
-    FRESULT res = f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+static SD_BenchSlot s_slots[SD_BENCH_MAX_QD];
+static QueueHandle_t s_free_slots;
+static volatile SD_Status s_iops_status;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticQueue_t s_free_buffer;
+static uint8_t s_free_storage[SD_BENCH_MAX_QD];
+#endif
+#endif
+
+void sd_benchmark_cycles_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0U) {
+        DWT->CYCCNT = 0U;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+}
+
+static int sd_bench_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long sd_bench_us(uint64_t cycles) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    return (unsigned long)(cycles / (per_us ? per_us : 1U));
+}
+
+static void sd_bench_start(SD_BenchResult *out, SD_Handle_t *sd_handle, uint32_t bytes,
+                           uint32_t per_call) {
+    sd_benchmark_cycles_init();
+    memset(out, 0, sizeof(*out));
+    out->file_bytes = bytes;
+    out->buf_bytes = per_call;
+    out->use_dma = sd_handle->use_dma;
+    out->min_cycles = UINT32_MAX;
+#if (SD_LATENCY_STATS == 1)
+    s_bus_start = sd_handle->stats.bus_xfer_cycles;
+#endif
+}
+
+static void sd_bench_record(SD_BenchResult *out, uint32_t cycles) {
+    if (out->calls < SD_BENCH_MAX_SAMPLES) {
+        s_samples[out->calls] = cycles;
+    }
+    out->calls++;
+    out->total_cycles += cycles;
+    if (cycles < out->min_cycles) out->min_cycles = cycles;
+    if (cycles > out->max_cycles) out->max_cycles = cycles;
+}
+
+static void sd_bench_finish(SD_BenchResult *out, SD_Handle_t *sd_handle) {
+#if (SD_LATENCY_STATS == 1)
+    out->bus_cycles = sd_handle->stats.bus_xfer_cycles - s_bus_start;
+#else
+    (void)sd_handle;
+#endif
+    uint32_t kept = (out->calls < SD_BENCH_MAX_SAMPLES) ? out->calls : SD_BENCH_MAX_SAMPLES;
+    if (kept == 0U) {
+        out->min_cycles = 0U;
+    } else {
+        qsort(s_samples, kept, sizeof(s_samples[0]), sd_bench_cmp);
+        out->p99_cycles = s_samples[((uint64_t)kept * 99U) / 100U];
+    }
+}
+
+int sd_benchmark_file(const char *filename, bool write, uint32_t file_bytes,
+                      uint32_t buf_bytes, SD_BenchResult *out) {
+    if (!out || buf_bytes == 0U || buf_bytes > SD_BENCH_MAX_BUFFER) {
+        return FR_INVALID_PARAMETER;
+    }
+    sd_bench_start(out, &g_sd_handle, file_bytes, buf_bytes);
+    if (write) {
+        memset(s_buffer, 0xAA, buf_bytes);
+    }
+
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_open(file, filename, write ? (FA_CREATE_ALWAYS | FA_WRITE) : FA_READ);
     if (res != FR_OK) {
-        printf("f_open failed: %d\r\n", res);
-        return 0;
+        sd_pool_fil_put(file);
+        return res;
     }
 
-    uint32_t start = HAL_GetTick();
-    uint32_t remaining = size_bytes;
+    uint32_t remaining = file_bytes;
+    while (remaining > 0U && res == FR_OK) {
+        UINT chunk = (remaining > buf_bytes) ? buf_bytes : remaining;
+        UINT done = 0;
+        uint32_t start = DWT->CYCCNT;
+        res = write ? f_write(file, s_buffer, chunk, &done)
+                    : f_read(file, s_buffer, chunk, &done);
+        uint32_t cycles = DWT->CYCCNT - start;
+        if (res == FR_OK && done != chunk) {
+            res = write ? FR_DENIED : FR_INT_ERR; /* volume full / file short */
+        }
 
-    while (remaining > 0) {
-        UINT to_write = (remaining > sizeof(buffer)) ? sizeof(buffer) : remaining;
-        res = f_write(&file, buffer, to_write, &written);
-        if (res != FR_OK || written != to_write) {
-            printf("f_write error\r\n");
+        sd_bench_record(out, cycles);
+        remaining -= done;
+    }
+
+    uint32_t start = DWT->CYCCNT;
+    FRESULT close_res = f_close(file);
+    out->total_cycles += DWT->CYCCNT - start;
+    sd_pool_fil_put(file);
+    if (res == FR_OK) {
+        res = close_res;
+    }
+
+    sd_bench_finish(out, &g_sd_handle);
+    return res;
+}
+
+static uint32_t sd_bench_rand(uint32_t *seed) {
+    *seed = *seed * 1664525U + 1013904223U; /* LCG: repeatable pattern across runs */
+    return *seed >> 8;
+}
+
+SD_Status sd_benchmark_raw(SD_Handle_t *sd_handle, const SD_BenchRawConfig *cfg,
+                           SD_BenchResult *out) {
+    if (!sd_handle || !cfg || !out || cfg->blocks_per_cmd == 0U ||
+        cfg->blocks_per_cmd > SD_BENCH_MAX_BUFFER / SD_BLOCK_SIZE ||
+        cfg->span_blocks < cfg->blocks_per_cmd || cfg->op > SD_BENCH_RAW_WRITE_MULTI) {
+        return SD_PARAM;
+    }
+    bool write = (cfg->op == SD_BENCH_RAW_WRITE || cfg->op == SD_BENCH_RAW_WRITE_MULTI);
+    sd_bench_start(out, sd_handle, cfg->total_blocks * SD_BLOCK_SIZE,
+                   cfg->blocks_per_cmd * SD_BLOCK_SIZE);
+    if (write) {
+        memset(s_buffer, 0x5A, cfg->blocks_per_cmd * SD_BLOCK_SIZE);
+    }
+
+    uint32_t slots = cfg->span_blocks / cfg->blocks_per_cmd; /* command-aligned offsets */
+    uint32_t seed = 0x2545F491U;
+    uint32_t next = 0;
+    uint32_t remaining = cfg->total_blocks;
+    SD_Status status = SD_OK;
+
+    while (remaining > 0U && status == SD_OK) {
+        uint32_t count = (remaining > cfg->blocks_per_cmd) ? cfg->blocks_per_cmd : remaining;
+        uint32_t slot;
+        if (cfg->random) {
+            slot = sd_bench_rand(&seed) % slots;
+        } else {
+            slot = next;
+            next = (next + 1U < slots) ? next + 1U : 0U;
+        }
+        uint32_t lba = cfg->first_lba + slot * cfg->blocks_per_cmd;
+
+        uint32_t start = DWT->CYCCNT;
+        switch (cfg->op) {
+        case SD_BENCH_RAW_READ:
+            status = SD_ReadBlocks(sd_handle, s_buffer, lba, count);
+            break;
+        case SD_BENCH_RAW_WRITE:
+            status = SD_WriteBlocks(sd_handle, s_buffer, lba, count);
+            break;
+        case SD_BENCH_RAW_READ_MULTI:
+            status = SD_ReadMultiBlocks(sd_handle, s_buffer, lba, count);
+            break;
+        default:
+            status = SD_WriteMultiBlocks(sd_handle, s_buffer, lba, count);
             break;
         }
-        remaining -= written;
+        sd_bench_record(out, DWT->CYCCNT - start);
+        remaining -= count;
     }
 
-    f_close(&file);
-    uint32_t elapsed = HAL_GetTick() - start;
-    printf("[%s] Write %lu bytes in %lu ms\r\n",
-           g_sd_handle.use_dma ? "DMA" : "Polling", size_bytes, elapsed);
-    return elapsed;
+    if (write && status == SD_OK) {
+        uint32_t start = DWT->CYCCNT;
+        status = SD_Sync(sd_handle); /* charge the last block's programming time */
+        out->total_cycles += DWT->CYCCNT - start;
+    }
+    sd_bench_finish(out, sd_handle);
+    return status;
 }
 
-uint32_t sd_benchmark_read(const char *filename, uint32_t size_bytes) {
-    FIL file;
-    UINT read;
-    uint8_t buffer[512];
+void sd_benchmark_raw_suite(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks) {
+    static const char *const op_tags[] = {"read", "write", "readmulti", "writemulti"};
+    static const SD_BenchRawOp ops[] = {SD_BENCH_RAW_WRITE, SD_BENCH_RAW_READ,
+                                        SD_BENCH_RAW_WRITE_MULTI, SD_BENCH_RAW_READ_MULTI};
+    SD_BenchRawConfig cfg;
+    SD_BenchResult r;
+    char tag[24];
 
-    FRESULT res = f_open(&file, filename, FA_READ);
+    sd_benchmark_print_card(sd_handle);
+    sd_benchmark_print_header();
+    for (uint32_t per_cmd = 1U; per_cmd <= SD_BENCH_MAX_BUFFER / SD_BLOCK_SIZE; per_cmd <<= 1) {
+        if (per_cmd > span_blocks) {
+            break;
+        }
+        for (uint32_t pattern = 0; pattern < 2U; pattern++) {
+            for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+                cfg.op = ops[i];
+                cfg.random = (pattern == 1U);
+                cfg.first_lba = first_lba;
+                cfg.span_blocks = span_blocks;
+                cfg.blocks_per_cmd = per_cmd;
+                cfg.total_blocks = (span_blocks < 1024U) ? span_blocks : 1024U;
+
+                snprintf(tag, sizeof(tag), "raw_%s_%s", op_tags[ops[i]],
+                         cfg.random ? "rand" : "seq");
+                SD_Status status = sd_benchmark_raw(sd_handle, &cfg, &r);
+                if (status != SD_OK) {
+                    printf("SDBENCH,error,%s,%d\r\n", tag, (int)status);
+                    continue;
+                }
+                sd_benchmark_print(tag, &r);
+            }
+        }
+    }
+    printf("SDBENCH,done\r\n");
+}
+
+void sd_benchmark_dma_suite(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks) {
+#if (SD_DMA_PROFILE == 1)
+    /* The CubeMX defaults first, then one change at a time. */
+    static const struct {
+        const char *tag;
+        SD_DmaProfile profile;
+    } profiles[] = {
+        {"cubemx", {DMA_PRIORITY_LOW, false, false, DMA_MBURST_SINGLE}},
+        {"fifo", {DMA_PRIORITY_LOW, true, false, DMA_MBURST_SINGLE}},
+        {"packed", {DMA_PRIORITY_LOW, true, true, DMA_MBURST_SINGLE}},
+        {"burst", {DMA_PRIORITY_LOW, true, true, DMA_MBURST_INC4}},
+        {"burst_high", {DMA_PRIORITY_HIGH, true, true, DMA_MBURST_INC4}},
+        {"burst_vhigh", {DMA_PRIORITY_VERY_HIGH, true, true, DMA_MBURST_INC4}},
+    };
+    static const SD_BenchRawOp ops[] = {SD_BENCH_RAW_WRITE, SD_BENCH_RAW_READ};
+    static const char *const op_tags[] = {"read", "write"};
+    SD_DmaProfile saved;
+    SD_BenchRawConfig cfg;
+    SD_BenchResult r;
+    char tag[32];
+
+    if (!sd_handle || SD_GetDmaProfile(sd_handle, &saved) != SD_OK) {
+        printf("SDBENCH,error,dma_profile\r\n");
+        return;
+    }
+    bool saved_dma = sd_handle->use_dma;
+    sd_handle->use_dma = true;
+    sd_benchmark_print_header();
+    for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        if (SD_SetDmaProfile(sd_handle, &profiles[p].profile) != SD_OK) {
+            printf("SDBENCH,error,%s\r\n", profiles[p].tag);
+            continue;
+        }
+        /* Single blocks are packed; 8-block commands show the pipelined stages. */
+        for (uint32_t per_cmd = 1U; per_cmd <= 8U && per_cmd <= span_blocks; per_cmd <<= 3) {
+            for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+                cfg.op = ops[i];
+                cfg.random = false;
+                cfg.first_lba = first_lba;
+                cfg.span_blocks = span_blocks;
+                cfg.blocks_per_cmd = per_cmd;
+                cfg.total_blocks = (span_blocks < 1024U) ? span_blocks : 1024U;
+
+                snprintf(tag, sizeof(tag), "dma_%s_%s%lu", profiles[p].tag, op_tags[ops[i]],
+                         (unsigned long)per_cmd);
+                SD_Status status = sd_benchmark_raw(sd_handle, &cfg, &r);
+                if (status != SD_OK) {
+                    printf("SDBENCH,error,%s,%d\r\n", tag, (int)status);
+                    continue;
+                }
+                sd_benchmark_print(tag, &r);
+            }
+        }
+    }
+    (void)SD_SetDmaProfile(sd_handle, &saved);
+    sd_handle->use_dma = saved_dma;
+    printf("SDBENCH,done\r\n");
+#else
+    (void)sd_handle;
+    (void)first_lba;
+    (void)span_blocks;
+    printf("SDBENCH,error,dma_profile\r\n");
+#endif
+}
+
+static void sd_bench_iops_record(SD_BenchIopsResult *out, bool write, uint32_t cycles) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    uint32_t us = cycles / (per_us ? per_us : 1U);
+    uint32_t bucket = 0;
+    while (bucket + 1U < SD_BENCH_HIST_BUCKETS && (us >> (bucket + 1U)) != 0U) {
+        bucket++;
+    }
+
+    if (write) {
+        out->writes++;
+        out->write_cycles += cycles;
+        out->write_hist[bucket]++;
+        if (cycles > out->write_max_cycles) out->write_max_cycles = cycles;
+    } else {
+        out->reads++;
+        out->read_cycles += cycles;
+        out->read_hist[bucket]++;
+        if (cycles > out->read_max_cycles) out->read_max_cycles = cycles;
+    }
+}
+
+#ifdef USE_FREERTOS
+/* Runs in the SD I/O task. */
+static void sd_bench_iops_done(SD_Status status, void *context) {
+    SD_BenchSlot *slot = (SD_BenchSlot *)context;
+    sd_bench_iops_record(slot->out, slot->write, DWT->CYCCNT - slot->start);
+    if (status != SD_OK && s_iops_status == SD_OK) {
+        s_iops_status = status;
+    }
+    (void)xQueueSend(s_free_slots, &slot->index, 0);
+}
+
+static SD_Status sd_bench_iops_queued(SD_Handle_t *sd_handle, const SD_BenchIopsConfig *cfg,
+                                      SD_BenchIopsResult *out, uint32_t *seed) {
+    if (SD_AsyncStart() != SD_OK) {
+        return SD_ERROR;
+    }
+    if (s_free_slots == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        s_free_slots = xQueueCreateStatic(SD_BENCH_MAX_QD, sizeof(uint8_t), s_free_storage,
+                                          &s_free_buffer);
+#else
+        s_free_slots = xQueueCreate(SD_BENCH_MAX_QD, sizeof(uint8_t));
+#endif
+        if (s_free_slots == NULL) {
+            return SD_ERROR;
+        }
+    }
+    (void)xQueueReset(s_free_slots);
+    for (uint8_t i = 0; i < cfg->queue_depth; i++) {
+        (void)xQueueSend(s_free_slots, &i, 0);
+    }
+    s_iops_status = SD_OK;
+
+    uint32_t ios = cfg->span_blocks / cfg->io_blocks;
+    uint32_t io_bytes = cfg->io_blocks * SD_BLOCK_SIZE;
+    uint32_t issued = 0;
+    while (issued < cfg->ops && s_iops_status == SD_OK) {
+        uint8_t index;
+        (void)xQueueReceive(s_free_slots, &index, portMAX_DELAY);
+        SD_BenchSlot *slot = &s_slots[index];
+        uint8_t *buff = s_buffer + (index * io_bytes);
+        uint32_t lba = cfg->first_lba + (sd_bench_rand(seed) % ios) * cfg->io_blocks;
+
+        slot->out = out;
+        slot->index = index;
+        slot->write = (sd_bench_rand(seed) % 100U) >= cfg->read_percent;
+        slot->start = DWT->CYCCNT;
+        SD_Status status = slot->write
+            ? SD_SubmitWrite(sd_handle, buff, lba, cfg->io_blocks, sd_bench_iops_done, slot)
+            : SD_SubmitRead(sd_handle, buff, lba, cfg->io_blocks, sd_bench_iops_done, slot);
+        if (status == SD_OK) {
+            issued++;
+            continue;
+        }
+        (void)xQueueSend(s_free_slots, &index, 0);
+        if (status == SD_BUSY) {
+            vTaskDelay(1); /* async queue momentarily full; retry another I/O */
+        } else {
+            s_iops_status = status;
+        }
+    }
+
+    /* Drain: every slot back in the free queue means nothing is in flight. */
+    for (uint32_t i = 0; i < cfg->queue_depth; i++) {
+        uint8_t index;
+        (void)xQueueReceive(s_free_slots, &index, portMAX_DELAY);
+    }
+    return s_iops_status;
+}
+#endif
+
+SD_Status sd_benchmark_iops(SD_Handle_t *sd_handle, const SD_BenchIopsConfig *cfg,
+                            SD_BenchIopsResult *out) {
+    if (!sd_handle || !cfg || !out || cfg->io_blocks == 0U || cfg->read_percent > 100U ||
+        cfg->span_blocks < cfg->io_blocks || cfg->queue_depth == 0U ||
+        cfg->queue_depth > SD_BENCH_MAX_QD ||
+        cfg->io_blocks * cfg->queue_depth > SD_BENCH_MAX_BUFFER / SD_BLOCK_SIZE) {
+        return SD_PARAM;
+    }
+#ifndef USE_FREERTOS
+    if (cfg->queue_depth > 1U) {
+        return SD_PARAM;
+    }
+#endif
+    sd_benchmark_cycles_init();
+    memset(out, 0, sizeof(*out));
+    out->io_blocks = cfg->io_blocks;
+    out->read_percent = cfg->read_percent;
+    out->queue_depth = cfg->queue_depth;
+    out->use_dma = sd_handle->use_dma;
+    memset(s_buffer, 0x3C, cfg->io_blocks * cfg->queue_depth * SD_BLOCK_SIZE);
+
+    uint32_t seed = 0x6A09E667U;
+    uint32_t begin = DWT->CYCCNT;
+    SD_Status status = SD_OK;
+
+#ifdef USE_FREERTOS
+    if (cfg->queue_depth > 1U) {
+        status = sd_bench_iops_queued(sd_handle, cfg, out, &seed);
+    } else
+#endif
+    {
+        uint32_t ios = cfg->span_blocks / cfg->io_blocks;
+        for (uint32_t n = 0; n < cfg->ops && status == SD_OK; n++) {
+            uint32_t lba = cfg->first_lba + (sd_bench_rand(&seed) % ios) * cfg->io_blocks;
+            bool write = (sd_bench_rand(&seed) % 100U) >= cfg->read_percent;
+            uint32_t start = DWT->CYCCNT;
+            status = write ? SD_WriteBlocks(sd_handle, s_buffer, lba, cfg->io_blocks)
+                           : SD_ReadBlocks(sd_handle, s_buffer, lba, cfg->io_blocks);
+            sd_bench_iops_record(out, write, DWT->CYCCNT - start);
+        }
+    }
+
+    if (status == SD_OK && out->writes > 0U) {
+        status = SD_Sync(sd_handle);
+    }
+    out->total_cycles = DWT->CYCCNT - begin;
+    return status;
+}
+
+void sd_benchmark_iops_print(const char *tag, const SD_BenchIopsResult *r) {
+    uint32_t ops = r->reads + r->writes;
+    uint64_t iops = r->total_cycles ? ((uint64_t)ops * SystemCoreClock) / r->total_cycles : 0U;
+    uint64_t rd_avg = r->reads ? r->read_cycles / r->reads : 0U;
+    uint64_t wr_avg = r->writes ? r->write_cycles / r->writes : 0U;
+
+    printf("SDBENCH_IOPS,%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", tag,
+           r->use_dma ? "dma" : "poll", (unsigned long)(r->io_blocks * SD_BLOCK_SIZE),
+           (unsigned long)r->read_percent, (unsigned long)r->queue_depth, (unsigned long)ops,
+           (unsigned long)iops, sd_bench_us(rd_avg), sd_bench_us(r->read_max_cycles),
+           sd_bench_us(wr_avg), sd_bench_us(r->write_max_cycles));
+    for (uint32_t dir = 0; dir < 2U; dir++) {
+        const uint32_t *hist = dir ? r->write_hist : r->read_hist;
+        printf("SDBENCH_HIST,%s,%s", tag, dir ? "write" : "read");
+        for (uint32_t i = 0; i < SD_BENCH_HIST_BUCKETS; i++) {
+            printf(",%lu", (unsigned long)hist[i]);
+        }
+        printf("\r\n");
+    }
+}
+
+void sd_benchmark_iops_suite(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks) {
+    static const uint32_t io_sizes[] = {1U, 8U};
+    static const uint32_t mixes[] = {100U, 0U, 70U};
+#ifdef USE_FREERTOS
+    static const uint32_t depths[] = {1U, 4U};
+#else
+    static const uint32_t depths[] = {1U};
+#endif
+    SD_BenchIopsConfig cfg;
+    SD_BenchIopsResult r;
+    char tag[40];
+
+    printf("SDBENCH_IOPS,tag,mode,io_bytes,read_pct,qd,ops,iops,rd_avg_us,rd_max_us,"
+           "wr_avg_us,wr_max_us\r\n");
+    for (size_t s = 0; s < sizeof(io_sizes) / sizeof(io_sizes[0]); s++) {
+        for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+            for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+                cfg.first_lba = first_lba;
+                cfg.span_blocks = span_blocks;
+                cfg.io_blocks = io_sizes[s];
+                cfg.read_percent = mixes[m];
+                cfg.ops = 500U;
+                cfg.queue_depth = depths[d];
+
+                snprintf(tag, sizeof(tag), "rand%lu_r%lu_qd%lu",
+                         (unsigned long)(io_sizes[s] * SD_BLOCK_SIZE),
+                         (unsigned long)mixes[m], (unsigned long)depths[d]);
+                SD_Status status = sd_benchmark_iops(sd_handle, &cfg, &r);
+                if (status != SD_OK) {
+                    printf("SDBENCH,error,%s,%d\r\n", tag, (int)status);
+                    continue;
+                }
+                sd_benchmark_iops_print(tag, &r);
+            }
+        }
+    }
+    printf("SDBENCH,done\r\n");
+}
+
+/* ff.c's mem_cpy/mem_set/mem_cmp, kept out of line as they are there. */
+static __attribute__((noinline)) void sd_bench_ff_cpy(void *dst, const void *src, UINT cnt) {
+    BYTE *d = (BYTE *)dst;
+    const BYTE *s = (const BYTE *)src;
+    if (cnt) {
+        do {
+            *d++ = *s++;
+        } while (--cnt);
+    }
+}
+
+static __attribute__((noinline)) void sd_bench_ff_set(void *dst, int val, UINT cnt) {
+    BYTE *d = (BYTE *)dst;
+    do {
+        *d++ = (BYTE)val;
+    } while (--cnt);
+}
+
+static __attribute__((noinline)) int sd_bench_ff_cmp(const void *dst, const void *src, UINT cnt) {
+    const BYTE *d = (const BYTE *)dst, *s = (const BYTE *)src;
+    int r = 0;
+    do {
+        r = *d++ - *s++;
+    } while (--cnt && r == 0);
+    return r;
+}
+
+#define SD_BENCH_MEM_REPS 16U
+
+/* Cycles per call of one routine; impl 0 = ff.c's loop, 1 = sd_mem, 2 = libc. */
+static uint32_t sd_bench_mem_time(int op, int impl, uint8_t *dst, const uint8_t *src,
+                                  uint32_t n) {
+    volatile int sink = 0;
+    uint32_t start = DWT->CYCCNT;
+    for (uint32_t i = 0; i < SD_BENCH_MEM_REPS; i++) {
+        if (op == 0) {
+            if (impl == 0) sd_bench_ff_cpy(dst, src, n);
+            else if (impl == 1) sd_mem_copy(dst, src, n);
+            else memcpy(dst, src, n);
+        } else if (op == 1) {
+            if (impl == 0) sd_bench_ff_set(dst, (int)i, n);
+            else if (impl == 1) sd_mem_set(dst, (int)i, n);
+            else memset(dst, (int)i, n);
+        } else {
+            if (impl == 0) sink += sd_bench_ff_cmp(dst, src, n);
+            else if (impl == 1) sink += sd_mem_cmp(dst, src, n);
+            else sink += memcmp(dst, src, n);
+        }
+    }
+    (void)sink;
+    return (DWT->CYCCNT - start) / SD_BENCH_MEM_REPS;
+}
+
+void sd_benchmark_mem_suite(void) {
+    static const char *const ops[] = {"copy", "set", "cmp"};
+    uint8_t *dst = s_buffer;
+    uint8_t *src = &s_buffer[1024];
+
+    sd_benchmark_cycles_init();
+    printf("SDBENCH_MEM,op,bytes,src_offset,byte_cycles,sd_mem_cycles,libc_cycles\r\n");
+    for (int op = 0; op < 3; op++) {
+        for (size_t k = 0; k < sizeof(s_mem_sizes) / sizeof(s_mem_sizes[0]); k++) {
+            uint32_t n = s_mem_sizes[k];
+            for (uint32_t off = 0; off < ((op == 1) ? 1U : 2U); off++) {
+                memset(&src[off], 0x5A, n);
+                memset(dst, 0x5A, n);
+                uint32_t c[3];
+                for (int impl = 0; impl < 3; impl++) {
+                    c[impl] = sd_bench_mem_time(op, impl, dst, &src[off], n);
+                }
+                printf("SDBENCH_MEM,%s,%lu,%lu,%lu,%lu,%lu\r\n", ops[op], (unsigned long)n,
+                       (unsigned long)off, (unsigned long)c[0], (unsigned long)c[1],
+                       (unsigned long)c[2]);
+            }
+        }
+    }
+}
+
+void sd_benchmark_print_card(SD_Handle_t *sd_handle) {
+    SD_CardInfo ci;
+    if (SD_GetCardInfo(sd_handle, &ci) != SD_OK) {
+        return;
+    }
+    printf("SDBENCH_CARD,0x%02X,%s,%s,%u.%u,0x%08lX,%04u-%02u,%lu,%u,%u,%u,%lu,0x%02lX\r\n",
+           ci.manufacturer_id, ci.oem_id, ci.product_name, (unsigned)(ci.revision >> 4),
+           (unsigned)(ci.revision & 0x0FU), (unsigned long)ci.serial, (unsigned)ci.mfg_year,
+           (unsigned)ci.mfg_month, (unsigned long)ci.tran_speed_kbps, (unsigned)ci.speed_class,
+           (unsigned)ci.uhs_grade, (unsigned)ci.video_class, (unsigned long)(ci.au_blocks / 2U),
+           (unsigned long)SD_GetBusPrescaler(sd_handle));
+}
+
+void sd_benchmark_set_csv(SD_Handle_t *sd_handle, const char *path, const char *tag) {
+    s_csv_sd = sd_handle;
+    s_csv_path = path;
+    snprintf(s_csv_tag, sizeof(s_csv_tag), "%s", tag ? tag : "");
+}
+
+static unsigned long sd_bench_kbps(const SD_BenchResult *r) {
+    return (unsigned long)(r->total_cycles
+        ? ((uint64_t)r->file_bytes * SystemCoreClock) / (1024U * r->total_cycles) : 0U);
+}
+
+/* bus_cycles also covers the gaps between timed calls, hence the clamp. */
+static unsigned long sd_bench_bus_permille(const SD_BenchResult *r) {
+    uint64_t permille = r->total_cycles ? (r->bus_cycles * 1000U) / r->total_cycles : 0U;
+    return (unsigned long)((permille > 1000U) ? 1000U : permille);
+}
+
+/* Card and clock columns: tag,mid,oid,pnm,prv,psn,mdt,prescaler,spi_khz */
+static int sd_bench_csv_card(char *out, size_t len) {
+    SD_CardInfo ci;
+    uint32_t prescaler = SD_GetBusPrescaler(s_csv_sd);
+    uint32_t divisor = 2U << ((prescaler - SPI_BAUDRATEPRESCALER_2) /
+                              (SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2));
+    unsigned long khz = (unsigned long)(SD_SPI_CLOCK_HZ / divisor / 1000U);
+    if (SD_GetCardInfo(s_csv_sd, &ci) != SD_OK || !ci.cid_valid) {
+        return snprintf(out, len, "%s,,,,,,,0x%02lX,%lu", s_csv_tag, (unsigned long)prescaler,
+                        khz);
+    }
+    return snprintf(out, len, "%s,0x%02X,%s,%s,%u.%u,0x%08lX,%04u-%02u,0x%02lX,%lu", s_csv_tag,
+                    ci.manufacturer_id, ci.oem_id, ci.product_name,
+                    (unsigned)(ci.revision >> 4), (unsigned)(ci.revision & 0x0FU),
+                    (unsigned long)ci.serial, (unsigned)ci.mfg_year, (unsigned)ci.mfg_month,
+                    (unsigned long)prescaler, khz);
+}
+
+int sd_benchmark_csv_append(const char *op, const SD_BenchResult *r) {
+    static const char header[] = "tag,mid,oid,pnm,prv,psn,mdt,prescaler,spi_khz,op,mode,"
+                                 "file_bytes,buf_bytes,calls,min_us,avg_us,p99_us,max_us,"
+                                 "kb_per_s\r\n";
+    if (s_csv_path == NULL || s_csv_sd == NULL || op == NULL || r == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    uint64_t avg = r->calls ? (r->total_cycles / r->calls) : 0U;
+    int n = sd_bench_csv_card(s_csv_line, sizeof(s_csv_line));
+    if (n > 0 && (size_t)n < sizeof(s_csv_line)) {
+        n += snprintf(s_csv_line + n, sizeof(s_csv_line) - (size_t)n,
+                      ",%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", op,
+                      r->use_dma ? "dma" : "poll", (unsigned long)r->file_bytes,
+                      (unsigned long)r->buf_bytes, (unsigned long)r->calls,
+                      sd_bench_us(r->min_cycles), sd_bench_us(avg), sd_bench_us(r->p99_cycles),
+                      sd_bench_us(r->max_cycles), sd_bench_kbps(r));
+    }
+    if (n <= 0 || (size_t)n >= sizeof(s_csv_line)) {
+        return FR_INVALID_PARAMETER;
+    }
+
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_open(file, s_csv_path, FA_OPEN_APPEND | FA_WRITE);
+    if (res != FR_OK) {
+        sd_pool_fil_put(file);
+        return res;
+    }
+    UINT done = 0;
+    if (f_size(file) == 0U) {
+        res = f_write(file, header, sizeof(header) - 1U, &done);
+        if (res == FR_OK && done != sizeof(header) - 1U) {
+            res = FR_DENIED;
+        }
+    }
+    if (res == FR_OK) {
+        res = f_write(file, s_csv_line, (UINT)n, &done);
+        if (res == FR_OK && done != (UINT)n) {
+            res = FR_DENIED; /* volume full */
+        }
+    }
+    FRESULT close_res = f_close(file);
+    sd_pool_fil_put(file);
+    return (res == FR_OK) ? close_res : res;
+}
+
+void sd_benchmark_print_header(void) {
+    printf("SDBENCH,op,mode,file_bytes,buf_bytes,calls,min_us,avg_us,p99_us,max_us,kb_per_s,"
+           "bus_permille\r\n");
+}
+
+void sd_benchmark_print(const char *op, const SD_BenchResult *r) {
+    uint64_t avg = r->calls ? (r->total_cycles / r->calls) : 0U;
+    printf("SDBENCH,%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", op,
+           r->use_dma ? "dma" : "poll", (unsigned long)r->file_bytes,
+           (unsigned long)r->buf_bytes, (unsigned long)r->calls, sd_bench_us(r->min_cycles),
+           sd_bench_us(avg), sd_bench_us(r->p99_cycles), sd_bench_us(r->max_cycles),
+           sd_bench_kbps(r), sd_bench_bus_permille(r));
+    if (s_csv_path != NULL) {
+        int res = sd_benchmark_csv_append(op, r);
+        if (res != FR_OK) {
+            printf("SDBENCH,error,csv,%d\r\n", res);
+        }
+    }
+}
+
+/* Card traffic around one fsconf workload. */
+typedef struct {
+    uint32_t read_blocks;
+    uint32_t write_blocks;
+    uint32_t cmds;
+} SD_BenchTraffic;
+
+static void sd_bench_traffic(SD_BenchTraffic *t) {
+    t->read_blocks = g_sd_handle.stats.read_blocks;
+    t->write_blocks = g_sd_handle.stats.write_blocks;
+    t->cmds = g_sd_handle.stats.read_ops + g_sd_handle.stats.write_ops;
+}
+
+static void sd_bench_fsconf_print(const char *op, const SD_BenchResult *r,
+                                  const SD_BenchTraffic *before) {
+    SD_BenchTraffic after;
+    sd_bench_traffic(&after);
+    printf("SDBENCH_FSCONF,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", op, (unsigned long)r->file_bytes,
+           (unsigned long)r->calls, sd_bench_us(r->total_cycles), sd_bench_kbps(r),
+           (unsigned long)(after.read_blocks - before->read_blocks),
+           (unsigned long)(after.write_blocks - before->write_blocks),
+           (unsigned long)(after.cmds - before->cmds));
+}
+
+static void sd_bench_fsconf_file(const char *op, bool write, uint32_t buf_bytes) {
+    SD_BenchResult r;
+    SD_BenchTraffic before;
+    sd_bench_traffic(&before);
+    int res = sd_benchmark_file("fsconf.bin", write, SD_BENCH_FSCONF_BYTES, buf_bytes, &r);
+    if (res != FR_OK) {
+        printf("SDBENCH_FSCONF,error,%s,%d\r\n", op, res);
+        return;
+    }
+    sd_bench_fsconf_print(op, &r, &before);
+}
+
+/* 512-byte reads at repeatable random sector offsets of the file written before. */
+static void sd_bench_fsconf_seek(void) {
+    SD_BenchResult r;
+    SD_BenchTraffic before;
+    const uint32_t reads = 128U;
+    uint32_t seed = 0x9E3779B9U;
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        printf("SDBENCH_FSCONF,error,seek_read,%d\r\n", FR_TOO_MANY_OPEN_FILES);
+        return;
+    }
+    FRESULT res = f_open(file, "fsconf.bin", FA_READ);
+    if (res != FR_OK) {
+        sd_pool_fil_put(file);
+        printf("SDBENCH_FSCONF,error,seek_read,%d\r\n", res);
+        return;
+    }
+    sd_bench_traffic(&before);
+    sd_bench_start(&r, &g_sd_handle, reads * 512U, 512U);
+#if (_USE_FASTSEEK == 1)
+    /* The link map is built inside the timed run: it is part of what fast seek costs. */
+    static DWORD clmt[64];
+    clmt[0] = sizeof(clmt) / sizeof(clmt[0]);
+    file->cltbl = clmt;
+    uint32_t start = DWT->CYCCNT;
+    res = f_lseek(file, CREATE_LINKMAP);
+    r.total_cycles += DWT->CYCCNT - start;
+    if (res != FR_OK) {
+        file->cltbl = NULL; /* map too small for the fragmentation: walk the FAT */
+        res = FR_OK;
+    }
+#endif
+    uint32_t sectors = SD_BENCH_FSCONF_BYTES / 512U;
+    for (uint32_t i = 0; i < reads && res == FR_OK; i++) {
+        UINT done = 0;
+        uint32_t start = DWT->CYCCNT;
+        res = f_lseek(file, (FSIZE_t)(sd_bench_rand(&seed) % sectors) * 512U);
+        if (res == FR_OK) {
+            res = f_read(file, s_buffer, 512U, &done);
+        }
+        sd_bench_record(&r, DWT->CYCCNT - start);
+    }
+    (void)f_close(file);
+    sd_pool_fil_put(file);
+    sd_bench_finish(&r, &g_sd_handle);
     if (res != FR_OK) {
-        printf("f_open failed: %d\r\n", res);
-        return 0;
+        printf("SDBENCH_FSCONF,error,seek_read,%d\r\n", res);
+        return;
+    }
+    sd_bench_fsconf_print("seek_read", &r, &before);
+}
+
+/* Long names where the build has LFN; 8.3 names otherwise, same count and directory. */
+static void sd_bench_fsconf_name(char *name, size_t len, uint32_t i) {
+#if (_USE_LFN != 0)
+    snprintf(name, len, "fsconf/sensor_record_%04lu.dat", (unsigned long)i);
+#else
+    snprintf(name, len, "fsconf/R%04lu.DAT", (unsigned long)i);
+#endif
+}
+
+static void sd_bench_fsconf_dir(void) {
+    SD_BenchResult r;
+    SD_BenchTraffic before;
+    char name[40];
+    FRESULT res = f_mkdir("fsconf");
+    if (res != FR_OK && res != FR_EXIST) {
+        printf("SDBENCH_FSCONF,error,dir_create,%d\r\n", res);
+        return;
     }
 
-    uint32_t start = HAL_GetTick();
-    uint32_t remaining = size_bytes;
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        printf("SDBENCH_FSCONF,error,dir_create,%d\r\n", FR_TOO_MANY_OPEN_FILES);
+        return;
+    }
+    sd_bench_traffic(&before);
+    sd_bench_start(&r, &g_sd_handle, 0U, 0U);
+    for (uint32_t i = 0; i < SD_BENCH_FSCONF_FILES && res != FR_DISK_ERR; i++) {
+        sd_bench_fsconf_name(name, sizeof(name), i);
+        uint32_t start = DWT->CYCCNT;
+        res = f_open(file, name, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res == FR_OK) {
+            res = f_close(file);
+        }
+        sd_bench_record(&r, DWT->CYCCNT - start);
+    }
+    sd_pool_fil_put(file);
+    sd_bench_finish(&r, &g_sd_handle);
+    if (res != FR_OK) {
+        printf("SDBENCH_FSCONF,error,dir_create,%d\r\n", res);
+        return;
+    }
+    sd_bench_fsconf_print("dir_create", &r, &before);
 
-    while (remaining > 0) {
-        UINT to_read = (remaining > sizeof(buffer)) ? sizeof(buffer) : remaining;
-        res = f_read(&file, buffer, to_read, &read);
-        if (res != FR_OK || read != to_read) {
-            printf("f_read error\r\n");
+    static FILINFO fno; /* a full LFN name: kept off the caller's stack */
+    SD_POOL_DIR_DECL(dir);
+    if (dir == NULL) {
+        printf("SDBENCH_FSCONF,error,dir_list,%d\r\n", FR_TOO_MANY_OPEN_FILES);
+        return;
+    }
+    sd_bench_traffic(&before);
+    sd_bench_start(&r, &g_sd_handle, 0U, 0U);
+    res = f_opendir(dir, "fsconf");
+    while (res == FR_OK) {
+        uint32_t start = DWT->CYCCNT;
+        res = f_readdir(dir, &fno);
+        sd_bench_record(&r, DWT->CYCCNT - start);
+        if (fno.fname[0] == 0) {
             break;
         }
-        remaining -= read;
+    }
+    (void)f_closedir(dir);
+    sd_pool_dir_put(dir);
+    sd_bench_finish(&r, &g_sd_handle);
+    if (res != FR_OK) {
+        printf("SDBENCH_FSCONF,error,dir_list,%d\r\n", res);
+        return;
+    }
+    sd_bench_fsconf_print("dir_list", &r, &before);
+
+#if (_FS_MINIMIZE == 0)
+    sd_bench_traffic(&before);
+    sd_bench_start(&r, &g_sd_handle, 0U, 0U);
+    for (uint32_t i = 0; i < SD_BENCH_FSCONF_FILES; i++) {
+        sd_bench_fsconf_name(name, sizeof(name), i);
+        uint32_t start = DWT->CYCCNT;
+        (void)f_unlink(name);
+        sd_bench_record(&r, DWT->CYCCNT - start);
+    }
+    (void)f_unlink("fsconf");
+    sd_bench_finish(&r, &g_sd_handle);
+    sd_bench_fsconf_print("dir_remove", &r, &before);
+#endif
+}
+
+void sd_benchmark_fsconf_suite(void) {
+    if (sd_mount() != FR_OK) {
+        printf("SDBENCH_FSCONF,error,mount\r\n");
+        return;
+    }
+
+    uint32_t cache_lines = SD_CACHE_ENABLED ? SD_CACHE_LINES : 0U;
+    uint32_t ram_lfn = (_USE_LFN == 1) ? (_MAX_LFN + 1U) * (uint32_t)sizeof(WCHAR) : 0U;
+    uint32_t ram_cache = cache_lines * 512U;
+    uint32_t ram_total = (uint32_t)(sizeof(FATFS) + sizeof(FIL)) + ram_lfn + ram_cache;
+    printf("SDBENCH_FSCONF,config,tiny%d-lfn%d-fastseek%d-cache%lu,tiny=%d,lfn=%d,fastseek=%d,"
+           "cache_lines=%lu,ram_fatfs=%lu,ram_fil=%lu,ram_lfn=%lu,ram_cache=%lu,ram_total=%lu\r\n",
+           _FS_TINY, _USE_LFN, _USE_FASTSEEK, (unsigned long)cache_lines, _FS_TINY, _USE_LFN,
+           _USE_FASTSEEK, (unsigned long)cache_lines, (unsigned long)sizeof(FATFS),
+           (unsigned long)sizeof(FIL), (unsigned long)ram_lfn, (unsigned long)ram_cache,
+           (unsigned long)ram_total);
+    printf("SDBENCH_FSCONF,op,bytes,calls,us,kb_per_s,sect_rd,sect_wr,cmds\r\n");
+
+    sd_bench_fsconf_file("seq_write", true, 4096U);
+    sd_bench_fsconf_file("seq_read", false, 4096U);
+    sd_bench_fsconf_seek();
+    sd_bench_fsconf_file("small_write", true, 64U);
+    sd_bench_fsconf_file("small_read", false, 64U);
+    sd_bench_fsconf_dir();
+
+#if (_FS_MINIMIZE == 0)
+    f_unlink("fsconf.bin");
+#endif
+    printf("SDBENCH_FSCONF,done\r\n");
+    sd_unmount();
+}
+
+void sd_benchmark_suite(void) {
+    if (sd_mount() != FR_OK) {
+        printf("SDBENCH,error,mount\r\n");
+        return;
+    }
+
+    bool saved_dma = g_sd_handle.use_dma;
+    SD_BenchResult r;
+    sd_benchmark_print_card(&g_sd_handle);
+    sd_benchmark_print_header();
+
+    for (uint32_t mode = 0; mode < 2U; mode++) {
+        g_sd_handle.use_dma = (mode == 1U);
+        for (size_t f = 0; f < sizeof(s_file_sizes) / sizeof(s_file_sizes[0]); f++) {
+            for (size_t b = 0; b < sizeof(s_buf_sizes) / sizeof(s_buf_sizes[0]); b++) {
+                if (s_buf_sizes[b] > SD_BENCH_MAX_BUFFER) {
+                    continue;
+                }
+                int res = sd_benchmark_file("bench.bin", true, s_file_sizes[f], s_buf_sizes[b], &r);
+                if (res != FR_OK) {
+                    printf("SDBENCH,error,write,%d\r\n", res);
+                    continue;
+                }
+                sd_benchmark_print("write", &r);
+
+                res = sd_benchmark_file("bench.bin", false, s_file_sizes[f], s_buf_sizes[b], &r);
+                if (res != FR_OK) {
+                    printf("SDBENCH,error,read,%d\r\n", res);
+                    continue;
+                }
+                sd_benchmark_print("read", &r);
+            }
+        }
     }
 
-    f_close(&file);
-    uint32_t elapsed = HAL_GetTick() - start;
-    printf("[%s] Read %lu bytes in %lu ms\r\n",
-           g_sd_handle.use_dma ? "DMA" : "Polling", size_bytes, elapsed);
-    return elapsed;
+    g_sd_handle.use_dma = saved_dma;
+#if (_FS_MINIMIZE == 0)
+    f_unlink("bench.bin");
+#endif
+    printf("SDBENCH,done\r\n");
+    sd_unmount();
 }
 
 void sd_benchmark(void) {
     if (sd_mount() == FR_OK) {
         printf("Starting Benchmark Test\r\n");
-        uint32_t w = sd_benchmark_write("bench.bin", TEST_SIZE);
-        uint32_t r = sd_benchmark_read("bench.bin", TEST_SIZE);
+        SD_BenchResult w;
+        SD_BenchResult r;
+        int wres = sd_benchmark_file("bench.bin", true, TEST_SIZE, 512U, &w);
+        int rres = sd_benchmark_file("bench.bin", false, TEST_SIZE, 512U, &r);
 
-        if (w > 0) printf("Write speed: %lu KB/s\r\n", (TEST_SIZE / 1024 * 1000) / w);
-        if (r > 0) printf("Read  speed: %lu KB/s\r\n", (TEST_SIZE / 1024 * 1000) / r);
+        sd_benchmark_print_header();
+        if (wres == FR_OK) sd_benchmark_print("write", &w);
+        else printf("Write failed: %d\r\n", wres);
+        if (rres == FR_OK) sd_benchmark_print("read", &r);
+        else printf("Read failed: %d\r\n", rres);
 
         sd_unmount();
     }
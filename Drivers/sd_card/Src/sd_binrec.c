@@ -0,0 +1,371 @@
+/*
+ * sd_binrec.c
+ *
+ * Binary record files: header build and check, logger start, in-place reads
+ * through sd_mapwin and the CSV converter (sd_csv_parse callback filling one
+ * static record per row).
+ */
+
+#include "sd_binrec.h"
+#include "sd_crc32.h"
+#include "sd_functions.h"
+#include "sd_logger.h"
+#include "sd_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SD_BR_MAGIC   0x52424453UL /* "SDBR" */
+#define SD_BR_VERSION 1U
+
+#define SD_BR_HD_VERSION 4U
+#define SD_BR_HD_FIELDS  6U
+#define SD_BR_HD_SIZE    8U
+#define SD_BR_HD_HEADER  10U
+#define SD_BR_HD_FIELD0  16U
+#define SD_BR_HD_CRC     508U
+
+_Static_assert(sizeof(SD_BinRecField) == 16U, "SD_BinRecField must match the header layout");
+_Static_assert(SD_BR_HD_FIELD0 + SD_BINREC_MAX_FIELDS * 16U <= SD_BR_HD_CRC,
+               "SD_BINREC_MAX_FIELDS does not fit the header");
+
+static void sd_br_put16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void sd_br_put32(uint8_t *p, uint32_t v) {
+    sd_br_put16(p, v);
+    sd_br_put16(p + 2, v >> 16);
+}
+
+static uint32_t sd_br_get16(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t sd_br_get32(const uint8_t *p) {
+    return sd_br_get16(p) | (sd_br_get16(p + 2) << 16);
+}
+
+static uint32_t sd_br_crc(const uint8_t *header) {
+    return ~SD_Crc32(SD_CRC32_INIT, header, SD_BR_HD_CRC);
+}
+
+/* Bytes per element of a type; 0 for an unknown one. */
+static uint32_t sd_br_elem(uint8_t type) {
+    switch (type) {
+    case SD_BINREC_U8:
+    case SD_BINREC_I8:
+    case SD_BINREC_CHAR:
+        return 1U;
+    case SD_BINREC_U16:
+    case SD_BINREC_I16:
+        return 2U;
+    case SD_BINREC_U32:
+    case SD_BINREC_I32:
+    case SD_BINREC_F32:
+        return 4U;
+    case SD_BINREC_U64:
+    case SD_BINREC_I64:
+    case SD_BINREC_F64:
+        return 8U;
+    default:
+        return 0U;
+    }
+}
+
+static bool sd_br_layout_ok(const SD_BinRecField *fields, uint32_t n, uint32_t record_size) {
+    if (fields == NULL || n == 0U || n > SD_BINREC_MAX_FIELDS || record_size == 0U ||
+        record_size > 0xFFFFU) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const SD_BinRecField *f = &fields[i];
+        uint32_t elem = sd_br_elem(f->type);
+        size_t name_len = strnlen(f->name, SD_BINREC_NAME_LEN);
+        if (elem == 0U || f->size == 0U || (f->size % elem) != 0U ||
+            (uint32_t)f->offset + f->size > record_size || name_len == 0U ||
+            name_len >= SD_BINREC_NAME_LEN) {
+            return false;
+        }
+        for (uint32_t j = 0; j < i; j++) {
+            if (strcmp(fields[j].name, f->name) == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int sd_binrec_header(const SD_BinRecField *fields, uint32_t n, uint32_t record_size,
+                     uint8_t *header) {
+    if (header == NULL || !sd_br_layout_ok(fields, n, record_size)) {
+        return FR_INVALID_PARAMETER;
+    }
+    memset(header, 0, SD_BINREC_HEADER_BYTES);
+    sd_br_put32(header, SD_BR_MAGIC);
+    sd_br_put16(header + SD_BR_HD_VERSION, SD_BR_VERSION);
+    sd_br_put16(header + SD_BR_HD_FIELDS, n);
+    sd_br_put16(header + SD_BR_HD_SIZE, record_size);
+    sd_br_put16(header + SD_BR_HD_HEADER, SD_BINREC_HEADER_BYTES);
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *d = header + SD_BR_HD_FIELD0 + i * 16U;
+        strncpy((char *)d, fields[i].name, SD_BINREC_NAME_LEN); /* pads with NULs */
+        d[12] = fields[i].type;
+        d[13] = fields[i].size;
+        sd_br_put16(d + 14, fields[i].offset);
+    }
+    sd_br_put32(header + SD_BR_HD_CRC, sd_br_crc(header));
+    return FR_OK;
+}
+
+static bool sd_br_header_ok(const uint8_t *header) {
+    return sd_br_get32(header) == SD_BR_MAGIC &&
+           sd_br_get16(header + SD_BR_HD_VERSION) == SD_BR_VERSION &&
+           sd_br_get16(header + SD_BR_HD_HEADER) == SD_BINREC_HEADER_BYTES &&
+           sd_br_get32(header + SD_BR_HD_CRC) == sd_br_crc(header);
+}
+
+static uint8_t s_br_header[SD_BINREC_HEADER_BYTES] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_br_found[SD_BINREC_HEADER_BYTES] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+int sd_binrec_logger_start(const char *path, const SD_BinRecField *fields, uint32_t n,
+                           uint32_t record_size) {
+#if SD_LOGGER_COMPRESS || (SD_LOGGER_CHANNELS > 0U)
+    (void)path;
+    (void)fields;
+    (void)n;
+    (void)record_size;
+    return FR_DENIED;
+#else
+    if (path == NULL || record_size > SD_LOGGER_MAX_RECORD ||
+        sd_binrec_header(fields, n, record_size, s_br_header) != FR_OK) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (SD_LOGGER_PREALLOC_BYTES == 0U) {
+        /* Appending: whatever is there must be the same layout. */
+        SD_POOL_FIL_DECL(file);
+        if (file == NULL) {
+            return FR_TOO_MANY_OPEN_FILES;
+        }
+        FRESULT res = f_open(file, path, FA_READ);
+        if (res == FR_OK) {
+            UINT br = 0;
+            if (f_size(file) > 0U) {
+                res = f_read(file, s_br_found, SD_BINREC_HEADER_BYTES, &br);
+                if (res == FR_OK && (br != SD_BINREC_HEADER_BYTES ||
+                                     memcmp(s_br_found, s_br_header, SD_BINREC_HEADER_BYTES) != 0)) {
+                    res = FR_INVALID_OBJECT;
+                }
+            }
+            (void)f_close(file);
+        } else if (res == FR_NO_FILE) {
+            res = FR_OK;
+        }
+        sd_pool_fil_put(file);
+        if (res != FR_OK) {
+            return res;
+        }
+    }
+    return sd_logger_start_with_header(path, s_br_header, SD_BINREC_HEADER_BYTES);
+#endif
+}
+
+int sd_binrec_open(SD_BinRecReader *r, FIL *fp, void *buf, uint32_t bytes) {
+    if (r == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    FRESULT res = sd_map_init(&r->map, fp, buf, bytes);
+    if (res != FR_OK) {
+        return res;
+    }
+    const uint8_t *header = NULL;
+    if (f_size(fp) >= SD_BINREC_HEADER_BYTES) {
+        header = sd_map_window(&r->map, 0U, SD_BINREC_HEADER_BYTES);
+        if (header == NULL) {
+            return r->map.err;
+        }
+    }
+    if (header == NULL || !sd_br_header_ok(header)) {
+        return FR_NO_FILESYSTEM;
+    }
+    r->nfields = sd_br_get16(header + SD_BR_HD_FIELDS);
+    r->record_size = sd_br_get16(header + SD_BR_HD_SIZE);
+    if (r->nfields == 0U || r->nfields > SD_BINREC_MAX_FIELDS || r->record_size == 0U) {
+        return FR_NO_FILESYSTEM;
+    }
+    if (r->record_size > r->map.size) {
+        return FR_INVALID_PARAMETER;
+    }
+    r->count = (uint32_t)((f_size(fp) - SD_BINREC_HEADER_BYTES) / r->record_size);
+    return FR_OK;
+}
+
+const void *sd_binrec_get(SD_BinRecReader *r, uint32_t index) {
+    if (index >= r->count) {
+        return NULL;
+    }
+    return sd_map_window(&r->map, SD_BINREC_HEADER_BYTES + index * r->record_size,
+                         r->record_size);
+}
+
+int sd_binrec_field(SD_BinRecReader *r, const char *name, SD_BinRecField *out) {
+    if (name == NULL || out == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    const uint8_t *header = sd_map_window(&r->map, 0U, SD_BINREC_HEADER_BYTES);
+    if (header == NULL) {
+        return r->map.err;
+    }
+    for (uint32_t i = 0; i < r->nfields; i++) {
+        const uint8_t *d = header + SD_BR_HD_FIELD0 + i * 16U;
+        if (strncmp((const char *)d, name, SD_BINREC_NAME_LEN) == 0) {
+            memcpy(out->name, d, SD_BINREC_NAME_LEN);
+            out->type = d[12];
+            out->size = d[13];
+            out->offset = (uint16_t)sd_br_get16(d + 14);
+            return FR_OK;
+        }
+    }
+    return FR_NO_FILE;
+}
+
+/* CSV conversion state for the sd_csv_parse callback. */
+typedef struct {
+    FIL *out;
+    const SD_BinRecField *fields;
+    uint32_t n;
+    uint32_t record_size;
+    SD_BinRecConvertStats stats;
+    FRESULT res;
+} sd_br_convert_ctx;
+
+static uint8_t s_br_record[SD_BINREC_MAX_RECORD];
+
+/* One column into its field; false if it does not parse. */
+static bool sd_br_put_value(const SD_BinRecField *f, const char *text, uint8_t *dst) {
+    char *end = NULL;
+    if (f->type == SD_BINREC_CHAR) {
+        strncpy((char *)dst, text, f->size);
+        return true;
+    }
+    union {
+        uint8_t u8;
+        int8_t i8;
+        uint16_t u16;
+        int16_t i16;
+        uint32_t u32;
+        int32_t i32;
+        uint64_t u64;
+        int64_t i64;
+        float f32;
+        double f64;
+    } v;
+    switch (f->type) {
+    case SD_BINREC_U8:
+    case SD_BINREC_U16:
+    case SD_BINREC_U32:
+    case SD_BINREC_U64:
+        v.u64 = strtoull(text, &end, 0);
+        if (f->type == SD_BINREC_U8) {
+            v.u8 = (uint8_t)v.u64;
+        } else if (f->type == SD_BINREC_U16) {
+            v.u16 = (uint16_t)v.u64;
+        } else if (f->type == SD_BINREC_U32) {
+            v.u32 = (uint32_t)v.u64;
+        }
+        break;
+    case SD_BINREC_I8:
+    case SD_BINREC_I16:
+    case SD_BINREC_I32:
+    case SD_BINREC_I64:
+        v.i64 = strtoll(text, &end, 0);
+        if (f->type == SD_BINREC_I8) {
+            v.i8 = (int8_t)v.i64;
+        } else if (f->type == SD_BINREC_I16) {
+            v.i16 = (int16_t)v.i64;
+        } else if (f->type == SD_BINREC_I32) {
+            v.i32 = (int32_t)v.i64;
+        }
+        break;
+    case SD_BINREC_F32:
+        v.f32 = strtof(text, &end);
+        break;
+    default:
+        v.f64 = strtod(text, &end);
+        break;
+    }
+    if (end == text) {
+        return false;
+    }
+    /* Array fields take the one value in their first element. */
+    memcpy(dst, &v, sd_br_elem(f->type));
+    return true;
+}
+
+static bool sd_br_convert_row(char **fields, int nfields, uint32_t line, void *context) {
+    sd_br_convert_ctx *ctx = (sd_br_convert_ctx *)context;
+    (void)line;
+    if ((uint32_t)nfields < ctx->n) {
+        ctx->stats.skipped++;
+        return true;
+    }
+    memset(s_br_record, 0, ctx->record_size);
+    for (uint32_t i = 0; i < ctx->n; i++) {
+        const SD_BinRecField *f = &ctx->fields[i];
+        if (!sd_br_put_value(f, fields[i], s_br_record + f->offset)) {
+            ctx->stats.skipped++;
+            return true;
+        }
+    }
+    UINT bw = 0;
+    ctx->res = f_write(ctx->out, s_br_record, ctx->record_size, &bw);
+    if (ctx->res == FR_OK && bw != ctx->record_size) {
+        ctx->res = FR_DENIED; /* volume full */
+    }
+    if (ctx->res != FR_OK) {
+        return false;
+    }
+    ctx->stats.records++;
+    return true;
+}
+
+int sd_binrec_from_csv(const char *csv, const char *bin, const SD_BinRecField *fields,
+                       uint32_t n, uint32_t record_size, SD_BinRecConvertStats *stats) {
+    if (csv == NULL || bin == NULL || record_size > SD_BINREC_MAX_RECORD ||
+        sd_binrec_header(fields, n, record_size, s_br_header) != FR_OK) {
+        return FR_INVALID_PARAMETER;
+    }
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    sd_br_convert_ctx ctx = {file, fields, n, record_size, {0, 0}, FR_OK};
+    FRESULT res = f_open(file, bin, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK) {
+        sd_dirindex_add(bin);
+        UINT bw = 0;
+        res = f_write(file, s_br_header, SD_BINREC_HEADER_BYTES, &bw);
+        if (res == FR_OK && bw != SD_BINREC_HEADER_BYTES) {
+            res = FR_DENIED;
+        }
+        if (res == FR_OK) {
+            res = sd_csv_parse(csv, ',', sd_br_convert_row, &ctx, NULL);
+            if (res == FR_OK) {
+                res = ctx.res;
+            }
+        }
+        FRESULT close_res = f_close(file);
+        if (res == FR_OK) {
+            res = close_res;
+        }
+        if (res != FR_OK) {
+            (void)f_unlink(bin);
+            sd_dirindex_invalidate(bin);
+        }
+    }
+    sd_pool_fil_put(file);
+    if (stats != NULL) {
+        *stats = ctx.stats;
+    }
+    return res;
+}
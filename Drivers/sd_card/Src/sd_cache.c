@@ -0,0 +1,1256 @@
+/*
+ * sd_cache.c
+ *
+ * Write-back sector cache: static pool, LRU replacement, dirty bitmap.
+ * Holds are kept by (card, sector) rather than by line, so they survive
+ * eviction races and discards; the victim search skips held sectors.
+ *
+ * A read miss claims its line as filling (not valid, never a victim) and reads
+ * the card outside the pool lock. A write, discard or reset that overlaps the
+ * sector meanwhile marks the fill stale, and a stale fill is not installed.
+ *
+ * With SD_CACHE_CLASSES each line records the class of its sector. A class
+ * at its share of lines picks the victim among its own; below it, a free line
+ * or the pool-wide LRU line. FIFO classes are simply not re-stamped on hits.
+ *
+ * Journal record (SD_CACHE_JOURNAL), little-endian: magic, sequence number,
+ * sector count n, FNV-1a check of the header (check field 0) and of the n
+ * images that follow it; then the n target sectors. Record s lives in slot
+ * s & 1, so a record is never written over the one before it.
+ */
+
+#include "sd_cache.h"
+#include "sd_mem.h"
+#include <string.h>
+
+typedef struct {
+    SD_Handle_t *sd_handle; // Card the sector belongs to
+    uint32_t sector; // Cached sector number (valid only if its s_valid bit is set)
+    uint32_t stamp;  // LRU stamp; larger is more recently used
+    uint8_t cls;     // SD_CLASS_* of the sector
+} SD_CacheLine;
+
+#define SD_CLASS_FAT   0U
+#define SD_CLASS_DIR   1U
+#define SD_CLASS_DATA  2U
+#define SD_CLASS_NONE  3U /* card without registered regions: the whole pool, LRU */
+
+static SD_CacheLine s_lines[SD_CACHE_LINES];
+static uint8_t s_data[SD_CACHE_LINES][SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint32_t s_valid;
+static uint32_t s_dirty;
+static uint32_t s_filling;    // Lines claimed by a read miss whose card read is in flight
+static uint32_t s_fill_stale; // Filling lines overlapped by a write or discard meanwhile
+static uint32_t s_clock;
+static uint32_t s_active = SD_CACHE_LINES; // Lines in use (SD_CacheSetLines; 0 = off)
+static SD_CacheStats s_stats;
+#if (SD_CACHE_BUSY_READS == 1)
+static SD_Handle_t *volatile s_writeback_card; // Card a shared write-back is writing to
+#endif
+
+#if defined(USE_FREERTOS) && (SD_CACHE_LOCK == 1)
+/*
+ * Reader/writer lock. Writers hold s_gate for their whole section; readers only
+ * pass through it to register, so a waiting writer keeps new readers out. The
+ * last reader to leave while a writer waits gives s_drained.
+ */
+static SemaphoreHandle_t s_gate;
+static SemaphoreHandle_t s_drained;
+static volatile uint32_t s_readers;
+static volatile bool s_writer_waiting;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_gate_buffer;
+static StaticSemaphore_t s_drained_buffer;
+#endif
+
+static bool SD_CacheLockCreate(void) {
+    if (s_gate != NULL && s_drained != NULL) {
+        return true;
+    }
+    vTaskSuspendAll();
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    if (s_gate == NULL) {
+        s_gate = xSemaphoreCreateMutexStatic(&s_gate_buffer);
+    }
+    if (s_drained == NULL) {
+        s_drained = xSemaphoreCreateBinaryStatic(&s_drained_buffer);
+    }
+#else
+    if (s_gate == NULL) {
+        s_gate = xSemaphoreCreateMutex();
+    }
+    if (s_drained == NULL) {
+        s_drained = xSemaphoreCreateBinary();
+    }
+#endif
+    (void)xTaskResumeAll();
+    return s_gate != NULL && s_drained != NULL;
+}
+
+static bool SD_CacheLockShared(void) {
+    if (!SD_CacheLockCreate() || xSemaphoreTake(s_gate, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    taskENTER_CRITICAL();
+    s_readers++;
+    taskEXIT_CRITICAL();
+    (void)xSemaphoreGive(s_gate);
+    return true;
+}
+
+static void SD_CacheUnlockShared(void) {
+    taskENTER_CRITICAL();
+    bool wake = (--s_readers == 0U) && s_writer_waiting;
+    if (wake) {
+        s_writer_waiting = false;
+    }
+    taskEXIT_CRITICAL();
+    if (wake) {
+        (void)xSemaphoreGive(s_drained);
+    }
+}
+
+static bool SD_CacheLockExclusive(void) {
+    if (!SD_CacheLockCreate() || xSemaphoreTake(s_gate, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    taskENTER_CRITICAL();
+    bool wait = (s_readers > 0U);
+    s_writer_waiting = wait;
+    taskEXIT_CRITICAL();
+    if (wait) {
+        (void)xSemaphoreTake(s_drained, portMAX_DELAY);
+    }
+    return true;
+}
+
+static void SD_CacheUnlockExclusive(void) {
+    (void)xSemaphoreGive(s_gate);
+}
+
+#if (SD_CACHE_BUSY_READS == 1)
+/* Exclusive to shared without letting a writer in between; undo with SD_CacheUnlockShared. */
+static void SD_CacheLockDowngrade(void) {
+    taskENTER_CRITICAL();
+    s_readers++;
+    taskEXIT_CRITICAL();
+    (void)xSemaphoreGive(s_gate);
+}
+#endif
+
+/* Bookkeeping that concurrent readers share. */
+#define SD_CACHE_ENTER() taskENTER_CRITICAL()
+#define SD_CACHE_EXIT()  taskEXIT_CRITICAL()
+#else
+static bool SD_CacheLockShared(void) {
+    return true;
+}
+
+static void SD_CacheUnlockShared(void) {
+}
+
+static bool SD_CacheLockExclusive(void) {
+    return true;
+}
+
+static void SD_CacheUnlockExclusive(void) {
+}
+
+#if (SD_CACHE_BUSY_READS == 1)
+static void SD_CacheLockDowngrade(void) {
+}
+#endif
+
+#define SD_CACHE_ENTER() do { } while (0)
+#define SD_CACHE_EXIT()  do { } while (0)
+#endif
+
+#if (SD_CACHE_CLASSES == 1)
+typedef struct {
+    SD_Handle_t *sd_handle; // NULL = free slot
+    uint32_t fat_first;
+    uint32_t dir_first;
+    uint32_t data_first;
+} SD_CacheRegions;
+
+static SD_CacheRegions s_regions[SD_MAX_INSTANCES];
+static uint32_t s_class_lines[3] = {SD_CACHE_FAT_LINES, SD_CACHE_DIR_LINES,
+                                    SD_CACHE_DATA_LINES}; // SD_CacheSetClassLines
+static const uint8_t s_class_policy[3] = {SD_CACHE_FAT_POLICY, SD_CACHE_DIR_POLICY,
+                                          SD_CACHE_DATA_POLICY};
+
+static SD_CacheRegions *SD_CacheRegionsFind(const SD_Handle_t *sd_handle) {
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES; i++) {
+        if (s_regions[i].sd_handle != NULL && s_regions[i].sd_handle == sd_handle) {
+            return &s_regions[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+static uint8_t SD_CacheClassOf(const SD_Handle_t *sd_handle, uint32_t sector) {
+#if (SD_CACHE_CLASSES == 1)
+    const SD_CacheRegions *r = SD_CacheRegionsFind(sd_handle);
+    if (r != NULL) {
+        if (sector >= r->data_first) {
+            return SD_CLASS_DATA;
+        }
+        return (sector >= r->fat_first && sector < r->dir_first) ? SD_CLASS_FAT : SD_CLASS_DIR;
+    }
+#else
+    (void)sd_handle;
+    (void)sector;
+#endif
+    return SD_CLASS_NONE;
+}
+
+/* Lines the class may fill. */
+static uint32_t SD_CacheClassLines(uint8_t cls) {
+#if (SD_CACHE_CLASSES == 1)
+    if (cls != SD_CLASS_NONE) {
+        return s_class_lines[cls];
+    }
+#endif
+    (void)cls;
+    return SD_CACHE_LINES;
+}
+
+/* Whether a hit refreshes the line's stamp. */
+static bool SD_CacheLru(uint32_t line) {
+#if (SD_CACHE_CLASSES == 1)
+    uint8_t cls = s_lines[line].cls;
+    return cls == SD_CLASS_NONE || s_class_policy[cls] == SD_CACHE_LRU;
+#else
+    (void)line;
+    return true;
+#endif
+}
+
+/* A single-sector access that skips the pool: its class has no lines. */
+static bool SD_CacheBypass(const SD_Handle_t *sd_handle, uint32_t sector) {
+    if (SD_CacheClassLines(SD_CacheClassOf(sd_handle, sector)) != 0U) {
+        return false;
+    }
+    SD_CACHE_ENTER();
+    s_stats.bypassed++;
+    SD_CACHE_EXIT();
+    return true;
+}
+
+#if (SD_CACHE_HOLD_LINES > 0U)
+typedef struct {
+    SD_Handle_t *sd_handle;
+    uint32_t sector;
+    uint32_t refs; // 0 = free slot
+} SD_CacheHoldSlot;
+
+static SD_CacheHoldSlot s_holds[SD_CACHE_HOLD_LINES];
+
+static SD_CacheHoldSlot *SD_CacheHoldFind(const SD_Handle_t *sd_handle, uint32_t sector) {
+    for (uint32_t i = 0; i < SD_CACHE_HOLD_LINES; i++) {
+        if (s_holds[i].refs > 0U && s_holds[i].sd_handle == sd_handle &&
+            s_holds[i].sector == sector) {
+            return &s_holds[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+#if (SD_CACHE_JOURNAL == 1)
+#define SD_JOURNAL_MAGIC  0x4C4A4453UL /* "SDJL" */
+#define SD_JOURNAL_HEADER 16U          /* Bytes before the sector list */
+#define SD_JOURNAL_FNV    2166136261UL
+
+typedef struct {
+    SD_Handle_t *sd_handle; // NULL = free slot
+    uint32_t first;         // First block of the region (slot 0; slot 1 follows)
+    bool scanned;           // seq/count reflect the card
+    uint32_t seq;           // Newest complete record on the card
+    uint32_t count;         // Its sectors (0 = nothing a replay would change)
+    uint32_t sectors[SD_CACHE_LINES];
+} SD_CacheJournal;
+
+static SD_CacheJournal s_journals[SD_MAX_INSTANCES];
+static uint8_t s_journal_hdr[SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_journal_img[SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static SD_CacheJournal *SD_CacheJournalFind(const SD_Handle_t *sd_handle) {
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES; i++) {
+        if (s_journals[i].sd_handle != NULL && s_journals[i].sd_handle == sd_handle) {
+            return &s_journals[i];
+        }
+    }
+    return NULL;
+}
+
+static void SD_JournalPut32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t SD_JournalGet32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static uint32_t SD_JournalHash(uint32_t hash, const uint8_t *p, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+static uint32_t SD_JournalSlot(const SD_CacheJournal *j, uint32_t seq) {
+    return j->first + ((seq & 1U) * SD_CACHE_JOURNAL_SLOT);
+}
+
+/*
+ * Write record j->seq + 1 for n sectors; blocks[1..n] hold the images and
+ * blocks[0] is filled in with the header. n = 0 voids the previous record.
+ */
+static SD_Status SD_CacheJournalWrite(SD_CacheJournal *j, const uint32_t *sectors,
+                                      const uint8_t **blocks, uint32_t n) {
+    uint32_t seq = j->seq + 1U;
+    uint8_t *hdr = s_journal_hdr;
+    memset(hdr, 0, SD_BLOCK_SIZE);
+    SD_JournalPut32(&hdr[0], SD_JOURNAL_MAGIC);
+    SD_JournalPut32(&hdr[4], seq);
+    SD_JournalPut32(&hdr[8], n);
+    for (uint32_t i = 0; i < n; i++) {
+        SD_JournalPut32(&hdr[SD_JOURNAL_HEADER + (i * 4U)], sectors[i]);
+    }
+    uint32_t check = SD_JournalHash(SD_JOURNAL_FNV, hdr, SD_JOURNAL_HEADER + (n * 4U));
+    for (uint32_t i = 0; i < n; i++) {
+        check = SD_JournalHash(check, blocks[i + 1U], SD_BLOCK_SIZE);
+    }
+    SD_JournalPut32(&hdr[12], check);
+    blocks[0] = hdr;
+
+    SD_Status status = SD_WriteBlocksGather(j->sd_handle, blocks, SD_JournalSlot(j, seq), n + 1U);
+    if (status == SD_OK) {
+        j->seq = seq;
+        j->count = n;
+        memcpy(j->sectors, sectors, n * sizeof(sectors[0]));
+    }
+    return status;
+}
+
+/*
+ * Read the record in slot, leaving its header in s_journal_hdr. *valid is set
+ * when it is complete: magic, slot parity, count and check all match.
+ */
+static SD_Status SD_CacheJournalCheck(const SD_CacheJournal *j, uint32_t slot, bool *valid) {
+    uint32_t base = j->first + (slot * SD_CACHE_JOURNAL_SLOT);
+    *valid = false;
+    SD_Status status = SD_ReadBlocks(j->sd_handle, s_journal_hdr, base, 1);
+    if (status != SD_OK) {
+        return status;
+    }
+    const uint8_t *hdr = s_journal_hdr;
+    uint32_t seq = SD_JournalGet32(&hdr[4]);
+    uint32_t n = SD_JournalGet32(&hdr[8]);
+    if (SD_JournalGet32(&hdr[0]) != SD_JOURNAL_MAGIC || (seq & 1U) != slot ||
+        n > SD_CACHE_LINES) {
+        return SD_OK;
+    }
+    uint32_t want = SD_JournalGet32(&hdr[12]);
+    uint8_t head[SD_JOURNAL_HEADER + (SD_CACHE_LINES * 4U)];
+    memcpy(head, hdr, SD_JOURNAL_HEADER + (n * 4U));
+    SD_JournalPut32(&head[12], 0U);
+    uint32_t check = SD_JournalHash(SD_JOURNAL_FNV, head, SD_JOURNAL_HEADER + (n * 4U));
+    for (uint32_t i = 0; i < n && status == SD_OK; i++) {
+        status = SD_ReadBlocks(j->sd_handle, s_journal_img, base + 1U + i, 1);
+        check = SD_JournalHash(check, s_journal_img, SD_BLOCK_SIZE);
+    }
+    *valid = (status == SD_OK) && (check == want);
+    return status;
+}
+
+static SD_Status SD_CacheJournalScan(SD_CacheJournal *j, bool apply, uint32_t *replayed);
+
+/*
+ * Record the card's dirty lines outside the kept range ahead of writing them
+ * in place (no journal: nothing).
+ */
+static SD_Status SD_CacheJournalCommit(SD_Handle_t *sd_handle, uint32_t keep_first,
+                                       uint32_t keep_count) {
+    SD_CacheJournal *j = SD_CacheJournalFind(sd_handle);
+    if (j == NULL) {
+        return SD_OK;
+    }
+    if (!j->scanned) {
+        SD_Status status = SD_CacheJournalScan(j, false, NULL);
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+    const uint8_t *blocks[SD_CACHE_JOURNAL_SLOT];
+    uint32_t sectors[SD_CACHE_LINES];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if ((s_dirty & (1UL << i)) != 0U && s_lines[i].sd_handle == sd_handle &&
+            (s_lines[i].sector - keep_first) >= keep_count) {
+            sectors[n] = s_lines[i].sector;
+            blocks[n + 1U] = s_data[i];
+            n++;
+        }
+    }
+    if (n == 0U) {
+        return SD_OK;
+    }
+    SD_Status status = SD_CacheJournalWrite(j, sectors, blocks, n);
+    if (status == SD_OK) {
+        s_stats.journal_commits++;
+    }
+    return status;
+}
+
+/*
+ * Void the newest record once its sectors are all in place, so a replay never
+ * rolls back a later write that did not go through the cache (USB host,
+ * SD_PolicyDirect, another machine).
+ */
+static SD_Status SD_CacheJournalRetire(SD_CacheJournal *j) {
+    if (j == NULL || j->count == 0U) {
+        return SD_OK;
+    }
+    const uint8_t *blocks[1];
+    SD_Status status = SD_CacheJournalWrite(j, NULL, blocks, 0U);
+    if (status == SD_OK) {
+        s_stats.journal_retired++;
+    }
+    return status;
+}
+
+/* Void the newest record before a direct write lands on one of its sectors. */
+static SD_Status SD_CacheJournalGuard(SD_Handle_t *sd_handle, uint32_t sector, uint32_t count) {
+    SD_CacheJournal *j = SD_CacheJournalFind(sd_handle);
+    if (j == NULL || !j->scanned || j->count == 0U) {
+        return SD_OK; /* an unscanned card is scanned by the next commit, before any record */
+    }
+    for (uint32_t i = 0; i < j->count; i++) {
+        if ((j->sectors[i] - sector) < count) {
+            const uint8_t *blocks[1];
+            SD_Status status = SD_CacheJournalWrite(j, NULL, blocks, 0U);
+            if (status == SD_OK) {
+                s_stats.journal_drops++;
+            }
+            return status;
+        }
+    }
+    return SD_OK;
+}
+#else
+static SD_Status SD_CacheJournalCommit(SD_Handle_t *sd_handle, uint32_t keep_first,
+                                       uint32_t keep_count) {
+    (void)sd_handle;
+    (void)keep_first;
+    (void)keep_count;
+    return SD_OK;
+}
+
+static SD_Status SD_CacheJournalGuard(SD_Handle_t *sd_handle, uint32_t sector, uint32_t count) {
+    (void)sd_handle;
+    (void)sector;
+    (void)count;
+    return SD_OK;
+}
+#endif
+
+/* Retire the card's record after its write-back has landed (no journal: nothing). */
+static SD_Status SD_CacheJournalDone(SD_Handle_t *sd_handle) {
+#if (SD_CACHE_JOURNAL == 1)
+    return SD_CacheJournalRetire(SD_CacheJournalFind(sd_handle));
+#else
+    (void)sd_handle;
+    return SD_OK;
+#endif
+}
+
+static bool SD_CacheBit(uint32_t mask, uint32_t line) {
+    return (mask & (1UL << line)) != 0U;
+}
+
+/* Valid line of this card whose sector lies in [sector, sector + count). */
+static bool SD_CacheInRange(uint32_t line, const SD_Handle_t *sd_handle, uint32_t sector,
+                            uint32_t count) {
+    return SD_CacheBit(s_valid, line) && s_lines[line].sd_handle == sd_handle &&
+           (s_lines[line].sector - sector) < count;
+}
+
+static int SD_CacheFind(const SD_Handle_t *sd_handle, uint32_t sector) {
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if (SD_CacheInRange(i, sd_handle, sector, 1U)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int SD_CacheFindDirty(const SD_Handle_t *sd_handle, uint32_t sector) {
+    int line = SD_CacheFind(sd_handle, sector);
+    return (line >= 0 && SD_CacheBit(s_dirty, (uint32_t)line)) ? line : -1;
+}
+
+static void SD_CacheTouch(uint32_t line) {
+    SD_CACHE_ENTER();
+    s_lines[line].stamp = ++s_clock;
+    SD_CACHE_EXIT();
+}
+
+/* Mark fills of this card's sectors in [sector, sector + count) as stale. */
+static void SD_CacheStaleFills(const SD_Handle_t *sd_handle, uint32_t sector, uint32_t count) {
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if (SD_CacheBit(s_filling, i) && s_lines[i].sd_handle == sd_handle &&
+            (s_lines[i].sector - sector) < count) {
+            s_fill_stale |= (1UL << i);
+        }
+    }
+}
+
+static bool SD_CacheHeld(uint32_t line) {
+#if (SD_CACHE_HOLD_LINES > 0U)
+    return SD_CacheHoldFind(s_lines[line].sd_handle, s_lines[line].sector) != NULL;
+#else
+    (void)line;
+    return false;
+#endif
+}
+
+/* Lines of the class that are valid or being filled. */
+static uint32_t SD_CacheClassUsed(uint8_t cls) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if (SD_CacheBit(s_valid | s_filling, i) && s_lines[i].cls == cls) {
+            used++;
+        }
+    }
+    return used;
+}
+
+/*
+ * A line for a sector of class cls: a free line if there is one, otherwise the
+ * least recently used line not held. A class at its share of lines only
+ * replaces its own. SD_CACHE_LINES when every candidate is being filled or held.
+ */
+static uint32_t SD_CacheVictim(uint8_t cls) {
+    uint32_t victim = SD_CACHE_LINES;
+    bool skipped = false;
+    bool own = (cls != SD_CLASS_NONE) && SD_CacheClassUsed(cls) >= SD_CacheClassLines(cls);
+    for (uint32_t i = 0; i < s_active; i++) {
+        if (SD_CacheBit(s_filling, i)) {
+            continue;
+        }
+        if (!SD_CacheBit(s_valid, i)) {
+            if (!own) {
+                return i;
+            }
+            continue;
+        }
+        if (own && s_lines[i].cls != cls) {
+            continue;
+        }
+        if (SD_CacheHeld(i)) {
+            skipped = true;
+            continue;
+        }
+        if (victim == SD_CACHE_LINES || s_lines[i].stamp < s_lines[victim].stamp) {
+            victim = i;
+        }
+    }
+    /* Fewer hold slots than lines: only concurrent fills can leave no victim. */
+    if (skipped) {
+        s_stats.hold_saves++;
+    }
+    return victim;
+}
+
+/* Dirty line of sector that a write-back keeping [keep_first, +keep_count) may take. */
+static int SD_CacheFindFlushable(const SD_Handle_t *sd_handle, uint32_t sector,
+                                 uint32_t keep_first, uint32_t keep_count) {
+    return ((sector - keep_first) < keep_count) ? -1 : SD_CacheFindDirty(sd_handle, sector);
+}
+
+/* Write back the run of consecutive dirty sectors holding this line, short of the kept range. */
+static SD_Status SD_CacheFlushRun(uint32_t line, uint32_t keep_first, uint32_t keep_count) {
+    SD_Handle_t *sd_handle = s_lines[line].sd_handle;
+    uint32_t first = s_lines[line].sector;
+    while (first > 0U &&
+           SD_CacheFindFlushable(sd_handle, first - 1U, keep_first, keep_count) >= 0) {
+        first--;
+    }
+
+    const uint8_t *blocks[SD_CACHE_LINES];
+    uint32_t run_lines[SD_CACHE_LINES];
+    uint32_t count = 0;
+    for (int l = SD_CacheFindFlushable(sd_handle, first, keep_first, keep_count);
+         l >= 0 && count < SD_CACHE_LINES;
+         l = SD_CacheFindFlushable(sd_handle, first + count, keep_first, keep_count)) {
+        blocks[count] = s_data[l];
+        run_lines[count] = (uint32_t)l;
+        count++;
+    }
+
+    SD_Status status = SD_WriteBlocksGather(sd_handle, blocks, first, count);
+    if (status == SD_OK) {
+        s_stats.writebacks += count;
+        s_stats.writeback_runs++;
+        if (count > 1U) {
+            s_stats.coalesced += count;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            s_dirty &= ~(1UL << run_lines[i]);
+        }
+    }
+    return status;
+}
+
+/*
+ * Write back every dirty line of the card outside [keep_first, +keep_count)
+ * (keep_count 0 = all), journal record first and voided once all of them land.
+ */
+static SD_Status SD_CacheWriteBack(SD_Handle_t *sd_handle, uint32_t keep_first,
+                                   uint32_t keep_count) {
+    SD_Status status = SD_CacheJournalCommit(sd_handle, keep_first, keep_count);
+    for (uint32_t i = 0; i < SD_CACHE_LINES && status == SD_OK; i++) {
+        if (SD_CacheBit(s_dirty, i) && s_lines[i].sd_handle == sd_handle &&
+            (s_lines[i].sector - keep_first) >= keep_count) {
+            status = SD_CacheFlushRun(i, keep_first, keep_count);
+        }
+    }
+    return (status == SD_OK) ? SD_CacheJournalDone(sd_handle) : status;
+}
+
+/* Write back the line if it is dirty, so it can be reused. */
+static SD_Status SD_CacheClean(uint32_t line) {
+    if (!SD_CacheBit(s_dirty, line)) {
+        return SD_OK;
+    }
+#if (SD_CACHE_JOURNAL == 1)
+    /* A journaled card writes back all or none of its lines: never half a record. */
+    SD_Handle_t *owner = s_lines[line].sd_handle;
+    return SD_CacheJournalFind(owner) != NULL ? SD_CacheWriteBack(owner, 0, 0)
+                                              : SD_CacheFlushRun(line, 0, 0);
+#else
+    return SD_CacheFlushRun(line, 0, 0);
+#endif
+}
+
+/*
+ * Claim a line for sector, writing back its previous contents if dirty.
+ * *line is SD_CACHE_LINES when no line can be claimed.
+ */
+static SD_Status SD_CacheAllocate(SD_Handle_t *sd_handle, uint32_t sector, uint32_t *line) {
+    uint8_t cls = SD_CacheClassOf(sd_handle, sector);
+    uint32_t victim = SD_CacheVictim(cls);
+    *line = victim;
+    if (victim == SD_CACHE_LINES) {
+        return SD_OK;
+    }
+    SD_Status status = SD_CacheClean(victim);
+    if (status != SD_OK) {
+        return status;
+    }
+    if (SD_CacheBit(s_valid, victim)) {
+        s_stats.evictions++;
+    }
+    s_valid &= ~(1UL << victim);
+    s_lines[victim].sd_handle = sd_handle;
+    s_lines[victim].sector = sector;
+    s_lines[victim].cls = cls;
+    *line = victim;
+    return SD_OK;
+}
+
+void SD_CacheReset(void) {
+    if (!SD_CacheLockExclusive()) {
+        return;
+    }
+    s_valid = 0;
+    s_dirty = 0;
+    s_fill_stale = s_filling;
+    s_clock = 0;
+    memset(&s_stats, 0, sizeof(s_stats));
+#if (SD_CACHE_HOLD_LINES > 0U)
+    memset(s_holds, 0, sizeof(s_holds));
+#endif
+#if (SD_CACHE_CLASSES == 1)
+    memset(s_regions, 0, sizeof(s_regions)); /* registered again after the next mount */
+#endif
+#if (SD_CACHE_JOURNAL == 1)
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES; i++) {
+        s_journals[i].scanned = false; /* the card may have changed */
+    }
+#endif
+    SD_CacheUnlockExclusive();
+}
+
+#if (SD_CACHE_BUSY_READS == 1)
+/* The card is programming a write-back: a shared one in flight, or a split busy left over. */
+static bool SD_CacheCardBusy(const SD_Handle_t *sd_handle) {
+#if (SD_SPLIT_BUSY == 1)
+    if (sd_handle->busy_pending) {
+        return true;
+    }
+#endif
+    return s_writeback_card == sd_handle;
+}
+#endif
+
+/* Serve a single-sector read from a valid line; the caller holds the pool lock. */
+static bool SD_CacheReadHit(const SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector) {
+    int hit = SD_CacheFind(sd_handle, sector);
+    if (hit < 0) {
+        return false;
+    }
+    memcpy(buff, s_data[hit], SD_BLOCK_SIZE);
+    SD_CACHE_ENTER();
+    if (SD_CacheLru((uint32_t)hit)) {
+        s_lines[hit].stamp = ++s_clock;
+    }
+    s_stats.read_hits++;
+#if (SD_CACHE_BUSY_READS == 1)
+    if (SD_CacheCardBusy(sd_handle)) {
+        s_stats.busy_hits++;
+    }
+#endif
+    SD_CACHE_EXIT();
+    return true;
+}
+
+/* Single-sector miss: claim a line, read the card unlocked, then install it. */
+static SD_Status SD_CacheReadMiss(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector) {
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    /* Another task may have filled it between the two locks. */
+    if (SD_CacheReadHit(sd_handle, buff, sector)) {
+        SD_CacheUnlockExclusive();
+        return SD_OK;
+    }
+    s_stats.read_misses++;
+
+    uint32_t line = 0;
+    SD_Status status = SD_CacheAllocate(sd_handle, sector, &line);
+    if (status != SD_OK || line == SD_CACHE_LINES) {
+        SD_CacheUnlockExclusive();
+        return (status != SD_OK) ? status : SD_ReadBlocks(sd_handle, buff, sector, 1);
+    }
+    uint32_t bit = 1UL << line;
+    s_filling |= bit;
+    SD_CacheUnlockExclusive();
+
+    status = SD_ReadBlocks(sd_handle, s_data[line], sector, 1);
+
+    (void)SD_CacheLockExclusive(); /* created above, so it cannot fail now */
+    bool stale = SD_CacheBit(s_fill_stale, line);
+    s_filling &= ~bit;
+    s_fill_stale &= ~bit;
+    if (status == SD_OK) {
+        /* A copy written or filled meanwhile is newer than this read. */
+        int newer = SD_CacheFind(sd_handle, sector);
+        memcpy(buff, s_data[(newer >= 0) ? (uint32_t)newer : line], SD_BLOCK_SIZE);
+        if (!stale && newer < 0) {
+            s_valid |= bit;
+            SD_CacheTouch(line);
+        }
+    }
+    SD_CacheUnlockExclusive();
+    return status;
+}
+
+SD_Status SD_CacheRead(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count) {
+    if (!sd_handle || !buff || count == 0) {
+        return SD_PARAM;
+    }
+
+    if (!SD_CacheLockShared()) {
+        return SD_ERROR;
+    }
+    if (count == 1U) {
+        bool hit = SD_CacheReadHit(sd_handle, buff, sector);
+        if (!hit && SD_CacheBypass(sd_handle, sector)) {
+            SD_Status status = SD_ReadBlocks(sd_handle, buff, sector, 1);
+            SD_CacheUnlockShared();
+            return status;
+        }
+        SD_CacheUnlockShared();
+        return hit ? SD_OK : SD_CacheReadMiss(sd_handle, buff, sector);
+    }
+
+    /* Shared across the card read, so no dirty copy is written back and evicted meanwhile. */
+    SD_Status status = SD_ReadBlocks(sd_handle, buff, sector, count);
+    if (status == SD_OK) {
+        /* Cached copies are at least as new as the card (newer when dirty). */
+        for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+            if (SD_CacheInRange(i, sd_handle, sector, count)) {
+                memcpy(buff + ((s_lines[i].sector - sector) * SD_BLOCK_SIZE), s_data[i],
+                       SD_BLOCK_SIZE);
+            }
+        }
+    }
+    SD_CacheUnlockShared();
+    return status;
+}
+
+SD_Status SD_CacheWrite(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
+                        uint32_t count) {
+    if (!sd_handle || !buff || count == 0) {
+        return SD_PARAM;
+    }
+
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    SD_CacheStaleFills(sd_handle, sector, count);
+    if (count == 1U) {
+        int hit = SD_CacheFind(sd_handle, sector);
+        uint32_t line = (uint32_t)hit;
+        SD_Status status = SD_OK;
+        if (hit >= 0) {
+            s_stats.write_hits++;
+        } else if (SD_CacheBypass(sd_handle, sector)) {
+            line = SD_CACHE_LINES;
+        } else {
+            status = SD_CacheAllocate(sd_handle, sector, &line);
+        }
+        if (status == SD_OK && line == SD_CACHE_LINES) {
+            /* Uncached class, or every candidate line is being filled: write through. */
+            status = SD_CacheJournalGuard(sd_handle, sector, 1);
+            if (status == SD_OK) {
+                status = SD_WriteBlocks(sd_handle, buff, sector, 1);
+            }
+        } else if (status == SD_OK) {
+            memcpy(s_data[line], buff, SD_BLOCK_SIZE);
+            s_valid |= (1UL << line);
+            s_dirty |= (1UL << line);
+            if (hit < 0 || SD_CacheLru(line)) {
+                SD_CacheTouch(line);
+            }
+        }
+        SD_CacheUnlockExclusive();
+        return status;
+    }
+
+    SD_Status status = SD_CacheJournalGuard(sd_handle, sector, count);
+    if (status != SD_OK) {
+        SD_CacheUnlockExclusive();
+        return status;
+    }
+    /* The first overlapping line is refreshed while the card takes the blocks. */
+    uint32_t first = SD_CACHE_LINES;
+    bool copying = false;
+    for (uint32_t i = 0; i < SD_CACHE_LINES && first == SD_CACHE_LINES; i++) {
+        if (SD_CacheInRange(i, sd_handle, sector, count)) {
+            first = i;
+            copying = sd_mem_copy_start(
+                s_data[i], buff + ((s_lines[i].sector - sector) * SD_BLOCK_SIZE), SD_BLOCK_SIZE);
+        }
+    }
+    status = SD_WriteBlocks(sd_handle, buff, sector, count);
+    if (copying) {
+        sd_mem_copy_wait();
+    }
+    /* Keep overlapping lines coherent; on failure they stay dirty so a flush retries. */
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if (SD_CacheInRange(i, sd_handle, sector, count)) {
+            if (i != first) {
+                memcpy(s_data[i], buff + ((s_lines[i].sector - sector) * SD_BLOCK_SIZE),
+                       SD_BLOCK_SIZE);
+            }
+            if (status == SD_OK) {
+                s_dirty &= ~(1UL << i);
+            } else {
+                s_dirty |= (1UL << i);
+            }
+        }
+    }
+    SD_CacheUnlockExclusive();
+    return status;
+}
+
+SD_Status SD_CacheFlush(SD_Handle_t *sd_handle) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    return SD_CacheFlushExcept(sd_handle, 0, 0);
+}
+
+SD_Status SD_CacheFlushExcept(SD_Handle_t *sd_handle, uint32_t keep_first, uint32_t keep_count) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+#if (SD_CACHE_BUSY_READS == 1)
+    /*
+     * Shared from here on: hits go on, and misses and writes, which need the
+     * lock exclusive, wait for the write-back. A second flush is one of them,
+     * so only dirty bits and write-back counters change under this lock.
+     */
+    s_writeback_card = sd_handle;
+    SD_CacheLockDowngrade();
+    SD_Status status = SD_CacheWriteBack(sd_handle, keep_first, keep_count);
+    s_writeback_card = NULL;
+    SD_CacheUnlockShared();
+#else
+    SD_Status status = SD_CacheWriteBack(sd_handle, keep_first, keep_count);
+    SD_CacheUnlockExclusive();
+#endif
+    return status;
+}
+
+void SD_CacheDiscard(SD_Handle_t *sd_handle, uint32_t sector, uint32_t count) {
+    if (!SD_CacheLockExclusive()) {
+        return;
+    }
+    SD_CacheStaleFills(sd_handle, sector, count);
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if (SD_CacheInRange(i, sd_handle, sector, count)) {
+            s_valid &= ~(1UL << i);
+            s_dirty &= ~(1UL << i);
+        }
+    }
+    SD_CacheUnlockExclusive();
+}
+
+void SD_CacheFill(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count) {
+    if (!sd_handle || !buff || !SD_CacheLockExclusive()) {
+        return;
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        if (SD_CacheFind(sd_handle, sector + n) >= 0) {
+            continue; /* a cached copy may be newer than the caller's read */
+        }
+        uint8_t cls = SD_CacheClassOf(sd_handle, sector + n);
+        uint32_t line = (SD_CacheClassLines(cls) != 0U) ? SD_CacheVictim(cls) : SD_CACHE_LINES;
+        if (line == SD_CACHE_LINES || SD_CacheBit(s_dirty, line)) {
+            continue; /* warm-up never costs a write-back */
+        }
+        if (SD_CacheBit(s_valid, line)) {
+            s_stats.evictions++;
+        }
+        s_lines[line].sd_handle = sd_handle;
+        s_lines[line].sector = sector + n;
+        s_lines[line].cls = cls;
+        memcpy(s_data[line], buff + (n * SD_BLOCK_SIZE), SD_BLOCK_SIZE);
+        s_valid |= (1UL << line);
+        SD_CacheTouch(line);
+        s_stats.filled++;
+    }
+    SD_CacheUnlockExclusive();
+}
+
+bool SD_CacheHold(SD_Handle_t *sd_handle, uint32_t sector) {
+#if (SD_CACHE_HOLD_LINES > 0U)
+    if (!sd_handle || !SD_CacheLockExclusive()) {
+        return false;
+    }
+    SD_CacheHoldSlot *slot = SD_CacheHoldFind(sd_handle, sector);
+    for (uint32_t i = 0; i < SD_CACHE_HOLD_LINES && slot == NULL; i++) {
+        if (s_holds[i].refs == 0U) {
+            slot = &s_holds[i];
+            slot->sd_handle = sd_handle;
+            slot->sector = sector;
+            s_stats.held++;
+        }
+    }
+    if (slot != NULL) {
+        slot->refs++;
+    } else {
+        s_stats.hold_refused++;
+    }
+    SD_CacheUnlockExclusive();
+    return slot != NULL;
+#else
+    (void)sd_handle;
+    (void)sector;
+    s_stats.hold_refused++;
+    return false;
+#endif
+}
+
+void SD_CacheRelease(SD_Handle_t *sd_handle, uint32_t sector) {
+#if (SD_CACHE_HOLD_LINES > 0U)
+    if (!SD_CacheLockExclusive()) {
+        return;
+    }
+    SD_CacheHoldSlot *slot = SD_CacheHoldFind(sd_handle, sector);
+    if (slot != NULL && --slot->refs == 0U) {
+        s_stats.held--;
+    }
+    SD_CacheUnlockExclusive();
+#else
+    (void)sd_handle;
+    (void)sector;
+#endif
+}
+
+SD_Status SD_CacheSetLines(uint32_t lines) {
+    if (lines > SD_CACHE_LINES) {
+        return SD_PARAM;
+    }
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    SD_Status status = SD_OK;
+    for (uint32_t i = lines; i < SD_CACHE_LINES && status == SD_OK; i++) {
+        status = SD_CacheClean(i);
+    }
+    if (status == SD_OK) {
+        uint32_t keep = (lines == 32U) ? 0xFFFFFFFFUL : ((1UL << lines) - 1U);
+        s_fill_stale |= s_filling & ~keep;
+        s_valid &= keep;
+        s_active = lines;
+    }
+    SD_CacheUnlockExclusive();
+    return status;
+}
+
+uint32_t SD_CacheGetLines(void) {
+    return s_active;
+}
+
+SD_Status SD_CacheSetClassLines(uint32_t fat_lines, uint32_t dir_lines, uint32_t data_lines) {
+#if (SD_CACHE_CLASSES == 1)
+    if ((uint64_t)fat_lines + dir_lines + data_lines > SD_CACHE_LINES ||
+        (SD_CACHE_HOLD_LINES > 0U && data_lines <= SD_CACHE_HOLD_LINES)) {
+        return SD_PARAM;
+    }
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    /* Lines a class holds above its new quota are the first it replaces. */
+    s_class_lines[SD_CLASS_FAT] = fat_lines;
+    s_class_lines[SD_CLASS_DIR] = dir_lines;
+    s_class_lines[SD_CLASS_DATA] = data_lines;
+    SD_CacheUnlockExclusive();
+    return SD_OK;
+#else
+    (void)fat_lines;
+    (void)dir_lines;
+    (void)data_lines;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+void SD_CacheGetClassLines(uint32_t *fat_lines, uint32_t *dir_lines, uint32_t *data_lines) {
+#if (SD_CACHE_CLASSES == 1)
+    const uint32_t *lines = s_class_lines;
+#else
+    static const uint32_t lines[3] = {0};
+#endif
+    if (fat_lines) *fat_lines = lines[SD_CLASS_FAT];
+    if (dir_lines) *dir_lines = lines[SD_CLASS_DIR];
+    if (data_lines) *data_lines = lines[SD_CLASS_DATA];
+}
+
+void SD_CacheResetStats(void) {
+    if (SD_CacheLockExclusive()) {
+        uint32_t held = s_stats.held;
+        memset(&s_stats, 0, sizeof(s_stats));
+        s_stats.held = held; /* a gauge, not a counter */
+        SD_CacheUnlockExclusive();
+    }
+}
+
+void SD_CacheSetRegions(SD_Handle_t *sd_handle, uint32_t fat_first, uint32_t dir_first,
+                        uint32_t data_first) {
+#if (SD_CACHE_CLASSES == 1)
+    if (!sd_handle || !SD_CacheLockExclusive()) {
+        return;
+    }
+    SD_CacheRegions *r = SD_CacheRegionsFind(sd_handle);
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES && r == NULL && data_first != 0U; i++) {
+        if (s_regions[i].sd_handle == NULL) {
+            r = &s_regions[i];
+        }
+    }
+    if (r != NULL) {
+        memset(r, 0, sizeof(*r));
+        if (data_first != 0U) {
+            r->sd_handle = sd_handle;
+            r->fat_first = fat_first;
+            r->dir_first = dir_first;
+            r->data_first = data_first;
+        }
+    }
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        if (SD_CacheBit(s_valid | s_filling, i) && s_lines[i].sd_handle == sd_handle) {
+            s_lines[i].cls = SD_CacheClassOf(sd_handle, s_lines[i].sector);
+        }
+    }
+    SD_CacheUnlockExclusive();
+#else
+    (void)sd_handle;
+    (void)fat_first;
+    (void)dir_first;
+    (void)data_first;
+#endif
+}
+
+#if (SD_CACHE_JOURNAL == 1)
+static SD_Status SD_CacheJournalScan(SD_CacheJournal *j, bool apply, uint32_t *replayed) {
+    uint32_t seq[2] = {0, 0};
+    uint32_t count[2] = {0, 0};
+    uint32_t sectors[2][SD_CACHE_LINES];
+    bool valid[2];
+    for (uint32_t slot = 0; slot < 2U; slot++) {
+        SD_Status status = SD_CacheJournalCheck(j, slot, &valid[slot]);
+        if (status != SD_OK) {
+            return status;
+        }
+        if (valid[slot]) {
+            seq[slot] = SD_JournalGet32(&s_journal_hdr[4]);
+            count[slot] = SD_JournalGet32(&s_journal_hdr[8]);
+            for (uint32_t i = 0; i < count[slot]; i++) {
+                sectors[slot][i] = SD_JournalGet32(&s_journal_hdr[SD_JOURNAL_HEADER + (i * 4U)]);
+            }
+        }
+    }
+
+    /* The newer complete record; a torn one leaves the record before it in charge. */
+    int best = -1;
+    if (valid[0] && valid[1]) {
+        best = ((int32_t)(seq[1] - seq[0]) > 0) ? 1 : 0;
+    } else if (valid[0] || valid[1]) {
+        best = valid[0] ? 0 : 1;
+    }
+    j->seq = 0;
+    j->count = 0;
+    if (best >= 0) {
+        j->seq = seq[best];
+        j->count = count[best];
+        memcpy(j->sectors, sectors[best], count[best] * sizeof(sectors[0][0]));
+    }
+    j->scanned = true;
+
+    uint32_t base = SD_JournalSlot(j, j->seq) + 1U;
+    for (uint32_t i = 0; apply && i < j->count; i++) {
+        uint32_t target = j->sectors[i];
+        SD_Status status = SD_ReadBlocks(j->sd_handle, s_journal_img, base + i, 1);
+        if (status == SD_OK) {
+            status = SD_ReadBlocks(j->sd_handle, s_journal_hdr, target, 1);
+        }
+        if (status == SD_OK && memcmp(s_journal_img, s_journal_hdr, SD_BLOCK_SIZE) != 0) {
+            SD_CacheStaleFills(j->sd_handle, target, 1);
+            int line = SD_CacheFind(j->sd_handle, target);
+            if (line >= 0) {
+                s_valid &= ~(1UL << (uint32_t)line);
+                s_dirty &= ~(1UL << (uint32_t)line);
+            }
+            status = SD_WriteBlocks(j->sd_handle, s_journal_img, target, 1);
+            if (status == SD_OK) {
+                s_stats.journal_replayed++;
+                if (replayed) {
+                    (*replayed)++;
+                }
+            }
+        }
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+    /* Applied: the sectors are in place and later direct writes must stand. */
+    return apply ? SD_CacheJournalRetire(j) : SD_OK;
+}
+
+SD_Status SD_CacheJournalVoid(SD_Handle_t *sd_handle) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    SD_CacheJournal *j = SD_CacheJournalFind(sd_handle);
+    SD_Status status = SD_OK;
+    if (j != NULL) {
+        /* The card, not the last record written, decides: a retire may have been lost. */
+        status = SD_CacheJournalScan(j, false, NULL);
+        if (status == SD_OK) {
+            status = SD_CacheJournalRetire(j);
+        }
+    }
+    SD_CacheUnlockExclusive();
+    return status;
+}
+
+SD_Status SD_CacheJournalAttach(SD_Handle_t *sd_handle, uint32_t first_block) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    SD_CacheJournal *j = SD_CacheJournalFind(sd_handle);
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES && j == NULL && first_block != 0U; i++) {
+        if (s_journals[i].sd_handle == NULL) {
+            j = &s_journals[i];
+        }
+    }
+    SD_Status status = SD_OK;
+    if (j != NULL) {
+        memset(j, 0, sizeof(*j));
+        if (first_block != 0U) {
+            j->sd_handle = sd_handle;
+            j->first = first_block;
+        }
+    } else if (first_block != 0U) {
+        status = SD_ERROR;
+    }
+    SD_CacheUnlockExclusive();
+    return status;
+}
+
+SD_Status SD_CacheJournalReplay(SD_Handle_t *sd_handle, uint32_t *replayed) {
+    if (replayed) {
+        *replayed = 0;
+    }
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!SD_CacheLockExclusive()) {
+        return SD_ERROR;
+    }
+    SD_CacheJournal *j = SD_CacheJournalFind(sd_handle);
+    SD_Status status = (j != NULL) ? SD_CacheJournalScan(j, true, replayed) : SD_OK;
+    SD_CacheUnlockExclusive();
+    return status;
+}
+#endif
+
+void SD_CacheGetStats(SD_CacheStats *out) {
+    if (out && SD_CacheLockShared()) {
+        SD_CACHE_ENTER();
+        *out = s_stats;
+        SD_CACHE_EXIT();
+        out->lines = s_active;
+        out->run_len_x10 = (out->writeback_runs > 0U)
+                               ? (out->writebacks * 10U) / out->writeback_runs
+                               : 0U;
+        uint32_t *per_class[3] = {&out->fat_lines, &out->dir_lines, &out->data_lines};
+        for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+            if (SD_CacheBit(s_valid, i) && s_lines[i].cls < SD_CLASS_NONE) {
+                (*per_class[s_lines[i].cls])++;
+            }
+        }
+        SD_CacheUnlockShared();
+    }
+}
+
+uint32_t SD_CacheDirtyCount(void) {
+    uint32_t count = 0;
+    if (!SD_CacheLockShared()) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < SD_CACHE_LINES; i++) {
+        count += SD_CacheBit(s_dirty, i) ? 1U : 0U;
+    }
+    SD_CacheUnlockShared();
+    return count;
+}
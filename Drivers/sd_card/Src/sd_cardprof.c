@@ -0,0 +1,415 @@
+/*
+ * sd_cardprof.c
+ *
+ * AU walk, write-size and run-length sweeps, and the per-card profile file:
+ * "SDPROF,1,mid,psn,blocks,au_blocks,au_entry_us,write_blocks,pre_erase,
+ * small_write_us,peak_kb_per_s", one line per card.
+ */
+
+#include "sd_cardprof.h"
+#include "ff.h"
+#include "main.h"
+#include "sd_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SD_CARDPROF_VERSION 1U
+#define SD_CARDPROF_LINE    112U
+#define SD_CARDPROF_FIELDS  10U
+
+static uint8_t s_probe[SD_CARDPROF_PROBE_BLOCKS * SD_BLOCK_SIZE]
+    __attribute__((aligned((SD_DMA_ALIGNMENT < 16U) ? 16U : SD_DMA_ALIGNMENT)));
+static char s_text[SD_CARDPROF_MAX_CARDS * SD_CARDPROF_LINE];
+static SD_CardProfile s_active;
+static bool s_active_set;
+
+static uint32_t sd_cardprof_us(uint64_t cycles) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    return (uint32_t)(cycles / (per_us ? per_us : 1U));
+}
+
+static uint32_t sd_cardprof_kbps(uint64_t bytes, uint64_t cycles) {
+    return cycles ? (uint32_t)((bytes * SystemCoreClock) / (1024U * cycles)) : 0U;
+}
+
+static void sd_cardprof_identify(SD_Handle_t *sd_handle, SD_CardProfile *prof) {
+    prof->mid = 0U;
+    prof->psn = 0U;
+    prof->blocks = SD_GetBlockCount(sd_handle);
+#if (SD_CARD_INFO == 1)
+    SD_CardInfo ci;
+    if (SD_GetCardInfo(sd_handle, &ci) == SD_OK && ci.cid_valid) {
+        prof->mid = ci.manufacturer_id;
+        prof->psn = ci.serial;
+    }
+#endif
+}
+
+static bool sd_cardprof_same(const SD_CardProfile *a, const SD_CardProfile *b) {
+    return a->mid == b->mid && a->psn == b->psn && a->blocks == b->blocks;
+}
+
+/* Walk the AUs; every probe write is timed to the end of its busy. */
+static SD_Status sd_cardprof_walk(SD_Handle_t *sd_handle, uint32_t first_au_lba,
+                                  SD_CardProfile *out) {
+    uint64_t sum[SD_CARDPROF_AU_POINTS] = {0};
+    uint32_t calls[SD_CARDPROF_AU_POINTS] = {0};
+    uint64_t first_sum = 0;
+    uint64_t rest_sum = 0;
+    uint32_t rest_calls = 0;
+    SD_Status status = SD_OK;
+
+    memset(s_probe, 0xA5, sizeof(s_probe));
+    for (uint32_t round = 0; round < SD_CARDPROF_AU_ROUNDS && status == SD_OK; round++) {
+        uint32_t base = first_au_lba + round * out->au_blocks;
+        for (uint32_t off = 0; off < out->au_blocks && status == SD_OK;
+             off += SD_CARDPROF_PROBE_BLOCKS) {
+            uint32_t count = out->au_blocks - off;
+            if (count > SD_CARDPROF_PROBE_BLOCKS) {
+                count = SD_CARDPROF_PROBE_BLOCKS;
+            }
+            uint32_t start = DWT->CYCCNT;
+            status = SD_WriteBlocks(sd_handle, s_probe, base + off, count);
+            if (status == SD_OK) {
+                status = SD_Sync(sd_handle);
+            }
+            uint32_t cycles = DWT->CYCCNT - start;
+            uint32_t us = sd_cardprof_us(cycles);
+            uint32_t bin = (uint32_t)(((uint64_t)off * SD_CARDPROF_AU_POINTS) / out->au_blocks);
+            sum[bin] += us;
+            calls[bin]++;
+            if (us > out->au_max_us[bin]) {
+                out->au_max_us[bin] = us;
+            }
+            if (off == 0U) {
+                first_sum += us;
+            } else {
+                rest_sum += us;
+                rest_calls++;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < SD_CARDPROF_AU_POINTS; i++) {
+        out->au_mean_us[i] = calls[i] ? (uint32_t)(sum[i] / calls[i]) : 0U;
+    }
+    uint32_t first_mean = (uint32_t)(first_sum / SD_CARDPROF_AU_ROUNDS);
+    uint32_t rest_mean = rest_calls ? (uint32_t)(rest_sum / rest_calls) : first_mean;
+    out->au_entry_us = (first_mean > rest_mean) ? first_mean - rest_mean : 0U;
+    return status;
+}
+
+/* Random writes of 1 << i blocks, and sequential runs with and without ACMD23. */
+static SD_Status sd_cardprof_sweep(SD_Handle_t *sd_handle, uint32_t first_lba,
+                                   uint32_t span_blocks, SD_CardProfile *out) {
+    SD_BenchRawConfig cfg;
+    SD_BenchResult r;
+    const bool saved_acmd23 = sd_handle->acmd23_ok;
+    SD_Status status = SD_OK;
+
+    cfg.first_lba = first_lba;
+    cfg.span_blocks = span_blocks;
+    for (uint32_t i = 0; i < SD_CARDPROF_SIZES && status == SD_OK; i++) {
+        cfg.blocks_per_cmd = 1U << i;
+        cfg.op = SD_BENCH_RAW_WRITE;
+        cfg.random = true;
+        cfg.total_blocks = cfg.blocks_per_cmd * SD_CARDPROF_SIZE_WRITES;
+        status = sd_benchmark_raw(sd_handle, &cfg, &r);
+        if (status != SD_OK) {
+            break;
+        }
+        out->size_mean_us[i] = sd_cardprof_us(r.total_cycles / r.calls);
+        out->size_max_us[i] = sd_cardprof_us(r.max_cycles);
+
+        cfg.op = SD_BENCH_RAW_WRITE_MULTI;
+        cfg.random = false;
+        cfg.total_blocks = (SD_CARDPROF_RUN_BLOCKS < span_blocks) ? SD_CARDPROF_RUN_BLOCKS
+                                                                  : span_blocks;
+        for (uint32_t pre = 0; pre < 2U && status == SD_OK; pre++) {
+            if (pre == 1U && !saved_acmd23) {
+                break; /* refused at init: nothing to compare */
+            }
+            sd_handle->acmd23_ok = (pre == 1U);
+            status = sd_benchmark_raw(sd_handle, &cfg, &r);
+            uint32_t kbps = sd_cardprof_kbps((uint64_t)cfg.total_blocks * SD_BLOCK_SIZE,
+                                             r.total_cycles);
+            if (pre == 1U) {
+                /* The card may turn hints away on first use; then they cost nothing. */
+                out->run_pre_kb_per_s[i] = sd_handle->acmd23_ok ? kbps : 0U;
+            } else {
+                out->run_kb_per_s[i] = kbps;
+            }
+        }
+    }
+    sd_handle->acmd23_ok = saved_acmd23;
+    return status;
+}
+
+/* Pre-erase verdict at the longest run, then the knee of the curve in use. */
+static void sd_cardprof_derive(SD_CardProfile *out) {
+    const uint32_t last = SD_CARDPROF_SIZES - 1U;
+    out->pre_erase = (out->run_pre_kb_per_s[last] != 0U) &&
+                     ((uint64_t)out->run_pre_kb_per_s[last] * 100U >=
+                      (uint64_t)out->run_kb_per_s[last] * 105U);
+    const uint32_t *curve = out->pre_erase ? out->run_pre_kb_per_s : out->run_kb_per_s;
+    out->peak_kb_per_s = 0U;
+    for (uint32_t i = 0; i < SD_CARDPROF_SIZES; i++) {
+        if (curve[i] > out->peak_kb_per_s) {
+            out->peak_kb_per_s = curve[i];
+        }
+    }
+    out->write_blocks = 1U << last;
+    for (uint32_t i = 0; i < SD_CARDPROF_SIZES; i++) {
+        if ((uint64_t)curve[i] * 100U >= (uint64_t)out->peak_kb_per_s * SD_CARDPROF_KNEE_PERCENT) {
+            out->write_blocks = 1U << i;
+            break;
+        }
+    }
+    out->small_write_us = out->size_mean_us[0];
+}
+
+SD_Status sd_cardprof_measure(SD_Handle_t *sd_handle, uint32_t first_lba, uint32_t span_blocks,
+                              SD_CardProfile *out) {
+    if (!sd_handle || !out) {
+        return SD_PARAM;
+    }
+    memset(out, 0, sizeof(*out));
+    sd_cardprof_identify(sd_handle, out);
+    out->au_blocks = SD_CARDPROF_AU_BLOCKS;
+#if (SD_CARD_INFO == 1)
+    SD_CardInfo ci;
+    if (SD_GetCardInfo(sd_handle, &ci) == SD_OK && ci.status_valid && ci.au_blocks != 0U) {
+        out->au_blocks = ci.au_blocks;
+    }
+#endif
+    uint32_t first_au = ((first_lba + out->au_blocks - 1U) / out->au_blocks) * out->au_blocks;
+    if (span_blocks < (1U << (SD_CARDPROF_SIZES - 1U)) ||
+        (uint64_t)first_au + (uint64_t)SD_CARDPROF_AU_ROUNDS * out->au_blocks >
+            (uint64_t)first_lba + span_blocks) {
+        return SD_PARAM;
+    }
+
+    sd_benchmark_cycles_init();
+    SD_Status status = sd_cardprof_walk(sd_handle, first_au, out);
+    if (status == SD_OK) {
+        status = sd_cardprof_sweep(sd_handle, first_lba, span_blocks, out);
+    }
+    if (status == SD_OK) {
+        sd_cardprof_derive(out);
+    }
+    return status;
+}
+
+/* Parse one line; false unless it is a well-formed current-version line. */
+static bool sd_cardprof_parse(const char *line, SD_CardProfile *out) {
+    uint32_t v[SD_CARDPROF_FIELDS];
+    if (strncmp(line, "SDPROF,", 7) != 0) {
+        return false;
+    }
+    const char *p = line + 7;
+    for (uint32_t i = 0; i < SD_CARDPROF_FIELDS; i++) {
+        char *end;
+        v[i] = (uint32_t)strtoul(p, &end, 0);
+        if (end == p || (i + 1U < SD_CARDPROF_FIELDS && *end != ',')) {
+            return false;
+        }
+        p = end + 1;
+    }
+    if (v[0] != SD_CARDPROF_VERSION || v[4] == 0U || v[6] == 0U ||
+        v[6] > (1U << (SD_CARDPROF_SIZES - 1U))) {
+        return false;
+    }
+    memset(out, 0, sizeof(*out));
+    out->mid = (uint8_t)v[1];
+    out->psn = v[2];
+    out->blocks = v[3];
+    out->au_blocks = v[4];
+    out->au_entry_us = v[5];
+    out->write_blocks = v[6];
+    out->pre_erase = (v[7] != 0U);
+    out->small_write_us = v[8];
+    out->peak_kb_per_s = v[9];
+    return true;
+}
+
+/* Whole file into s_text, NUL-terminated; a missing file reads as empty. */
+static int sd_cardprof_read(const char *path) {
+    UINT br = 0;
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_open(file, path, FA_READ);
+    if (res == FR_OK) {
+        res = f_read(file, s_text, sizeof(s_text) - 1U, &br);
+        (void)f_close(file);
+    } else if (res == FR_NO_FILE) {
+        res = FR_OK;
+    }
+    sd_pool_fil_put(file);
+    s_text[(res == FR_OK) ? br : 0U] = '\0';
+    return res;
+}
+
+int sd_cardprof_load(const char *path, SD_Handle_t *sd_handle, SD_CardProfile *out) {
+    SD_CardProfile card;
+    SD_CardProfile line;
+    if (path == NULL || sd_handle == NULL || out == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    sd_cardprof_identify(sd_handle, &card);
+    int res = sd_cardprof_read(path);
+    if (res != FR_OK) {
+        return res;
+    }
+    for (char *p = s_text; *p != '\0';) {
+        char *eol = strchr(p, '\n');
+        if (sd_cardprof_parse(p, &line) && sd_cardprof_same(&line, &card)) {
+            *out = line;
+            return FR_OK;
+        }
+        p = (eol != NULL) ? eol + 1 : p + strlen(p);
+    }
+    return FR_NO_FILE;
+}
+
+int sd_cardprof_save(const char *path, const SD_CardProfile *prof) {
+    char line[SD_CARDPROF_LINE];
+    SD_CardProfile other;
+    if (path == NULL || prof == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    int n = snprintf(line, sizeof(line), "SDPROF,%u,0x%02X,0x%08lX,%lu,%lu,%lu,%lu,%u,%lu,%lu\r\n",
+                     SD_CARDPROF_VERSION, (unsigned)prof->mid, (unsigned long)prof->psn,
+                     (unsigned long)prof->blocks, (unsigned long)prof->au_blocks,
+                     (unsigned long)prof->au_entry_us, (unsigned long)prof->write_blocks,
+                     prof->pre_erase ? 1U : 0U, (unsigned long)prof->small_write_us,
+                     (unsigned long)prof->peak_kb_per_s);
+    if (n <= 0 || (size_t)n >= sizeof(line)) {
+        return FR_INT_ERR;
+    }
+    int res = sd_cardprof_read(path);
+    if (res != FR_OK) {
+        return res;
+    }
+
+    /* Keep the other cards' valid lines, newest last, dropping the oldest beyond the cap. */
+    uint32_t kept = 0;
+    char *w = s_text;
+    for (char *p = s_text; *p != '\0';) {
+        char *eol = strchr(p, '\n');
+        size_t len = (eol != NULL) ? (size_t)(eol + 1 - p) : strlen(p);
+        if (sd_cardprof_parse(p, &other) && !sd_cardprof_same(&other, prof)) {
+            memmove(w, p, len);
+            w += len;
+            kept++;
+        }
+        p += len;
+    }
+    *w = '\0';
+    char *keep = s_text;
+    while (kept >= SD_CARDPROF_MAX_CARDS) {
+        char *eol = strchr(keep, '\n');
+        keep = (eol != NULL) ? eol + 1 : w;
+        kept--;
+    }
+
+    UINT bw = 0;
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    res = f_open(file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK) {
+        UINT others = (UINT)(w - keep);
+        res = f_write(file, keep, others, &bw);
+        if (res == FR_OK && bw == others) {
+            res = f_write(file, line, (UINT)n, &bw);
+            others = (UINT)n;
+        }
+        if (res == FR_OK && bw != others) {
+            res = FR_DENIED; /* volume full */
+        }
+        FRESULT close_res = f_close(file);
+        if (res == FR_OK) {
+            res = close_res;
+        }
+    }
+    sd_pool_fil_put(file);
+    return res;
+}
+
+SD_Status sd_cardprof_apply(SD_Handle_t *sd_handle, const SD_CardProfile *prof) {
+    SD_CardProfile card;
+    if (sd_handle == NULL || prof == NULL) {
+        return SD_PARAM;
+    }
+    sd_cardprof_identify(sd_handle, &card);
+    if (!sd_cardprof_same(&card, prof)) {
+        return SD_PARAM;
+    }
+    if (!prof->pre_erase) {
+        sd_handle->acmd23_ok = false;
+    }
+    s_active = *prof;
+    s_active_set = true;
+    return SD_OK;
+}
+
+const SD_CardProfile *sd_cardprof_active(SD_Handle_t *sd_handle) {
+    SD_CardProfile card;
+    if (sd_handle == NULL || !s_active_set) {
+        return NULL;
+    }
+    sd_cardprof_identify(sd_handle, &card);
+    return sd_cardprof_same(&card, &s_active) ? &s_active : NULL;
+}
+
+int sd_cardprof(const char *path, SD_Handle_t *sd_handle, uint32_t first_lba,
+                uint32_t span_blocks, bool force, SD_CardProfile *out) {
+    static SD_CardProfile prof;
+    if (path == NULL || sd_handle == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    int res = force ? FR_NO_FILE : sd_cardprof_load(path, sd_handle, &prof);
+    if (res == FR_NO_FILE && span_blocks != 0U) {
+        if (sd_cardprof_measure(sd_handle, first_lba, span_blocks, &prof) != SD_OK) {
+            return FR_DISK_ERR;
+        }
+        res = sd_cardprof_save(path, &prof);
+    }
+    if (res != FR_OK) {
+        return res;
+    }
+    (void)sd_cardprof_apply(sd_handle, &prof);
+    if (out != NULL) {
+        *out = prof;
+    }
+    return FR_OK;
+}
+
+void sd_cardprof_print(const SD_CardProfile *prof) {
+    printf("SDPROF,card,mid=0x%02X,psn=0x%08lX,blocks=%lu,au_blocks=%lu\r\n", (unsigned)prof->mid,
+           (unsigned long)prof->psn, (unsigned long)prof->blocks, (unsigned long)prof->au_blocks);
+    printf("SDPROF,au,offset_kb,mean_us,max_us\r\n");
+    for (uint32_t i = 0; i < SD_CARDPROF_AU_POINTS; i++) {
+        printf("SDPROF,au,%lu,%lu,%lu\r\n",
+               (unsigned long)(((uint64_t)prof->au_blocks * i / SD_CARDPROF_AU_POINTS) / 2U),
+               (unsigned long)prof->au_mean_us[i], (unsigned long)prof->au_max_us[i]);
+    }
+    printf("SDPROF,size,bytes,mean_us,max_us\r\n");
+    for (uint32_t i = 0; i < SD_CARDPROF_SIZES; i++) {
+        printf("SDPROF,size,%lu,%lu,%lu\r\n", (unsigned long)(SD_BLOCK_SIZE << i),
+               (unsigned long)prof->size_mean_us[i], (unsigned long)prof->size_max_us[i]);
+    }
+    printf("SDPROF,run,blocks,kb_per_s,pre_erase_kb_per_s\r\n");
+    for (uint32_t i = 0; i < SD_CARDPROF_SIZES; i++) {
+        printf("SDPROF,run,%lu,%lu,%lu\r\n", (unsigned long)(1U << i),
+               (unsigned long)prof->run_kb_per_s[i], (unsigned long)prof->run_pre_kb_per_s[i]);
+    }
+    printf("SDPROF,profile,au_entry_us=%lu,write_blocks=%lu,pre_erase=%u,small_write_us=%lu,"
+           "peak_kb_per_s=%lu\r\n",
+           (unsigned long)prof->au_entry_us, (unsigned long)prof->write_blocks,
+           prof->pre_erase ? 1U : 0U, (unsigned long)prof->small_write_us,
+           (unsigned long)prof->peak_kb_per_s);
+}
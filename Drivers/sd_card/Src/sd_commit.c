@@ -0,0 +1,187 @@
+/*
+ * sd_commit.c
+ *
+ * sd_sync_data repeats the data half of ff.c's f_sync and its sync_window
+ * on the FIL and FATFS fields directly, under the volume lock; FA_MODIFIED
+ * is left set so the next f_sync still writes the entry. sd_flush_data_only
+ * stops before the window, except for a _FS_TINY data sector held there.
+ */
+
+#include "sd_commit.h"
+#include "diskio.h"
+#include "sd_diskio_spi.h"
+#include "main.h"
+#include <string.h>
+
+/* ff.c's private FIL.flag bit: FIL.buf[] holds unwritten data (R0.12c value). */
+#define SD_FA_DIRTY 0x80U
+
+static FIL *s_pending[SD_COMMIT_FILES];
+static uint32_t s_oldest; // Tick of the first deferral since the last commit
+static SD_CommitStats s_stats;
+
+/* The checks ff.c's validate makes before touching a file. */
+static bool sd_commit_valid(FIL *fp) {
+    return fp != NULL && fp->obj.fs != NULL && fp->obj.fs->fs_type != 0U &&
+           fp->obj.id == fp->obj.fs->id &&
+           (disk_status(fp->obj.fs->drv) & STA_NOINIT) == 0U;
+}
+
+/* Write the window like sync_window: FAT sectors go to every FAT copy. */
+static FRESULT sd_commit_window(FATFS *fs) {
+    if (!fs->wflag) {
+        return FR_OK;
+    }
+    DWORD sect = fs->winsect;
+    if (disk_write(fs->drv, fs->win, sect, 1U) != RES_OK) {
+        return FR_DISK_ERR;
+    }
+    fs->wflag = 0;
+    if (sect - fs->fatbase < fs->fsize) {
+        for (UINT nf = fs->n_fats; nf >= 2U; nf--) {
+            sect += fs->fsize;
+            (void)disk_write(fs->drv, fs->win, sect, 1U);
+        }
+    }
+    return FR_OK;
+}
+
+/* fat: also the window and CTRL_SYNC; else data sectors and SD_CTRL_SYNC_DATA. */
+static FRESULT sd_commit_data(FIL *fp, bool fat) {
+    FATFS *fs = fp->obj.fs;
+#if _FS_REENTRANT
+    if (!ff_req_grant(fs->sobj)) {
+        return FR_TIMEOUT;
+    }
+#endif
+    FRESULT res = FR_OK;
+#if !_FS_TINY
+    if ((fp->flag & SD_FA_DIRTY) != 0U) {
+        if (disk_write(fs->drv, fp->buf, fp->sect, 1U) != RES_OK) {
+            res = FR_DISK_ERR;
+        } else {
+            fp->flag &= (BYTE)~SD_FA_DIRTY;
+        }
+    }
+#else
+    if (!fat && fs->winsect >= fs->database) {
+        res = sd_commit_window(fs); /* the file's sector */
+    }
+#endif
+    if (res == FR_OK && fat) {
+        res = sd_commit_window(fs);
+    }
+    if (res == FR_OK && disk_ioctl(fs->drv, fat ? CTRL_SYNC : SD_CTRL_SYNC_DATA, NULL) != RES_OK) {
+        res = FR_DISK_ERR;
+    }
+#if _FS_REENTRANT
+    ff_rel_grant(fs->sobj);
+#endif
+    return res;
+}
+
+int sd_sync_data(FIL *fp) {
+    if (!sd_commit_valid(fp)) {
+        return FR_INVALID_OBJECT;
+    }
+#if _FS_EXFAT
+    if (fp->obj.fs->fs_type == FS_EXFAT) {
+        return f_sync(fp);
+    }
+#endif
+    FRESULT res = sd_commit_data(fp, true);
+    if (res == FR_OK) {
+        s_stats.data_syncs++;
+    }
+    return res;
+}
+
+int sd_flush_data_only(FIL *fp) {
+    if (!sd_commit_valid(fp)) {
+        return FR_INVALID_OBJECT;
+    }
+    FRESULT res = sd_commit_data(fp, false);
+    if (res == FR_OK) {
+        s_stats.data_flushes++;
+    }
+    return res;
+}
+
+int sd_defer_sync(FIL *fp) {
+    if (!sd_commit_valid(fp)) {
+        return FR_INVALID_OBJECT;
+    }
+    int slot = -1;
+    for (uint32_t i = 0; i < SD_COMMIT_FILES; i++) {
+        if (s_pending[i] == fp) {
+            slot = (int)i;
+            break;
+        }
+        if (slot < 0 && s_pending[i] == NULL) {
+            slot = (int)i;
+        }
+    }
+#if _FS_EXFAT
+    if (fp->obj.fs->fs_type == FS_EXFAT) {
+        slot = -1;
+    }
+#endif
+    if (slot < 0) {
+        s_stats.full_syncs++;
+        return f_sync(fp);
+    }
+    int res = sd_sync_data(fp);
+    if (res == FR_OK && s_pending[slot] == NULL) {
+        if (s_stats.pending == 0U) {
+            s_oldest = HAL_GetTick();
+        }
+        s_pending[slot] = fp;
+        s_stats.pending++;
+    }
+    return res;
+}
+
+int sd_commit(void) {
+    int first = FR_OK;
+    for (uint32_t i = 0; i < SD_COMMIT_FILES; i++) {
+        FIL *fp = s_pending[i];
+        if (fp == NULL) {
+            continue;
+        }
+        s_pending[i] = NULL;
+        if (!sd_commit_valid(fp)) {
+            continue; /* closed since: f_close wrote the entry */
+        }
+        FRESULT res = f_sync(fp);
+        if (res == FR_OK) {
+            s_stats.commits++;
+        } else if (first == FR_OK) {
+            first = res;
+        }
+    }
+    s_stats.pending = 0;
+    return first;
+}
+
+int sd_commit_poll(void) {
+    if (SD_COMMIT_MS == 0U || s_stats.pending == 0U ||
+        (HAL_GetTick() - s_oldest) < SD_COMMIT_MS) {
+        return FR_OK;
+    }
+    return sd_commit();
+}
+
+void sd_commit_forget(FIL *fp) {
+    for (uint32_t i = 0; i < SD_COMMIT_FILES; i++) {
+        if (s_pending[i] == fp && fp != NULL) {
+            s_pending[i] = NULL;
+            s_stats.pending--;
+        }
+    }
+}
+
+void sd_commit_get_stats(SD_CommitStats *out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
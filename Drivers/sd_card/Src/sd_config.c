@@ -0,0 +1,58 @@
+/*
+ * sd_config.c
+ *
+ * Build-time consistency checks across the module configurations and
+ * ffconf.h. Each module header checks its own knobs; the combinations that
+ * only break (or silently waste RAM) together are checked here, where every
+ * header has settled its values.
+ */
+
+#include "sd_config.h"
+#include "sd_cache.h"
+#include "sd_diskio_spi.h"
+#include "sd_pool.h"
+#include "sd_spi.h"
+#include "ff.h"
+
+#if (_MIN_SS != SD_DISK_SECTOR_SIZE) || (_MAX_SS != SD_DISK_SECTOR_SIZE)
+#error "ffconf.h: _MIN_SS and _MAX_SS must both equal SD_DISK_SECTOR_SIZE (512 by default)"
+#endif
+
+#if (SD_CONFIG_PROFILE != SD_CONFIG_DEFAULT) && (_FS_TINY != SD_CONFIG_FS_TINY)
+#error "ffconf.h: _FS_TINY differs from the selected SD_CONFIG_PROFILE (use SD_CONFIG_FS_TINY)"
+#endif
+
+#if (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT) &&                                                \
+    ((_FS_MINIMIZE != SD_CONFIG_FS_MINIMIZE) || (_USE_STRFUNC != SD_CONFIG_FS_STRFUNC) ||         \
+     (_USE_LABEL != SD_CONFIG_FS_LABEL) || (_USE_MKFS != SD_CONFIG_FS_MKFS))
+#error "ffconf.h: _FS_MINIMIZE/_USE_STRFUNC/_USE_LABEL/_USE_MKFS differ from SD_CONFIG_COMPACT"
+#endif
+
+/* The writers that preallocate with f_expand trim the unused part with f_truncate. */
+#if _USE_EXPAND && (_FS_MINIMIZE != 0)
+#error "_USE_EXPAND 1 needs _FS_MINIMIZE 0 in ffconf.h"
+#endif
+
+/* Held lines stand in for FIL sector buffers, which only _FS_TINY 1 removes. */
+#if (SD_CACHE_HOLD_LINES > 0U) && (!SD_CACHE_ENABLED || !_FS_TINY)
+#error "SD_CACHE_HOLD_LINES needs SD_CACHE_ENABLED 1 and _FS_TINY 1"
+#endif
+
+/* FatFs only calls ff_memalloc for its LFN buffer with _USE_LFN 3. */
+#if (SD_POOL_LFN_BUFS > 0U) && (_USE_LFN != 3)
+#error "SD_POOL_LFN_BUFS needs _USE_LFN 3 in ffconf.h"
+#endif
+
+const char *SD_ConfigProfileName(void) {
+#if (SD_CONFIG_PROFILE == SD_CONFIG_LOW_RAM)
+    return "low-ram";
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_MAX_THROUGHPUT)
+    return "max-throughput";
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_LOW_LATENCY)
+    return "low-latency";
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT)
+    return "compact";
+#else
+    return "default";
+#endif
+}
@@ -0,0 +1,193 @@
+/*
+ * sd_crc32.c
+ *
+ * CRC-32 in the STM32 CRC unit's form: a nibble table in software, or the
+ * peripheral fed from the CPU or by DMA.
+ */
+
+#include "sd_crc32.h"
+#include <string.h>
+
+#if (SD_CRC32_HW == 1) && defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+/* 0x04C11DB7 applied to a nibble shifted out of the top of the register. */
+static const uint32_t s_crc_nibble[16] = {
+    0x00000000U, 0x04C11DB7U, 0x09823B6EU, 0x0D4326D9U, 0x130476DCU, 0x17C56B6BU,
+    0x1A864DB2U, 0x1E475005U, 0x2608EDB8U, 0x22C9F00FU, 0x2F8AD6D6U, 0x2B4BCB61U,
+    0x350C9B64U, 0x31CD86D3U, 0x3C8EA00AU, 0x384FBDBDU,
+};
+
+#if (SD_CRC32_HW == 1)
+static CRC_HandleTypeDef *s_hcrc;
+static bool s_unit_taken;
+#if (SD_CRC32_DMA == 1)
+static DMA_HandleTypeDef *s_hdma;
+#endif
+#endif
+
+static uint32_t SD_Crc32Word(uint32_t crc, uint32_t word) {
+    crc ^= word;
+    for (uint32_t i = 0; i < 8U; i++) {
+        crc = (crc << 4) ^ s_crc_nibble[crc >> 28];
+    }
+    return crc;
+}
+
+uint32_t SD_Crc32(uint32_t crc, const void *data, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (; len >= 4U; len -= 4U, p += 4) {
+        crc = SD_Crc32Word(crc, (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                                    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    }
+    if (len > 0U) {
+        uint32_t word = 0;
+        for (uint32_t i = 0; i < len; i++) {
+            word |= (uint32_t)p[i] << (8U * i);
+        }
+        crc = SD_Crc32Word(crc, word);
+    }
+    return crc;
+}
+
+#if (SD_CRC32_HW == 1)
+void SD_Crc32SetUnit(CRC_HandleTypeDef *hcrc, DMA_HandleTypeDef *hdma) {
+    s_hcrc = hcrc;
+#if (SD_CRC32_DMA == 1)
+    s_hdma = hdma;
+#else
+    (void)hdma;
+#endif
+}
+
+static bool SD_Crc32TakeUnit(void) {
+    bool taken = false;
+#if defined(USE_FREERTOS)
+    taskENTER_CRITICAL();
+#endif
+    if (s_hcrc != NULL && !s_unit_taken) {
+        s_unit_taken = true;
+        taken = true;
+    }
+#if defined(USE_FREERTOS)
+    taskEXIT_CRITICAL();
+#endif
+    return taken;
+}
+#endif
+
+/* Let a DMA feed into the unit finish before the data register is touched again. */
+static void SD_Crc32Wait(SD_Crc32Stream *s) {
+#if (SD_CRC32_DMA == 1)
+    if (s->dma_pending) {
+        (void)HAL_DMA_PollForTransfer(s_hdma, HAL_DMA_FULL_TRANSFER, SD_CRC32_DMA_TIMEOUT_MS);
+    }
+#endif
+    s->dma_pending = false;
+}
+
+/* Whole words; p need not be aligned unless a DMA feed takes them. */
+static void SD_Crc32Words(SD_Crc32Stream *s, const uint8_t *p, uint32_t words) {
+#if (SD_CRC32_HW == 1)
+    if (s->unit) {
+#if (SD_CRC32_DMA == 1)
+        if (s_hdma != NULL && ((uintptr_t)p % 4U) == 0U) {
+            /* A DMA transfer counts at most 65535 items; only the last one is left running. */
+            while (words > 0U) {
+                uint32_t n = (words > 0xFFFFU) ? 0xFFFFU : words;
+                SD_Crc32Wait(s);
+                if (HAL_DMA_Start(s_hdma, (uint32_t)(uintptr_t)p,
+                                  (uint32_t)(uintptr_t)&s_hcrc->Instance->DR, n) != HAL_OK) {
+                    break; /* the CPU takes the rest */
+                }
+                s->dma_pending = true;
+                p += 4U * n;
+                words -= n;
+            }
+            if (words == 0U) {
+                return;
+            }
+            SD_Crc32Wait(s);
+        }
+#endif
+        if (((uintptr_t)p % 4U) == 0U) {
+            (void)HAL_CRC_Accumulate(s_hcrc, (uint32_t *)(uintptr_t)p, words);
+        } else {
+            for (; words > 0U; words--, p += 4) {
+                uint32_t word;
+                memcpy(&word, p, sizeof(word));
+                (void)HAL_CRC_Accumulate(s_hcrc, &word, 1U);
+            }
+        }
+        return;
+    }
+#endif
+    s->crc = SD_Crc32(s->crc, p, 4U * words);
+}
+
+void SD_Crc32Begin(SD_Crc32Stream *s) {
+    memset(s, 0, sizeof(*s));
+    s->crc = SD_CRC32_INIT;
+#if (SD_CRC32_HW == 1)
+    s->unit = SD_Crc32TakeUnit();
+    if (s->unit) {
+        __HAL_CRC_DR_RESET(s_hcrc);
+    }
+#endif
+}
+
+void SD_Crc32Update(SD_Crc32Stream *s, const void *data, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    SD_Crc32Wait(s);
+    /* Finish the word the last call left open; the buffer's own words follow it. */
+    for (; len > 0U && s->tail_len > 0U; len--, p++) {
+        s->tail |= (uint32_t)*p << (8U * s->tail_len);
+        if (++s->tail_len == 4U) {
+            uint8_t word[4];
+            memcpy(word, &s->tail, sizeof(word));
+            SD_Crc32Words(s, word, 1U);
+            SD_Crc32Wait(s);
+            s->tail = 0;
+            s->tail_len = 0;
+        }
+    }
+    uint32_t words = len / 4U;
+    if (words > 0U) {
+        SD_Crc32Words(s, p, words);
+        p += 4U * words;
+        len -= 4U * words;
+    }
+    if (len > 0U) {
+        for (uint32_t i = 0; i < len; i++) {
+            s->tail |= (uint32_t)p[i] << (8U * i);
+        }
+        s->tail_len = (uint8_t)len;
+    }
+}
+
+uint32_t SD_Crc32End(SD_Crc32Stream *s) {
+    SD_Crc32Wait(s);
+    if (s->tail_len > 0U) {
+        if (!s->unit) {
+            s->crc = SD_Crc32Word(s->crc, s->tail);
+        }
+#if (SD_CRC32_HW == 1)
+        else {
+            (void)HAL_CRC_Accumulate(s_hcrc, &s->tail, 1U);
+        }
+#endif
+        s->tail_len = 0;
+    }
+    uint32_t crc = s->crc;
+#if (SD_CRC32_HW == 1)
+    if (s->unit) {
+        uint32_t none = 0;
+        crc = HAL_CRC_Accumulate(s_hcrc, &none, 0U); /* reads the data register */
+        s->unit = false;
+        s_unit_taken = false;
+    }
+#endif
+    return crc;
+}
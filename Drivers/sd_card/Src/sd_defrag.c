@@ -0,0 +1,495 @@
+/*
+ * sd_defrag.c
+ *
+ * Background file compaction: a scan of one directory, one entry per step,
+ * and for each fragmented file a copy into a contiguous run, one chunk per
+ * step, followed by a journalled swap.
+ */
+
+#include "sd_defrag.h"
+#include "sd_diskio_spi.h"
+#include "sd_freemap.h"
+#include "sd_spi.h"
+#include "diskio.h"
+#include <string.h>
+
+#if (SD_DEFRAG_ENABLED == 1)
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#endif
+
+#if (SD_DEFRAG_CHUNK % _MAX_SS) != 0U
+#error "SD_DEFRAG_CHUNK must be a multiple of _MAX_SS"
+#endif
+
+#define SD_DEFRAG_IDLE 0U
+#define SD_DEFRAG_SCAN 1U
+#define SD_DEFRAG_COPY 2U
+
+static uint8_t s_state;
+static SD_DefragStats s_stats;
+static const char *s_dir_path;
+static char s_tmp[12U + sizeof(SD_DEFRAG_TMP_NAME)];     // Volume prefix and the copy's name
+static char s_jnl[12U + sizeof(SD_DEFRAG_JOURNAL_NAME)]; // ...and the journal's
+static char s_path[SD_DEFRAG_PATH_MAX];                  // File being moved
+static uint32_t s_index;  // Directory entries passed
+static BYTE s_drv;
+static DIR s_dir;
+static FIL s_src;
+static FILINFO s_fno;     // The file being moved, as found
+static FILINFO s_check;
+static uint32_t s_runs;
+static uint32_t s_copied;
+static DWORD s_run_sector; // First sector of the contiguous run
+static uint32_t s_ops;         // Card operations seen after the last step
+static uint32_t s_idle_from;   // HAL tick the card was last seen in use
+static uint32_t s_not_before;  // HAL tick the bandwidth cap allows the next copy at
+static uint8_t s_buf[SD_DEFRAG_CHUNK] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+#if defined(USE_FREERTOS)
+static SemaphoreHandle_t s_run; // Held across a step, so SD_DefragStop waits it out
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_run_buffer;
+#endif
+
+static void SD_DefragRunLock(void) {
+    if (s_run == NULL) {
+        vTaskSuspendAll();
+        if (s_run == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+            s_run = xSemaphoreCreateMutexStatic(&s_run_buffer);
+#else
+            s_run = xSemaphoreCreateMutex();
+#endif
+        }
+        (void)xTaskResumeAll();
+    }
+    if (s_run != NULL) {
+        (void)xSemaphoreTake(s_run, portMAX_DELAY);
+    }
+}
+
+static void SD_DefragRunUnlock(void) {
+    if (s_run != NULL) {
+        (void)xSemaphoreGive(s_run);
+    }
+}
+#else
+static void SD_DefragRunLock(void) {
+}
+
+static void SD_DefragRunUnlock(void) {
+}
+#endif
+
+/* dst = the volume prefix of path ("0:" or nothing) followed by name. */
+static void SD_DefragVolPath(char *dst, size_t size, const char *path, const char *name) {
+    size_t n = 0;
+    const char *colon = (path != NULL) ? strchr(path, ':') : NULL;
+    if (colon != NULL && (size_t)(colon - path) + 1U + strlen(name) < size) {
+        n = (size_t)(colon - path) + 1U;
+        memcpy(dst, path, n);
+    }
+    strncpy(&dst[n], name, size - n - 1U);
+    dst[size - 1U] = '\0';
+}
+
+static uint32_t SD_DefragCardOps(void) {
+    SD_Handle_t *sd = SD_DiskHandle(s_drv);
+    return (sd != NULL) ? sd->stats.read_ops + sd->stats.write_ops : 0U;
+}
+
+static uint32_t SD_DefragWait(void) {
+    uint32_t now = HAL_GetTick();
+    uint32_t wait = 0;
+#if (SD_DEFRAG_IDLE_MS > 0U)
+    uint32_t ops = SD_DefragCardOps();
+    if (ops != s_ops) {
+        s_ops = ops;
+        s_idle_from = now;
+    }
+    if (now - s_idle_from < SD_DEFRAG_IDLE_MS) {
+        wait = SD_DEFRAG_IDLE_MS - (now - s_idle_from);
+    }
+#endif
+    if ((int32_t)(s_not_before - now) > 0 && s_not_before - now > wait) {
+        wait = s_not_before - now;
+    }
+    return wait;
+}
+
+/* Drop the copy of the file being moved; the source stays as it was. */
+static void SD_DefragAbandon(void) {
+    if (s_state == SD_DEFRAG_COPY) {
+        (void)f_close(&s_src);
+        (void)f_unlink(s_tmp);
+        s_state = SD_DEFRAG_SCAN;
+    }
+}
+
+static void SD_DefragEndPass(void) {
+    SD_DefragAbandon();
+    s_state = SD_DEFRAG_IDLE;
+    s_stats.active = false;
+}
+
+/* Runs of clusters in the chain of an open file, from its fast-seek link map. */
+static FRESULT SD_DefragCountRuns(FIL *fp, uint32_t *runs) {
+    DWORD tbl[2 * SD_DEFRAG_MIN_FRAGMENTS + 1U];
+    tbl[0] = (DWORD)(sizeof(tbl) / sizeof(tbl[0]));
+    fp->cltbl = tbl;
+    FRESULT res = f_lseek(fp, CREATE_LINKMAP);
+    fp->cltbl = NULL;
+    if (res == FR_NOT_ENOUGH_CORE) {
+        res = FR_OK; /* tbl[0] holds the size it needs */
+    }
+    *runs = (uint32_t)(tbl[0] - 2U) / 2U;
+    return res;
+}
+
+static void SD_DefragCount(FRESULT res) {
+    if (res == FR_LOCKED || res == FR_TOO_MANY_OPEN_FILES) {
+        s_stats.busy++;
+    } else if (res == FR_DENIED) {
+        s_stats.no_space++;
+    } else if (res != FR_OK) {
+        s_stats.errors++;
+    }
+}
+
+/* Reserve a contiguous run for the file at s_path and open the source for the copy. */
+static FRESULT SD_DefragPrepare(void) {
+    uint32_t runs = 0;
+    FRESULT res = f_open(&s_src, s_path, FA_READ);
+    if (res != FR_OK) {
+        return res;
+    }
+    res = SD_DefragCountRuns(&s_src, &runs);
+    (void)f_close(&s_src); /* one file open at a time: _FS_LOCK may be small */
+    if (res != FR_OK || runs < SD_DEFRAG_MIN_FRAGMENTS) {
+        return res;
+    }
+    s_stats.fragmented++;
+
+    res = f_open(&s_src, s_tmp, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        return res;
+    }
+    (void)SD_FreeMapHint(s_fno.fsize); /* f_expand searches from the hinted free run */
+    res = f_expand(&s_src, s_fno.fsize, 1);
+    FATFS *fs = s_src.obj.fs;
+    s_run_sector = fs->database + (s_src.obj.sclust - 2U) * fs->csize;
+    FRESULT close_res = f_close(&s_src);
+    if (res == FR_OK) {
+        res = close_res;
+    }
+    if (res == FR_OK) {
+        res = f_open(&s_src, s_path, FA_READ);
+    }
+    if (res != FR_OK) {
+        (void)f_unlink(s_tmp);
+        return res;
+    }
+    s_runs = runs;
+    s_copied = 0;
+    s_state = SD_DEFRAG_COPY;
+    return FR_OK;
+}
+
+/* Look at the next directory entry. */
+static void SD_DefragScanStep(void) {
+    FRESULT res = f_opendir(&s_dir, s_dir_path);
+    for (uint32_t i = 0; res == FR_OK && i <= s_index; i++) {
+        res = f_readdir(&s_dir, &s_fno);
+    }
+    (void)f_closedir(&s_dir);
+    if (res != FR_OK || s_fno.fname[0] == '\0') {
+        SD_DefragCount(res);
+        SD_DefragEndPass();
+        return;
+    }
+    s_index++;
+    if ((s_fno.fattrib & AM_DIR) != 0U || strcmp(s_fno.fname, SD_DEFRAG_TMP_NAME) == 0 ||
+        strcmp(s_fno.fname, SD_DEFRAG_JOURNAL_NAME) == 0) {
+        return;
+    }
+    s_stats.files++;
+    if (s_fno.fsize == 0U) {
+        return;
+    }
+    size_t dir_len = strlen(s_dir_path);
+    if (dir_len + 1U + strlen(s_fno.fname) >= sizeof(s_path)) {
+        s_stats.errors++;
+        return;
+    }
+    memcpy(s_path, s_dir_path, dir_len);
+    if (dir_len == 0U || (s_path[dir_len - 1U] != '/' && s_path[dir_len - 1U] != ':')) {
+        s_path[dir_len++] = '/';
+    }
+    strcpy(&s_path[dir_len], s_fno.fname);
+    SD_DefragCount(SD_DefragPrepare());
+}
+
+/* Put the copy in place of the source, once the source is known not to have changed. */
+static FRESULT SD_DefragSwap(void) {
+    (void)f_close(&s_src);
+    s_state = SD_DEFRAG_SCAN;
+    FRESULT res = f_stat(s_path, &s_check);
+    if (res != FR_OK || s_check.fsize != s_fno.fsize || s_check.fdate != s_fno.fdate ||
+        s_check.ftime != s_fno.ftime) {
+        (void)f_unlink(s_tmp);
+        return (res == FR_OK || res == FR_NO_FILE) ? FR_LOCKED : res;
+    }
+
+    /* The copy is on the card before the journal names it. */
+    if (disk_ioctl(s_drv, CTRL_SYNC, NULL) != RES_OK) {
+        (void)f_unlink(s_tmp);
+        return FR_DISK_ERR;
+    }
+    UINT bw = 0;
+    res = f_open(&s_src, s_jnl, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK) {
+        res = f_write(&s_src, s_path, (UINT)strlen(s_path), &bw);
+        FRESULT close_res = f_close(&s_src);
+        if (res == FR_OK) {
+            res = close_res;
+        }
+    }
+    if (res == FR_OK) {
+        res = f_unlink(s_path); /* FR_LOCKED if someone opened it meanwhile */
+    }
+    if (res != FR_OK) {
+        (void)f_unlink(s_tmp);
+        (void)f_unlink(s_jnl);
+        return res;
+    }
+    res = f_rename(s_tmp, s_path);
+    if (res != FR_OK) {
+        return res; /* the journal lets SD_DefragRecover finish the move */
+    }
+#if _USE_CHMOD
+    (void)f_utime(s_path, &s_fno);
+    (void)f_chmod(s_path, s_fno.fattrib, AM_RDO | AM_ARC | AM_SYS | AM_HID);
+#endif
+    (void)f_unlink(s_jnl);
+    s_stats.moved++;
+    s_stats.runs_removed += s_runs - 1U;
+    return FR_OK;
+}
+
+/* Copy the next chunk of the source onto the run. */
+static void SD_DefragCopyStep(void) {
+    uint32_t left = s_fno.fsize - s_copied;
+    UINT n = (left < SD_DEFRAG_CHUNK) ? (UINT)left : (UINT)SD_DEFRAG_CHUNK;
+    UINT br = 0;
+    FRESULT res = f_read(&s_src, s_buf, n, &br);
+    if (res == FR_OK && br != n) {
+        res = FR_LOCKED; /* shorter than it was: changed under us */
+    }
+    if (res == FR_OK) {
+        uint32_t ss = SD_FS_SECTOR_SIZE(s_src.obj.fs);
+        uint32_t sectors = (n + ss - 1U) / ss;
+        memset(&s_buf[n], 0, sectors * ss - n);
+        if (disk_write(s_drv, s_buf, s_run_sector + s_copied / ss, sectors) != RES_OK) {
+            res = FR_DISK_ERR;
+        }
+    }
+    if (res != FR_OK) {
+        SD_DefragAbandon();
+        SD_DefragCount(res);
+        return;
+    }
+    s_copied += n;
+    s_stats.bytes_copied += n;
+#if (SD_DEFRAG_KBPS > 0U)
+    s_not_before = HAL_GetTick() + (uint32_t)(((uint64_t)n * 1000U) / (SD_DEFRAG_KBPS * 1024U));
+#endif
+    if (s_copied == s_fno.fsize) {
+        SD_DefragCount(SD_DefragSwap());
+    }
+}
+
+FRESULT SD_DefragStart(const char *dir) {
+    if (dir == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    SD_DefragRunLock();
+    SD_DefragEndPass();
+    FRESULT res = f_opendir(&s_dir, dir);
+    if (res == FR_OK) {
+        s_drv = s_dir.obj.fs->drv;
+        (void)f_closedir(&s_dir);
+        memset(&s_stats, 0, sizeof(s_stats));
+        s_dir_path = dir;
+        SD_DefragVolPath(s_tmp, sizeof(s_tmp), dir, SD_DEFRAG_TMP_NAME);
+        SD_DefragVolPath(s_jnl, sizeof(s_jnl), dir, SD_DEFRAG_JOURNAL_NAME);
+        s_index = 0;
+        s_ops = SD_DefragCardOps();
+        s_idle_from = HAL_GetTick();
+        s_not_before = s_idle_from;
+        s_state = SD_DEFRAG_SCAN;
+        s_stats.active = true;
+    }
+    SD_DefragRunUnlock();
+    return res;
+}
+
+bool SD_DefragStep(void) {
+    SD_DefragRunLock();
+    if (s_state != SD_DEFRAG_IDLE) {
+        if (SD_DefragWait() > 0U) {
+            s_stats.idle_waits++;
+        } else {
+            if (s_state == SD_DEFRAG_COPY) {
+                SD_DefragCopyStep();
+            } else {
+                SD_DefragScanStep();
+            }
+            s_ops = SD_DefragCardOps(); /* our own I/O does not count as use */
+            s_idle_from = HAL_GetTick();
+#if (SD_DEFRAG_IDLE_MS > 0U)
+            s_idle_from -= SD_DEFRAG_IDLE_MS; /* the card is still idle to us */
+#endif
+        }
+    }
+    bool more = (s_state != SD_DEFRAG_IDLE);
+    SD_DefragRunUnlock();
+    return more;
+}
+
+uint32_t SD_DefragWaitMs(void) {
+    SD_DefragRunLock();
+    uint32_t wait = (s_state != SD_DEFRAG_IDLE) ? SD_DefragWait() : 0U;
+    SD_DefragRunUnlock();
+    return wait;
+}
+
+void SD_DefragStop(void) {
+    SD_DefragRunLock();
+    SD_DefragEndPass();
+    SD_DefragRunUnlock();
+}
+
+FRESULT SD_DefragRecover(const char *vol) {
+    SD_DefragRunLock();
+    SD_DefragEndPass();
+    SD_DefragVolPath(s_tmp, sizeof(s_tmp), vol, SD_DEFRAG_TMP_NAME);
+    SD_DefragVolPath(s_jnl, sizeof(s_jnl), vol, SD_DEFRAG_JOURNAL_NAME);
+
+    FRESULT res = f_open(&s_src, s_jnl, FA_READ);
+    if (res == FR_OK) {
+        UINT br = 0;
+        res = f_read(&s_src, s_path, sizeof(s_path) - 1U, &br);
+        (void)f_close(&s_src);
+        s_path[br] = '\0';
+        /* Source removed but copy not yet renamed: the copy takes its place. */
+        if (res == FR_OK && br > 0U && f_stat(s_path, &s_check) == FR_NO_FILE &&
+            f_stat(s_tmp, &s_check) == FR_OK) {
+            res = f_rename(s_tmp, s_path);
+        }
+        if (res == FR_OK) {
+            res = f_unlink(s_jnl);
+        }
+    } else if (res == FR_NO_FILE) {
+        res = FR_OK;
+    }
+    if (res == FR_OK) {
+        FRESULT tmp_res = f_unlink(s_tmp); /* a copy cut short, or a source never removed */
+        if (tmp_res != FR_NO_FILE) {
+            res = tmp_res;
+        }
+    }
+    SD_DefragRunUnlock();
+    return res;
+}
+
+void SD_DefragGetStats(SD_DefragStats *out) {
+    if (out) {
+        *out = s_stats;
+    }
+}
+
+#if defined(USE_FREERTOS)
+static TaskHandle_t s_task;
+static const char *volatile s_task_dir;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticTask_t s_task_buffer;
+static StackType_t s_task_stack[SD_DEFRAG_TASK_STACK];
+#endif
+
+static void SD_DefragTask(void *argument) {
+    (void)argument;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        (void)SD_DefragStart(s_task_dir);
+        while (SD_DefragStep()) {
+            TickType_t ticks = pdMS_TO_TICKS(SD_DefragWaitMs());
+            if (ulTaskNotifyTake(pdTRUE, (ticks > 0U) ? ticks : 1U) != 0U) {
+                (void)SD_DefragStart(s_task_dir); /* asked again meanwhile: start over */
+            }
+        }
+    }
+}
+
+bool SD_DefragStartTask(const char *dir) {
+    if (s_task == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        s_task = xTaskCreateStatic(SD_DefragTask, "sd_defrag", SD_DEFRAG_TASK_STACK, NULL,
+                                   SD_DEFRAG_TASK_PRIORITY, s_task_stack, &s_task_buffer);
+#else
+        if (xTaskCreate(SD_DefragTask, "sd_defrag", SD_DEFRAG_TASK_STACK, NULL,
+                        SD_DEFRAG_TASK_PRIORITY, &s_task) != pdPASS) {
+            s_task = NULL;
+        }
+#endif
+    }
+    if (s_task == NULL) {
+        return false;
+    }
+    s_task_dir = dir;
+    (void)xTaskNotifyGive(s_task);
+    return true;
+}
+#endif
+
+#else
+
+FRESULT SD_DefragStart(const char *dir) {
+    (void)dir;
+    return FR_DENIED;
+}
+
+bool SD_DefragStep(void) {
+    return false;
+}
+
+uint32_t SD_DefragWaitMs(void) {
+    return 0;
+}
+
+void SD_DefragStop(void) {
+}
+
+FRESULT SD_DefragRecover(const char *vol) {
+    (void)vol;
+    return FR_OK;
+}
+
+void SD_DefragGetStats(SD_DefragStats *out) {
+    if (out) {
+        memset(out, 0, sizeof(*out));
+    }
+}
+
+#if defined(USE_FREERTOS)
+bool SD_DefragStartTask(const char *dir) {
+    (void)dir;
+    return false;
+}
+#endif
+
+#endif
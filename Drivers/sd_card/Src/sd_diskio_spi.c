@@ -6,54 +6,1413 @@
 #include "diskio.h"
 #include "sd_diskio_spi.h"
 #include "sd_spi.h"
+#include "sd_cache.h"
+#include "sd_profile.h"
+#include "sd_freemap.h"
+#include "sd_fsck.h"
+#include "sd_mem.h"
 #include "ff_gen_drv.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-/* Global SD handle */
+/* Global SD handle (drive 0) */
 SD_Handle_t g_sd_handle;
 
+#if (SD_DISK_DRIVES > 1U)
+static SD_Handle_t s_sd_handles[SD_DISK_DRIVES - 1U];
+#endif
+
+#if (SD_FAT_CACHE_GROUPS > 0U)
+typedef struct {
+    uint32_t start; // First sector held by the group
+    uint32_t count; // Sectors held (0 = empty)
+    uint32_t stamp; // LRU stamp; larger is more recently used
+} SD_FatGroup;
+#endif
+
+#if (SD_UNWRITTEN_RANGES > 0U)
+typedef struct {
+    uint32_t start; // First never-written sector
+    uint32_t count; // Sectors in the range (0 = free slot)
+} SD_Unwritten;
+#endif
+
+#if (SD_FAT_MIRROR_RANGES > 0U)
+typedef struct {
+    uint32_t start; // First stale sector, relative to the start of a FAT
+    uint32_t count; // Sectors in the range (0 = free slot)
+} SD_MirrorRange;
+#endif
+
+#if (SD_DISK_BATCH_SECTORS > 0U)
+typedef struct {
+    uint32_t sector;
+    uint32_t stamp; // LRU clock of the last access
+    bool used;
+    bool dirty; // Written in batch mode, not yet on the card
+} SD_BatchSlot;
+#endif
+
+#if (SD_DISK_POLICY_RANGES > 0U)
+typedef struct {
+    uint32_t start;       // First sector of the range
+    uint32_t count;       // Sectors in the range (0 = free slot)
+    SD_DiskPolicy policy;
+    uint8_t *ram;         // SD_DISK_POLICY_RESIDENT: copy of the whole range
+    bool loaded;          // ram holds the range
+} SD_PolicyRange;
+#endif
+
+#if (SD_WARM_SECTORS > 0U)
+typedef struct {
+    uint32_t sector;
+    uint32_t hits; // Sampled reads (0 = free entry)
+} SD_WarmEntry;
+#endif
+
+/*
+ * Per-drive diskio state: card handle, read-ahead window, FAT-sector cache,
+ * unwritten ranges, stale FAT mirrors, batch slots, policy ranges, access
+ * histogram.
+ */
+typedef struct {
+    SD_Handle_t *sd;
+#if (SD_READAHEAD_SECTORS > 0U)
+    uint8_t ra_buf[SD_READAHEAD_SECTORS * SD_DISK_SECTOR_SIZE]
+        __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    uint32_t ra_start; // First sector held in ra_buf
+    uint32_t ra_count; // Sectors held (0 = empty)
+    uint32_t ra_next;  // Sector just past the previous read
+#endif
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    uint8_t fat_buf[SD_FAT_CACHE_GROUPS][SD_FAT_CACHE_SPAN * SD_DISK_SECTOR_SIZE]
+        __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    SD_FatGroup fat_groups[SD_FAT_CACHE_GROUPS];
+    uint32_t fat_first; // FAT region registered by SD_DiskSetFatRegion
+    uint32_t fat_count;
+    uint32_t fat_clock;
+    uint32_t fat_hits;
+    uint32_t fat_misses;
+    uint32_t fat_evictions;
+#endif
+#if (SD_UNWRITTEN_RANGES > 0U)
+    SD_Unwritten unwritten[SD_UNWRITTEN_RANGES];
+#endif
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    uint8_t mirror_buf[SD_FAT_MIRROR_CHUNK * SD_DISK_SECTOR_SIZE]
+        __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    SD_MirrorRange mirror_stale[SD_FAT_MIRROR_RANGES];
+    uint32_t mirror_fat;    // First FAT registered by SD_DiskSetFatMirror
+    uint32_t mirror_size;   // Sectors per FAT
+    uint32_t mirror_count;  // FATs after the first (0 = nothing deferred)
+    uint32_t mirror_tick;   // HAL tick when the oldest stale sector was marked
+    SD_DiskMirrorStats mirror_stats;
+#endif
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    uint8_t batch_buf[SD_DISK_BATCH_SECTORS][SD_DISK_SECTOR_SIZE]
+        __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    SD_BatchSlot batch[SD_DISK_BATCH_SECTORS];
+    uint32_t batch_clock;
+#endif
+#if (SD_DISK_POLICY_RANGES > 0U)
+    SD_PolicyRange ranges[SD_DISK_POLICY_RANGES];
+    uint32_t stream_ranges; // Ranges with SD_DISK_POLICY_STREAM
+    SD_DiskPolicyStats policy_stats;
+#endif
+#if (SD_WARM_SECTORS > 0U)
+    SD_WarmEntry warm[SD_WARM_SECTORS];
+    uint32_t warm_skip; // Single-sector reads left before the next sample
+#endif
+    uint32_t batch_depth; // SD_DiskBatchBegin nesting (0 = not batching)
+    uint32_t limit;       // Sectors FatFs may use (0 = the whole card)
+    bool read_only;       // SD_DiskSetReadOnly: writes and trims refused
+    bool external;        // SD_DiskSetExternal: lent out, FatFs gets RES_NOTRDY
+    uint32_t meta_first;  // Metadata region registered by SD_DiskSetMetaRegion
+    uint32_t meta_count;
+    bool tuned;           // SD_DiskSetCacheSize was called: the two sizes below apply
+    uint32_t ra_window;   // Read-ahead window in sectors
+    uint32_t fat_active;  // FAT cache groups in use
+} SD_DiskState;
+
+static SD_DiskState s_disks[SD_DISK_DRIVES];
+
+SD_Handle_t *SD_DiskHandle(BYTE pdrv) {
+    if (pdrv == 0U) {
+        return &g_sd_handle;
+    }
+#if (SD_DISK_DRIVES > 1U)
+    if (pdrv < SD_DISK_DRIVES) {
+        return &s_sd_handles[pdrv - 1U];
+    }
+#endif
+    return NULL;
+}
+
+static SD_DiskState *SD_Disk(BYTE pdrv) {
+    if (pdrv >= SD_DISK_DRIVES) {
+        return NULL;
+    }
+    SD_DiskState *disk = &s_disks[pdrv];
+    disk->sd = SD_DiskHandle(pdrv);
+    return disk;
+}
+
+/*
+ * Logical sectors on the card, up to the limit; every card block of a sector
+ * is one multi-block transfer.
+ */
+static uint32_t SD_DiskSectors(const SD_DiskState *disk) {
+    uint32_t sectors = SD_GetBlockCount(disk->sd) / SD_DISK_SECTOR_BLOCKS;
+    return (disk->limit > 0U && disk->limit < sectors) ? disk->limit : sectors;
+}
+
+/* True if sectors [sector, sector + count) reach past the limit. */
+static bool SD_DiskPastLimit(const SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    return disk->limit > 0U && (sector >= disk->limit || count > disk->limit - sector);
+}
+
+#if (SD_DISK_POLICY_RANGES > 0U)
+/* The policy range holding all of [sector, sector + count), or NULL. */
+static SD_PolicyRange *SD_PolicyFind(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    for (uint32_t i = 0; i < SD_DISK_POLICY_RANGES; i++) {
+        SD_PolicyRange *r = &disk->ranges[i];
+        if (r->count > 0U && (sector - r->start) < r->count &&
+            count <= r->count - (sector - r->start)) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/* Single-sector data I/O in a stream range goes straight to the card. */
+static bool SD_PolicyDirect(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    if (count != 1U || disk->stream_ranges == 0U ||
+        (sector - disk->meta_first) < disk->meta_count) {
+        return false;
+    }
+    const SD_PolicyRange *r = SD_PolicyFind(disk, sector, 1U);
+    return r != NULL && r->policy == SD_DISK_POLICY_STREAM;
+}
+
+/* Keep resident copies in step with a write; NULL (trimmed, failed) reloads them. */
+static void SD_PolicyWritten(SD_DiskState *disk, const uint8_t *buff, uint32_t sector,
+                             uint32_t count) {
+    for (uint32_t i = 0; i < SD_DISK_POLICY_RANGES; i++) {
+        SD_PolicyRange *r = &disk->ranges[i];
+        if (r->count == 0U || !r->loaded || sector >= r->start + r->count ||
+            r->start >= sector + count) {
+            continue;
+        }
+        if (buff == NULL) {
+            r->loaded = false;
+            continue;
+        }
+        uint32_t first = (sector > r->start) ? sector : r->start;
+        uint32_t end = (sector + count < r->start + r->count) ? sector + count : r->start + r->count;
+        memcpy(&r->ram[(first - r->start) * SD_DISK_SECTOR_SIZE],
+               buff + ((first - sector) * SD_DISK_SECTOR_SIZE),
+               (end - first) * SD_DISK_SECTOR_SIZE);
+    }
+}
+#endif
+
+#if (SD_DISK_BATCH_SECTORS > 0U)
+static int SD_BatchFind(const SD_DiskState *disk, uint32_t sector) {
+    for (uint32_t i = 0; i < SD_DISK_BATCH_SECTORS; i++) {
+        if (disk->batch[i].used && disk->batch[i].sector == sector) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Held writes are newer than the card: lay them over data just read from it. */
+static void SD_BatchOverlay(const SD_DiskState *disk, uint8_t *buff, uint32_t sector,
+                            uint32_t count) {
+    for (uint32_t i = 0; i < SD_DISK_BATCH_SECTORS; i++) {
+        const SD_BatchSlot *slot = &disk->batch[i];
+        if (slot->used && slot->dirty && (slot->sector - sector) < count) {
+            memcpy(buff + ((slot->sector - sector) * SD_DISK_SECTOR_SIZE), disk->batch_buf[i],
+                   SD_DISK_SECTOR_SIZE);
+        }
+    }
+}
+
+/* Forget held copies in a range (rewritten as a whole, trimmed or unknown). */
+static void SD_BatchDrop(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    for (uint32_t i = 0; i < SD_DISK_BATCH_SECTORS; i++) {
+        if (disk->batch[i].used && (disk->batch[i].sector - sector) < count) {
+            disk->batch[i].used = false;
+        }
+    }
+}
+#endif
+
+/* Card read used by both direct reads and read-ahead fills (cache-aware when enabled). */
+static SD_Status SD_DiskRead(SD_DiskState *disk, uint8_t *buff, uint32_t sector, uint32_t count) {
+#if SD_CACHE_ENABLED
+    SD_Status status;
+#if (SD_DISK_POLICY_RANGES > 0U)
+    if (SD_PolicyDirect(disk, sector, count)) {
+        disk->policy_stats.stream_direct++;
+        status = SD_ReadBlocks(disk->sd, buff, sector * SD_DISK_SECTOR_BLOCKS,
+                               SD_DISK_SECTOR_BLOCKS);
+    } else
+#endif
+    {
+        status = SD_CacheRead(disk->sd, buff, sector * SD_DISK_SECTOR_BLOCKS,
+                              count * SD_DISK_SECTOR_BLOCKS);
+    }
+#else
+    SD_Status status = SD_ReadBlocks(disk->sd, buff, sector * SD_DISK_SECTOR_BLOCKS,
+                                     count * SD_DISK_SECTOR_BLOCKS);
+#endif
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    if (status == SD_OK) {
+        SD_BatchOverlay(disk, buff, sector, count);
+    }
+#endif
+    return status;
+}
+
+static SD_Status SD_DiskWriteCard(SD_DiskState *disk, const uint8_t *buff, uint32_t sector,
+                                  uint32_t count) {
+#if SD_CACHE_ENABLED
+#if (SD_DISK_POLICY_RANGES > 0U)
+    if (SD_PolicyDirect(disk, sector, count)) {
+        disk->policy_stats.stream_direct++;
+        SD_CacheDiscard(disk->sd, sector * SD_DISK_SECTOR_BLOCKS, SD_DISK_SECTOR_BLOCKS);
+        return SD_WriteBlocks(disk->sd, buff, sector * SD_DISK_SECTOR_BLOCKS,
+                              SD_DISK_SECTOR_BLOCKS);
+    }
+#endif
+    return SD_CacheWrite(disk->sd, buff, sector * SD_DISK_SECTOR_BLOCKS,
+                         count * SD_DISK_SECTOR_BLOCKS);
+#else
+    return SD_WriteBlocks(disk->sd, buff, sector * SD_DISK_SECTOR_BLOCKS,
+                          count * SD_DISK_SECTOR_BLOCKS);
+#endif
+}
+
+#if (SD_READAHEAD_SECTORS > 0U)
+/* Window in effect: as built until SD_DiskSetCacheSize. */
+static uint32_t SD_ReadAheadWindow(const SD_DiskState *disk) {
+    return disk->tuned ? disk->ra_window : SD_READAHEAD_SECTORS;
+}
+
+static void SD_ReadAheadInvalidate(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    if (disk->ra_count > 0U && sector < disk->ra_start + disk->ra_count &&
+        disk->ra_start < sector + count) {
+        disk->ra_count = 0;
+    }
+}
+
+/*
+ * Serve a read from the prefetch window when it covers the request. A request
+ * that continues the previous one and is shorter than the window refills it
+ * with a single multi-block read starting at the requested sector.
+ */
+static SD_Status SD_ReadAheadRead(SD_DiskState *disk, uint8_t *buff, uint32_t sector,
+                                  uint32_t count) {
+    uint32_t window = SD_ReadAheadWindow(disk);
+#if (SD_DISK_POLICY_RANGES > 0U)
+    const SD_PolicyRange *range = NULL;
+    if (disk->stream_ranges > 0U) {
+        range = SD_PolicyFind(disk, sector, count);
+        if (range == NULL || range->policy != SD_DISK_POLICY_STREAM) {
+            window = 0; /* prefetch only where the data streams */
+        }
+    }
+#endif
+    if (window == 0U) {
+        return SD_DiskRead(disk, buff, sector, count);
+    }
+    bool sequential = (sector == disk->ra_next);
+    disk->ra_next = sector + count;
+
+    uint32_t head = 0;
+    if (disk->ra_count > 0U && sector >= disk->ra_start &&
+        (sector - disk->ra_start) < disk->ra_count) {
+        head = disk->ra_count - (sector - disk->ra_start);
+    }
+    if (head >= count) {
+        (void)__atomic_fetch_add(&disk->sd->stats.readahead_hits, 1U, __ATOMIC_RELAXED);
+        memcpy(buff, &disk->ra_buf[(sector - disk->ra_start) * SD_DISK_SECTOR_SIZE],
+               count * SD_DISK_SECTOR_SIZE);
+        return SD_OK;
+    }
+    (void)__atomic_fetch_add(&disk->sd->stats.readahead_misses, 1U, __ATOMIC_RELAXED);
+
+    if (head > 0U) {
+        /* The window holds the start: copy it out while the card sends the rest. */
+        bool copying = sd_mem_copy_start(
+            buff, &disk->ra_buf[(sector - disk->ra_start) * SD_DISK_SECTOR_SIZE],
+            head * SD_DISK_SECTOR_SIZE);
+        SD_Status status = SD_DiskRead(disk, buff + (head * SD_DISK_SECTOR_SIZE), sector + head,
+                                       count - head);
+        if (copying) {
+            sd_mem_copy_wait();
+        }
+        return status;
+    }
+
+    if (!sequential || count >= window) {
+        return SD_DiskRead(disk, buff, sector, count);
+    }
+
+    uint32_t capacity = SD_DiskSectors(disk);
+    if (capacity > 0U && sector < capacity && window > capacity - sector) {
+        window = capacity - sector;
+    }
+#if (SD_DISK_POLICY_RANGES > 0U)
+    if (range != NULL && window > range->start + range->count - sector) {
+        window = range->start + range->count - sector;
+    }
+#endif
+    if (window <= count) {
+        return SD_DiskRead(disk, buff, sector, count);
+    }
+
+    disk->ra_count = 0;
+    SD_Status status = SD_DiskRead(disk, disk->ra_buf, sector, window);
+    if (status != SD_OK) {
+        return status;
+    }
+    disk->ra_start = sector;
+    disk->ra_count = window;
+    memcpy(buff, disk->ra_buf, count * SD_DISK_SECTOR_SIZE);
+    return SD_OK;
+}
+#endif
+
+#if (SD_FAT_CACHE_GROUPS > 0U)
+/* Groups in use: as built until SD_DiskSetCacheSize. */
+static uint32_t SD_FatGroups(const SD_DiskState *disk) {
+    return disk->tuned ? disk->fat_active : SD_FAT_CACHE_GROUPS;
+}
+
+static bool SD_FatRegionHas(const SD_DiskState *disk, uint32_t sector) {
+    return (disk->fat_count > 0U) && ((sector - disk->fat_first) < disk->fat_count) &&
+           SD_FatGroups(disk) > 0U;
+}
+
+/*
+ * Single-sector read inside the FAT region. A miss loads the sector together
+ * with the FAT sectors that follow it, since chain walks move forward.
+ */
+static SD_Status SD_FatCacheRead(SD_DiskState *disk, uint8_t *buff, uint32_t sector) {
+    uint32_t victim = 0;
+    for (uint32_t i = 0; i < SD_FatGroups(disk); i++) {
+        SD_FatGroup *group = &disk->fat_groups[i];
+        if (group->count > 0U && (sector - group->start) < group->count) {
+            memcpy(buff, &disk->fat_buf[i][(sector - group->start) * SD_DISK_SECTOR_SIZE],
+                   SD_DISK_SECTOR_SIZE);
+            group->stamp = ++disk->fat_clock;
+            disk->fat_hits++;
+            return SD_OK;
+        }
+        if (disk->fat_groups[victim].count > 0U &&
+            (group->count == 0U || group->stamp < disk->fat_groups[victim].stamp)) {
+            victim = i;
+        }
+    }
+
+    uint32_t span = SD_FAT_CACHE_SPAN;
+    uint32_t left = disk->fat_first + disk->fat_count - sector;
+    if (span > left) {
+        span = left;
+    }
+    SD_FatGroup *group = &disk->fat_groups[victim];
+    disk->fat_misses++;
+    if (group->count > 0U) {
+        disk->fat_evictions++;
+    }
+    group->count = 0;
+    SD_Status status = SD_DiskRead(disk, disk->fat_buf[victim], sector, span);
+    if (status != SD_OK) {
+        return status;
+    }
+    group->start = sector;
+    group->count = span;
+    group->stamp = ++disk->fat_clock;
+    memcpy(buff, disk->fat_buf[victim], SD_DISK_SECTOR_SIZE);
+    return SD_OK;
+}
+
+/* Refresh (written) or drop (unknown contents) cached FAT sectors in a range. */
+static void SD_FatCacheApply(SD_DiskState *disk, const uint8_t *buff, uint32_t sector,
+                             uint32_t count) {
+    for (uint32_t i = 0; i < SD_FAT_CACHE_GROUPS; i++) {
+        SD_FatGroup *group = &disk->fat_groups[i];
+        for (uint32_t k = 0; k < group->count; k++) {
+            uint32_t offset = group->start + k - sector;
+            if (offset >= count) {
+                continue;
+            }
+            if (buff == NULL) {
+                group->count = 0;
+                break;
+            }
+            memcpy(&disk->fat_buf[i][k * SD_DISK_SECTOR_SIZE],
+                   buff + (offset * SD_DISK_SECTOR_SIZE), SD_DISK_SECTOR_SIZE);
+        }
+    }
+}
+#endif
+
+void SD_DiskSetSectorLimit(BYTE pdrv, uint32_t sectors) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (disk) {
+        disk->limit = sectors;
+    }
+}
+
+SD_Status SD_DiskSetReadOnly(BYTE pdrv, bool read_only) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || disk->batch_depth > 0U) {
+        return SD_PARAM;
+    }
+    /* Stale FAT mirrors are brought up to date while writes are still allowed. */
+    if (read_only && !disk->read_only && SD_IsInitialized(disk->sd)) {
+        SD_Status status = SD_DiskMirrorFlush(pdrv);
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+#if SD_CACHE_ENABLED
+    /* Nothing dirty may be left behind that a later write-back would send. */
+    if (read_only && !disk->read_only && SD_IsInitialized(disk->sd)) {
+        SD_Status status = SD_CacheFlush(disk->sd);
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+#endif
+    disk->read_only = read_only;
+    return SD_OK;
+}
+
+bool SD_DiskIsReadOnly(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    return disk != NULL && disk->read_only;
+}
+
+static void SD_DiskReset(BYTE pdrv);
+
+SD_Status SD_DiskSetExternal(BYTE pdrv, bool external) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || disk->batch_depth > 0U) {
+        return SD_PARAM;
+    }
+    if (external && !disk->external && SD_IsInitialized(disk->sd) && !disk->read_only) {
+        SD_Status status = SD_DiskMirrorFlush(pdrv);
+#if SD_CACHE_ENABLED
+        if (status == SD_OK) {
+            status = SD_CacheFlush(disk->sd);
+        }
+#if (SD_CACHE_JOURNAL == 1)
+        /* The holder writes FAT and directories too: no replay may undo them. */
+        if (status == SD_OK) {
+            status = SD_CacheJournalVoid(disk->sd);
+        }
+#endif
+#endif
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+    SD_DiskReset(pdrv);
+    disk->external = external;
+    return SD_OK;
+}
+
+bool SD_DiskIsExternal(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    return disk != NULL && disk->external;
+}
+
+/* STA_PROTECT on a read-only drive, so FatFs refuses writes with FR_WRITE_PROTECTED. */
+static DSTATUS SD_DiskProtect(BYTE drv, DSTATUS status) {
+    return SD_DiskIsReadOnly(drv) ? (DSTATUS)(status | STA_PROTECT) : status;
+}
+
+void SD_DiskSetFatRegion(BYTE pdrv, uint32_t first_sector, uint32_t sector_count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return;
+    }
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    memset(disk->fat_groups, 0, sizeof(disk->fat_groups));
+    disk->fat_first = first_sector;
+    disk->fat_count = sector_count;
+#else
+    (void)first_sector;
+    (void)sector_count;
+#endif
+}
+
+void SD_DiskSetMetaRegion(BYTE pdrv, uint32_t first_sector, uint32_t sector_count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (disk) {
+        disk->meta_first = first_sector;
+        disk->meta_count = sector_count;
+    }
+}
+
+void SD_DiskSetCacheRegions(BYTE pdrv, uint32_t fat_sector, uint32_t dir_sector,
+                            uint32_t data_sector) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+#if SD_CACHE_ENABLED
+    if (disk) {
+        SD_CacheSetRegions(disk->sd, fat_sector * SD_DISK_SECTOR_BLOCKS,
+                           dir_sector * SD_DISK_SECTOR_BLOCKS, data_sector * SD_DISK_SECTOR_BLOCKS);
+    }
+#else
+    (void)disk;
+    (void)fat_sector;
+    (void)dir_sector;
+    (void)data_sector;
+#endif
+}
+
+void SD_DiskGetCacheStats(BYTE pdrv, SD_DiskCacheStats *out) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || !out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+#if SD_CACHE_ENABLED
+    SD_CacheGetStats(&out->sectors);
+#endif
+#if (SD_READAHEAD_SECTORS > 0U)
+    out->readahead_window = SD_ReadAheadWindow(disk);
+    out->readahead_hits = disk->sd->stats.readahead_hits;
+    out->readahead_misses = disk->sd->stats.readahead_misses;
+#endif
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    out->fat_groups = SD_FatGroups(disk);
+    out->fat_hits = disk->fat_hits;
+    out->fat_misses = disk->fat_misses;
+    out->fat_evictions = disk->fat_evictions;
+#endif
+}
+
+void SD_DiskResetCacheStats(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return;
+    }
+#if SD_CACHE_ENABLED
+    SD_CacheResetStats();
+#endif
+    disk->sd->stats.readahead_hits = 0;
+    disk->sd->stats.readahead_misses = 0;
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    disk->fat_hits = 0;
+    disk->fat_misses = 0;
+    disk->fat_evictions = 0;
+#endif
+}
+
+SD_Status SD_DiskSetCacheSize(BYTE pdrv, SD_DiskCache cache, uint32_t size) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return SD_PARAM;
+    }
+    if (!disk->tuned) {
+        disk->ra_window = SD_READAHEAD_SECTORS;
+        disk->fat_active = SD_FAT_CACHE_GROUPS;
+        disk->tuned = true;
+    }
+    switch (cache) {
+    case SD_DISK_CACHE_SECTORS:
+#if SD_CACHE_ENABLED
+        return SD_CacheSetLines(size);
+#else
+        return (size == 0U) ? SD_OK : SD_PARAM;
+#endif
+    case SD_DISK_CACHE_READAHEAD:
+        if (size > SD_READAHEAD_SECTORS) {
+            return SD_PARAM;
+        }
+#if (SD_READAHEAD_SECTORS > 0U)
+        disk->ra_count = 0;
+#endif
+        disk->ra_window = size;
+        return SD_OK;
+    case SD_DISK_CACHE_FAT:
+        if (size > SD_FAT_CACHE_GROUPS) {
+            return SD_PARAM;
+        }
+#if (SD_FAT_CACHE_GROUPS > 0U)
+        for (uint32_t i = size; i < SD_FAT_CACHE_GROUPS; i++) {
+            disk->fat_groups[i].count = 0;
+        }
+#endif
+        disk->fat_active = size;
+        return SD_OK;
+    default:
+        return SD_PARAM;
+    }
+}
+
+#if (SD_UNWRITTEN_RANGES > 0U)
+static bool SD_UnwrittenHas(const SD_DiskState *disk, uint32_t sector) {
+    for (uint32_t i = 0; i < SD_UNWRITTEN_RANGES; i++) {
+        if ((sector - disk->unwritten[i].start) < disk->unwritten[i].count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Sectors [sector, sector + count) now hold data: cut them out of every range. */
+static void SD_UnwrittenClear(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    uint32_t end = sector + count;
+    for (uint32_t i = 0; i < SD_UNWRITTEN_RANGES; i++) {
+        SD_Unwritten *r = &disk->unwritten[i];
+        uint32_t r_end = r->start + r->count;
+        if (r->count == 0U || end <= r->start || sector >= r_end) {
+            continue;
+        }
+        uint32_t head = (sector > r->start) ? sector - r->start : 0U;
+        uint32_t tail = (r_end > end) ? r_end - end : 0U;
+        /* Writes usually advance from the front; keep the larger remainder. */
+        if (tail >= head) {
+            r->start = r_end - tail;
+            r->count = tail;
+        } else {
+            r->count = head;
+        }
+    }
+}
+#endif
+
+void SD_DiskMarkUnwritten(BYTE pdrv, uint32_t first_sector, uint32_t sector_count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return;
+    }
+#if (SD_UNWRITTEN_RANGES > 0U)
+    if (sector_count == 0U) {
+        memset(disk->unwritten, 0, sizeof(disk->unwritten));
+        return;
+    }
+    SD_UnwrittenClear(disk, first_sector, sector_count); /* no overlapping ranges */
+    SD_Unwritten *slot = &disk->unwritten[0];
+    for (uint32_t i = 1; i < SD_UNWRITTEN_RANGES; i++) {
+        if (disk->unwritten[i].count < slot->count) {
+            slot = &disk->unwritten[i];
+        }
+    }
+    if (slot->count < sector_count) {
+        slot->start = first_sector;
+        slot->count = sector_count;
+    }
+#else
+    (void)first_sector;
+    (void)sector_count;
+#endif
+}
+
+/* Forget cached/prefetched copies of a sector range (card contents changed or unknown). */
+static void SD_DiskInvalidate(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+#if (SD_READAHEAD_SECTORS > 0U)
+    SD_ReadAheadInvalidate(disk, sector, count);
+#endif
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    SD_FatCacheApply(disk, NULL, sector, count);
+#endif
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    SD_BatchDrop(disk, sector, count);
+#endif
+#if (SD_DISK_POLICY_RANGES > 0U)
+    SD_PolicyWritten(disk, NULL, sector, count);
+#endif
+    (void)disk;
+    (void)sector;
+    (void)count;
+}
+
+/* Keep RAM copies coherent after a write; failed writes leave the card contents unknown. */
+static void SD_DiskWritten(SD_DiskState *disk, const uint8_t *buff, uint32_t sector,
+                           uint32_t count, bool ok) {
+#if (SD_UNWRITTEN_RANGES > 0U)
+    SD_UnwrittenClear(disk, sector, count); /* even a failed write leaves them undefined */
+#endif
+#if (SD_READAHEAD_SECTORS > 0U)
+    SD_ReadAheadInvalidate(disk, sector, count);
+#endif
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    SD_FatCacheApply(disk, ok ? buff : NULL, sector, count);
+#endif
+#if (SD_DISK_POLICY_RANGES > 0U)
+    SD_PolicyWritten(disk, ok ? buff : NULL, sector, count);
+#endif
+    (void)disk;
+    (void)buff;
+    (void)sector;
+    (void)count;
+    (void)ok;
+}
+
+#if (SD_FAT_MIRROR_RANGES > 0U)
+static bool SD_MirrorPending(const SD_DiskState *disk) {
+    for (uint32_t i = 0; i < SD_FAT_MIRROR_RANGES; i++) {
+        if (disk->mirror_stale[i].count > 0U) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Mark FAT sectors [rel, rel + count) stale in the mirrors, merging ranges they touch. */
+static void SD_MirrorMark(SD_DiskState *disk, uint32_t rel, uint32_t count) {
+    uint32_t end = rel + count;
+    SD_MirrorRange *slot = NULL;
+    if (!SD_MirrorPending(disk)) {
+        disk->mirror_tick = HAL_GetTick();
+    }
+    for (uint32_t i = 0; i < SD_FAT_MIRROR_RANGES; i++) {
+        SD_MirrorRange *r = &disk->mirror_stale[i];
+        if (r->count > 0U && end >= r->start && rel <= r->start + r->count) {
+            end = (r->start + r->count > end) ? r->start + r->count : end;
+            rel = (r->start < rel) ? r->start : rel;
+            r->count = 0; /* absorbed */
+        }
+        if (r->count == 0U && slot == NULL) {
+            slot = r;
+        }
+    }
+    if (slot == NULL) {
+        /* Every slot taken: widen the nearest range, no other range lies in the gap. */
+        uint32_t best_gap = UINT32_MAX;
+        for (uint32_t i = 0; i < SD_FAT_MIRROR_RANGES; i++) {
+            SD_MirrorRange *r = &disk->mirror_stale[i];
+            uint32_t gap = (rel >= r->start + r->count) ? rel - (r->start + r->count)
+                                                        : r->start - end;
+            if (gap < best_gap) {
+                best_gap = gap;
+                slot = r;
+            }
+        }
+        end = (slot->start + slot->count > end) ? slot->start + slot->count : end;
+        rel = (slot->start < rel) ? slot->start : rel;
+    }
+    slot->start = rel;
+    slot->count = end - rel;
+}
+
+/* A write that lies inside one mirror FAT: mark it instead (true = nothing to write). */
+static bool SD_MirrorDefer(SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    if (disk->mirror_count == 0U || sector < disk->mirror_fat + disk->mirror_size) {
+        return false;
+    }
+    uint32_t off = sector - disk->mirror_fat - disk->mirror_size;
+    if (off >= disk->mirror_size * disk->mirror_count) {
+        return false;
+    }
+    uint32_t rel = off % disk->mirror_size;
+    if (count > disk->mirror_size - rel) {
+        return false; /* spans two FATs: not a FatFs mirror write */
+    }
+    SD_MirrorMark(disk, rel, count);
+    disk->mirror_stats.deferred += count;
+    return true;
+}
+
+/* True if [sector, sector + count) reads a mirror FAT while any of it is stale. */
+static bool SD_MirrorStale(const SD_DiskState *disk, uint32_t sector, uint32_t count) {
+    uint32_t first = disk->mirror_fat + disk->mirror_size;
+    return disk->mirror_count > 0U && sector < first + disk->mirror_size * disk->mirror_count &&
+           sector + count > first && SD_MirrorPending(disk);
+}
+
+/* Copy the stale sectors from the first FAT to every mirror, a chunk per read. */
+static SD_Status SD_MirrorCopy(SD_DiskState *disk) {
+    bool ran = false;
+    for (uint32_t i = 0; i < SD_FAT_MIRROR_RANGES; i++) {
+        SD_MirrorRange *r = &disk->mirror_stale[i];
+        while (r->count > 0U) {
+            uint32_t n = (r->count < SD_FAT_MIRROR_CHUNK) ? r->count : SD_FAT_MIRROR_CHUNK;
+            SD_Status status = SD_DiskRead(disk, disk->mirror_buf, disk->mirror_fat + r->start, n);
+            for (uint32_t m = 1; m <= disk->mirror_count && status == SD_OK; m++) {
+                uint32_t sector = disk->mirror_fat + m * disk->mirror_size + r->start;
+#if (SD_DISK_BATCH_SECTORS > 0U)
+                SD_BatchDrop(disk, sector, n);
+#endif
+                status = SD_DiskWriteCard(disk, disk->mirror_buf, sector, n);
+                SD_DiskWritten(disk, disk->mirror_buf, sector, n, status == SD_OK);
+                disk->mirror_stats.copied += (status == SD_OK) ? n : 0U;
+            }
+            if (status != SD_OK) {
+                return status; /* the range keeps what is left, this chunk included */
+            }
+            ran = true;
+            r->start += n;
+            r->count -= n;
+        }
+    }
+    disk->mirror_stats.copies += ran ? 1U : 0U;
+    return SD_OK;
+}
+#endif
+
+void SD_DiskSetFatMirror(BYTE pdrv, uint32_t fat_sector, uint32_t fat_sectors,
+                         uint32_t fat_count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return;
+    }
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    memset(disk->mirror_stale, 0, sizeof(disk->mirror_stale));
+    disk->mirror_fat = fat_sector;
+    disk->mirror_size = fat_sectors;
+    disk->mirror_count = (fat_sectors > 0U && fat_count > 1U) ? fat_count - 1U : 0U;
+#else
+    (void)fat_sector;
+    (void)fat_sectors;
+    (void)fat_count;
+#endif
+}
+
+SD_Status SD_DiskMirrorFlush(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return SD_PARAM;
+    }
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    if (!SD_MirrorPending(disk)) {
+        return SD_OK;
+    }
+    if (disk->read_only) {
+        return SD_ERROR;
+    }
+    return SD_MirrorCopy(disk);
+#else
+    return SD_OK;
+#endif
+}
+
+SD_Status SD_DiskMirrorPoll(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return SD_PARAM;
+    }
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    if (!SD_MirrorPending(disk) || (HAL_GetTick() - disk->mirror_tick) < SD_FAT_MIRROR_IDLE_MS) {
+        return SD_OK;
+    }
+#endif
+    return SD_DiskMirrorFlush(pdrv);
+}
+
+void SD_DiskGetMirrorStats(BYTE pdrv, SD_DiskMirrorStats *out) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    if (disk) {
+        *out = disk->mirror_stats;
+        for (uint32_t i = 0; i < SD_FAT_MIRROR_RANGES; i++) {
+            out->stale += disk->mirror_stale[i].count;
+        }
+    }
+#else
+    (void)disk;
+#endif
+}
+
+#if (SD_DISK_BATCH_SECTORS > 0U)
+/* Slot for a new sector: a free one, else the least recently used clean one; -1 if all are dirty. */
+static int SD_BatchClaim(const SD_DiskState *disk) {
+    int victim = -1;
+    for (uint32_t i = 0; i < SD_DISK_BATCH_SECTORS; i++) {
+        const SD_BatchSlot *slot = &disk->batch[i];
+        if (!slot->used) {
+            return (int)i;
+        }
+        if (!slot->dirty && (victim < 0 || slot->stamp < disk->batch[victim].stamp)) {
+            victim = (int)i;
+        }
+    }
+    return victim;
+}
+
+/* Write every held sector back, lowest first; a failed one is dropped with its cached copies. */
+static SD_Status SD_BatchFlush(SD_DiskState *disk) {
+    SD_Status result = SD_OK;
+    for (;;) {
+        int next = -1;
+        for (uint32_t i = 0; i < SD_DISK_BATCH_SECTORS; i++) {
+            const SD_BatchSlot *slot = &disk->batch[i];
+            if (slot->used && slot->dirty &&
+                (next < 0 || slot->sector < disk->batch[next].sector)) {
+                next = (int)i;
+            }
+        }
+        if (next < 0) {
+            return result;
+        }
+        SD_BatchSlot *slot = &disk->batch[next];
+        slot->dirty = false;
+        SD_Status status = SD_DiskWriteCard(disk, disk->batch_buf[next], slot->sector, 1U);
+        if (status != SD_OK) {
+            slot->used = false;
+            SD_DiskWritten(disk, NULL, slot->sector, 1U, false);
+            if (result == SD_OK) {
+                result = status;
+            }
+        }
+    }
+}
+
+static SD_Status SD_BatchWrite(SD_DiskState *disk, const uint8_t *buff, uint32_t sector) {
+    int slot = SD_BatchFind(disk, sector);
+    if (slot < 0) {
+        slot = SD_BatchClaim(disk);
+    }
+    if (slot < 0) {
+        SD_Status status = SD_BatchFlush(disk);
+        if (status != SD_OK) {
+            return status;
+        }
+        slot = SD_BatchClaim(disk);
+    }
+    memcpy(disk->batch_buf[slot], buff, SD_DISK_SECTOR_SIZE);
+    disk->batch[slot] = (SD_BatchSlot){sector, ++disk->batch_clock, true, true};
+    return SD_OK;
+}
+
+/* Keep a sector just read; FAT sectors are left to the FAT cache and dirty slots are never evicted. */
+static void SD_BatchKeep(SD_DiskState *disk, const uint8_t *buff, uint32_t sector) {
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    if (SD_FatRegionHas(disk, sector)) {
+        return;
+    }
+#endif
+    int slot = SD_BatchClaim(disk);
+    if (slot < 0) {
+        return;
+    }
+    memcpy(disk->batch_buf[slot], buff, SD_DISK_SECTOR_SIZE);
+    disk->batch[slot] = (SD_BatchSlot){sector, ++disk->batch_clock, true, false};
+}
+#endif
+
+SD_Status SD_DiskBatchBegin(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return SD_PARAM;
+    }
+    disk->batch_depth++;
+    return SD_OK;
+}
+
+SD_Status SD_DiskBatchEnd(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || disk->batch_depth == 0U) {
+        return SD_PARAM;
+    }
+    if (--disk->batch_depth > 0U) {
+        return SD_OK;
+    }
+
+    SD_Status status = SD_OK;
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    status = SD_BatchFlush(disk);
+    SD_BatchDrop(disk, 0, UINT32_MAX);
+#endif
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    SD_Status mirrored = disk->read_only ? SD_OK : SD_MirrorCopy(disk);
+    if (status == SD_OK) {
+        status = mirrored;
+    }
+#endif
+#if SD_CACHE_ENABLED
+    SD_Status flushed = SD_CacheFlush(disk->sd);
+    if (status == SD_OK) {
+        status = flushed;
+    }
+#endif
+    SD_Status synced = SD_Sync(disk->sd);
+    return (status != SD_OK) ? status : synced;
+}
+
+SD_Status SD_DiskReadShared(BYTE pdrv, uint8_t *buff, uint32_t sector, uint32_t count) {
+    SD_Handle_t *sd = SD_DiskHandle(pdrv);
+    if (!sd || !buff || count == 0U) {
+        return SD_PARAM;
+    }
+    if (SD_DiskIsExternal(pdrv)) {
+        return SD_BUSY;
+    }
+#if SD_CACHE_ENABLED
+    return SD_CacheRead(sd, buff, sector * SD_DISK_SECTOR_BLOCKS, count * SD_DISK_SECTOR_BLOCKS);
+#else
+    return SD_ReadBlocks(sd, buff, sector * SD_DISK_SECTOR_BLOCKS, count * SD_DISK_SECTOR_BLOCKS);
+#endif
+}
+
+#if (SD_DISK_POLICY_RANGES > 0U)
+/* Read from a resident range, loading all of it with one read the first time. */
+static SD_Status SD_PolicyResidentRead(SD_DiskState *disk, SD_PolicyRange *range, uint8_t *buff,
+                                       uint32_t sector, uint32_t count) {
+    if (!range->loaded) {
+        SD_Status status = SD_DiskRead(disk, range->ram, range->start, range->count);
+        if (status != SD_OK) {
+            return status;
+        }
+        range->loaded = true;
+        disk->policy_stats.resident_loads++;
+    }
+    disk->policy_stats.resident_hits++;
+    memcpy(buff, &range->ram[(sector - range->start) * SD_DISK_SECTOR_SIZE],
+           count * SD_DISK_SECTOR_SIZE);
+    return SD_OK;
+}
+#endif
+
+SD_Status SD_DiskSetPolicy(BYTE pdrv, uint32_t first_sector, uint32_t sector_count,
+                           SD_DiskPolicy policy, void *ram, uint32_t ram_size) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || disk->batch_depth > 0U || policy > SD_DISK_POLICY_STREAM) {
+        return SD_PARAM;
+    }
+#if (SD_DISK_POLICY_RANGES > 0U)
+    if (policy != SD_DISK_POLICY_DEFAULT &&
+        (sector_count == 0U || first_sector + sector_count < first_sector ||
+         (policy == SD_DISK_POLICY_RESIDENT &&
+          (ram == NULL || ram_size / SD_DISK_SECTOR_SIZE < sector_count)))) {
+        return SD_PARAM;
+    }
+    SD_PolicyRange *slot = NULL;
+    SD_PolicyRange *free_slot = NULL;
+    for (uint32_t i = 0; i < SD_DISK_POLICY_RANGES; i++) {
+        SD_PolicyRange *r = &disk->ranges[i];
+        if (r->count == 0U) {
+            free_slot = (free_slot != NULL) ? free_slot : r;
+        } else if (r->start == first_sector) {
+            slot = r;
+        } else if (policy != SD_DISK_POLICY_DEFAULT && first_sector < r->start + r->count &&
+                   r->start < first_sector + sector_count) {
+            return SD_PARAM;
+        }
+    }
+    if (slot == NULL && policy == SD_DISK_POLICY_DEFAULT) {
+        return SD_OK;
+    }
+    slot = (slot != NULL) ? slot : free_slot;
+    if (slot == NULL) {
+        return SD_PARAM;
+    }
+    if (policy != SD_DISK_POLICY_DEFAULT) {
+#if SD_CACHE_ENABLED
+        /* Nothing of the range may stay dirty behind a path that no longer looks at it. */
+        SD_Status status = SD_CacheFlush(disk->sd);
+        if (status != SD_OK) {
+            return status;
+        }
+        SD_CacheDiscard(disk->sd, first_sector * SD_DISK_SECTOR_BLOCKS,
+                        sector_count * SD_DISK_SECTOR_BLOCKS);
+#endif
+        SD_DiskInvalidate(disk, first_sector, sector_count);
+    }
+    if (slot->count > 0U && slot->policy == SD_DISK_POLICY_STREAM) {
+        disk->stream_ranges--;
+    }
+    slot->start = first_sector;
+    slot->count = (policy != SD_DISK_POLICY_DEFAULT) ? sector_count : 0U;
+    slot->policy = policy;
+    slot->ram = (policy == SD_DISK_POLICY_RESIDENT) ? (uint8_t *)ram : NULL;
+    slot->loaded = false;
+    if (policy == SD_DISK_POLICY_STREAM) {
+        disk->stream_ranges++;
+    }
+    return SD_OK;
+#else
+    (void)first_sector;
+    (void)sector_count;
+    (void)ram;
+    (void)ram_size;
+    return (policy == SD_DISK_POLICY_DEFAULT) ? SD_OK : SD_PARAM;
+#endif
+}
+
+void SD_DiskGetPolicyStats(BYTE pdrv, SD_DiskPolicyStats *out) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || !out) {
+        return;
+    }
+#if (SD_DISK_POLICY_RANGES > 0U)
+    *out = disk->policy_stats;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
+
+#if (SD_WARM_SECTORS > 0U)
+/* Count a read of sector; space-saving replacement once every entry is taken. */
+static void SD_WarmSample(SD_DiskState *disk, uint32_t sector) {
+    if (disk->warm_skip > 0U) {
+        disk->warm_skip--;
+        return;
+    }
+    disk->warm_skip = SD_WARM_SAMPLE - 1U;
+    SD_WarmEntry *least = &disk->warm[0];
+    for (uint32_t i = 0; i < SD_WARM_SECTORS; i++) {
+        SD_WarmEntry *e = &disk->warm[i];
+        if (e->hits > 0U && e->sector == sector) {
+            e->hits++;
+            return;
+        }
+        if (e->hits < least->hits) {
+            least = e;
+        }
+    }
+    least->sector = sector;
+    least->hits++; /* 1 for a free entry; inherits the count it displaces otherwise */
+}
+#endif
+
+uint32_t SD_DiskWarmList(BYTE pdrv, uint32_t *sectors, uint32_t max) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || !sectors) {
+        return 0;
+    }
+    uint32_t n = 0;
+#if (SD_WARM_SECTORS > 0U)
+    uint32_t below = UINT32_MAX; /* counts taken so far are at least this */
+    while (n < max) {
+        uint32_t best = SD_WARM_SECTORS;
+        for (uint32_t i = 0; i < SD_WARM_SECTORS; i++) {
+            const SD_WarmEntry *e = &disk->warm[i];
+            if (e->hits > 0U && e->hits < below &&
+                (best == SD_WARM_SECTORS || e->hits > disk->warm[best].hits)) {
+                best = i;
+            }
+        }
+        if (best == SD_WARM_SECTORS) {
+            break;
+        }
+        below = disk->warm[best].hits;
+        /* Every entry with that count, in slot order. */
+        for (uint32_t i = 0; i < SD_WARM_SECTORS && n < max; i++) {
+            if (disk->warm[i].hits == below) {
+                sectors[n++] = disk->warm[i].sector;
+            }
+        }
+    }
+#else
+    (void)max;
+#endif
+    return n;
+}
+
+SD_Status SD_DiskWarmRun(BYTE pdrv, const uint32_t *sectors, uint32_t count, uint8_t *buff,
+                         uint32_t buff_sectors, uint32_t *used) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (used != NULL) {
+        *used = 0;
+    }
+    if (!disk || !sectors || !buff || !used || count == 0U || buff_sectors == 0U) {
+        return SD_PARAM;
+    }
+#if SD_CACHE_ENABLED && (SD_WARM_SECTORS > 0U)
+    if (disk->external || disk->batch_depth > 0U) {
+        return SD_BUSY;
+    }
+    if (!SD_IsInitialized(disk->sd) || !SD_IsCardPresent(disk->sd)) {
+        return SD_NO_MEDIA;
+    }
+    uint32_t first = sectors[0];
+    uint32_t n = 1;
+    while (n < count && sectors[n] >= sectors[n - 1U] &&
+           sectors[n] - sectors[n - 1U] <= SD_WARM_GAP + 1U && sectors[n] - first < buff_sectors) {
+        n++;
+    }
+    *used = n;
+    uint32_t span = sectors[n - 1U] - first + 1U;
+    uint32_t card = SD_DiskSectors(disk);
+    if (first >= card || span > card - first) {
+        return SD_OK; /* a list saved from another card */
+    }
+    SD_Status status = SD_DiskRead(disk, buff, first, span);
+    if (status != SD_OK) {
+        return status;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == 0U || sectors[i] != sectors[i - 1U]) {
+            SD_CacheFill(disk->sd, &buff[(sectors[i] - first) * SD_DISK_SECTOR_SIZE],
+                         sectors[i] * SD_DISK_SECTOR_BLOCKS, SD_DISK_SECTOR_BLOCKS);
+        }
+    }
+    return SD_OK;
+#else
+    return SD_UNSUPPORTED;
+#endif
+}
+
+static void SD_DiskReset(BYTE pdrv) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+#if SD_CACHE_ENABLED
+    SD_CacheDiscard(disk->sd, 0, UINT32_MAX);
+#endif
+#if (SD_READAHEAD_SECTORS > 0U)
+    disk->ra_count = 0;
+    disk->ra_next = UINT32_MAX;
+#endif
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    SD_BatchDrop(disk, 0, UINT32_MAX); /* batch_depth belongs to the caller */
+#endif
+#if (SD_DISK_POLICY_RANGES > 0U)
+    SD_PolicyWritten(disk, NULL, 0, UINT32_MAX); /* ranges stay; the card may be another */
+#endif
+#if (SD_WARM_SECTORS > 0U)
+    memset(disk->warm, 0, sizeof(disk->warm));
+    disk->warm_skip = 0;
+#endif
+    (void)disk;
+    SD_DiskSetFatRegion(pdrv, 0, 0); /* re-registered after the next mount */
+    SD_DiskSetMetaRegion(pdrv, 0, 0);
+    SD_DiskSetCacheRegions(pdrv, 0, 0, 0);
+    SD_DiskSetFatMirror(pdrv, 0, 0, 0);
+    SD_DiskMarkUnwritten(pdrv, 0, 0);
+}
+
 SD_Status SD_DiskIoInit(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin, bool use_dma) {
-    return SD_Init(&g_sd_handle, hspi, cs_port, cs_pin, use_dma);
+    return SD_DiskIoInitDrive(0, hspi, cs_port, cs_pin, use_dma);
+}
+
+SD_Status SD_DiskIoInitDrive(BYTE pdrv, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port,
+                             uint16_t cs_pin, bool use_dma) {
+    SD_Handle_t *sd = SD_DiskHandle(pdrv);
+    if (!sd) {
+        return SD_PARAM;
+    }
+    SD_DiskReset(pdrv);
+    return SD_Init(sd, hspi, cs_port, cs_pin, use_dma);
 }
 
 DSTATUS SD_disk_status(BYTE drv) {
-    if (drv != 0) {
+    SD_Handle_t *sd = SD_DiskHandle(drv);
+    if (!sd) {
         return STA_NOINIT;
     }
 
-    if (!SD_IsCardPresent(&g_sd_handle)) {
+    if (!SD_IsCardPresent(sd)) {
+        SD_DiskReset(drv); /* nowhere left to write dirty sectors */
         return STA_NODISK | STA_NOINIT;
     }
-    return SD_IsInitialized(&g_sd_handle) ? 0 : STA_NOINIT;
+    if (SD_DiskIsExternal(drv)) {
+        return STA_NOINIT;
+    }
+    return SD_DiskProtect(drv, SD_IsInitialized(sd) ? 0 : STA_NOINIT);
 }
 
-DSTATUS SD_disk_initialize(BYTE drv) {
-    if (drv != 0) {
+static DSTATUS SD_DiskDoInitialize(BYTE drv) {
+    SD_Handle_t *sd = SD_DiskHandle(drv);
+    if (!sd) {
         return STA_NOINIT;
     }
 
-    if (!SD_IsCardPresent(&g_sd_handle)) {
+    if (!SD_IsCardPresent(sd)) {
         return STA_NODISK | STA_NOINIT;
     }
+    if (SD_DiskIsExternal(drv)) {
+        return STA_NOINIT;
+    }
+
+#if (SD_FAST_MOUNT == 1)
+    /* Same card, never powered down: the session and the caches behind it stay valid. */
+    if (SD_IsInitialized(sd) && SD_CheckStatus(sd) == SD_OK) {
+        return 0;
+    }
+#endif
 
-    if (SD_SPI_Init(&g_sd_handle) == SD_OK) {
+    /* The socket may hold a different card than the one identified last. */
+    if (SD_Reattach(sd) == SD_OK) {
+        SD_DiskReset(drv);
+#if SD_CACHE_ENABLED && (SD_CACHE_JOURNAL == 1)
+        /* Finish the write-back a power loss interrupted before FatFs reads the FAT. */
+        if (SD_CacheJournalReplay(sd, NULL) != SD_OK) {
+            return STA_NOINIT;
+        }
+#endif
         return 0;
     }
     return STA_NOINIT;
 }
 
-DRESULT SD_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
-    if (pdrv != 0 || count == 0 || buff == NULL) {
+static DRESULT SD_DiskDoRead(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || count == 0 || buff == NULL) {
         return RES_PARERR;
     }
 
-    if (!SD_IsInitialized(&g_sd_handle) || !SD_IsCardPresent(&g_sd_handle)) {
+    if (!SD_IsInitialized(disk->sd) || !SD_IsCardPresent(disk->sd) || disk->external) {
         return RES_NOTRDY;
     }
 
-    SD_Status status = SD_ReadBlocks(&g_sd_handle, buff, sector, count);
+    SD_Status status;
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    /* The first FAT is authoritative: bring a stale mirror up to date before it is read. */
+    if (SD_MirrorStale(disk, sector, count) && !disk->read_only &&
+        SD_MirrorCopy(disk) != SD_OK) {
+        return RES_ERROR;
+    }
+#endif
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    bool batching = (disk->batch_depth > 0U && count == 1U);
+    if (batching) {
+        int slot = SD_BatchFind(disk, sector);
+        if (slot >= 0) {
+            memcpy(buff, disk->batch_buf[slot], SD_DISK_SECTOR_SIZE);
+            disk->batch[slot].stamp = ++disk->batch_clock;
+            return RES_OK;
+        }
+    }
+#endif
+#if (SD_UNWRITTEN_RANGES > 0U)
+    if (count == 1U && SD_UnwrittenHas(disk, sector)) {
+        memset(buff, 0, SD_DISK_SECTOR_SIZE); /* f_write's read-before-modify of a fresh sector */
+        (void)__atomic_fetch_add(&disk->sd->stats.rmw_avoided, 1U, __ATOMIC_RELAXED);
+        return RES_OK;
+    }
+#endif
+#if (SD_DISK_POLICY_RANGES > 0U)
+    SD_PolicyRange *range = SD_PolicyFind(disk, sector, count);
+    if (range != NULL && range->policy == SD_DISK_POLICY_RESIDENT) {
+        status = SD_PolicyResidentRead(disk, range, buff, sector, count);
+    } else
+#endif
+#if (SD_FAT_CACHE_GROUPS > 0U)
+    if (count == 1U && SD_FatRegionHas(disk, sector)) {
+        status = SD_FatCacheRead(disk, buff, sector);
+    } else
+#endif
+    {
+#if (SD_READAHEAD_SECTORS > 0U)
+        status = SD_ReadAheadRead(disk, buff, sector, count);
+#else
+        status = SD_DiskRead(disk, buff, sector, count);
+#endif
+    }
     if (status == SD_OK) {
+#if (SD_DISK_BATCH_SECTORS > 0U)
+        if (batching) {
+            SD_BatchKeep(disk, buff, sector);
+        }
+#endif
+#if (SD_WARM_SECTORS > 0U)
+        if (count == 1U) {
+            SD_WarmSample(disk, sector);
+        }
+#endif
         return RES_OK;
     }
     if (status == SD_NO_MEDIA || status == SD_BUSY) {
@@ -62,16 +1421,40 @@ DRESULT SD_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
     return RES_ERROR;
 }
 
-DRESULT SD_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
-    if (pdrv != 0 || count == 0 || buff == NULL) {
+static DRESULT SD_DiskDoWrite(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk || count == 0 || buff == NULL) {
         return RES_PARERR;
     }
 
-    if (!SD_IsInitialized(&g_sd_handle) || !SD_IsCardPresent(&g_sd_handle)) {
+    if (!SD_IsInitialized(disk->sd) || !SD_IsCardPresent(disk->sd) || disk->external) {
         return RES_NOTRDY;
     }
+    if (SD_DiskPastLimit(disk, sector, count)) {
+        return RES_PARERR;
+    }
+    if (disk->read_only) {
+        return RES_WRPRT;
+    }
+#if (SD_FAT_MIRROR_RANGES > 0U)
+    if (SD_MirrorDefer(disk, sector, count)) {
+        return RES_OK;
+    }
+#endif
 
-    SD_Status status = SD_WriteBlocks(&g_sd_handle, (const uint8_t *)buff, sector, count);
+    SD_Status status;
+#if (SD_DISK_BATCH_SECTORS > 0U)
+    if (disk->batch_depth > 0U && count == 1U) {
+        status = SD_BatchWrite(disk, (const uint8_t *)buff, sector);
+    } else
+#endif
+    {
+#if (SD_DISK_BATCH_SECTORS > 0U)
+        SD_BatchDrop(disk, sector, count); /* superseded by this write */
+#endif
+        status = SD_DiskWriteCard(disk, (const uint8_t *)buff, sector, count);
+    }
+    SD_DiskWritten(disk, (const uint8_t *)buff, sector, count, status == SD_OK);
     if (status == SD_OK) {
         return RES_OK;
     }
@@ -81,31 +1464,415 @@ DRESULT SD_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
     return RES_ERROR;
 }
 
-DRESULT SD_disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
-    if (pdrv != 0) {
+/* Segments go out as one SD_WriteBlocksV; the sector cache and batch slots take them one by one. */
+static DRESULT SD_DiskDoWriteV(BYTE pdrv, const SD_IoVec *iov, uint32_t iovcnt, DWORD sector,
+                               uint32_t *count) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    *count = 0;
+    if (!disk || iov == NULL || iovcnt == 0U) {
         return RES_PARERR;
     }
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        if (iov[i].base == NULL || iov[i].len == 0U || (iov[i].len % SD_DISK_SECTOR_SIZE) != 0U) {
+            return RES_PARERR;
+        }
+        *count += iov[i].len / SD_DISK_SECTOR_SIZE;
+    }
+    if (disk->external) {
+        return RES_NOTRDY;
+    }
+    if (disk->read_only) {
+        return RES_WRPRT;
+    }
+    if (SD_CACHE_ENABLED || disk->batch_depth > 0U) {
+        uint32_t s = sector;
+        for (uint32_t i = 0; i < iovcnt; i++) {
+            uint32_t n = iov[i].len / SD_DISK_SECTOR_SIZE;
+            DRESULT res = SD_DiskDoWrite(pdrv, (const BYTE *)iov[i].base, s, n);
+            if (res != RES_OK) {
+                return res;
+            }
+            s += n;
+        }
+        return RES_OK;
+    }
+
+    if (!SD_IsInitialized(disk->sd) || !SD_IsCardPresent(disk->sd) || disk->external) {
+        return RES_NOTRDY;
+    }
+    if (SD_DiskPastLimit(disk, sector, *count)) {
+        return RES_PARERR;
+    }
+    SD_Status status = SD_WriteBlocksV(disk->sd, iov, iovcnt, sector * SD_DISK_SECTOR_BLOCKS);
+    uint32_t s = sector;
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        uint32_t n = iov[i].len / SD_DISK_SECTOR_SIZE;
+        SD_DiskWritten(disk, (const uint8_t *)iov[i].base, s, n, status == SD_OK);
+        s += n;
+    }
+    if (status == SD_OK) {
+        return RES_OK;
+    }
+    if (status == SD_NO_MEDIA || status == SD_BUSY) {
+        return RES_NOTRDY;
+    }
+    return RES_ERROR;
+}
+
+static DRESULT SD_DiskDoIoctl(BYTE pdrv, BYTE cmd, void *buff) {
+    SD_DiskState *disk = SD_Disk(pdrv);
+    if (!disk) {
+        return RES_PARERR;
+    }
+    if (disk->external) {
+        return RES_NOTRDY;
+    }
 
     switch (cmd) {
     case CTRL_SYNC:
-        return (SD_Sync(&g_sd_handle) == SD_OK) ? RES_OK : RES_ERROR;
+        if (disk->batch_depth > 0U || disk->read_only) {
+            return RES_OK; /* SD_DiskBatchEnd writes back and syncs; read-only has nothing */
+        }
+#if (SD_FAT_MIRROR_RANGES > 0U)
+        if (SD_MirrorCopy(disk) != SD_OK) return RES_ERROR;
+#endif
+#if SD_CACHE_ENABLED
+        if (SD_CacheFlush(disk->sd) != SD_OK) return RES_ERROR;
+#endif
+        return (SD_Sync(disk->sd) == SD_OK) ? RES_OK : RES_ERROR;
+    case SD_CTRL_SYNC_DATA:
+    case SD_CTRL_BARRIER:
+        if (disk->batch_depth > 0U || disk->read_only) {
+            return RES_OK;
+        }
+#if (SD_FAT_MIRROR_RANGES > 0U)
+        /* Mirror copies are metadata: through the cache they wait for the barrier's second half. */
+        if (cmd == SD_CTRL_BARRIER && SD_MirrorCopy(disk) != SD_OK) return RES_ERROR;
+#endif
+#if SD_CACHE_ENABLED
+        if (SD_CacheFlushExcept(disk->sd, disk->meta_first * SD_DISK_SECTOR_BLOCKS,
+                                disk->meta_count * SD_DISK_SECTOR_BLOCKS) != SD_OK) {
+            return RES_ERROR;
+        }
+        if (cmd == SD_CTRL_BARRIER && disk->meta_count > 0U) {
+            /* Data programmed before the first metadata sector is sent. */
+            if (SD_Sync(disk->sd) != SD_OK || SD_CacheFlush(disk->sd) != SD_OK) {
+                return RES_ERROR;
+            }
+        }
+#endif
+        return (SD_Sync(disk->sd) == SD_OK) ? RES_OK : RES_ERROR;
     case GET_SECTOR_SIZE:
         if (buff == NULL) return RES_PARERR;
-        *(WORD *)buff = SD_BLOCK_SIZE;
+        *(WORD *)buff = SD_DISK_SECTOR_SIZE;
         return RES_OK;
     case GET_SECTOR_COUNT:
         if (buff == NULL) return RES_PARERR;
-        *(DWORD *)buff = SD_GetBlockCount(&g_sd_handle);
+        *(DWORD *)buff = SD_DiskSectors(disk);
         return (*(DWORD *)buff > 0) ? RES_OK : RES_ERROR;
-    case GET_BLOCK_SIZE:
+    case GET_BLOCK_SIZE: {
+        /* f_mkfs wants a power of two up to 32768; an SDXC 12/24 MiB AU gives its 4/8 MiB factor. */
         if (buff == NULL) return RES_PARERR;
-        *(DWORD *)buff = 1;
+        uint32_t blocks = 1;
+        if (SD_GetEraseBlockSize(disk->sd, &blocks) != SD_OK) return RES_ERROR;
+        blocks &= ~(blocks - 1U);
+        blocks = (blocks > SD_DISK_SECTOR_BLOCKS) ? blocks / SD_DISK_SECTOR_BLOCKS : 1U;
+        *(DWORD *)buff = (blocks > 32768U) ? 32768U : blocks;
         return RES_OK;
+    }
+    case CTRL_TRIM: {
+        /* buff -> DWORD[2]: first and last sector of the freed range (inclusive). */
+        if (buff == NULL) return RES_PARERR;
+        const DWORD *range = (const DWORD *)buff;
+        if (range[1] < range[0]) return RES_PARERR;
+        if (disk->read_only) return RES_WRPRT;
+        if (SD_DiskPastLimit(disk, range[0], range[1] - range[0] + 1U)) return RES_PARERR;
+        SD_DiskInvalidate(disk, range[0], range[1] - range[0] + 1U);
+        uint32_t first = range[0] * SD_DISK_SECTOR_BLOCKS;
+        uint32_t blocks = (range[1] - range[0] + 1U) * SD_DISK_SECTOR_BLOCKS;
+#if SD_CACHE_ENABLED
+        SD_CacheDiscard(disk->sd, first, blocks);
+#endif
+        SD_Status status = SD_EraseBlocks(disk->sd, first, blocks);
+        if (status == SD_OK) return RES_OK;
+        return (status == SD_PARAM) ? RES_PARERR : RES_ERROR;
+    }
     default:
         return RES_PARERR;
     }
 }
 
+#if (SD_DISK_CAPTURE_ENTRIES > 0U)
+#define SD_CAPTURE_MASK (SD_DISK_CAPTURE_ENTRIES - 1U)
+
+static SD_DiskCaptureRecord s_capture[SD_DISK_CAPTURE_ENTRIES];
+static uint32_t s_capture_head; // Records claimed since SD_DiskCaptureStart (atomic)
+static uint32_t s_capture_tail; // Next record to read
+static uint32_t s_capture_dropped;
+static volatile bool s_capturing;
+
+static void SD_DiskCaptureAdd(SD_DiskOp op, BYTE pdrv, uint32_t sector, uint32_t count,
+                              DRESULT res, uint32_t start) {
+    if (!s_capturing) {
+        return;
+    }
+    uint32_t now = DWT->CYCCNT;
+    uint32_t index = __atomic_fetch_add(&s_capture_head, 1U, __ATOMIC_RELAXED);
+    SD_DiskCaptureRecord *rec = &s_capture[index & SD_CAPTURE_MASK];
+    rec->time = start;
+    rec->duration = now - start;
+    rec->sector = sector;
+    rec->count = count;
+    rec->op = (uint8_t)op;
+    rec->pdrv = pdrv;
+    rec->result = (uint8_t)res;
+    rec->reserved = 0;
+}
+#define SD_CAPTURE_START() (DWT->CYCCNT)
+#define SD_CAPTURE(op, pdrv, sector, count, res, start) \
+    SD_DiskCaptureAdd((op), (pdrv), (uint32_t)(sector), (uint32_t)(count), (res), (start))
+#else
+#define SD_CAPTURE_START() 0U
+#define SD_CAPTURE(op, pdrv, sector, count, res, start) ((void)(sector), (void)(start))
+#endif
+
+void SD_DiskCaptureStart(void) {
+#if (SD_DISK_CAPTURE_ENTRIES > 0U)
+    s_capturing = false;
+    s_capture_tail = 0;
+    s_capture_dropped = 0;
+    __atomic_store_n(&s_capture_head, 0U, __ATOMIC_RELEASE);
+    s_capturing = true;
+#endif
+}
+
+void SD_DiskCaptureStop(void) {
+#if (SD_DISK_CAPTURE_ENTRIES > 0U)
+    s_capturing = false;
+#endif
+}
+
+uint32_t SD_DiskCaptureRead(SD_DiskCaptureRecord *out, uint32_t max) {
+    uint32_t n = 0;
+    if (!out) {
+        return 0;
+    }
+#if (SD_DISK_CAPTURE_ENTRIES > 0U)
+    uint32_t head = __atomic_load_n(&s_capture_head, __ATOMIC_ACQUIRE);
+    if (head - s_capture_tail > SD_DISK_CAPTURE_ENTRIES) {
+        s_capture_dropped += (head - s_capture_tail) - SD_DISK_CAPTURE_ENTRIES;
+        s_capture_tail = head - SD_DISK_CAPTURE_ENTRIES;
+    }
+    while (n < max && s_capture_tail != head) {
+        out[n++] = s_capture[s_capture_tail & SD_CAPTURE_MASK];
+        s_capture_tail++;
+    }
+#else
+    (void)max;
+#endif
+    return n;
+}
+
+uint32_t SD_DiskCaptureDropped(void) {
+#if (SD_DISK_CAPTURE_ENTRIES > 0U)
+    return s_capture_dropped;
+#else
+    return 0;
+#endif
+}
+
+int SD_DiskCaptureFormat(const SD_DiskCaptureRecord *rec, char *line, size_t len) {
+    if (!rec || !line) {
+        return -1;
+    }
+    return snprintf(line, len, "SDCAP,%u,%u,%lu,%lu,%u,%lu,%lu\r\n", rec->op, rec->pdrv,
+                    (unsigned long)rec->sector, (unsigned long)rec->count, rec->result,
+                    (unsigned long)rec->time, (unsigned long)rec->duration);
+}
+
+bool SD_DiskCaptureParse(const char *line, SD_DiskCaptureRecord *rec) {
+    if (!line || !rec || strncmp(line, "SDCAP,", 6) != 0) {
+        return false;
+    }
+    unsigned long field[7];
+    const char *p = line + 6;
+    for (uint32_t i = 0; i < 7U; i++) {
+        char *end = NULL;
+        field[i] = strtoul(p, &end, 10);
+        if (end == p || (i < 6U && *end != ',')) {
+            return false; /* the clock line fails on its first field */
+        }
+        p = end + 1;
+    }
+    if (field[0] > SD_DISK_OP_IOCTL || field[1] > 0xFFU || field[4] > 0xFFU) {
+        return false;
+    }
+    memset(rec, 0, sizeof(*rec));
+    rec->op = (uint8_t)field[0];
+    rec->pdrv = (uint8_t)field[1];
+    rec->sector = (uint32_t)field[2];
+    rec->count = (uint32_t)field[3];
+    rec->result = (uint8_t)field[4];
+    rec->time = (uint32_t)field[5];
+    rec->duration = (uint32_t)field[6];
+    return true;
+}
+
+void SD_DiskCaptureDump(void) {
+    SD_DiskCaptureRecord batch[8];
+    char line[96];
+    uint32_t n;
+    printf("SDCAP,clock,%lu\r\n", (unsigned long)SystemCoreClock);
+    while ((n = SD_DiskCaptureRead(batch, sizeof(batch) / sizeof(batch[0]))) > 0U) {
+        for (uint32_t i = 0; i < n; i++) {
+            (void)SD_DiskCaptureFormat(&batch[i], line, sizeof(line));
+            printf("%s", line);
+        }
+    }
+    if (SD_DiskCaptureDropped() > 0U) {
+        printf("SDCAP,dropped,%lu\r\n", (unsigned long)SD_DiskCaptureDropped());
+    }
+}
+
+/* One recorded call, transfers cut to the buffer. */
+static DRESULT SD_DiskReplayOne(const SD_DiskCaptureRecord *rec, uint8_t *buff,
+                                uint32_t buff_sectors) {
+    DRESULT res = RES_OK;
+    switch (rec->op) {
+    case SD_DISK_OP_READ:
+    case SD_DISK_OP_WRITE:
+        for (uint32_t done = 0; done < rec->count && res == RES_OK;) {
+            uint32_t n = rec->count - done;
+            if (n > buff_sectors) {
+                n = buff_sectors;
+            }
+            res = (rec->op == SD_DISK_OP_READ)
+                      ? SD_disk_read(rec->pdrv, buff, rec->sector + done, n)
+                      : SD_disk_write(rec->pdrv, buff, rec->sector + done, n);
+            done += n;
+        }
+        return res;
+    case SD_DISK_OP_SYNC:
+        return SD_disk_ioctl(rec->pdrv, CTRL_SYNC, NULL);
+    case SD_DISK_OP_TRIM: {
+        DWORD range[2] = {rec->sector, rec->sector + rec->count - 1U};
+        return (rec->count > 0U) ? SD_disk_ioctl(rec->pdrv, CTRL_TRIM, range) : RES_PARERR;
+    }
+    default:
+        return RES_OK; /* queries change nothing on the card */
+    }
+}
+
+SD_Status SD_DiskCaptureReplay(SD_DiskCaptureRecord *records, uint32_t count, uint8_t *buff,
+                               uint32_t buff_sectors, bool gaps) {
+    if (!records || !buff || buff_sectors == 0U) {
+        return SD_PARAM;
+    }
+    SD_Status status = SD_OK;
+    uint32_t cycles_per_ms = SystemCoreClock / 1000U;
+    uint32_t recorded_end = 0; /* end of the previous call as recorded */
+    for (uint32_t i = 0; i < count; i++) {
+        SD_DiskCaptureRecord *rec = &records[i];
+        int32_t idle = (int32_t)(rec->time - recorded_end);
+        recorded_end = rec->time + rec->duration;
+        if (gaps && i > 0U && idle > 0 && cycles_per_ms > 0U &&
+            (uint32_t)idle >= cycles_per_ms) {
+            HAL_Delay((uint32_t)idle / cycles_per_ms);
+        }
+        uint32_t start = DWT->CYCCNT;
+        DRESULT res = SD_DiskReplayOne(rec, buff, buff_sectors);
+        rec->duration = DWT->CYCCNT - start;
+        rec->time = start;
+        rec->result = (uint8_t)res;
+        if (res != RES_OK) {
+            status = SD_ERROR;
+        }
+    }
+    return status;
+}
+
+/* Public entry points: traced wrappers around the diskio bodies above. */
+DSTATUS SD_disk_initialize(BYTE drv) {
+    uint32_t start = SD_TRACE_START();
+    DSTATUS status = SD_DiskProtect(drv, SD_DiskDoInitialize(drv));
+    SD_TRACE(SD_TRACE_DISK_INIT, 0U, drv, 0U, status, 0U, start);
+    return status;
+}
+
+DRESULT SD_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    uint32_t start = SD_TRACE_START();
+    uint32_t cap_start = SD_CAPTURE_START();
+#if (SD_PROFILE_ENABLED == 1)
+    uint32_t prof_start = SD_PROF_START();
+#endif
+    DRESULT res = SD_DiskDoRead(pdrv, buff, sector, count);
+    SD_TRACE(SD_TRACE_DISK_READ, 0U, pdrv, sector, res, count, start);
+    SD_CAPTURE(SD_DISK_OP_READ, pdrv, sector, count, res, cap_start);
+#if (SD_PROFILE_ENABLED == 1)
+    SD_ProfDiskIo(pdrv, false, sector, count, prof_start);
+#endif
+    return res;
+}
+
+DRESULT SD_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    uint32_t start = SD_TRACE_START();
+    uint32_t cap_start = SD_CAPTURE_START();
+#if (SD_PROFILE_ENABLED == 1)
+    uint32_t prof_start = SD_PROF_START();
+#endif
+    DRESULT res = SD_DiskDoWrite(pdrv, buff, sector, count);
+    SD_TRACE(SD_TRACE_DISK_WRITE, 0U, pdrv, sector, res, count, start);
+    SD_CAPTURE(SD_DISK_OP_WRITE, pdrv, sector, count, res, cap_start);
+#if (SD_FREEMAP_GROUPS > 0U)
+    SD_FreeMapFatWritten(pdrv, sector, count);
+#endif
+#if (SD_FSCK_WINDOW_CLUSTERS > 0U)
+    SD_FsckFatWritten(pdrv, sector, count);
+#endif
+#if (SD_PROFILE_ENABLED == 1)
+    SD_ProfDiskIo(pdrv, true, sector, count, prof_start);
+#endif
+    return res;
+}
+
+DRESULT SD_disk_writev(BYTE pdrv, const SD_IoVec *iov, uint32_t iovcnt, DWORD sector) {
+    uint32_t count = 0;
+    uint32_t start = SD_TRACE_START();
+    uint32_t cap_start = SD_CAPTURE_START();
+#if (SD_PROFILE_ENABLED == 1)
+    uint32_t prof_start = SD_PROF_START();
+#endif
+    DRESULT res = SD_DiskDoWriteV(pdrv, iov, iovcnt, sector, &count);
+    SD_TRACE(SD_TRACE_DISK_WRITE, 0U, pdrv, sector, res, count, start);
+    SD_CAPTURE(SD_DISK_OP_WRITE, pdrv, sector, count, res, cap_start);
+#if (SD_FREEMAP_GROUPS > 0U)
+    SD_FreeMapFatWritten(pdrv, sector, count);
+#endif
+#if (SD_FSCK_WINDOW_CLUSTERS > 0U)
+    SD_FsckFatWritten(pdrv, sector, count);
+#endif
+#if (SD_PROFILE_ENABLED == 1)
+    SD_ProfDiskIo(pdrv, true, sector, count, prof_start);
+#endif
+    return res;
+}
+
+DRESULT SD_disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    uint32_t start = SD_TRACE_START();
+    uint32_t cap_start = SD_CAPTURE_START();
+    DRESULT res = SD_DiskDoIoctl(pdrv, cmd, buff);
+    SD_TRACE(SD_TRACE_DISK_IOCTL, 0U, pdrv, cmd, res, 0U, start);
+    if (cmd == CTRL_SYNC) {
+        SD_CAPTURE(SD_DISK_OP_SYNC, pdrv, 0U, 0U, res, cap_start);
+    } else if (cmd == CTRL_TRIM && buff != NULL) {
+        const DWORD *range = (const DWORD *)buff;
+        SD_CAPTURE(SD_DISK_OP_TRIM, pdrv, range[0], range[1] - range[0] + 1U, res, cap_start);
+    } else {
+        SD_CAPTURE(SD_DISK_OP_IOCTL, pdrv, cmd, 0U, res, cap_start);
+    }
+    return res;
+}
+
 const Diskio_drvTypeDef SD_Driver = {
     SD_disk_initialize,
     SD_disk_status,
@@ -0,0 +1,248 @@
+/*
+ * sd_energy.c
+ *
+ * Energy estimate of SD I/O from the driver's time split.
+ */
+
+#include "sd_spi.h"
+
+#if (SD_ENERGY_STATS == 1)
+
+#include "sd_energy.h"
+#include "sd_benchmark.h"
+#include "sd_cache.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *const s_op_names[SD_ENERGY_OPS] = {"cmd17", "cmd18", "cmd24", "cmd25"};
+static const char *const s_xfer_names[SD_XFER_COUNT] = {"poll", "irq", "dma"};
+
+void sd_energy_defaults(SD_EnergyModel *model) {
+    if (!model) {
+        return;
+    }
+    model->supply_mv = 3300U;
+    model->card_ua = 45000U;
+    model->bus_ua = 30000U;
+    model->selected_ua = 2000U;
+    model->standby_ua = 200U;
+}
+
+void sd_energy_sample(SD_Handle_t *sd_handle, SD_EnergySample *out) {
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    if (!sd_handle) {
+        return;
+    }
+    out->mark = DWT->CYCCNT;
+    out->card = sd_handle->stats.card_active_cycles;
+    out->bus = sd_handle->stats.bus_data_cycles;
+    out->selected = SD_SelectedCycles(sd_handle);
+}
+
+/* uW x ms = nJ; the microwatts stay far below 2^32, so 64 bits hold days of cycles. */
+static uint64_t sd_energy_nj(const SD_EnergyModel *model, uint32_t ua, uint64_t cycles) {
+    uint64_t uw = ((uint64_t)model->supply_mv * ua) / 1000U;
+    uint32_t per_ms = SystemCoreClock / 1000U;
+    return (uw * cycles) / (per_ms ? per_ms : 1U);
+}
+
+/* Fill the energy fields from the time split already in out. */
+static void sd_energy_finish(const SD_EnergyModel *model, SD_EnergyReport *out) {
+    out->card_nj = sd_energy_nj(model, model->card_ua, out->card_cycles);
+    out->bus_nj = sd_energy_nj(model, model->bus_ua, out->bus_cycles);
+    out->idle_nj = sd_energy_nj(model, model->selected_ua, out->idle_cycles);
+    out->standby_nj = sd_energy_nj(model, model->standby_ua, out->standby_cycles);
+    out->total_nj = out->card_nj + out->bus_nj + out->idle_nj + out->standby_nj;
+    out->nj_per_kb = out->bytes ? (uint32_t)((out->total_nj * 1024U) / out->bytes) : 0U;
+}
+
+void sd_energy_between(const SD_EnergyModel *model, const SD_EnergySample *from,
+                       const SD_EnergySample *to, uint64_t bytes, SD_EnergyReport *out) {
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    if (!model || !from || !to) {
+        return;
+    }
+    uint64_t selected = to->selected - from->selected;
+    out->bytes = bytes;
+    out->total_cycles = (uint32_t)(to->mark - from->mark);
+    out->card_cycles = to->card - from->card;
+    out->bus_cycles = to->bus - from->bus;
+    out->idle_cycles = (selected > out->card_cycles + out->bus_cycles)
+                           ? selected - out->card_cycles - out->bus_cycles
+                           : 0U;
+    out->standby_cycles = (out->total_cycles > selected) ? out->total_cycles - selected : 0U;
+    sd_energy_finish(model, out);
+}
+
+void sd_energy_of_op(const SD_EnergyModel *model, const SD_EnergyOp *op, SD_EnergyReport *out) {
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    if (!model || !op) {
+        return;
+    }
+    out->bytes = op->bytes;
+    out->total_cycles = op->total_cycles;
+    out->card_cycles = op->card_cycles;
+    out->bus_cycles = op->bus_cycles;
+    out->idle_cycles = op->idle_cycles;
+    sd_energy_finish(model, out);
+}
+
+int sd_energy_write(const SD_EnergyModel *model, const char *path, uint32_t file_bytes,
+                    uint32_t buf_bytes, SD_EnergyReport *out) {
+    SD_EnergySample from;
+    SD_EnergySample to;
+    SD_BenchResult bench;
+    if (!model || !path || !out) {
+        return FR_INVALID_PARAMETER;
+    }
+    sd_benchmark_cycles_init();
+    sd_energy_sample(&g_sd_handle, &from);
+    int res = sd_benchmark_file(path, true, file_bytes, buf_bytes, &bench);
+    sd_energy_sample(&g_sd_handle, &to);
+    sd_energy_between(model, &from, &to, file_bytes, out);
+    return res;
+}
+
+static unsigned long sd_energy_us(uint64_t cycles) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    return (unsigned long)(cycles / (per_us ? per_us : 1U));
+}
+
+static void sd_energy_line(const char *prefix, const char *tag, uint32_t ops,
+                           const SD_EnergyReport *r) {
+    printf("%s,%s,", prefix, tag);
+    if (ops > 0U) {
+        printf("%lu,", (unsigned long)ops);
+    }
+    printf("%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n",
+           (unsigned long)(r->bytes / 1024U), sd_energy_us(r->total_cycles) / 1000U,
+           sd_energy_us(r->card_cycles), sd_energy_us(r->bus_cycles),
+           sd_energy_us(r->idle_cycles), sd_energy_us(r->standby_cycles),
+           (unsigned long)(r->card_nj / 1000U), (unsigned long)(r->bus_nj / 1000U),
+           (unsigned long)(r->idle_nj / 1000U), (unsigned long)(r->standby_nj / 1000U),
+           (unsigned long)(r->total_nj / 1000U), (unsigned long)r->nj_per_kb);
+}
+
+void sd_energy_print(const char *tag, const SD_EnergyReport *r) {
+    if (tag && r) {
+        sd_energy_line("SDENERGY", tag, 0U, r);
+    }
+}
+
+void sd_energy_print_ops(const SD_EnergyModel *model, const SD_EnergyOp *ops) {
+    SD_EnergyReport r;
+    if (!model || !ops) {
+        return;
+    }
+    for (uint32_t i = 0; i < SD_ENERGY_OPS; i++) {
+        if (ops[i].ops == 0U) {
+            continue;
+        }
+        sd_energy_of_op(model, &ops[i], &r);
+        sd_energy_line("SDENERGY_OP", s_op_names[i], ops[i].ops, &r);
+    }
+}
+
+/* ops = after - before, entry by entry. */
+static void sd_energy_ops_delta(SD_EnergyOp *ops, const SD_EnergyOp *before) {
+    for (uint32_t i = 0; i < SD_ENERGY_OPS; i++) {
+        ops[i].ops -= before[i].ops;
+        ops[i].bytes -= before[i].bytes;
+        ops[i].total_cycles -= before[i].total_cycles;
+        ops[i].card_cycles -= before[i].card_cycles;
+        ops[i].bus_cycles -= before[i].bus_cycles;
+        ops[i].idle_cycles -= before[i].idle_cycles;
+    }
+}
+
+static int sd_energy_suite_run(const SD_EnergyModel *model, const char *path,
+                               uint32_t file_bytes, uint32_t buf_bytes, SD_XferMode mode,
+                               uint32_t lines) {
+    SD_EnergyOp before[SD_ENERGY_OPS];
+    SD_EnergyOp ops[SD_ENERGY_OPS];
+    SD_EnergyReport r;
+    char tag[32];
+
+    if (SD_SetTransport(&g_sd_handle, mode, g_sd_handle.xfer_threshold) != SD_OK) {
+        printf("SDENERGY,error,transport,%s\r\n", s_xfer_names[mode]);
+        return FR_OK;
+    }
+#if SD_CACHE_ENABLED
+    if (SD_CacheSetLines(lines) != SD_OK) {
+        return FR_DISK_ERR;
+    }
+#else
+    (void)lines;
+#endif
+    memcpy(before, g_sd_handle.stats.energy, sizeof(before));
+    int res = sd_energy_write(model, path, file_bytes, buf_bytes, &r);
+    if (res != FR_OK) {
+        printf("SDENERGY,error,write,%d\r\n", res);
+        return res;
+    }
+    memcpy(ops, g_sd_handle.stats.energy, sizeof(ops));
+    sd_energy_ops_delta(ops, before);
+    (void)snprintf(tag, sizeof(tag), "write_%s_cache%lu", s_xfer_names[mode],
+                   (unsigned long)lines);
+    sd_energy_print(tag, &r);
+    sd_energy_print_ops(model, ops);
+    return FR_OK;
+}
+
+int sd_energy_suite(const SD_EnergyModel *model, const char *path, uint32_t file_bytes,
+                    uint32_t buf_bytes) {
+    SD_EnergyModel defaults;
+    if (!path) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (!model) {
+        sd_energy_defaults(&defaults);
+        model = &defaults;
+    }
+    SD_XferMode mode = g_sd_handle.use_dma ? SD_XFER_DMA
+                       : g_sd_handle.use_irq ? SD_XFER_IRQ
+                                             : SD_XFER_POLL;
+    uint16_t threshold = g_sd_handle.xfer_threshold;
+#if SD_CACHE_ENABLED
+    const uint32_t cache_lines[] = {0U, SD_CACHE_LINES};
+    uint32_t lines_before = SD_CacheGetLines();
+#else
+    const uint32_t cache_lines[] = {0U};
+#endif
+    printf("SDENERGY,model,mv=%lu,card_ua=%lu,bus_ua=%lu,selected_ua=%lu,standby_ua=%lu\r\n",
+           (unsigned long)model->supply_mv, (unsigned long)model->card_ua,
+           (unsigned long)model->bus_ua, (unsigned long)model->selected_ua,
+           (unsigned long)model->standby_ua);
+    printf("SDENERGY,config,kb,ms,card_us,bus_us,idle_us,standby_us,card_uj,bus_uj,idle_uj,"
+           "standby_uj,uj,nj_per_kb\r\n");
+
+    int res = FR_OK;
+    for (uint32_t x = 0; x < SD_XFER_COUNT && res == FR_OK; x++) {
+        for (uint32_t c = 0; c < sizeof(cache_lines) / sizeof(cache_lines[0]) && res == FR_OK;
+             c++) {
+            res = sd_energy_suite_run(model, path, file_bytes, buf_bytes, (SD_XferMode)x,
+                                      cache_lines[c]);
+        }
+    }
+
+    (void)SD_SetTransport(&g_sd_handle, mode, threshold);
+#if SD_CACHE_ENABLED
+    (void)SD_CacheSetLines(lines_before);
+#endif
+    (void)f_unlink(path);
+    return res;
+}
+
+#endif /* SD_ENERGY_STATS */
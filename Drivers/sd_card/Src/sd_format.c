@@ -0,0 +1,596 @@
+/*
+ * sd_format.c
+ *
+ * SD-aware FAT formatter: SD Association cluster and boundary tables, an
+ * AU-aligned layout, and the metadata writes through the diskio layer.
+ */
+
+#include "sd_format.h"
+#include "diskio.h"
+#include <string.h>
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+#define SD_FMT_SECTOR      512U  /* unit of the capacity table */
+#define SD_FMT_ROOT_BYTES  16384U /* 512 root entries on FAT12/16 */
+#define SD_FMT_FAT32_RSV   32U
+#define SD_FMT_MAX_FAT12   4085U /* cluster counts FatFs and other hosts agree on */
+#define SD_FMT_MAX_FAT16   65525U
+#define SD_FMT_MAX_FAT32   0x0FFFFFF5UL
+#define SD_FMT_MAX_TRIES   16U
+
+/* exFAT volumes come from f_mkfs, which places them after the first track. */
+#define SD_FMT_EXFAT       (_FS_EXFAT && _USE_MKFS)
+#define SD_FMT_EXFAT_BASE  63U
+#define SD_FMT_EXFAT_RSV   32U   /* boot region and its backup */
+#define SD_FMT_EXFAT_MIN   0x1000U
+#define SD_FMT_MAX_EXFAT   0x7FFFFFFDUL
+
+/* SD Association File System Specification: recommendation by capacity. */
+typedef struct {
+    uint32_t max_sectors;
+    SD_FsType fs_type;
+    uint32_t cluster_sectors;
+    uint32_t boundary;
+} SD_FormatRule;
+
+static const SD_FormatRule s_rules[] = {
+    {16384U, SD_FS_FAT12, 16U, 16U},       /* up to 8 MiB */
+    {131072U, SD_FS_FAT12, 32U, 32U},      /* 64 MiB */
+    {524288U, SD_FS_FAT16, 32U, 64U},      /* 256 MiB */
+    {2097152U, SD_FS_FAT16, 32U, 128U},    /* 1 GiB */
+    {4194304U, SD_FS_FAT16, 64U, 128U},    /* 2 GiB */
+    {67108864U, SD_FS_FAT32, 64U, 8192U},  /* 32 GiB (SDHC) */
+#if SD_FMT_EXFAT
+    {1073741824U, SD_FS_EXFAT, 256U, 32768U}, /* 512 GiB (SDXC) */
+    {UINT32_MAX, SD_FS_EXFAT, 512U, 65536U}   /* 2 TiB */
+#else
+    {UINT32_MAX, SD_FS_FAT32, 128U, 32768U} /* SDXC; FAT32 in place of exFAT */
+#endif
+};
+
+static const SD_FormatRule *SD_FormatRuleFor(uint32_t sectors) {
+    uint32_t i = 0;
+    while (sectors > s_rules[i].max_sectors) {
+        i++;
+    }
+    return &s_rules[i];
+}
+
+static bool SD_FormatPow2(uint32_t v) {
+    return v != 0U && (v & (v - 1U)) == 0U;
+}
+
+static uint32_t SD_FormatRoundUp(uint32_t v, uint32_t unit) {
+    return ((v + unit - 1U) / unit) * unit;
+}
+
+/* The type FatFs will mount for n clusters; SD_FS_AUTO on the ambiguous counts. */
+static SD_FsType SD_FormatTypeFor(uint32_t n) {
+    if (n < SD_FMT_MAX_FAT12) {
+        return SD_FS_FAT12;
+    }
+    if (n > SD_FMT_MAX_FAT12 && n < SD_FMT_MAX_FAT16) {
+        return SD_FS_FAT16;
+    }
+    if (n > SD_FMT_MAX_FAT16 && n <= SD_FMT_MAX_FAT32) {
+        return SD_FS_FAT32;
+    }
+    return SD_FS_AUTO;
+}
+
+/* Lay out one type/cluster combination; false if the card is too small for it. */
+static bool SD_FormatTry(uint32_t sectors, uint32_t ss, uint32_t bu, SD_FsType type, uint32_t sc,
+                         SD_FormatLayout *l) {
+    memset(l, 0, sizeof(*l));
+    l->sector_size = ss;
+    l->fs_type = type;
+    l->boundary = bu;
+    l->cluster_sectors = sc;
+    l->partition_start = bu;
+    l->reserved_sectors =
+        SD_FormatRoundUp((type == SD_FS_FAT32) ? SD_FMT_FAT32_RSV : 1U, bu);
+    l->root_sectors = (type == SD_FS_FAT32) ? 0U : SD_FMT_ROOT_BYTES / ss;
+    if (sectors <= l->partition_start + l->reserved_sectors + l->root_sectors) {
+        return false;
+    }
+    l->partition_sectors = sectors - l->partition_start;
+
+    /* Size the FAT for every cluster the area could hold, then pad it to the boundary. */
+    uint32_t fat_start = l->partition_start + l->reserved_sectors;
+    uint32_t estimate = (l->partition_sectors - l->reserved_sectors - l->root_sectors) / sc + 2U;
+    uint64_t fat_bytes = (type == SD_FS_FAT12) ? ((uint64_t)estimate * 3U + 1U) / 2U :
+                         (uint64_t)estimate * ((type == SD_FS_FAT16) ? 2U : 4U);
+    uint32_t fat = (uint32_t)((fat_bytes + ss - 1U) / ss);
+    uint64_t meta_end = (uint64_t)fat_start + 2U * (uint64_t)fat + l->root_sectors;
+    if (meta_end + bu + sc > sectors) {
+        return false;
+    }
+    l->data_start = SD_FormatRoundUp((uint32_t)meta_end, bu);
+    l->fat_sectors = (l->data_start - fat_start - l->root_sectors) / 2U;
+    l->clusters = (sectors - l->data_start) / sc;
+
+    /* Stay off the counts where hosts disagree on the type: drop the last cluster. */
+    if (l->clusters == SD_FMT_MAX_FAT12 || l->clusters == SD_FMT_MAX_FAT16) {
+        l->clusters--;
+        l->partition_sectors -= sc;
+    }
+    return true;
+}
+
+/* FAT12 configuration volume of sectors at start: the smallest clusters that fit. */
+static bool SD_FormatPlanConfig(uint32_t start, uint32_t sectors, uint32_t ss, SD_FormatLayout *l) {
+    for (uint32_t sc = 1U; sc <= 128U; sc <<= 1) {
+        /* Planned as if it started at sector 1 of its own card, then moved into place. */
+        if (SD_FormatTry(sectors + 1U, ss, 1U, SD_FS_FAT12, sc, l) &&
+            SD_FormatTypeFor(l->clusters) == SD_FS_FAT12) {
+            l->partition_start += start - 1U;
+            l->data_start += start - 1U;
+            return true;
+        }
+    }
+    return false;
+}
+
+#if SD_FMT_EXFAT
+/* The layout f_mkfs(FM_EXFAT) writes with this cluster size; it aligns to GET_BLOCK_SIZE only. */
+static FRESULT SD_FormatPlanExFat(uint32_t sectors, uint32_t ss, uint32_t erase_block,
+                                  uint32_t sc, SD_FormatLayout *l) {
+    uint32_t blk = (SD_FormatPow2(erase_block) && erase_block <= 32768U) ? erase_block : 1U;
+    memset(l, 0, sizeof(*l));
+    l->sector_size = ss;
+    if (sectors < SD_FMT_EXFAT_BASE + SD_FMT_EXFAT_MIN) {
+        return FR_MKFS_ABORTED;
+    }
+    l->fs_type = SD_FS_EXFAT;
+    l->boundary = blk;
+    l->cluster_sectors = sc;
+    l->partition_start = SD_FMT_EXFAT_BASE;
+    l->partition_sectors = sectors - SD_FMT_EXFAT_BASE;
+    l->reserved_sectors = SD_FMT_EXFAT_RSV;
+    l->fat_sectors =
+        (uint32_t)((((uint64_t)(l->partition_sectors / sc) + 2U) * 4U + ss - 1U) / ss);
+    uint32_t fat_start = l->partition_start + l->reserved_sectors;
+    l->data_start = SD_FormatRoundUp(fat_start + l->fat_sectors, blk);
+    if (l->data_start >= l->partition_sectors / 2U) {
+        return FR_MKFS_ABORTED;
+    }
+    l->clusters = (l->partition_sectors - (l->data_start - l->partition_start)) / sc;
+    return (l->clusters < 16U || l->clusters > SD_FMT_MAX_EXFAT) ? FR_MKFS_ABORTED : FR_OK;
+}
+#endif
+
+/* Plan in sectors of ss bytes; the table and SD_FORMAT_MAX_BOUNDARY count 512-byte sectors. */
+static FRESULT SD_FormatPlanSized(uint32_t card_sectors, uint32_t ss, uint32_t erase_block,
+                                  const SD_FormatOptions *options, SD_FormatLayout *layout) {
+    static const SD_FormatOptions defaults = {0};
+    const SD_FormatOptions *opt = options ? options : &defaults;
+    uint32_t ratio = ss / SD_FMT_SECTOR;
+    uint32_t max_cluster = (opt->fs_type == SD_FS_EXFAT) ? 0x1000000U / ss : 128U;
+    if (!layout || opt->fs_type > SD_FS_EXFAT || (opt->fs_type == SD_FS_EXFAT && !SD_FMT_EXFAT) ||
+        (opt->cluster_sectors != 0U &&
+         (!SD_FormatPow2(opt->cluster_sectors) || opt->cluster_sectors > max_cluster)) ||
+        (opt->boundary != 0U && !SD_FormatPow2(opt->boundary)) ||
+        ((opt->raw_sectors != 0U || opt->config_sectors != 0U) && opt->fs_type == SD_FS_EXFAT)) {
+        return FR_INVALID_PARAMETER;
+    }
+
+    uint64_t bytes = (uint64_t)card_sectors * ss;
+    const SD_FormatRule *rule = SD_FormatRuleFor(
+        (bytes / SD_FMT_SECTOR > UINT32_MAX) ? UINT32_MAX : (uint32_t)(bytes / SD_FMT_SECTOR));
+    uint32_t bu = opt->boundary;
+    if (bu == 0U) {
+        /* GET_BLOCK_SIZE is already a power of two; 1 means the drive does not know. */
+        bu = (erase_block > 1U && SD_FormatPow2(erase_block)) ? erase_block :
+             (rule->boundary > ratio) ? rule->boundary / ratio : 1U;
+    }
+    while (bu > 1U && (bu > SD_FORMAT_MAX_BOUNDARY / ratio || bu > card_sectors / 64U)) {
+        bu >>= 1;
+    }
+
+    /* The raw region starts on a boundary; the volume gets everything before it. */
+    uint32_t raw_start = card_sectors;
+    if (opt->raw_sectors != 0U) {
+        uint32_t raw = SD_FormatRoundUp(opt->raw_sectors, bu);
+        if (raw == 0U || raw >= card_sectors / 2U) {
+            return FR_INVALID_PARAMETER;
+        }
+        raw_start = ((card_sectors - raw) / bu) * bu;
+    }
+    /* The configuration volume sits right before it, so the main volume keeps its start. */
+    uint32_t vol_end = raw_start;
+    SD_FormatLayout config;
+    if (opt->config_sectors != 0U) {
+        uint32_t cfg = SD_FormatRoundUp(opt->config_sectors, bu);
+        if (cfg == 0U || cfg >= raw_start / 2U) {
+            return FR_INVALID_PARAMETER;
+        }
+        vol_end = raw_start - cfg;
+        if (!SD_FormatPlanConfig(vol_end, cfg, ss, &config)) {
+            return FR_MKFS_ABORTED;
+        }
+    }
+
+    SD_FsType type = (opt->fs_type != SD_FS_AUTO) ? opt->fs_type : rule->fs_type;
+    uint32_t sc = (opt->cluster_sectors != 0U) ? opt->cluster_sectors :
+                  (rule->cluster_sectors > ratio) ? rule->cluster_sectors / ratio : 1U;
+    SD_FsType previous = SD_FS_AUTO;
+#if SD_FMT_EXFAT
+    if (type == SD_FS_EXFAT) {
+        if (vol_end != card_sectors) {
+            return FR_INVALID_PARAMETER; /* f_mkfs claims the whole card */
+        }
+        return SD_FormatPlanExFat(card_sectors, ss, erase_block, sc, layout);
+    }
+#endif
+    if (sc > 128U) {
+        sc = 128U; /* FAT forced on an exFAT-sized card */
+    }
+
+    for (uint32_t attempt = 0; attempt < SD_FMT_MAX_TRIES; attempt++) {
+        if (!SD_FormatTry(vol_end, ss, bu, type, sc, layout)) {
+            if (opt->cluster_sectors != 0U || sc == 1U) {
+                return FR_MKFS_ABORTED;
+            }
+            sc >>= 1; /* small card: smaller clusters leave room for the metadata */
+            continue;
+        }
+        SD_FsType fits = SD_FormatTypeFor(layout->clusters);
+        if (fits == type) {
+            if (raw_start != card_sectors) {
+                layout->raw_start = raw_start;
+                layout->raw_sectors = card_sectors - raw_start;
+            }
+            if (vol_end != raw_start) {
+                layout->config_start = config.partition_start;
+                layout->config_sectors = config.partition_sectors;
+            }
+            return FR_OK;
+        }
+        bool too_many = (fits == SD_FS_AUTO) || (fits > type);
+        if (opt->fs_type == SD_FS_AUTO && fits != SD_FS_AUTO && fits != previous) {
+            previous = type;
+            type = fits; /* the counts decide the type, as they do at mount */
+        } else if (opt->cluster_sectors == 0U && too_many && sc < 128U) {
+            sc <<= 1;
+        } else if (opt->cluster_sectors == 0U && !too_many && sc > 1U) {
+            sc >>= 1;
+        } else {
+            return FR_MKFS_ABORTED;
+        }
+    }
+    return FR_MKFS_ABORTED;
+}
+
+FRESULT SD_FormatPlan(uint32_t card_sectors, uint32_t erase_block,
+                      const SD_FormatOptions *options, SD_FormatLayout *layout) {
+    return SD_FormatPlanSized(card_sectors, SD_FMT_SECTOR, erase_block, options, layout);
+}
+
+/* -----------------------------------------------------------------------
+ * Sector images
+ * ----------------------------------------------------------------------- */
+
+static void SD_FormatPut16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void SD_FormatPut32(uint8_t *p, uint32_t v) {
+    SD_FormatPut16(p, v);
+    SD_FormatPut16(p + 2, v >> 16);
+}
+
+/* CHS of an LBA with 255 heads and 63 sectors per track, clamped past cylinder 1023. */
+static void SD_FormatChs(uint8_t *p, uint32_t lba) {
+    uint32_t cyl = lba / (255U * 63U);
+    if (cyl > 1023U) {
+        p[0] = 0xFEU;
+        p[1] = 0xFFU;
+        p[2] = 0xFFU;
+        return;
+    }
+    uint32_t head = (lba / 63U) % 255U;
+    uint32_t sect = lba % 63U + 1U;
+    p[0] = (uint8_t)head;
+    p[1] = (uint8_t)(((cyl >> 2) & 0xC0U) | sect);
+    p[2] = (uint8_t)cyl;
+}
+
+static void SD_FormatEntry(uint8_t *pte, uint8_t type, uint32_t start, uint32_t sectors) {
+    SD_FormatChs(&pte[1], start);
+    pte[4] = type;
+    SD_FormatChs(&pte[5], start + sectors - 1U);
+    SD_FormatPut32(&pte[8], start);
+    SD_FormatPut32(&pte[12], sectors);
+}
+
+static void SD_FormatMbr(uint8_t *s, const SD_FormatLayout *l) {
+    uint8_t *pte = &s[446];
+    uint8_t type = 0x0CU; /* FAT32, LBA */
+    if (l->fs_type == SD_FS_FAT12) {
+        type = 0x01U;
+    } else if (l->fs_type == SD_FS_FAT16) {
+        type = (l->partition_sectors < 0x10000UL) ? 0x04U : 0x06U;
+    }
+    memset(s, 0, l->sector_size);
+    SD_FormatEntry(pte, type, l->partition_start, l->partition_sectors);
+    if (l->config_sectors > 0U) {
+        pte += 16;
+        SD_FormatEntry(pte, 0x01U, l->config_start, l->config_sectors);
+    }
+    if (l->raw_sectors > 0U) {
+        pte += 16;
+        SD_FormatEntry(pte, SD_FORMAT_RAW_TYPE, l->raw_start, l->raw_sectors);
+    }
+    s[510] = 0x55U;
+    s[511] = 0xAAU;
+}
+
+static void SD_FormatBoot(uint8_t *s, const SD_FormatLayout *l, uint32_t volume_id) {
+    bool fat32 = (l->fs_type == SD_FS_FAT32);
+    memset(s, 0, l->sector_size);
+    s[0] = 0xEBU;
+    s[1] = fat32 ? 0x58U : 0x3CU;
+    s[2] = 0x90U;
+    memcpy(&s[3], "MSDOS5.0", 8);
+    SD_FormatPut16(&s[11], l->sector_size);
+    s[13] = (uint8_t)l->cluster_sectors;
+    SD_FormatPut16(&s[14], l->reserved_sectors);
+    s[16] = 2U; /* FATs */
+    SD_FormatPut16(&s[17], fat32 ? 0U : SD_FMT_ROOT_BYTES / 32U);
+    if (!fat32 && l->partition_sectors < 0x10000UL) {
+        SD_FormatPut16(&s[19], l->partition_sectors);
+    } else {
+        SD_FormatPut32(&s[32], l->partition_sectors);
+    }
+    s[21] = 0xF8U; /* fixed media */
+    SD_FormatPut16(&s[24], 63U);
+    SD_FormatPut16(&s[26], 255U);
+    SD_FormatPut32(&s[28], l->partition_start); /* hidden sectors */
+
+    uint8_t *ext = &s[36];
+    if (fat32) {
+        SD_FormatPut32(&s[36], l->fat_sectors);
+        SD_FormatPut32(&s[44], 2U); /* root directory cluster */
+        SD_FormatPut16(&s[48], 1U); /* FSInfo */
+        SD_FormatPut16(&s[50], 6U); /* backup boot sector */
+        ext = &s[64];
+    } else {
+        SD_FormatPut16(&s[22], l->fat_sectors);
+    }
+    ext[0] = 0x80U; /* drive number */
+    ext[2] = 0x29U; /* extended boot signature */
+    SD_FormatPut32(&ext[3], volume_id);
+    memcpy(&ext[7], "NO NAME    ", 11);
+    memcpy(&ext[18], (l->fs_type == SD_FS_FAT12) ? "FAT12   " :
+                     (l->fs_type == SD_FS_FAT16) ? "FAT16   " : "FAT32   ", 8);
+    s[510] = 0x55U;
+    s[511] = 0xAAU;
+}
+
+static void SD_FormatFsInfo(uint8_t *s, const SD_FormatLayout *l) {
+    memset(s, 0, l->sector_size);
+    SD_FormatPut32(&s[0], 0x41615252UL);
+    SD_FormatPut32(&s[484], 0x61417272UL);
+    SD_FormatPut32(&s[488], l->clusters - 1U); /* cluster 2 holds the root directory */
+    SD_FormatPut32(&s[492], 3U);
+    SD_FormatPut32(&s[508], 0xAA550000UL);
+}
+
+/* The first FAT sector: media and end-of-chain entries, plus the FAT32 root cluster. */
+static void SD_FormatFatHead(uint8_t *s, const SD_FormatLayout *l) {
+    SD_FsType type = l->fs_type;
+    memset(s, 0, l->sector_size);
+    if (type == SD_FS_FAT12) {
+        SD_FormatPut32(&s[0], 0x00FFFFF8UL);
+    } else if (type == SD_FS_FAT16) {
+        SD_FormatPut32(&s[0], 0xFFFFFFF8UL);
+    } else {
+        SD_FormatPut32(&s[0], 0x0FFFFFF8UL);
+        SD_FormatPut32(&s[4], 0x0FFFFFFFUL);
+        SD_FormatPut32(&s[8], 0x0FFFFFFFUL);
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Writes
+ * ----------------------------------------------------------------------- */
+
+static FRESULT SD_FormatWrite(BYTE pdrv, const uint8_t *buf, uint32_t sector, uint32_t count) {
+    return (disk_write(pdrv, buf, sector, count) == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+static FRESULT SD_FormatZero(BYTE pdrv, uint8_t *work, uint32_t work_sectors, uint32_t ss,
+                             uint32_t sector, uint32_t count) {
+    memset(work, 0, work_sectors * ss);
+    while (count > 0U) {
+        uint32_t n = (count < work_sectors) ? count : work_sectors;
+        FRESULT res = SD_FormatWrite(pdrv, work, sector, n);
+        if (res != FR_OK) {
+            return res;
+        }
+        sector += n;
+        count -= n;
+        if (count > 0U) {
+            SD_FORMAT_YIELD();
+        }
+    }
+    return FR_OK;
+}
+
+#if SD_FMT_EXFAT
+static FRESULT SD_FormatExFat(BYTE pdrv, const SD_FormatLayout *l, void *work, UINT work_len) {
+    /* Without _MULTI_PARTITION the logical drive number is the physical one. */
+    const TCHAR path[3] = {(TCHAR)('0' + pdrv), (TCHAR)':', (TCHAR)0};
+    return f_mkfs(path, FM_EXFAT, l->cluster_sectors * l->sector_size, work, work_len);
+}
+#endif
+
+/* FATs and root directory (FAT32: cluster 2), then the records that make it mountable. */
+static FRESULT SD_FormatVolume(BYTE pdrv, const SD_FormatLayout *l, uint8_t *buf,
+                               uint32_t work_sectors, uint32_t volume_id) {
+    uint32_t ss = l->sector_size;
+    uint32_t boot = l->partition_start;
+    uint32_t fat_start = boot + l->reserved_sectors;
+    bool fat32 = (l->fs_type == SD_FS_FAT32);
+
+    FRESULT res = SD_FormatZero(pdrv, buf, work_sectors, ss, fat_start,
+                                2U * l->fat_sectors + l->root_sectors);
+    if (res == FR_OK && fat32) {
+        res = SD_FormatZero(pdrv, buf, work_sectors, ss, l->data_start, l->cluster_sectors);
+    }
+    for (uint32_t i = 0; res == FR_OK && i < 2U; i++) {
+        SD_FormatFatHead(buf, l);
+        res = SD_FormatWrite(pdrv, buf, fat_start + i * l->fat_sectors, 1U);
+    }
+    if (res == FR_OK && fat32) {
+        SD_FormatFsInfo(buf, l);
+        res = SD_FormatWrite(pdrv, buf, boot + 1U, 1U);
+        if (res == FR_OK) {
+            res = SD_FormatWrite(pdrv, buf, boot + 7U, 1U);
+        }
+        if (res == FR_OK) {
+            SD_FormatBoot(buf, l, volume_id);
+            res = SD_FormatWrite(pdrv, buf, boot + 6U, 1U);
+        }
+    }
+    if (res == FR_OK) {
+        SD_FormatBoot(buf, l, volume_id);
+        res = SD_FormatWrite(pdrv, buf, boot, 1U);
+    }
+    return res;
+}
+
+/* Full format: discard the whole card. Drives without CTRL_TRIM answer RES_PARERR. */
+static FRESULT SD_FormatDiscard(BYTE pdrv, uint32_t sectors) {
+    for (uint32_t first = 0; first < sectors;) {
+        uint32_t n = sectors - first;
+        if (n > SD_FORMAT_ERASE_CHUNK) {
+            n = SD_FORMAT_ERASE_CHUNK;
+        }
+        DWORD range[2] = {first, first + n - 1U};
+        DRESULT res = disk_ioctl(pdrv, CTRL_TRIM, range);
+        if (res == RES_PARERR && first == 0U) {
+            return FR_OK;
+        }
+        if (res != RES_OK) {
+            return FR_DISK_ERR;
+        }
+        first += n;
+        if (first < sectors) {
+            SD_FORMAT_YIELD();
+        }
+    }
+    return FR_OK;
+}
+
+FRESULT SD_FormatDrive(BYTE pdrv, const SD_FormatOptions *options, void *work, UINT work_len,
+                       SD_FormatLayout *layout) {
+    if (!work) {
+        return FR_INVALID_PARAMETER;
+    }
+    DSTATUS stat = disk_initialize(pdrv);
+    if (stat & STA_NOINIT) {
+        return FR_NOT_READY;
+    }
+    if (stat & STA_PROTECT) {
+        return FR_WRITE_PROTECTED;
+    }
+#if (_MAX_SS != _MIN_SS)
+    WORD ss = 0;
+    if (disk_ioctl(pdrv, GET_SECTOR_SIZE, &ss) != RES_OK || ss < _MIN_SS || ss > _MAX_SS ||
+        !SD_FormatPow2(ss)) {
+        return FR_DISK_ERR;
+    }
+#else
+    WORD ss = _MAX_SS;
+#endif
+    if (work_len < ss) {
+        return FR_INVALID_PARAMETER;
+    }
+
+    DWORD sectors = 0;
+    DWORD erase_block = 1;
+    if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &sectors) != RES_OK || sectors == 0U) {
+        return FR_DISK_ERR;
+    }
+    if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &erase_block) != RES_OK) {
+        erase_block = 1;
+    }
+
+    SD_FormatLayout l;
+    FRESULT res = SD_FormatPlanSized(sectors, ss, erase_block, options, &l);
+    if (res != FR_OK) {
+        return res;
+    }
+
+#if SD_FMT_EXFAT
+    if (l.fs_type == SD_FS_EXFAT) {
+        if (!options || !options->quick) {
+            res = SD_FormatDiscard(pdrv, sectors);
+        }
+        if (res == FR_OK) {
+            res = SD_FormatExFat(pdrv, &l, work, work_len);
+        }
+        if (res == FR_OK && layout) {
+            *layout = l;
+        }
+        return res;
+    }
+#endif
+
+    uint8_t *buf = (uint8_t *)work;
+    uint32_t work_sectors = work_len / ss;
+    uint32_t volume_id = options ? options->volume_id : 0U;
+
+    if (!options || !options->quick) {
+        res = SD_FormatDiscard(pdrv, sectors);
+    }
+    if (res == FR_OK) {
+        res = SD_FormatVolume(pdrv, &l, buf, work_sectors, volume_id);
+    }
+    if (res == FR_OK && l.config_sectors > 0U) {
+        SD_FormatLayout config;
+        (void)SD_FormatPlanConfig(l.config_start, l.config_sectors, ss, &config);
+        res = SD_FormatVolume(pdrv, &config, buf, work_sectors, volume_id + 1U);
+    }
+    if (res == FR_OK) {
+        SD_FormatMbr(buf, &l);
+        res = SD_FormatWrite(pdrv, buf, 0U, 1U);
+    }
+    if (res == FR_OK && disk_ioctl(pdrv, CTRL_SYNC, NULL) != RES_OK) {
+        res = FR_DISK_ERR;
+    }
+    if (res == FR_OK && layout) {
+        *layout = l;
+    }
+    return res;
+}
+
+FRESULT SD_FormatFindRaw(BYTE pdrv, void *work, uint32_t *start, uint32_t *sectors) {
+    if (!work || !start || !sectors) {
+        return FR_INVALID_PARAMETER;
+    }
+    const uint8_t *s = (const uint8_t *)work;
+    if (disk_read(pdrv, (BYTE *)work, 0U, 1U) != RES_OK) {
+        return FR_DISK_ERR;
+    }
+    if (s[510] != 0x55U || s[511] != 0xAAU) {
+        return FR_NO_FILESYSTEM;
+    }
+    for (uint32_t i = 0; i < 4U; i++) {
+        const uint8_t *pte = &s[446U + 16U * i];
+        uint32_t count = (uint32_t)pte[12] | ((uint32_t)pte[13] << 8) |
+                         ((uint32_t)pte[14] << 16) | ((uint32_t)pte[15] << 24);
+        if (pte[4] == SD_FORMAT_RAW_TYPE && count > 0U) {
+            *start = (uint32_t)pte[8] | ((uint32_t)pte[9] << 8) | ((uint32_t)pte[10] << 16) |
+                     ((uint32_t)pte[11] << 24);
+            *sectors = count;
+            return FR_OK;
+        }
+    }
+    return FR_NO_FILE;
+}
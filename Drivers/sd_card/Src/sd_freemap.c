@@ -0,0 +1,478 @@
+/*
+ * sd_freemap.c
+ *
+ * Coarse free-cluster map: per-group free counts built by an incremental FAT
+ * scan and kept current from the diskio write path.
+ */
+
+#include "sd_freemap.h"
+#include "diskio.h"
+#include "sd_diskio_spi.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#if (SD_FREEMAP_GROUPS > 0U)
+
+static FATFS *s_fs;
+static WORD s_fs_id;
+static uint32_t s_count[SD_FREEMAP_GROUPS];           // Free clusters per group
+static uint8_t s_dirty[(SD_FREEMAP_GROUPS + 7U) / 8U]; // Group changed since counted
+static uint8_t s_sector[_MAX_SS] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint32_t s_groups;
+static uint32_t s_group_sectors; // FAT sectors per group
+static uint32_t s_per_sector;    // FAT entries per sector (128 FAT32, 256 FAT16 at 512 bytes)
+static uint32_t s_fat_sectors;   // FAT sectors holding entries below n_fatent
+static uint32_t s_scan;          // Next FAT sector of the first scan
+static uint32_t s_recounts;
+static bool s_done;
+static bool s_error;
+#if SD_FREEMAP_WEAR
+static DWORD s_wear;          // Wear cursor: hints search from here
+static uint32_t s_wear_laps;  // Times the cursor wrapped to the start of the volume
+#endif
+
+static bool SD_FreeMapValid(void) {
+    return s_fs != NULL && s_groups != 0U && s_fs->fs_type != 0U && s_fs->id == s_fs_id;
+}
+
+#if _FS_REENTRANT
+static bool SD_FreeMapLock(void) {
+    return ff_req_grant(s_fs->sobj) != 0;
+}
+
+static void SD_FreeMapUnlock(void) {
+    ff_rel_grant(s_fs->sobj);
+}
+#else
+static bool SD_FreeMapLock(void) {
+    return true;
+}
+
+static void SD_FreeMapUnlock(void) {
+}
+#endif
+
+static bool SD_FreeMapIsDirty(uint32_t group) {
+    return (s_dirty[group >> 3] & (1U << (group & 7U))) != 0U;
+}
+
+static void SD_FreeMapSetDirty(uint32_t group, bool dirty) {
+    if (dirty) {
+        s_dirty[group >> 3] |= (uint8_t)(1U << (group & 7U));
+    } else {
+        s_dirty[group >> 3] &= (uint8_t)~(1U << (group & 7U));
+    }
+}
+
+/* Clusters a group can hold: entries 0 and 1 are reserved, the last group is short. */
+static uint32_t SD_FreeMapCapacity(uint32_t group) {
+    uint32_t first = group * s_group_sectors * s_per_sector;
+    uint32_t last = first + s_group_sectors * s_per_sector;
+    if (first < 2U) {
+        first = 2U;
+    }
+    if (last > s_fs->n_fatent) {
+        last = s_fs->n_fatent;
+    }
+    return (last > first) ? last - first : 0U;
+}
+
+static DWORD SD_FreeMapGroupCluster(uint32_t group) {
+    DWORD clst = group * s_group_sectors * s_per_sector;
+    return (clst < 2U) ? 2U : clst;
+}
+
+/* Free entries in FAT sector rel; the window is used if FatFs holds that sector. */
+static bool SD_FreeMapCountSector(uint32_t rel, uint32_t *free_entries) {
+    DWORD sect = s_fs->fatbase + rel;
+    const BYTE *p = s_fs->win;
+    if (sect != s_fs->winsect) {
+        if (disk_read(s_fs->drv, s_sector, sect, 1) != RES_OK) {
+            return false;
+        }
+        p = s_sector;
+    }
+
+    uint32_t first = rel * s_per_sector;
+    uint32_t end = first + s_per_sector;
+    if (end > s_fs->n_fatent) {
+        end = s_fs->n_fatent;
+    }
+    uint32_t n = 0;
+    for (uint32_t e = (first < 2U) ? 2U : first; e < end; e++) {
+        uint32_t i = e - first;
+        uint32_t v;
+        if (s_fs->fs_type == FS_FAT32) {
+            v = ((uint32_t)p[i * 4U] | ((uint32_t)p[i * 4U + 1U] << 8) |
+                 ((uint32_t)p[i * 4U + 2U] << 16) | ((uint32_t)p[i * 4U + 3U] << 24)) &
+                0x0FFFFFFFU;
+        } else {
+            v = (uint32_t)p[i * 2U] | ((uint32_t)p[i * 2U + 1U] << 8);
+        }
+        n += (v == 0U) ? 1U : 0U;
+    }
+    *free_entries = n;
+    return true;
+}
+
+static bool SD_FreeMapRecount(uint32_t group) {
+    uint32_t first = group * s_group_sectors;
+    uint32_t end = first + s_group_sectors;
+    if (end > s_fat_sectors) {
+        end = s_fat_sectors;
+    }
+    uint32_t total = 0;
+    for (uint32_t rel = first; rel < end; rel++) {
+        uint32_t n;
+        if (!SD_FreeMapCountSector(rel, &n)) {
+            return false;
+        }
+        total += n;
+    }
+    s_count[group] = total;
+    SD_FreeMapSetDirty(group, false);
+    s_recounts++;
+    return true;
+}
+
+static uint32_t SD_FreeMapTotal(void) {
+    uint32_t total = 0;
+    for (uint32_t g = 0; g < s_groups; g++) {
+        total += s_count[g];
+    }
+    return total;
+}
+
+#if SD_FREEMAP_WEAR
+static void SD_FreeMapWearMove(DWORD clst) {
+    if (clst < 2U || clst >= s_fs->n_fatent) {
+        clst = 2U;
+    }
+    if (clst < s_wear) {
+        s_wear_laps++;
+    }
+    s_wear = clst;
+}
+
+/* Follow the allocator forward past the cursor; moves back (to a freed hole) are ignored. */
+static void SD_FreeMapWearFollow(void) {
+    DWORD last = s_fs->last_clst;
+    if (last >= s_wear && last < s_fs->n_fatent) {
+        SD_FreeMapWearMove(last + 1U);
+    }
+}
+#endif
+
+/* End of the first scan, under the lock: settle changed groups, then seed FatFs. */
+static void SD_FreeMapFinish(void) {
+    if ((s_fs->wflag & 1U) != 0U && s_fs->winsect >= s_fs->fatbase &&
+        s_fs->winsect - s_fs->fatbase < s_fat_sectors) {
+        SD_FreeMapSetDirty((s_fs->winsect - s_fs->fatbase) / s_group_sectors, true);
+    }
+    for (uint32_t g = 0; g < s_groups; g++) {
+        if (SD_FreeMapIsDirty(g) && !SD_FreeMapRecount(g)) {
+            s_error = true;
+            return;
+        }
+    }
+    s_done = true;
+
+    if (s_fs->free_clst > s_fs->n_fatent - 2U) {
+        s_fs->free_clst = SD_FreeMapTotal();
+        s_fs->fsi_flag |= 1U; /* FSINFO gets the count on the next sync */
+    }
+}
+
+void SD_FreeMapStart(FATFS *fs) {
+    s_fs = fs;
+    s_groups = 0;
+    s_done = false;
+    s_error = false;
+    s_scan = 0;
+    s_recounts = 0;
+    memset(s_count, 0, sizeof(s_count));
+    memset(s_dirty, 0, sizeof(s_dirty));
+    if (fs == NULL || (fs->fs_type != FS_FAT16 && fs->fs_type != FS_FAT32)) {
+        return;
+    }
+
+    s_fs_id = fs->id;
+    s_per_sector = SD_FS_SECTOR_SIZE(fs) / ((fs->fs_type == FS_FAT32) ? 4U : 2U);
+    s_fat_sectors = (fs->n_fatent + s_per_sector - 1U) / s_per_sector;
+    if (s_fat_sectors > fs->fsize) {
+        s_fat_sectors = fs->fsize;
+    }
+    s_group_sectors = (s_fat_sectors + SD_FREEMAP_GROUPS - 1U) / SD_FREEMAP_GROUPS;
+    if (s_group_sectors == 0U) {
+        return;
+    }
+    s_groups = (s_fat_sectors + s_group_sectors - 1U) / s_group_sectors;
+#if SD_FREEMAP_WEAR
+    /* FAT32 keeps the allocator's position in FSINFO across mounts; FAT16 starts over. */
+    s_wear = (fs->last_clst >= 2U && fs->last_clst + 1U < fs->n_fatent) ? fs->last_clst + 1U : 2U;
+    s_wear_laps = 0;
+#endif
+}
+
+void SD_FreeMapStop(void) {
+    s_fs = NULL;
+    s_groups = 0;
+}
+
+bool SD_FreeMapStep(void) {
+    if (!SD_FreeMapValid() || s_error) {
+        return false;
+    }
+    if (!SD_FreeMapLock()) {
+        return true;
+    }
+
+    if (!s_done) {
+        for (uint32_t n = 0; n < SD_FREEMAP_SLICE && s_scan < s_fat_sectors; n++, s_scan++) {
+            uint32_t g = s_scan / s_group_sectors;
+            if (s_scan % s_group_sectors == 0U) {
+                /* Counted from here on: earlier writes to the group are seen by the scan. */
+                s_count[g] = 0;
+                SD_FreeMapSetDirty(g, false);
+            }
+            uint32_t free_entries;
+            if (!SD_FreeMapCountSector(s_scan, &free_entries)) {
+                s_error = true;
+                break;
+            }
+            s_count[g] += free_entries;
+        }
+        if (!s_error && s_scan >= s_fat_sectors) {
+            SD_FreeMapFinish();
+        }
+    } else {
+        for (uint32_t g = 0; g < s_groups; g++) {
+            if (SD_FreeMapIsDirty(g)) {
+                s_error = !SD_FreeMapRecount(g);
+                break;
+            }
+        }
+    }
+
+#if SD_FREEMAP_WEAR
+    SD_FreeMapWearFollow();
+#endif
+    bool more = !s_error && !s_done;
+    for (uint32_t g = 0; !more && !s_error && g < s_groups; g++) {
+        more = SD_FreeMapIsDirty(g);
+    }
+    SD_FreeMapUnlock();
+    return more;
+}
+
+void SD_FreeMapFatWritten(BYTE pdrv, DWORD sector, UINT count) {
+    if (!SD_FreeMapValid() || pdrv != s_fs->drv) {
+        return;
+    }
+    /* Only the first FAT; the mirror copy carries the same entries. */
+    DWORD first = (sector > s_fs->fatbase) ? sector : s_fs->fatbase;
+    DWORD end = sector + count;
+    if (end > s_fs->fatbase + s_fat_sectors) {
+        end = s_fs->fatbase + s_fat_sectors;
+    }
+    for (DWORD s = first; s < end; s += s_group_sectors) {
+        SD_FreeMapSetDirty((s - s_fs->fatbase) / s_group_sectors, true);
+    }
+    if (first < end) {
+        SD_FreeMapSetDirty((end - 1U - s_fs->fatbase) / s_group_sectors, true);
+    }
+}
+
+/* A group's count is usable once the scan passed it and no FAT write has touched it since. */
+static bool SD_FreeMapUsable(uint32_t group) {
+    return !SD_FreeMapIsDirty(group) &&
+           (s_done || (group + 1U) * s_group_sectors <= s_scan);
+}
+
+static uint32_t SD_FreeMapClusters(uint32_t bytes) {
+    uint32_t cluster_bytes = (uint32_t)s_fs->csize * SD_FS_SECTOR_SIZE(s_fs);
+    uint32_t need = (bytes + cluster_bytes - 1U) / cluster_bytes;
+    return (need == 0U) ? 1U : need;
+}
+
+/* Group FatFs allocates in next (0 when it has no valid suggestion). */
+static uint32_t SD_FreeMapLastGroup(void) {
+    DWORD last = s_fs->last_clst;
+    return (last < s_fs->n_fatent) ? (last / s_per_sector) / s_group_sectors : 0U;
+}
+
+/* From group start to the end, then from the start; runs do not wrap. */
+static DWORD SD_FreeMapFindRunFrom(uint32_t need, uint32_t start) {
+    for (uint32_t pass = 0; pass < 2U; pass++) {
+        uint32_t from = (pass == 0U) ? start : 0U;
+        uint32_t to = (pass == 0U) ? s_groups : start;
+        uint32_t run = 0;
+        uint32_t run_first = 0;
+        for (uint32_t g = from; g < to; g++) {
+            uint32_t cap = SD_FreeMapCapacity(g);
+            if (!SD_FreeMapUsable(g) || cap == 0U || s_count[g] != cap) {
+                run = 0;
+                continue;
+            }
+            if (run == 0U) {
+                run_first = g;
+            }
+            run += cap;
+            if (run >= need) {
+                return SD_FreeMapGroupCluster(run_first);
+            }
+        }
+    }
+    return 0;
+}
+
+static DWORD SD_FreeMapFindRunLocked(uint32_t bytes) {
+    return SD_FreeMapFindRunFrom(SD_FreeMapClusters(bytes), SD_FreeMapLastGroup());
+}
+
+#if SD_FREEMAP_WEAR
+/*
+ * Hint from the cursor: the first whole free run starting at or after it
+ * (wrapping), else the cursor's own group if it has free clusters, else the
+ * next group that does. The cursor then moves past the bytes announced.
+ */
+static DWORD SD_FreeMapWearHint(uint32_t bytes) {
+    uint32_t need = SD_FreeMapClusters(bytes);
+    uint32_t group_clusters = s_group_sectors * s_per_sector;
+    uint32_t at = s_wear / group_clusters;
+    uint32_t ahead = (s_wear <= SD_FreeMapGroupCluster(at)) ? at : at + 1U;
+    DWORD clst = SD_FreeMapFindRunFrom(need, (ahead < s_groups) ? ahead : s_groups);
+    for (uint32_t i = 0; i < s_groups && clst == 0U; i++) {
+        uint32_t g = (at + i) % s_groups;
+        if (SD_FreeMapUsable(g) && s_count[g] != 0U) {
+            clst = (i == 0U) ? s_wear : SD_FreeMapGroupCluster(g);
+        }
+    }
+    if (clst != 0U) {
+        SD_FreeMapWearMove(clst);
+        SD_FreeMapWearMove(clst + need);
+    }
+    return clst;
+}
+#endif
+
+DWORD SD_FreeMapFindRun(uint32_t bytes) {
+    if (!SD_FreeMapValid() || !SD_FreeMapLock()) {
+        return 0;
+    }
+    DWORD clst = SD_FreeMapFindRunLocked(bytes);
+    SD_FreeMapUnlock();
+    return clst;
+}
+
+bool SD_FreeMapHint(uint32_t bytes) {
+    if (!SD_FreeMapValid() || !SD_FreeMapLock()) {
+        return false;
+    }
+#if SD_FREEMAP_WEAR
+    SD_FreeMapWearFollow();
+    DWORD clst = SD_FreeMapWearHint(bytes);
+#else
+    DWORD clst = SD_FreeMapFindRunLocked(bytes);
+    if (clst == 0U) {
+        /* No whole free run: at least skip the full groups ahead of the allocator. */
+        uint32_t start = SD_FreeMapLastGroup();
+        for (uint32_t i = 0; i < s_groups && clst == 0U; i++) {
+            uint32_t g = (start + i) % s_groups;
+            if (SD_FreeMapUsable(g) && s_count[g] != 0U) {
+                clst = SD_FreeMapGroupCluster(g);
+            }
+        }
+    }
+#endif
+    if (clst != 0U) {
+        s_fs->last_clst = clst - 1U; /* create_chain and f_expand search from here */
+    }
+    SD_FreeMapUnlock();
+    return clst != 0U;
+}
+
+void SD_FreeMapGetStats(SD_FreeMapStats *out) {
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    if (!SD_FreeMapValid()) {
+        return;
+    }
+    out->groups = s_groups;
+    out->group_clusters = s_group_sectors * s_per_sector;
+    out->scanned_sectors = s_scan;
+    out->free_clusters = SD_FreeMapTotal();
+    out->recounts = s_recounts;
+    out->done = s_done;
+    out->error = s_error;
+#if SD_FREEMAP_WEAR
+    out->wear_cursor = s_wear;
+    out->wear_laps = s_wear_laps;
+#endif
+}
+
+DWORD SD_FreeMapCursor(void) {
+#if SD_FREEMAP_WEAR
+    return SD_FreeMapValid() ? s_wear : 0U;
+#else
+    return 0U;
+#endif
+}
+
+void SD_FreeMapSetCursor(DWORD clst) {
+#if SD_FREEMAP_WEAR
+    if (SD_FreeMapValid() && SD_FreeMapLock()) {
+        s_wear = (clst >= 2U && clst < s_fs->n_fatent) ? clst : 2U;
+        SD_FreeMapUnlock();
+    }
+#else
+    (void)clst;
+#endif
+}
+
+#else
+
+void SD_FreeMapStart(FATFS *fs) {
+    (void)fs;
+}
+
+void SD_FreeMapStop(void) {
+}
+
+bool SD_FreeMapStep(void) {
+    return false;
+}
+
+void SD_FreeMapFatWritten(BYTE pdrv, DWORD sector, UINT count) {
+    (void)pdrv;
+    (void)sector;
+    (void)count;
+}
+
+DWORD SD_FreeMapFindRun(uint32_t bytes) {
+    (void)bytes;
+    return 0;
+}
+
+bool SD_FreeMapHint(uint32_t bytes) {
+    (void)bytes;
+    return false;
+}
+
+void SD_FreeMapGetStats(SD_FreeMapStats *out) {
+    if (out) {
+        memset(out, 0, sizeof(*out));
+    }
+}
+
+DWORD SD_FreeMapCursor(void) {
+    return 0;
+}
+
+void SD_FreeMapSetCursor(DWORD clst) {
+    (void)clst;
+}
+
+#endif
@@ -0,0 +1,608 @@
+/*
+ * sd_fsck.c
+ *
+ * Incremental FAT check: per window, a walk of the directory tree with an
+ * explicit stack of directory positions and one chain in progress, then a
+ * pass over the window's FAT entries. Three bitmaps cover the window: reached,
+ * reached twice, and pointed to by a lost cluster. The reached bit of a
+ * cluster becomes its lost bit once its FAT entry has been read.
+ */
+
+#include "sd_fsck.h"
+#include "diskio.h"
+#include "sd_diskio_spi.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#if (SD_FSCK_WINDOW_CLUSTERS > 0U)
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#endif
+
+#define SD_FSCK_BITMAP      (SD_FSCK_WINDOW_CLUSTERS / 8U)
+#define SD_FSCK_TOUCH_BITS  (SD_FSCK_WINDOW_CLUSTERS / 128U + 1U) /* FAT sectors of a window */
+#define SD_FSCK_NONE        0xFFFFFFFFUL
+#define SD_FSCK_MAX_ACTIONS (SD_FSCK_SLICE * 32U)
+
+#define SD_FSCK_WALK 0U
+#define SD_FSCK_SCAN 1U
+#define SD_FSCK_DONE 2U
+
+/* A directory being scanned: first == 0 is the FAT16 root region. */
+typedef struct {
+    DWORD first;
+    DWORD clst;    // Cluster being read
+    uint32_t sect; // Sector within the cluster (or the root region)
+    uint32_t ent;  // Entry within the sector
+} SD_FsckDir;
+
+static FATFS *s_fs;
+static WORD s_fs_id;
+static SD_FsckReport s_report;
+static uint8_t s_phase;
+static uint32_t s_per_sector; // FAT entries per sector
+static DWORD s_eoc;           // Smallest end-of-chain value
+static DWORD s_bad;           // Bad-cluster marker
+static uint32_t s_win_first;  // First cluster of the window
+static uint32_t s_win_end;
+static uint32_t s_used;       // Sectors read by this step
+static uint32_t s_fat_writes; // FAT sector writes seen by the hook
+
+static uint8_t s_mark[SD_FSCK_BITMAP];
+static uint8_t s_dup[SD_FSCK_BITMAP];
+static uint8_t s_ref[SD_FSCK_BITMAP];
+static uint8_t s_touched[(SD_FSCK_TOUCH_BITS + 7U) / 8U];
+
+static SD_FsckDir s_stack[SD_FSCK_MAX_DEPTH + 1U]; // The root, then SD_FSCK_MAX_DEPTH levels
+static uint32_t s_depth;
+
+/* The chain being walked. */
+static bool s_in_chain;
+static bool s_chain_dir;
+static DWORD s_next;
+static uint32_t s_links;
+static uint32_t s_size;
+static DWORD s_chain_first;
+static uint32_t s_chain_writes; // s_fat_writes when the walk began
+
+static uint32_t s_scan_rel; // Next FAT sector of the window pass
+static uint32_t s_scan_end;
+
+static uint8_t s_fat_buf[_MAX_SS] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_dir_buf[_MAX_SS] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static DWORD s_fat_held;
+static DWORD s_dir_held;
+
+#if defined(USE_FREERTOS)
+static SemaphoreHandle_t s_run; // Held across a step, so SD_FsckStop waits it out
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_run_buffer;
+#endif
+
+static void SD_FsckRunLock(void) {
+    if (s_run == NULL) {
+        vTaskSuspendAll();
+        if (s_run == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+            s_run = xSemaphoreCreateMutexStatic(&s_run_buffer);
+#else
+            s_run = xSemaphoreCreateMutex();
+#endif
+        }
+        (void)xTaskResumeAll();
+    }
+    if (s_run != NULL) {
+        (void)xSemaphoreTake(s_run, portMAX_DELAY);
+    }
+}
+
+static void SD_FsckRunUnlock(void) {
+    if (s_run != NULL) {
+        (void)xSemaphoreGive(s_run);
+    }
+}
+#else
+static void SD_FsckRunLock(void) {
+}
+
+static void SD_FsckRunUnlock(void) {
+}
+#endif
+
+#if _FS_REENTRANT
+static bool SD_FsckLock(void) {
+    return ff_req_grant(s_fs->sobj) != 0;
+}
+
+static void SD_FsckUnlock(void) {
+    ff_rel_grant(s_fs->sobj);
+}
+#else
+static bool SD_FsckLock(void) {
+    return true;
+}
+
+static void SD_FsckUnlock(void) {
+}
+#endif
+
+static bool SD_FsckValid(void) {
+    return s_fs != NULL && s_fs->fs_type != 0U && s_fs->id == s_fs_id;
+}
+
+static bool SD_FsckBit(const uint8_t *map, uint32_t bit) {
+    return (map[bit >> 3] & (1U << (bit & 7U))) != 0U;
+}
+
+static void SD_FsckSetBit(uint8_t *map, uint32_t bit, bool set) {
+    if (set) {
+        map[bit >> 3] |= (uint8_t)(1U << (bit & 7U));
+    } else {
+        map[bit >> 3] &= (uint8_t)~(1U << (bit & 7U));
+    }
+}
+
+static uint32_t SD_FsckLd16(const BYTE *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t SD_FsckLd32(const BYTE *p) {
+    return SD_FsckLd16(p) | (SD_FsckLd16(p + 2) << 16);
+}
+
+/* A sector into buf, unless FatFs's window or buf already holds it; NULL on a read error. */
+static const BYTE *SD_FsckSector(DWORD sect, uint8_t *buf, DWORD *held) {
+    if (sect == s_fs->winsect) {
+        return s_fs->win;
+    }
+    if (sect != *held) {
+        *held = SD_FSCK_NONE;
+        if (disk_read(s_fs->drv, buf, sect, 1) != RES_OK) {
+            return NULL;
+        }
+        *held = sect;
+        s_report.sectors_read++;
+        s_used++;
+    }
+    return buf;
+}
+
+/* True if reading clst's FAT entry costs a sector read. */
+static bool SD_FsckEntryMisses(DWORD clst) {
+    DWORD sect = s_fs->fatbase + clst / s_per_sector;
+    return sect != s_fs->winsect && sect != s_fat_held;
+}
+
+static bool SD_FsckEntry(DWORD clst, DWORD *value) {
+    const BYTE *p = SD_FsckSector(s_fs->fatbase + clst / s_per_sector, s_fat_buf, &s_fat_held);
+    if (p == NULL) {
+        return false;
+    }
+    uint32_t i = clst % s_per_sector;
+    *value = (s_fs->fs_type == FS_FAT32) ? (SD_FsckLd32(&p[i * 4U]) & 0x0FFFFFFFU)
+                                        : SD_FsckLd16(&p[i * 2U]);
+    return true;
+}
+
+static void SD_FsckMark(DWORD clst) {
+    if (clst >= s_win_first && clst < s_win_end) {
+        uint32_t bit = clst - s_win_first;
+        if (SD_FsckBit(s_mark, bit)) {
+            SD_FsckSetBit(s_dup, bit, true);
+        }
+        SD_FsckSetBit(s_mark, bit, true);
+    }
+}
+
+static void SD_FsckPush(DWORD first) {
+    if (s_depth > SD_FSCK_MAX_DEPTH) {
+        s_report.partial = true;
+        return;
+    }
+    s_stack[s_depth] = (SD_FsckDir){first, first, 0, 0};
+    s_depth++;
+}
+
+/* A bad link seen while the FAT was being written may be a chain changing under the walk. */
+static void SD_FsckBadChain(void) {
+    if (s_report.window == 0U && s_chain_writes == s_fat_writes) {
+        s_report.bad_chains++;
+    }
+}
+
+static void SD_FsckChainBegin(DWORD first, uint32_t size, bool dir) {
+    s_chain_writes = s_fat_writes;
+    if (first == 0U) {
+        if (dir) {
+            SD_FsckBadChain();
+        } else if (size > 0U && s_report.window == 0U) {
+            s_report.short_chains++;
+        }
+        return;
+    }
+    if (first < 2U || first >= s_fs->n_fatent) {
+        SD_FsckBadChain();
+        return;
+    }
+    s_in_chain = true;
+    s_chain_dir = dir;
+    s_next = first;
+    s_links = 0;
+    s_size = size;
+    s_chain_first = first;
+}
+
+static void SD_FsckChainEnd(bool ok) {
+    s_in_chain = false;
+    if (!ok) {
+        SD_FsckBadChain();
+        return;
+    }
+    if (s_chain_dir) {
+        SD_FsckPush(s_chain_first);
+        return;
+    }
+    if (s_report.window == 0U && s_chain_writes == s_fat_writes) {
+        uint32_t cluster_bytes = (uint32_t)s_fs->csize * SD_FS_SECTOR_SIZE(s_fs);
+        uint32_t need = (uint32_t)(((uint64_t)s_size + cluster_bytes - 1U) / cluster_bytes);
+        if (s_links < need) {
+            s_report.short_chains++;
+        } else if (s_links > need) {
+            s_report.long_chains++;
+        }
+    }
+}
+
+/* Follow links of the chain, reading at most one FAT sector. */
+static bool SD_FsckChainAction(void) {
+    bool read = false;
+    for (uint32_t n = 0; n < s_per_sector && s_in_chain; n++) {
+        if (SD_FsckEntryMisses(s_next)) {
+            if (read) {
+                break;
+            }
+            read = true;
+        }
+        DWORD v;
+        if (!SD_FsckEntry(s_next, &v)) {
+            return false;
+        }
+        SD_FsckMark(s_next);
+        if (++s_links > s_fs->n_fatent - 2U) {
+            SD_FsckChainEnd(false); /* longer than the FAT: a loop */
+        } else if (v >= s_eoc) {
+            SD_FsckChainEnd(true);
+        } else if (v < 2U || v >= s_fs->n_fatent) {
+            SD_FsckChainEnd(false);
+        } else {
+            s_next = v;
+        }
+    }
+    return true;
+}
+
+/* Look at the next entry of the innermost directory, reading at most one sector. */
+static bool SD_FsckDirAction(void) {
+    SD_FsckDir *d = &s_stack[s_depth - 1U];
+    uint32_t ss = SD_FS_SECTOR_SIZE(s_fs);
+    DWORD sect;
+    if (d->first == 0U) {
+        if (d->sect >= ((uint32_t)s_fs->n_rootdir * 32U + ss - 1U) / ss) {
+            s_depth--;
+            return true;
+        }
+        sect = s_fs->dirbase + d->sect;
+    } else {
+        if (d->sect >= s_fs->csize) {
+            DWORD v;
+            if (!SD_FsckEntry(d->clst, &v)) {
+                return false;
+            }
+            if (v < 2U || v >= s_fs->n_fatent) {
+                s_depth--; /* end of the directory, or a bad link the walk counted */
+                return true;
+            }
+            d->clst = v;
+            d->sect = 0;
+            return true;
+        }
+        sect = s_fs->database + (d->clst - 2U) * s_fs->csize + d->sect;
+    }
+    const BYTE *p = SD_FsckSector(sect, s_dir_buf, &s_dir_held);
+    if (p == NULL) {
+        return false;
+    }
+    const BYTE *e = &p[d->ent * 32U];
+    if (++d->ent == ss / 32U) {
+        d->ent = 0;
+        d->sect++;
+    }
+
+    BYTE attr = e[11];
+    if (e[0] == 0U) {
+        s_depth--; /* end of the directory */
+        return true;
+    }
+    /* Deleted, long-name and volume-label entries, and "." / "..". */
+    if (e[0] == 0xE5U || attr == 0x0FU || (attr & 0x08U) != 0U || e[0] == '.') {
+        return true;
+    }
+    bool dir = (attr & 0x10U) != 0U;
+    DWORD first = SD_FsckLd16(&e[26]);
+    if (s_fs->fs_type == FS_FAT32) {
+        first |= SD_FsckLd16(&e[20]) << 16;
+    }
+    if (s_report.window == 0U) {
+        if (dir) {
+            s_report.dirs++;
+        } else {
+            s_report.files++;
+        }
+    }
+    SD_FsckChainBegin(first, dir ? 0U : SD_FsckLd32(&e[28]), dir);
+    return true;
+}
+
+static void SD_FsckBeginWindow(void) {
+    memset(s_mark, 0, sizeof(s_mark));
+    memset(s_dup, 0, sizeof(s_dup));
+    memset(s_ref, 0, sizeof(s_ref));
+    memset(s_touched, 0, sizeof(s_touched));
+    s_win_first = s_report.window * SD_FSCK_WINDOW_CLUSTERS;
+    s_win_end = s_win_first + SD_FSCK_WINDOW_CLUSTERS;
+    if (s_win_end > s_fs->n_fatent) {
+        s_win_end = s_fs->n_fatent;
+    }
+    s_depth = 0;
+    s_in_chain = false;
+    s_phase = SD_FSCK_WALK;
+    if (s_fs->fs_type == FS_FAT32) {
+        SD_FsckChainBegin(s_fs->dirbase, 0, true); /* the root is a chain too */
+    } else {
+        SD_FsckPush(0);
+    }
+}
+
+static void SD_FsckBeginScan(void) {
+    s_scan_rel = s_win_first / s_per_sector;
+    s_scan_end = (s_win_end - 1U) / s_per_sector + 1U;
+    s_phase = SD_FSCK_SCAN;
+}
+
+static void SD_FsckEndWindow(void) {
+    if (!s_report.partial) {
+        /* Lost clusters no lost cluster points to start a lost chain. */
+        for (uint32_t i = 0; i < SD_FSCK_BITMAP; i++) {
+            uint32_t heads = (uint32_t)(s_mark[i] & (uint8_t)~s_ref[i]);
+            while (heads != 0U) {
+                s_report.lost_chains++;
+                heads &= heads - 1U;
+            }
+        }
+    }
+    s_report.window++;
+    if (s_report.window >= s_report.windows) {
+        s_report.done = true;
+        s_phase = SD_FSCK_DONE;
+    } else {
+        SD_FsckBeginWindow();
+    }
+}
+
+/* Read one FAT sector of the window and settle its clusters. */
+static bool SD_FsckScanAction(void) {
+    uint32_t rel = s_scan_rel - s_win_first / s_per_sector;
+    DWORD sect = s_fs->fatbase + s_scan_rel;
+    uint32_t first = s_scan_rel * s_per_sector;
+    uint32_t end = first + s_per_sector;
+    if (first < s_win_first) {
+        first = s_win_first;
+    }
+    if (first < 2U) {
+        first = 2U;
+    }
+    if (end > s_win_end) {
+        end = s_win_end;
+    }
+
+    bool written = SD_FsckBit(s_touched, rel) ||
+                   (sect == s_fs->winsect && (s_fs->wflag & 1U) != 0U);
+    if (written) {
+        s_report.skipped += (end > first) ? end - first : 0U;
+        for (uint32_t c = first; c < end; c++) {
+            SD_FsckSetBit(s_mark, c - s_win_first, false);
+        }
+    } else {
+        for (uint32_t c = first; c < end; c++) {
+            DWORD v;
+            if (!SD_FsckEntry(c, &v)) {
+                return false;
+            }
+            uint32_t bit = c - s_win_first;
+            if (SD_FsckBit(s_dup, bit)) {
+                s_report.cross_linked++;
+            }
+            bool lost = !s_report.partial && v != 0U && v != s_bad && !SD_FsckBit(s_mark, bit);
+            SD_FsckSetBit(s_mark, bit, lost);
+            if (lost) {
+                s_report.lost_clusters++;
+                if (v >= s_win_first && v < s_win_end && v >= 2U) {
+                    SD_FsckSetBit(s_ref, v - s_win_first, true);
+                }
+            }
+        }
+    }
+    if (++s_scan_rel >= s_scan_end) {
+        SD_FsckEndWindow();
+    }
+    return true;
+}
+
+void SD_FsckStart(FATFS *fs) {
+    SD_FsckRunLock();
+    s_fs = NULL;
+    memset(&s_report, 0, sizeof(s_report));
+    s_phase = SD_FSCK_DONE;
+    if (fs != NULL && (fs->fs_type == FS_FAT16 || fs->fs_type == FS_FAT32) && fs->n_fatent > 2U) {
+        s_fs = fs;
+        s_fs_id = fs->id;
+        bool fat32 = (fs->fs_type == FS_FAT32);
+        s_per_sector = SD_FS_SECTOR_SIZE(fs) / (fat32 ? 4U : 2U);
+        s_eoc = fat32 ? 0x0FFFFFF8UL : 0xFFF8UL;
+        s_bad = fat32 ? 0x0FFFFFF7UL : 0xFFF7UL;
+        s_report.windows = (fs->n_fatent + SD_FSCK_WINDOW_CLUSTERS - 1U) / SD_FSCK_WINDOW_CLUSTERS;
+        SD_FsckBeginWindow();
+    }
+    SD_FsckRunUnlock();
+}
+
+void SD_FsckStop(void) {
+    SD_FsckRunLock();
+    s_fs = NULL;
+    SD_FsckRunUnlock();
+}
+
+bool SD_FsckStep(void) {
+    SD_FsckRunLock();
+    if (!SD_FsckValid() || s_phase == SD_FSCK_DONE || s_report.error) {
+        SD_FsckRunUnlock();
+        return false;
+    }
+    if (!SD_FsckLock()) {
+        SD_FsckRunUnlock();
+        return true;
+    }
+
+    /* The volume may have changed since the last step: nothing read then is kept. */
+    s_fat_held = SD_FSCK_NONE;
+    s_dir_held = SD_FSCK_NONE;
+    s_used = 0;
+    s_report.steps++;
+    bool ok = true;
+    for (uint32_t n = 0; ok && n < SD_FSCK_MAX_ACTIONS && s_used < SD_FSCK_SLICE &&
+                         s_phase != SD_FSCK_DONE;
+         n++) {
+        if (s_phase == SD_FSCK_SCAN) {
+            ok = SD_FsckScanAction();
+        } else if (s_in_chain) {
+            ok = SD_FsckChainAction();
+        } else if (s_depth > 0U) {
+            ok = SD_FsckDirAction();
+        } else {
+            SD_FsckBeginScan();
+        }
+    }
+    if (!ok) {
+        s_report.error = true;
+    }
+    bool more = !s_report.error && s_phase != SD_FSCK_DONE;
+    SD_FsckUnlock();
+    SD_FsckRunUnlock();
+    return more;
+}
+
+void SD_FsckFatWritten(BYTE pdrv, DWORD sector, UINT count) {
+    if (!SD_FsckValid() || pdrv != s_fs->drv || s_phase == SD_FSCK_DONE) {
+        return;
+    }
+    uint32_t first_rel = s_win_first / s_per_sector;
+    uint32_t sectors = (s_win_end - 1U) / s_per_sector + 1U - first_rel;
+    for (uint32_t k = 0; k < s_fs->n_fats; k++) {
+        DWORD fat = s_fs->fatbase + k * s_fs->fsize;
+        if (sector < fat + s_fs->fsize && sector + count > fat) {
+            s_fat_writes++;
+        }
+        DWORD lo = (sector > fat + first_rel) ? sector : fat + first_rel;
+        DWORD hi = (sector + count < fat + first_rel + sectors) ? sector + count
+                                                                : fat + first_rel + sectors;
+        for (DWORD s = lo; s < hi; s++) {
+            SD_FsckSetBit(s_touched, s - fat - first_rel, true);
+        }
+    }
+}
+
+void SD_FsckGetReport(SD_FsckReport *out) {
+    if (out) {
+        *out = s_report;
+    }
+}
+
+#if defined(USE_FREERTOS)
+static TaskHandle_t s_task;
+static FATFS *volatile s_task_fs;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticTask_t s_task_buffer;
+static StackType_t s_task_stack[SD_FSCK_TASK_STACK];
+#endif
+
+static void SD_FsckTask(void *argument) {
+    (void)argument;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        SD_FsckStart(s_task_fs);
+        while (SD_FsckStep()) {
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SD_FSCK_STEP_MS)) != 0U) {
+                SD_FsckStart(s_task_fs); /* asked again meanwhile: start over */
+            }
+        }
+    }
+}
+
+bool SD_FsckStartTask(FATFS *fs) {
+    if (s_task == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        s_task = xTaskCreateStatic(SD_FsckTask, "sd_fsck", SD_FSCK_TASK_STACK, NULL,
+                                   SD_FSCK_TASK_PRIORITY, s_task_stack, &s_task_buffer);
+#else
+        if (xTaskCreate(SD_FsckTask, "sd_fsck", SD_FSCK_TASK_STACK, NULL, SD_FSCK_TASK_PRIORITY,
+                        &s_task) != pdPASS) {
+            s_task = NULL;
+        }
+#endif
+    }
+    if (s_task == NULL) {
+        return false;
+    }
+    s_task_fs = fs;
+    (void)xTaskNotifyGive(s_task);
+    return true;
+}
+#endif
+
+#else
+
+void SD_FsckStart(FATFS *fs) {
+    (void)fs;
+}
+
+void SD_FsckStop(void) {
+}
+
+bool SD_FsckStep(void) {
+    return false;
+}
+
+void SD_FsckFatWritten(BYTE pdrv, DWORD sector, UINT count) {
+    (void)pdrv;
+    (void)sector;
+    (void)count;
+}
+
+void SD_FsckGetReport(SD_FsckReport *out) {
+    if (out) {
+        memset(out, 0, sizeof(*out));
+    }
+}
+
+#if defined(USE_FREERTOS)
+bool SD_FsckStartTask(FATFS *fs) {
+    (void)fs;
+    return false;
+}
+#endif
+
+#endif
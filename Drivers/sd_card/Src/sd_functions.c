@@ -7,240 +7,3909 @@
 
 #include "fatfs.h"
 #include "sd_diskio_spi.h"
+#include "sd_cache.h"
 #include "sd_spi.h"
 #include "sd_functions.h"
+#include "sd_profile.h"
+#include "sd_freemap.h"
+#include "sd_fsck.h"
+#include "sd_defrag.h"
+#include "sd_pool.h"
+#include "sd_format.h"
+#include "sd_logsink.h"
+#include "sd_fwload.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "ff.h"
 #include "ffconf.h"
 
+#if defined(USE_FREERTOS) && ((SD_FAST_MOUNT == 1) || (SD_FREEMAP_GROUPS > 0U) || \
+                              (SD_SPACE_CACHE == 1))
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#endif
+
 char sd_path[4] = "0:/";
 FATFS fs;
 
+/* sd_mount_lazy: volume registered, the work after its mount not run yet. */
+static volatile bool s_lazy_pending;
+
 #ifndef SD_FUNCTIONS_LOG_ENABLED
 #define SD_FUNCTIONS_LOG_ENABLED 1
 #endif
 
-#if SD_FUNCTIONS_LOG_ENABLED
-#define SD_APP_LOG(fmt, ...) printf(fmt, ##__VA_ARGS__)
+/* Progress lines log at INFO, failures at ERROR when routed through sd_logsink. */
+#if SD_FUNCTIONS_LOG_ENABLED && SD_LOGSINK_ENABLED
+#define SD_APP_LOG(...) SD_LOG_AT(SD_LOG_LEVEL_INFO, __VA_ARGS__)
+#define SD_APP_LOG_ERROR(...) SD_LOG_AT(SD_LOG_LEVEL_ERROR, __VA_ARGS__)
+#elif SD_FUNCTIONS_LOG_ENABLED
+#define SD_APP_LOG(fmt, ...) printf(fmt, ##__VA_ARGS__)
+#define SD_APP_LOG_ERROR(fmt, ...) printf(fmt, ##__VA_ARGS__)
+#else
+/* Compiled out, but the arguments still count as used. */
+#define SD_APP_LOG(...) do { if (0) { printf(__VA_ARGS__); } } while (0)
+#define SD_APP_LOG_ERROR(...) do { if (0) { printf(__VA_ARGS__); } } while (0)
+#endif
+
+#ifndef SD_DIR_MAX_DEPTH
+#define SD_DIR_MAX_DEPTH 8
+#endif
+
+/*
+ * Directory preallocation: designated directories (0 = off), the free entries
+ * kept past each one's end, and the placeholder files one growth may use.
+ */
+#ifndef SD_DIRPRE_DIRS
+#define SD_DIRPRE_DIRS 0
+#endif
+
+#ifndef SD_DIRPRE_SLACK
+#define SD_DIRPRE_SLACK 32U
+#endif
+
+#ifndef SD_DIRPRE_TEMPS
+#define SD_DIRPRE_TEMPS 64U
+#endif
+
+/* Subdirectories sd_shard_* spread a flat name space over (power of two, at most 256). */
+#ifndef SD_SHARD_BUCKETS
+#define SD_SHARD_BUCKETS 64U
+#endif
+
+#if (SD_SHARD_BUCKETS == 0U) || (SD_SHARD_BUCKETS > 256U) || \
+    ((SD_SHARD_BUCKETS & (SD_SHARD_BUCKETS - 1U)) != 0U)
+#error "SD_SHARD_BUCKETS must be a power of two between 1 and 256"
+#endif
+
+/* Cached free space: sd_mount skips f_getfree and the count is reconciled in the background. */
+#ifndef SD_SPACE_CACHE
+#define SD_SPACE_CACHE 0
+#endif
+
+/* Background free-space work: the count SD_FAST_MOUNT defers, the free map, the reconcile. */
+#define SD_FREE_BACKGROUND ((SD_FAST_MOUNT == 1) || (SD_FREEMAP_GROUPS > 0U) || (SD_SPACE_CACHE == 1))
+
+/* The "sd_free" worker task (FreeRTOS builds with SD_FREE_BACKGROUND). */
+#ifndef SD_FREE_TASK_STACK
+#define SD_FREE_TASK_STACK 256U
+#endif
+
+#ifndef SD_FREE_TASK_PRIORITY
+#define SD_FREE_TASK_PRIORITY tskIDLE_PRIORITY
+#endif
+
+/* Card hot-plug: remount after card-detect events (sd_hotplug_enable). */
+#ifndef SD_HOTPLUG
+#define SD_HOTPLUG 0
+#endif
+
+/* The "sd_hotplug" task's period: debounce tick and event check (FreeRTOS builds). */
+#ifndef SD_HOTPLUG_POLL_MS
+#define SD_HOTPLUG_POLL_MS 20U
+#endif
+
+#ifndef SD_HOTPLUG_TASK_STACK
+#define SD_HOTPLUG_TASK_STACK 384U
+#endif
+
+#ifndef SD_HOTPLUG_TASK_PRIORITY
+#define SD_HOTPLUG_TASK_PRIORITY tskIDLE_PRIORITY
+#endif
+
+#if (SD_FAST_MOUNT == 1) && ((_FS_NOFSINFO & 1) != 0)
+#warning "SD_FAST_MOUNT: _FS_NOFSINFO ignores the FSINFO free count, so every mount defers a FAT scan"
+#endif
+
+/* Cached fast-seek tables, and DWORDs per table (2 per fragment + 1). */
+#ifndef SD_FASTSEEK_SLOTS
+#define SD_FASTSEEK_SLOTS 4
+#endif
+
+#ifndef SD_FASTSEEK_CLMT_WORDS
+#define SD_FASTSEEK_CLMT_WORDS 64
+#endif
+
+#if _USE_FASTSEEK
+typedef struct {
+    DWORD tbl[SD_FASTSEEK_CLMT_WORDS];
+    WORD fs_id;     // Volume mount id the table was built on
+    DWORD sclust;   // File start cluster
+    FSIZE_t size;   // File size when built
+    uint32_t stamp; // Last use, for LRU replacement
+    uint8_t refs;   // Open files using the table
+    bool valid;
+} sd_clmt_slot;
+
+static sd_clmt_slot s_clmt[SD_FASTSEEK_SLOTS];
+static uint32_t s_clmt_clock;
+#endif
+
+/*
+ * Write handles kept open between sd_write_file/sd_append_file calls (0 = off),
+ * the longest path they are cached for, and whether every cached write is
+ * followed by f_sync (otherwise data is committed by sd_file_cache_flush,
+ * eviction or unmount).
+ */
+#ifndef SD_FILE_CACHE_SLOTS
+#define SD_FILE_CACHE_SLOTS 2
+#endif
+
+#ifndef SD_FILE_CACHE_PATH
+#define SD_FILE_CACHE_PATH 48
+#endif
+
+#ifndef SD_FILE_CACHE_SYNC_WRITES
+#define SD_FILE_CACHE_SYNC_WRITES 0
+#endif
+
+/*
+ * Clusters a cached write handle allocates ahead of its data (0 = off). Each
+ * writer then fills its own contiguous extent instead of interleaving single
+ * clusters with other growing files; the unused tail is truncated when the
+ * handle closes.
+ */
+#ifndef SD_EXTENT_CLUSTERS
+#define SD_EXTENT_CLUSTERS 0
+#endif
+
+/*
+ * A rewrite through a cached handle, and an extent given back on close, end
+ * in f_truncate, which _FS_MINIMIZE 1..3 leaves out of FatFs.
+ */
+#if (_FS_MINIMIZE != 0) && ((SD_FILE_CACHE_SLOTS > 0) || (SD_EXTENT_CLUSTERS > 0))
+#error "SD_FILE_CACHE_SLOTS and SD_EXTENT_CLUSTERS need _FS_MINIMIZE 0 in ffconf.h"
+#endif
+
+/* Cached handles count against _FS_LOCK; always leave one lock entry for other opens. */
+#if (_FS_LOCK > 0) && (SD_FILE_CACHE_SLOTS > (_FS_LOCK - 1))
+#define SD_FILE_CACHE_LIMIT (_FS_LOCK - 1)
+#else
+#define SD_FILE_CACHE_LIMIT SD_FILE_CACHE_SLOTS
+#endif
+
+/*
+ * Incremental delete (sd_delete_begin/sd_delete_step): clusters freed per
+ * step, and the fast-seek table, in DWORDs, that maps the chain once so a
+ * step does not walk it from the start (0 = plain seeks).
+ */
+#ifndef SD_DELETE_STEP_CLUSTERS
+#define SD_DELETE_STEP_CLUSTERS 256U
+#endif
+
+#ifndef SD_DELETE_CLMT
+#define SD_DELETE_CLMT 64U
+#endif
+
+#if (SD_DELETE_STEP_CLUSTERS < 1U)
+#error "SD_DELETE_STEP_CLUSTERS must be at least 1"
+#endif
+
+/* Longest path the directory walker builds (root plus every level). */
+#ifndef SD_WALK_PATH_MAX
+#define SD_WALK_PATH_MAX 256
+#endif
+
+/* CSV parser: bytes per f_read, longest line and most fields per record. */
+#ifndef SD_CSV_CHUNK_BYTES
+#define SD_CSV_CHUNK_BYTES 4096
+#endif
+
+#ifndef SD_CSV_MAX_LINE
+#define SD_CSV_MAX_LINE 256
+#endif
+
+#ifndef SD_CSV_MAX_FIELDS
+#define SD_CSV_MAX_FIELDS 16
+#endif
+
+/*
+ * Directory index: hash slots shared by up to SD_DIRINDEX_DIRS directories
+ * (0 = off). Each indexed directory owns SD_DIRINDEX_SLOTS / SD_DIRINDEX_DIRS
+ * slots of 4 bytes.
+ */
+#ifndef SD_DIRINDEX_SLOTS
+#define SD_DIRINDEX_SLOTS 0
+#endif
+
+#ifndef SD_DIRINDEX_DIRS
+#define SD_DIRINDEX_DIRS 2
+#endif
+
+#ifndef SD_DIRINDEX_PATH
+#define SD_DIRINDEX_PATH 48
+#endif
+
+#if (SD_DIRINDEX_SLOTS > 0)
+#define SD_DIRINDEX_PER_DIR (SD_DIRINDEX_SLOTS / SD_DIRINDEX_DIRS)
+
+#if (SD_DIRINDEX_PER_DIR & (SD_DIRINDEX_PER_DIR - 1)) != 0
+#error "SD_DIRINDEX_SLOTS / SD_DIRINDEX_DIRS must be a power of two"
+#endif
+
+typedef struct {
+    char key[SD_DIRINDEX_PATH]; // Normalized directory ("0:logs")
+    uint32_t used;              // Occupied slots (a full directory is not indexed)
+    uint32_t stamp;             // Last use, for LRU replacement
+    bool valid;
+} sd_dirindex_dir;
+
+static sd_dirindex_dir s_dirindex[SD_DIRINDEX_DIRS];
+static uint32_t s_dirindex_slots[SD_DIRINDEX_SLOTS]; // 0 = empty, else name hash
+static uint32_t s_dirindex_clock;
+static FILINFO s_dirindex_fno;
+#endif
+
+/*
+ * Stat cache: FILINFO of the last SD_STAT_CACHE_SLOTS paths sd_stat found
+ * (0 = off), keyed by paths shorter than SD_STAT_CACHE_PATH.
+ */
+#ifndef SD_STAT_CACHE_SLOTS
+#define SD_STAT_CACHE_SLOTS 0
+#endif
+
+#ifndef SD_STAT_CACHE_PATH
+#define SD_STAT_CACHE_PATH 48
+#endif
+
+#if (SD_STAT_CACHE_SLOTS > 0) && (_FS_MINIMIZE == 0)
+typedef struct {
+    char key[SD_STAT_CACHE_PATH]; // Path without drive and leading '/'
+    FILINFO fno;
+    uint32_t stamp; // Last use, for LRU replacement
+    bool valid;
+} sd_stat_slot;
+
+static sd_stat_slot s_stat[SD_STAT_CACHE_SLOTS];
+static uint32_t s_stat_clock;
+static SD_StatCacheStats s_stat_stats;
+#endif
+
+/*
+ * Small-file cache: whole contents of files up to SD_SMALLFILE_MAX bytes
+ * read through sd_read_file, in a pool of SD_SMALLFILE_POOL bytes (0 = off)
+ * shared by up to SD_SMALLFILE_SLOTS files with paths shorter than
+ * SD_SMALLFILE_PATH.
+ */
+#ifndef SD_SMALLFILE_POOL
+#define SD_SMALLFILE_POOL 0
+#endif
+
+#ifndef SD_SMALLFILE_MAX
+#define SD_SMALLFILE_MAX 4096U
+#endif
+
+#ifndef SD_SMALLFILE_SLOTS
+#define SD_SMALLFILE_SLOTS 8
+#endif
+
+#ifndef SD_SMALLFILE_PATH
+#define SD_SMALLFILE_PATH 48
+#endif
+
+#if (SD_SMALLFILE_POOL > 0)
+typedef struct {
+    char key[SD_SMALLFILE_PATH]; // Path without drive and leading '/'
+    uint32_t offset;             // Contents in s_small_pool
+    uint32_t size;
+    uint32_t stamp; // Last use, for LRU replacement
+    bool valid;
+} sd_small_slot;
+
+static sd_small_slot s_small[SD_SMALLFILE_SLOTS];
+static uint8_t s_small_pool[SD_SMALLFILE_POOL];
+static uint32_t s_small_clock;
+static SD_SmallFileStats s_small_stats;
+#endif
+
+/* Path-keyed caches dropped by sd_path_changed. */
+#define SD_PATH_KEYS (((SD_STAT_CACHE_SLOTS > 0) && (_FS_MINIMIZE == 0)) || (SD_SMALLFILE_POOL > 0))
+
+/*
+ * Sequence-numbered names (sd_seq_next): slots for (directory, prefix) pairs
+ * (0 = off), and the longest prefix and extension, terminator included.
+ */
+#ifndef SD_SEQ_SLOTS
+#define SD_SEQ_SLOTS 0
+#endif
+
+#ifndef SD_SEQ_PREFIX
+#define SD_SEQ_PREFIX 16
+#endif
+
+#ifndef SD_SEQ_EXT
+#define SD_SEQ_EXT 8
+#endif
+
+#if (SD_SEQ_SLOTS > 0)
+typedef struct {
+    char key[SD_DIRINDEX_PATH]; // Normalized directory, as the directory index keys it
+    char prefix[SD_SEQ_PREFIX];
+    char ext[SD_SEQ_EXT];
+    uint32_t digits;            // Zero-padded width of new numbers
+    uint32_t last;              // Highest number on the card or handed out
+    bool used;
+    bool valid;                 // last is known; false until the directory is read
+} sd_seq_slot;
+
+static sd_seq_slot s_seq[SD_SEQ_SLOTS];
+static FILINFO s_seq_fno;
+#endif
+
+/*
+ * Shared-sector mode: with _FS_TINY 1 a FIL has no sector buffer, so each
+ * cached handle holds its partial tail sector in the diskio cache instead.
+ */
+#if (SD_FILE_CACHE_LIMIT > 0) && SD_CACHE_ENABLED && (SD_CACHE_HOLD_LINES > 0) && _FS_TINY
+#define SD_FILE_HOLD 1
+#else
+#define SD_FILE_HOLD 0
+#endif
+
+/*
+ * Cache warm-up list (SD_WARM_SECTORS in sd_diskio_spi.h, with the sector
+ * cache): root-directory name of the file sd_unmount saves it in, and the
+ * buffer, in sectors, of one sd_warm_poll read.
+ */
+#ifndef SD_WARM_NAME
+#define SD_WARM_NAME "WARM.BIN"
+#endif
+
+#ifndef SD_WARM_RUN_SECTORS
+#define SD_WARM_RUN_SECTORS 8U
+#endif
+
+#define SD_WARM ((SD_WARM_SECTORS > 0U) && SD_CACHE_ENABLED)
+
+#if SD_WARM
+#define SD_WARM_MAGIC 0x314D5257UL /* "WRM1" */
+
+static uint32_t s_warm_list[SD_WARM_SECTORS]; // Loaded at mount, ascending
+static uint32_t s_warm_hot[SD_WARM_SECTORS];  // Saved at unmount, hottest first
+static uint32_t s_warm_count;
+static uint32_t s_warm_next;                  // First entry not prefetched yet
+static uint8_t s_warm_buf[SD_WARM_RUN_SECTORS * SD_DISK_SECTOR_SIZE]
+    __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static SD_WarmStats s_warm_stats;
+#endif
+
+#if (SD_SEQ_SLOTS > 0) || SD_PATH_KEYS
+static bool sd_char_equal(char a, char b) {
+    a = (a >= 'a' && a <= 'z') ? (char)(a - 'a' + 'A') : a;
+    b = (b >= 'a' && b <= 'z') ? (char)(b - 'a' + 'A') : b;
+    return a == b;
+}
+#endif
+
+#if (SD_FILE_CACHE_LIMIT > 0) || SD_PATH_KEYS
+/* FAT names are case-insensitive. */
+static bool sd_path_equal(const char *a, const char *b) {
+    while (*a && *b) {
+        char ca = (*a >= 'a' && *a <= 'z') ? (char)(*a - 'a' + 'A') : *a;
+        char cb = (*b >= 'a' && *b <= 'z') ? (char)(*b - 'a' + 'A') : *b;
+        if (ca != cb) {
+            return false;
+        }
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+#endif
+
+#if SD_PATH_KEYS
+/* The part of path after the drive and leading '/', or NULL if not shorter than max. */
+static const char *sd_path_key(const char *path, size_t max) {
+    const char *colon = strchr(path, ':');
+    if (colon != NULL) {
+        path = colon + 1;
+    }
+    while (*path == '/') {
+        path++;
+    }
+    return (strlen(path) < max) ? path : NULL;
+}
+
+/* Whether a change to key (NULL = unknown) affects the entry for entry_key. */
+static bool sd_path_affects(const char *key, const char *entry_key) {
+    if (key == NULL || *key == '\0') {
+        return true; /* unknown or the root: everything may be affected */
+    }
+    const char *a = entry_key;
+    const char *b = key;
+    while (*b && sd_char_equal(*a, *b)) {
+        a++;
+        b++;
+    }
+    return *b == '\0' && (*a == '\0' || *a == '/' || b[-1] == '/');
+}
+#endif
+
+#if (SD_STAT_CACHE_SLOTS > 0) && (_FS_MINIMIZE == 0)
+static sd_stat_slot *sd_stat_lookup(const char *key) {
+    for (int i = 0; i < SD_STAT_CACHE_SLOTS; i++) {
+        if (s_stat[i].valid && sd_path_equal(s_stat[i].key, key)) {
+            return &s_stat[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+#if (SD_SMALLFILE_POOL > 0)
+static sd_small_slot *sd_small_lookup(const char *key) {
+    for (int i = 0; i < SD_SMALLFILE_SLOTS; i++) {
+        if (s_small[i].valid && sd_path_equal(s_small[i].key, key)) {
+            return &s_small[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Keep size bytes of data for key: drop least recently used files until a
+ * slot and the bytes are free, then pack the survivors to the front of the
+ * pool so the free bytes are one run at its end.
+ */
+static void sd_small_store(const char *key, const void *data, uint32_t size) {
+    sd_small_slot *slot = NULL;
+    uint32_t used = 0;
+    for (;;) {
+        sd_small_slot *oldest = NULL;
+        slot = NULL;
+        used = 0;
+        for (int i = 0; i < SD_SMALLFILE_SLOTS; i++) {
+            if (!s_small[i].valid) {
+                slot = &s_small[i];
+            } else {
+                used += s_small[i].size;
+                if (oldest == NULL || s_small[i].stamp < oldest->stamp) {
+                    oldest = &s_small[i];
+                }
+            }
+        }
+        if (slot != NULL && used + size <= SD_SMALLFILE_POOL) {
+            break;
+        }
+        oldest->valid = false;
+        s_small_stats.evictions++;
+    }
+
+    uint32_t end = 0;
+    for (;;) {
+        sd_small_slot *next = NULL; /* lowest live entry at or past end */
+        for (int i = 0; i < SD_SMALLFILE_SLOTS; i++) {
+            if (s_small[i].valid && s_small[i].offset >= end &&
+                (next == NULL || s_small[i].offset < next->offset)) {
+                next = &s_small[i];
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        if (next->offset != end) {
+            memmove(&s_small_pool[end], &s_small_pool[next->offset], next->size);
+            next->offset = end;
+        }
+        end += next->size;
+    }
+
+    memcpy(slot->key, key, strlen(key) + 1U);
+    memcpy(&s_small_pool[end], data, size);
+    slot->offset = end;
+    slot->size = size;
+    slot->stamp = ++s_small_clock;
+    slot->valid = true;
+}
+#endif
+
+/* Drop what the stat and small-file caches hold for path and below it (NULL = all). */
+static void sd_path_changed(const char *path) {
+#if SD_PATH_KEYS
+    const char *key = NULL;
+#endif
+#if (SD_STAT_CACHE_SLOTS > 0) && (_FS_MINIMIZE == 0)
+    key = (path != NULL) ? sd_path_key(path, SD_STAT_CACHE_PATH) : NULL;
+    for (int i = 0; i < SD_STAT_CACHE_SLOTS; i++) {
+        if (s_stat[i].valid && sd_path_affects(key, s_stat[i].key)) {
+            s_stat[i].valid = false;
+            s_stat_stats.invalidations++;
+        }
+    }
+#endif
+#if (SD_SMALLFILE_POOL > 0)
+    key = (path != NULL) ? sd_path_key(path, SD_SMALLFILE_PATH) : NULL;
+    for (int i = 0; i < SD_SMALLFILE_SLOTS; i++) {
+        if (s_small[i].valid && sd_path_affects(key, s_small[i].key)) {
+            s_small[i].valid = false;
+        }
+    }
+#endif
+#if !SD_PATH_KEYS
+    (void)path;
+#endif
+}
+
+#if (SD_FILE_CACHE_LIMIT > 0)
+typedef struct {
+    FIL file;
+    char path[SD_FILE_CACHE_PATH];
+    FSIZE_t end;    // End of the data; the file may extend past it into its extent
+    uint32_t stamp; // Last use, for LRU eviction
+#if SD_FILE_HOLD
+    DWORD held;     // Sector held in the diskio cache (0 = none)
+#endif
+    bool open;
+} sd_file_slot;
+
+static sd_file_slot s_files[SD_FILE_CACHE_LIMIT];
+static uint32_t s_files_clock;
+
+#if SD_FILE_HOLD
+/* Hold the sector the handle's next write lands in (none on a sector boundary). */
+static void sd_file_slot_hold(sd_file_slot *slot, bool keep) {
+    DWORD sector = (keep && (slot->file.fptr % _MIN_SS) != 0U) ? slot->file.sect : 0U;
+    if (sector == slot->held) {
+        return;
+    }
+    SD_Handle_t *sd = SD_DiskHandle(slot->file.obj.fs->drv);
+    if (slot->held != 0U) {
+        SD_CacheRelease(sd, slot->held);
+    }
+    slot->held = (sector != 0U && SD_CacheHold(sd, sector)) ? sector : 0U;
+}
+#endif
+
+static FRESULT sd_file_slot_close(sd_file_slot *slot) {
+    FRESULT res = FR_OK;
+#if SD_FILE_HOLD
+    sd_file_slot_hold(slot, false);
+#endif
+#if (SD_EXTENT_CLUSTERS > 0)
+    if (f_size(&slot->file) > slot->end) {
+        /* Give the unused part of the extent back. */
+        res = SD_PROF_FCALL(SD_PROF_LSEEK, &slot->file, f_lseek(&slot->file, slot->end));
+        if (res == FR_OK) {
+            res = f_truncate(&slot->file);
+        }
+    }
+#endif
+    slot->open = false;
+    FRESULT close_res = SD_PROF_FCALL(SD_PROF_CLOSE, &slot->file, f_close(&slot->file));
+    sd_path_changed(slot->path);
+    return (res == FR_OK) ? close_res : res;
+}
+
+#if (SD_EXTENT_CLUSTERS > 0)
+/*
+ * Make the allocation cover need bytes: when it does not, extend the file to
+ * SD_EXTENT_CLUSTERS clusters past need in one f_lseek, which allocates the
+ * run in a single pass under the volume lock.
+ */
+static FRESULT sd_extent_reserve(FIL *fp, FSIZE_t need) {
+    if (need <= f_size(fp)) {
+        return FR_OK;
+    }
+    FSIZE_t cluster = (FSIZE_t)fs.csize * _MIN_SS;
+    FSIZE_t target = ((need + cluster - 1U) / cluster + SD_EXTENT_CLUSTERS) * cluster;
+    FSIZE_t pos = fp->fptr;
+    (void)SD_FreeMapHint((uint32_t)(target - f_size(fp)));
+    /* On a nearly full volume this stops short; the write then fails as it would have. */
+    FRESULT res = SD_PROF_FCALL(SD_PROF_LSEEK, fp, f_lseek(fp, target));
+    if (res == FR_OK) {
+        res = SD_PROF_FCALL(SD_PROF_LSEEK, fp, f_lseek(fp, pos));
+    }
+    return res;
+}
+#endif
+
+/* Close the least recently used handle; false if none is open. */
+static bool sd_file_cache_evict(void) {
+    sd_file_slot *lru = NULL;
+    for (int i = 0; i < SD_FILE_CACHE_LIMIT; i++) {
+        if (s_files[i].open && (lru == NULL || s_files[i].stamp < lru->stamp)) {
+            lru = &s_files[i];
+        }
+    }
+    if (lru == NULL) {
+        return false;
+    }
+    (void)sd_file_slot_close(lru);
+    return true;
+}
+#endif
+
+#if (SD_DIRINDEX_SLOTS > 0) || (SD_SEQ_SLOTS > 0)
+/*
+ * Split path into a normalized directory key ("<drive>:<dir>" without leading,
+ * trailing or doubled '/') and the final name. Returns false for names the
+ * index cannot answer for: non-ASCII (FatFs case folding is code-page
+ * dependent) or containing '~' (possible 8.3 alias of a long name).
+ */
+static bool sd_dirindex_split(const char *path, char *key, const char **name) {
+    size_t k = 0;
+    const char *p = path;
+
+    if (p[0] >= '0' && p[0] <= '9' && p[1] == ':') {
+        key[k++] = p[0];
+        p += 2;
+    } else {
+        key[k++] = '0';
+    }
+    key[k++] = ':';
+
+    const char *last = p;
+    for (const char *q = p; *q; q++) {
+        if (*q == '/' || *q == '\\') {
+            last = q + 1;
+        }
+    }
+    if (*last == '\0') {
+        return false;
+    }
+    for (const char *q = last; *q; q++) {
+        if ((unsigned char)*q >= 0x80U || *q == '~') {
+            return false;
+        }
+    }
+
+    bool slash = false;
+    for (const char *q = p; q < last; q++) {
+        if (*q == '/' || *q == '\\') {
+            slash = true;
+            continue;
+        }
+        if (slash && k > 2U) {
+            if (k + 1U >= SD_DIRINDEX_PATH) {
+                return false;
+            }
+            key[k++] = '/';
+        }
+        slash = false;
+        if (k + 1U >= SD_DIRINDEX_PATH) {
+            return false;
+        }
+        key[k++] = (*q >= 'a' && *q <= 'z') ? (char)(*q - 'a' + 'A') : *q;
+    }
+    key[k] = '\0';
+    *name = last;
+    return true;
+}
+#endif
+
+/* FNV-1a over the upper-cased name; never 0 (the directory index's empty-slot marker). */
+static uint32_t sd_name_hash(const char *name) {
+    uint32_t h = 2166136261U;
+    for (; *name; name++) {
+        char c = (*name >= 'a' && *name <= 'z') ? (char)(*name - 'a' + 'A') : *name;
+        h = (h ^ (uint8_t)c) * 16777619U;
+    }
+    return (h != 0U) ? h : 1U;
+}
+
+#if (SD_DIRINDEX_SLOTS > 0)
+
+static uint32_t *sd_dirindex_table(const sd_dirindex_dir *dir) {
+    return &s_dirindex_slots[(size_t)(dir - s_dirindex) * SD_DIRINDEX_PER_DIR];
+}
+
+/* Insert if absent; false once the directory's table is three-quarters full. */
+static bool sd_dirindex_insert(sd_dirindex_dir *dir, uint32_t hash) {
+    uint32_t *table = sd_dirindex_table(dir);
+    uint32_t i = hash & (SD_DIRINDEX_PER_DIR - 1U);
+    while (table[i] != 0U) {
+        if (table[i] == hash) {
+            return true;
+        }
+        i = (i + 1U) & (SD_DIRINDEX_PER_DIR - 1U);
+    }
+    if ((dir->used + 1U) * 4U > SD_DIRINDEX_PER_DIR * 3U) {
+        return false;
+    }
+    table[i] = hash;
+    dir->used++;
+    return true;
+}
+
+static bool sd_dirindex_has(const sd_dirindex_dir *dir, uint32_t hash) {
+    const uint32_t *table = sd_dirindex_table(dir);
+    uint32_t i = hash & (SD_DIRINDEX_PER_DIR - 1U);
+    while (table[i] != 0U) {
+        if (table[i] == hash) {
+            return true;
+        }
+        i = (i + 1U) & (SD_DIRINDEX_PER_DIR - 1U);
+    }
+    return false;
+}
+
+static void sd_dirindex_drop(sd_dirindex_dir *dir) {
+    dir->valid = false;
+    dir->used = 0;
+    memset(sd_dirindex_table(dir), 0, SD_DIRINDEX_PER_DIR * sizeof(uint32_t));
+}
+
+static sd_dirindex_dir *sd_dirindex_find(const char *key) {
+    for (int i = 0; i < SD_DIRINDEX_DIRS; i++) {
+        if (s_dirindex[i].valid && strcmp(s_dirindex[i].key, key) == 0) {
+            return &s_dirindex[i];
+        }
+    }
+    return NULL;
+}
+
+/* Index a directory with one f_readdir pass (long and 8.3 names). */
+static sd_dirindex_dir *sd_dirindex_build(const char *key) {
+    sd_dirindex_dir *dir = &s_dirindex[0];
+    for (int i = 1; i < SD_DIRINDEX_DIRS; i++) {
+        if (!s_dirindex[i].valid || (dir->valid && s_dirindex[i].stamp < dir->stamp)) {
+            dir = &s_dirindex[i];
+        }
+    }
+    sd_dirindex_drop(dir);
+
+    /* Rebuild an openable path: "<drive>:/<dir>". */
+    char path[SD_DIRINDEX_PATH + 2];
+    path[0] = key[0];
+    path[1] = ':';
+    path[2] = '/';
+    strcpy(&path[3], &key[2]);
+
+    SD_POOL_DIR_DECL(dj);
+    FILINFO *fno = &s_dirindex_fno;
+    if (dj == NULL) {
+        return NULL;
+    }
+    if (f_opendir(dj, path) != FR_OK) {
+        sd_pool_dir_put(dj);
+        return NULL;
+    }
+    bool ok = true;
+    while (ok) {
+        if (f_readdir(dj, fno) != FR_OK) {
+            ok = false;
+            break;
+        }
+        if (fno->fname[0] == '\0') {
+            break;
+        }
+        ok = sd_dirindex_insert(dir, sd_name_hash(fno->fname));
+#if _USE_LFN
+        if (ok && fno->altname[0] != '\0') {
+            ok = sd_dirindex_insert(dir, sd_name_hash(fno->altname));
+        }
+#endif
+    }
+    (void)f_closedir(dj);
+    sd_pool_dir_put(dj);
+    if (!ok) {
+        sd_dirindex_drop(dir); /* too large or unreadable: fall back to FatFs */
+        return NULL;
+    }
+    strcpy(dir->key, key);
+    dir->valid = true;
+    return dir;
+}
+
+/* False only when the index proves path does not exist. */
+static bool sd_dirindex_may_exist(const char *path) {
+    char key[SD_DIRINDEX_PATH];
+    const char *name;
+    if (!sd_dirindex_split(path, key, &name)) {
+        return true;
+    }
+    sd_dirindex_dir *dir = sd_dirindex_find(key);
+    if (dir == NULL) {
+        dir = sd_dirindex_build(key);
+        if (dir == NULL) {
+            return true;
+        }
+    }
+    dir->stamp = ++s_dirindex_clock;
+    return sd_dirindex_has(dir, sd_name_hash(name));
+}
+#endif
+
+#if (SD_SEQ_SLOTS > 0)
+/* The number in name if it is prefix, digits, then the extension (case-insensitive). */
+static bool sd_seq_number(const sd_seq_slot *slot, const char *name, uint32_t *number) {
+    for (const char *p = slot->prefix; *p; p++, name++) {
+        if (!sd_char_equal(*p, *name)) {
+            return false;
+        }
+    }
+    uint32_t n = 0;
+    uint32_t count = 0;
+    for (; *name >= '0' && *name <= '9'; name++, count++) {
+        if (count == 9U) {
+            return false;
+        }
+        n = n * 10U + (uint32_t)(*name - '0');
+    }
+    if (count == 0U) {
+        return false;
+    }
+    for (const char *e = slot->ext; *e; e++, name++) {
+        if (!sd_char_equal(*e, *name)) {
+            return false;
+        }
+    }
+    if (*name != '\0') {
+        return false;
+    }
+    *number = n;
+    return true;
+}
+
+static sd_seq_slot *sd_seq_find(const char *key, const char *prefix) {
+    for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+        if (!s_seq[i].used || strcmp(s_seq[i].key, key) != 0) {
+            continue;
+        }
+        const char *a = s_seq[i].prefix;
+        const char *b = prefix;
+        while (*a && sd_char_equal(*a, *b)) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') {
+            return &s_seq[i];
+        }
+    }
+    return NULL;
+}
+
+/* Read directory key once for every slot on it that lacks its number. */
+static FRESULT sd_seq_scan(const char *key) {
+    char path[SD_DIRINDEX_PATH + 2];
+    path[0] = key[0];
+    path[1] = ':';
+    path[2] = '/';
+    strcpy(&path[3], &key[2]);
+    for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+        if (s_seq[i].used && strcmp(s_seq[i].key, key) == 0) {
+            s_seq[i].last = 0;
+        }
+    }
+
+    SD_POOL_DIR_DECL(dj);
+    FILINFO *fno = &s_seq_fno;
+    if (dj == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_opendir(dj, path);
+    if (res != FR_OK) {
+        sd_pool_dir_put(dj);
+        return res;
+    }
+    for (;;) {
+        res = f_readdir(dj, fno);
+        if (res != FR_OK || fno->fname[0] == '\0') {
+            break;
+        }
+        for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+            sd_seq_slot *slot = &s_seq[i];
+            uint32_t n;
+            if (slot->used && strcmp(slot->key, key) == 0 &&
+                ((fno->fattrib & AM_DIR) == 0U) && sd_seq_number(slot, fno->fname, &n) &&
+                n > slot->last) {
+                slot->last = n;
+            }
+        }
+    }
+    (void)f_closedir(dj);
+    sd_pool_dir_put(dj);
+    for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+        if (s_seq[i].used && strcmp(s_seq[i].key, key) == 0) {
+            s_seq[i].valid = (res == FR_OK);
+        }
+    }
+    return res;
+}
+
+/* At mount: one pass over each directory a slot is registered for. */
+static void sd_seq_scan_all(void) {
+    for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+        if (s_seq[i].used && !s_seq[i].valid) {
+            (void)sd_seq_scan(s_seq[i].key);
+        }
+    }
+}
+
+/* path was created: a higher number raises the slot's figure. */
+static void sd_seq_added(const char *path) {
+    char key[SD_DIRINDEX_PATH];
+    const char *name;
+    if (!sd_dirindex_split(path, key, &name)) {
+        return;
+    }
+    for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+        sd_seq_slot *slot = &s_seq[i];
+        uint32_t n;
+        if (slot->valid && strcmp(slot->key, key) == 0 && sd_seq_number(slot, name, &n) &&
+            n > slot->last) {
+            slot->last = n;
+        }
+    }
+}
+
+/*
+ * path is gone (NULL = everything may have changed). Removing the highest
+ * name, or the directory itself, has the next sd_seq_next read it again.
+ */
+static void sd_seq_removed(const char *path) {
+    char key[SD_DIRINDEX_PATH];
+    const char *name = NULL;
+    size_t len = 0;
+    if (path != NULL && sd_dirindex_split(path, key, &name)) {
+        len = strlen(key);
+    } else {
+        path = NULL;
+    }
+    for (int i = 0; i < SD_SEQ_SLOTS; i++) {
+        sd_seq_slot *slot = &s_seq[i];
+        uint32_t n;
+        if (!slot->valid) {
+            continue;
+        }
+        if (path == NULL) {
+            slot->valid = false;
+        } else if (strcmp(slot->key, key) == 0) {
+            if (sd_seq_number(slot, name, &n) && n == slot->last) {
+                slot->valid = false;
+            }
+        } else if (strncmp(slot->key, key, len) == 0) {
+            /* A directory on the slot's path: key, then name as one component. */
+            const char *rest = &slot->key[len];
+            if (len > 2U) {
+                if (*rest != '/') {
+                    continue;
+                }
+                rest++;
+            }
+            const char *q = name;
+            while (*q && sd_char_equal(*q, *rest)) {
+                q++;
+                rest++;
+            }
+            if (*q == '\0' && (*rest == '\0' || *rest == '/')) {
+                slot->valid = false;
+            }
+        }
+    }
+}
+#endif
+
+int sd_seq_register(const char *dir, const char *prefix, const char *ext, uint32_t digits) {
+#if (SD_SEQ_SLOTS > 0)
+    char probe[SD_DIRINDEX_PATH + 2];
+    char key[SD_DIRINDEX_PATH];
+    const char *name;
+    if (dir == NULL || prefix == NULL || digits == 0U || digits > 9U) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (ext == NULL) {
+        ext = "";
+    }
+    /* Normalize dir the way the hooks will see paths inside it. */
+    int n = snprintf(probe, sizeof(probe), "%s/x", dir);
+    if (n < 0 || (size_t)n >= sizeof(probe) || strlen(prefix) >= SD_SEQ_PREFIX ||
+        strlen(ext) >= SD_SEQ_EXT || !sd_dirindex_split(probe, key, &name)) {
+        return FR_INVALID_NAME;
+    }
+
+    sd_seq_slot *slot = sd_seq_find(key, prefix);
+    for (int i = 0; i < SD_SEQ_SLOTS && slot == NULL; i++) {
+        if (!s_seq[i].used) {
+            slot = &s_seq[i];
+        }
+    }
+    if (slot == NULL) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+    strcpy(slot->key, key);
+    strcpy(slot->prefix, prefix);
+    strcpy(slot->ext, ext);
+    slot->digits = digits;
+    slot->last = 0;
+    slot->valid = false;
+    slot->used = true;
+    return (fs.fs_type != 0) ? sd_seq_scan(key) : FR_OK;
+#else
+    (void)dir;
+    (void)prefix;
+    (void)ext;
+    (void)digits;
+    return FR_DENIED;
+#endif
+}
+
+int sd_seq_next(const char *dir, const char *prefix, char *path, size_t len, uint32_t *number) {
+#if (SD_SEQ_SLOTS > 0)
+    char probe[SD_DIRINDEX_PATH + 2];
+    char key[SD_DIRINDEX_PATH];
+    const char *name;
+    if (dir == NULL || prefix == NULL || path == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    int n = snprintf(probe, sizeof(probe), "%s/x", dir);
+    if (n < 0 || (size_t)n >= sizeof(probe) || !sd_dirindex_split(probe, key, &name)) {
+        return FR_INVALID_NAME;
+    }
+    sd_seq_slot *slot = sd_seq_find(key, prefix);
+    if (slot == NULL) {
+        return FR_NO_FILE;
+    }
+    if (fs.fs_type == 0 && !s_lazy_pending) {
+        return FR_NOT_ENABLED; /* a lazy mount happens in the scan below */
+    }
+    if (!slot->valid) {
+        FRESULT res = sd_seq_scan(key);
+        if (res != FR_OK) {
+            return res;
+        }
+    }
+
+    uint32_t limit = 1U;
+    for (uint32_t d = 0; d < slot->digits; d++) {
+        limit *= 10U;
+    }
+    uint32_t next = slot->last + 1U;
+    if (next >= limit) {
+        return FR_DENIED; /* the numbers ran out at this width */
+    }
+    n = snprintf(path, len, "%c:/%s%s%s%0*lu%s", key[0], &key[2], (key[2] != '\0') ? "/" : "",
+                 slot->prefix, (int)slot->digits, (unsigned long)next, slot->ext);
+    if (n < 0 || (size_t)n >= len) {
+        return FR_INVALID_PARAMETER;
+    }
+    slot->last = next; /* handed out, even if never created */
+    if (number != NULL) {
+        *number = next;
+    }
+    return FR_OK;
+#else
+    (void)dir;
+    (void)prefix;
+    (void)path;
+    (void)len;
+    (void)number;
+    return FR_DENIED;
+#endif
+}
+
+void sd_dirindex_add(const char *path) {
+    sd_path_changed(path); /* a create may have replaced it */
+#if (SD_SEQ_SLOTS > 0)
+    if (path != NULL) {
+        sd_seq_added(path);
+    }
+#endif
+#if (SD_DIRINDEX_SLOTS > 0)
+    char key[SD_DIRINDEX_PATH];
+    const char *name;
+    if (path == NULL) {
+        return;
+    }
+    if (!sd_dirindex_split(path, key, &name)) {
+        return; /* lookups of such names bypass the index anyway */
+    }
+    sd_dirindex_dir *dir = sd_dirindex_find(key);
+    if (dir != NULL && !sd_dirindex_insert(dir, sd_name_hash(name))) {
+        sd_dirindex_drop(dir);
+    }
+#else
+    (void)path;
+#endif
+}
+
+void sd_dirindex_invalidate(const char *path) {
+    sd_path_changed(path);
+#if (SD_SEQ_SLOTS > 0)
+    sd_seq_removed(path);
+#endif
+#if (SD_DIRINDEX_SLOTS > 0)
+    char key[SD_DIRINDEX_PATH];
+    const char *name;
+    size_t len = 0;
+    if (path != NULL) {
+        if (!sd_dirindex_split(path, key, &name)) {
+            path = NULL; /* cannot tell which index it affects: drop all */
+        } else {
+            /* path names a directory: its key is the parent key plus its name. */
+            len = strlen(key);
+            if (len > 2U && len + 1U < SD_DIRINDEX_PATH) {
+                key[len++] = '/';
+            }
+            for (; *name && len + 1U < SD_DIRINDEX_PATH; name++) {
+                key[len++] = (*name >= 'a' && *name <= 'z') ? (char)(*name - 'a' + 'A') : *name;
+            }
+            key[len] = '\0';
+        }
+    }
+    for (int i = 0; i < SD_DIRINDEX_DIRS; i++) {
+        sd_dirindex_dir *dir = &s_dirindex[i];
+        if (dir->valid &&
+            (path == NULL || (strncmp(dir->key, key, len) == 0 &&
+                              (dir->key[len] == '\0' || dir->key[len] == '/')))) {
+            sd_dirindex_drop(dir);
+        }
+    }
+#else
+    (void)path;
+#endif
+}
+
+int sd_stat(const char *path, FILINFO *fno) {
+    if (path == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+#if (SD_DIRINDEX_SLOTS > 0)
+    if (!sd_dirindex_may_exist(path)) {
+        return FR_NO_FILE;
+    }
+#endif
+#if (_FS_MINIMIZE == 0)
+#if (SD_STAT_CACHE_SLOTS > 0)
+    const char *key = sd_path_key(path, SD_STAT_CACHE_PATH);
+    if (key == NULL) {
+        return f_stat(path, fno);
+    }
+    sd_stat_slot *slot = sd_stat_lookup(key);
+    if (slot != NULL) {
+        s_stat_stats.hits++;
+    } else {
+        slot = &s_stat[0];
+        for (int i = 1; i < SD_STAT_CACHE_SLOTS && slot->valid; i++) {
+            if (!s_stat[i].valid || s_stat[i].stamp < slot->stamp) {
+                slot = &s_stat[i];
+            }
+        }
+        slot->valid = false;
+        s_stat_stats.misses++;
+        FRESULT res = f_stat(path, &slot->fno);
+        if (res != FR_OK) {
+            return res;
+        }
+        memcpy(slot->key, key, strlen(key) + 1U);
+        slot->valid = true;
+    }
+    slot->stamp = ++s_stat_clock;
+    if (fno != NULL) {
+        *fno = slot->fno;
+    }
+    return FR_OK;
+#else
+    return f_stat(path, fno);
+#endif
+#else
+    /* No f_stat: only whether the file or directory exists, by opening it. */
+    if (fno != NULL) {
+        return FR_DENIED;
+    }
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_open(file, path, FA_OPEN_EXISTING | FA_READ);
+    if (res == FR_OK) {
+        (void)f_close(file);
+    }
+    sd_pool_fil_put(file);
+    if (res == FR_NO_FILE) {
+        SD_POOL_DIR_DECL(dj);
+        if (dj == NULL) {
+            return FR_TOO_MANY_OPEN_FILES;
+        }
+        res = f_opendir(dj, path);
+        if (res == FR_OK) {
+            (void)f_closedir(dj);
+        } else if (res == FR_NO_PATH) {
+            res = FR_NO_FILE;
+        }
+        sd_pool_dir_put(dj);
+    }
+    return res;
+#endif
+}
+
+bool sd_file_exists(const char *path) {
+    return sd_stat(path, NULL) == FR_OK;
+}
+
+void sd_smallfile_get_stats(SD_SmallFileStats *out) {
+    if (out == NULL) {
+        return;
+    }
+#if (SD_SMALLFILE_POOL > 0)
+    *out = s_small_stats;
+    out->files = 0;
+    out->bytes = 0;
+    for (int i = 0; i < SD_SMALLFILE_SLOTS; i++) {
+        if (s_small[i].valid) {
+            out->files++;
+            out->bytes += s_small[i].size;
+        }
+    }
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
+
+void sd_stat_cache_get_stats(SD_StatCacheStats *out) {
+    if (out == NULL) {
+        return;
+    }
+#if (SD_STAT_CACHE_SLOTS > 0) && (_FS_MINIMIZE == 0)
+    *out = s_stat_stats;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
+
+/* f_open that frees a cached handle and retries when _FS_LOCK has no entry left. */
+static FRESULT sd_open(FIL *fp, const char *filename, BYTE mode) {
+    bool create = (mode & (FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS)) != 0U;
+#if (SD_DIRINDEX_SLOTS > 0)
+    if (!create && !sd_dirindex_may_exist(filename)) {
+        return FR_NO_FILE;
+    }
+#endif
+    FRESULT res = SD_PROF_OPEN_CALL(fp, filename, f_open(fp, filename, mode));
+#if (SD_FILE_CACHE_LIMIT > 0)
+    while (res == FR_TOO_MANY_OPEN_FILES && sd_file_cache_evict()) {
+        res = SD_PROF_OPEN_CALL(fp, filename, f_open(fp, filename, mode));
+    }
+#endif
+    if (res == FR_OK && create) {
+        sd_dirindex_add(filename);
+    }
+    return res;
+}
+
+/*
+ * Open filename for sd_write_file (append = false: positioned at 0, truncated
+ * by sd_put_finish) or sd_append_file (positioned at the end), ready for a
+ * write of len bytes. *fpp is a cached handle when one is available,
+ * otherwise local.
+ */
+static FRESULT sd_put_open(const char *filename, bool append, UINT len, FIL *local, FIL **fpp) {
+    FRESULT res;
+    FIL *fp = local;
+
+    sd_path_changed(filename); /* size and time are about to change */
+
+#if (SD_FILE_CACHE_LIMIT > 0)
+    sd_file_slot *slot = NULL;
+    if (strlen(filename) < SD_FILE_CACHE_PATH) {
+        sd_file_slot *victim = NULL;
+        for (int i = 0; i < SD_FILE_CACHE_LIMIT && slot == NULL; i++) {
+            if (s_files[i].open && sd_path_equal(s_files[i].path, filename)) {
+                slot = &s_files[i];
+            } else if (victim == NULL || !s_files[i].open ||
+                       (victim->open && s_files[i].stamp < victim->stamp)) {
+                victim = &s_files[i];
+            }
+        }
+        if (slot == NULL) {
+            if (victim->open) {
+                (void)sd_file_slot_close(victim);
+            }
+            res = sd_open(&victim->file, filename, FA_OPEN_ALWAYS | FA_WRITE);
+            if (res != FR_OK) {
+                return res;
+            }
+            strcpy(victim->path, filename);
+            victim->end = f_size(&victim->file);
+            victim->open = true;
+#if SD_FILE_HOLD
+            victim->held = 0;
+#endif
+            slot = victim;
+        }
+        slot->stamp = ++s_files_clock;
+        fp = &slot->file;
+    } else
+#endif
+    {
+        res = sd_open(fp, filename, append ? (FA_OPEN_ALWAYS | FA_WRITE)
+                                           : (FA_CREATE_ALWAYS | FA_WRITE));
+        if (res != FR_OK) {
+            return res;
+        }
+    }
+
+    FSIZE_t pos = append ? f_size(fp) : 0;
+#if (SD_FILE_CACHE_LIMIT > 0)
+    if (fp != local && append) {
+        pos = slot->end;
+    }
+#endif
+    res = SD_PROF_FCALL(SD_PROF_LSEEK, fp, f_lseek(fp, pos));
+#if (SD_FILE_CACHE_LIMIT > 0) && (SD_EXTENT_CLUSTERS > 0)
+    if (res == FR_OK && fp != local) {
+        res = sd_extent_reserve(fp, pos + len);
+    }
+#else
+    (void)len;
+#endif
+    if (res != FR_OK) {
+#if (SD_FILE_CACHE_LIMIT > 0)
+        if (fp != local) {
+            (void)sd_file_slot_close(slot);
+            return res;
+        }
+#endif
+        (void)SD_PROF_FCALL(SD_PROF_CLOSE, fp, f_close(fp));
+        return res;
+    }
+    *fpp = fp;
+    return FR_OK;
+}
+
+/* Finish a write started by sd_put_open; ok is false if the write itself failed. */
+static FRESULT sd_put_finish(FIL *fp, FIL *local, bool append, bool ok) {
+    if (fp == local) {
+        return SD_PROF_FCALL(SD_PROF_CLOSE, fp, f_close(fp));
+    }
+#if (SD_FILE_CACHE_LIMIT > 0)
+    sd_file_slot *slot = &s_files[0];
+    while (&slot->file != fp) {
+        slot++;
+    }
+    FRESULT res = FR_OK;
+    slot->end = fp->fptr;
+#if (SD_EXTENT_CLUSTERS == 0)
+    if (!append) {
+        res = f_truncate(fp);
+    }
+#else
+    (void)append; /* a rewrite's old tail goes with the extent when the handle closes */
+#endif
+    if (!ok) {
+        /* Do not keep a handle in an unknown state. */
+        FRESULT r = sd_file_slot_close(slot);
+        return (res == FR_OK) ? r : res;
+    }
+    if (res == FR_OK && SD_FILE_CACHE_SYNC_WRITES) {
+        res = SD_PROF_FCALL(SD_PROF_SYNC, fp, f_sync(fp));
+    }
+    if (res != FR_OK) {
+        (void)sd_file_slot_close(slot);
+        return res;
+    }
+#if SD_FILE_HOLD
+    sd_file_slot_hold(slot, true);
+#endif
+    return res;
+#else
+    (void)append;
+    (void)ok;
+    return FR_OK;
+#endif
+}
+
+int sd_file_cache_flush(void) {
+    FRESULT res = FR_OK;
+#if (SD_FILE_CACHE_LIMIT > 0)
+    for (int i = 0; i < SD_FILE_CACHE_LIMIT; i++) {
+        if (s_files[i].open) {
+            FRESULT r = SD_PROF_FCALL(SD_PROF_SYNC, &s_files[i].file, f_sync(&s_files[i].file));
+            sd_path_changed(s_files[i].path);
+            if (res == FR_OK) {
+                res = r;
+            }
+        }
+    }
+#endif
+    return res;
+}
+
+int sd_file_cache_close(const char *filename) {
+    FRESULT res = FR_OK;
+#if (SD_FILE_CACHE_LIMIT > 0)
+    for (int i = 0; i < SD_FILE_CACHE_LIMIT; i++) {
+        if (s_files[i].open && (filename == NULL || sd_path_equal(s_files[i].path, filename))) {
+            FRESULT r = sd_file_slot_close(&s_files[i]);
+            if (res == FR_OK) {
+                res = r;
+            }
+        }
+    }
+#else
+    (void)filename;
+#endif
+    return res;
+}
+
+int sd_system_init(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin, bool use_dma) {
+    return (SD_DiskIoInit(hspi, cs_port, cs_pin, use_dma) == SD_OK) ? 0 : -1;
+}
+
+int sd_get_space_kb(void) {
+#if (_FS_MINIMIZE != 0)
+    SD_APP_LOG("Free space needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+#else
+    FATFS *pfs;
+    DWORD fre_clust;
+    FRESULT res = f_getfree(sd_path, &fre_clust, &pfs);
+    if (res != FR_OK) return res;
+
+    /* exFAT clusters reach 32 MiB: sector counts no longer fit a DWORD product. */
+    uint64_t total_kb = (uint64_t)(pfs->n_fatent - 2U) * pfs->csize / 2U;
+    uint64_t free_kb = (uint64_t)fre_clust * pfs->csize / 2U;
+    SD_APP_LOG("Total: %lu KB, Free: %lu KB\r\n", (unsigned long)total_kb,
+               (unsigned long)free_kb);
+    return FR_OK;
+#endif
+}
+
+bool sd_free_space_get(uint32_t *free_kb, uint32_t *total_kb) {
+    if (fs.fs_type == 0 || fs.free_clst > fs.n_fatent - 2U) {
+        return false;
+    }
+    if (free_kb) {
+        *free_kb = (uint32_t)((uint64_t)fs.free_clst * fs.csize / 2U);
+    }
+    if (total_kb) {
+        *total_kb = (uint32_t)((uint64_t)(fs.n_fatent - 2U) * fs.csize / 2U);
+    }
+    return true;
+}
+
+#if SD_FREE_BACKGROUND
+static volatile bool s_free_pending; // Mounted without a valid free count
+static volatile bool s_free_more;    // Free map has work left
+#if (SD_SPACE_CACHE == 1)
+static volatile bool s_space_reconcile; // Mounted, FAT recount not yet run
+static bool s_space_reconciled;         // The recount has confirmed the live count
+static DWORD s_space_hint = 0xFFFFFFFFU; // Count reported while the recount runs
+static int32_t s_space_drift;           // Recount minus the count it replaced, in clusters
+#endif
+
+#if defined(USE_FREERTOS)
+static SemaphoreHandle_t s_free_lock;
+static TaskHandle_t s_free_task;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_free_lock_buffer;
+static StaticTask_t s_free_task_buffer;
+static StackType_t s_free_task_stack[SD_FREE_TASK_STACK];
+#endif
+#define SD_FREE_LOCK()   do { if (s_free_lock) (void)xSemaphoreTake(s_free_lock, portMAX_DELAY); } while (0)
+#define SD_FREE_UNLOCK() do { if (s_free_lock) (void)xSemaphoreGive(s_free_lock); } while (0)
+
+#if (SD_FREEMAP_GROUPS > 0U)
+#define SD_FREE_IDLE_TICKS pdMS_TO_TICKS(SD_FREEMAP_IDLE_MS)
+#else
+#define SD_FREE_IDLE_TICKS portMAX_DELAY
+#endif
+
+static void sd_free_task(void *argument) {
+    (void)argument;
+    TickType_t wait = portMAX_DELAY;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, wait);
+        (void)sd_free_space_poll();
+        wait = s_free_more ? 1U : SD_FREE_IDLE_TICKS; /* one slice per tick while scanning */
+    }
+}
+
+static bool sd_free_create_task(void) {
+    if (s_free_task != NULL) {
+        return true;
+    }
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    if (s_free_lock == NULL) {
+        s_free_lock = xSemaphoreCreateMutexStatic(&s_free_lock_buffer);
+    }
+    if (s_free_lock == NULL) {
+        return false;
+    }
+    s_free_task = xTaskCreateStatic(sd_free_task, "sd_free", SD_FREE_TASK_STACK, NULL,
+                                    SD_FREE_TASK_PRIORITY, s_free_task_stack, &s_free_task_buffer);
+#else
+    if (s_free_lock == NULL) {
+        s_free_lock = xSemaphoreCreateMutex();
+    }
+    if (s_free_lock == NULL) {
+        return false;
+    }
+    if (xTaskCreate(sd_free_task, "sd_free", SD_FREE_TASK_STACK, NULL,
+                    SD_FREE_TASK_PRIORITY, &s_free_task) != pdPASS) {
+        s_free_task = NULL;
+    }
+#endif
+    return s_free_task != NULL;
+}
+#else
+#define SD_FREE_LOCK()   do { } while (0)
+#define SD_FREE_UNLOCK() do { } while (0)
+#endif
+
+/* Wake the background worker after a mount. */
+static void sd_free_kick(void) {
+#if defined(USE_FREERTOS)
+    if (sd_free_create_task()) {
+        (void)xTaskNotifyGive(s_free_task);
+    }
+#endif
+}
+#endif
+
+#if (SD_FAST_MOUNT == 1)
+/* Report the FSINFO free count if the volume has one; otherwise queue the FAT scan. */
+static void sd_free_space_defer(void) {
+    uint32_t free_kb, total_kb;
+    if (sd_free_space_get(&free_kb, &total_kb)) {
+        SD_APP_LOG("Total: %lu KB, Free: %lu KB (FSINFO)\r\n", (unsigned long)total_kb,
+                   (unsigned long)free_kb);
+        return;
+    }
+    s_free_pending = true;
+    SD_APP_LOG("Free space: no FSINFO count, deferred to background\r\n");
+}
+#endif
+
+#if (SD_SPACE_CACHE == 1)
+/* Trust the mount's count (FSINFO) for now and queue the FAT recount. */
+static void sd_space_cache_start(void) {
+    uint32_t free_kb, total_kb;
+    s_space_hint = fs.free_clst;
+    s_space_reconciled = false;
+    s_space_drift = 0;
+    s_space_reconcile = true;
+    if (sd_free_space_get(&free_kb, &total_kb)) {
+        SD_APP_LOG("Total: %lu KB, Free: %lu KB (FSINFO, reconcile queued)\r\n",
+                   (unsigned long)total_kb, (unsigned long)free_kb);
+    } else {
+        SD_APP_LOG("Free space: no FSINFO count, counted in the background\r\n");
+    }
+}
+
+/*
+ * Recount the free clusters with f_getfree (under the volume lock). FatFs keeps
+ * the count live as it allocates and frees, so this only corrects what the
+ * FSINFO figure got wrong; readers get that figure until the scan ends.
+ */
+static FRESULT sd_space_reconcile(void) {
+#if (_FS_MINIMIZE == 0)
+    DWORD before = fs.free_clst;
+    DWORD fre_clust;
+    FATFS *pfs;
+    s_space_hint = before;
+    fs.free_clst = 0xFFFFFFFFU; /* an invalid count makes f_getfree scan */
+    FRESULT res = f_getfree(sd_path, &fre_clust, &pfs);
+    if (res != FR_OK) {
+        if (fs.free_clst > fs.n_fatent - 2U) {
+            fs.free_clst = before;
+        }
+        return res;
+    }
+    s_space_reconciled = true;
+    if (before <= fs.n_fatent - 2U && before != fre_clust) {
+        s_space_drift = (int32_t)(fre_clust - before);
+        SD_APP_LOG("Free space reconciled: %ld clusters off FSINFO\r\n", (long)s_space_drift);
+    }
+    return FR_OK;
+#else
+    s_space_reconciled = false;
+    return FR_OK;
+#endif
+}
+#endif
+
+int sd_free_space_poll(void) {
+#if SD_FREE_BACKGROUND
+    FRESULT res = FR_OK;
+    SD_FREE_LOCK();
+#if (SD_SPACE_CACHE == 1)
+    if (s_space_reconcile) {
+        res = sd_space_reconcile();
+        s_space_reconcile = false;
+        s_free_pending = false; /* the recount leaves FatFs a valid count */
+    }
+#endif
+#if (SD_FREEMAP_GROUPS > 0U)
+    /* The map's first scan seeds the FatFs count, a slice at a time. */
+    s_free_more = SD_FreeMapStep();
+    SD_FreeMapStats st;
+    SD_FreeMapGetStats(&st);
+    if (st.error) {
+        res = FR_DISK_ERR;
+    }
+    if (sd_free_space_get(NULL, NULL) || st.groups == 0U || st.error) {
+        s_free_pending = false;
+    }
+#endif
+    if (s_free_pending) {
+#if (_FS_MINIMIZE == 0)
+        DWORD fre_clust;
+        FATFS *pfs;
+        res = f_getfree(sd_path, &fre_clust, &pfs); /* full FAT scan, under the volume lock */
+#endif
+        s_free_pending = false;
+    }
+    SD_FREE_UNLOCK();
+    return res;
+#else
+    return FR_OK;
+#endif
+}
+
+int sd_get_space_cached(SD_SpaceInfo *info) {
+    if (info == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    memset(info, 0, sizeof(*info));
+    if (fs.fs_type == 0) {
+        return FR_NOT_ENABLED;
+    }
+    DWORD clst = fs.free_clst;
+#if (SD_SPACE_CACHE == 1)
+    if (clst > fs.n_fatent - 2U) {
+        clst = s_space_hint; /* the recount is running */
+    }
+    info->reconciled = s_space_reconciled;
+    info->drift_kb = (int32_t)((int64_t)s_space_drift * fs.csize / 2);
+#endif
+    info->total_kb = (uint32_t)((uint64_t)(fs.n_fatent - 2U) * fs.csize / 2U);
+    if (clst > fs.n_fatent - 2U) {
+        return FR_NOT_READY;
+    }
+    info->free_kb = (uint32_t)((uint64_t)clst * fs.csize / 2U);
+    return FR_OK;
+}
+
+/* Cache sizes in effect before sd_mount_readonly raised them. */
+static struct {
+    bool active;
+    uint32_t lines;
+    uint32_t readahead;
+    uint32_t fat_groups;
+    uint32_t class_lines[3];
+} s_readonly_saved;
+
+/* No writes to make room for: every cache gets the RAM it was built with. */
+static void sd_readonly_enter(void) {
+    SD_DiskCacheStats st;
+    SD_DiskGetCacheStats(0, &st);
+    s_readonly_saved.lines = st.sectors.lines;
+    s_readonly_saved.readahead = st.readahead_window;
+    s_readonly_saved.fat_groups = st.fat_groups;
+    SD_CacheGetClassLines(&s_readonly_saved.class_lines[0], &s_readonly_saved.class_lines[1],
+                          &s_readonly_saved.class_lines[2]);
+    s_readonly_saved.active = true;
+
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, SD_CACHE_ENABLED ? SD_CACHE_LINES : 0U);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, SD_READAHEAD_SECTORS);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, SD_FAT_CACHE_GROUPS);
+#if SD_CACHE_ENABLED && (SD_CACHE_CLASSES == 1)
+    /* FAT and directories keep their quotas; file data takes every other line. */
+    (void)SD_CacheSetClassLines(SD_CACHE_FAT_LINES, SD_CACHE_DIR_LINES,
+                                SD_CACHE_LINES - SD_CACHE_FAT_LINES - SD_CACHE_DIR_LINES);
+#endif
+}
+
+static void sd_readonly_leave(void) {
+    if (!s_readonly_saved.active) {
+        return;
+    }
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, s_readonly_saved.lines);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, s_readonly_saved.readahead);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, s_readonly_saved.fat_groups);
+#if SD_CACHE_ENABLED && (SD_CACHE_CLASSES == 1)
+    (void)SD_CacheSetClassLines(s_readonly_saved.class_lines[0], s_readonly_saved.class_lines[1],
+                                s_readonly_saved.class_lines[2]);
+#endif
+    (void)SD_DiskSetReadOnly(0, false);
+    s_readonly_saved.active = false;
+}
+
+/* Tell the drive where FAT, directories and data of the mounted volume are. */
+static void sd_mount_regions(void) {
+    uint32_t alloc_first = fs.fatbase;
+    uint32_t alloc_count = fs.fsize * fs.n_fats;
+#if _FS_EXFAT
+    if (fs.fs_type == FS_EXFAT) {
+        /* Allocation goes through the bitmap (cluster 2), not the FAT: cache that instead. */
+        alloc_first = fs.database;
+        alloc_count = (fs.n_fatent - 2U + 8U * _MIN_SS - 1U) / (8U * _MIN_SS);
+    }
+#endif
+    SD_DiskSetFatRegion(0, alloc_first, alloc_count);
+    SD_DiskSetMetaRegion(0, fs.volbase, fs.database - fs.volbase);
+    SD_DiskSetCacheRegions(0, fs.fatbase,
+                           (fs.fs_type == FS_FAT12 || fs.fs_type == FS_FAT16) ? fs.dirbase
+                                                                             : fs.database,
+                           fs.database);
+    if (fs.fs_type != FS_EXFAT) {
+        SD_DiskSetFatMirror(0, fs.fatbase, fs.fsize, fs.n_fats);
+    }
+    SD_ProfSetRegions(0, fs.fatbase, fs.fsize * fs.n_fats, fs.database);
+}
+
+#if SD_WARM
+static void sd_warm_path(char *path, size_t len) {
+    (void)snprintf(path, len, "%s%s", sd_path, SD_WARM_NAME);
+}
+
+/* Read the list the last unmount saved, for sd_warm_poll; header: magic, volbase, count. */
+static void sd_warm_load(void) {
+    char path[sizeof(sd_path) + sizeof(SD_WARM_NAME)];
+    uint32_t head[3];
+    UINT br = 0;
+    FIL fil;
+    s_warm_count = 0;
+    s_warm_next = 0;
+    sd_warm_path(path, sizeof(path));
+    if (f_open(&fil, path, FA_READ) != FR_OK) {
+        return;
+    }
+    if (f_read(&fil, head, sizeof(head), &br) == FR_OK && br == sizeof(head) &&
+        head[0] == SD_WARM_MAGIC && head[1] == (uint32_t)fs.volbase &&
+        head[2] <= SD_WARM_SECTORS &&
+        f_read(&fil, s_warm_list, head[2] * sizeof(uint32_t), &br) == FR_OK &&
+        br == head[2] * sizeof(uint32_t)) {
+        s_warm_count = head[2];
+    }
+    (void)f_close(&fil);
+    /* Ascending, so neighbouring sectors share a multi-block read. */
+    for (uint32_t i = 1; i < s_warm_count; i++) {
+        uint32_t v = s_warm_list[i];
+        uint32_t j = i;
+        for (; j > 0U && s_warm_list[j - 1U] > v; j--) {
+            s_warm_list[j] = s_warm_list[j - 1U];
+        }
+        s_warm_list[j] = v;
+    }
+    s_warm_stats.loaded = s_warm_count;
+    s_warm_stats.prefetched = 0;
+}
+
+/* Save this session's hottest sectors, topped up with the list loaded at mount. */
+static void sd_warm_save(void) {
+#if !_FS_READONLY
+    if (fs.fs_type == 0 || s_readonly_saved.active) {
+        return;
+    }
+    uint32_t n = SD_DiskWarmList(0, s_warm_hot, SD_WARM_SECTORS);
+    for (uint32_t i = 0; i < s_warm_count && n < SD_WARM_SECTORS; i++) {
+        uint32_t j = 0;
+        while (j < n && s_warm_hot[j] != s_warm_list[i]) {
+            j++;
+        }
+        if (j == n) {
+            s_warm_hot[n++] = s_warm_list[i];
+        }
+    }
+    if (n == 0U) {
+        return;
+    }
+    char path[sizeof(sd_path) + sizeof(SD_WARM_NAME)];
+    uint32_t head[3] = {SD_WARM_MAGIC, (uint32_t)fs.volbase, n};
+    UINT bw = 0;
+    UINT bw_list = 0;
+    FIL fil;
+    sd_warm_path(path, sizeof(path));
+    FRESULT res = f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (res == FR_OK) {
+        res = f_write(&fil, head, sizeof(head), &bw);
+        if (res == FR_OK) {
+            res = f_write(&fil, s_warm_hot, n * sizeof(uint32_t), &bw_list);
+        }
+        FRESULT closed = f_close(&fil);
+        res = (res != FR_OK) ? res : closed;
+    }
+    sd_path_changed(path);
+    if (res == FR_OK && bw == sizeof(head) && bw_list == n * sizeof(uint32_t)) {
+        s_warm_stats.saved = n;
+    } else {
+        s_warm_stats.errors++;
+        SD_APP_LOG_ERROR("SD unmount: warm-up list not saved: %d\r\n", res);
+    }
+#endif
+}
+#endif
+
+int sd_warm_poll(void) {
+#if SD_WARM
+    if (fs.fs_type == 0) {
+        return FR_NOT_ENABLED;
+    }
+    if (s_warm_next >= s_warm_count) {
+        return FR_OK;
+    }
+#if _FS_REENTRANT
+    if (!ff_req_grant(fs.sobj)) {
+        return FR_TIMEOUT;
+    }
+#endif
+    uint32_t used = 0;
+    SD_Status status = SD_DiskWarmRun(0, &s_warm_list[s_warm_next], s_warm_count - s_warm_next,
+                                      s_warm_buf, SD_WARM_RUN_SECTORS, &used);
+#if _FS_REENTRANT
+    ff_rel_grant(fs.sobj);
+#endif
+    if (status == SD_BUSY) {
+        return FR_TIMEOUT; /* batch mode or lent out: try again later */
+    }
+    if (status != SD_OK) {
+        s_warm_stats.errors++;
+        s_warm_next = s_warm_count; /* only a speed-up: give the rest up */
+        return FR_DISK_ERR;
+    }
+    s_warm_next += used;
+    s_warm_stats.prefetched += used;
+    s_warm_stats.reads++;
+    return FR_OK;
+#else
+    return FR_OK;
+#endif
+}
+
+void sd_warm_get_stats(SD_WarmStats *out) {
+    if (out == NULL) {
+        return;
+    }
+#if SD_WARM
+    *out = s_warm_stats;
+    out->pending = s_warm_count - s_warm_next;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
+
+int sd_capture_save(const char *path, uint32_t *records) {
+    if (records != NULL) {
+        *records = 0;
+    }
+#if (_FS_READONLY == 0)
+    SD_DiskCaptureRecord batch[8];
+    char line[96];
+    FIL fil;
+    UINT bw = 0;
+    uint32_t n;
+    if (path == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    SD_DiskCaptureStop(); /* the file's own writes are not part of the trace */
+    FRESULT res = f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (res != FR_OK) {
+        return res;
+    }
+    int len = snprintf(line, sizeof(line), "SDCAP,clock,%lu\r\n", (unsigned long)SystemCoreClock);
+    res = f_write(&fil, line, (UINT)len, &bw);
+    while (res == FR_OK && bw == (UINT)len &&
+           (n = SD_DiskCaptureRead(batch, sizeof(batch) / sizeof(batch[0]))) > 0U) {
+        for (uint32_t i = 0; i < n && res == FR_OK && bw == (UINT)len; i++) {
+            len = SD_DiskCaptureFormat(&batch[i], line, sizeof(line));
+            res = f_write(&fil, line, (UINT)len, &bw);
+            if (records != NULL && res == FR_OK) {
+                (*records)++;
+            }
+        }
+    }
+    if (res == FR_OK && bw != (UINT)len) {
+        res = FR_DENIED; /* volume full */
+    }
+    FRESULT closed = f_close(&fil);
+    sd_path_changed(path);
+    return (res != FR_OK) ? res : closed;
+#else
+    (void)path;
+    return FR_DENIED;
+#endif
+}
+
+/* Free-space tracking, recovery and checks of a mounted, writable volume. */
+static void sd_mount_services(void) {
+    SD_FreeMapStart(&fs);
+#if SD_WARM
+    sd_warm_load();
+#endif
+#if (SD_DEFRAG_ENABLED == 1)
+    FRESULT defrag_res = SD_DefragRecover(sd_path); /* a move cut short by a reset */
+    if (defrag_res != FR_OK) {
+        SD_APP_LOG_ERROR("Defrag recovery failed: %d\r\n", defrag_res);
+    }
+#endif
+#if (SD_FSCK_WINDOW_CLUSTERS > 0U) && defined(USE_FREERTOS)
+    (void)SD_FsckStartTask(&fs);
+#elif (SD_FSCK_WINDOW_CLUSTERS > 0U)
+    SD_FsckStart(&fs); /* stepped from the main loop */
+#endif
+#if (SD_SPACE_CACHE == 1)
+    sd_space_cache_start();
+#elif (SD_FAST_MOUNT == 1)
+    sd_free_space_defer();
+#elif (_FS_MINIMIZE == 0)
+    sd_get_space_kb();
+#endif
+#if SD_FREE_BACKGROUND
+    sd_free_kick();
+#endif
+}
+
+static int sd_mount_volume(bool read_only) {
+    FRESULT res;
+
+    s_lazy_pending = false;
+
+    SD_APP_LOG("\r\n========================================\r\n");
+    SD_APP_LOG("SD card mount%s\r\n", read_only ? " (read-only)" : "");
+    SD_APP_LOG("========================================\r\n");
+
+    SD_APP_LOG("Checking SD card presence...\r\n");
+    if (!SD_IsCardPresent(&g_sd_handle)) {
+        SD_APP_LOG_ERROR("ERROR: SD card not present!\r\n");
+        return FR_NOT_READY;
+    }
+    SD_APP_LOG("OK: SD card detected\r\n");
+
+    SD_APP_LOG("Initializing SD card disk interface...\r\n");
+    DSTATUS stat = disk_initialize(0);
+    SD_APP_LOG("disk_initialize returned: 0x%02X\r\n", stat);
+    if (stat != 0) {
+        SD_APP_LOG_ERROR("ERROR: disk_initialize failed: 0x%02X\r\n", stat);
+        SD_APP_LOG("  STA_NOINIT=0x01, STA_NODISK=0x02, STA_PROTECT=0x04\r\n");
+        return FR_NOT_READY;
+    }
+    SD_APP_LOG("OK: Disk interface initialized\r\n");
+
+    sd_readonly_leave(); /* a read-only mount never unmounted */
+    if (read_only) {
+        if (SD_DiskSetReadOnly(0, true) != SD_OK) {
+            SD_APP_LOG_ERROR("ERROR: Write-back before read-only mount failed\r\n");
+            return FR_DISK_ERR;
+        }
+        sd_readonly_enter();
+    }
+
+    SD_APP_LOG("Mounting filesystem at %s...\r\n", sd_path);
+    sd_dirindex_invalidate(NULL);
+    res = f_mount(&fs, sd_path, 1);
+    SD_APP_LOG("f_mount returned: %d (0=OK, 1=DISK_ERR, 2=INT_ERR, 3=NOT_READY, 4=NO_FILE, 13=INVALID_NAME)\r\n", res);
+    if (res == FR_OK) {
+        sd_mount_regions();
+#if (SD_SEQ_SLOTS > 0)
+        sd_seq_scan_all();
+#endif
+        if (read_only) {
+            /* No free-space scan, recovery or background checks: nothing may be written back. */
+            uint32_t free_kb, total_kb;
+            SD_APP_LOG("OK: Filesystem mounted read-only\r\n");
+            if (sd_free_space_get(&free_kb, &total_kb)) {
+                SD_APP_LOG("Total: %lu KB, Free: %lu KB (FSINFO)\r\n", (unsigned long)total_kb,
+                           (unsigned long)free_kb);
+            }
+            SD_APP_LOG("========================================\r\n\r\n");
+            return FR_OK;
+        }
+        SD_APP_LOG("OK: Filesystem mounted successfully\r\n");
+        SD_APP_LOG("Card Type: %s, %s\r\n", SD_IsSDHC(&g_sd_handle) ? "SDHC/SDXC" : "SDSC",
+                   (fs.fs_type == FS_FAT12) ? "FAT12" : (fs.fs_type == FS_FAT16) ? "FAT16" :
+                   (fs.fs_type == FS_FAT32) ? "FAT32" : "exFAT");
+        sd_mount_services();
+        SD_APP_LOG("========================================\r\n\r\n");
+        return FR_OK;
+    }
+
+    /* A card without a usable filesystem is never formatted implicitly; see sd_format(). */
+
+    sd_readonly_leave();
+    SD_APP_LOG_ERROR("ERROR: Mount failed with code: %d\r\n", res);
+    SD_APP_LOG("========================================\r\n\r\n");
+    return res;
+}
+
+int sd_mount(void) {
+    return sd_mount_volume(false);
+}
+
+int sd_mount_readonly(void) {
+    return sd_mount_volume(true);
+}
+
+int sd_mount_lazy(void) {
+    if (fs.fs_type != 0) {
+        return FR_OK;
+    }
+    sd_readonly_leave();
+    sd_dirindex_invalidate(NULL);
+    /* Registered only: FatFs identifies the card and mounts at the first call on the volume. */
+    FRESULT res = f_mount(&fs, sd_path, 0);
+    s_lazy_pending = (res == FR_OK);
+    SD_APP_LOG("SD mount deferred to first access: %d\r\n", res);
+    return res;
+}
+
+int sd_volume_extent(const char *path, uint32_t *first_sector, uint32_t *sector_count) {
+    if (!path || !first_sector || !sector_count) {
+        return FR_INVALID_PARAMETER;
+    }
+#if (_FS_MINIMIZE > 1)
+    return FR_DENIED;
+#else
+    DIR dir;
+    FRESULT res = f_opendir(&dir, path); /* mounts the volume on demand */
+    if (res != FR_OK) {
+        return res;
+    }
+    const FATFS *vfs = dir.obj.fs;
+    *first_sector = (uint32_t)vfs->volbase;
+    *sector_count = (uint32_t)(vfs->database + (vfs->n_fatent - 2U) * vfs->csize - vfs->volbase);
+    return f_closedir(&dir);
+#endif
+}
+
+int sd_mount_poll(void) {
+    if (!s_lazy_pending) {
+        return (fs.fs_type != 0) ? FR_OK : FR_NOT_READY;
+    }
+    if (fs.fs_type == 0) {
+        return FR_NOT_READY; /* nothing has touched the volume yet */
+    }
+#if _FS_REENTRANT
+    /* The mounting call may still be running in another task. */
+    if (!ff_req_grant(fs.sobj)) {
+        return FR_TIMEOUT;
+    }
+#endif
+    bool first = s_lazy_pending;
+    s_lazy_pending = false;
+    if (first) {
+        sd_mount_regions();
+    }
+#if _FS_REENTRANT
+    ff_rel_grant(fs.sobj);
+#endif
+    if (first) {
+        SD_APP_LOG("SD mounted on first access: %s\r\n",
+                   (fs.fs_type == FS_FAT12) ? "FAT12" : (fs.fs_type == FS_FAT16) ? "FAT16" :
+                   (fs.fs_type == FS_FAT32) ? "FAT32" : "exFAT");
+        sd_mount_services();
+    }
+    return FR_OK;
+}
+
+int sd_unmount(void) {
+    s_lazy_pending = false;
+    (void)sd_file_cache_close(NULL);
+    (void)sd_delete_cancel();
+#if SD_WARM
+    sd_warm_save();
+    s_warm_count = 0;
+    s_warm_next = 0;
+#endif
+    sd_dirindex_invalidate(NULL);
+#if SD_FREE_BACKGROUND
+    SD_FREE_LOCK(); /* wait out a running FAT scan */
+    s_free_pending = false;
+    s_free_more = false;
+#if (SD_SPACE_CACHE == 1)
+    s_space_reconcile = false;
+    s_space_reconciled = false;
+    s_space_hint = 0xFFFFFFFFU;
+    s_space_drift = 0;
+#endif
+#endif
+    SD_FreeMapStop();
+    SD_FsckStop();
+    SD_DefragStop();
+    if (SD_DiskMirrorFlush(0) != SD_OK) { /* f_mount(NULL) does not sync */
+        SD_APP_LOG_ERROR("SD unmount: FAT mirror copy failed\r\n");
+    }
+    SD_DiskSetFatMirror(0, 0, 0, 0); /* a format must reach every FAT */
+    FRESULT res = f_mount(NULL, sd_path, 1);
+    sd_readonly_leave();
+#if SD_FREE_BACKGROUND
+    SD_FREE_UNLOCK();
+#endif
+    SD_APP_LOG("SD unmount: %s\r\n", (res == FR_OK) ? "OK" : "Failed");
+    return res;
+}
+
+int sd_format(bool quick) {
+    /* At least one FatFs sector; four at 512 bytes. */
+    static uint8_t work[(_MAX_SS > 4U * SD_BLOCK_SIZE) ? _MAX_SS : 4U * SD_BLOCK_SIZE]
+        __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    SD_FormatOptions options = {
+        .quick = quick,
+        .volume_id = HAL_GetTick(),
+    };
+    SD_FormatLayout layout;
+
+    (void)sd_unmount();
+    FRESULT res = SD_FormatDrive(0, &options, work, sizeof(work), &layout);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("SD format failed: %d\r\n", res);
+        return res;
+    }
+    SD_APP_LOG("SD format: %s, %lu x %lu-sector clusters, data at %lu (AU %lu)\r\n",
+               (layout.fs_type == SD_FS_FAT12) ? "FAT12" :
+               (layout.fs_type == SD_FS_FAT16) ? "FAT16" :
+               (layout.fs_type == SD_FS_FAT32) ? "FAT32" : "exFAT",
+               (unsigned long)layout.clusters, (unsigned long)layout.cluster_sectors,
+               (unsigned long)layout.data_start, (unsigned long)layout.boundary);
+    return sd_mount();
+}
+
+#if (SD_HOTPLUG == 1)
+static uint32_t s_hotplug_events; // Card-detect events already handled
+static bool s_hotplug_mount;      // Card inserted, volume not mounted yet
+static FRESULT s_hotplug_res = FR_NOT_READY;
+
+#if defined(USE_FREERTOS)
+static TaskHandle_t s_hotplug_task;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticTask_t s_hotplug_task_buffer;
+static StackType_t s_hotplug_task_stack[SD_HOTPLUG_TASK_STACK];
+#endif
+
+static void sd_hotplug_task(void *argument) {
+    (void)argument;
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(SD_HOTPLUG_POLL_MS));
+        (void)sd_hotplug_poll();
+    }
+}
+#endif
+#endif
+
+int sd_hotplug_enable(GPIO_TypeDef *cd_port, uint16_t cd_pin, bool active_low) {
+#if (SD_HOTPLUG == 1)
+    if (SD_SetCardDetect(&g_sd_handle, cd_port, cd_pin, active_low) != SD_OK ||
+        SD_SetCardDetectIrq(&g_sd_handle, true) != SD_OK) {
+        return FR_INVALID_PARAMETER;
+    }
+    s_hotplug_events = SD_GetCardDetectEvents(&g_sd_handle);
+    s_hotplug_mount = (fs.fs_type == 0) && !s_lazy_pending && SD_IsCardPresent(&g_sd_handle);
+    s_hotplug_res = (fs.fs_type != 0) ? FR_OK : FR_NOT_READY;
+#if defined(USE_FREERTOS)
+    if (s_hotplug_task == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        s_hotplug_task = xTaskCreateStatic(sd_hotplug_task, "sd_hotplug", SD_HOTPLUG_TASK_STACK,
+                                           NULL, SD_HOTPLUG_TASK_PRIORITY, s_hotplug_task_stack,
+                                           &s_hotplug_task_buffer);
+#else
+        if (xTaskCreate(sd_hotplug_task, "sd_hotplug", SD_HOTPLUG_TASK_STACK, NULL,
+                        SD_HOTPLUG_TASK_PRIORITY, &s_hotplug_task) != pdPASS) {
+            s_hotplug_task = NULL;
+        }
+#endif
+        if (s_hotplug_task == NULL) {
+            return FR_NOT_ENOUGH_CORE;
+        }
+    }
+#endif
+    return FR_OK;
+#else
+    (void)cd_port;
+    (void)cd_pin;
+    (void)active_low;
+    return FR_INVALID_PARAMETER;
+#endif
+}
+
+int sd_hotplug_poll(void) {
+#if (SD_HOTPLUG == 1)
+    SD_CardDetectTick(&g_sd_handle);
+    uint32_t events = SD_GetCardDetectEvents(&g_sd_handle);
+    if (events != s_hotplug_events) {
+        s_hotplug_events = events;
+        if (fs.fs_type != 0) {
+            /*
+             * The card session already ended in SD_CardDetectTick, so FatFs sees
+             * STA_NOINIT: cached handles close without writing anything back
+             * (which could land on a different card), and the diskio caches are
+             * dropped by the removal or by the re-identification below.
+             */
+            SD_APP_LOG("SD hotplug: card %s, unmounting\r\n",
+                       SD_IsCardPresent(&g_sd_handle) ? "changed" : "removed");
+            (void)sd_unmount();
+        }
+        s_hotplug_mount = SD_IsCardPresent(&g_sd_handle);
+        s_hotplug_res = FR_NOT_READY;
+    }
+    if (s_hotplug_mount) {
+        /* Retried every poll until it works: a card still sliding in fails init. */
+        s_hotplug_res = (FRESULT)sd_mount();
+        s_hotplug_mount = (s_hotplug_res != FR_OK) && SD_IsCardPresent(&g_sd_handle);
+    }
+    if (s_lazy_pending && sd_mount_poll() == FR_OK) {
+        s_hotplug_res = FR_OK;
+    }
+    return s_hotplug_res;
+#else
+    return FR_OK;
+#endif
+}
+
+int sd_write_file(const char *filename, const char *text) {
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FIL *fp;
+    UINT bw = 0;
+    sd_fastseek_invalidate();
+    FRESULT res = sd_put_open(filename, false, (UINT)strlen(text), file, &fp);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("File open failed: %d\r\n", res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    res = SD_PROF_FCALL(SD_PROF_WRITE, fp, f_write(fp, text, strlen(text), &bw));
+    FRESULT fin = sd_put_finish(fp, file, false, res == FR_OK);
+    if (res == FR_OK && fin != FR_OK) {
+        res = fin;
+    }
+    if (res == FR_OK && bw == strlen(text)) {
+        SD_APP_LOG("Wrote %u bytes to %s\r\n", bw, filename);
+    } else {
+        SD_APP_LOG_ERROR("Write failed: %d (expected %u bytes, wrote %u)\r\n", res,
+                         (unsigned int)strlen(text), bw);
+    }
+    sd_pool_fil_put(file);
+    return (res == FR_OK && bw == strlen(text)) ? FR_OK : FR_DISK_ERR;
+}
+
+int sd_append_file(const char *filename, const char *text) {
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FIL *fp;
+    UINT bw = 0;
+    sd_fastseek_invalidate();
+    FRESULT res = sd_put_open(filename, true, (UINT)strlen(text), file, &fp);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("File open failed: %d\r\n", res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    res = SD_PROF_FCALL(SD_PROF_WRITE, fp, f_write(fp, text, strlen(text), &bw));
+    FRESULT fin = sd_put_finish(fp, file, true, res == FR_OK);
+    if (res == FR_OK && fin != FR_OK) {
+        res = fin;
+    }
+    if (res == FR_OK && bw == strlen(text)) {
+        SD_APP_LOG("Appended %u bytes to %s\r\n", bw, filename);
+    } else {
+        SD_APP_LOG_ERROR("Append failed: %d\r\n", res);
+    }
+    sd_pool_fil_put(file);
+    return (res == FR_OK && bw == strlen(text)) ? FR_OK : FR_DISK_ERR;
+}
+
+int sd_preallocate_file(const char *filename, uint32_t bytes) {
+#if _USE_EXPAND
+    if (bytes == 0U) {
+        return FR_INVALID_PARAMETER;
+    }
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    sd_fastseek_invalidate();
+    (void)sd_file_cache_close(filename);
+
+    FRESULT res = sd_open(file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("File open failed: %d\r\n", res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    (void)SD_FreeMapHint(bytes); /* f_expand searches from the hinted free run */
+    res = f_expand(file, bytes, 1);
+    if (res == FR_OK) {
+        /* One contiguous run: its sectors need no read before partial writes. */
+        FATFS *vol = file->obj.fs;
+        SD_DiskMarkUnwritten(vol->drv, vol->database + (file->obj.sclust - 2U) * vol->csize,
+                             (bytes + _MIN_SS - 1U) / _MIN_SS);
+    }
+    FRESULT close_res = SD_PROF_FCALL(SD_PROF_CLOSE, file, f_close(file));
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("Preallocate %s (%lu bytes) failed: %d\r\n", filename,
+                         (unsigned long)bytes, res);
+        (void)f_unlink(filename);
+        sd_pool_fil_put(file);
+        return res;
+    }
+    SD_APP_LOG("Preallocated %lu contiguous bytes for %s\r\n", (unsigned long)bytes, filename);
+    sd_pool_fil_put(file);
+    return close_res;
+#else
+    (void)filename;
+    (void)bytes;
+    SD_APP_LOG("Preallocate needs _USE_EXPAND 1 in ffconf.h\r\n");
+    return FR_DENIED;
+#endif
+}
+
+int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_read) {
+    if (buffer == NULL || bytes_read == NULL || bufsize == 0) {
+        return FR_INVALID_PARAMETER;
+    }
+    *bytes_read = 0;
+#if (SD_SMALLFILE_POOL > 0)
+    const char *key = sd_path_key(filename, SD_SMALLFILE_PATH);
+    sd_small_slot *small = (key != NULL) ? sd_small_lookup(key) : NULL;
+    if (small != NULL) {
+        /* Held since the last read: no write has gone through the helpers since. */
+        UINT n = (small->size < bufsize - 1U) ? (UINT)small->size : bufsize - 1U;
+        memcpy(buffer, &s_small_pool[small->offset], n);
+        buffer[n] = '\0';
+        *bytes_read = n;
+        small->stamp = ++s_small_clock;
+        s_small_stats.hits++;
+        return FR_OK;
+    }
+    s_small_stats.misses++;
+#endif
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+
+    (void)sd_file_cache_close(filename);
+    FRESULT res = sd_open(file, filename, FA_READ);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("File open failed: %d\r\n", res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    res = SD_PROF_FCALL(SD_PROF_READ, file, f_read(file, buffer, bufsize - 1, bytes_read));
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("Read failed: %d\r\n", res);
+        (void)SD_PROF_FCALL(SD_PROF_CLOSE, file, f_close(file));
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    buffer[*bytes_read] = '\0';
+#if (SD_SMALLFILE_POOL > 0)
+    /* Only a file read whole fits the cache. */
+    if (key != NULL && f_size(file) == *bytes_read && *bytes_read <= SD_SMALLFILE_MAX &&
+        *bytes_read <= SD_SMALLFILE_POOL) {
+        sd_small_store(key, buffer, *bytes_read);
+    }
+#endif
+
+    res = SD_PROF_FCALL(SD_PROF_CLOSE, file, f_close(file));
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("File close failed: %d\r\n", res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    SD_APP_LOG("Read %u bytes from %s\r\n", *bytes_read, filename);
+    sd_pool_fil_put(file);
+    return FR_OK;
+}
+
+int sd_fastseek_open(FIL *fp, const char *filename) {
+    if (fp == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    (void)sd_file_cache_close(filename);
+    FRESULT res = sd_open(fp, filename, FA_READ);
+    if (res != FR_OK) {
+        return res;
+    }
+
+#if _USE_FASTSEEK
+    if (fp->obj.sclust == 0U) {
+        return FR_OK; /* Empty file: nothing to map */
+    }
+
+    sd_clmt_slot *victim = NULL;
+    for (int i = 0; i < SD_FASTSEEK_SLOTS; i++) {
+        sd_clmt_slot *slot = &s_clmt[i];
+        if (slot->valid && slot->fs_id == fp->obj.fs->id && slot->sclust == fp->obj.sclust &&
+            slot->size == fp->obj.objsize) {
+            slot->refs++;
+            slot->stamp = ++s_clmt_clock;
+            fp->cltbl = slot->tbl;
+            return FR_OK;
+        }
+        if (slot->refs == 0U && (victim == NULL || !slot->valid ||
+                                 (victim->valid && slot->stamp < victim->stamp))) {
+            victim = slot;
+        }
+    }
+    if (victim == NULL) {
+        return FR_OK; /* Every table is in use: plain FAT-chain seeks */
+    }
+
+    victim->valid = false;
+    victim->tbl[0] = SD_FASTSEEK_CLMT_WORDS;
+    fp->cltbl = victim->tbl;
+    res = SD_PROF_FCALL(SD_PROF_LSEEK, fp, f_lseek(fp, CREATE_LINKMAP));
+    if (res == FR_NOT_ENOUGH_CORE) {
+        SD_APP_LOG("Fast seek: %s needs %lu table words\r\n", filename,
+                   (unsigned long)victim->tbl[0]);
+        fp->cltbl = NULL;
+        return FR_OK;
+    }
+    if (res != FR_OK) {
+        fp->cltbl = NULL;
+        (void)SD_PROF_FCALL(SD_PROF_CLOSE, fp, f_close(fp));
+        return res;
+    }
+    victim->fs_id = fp->obj.fs->id;
+    victim->sclust = fp->obj.sclust;
+    victim->size = fp->obj.objsize;
+    victim->stamp = ++s_clmt_clock;
+    victim->refs = 1;
+    victim->valid = true;
+#endif
+    return FR_OK;
+}
+
+int sd_fastseek_close(FIL *fp) {
+    if (fp == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+#if _USE_FASTSEEK
+    for (int i = 0; i < SD_FASTSEEK_SLOTS; i++) {
+        if (fp->cltbl == s_clmt[i].tbl && s_clmt[i].refs > 0U) {
+            s_clmt[i].refs--;
+            break;
+        }
+    }
+    fp->cltbl = NULL;
+#endif
+    return SD_PROF_FCALL(SD_PROF_CLOSE, fp, f_close(fp));
+}
+
+void sd_fastseek_invalidate(void) {
+#if _USE_FASTSEEK
+    /* Tables still attached to open files keep working until those are closed. */
+    for (int i = 0; i < SD_FASTSEEK_SLOTS; i++) {
+        s_clmt[i].valid = false;
+    }
+#endif
+}
+
+int sd_read_at(const char *filename, uint32_t offset, void *buffer, UINT len, UINT *bytes_read) {
+    if (buffer == NULL || bytes_read == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    *bytes_read = 0;
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+
+    FRESULT res = sd_fastseek_open(file, filename);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("File open failed: %d\r\n", res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    res = SD_PROF_FCALL(SD_PROF_LSEEK, file, f_lseek(file, offset));
+    if (res == FR_OK) {
+        res = SD_PROF_FCALL(SD_PROF_READ, file, f_read(file, buffer, len, bytes_read));
+    }
+    FRESULT close_res = sd_fastseek_close(file);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("Read at %lu failed: %d\r\n", (unsigned long)offset, res);
+        sd_pool_fil_put(file);
+        return res;
+    }
+    sd_pool_fil_put(file);
+    return close_res;
+}
+
+int sd_file_crc32(const char *filename, uint32_t *crc) {
+    if (filename == NULL || crc == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    /* Cached appends must be on the card, and the cached handle closed for _FS_LOCK. */
+    (void)sd_file_cache_close(filename);
+    const SD_FwLoadConfig cfg = {NULL, NULL, SD_FWLOAD_CRC_NONE, 0, 0};
+    SD_FwLoadStats st;
+    FRESULT res = SD_FwLoad(filename, &cfg, &st);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("CRC of %s failed: %d\r\n", filename, res);
+        return res;
+    }
+    *crc = st.crc;
+    return FR_OK;
+}
+
+typedef struct {
+    sd_chunk_callback callback;
+    void *context;
+} sd_stream_ctx;
+
+static bool sd_stream_piece(void *context, uint32_t offset, const uint8_t *data, uint32_t len) {
+    const sd_stream_ctx *stream = (const sd_stream_ctx *)context;
+    return stream->callback(data, len, offset, stream->context);
+}
+
+int sd_read_file_stream(const char *filename, sd_chunk_callback callback, void *context) {
+    if (filename == NULL || callback == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    (void)sd_file_cache_close(filename);
+    sd_stream_ctx stream = {callback, context};
+    const SD_FwLoadConfig cfg = {sd_stream_piece, &stream, SD_FWLOAD_CRC_NONE, 0, 0};
+    SD_FwLoadStats st;
+    FRESULT res = SD_FwLoad(filename, &cfg, &st);
+    if (res != FR_OK && res != FR_DENIED) {
+        SD_APP_LOG_ERROR("Stream of %s failed: %d\r\n", filename, res);
+        return res;
+    }
+    SD_APP_LOG("Streamed %lu bytes of %s in %lu chunks (%lu overlapped)\r\n",
+               (unsigned long)st.image_bytes, filename, (unsigned long)st.chunks,
+               (unsigned long)st.overlapped);
+    return res;
+}
+
+#if (_FS_MINIMIZE == 0)
+typedef struct {
+    FIL *dst;
+    FRESULT res;
+} sd_copy_ctx;
+
+static FILINFO s_copy_fno;
+
+/* Pieces arrive in aligned buffers at sector-aligned offsets: f_write sends them straight out. */
+static bool sd_copy_piece(void *context, uint32_t offset, const uint8_t *data, uint32_t len) {
+    sd_copy_ctx *copy = (sd_copy_ctx *)context;
+    UINT bw = 0;
+    (void)offset;
+    copy->res = SD_PROF_FCALL(SD_PROF_WRITE, copy->dst, f_write(copy->dst, data, len, &bw));
+    if (copy->res == FR_OK && bw < len) {
+        copy->res = FR_DENIED; /* volume full */
+    }
+    return copy->res == FR_OK;
+}
+#endif
+
+int sd_copy_file(const char *src, const char *dst) {
+#if (_FS_MINIMIZE != 0)
+    (void)src;
+    (void)dst;
+    SD_APP_LOG("Copy needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+#else
+    if (src == NULL || dst == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    (void)sd_file_cache_close(src);
+    FRESULT res = f_stat(src, &s_copy_fno);
+    if (res != FR_OK) {
+        return res;
+    }
+    if ((s_copy_fno.fattrib & AM_DIR) != 0U) {
+        return FR_NO_FILE;
+    }
+    FSIZE_t size = s_copy_fno.fsize;
+
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    sd_fastseek_invalidate();
+    (void)sd_file_cache_close(dst);
+#if _FS_LOCK
+    /* Hold src open so that a dst naming the same file is refused before it is truncated. */
+    SD_POOL_FIL_DECL(guard);
+    if (guard == NULL) {
+        sd_pool_fil_put(file);
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    res = f_open(guard, src, FA_READ);
+    if (res == FR_OK) {
+        res = sd_open(file, dst, FA_CREATE_ALWAYS | FA_WRITE);
+        (void)f_close(guard);
+    }
+    sd_pool_fil_put(guard);
+#else
+    res = sd_open(file, dst, FA_CREATE_ALWAYS | FA_WRITE);
+#endif
+    if (res != FR_OK) {
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    if (size > 0U) {
+        (void)SD_FreeMapHint((uint32_t)size);
+#if _USE_EXPAND
+        /* One contiguous run when there is one; otherwise the writes allocate as usual. */
+        if (f_expand(file, size, 1) == FR_OK) {
+            FATFS *vol = file->obj.fs;
+            SD_DiskMarkUnwritten(vol->drv, vol->database + (file->obj.sclust - 2U) * vol->csize,
+                                 (uint32_t)((size + _MIN_SS - 1U) / _MIN_SS));
+        }
+#endif
+    }
+
+    sd_copy_ctx copy = {file, FR_OK};
+    const SD_FwLoadConfig cfg = {sd_copy_piece, &copy, SD_FWLOAD_CRC_NONE, 0, 0};
+    SD_FwLoadStats st;
+    res = SD_FwLoad(src, &cfg, &st);
+    if (res == FR_DENIED && copy.res != FR_OK) {
+        res = copy.res;
+    }
+    FRESULT close_res = SD_PROF_FCALL(SD_PROF_CLOSE, file, f_close(file));
+    sd_pool_fil_put(file);
+    if (res == FR_OK) {
+        res = close_res;
+    }
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("Copy %s to %s failed: %d\r\n", src, dst, res);
+        (void)f_unlink(dst);
+        sd_dirindex_invalidate(dst);
+        return res;
+    }
+    SD_APP_LOG("Copied %lu bytes from %s to %s in %lu chunks\r\n",
+               (unsigned long)st.image_bytes, src, dst, (unsigned long)st.chunks);
+    return FR_OK;
+#endif
+}
+
+static bool sd_aligned_ok(const FIL *fp, const void *buffer, UINT len) {
+    return fp != NULL && buffer != NULL && ((uintptr_t)buffer % SD_DMA_ALIGNMENT) == 0U &&
+           (fp->fptr % _MIN_SS) == 0U && (len % _MIN_SS) == 0U;
+}
+
+int sd_read_aligned(FIL *fp, void *buffer, UINT len, UINT *bytes_read) {
+    if (bytes_read == NULL || !sd_aligned_ok(fp, buffer, len)) {
+        return FR_INVALID_PARAMETER;
+    }
+    return SD_PROF_FCALL(SD_PROF_READ, fp, f_read(fp, buffer, len, bytes_read));
+}
+
+int sd_write_aligned(FIL *fp, const void *buffer, UINT len, UINT *bytes_written) {
+    if (bytes_written == NULL || !sd_aligned_ok(fp, buffer, len)) {
+        return FR_INVALID_PARAMETER;
+    }
+    return SD_PROF_FCALL(SD_PROF_WRITE, fp, f_write(fp, buffer, len, bytes_written));
+}
+
+/*
+ * The block starts with one alignment unit of header holding the raw pointer,
+ * so the caller's area begins on an SD_DMA_ALIGNMENT boundary.
+ */
+void *sd_dma_alloc(size_t bytes) {
+    if (bytes == 0U) {
+        return NULL;
+    }
+    size_t size = (bytes + _MIN_SS - 1U) / _MIN_SS * _MIN_SS;
+    size_t header = (sizeof(void *) + SD_DMA_ALIGNMENT - 1U) & ~(size_t)(SD_DMA_ALIGNMENT - 1U);
+#ifdef USE_FREERTOS
+    uint8_t *raw = pvPortMalloc(size + header + SD_DMA_ALIGNMENT - 1U);
+#else
+    uint8_t *raw = malloc(size + header + SD_DMA_ALIGNMENT - 1U);
+#endif
+    if (raw == NULL) {
+        return NULL;
+    }
+    uintptr_t user = ((uintptr_t)raw + header + SD_DMA_ALIGNMENT - 1U) &
+                     ~(uintptr_t)(SD_DMA_ALIGNMENT - 1U);
+    ((void **)user)[-1] = raw;
+    return (void *)user;
+}
+
+void sd_dma_free(void *buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    void *raw = ((void **)buffer)[-1];
+#ifdef USE_FREERTOS
+    vPortFree(raw);
+#else
+    free(raw);
+#endif
+}
+
+int sd_line_reader_init(SD_LineReader *lr, FIL *fp, char *buf, uint32_t size, uint32_t max_line) {
+    if (lr == NULL || fp == NULL || buf == NULL || size <= max_line + 1U) {
+        return FR_INVALID_PARAMETER;
+    }
+    lr->fp = fp;
+    lr->chunk = buf + max_line;
+    lr->chunk_bytes = size - max_line - 1U; /* room for the '\n' added at the end */
+    lr->max_line = max_line;
+    lr->line = lr->chunk;
+    lr->end = lr->chunk;
+    lr->eof = false;
+    lr->skipping = false;
+    lr->lines = 0;
+    lr->long_lines = 0;
+    return FR_OK;
+}
+
+int sd_line_read(SD_LineReader *lr, char **line, uint32_t *len) {
+    for (;;) {
+        char *nl = (lr->line < lr->end) ? memchr(lr->line, '\n', (size_t)(lr->end - lr->line))
+                                        : NULL;
+        if (nl != NULL) {
+            char *start = lr->line;
+            lr->line = nl + 1;
+            lr->lines++;
+            if (lr->skipping) {
+                lr->skipping = false;
+                continue;
+            }
+            if (nl > start && nl[-1] == '\r') {
+                nl--;
+            }
+            *nl = '\0';
+            *line = start;
+            if (len != NULL) {
+                *len = (uint32_t)(nl - start);
+            }
+            return FR_OK;
+        }
+        if (lr->eof) {
+            *line = NULL;
+            if (len != NULL) {
+                *len = 0;
+            }
+            return FR_OK;
+        }
+
+        /* Keep the unfinished line just below the chunk, then refill it. */
+        uint32_t carry = (uint32_t)(lr->end - lr->line);
+        if (lr->skipping || carry > lr->max_line) {
+            if (!lr->skipping) {
+                lr->long_lines++;
+            }
+            lr->skipping = true;
+            carry = 0;
+        } else {
+            memmove(lr->chunk - carry, lr->line, carry);
+        }
+        UINT br = 0;
+        FRESULT res =
+            SD_PROF_FCALL(SD_PROF_READ, lr->fp, f_read(lr->fp, lr->chunk, lr->chunk_bytes, &br));
+        if (res != FR_OK) {
+            return res;
+        }
+        lr->eof = (br < lr->chunk_bytes);
+        lr->line = lr->chunk - carry;
+        lr->end = lr->chunk + br;
+        /* A final line without a newline still counts. */
+        if (lr->eof && lr->end > lr->line && lr->end[-1] != '\n') {
+            *lr->end++ = '\n';
+        }
+    }
+}
+
+/*
+ * Parse buffer: the line reader's carry area for the unfinished line of the
+ * previous chunk, directly followed by the aligned chunk f_read target (and
+ * one byte for the newline added to a last line without one).
+ */
+static char s_csv_buf[SD_CSV_MAX_LINE + SD_CSV_CHUNK_BYTES + 1]
+    __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+/* Split one line in place. Quoted fields may contain the delimiter and "" escapes. */
+static int sd_csv_split(char *line, char delim, char **fields) {
+    int n = 0;
+    char *p = line;
+
+    for (;;) {
+        char *field = p;
+        if (*p == '"') {
+            char *out = p;
+            field = out;
+            p++;
+            while (*p) {
+                if (*p == '"') {
+                    if (p[1] != '"') {
+                        p++;
+                        break;
+                    }
+                    p++;
+                }
+                *out++ = *p++;
+            }
+            while (*p && *p != delim) {
+                p++; /* text after the closing quote is ignored */
+            }
+            if (n < SD_CSV_MAX_FIELDS) {
+                fields[n++] = field;
+            }
+            char next = *p;
+            *out = '\0';
+            if (next == '\0') {
+                break;
+            }
+            p++;
+            continue;
+        }
+        while (*p && *p != delim) {
+            p++;
+        }
+        if (n < SD_CSV_MAX_FIELDS) {
+            fields[n++] = field;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        *p++ = '\0';
+    }
+    return n;
+}
+
+int sd_csv_parse(const char *filename, char delim, sd_csv_callback callback, void *context,
+                 SD_CsvStats *stats) {
+    SD_CsvStats st = {0};
+    char *fields[SD_CSV_MAX_FIELDS];
+    SD_LineReader lr;
+    bool stop = false;
+
+    if (filename == NULL || callback == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    (void)sd_file_cache_close(filename);
+    FRESULT res = sd_open(file, filename, FA_READ);
+    if (res != FR_OK) {
+        sd_pool_fil_put(file);
+        return res;
+    }
+
+    (void)sd_line_reader_init(&lr, file, s_csv_buf, sizeof(s_csv_buf), SD_CSV_MAX_LINE);
+    while (!stop) {
+        char *line;
+        res = sd_line_read(&lr, &line, NULL);
+        if (res != FR_OK || line == NULL) {
+            break;
+        }
+        if (*line != '\0') {
+            int n = sd_csv_split(line, delim, fields);
+            st.records++;
+            stop = !callback(fields, n, lr.lines, context);
+        }
+    }
+    st.lines = lr.lines;
+    st.long_lines = lr.long_lines;
+
+    (void)SD_PROF_FCALL(SD_PROF_CLOSE, file, f_close(file));
+    if (stats != NULL) {
+        *stats = st;
+    }
+    sd_pool_fil_put(file);
+    return res;
+}
+
+typedef struct {
+    CsvRecord *records;
+    int max_records;
+    int *record_count;
+} sd_csv_records_ctx;
+
+static bool sd_csv_to_record(char **fields, int nfields, uint32_t line, void *context) {
+    sd_csv_records_ctx *ctx = (sd_csv_records_ctx *)context;
+    (void)line;
+    if (nfields < 2) {
+        return true;
+    }
+    CsvRecord *rec = &ctx->records[*ctx->record_count];
+    strncpy(rec->field1, fields[0], sizeof(rec->field1) - 1);
+    rec->field1[sizeof(rec->field1) - 1] = '\0';
+    strncpy(rec->field2, fields[1], sizeof(rec->field2) - 1);
+    rec->field2[sizeof(rec->field2) - 1] = '\0';
+    rec->value = (nfields > 2) ? (int)strtol(fields[2], NULL, 10) : 0;
+    (*ctx->record_count)++;
+    return *ctx->record_count < ctx->max_records;
+}
+
+int sd_read_csv(const char *filename, CsvRecord *records, int max_records, int *record_count) {
+    if (records == NULL || record_count == NULL || max_records <= 0) {
+        return FR_INVALID_PARAMETER;
+    }
+    *record_count = 0;
+
+    SD_APP_LOG("Reading CSV: %s\r\n", filename);
+    sd_csv_records_ctx ctx = { records, max_records, record_count };
+    FRESULT res = sd_csv_parse(filename, ',', sd_csv_to_record, &ctx, NULL);
+    if (res != FR_OK) {
+        SD_APP_LOG_ERROR("Failed to read CSV: %s (%d)\r\n", filename, res);
+        return res;
+    }
+
+    for (int i = 0; i < *record_count; i++) {
+        SD_APP_LOG("[%d] %s | %s | %d\r\n", i,
+                records[i].field1,
+                records[i].field2,
+                records[i].value);
+    }
+
+    return FR_OK;
+}
+
+#if (_FS_MINIMIZE == 0)
+/*
+ * Batch mode switches under the volume lock, so no FatFs call is inside the
+ * driver meanwhile. Leaving it goes ahead without the lock rather than keep
+ * the drive batching.
+ */
+static SD_Status sd_batch_mode(bool begin) {
+#if _FS_REENTRANT
+    bool locked = ff_req_grant(fs.sobj) != 0;
+    if (!locked && begin) {
+        return SD_TIMEOUT;
+    }
+#endif
+    SD_Status status = begin ? SD_DiskBatchBegin(0) : SD_DiskBatchEnd(0);
+#if _FS_REENTRANT
+    if (locked) {
+        ff_rel_grant(fs.sobj);
+    }
+#endif
+    return status;
+}
+#endif
+
+int sd_delete_file(const char *filename) {
+#if (_FS_MINIMIZE != 0)
+    (void)filename;
+    SD_APP_LOG("Delete needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+#else
+    sd_fastseek_invalidate();
+    (void)sd_file_cache_close(filename);
+    /*
+     * In batch mode every FAT sector remove_chain changes is written back
+     * once, however often a fragmented chain comes back to it, together
+     * with the directory sector and FSInfo. With _USE_TRIM each freed run
+     * is also erased with one CTRL_TRIM.
+     */
+    bool batched = sd_batch_mode(true) == SD_OK;
+    FRESULT res = f_unlink(filename);
+    if (batched && sd_batch_mode(false) != SD_OK && res == FR_OK) {
+        res = FR_DISK_ERR;
+    }
+    if (res == FR_OK) {
+        sd_dirindex_invalidate(filename); /* in case it was an indexed directory */
+    }
+    SD_APP_LOG("Delete %s: %s\r\n", filename, (res == FR_OK ? "OK" : "Failed"));
+    return res;
+#endif
+}
+
+#if (_FS_MINIMIZE == 0)
+static FIL s_del_file;
+static char s_del_path[SD_WALK_PATH_MAX];
+static bool s_del_open;
+#if _USE_FASTSEEK && (SD_DELETE_CLMT > 0U)
+static DWORD s_del_clmt[SD_DELETE_CLMT];
+#endif
+#endif
+
+int sd_delete_begin(const char *filename) {
+#if (_FS_MINIMIZE != 0)
+    (void)filename;
+    return FR_DENIED;
+#else
+    if (filename == NULL || strlen(filename) >= sizeof(s_del_path)) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (s_del_open) {
+        return FR_LOCKED;
+    }
+    sd_fastseek_invalidate();
+    (void)sd_file_cache_close(filename);
+    FRESULT res = f_open(&s_del_file, filename, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+    if (res != FR_OK) {
+        return res;
+    }
+#if _USE_FASTSEEK && (SD_DELETE_CLMT > 0U)
+    /* One walk of the chain; too fragmented for the table means plain seeks. */
+    s_del_clmt[0] = SD_DELETE_CLMT;
+    s_del_file.cltbl = s_del_clmt;
+    if (f_lseek(&s_del_file, CREATE_LINKMAP) != FR_OK) {
+        s_del_file.cltbl = NULL;
+    }
+#endif
+    strcpy(s_del_path, filename);
+    s_del_open = true;
+    return FR_OK;
+#endif
+}
+
+int sd_delete_step(void) {
+#if (_FS_MINIMIZE != 0)
+    return FR_DENIED;
+#else
+    if (!s_del_open) {
+        return FR_INVALID_OBJECT;
+    }
+    FRESULT res;
+    FSIZE_t size = f_size(&s_del_file);
+    if (size == 0U) {
+        /* Nothing left to free: closing and unlinking only touch the directory. */
+        s_del_open = false;
+        res = f_close(&s_del_file);
+        if (res == FR_OK) {
+            res = f_unlink(s_del_path);
+        }
+        if (res == FR_OK) {
+            sd_dirindex_invalidate(s_del_path);
+        }
+        SD_APP_LOG("Delete %s: %s\r\n", s_del_path, (res == FR_OK ? "OK" : "Failed"));
+        return res;
+    }
+    /* Cut the last SD_DELETE_STEP_CLUSTERS clusters; the sync leaves a valid, shorter file. */
+    FSIZE_t cluster = (FSIZE_t)s_del_file.obj.fs->csize * _MIN_SS;
+    FSIZE_t clusters = (size + cluster - 1U) / cluster;
+    FSIZE_t keep = (clusters > SD_DELETE_STEP_CLUSTERS) ? clusters - SD_DELETE_STEP_CLUSTERS : 0U;
+    res = f_lseek(&s_del_file, keep * cluster);
+    if (res == FR_OK) {
+        res = f_truncate(&s_del_file);
+    }
+    if (res == FR_OK) {
+        res = f_sync(&s_del_file);
+    }
+    if (res != FR_OK) {
+        s_del_open = false;
+        (void)f_close(&s_del_file);
+        return res;
+    }
+    return FR_NOT_READY;
+#endif
+}
+
+int sd_delete_cancel(void) {
+#if (_FS_MINIMIZE != 0)
+    return FR_DENIED;
+#else
+    if (!s_del_open) {
+        return FR_OK;
+    }
+    s_del_open = false;
+    return f_close(&s_del_file);
+#endif
+}
+
+int sd_rename_file(const char *oldname, const char *newname) {
+#if (_FS_MINIMIZE != 0)
+    (void)oldname;
+    (void)newname;
+    SD_APP_LOG("Rename needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+#else
+    (void)sd_file_cache_close(oldname);
+    (void)sd_file_cache_close(newname);
+    FRESULT res = f_rename(oldname, newname);
+    if (res == FR_OK) {
+        sd_dirindex_invalidate(oldname);
+        sd_dirindex_add(newname);
+    }
+    SD_APP_LOG("Rename %s to %s: %s\r\n", oldname, newname, (res == FR_OK ? "OK" : "Failed"));
+    return res;
+#endif
+}
+
+#if (_FS_MINIMIZE == 0)
+static char s_batch_from[SD_WALK_PATH_MAX];
+static char s_batch_to[SD_WALK_PATH_MAX];
+static bool s_batch_busy;
+
+static bool sd_batch_path(char *out, const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    bool sep = len > 0U && dir[len - 1U] != '/' && dir[len - 1U] != ':';
+    int n = snprintf(out, SD_WALK_PATH_MAX, sep ? "%s/%s" : "%s%s", dir, name);
+    return n > 0 && n < SD_WALK_PATH_MAX;
+}
+
+static FRESULT sd_batch_one(const char *dir, SD_BatchOp *op) {
+    if (op->name == NULL || (op->type == SD_BATCH_RENAME && op->new_name == NULL)) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (!sd_batch_path(s_batch_from, dir, op->name)) {
+        return FR_INVALID_NAME;
+    }
+    (void)sd_file_cache_close(s_batch_from);
+    if (op->type == SD_BATCH_DELETE) {
+        FRESULT res = f_unlink(s_batch_from);
+        if (res == FR_OK) {
+            sd_dirindex_invalidate(s_batch_from);
+        }
+        return res;
+    }
+    if (!sd_batch_path(s_batch_to, dir, op->new_name)) {
+        return FR_INVALID_NAME;
+    }
+    (void)sd_file_cache_close(s_batch_to);
+    FRESULT res = f_rename(s_batch_from, s_batch_to);
+    if (res == FR_OK) {
+        sd_dirindex_invalidate(s_batch_from);
+        sd_dirindex_add(s_batch_to);
+    }
+    return res;
+}
+
+/* ops, or deletes of names when ops is NULL. */
+static FRESULT sd_batch_run(const char *dir, SD_BatchOp *ops, const char *const *names,
+                            uint32_t count) {
+    if (dir == NULL || (ops == NULL && names == NULL)) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (s_batch_busy) {
+        return FR_LOCKED;
+    }
+
+    DIR dj;
+    FRESULT res = f_opendir(&dj, dir); /* one lookup of the path before the batch */
+    if (res != FR_OK) {
+        return res;
+    }
+    (void)f_closedir(&dj);
+    if (sd_batch_mode(true) != SD_OK) {
+        return FR_TIMEOUT;
+    }
+    s_batch_busy = true;
+    sd_fastseek_invalidate();
+
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        SD_BatchOp del = { SD_BATCH_DELETE, (names != NULL) ? names[i] : NULL, NULL, FR_OK };
+        SD_BatchOp *op = (ops != NULL) ? &ops[i] : &del;
+        op->result = sd_batch_one(dir, op);
+        if (op->result != FR_OK) {
+            failed++;
+            if (res == FR_OK) {
+                res = op->result;
+            }
+        }
+    }
+
+    SD_Status status = sd_batch_mode(false);
+    s_batch_busy = false;
+    if (res == FR_OK && status != SD_OK) {
+        res = FR_DISK_ERR;
+    }
+    SD_APP_LOG("Batch in %s: %lu ops, %lu failed, sync %s\r\n", dir, (unsigned long)count,
+               (unsigned long)failed, (status == SD_OK) ? "OK" : "Failed");
+    return res;
+}
+#else
+static FRESULT sd_batch_run(const char *dir, SD_BatchOp *ops, const char *const *names,
+                            uint32_t count) {
+    (void)dir;
+    (void)ops;
+    (void)names;
+    (void)count;
+    SD_APP_LOG("Batch needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+}
+#endif
+
+int sd_batch(const char *dir, SD_BatchOp *ops, uint32_t count) {
+    return sd_batch_run(dir, ops, NULL, count);
+}
+
+int sd_delete_files(const char *dir, const char *const *names, uint32_t count) {
+    return sd_batch_run(dir, NULL, names, count);
+}
+
+static char s_shard_path[SD_WALK_PATH_MAX];
+
+#if (_FS_MINIMIZE == 0)
+static FILINFO s_shard_fno;
+
+/* "<root>/<XX>" for bucket, or "<root>/<XX>/<name>"; false if it does not fit. */
+static bool sd_shard_join(char *out, size_t len, const char *root, uint32_t bucket,
+                          const char *name) {
+    size_t root_len = strlen(root);
+    bool sep = root_len > 0U && root[root_len - 1U] != '/' && root[root_len - 1U] != ':';
+    int n = snprintf(out, len, "%s%s%02X%s%s", root, sep ? "/" : "", (unsigned)bucket,
+                     (name != NULL) ? "/" : "", (name != NULL) ? name : "");
+    return n > 0 && (size_t)n < len;
+}
+
+static bool sd_shard_name_ok(const char *name) {
+    if (name == NULL || name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return false;
+    }
+    return strchr(name, '/') == NULL && strchr(name, '\\') == NULL && strchr(name, ':') == NULL;
+}
+#endif
+
+int sd_shard_path(const char *root, const char *name, char *path, size_t len) {
+    if (root == NULL || path == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+#if (_FS_MINIMIZE == 0)
+    if (!sd_shard_name_ok(name)) {
+        return FR_INVALID_NAME;
+    }
+    uint32_t bucket = sd_name_hash(name) & (SD_SHARD_BUCKETS - 1U);
+    return sd_shard_join(path, len, root, bucket, name) ? FR_OK : FR_INVALID_NAME;
+#else
+    (void)name;
+    (void)len;
+    return FR_DENIED;
+#endif
+}
+
+int sd_shard_open(FIL *fp, const char *root, const char *name, BYTE mode) {
+#if (_FS_MINIMIZE == 0)
+    if (fp == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    FRESULT res = (FRESULT)sd_shard_path(root, name, s_shard_path, sizeof(s_shard_path));
+    if (res != FR_OK) {
+        return res;
+    }
+    res = sd_open(fp, s_shard_path, mode);
+    if (res == FR_NO_PATH && (mode & (FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS)) != 0U) {
+        /* First file in the bucket: create it, and the root on the very first. */
+        char *slash = strrchr(s_shard_path, '/');
+        *slash = '\0';
+        res = f_mkdir(s_shard_path);
+        if (res == FR_NO_PATH && f_mkdir(root) == FR_OK) {
+            sd_dirindex_add(root);
+            res = f_mkdir(s_shard_path);
+        }
+        if (res == FR_OK) {
+            sd_dirindex_add(s_shard_path);
+        }
+        *slash = '/';
+        if (res == FR_OK || res == FR_EXIST) {
+            res = sd_open(fp, s_shard_path, mode);
+        }
+    }
+#if (SD_PROFILE_ENABLED == 1)
+    SD_ProfFileClose(fp); /* the caller closes it with f_close: only the open is charged */
+#endif
+    return res;
+#else
+    (void)fp;
+    (void)root;
+    (void)name;
+    (void)mode;
+    return FR_DENIED;
+#endif
+}
+
+int sd_shard_stat(const char *root, const char *name, FILINFO *fno) {
+    FRESULT res = (FRESULT)sd_shard_path(root, name, s_shard_path, sizeof(s_shard_path));
+    if (res != FR_OK) {
+        return res;
+    }
+    res = (FRESULT)sd_stat(s_shard_path, fno);
+    return (res == FR_NO_PATH) ? FR_NO_FILE : res; /* bucket not created yet */
+}
+
+int sd_shard_delete(const char *root, const char *name) {
+    FRESULT res = (FRESULT)sd_shard_path(root, name, s_shard_path, sizeof(s_shard_path));
+    if (res != FR_OK) {
+        return res;
+    }
+#if (_FS_MINIMIZE == 0)
+    sd_fastseek_invalidate();
+    (void)sd_file_cache_close(s_shard_path);
+    res = f_unlink(s_shard_path);
+    if (res == FR_OK) {
+        sd_dirindex_invalidate(s_shard_path);
+    }
+    return (res == FR_NO_PATH) ? FR_NO_FILE : res;
+#else
+    return FR_DENIED;
+#endif
+}
+
+int sd_shard_list(const char *root, sd_shard_visitor visitor, void *context, uint32_t *count) {
+    if (count != NULL) {
+        *count = 0;
+    }
+    if (root == NULL || visitor == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+#if (_FS_MINIMIZE == 0)
+    SD_POOL_DIR_DECL(dj);
+    if (dj == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = FR_OK;
+    bool more = true;
+    for (uint32_t bucket = 0; bucket < SD_SHARD_BUCKETS && more && res == FR_OK; bucket++) {
+        if (!sd_shard_join(s_shard_path, sizeof(s_shard_path), root, bucket, NULL)) {
+            res = FR_INVALID_NAME;
+            break;
+        }
+        res = f_opendir(dj, s_shard_path);
+        if (res == FR_NO_PATH) {
+            res = FR_OK; /* never used */
+            continue;
+        }
+        while (res == FR_OK && more) {
+            res = f_readdir(dj, &s_shard_fno);
+            if (res != FR_OK || s_shard_fno.fname[0] == '\0') {
+                break;
+            }
+            if ((s_shard_fno.fattrib & AM_DIR) != 0U) {
+                continue;
+            }
+            if (count != NULL) {
+                (*count)++;
+            }
+            more = visitor(s_shard_fno.fname, &s_shard_fno, context);
+        }
+        (void)f_closedir(dj);
+    }
+    sd_pool_dir_put(dj);
+    return res;
+#else
+    (void)context;
+    return FR_DENIED;
+#endif
+}
+
+#if (SD_DIRPRE_DIRS > 0) && (_FS_MINIMIZE == 0)
+typedef struct {
+    char path[SD_DIRINDEX_PATH];
+    DWORD end;  // End-of-directory offset when placeholders last found only deleted slots
+    bool holes; // ...and that attempt is not repeated until the end moves
+    bool used;
+} sd_dirpre_slot;
+
+static sd_dirpre_slot s_dirpre[SD_DIRPRE_DIRS];
+static uint32_t s_dirpre_next;
+static SD_DirPreStats s_dirpre_stats;
+static FILINFO s_dirpre_fno;
+static char s_dirpre_name[SD_DIRINDEX_PATH + 80];
+
+/* Placeholder i in dir: an LFN of 64 characters takes 6 entries, an 8.3 name one. */
+static const char *sd_dirpre_name(const char *dir, uint32_t i) {
+#if _USE_LFN
+    (void)snprintf(s_dirpre_name, sizeof(s_dirpre_name),
+                   "%s/~sd-dirpre-%03u-placeholder-for-directory-growth-0123456789ab.tmp", dir,
+                   (unsigned)i);
 #else
-#define SD_APP_LOG(...) do { } while (0)
+    (void)snprintf(s_dirpre_name, sizeof(s_dirpre_name), "%s/~DP%05u.TMP", dir, (unsigned)i);
 #endif
+    return s_dirpre_name;
+}
 
-#ifndef SD_DIR_MAX_DEPTH
-#define SD_DIR_MAX_DEPTH 8
-#endif
+/*
+ * Grow slot's directory by one cluster if fewer than SD_DIRPRE_SLACK entries
+ * are left past its end: empty placeholder files are created until FatFs
+ * stretches the directory (and zero-fills the new cluster), then removed.
+ * Their slots are reused by the next files created there.
+ */
+static FRESULT sd_dirpre_check(sd_dirpre_slot *slot) {
+    SD_POOL_DIR_DECL(dj);
+    if (dj == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_opendir(dj, slot->path);
+    bool opened = (res == FR_OK);
+    while (res == FR_OK) {
+        res = f_readdir(dj, &s_dirpre_fno);
+        if (res != FR_OK || s_dirpre_fno.fname[0] == '\0') {
+            break;
+        }
+    }
+    DWORD sclust = dj->obj.sclust;
+    DWORD end = dj->dptr; /* offset of the first never-used entry */
+    if (opened) {
+        (void)f_closedir(dj);
+    }
+    sd_pool_dir_put(dj);
+    if (res == FR_NO_PATH || res == FR_NO_FILE) {
+        return FR_OK; /* not created yet */
+    }
+    if (res != FR_OK) {
+        return res;
+    }
+    s_dirpre_stats.checks++;
 
-int sd_system_init(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin, bool use_dma) {
-    return (SD_DiskIoInit(hspi, cs_port, cs_pin, use_dma) == SD_OK) ? 0 : -1;
-}
+    uint32_t cluster_bytes = (uint32_t)fs.csize * _MIN_SS;
+    uint32_t room = (cluster_bytes - end % cluster_bytes) / 32U;
+    if (sclust == 0U || room >= SD_DIRPRE_SLACK || (slot->holes && slot->end == end)) {
+        return FR_OK; /* fixed-size root, enough room, or deleted slots left to use */
+    }
 
-int sd_get_space_kb(void) {
-    FATFS *pfs;
-    DWORD fre_clust, tot_sect, fre_sect, total_kb, free_kb;
-    FRESULT res = f_getfree(sd_path, &fre_clust, &pfs);
-    if (res != FR_OK) return res;
+    SD_POOL_FIL_DECL(file);
+    if (file == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    uint32_t made = 0;
+    bool grown = false;
+    while (res == FR_OK && !grown && made < SD_DIRPRE_TEMPS) {
+        DWORD last = fs.last_clst;
+        res = f_open(file, sd_dirpre_name(slot->path, made), FA_CREATE_NEW | FA_WRITE);
+        if (res == FR_EXIST) {
+            /* Left behind by a reset: take it over. */
+            res = f_unlink(s_dirpre_name);
+            if (res == FR_OK) {
+                res = f_open(file, s_dirpre_name, FA_CREATE_NEW | FA_WRITE);
+            }
+        }
+        if (res != FR_OK) {
+            break;
+        }
+        made++;
+        grown = fs.last_clst != last; /* placeholders are empty: only the directory allocates */
+        res = f_close(file);
+    }
+    sd_pool_fil_put(file);
+    for (uint32_t i = 0; i < made; i++) {
+        FRESULT del = f_unlink(sd_dirpre_name(slot->path, i));
+        if (res == FR_OK) {
+            res = del;
+        }
+    }
 
-    tot_sect = (pfs->n_fatent - 2) * pfs->csize;
-    fre_sect = fre_clust * pfs->csize;
-    total_kb = tot_sect / 2;
-    free_kb = fre_sect / 2;
-    SD_APP_LOG("Total: %lu KB, Free: %lu KB\r\n", total_kb, free_kb);
-    return FR_OK;
+    if (grown) {
+        s_dirpre_stats.grown++;
+        slot->holes = false;
+    } else if (res == FR_OK) {
+        s_dirpre_stats.holes++;
+        slot->holes = true;
+        slot->end = end;
+    }
+    return res;
 }
+#endif
 
-int sd_mount(void) {
-    FRESULT res;
-
-    SD_APP_LOG("\r\n========================================\r\n");
-    SD_APP_LOG("SD card mount\r\n");
-    SD_APP_LOG("========================================\r\n");
+int sd_dirpre_add(const char *dir) {
+#if (SD_DIRPRE_DIRS > 0) && (_FS_MINIMIZE == 0)
+    if (dir == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    size_t len = strlen(dir);
+    while (len > 0U && dir[len - 1U] == '/') {
+        len--; /* placeholder paths add their own separator */
+    }
+    if (len == 0U || len >= SD_DIRINDEX_PATH) {
+        return FR_INVALID_NAME;
+    }
+    sd_dirpre_slot *free_slot = NULL;
+    for (int i = 0; i < SD_DIRPRE_DIRS; i++) {
+        if (s_dirpre[i].used && strncmp(s_dirpre[i].path, dir, len) == 0 &&
+            s_dirpre[i].path[len] == '\0') {
+            return FR_OK;
+        }
+        if (!s_dirpre[i].used && free_slot == NULL) {
+            free_slot = &s_dirpre[i];
+        }
+    }
+    if (free_slot == NULL) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+    memcpy(free_slot->path, dir, len);
+    free_slot->path[len] = '\0';
+    free_slot->holes = false;
+    free_slot->used = true;
+    return FR_OK;
+#else
+    (void)dir;
+    return FR_DENIED;
+#endif
+}
 
-    SD_APP_LOG("Checking SD card presence...\r\n");
-    if (!SD_IsCardPresent(&g_sd_handle)) {
-        SD_APP_LOG("ERROR: SD card not present!\r\n");
-        return FR_NOT_READY;
+int sd_dirpre_poll(void) {
+#if (SD_DIRPRE_DIRS > 0) && (_FS_MINIMIZE == 0)
+    if (fs.fs_type == 0) {
+        return FR_NOT_ENABLED;
     }
-    SD_APP_LOG("OK: SD card detected\r\n");
+    for (int n = 0; n < SD_DIRPRE_DIRS; n++) {
+        sd_dirpre_slot *slot = &s_dirpre[s_dirpre_next];
+        s_dirpre_next = (s_dirpre_next + 1U) % SD_DIRPRE_DIRS;
+        if (slot->used) {
+            FRESULT res = sd_dirpre_check(slot);
+            if (res != FR_OK) {
+                s_dirpre_stats.errors++;
+            }
+            return res;
+        }
+    }
+    return FR_OK;
+#else
+    return FR_OK;
+#endif
+}
 
-    SD_APP_LOG("Initializing SD card disk interface...\r\n");
-    DSTATUS stat = disk_initialize(0);
-    SD_APP_LOG("disk_initialize returned: 0x%02X\r\n", stat);
-    if (stat != 0) {
-        SD_APP_LOG("ERROR: disk_initialize failed: 0x%02X\r\n", stat);
-        SD_APP_LOG("  STA_NOINIT=0x01, STA_NODISK=0x02, STA_PROTECT=0x04\r\n");
-        return FR_NOT_READY;
+void sd_dirpre_get_stats(SD_DirPreStats *out) {
+    if (out == NULL) {
+        return;
     }
-    SD_APP_LOG("OK: Disk interface initialized\r\n");
+#if (SD_DIRPRE_DIRS > 0) && (_FS_MINIMIZE == 0)
+    *out = s_dirpre_stats;
+#else
+    memset(out, 0, sizeof(*out));
+#endif
+}
 
-    SD_APP_LOG("Mounting filesystem at %s...\r\n", sd_path);
-    res = f_mount(&fs, sd_path, 1);
-    SD_APP_LOG("f_mount returned: %d (0=OK, 1=DISK_ERR, 2=INT_ERR, 3=NOT_READY, 4=NO_FILE, 13=INVALID_NAME)\r\n", res);
+FRESULT sd_create_directory(const char *path) {
+#if (_FS_MINIMIZE != 0)
+    (void)path;
+    SD_APP_LOG("Create directory needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+#else
+    FRESULT res = f_mkdir(path);
     if (res == FR_OK) {
-        SD_APP_LOG("OK: Filesystem mounted successfully\r\n");
-        SD_APP_LOG("Card Type: %s\r\n", SD_IsSDHC(&g_sd_handle) ? "SDHC/SDXC" : "SDSC");
-        sd_get_space_kb();
-        SD_APP_LOG("========================================\r\n\r\n");
-        return FR_OK;
+        sd_dirindex_add(path);
     }
-
-    /* Many users were having issues with f_mkfs, so I have disabled it
-     * You need to format SD card in FAT FileSysytem before inserting it
-     */
-
-    SD_APP_LOG("ERROR: Mount failed with code: %d\r\n", res);
-    SD_APP_LOG("========================================\r\n\r\n");
+    SD_APP_LOG("Create directory %s: %s\r\n", path, (res == FR_OK ? "OK" : "Failed"));
     return res;
+#endif
 }
 
-int sd_unmount(void) {
-    FRESULT res = f_mount(NULL, sd_path, 1);
-    SD_APP_LOG("SD unmount: %s\r\n", (res == FR_OK) ? "OK" : "Failed");
-    return res;
+/* Case-insensitive match with '*' (any run) and '?' (any one character). */
+static bool sd_name_match(const char *pattern, const char *name) {
+    const char *star = NULL;
+    const char *resume = NULL;
+    while (*name) {
+        char pc = (*pattern >= 'a' && *pattern <= 'z') ? (char)(*pattern - 'a' + 'A') : *pattern;
+        char nc = (*name >= 'a' && *name <= 'z') ? (char)(*name - 'a' + 'A') : *name;
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = name;
+        } else if (*pattern == '?' || (pc == nc && *pattern)) {
+            pattern++;
+            name++;
+        } else if (star) {
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
 }
 
-int sd_write_file(const char *filename, const char *text) {
-    FIL file;
-    UINT bw;
-    FRESULT res = f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+/*
+ * Walker state. Each level keeps its DIR open while the lock table allows;
+ * when _FS_LOCK runs out the parent is closed ("parked") and reopened at its
+ * saved entry index after the child is done.
+ */
+typedef struct {
+    DIR dir;
+    uint32_t index;    // Entries already read at this level
+    uint16_t path_len; // Length of this level's path in s_walk_path
+    bool open;
+} sd_walk_level;
+
+static sd_walk_level s_walk[SD_DIR_MAX_DEPTH];
+static char s_walk_path[SD_WALK_PATH_MAX];
+static FILINFO s_walk_fno;
+static bool s_walk_busy;
+
+static FRESULT sd_walk_open(int depth) {
+    sd_walk_level *level = &s_walk[depth];
+    s_walk_path[level->path_len] = '\0';
+    FRESULT res = f_opendir(&level->dir, s_walk_path);
+#if (SD_FILE_CACHE_LIMIT > 0)
+    while (res == FR_TOO_MANY_OPEN_FILES && sd_file_cache_evict()) {
+        res = f_opendir(&level->dir, s_walk_path);
+    }
+#endif
+    if (res == FR_TOO_MANY_OPEN_FILES && depth > 0 && s_walk[depth - 1].open) {
+        s_walk[depth - 1].open = false;
+        (void)f_closedir(&s_walk[depth - 1].dir);
+        s_walk_path[level->path_len] = '\0';
+        res = f_opendir(&level->dir, s_walk_path);
+    }
     if (res != FR_OK) {
-        SD_APP_LOG("File open failed: %d\r\n", res);
         return res;
     }
+    level->open = true;
 
-    res = f_write(&file, text, strlen(text), &bw);
-    f_close(&file);
-    if (res == FR_OK && bw == strlen(text)) {
-        SD_APP_LOG("Wrote %u bytes to %s\r\n", bw, filename);
-    } else {
-        SD_APP_LOG("Write failed: %d (expected %u bytes, wrote %u)\r\n", res, (unsigned int)strlen(text), bw);
+    /* Reopened after parking: skip what was already visited. */
+    for (uint32_t i = 0; i < level->index && res == FR_OK; i++) {
+        res = f_readdir(&level->dir, &s_walk_fno);
     }
-    return (res == FR_OK && bw == strlen(text)) ? FR_OK : FR_DISK_ERR;
+    return res;
 }
 
-int sd_append_file(const char *filename, const char *text) {
-    FIL file;
-    UINT bw;
-    FRESULT res = f_open(&file, filename, FA_OPEN_ALWAYS | FA_WRITE);
-    if (res != FR_OK) {
-        SD_APP_LOG("File open failed: %d\r\n", res);
-        return res;
+int sd_walk(const char *root, int max_depth, const char *pattern, sd_walk_visitor visitor,
+            void *context, SD_WalkStats *stats) {
+    SD_WalkStats st = {0};
+    FRESULT res = FR_OK;
+    int depth = 0;
+
+    if (root == NULL || visitor == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    size_t root_len = strlen(root);
+    if (root_len >= SD_WALK_PATH_MAX) {
+        return FR_INVALID_NAME;
+    }
+    if (s_walk_busy) {
+        return FR_LOCKED;
+    }
+    s_walk_busy = true;
+    if (max_depth <= 0 || max_depth > SD_DIR_MAX_DEPTH) {
+        max_depth = SD_DIR_MAX_DEPTH;
     }
 
-    res = f_lseek(&file, f_size(&file));
-    if (res != FR_OK) {
-        SD_APP_LOG("Seek failed: %d\r\n", res);
-        f_close(&file);
-        return res;
+    memcpy(s_walk_path, root, root_len + 1U);
+    s_walk[0].path_len = (uint16_t)root_len;
+    s_walk[0].index = 0;
+    s_walk[0].open = false;
+
+    while (depth >= 0) {
+        sd_walk_level *level = &s_walk[depth];
+        if (!level->open) {
+            res = sd_walk_open(depth);
+            if (res != FR_OK) {
+                break;
+            }
+        }
+
+        res = f_readdir(&level->dir, &s_walk_fno);
+        if (res != FR_OK) {
+            break;
+        }
+        if (s_walk_fno.fname[0] == '\0') {
+            level->open = false;
+            (void)f_closedir(&level->dir);
+            depth--;
+            continue;
+        }
+        level->index++;
+
+        const char *name = s_walk_fno.fname;
+        bool is_dir = (s_walk_fno.fattrib & AM_DIR) != 0U;
+        if (is_dir && (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+            continue;
+        }
+
+        /* Filter files before their path is assembled. */
+        if (!is_dir && pattern != NULL && !sd_name_match(pattern, name)) {
+            continue;
+        }
+
+        size_t base = level->path_len;
+        bool sep = (base > 0U && s_walk_path[base - 1U] != '/');
+        size_t name_len = strlen(name);
+        if (base + (sep ? 1U : 0U) + name_len >= SD_WALK_PATH_MAX) {
+            st.skipped++;
+            continue;
+        }
+        s_walk_path[base] = '/';
+        memcpy(&s_walk_path[base + (sep ? 1U : 0U)], name, name_len + 1U);
+        size_t child_len = base + (sep ? 1U : 0U) + name_len;
+
+        sd_walk_action action = SD_WALK_CONTINUE;
+        if (is_dir) {
+            st.dirs++;
+            action = visitor(s_walk_path, &s_walk_fno, depth, context);
+        } else {
+            st.files++;
+            action = visitor(s_walk_path, &s_walk_fno, depth, context);
+        }
+        if (action == SD_WALK_STOP) {
+            break;
+        }
+
+        if (is_dir && action != SD_WALK_SKIP) {
+            if (depth + 1 >= max_depth) {
+                st.depth_limited++;
+            } else {
+                sd_walk_level *child = &s_walk[depth + 1];
+                child->path_len = (uint16_t)child_len;
+                child->index = 0;
+                child->open = false;
+                res = sd_walk_open(depth + 1);
+                if (res == FR_OK) {
+                    depth++;
+                    continue;
+                }
+                st.errors++;
+                res = FR_OK;
+            }
+        }
+        s_walk_path[base] = '\0';
     }
 
-    res = f_write(&file, text, strlen(text), &bw);
-    f_close(&file);
-    if (res == FR_OK && bw == strlen(text)) {
-        SD_APP_LOG("Appended %u bytes to %s\r\n", bw, filename);
-    } else {
-        SD_APP_LOG("Append failed: %d\r\n", res);
+    for (int i = 0; i < SD_DIR_MAX_DEPTH; i++) {
+        if (s_walk[i].open) {
+            s_walk[i].open = false;
+            (void)f_closedir(&s_walk[i].dir);
+        }
     }
-    return (res == FR_OK && bw == strlen(text)) ? FR_OK : FR_DISK_ERR;
+    s_walk_busy = false;
+    if (stats != NULL) {
+        *stats = st;
+    }
+    return res;
 }
 
-int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_read) {
-    FIL file;
-    if (buffer == NULL || bytes_read == NULL || bufsize == 0) {
+static FILINFO s_find_fno;
+static bool s_find_busy;
+
+int sd_find(const char *dir, const char *pattern, sd_find_visitor visitor, void *context,
+            uint32_t *count) {
+    DIR dj;
+    uint32_t n = 0;
+
+    if (count != NULL) {
+        *count = 0;
+    }
+    if (dir == NULL || pattern == NULL || visitor == NULL) {
         return FR_INVALID_PARAMETER;
     }
-    *bytes_read = 0;
-
-    FRESULT res = f_open(&file, filename, FA_READ);
-    if (res != FR_OK) {
-        SD_APP_LOG("File open failed: %d\r\n", res);
-        return res;
+    if (s_find_busy) {
+        return FR_LOCKED;
     }
+    s_find_busy = true;
 
-    res = f_read(&file, buffer, bufsize - 1, bytes_read);
-    if (res != FR_OK) {
-        SD_APP_LOG("Read failed: %d\r\n", res);
-        f_close(&file);
-        return res;
+#if _USE_FIND
+    /* FatFs matches each entry right after reading it, so no copy is made here. */
+    FRESULT res = f_findfirst(&dj, &s_find_fno, dir, pattern);
+    while (res == FR_OK && s_find_fno.fname[0] != '\0') {
+        n++;
+        if (!visitor(s_find_fno.fname, &s_find_fno, context)) {
+            break;
+        }
+        res = f_findnext(&dj, &s_find_fno);
+    }
+#else
+    FRESULT res = f_opendir(&dj, dir);
+    while (res == FR_OK) {
+        res = f_readdir(&dj, &s_find_fno);
+        if (res != FR_OK || s_find_fno.fname[0] == '\0') {
+            break;
+        }
+        if (!sd_name_match(pattern, s_find_fno.fname)) {
+            continue;
+        }
+        n++;
+        if (!visitor(s_find_fno.fname, &s_find_fno, context)) {
+            break;
+        }
+    }
+#endif
+    (void)f_closedir(&dj); /* A failed open left the object invalid: no-op */
+    s_find_busy = false;
+    if (count != NULL) {
+        *count = n;
     }
+    return res;
+}
 
-    buffer[*bytes_read] = '\0';
+#if (_FS_MINIMIZE == 0)
+typedef struct {
+    const char *from;
+    const char *to;
+    uint32_t moved;
+    uint32_t failed;
+    FRESULT res; // First failure
+} sd_move_ctx;
 
-    res = f_close(&file);
-    if (res != FR_OK) {
-        SD_APP_LOG("File close failed: %d\r\n", res);
-        return res;
+/* sd_find visitor: move one matching file (directories stay) in batch mode. */
+static bool sd_move_one(const char *name, const FILINFO *fno, void *context) {
+    sd_move_ctx *move = (sd_move_ctx *)context;
+    FRESULT res = FR_INVALID_NAME;
+    if ((fno->fattrib & AM_DIR) != 0U) {
+        return true;
     }
-
-    SD_APP_LOG("Read %u bytes from %s\r\n", *bytes_read, filename);
-    return FR_OK;
+    if (sd_batch_path(s_batch_from, move->from, name) &&
+        sd_batch_path(s_batch_to, move->to, name)) {
+        (void)sd_file_cache_close(s_batch_from);
+        res = f_rename(s_batch_from, s_batch_to);
+    }
+    if (res == FR_OK) {
+        sd_dirindex_invalidate(s_batch_from);
+        sd_dirindex_add(s_batch_to);
+        move->moved++;
+    } else {
+        move->failed++;
+        if (move->res == FR_OK) {
+            move->res = res;
+        }
+    }
+    return true;
 }
+#endif
 
-int sd_read_csv(const char *filename, CsvRecord *records, int max_records, int *record_count) {
-    FIL file;
-    char line[128];
-    if (records == NULL || record_count == NULL || max_records <= 0) {
+int sd_move_files(const char *dir_from, const char *dir_to, const char *pattern, uint32_t *moved) {
+    if (moved != NULL) {
+        *moved = 0;
+    }
+#if (_FS_MINIMIZE != 0)
+    (void)dir_from;
+    (void)dir_to;
+    (void)pattern;
+    SD_APP_LOG("Move needs _FS_MINIMIZE 0 in ffconf.h\r\n");
+    return FR_DENIED;
+#else
+    if (dir_from == NULL || dir_to == NULL) {
         return FR_INVALID_PARAMETER;
     }
-    *record_count = 0;
-
-    FRESULT res = f_open(&file, filename, FA_READ);
+    if (s_batch_busy) {
+        return FR_LOCKED;
+    }
+    DIR dj;
+    FRESULT res = f_opendir(&dj, dir_to); /* the destination must exist */
     if (res != FR_OK) {
-        SD_APP_LOG("Failed to open CSV: %s (%d)\r\n", filename, res);
         return res;
     }
-
-    SD_APP_LOG("Reading CSV: %s\r\n", filename);
-    while (f_gets(line, sizeof(line), &file) && *record_count < max_records) {
-        char *saveptr;
-        char *token = strtok_r(line, ",", &saveptr);
-        if (!token) continue;
-        strncpy(records[*record_count].field1, token, sizeof(records[*record_count].field1) - 1);
-        records[*record_count].field1[sizeof(records[*record_count].field1) - 1] = '\0';
-
-        token = strtok_r(NULL, ",", &saveptr);
-        if (!token) continue;
-        strncpy(records[*record_count].field2, token, sizeof(records[*record_count].field2) - 1);
-        records[*record_count].field2[sizeof(records[*record_count].field2) - 1] = '\0';
-
-        token = strtok_r(NULL, ",", &saveptr);
-        if (token)
-            records[*record_count].value = atoi(token);
-        else
-            records[*record_count].value = 0;
-
-        (*record_count)++;
+    (void)f_closedir(&dj);
+    if (sd_batch_mode(true) != SD_OK) {
+        return FR_TIMEOUT;
     }
+    s_batch_busy = true;
+    sd_fastseek_invalidate();
 
-    f_close(&file);
-
-    for (int i = 0; i < *record_count; i++) {
-        SD_APP_LOG("[%d] %s | %s | %d\r\n", i,
-                records[i].field1,
-                records[i].field2,
-                records[i].value);
+    sd_move_ctx move = {dir_from, dir_to, 0, 0, FR_OK};
+    res = sd_find(dir_from, (pattern != NULL) ? pattern : "*", sd_move_one, &move, NULL);
+    if (res == FR_OK) {
+        res = move.res;
     }
 
-    return FR_OK;
-}
-
-int sd_delete_file(const char *filename) {
-    FRESULT res = f_unlink(filename);
-    SD_APP_LOG("Delete %s: %s\r\n", filename, (res == FR_OK ? "OK" : "Failed"));
+    SD_Status status = sd_batch_mode(false);
+    s_batch_busy = false;
+    if (res == FR_OK && status != SD_OK) {
+        res = FR_DISK_ERR;
+    }
+    if (moved != NULL) {
+        *moved = move.moved;
+    }
+    SD_APP_LOG("Move %s to %s: %lu moved, %lu failed, sync %s\r\n", dir_from, dir_to,
+               (unsigned long)move.moved, (unsigned long)move.failed,
+               (status == SD_OK) ? "OK" : "Failed");
     return res;
+#endif
 }
 
-int sd_rename_file(const char *oldname, const char *newname) {
-    FRESULT res = f_rename(oldname, newname);
-    SD_APP_LOG("Rename %s to %s: %s\r\n", oldname, newname, (res == FR_OK ? "OK" : "Failed"));
-    return res;
-}
+typedef struct {
+    int indent;
+    int max_depth;
+} sd_list_ctx;
 
-FRESULT sd_create_directory(const char *path) {
-    FRESULT res = f_mkdir(path);
-    SD_APP_LOG("Create directory %s: %s\r\n", path, (res == FR_OK ? "OK" : "Failed"));
-    return res;
+static sd_walk_action sd_list_visit(const char *path, const FILINFO *fno, int depth,
+                                    void *context) {
+    const sd_list_ctx *ctx = (const sd_list_ctx *)context;
+    int col = (ctx->indent + depth) * 2;
+    (void)path;
+    if (fno->fattrib & AM_DIR) {
+        SD_APP_LOG("%*s[D] %s\r\n", col, "", fno->fname);
+        if (depth + 1 >= ctx->max_depth) {
+            SD_APP_LOG("%*s[...] max depth reached\r\n", col + 2, "");
+        }
+    } else {
+        SD_APP_LOG("%*s[F] %s (%lu bytes)\r\n", col, "", fno->fname, (unsigned long)fno->fsize);
+    }
+    return SD_WALK_CONTINUE;
 }
 
 void sd_list_directory_recursive(const char *path, int depth) {
@@ -249,36 +3918,10 @@ void sd_list_directory_recursive(const char *path, int depth) {
         return;
     }
 
-    DIR dir;
-    FILINFO fno;
-    FRESULT res = f_opendir(&dir, path);
-    if (res != FR_OK) {
-        SD_APP_LOG("%*s[ERR] Cannot open: %s\r\n", depth * 2, "", path);
-        return;
-    }
-
-    while (1) {
-        res = f_readdir(&dir, &fno);
-        if (res != FR_OK || fno.fname[0] == 0) break;
-
-        const char *name = (fno.fname[0] != 0) ? fno.fname : fno.altname;
-
-        if (fno.fattrib & AM_DIR) {
-            if (strcmp(name, ".") && strcmp(name, "..")) {
-                SD_APP_LOG("%*s[D] %s\r\n", depth * 2, "", name);
-                char newpath[128];
-                int written = snprintf(newpath, sizeof(newpath), "%s/%s", path, name);
-                if (written > 0 && (size_t)written < sizeof(newpath)) {
-                    sd_list_directory_recursive(newpath, depth + 1);
-                } else {
-                    SD_APP_LOG("%*s[ERR] Path too long\r\n", (depth + 1) * 2, "");
-                }
-            }
-        } else {
-            SD_APP_LOG("%*s[F] %s (%lu bytes)\r\n", depth * 2, "", name, (unsigned long)fno.fsize);
-        }
+    sd_list_ctx ctx = { depth, SD_DIR_MAX_DEPTH - depth };
+    if (sd_walk(path, ctx.max_depth, NULL, sd_list_visit, &ctx, NULL) != FR_OK) {
+        SD_APP_LOG_ERROR("%*s[ERR] Cannot open: %s\r\n", depth * 2, "", path);
     }
-    f_closedir(&dir);
 }
 
 void sd_list_files(void) {
@@ -286,3 +3929,56 @@ void sd_list_files(void) {
     sd_list_directory_recursive(sd_path, 0);
     SD_APP_LOG("\r\n\r\n");
 }
+
+#if (SD_PROFILE_ENABLED == 1)
+static uint32_t sd_profile_us(uint64_t cycles) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    return (uint32_t)(cycles / ((per_us != 0U) ? per_us : 1U));
+}
+#endif
+
+void sd_profile_report(bool reset) {
+#if (SD_PROFILE_ENABLED == 1)
+    SD_APP_LOG("SDPROF,api,calls,errors,total_us,max_us,io_us,"
+               "rd_fat,rd_dir,rd_data,wr_fat,wr_dir,wr_data\r\n");
+    for (int api = 0; api < SD_PROF_COUNT; api++) {
+        const SD_ProfStats *p = SD_ProfGet((SD_ProfApi)api);
+        if (p->calls == 0U && p->io_cycles == 0U) {
+            continue;
+        }
+        SD_APP_LOG("SDPROF,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n",
+                   SD_ProfName((SD_ProfApi)api), (unsigned long)p->calls,
+                   (unsigned long)p->errors, (unsigned long)sd_profile_us(p->cycles),
+                   (unsigned long)sd_profile_us(p->max_cycles),
+                   (unsigned long)sd_profile_us(p->io_cycles),
+                   (unsigned long)p->sectors_read[SD_PROF_REGION_FAT],
+                   (unsigned long)p->sectors_read[SD_PROF_REGION_DIR],
+                   (unsigned long)p->sectors_read[SD_PROF_REGION_DATA],
+                   (unsigned long)p->sectors_written[SD_PROF_REGION_FAT],
+                   (unsigned long)p->sectors_written[SD_PROF_REGION_DIR],
+                   (unsigned long)p->sectors_written[SD_PROF_REGION_DATA]);
+    }
+#if (SD_PROFILE_FILES > 0U)
+    SD_APP_LOG("SDPROF,file,path,opens,rd_bytes,wr_bytes,rd_sectors,wr_sectors,syncs,"
+               "total_us,io_us\r\n");
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        const SD_ProfFileStats *f = SD_ProfFileGet(i);
+        if (f == NULL) {
+            continue;
+        }
+        SD_APP_LOG("SDPROF,file,%s,%lu,%llu,%llu,%lu,%lu,%lu,%lu,%lu\r\n", f->name,
+                   (unsigned long)f->opens, (unsigned long long)f->bytes_read,
+                   (unsigned long long)f->bytes_written, (unsigned long)f->sectors_read,
+                   (unsigned long)f->sectors_written, (unsigned long)f->syncs,
+                   (unsigned long)sd_profile_us(f->cycles),
+                   (unsigned long)sd_profile_us(f->io_cycles));
+    }
+#endif
+    if (reset) {
+        SD_ProfReset();
+    }
+#else
+    (void)reset;
+    SD_APP_LOG("Profiler disabled (build with SD_PROFILE_ENABLED=1)\r\n");
+#endif
+}
@@ -0,0 +1,243 @@
+/*
+ * sd_fwload.c
+ *
+ * Image loader: pieces read into two buffers from the file's cluster runs,
+ * the next one queued to the SD I/O task while the current one is
+ * programmed, with the CRC updated on the way.
+ */
+
+#include "sd_fwload.h"
+#include "sd_crc32.h"
+#include "sd_diskio_spi.h"
+#include "sd_spi.h"
+#include "diskio.h"
+#if defined(USE_FREERTOS)
+#include "sd_async.h"
+#endif
+#include <string.h>
+
+#if (SD_FWLOAD_CHUNK % _MAX_SS) != 0U
+#error "SD_FWLOAD_CHUNK must be a multiple of _MAX_SS"
+#endif
+
+/* One load at a time: the buffers, map and file are the loader's own. */
+static uint8_t s_buf[2][SD_FWLOAD_CHUNK] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static FIL s_fil;
+#if _USE_FASTSEEK
+static DWORD s_map[SD_FWLOAD_MAP_ENTRIES];
+#endif
+
+typedef struct {
+    FSIZE_t offset; // File offset of the piece
+    uint32_t len;   // File bytes in it
+    bool queued;    // Read handed to the SD I/O task, not yet collected
+} SD_FwPiece;
+
+#if _USE_FASTSEEK
+/* Card sector holding file offset off, and the sectors of its run from there. */
+static bool SD_FwMapSector(const FATFS *fs, FSIZE_t off, DWORD *sector, uint32_t *left) {
+    uint32_t ss = SD_FS_SECTOR_SIZE(fs);
+    uint32_t cluster_bytes = (uint32_t)fs->csize * ss;
+    DWORD cl = (DWORD)(off / cluster_bytes);
+    uint32_t in_cluster = (uint32_t)(off % cluster_bytes) / ss;
+    const DWORD *tbl = &s_map[1];
+    for (DWORD ncl = *tbl++; ncl != 0U; ncl = *tbl++) {
+        if (cl < ncl) {
+            *sector = fs->database + (DWORD)fs->csize * (tbl[0] + cl - 2U) + in_cluster;
+            *left = (ncl - cl) * fs->csize - in_cluster;
+            return true;
+        }
+        cl -= ncl;
+        tbl++;
+    }
+    return false;
+}
+#endif
+
+/* Start reading the piece at off into buf; a queued read is collected by SD_FwFinish. */
+static FRESULT SD_FwStart(SD_FwPiece *piece, uint8_t *buf, FSIZE_t off, bool mapped, bool async) {
+    FSIZE_t size = f_size(&s_fil);
+    piece->offset = off;
+    piece->queued = false;
+    piece->len = (size - off < SD_FWLOAD_CHUNK) ? (uint32_t)(size - off) : SD_FWLOAD_CHUNK;
+#if _USE_FASTSEEK
+    if (mapped) {
+        FATFS *fs = s_fil.obj.fs;
+        uint32_t ss = SD_FS_SECTOR_SIZE(fs);
+        DWORD sector;
+        uint32_t left;
+        if (!SD_FwMapSector(fs, off, &sector, &left)) {
+            return FR_INT_ERR;
+        }
+        uint32_t sectors = (piece->len + ss - 1U) / ss;
+        if (sectors > left) {
+            sectors = left; /* a piece ends with its run */
+            piece->len = sectors * ss;
+        }
+#if defined(USE_FREERTOS)
+        if (async) {
+            SD_Status status = SD_SubmitRead(SD_DiskHandle(fs->drv), buf,
+                                             sector * SD_DISK_SECTOR_BLOCKS,
+                                             sectors * SD_DISK_SECTOR_BLOCKS, NULL, NULL);
+            piece->queued = (status == SD_OK);
+            return piece->queued ? FR_OK : FR_DISK_ERR;
+        }
+#endif
+        (void)async;
+        return (disk_read(fs->drv, buf, sector, sectors) == RES_OK) ? FR_OK : FR_DISK_ERR;
+    }
+#endif
+    (void)mapped;
+    (void)async;
+    UINT br = 0;
+    FRESULT res = f_read(&s_fil, buf, piece->len, &br);
+    return (res == FR_OK && br != piece->len) ? FR_INT_ERR : res;
+}
+
+static FRESULT SD_FwFinish(SD_FwPiece *piece) {
+#if defined(USE_FREERTOS)
+    if (piece->queued) {
+        piece->queued = false;
+        SD_Status status = SD_AsyncWait(SD_FWLOAD_TIMEOUT_MS);
+        if (status == SD_TIMEOUT) {
+            return FR_TIMEOUT;
+        }
+        return (status == SD_OK) ? FR_OK : FR_DISK_ERR;
+    }
+#else
+    (void)piece;
+#endif
+    return FR_OK;
+}
+
+FRESULT SD_FwLoad(const char *path, const SD_FwLoadConfig *cfg, SD_FwLoadStats *stats) {
+    SD_FwLoadStats st;
+    memset(&st, 0, sizeof(st));
+    st.crc = SD_CRC32_INIT;
+    uint32_t start = HAL_GetTick();
+    if (stats) {
+        *stats = st;
+    }
+    if (path == NULL || cfg == NULL || cfg->crc_mode > SD_FWLOAD_CRC_TRAILER) {
+        return FR_INVALID_PARAMETER;
+    }
+    FRESULT res = f_open(&s_fil, path, FA_READ);
+    if (res != FR_OK) {
+        return res;
+    }
+    FSIZE_t size = f_size(&s_fil);
+    FSIZE_t image = size;
+    if (cfg->crc_mode == SD_FWLOAD_CRC_TRAILER) {
+        image = (size >= 4U) ? size - 4U : 0U;
+    }
+    bool too_large = (cfg->max_bytes > 0U && image > cfg->max_bytes);
+#if _FS_EXFAT
+    too_large = too_large || image > UINT32_MAX; /* offsets passed to program are 32-bit */
+#endif
+    if ((cfg->crc_mode == SD_FWLOAD_CRC_TRAILER && size < 4U) || too_large) {
+        (void)f_close(&s_fil);
+        return FR_INVALID_PARAMETER;
+    }
+
+    bool mapped = false;
+    bool async = false;
+#if _USE_FASTSEEK
+    if (size > 0U) {
+        s_map[0] = SD_FWLOAD_MAP_ENTRIES;
+        s_fil.cltbl = s_map;
+        res = f_lseek(&s_fil, CREATE_LINKMAP);
+        if (res == FR_OK) {
+            mapped = true;
+            st.runs = (s_map[0] - 2U) / 2U;
+        } else if (res == FR_NOT_ENOUGH_CORE) {
+            s_fil.cltbl = NULL; /* too many runs: walk the chain with f_read */
+            res = FR_OK;
+        }
+    }
+#endif
+#if defined(USE_FREERTOS)
+    if (res == FR_OK && mapped && SD_AsyncTaskHandle() != NULL) {
+        /* Queued reads go to the card behind the sector cache: write it back first. */
+        async = true;
+        res = (disk_ioctl(s_fil.obj.fs->drv, CTRL_SYNC, NULL) == RES_OK) ? FR_OK : FR_DISK_ERR;
+    }
+#endif
+
+    uint8_t trailer[4] = {0};
+    SD_FwPiece cur = {0}, next = {0};
+    uint32_t b = 0;
+    SD_Crc32Stream crc;
+    SD_Crc32Begin(&crc);
+    if (res == FR_OK && size > 0U) {
+        res = SD_FwStart(&cur, s_buf[0], 0U, mapped, async);
+        if (res == FR_OK) {
+            res = SD_FwFinish(&cur);
+        }
+        st.chunks = (res == FR_OK) ? 1U : 0U;
+    }
+    while (res == FR_OK && cur.offset < size) {
+        const uint8_t *data = s_buf[b];
+        uint32_t len = (cur.offset >= image) ? 0U
+                       : (image - cur.offset < cur.len) ? (uint32_t)(image - cur.offset)
+                                                       : cur.len;
+        /*
+         * CRC first: a DMA feed reads this buffer alongside the card read into
+         * the other one and the program callback, and the next Update waits
+         * for it before this buffer is refilled.
+         */
+        SD_Crc32Update(&crc, data, len);
+
+        FSIZE_t next_off = cur.offset + cur.len;
+        if (next_off < size) {
+            res = SD_FwStart(&next, s_buf[b ^ 1U], next_off, mapped, async);
+            if (res != FR_OK) {
+                break;
+            }
+            st.overlapped += next.queued ? 1U : 0U;
+        }
+
+        for (uint32_t i = len; i < cur.len; i++) {
+            trailer[(cur.offset + i - image) & 3U] = data[i];
+        }
+        if (len > 0U) {
+            if (cfg->program != NULL &&
+                !cfg->program(cfg->context, (uint32_t)cur.offset, data, len)) {
+                (void)SD_FwFinish(&next); /* the buffer is the loader's until the read is in */
+                res = FR_DENIED;
+                break;
+            }
+            st.image_bytes += len;
+        }
+
+        if (next_off >= size) {
+            break;
+        }
+        res = SD_FwFinish(&next);
+        if (res == FR_OK) {
+            st.chunks++;
+            cur = next;
+            b ^= 1U;
+        }
+    }
+    st.crc = SD_Crc32End(&crc);
+    FRESULT close_res = f_close(&s_fil);
+    if (res == FR_OK) {
+        res = close_res;
+    }
+
+    if (res == FR_OK) {
+        uint32_t expected = cfg->crc;
+        if (cfg->crc_mode == SD_FWLOAD_CRC_TRAILER) {
+            expected = (uint32_t)trailer[0] | ((uint32_t)trailer[1] << 8) |
+                       ((uint32_t)trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+        }
+        if (cfg->crc_mode != SD_FWLOAD_CRC_NONE && st.crc != expected) {
+            res = FR_INT_ERR;
+        }
+    }
+    st.elapsed_ms = HAL_GetTick() - start;
+    if (stats) {
+        *stats = st;
+    }
+    return res;
+}
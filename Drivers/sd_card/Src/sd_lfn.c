@@ -0,0 +1,26 @@
+/*
+ * sd_lfn.c
+ *
+ * The fast path reproduces ccsbcs.c's cvt1 entries below U+0100: a-z and
+ * U+00E0..U+00FE (except U+00F7) shift down by 0x20, U+00FF maps to U+0178.
+ * Nothing else there changes case (U+00B5 is left alone, as in FatFs).
+ */
+
+#include "sd_lfn.h"
+
+#if SD_LFN_FAST_UPPER
+
+WCHAR __wrap_ff_wtoupper(WCHAR chr) {
+    if (chr < 0x80U) {
+        return (chr >= 'a' && chr <= 'z') ? (WCHAR)(chr - 0x20U) : chr;
+    }
+    if (chr < 0x100U) {
+        if (chr == 0xFFU) {
+            return 0x0178U;
+        }
+        return (chr >= 0xE0U && chr != 0xF7U) ? (WCHAR)(chr - 0x20U) : chr;
+    }
+    return __real_ff_wtoupper(chr);
+}
+
+#endif
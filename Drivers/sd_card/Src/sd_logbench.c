@@ -0,0 +1,464 @@
+/*
+ * sd_logbench.c
+ *
+ * Logger tail-latency benchmark under competing file system load.
+ */
+
+#include "sd_logbench.h"
+#include "ff.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef USE_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+#define SD_LOGBENCH_UI_MAX 4096U
+
+/* Record's end in the log and its due time; filled by the producer, drained by the checker. */
+typedef struct {
+    uint32_t end;
+    uint32_t stamp;
+} SD_LogBenchPending;
+
+static const SD_LogBenchConfig *s_cfg;
+static SD_LogBenchResult *s_out;
+static SD_LogBenchPending s_pending[SD_LOGBENCH_PENDING];
+static volatile uint32_t s_head; /* producer */
+static volatile uint32_t s_tail; /* checker */
+static uint32_t s_offset;        /* log bytes of the records accepted so far */
+static uint32_t s_seq;
+static uint8_t s_record[SD_LOGGER_MAX_RECORD];
+static uint8_t s_ui_buf[SD_LOGBENCH_UI_MAX];
+static uint32_t s_ui_pos;
+
+static uint32_t sd_logbench_cycles_per_us(void) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    return per_us ? per_us : 1U;
+}
+
+static uint32_t sd_logbench_bucket(uint32_t us) {
+    if (us < 4U) {
+        return us;
+    }
+    uint32_t e = 31U - (uint32_t)__builtin_clz(us);
+    return 4U * (e - 1U) + ((us >> (e - 2U)) & 3U);
+}
+
+uint32_t sd_logbench_bucket_us(uint32_t b) {
+    if (b < 4U) {
+        return b;
+    }
+    uint32_t e = b / 4U + 1U;
+    return (((4U + b % 4U + 1U) << (e - 2U)) - 1U);
+}
+
+void sd_logbench_defaults(SD_LogBenchConfig *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->path = "bench.log";
+    cfg->duration_ms = 10000U;
+    cfg->record_bytes = 64U;
+    cfg->record_period_ms = 5U;
+    cfg->ui_path = "ui.bin";
+    cfg->ui_file_bytes = 65536U;
+    cfg->ui_period_ms = 50U;
+    cfg->ui_read_bytes = 4096U;
+    cfg->stat_period_ms = 200U;
+    cfg->led_period_ms = 10U;
+}
+
+/* Producer: one record due at stamp (a DWT cycle count). */
+static void sd_logbench_produce(uint32_t stamp) {
+    uint32_t len = s_cfg->record_bytes;
+    memcpy(&s_record[0], &s_seq, sizeof(s_seq));
+    memcpy(&s_record[4], &stamp, sizeof(stamp));
+    s_seq++;
+    s_out->records++;
+    if (!sd_logger_write(s_record, len)) {
+        s_out->dropped++;
+        return;
+    }
+    s_offset += len + ((SD_LOGGER_CHANNELS > 0U) ? 4U : 0U); /* the tag in front */
+    uint32_t head = s_head;
+    if (SD_LOGGER_COMPRESS == 1 || head - s_tail >= SD_LOGBENCH_PENDING) {
+        s_out->unmeasured++;
+        return;
+    }
+    s_pending[head & (SD_LOGBENCH_PENDING - 1U)].end = s_offset;
+    s_pending[head & (SD_LOGBENCH_PENDING - 1U)].stamp = stamp;
+    __atomic_store_n(&s_head, head + 1U, __ATOMIC_RELEASE);
+}
+
+/* Checker: time every pending record the logger has written out by now. */
+static void sd_logbench_check(void) {
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    uint32_t now = DWT->CYCCNT;
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = s_tail;
+    while (tail != head) {
+        const SD_LogBenchPending *p = &s_pending[tail & (SD_LOGBENCH_PENDING - 1U)];
+        if ((int32_t)(st.file_bytes - p->end) < 0) {
+            break;
+        }
+        uint32_t us = (now - p->stamp) / sd_logbench_cycles_per_us();
+        s_out->hist[sd_logbench_bucket(us)]++;
+        if (us > s_out->max_us) {
+            s_out->max_us = us;
+        }
+        s_out->committed++;
+        tail++;
+    }
+    s_tail = tail;
+}
+
+static uint32_t sd_logbench_since_us(uint32_t start) {
+    return (DWT->CYCCNT - start) / sd_logbench_cycles_per_us();
+}
+
+/* One chunk of the asset file, wrapping at its end. */
+static void sd_logbench_ui_read(void) {
+    FIL file;
+    UINT br = 0;
+    uint32_t start = DWT->CYCCNT;
+    FRESULT res = f_open(&file, s_cfg->ui_path, FA_READ);
+    if (res == FR_OK) {
+        if (s_ui_pos + s_cfg->ui_read_bytes > s_cfg->ui_file_bytes) {
+            s_ui_pos = 0;
+        }
+        res = f_lseek(&file, s_ui_pos);
+        if (res == FR_OK) {
+            res = f_read(&file, s_ui_buf, s_cfg->ui_read_bytes, &br);
+        }
+        (void)f_close(&file);
+        s_ui_pos += br;
+    }
+    uint32_t us = sd_logbench_since_us(start);
+    s_out->ui_reads++;
+    if (res != FR_OK) {
+        s_out->load_errors++;
+    }
+    if (us > s_out->ui_max_us) {
+        s_out->ui_max_us = us;
+    }
+}
+
+static void sd_logbench_stat(void) {
+    FILINFO fno;
+    uint32_t start = DWT->CYCCNT;
+    FRESULT res = f_stat(s_cfg->path, &fno);
+    if (res == FR_OK && s_cfg->ui_period_ms != 0U) {
+        res = f_stat(s_cfg->ui_path, &fno);
+    }
+    uint32_t us = sd_logbench_since_us(start);
+    s_out->stat_polls++;
+    if (res != FR_OK) {
+        s_out->load_errors++;
+    }
+    if (us > s_out->stat_max_us) {
+        s_out->stat_max_us = us;
+    }
+}
+
+static void sd_logbench_led(uint32_t late_us) {
+    if (s_cfg->led_port != NULL) {
+        HAL_GPIO_TogglePin(s_cfg->led_port, s_cfg->led_pin);
+    }
+    s_out->led_toggles++;
+    if (late_us > s_out->led_late_max_us) {
+        s_out->led_late_max_us = late_us;
+    }
+}
+
+/* Fill the asset file up to ui_file_bytes before the measured run. */
+static FRESULT sd_logbench_ui_prepare(void) {
+    FILINFO fno;
+    if (s_cfg->ui_period_ms == 0U ||
+        (f_stat(s_cfg->ui_path, &fno) == FR_OK && fno.fsize >= s_cfg->ui_file_bytes)) {
+        return FR_OK;
+    }
+    FIL file;
+    FRESULT res = f_open(&file, s_cfg->ui_path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        return res;
+    }
+    memset(s_ui_buf, 0x3C, sizeof(s_ui_buf));
+    for (uint32_t done = 0; done < s_cfg->ui_file_bytes && res == FR_OK;) {
+        uint32_t n = s_cfg->ui_file_bytes - done;
+        UINT bw = 0;
+        if (n > sizeof(s_ui_buf)) {
+            n = sizeof(s_ui_buf);
+        }
+        res = f_write(&file, s_ui_buf, n, &bw);
+        if (res == FR_OK && bw != n) {
+            res = FR_DENIED;
+        }
+        done += n;
+    }
+    FRESULT close_res = f_close(&file);
+    return (res == FR_OK) ? close_res : res;
+}
+
+#ifdef USE_FREERTOS
+#define SD_LOGBENCH_TASKS 4U
+
+static volatile bool s_run;
+static volatile uint32_t s_exited;
+static TaskHandle_t s_tasks[SD_LOGBENCH_TASKS];
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StackType_t s_stacks[SD_LOGBENCH_TASKS][SD_LOGBENCH_TASK_STACK];
+static StaticTask_t s_tcbs[SD_LOGBENCH_TASKS];
+#endif
+
+static void sd_logbench_exit(void) {
+    __atomic_fetch_add(&s_exited, 1U, __ATOMIC_RELEASE);
+    vTaskDelete(NULL);
+}
+
+static void sd_logbench_producer_task(void *argument) {
+    (void)argument;
+    TickType_t wake = xTaskGetTickCount();
+    while (s_run) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(s_cfg->record_period_ms));
+        if (s_run) {
+            sd_logbench_produce(DWT->CYCCNT);
+        }
+    }
+    sd_logbench_exit();
+}
+
+static void sd_logbench_ui_task(void *argument) {
+    (void)argument;
+    TickType_t wake = xTaskGetTickCount();
+    while (s_run) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(s_cfg->ui_period_ms));
+        if (s_run) {
+            sd_logbench_ui_read();
+        }
+    }
+    sd_logbench_exit();
+}
+
+static void sd_logbench_stat_task(void *argument) {
+    (void)argument;
+    TickType_t wake = xTaskGetTickCount();
+    while (s_run) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(s_cfg->stat_period_ms));
+        if (s_run) {
+            sd_logbench_stat();
+        }
+    }
+    sd_logbench_exit();
+}
+
+static void sd_logbench_led_task(void *argument) {
+    (void)argument;
+    uint32_t period = s_cfg->led_period_ms * (SystemCoreClock / 1000U);
+    TickType_t wake = xTaskGetTickCount();
+    uint32_t due = DWT->CYCCNT;
+    while (s_run) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(s_cfg->led_period_ms));
+        due += period;
+        int32_t late = (int32_t)(DWT->CYCCNT - due);
+        sd_logbench_led((late > 0) ? (uint32_t)late / sd_logbench_cycles_per_us() : 0U);
+    }
+    sd_logbench_exit();
+}
+
+static bool sd_logbench_spawn(uint32_t i, TaskFunction_t fn, const char *name,
+                              UBaseType_t priority) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_tasks[i] = xTaskCreateStatic(fn, name, SD_LOGBENCH_TASK_STACK, NULL, priority,
+                                   s_stacks[i], &s_tcbs[i]);
+#else
+    if (xTaskCreate(fn, name, SD_LOGBENCH_TASK_STACK, NULL, priority, &s_tasks[i]) != pdPASS) {
+        s_tasks[i] = NULL;
+    }
+#endif
+    return s_tasks[i] != NULL;
+}
+
+static FRESULT sd_logbench_loop(void) {
+    static const struct {
+        TaskFunction_t fn;
+        const char *name;
+        UBaseType_t priority;
+    } tasks[SD_LOGBENCH_TASKS] = {
+        {sd_logbench_producer_task, "lb_prod", SD_LOGBENCH_PRODUCER_PRIORITY},
+        {sd_logbench_led_task, "lb_led", SD_LOGBENCH_LED_PRIORITY},
+        {sd_logbench_ui_task, "lb_ui", SD_LOGBENCH_LOAD_PRIORITY},
+        {sd_logbench_stat_task, "lb_stat", SD_LOGBENCH_LOAD_PRIORITY},
+    };
+    const uint32_t periods[SD_LOGBENCH_TASKS] = {s_cfg->record_period_ms, s_cfg->led_period_ms,
+                                                 s_cfg->ui_period_ms, s_cfg->stat_period_ms};
+    uint32_t started = 0;
+    FRESULT res = FR_OK;
+    s_run = true;
+    s_exited = 0;
+    for (uint32_t i = 0; i < SD_LOGBENCH_TASKS && res == FR_OK; i++) {
+        if (periods[i] == 0U) {
+            continue;
+        }
+        if (sd_logbench_spawn(started, tasks[i].fn, tasks[i].name, tasks[i].priority)) {
+            started++;
+        } else {
+            res = FR_NOT_ENOUGH_CORE;
+        }
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    while (res == FR_OK && (xTaskGetTickCount() - start) < pdMS_TO_TICKS(s_cfg->duration_ms)) {
+        vTaskDelay(1);
+        sd_logbench_check();
+    }
+    s_run = false;
+    while (__atomic_load_n(&s_exited, __ATOMIC_ACQUIRE) < started) {
+        vTaskDelay(1);
+        sd_logbench_check();
+    }
+    return res;
+}
+#else
+/* Next due tick of a periodic load; a load that fell a whole period behind skips ahead. */
+static bool sd_logbench_due(uint32_t now, uint32_t *next, uint32_t period, uint32_t *late_ms) {
+    if (period == 0U || (int32_t)(now - *next) < 0) {
+        return false;
+    }
+    *late_ms = now - *next;
+    *next += period;
+    if ((int32_t)(now - *next) >= 0) {
+        *next = now + period;
+    }
+    return true;
+}
+
+/* Every record due by now (the last one at end), stamped with its due time. */
+static void sd_logbench_catch_up(uint32_t *next, uint32_t end) {
+    uint32_t now = HAL_GetTick();
+    uint32_t per_ms = SystemCoreClock / 1000U;
+    uint32_t cycles = DWT->CYCCNT;
+    while ((int32_t)(now - *next) >= 0 && (int32_t)(end - *next) >= 0) {
+        sd_logbench_produce(cycles - (now - *next) * per_ms);
+        *next += s_cfg->record_period_ms;
+    }
+}
+
+static FRESULT sd_logbench_loop(void) {
+    uint32_t start = HAL_GetTick();
+    uint32_t end = start + s_cfg->duration_ms;
+    uint32_t next_rec = start + s_cfg->record_period_ms;
+    uint32_t next_poll = start + SD_LOGGER_POLL_MS;
+    uint32_t next_ui = start + s_cfg->ui_period_ms;
+    uint32_t next_stat = start + s_cfg->stat_period_ms;
+    uint32_t next_led = start + s_cfg->led_period_ms;
+    uint32_t late_ms;
+
+    while ((int32_t)(HAL_GetTick() - end) < 0) {
+        uint32_t tick = HAL_GetTick();
+        sd_logbench_catch_up(&next_rec, end);
+        if (sd_logbench_due(HAL_GetTick(), &next_led, s_cfg->led_period_ms, &late_ms)) {
+            sd_logbench_led(late_ms * 1000U);
+        }
+        if (sd_logbench_due(HAL_GetTick(), &next_poll, SD_LOGGER_POLL_MS, &late_ms)) {
+            (void)sd_logger_poll();
+            sd_logbench_check();
+            sd_logbench_catch_up(&next_rec, end);
+        }
+        if (sd_logbench_due(HAL_GetTick(), &next_ui, s_cfg->ui_period_ms, &late_ms)) {
+            sd_logbench_ui_read();
+            sd_logbench_catch_up(&next_rec, end);
+        }
+        if (sd_logbench_due(HAL_GetTick(), &next_stat, s_cfg->stat_period_ms, &late_ms)) {
+            sd_logbench_stat();
+            sd_logbench_catch_up(&next_rec, end);
+        }
+        if (HAL_GetTick() == tick) {
+            HAL_Delay(1);
+        }
+    }
+    sd_logbench_catch_up(&next_rec, end);
+    return FR_OK;
+}
+#endif
+
+static uint32_t sd_logbench_percentile(const SD_LogBenchResult *r, uint32_t permille) {
+    uint64_t want = ((uint64_t)r->committed * permille + 999U) / 1000U;
+    uint64_t seen = 0;
+    if (want == 0U) {
+        return 0U;
+    }
+    for (uint32_t b = 0; b < SD_LOGBENCH_BUCKETS; b++) {
+        seen += r->hist[b];
+        if (seen >= want) {
+            uint32_t us = sd_logbench_bucket_us(b);
+            return (us < r->max_us) ? us : r->max_us;
+        }
+    }
+    return r->max_us;
+}
+
+int sd_logbench_run(const SD_LogBenchConfig *cfg, SD_LogBenchResult *out) {
+    if (!cfg || !out || !cfg->path || cfg->duration_ms == 0U || cfg->record_period_ms == 0U ||
+        cfg->record_bytes < 8U || cfg->record_bytes > SD_LOGGER_MAX_RECORD ||
+        (cfg->ui_period_ms != 0U && (!cfg->ui_path || cfg->ui_read_bytes == 0U ||
+                                     cfg->ui_read_bytes > SD_LOGBENCH_UI_MAX ||
+                                     cfg->ui_read_bytes > cfg->ui_file_bytes))) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (sd_logger_running()) {
+        return FR_LOCKED;
+    }
+    memset(out, 0, sizeof(*out));
+    s_cfg = cfg;
+    s_out = out;
+    s_head = 0;
+    s_tail = 0;
+    s_offset = 0;
+    s_seq = 0;
+    s_ui_pos = 0;
+    memset(s_record, 0xA5, sizeof(s_record));
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    FRESULT res = sd_logbench_ui_prepare();
+    if (res != FR_OK) {
+        return res;
+    }
+    res = (FRESULT)sd_logger_start(cfg->path);
+    if (res != FR_OK) {
+        return res;
+    }
+
+    res = sd_logbench_loop();
+
+    /* What is still queued goes out with the flush; its wait counts. */
+    (void)sd_logger_flush();
+    sd_logbench_check();
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    out->logger_error = st.last_error;
+    (void)sd_logger_stop();
+    out->unmeasured += s_head - s_tail;
+
+    out->p50_us = sd_logbench_percentile(out, 500U);
+    out->p90_us = sd_logbench_percentile(out, 900U);
+    out->p99_us = sd_logbench_percentile(out, 990U);
+    out->p999_us = sd_logbench_percentile(out, 999U);
+    return res;
+}
+
+void sd_logbench_print(const SD_LogBenchResult *r) {
+    printf("SDLOGBENCH,records,dropped,committed,unmeasured,p50_us,p90_us,p99_us,p999_us,max_us\r\n");
+    printf("SDLOGBENCH,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", (unsigned long)r->records,
+           (unsigned long)r->dropped, (unsigned long)r->committed, (unsigned long)r->unmeasured,
+           (unsigned long)r->p50_us, (unsigned long)r->p90_us, (unsigned long)r->p99_us,
+           (unsigned long)r->p999_us, (unsigned long)r->max_us);
+    printf("SDLOGBENCH,loads,ui_reads=%lu,ui_max_us=%lu,stat_polls=%lu,stat_max_us=%lu,"
+           "led_toggles=%lu,led_late_max_us=%lu,load_errors=%lu,logger_error=%d\r\n",
+           (unsigned long)r->ui_reads, (unsigned long)r->ui_max_us, (unsigned long)r->stat_polls,
+           (unsigned long)r->stat_max_us, (unsigned long)r->led_toggles,
+           (unsigned long)r->led_late_max_us, (unsigned long)r->load_errors, r->logger_error);
+}
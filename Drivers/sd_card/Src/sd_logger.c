@@ -0,0 +1,1832 @@
+/*
+ * sd_logger.c
+ *
+ * Producer ring: each record is a 4-byte length word followed by the payload,
+ * padded to 4 bytes. A producer reserves space by advancing head with a CAS,
+ * copies the payload and then publishes the length word. Free ring space is
+ * kept zeroed, so an unpublished record reads as length 0 and stops the
+ * consumer until it is complete. Only the logger (one consumer, under
+ * s_lock) advances tail. A length word with SD_LOGGER_DESC set carries a
+ * buffer descriptor instead of the payload; the buffer is written in place
+ * and released after the write.
+ *
+ * In raw mode the chunks go to a block region with SD_WriteMultiBlocks. The
+ * chunk buffer then always starts on a block boundary (s_raw_pos); a sync
+ * writes the partial last block zero-padded and keeps its bytes, so the
+ * block is written again as it fills. The header block is rewritten at each
+ * sync as the checkpoint.
+ *
+ * With SD_LOGGER_COMPRESS the drained bytes collect in s_zin and each full
+ * block is compressed (greedy LZ4, one hash probe per position) into s_zout,
+ * which is staged like any other bytes. The hash table is never cleared:
+ * every candidate is checked against the block itself, so stale entries only
+ * cost a miss and blocks stay independent. *
+ * The sidecar index takes an entry (key, s_file_pos + s_fill) as every Nth
+ * record leaves the ring, before its bytes are staged. Entries wait in
+ * s_index_buf and follow each chunk write into the index file, whose FIL
+ * buffer absorbs the small writes until a sector fills or the log syncs.
+ *
+ * A channel ring holds records in the shared ring's format, but with one
+ * producer it needs neither the CAS nor the zeroed free space: the producer
+ * fills the record and then publishes it by advancing head, and the logger
+ * alone advances tail. In a tagged log every record, from any ring or
+ * buffer, leaves the logger behind its tag word.
+ *
+ * Resuming from a checkpoint sets what f_lseek to the end would: fptr, the
+ * last cluster and, mid-sector, the sector in the FIL buffer, which f_write
+ * then completes. The cluster at a checkpoint is the one holding the last
+ * byte, as FatFs keeps it at a cluster boundary.
+ */
+
+#include "sd_logger.h"
+#include "sd_functions.h"
+#include "sd_profile.h"
+#include "sd_freemap.h"
+#if (SD_LOGGER_COMMIT_MS > 0U)
+#include "sd_commit.h"
+#endif
+#include "sd_spi.h"
+#if SD_LOGGER_RESUME
+#include "diskio.h"
+#endif
+#if SD_LOGGER_CARD_UNITS
+#include "sd_diskio_spi.h"
+#endif
+#if SD_LOGGER_CARD_PROFILE
+#include "sd_cardprof.h"
+#endif
+#include <string.h>
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#if (SD_LOGGER_INGRESS_BYTES > 0U)
+#include "message_buffer.h"
+#define SD_LOGGER_INGRESS 1
+#endif
+#endif
+
+#ifndef SD_LOGGER_INGRESS
+#define SD_LOGGER_INGRESS 0
+#endif
+
+#if (SD_LOGGER_RING_BYTES < 2U * (SD_LOGGER_MAX_RECORD + 4U))
+#error "SD_LOGGER_RING_BYTES must hold at least two maximum-size records"
+#endif
+
+#define SD_LOGGER_MASK   (SD_LOGGER_RING_BYTES - 1U)
+#define SD_LOGGER_HDR    4U
+#define SD_LOGGER_PAD(n) (((n) + 3U) & ~3U)
+#define SD_LOGGER_DESC   0x80000000U
+
+#define SD_LOGGER_RAW_MAGIC   0x4C524453UL /* "SDRL" */
+#define SD_LOGGER_RAW_VERSION 1U
+
+typedef struct {
+    uint8_t *buf;
+    sd_logger_release_fn release;
+    void *context;
+} sd_logger_desc;
+
+static uint8_t s_ring[SD_LOGGER_RING_BYTES] __attribute__((aligned(4)));
+static uint32_t s_head; // Next byte to reserve (producers, atomic)
+static uint32_t s_tail; // Next byte to consume (logger only)
+static volatile bool s_running;
+
+/* Owned by the logger under s_lock. */
+static uint8_t s_chunk[SD_LOGGER_CHUNK_BYTES] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint32_t s_fill;  // Bytes staged in s_chunk
+static uint32_t s_limit; // Bytes that take the file to the next chunk boundary
+static uint32_t s_chunk_bytes = SD_LOGGER_CHUNK_BYTES; // Chunk size of this session
+#if SD_LOGGER_CARD_UNITS
+static uint32_t s_unit_bytes; // Recording unit s_chunk_bytes was sized to (0 = none)
+static bool s_unit_aligned;
+#endif
+static FIL s_file;
+static uint32_t s_file_pos;
+static uint32_t s_last_sync;
+static uint32_t s_last_commit;
+static bool s_unsynced;
+static bool s_preallocated;
+
+/* Raw mode (s_raw_sd != NULL): region and the stream offset of s_chunk[0]. */
+static SD_Handle_t *s_raw_sd;
+static uint32_t s_raw_first;  // Header block
+static uint32_t s_raw_blocks; // Data blocks after it
+static uint64_t s_raw_pos;
+static uint32_t s_raw_seq; // Checkpoints written
+static uint8_t s_raw_hdr[SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static SD_LoggerStats s_stats;
+
+#if (SD_LOGGER_CHANNELS > 0U)
+#define SD_LOGGER_CHANNEL_MASK (SD_LOGGER_CHANNEL_BYTES - 1U)
+
+#if (SD_LOGGER_CHANNEL_BYTES < 2U * (SD_LOGGER_MAX_RECORD + 4U))
+#error "SD_LOGGER_CHANNEL_BYTES must hold at least two maximum-size records"
+#endif
+
+typedef struct {
+    uint8_t buf[SD_LOGGER_CHANNEL_BYTES] __attribute__((aligned(4)));
+    uint32_t head; // Written by the channel's producer only
+    uint32_t tail; // Written by the logger only
+    SD_LoggerChannelStats stats;
+} sd_logger_channel;
+
+static sd_logger_channel s_channels[SD_LOGGER_CHANNELS];
+#endif
+
+#if SD_LOGGER_RESUME
+#define SD_LOGGER_CK_MAGIC 0x434C4453UL /* "SDLC" */
+
+static SD_LoggerBackup s_backup;
+static uint32_t s_ck_path; // CRC-32 of the open file's path
+static uint32_t s_ck_seq;
+static bool s_ck_resumed;
+static uint8_t s_ck_sector[SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+#endif
+
+/* Sidecar index (sd_logger_set_index); s_index_open only in file mode. */
+static const char *s_index_path;
+static uint32_t s_index_every;
+static sd_logger_key_fn s_index_key;
+static void *s_index_context;
+static FIL s_index_file;
+static bool s_index_open;
+static uint32_t s_index_seq; // Records since start
+static uint32_t s_index_n;   // Entries waiting in s_index_buf
+static uint8_t s_index_buf[SD_LOGGER_INDEX_ENTRIES * sizeof(SD_LoggerIndexEntry)];
+static uint8_t s_index_rec[SD_LOGGER_MAX_RECORD]; // A record that wraps the ring, for the key
+
+#if SD_LOGGER_COMPRESS
+#define SD_LZ_MINMATCH     4U
+#define SD_LZ_LASTLITERALS 5U  /* LZ4: the block ends with this many literals */
+#define SD_LZ_MFLIMIT      12U /* LZ4: no match starts in the last 12 bytes */
+#define SD_LZ_STORED       0x8000U
+
+static uint8_t s_zin[SD_LOGGER_COMPRESS_BLOCK];
+static uint8_t s_zout[SD_LOGGER_BLOCK_HEADER + SD_LOGGER_COMPRESS_BLOCK];
+static uint16_t s_zhash[1U << SD_LOGGER_COMPRESS_HASH_BITS];
+static uint32_t s_zfill; // Bytes waiting in s_zin
+#endif
+
+#if (SD_LOGGER_ISR_BUFS > 0U)
+#define SD_LOGGER_POOL_ALL ((SD_LOGGER_ISR_BUFS == 32U) ? 0xFFFFFFFFU                   \
+                                                         : ((1U << SD_LOGGER_ISR_BUFS) - 1U))
+static uint8_t s_pool[SD_LOGGER_ISR_BUFS][SD_LOGGER_ISR_BUF_BYTES]
+    __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint32_t s_pool_free = SD_LOGGER_POOL_ALL; // Bit i set: s_pool[i] is free
+#endif
+
+#if defined(USE_FREERTOS)
+static SemaphoreHandle_t s_lock;
+static TaskHandle_t s_task;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_lock_buffer;
+static StaticTask_t s_task_buffer;
+static StackType_t s_task_stack[SD_LOGGER_TASK_STACK];
+#endif
+#if SD_LOGGER_INGRESS
+#if (SD_LOGGER_INGRESS_BYTES < 2U * (SD_LOGGER_MAX_RECORD + 4U))
+#error "SD_LOGGER_INGRESS_BYTES must hold at least two maximum-size records"
+#endif
+/* Wake the task once a chunk is queued, or at half the buffer if that is smaller. */
+#define SD_LOGGER_INGRESS_TRIGGER ((SD_LOGGER_CHUNK_BYTES < SD_LOGGER_INGRESS_BYTES / 2U) \
+                                       ? SD_LOGGER_CHUNK_BYTES                         \
+                                       : SD_LOGGER_INGRESS_BYTES / 2U)
+static MessageBufferHandle_t s_ingress;
+static uint8_t s_ingress_wait[SD_LOGGER_MAX_RECORD]; // Message the task woke up with
+static uint8_t s_ingress_rx[SD_LOGGER_MAX_RECORD];   // Messages drained under s_lock
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticMessageBuffer_t s_ingress_buffer;
+static uint8_t s_ingress_storage[SD_LOGGER_INGRESS_BYTES + 1U];
+#endif
+#endif
+#define SD_LOGGER_LOCK()   (void)xSemaphoreTake(s_lock, portMAX_DELAY)
+#define SD_LOGGER_UNLOCK() (void)xSemaphoreGive(s_lock)
+#else
+#define SD_LOGGER_LOCK()   do { } while (0)
+#define SD_LOGGER_UNLOCK() do { } while (0)
+#endif
+
+static void sd_logger_ring_copy_in(uint32_t pos, const uint8_t *src, uint32_t len) {
+    uint32_t off = pos & SD_LOGGER_MASK;
+    uint32_t first = SD_LOGGER_RING_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&s_ring[off], src, first);
+    memcpy(&s_ring[0], src + first, len - first);
+}
+
+static void sd_logger_ring_clear(uint32_t pos, uint32_t len) {
+    uint32_t off = pos & SD_LOGGER_MASK;
+    uint32_t first = SD_LOGGER_RING_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    memset(&s_ring[off], 0, first);
+    memset(&s_ring[0], 0, len - first);
+}
+
+static void sd_logger_ring_copy_out(uint32_t pos, uint8_t *dst, uint32_t len) {
+    uint32_t off = pos & SD_LOGGER_MASK;
+    uint32_t first = SD_LOGGER_RING_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, &s_ring[off], first);
+    memcpy(dst + first, &s_ring[0], len - first);
+}
+
+/* Reserve need ring bytes for a record of len payload bytes; false (counted) if full. */
+static bool sd_logger_reserve(uint32_t need, uint32_t len, uint32_t *pos) {
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_RELAXED);
+    uint32_t used;
+    do {
+        used = head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE);
+        if (used + need > SD_LOGGER_RING_BYTES) {
+            __atomic_fetch_add(&s_stats.dropped_records, 1U, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s_stats.dropped_bytes, len, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&s_head, &head, head + need, true, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+
+    uint32_t level = used + need;
+    uint32_t high = __atomic_load_n(&s_stats.ring_high_water, __ATOMIC_RELAXED);
+    while (level > high && !__atomic_compare_exchange_n(&s_stats.ring_high_water, &high, level,
+                                                         true, __ATOMIC_RELAXED,
+                                                         __ATOMIC_RELAXED)) {
+    }
+    *pos = head;
+    return true;
+}
+
+/* Publish the record at pos: its length word makes it visible to the consumer. */
+static void sd_logger_publish(uint32_t pos, uint32_t word, uint32_t len) {
+    __atomic_store_n((uint32_t *)(void *)&s_ring[pos & SD_LOGGER_MASK], word, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&s_stats.records, 1U, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_stats.bytes, len, __ATOMIC_RELAXED);
+}
+
+bool sd_logger_write(const void *data, uint32_t len) {
+    if (!s_running || data == NULL || len == 0U || len > SD_LOGGER_MAX_RECORD) {
+        return false;
+    }
+
+    uint32_t pos;
+    if (!sd_logger_reserve(SD_LOGGER_HDR + SD_LOGGER_PAD(len), len, &pos)) {
+        return false;
+    }
+    sd_logger_ring_copy_in(pos + SD_LOGGER_HDR, (const uint8_t *)data, len);
+    sd_logger_publish(pos, len, len);
+    return true;
+}
+
+bool sd_logger_channel_write(uint32_t channel, const void *data, uint32_t len) {
+#if (SD_LOGGER_CHANNELS > 0U)
+    if (!s_running || channel >= SD_LOGGER_CHANNELS || data == NULL || len == 0U ||
+        len > SD_LOGGER_MAX_RECORD) {
+        return false;
+    }
+    sd_logger_channel *c = &s_channels[channel];
+    uint32_t head = c->head;
+    uint32_t need = SD_LOGGER_HDR + SD_LOGGER_PAD(len);
+    uint32_t used = head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+    if (used + need > SD_LOGGER_CHANNEL_BYTES) {
+        c->stats.dropped_records++;
+        return false;
+    }
+
+    uint8_t *dst = c->buf;
+    uint32_t off = (head + SD_LOGGER_HDR) & SD_LOGGER_CHANNEL_MASK;
+    uint32_t first = SD_LOGGER_CHANNEL_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    *(uint32_t *)(void *)&dst[head & SD_LOGGER_CHANNEL_MASK] = len;
+    memcpy(&dst[off], data, first);
+    memcpy(&dst[0], (const uint8_t *)data + first, len - first);
+    __atomic_store_n(&c->head, head + need, __ATOMIC_RELEASE);
+
+    c->stats.records++;
+    c->stats.bytes += len;
+    if (used + need > c->stats.high_water) {
+        c->stats.high_water = used + need;
+    }
+    return true;
+#else
+    (void)channel;
+    (void)data;
+    (void)len;
+    return false;
+#endif
+}
+
+bool sd_logger_send(const void *data, uint32_t len) {
+#if SD_LOGGER_INGRESS
+    if (!s_running || s_ingress == NULL || data == NULL || len == 0U ||
+        len > SD_LOGGER_MAX_RECORD) {
+        return false;
+    }
+    /* FromISR calls in both contexts: they never block inside the critical section. */
+    BaseType_t woken = pdFALSE;
+    size_t sent;
+    if (__get_IPSR() != 0U) {
+        UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+        sent = xMessageBufferSendFromISR(s_ingress, data, len, &woken);
+        taskEXIT_CRITICAL_FROM_ISR(mask);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        taskENTER_CRITICAL();
+        sent = xMessageBufferSendFromISR(s_ingress, data, len, &woken);
+        taskEXIT_CRITICAL();
+        if (woken == pdTRUE) {
+            taskYIELD();
+        }
+    }
+    if (sent == 0U) {
+        __atomic_fetch_add(&s_stats.dropped_records, 1U, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s_stats.dropped_bytes, len, __ATOMIC_RELAXED);
+        return false;
+    }
+    __atomic_fetch_add(&s_stats.records, 1U, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_stats.bytes, len, __ATOMIC_RELAXED);
+    return true;
+#else
+    (void)data;
+    (void)len;
+    return false;
+#endif
+}
+
+bool sd_logger_push_from_isr(void *buf, uint32_t len, sd_logger_release_fn release,
+                             void *context) {
+    if (!s_running || buf == NULL || len == 0U || (len & SD_LOGGER_DESC) != 0U) {
+        return false;
+    }
+#if (SD_LOGGER_CHANNELS > 0U)
+    if (len > 0x00FFFFFFU) {
+        return false; /* does not fit a tag */
+    }
+#endif
+
+    uint32_t pos;
+    if (!sd_logger_reserve(SD_LOGGER_HDR + SD_LOGGER_PAD(sizeof(sd_logger_desc)), len, &pos)) {
+        return false;
+    }
+    sd_logger_desc desc = {(uint8_t *)buf, release, context};
+    sd_logger_ring_copy_in(pos + SD_LOGGER_HDR, (const uint8_t *)&desc, sizeof(desc));
+    sd_logger_publish(pos, SD_LOGGER_DESC | len, len);
+    __atomic_fetch_add(&s_stats.buffers, 1U, __ATOMIC_RELAXED);
+    return true;
+}
+
+void *sd_logger_buf_get(void) {
+#if (SD_LOGGER_ISR_BUFS > 0U)
+    uint32_t free_bits = __atomic_load_n(&s_pool_free, __ATOMIC_RELAXED);
+    uint32_t bit;
+    do {
+        if (free_bits == 0U) {
+            __atomic_fetch_add(&s_stats.pool_empty, 1U, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        bit = free_bits & (~free_bits + 1U); /* lowest free buffer */
+    } while (!__atomic_compare_exchange_n(&s_pool_free, &free_bits, free_bits & ~bit, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    uint32_t out = (uint32_t)__builtin_popcount(SD_LOGGER_POOL_ALL & ~(free_bits & ~bit));
+    uint32_t high = __atomic_load_n(&s_stats.pool_high_water, __ATOMIC_RELAXED);
+    while (out > high && !__atomic_compare_exchange_n(&s_stats.pool_high_water, &high, out, true,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return s_pool[__builtin_ctz(bit)];
+#else
+    __atomic_fetch_add(&s_stats.pool_empty, 1U, __ATOMIC_RELAXED);
+    return NULL;
+#endif
+}
+
+void sd_logger_buf_put(void *buf) {
+#if (SD_LOGGER_ISR_BUFS > 0U)
+    uintptr_t off = (uintptr_t)buf - (uintptr_t)&s_pool[0][0];
+    if (buf == NULL || off >= sizeof(s_pool) || (off % SD_LOGGER_ISR_BUF_BYTES) != 0U) {
+        return; /* not a pool buffer */
+    }
+    __atomic_fetch_or(&s_pool_free, 1U << (off / SD_LOGGER_ISR_BUF_BYTES), __ATOMIC_RELEASE);
+#else
+    (void)buf;
+#endif
+}
+
+static void sd_logger_index_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* Append the waiting entries to the index file. */
+static FRESULT sd_logger_index_out(void) {
+    if (s_index_n == 0U) {
+        return FR_OK;
+    }
+    uint32_t n = s_index_n * (uint32_t)sizeof(SD_LoggerIndexEntry);
+    UINT bw = 0;
+    FRESULT res = f_write(&s_index_file, s_index_buf, n, &bw);
+    if (res == FR_OK && bw != n) {
+        res = FR_DENIED; /* volume full */
+    }
+    s_stats.index_entries += bw / (uint32_t)sizeof(SD_LoggerIndexEntry);
+    s_index_n = 0;
+    if (res != FR_OK) {
+        s_stats.last_error = res;
+    }
+    return res;
+}
+
+/* Take an entry for the record about to be staged if it is every Nth; record may wrap the ring. */
+static void sd_logger_index_add(const uint8_t *first, uint32_t first_len, const uint8_t *rest,
+                                uint32_t len) {
+    if (!s_index_open || (s_index_seq++ % s_index_every) != 0U) {
+        return;
+    }
+    uint32_t key;
+    if (s_index_key == NULL) {
+        key = HAL_GetTick();
+    } else if (first_len == len) {
+        key = s_index_key(first, len, s_index_context);
+    } else {
+        memcpy(s_index_rec, first, first_len);
+        memcpy(&s_index_rec[first_len], rest, len - first_len);
+        key = s_index_key(s_index_rec, len, s_index_context);
+    }
+    if (s_index_n == SD_LOGGER_INDEX_ENTRIES) {
+        (void)sd_logger_index_out(); /* more entries than one chunk holds */
+    }
+    uint8_t *e = &s_index_buf[s_index_n++ * sizeof(SD_LoggerIndexEntry)];
+    sd_logger_index_put32(&e[0], key);
+    sd_logger_index_put32(&e[4], s_file_pos + s_fill);
+}
+
+/*
+ * Bytes from s_raw_pos to the next chunk boundary. With SD_LOGGER_CARD_UNITS
+ * the boundaries are card addresses, so whole chunks fill recording units.
+ */
+static uint32_t sd_logger_raw_limit(void) {
+#if SD_LOGGER_CARD_UNITS
+    uint64_t block = s_raw_first + 1U + (s_raw_pos / SD_BLOCK_SIZE) % s_raw_blocks;
+    return s_chunk_bytes - (uint32_t)((block * SD_BLOCK_SIZE) % s_chunk_bytes);
+#else
+    return s_chunk_bytes - (uint32_t)(s_raw_pos % s_chunk_bytes);
+#endif
+}
+
+/* Write whole blocks at s_raw_pos, split where the region wraps, and advance by advance bytes. */
+static FRESULT sd_logger_raw_out(const uint8_t *src, uint32_t n, uint32_t advance) {
+    FRESULT res = FR_OK;
+    uint32_t blocks = n / SD_BLOCK_SIZE;
+    uint32_t block = (uint32_t)((s_raw_pos / SD_BLOCK_SIZE) % s_raw_blocks);
+    while (blocks > 0U) {
+        uint32_t run = s_raw_blocks - block;
+        if (run > blocks) {
+            run = blocks;
+        }
+        if (SD_WriteMultiBlocks(s_raw_sd, src, s_raw_first + 1U + block, run) != SD_OK) {
+            res = FR_DISK_ERR;
+            break;
+        }
+        src += run * SD_BLOCK_SIZE;
+        blocks -= run;
+        block = 0;
+    }
+    s_stats.chunks++;
+    if (res == FR_OK) {
+        s_stats.file_bytes += advance;
+        s_raw_pos += advance;
+    } else {
+        s_stats.last_error = res;
+    }
+    s_limit = sd_logger_raw_limit();
+    s_unsynced = true;
+    return res;
+}
+
+/* Write n bytes at the file position; a partial chunk shortens the next one to restore alignment. */
+static FRESULT sd_logger_write_out(const uint8_t *src, uint32_t n) {
+    if (s_raw_sd != NULL) {
+        return sd_logger_raw_out(src, n, n); /* whole blocks outside a sync */
+    }
+    UINT bw = 0;
+    FRESULT res = SD_PROF_CALL(SD_PROF_WRITE, f_write(&s_file, src, n, &bw));
+    if (res == FR_OK && bw != n) {
+        res = FR_DENIED; /* volume full */
+    }
+    s_stats.chunks++;
+    s_stats.file_bytes += bw;
+    s_file_pos += bw;
+    s_limit = s_chunk_bytes - (s_file_pos % s_chunk_bytes);
+    s_unsynced = true;
+    if (res != FR_OK) {
+        s_stats.last_error = res;
+    } else if (s_index_open) {
+        (void)sd_logger_index_out(); /* failures show in last_error and at the next sync */
+    }
+    return res;
+}
+
+/* Write the staged bytes. */
+static FRESULT sd_logger_write_chunk(void) {
+    if (s_fill == 0U) {
+        return FR_OK;
+    }
+    uint32_t n = s_fill;
+    s_fill = 0;
+    if (s_raw_sd == NULL) {
+        return sd_logger_write_out(s_chunk, n);
+    }
+    /* Pad the last block; its bytes stay staged and are written again as it fills. */
+    uint32_t keep = n % SD_BLOCK_SIZE;
+    uint32_t padded = n + ((keep > 0U) ? SD_BLOCK_SIZE - keep : 0U);
+    memset(&s_chunk[n], 0, padded - n);
+    FRESULT res = sd_logger_raw_out(s_chunk, padded, n - keep);
+    if (res != FR_OK) {
+        keep = 0; /* the next chunk starts again at s_raw_pos */
+    } else if (keep > 0U) {
+        memmove(s_chunk, &s_chunk[n - keep], keep);
+    }
+    s_fill = keep;
+    return res;
+}
+
+static FRESULT sd_logger_stage(const uint8_t *src, uint32_t len) {
+    FRESULT res = FR_OK;
+    while (len > 0U) {
+        uint32_t n = s_limit - s_fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&s_chunk[s_fill], src, n);
+        s_fill += n;
+        src += n;
+        len -= n;
+        if (s_fill == s_limit) {
+            FRESULT r = sd_logger_write_chunk();
+            if (r != FR_OK) {
+                res = r;
+            }
+        }
+    }
+    return res;
+}
+
+/*
+ * Stage a producer buffer. Whenever the chunk buffer is empty, the run that
+ * reaches a chunk boundary (plus any whole chunks after it) is written
+ * straight from the buffer; only the head and tail pieces are copied.
+ */
+static FRESULT sd_logger_stage_buffer(const uint8_t *src, uint32_t len) {
+    FRESULT res = FR_OK;
+    while (len > 0U) {
+        uint32_t n;
+        FRESULT r;
+        if (s_fill == 0U && len >= s_limit) {
+            n = s_limit + ((len - s_limit) / s_chunk_bytes) * s_chunk_bytes;
+            r = sd_logger_write_out(src, n);
+            s_stats.direct_bytes += n;
+        } else {
+            n = s_limit - s_fill;
+            if (n > len) {
+                n = len;
+            }
+            r = sd_logger_stage(src, n);
+        }
+        if (r != FR_OK) {
+            res = r;
+        }
+        src += n;
+        len -= n;
+    }
+    return res;
+}
+
+#if SD_LOGGER_COMPRESS
+static uint32_t sd_lz_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* LZ4 length continuation: 255s, then the rest. */
+static uint32_t sd_lz_put_len(uint8_t *dst, uint32_t len) {
+    uint32_t n = 0;
+    while (len >= 255U) {
+        dst[n++] = 255U;
+        len -= 255U;
+    }
+    dst[n++] = (uint8_t)len;
+    return n;
+}
+
+/* One literal run and, with match_len, the match after it; false if it does not fit in cap. */
+static bool sd_lz_sequence(uint8_t *dst, uint32_t *op, uint32_t cap, const uint8_t *lit,
+                           uint32_t lit_len, uint32_t offset, uint32_t match_len) {
+    uint32_t need = 2U + lit_len + lit_len / 255U;
+    if (match_len > 0U) {
+        need += 3U + match_len / 255U;
+    }
+    if (*op + need > cap) {
+        return false;
+    }
+    uint32_t o = *op;
+    uint32_t token = o++;
+    uint32_t ml = (match_len > 0U) ? match_len - SD_LZ_MINMATCH : 0U;
+    dst[token] = (uint8_t)(((lit_len < 15U) ? lit_len : 15U) << 4);
+    if (lit_len >= 15U) {
+        o += sd_lz_put_len(&dst[o], lit_len - 15U);
+    }
+    memcpy(&dst[o], lit, lit_len);
+    o += lit_len;
+    if (match_len > 0U) {
+        dst[o++] = (uint8_t)offset;
+        dst[o++] = (uint8_t)(offset >> 8);
+        dst[token] |= (uint8_t)((ml < 15U) ? ml : 15U);
+        if (ml >= 15U) {
+            o += sd_lz_put_len(&dst[o], ml - 15U);
+        }
+    }
+    *op = o;
+    return true;
+}
+
+/* LZ4 block of src into dst; 0 if it would not be smaller than cap bytes. */
+static uint32_t sd_lz_compress(const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap) {
+    uint32_t ip = 0, anchor = 0, op = 0;
+    if (n > SD_LZ_MFLIMIT) {
+        uint32_t limit = n - SD_LZ_MFLIMIT;
+        while (ip < limit) {
+            uint32_t seq = sd_lz_read32(&src[ip]);
+            uint32_t h = (uint32_t)(seq * 2654435761U) >> (32U - SD_LOGGER_COMPRESS_HASH_BITS);
+            uint32_t ref = s_zhash[h];
+            s_zhash[h] = (uint16_t)ip;
+            if (ref >= ip || sd_lz_read32(&src[ref]) != seq) {
+                ip++;
+                continue;
+            }
+            uint32_t len = SD_LZ_MINMATCH;
+            while (ip + len < n - SD_LZ_LASTLITERALS && src[ref + len] == src[ip + len]) {
+                len++;
+            }
+            if (!sd_lz_sequence(dst, &op, cap, &src[anchor], ip - anchor, ip - ref, len)) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+    }
+    if (!sd_lz_sequence(dst, &op, cap, &src[anchor], n - anchor, 0U, 0U) || op >= cap) {
+        return 0;
+    }
+    return op;
+}
+
+/* Compress and stage the bytes in s_zin as one block. */
+static FRESULT sd_logger_zblock(void) {
+    if (s_zfill == 0U) {
+        return FR_OK;
+    }
+    uint32_t start = SD_PROF_START();
+    uint32_t n = sd_lz_compress(s_zin, s_zfill, &s_zout[SD_LOGGER_BLOCK_HEADER], s_zfill);
+    uint32_t word = n;
+    if (n == 0U) {
+        memcpy(&s_zout[SD_LOGGER_BLOCK_HEADER], s_zin, s_zfill);
+        n = s_zfill;
+        word = n | SD_LZ_STORED;
+        s_stats.compress_stored++;
+    }
+    s_zout[0] = (uint8_t)word;
+    s_zout[1] = (uint8_t)(word >> 8);
+    s_zout[2] = (uint8_t)s_zfill;
+    s_zout[3] = (uint8_t)(s_zfill >> 8);
+    s_stats.compress_cycles += (uint32_t)(SD_PROF_START() - start);
+    s_stats.compress_blocks++;
+    s_stats.compress_in += s_zfill;
+    s_stats.compress_out += SD_LOGGER_BLOCK_HEADER + n;
+    s_zfill = 0;
+    return sd_logger_stage(s_zout, SD_LOGGER_BLOCK_HEADER + n);
+}
+#endif
+
+/* Pass drained bytes on: to the compressor, or straight to the chunk buffer. */
+static FRESULT sd_logger_put(const uint8_t *src, uint32_t len, bool in_place) {
+#if SD_LOGGER_COMPRESS
+    (void)in_place;
+    FRESULT res = FR_OK;
+    while (len > 0U) {
+        uint32_t n = SD_LOGGER_COMPRESS_BLOCK - s_zfill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&s_zin[s_zfill], src, n);
+        s_zfill += n;
+        src += n;
+        len -= n;
+        if (s_zfill == SD_LOGGER_COMPRESS_BLOCK) {
+            FRESULT r = sd_logger_zblock();
+            if (r != FR_OK) {
+                res = r;
+            }
+        }
+    }
+    return res;
+#else
+    return in_place ? sd_logger_stage_buffer(src, len) : sd_logger_stage(src, len);
+#endif
+}
+
+/* Emit a partial compression block before a sync or stop. */
+static FRESULT sd_logger_put_flush(void) {
+#if SD_LOGGER_COMPRESS
+    return sd_logger_zblock();
+#else
+    return FR_OK;
+#endif
+}
+
+static bool sd_logger_pending(void) {
+#if SD_LOGGER_COMPRESS
+    if (s_zfill > 0U) {
+        return true;
+    }
+#endif
+    return s_fill > 0U || s_unsynced;
+}
+
+/* Put the tag of a record in a tagged log (SD_LOGGER_CHANNELS builds). */
+static FRESULT sd_logger_put_tag(uint32_t channel, uint32_t len) {
+#if (SD_LOGGER_CHANNELS > 0U)
+    uint8_t tag[4];
+    sd_logger_index_put32(tag, (channel << 24) | len);
+    return sd_logger_put(tag, sizeof(tag), false);
+#else
+    (void)channel;
+    (void)len;
+    return FR_OK;
+#endif
+}
+
+#if (SD_LOGGER_CHANNELS > 0U)
+/* Move every published record from each channel into the chunk buffer. */
+static FRESULT sd_logger_drain_channels(void) {
+    FRESULT res = FR_OK;
+    for (uint32_t ch = 0; ch < SD_LOGGER_CHANNELS; ch++) {
+        sd_logger_channel *c = &s_channels[ch];
+        uint32_t tail = c->tail;
+        uint32_t head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            uint32_t len = *(const uint32_t *)(const void *)&c->buf[tail & SD_LOGGER_CHANNEL_MASK];
+            uint32_t off = (tail + SD_LOGGER_HDR) & SD_LOGGER_CHANNEL_MASK;
+            uint32_t first = SD_LOGGER_CHANNEL_BYTES - off;
+            if (first > len) {
+                first = len;
+            }
+            sd_logger_index_add(&c->buf[off], first, &c->buf[0], len);
+            FRESULT r = sd_logger_put_tag(ch, len);
+            if (r == FR_OK) {
+                r = sd_logger_put(&c->buf[off], first, false);
+            }
+            if (r == FR_OK && len > first) {
+                r = sd_logger_put(&c->buf[0], len - first, false);
+            }
+            if (r != FR_OK) {
+                res = r;
+            }
+            tail += SD_LOGGER_HDR + SD_LOGGER_PAD(len);
+            __atomic_store_n(&c->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    return res;
+}
+#endif
+
+#if SD_LOGGER_INGRESS
+/* Stage one record that arrived whole (ingress message): index entry, tag, bytes. */
+static FRESULT sd_logger_take(const uint8_t *src, uint32_t len) {
+    sd_logger_index_add(src, len, NULL, len);
+    FRESULT res = sd_logger_put_tag(SD_LOGGER_SHARED_CHANNEL, len);
+    if (res == FR_OK) {
+        res = sd_logger_put(src, len, false);
+    }
+    return res;
+}
+
+/* Move every waiting ingress message into the chunk buffer (single reader: s_lock). */
+static FRESULT sd_logger_drain_ingress(void) {
+    FRESULT res = FR_OK;
+    if (s_ingress == NULL) {
+        return FR_OK;
+    }
+    for (;;) {
+        size_t n = xMessageBufferReceive(s_ingress, s_ingress_rx, sizeof(s_ingress_rx), 0);
+        if (n == 0U) {
+            break;
+        }
+        FRESULT r = sd_logger_take(s_ingress_rx, (uint32_t)n);
+        if (r != FR_OK) {
+            res = r;
+        }
+    }
+    return res;
+}
+#endif
+
+/* Move every published record from the ring (then the channels) into the chunk buffer. */
+static FRESULT sd_logger_drain(void) {
+    FRESULT res = FR_OK;
+    uint32_t tail = s_tail;
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        uint32_t len = __atomic_load_n((uint32_t *)(void *)&s_ring[tail & SD_LOGGER_MASK],
+                                       __ATOMIC_ACQUIRE);
+        if (len == 0U) {
+            break; /* reserved but not yet published */
+        }
+        if ((len & SD_LOGGER_DESC) != 0U) {
+            uint32_t need = SD_LOGGER_HDR + SD_LOGGER_PAD(sizeof(sd_logger_desc));
+            sd_logger_desc desc;
+            sd_logger_ring_copy_out(tail + SD_LOGGER_HDR, (uint8_t *)&desc, sizeof(desc));
+            sd_logger_index_add(desc.buf, len & ~SD_LOGGER_DESC, NULL, len & ~SD_LOGGER_DESC);
+            FRESULT r = sd_logger_put_tag(SD_LOGGER_SHARED_CHANNEL, len & ~SD_LOGGER_DESC);
+            if (r == FR_OK) {
+                r = sd_logger_put(desc.buf, len & ~SD_LOGGER_DESC, true);
+            }
+            if (r != FR_OK) {
+                res = r;
+            }
+            if (desc.release) {
+                desc.release(desc.buf, desc.context);
+            } else {
+                sd_logger_buf_put(desc.buf);
+            }
+            sd_logger_ring_clear(tail, need);
+            tail += need;
+            __atomic_store_n(&s_tail, tail, __ATOMIC_RELEASE);
+            continue;
+        }
+        uint32_t need = SD_LOGGER_HDR + SD_LOGGER_PAD(len);
+        uint32_t off = (tail + SD_LOGGER_HDR) & SD_LOGGER_MASK;
+        uint32_t first = SD_LOGGER_RING_BYTES - off;
+        if (first > len) {
+            first = len;
+        }
+        sd_logger_index_add(&s_ring[off], first, &s_ring[0], len);
+        FRESULT r = sd_logger_put_tag(SD_LOGGER_SHARED_CHANNEL, len);
+        if (r == FR_OK) {
+            r = sd_logger_put(&s_ring[off], first, false);
+        }
+        if (r == FR_OK && len > first) {
+            r = sd_logger_put(&s_ring[0], len - first, false);
+        }
+        if (r != FR_OK) {
+            res = r;
+        }
+
+        sd_logger_ring_clear(tail, need);
+        tail += need;
+        __atomic_store_n(&s_tail, tail, __ATOMIC_RELEASE);
+    }
+#if SD_LOGGER_INGRESS
+    FRESULT ri = sd_logger_drain_ingress();
+    if (res == FR_OK) {
+        res = ri;
+    }
+#endif
+#if (SD_LOGGER_CHANNELS > 0U)
+    FRESULT r = sd_logger_drain_channels();
+    if (res == FR_OK) {
+        res = r;
+    }
+#endif
+    return res;
+}
+
+static uint32_t sd_logger_raw_crc(const uint8_t *p, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFFUL;
+    while (len-- > 0U) {
+        crc ^= *p++;
+        for (uint32_t bit = 0; bit < 8U; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0U - (crc & 1U)));
+        }
+    }
+    return ~crc;
+}
+
+static void sd_logger_raw_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t sd_logger_raw_get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+/* Header block: see sd_logger.h. */
+static FRESULT sd_logger_raw_checkpoint(void) {
+    uint64_t total = s_raw_pos + s_fill;
+    memset(s_raw_hdr, 0, sizeof(s_raw_hdr));
+    sd_logger_raw_put32(&s_raw_hdr[0], SD_LOGGER_RAW_MAGIC);
+    sd_logger_raw_put32(&s_raw_hdr[4], SD_LOGGER_RAW_VERSION);
+    sd_logger_raw_put32(&s_raw_hdr[8], s_raw_first);
+    sd_logger_raw_put32(&s_raw_hdr[12], s_raw_blocks + 1U);
+    sd_logger_raw_put32(&s_raw_hdr[16], (uint32_t)total);
+    sd_logger_raw_put32(&s_raw_hdr[20], (uint32_t)(total >> 32));
+    sd_logger_raw_put32(&s_raw_hdr[24], ++s_raw_seq);
+    sd_logger_raw_put32(&s_raw_hdr[28], sd_logger_raw_crc(s_raw_hdr, 28U));
+    if (SD_WriteBlocks(s_raw_sd, s_raw_hdr, s_raw_first, 1U) != SD_OK ||
+        SD_Sync(s_raw_sd) != SD_OK) {
+        return FR_DISK_ERR;
+    }
+    return FR_OK;
+}
+
+/* Read and check the header of a region; false if it holds none for these bounds. */
+static bool sd_logger_raw_header(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks,
+                                 uint8_t *hdr, uint64_t *total, uint32_t *seq) {
+    if (SD_ReadBlocks(sd, hdr, first_block, 1U) != SD_OK ||
+        sd_logger_raw_get32(&hdr[0]) != SD_LOGGER_RAW_MAGIC ||
+        sd_logger_raw_get32(&hdr[4]) != SD_LOGGER_RAW_VERSION ||
+        sd_logger_raw_get32(&hdr[8]) != first_block || sd_logger_raw_get32(&hdr[12]) != blocks ||
+        sd_logger_raw_get32(&hdr[28]) != sd_logger_raw_crc(hdr, 28U)) {
+        return false;
+    }
+    *total = (uint64_t)sd_logger_raw_get32(&hdr[16]) |
+             ((uint64_t)sd_logger_raw_get32(&hdr[20]) << 32);
+    *seq = sd_logger_raw_get32(&hdr[24]);
+    return true;
+}
+
+#if SD_LOGGER_RESUME
+/* Read the checkpoint; false if there is no store or its words do not check out. */
+static bool sd_logger_ck_load(uint32_t *w) {
+    uint8_t bytes[4U * (SD_LOGGER_BACKUP_WORDS - 1U)];
+    if (s_backup.read == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < SD_LOGGER_BACKUP_WORDS; i++) {
+        w[i] = s_backup.read(i, s_backup.context);
+    }
+    for (uint32_t i = 0; i + 1U < SD_LOGGER_BACKUP_WORDS; i++) {
+        sd_logger_raw_put32(&bytes[4U * i], w[i]);
+    }
+    return w[0] == SD_LOGGER_CK_MAGIC &&
+           w[SD_LOGGER_BACKUP_WORDS - 1U] == sd_logger_raw_crc(bytes, sizeof(bytes));
+}
+
+/* Checkpoint the open file after a full sync (the directory entry holds its size). */
+static void sd_logger_ck_store(void) {
+    uint32_t w[SD_LOGGER_BACKUP_WORDS];
+    uint8_t bytes[4U * (SD_LOGGER_BACKUP_WORDS - 1U)];
+    if (s_backup.write == NULL || s_preallocated || s_file.fptr == 0U ||
+        s_file.fptr != f_size(&s_file)) {
+        return;
+    }
+    w[0] = SD_LOGGER_CK_MAGIC;
+    w[1] = s_ck_path;
+    w[2] = s_file.obj.sclust;
+    w[3] = s_file.clust;
+    w[4] = (uint32_t)s_file.fptr;
+    w[5] = ++s_ck_seq;
+    for (uint32_t i = 0; i + 1U < SD_LOGGER_BACKUP_WORDS; i++) {
+        sd_logger_raw_put32(&bytes[4U * i], w[i]);
+    }
+    w[6] = sd_logger_raw_crc(bytes, sizeof(bytes));
+    for (uint32_t i = 0; i < SD_LOGGER_BACKUP_WORDS; i++) {
+        s_backup.write(i, w[i], s_backup.context);
+    }
+    s_stats.checkpoint_seq = s_ck_seq;
+}
+
+/* Tail check: the FAT entry of clst is an end-of-chain mark (FAT16/FAT32 only). */
+static bool sd_logger_ck_chain_end(FATFS *fs, DWORD clst) {
+    DWORD sect;
+    UINT off;
+    if (clst < 2U || clst >= fs->n_fatent) {
+        return false;
+    }
+    if (fs->fs_type == FS_FAT16) {
+        sect = fs->fatbase + clst / (SD_BLOCK_SIZE / 2U);
+        off = (UINT)((clst * 2U) % SD_BLOCK_SIZE);
+    } else if (fs->fs_type == FS_FAT32) {
+        sect = fs->fatbase + clst / (SD_BLOCK_SIZE / 4U);
+        off = (UINT)((clst * 4U) % SD_BLOCK_SIZE);
+    } else {
+        return false;
+    }
+    const uint8_t *p = fs->win; /* newer than the card if it holds the sector */
+    if (fs->winsect != sect) {
+        if (disk_read(fs->drv, s_ck_sector, sect, 1U) != RES_OK) {
+            return false;
+        }
+        p = s_ck_sector;
+    }
+    if (fs->fs_type == FS_FAT16) {
+        return ((uint32_t)p[off] | ((uint32_t)p[off + 1U] << 8)) >= 0xFFF8U;
+    }
+    return (sd_logger_raw_get32(&p[off]) & 0x0FFFFFFFUL) >= 0x0FFFFFF8UL;
+}
+
+/* Position the just-opened file at its end from the checkpoint; false leaves it untouched. */
+static bool sd_logger_ck_resume(void) {
+    uint32_t w[SD_LOGGER_BACKUP_WORDS];
+    FATFS *fs = s_file.obj.fs;
+    if (!sd_logger_ck_load(w) || w[1] != s_ck_path || w[2] != s_file.obj.sclust ||
+        w[4] == 0U || w[4] != f_size(&s_file) || !sd_logger_ck_chain_end(fs, w[3])) {
+        return false;
+    }
+    DWORD sect = 0;
+    if (w[4] % SD_BLOCK_SIZE != 0U) {
+        sect = fs->database + (w[3] - 2U) * fs->csize +
+               ((w[4] / SD_BLOCK_SIZE) & (fs->csize - 1U));
+#if !_FS_TINY
+        if (disk_read(fs->drv, s_file.buf, sect, 1U) != RES_OK) {
+            return false;
+        }
+#endif
+    }
+    s_file.fptr = w[4];
+    s_file.clust = w[3];
+    s_file.sect = sect;
+    s_ck_seq = w[5];
+    return true;
+}
+#endif
+
+void sd_logger_set_backup(const SD_LoggerBackup *backup) {
+#if SD_LOGGER_RESUME
+    SD_LOGGER_LOCK();
+    if (backup != NULL) {
+        s_backup = *backup;
+    } else {
+        memset(&s_backup, 0, sizeof(s_backup));
+    }
+    SD_LOGGER_UNLOCK();
+#else
+    (void)backup;
+#endif
+}
+
+#if defined(HAL_RTC_MODULE_ENABLED)
+static uint32_t s_bkp_first;
+
+static uint32_t sd_logger_rtc_read(uint32_t index, void *context) {
+    return HAL_RTCEx_BKUPRead((RTC_HandleTypeDef *)context, s_bkp_first + index);
+}
+
+static void sd_logger_rtc_write(uint32_t index, uint32_t value, void *context) {
+    HAL_RTCEx_BKUPWrite((RTC_HandleTypeDef *)context, s_bkp_first + index, value);
+}
+
+void sd_logger_use_rtc_backup(RTC_HandleTypeDef *hrtc, uint32_t first_reg) {
+    SD_LoggerBackup backup = {sd_logger_rtc_read, sd_logger_rtc_write, hrtc};
+    s_bkp_first = first_reg;
+    sd_logger_set_backup((hrtc != NULL) ? &backup : NULL);
+}
+#endif
+
+/* commit: also write the directory entry, even inside SD_LOGGER_COMMIT_MS. */
+static FRESULT sd_logger_sync(bool commit) {
+    (void)commit; /* only read with SD_LOGGER_COMMIT_MS */
+    FRESULT res = sd_logger_put_flush();
+    FRESULT w = sd_logger_write_chunk();
+    if (res == FR_OK) {
+        res = w;
+    }
+    FRESULT r;
+    if (s_raw_sd != NULL) {
+        r = sd_logger_raw_checkpoint();
+#if (SD_LOGGER_COMMIT_MS > 0U)
+    } else if (!commit && (HAL_GetTick() - s_last_commit) < SD_LOGGER_COMMIT_MS) {
+        /* A preallocated chain is already on the card: the FAT has nothing to add. */
+        r = s_preallocated ? SD_PROF_CALL(SD_PROF_SYNC, sd_flush_data_only(&s_file))
+                           : SD_PROF_CALL(SD_PROF_SYNC, sd_sync_data(&s_file));
+        s_stats.data_syncs++;
+#endif
+    } else {
+        r = SD_PROF_CALL(SD_PROF_SYNC, f_sync(&s_file));
+        s_last_commit = HAL_GetTick();
+#if SD_LOGGER_RESUME
+        if (r == FR_OK) {
+            sd_logger_ck_store();
+        }
+#endif
+    }
+    if (r == FR_OK && s_index_open) {
+        /* After the log, so a synced entry never points past synced data. */
+        r = sd_logger_index_out();
+        if (r == FR_OK) {
+            r = SD_PROF_CALL(SD_PROF_SYNC, f_sync(&s_index_file));
+        }
+    }
+    s_stats.syncs++;
+    s_last_sync = HAL_GetTick();
+    s_unsynced = false;
+    if (r != FR_OK) {
+        s_stats.last_error = r;
+        res = r;
+    }
+    return res;
+}
+
+static int sd_logger_poll_locked(void) {
+    if (!s_running) {
+        return FR_OK;
+    }
+    FRESULT res = sd_logger_drain();
+    if ((SD_LOGGER_SYNC_MS > 0U) && sd_logger_pending() &&
+        (HAL_GetTick() - s_last_sync) >= SD_LOGGER_SYNC_MS) {
+        FRESULT r = sd_logger_sync(false);
+        if (res == FR_OK) {
+            res = r;
+        }
+    }
+    return res;
+}
+
+int sd_logger_poll(void) {
+    SD_LOGGER_LOCK();
+    int res = sd_logger_poll_locked();
+    SD_LOGGER_UNLOCK();
+    return res;
+}
+
+int sd_logger_flush(void) {
+    SD_LOGGER_LOCK();
+    FRESULT res = FR_OK;
+    if (s_running) {
+        res = sd_logger_drain();
+        FRESULT r = sd_logger_sync(true);
+        if (res == FR_OK) {
+            res = r;
+        }
+    }
+    SD_LOGGER_UNLOCK();
+    return res;
+}
+
+#if defined(USE_FREERTOS)
+static void sd_logger_task(void *argument) {
+    (void)argument;
+    for (;;) {
+#if SD_LOGGER_INGRESS
+        /* Sleeps until the trigger level (about one chunk) is queued, then writes it. */
+        size_t n = xMessageBufferReceive(s_ingress, s_ingress_wait, sizeof(s_ingress_wait),
+                                         pdMS_TO_TICKS(SD_LOGGER_INGRESS_WAIT_MS));
+        SD_LOGGER_LOCK();
+        if (n > 0U && s_running) {
+            (void)sd_logger_take(s_ingress_wait, (uint32_t)n);
+        }
+        (void)sd_logger_poll_locked();
+        SD_LOGGER_UNLOCK();
+#else
+        vTaskDelay(pdMS_TO_TICKS(SD_LOGGER_POLL_MS));
+        (void)sd_logger_poll();
+#endif
+    }
+}
+
+static bool sd_logger_create_task(void) {
+    if (s_task != NULL) {
+        return true;
+    }
+#if SD_LOGGER_INGRESS
+    if (s_ingress == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        s_ingress = xMessageBufferCreateStatic(sizeof(s_ingress_storage) - 1U,
+                                               s_ingress_storage, &s_ingress_buffer);
+#else
+        s_ingress = xMessageBufferCreate(SD_LOGGER_INGRESS_BYTES);
+#endif
+        if (s_ingress == NULL) {
+            return false;
+        }
+        (void)xStreamBufferSetTriggerLevel(s_ingress, SD_LOGGER_INGRESS_TRIGGER);
+    }
+#endif
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
+    if (s_lock == NULL) {
+        return false;
+    }
+    s_task = xTaskCreateStatic(sd_logger_task, "sd_log", SD_LOGGER_TASK_STACK, NULL,
+                               SD_LOGGER_TASK_PRIORITY, s_task_stack, &s_task_buffer);
+#else
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return false;
+    }
+    if (xTaskCreate(sd_logger_task, "sd_log", SD_LOGGER_TASK_STACK, NULL,
+                    SD_LOGGER_TASK_PRIORITY, &s_task) != pdPASS) {
+        s_task = NULL;
+    }
+#endif
+    return s_task != NULL;
+}
+#endif
+
+#if SD_LOGGER_CARD_UNITS
+/* Recording unit in bytes: the applied profile's, else the speed class's (0 = neither). */
+static uint32_t sd_logger_card_unit(SD_Handle_t *sd) {
+#if SD_LOGGER_CARD_PROFILE
+    const SD_CardProfile *prof = sd_cardprof_active(sd);
+    if (prof != NULL) {
+        return prof->write_blocks * SD_BLOCK_SIZE; /* measured beats the class table */
+    }
+#endif
+    SD_CardInfo info;
+    if (sd == NULL || SD_GetCardInfo(sd, &info) != SD_OK || !info.status_valid) {
+        return 0;
+    }
+    if (info.speed_class == 10U || info.uhs_grade > 0U || info.video_class > 0U) {
+        return 512U * 1024U;
+    }
+    return (info.speed_class > 0U) ? 16U * 1024U : 0U;
+}
+
+/* Chunk = largest power of two within SD_LOGGER_CHUNK_BYTES, the unit and max_bytes. */
+static void sd_logger_size_chunks(SD_Handle_t *sd, uint32_t max_bytes) {
+    s_unit_bytes = sd_logger_card_unit(sd);
+    s_chunk_bytes = SD_LOGGER_CHUNK_BYTES;
+    if (s_unit_bytes == 0U) {
+        return;
+    }
+    uint32_t cap = (s_unit_bytes < SD_LOGGER_CHUNK_BYTES) ? s_unit_bytes : SD_LOGGER_CHUNK_BYTES;
+    if (max_bytes < cap) {
+        cap = max_bytes;
+    }
+    s_chunk_bytes = SD_BLOCK_SIZE;
+    while (s_chunk_bytes * 2U <= cap) {
+        s_chunk_bytes *= 2U;
+    }
+}
+#endif
+
+static FRESULT sd_logger_open(const char *path) {
+    FRESULT res;
+    s_preallocated = false;
+
+    if (SD_LOGGER_PREALLOC_BYTES > 0U) {
+        /* Falls back to a plain append when no contiguous area is free. */
+        if (sd_preallocate_file(path, SD_LOGGER_PREALLOC_BYTES) == FR_OK) {
+            res = SD_PROF_CALL(SD_PROF_OPEN, f_open(&s_file, path, FA_OPEN_EXISTING | FA_WRITE));
+            if (res == FR_OK) {
+                s_preallocated = true;
+                s_file_pos = 0;
+            }
+#if SD_LOGGER_RESUME
+            s_ck_resumed = false;
+#endif
+            return res;
+        }
+    }
+
+    res = SD_PROF_CALL(SD_PROF_OPEN, f_open(&s_file, path, FA_OPEN_ALWAYS | FA_WRITE));
+    if (res != FR_OK) {
+        return res;
+    }
+    sd_dirindex_add(path);
+#if SD_LOGGER_RESUME
+    s_ck_path = sd_logger_raw_crc((const uint8_t *)path, (uint32_t)strlen(path));
+    s_ck_seq = 0;
+    s_ck_resumed = sd_logger_ck_resume();
+    res = s_ck_resumed ? FR_OK : SD_PROF_CALL(SD_PROF_LSEEK, f_lseek(&s_file, f_size(&s_file)));
+#else
+    res = SD_PROF_CALL(SD_PROF_LSEEK, f_lseek(&s_file, f_size(&s_file)));
+#endif
+    if (res != FR_OK) {
+        (void)SD_PROF_CALL(SD_PROF_CLOSE, f_close(&s_file));
+        return res;
+    }
+#if SD_LOGGER_CARD_UNITS
+    FATFS *fs = s_file.obj.fs;
+    sd_logger_size_chunks(SD_DiskHandle(fs->drv), (uint32_t)fs->csize * SD_BLOCK_SIZE);
+    /* Clusters, and so chunks, start on unit-aligned addresses if the data area does. */
+    s_unit_aligned = ((uint64_t)fs->database * SD_BLOCK_SIZE) % s_chunk_bytes == 0U;
+#endif
+#if (SD_FREEMAP_GROUPS > 0U)
+    (void)SD_FreeMapHint(s_chunk_bytes); /* new clusters come from a free group */
+#endif
+    s_file_pos = (uint32_t)f_size(&s_file);
+    return FR_OK;
+}
+
+/* Clear the ring and the counters for a new session (under s_lock). */
+static void sd_logger_begin(void) {
+    memset(s_ring, 0, sizeof(s_ring));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.chunk_bytes = s_chunk_bytes;
+#if SD_LOGGER_CARD_UNITS
+    s_stats.unit_bytes = s_unit_bytes;
+    s_stats.unit_aligned = s_unit_aligned ? 1U : 0U;
+#endif
+    s_tail = 0;
+    __atomic_store_n(&s_head, 0U, __ATOMIC_RELEASE);
+    s_last_sync = HAL_GetTick();
+    s_last_commit = s_last_sync;
+    s_unsynced = false;
+#if SD_LOGGER_COMPRESS
+    s_zfill = 0;
+#endif
+#if (SD_LOGGER_CHANNELS > 0U)
+    memset(s_channels, 0, sizeof(s_channels));
+#endif
+    s_running = true;
+}
+
+/* Put header at the start of a new (or preallocated) file; an existing file keeps its own. */
+static FRESULT sd_logger_put_header(const void *header, uint32_t len) {
+    if (len == 0U || s_file_pos != 0U) {
+        return FR_OK;
+    }
+    UINT bw = 0;
+    FRESULT res = SD_PROF_CALL(SD_PROF_WRITE, f_write(&s_file, header, len, &bw));
+    if (res == FR_OK && bw != len) {
+        res = FR_DENIED; /* volume full */
+    }
+    if (res != FR_OK) {
+        (void)SD_PROF_CALL(SD_PROF_CLOSE, f_close(&s_file));
+        return res;
+    }
+    s_file_pos = len;
+    return FR_OK;
+}
+
+/* Open the index for a log that is new (fresh) or appended to; closes the log on failure. */
+static FRESULT sd_logger_index_open(bool fresh) {
+    s_index_open = false;
+    s_index_seq = 0;
+    s_index_n = 0;
+    if (s_index_path == NULL) {
+        return FR_OK;
+    }
+    FRESULT res = SD_PROF_CALL(SD_PROF_OPEN,
+                               f_open(&s_index_file, s_index_path,
+                                      FA_WRITE | (fresh ? FA_CREATE_ALWAYS : FA_OPEN_ALWAYS)));
+    if (res == FR_OK) {
+        sd_dirindex_add(s_index_path);
+        /* Drop a torn last entry; the next one overwrites it. */
+        FSIZE_t end = f_size(&s_index_file);
+        res = SD_PROF_CALL(SD_PROF_LSEEK,
+                           f_lseek(&s_index_file, end - end % sizeof(SD_LoggerIndexEntry)));
+        if (res != FR_OK) {
+            (void)SD_PROF_CALL(SD_PROF_CLOSE, f_close(&s_index_file));
+        }
+    }
+    if (res != FR_OK) {
+        (void)SD_PROF_CALL(SD_PROF_CLOSE, f_close(&s_file));
+        return res;
+    }
+    s_index_open = true;
+    return FR_OK;
+}
+
+int sd_logger_set_index(const char *index_path, uint32_t every, sd_logger_key_fn key,
+                        void *context) {
+    if (index_path != NULL && every == 0U) {
+        return FR_INVALID_PARAMETER;
+    }
+#if SD_LOGGER_COMPRESS
+    if (index_path != NULL) {
+        return FR_DENIED;
+    }
+#endif
+    SD_LOGGER_LOCK();
+    if (s_running) {
+        SD_LOGGER_UNLOCK();
+        return FR_LOCKED;
+    }
+    s_index_path = index_path;
+    s_index_every = every;
+    s_index_key = key;
+    s_index_context = context;
+    SD_LOGGER_UNLOCK();
+    return FR_OK;
+}
+
+int sd_logger_start(const char *path) {
+    return sd_logger_start_with_header(path, NULL, 0U);
+}
+
+int sd_logger_start_with_header(const char *path, const void *header, uint32_t len) {
+    if (path == NULL || (header == NULL && len > 0U)) {
+        return FR_INVALID_PARAMETER;
+    }
+#if defined(USE_FREERTOS)
+    if (!sd_logger_create_task()) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+#endif
+
+    SD_LOGGER_LOCK();
+    if (s_running) {
+        SD_LOGGER_UNLOCK();
+        return FR_LOCKED;
+    }
+
+    FRESULT res = sd_logger_open(path);
+    bool fresh = (res == FR_OK && s_file_pos == 0U);
+    if (res == FR_OK) {
+        res = sd_logger_put_header(header, len);
+    }
+    if (res == FR_OK) {
+        res = sd_logger_index_open(fresh);
+    }
+    if (res == FR_OK) {
+        s_raw_sd = NULL;
+        s_fill = 0;
+        s_limit = s_chunk_bytes - (s_file_pos % s_chunk_bytes);
+        sd_logger_begin();
+#if SD_LOGGER_RESUME
+        s_stats.resumed = s_ck_resumed ? 1U : 0U;
+        s_stats.checkpoint_seq = s_ck_seq;
+#endif
+    }
+    SD_LOGGER_UNLOCK();
+    return res;
+}
+
+/* Resume after the checkpoint of a region, or write a new header. */
+static FRESULT sd_logger_raw_open(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks) {
+    uint64_t total = 0;
+    uint32_t seq = 0;
+    s_raw_sd = sd;
+    s_raw_first = first_block;
+    s_raw_blocks = blocks - 1U;
+    s_fill = 0;
+    if (!sd_logger_raw_header(sd, first_block, blocks, s_raw_hdr, &total, &seq)) {
+        total = 0;
+        seq = 0;
+    }
+    s_raw_seq = seq;
+    s_raw_pos = total - (total % SD_BLOCK_SIZE);
+    if (total % SD_BLOCK_SIZE != 0U) {
+        uint32_t block = (uint32_t)((s_raw_pos / SD_BLOCK_SIZE) % s_raw_blocks);
+        if (SD_ReadBlocks(sd, s_chunk, first_block + 1U + block, 1U) != SD_OK) {
+            s_raw_sd = NULL;
+            return FR_DISK_ERR;
+        }
+        s_fill = (uint32_t)(total % SD_BLOCK_SIZE);
+    }
+#if SD_LOGGER_CARD_UNITS
+    sd_logger_size_chunks(sd, SD_LOGGER_CHUNK_BYTES);
+    s_unit_aligned = true;
+#endif
+    s_limit = sd_logger_raw_limit();
+    FRESULT res = (seq == 0U) ? sd_logger_raw_checkpoint() : FR_OK;
+    if (res != FR_OK) {
+        s_raw_sd = NULL;
+    }
+    return res;
+}
+
+int sd_logger_start_raw(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks) {
+    if (sd == NULL || blocks < 2U || first_block + blocks < first_block) {
+        return FR_INVALID_PARAMETER;
+    }
+#if defined(USE_FREERTOS)
+    if (!sd_logger_create_task()) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+#endif
+
+    SD_LOGGER_LOCK();
+    if (s_running) {
+        SD_LOGGER_UNLOCK();
+        return FR_LOCKED;
+    }
+    FRESULT res = sd_logger_raw_open(sd, first_block, blocks);
+    if (res == FR_OK) {
+        s_index_open = false;
+        uint32_t seq = s_raw_seq;
+        sd_logger_begin();
+        s_raw_seq = seq;
+    }
+    SD_LOGGER_UNLOCK();
+    return res;
+}
+
+int sd_logger_raw_info(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks,
+                       SD_LoggerRawInfo *info) {
+    uint8_t hdr[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+    if (sd == NULL || info == NULL || blocks < 2U) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (!sd_logger_raw_header(sd, first_block, blocks, hdr, &info->total, &info->checkpoints)) {
+        return FR_NO_FILESYSTEM;
+    }
+    /* The block being filled reuses the slot of the oldest one. */
+    uint64_t block = info->total / SD_BLOCK_SIZE;
+    info->oldest = (block >= blocks - 1U) ? (block - (blocks - 1U) + 1U) * SD_BLOCK_SIZE : 0U;
+    return FR_OK;
+}
+
+int sd_logger_raw_read(SD_Handle_t *sd, uint32_t first_block, uint32_t blocks, uint64_t offset,
+                       void *buf, uint32_t len, uint32_t *got) {
+    uint8_t bounce[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+    SD_LoggerRawInfo info;
+    if (buf == NULL || got == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    *got = 0;
+    int res = sd_logger_raw_info(sd, first_block, blocks, &info);
+    if (res != FR_OK) {
+        return res;
+    }
+    if (offset < info.oldest || offset > info.total) {
+        return FR_NO_FILE;
+    }
+    if (len > info.total - offset) {
+        len = (uint32_t)(info.total - offset);
+    }
+
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t data_blocks = blocks - 1U;
+    while (len > 0U) {
+        uint32_t block = (uint32_t)((offset / SD_BLOCK_SIZE) % data_blocks);
+        uint32_t skip = (uint32_t)(offset % SD_BLOCK_SIZE);
+        uint32_t n;
+        SD_Status st;
+        if (skip == 0U && len >= SD_BLOCK_SIZE) {
+            /* Whole blocks straight into buf, up to the end of the region. */
+            uint32_t run = len / SD_BLOCK_SIZE;
+            if (run > data_blocks - block) {
+                run = data_blocks - block;
+            }
+            n = run * SD_BLOCK_SIZE;
+            st = SD_ReadBlocks(sd, dst, first_block + 1U + block, run);
+        } else {
+            n = SD_BLOCK_SIZE - skip;
+            if (n > len) {
+                n = len;
+            }
+            st = SD_ReadBlocks(sd, bounce, first_block + 1U + block, 1U);
+            memcpy(dst, &bounce[skip], n);
+        }
+        if (st != SD_OK) {
+            return FR_DISK_ERR;
+        }
+        dst += n;
+        offset += n;
+        len -= n;
+        *got += n;
+    }
+    return FR_OK;
+}
+
+int sd_logger_stop(void) {
+    SD_LOGGER_LOCK();
+    if (!s_running) {
+        SD_LOGGER_UNLOCK();
+        return FR_OK;
+    }
+    s_running = false;
+
+    FRESULT res = sd_logger_drain();
+    FRESULT r = sd_logger_put_flush();
+    if (res == FR_OK) {
+        res = r;
+    }
+    r = sd_logger_write_chunk();
+    if (res == FR_OK) {
+        res = r;
+    }
+    if (s_raw_sd != NULL) {
+        r = sd_logger_raw_checkpoint();
+        if (res == FR_OK) {
+            res = r;
+        }
+        if (res != FR_OK) {
+            s_stats.last_error = res;
+        }
+        s_raw_sd = NULL;
+        SD_LOGGER_UNLOCK();
+        return res;
+    }
+    if (s_index_open) {
+        r = sd_logger_index_out();
+        if (res == FR_OK) {
+            res = r;
+        }
+        r = SD_PROF_CALL(SD_PROF_CLOSE, f_close(&s_index_file));
+        if (res == FR_OK) {
+            res = r;
+        }
+        s_index_open = false;
+    }
+#if (_FS_MINIMIZE == 0)
+    if (s_preallocated) {
+        /* Drop the reserved space past the last record. */
+        r = f_truncate(&s_file);
+        if (res == FR_OK) {
+            res = r;
+        }
+    }
+#endif
+    r = SD_PROF_CALL(SD_PROF_CLOSE, f_close(&s_file));
+    if (res == FR_OK) {
+        res = r;
+    }
+#if SD_LOGGER_RESUME
+    if (res == FR_OK) {
+        sd_logger_ck_store(); /* f_close synced: the next start resumes here */
+    }
+#endif
+    if (res != FR_OK) {
+        s_stats.last_error = res;
+    }
+    SD_LOGGER_UNLOCK();
+    return res;
+}
+
+bool sd_logger_running(void) {
+    return s_running;
+}
+
+/* Entry i of an index file. */
+static FRESULT sd_logger_index_entry(FIL *index, uint32_t i, SD_LoggerIndexEntry *e) {
+    uint8_t raw[sizeof(SD_LoggerIndexEntry)];
+    UINT br = 0;
+    FRESULT res = f_lseek(index, (FSIZE_t)i * sizeof(raw));
+    if (res == FR_OK) {
+        res = f_read(index, raw, sizeof(raw), &br);
+    }
+    if (res == FR_OK && br != sizeof(raw)) {
+        res = FR_INT_ERR;
+    }
+    e->key = sd_logger_raw_get32(&raw[0]);
+    e->offset = sd_logger_raw_get32(&raw[4]);
+    return res;
+}
+
+int sd_logger_index_seek(FIL *log, FIL *index, uint32_t key, SD_LoggerIndexEntry *entry) {
+    SD_LoggerIndexEntry e;
+    if (log == NULL || index == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    /* Offsets grow, so the entries inside the log are a prefix: [0, valid). */
+    uint32_t lo = 0;
+    uint32_t hi = (uint32_t)(f_size(index) / sizeof(SD_LoggerIndexEntry));
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        FRESULT res = sd_logger_index_entry(index, mid, &e);
+        if (res != FR_OK) {
+            return res;
+        }
+        if (e.offset < f_size(log)) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    uint32_t valid = lo;
+    if (valid == 0U) {
+        return FR_NO_FILE;
+    }
+    /* First entry with a key above key; the one before it is the answer. */
+    lo = 0;
+    hi = valid;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        FRESULT res = sd_logger_index_entry(index, mid, &e);
+        if (res != FR_OK) {
+            return res;
+        }
+        if (e.key <= key) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    FRESULT res = sd_logger_index_entry(index, (lo > 0U) ? lo - 1U : 0U, &e);
+    if (res == FR_OK) {
+        res = SD_PROF_CALL(SD_PROF_LSEEK, f_lseek(log, e.offset));
+    }
+    if (res == FR_OK && entry != NULL) {
+        *entry = e;
+    }
+    return res;
+}
+
+/* LZ4 length continuation; false past the end of the input. */
+static bool sd_lz_get_len(const uint8_t *in, uint32_t end, uint32_t *ip, uint32_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = in[(*ip)++];
+        *len += b;
+    } while (b == 255U);
+    return true;
+}
+
+int sd_logger_unpack(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_cap,
+                     uint32_t *used, uint32_t *out_len) {
+    if (in == NULL || out == NULL || used == NULL || out_len == NULL ||
+        in_len < SD_LOGGER_BLOCK_HEADER) {
+        return FR_INT_ERR;
+    }
+    uint32_t word = (uint32_t)in[0] | ((uint32_t)in[1] << 8);
+    uint32_t raw = (uint32_t)in[2] | ((uint32_t)in[3] << 8);
+    uint32_t size = word & 0x7FFFU;
+    if (size > in_len - SD_LOGGER_BLOCK_HEADER || raw > out_cap) {
+        return FR_INT_ERR;
+    }
+    const uint8_t *src = &in[SD_LOGGER_BLOCK_HEADER];
+    *used = SD_LOGGER_BLOCK_HEADER + size;
+    *out_len = raw;
+    if ((word & 0x8000U) != 0U) {
+        if (size != raw) {
+            return FR_INT_ERR;
+        }
+        memcpy(out, src, raw);
+        return FR_OK;
+    }
+
+    uint32_t ip = 0, op = 0;
+    while (ip < size) {
+        uint32_t token = src[ip++];
+        uint32_t lit = token >> 4;
+        if (lit == 15U && !sd_lz_get_len(src, size, &ip, &lit)) {
+            return FR_INT_ERR;
+        }
+        if (lit > size - ip || lit > raw - op) {
+            return FR_INT_ERR;
+        }
+        memcpy(&out[op], &src[ip], lit);
+        ip += lit;
+        op += lit;
+        if (ip == size) {
+            break; /* the last sequence has no match */
+        }
+        if (size - ip < 2U) {
+            return FR_INT_ERR;
+        }
+        uint32_t offset = (uint32_t)src[ip] | ((uint32_t)src[ip + 1U] << 8);
+        ip += 2U;
+        uint32_t len = token & 15U;
+        if (len == 15U && !sd_lz_get_len(src, size, &ip, &len)) {
+            return FR_INT_ERR;
+        }
+        len += 4U;
+        if (offset == 0U || offset > op || len > raw - op) {
+            return FR_INT_ERR;
+        }
+        for (uint32_t i = 0; i < len; i++, op++) {
+            out[op] = out[op - offset]; /* may overlap */
+        }
+    }
+    return (op == raw) ? FR_OK : FR_INT_ERR;
+}
+
+void sd_logger_get_stats(SD_LoggerStats *out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
+
+void sd_logger_get_channel_stats(uint32_t channel, SD_LoggerChannelStats *out) {
+    if (out == NULL) {
+        return;
+    }
+#if (SD_LOGGER_CHANNELS > 0U)
+    if (channel < SD_LOGGER_CHANNELS) {
+        *out = s_channels[channel].stats;
+        return;
+    }
+#else
+    (void)channel;
+#endif
+    memset(out, 0, sizeof(*out));
+}
+
+uint32_t sd_logger_tag_next(const uint8_t *buf, uint32_t len, uint32_t *channel,
+                            const uint8_t **payload, uint32_t *payload_len) {
+    if (buf == NULL || channel == NULL || payload == NULL || payload_len == NULL || len < 4U) {
+        return 0;
+    }
+    uint32_t tag = sd_logger_raw_get32(buf);
+    uint32_t n = tag & 0x00FFFFFFU;
+    if (n > len - 4U) {
+        return 0;
+    }
+    *channel = tag >> 24;
+    *payload = &buf[4];
+    *payload_len = n;
+    return 4U + n;
+}
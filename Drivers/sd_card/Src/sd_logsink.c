@@ -0,0 +1,285 @@
+/*
+ * sd_logsink.c
+ *
+ * Message ring and transmit pump behind sd_logsink_printf. Records are a
+ * length word and the text padded to a word, reserved with one CAS on head
+ * and published by storing the length last (as in sd_logger.c). Whoever
+ * takes s_busy first (a producer or the completion callback) copies whole
+ * records into s_tx and hands it to the hook; s_busy then stays set until
+ * sd_logsink_tx_done, so only one block is ever in flight.
+ */
+
+#include "sd_logsink.h"
+#include "sd_spi.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SD_LOGSINK_MASK   (SD_LOGSINK_RING_BYTES - 1U)
+#define SD_LOGSINK_HDR    4U
+#define SD_LOGSINK_PAD(n) (((n) + 3U) & ~3U)
+
+/* Staging buffer rounded up to whole cache lines for the DMA clean. */
+#define SD_LOGSINK_TX_ALLOC                                                                        \
+    ((SD_LOGSINK_TX_BYTES + SD_DMA_ALIGNMENT - 1U) & ~(SD_DMA_ALIGNMENT - 1U))
+
+static uint8_t s_ring[SD_LOGSINK_RING_BYTES] __attribute__((aligned(4)));
+static uint32_t s_head; // Next byte to reserve (producers, atomic)
+static uint32_t s_tail; // Next byte to stage (holder of s_busy)
+
+/* Owned by the holder of s_busy. */
+static uint8_t s_tx[SD_LOGSINK_TX_ALLOC] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint32_t s_tx_len; // Bytes staged in s_tx, sent or waiting for the hook
+static uint32_t s_busy;   // 1 while a context stages or a block is in flight
+static volatile bool s_in_flight;
+
+static sd_logsink_tx_fn s_tx_fn;
+static void *s_tx_context;
+static volatile uint8_t s_level = SD_LOG_LEVEL;
+static SD_LogSinkStats s_stats;
+
+static void sd_logsink_count(uint32_t *counter, uint32_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static uint32_t sd_logsink_word(uint32_t pos) {
+    return __atomic_load_n((uint32_t *)(void *)&s_ring[pos & SD_LOGSINK_MASK], __ATOMIC_ACQUIRE);
+}
+
+static void sd_logsink_copy_in(uint32_t pos, const char *src, uint32_t len) {
+    uint32_t off = pos & SD_LOGSINK_MASK;
+    uint32_t first = SD_LOGSINK_RING_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&s_ring[off], src, first);
+    memcpy(&s_ring[0], src + first, len - first);
+}
+
+static void sd_logsink_copy_out(uint32_t pos, uint8_t *dst, uint32_t len) {
+    uint32_t off = pos & SD_LOGSINK_MASK;
+    uint32_t first = SD_LOGSINK_RING_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, &s_ring[off], first);
+    memcpy(dst + first, &s_ring[0], len - first);
+}
+
+static void sd_logsink_clear(uint32_t pos, uint32_t len) {
+    uint32_t off = pos & SD_LOGSINK_MASK;
+    uint32_t first = SD_LOGSINK_RING_BYTES - off;
+    if (first > len) {
+        first = len;
+    }
+    memset(&s_ring[off], 0, first);
+    memset(&s_ring[0], 0, len - first);
+}
+
+/* Move whole published records from the ring into s_tx; returns the bytes staged. */
+static uint32_t sd_logsink_stage(void) {
+    uint32_t tail = s_tail;
+    uint32_t n = 0;
+    for (;;) {
+        uint32_t len = sd_logsink_word(tail);
+        if (len == 0U || n + len > SD_LOGSINK_TX_BYTES) {
+            break; /* empty, reserved but not yet published, or full */
+        }
+        uint32_t need = SD_LOGSINK_HDR + SD_LOGSINK_PAD(len);
+        sd_logsink_copy_out(tail + SD_LOGSINK_HDR, &s_tx[n], len);
+        n += len;
+        sd_logsink_clear(tail, need);
+        tail += need;
+        __atomic_store_n(&s_tail, tail, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+static void sd_logsink_pump(void) {
+    while (s_tx_fn != NULL) {
+        uint32_t idle = 0U;
+        if (!__atomic_compare_exchange_n(&s_busy, &idle, 1U, false, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED)) {
+            return; /* another context stages, or a block is in flight */
+        }
+        if (s_tx_len == 0U) {
+            s_tx_len = sd_logsink_stage();
+        }
+        if (s_tx_len > 0U) {
+            s_in_flight = true;
+            if (s_tx_fn(s_tx, s_tx_len, s_tx_context)) {
+                sd_logsink_count(&s_stats.transfers, 1U);
+                return; /* s_busy passes to the transfer */
+            }
+            s_in_flight = false;
+            __atomic_store_n(&s_busy, 0U, __ATOMIC_RELEASE);
+            return; /* transport busy: offered again on the next message or flush */
+        }
+        __atomic_store_n(&s_busy, 0U, __ATOMIC_RELEASE);
+        if (sd_logsink_word(__atomic_load_n(&s_tail, __ATOMIC_ACQUIRE)) == 0U) {
+            return;
+        }
+        /* A record was published after the staging pass: go round again. */
+    }
+}
+
+void sd_logsink_set_sink(sd_logsink_tx_fn tx, void *context) {
+    s_tx_context = context;
+    s_tx_fn = tx;
+    sd_logsink_pump();
+}
+
+void sd_logsink_tx_done(void) {
+    if (!s_in_flight) {
+        return;
+    }
+    sd_logsink_count(&s_stats.sent_bytes, s_tx_len);
+    s_tx_len = 0U;
+    s_in_flight = false;
+    __atomic_store_n(&s_busy, 0U, __ATOMIC_RELEASE);
+    sd_logsink_pump();
+}
+
+void sd_logsink_set_level(uint8_t level) {
+    s_level = (level > SD_LOG_LEVEL) ? (uint8_t)SD_LOG_LEVEL : level;
+}
+
+uint8_t sd_logsink_get_level(void) {
+    return s_level;
+}
+
+static bool sd_logsink_filtered(uint8_t level) {
+    if (level == SD_LOG_LEVEL_NONE || level > s_level) {
+        sd_logsink_count(&s_stats.filtered, 1U);
+        return true;
+    }
+    return false;
+}
+
+static bool sd_logsink_put(const char *text, uint32_t len) {
+    if (len == 0U) {
+        return true;
+    }
+    if (len > SD_LOGSINK_LINE_MAX) {
+        len = SD_LOGSINK_LINE_MAX;
+        sd_logsink_count(&s_stats.truncated, 1U);
+    }
+
+    uint32_t need = SD_LOGSINK_HDR + SD_LOGSINK_PAD(len);
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_RELAXED);
+    uint32_t used;
+    do {
+        used = head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE);
+        if (used + need > SD_LOGSINK_RING_BYTES) {
+            sd_logsink_count(&s_stats.dropped, 1U);
+            sd_logsink_count(&s_stats.dropped_bytes, len);
+            sd_logsink_pump();
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&s_head, &head, head + need, true, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+
+    uint32_t level = used + need;
+    uint32_t high = __atomic_load_n(&s_stats.ring_high_water, __ATOMIC_RELAXED);
+    while (level > high && !__atomic_compare_exchange_n(&s_stats.ring_high_water, &high, level,
+                                                         true, __ATOMIC_RELAXED,
+                                                         __ATOMIC_RELAXED)) {
+    }
+
+    sd_logsink_copy_in(head + SD_LOGSINK_HDR, text, len);
+    __atomic_store_n((uint32_t *)(void *)&s_ring[head & SD_LOGSINK_MASK], len, __ATOMIC_RELEASE);
+    sd_logsink_count(&s_stats.messages, 1U);
+    sd_logsink_count(&s_stats.bytes, len);
+    sd_logsink_pump();
+    return true;
+}
+
+bool sd_logsink_write(uint8_t level, const char *text, uint32_t len) {
+    if (text == NULL || sd_logsink_filtered(level)) {
+        return false;
+    }
+    return sd_logsink_put(text, len);
+}
+
+void sd_logsink_printf(uint8_t level, const char *fmt, ...) {
+    char line[SD_LOGSINK_LINE_MAX + 1U];
+    if (fmt == NULL || sd_logsink_filtered(level)) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        (void)sd_logsink_put(line, (uint32_t)n); /* past LINE_MAX: cut and counted */
+    }
+}
+
+bool sd_logsink_flush(uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+    if (s_tx_fn == NULL) {
+        return false;
+    }
+    for (;;) {
+        sd_logsink_pump();
+        if (!s_in_flight && s_tx_len == 0U &&
+            __atomic_load_n(&s_head, __ATOMIC_ACQUIRE) ==
+                __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+        if ((HAL_GetTick() - start) >= timeout_ms) {
+            return false;
+        }
+    }
+}
+
+void sd_logsink_get_stats(SD_LogSinkStats *out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
+
+void sd_logsink_reset_stats(void) {
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void sd_logsink_reset(void) {
+    memset(s_ring, 0, sizeof(s_ring));
+    s_head = 0U;
+    s_tail = 0U;
+    s_tx_len = 0U;
+    s_in_flight = false;
+    s_busy = 0U;
+    s_level = SD_LOG_LEVEL;
+    sd_logsink_reset_stats();
+}
+
+#if defined(HAL_UART_MODULE_ENABLED)
+static UART_HandleTypeDef *s_uart;
+
+static bool sd_logsink_uart_tx(const uint8_t *data, uint32_t len, void *context) {
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_CleanDCache_by_Addr((uint32_t *)(uintptr_t)data,
+                            (int32_t)((len + SD_DMA_ALIGNMENT - 1U) & ~(SD_DMA_ALIGNMENT - 1U)));
+#endif
+    return HAL_UART_Transmit_DMA((UART_HandleTypeDef *)context, (uint8_t *)(uintptr_t)data,
+                                 (uint16_t)len) == HAL_OK;
+}
+
+void sd_logsink_use_uart(UART_HandleTypeDef *huart) {
+    s_uart = huart;
+    sd_logsink_set_sink((huart != NULL) ? sd_logsink_uart_tx : NULL, huart);
+}
+
+void sd_logsink_uart_tx_cplt(UART_HandleTypeDef *huart) {
+    if (huart != NULL && huart == s_uart) {
+        sd_logsink_tx_done();
+    }
+}
+
+void sd_logsink_uart_error(UART_HandleTypeDef *huart) {
+    if (huart != NULL && huart == s_uart && huart->gState == HAL_UART_STATE_READY) {
+        sd_logsink_tx_done();
+    }
+}
+#endif
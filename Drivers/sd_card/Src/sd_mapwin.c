@@ -0,0 +1,87 @@
+/*
+ * sd_mapwin.c
+ *
+ * A lookup outside the window places the next one at offset rounded down to
+ * a multiple of the window size (cluster-aligned for a full-cluster window)
+ * or, if the range would cross its end, at offset's sector. A full window
+ * that overlaps the new one keeps the overlap.
+ */
+
+#include "sd_mapwin.h"
+#include <string.h>
+
+#define SD_MAP_SS ((uint32_t)_MAX_SS)
+
+int sd_map_init(SD_MapWindow *map, FIL *fp, void *buf, uint32_t bytes) {
+    if (map == NULL || fp == NULL || buf == NULL || bytes < SD_MAP_SS) {
+        return FR_INVALID_PARAMETER;
+    }
+    const FATFS *fs = fp->obj.fs;
+    if (fs == NULL || fs->fs_type == 0U || fp->obj.id != fs->id) {
+        return FR_INVALID_OBJECT;
+    }
+    uint32_t cluster = (uint32_t)fs->csize * SD_MAP_SS;
+    memset(map, 0, sizeof(*map));
+    map->fp = fp;
+    map->buf = (uint8_t *)buf;
+    map->size = (bytes < cluster) ? (bytes / SD_MAP_SS) * SD_MAP_SS : cluster;
+    return FR_OK;
+}
+
+void sd_map_invalidate(SD_MapWindow *map) {
+    if (map != NULL) {
+        map->valid = 0;
+    }
+}
+
+static FRESULT sd_map_load(SD_MapWindow *map, FSIZE_t base) {
+    uint32_t keep = 0;
+    if (map->valid == map->size && base > map->start && base < map->start + map->valid) {
+        keep = (uint32_t)(map->start + map->valid - base);
+        memmove(map->buf, map->buf + (map->size - keep), keep);
+        map->stats.slides++;
+    }
+    map->start = base;
+    map->valid = 0;
+    map->stats.loads++;
+
+    UINT br = 0;
+    FRESULT res = f_lseek(map->fp, base + keep);
+    if (res == FR_OK) {
+        res = f_read(map->fp, map->buf + keep, map->size - keep, &br);
+    }
+    if (res != FR_OK) {
+        return res;
+    }
+    map->valid = keep + (uint32_t)br;
+    map->stats.bytes_read += (uint32_t)br;
+    return FR_OK;
+}
+
+const void *sd_map_window(SD_MapWindow *map, uint32_t offset, uint32_t len) {
+    if (map == NULL || map->fp == NULL) {
+        return NULL;
+    }
+    FSIZE_t size = f_size(map->fp);
+    if (len == 0U || offset >= size || len > size - offset ||
+        (offset % SD_MAP_SS) + len > map->size) {
+        map->err = FR_INVALID_PARAMETER;
+        return NULL;
+    }
+    if (map->valid > 0U && offset >= map->start && offset + len <= map->start + map->valid) {
+        map->stats.hits++;
+        map->err = FR_OK;
+        return map->buf + (offset - map->start);
+    }
+
+    FSIZE_t base = offset - (offset % map->size);
+    if ((offset - base) + len > map->size) {
+        base = offset - (offset % SD_MAP_SS);
+    }
+    FRESULT res = sd_map_load(map, base);
+    if (res == FR_OK && offset + len > map->start + map->valid) {
+        res = FR_INT_ERR; /* f_read stopped short of the size */
+    }
+    map->err = res;
+    return (res == FR_OK) ? map->buf + (offset - map->start) : NULL;
+}
@@ -0,0 +1,204 @@
+/*
+ * sd_mem.c
+ *
+ * Word accesses go through fixed-size memcpy so they stay free of aliasing
+ * and alignment assumptions; GCC turns each into one LDR/STR (or byte loads
+ * on cores without unaligned access) from -O1 up.
+ */
+
+#include "sd_mem.h"
+#include <string.h>
+
+#if (SD_MEM_ROUTINES == 0)
+
+void sd_mem_copy(void *dst, const void *src, uint32_t cnt) {
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    while (cnt-- > 0U) {
+        *d++ = *s++;
+    }
+}
+
+void sd_mem_set(void *dst, int val, uint32_t cnt) {
+    uint8_t *d = (uint8_t *)dst;
+    while (cnt-- > 0U) {
+        *d++ = (uint8_t)val;
+    }
+}
+
+int sd_mem_cmp(const void *a, const void *b, uint32_t cnt) {
+    const uint8_t *x = (const uint8_t *)a, *y = (const uint8_t *)b;
+    for (; cnt > 0U; cnt--, x++, y++) {
+        if (*x != *y) {
+            return *x - *y;
+        }
+    }
+    return 0;
+}
+
+#elif (SD_MEM_ROUTINES == 1)
+
+static inline uint32_t sd_mem_load(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void sd_mem_store(uint8_t *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+void sd_mem_copy(void *dst, const void *src, uint32_t cnt) {
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    while (cnt > 0U && ((uintptr_t)d & 3U) != 0U) {
+        *d++ = *s++;
+        cnt--;
+    }
+    for (; cnt >= 16U; cnt -= 16U, d += 16, s += 16) {
+        uint32_t w0 = sd_mem_load(s), w1 = sd_mem_load(s + 4);
+        uint32_t w2 = sd_mem_load(s + 8), w3 = sd_mem_load(s + 12);
+        sd_mem_store(d, w0);
+        sd_mem_store(d + 4, w1);
+        sd_mem_store(d + 8, w2);
+        sd_mem_store(d + 12, w3);
+    }
+    for (; cnt >= 4U; cnt -= 4U, d += 4, s += 4) {
+        sd_mem_store(d, sd_mem_load(s));
+    }
+    while (cnt-- > 0U) {
+        *d++ = *s++;
+    }
+}
+
+void sd_mem_set(void *dst, int val, uint32_t cnt) {
+    uint8_t *d = (uint8_t *)dst;
+    uint32_t w = (uint8_t)val * 0x01010101U;
+    while (cnt > 0U && ((uintptr_t)d & 3U) != 0U) {
+        *d++ = (uint8_t)val;
+        cnt--;
+    }
+    for (; cnt >= 16U; cnt -= 16U, d += 16) {
+        sd_mem_store(d, w);
+        sd_mem_store(d + 4, w);
+        sd_mem_store(d + 8, w);
+        sd_mem_store(d + 12, w);
+    }
+    for (; cnt >= 4U; cnt -= 4U, d += 4) {
+        sd_mem_store(d, w);
+    }
+    while (cnt-- > 0U) {
+        *d++ = (uint8_t)val;
+    }
+}
+
+int sd_mem_cmp(const void *a, const void *b, uint32_t cnt) {
+    const uint8_t *x = (const uint8_t *)a, *y = (const uint8_t *)b;
+    /* Skip equal words; the first differing word is finished bytewise below. */
+    for (; cnt >= 4U && sd_mem_load(x) == sd_mem_load(y); cnt -= 4U, x += 4, y += 4) {
+    }
+    for (; cnt > 0U; cnt--, x++, y++) {
+        if (*x != *y) {
+            return *x - *y;
+        }
+    }
+    return 0;
+}
+
+#else
+
+void sd_mem_copy(void *dst, const void *src, uint32_t cnt) {
+    memcpy(dst, src, cnt);
+}
+
+void sd_mem_set(void *dst, int val, uint32_t cnt) {
+    memset(dst, val, cnt);
+}
+
+int sd_mem_cmp(const void *a, const void *b, uint32_t cnt) {
+    return memcmp(a, b, cnt);
+}
+
+#endif
+
+#if (SD_MEM_DMA_THRESHOLD > 0U)
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+/* With a data cache the destination is invalidated afterwards, so it must cover whole lines. */
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+#define SD_MEM_DMA_ALIGN 32U
+#else
+#define SD_MEM_DMA_ALIGN 4U
+#endif
+
+static DMA_HandleTypeDef *s_hdma;
+static bool s_dma_busy;
+static void *s_dma_dst;
+static const void *s_dma_src;
+static uint32_t s_dma_cnt;
+
+void sd_mem_set_dma(DMA_HandleTypeDef *hdma) {
+    s_hdma = hdma;
+}
+
+static bool sd_mem_take_dma(void) {
+    bool taken = false;
+#if defined(USE_FREERTOS)
+    taskENTER_CRITICAL();
+#endif
+    if (s_hdma != NULL && !s_dma_busy) {
+        s_dma_busy = true;
+        taken = true;
+    }
+#if defined(USE_FREERTOS)
+    taskEXIT_CRITICAL();
+#endif
+    return taken;
+}
+
+bool sd_mem_copy_start(void *dst, const void *src, uint32_t cnt) {
+    /* A DMA transfer counts at most 65535 words. */
+    if (cnt < SD_MEM_DMA_THRESHOLD || cnt / 4U > 0xFFFFU || (cnt % SD_MEM_DMA_ALIGN) != 0U ||
+        ((uintptr_t)dst % SD_MEM_DMA_ALIGN) != 0U || ((uintptr_t)src % 4U) != 0U ||
+        !sd_mem_take_dma()) {
+        memcpy(dst, src, cnt);
+        return false;
+    }
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_CleanDCache_by_Addr((uint32_t *)((uintptr_t)src & ~(uintptr_t)(SD_MEM_DMA_ALIGN - 1U)),
+                            (int32_t)(cnt + SD_MEM_DMA_ALIGN));
+    SCB_CleanDCache_by_Addr((uint32_t *)dst, (int32_t)cnt);
+#endif
+    if (HAL_DMA_Start(s_hdma, (uint32_t)(uintptr_t)src, (uint32_t)(uintptr_t)dst, cnt / 4U) !=
+        HAL_OK) {
+        s_dma_busy = false;
+        memcpy(dst, src, cnt);
+        return false;
+    }
+    s_dma_dst = dst;
+    s_dma_src = src;
+    s_dma_cnt = cnt;
+    return true;
+}
+
+void sd_mem_copy_wait(void) {
+    bool done = HAL_DMA_PollForTransfer(s_hdma, HAL_DMA_FULL_TRANSFER, SD_MEM_DMA_TIMEOUT_MS) ==
+                HAL_OK;
+    if (!done) {
+        (void)HAL_DMA_Abort(s_hdma);
+    }
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_InvalidateDCache_by_Addr((uint32_t *)s_dma_dst, (int32_t)s_dma_cnt);
+#endif
+    if (!done) {
+        /* Stream stuck or faulted: copy again on the CPU. */
+        memcpy(s_dma_dst, s_dma_src, s_dma_cnt);
+    }
+    s_dma_busy = false;
+}
+
+#endif
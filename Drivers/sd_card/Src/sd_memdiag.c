@@ -0,0 +1,176 @@
+/*
+ * sd_memdiag.c
+ *
+ * Collects the stack, heap and pool figures from FreeRTOS, sd_pool, the
+ * sector cache and the logger. Nothing is sampled in the background: each
+ * call reads the counters those modules already keep.
+ */
+
+#include "sd_memdiag.h"
+#include "sd_cache.h"
+#include "sd_logger.h"
+#include "sd_pool.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(USE_FREERTOS)
+
+/* Names the driver gives the tasks it creates. */
+static const char *const s_driver_tasks[] = {"sd_io", "sd_log", "sd_free", "sd_hotplug",
+                                             "sd_raid"};
+
+static TaskHandle_t s_watched[SD_MEMDIAG_WATCH_TASKS];
+
+bool sd_memdiag_watch(TaskHandle_t task) {
+    if (task == NULL) {
+        return true;
+    }
+    TaskHandle_t *slot = NULL;
+    for (uint32_t i = 0; i < SD_MEMDIAG_WATCH_TASKS; i++) {
+        if (s_watched[i] == task) {
+            return true;
+        }
+        if (s_watched[i] == NULL && slot == NULL) {
+            slot = &s_watched[i];
+        }
+    }
+    if (slot == NULL) {
+        return false;
+    }
+    *slot = task;
+    return true;
+}
+
+void sd_memdiag_unwatch(TaskHandle_t task) {
+    for (uint32_t i = 0; i < SD_MEMDIAG_WATCH_TASKS; i++) {
+        if (s_watched[i] == task) {
+            s_watched[i] = NULL;
+        }
+    }
+}
+
+#if (INCLUDE_uxTaskGetStackHighWaterMark == 1)
+static bool SD_MemTaskAdd(TaskHandle_t task, SD_MemTask *out, uint32_t max, uint32_t *n) {
+    if (*n >= max) {
+        return false;
+    }
+    out[*n].name = pcTaskGetName(task);
+    out[*n].stack_free_min = (uint32_t)uxTaskGetStackHighWaterMark(task);
+    (*n)++;
+    return true;
+}
+#endif
+
+uint32_t sd_memdiag_tasks(SD_MemTask *out, uint32_t max) {
+    uint32_t n = 0;
+    if (out == NULL) {
+        return 0U;
+    }
+#if (INCLUDE_uxTaskGetStackHighWaterMark == 1)
+#if (INCLUDE_xTaskGetHandle == 1)
+    for (uint32_t i = 0; i < sizeof(s_driver_tasks) / sizeof(s_driver_tasks[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(s_driver_tasks[i]);
+        if (task != NULL && !SD_MemTaskAdd(task, out, max, &n)) {
+            return n;
+        }
+    }
+#else
+    (void)s_driver_tasks;
+#endif
+    for (uint32_t i = 0; i < SD_MEMDIAG_WATCH_TASKS; i++) {
+        if (s_watched[i] != NULL && !SD_MemTaskAdd(s_watched[i], out, max, &n)) {
+            break;
+        }
+    }
+#else
+    (void)max;
+#endif
+    return n;
+}
+
+void sd_memdiag_heap(SD_MemHeap *out) {
+    if (out == NULL) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+#if (SD_MEMDIAG_HEAP == 1)
+    out->total = (uint32_t)configTOTAL_HEAP_SIZE;
+    out->free = (uint32_t)xPortGetFreeHeapSize();
+    out->free_min = (uint32_t)xPortGetMinimumEverFreeHeapSize();
+#endif
+}
+
+#else
+
+uint32_t sd_memdiag_tasks(SD_MemTask *out, uint32_t max) {
+    (void)out;
+    (void)max;
+    return 0U;
+}
+
+void sd_memdiag_heap(SD_MemHeap *out) {
+    if (out != NULL) {
+        memset(out, 0, sizeof(*out));
+    }
+}
+
+#endif /* USE_FREERTOS */
+
+static void SD_MemPoolFrom(SD_MemPool *out, const char *name, SD_PoolKind kind,
+                           uint32_t object) {
+    SD_PoolStats st;
+    sd_pool_get_stats(kind, &st);
+    out->name = name;
+    out->bytes = st.size * object;
+    out->peak = st.high_water * object;
+}
+
+uint32_t sd_memdiag_pools(SD_MemPool *out, uint32_t max) {
+    SD_MemPool all[SD_MEMDIAG_POOLS];
+    SD_LoggerStats log;
+    if (out == NULL) {
+        return 0U;
+    }
+    SD_MemPoolFrom(&all[0], "fil", SD_POOL_FIL, (uint32_t)sizeof(FIL));
+    SD_MemPoolFrom(&all[1], "dir", SD_POOL_DIR, (uint32_t)sizeof(DIR));
+    SD_MemPoolFrom(&all[2], "filinfo", SD_POOL_FILINFO, (uint32_t)sizeof(FILINFO));
+    SD_MemPoolFrom(&all[3], "lfn", SD_POOL_LFN, (uint32_t)SD_POOL_LFN_BYTES);
+
+    all[4].name = "cache";
+    all[4].bytes = SD_CACHE_ENABLED ? (uint32_t)(SD_CACHE_LINES * SD_BLOCK_SIZE) : 0U;
+    all[4].peak = all[4].bytes;
+
+    sd_logger_get_stats(&log);
+    all[5].name = "log_ring";
+    all[5].bytes = SD_LOGGER_RING_BYTES;
+    all[5].peak = log.ring_high_water;
+    all[6].name = "log_bufs";
+    all[6].bytes = (uint32_t)(SD_LOGGER_ISR_BUFS * SD_LOGGER_ISR_BUF_BYTES);
+    all[6].peak = log.pool_high_water * SD_LOGGER_ISR_BUF_BYTES;
+
+    SD_MemPoolFrom(&all[7], "ioreq", SD_POOL_IOREQ, (uint32_t)sizeof(SD_IoRequest));
+    SD_MemPoolFrom(&all[8], "iobuf", SD_POOL_IOBUF, (uint32_t)SD_POOL_IOBUF_BYTES);
+
+    uint32_t n = (max < SD_MEMDIAG_POOLS) ? max : SD_MEMDIAG_POOLS;
+    memcpy(out, all, n * sizeof(all[0]));
+    return n;
+}
+
+void sd_memdiag_report(void) {
+    SD_MemTask tasks[SD_MEMDIAG_MAX_TASKS];
+    SD_MemPool pools[SD_MEMDIAG_POOLS];
+    SD_MemHeap heap;
+
+    uint32_t n = sd_memdiag_tasks(tasks, SD_MEMDIAG_MAX_TASKS);
+    for (uint32_t i = 0; i < n; i++) {
+        printf("SDMEM,task,%s,%lu\r\n", tasks[i].name, (unsigned long)tasks[i].stack_free_min);
+    }
+    sd_memdiag_heap(&heap);
+    printf("SDMEM,heap,%lu,%lu,%lu\r\n", (unsigned long)heap.total, (unsigned long)heap.free,
+           (unsigned long)heap.free_min);
+    n = sd_memdiag_pools(pools, SD_MEMDIAG_POOLS);
+    for (uint32_t i = 0; i < n; i++) {
+        printf("SDMEM,pool,%s,%lu,%lu\r\n", pools[i].name, (unsigned long)pools[i].bytes,
+               (unsigned long)pools[i].peak);
+    }
+}
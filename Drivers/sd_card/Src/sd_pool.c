@@ -0,0 +1,220 @@
+/*
+ * sd_pool.c
+ *
+ * Each pool is a static array plus a free bitmap claimed with compare-and-
+ * swap, so acquire and release need no lock and work from interrupts.
+ */
+
+#include "sd_pool.h"
+#include <string.h>
+
+typedef struct {
+    uint32_t free_bits; // Bit i set: object i is free
+    SD_PoolStats stats;
+} sd_pool;
+
+#define SD_POOL_MASK(n) (((n) >= 32U) ? 0xFFFFFFFFU : ((1U << (n)) - 1U))
+
+#if (SD_POOL_FILS > 0U)
+static FIL s_fils[SD_POOL_FILS];
+#endif
+#if (SD_POOL_DIRS > 0U)
+static DIR s_dirs[SD_POOL_DIRS];
+#endif
+#if (SD_POOL_FILINFOS > 0U)
+static FILINFO s_filinfos[SD_POOL_FILINFOS];
+#endif
+#if (SD_POOL_LFN_BUFS > 0U)
+#define SD_POOL_LFN_WORDS ((SD_POOL_LFN_BYTES + 3U) / 4U)
+static uint32_t s_lfn[SD_POOL_LFN_BUFS][SD_POOL_LFN_WORDS];
+#endif
+#if (SD_POOL_IOREQS > 0U)
+static SD_IoRequest s_ioreqs[SD_POOL_IOREQS];
+#endif
+#if (SD_POOL_IOBUFS > 0U)
+/* The buffer size is a multiple of 512, so every buffer keeps the array's alignment. */
+static uint8_t s_iobufs[SD_POOL_IOBUFS][SD_POOL_IOBUF_BYTES]
+    __attribute__((aligned(SD_DMA_ALIGNMENT)));
+#endif
+
+static sd_pool s_pools[SD_POOL_KINDS] = {
+    {SD_POOL_MASK(SD_POOL_FILS), {SD_POOL_FILS, 0, 0, 0, 0}},
+    {SD_POOL_MASK(SD_POOL_DIRS), {SD_POOL_DIRS, 0, 0, 0, 0}},
+    {SD_POOL_MASK(SD_POOL_FILINFOS), {SD_POOL_FILINFOS, 0, 0, 0, 0}},
+    {SD_POOL_MASK(SD_POOL_LFN_BUFS), {SD_POOL_LFN_BUFS, 0, 0, 0, 0}},
+    {SD_POOL_MASK(SD_POOL_IOREQS), {SD_POOL_IOREQS, 0, 0, 0, 0}},
+    {SD_POOL_MASK(SD_POOL_IOBUFS), {SD_POOL_IOBUFS, 0, 0, 0, 0}},
+};
+
+/* Claim the lowest free slot; -1 (counted) if none. */
+static int sd_pool_take(sd_pool *pool) {
+    uint32_t free_bits = __atomic_load_n(&pool->free_bits, __ATOMIC_RELAXED);
+    uint32_t bit;
+    do {
+        if (free_bits == 0U) {
+            __atomic_fetch_add(&pool->stats.misses, 1U, __ATOMIC_RELAXED);
+            return -1;
+        }
+        bit = free_bits & (~free_bits + 1U);
+    } while (!__atomic_compare_exchange_n(&pool->free_bits, &free_bits, free_bits & ~bit, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    __atomic_fetch_add(&pool->stats.acquires, 1U, __ATOMIC_RELAXED);
+    uint32_t used = __atomic_add_fetch(&pool->stats.in_use, 1U, __ATOMIC_RELAXED);
+    uint32_t high = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+    while (used > high && !__atomic_compare_exchange_n(&pool->stats.high_water, &high, used,
+                                                        true, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+    }
+    return __builtin_ctz(bit);
+}
+
+/* Free the slot holding obj if obj lies in base[0..count). */
+static void sd_pool_give(sd_pool *pool, const void *base, uint32_t count, size_t size,
+                         const void *obj) {
+    uintptr_t off = (uintptr_t)obj - (uintptr_t)base;
+    if (obj == NULL || base == NULL || off >= count * size || (off % size) != 0U) {
+        return;
+    }
+    uint32_t bit = 1U << (off / size);
+    uint32_t prev = __atomic_fetch_or(&pool->free_bits, bit, __ATOMIC_RELEASE);
+    if ((prev & bit) == 0U) { /* ignore a double release */
+        __atomic_fetch_sub(&pool->stats.in_use, 1U, __ATOMIC_RELAXED);
+    }
+}
+
+FIL *sd_pool_fil_get(void) {
+#if (SD_POOL_FILS > 0U)
+    int i = sd_pool_take(&s_pools[SD_POOL_FIL]);
+    return (i < 0) ? NULL : &s_fils[i];
+#else
+    (void)sd_pool_take(&s_pools[SD_POOL_FIL]);
+    return NULL;
+#endif
+}
+
+DIR *sd_pool_dir_get(void) {
+#if (SD_POOL_DIRS > 0U)
+    int i = sd_pool_take(&s_pools[SD_POOL_DIR]);
+    return (i < 0) ? NULL : &s_dirs[i];
+#else
+    (void)sd_pool_take(&s_pools[SD_POOL_DIR]);
+    return NULL;
+#endif
+}
+
+FILINFO *sd_pool_filinfo_get(void) {
+#if (SD_POOL_FILINFOS > 0U)
+    int i = sd_pool_take(&s_pools[SD_POOL_FILINFO]);
+    return (i < 0) ? NULL : &s_filinfos[i];
+#else
+    (void)sd_pool_take(&s_pools[SD_POOL_FILINFO]);
+    return NULL;
+#endif
+}
+
+void sd_pool_fil_put(FIL *fp) {
+#if (SD_POOL_FILS > 0U)
+    sd_pool_give(&s_pools[SD_POOL_FIL], s_fils, SD_POOL_FILS, sizeof(FIL), fp);
+#else
+    (void)fp;
+#endif
+}
+
+void sd_pool_dir_put(DIR *dp) {
+#if (SD_POOL_DIRS > 0U)
+    sd_pool_give(&s_pools[SD_POOL_DIR], s_dirs, SD_POOL_DIRS, sizeof(DIR), dp);
+#else
+    (void)dp;
+#endif
+}
+
+void sd_pool_filinfo_put(FILINFO *fno) {
+#if (SD_POOL_FILINFOS > 0U)
+    sd_pool_give(&s_pools[SD_POOL_FILINFO], s_filinfos, SD_POOL_FILINFOS, sizeof(FILINFO),
+                 fno);
+#else
+    (void)fno;
+#endif
+}
+
+void *sd_pool_lfn_get(UINT size) {
+    sd_pool *pool = &s_pools[SD_POOL_LFN];
+    if (size > SD_POOL_LFN_BYTES) {
+        __atomic_fetch_add(&pool->stats.misses, 1U, __ATOMIC_RELAXED);
+        return NULL;
+    }
+#if (SD_POOL_LFN_BUFS > 0U)
+    int i = sd_pool_take(pool);
+    return (i < 0) ? NULL : s_lfn[i];
+#else
+    (void)sd_pool_take(pool);
+    return NULL;
+#endif
+}
+
+void sd_pool_lfn_put(void *block) {
+#if (SD_POOL_LFN_BUFS > 0U)
+    sd_pool_give(&s_pools[SD_POOL_LFN], s_lfn, SD_POOL_LFN_BUFS, sizeof(s_lfn[0]), block);
+#else
+    (void)block;
+#endif
+}
+
+SD_IoRequest *sd_pool_ioreq_get(void) {
+#if (SD_POOL_IOREQS > 0U)
+    int i = sd_pool_take(&s_pools[SD_POOL_IOREQ]);
+    return (i < 0) ? NULL : &s_ioreqs[i];
+#else
+    (void)sd_pool_take(&s_pools[SD_POOL_IOREQ]);
+    return NULL;
+#endif
+}
+
+void sd_pool_ioreq_put(SD_IoRequest *request) {
+#if (SD_POOL_IOREQS > 0U)
+    sd_pool_give(&s_pools[SD_POOL_IOREQ], s_ioreqs, SD_POOL_IOREQS, sizeof(SD_IoRequest),
+                 request);
+#else
+    (void)request;
+#endif
+}
+
+uint8_t *sd_pool_iobuf_get(void) {
+#if (SD_POOL_IOBUFS > 0U)
+    int i = sd_pool_take(&s_pools[SD_POOL_IOBUF]);
+    return (i < 0) ? NULL : s_iobufs[i];
+#else
+    (void)sd_pool_take(&s_pools[SD_POOL_IOBUF]);
+    return NULL;
+#endif
+}
+
+void sd_pool_iobuf_put(void *buff) {
+#if (SD_POOL_IOBUFS > 0U)
+    sd_pool_give(&s_pools[SD_POOL_IOBUF], s_iobufs, SD_POOL_IOBUFS, SD_POOL_IOBUF_BYTES, buff);
+#else
+    (void)buff;
+#endif
+}
+
+void sd_pool_get_stats(SD_PoolKind kind, SD_PoolStats *out) {
+    if (out == NULL) {
+        return;
+    }
+    if ((unsigned)kind >= SD_POOL_KINDS) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    *out = s_pools[kind].stats;
+}
+
+void sd_pool_reset_stats(void) {
+    for (int k = 0; k < SD_POOL_KINDS; k++) {
+        SD_PoolStats *st = &s_pools[k].stats;
+        __atomic_store_n(&st->acquires, 0U, __ATOMIC_RELAXED);
+        __atomic_store_n(&st->misses, 0U, __ATOMIC_RELAXED);
+        __atomic_store_n(&st->high_water, __atomic_load_n(&st->in_use, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,289 @@
+/*
+ * sd_profile.c
+ *
+ * FatFs operation profiler: per-API call timing plus sector I/O attribution
+ * by volume region, and optionally per file.
+ */
+
+#include "sd_profile.h"
+#include <string.h>
+
+typedef struct {
+    uint32_t fat_first;
+    uint32_t fat_count;
+    uint32_t data_first; // 0 = layout not registered
+} SD_ProfLayout;
+
+static SD_ProfStats s_stats[SD_PROF_COUNT];
+static SD_ProfLayout s_layout[SD_PROFILE_DRIVES];
+static SD_ProfApi s_api = SD_PROF_OTHER; // Call the current I/O is charged to
+static uint32_t s_depth;
+static uint32_t s_start;
+
+#if (SD_PROFILE_FILES > 0U)
+typedef struct {
+    const void *fp; // NULL = free
+    SD_ProfFileStats *file;
+} SD_ProfBinding;
+
+static SD_ProfFileStats s_files[SD_PROFILE_FILES];
+static SD_ProfBinding s_bind[SD_PROFILE_FILES];
+static SD_ProfFileStats *s_file; // File the current call is charged to
+static const void *s_file_fp;
+static uint32_t s_file_fptr;     // File pointer when the call began
+#endif
+static int s_file_result;
+
+static const char *const s_names[SD_PROF_COUNT] = {
+    "open", "read", "write", "lseek", "sync", "close", "other"
+};
+
+void SD_ProfSetRegions(uint8_t pdrv, uint32_t fat_first, uint32_t fat_count,
+                       uint32_t data_first) {
+    if (pdrv >= SD_PROFILE_DRIVES) {
+        return;
+    }
+    s_layout[pdrv].fat_first = fat_first;
+    s_layout[pdrv].fat_count = fat_count;
+    s_layout[pdrv].data_first = data_first;
+}
+
+static SD_ProfRegion SD_ProfClassify(uint8_t pdrv, uint32_t sector) {
+    if (pdrv >= SD_PROFILE_DRIVES || s_layout[pdrv].data_first == 0U) {
+        return SD_PROF_REGION_DATA;
+    }
+    const SD_ProfLayout *layout = &s_layout[pdrv];
+    if ((sector - layout->fat_first) < layout->fat_count) {
+        return SD_PROF_REGION_FAT;
+    }
+    return (sector < layout->data_first) ? SD_PROF_REGION_DIR : SD_PROF_REGION_DATA;
+}
+
+void SD_ProfBegin(SD_ProfApi api) {
+    if (s_depth++ > 0U) {
+        return;
+    }
+    s_api = (api < SD_PROF_COUNT) ? api : SD_PROF_OTHER;
+    s_start = DWT->CYCCNT;
+}
+
+/* End a call; true with its duration when the outermost one ended. */
+static bool SD_ProfFinish(int result, uint32_t *out_cycles) {
+    if (s_depth == 0U) {
+        return false;
+    }
+    if (--s_depth > 0U) {
+        return false;
+    }
+
+    uint32_t cycles = DWT->CYCCNT - s_start;
+    *out_cycles = cycles;
+    SD_ProfStats *stats = &s_stats[s_api];
+    stats->calls++;
+    if (result != 0) {
+        stats->errors++;
+    }
+    stats->cycles += cycles;
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+    s_api = SD_PROF_OTHER;
+    return true;
+}
+
+int SD_ProfEnd(int result) {
+    uint32_t cycles;
+    (void)SD_ProfFinish(result, &cycles);
+    return result;
+}
+
+void SD_ProfDiskIo(uint8_t pdrv, bool write, uint32_t sector, uint32_t count, uint32_t start) {
+    SD_ProfStats *stats = &s_stats[s_api];
+    uint32_t io = DWT->CYCCNT - start;
+    stats->io_cycles += io;
+#if (SD_PROFILE_FILES > 0U)
+    if (s_file != NULL) {
+        s_file->io_cycles += io;
+        if (write) {
+            s_file->sectors_written += count;
+        } else {
+            s_file->sectors_read += count;
+        }
+    }
+#endif
+
+    /* A multi-sector transfer can straddle a region boundary; split it per sector. */
+    uint32_t *sectors = write ? stats->sectors_written : stats->sectors_read;
+    for (uint32_t i = 0; i < count; i++) {
+        sectors[SD_ProfClassify(pdrv, sector + i)]++;
+    }
+}
+
+const SD_ProfStats *SD_ProfGet(SD_ProfApi api) {
+    return (api < SD_PROF_COUNT) ? &s_stats[api] : NULL;
+}
+
+const char *SD_ProfName(SD_ProfApi api) {
+    return (api < SD_PROF_COUNT) ? s_names[api] : "?";
+}
+
+void SD_ProfReset(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    memset(s_stats, 0, sizeof(s_stats));
+    s_api = SD_PROF_OTHER;
+    s_depth = 0;
+#if (SD_PROFILE_FILES > 0U)
+    s_file = NULL;
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        SD_ProfFileStats *f = &s_files[i];
+        if (f->open_now == 0U) {
+            memset(f, 0, sizeof(*f));
+        } else {
+            uint32_t open_now = f->open_now;
+            char name[SD_PROFILE_NAME];
+            memcpy(name, f->name, sizeof(name));
+            memset(f, 0, sizeof(*f));
+            memcpy(f->name, name, sizeof(name));
+            f->open_now = open_now;
+        }
+    }
+#endif
+}
+
+#if (SD_PROFILE_FILES > 0U)
+static SD_ProfBinding *SD_ProfFindBinding(const void *fp) {
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        if (s_bind[i].fp == fp) {
+            return &s_bind[i];
+        }
+    }
+    return NULL;
+}
+
+/* path's slot, else a free one, else the closed file with the least I/O (NULL: all open). */
+static SD_ProfFileStats *SD_ProfFileSlot(const char *name) {
+    SD_ProfFileStats *victim = NULL;
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        if (strcmp(s_files[i].name, name) == 0) {
+            return &s_files[i];
+        }
+    }
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        SD_ProfFileStats *f = &s_files[i];
+        if (f->name[0] == '\0') {
+            victim = f;
+            break;
+        }
+        if (f->open_now == 0U &&
+            (victim == NULL || f->sectors_read + f->sectors_written <
+                                   victim->sectors_read + victim->sectors_written)) {
+            victim = f;
+        }
+    }
+    if (victim != NULL) {
+        memset(victim, 0, sizeof(*victim));
+        memcpy(victim->name, name, strlen(name) + 1U);
+    }
+    return victim;
+}
+#endif
+
+void SD_ProfFileClose(const void *fp) {
+#if (SD_PROFILE_FILES > 0U)
+    SD_ProfBinding *b = (fp != NULL) ? SD_ProfFindBinding(fp) : NULL;
+    if (b != NULL) {
+        b->file->open_now--;
+        b->fp = NULL;
+        b->file = NULL;
+    }
+#else
+    (void)fp;
+#endif
+}
+
+void SD_ProfFileOpen(const void *fp, const char *path) {
+#if (SD_PROFILE_FILES > 0U)
+    if (fp == NULL || path == NULL) {
+        return;
+    }
+    SD_ProfFileClose(fp); /* a reused FIL that was never closed */
+    size_t len = strlen(path);
+    if (len >= SD_PROFILE_NAME) {
+        path += len - (SD_PROFILE_NAME - 1U);
+    }
+    SD_ProfBinding *b = SD_ProfFindBinding(NULL);
+    SD_ProfFileStats *f = (b != NULL) ? SD_ProfFileSlot(path) : NULL;
+    if (f != NULL) {
+        b->fp = fp;
+        b->file = f;
+        f->open_now++;
+    }
+#else
+    (void)fp;
+    (void)path;
+#endif
+}
+
+void SD_ProfFileBegin(SD_ProfApi api, const void *fp, uint32_t fptr) {
+#if (SD_PROFILE_FILES > 0U)
+    if (s_depth == 0U) {
+        SD_ProfBinding *b = (fp != NULL) ? SD_ProfFindBinding(fp) : NULL;
+        s_file = (b != NULL) ? b->file : NULL;
+        s_file_fp = fp;
+        s_file_fptr = fptr;
+    }
+#else
+    (void)fp;
+    (void)fptr;
+#endif
+    SD_ProfBegin(api);
+}
+
+void SD_ProfFileResult(int result) {
+    s_file_result = result;
+}
+
+int SD_ProfFileEnd(uint32_t fptr) {
+    int result = s_file_result;
+    SD_ProfApi api = s_api;
+    uint32_t cycles;
+    if (!SD_ProfFinish(result, &cycles)) {
+        return result;
+    }
+#if (SD_PROFILE_FILES > 0U)
+    SD_ProfFileStats *f = s_file;
+    s_file = NULL;
+    if (f == NULL) {
+        return result;
+    }
+    f->cycles += cycles;
+    if (api == SD_PROF_READ) {
+        f->bytes_read += fptr - s_file_fptr;
+    } else if (api == SD_PROF_WRITE) {
+        f->bytes_written += fptr - s_file_fptr;
+    } else if (api == SD_PROF_SYNC) {
+        f->syncs++;
+    } else if (api == SD_PROF_OPEN && result == 0) {
+        f->opens++;
+    }
+    if (api == SD_PROF_CLOSE || (api == SD_PROF_OPEN && result != 0)) {
+        SD_ProfFileClose(s_file_fp);
+    }
+#else
+    (void)fptr;
+    (void)api;
+#endif
+    return result;
+}
+
+const SD_ProfFileStats *SD_ProfFileGet(uint32_t index) {
+#if (SD_PROFILE_FILES > 0U)
+    if (index < SD_PROFILE_FILES && s_files[index].name[0] != '\0') {
+        return &s_files[index];
+    }
+#else
+    (void)index;
+#endif
+    return NULL;
+}
@@ -0,0 +1,432 @@
+/*
+ * sd_raid.c
+ *
+ * Striped and mirrored virtual block device over two SD handles, plus its
+ * FatFs diskio glue. Each request is split into one job per card; both jobs
+ * run at once when a worker task is available.
+ */
+
+#include "sd_raid.h"
+#include <string.h>
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#endif
+
+SD_RaidDevice g_sd_raid;
+
+/* One card's share of a request: a contiguous card range from buff or a block list. */
+typedef struct {
+    SD_Handle_t *sd;
+    uint8_t *buff; // Contiguous data, or NULL to use blocks
+    union {
+        uint8_t *rx[SD_RAID_MAX_BLOCKS];
+        const uint8_t *tx[SD_RAID_MAX_BLOCKS];
+    } blocks;
+    uint32_t sector;
+    uint32_t count;
+    bool write;
+    SD_Status status;
+} SD_RaidJob;
+
+/* Shared by all devices; the lock below serializes users under FreeRTOS. */
+static SD_RaidJob s_jobs[2];
+
+#if defined(USE_FREERTOS)
+static TaskHandle_t s_worker;
+static SemaphoreHandle_t s_lock;
+static SemaphoreHandle_t s_done;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_lock_buffer;
+static StaticSemaphore_t s_done_buffer;
+static StaticTask_t s_worker_buffer;
+static StackType_t s_worker_stack[SD_RAID_TASK_STACK];
+#endif
+#endif
+
+static void SD_RaidRun(SD_RaidJob *job) {
+    if (job->count == 0U) {
+        job->status = SD_OK;
+    } else if (job->buff) {
+        job->status = job->write ? SD_WriteBlocks(job->sd, job->buff, job->sector, job->count)
+                                 : SD_ReadBlocks(job->sd, job->buff, job->sector, job->count);
+    } else {
+        job->status = job->write
+                          ? SD_WriteBlocksGather(job->sd, job->blocks.tx, job->sector, job->count)
+                          : SD_ReadBlocksScatter(job->sd, job->blocks.rx, job->sector, job->count);
+    }
+}
+
+#if defined(USE_FREERTOS)
+/* Runs the second card's job while the caller runs the first. */
+static void SD_RaidWorker(void *argument) {
+    (void)argument;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        SD_RaidRun(&s_jobs[1]);
+        (void)xSemaphoreGive(s_done);
+    }
+}
+
+static SD_Status SD_RaidStart(void) {
+    if (s_worker != NULL) {
+        return SD_OK;
+    }
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
+    s_done = xSemaphoreCreateBinaryStatic(&s_done_buffer);
+    if (s_lock == NULL || s_done == NULL) {
+        return SD_ERROR;
+    }
+    s_worker = xTaskCreateStatic(SD_RaidWorker, "sd_raid", SD_RAID_TASK_STACK, NULL,
+                                 SD_RAID_TASK_PRIORITY, s_worker_stack, &s_worker_buffer);
+#else
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+    }
+    if (s_done == NULL) {
+        s_done = xSemaphoreCreateBinary();
+    }
+    if (s_lock == NULL || s_done == NULL) {
+        return SD_ERROR;
+    }
+    if (xTaskCreate(SD_RaidWorker, "sd_raid", SD_RAID_TASK_STACK, NULL, SD_RAID_TASK_PRIORITY,
+                    &s_worker) != pdPASS) {
+        s_worker = NULL;
+    }
+#endif
+    return (s_worker != NULL) ? SD_OK : SD_ERROR;
+}
+#endif
+
+static void SD_RaidLock(void) {
+#if defined(USE_FREERTOS)
+    (void)xSemaphoreTake(s_lock, portMAX_DELAY);
+#endif
+}
+
+static void SD_RaidUnlock(void) {
+#if defined(USE_FREERTOS)
+    (void)xSemaphoreGive(s_lock);
+#endif
+}
+
+/* Run both jobs, overlapped when the worker can take the second one. */
+static void SD_RaidDispatch(void) {
+#if defined(USE_FREERTOS)
+    if (s_jobs[0].count > 0U && s_jobs[1].count > 0U) {
+        (void)xTaskNotifyGive(s_worker);
+        SD_RaidRun(&s_jobs[0]);
+        (void)xSemaphoreTake(s_done, portMAX_DELAY);
+        return;
+    }
+#endif
+    SD_RaidRun(&s_jobs[0]);
+    SD_RaidRun(&s_jobs[1]);
+}
+
+static void SD_RaidJobReset(const SD_RaidDevice *raid, uint8_t *buff, uint32_t sector,
+                            uint32_t count, bool write) {
+    for (uint32_t m = 0; m < 2U; m++) {
+        s_jobs[m].sd = raid->member[m];
+        s_jobs[m].buff = buff;
+        s_jobs[m].sector = sector;
+        s_jobs[m].count = count;
+        s_jobs[m].write = write;
+        s_jobs[m].status = SD_OK;
+    }
+}
+
+static SD_Status SD_RaidJobStatus(void) {
+    return (s_jobs[0].status != SD_OK) ? s_jobs[0].status : s_jobs[1].status;
+}
+
+/*
+ * Striped transfer. Stripe unit u lives on card u & 1 at card sector
+ * (u >> 1) * stripe, so each card's share of a virtual range is one contiguous
+ * card range and goes out as a single scatter/gather command per pass.
+ */
+static SD_Status SD_RaidStripe(SD_RaidDevice *raid, uint8_t *buff, uint32_t sector,
+                               uint32_t count, bool write) {
+    uint32_t stripe = raid->stripe_sectors;
+
+    while (count > 0U) {
+        SD_RaidJobReset(raid, NULL, 0, 0, write);
+        while (count > 0U) {
+            uint32_t unit = sector / stripe;
+            uint32_t offset = sector % stripe;
+            SD_RaidJob *job = &s_jobs[unit & 1U];
+            uint32_t run = stripe - offset;
+            if (run > count) {
+                run = count;
+            }
+            if (run > SD_RAID_MAX_BLOCKS - job->count) {
+                run = SD_RAID_MAX_BLOCKS - job->count;
+            }
+            if (run == 0U) {
+                break; /* this card's list is full */
+            }
+            if (job->count == 0U) {
+                job->sector = ((unit >> 1) * stripe) + offset;
+            }
+            for (uint32_t i = 0; i < run; i++) {
+                job->blocks.rx[job->count++] = buff + (i * SD_BLOCK_SIZE);
+            }
+            sector += run;
+            count -= run;
+            buff += run * SD_BLOCK_SIZE;
+        }
+
+        SD_RaidDispatch();
+        SD_Status status = SD_RaidJobStatus();
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+    return SD_OK;
+}
+
+/* Mirrored read target: the card not currently in use, else alternate. */
+static uint32_t SD_RaidIdleMember(SD_RaidDevice *raid) {
+#if defined(USE_FREERTOS)
+    bool idle[2];
+    for (uint32_t m = 0; m < 2U; m++) {
+        SemaphoreHandle_t mutex = raid->member[m]->mutex;
+        idle[m] = (mutex == NULL) || (uxSemaphoreGetCount(mutex) > 0U);
+    }
+    if (idle[0] != idle[1]) {
+        return idle[0] ? 0U : 1U;
+    }
+#endif
+    uint32_t member = raid->next_read;
+    raid->next_read ^= 1U;
+    return member;
+}
+
+static SD_Status SD_RaidMirrorRead(SD_RaidDevice *raid, uint8_t *buff, uint32_t sector,
+                                   uint32_t count) {
+    uint32_t first = SD_RaidIdleMember(raid);
+    uint32_t lead = count - (count / 2U);
+
+    /* The idle card reads the first part; the other card reads the rest alongside. */
+    SD_RaidJobReset(raid, buff, sector, lead, false);
+    s_jobs[0].sd = raid->member[first];
+    s_jobs[1].sd = raid->member[first ^ 1U];
+    s_jobs[1].buff = buff + (lead * SD_BLOCK_SIZE);
+    s_jobs[1].sector = sector + lead;
+    s_jobs[1].count = count - lead;
+    SD_RaidDispatch();
+
+    /* Retry a failed part on the other copy. */
+    for (uint32_t j = 0; j < 2U; j++) {
+        if (s_jobs[j].status != SD_OK) {
+            s_jobs[j].sd = (s_jobs[j].sd == raid->member[0]) ? raid->member[1] : raid->member[0];
+            SD_RaidRun(&s_jobs[j]);
+        }
+    }
+    return SD_RaidJobStatus();
+}
+
+static SD_Status SD_RaidCheck(SD_RaidDevice *raid, const uint8_t *buff, uint32_t sector,
+                              uint32_t count) {
+    if (!raid || !raid->member[0] || !raid->member[1] || !buff || count == 0) {
+        return SD_PARAM;
+    }
+    uint32_t capacity = SD_RaidGetBlockCount(raid);
+    if (capacity > 0U && (sector >= capacity || count > capacity - sector)) {
+        return SD_PARAM;
+    }
+    return SD_OK;
+}
+
+SD_Status SD_RaidInit(SD_RaidDevice *raid, SD_RaidMode mode, SD_Handle_t *card_a,
+                      SD_Handle_t *card_b, uint32_t stripe_sectors) {
+    if (!raid || !card_a || !card_b || card_a == card_b || card_a->hspi == card_b->hspi ||
+        (mode == SD_RAID_STRIPE && stripe_sectors == 0U) ||
+        (mode != SD_RAID_STRIPE && mode != SD_RAID_MIRROR)) {
+        return SD_PARAM;
+    }
+#if defined(USE_FREERTOS)
+    if (SD_RaidStart() != SD_OK) {
+        return SD_ERROR;
+    }
+#endif
+    raid->member[0] = card_a;
+    raid->member[1] = card_b;
+    raid->mode = mode;
+    raid->stripe_sectors = (mode == SD_RAID_STRIPE) ? stripe_sectors : 0U;
+    raid->next_read = 0;
+    return SD_OK;
+}
+
+SD_Status SD_RaidRead(SD_RaidDevice *raid, uint8_t *buff, uint32_t sector, uint32_t count) {
+    SD_Status status = SD_RaidCheck(raid, buff, sector, count);
+    if (status != SD_OK) {
+        return status;
+    }
+    SD_RaidLock();
+    if (raid->mode == SD_RAID_STRIPE) {
+        status = SD_RaidStripe(raid, buff, sector, count, false);
+    } else {
+        status = SD_RaidMirrorRead(raid, buff, sector, count);
+    }
+    SD_RaidUnlock();
+    return status;
+}
+
+SD_Status SD_RaidWrite(SD_RaidDevice *raid, const uint8_t *buff, uint32_t sector,
+                       uint32_t count) {
+    SD_Status status = SD_RaidCheck(raid, buff, sector, count);
+    if (status != SD_OK) {
+        return status;
+    }
+    SD_RaidLock();
+    if (raid->mode == SD_RAID_STRIPE) {
+        status = SD_RaidStripe(raid, (uint8_t *)buff, sector, count, true); // only read
+    } else {
+        SD_RaidJobReset(raid, (uint8_t *)buff, sector, count, true); // only read
+        SD_RaidDispatch();
+        status = SD_RaidJobStatus();
+    }
+    SD_RaidUnlock();
+    return status;
+}
+
+SD_Status SD_RaidSync(SD_RaidDevice *raid) {
+    if (!raid || !raid->member[0] || !raid->member[1]) {
+        return SD_PARAM;
+    }
+    SD_Status status = SD_Sync(raid->member[0]);
+    SD_Status other = SD_Sync(raid->member[1]);
+    return (status != SD_OK) ? status : other;
+}
+
+uint32_t SD_RaidGetBlockCount(SD_RaidDevice *raid) {
+    if (!raid || !raid->member[0] || !raid->member[1]) {
+        return 0;
+    }
+    uint32_t a = SD_GetBlockCount(raid->member[0]);
+    uint32_t b = SD_GetBlockCount(raid->member[1]);
+    uint32_t smaller = (a < b) ? a : b;
+    if (raid->mode == SD_RAID_MIRROR) {
+        return smaller;
+    }
+
+    uint64_t pair = 2ULL * raid->stripe_sectors;
+    uint64_t total = (smaller / raid->stripe_sectors) * pair;
+    if (total > UINT32_MAX) {
+        total = (UINT32_MAX / pair) * pair; /* sector numbers are 32-bit */
+    }
+    return (uint32_t)total;
+}
+
+/* -----------------------------------------------------------------------
+ * FatFs diskio glue for g_sd_raid
+ * ----------------------------------------------------------------------- */
+
+static DRESULT SD_raid_result(SD_Status status) {
+    if (status == SD_OK) {
+        return RES_OK;
+    }
+    if (status == SD_PARAM) {
+        return RES_PARERR;
+    }
+    if (status == SD_NO_MEDIA || status == SD_BUSY) {
+        return RES_NOTRDY;
+    }
+    return RES_ERROR;
+}
+
+static DSTATUS SD_raid_status(BYTE pdrv) {
+    if (pdrv != 0 || !g_sd_raid.member[0]) {
+        return STA_NOINIT;
+    }
+    DSTATUS status = 0;
+    for (uint32_t m = 0; m < 2U; m++) {
+        if (!SD_IsCardPresent(g_sd_raid.member[m])) {
+            status |= STA_NODISK | STA_NOINIT;
+        } else if (!SD_IsInitialized(g_sd_raid.member[m])) {
+            status |= STA_NOINIT;
+        }
+    }
+    return status;
+}
+
+static DSTATUS SD_raid_initialize(BYTE pdrv) {
+    if (pdrv != 0 || !g_sd_raid.member[0]) {
+        return STA_NOINIT;
+    }
+    for (uint32_t m = 0; m < 2U; m++) {
+        if (!SD_IsCardPresent(g_sd_raid.member[m])) {
+            return STA_NODISK | STA_NOINIT;
+        }
+        if (SD_SPI_Init(g_sd_raid.member[m]) != SD_OK) {
+            return STA_NOINIT;
+        }
+    }
+    return 0;
+}
+
+static DRESULT SD_raid_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    if (pdrv != 0) {
+        return RES_PARERR;
+    }
+    if (SD_raid_status(pdrv) != 0) {
+        return RES_NOTRDY;
+    }
+    return SD_raid_result(SD_RaidRead(&g_sd_raid, buff, sector, count));
+}
+
+#if _USE_WRITE
+static DRESULT SD_raid_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    if (pdrv != 0) {
+        return RES_PARERR;
+    }
+    if (SD_raid_status(pdrv) != 0) {
+        return RES_NOTRDY;
+    }
+    return SD_raid_result(SD_RaidWrite(&g_sd_raid, (const uint8_t *)buff, sector, count));
+}
+#endif
+
+#if _USE_IOCTL
+static DRESULT SD_raid_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    if (pdrv != 0 || !g_sd_raid.member[0]) {
+        return RES_PARERR;
+    }
+
+    switch (cmd) {
+    case CTRL_SYNC:
+        return SD_raid_result(SD_RaidSync(&g_sd_raid));
+    case GET_SECTOR_SIZE:
+        if (buff == NULL) return RES_PARERR;
+        *(WORD *)buff = SD_BLOCK_SIZE;
+        return RES_OK;
+    case GET_SECTOR_COUNT:
+        if (buff == NULL) return RES_PARERR;
+        *(DWORD *)buff = SD_RaidGetBlockCount(&g_sd_raid);
+        return (*(DWORD *)buff > 0) ? RES_OK : RES_ERROR;
+    case GET_BLOCK_SIZE:
+        if (buff == NULL) return RES_PARERR;
+        *(DWORD *)buff = 1;
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
+}
+#endif
+
+const Diskio_drvTypeDef SD_RaidDriver = {
+    SD_raid_initialize,
+    SD_raid_status,
+    SD_raid_read,
+#if _USE_WRITE
+    SD_raid_write,
+#endif
+#if _USE_IOCTL
+    SD_raid_ioctl,
+#endif
+};
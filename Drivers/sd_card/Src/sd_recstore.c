@@ -0,0 +1,495 @@
+/*
+ * sd_recstore.c
+ *
+ * Append-only record store: contiguous file from f_expand, pages written and
+ * read with disk_write/disk_read, write pointer in the file's first sector.
+ */
+
+#include "sd_recstore.h"
+#include "diskio.h"
+#include <string.h>
+
+#define SD_RS_PAGE_MAGIC 0x47505352UL /* "RSPG" */
+#define SD_RS_HEAD_MAGIC 0x44485352UL /* "RSHD" */
+#define SD_RS_VERSION    1U
+#define SD_RS_FLAG_WRAP  0x01U
+
+/* Page header: magic, epoch, seq, count (16), record size (16), first/last timestamp, CRC. */
+#define SD_RS_PG_EPOCH 4U
+#define SD_RS_PG_SEQ   8U
+#define SD_RS_PG_COUNT 12U
+#define SD_RS_PG_SIZE  14U
+#define SD_RS_PG_FIRST 16U
+#define SD_RS_PG_LAST  20U
+#define SD_RS_PG_CRC   24U
+
+/* Store header: magic, version, epoch, record size, pages, write pointer, flags, CRC. */
+#define SD_RS_HD_VERSION 4U
+#define SD_RS_HD_EPOCH   8U
+#define SD_RS_HD_SIZE    12U
+#define SD_RS_HD_PAGES   16U
+#define SD_RS_HD_HEAD    20U
+#define SD_RS_HD_FLAGS   24U
+#define SD_RS_HD_CRC     28U
+
+#if (_MAX_SS == _MIN_SS)
+#define SD_RS_SS(fs) ((uint32_t)_MAX_SS)
+#else
+#define SD_RS_SS(fs) ((uint32_t)(fs)->ssize)
+#endif
+
+#define SD_RS_NONE UINT32_MAX
+
+static void sd_rs_put16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void sd_rs_put32(uint8_t *p, uint32_t v) {
+    sd_rs_put16(p, v);
+    sd_rs_put16(p + 2, v >> 16);
+}
+
+static uint32_t sd_rs_get16(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t sd_rs_get32(const uint8_t *p) {
+    return sd_rs_get16(p) | (sd_rs_get16(p + 2) << 16);
+}
+
+/* CRC-32 (IEEE, reflected), four bits per step from a 64-byte table. */
+static uint32_t sd_rs_crc(uint32_t crc, const uint8_t *p, uint32_t len) {
+    static const uint32_t table[16] = {
+        0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+        0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+        0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+        0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL,
+    };
+    while (len-- > 0U) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0x0FU];
+        crc = (crc >> 4) ^ table[crc & 0x0FU];
+    }
+    return crc;
+}
+
+/* Everything but the CRC field itself. */
+static uint32_t sd_rs_page_crc(const uint8_t *page, uint32_t ss) {
+    uint32_t crc = sd_rs_crc(0xFFFFFFFFUL, page, SD_RS_PG_CRC);
+    crc = sd_rs_crc(crc, page + SD_RECSTORE_PAGE_HEADER, ss - SD_RECSTORE_PAGE_HEADER);
+    return ~crc;
+}
+
+static uint32_t sd_rs_record_bytes(const SD_RecStore *rs) {
+    return 4U + rs->record_size;
+}
+
+static const uint8_t *sd_rs_record(const SD_RecStore *rs, const uint8_t *page, uint32_t k) {
+    return page + SD_RECSTORE_PAGE_HEADER + (k * sd_rs_record_bytes(rs));
+}
+
+/* Sequence of the oldest page held; the page being filled replaces the one a wrap lapped. */
+static uint32_t sd_rs_oldest(const SD_RecStore *rs) {
+    return (rs->wrap && rs->head >= rs->pages) ? rs->head - rs->pages + 1U : 0U;
+}
+
+/* One past the newest page holding records. */
+static uint32_t sd_rs_end(const SD_RecStore *rs) {
+    return rs->head + ((rs->fill > 0U) ? 1U : 0U);
+}
+
+static uint32_t sd_rs_page_sector(const SD_RecStore *rs, uint32_t seq) {
+    return rs->first_sector + 1U + (seq % rs->pages);
+}
+
+/*
+ * Sector I/O under the volume lock: the diskio caches behind the drive are
+ * otherwise serialized by FatFs.
+ */
+static FRESULT sd_rs_io(SD_RecStore *rs, bool write, uint8_t *buf, uint32_t sector) {
+#if _FS_REENTRANT
+    if (!ff_req_grant(rs->fs->sobj)) {
+        return FR_TIMEOUT;
+    }
+#endif
+    DRESULT res = write ? disk_write(rs->fs->drv, buf, sector, 1U)
+                        : disk_read(rs->fs->drv, buf, sector, 1U);
+#if _FS_REENTRANT
+    ff_rel_grant(rs->fs->sobj);
+#endif
+    return (res == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+static FRESULT sd_rs_write_header(SD_RecStore *rs) {
+    uint8_t *h = rs->rpage;
+    rs->cached = SD_RS_NONE;
+    memset(h, 0, SD_RS_SS(rs->fs));
+    sd_rs_put32(h, SD_RS_HEAD_MAGIC);
+    sd_rs_put32(h + SD_RS_HD_VERSION, SD_RS_VERSION);
+    sd_rs_put32(h + SD_RS_HD_EPOCH, rs->epoch);
+    sd_rs_put32(h + SD_RS_HD_SIZE, rs->record_size);
+    sd_rs_put32(h + SD_RS_HD_PAGES, rs->pages);
+    sd_rs_put32(h + SD_RS_HD_HEAD, rs->head);
+    sd_rs_put32(h + SD_RS_HD_FLAGS, rs->wrap ? SD_RS_FLAG_WRAP : 0U);
+    sd_rs_put32(h + SD_RS_HD_CRC, ~sd_rs_crc(0xFFFFFFFFUL, h, SD_RS_HD_CRC));
+    FRESULT res = sd_rs_io(rs, true, h, rs->first_sector);
+    if (res == FR_OK) {
+        rs->stats.header_writes++;
+    }
+    return res;
+}
+
+/* Seal and write the page being filled. */
+static FRESULT sd_rs_write_page(SD_RecStore *rs) {
+    uint8_t *p = rs->page;
+    sd_rs_put32(p, SD_RS_PAGE_MAGIC);
+    sd_rs_put32(p + SD_RS_PG_EPOCH, rs->epoch);
+    sd_rs_put32(p + SD_RS_PG_SEQ, rs->head);
+    sd_rs_put16(p + SD_RS_PG_COUNT, rs->fill);
+    sd_rs_put16(p + SD_RS_PG_SIZE, rs->record_size);
+    sd_rs_put32(p + SD_RS_PG_FIRST, sd_rs_get32(sd_rs_record(rs, p, 0)));
+    sd_rs_put32(p + SD_RS_PG_LAST, sd_rs_get32(sd_rs_record(rs, p, rs->fill - 1U)));
+    sd_rs_put32(p + SD_RS_PG_CRC, sd_rs_page_crc(p, SD_RS_SS(rs->fs)));
+    if (rs->cached != SD_RS_NONE && (rs->cached % rs->pages) == (rs->head % rs->pages)) {
+        rs->cached = SD_RS_NONE;
+    }
+    FRESULT res = sd_rs_io(rs, true, p, sd_rs_page_sector(rs, rs->head));
+    if (res == FR_OK) {
+        rs->stats.page_writes++;
+    }
+    return res;
+}
+
+static bool sd_rs_page_valid(const SD_RecStore *rs, const uint8_t *p, uint32_t seq) {
+    uint32_t count = sd_rs_get16(p + SD_RS_PG_COUNT);
+    return sd_rs_get32(p) == SD_RS_PAGE_MAGIC && sd_rs_get32(p + SD_RS_PG_EPOCH) == rs->epoch &&
+           sd_rs_get32(p + SD_RS_PG_SEQ) == seq && count > 0U && count <= rs->per_page &&
+           sd_rs_get16(p + SD_RS_PG_SIZE) == rs->record_size &&
+           sd_rs_get32(p + SD_RS_PG_CRC) == sd_rs_page_crc(p, SD_RS_SS(rs->fs));
+}
+
+/*
+ * Page seq and its record count: the RAM page while it is being filled,
+ * otherwise read into rpage (kept for the next lookup). FR_NO_FILE when the
+ * page on the card does not belong to seq.
+ */
+static FRESULT sd_rs_page(SD_RecStore *rs, uint32_t seq, const uint8_t **page, uint32_t *count) {
+    if (seq == rs->head) {
+        *page = rs->page;
+        *count = rs->fill;
+        return FR_OK;
+    }
+    if (rs->cached != seq) {
+        rs->cached = SD_RS_NONE;
+        FRESULT res = sd_rs_io(rs, false, rs->rpage, sd_rs_page_sector(rs, seq));
+        if (res != FR_OK) {
+            return res;
+        }
+        if (!sd_rs_page_valid(rs, rs->rpage, seq)) {
+            return FR_NO_FILE;
+        }
+        rs->cached = seq;
+    }
+    *page = rs->rpage;
+    *count = sd_rs_get16(rs->rpage + SD_RS_PG_COUNT);
+    return FR_OK;
+}
+
+/* Scan forward from the recorded write pointer to the last intact page. */
+static FRESULT sd_rs_recover(SD_RecStore *rs) {
+    uint32_t seq = rs->head;
+    for (uint32_t scanned = 0; scanned < rs->pages; scanned++) {
+        if (!rs->wrap && seq >= rs->pages) {
+            break;
+        }
+        FRESULT res = sd_rs_io(rs, false, rs->page, sd_rs_page_sector(rs, seq));
+        if (res != FR_OK) {
+            return res;
+        }
+        if (!sd_rs_page_valid(rs, rs->page, seq)) {
+            break;
+        }
+        rs->stats.recovered_pages++;
+        uint32_t count = sd_rs_get16(rs->page + SD_RS_PG_COUNT);
+        rs->last_ts = sd_rs_get32(rs->page + SD_RS_PG_LAST);
+        if (count < rs->per_page) {
+            rs->head = seq;
+            rs->fill = count; /* keep filling the partial page */
+            return FR_OK;
+        }
+        seq++;
+    }
+    rs->head = seq;
+    rs->fill = 0;
+    memset(rs->page, 0, SD_RS_SS(rs->fs));
+    if (rs->stats.recovered_pages == 0U && seq > sd_rs_oldest(rs)) {
+        const uint8_t *prev;
+        uint32_t count;
+        if (sd_rs_page(rs, seq - 1U, &prev, &count) == FR_OK) {
+            rs->last_ts = sd_rs_get32(prev + SD_RS_PG_LAST);
+        }
+    }
+    return FR_OK;
+}
+
+/*
+ * True if the file's first sector holds a store header for record_size.
+ * *epoch gets the epoch of any intact header, matching or not.
+ */
+static bool sd_rs_read_header(SD_RecStore *rs, uint32_t record_size, FSIZE_t size,
+                              uint32_t *epoch) {
+    uint32_t ss = SD_RS_SS(rs->fs);
+    uint8_t *h = rs->rpage;
+    if (size < 2U * ss || sd_rs_io(rs, false, h, rs->first_sector) != FR_OK ||
+        sd_rs_get32(h) != SD_RS_HEAD_MAGIC || sd_rs_get32(h + SD_RS_HD_VERSION) != SD_RS_VERSION ||
+        sd_rs_get32(h + SD_RS_HD_CRC) != ~sd_rs_crc(0xFFFFFFFFUL, h, SD_RS_HD_CRC)) {
+        return false;
+    }
+    *epoch = sd_rs_get32(h + SD_RS_HD_EPOCH);
+    uint32_t pages = sd_rs_get32(h + SD_RS_HD_PAGES);
+    if (sd_rs_get32(h + SD_RS_HD_SIZE) != record_size || pages == 0U ||
+        (FSIZE_t)(pages + 1U) * ss > size) {
+        return false;
+    }
+    rs->pages = pages;
+    rs->head = sd_rs_get32(h + SD_RS_HD_HEAD);
+    rs->wrap = (sd_rs_get32(h + SD_RS_HD_FLAGS) & SD_RS_FLAG_WRAP) != 0U;
+    return true;
+}
+
+static uint32_t sd_rs_first_sector(const SD_RecStore *rs) {
+    return rs->fs->database + (rs->fil.obj.sclust - 2U) * rs->fs->csize;
+}
+
+int sd_recstore_open(SD_RecStore *rs, const char *path, uint32_t record_size, uint32_t bytes,
+                     bool wrap) {
+    if (rs == NULL || path == NULL || record_size == 0U) {
+        return FR_INVALID_PARAMETER;
+    }
+    memset(rs, 0, sizeof(*rs));
+    rs->cached = SD_RS_NONE;
+
+    FRESULT res = f_open(&rs->fil, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if (res != FR_OK) {
+        return res;
+    }
+    rs->fs = rs->fil.obj.fs;
+    uint32_t ss = SD_RS_SS(rs->fs);
+    if (record_size + 4U > ss - SD_RECSTORE_PAGE_HEADER) {
+        (void)f_close(&rs->fil);
+        return FR_INVALID_PARAMETER;
+    }
+    rs->record_size = record_size;
+    rs->per_page = (ss - SD_RECSTORE_PAGE_HEADER) / sd_rs_record_bytes(rs);
+
+    uint32_t epoch = 0;
+    bool stale = false;
+    if (rs->fil.obj.sclust >= 2U) {
+        rs->first_sector = sd_rs_first_sector(rs);
+        if (sd_rs_read_header(rs, record_size, f_size(&rs->fil), &epoch)) {
+            rs->epoch = epoch;
+            res = sd_rs_recover(rs);
+            if (res != FR_OK) {
+                (void)f_close(&rs->fil);
+                return res;
+            }
+            rs->open = true;
+            return FR_OK;
+        }
+        stale = (epoch != 0U);
+    }
+
+#if _USE_EXPAND
+    /* New store: one contiguous run, committed to the directory once. */
+    uint32_t pages = bytes / ss;
+    if (pages < 2U) {
+        (void)f_close(&rs->fil);
+        return FR_INVALID_PARAMETER;
+    }
+    res = f_truncate(&rs->fil);
+    if (res == FR_OK) {
+        res = f_expand(&rs->fil, (FSIZE_t)pages * ss, 1);
+    }
+    if (res == FR_OK) {
+        res = f_sync(&rs->fil);
+    }
+    if (res != FR_OK) {
+        (void)f_close(&rs->fil);
+        return res;
+    }
+    rs->first_sector = sd_rs_first_sector(rs);
+    rs->pages = pages - 1U;
+    rs->wrap = wrap;
+    /* Pages of an earlier store at this spot must not pass for ours. */
+    rs->epoch = stale ? epoch + 1U : ((HAL_GetTick() * 2654435761UL) ^ rs->first_sector);
+    res = sd_rs_write_header(rs);
+    if (res != FR_OK) {
+        (void)f_close(&rs->fil);
+        return res;
+    }
+    rs->open = true;
+    return FR_OK;
+#else
+    (void)bytes;
+    (void)wrap;
+    (void)stale;
+    (void)f_close(&rs->fil);
+    return FR_NOT_ENABLED;
+#endif
+}
+
+int sd_recstore_append(SD_RecStore *rs, uint32_t timestamp, const void *record) {
+    if (rs == NULL || !rs->open || record == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (timestamp < rs->last_ts) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (!rs->wrap && rs->head >= rs->pages) {
+        return FR_DENIED;
+    }
+
+    uint8_t *slot = (uint8_t *)sd_rs_record(rs, rs->page, rs->fill);
+    sd_rs_put32(slot, timestamp);
+    memcpy(slot + 4, record, rs->record_size);
+    rs->fill++;
+    if (rs->fill < rs->per_page) {
+        rs->last_ts = timestamp;
+        return FR_OK;
+    }
+
+    FRESULT res = sd_rs_write_page(rs);
+    if (res != FR_OK) {
+        rs->fill--; /* not stored; the caller may retry */
+        return res;
+    }
+    rs->last_ts = timestamp;
+    rs->head++;
+    rs->fill = 0;
+    memset(rs->page, 0, SD_RS_SS(rs->fs));
+    if ((rs->head % SD_RECSTORE_HEADER_PAGES) == 0U) {
+        res = sd_rs_write_header(rs);
+    }
+    return res;
+}
+
+int sd_recstore_flush(SD_RecStore *rs) {
+    if (rs == NULL || !rs->open) {
+        return FR_INVALID_PARAMETER;
+    }
+    if (rs->fill > 0U) {
+        FRESULT res = sd_rs_write_page(rs);
+        if (res != FR_OK) {
+            return res;
+        }
+    }
+#if _FS_REENTRANT
+    if (!ff_req_grant(rs->fs->sobj)) {
+        return FR_TIMEOUT;
+    }
+#endif
+    DRESULT res = disk_ioctl(rs->fs->drv, CTRL_SYNC, NULL);
+#if _FS_REENTRANT
+    ff_rel_grant(rs->fs->sobj);
+#endif
+    return (res == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+int sd_recstore_close(SD_RecStore *rs) {
+    if (rs == NULL || !rs->open) {
+        return FR_INVALID_PARAMETER;
+    }
+    FRESULT res = sd_rs_write_header(rs);
+    FRESULT flushed = sd_recstore_flush(rs);
+    if (res == FR_OK) {
+        res = flushed;
+    }
+    FRESULT closed = f_close(&rs->fil);
+    rs->open = false;
+    return (res != FR_OK) ? res : closed;
+}
+
+int sd_recstore_find(SD_RecStore *rs, uint32_t timestamp, uint32_t *index) {
+    if (rs == NULL || !rs->open || index == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    const uint8_t *page;
+    uint32_t count;
+    uint32_t lo = sd_rs_oldest(rs);
+    uint32_t hi = sd_rs_end(rs);
+
+    /* First page whose newest record is not older than timestamp. */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        FRESULT res = sd_rs_page(rs, mid, &page, &count);
+        if (res != FR_OK) {
+            return FR_DISK_ERR;
+        }
+        if (sd_rs_get32(sd_rs_record(rs, page, count - 1U)) < timestamp) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == sd_rs_end(rs)) {
+        *index = rs->head * rs->per_page + rs->fill;
+        return FR_OK;
+    }
+
+    FRESULT res = sd_rs_page(rs, lo, &page, &count);
+    if (res != FR_OK) {
+        return FR_DISK_ERR;
+    }
+    uint32_t first = 0;
+    uint32_t last = count - 1U; /* holds a match */
+    while (first < last) {
+        uint32_t mid = first + (last - first) / 2U;
+        if (sd_rs_get32(sd_rs_record(rs, page, mid)) < timestamp) {
+            first = mid + 1U;
+        } else {
+            last = mid;
+        }
+    }
+    *index = lo * rs->per_page + first;
+    return FR_OK;
+}
+
+int sd_recstore_read(SD_RecStore *rs, uint32_t index, uint32_t *timestamp, void *record) {
+    if (rs == NULL || !rs->open) {
+        return FR_INVALID_PARAMETER;
+    }
+    uint32_t seq = index / rs->per_page;
+    uint32_t k = index % rs->per_page;
+    if (seq < sd_rs_oldest(rs) || seq >= sd_rs_end(rs)) {
+        return FR_NO_FILE;
+    }
+    const uint8_t *page;
+    uint32_t count;
+    FRESULT res = sd_rs_page(rs, seq, &page, &count);
+    if (res != FR_OK) {
+        return FR_DISK_ERR;
+    }
+    if (k >= count) {
+        return FR_NO_FILE;
+    }
+    const uint8_t *slot = sd_rs_record(rs, page, k);
+    if (timestamp != NULL) {
+        *timestamp = sd_rs_get32(slot);
+    }
+    if (record != NULL) {
+        memcpy(record, slot + 4, rs->record_size);
+    }
+    return FR_OK;
+}
+
+void sd_recstore_get_stats(const SD_RecStore *rs, SD_RecStoreStats *out) {
+    if (rs == NULL || out == NULL) {
+        return;
+    }
+    *out = rs->stats;
+    out->first_index = sd_rs_oldest(rs) * rs->per_page;
+    out->records = rs->head * rs->per_page + rs->fill - out->first_index;
+    out->pages = rs->pages;
+    out->per_page = rs->per_page;
+}
@@ -0,0 +1,191 @@
+/*
+ * sd_rtstats.c
+ *
+ * Run-time counter for FreeRTOS and the SD interval report. The counter
+ * divides the DWT cycle count (or a TIM count) down to SD_RTSTATS_HZ,
+ * carrying the remainder, and widens it to 32 bits across hardware wraps.
+ */
+
+#include "sd_rtstats.h"
+
+#if defined(USE_FREERTOS)
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sd_async.h"
+#include <stdio.h>
+#include <string.h>
+
+#if (configGENERATE_RUN_TIME_STATS == 1)
+
+#if (configUSE_TRACE_FACILITY != 1)
+#error "sd_rtstats needs configUSE_TRACE_FACILITY 1 (vTaskGetInfo)"
+#endif
+
+#ifdef SD_RTSTATS_TIM
+#define SD_RTSTATS_MASK ((SD_RTSTATS_TIM_BITS == 32U) ? 0xFFFFFFFFUL : 0xFFFFUL)
+
+static uint32_t SD_RtSource(void) {
+    return (uint32_t)SD_RTSTATS_TIM->CNT;
+}
+#else
+#define SD_RTSTATS_MASK 0xFFFFFFFFUL
+
+static uint32_t SD_RtSource(void) {
+    return DWT->CYCCNT;
+}
+#endif
+
+/* Driver wait figures, in cycles, as read from SD_Stats. */
+typedef struct {
+    uint32_t dma_waits;
+    uint64_t dma_cycles;
+    uint32_t ready_waits;
+    uint64_t ready_cycles;
+    uint64_t sleep_cycles;
+} SD_RtWaits;
+
+static uint32_t s_last;  // Source count at the last sd_rtstats_counter
+static uint32_t s_div;   // Source counts per tick
+static uint32_t s_rem;   // Source counts not yet making up a tick
+static uint32_t s_ticks;
+
+static const SD_Handle_t *s_sd;
+static TaskHandle_t s_task;
+static uint32_t s_mark_ticks;
+static uint32_t s_mark_task;
+static SD_RtWaits s_mark_waits;
+static bool s_marked;
+
+void sd_rtstats_timer_init(void) {
+#ifdef SD_RTSTATS_TIM
+    s_div = 1U;
+#else
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    s_div = SystemCoreClock / SD_RTSTATS_HZ;
+    if (s_div == 0U) {
+        s_div = 1U;
+    }
+#endif
+    s_rem = 0;
+    s_ticks = 0;
+    s_last = SD_RtSource();
+}
+
+/* Called from the context switch and from tasks; the FROM_ISR mask works in both. */
+uint32_t sd_rtstats_counter(void) {
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    uint32_t now = SD_RtSource();
+    uint32_t delta = (now - s_last) & SD_RTSTATS_MASK;
+    s_last = now;
+    s_ticks += delta / s_div;
+    s_rem += delta % s_div;
+    if (s_rem >= s_div) {
+        s_rem -= s_div;
+        s_ticks++;
+    }
+    uint32_t ticks = s_ticks;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+    return ticks;
+}
+
+static void SD_RtReadWaits(const SD_Handle_t *sd_handle, SD_RtWaits *out) {
+    memset(out, 0, sizeof(*out));
+#if (SD_LATENCY_STATS == 1)
+    if (sd_handle != NULL) {
+        out->dma_waits = sd_handle->stats.latency[SD_LAT_DMA].count;
+        out->dma_cycles = sd_handle->stats.latency[SD_LAT_DMA].total_cycles;
+        out->ready_waits = sd_handle->stats.latency[SD_LAT_BUSY].count;
+        out->ready_cycles = sd_handle->stats.latency[SD_LAT_BUSY].total_cycles;
+        out->sleep_cycles = sd_handle->stats.busy_sleep_cycles;
+    }
+#else
+    (void)sd_handle;
+#endif
+}
+
+static uint32_t SD_RtTaskTicks(TaskHandle_t task) {
+    TaskStatus_t status;
+    if (task == NULL) {
+        return 0U;
+    }
+    vTaskGetInfo(task, &status, pdFALSE, eRunning);
+    return status.ulRunTimeCounter;
+}
+
+/* SD_ResetStats since the mark restarts the figures from zero. */
+static uint64_t SD_RtSince(uint64_t now, uint64_t mark) {
+    return (now >= mark) ? (now - mark) : now;
+}
+
+static uint32_t SD_RtCyclesToUs(uint64_t cycles) {
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    return (uint32_t)(cycles / ((per_us != 0U) ? per_us : 1U));
+}
+
+static uint32_t SD_RtTicksToUs(uint32_t ticks) {
+    return (uint32_t)(((uint64_t)ticks * 1000000U) / SD_RTSTATS_HZ);
+}
+
+void sd_rtstats_mark(const SD_Handle_t *sd_handle, TaskHandle_t task) {
+    s_sd = sd_handle;
+    s_task = (task != NULL) ? task : SD_AsyncTaskHandle();
+    SD_RtReadWaits(sd_handle, &s_mark_waits);
+    s_mark_task = SD_RtTaskTicks(s_task);
+    s_mark_ticks = sd_rtstats_counter();
+    s_marked = true;
+}
+
+bool sd_rtstats_get(SD_RtStats *out) {
+    SD_RtWaits now;
+    if (out == NULL || !s_marked) {
+        return false;
+    }
+    uint32_t ticks = sd_rtstats_counter() - s_mark_ticks;
+    uint32_t task = SD_RtTaskTicks(s_task) - s_mark_task;
+    SD_RtReadWaits(s_sd, &now);
+
+    memset(out, 0, sizeof(*out));
+    out->elapsed_us = SD_RtTicksToUs(ticks);
+    out->task_us = SD_RtTicksToUs(task);
+    out->task_permille = (ticks != 0U) ? (uint16_t)(((uint64_t)task * 1000U) / ticks) : 0U;
+    out->dma_waits = (uint32_t)SD_RtSince(now.dma_waits, s_mark_waits.dma_waits);
+    out->dma_wait_us = SD_RtCyclesToUs(SD_RtSince(now.dma_cycles, s_mark_waits.dma_cycles));
+    out->ready_waits = (uint32_t)SD_RtSince(now.ready_waits, s_mark_waits.ready_waits);
+    uint64_t ready = SD_RtSince(now.ready_cycles, s_mark_waits.ready_cycles);
+    uint64_t slept = SD_RtSince(now.sleep_cycles, s_mark_waits.sleep_cycles);
+    if (slept > ready) {
+        slept = ready;
+    }
+    out->ready_spin_us = SD_RtCyclesToUs(ready - slept);
+    out->ready_sleep_us = SD_RtCyclesToUs(slept);
+    return true;
+}
+
+#else
+
+void sd_rtstats_mark(const SD_Handle_t *sd_handle, TaskHandle_t task) {
+    (void)sd_handle;
+    (void)task;
+}
+
+bool sd_rtstats_get(SD_RtStats *out) {
+    (void)out;
+    return false;
+}
+
+#endif /* configGENERATE_RUN_TIME_STATS */
+
+void sd_rtstats_report(void) {
+    SD_RtStats st;
+    if (!sd_rtstats_get(&st)) {
+        printf("SDRTSTATS,unavailable\r\n");
+        return;
+    }
+    printf("SDRTSTATS,%lu,%lu,%u,%lu,%lu,%lu,%lu,%lu\r\n", (unsigned long)st.elapsed_us,
+           (unsigned long)st.task_us, (unsigned)st.task_permille, (unsigned long)st.dma_waits,
+           (unsigned long)st.dma_wait_us, (unsigned long)st.ready_waits,
+           (unsigned long)st.ready_spin_us, (unsigned long)st.ready_sleep_us);
+}
+
+#endif /* USE_FREERTOS */
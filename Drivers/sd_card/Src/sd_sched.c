@@ -0,0 +1,233 @@
+/*
+ * sd_sched.c
+ *
+ * Pending-request pool with elevator ordering, priority classes, starvation
+ * and deadline promotion, and adjacent-request merging.
+ */
+
+#include "sd_sched.h"
+#include <string.h>
+
+#define SD_SCHED_NONE SD_SCHED_SLOTS
+
+static bool SD_SchedUsed(const SD_Scheduler *sched, uint32_t slot) {
+    return (sched->used & (1UL << slot)) != 0U;
+}
+
+/* True when a arrived before b (sequence numbers may wrap). */
+static bool SD_SchedOlder(const SD_Scheduler *sched, uint32_t a, uint32_t b) {
+    return (int32_t)(sched->seq[a] - sched->seq[b]) < 0;
+}
+
+static bool SD_SchedOverlap(const SD_IoRequest *a, const SD_IoRequest *b) {
+    return (a->sd_handle == b->sd_handle) && (a->sector < b->sector + b->count) &&
+           (b->sector < a->sector + a->count);
+}
+
+/* An older pending request outside ignore_mask conflicts with this slot. */
+static bool SD_SchedBlocked(const SD_Scheduler *sched, uint32_t slot, uint32_t ignore_mask) {
+    const SD_IoRequest *request = &sched->req[slot];
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (i == slot || !SD_SchedUsed(sched, i) || (ignore_mask & (1UL << i)) != 0U) {
+            continue;
+        }
+        const SD_IoRequest *other = &sched->req[i];
+        if (SD_SchedOlder(sched, i, slot) && (other->write || request->write) &&
+            SD_SchedOverlap(other, request)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Milliseconds until a request is due (negative once late). */
+static int32_t SD_SchedSlack(const SD_Scheduler *sched, uint32_t slot) {
+    return (int32_t)(sched->req[slot].deadline - sched->now);
+}
+
+static bool SD_SchedUrgent(const SD_Scheduler *sched, uint32_t slot) {
+    return sched->req[slot].has_deadline &&
+           SD_SchedSlack(sched, slot) <= (int32_t)SD_SCHED_URGENT_MS;
+}
+
+static uint32_t SD_SchedOldest(const SD_Scheduler *sched) {
+    uint32_t oldest = SD_SCHED_NONE;
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (SD_SchedUsed(sched, i) &&
+            (oldest == SD_SCHED_NONE || SD_SchedOlder(sched, i, oldest))) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+void SD_SchedInit(SD_Scheduler *sched, SD_SchedPolicy policy) {
+    if (!sched) {
+        return;
+    }
+    memset(sched, 0, sizeof(*sched));
+    sched->policy = policy ? policy : SD_SchedElevator;
+}
+
+SD_Status SD_SchedAdd(SD_Scheduler *sched, const SD_IoRequest *request) {
+    if (!sched || !request || !request->sd_handle || !request->buff || request->count == 0) {
+        return SD_PARAM;
+    }
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (!SD_SchedUsed(sched, i)) {
+            sched->req[i] = *request;
+            sched->seq[i] = sched->next_seq++;
+            sched->skipped[i] = 0;
+            sched->used |= (1UL << i);
+            return SD_OK;
+        }
+    }
+    return SD_BUSY;
+}
+
+uint32_t SD_SchedPending(const SD_Scheduler *sched) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; sched && i < SD_SCHED_SLOTS; i++) {
+        count += SD_SchedUsed(sched, i) ? 1U : 0U;
+    }
+    return count;
+}
+
+uint32_t SD_SchedTakeExpired(SD_Scheduler *sched, uint32_t now, SD_IoRequest *expired,
+                             uint32_t max_expired) {
+    if (!sched || !expired) {
+        return 0;
+    }
+    uint32_t n = 0;
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS && n < max_expired; i++) {
+        if (SD_SchedUsed(sched, i) && sched->req[i].has_deadline &&
+            (int32_t)(now - sched->req[i].deadline) > 0 && !SD_SchedBlocked(sched, i, 0U)) {
+            expired[n++] = sched->req[i];
+            mask |= (1UL << i);
+        }
+    }
+    sched->used &= ~mask;
+    return n;
+}
+
+bool SD_SchedEligible(const SD_Scheduler *sched, uint32_t slot) {
+    return sched && slot < SD_SCHED_SLOTS && SD_SchedUsed(sched, slot) &&
+           !SD_SchedBlocked(sched, slot, 0U);
+}
+
+uint32_t SD_SchedElevator(const SD_Scheduler *sched) {
+    uint32_t best = SD_SCHED_NONE;
+
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (sched->skipped[i] >= SD_SCHED_STARVE_LIMIT && SD_SchedEligible(sched, i) &&
+            (best == SD_SCHED_NONE || SD_SchedOlder(sched, i, best))) {
+            best = i;
+        }
+    }
+    if (best != SD_SCHED_NONE) {
+        return best;
+    }
+
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (SD_SchedUrgent(sched, i) && SD_SchedEligible(sched, i) &&
+            (best == SD_SCHED_NONE || SD_SchedSlack(sched, i) < SD_SchedSlack(sched, best))) {
+            best = i;
+        }
+    }
+    if (best != SD_SCHED_NONE) {
+        return best;
+    }
+
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (!SD_SchedEligible(sched, i)) {
+            continue;
+        }
+        if (best == SD_SCHED_NONE) {
+            best = i;
+            continue;
+        }
+        const SD_IoRequest *a = &sched->req[i];
+        const SD_IoRequest *b = &sched->req[best];
+        /* Unsigned distance from the head gives one upward sweep, then wraps. */
+        uint32_t dist_a = a->sector - sched->head;
+        uint32_t dist_b = b->sector - sched->head;
+        if (a->priority > b->priority ||
+            (a->priority == b->priority &&
+             (dist_a < dist_b || (dist_a == dist_b && SD_SchedOlder(sched, i, best))))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+uint32_t SD_SchedNext(SD_Scheduler *sched, SD_IoRequest *batch, uint32_t max_batch) {
+    if (!sched || !batch || max_batch == 0 || sched->used == 0U) {
+        return 0;
+    }
+
+    sched->now = HAL_GetTick();
+    uint32_t lead = sched->policy(sched);
+    if (!SD_SchedEligible(sched, lead)) {
+        lead = SD_SchedOldest(sched); /* never blocked: nothing pending is older */
+    }
+
+    const SD_IoRequest *run = &sched->req[lead];
+    uint32_t mask = 1UL << lead;
+    uint32_t members = 1;
+    uint32_t first = run->sector;
+    uint32_t end = run->sector + run->count;
+    uint32_t newest = lead;
+
+    bool grown = true;
+    while (grown && members < max_batch) {
+        grown = false;
+        for (uint32_t i = 0; i < SD_SCHED_SLOTS && members < max_batch; i++) {
+            const SD_IoRequest *r = &sched->req[i];
+            if (!SD_SchedUsed(sched, i) || (mask & (1UL << i)) != 0U ||
+                r->sd_handle != run->sd_handle || r->write != run->write ||
+                (end - first) + r->count > SD_SCHED_MAX_MERGE) {
+                continue;
+            }
+            if (r->sector != end && r->sector + r->count != first) {
+                continue;
+            }
+            if (SD_SchedBlocked(sched, i, mask)) {
+                continue;
+            }
+            if (r->sector == end) {
+                end += r->count;
+            } else {
+                first = r->sector;
+            }
+            mask |= (1UL << i);
+            members++;
+            if (SD_SchedOlder(sched, newest, i)) {
+                newest = i;
+            }
+            grown = true;
+        }
+    }
+
+    /* Emit in ascending sector order (members are adjacent and disjoint). */
+    uint32_t n = 0;
+    for (uint32_t sector = first; sector != end;) {
+        for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+            if ((mask & (1UL << i)) != 0U && sched->req[i].sector == sector) {
+                batch[n++] = sched->req[i];
+                sector += sched->req[i].count;
+                break;
+            }
+        }
+    }
+
+    sched->used &= ~mask;
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (SD_SchedUsed(sched, i) && SD_SchedOlder(sched, i, newest) &&
+            sched->skipped[i] < UINT8_MAX) {
+            sched->skipped[i]++;
+        }
+    }
+    sched->head = end;
+    return n;
+}
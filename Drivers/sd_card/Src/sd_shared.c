@@ -0,0 +1,194 @@
+/*
+ * sd_shared.c
+ *
+ * sd_read_shared is ff.c's f_read with get_fat and disk_read replaced: FAT
+ * entries and data come from SD_DiskReadShared, and a FAT sector is read
+ * into fp->buf, which is marked empty afterwards (fp->sect = 0, as f_open
+ * leaves it). fp->fptr, clust and sect keep f_read's meaning.
+ */
+
+#include "sd_shared.h"
+#include "sd_diskio_spi.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+/* ff_gen_drv.c's table: which driver and lun serve a FatFs drive number. */
+extern Disk_drvTypeDef disk;
+
+#define SD_SHARED_SS ((uint32_t)_MAX_SS)
+
+static SD_SharedStats s_stats;
+
+#if (SD_SHARED_READ == 1)
+
+#if (_MAX_SS != _MIN_SS)
+#error "sd_read_shared needs a fixed sector size (_MIN_SS == _MAX_SS)"
+#endif
+
+/* Read a FAT or data sector of the file's volume into buff. */
+static FRESULT sd_shared_sectors(const FIL *fp, uint8_t *buff, DWORD sector, UINT count) {
+    BYTE lun = disk.lun[fp->obj.fs->drv];
+    return (SD_DiskReadShared(lun, buff, sector, count) == SD_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+/* FAT entry of clst, as ff.c's get_fat: 1 = bad cluster number, 0xFFFFFFFF = disk error. */
+static DWORD sd_shared_next(FIL *fp, DWORD clst) {
+    FATFS *fs = fp->obj.fs;
+    uint8_t *buf = fp->buf;
+    if (clst < 2U || clst >= fs->n_fatent) {
+        return 1U;
+    }
+    fp->sect = 0; /* buf now holds a FAT sector */
+
+    DWORD val = 0xFFFFFFFFUL;
+    UINT bc;
+    switch (fs->fs_type) {
+    case FS_FAT12:
+        bc = (UINT)clst + ((UINT)clst / 2U);
+        if (sd_shared_sectors(fp, buf, fs->fatbase + (bc / SD_SHARED_SS), 1U) != FR_OK) {
+            break;
+        }
+        val = buf[bc % SD_SHARED_SS];
+        bc++;
+        if ((bc % SD_SHARED_SS) == 0U &&
+            sd_shared_sectors(fp, buf, fs->fatbase + (bc / SD_SHARED_SS), 1U) != FR_OK) {
+            val = 0xFFFFFFFFUL;
+            break;
+        }
+        val |= (DWORD)buf[bc % SD_SHARED_SS] << 8;
+        val = (clst & 1U) ? (val >> 4) : (val & 0xFFFU);
+        break;
+    case FS_FAT16:
+        if (sd_shared_sectors(fp, buf, fs->fatbase + (clst / (SD_SHARED_SS / 2U)), 1U) == FR_OK) {
+            const uint8_t *p = &buf[(clst * 2U) % SD_SHARED_SS];
+            val = (DWORD)p[0] | ((DWORD)p[1] << 8);
+        }
+        break;
+    case FS_FAT32:
+        if (sd_shared_sectors(fp, buf, fs->fatbase + (clst / (SD_SHARED_SS / 4U)), 1U) == FR_OK) {
+            const uint8_t *p = &buf[(clst * 4U) % SD_SHARED_SS];
+            val = ((DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24)) &
+                  0x0FFFFFFFUL;
+        }
+        break;
+    default:
+        val = 1U;
+        break;
+    }
+    return val;
+}
+
+/* The checks ff.c's validate makes, less disk_status (it may reset the drive). */
+static bool sd_shared_qualifies(const FIL *fp) {
+    const FATFS *fs = fp->obj.fs;
+    if (fs == NULL || fs->fs_type == 0U || fp->obj.id != fs->id) {
+        return false;
+    }
+#if _FS_EXFAT
+    if (fs->fs_type == FS_EXFAT) {
+        return false;
+    }
+#endif
+    return (fp->flag & (FA_READ | FA_WRITE)) == FA_READ && disk.drv[fs->drv] == &SD_Driver;
+}
+
+#define SD_SHARED_ABORT(fp, res) \
+    do {                         \
+        (fp)->err = (BYTE)(res); \
+        return (res);            \
+    } while (0)
+
+FRESULT sd_read_shared(FIL *fp, void *buff, UINT btr, UINT *br) {
+    if (br == NULL || buff == NULL) {
+        return FR_INVALID_PARAMETER;
+    }
+    *br = 0;
+    if (fp == NULL) {
+        return FR_INVALID_OBJECT;
+    }
+    if (!sd_shared_qualifies(fp)) {
+        s_stats.fallbacks++;
+        return f_read(fp, buff, btr, br);
+    }
+    if (fp->err != 0U) {
+        return (FRESULT)fp->err;
+    }
+    s_stats.reads++;
+
+    FATFS *fs = fp->obj.fs;
+    uint8_t *rbuff = (uint8_t *)buff;
+    FSIZE_t remain = fp->obj.objsize - fp->fptr;
+    if (btr > remain) {
+        btr = (UINT)remain;
+    }
+    while (btr > 0U) {
+        UINT rcnt;
+        if ((fp->fptr % SD_SHARED_SS) == 0U) {
+            UINT csect = (UINT)(fp->fptr / SD_SHARED_SS) & (fs->csize - 1U);
+            if (csect == 0U) {
+                DWORD clst = (fp->fptr == 0U) ? fp->obj.sclust : sd_shared_next(fp, fp->clust);
+                if (clst < 2U) {
+                    SD_SHARED_ABORT(fp, FR_INT_ERR);
+                }
+                if (clst == 0xFFFFFFFFUL) {
+                    SD_SHARED_ABORT(fp, FR_DISK_ERR);
+                }
+                fp->clust = clst;
+            }
+            DWORD clst = fp->clust - 2U;
+            if (clst >= fs->n_fatent - 2U) {
+                SD_SHARED_ABORT(fp, FR_INT_ERR); /* end of chain before the file size */
+            }
+            DWORD sect = fs->database + (fs->csize * clst) + csect;
+
+            UINT cc = btr / SD_SHARED_SS;
+            if (cc > 0U) {
+                /* Whole sectors straight into buff, up to the end of the cluster. */
+                if (csect + cc > fs->csize) {
+                    cc = fs->csize - csect;
+                }
+                if (sd_shared_sectors(fp, rbuff, sect, cc) != FR_OK) {
+                    SD_SHARED_ABORT(fp, FR_DISK_ERR);
+                }
+                rcnt = (UINT)(SD_SHARED_SS * cc);
+                fp->fptr += rcnt;
+                rbuff += rcnt;
+                btr -= rcnt;
+                *br += rcnt;
+                continue;
+            }
+            if (fp->sect != sect) {
+                if (sd_shared_sectors(fp, fp->buf, sect, 1U) != FR_OK) {
+                    fp->sect = 0;
+                    SD_SHARED_ABORT(fp, FR_DISK_ERR);
+                }
+            }
+            fp->sect = sect;
+        }
+        rcnt = SD_SHARED_SS - (UINT)(fp->fptr % SD_SHARED_SS);
+        if (rcnt > btr) {
+            rcnt = btr;
+        }
+        memcpy(rbuff, &fp->buf[fp->fptr % SD_SHARED_SS], rcnt);
+        fp->fptr += rcnt;
+        rbuff += rcnt;
+        btr -= rcnt;
+        *br += rcnt;
+    }
+    return FR_OK;
+}
+
+#else
+
+FRESULT sd_read_shared(FIL *fp, void *buff, UINT btr, UINT *br) {
+    s_stats.fallbacks++;
+    return f_read(fp, buff, btr, br);
+}
+
+#endif
+
+void sd_shared_get_stats(SD_SharedStats *out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
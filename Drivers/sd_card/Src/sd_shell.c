@@ -0,0 +1,507 @@
+/*
+ * sd_shell.c
+ *
+ * Diagnostics shell: line editor, command table and the optional UART task.
+ */
+
+#include "sd_shell.h"
+#include "sd_spi.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_benchmark.h"
+#include "sd_trace.h"
+#include "sd_profile.h"
+#include "sd_pool.h"
+#include "ff.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(USE_FREERTOS) && defined(HAL_UART_MODULE_ENABLED)
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#endif
+
+/* The volume sd_mount mounts (sd_functions.c). */
+extern FATFS fs;
+
+#define SD_SHELL_BENCH_FILE "bench.bin"
+
+typedef int (*sd_shell_cmd_fn)(int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    const char *help;
+    sd_shell_cmd_fn fn;
+} sd_shell_cmd;
+
+static sd_shell_write_fn s_write;
+static char s_line[SD_SHELL_LINE_MAX + 1U];
+static uint32_t s_len;
+static bool s_last_cr;
+
+static void sd_shell_stdout(const char *text, uint32_t len) {
+    (void)fwrite(text, 1U, len, stdout);
+    (void)fflush(stdout);
+}
+
+static void sd_shell_write(const char *text, uint32_t len) {
+    if (s_write != NULL) {
+        s_write(text, len);
+    } else {
+        sd_shell_stdout(text, len);
+    }
+}
+
+static void sd_shell_puts(const char *text) {
+    sd_shell_write(text, (uint32_t)strlen(text));
+}
+
+static void sd_shell_printf(const char *fmt, ...) {
+    char buf[SD_SHELL_LINE_MAX + 32U];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        sd_shell_write(buf, ((uint32_t)n < sizeof(buf)) ? (uint32_t)n : sizeof(buf) - 1U);
+    }
+}
+
+/* Parse a decimal argument; false when it is not a whole non-negative number. */
+static bool sd_shell_number(const char *arg, uint32_t *out) {
+    char *end = NULL;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0' || arg[0] == '-') {
+        return false;
+    }
+    *out = (uint32_t)v;
+    return true;
+}
+
+static int sd_shell_usage(const char *usage) {
+    sd_shell_printf("usage: %s\r\n", usage);
+    return -1;
+}
+
+static int sd_shell_help(int argc, char **argv);
+
+static int sd_shell_stats(int argc, char **argv) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            return sd_shell_usage("stats [reset]");
+        }
+        SD_ResetStats(&g_sd_handle);
+        sd_shell_puts("stats cleared\r\n");
+        return 0;
+    }
+    SD_Stats st;
+    SD_GetStats(&g_sd_handle, &st);
+    sd_shell_printf("reads %lu ops %lu blocks %lu KB\r\n", (unsigned long)st.read_ops,
+                    (unsigned long)st.read_blocks, (unsigned long)(st.read_bytes / 1024U));
+    sd_shell_printf("writes %lu ops %lu blocks %lu KB\r\n", (unsigned long)st.write_ops,
+                    (unsigned long)st.write_blocks, (unsigned long)(st.write_bytes / 1024U));
+    sd_shell_printf("errors %lu timeouts %lu crc %lu inits %lu\r\n",
+                    (unsigned long)st.error_count, (unsigned long)st.timeout_count,
+                    (unsigned long)st.crc_errors, (unsigned long)st.init_attempts);
+    sd_shell_printf("dma direct %lu bounced %lu\r\n", (unsigned long)st.dma_direct_blocks,
+                    (unsigned long)st.dma_bounced_blocks);
+#if (SD_LATENCY_STATS == 1)
+    uint32_t permille = SD_BusUtilization(&st);
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    per_us = (per_us != 0U) ? per_us : 1U;
+    uint64_t kbps = (st.bus_window_ms != 0U)
+        ? (st.read_bytes + st.write_bytes) * 1000U / 1024U / st.bus_window_ms : 0U;
+    sd_shell_printf("bus %lu.%lu%% busy over %lu ms, %lu KB/s, gaps %lu ms max %lu us\r\n",
+                    (unsigned long)(permille / 10U), (unsigned long)(permille % 10U),
+                    (unsigned long)st.bus_window_ms, (unsigned long)kbps,
+                    (unsigned long)(st.bus_gap_cycles / per_us / 1000U),
+                    (unsigned long)(st.bus_gap_max_cycles / per_us));
+#endif
+    return 0;
+}
+
+static int sd_shell_cache(int argc, char **argv) {
+    static const char *const names[] = {"sectors", "readahead", "fat"};
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        SD_DiskResetCacheStats(0);
+        sd_shell_puts("cache counters cleared\r\n");
+        return 0;
+    }
+    if (argc == 3) {
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (strcmp(argv[1], names[i]) == 0 && sd_shell_number(argv[2], &size)) {
+                SD_Status status = SD_DiskSetCacheSize(0, (SD_DiskCache)i, size);
+                if (status != SD_OK) {
+                    sd_shell_printf("cache %s %lu: error %d\r\n", names[i],
+                                    (unsigned long)size, (int)status);
+                    return (int)status;
+                }
+                sd_shell_printf("cache %s %lu\r\n", names[i], (unsigned long)size);
+                return 0;
+            }
+        }
+    }
+    if (argc != 1) {
+        return sd_shell_usage("cache [reset | sectors|readahead|fat <n>]");
+    }
+
+    SD_DiskCacheStats st;
+    SD_DiskGetCacheStats(0, &st);
+    sd_shell_printf("sectors lines %lu hits %lu misses %lu evictions %lu\r\n",
+                    (unsigned long)st.sectors.lines, (unsigned long)st.sectors.read_hits,
+                    (unsigned long)st.sectors.read_misses, (unsigned long)st.sectors.evictions);
+    sd_shell_printf("writeback %lu in %lu runs avg %lu.%lu coalesced %lu\r\n",
+                    (unsigned long)st.sectors.writebacks, (unsigned long)st.sectors.writeback_runs,
+                    (unsigned long)(st.sectors.run_len_x10 / 10U),
+                    (unsigned long)(st.sectors.run_len_x10 % 10U),
+                    (unsigned long)st.sectors.coalesced);
+    sd_shell_printf("readahead window %lu hits %lu misses %lu\r\n",
+                    (unsigned long)st.readahead_window, (unsigned long)st.readahead_hits,
+                    (unsigned long)st.readahead_misses);
+    sd_shell_printf("fat groups %lu hits %lu misses %lu evictions %lu\r\n",
+                    (unsigned long)st.fat_groups, (unsigned long)st.fat_hits,
+                    (unsigned long)st.fat_misses, (unsigned long)st.fat_evictions);
+    return 0;
+}
+
+static int sd_shell_trace(int argc, char **argv) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            return sd_shell_usage("trace [reset]");
+        }
+        SD_TraceReset();
+        sd_shell_puts("trace cleared\r\n");
+        return 0;
+    }
+#if (SD_TRACE_ENABLED == 1)
+    SD_TraceDump();
+    sd_shell_printf("dropped %lu\r\n", (unsigned long)SD_TraceDropped());
+#else
+    sd_shell_puts("trace not built (SD_TRACE_ENABLED=0)\r\n");
+#endif
+    return 0;
+}
+
+/* Per-file accounting (sd_profile.h), the files with the most card time first. */
+static int sd_shell_files(int argc, char **argv) {
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset") != 0)) {
+        return sd_shell_usage("files [reset]");
+    }
+#if (SD_PROFILE_ENABLED == 1) && (SD_PROFILE_FILES > 0U)
+    if (argc == 2) {
+        SD_ProfReset();
+        sd_shell_puts("file counters cleared\r\n");
+        return 0;
+    }
+    uint32_t per_ms = SystemCoreClock / 1000U;
+    bool shown[SD_PROFILE_FILES] = {false};
+    sd_shell_puts("opens  rd KB  wr KB rd sec wr sec syncs  io ms  total ms  path\r\n");
+    for (;;) {
+        const SD_ProfFileStats *top = NULL;
+        uint32_t top_index = 0;
+        for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+            const SD_ProfFileStats *f = SD_ProfFileGet(i);
+            if (f != NULL && !shown[i] && (top == NULL || f->io_cycles > top->io_cycles)) {
+                top = f;
+                top_index = i;
+            }
+        }
+        if (top == NULL) {
+            break;
+        }
+        shown[top_index] = true;
+        sd_shell_printf("%5lu %6lu %6lu %6lu %6lu %5lu %6lu %9lu  %s%s\r\n",
+                        (unsigned long)top->opens, (unsigned long)(top->bytes_read / 1024U),
+                        (unsigned long)(top->bytes_written / 1024U),
+                        (unsigned long)top->sectors_read, (unsigned long)top->sectors_written,
+                        (unsigned long)top->syncs,
+                        (unsigned long)(top->io_cycles / (per_ms ? per_ms : 1U)),
+                        (unsigned long)(top->cycles / (per_ms ? per_ms : 1U)), top->name,
+                        (top->open_now > 0U) ? " (open)" : "");
+    }
+#else
+    sd_shell_puts("file accounting not built (SD_PROFILE_ENABLED=1, SD_PROFILE_FILES)\r\n");
+#endif
+    return 0;
+}
+
+static int sd_shell_bench(int argc, char **argv) {
+    uint32_t kb = SD_SHELL_BENCH_KB;
+    uint32_t buf = SD_SHELL_BENCH_BUF;
+    if (argc > 3 || (argc > 1 && !sd_shell_number(argv[1], &kb)) ||
+        (argc > 2 && !sd_shell_number(argv[2], &buf)) || kb == 0U || buf == 0U ||
+        buf > SD_BENCH_MAX_BUFFER) {
+        return sd_shell_usage("bench [kb] [buf <= SD_BENCH_MAX_BUFFER]");
+    }
+
+    SD_BenchResult r;
+    sd_benchmark_print_header();
+    int res = sd_benchmark_file(SD_SHELL_BENCH_FILE, true, kb * 1024U, buf, &r);
+    if (res == FR_OK) {
+        sd_benchmark_print("write", &r);
+        res = sd_benchmark_file(SD_SHELL_BENCH_FILE, false, kb * 1024U, buf, &r);
+        if (res == FR_OK) {
+            sd_benchmark_print("read", &r);
+        }
+    }
+#if (_FS_MINIMIZE == 0)
+    FRESULT rm = f_unlink(SD_SHELL_BENCH_FILE);
+    if (res == FR_OK && rm != FR_OK && rm != FR_NO_FILE) {
+        res = rm;
+    }
+#endif
+    if (res != FR_OK) {
+        sd_shell_printf("bench: error %d\r\n", res);
+    }
+    return res;
+}
+
+static int sd_shell_ls(int argc, char **argv) {
+    if (argc > 2) {
+        return sd_shell_usage("ls [path]");
+    }
+    const char *path = (argc == 2) ? argv[1] : sd_path;
+    SD_POOL_DIR_DECL(dir);
+    FILINFO fno;
+    uint32_t entries = 0;
+    if (dir == NULL) {
+        return FR_TOO_MANY_OPEN_FILES;
+    }
+    FRESULT res = f_opendir(dir, path);
+    bool opened = (res == FR_OK);
+    while (res == FR_OK) {
+        res = f_readdir(dir, &fno);
+        if (res != FR_OK || fno.fname[0] == '\0') {
+            break;
+        }
+        if ((fno.fattrib & AM_DIR) != 0U) {
+            sd_shell_printf("%10s  %s/\r\n", "<DIR>", fno.fname);
+        } else {
+            sd_shell_printf("%10lu  %s\r\n", (unsigned long)fno.fsize, fno.fname);
+        }
+        entries++;
+    }
+    if (opened) {
+        (void)f_closedir(dir);
+    }
+    sd_pool_dir_put(dir);
+    if (res != FR_OK) {
+        sd_shell_printf("ls %s: error %d\r\n", path, (int)res);
+        return (int)res;
+    }
+    sd_shell_printf("%lu entries\r\n", (unsigned long)entries);
+    return 0;
+}
+
+static int sd_shell_df(int argc, char **argv) {
+    (void)argv;
+    uint32_t free_kb = 0;
+    uint32_t total_kb = 0;
+    if (argc > 1) {
+        return sd_shell_usage("df");
+    }
+    if (!sd_free_space_get(&free_kb, &total_kb)) {
+        sd_shell_puts("df: volume not mounted\r\n");
+        return FR_NOT_READY;
+    }
+    sd_shell_printf("%lu KB free of %lu KB\r\n", (unsigned long)free_kb,
+                    (unsigned long)total_kb);
+    return 0;
+}
+
+/* Sync the cached file handles, then write back the drive's caches under the volume lock. */
+static int sd_shell_sync(int argc, char **argv) {
+    (void)argv;
+    if (argc > 1) {
+        return sd_shell_usage("sync");
+    }
+    int res = sd_file_cache_flush();
+#if _FS_REENTRANT
+    if (!ff_req_grant(fs.sobj)) {
+        sd_shell_puts("sync: volume busy\r\n");
+        return FR_TIMEOUT;
+    }
+#endif
+    DRESULT dres = disk_ioctl(0, CTRL_SYNC, NULL);
+#if _FS_REENTRANT
+    ff_rel_grant(fs.sobj);
+#endif
+    if (res == FR_OK && dres != RES_OK) {
+        res = FR_DISK_ERR;
+    }
+    if (res != FR_OK) {
+        sd_shell_printf("sync: error %d\r\n", res);
+        return res;
+    }
+    sd_shell_puts("synced\r\n");
+    return 0;
+}
+
+static const sd_shell_cmd s_cmds[] = {
+    {"help", "this list", sd_shell_help},
+    {"stats", "[reset]  driver counters", sd_shell_stats},
+    {"cache", "[reset | sectors|readahead|fat <n>]  cache metrics and sizes", sd_shell_cache},
+    {"trace", "[reset]  dump the trace ring", sd_shell_trace},
+    {"files", "[reset]  per-file I/O, busiest first", sd_shell_files},
+    {"bench", "[kb] [buf]  write then read " SD_SHELL_BENCH_FILE, sd_shell_bench},
+    {"ls", "[path]  list a directory", sd_shell_ls},
+    {"df", "free space", sd_shell_df},
+    {"sync", "write back files and caches", sd_shell_sync},
+};
+
+static int sd_shell_help(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    for (uint32_t i = 0; i < sizeof(s_cmds) / sizeof(s_cmds[0]); i++) {
+        sd_shell_printf("%-6s %s\r\n", s_cmds[i].name, s_cmds[i].help);
+    }
+    return 0;
+}
+
+void sd_shell_set_output(sd_shell_write_fn fn) {
+    s_write = fn;
+}
+
+void sd_shell_prompt(void) {
+    sd_shell_puts(SD_SHELL_PROMPT);
+}
+
+int sd_shell_exec(char *line) {
+    char *argv[SD_SHELL_ARGS];
+    int argc = 0;
+    char *p = line;
+
+    while (p != NULL && *p != '\0') {
+        while (*p == ' ' || *p == '\t') {
+            *p++ = '\0';
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (argc == (int)SD_SHELL_ARGS) {
+            sd_shell_puts("too many arguments\r\n");
+            return -1;
+        }
+        argv[argc++] = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+    }
+    if (argc == 0) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < sizeof(s_cmds) / sizeof(s_cmds[0]); i++) {
+        if (strcmp(argv[0], s_cmds[i].name) == 0) {
+            return s_cmds[i].fn(argc, argv);
+        }
+    }
+    sd_shell_printf("%s: unknown command, try help\r\n", argv[0]);
+    return -1;
+}
+
+void sd_shell_input(char c) {
+    if (c == '\n' && s_last_cr) {
+        s_last_cr = false;
+        return;
+    }
+    s_last_cr = (c == '\r');
+
+    if (c == '\r' || c == '\n') {
+        sd_shell_puts("\r\n");
+        s_line[s_len] = '\0';
+        s_len = 0;
+        (void)sd_shell_exec(s_line);
+        sd_shell_prompt();
+    } else if (c == '\b' || c == 0x7F) {
+        if (s_len > 0U) {
+            s_len--;
+            sd_shell_puts("\b \b");
+        }
+    } else if ((unsigned char)c >= 0x20U && s_len < SD_SHELL_LINE_MAX) {
+        s_line[s_len++] = c;
+        sd_shell_write(&c, 1U);
+    }
+}
+
+#if defined(USE_FREERTOS) && defined(HAL_UART_MODULE_ENABLED)
+static QueueHandle_t s_rx_queue;
+static TaskHandle_t s_task;
+static UART_HandleTypeDef *s_uart;
+static uint8_t s_rx_byte;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticQueue_t s_queue_buffer;
+static uint8_t s_queue_storage[SD_SHELL_RX_DEPTH];
+static StaticTask_t s_task_buffer;
+static StackType_t s_task_stack[SD_SHELL_TASK_STACK];
+#endif
+
+static void sd_shell_task(void *argument) {
+    (void)argument;
+    char c;
+    sd_shell_prompt();
+    for (;;) {
+        if (xQueueReceive(s_rx_queue, &c, portMAX_DELAY) == pdTRUE) {
+            sd_shell_input(c);
+        }
+    }
+}
+
+static void sd_shell_arm(void) {
+    (void)HAL_UART_Receive_IT(s_uart, &s_rx_byte, 1U);
+}
+
+SD_Status sd_shell_start(UART_HandleTypeDef *huart) {
+    if (huart == NULL) {
+        return SD_PARAM;
+    }
+    if (s_task != NULL) {
+        return SD_OK;
+    }
+    s_uart = huart;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_rx_queue = xQueueCreateStatic(SD_SHELL_RX_DEPTH, 1U, s_queue_storage, &s_queue_buffer);
+    if (s_rx_queue == NULL) {
+        return SD_ERROR;
+    }
+    s_task = xTaskCreateStatic(sd_shell_task, "sd_shell", SD_SHELL_TASK_STACK, NULL,
+                               SD_SHELL_TASK_PRIORITY, s_task_stack, &s_task_buffer);
+#else
+    s_rx_queue = xQueueCreate(SD_SHELL_RX_DEPTH, 1U);
+    if (s_rx_queue == NULL) {
+        return SD_ERROR;
+    }
+    if (xTaskCreate(sd_shell_task, "sd_shell", SD_SHELL_TASK_STACK, NULL,
+                    SD_SHELL_TASK_PRIORITY, &s_task) != pdPASS) {
+        s_task = NULL;
+    }
+#endif
+    if (s_task == NULL) {
+        return SD_ERROR;
+    }
+    return (HAL_UART_Receive_IT(s_uart, &s_rx_byte, 1U) == HAL_OK) ? SD_OK : SD_ERROR;
+}
+
+void sd_shell_uart_rx_cplt(UART_HandleTypeDef *huart) {
+    if (huart != s_uart || s_rx_queue == NULL) {
+        return;
+    }
+    BaseType_t woken = pdFALSE;
+    char c = (char)s_rx_byte;
+    (void)xQueueSendFromISR(s_rx_queue, &c, &woken); /* a full queue drops the byte */
+    sd_shell_arm();
+    portYIELD_FROM_ISR(woken);
+}
+
+void sd_shell_uart_error(UART_HandleTypeDef *huart) {
+    if (huart == s_uart && s_rx_queue != NULL) {
+        sd_shell_arm();
+    }
+}
+#endif
@@ -14,11 +14,27 @@
 #include "semphr.h"
 #endif
 
+/* Hot-path placement in RAM (SD_RAM_FUNCS); noinline keeps the loop out of flash callers. */
+#if (SD_RAM_FUNCS == 1)
+#define SD_RAMFUNC __attribute__((section(SD_RAMFUNC_SECTION), noinline))
+#else
+#define SD_RAMFUNC
+#endif
+
+#define SD_CMD6  (6)
 #define SD_CMD9  (9)
+#define SD_CMD10 (10)
 #define SD_CMD12 (12)
+#define SD_CMD13 (13)
 #define SD_CMD16 (16)
 #define SD_CMD18 (18)
 #define SD_CMD25 (25)
+#define SD_CMD32 (32)
+#define SD_CMD33 (33)
+#define SD_CMD38 (38)
+#define SD_CMD59 (59)
+#define SD_ACMD23 (23)
+#define SD_ACMD13 (13)
 
 #define SD_TOKEN_START_BLOCK       0xFEU
 #define SD_TOKEN_START_MULTI_WRITE 0xFCU
@@ -28,32 +44,215 @@
 #define SD_DATA_RESP_CRC_ERR       0x0BU
 #define SD_DATA_RESP_WRITE_ERR     0x0DU
 
+#define SD_CMD_FRAME_LEN 7U
+#define SD_R1_ILLEGAL_CMD 0x04U
+#define SD_R1_IDLE 0x01U
+/* R2 (CMD13) bits a status read should have cleared: general, card controller, ECC. */
+#define SD_R2_WEDGED 0x1CU
+#define SD_STATUS_SILENT 0xFFFFU
+#define SD_ACMD23_COUNT_MASK 0x007FFFFFU
+
 #if defined(USE_FREERTOS) && (configSUPPORT_STATIC_ALLOCATION == 1)
-static StaticSemaphore_t sd_mutex_buffer;
-static StaticSemaphore_t sd_dma_tx_buffer;
-static StaticSemaphore_t sd_dma_rx_buffer;
-static bool s_static_alloc_used = false;
+static StaticSemaphore_t sd_mutex_buffer[SD_MAX_INSTANCES];
+#if (SD_DMA_NOTIFY == 0)
+static StaticSemaphore_t sd_dma_tx_buffer[SD_MAX_INSTANCES];
+static StaticSemaphore_t sd_dma_rx_buffer[SD_MAX_INSTANCES];
+#endif
+#endif
+
+/* Registered instances; HAL SPI callbacks dispatch through this table. */
+static SD_Handle_t *s_instances[SD_MAX_INSTANCES];
+
+/* Driver-owned DMA buffers; word packing (SD_DMA_WORD_MEM) needs 16-byte alignment. */
+#if (SD_DMA_PROFILE == 1) && (SD_DMA_ALIGNMENT < 16U)
+#define SD_BUF_ALIGN 16U
+#else
+#define SD_BUF_ALIGN SD_DMA_ALIGNMENT
 #endif
 
-/* Single SPI SD instance for DMA callbacks. */
-static SD_Handle_t *s_dma_owner = NULL;
+/* One data block, its CRC16 and the streamed token gap, padded to the DMA alignment. */
+#define SD_RX_STAGE_LEN (SD_BLOCK_SIZE + 2U + SD_READ_STREAM_GAP)
+#define SD_RX_STAGE_SIZE ((SD_RX_STAGE_LEN + SD_DMA_ALIGNMENT - 1U) & ~(SD_DMA_ALIGNMENT - 1U))
+
+/* Driver-owned DMA buffers: aligned, and in non-cacheable RAM with SD_DMA_NOCACHE. */
+#if (SD_DMA_NOCACHE == 1)
+#define SD_DMA_BUF __attribute__((section(SD_DMA_NOCACHE_SECTION), aligned(SD_BUF_ALIGN)))
+#else
+#define SD_DMA_BUF __attribute__((aligned(SD_BUF_ALIGN)))
+#endif
 
-static uint8_t s_dummy_tx[SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+/*
+ * All-0xFF transmit source; only ever read by transfers, so instances share it.
+ * With SD_DMA_FIXED_TX the DMA re-reads its first beat, so it only needs to
+ * cover the longest command-side idle run sent from it in pieces.
+ */
+#if (SD_DMA_FIXED_TX == 1)
+#define SD_IDLE_TX_LEN 16U
+#else
+#define SD_IDLE_TX_LEN SD_RX_STAGE_SIZE
+#endif
+static uint8_t s_dummy_tx[SD_IDLE_TX_LEN] SD_DMA_BUF;
 static uint8_t s_dummy_init = 0;
 
+#if (SD_READ_PIPELINE == 1)
+/* Ping-pong staging for pipelined CMD18 reads, one pair per instance. */
+static uint8_t s_rx_stage[SD_MAX_INSTANCES][2][SD_RX_STAGE_SIZE] SD_DMA_BUF;
+#endif
+
+#if (SD_WRITE_PIPELINE == 1)
+/* Start token + data block + CRC16, sent as one DMA frame by pipelined CMD25. */
+#define SD_TX_STAGE_LEN (SD_BLOCK_SIZE + 3U)
+#define SD_TX_STAGE_SIZE ((SD_TX_STAGE_LEN + SD_DMA_ALIGNMENT - 1U) & ~(SD_DMA_ALIGNMENT - 1U))
+static uint8_t s_tx_stage[SD_MAX_INSTANCES][SD_TX_STAGE_SIZE] SD_DMA_BUF;
+#endif
+
+#if (SD_DMA_BOUNCE == 1)
+/* Aligned stand-in for unaligned caller blocks so they still move by DMA, one per instance. */
+static uint8_t s_bounce[SD_MAX_INSTANCES][SD_BLOCK_SIZE] SD_DMA_BUF;
+#endif
+
+/* Counters also bumped outside the bus lock; single words, added atomically. */
+#define SD_STAT_INC(h, field) ((void)__atomic_fetch_add(&(h)->stats.field, 1U, __ATOMIC_RELAXED))
+
 static SD_Status SD_RecordStatus(SD_Handle_t *sd_handle, SD_Status status) {
     if (sd_handle) {
         sd_handle->last_status = status;
         if (status != SD_OK) {
-            sd_handle->stats.error_count++;
+            SD_STAT_INC(sd_handle, error_count);
         }
         if (status == SD_TIMEOUT) {
-            sd_handle->stats.timeout_count++;
+            SD_STAT_INC(sd_handle, timeout_count);
         }
     }
     return status;
 }
 
+#if (SD_STATS_SNAPSHOT == 1)
+/*
+ * Copy the counters into the published copy readers are not using. Only the
+ * lock holder (or a caller owning the handle) publishes, so there is one
+ * writer; a reader that raced with it sees stats_seq move and retries.
+ */
+static void SD_StatsPublish(SD_Handle_t *sd_handle) {
+    uint32_t seq = __atomic_load_n(&sd_handle->stats_seq, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < 2U; i++) {
+        seq++;
+        __atomic_store_n(&sd_handle->stats_seq, seq, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        sd_handle->stats_pub[(seq & 1U) ^ 1U] = sd_handle->stats;
+    }
+}
+#endif
+
+#if (SD_LATENCY_STATS == 1) || (SD_TRACE_ENABLED == 1)
+static void SD_CycleCounterInit(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+#else
+static void SD_CycleCounterInit(void) {}
+#endif
+
+#if (SD_LATENCY_STATS == 1)
+static uint32_t SD_LatencyStart(void) {
+    return DWT->CYCCNT;
+}
+
+#if (SD_SLO_ENABLED == 1)
+/* Snapshot the trace leading up to a sample over its limit and report it. */
+static void SD_SloCheck(SD_Handle_t *sd_handle, SD_LatencyOp op, uint32_t us) {
+    uint32_t limit = sd_handle->slo_us[op];
+    if (limit == 0U || us <= limit) {
+        return;
+    }
+    SD_SloViolation *v = &sd_handle->slo_last;
+    sd_handle->stats.slo_violations[op]++;
+    v->op = op;
+    v->limit_us = limit;
+    v->latency_us = us;
+    v->time = DWT->CYCCNT;
+    v->count++;
+#if (SD_TRACE_ENABLED == 1)
+    v->events = SD_TraceLatest(v->trace, SD_SLO_TRACE_EVENTS);
+#else
+    v->events = 0U;
+#endif
+    if (sd_handle->slo_fn != NULL) {
+        sd_handle->slo_fn(sd_handle->slo_ctx, v);
+    }
+}
+#endif
+
+static void SD_LatencyRecord(SD_Handle_t *sd_handle, SD_LatencyOp op, uint32_t start) {
+    uint32_t cycles = DWT->CYCCNT - start;
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    uint32_t us = cycles / ((per_us != 0U) ? per_us : 1U);
+    uint32_t bucket = 0;
+    while ((bucket + 1U < SD_LAT_BUCKETS) && ((us >> (bucket + 1U)) != 0U)) {
+        bucket++;
+    }
+
+    SD_LatencyHist *hist = &sd_handle->stats.latency[op];
+    hist->count++;
+    hist->total_cycles += cycles;
+    hist->hist[bucket]++;
+    if (cycles > hist->max_cycles) {
+        hist->max_cycles = cycles;
+    }
+#if (SD_SLO_ENABLED == 1)
+    SD_SloCheck(sd_handle, op, us);
+#endif
+}
+#else
+static uint32_t SD_LatencyStart(void) {
+    return 0U;
+}
+
+static void SD_LatencyRecord(SD_Handle_t *sd_handle, SD_LatencyOp op, uint32_t start) {
+    (void)sd_handle;
+    (void)op;
+    (void)start;
+}
+#endif
+
+#if (SD_ENERGY_STATS == 1)
+static uint64_t SD_EnergySelected(const SD_Handle_t *sd_handle, uint32_t now) {
+    uint64_t selected = sd_handle->stats.selected_cycles;
+    if (sd_handle->bus_selected) {
+        selected += now - sd_handle->select_mark;
+    }
+    return selected;
+}
+
+/* Mark the start of a read or write operation; paired with SD_EnergyRecord. */
+static void SD_EnergyBegin(SD_Handle_t *sd_handle) {
+    uint32_t now = DWT->CYCCNT;
+    sd_handle->energy_start.mark = now;
+    sd_handle->energy_start.card = sd_handle->stats.card_active_cycles;
+    sd_handle->energy_start.bus = sd_handle->stats.bus_data_cycles;
+    sd_handle->energy_start.selected = SD_EnergySelected(sd_handle, now);
+}
+
+/* Split the operation since SD_EnergyBegin into card, bus and selected-idle time. */
+static void SD_EnergyRecord(SD_Handle_t *sd_handle, SD_LatencyOp op, uint32_t count) {
+    uint32_t now = DWT->CYCCNT;
+    SD_EnergyOp *e = &sd_handle->stats.energy[op];
+    uint64_t card = sd_handle->stats.card_active_cycles - sd_handle->energy_start.card;
+    uint64_t bus = sd_handle->stats.bus_data_cycles - sd_handle->energy_start.bus;
+    uint64_t selected = SD_EnergySelected(sd_handle, now) - sd_handle->energy_start.selected;
+    e->ops++;
+    e->bytes += (uint64_t)count * SD_BLOCK_SIZE;
+    e->total_cycles += now - sd_handle->energy_start.mark;
+    e->card_cycles += card;
+    e->bus_cycles += bus;
+    /* A wait deferred from before the selection can make card + bus exceed it. */
+    e->idle_cycles += (selected > card + bus) ? (selected - card - bus) : 0U;
+}
+#else
+#define SD_EnergyBegin(sd_handle)             ((void)(sd_handle))
+#define SD_EnergyRecord(sd_handle, op, count) ((void)(sd_handle), (void)(count))
+#endif
+
 static bool SD_InISR(void) {
 #if defined(USE_FREERTOS)
     return (__get_IPSR() != 0U);
@@ -62,71 +261,288 @@ static bool SD_InISR(void) {
 #endif
 }
 
-static void SD_BackoffDelay(void) {
+static void SD_SleepMs(uint32_t ms) {
 #if defined(USE_FREERTOS)
     if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
-        vTaskDelay(pdMS_TO_TICKS(1));
+        vTaskDelay(pdMS_TO_TICKS(ms));
     } else {
-        HAL_Delay(1);
+        HAL_Delay(ms);
     }
 #else
-    HAL_Delay(1);
+    HAL_Delay(ms);
 #endif
 }
 
+static void SD_BackoffDelay(void) {
+    SD_SleepMs(1U);
+}
+
 static bool SD_IsAligned(const void *ptr, size_t align) {
     return ((uintptr_t)ptr % align) == 0U;
 }
 
-#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
-static void SD_CacheClean(const void *addr, size_t size) {
-    uintptr_t start = (uintptr_t)addr & ~(SD_DMA_ALIGNMENT - 1U);
-    uintptr_t end = ((uintptr_t)addr + size + SD_DMA_ALIGNMENT - 1U) & ~(SD_DMA_ALIGNMENT - 1U);
-    SCB_CleanDCache_by_Addr((uint32_t *)start, (int32_t)(end - start));
+/* D-cache maintenance by address; the host tests hook SD_DCACHE_* to count it. */
+#if !defined(SD_DCACHE_CLEAN) && defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+#define SD_DCACHE_CLEAN(addr, size) SCB_CleanDCache_by_Addr((uint32_t *)(addr), (int32_t)(size))
+#define SD_DCACHE_INVALIDATE(addr, size) SCB_InvalidateDCache_by_Addr((uint32_t *)(addr), (int32_t)(size))
+#endif
+
+/* Non-cacheable RAM declared with SD_DmaSetNoCache, [lo, hi). */
+static uintptr_t s_nocache_lo;
+static uintptr_t s_nocache_hi;
+
+#ifdef SD_DCACHE_CLEAN
+/*
+ * Whether a buffer needs no maintenance: it is in non-cacheable RAM, or
+ * (covered set) inside the range SD_CacheRangeBegin already maintained.
+ */
+static bool SD_CacheSkip(SD_Handle_t *sd_handle, const void *addr, size_t size, bool covered) {
+    uintptr_t lo = (uintptr_t)addr;
+    uintptr_t hi = lo + size;
+    bool skip = (lo >= s_nocache_lo) && (hi <= s_nocache_hi);
+    if (covered) {
+        skip = skip || ((lo >= (uintptr_t)sd_handle->dcache_lo) && (hi <= (uintptr_t)sd_handle->dcache_hi));
+    }
+    if (skip) {
+        sd_handle->stats.dcache_skips++;
+    } else {
+        sd_handle->stats.dcache_ops++;
+    }
+    return skip;
+}
+
+static void SD_CacheLines(const void *addr, size_t size, uintptr_t *start, int32_t *bytes) {
+    uintptr_t end = ((uintptr_t)addr + size + SD_DMA_ALIGNMENT - 1U) & ~(uintptr_t)(SD_DMA_ALIGNMENT - 1U);
+    *start = (uintptr_t)addr & ~(uintptr_t)(SD_DMA_ALIGNMENT - 1U);
+    *bytes = (int32_t)(end - *start);
+}
+
+/* Write back a DMA source before the transfer. */
+static void SD_CacheClean(SD_Handle_t *sd_handle, const void *addr, size_t size) {
+    uintptr_t start;
+    int32_t bytes;
+    if (SD_CacheSkip(sd_handle, addr, size, true)) {
+        return;
+    }
+    SD_CacheLines(addr, size, &start, &bytes);
+    SD_DCACHE_CLEAN(start, bytes);
 }
 
-static void SD_CacheInvalidate(void *addr, size_t size) {
-    uintptr_t start = (uintptr_t)addr & ~(SD_DMA_ALIGNMENT - 1U);
-    uintptr_t end = ((uintptr_t)addr + size + SD_DMA_ALIGNMENT - 1U) & ~(SD_DMA_ALIGNMENT - 1U);
-    SCB_InvalidateDCache_by_Addr((uint32_t *)start, (int32_t)(end - start));
+/*
+ * Drop a DMA destination's lines: before the transfer (after false) so no
+ * dirty line is evicted over it, and after it for lines the core fetched
+ * meanwhile. A request's maintained range only stands in for the first.
+ */
+static void SD_CacheInvalidate(SD_Handle_t *sd_handle, void *addr, size_t size, bool after) {
+    uintptr_t start;
+    int32_t bytes;
+    if (SD_CacheSkip(sd_handle, addr, size, !after)) {
+        return;
+    }
+    SD_CacheLines(addr, size, &start, &bytes);
+    SD_DCACHE_INVALIDATE(start, bytes);
 }
 #else
-static void SD_CacheClean(const void *addr, size_t size) {
+static void SD_CacheClean(SD_Handle_t *sd_handle, const void *addr, size_t size) {
+    (void)sd_handle;
     (void)addr;
     (void)size;
 }
 
-static void SD_CacheInvalidate(void *addr, size_t size) {
+static void SD_CacheInvalidate(SD_Handle_t *sd_handle, void *addr, size_t size, bool after) {
+    (void)sd_handle;
     (void)addr;
     (void)size;
+    (void)after;
 }
 #endif
 
-static SD_Status SD_Lock(SD_Handle_t *sd_handle) {
+/*
+ * Maintain a CMD18/CMD25 run's contiguous, aligned caller buffer with one
+ * cache operation instead of one per block; its blocks then skip their own
+ * clean or pre-transfer invalidate. Nothing to do for a single block, the
+ * staging paths (their buffers are the driver's) or without a D-cache.
+ */
+static void SD_CacheRangeBegin(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t count,
+                               bool rx) {
+#ifdef SD_DCACHE_CLEAN
+    if (!sd_handle->use_dma || !buff || count < 2U || !SD_IsAligned(buff, SD_DMA_ALIGNMENT)) {
+        return;
+    }
+    size_t bytes = (size_t)count * SD_BLOCK_SIZE;
+    if (rx) {
+        SD_CacheInvalidate(sd_handle, (void *)buff, bytes, false);
+    } else {
+        SD_CacheClean(sd_handle, buff, bytes);
+    }
+    sd_handle->dcache_lo = buff;
+    sd_handle->dcache_hi = buff + bytes;
+#else
+    (void)sd_handle;
+    (void)buff;
+    (void)count;
+    (void)rx;
+#endif
+}
+
+static void SD_CacheRangeEnd(SD_Handle_t *sd_handle) {
+    sd_handle->dcache_lo = NULL;
+    sd_handle->dcache_hi = NULL;
+}
+
+#if (SD_IDLE_GATE_MS > 0U)
+static SD_Status SD_Ungate(SD_Handle_t *sd_handle);
+#endif
+
+#if (SD_SHARED_BUS == 1)
+static SD_Status SD_BusTake(SD_Handle_t *sd_handle);
+#endif
+
+#if defined(USE_FREERTOS)
+/* The lock a handle takes: its shared bus's when attached, else its own. */
+static SemaphoreHandle_t SD_MutexOf(const SD_Handle_t *sd_handle) {
+#if (SD_SHARED_BUS == 1)
+    if (sd_handle->bus != NULL) {
+        return sd_handle->bus->mutex;
+    }
+#endif
+    return sd_handle->mutex;
+}
+#endif
+
+/* Take the bus, waiting at most timeout_ms; the mutex lends the holder our priority. */
+static SD_Status SD_LockFor(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
 #if defined(USE_FREERTOS)
     if (SD_InISR()) {
         return SD_BUSY;
     }
-    if (sd_handle->mutex == NULL) {
+    SemaphoreHandle_t mutex = SD_MutexOf(sd_handle);
+    if (mutex == NULL) {
         return SD_ERROR;
     }
-    if (xSemaphoreTake(sd_handle->mutex, pdMS_TO_TICKS(SD_MUTEX_TIMEOUT_MS)) != pdTRUE) {
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
         return SD_BUSY;
     }
+#else
+    (void)timeout_ms;
+#endif
+#if (SD_IDLE_GATE_MS > 0U)
+    if (sd_handle->gated && SD_Ungate(sd_handle) != SD_OK) {
+#if defined(USE_FREERTOS)
+        xSemaphoreGive(mutex);
+#endif
+        return SD_ERROR;
+    }
+#endif
+#if (SD_SHARED_BUS == 1)
+    if (sd_handle->bus != NULL && SD_BusTake(sd_handle) != SD_OK) {
+#if defined(USE_FREERTOS)
+        xSemaphoreGive(mutex);
+#endif
+        return SD_ERROR;
+    }
 #endif
     return SD_OK;
 }
 
+static SD_Status SD_Lock(SD_Handle_t *sd_handle) {
+    return SD_LockFor(sd_handle, SD_MUTEX_TIMEOUT_MS);
+}
+
+/* Milliseconds left before a HAL tick deadline, 0 once it has passed. */
+static uint32_t SD_DeadlineLeft(uint32_t deadline) {
+    int32_t left = (int32_t)(deadline - HAL_GetTick());
+    return (left > 0) ? (uint32_t)left : 0U;
+}
+
 static void SD_Unlock(SD_Handle_t *sd_handle) {
+#if (SD_IDLE_GATE_MS > 0U)
+    if (sd_handle) {
+        sd_handle->last_io_tick = HAL_GetTick();
+    }
+#endif
+#if (SD_STATS_SNAPSHOT == 1)
+    if (sd_handle) {
+        SD_StatsPublish(sd_handle);
+    }
+#endif
 #if defined(USE_FREERTOS)
-    if (sd_handle && sd_handle->mutex) {
-        xSemaphoreGive(sd_handle->mutex);
+    if (sd_handle && SD_MutexOf(sd_handle)) {
+        xSemaphoreGive(SD_MutexOf(sd_handle));
     }
 #else
     (void)sd_handle;
 #endif
 }
 
+/*
+ * Sleep delay_ms between retries of a transfer with the bus released, so the
+ * backoff does not hold up other tasks' requests. Any other status means the
+ * lock is no longer held (busy, or the card was deinitialized meanwhile).
+ */
+static SD_Status SD_RetryBackoff(SD_Handle_t *sd_handle, uint32_t lock_ms, uint32_t delay_ms) {
+#if defined(USE_FREERTOS)
+    SD_Unlock(sd_handle);
+    SD_SleepMs(delay_ms);
+    SD_Status status = SD_LockFor(sd_handle, lock_ms);
+    if (status != SD_OK) {
+        return status;
+    }
+    if (!sd_handle->initialized) {
+        SD_Unlock(sd_handle);
+        return SD_ERROR;
+    }
+#else
+    (void)lock_ms;
+    SD_SleepMs(delay_ms);
+#endif
+    return SD_OK;
+}
+
+/*
+ * Per-request deadline for the block I/O entry points; NULL means none (bus wait
+ * SD_MUTEX_TIMEOUT_MS, every retry). Returns the bus wait in ms.
+ */
+static uint32_t SD_DeadlineLockMs(const uint32_t *deadline) {
+    return deadline ? SD_DeadlineLeft(*deadline) : SD_MUTEX_TIMEOUT_MS;
+}
+
+/* Backoff before retry `attempt` (0-based): doubling, capped, cut to the deadline. */
+static uint32_t SD_RetryDelayMs(uint32_t attempt, const uint32_t *deadline) {
+    uint32_t ms = SD_RETRY_BACKOFF_MAX_MS;
+    if (attempt < 16U && (SD_RETRY_BACKOFF_MS << attempt) < ms) {
+        ms = SD_RETRY_BACKOFF_MS << attempt;
+    }
+    if (deadline && SD_DeadlineLeft(*deadline) < ms) {
+        ms = SD_DeadlineLeft(*deadline);
+    }
+    return ms;
+}
+
+/* Count a deadline request and whether it was given up or finished late. */
+static void SD_DeadlineRecord(SD_Handle_t *sd_handle, const uint32_t *deadline, bool gave_up) {
+    if (deadline) {
+        SD_STAT_INC(sd_handle, deadline_requests);
+        if (gave_up || (int32_t)(HAL_GetTick() - *deadline) > 0) {
+            SD_STAT_INC(sd_handle, deadline_misses);
+        }
+    }
+}
+
+/* Take the bus for a block request; a deadline that passes first gives SD_TIMEOUT. */
+static SD_Status SD_DeadlineGate(SD_Handle_t *sd_handle, const uint32_t *deadline) {
+    if (deadline && SD_DeadlineLeft(*deadline) == 0U) {
+        SD_DeadlineRecord(sd_handle, deadline, true);
+        return SD_TIMEOUT;
+    }
+    SD_Status status = SD_LockFor(sd_handle, SD_DeadlineLockMs(deadline));
+    if (status == SD_BUSY && deadline) {
+        SD_DeadlineRecord(sd_handle, deadline, true);
+        return SD_TIMEOUT;
+    }
+    return status;
+}
+
 static SD_Status SD_FromHalStatus(HAL_StatusTypeDef status) {
     switch (status) {
     case HAL_OK:
@@ -138,684 +554,3709 @@ static SD_Status SD_FromHalStatus(HAL_StatusTypeDef status) {
     }
 }
 
-static void SD_Select(SD_Handle_t *sd_handle) {
-    HAL_GPIO_WritePin(sd_handle->cs_port, sd_handle->cs_pin, GPIO_PIN_RESET);
+static SD_Status SD_ApplyBusPrescaler(SD_Handle_t *sd_handle, uint32_t prescaler) {
+    if (sd_handle->hspi->Init.BaudRatePrescaler != prescaler) {
+        sd_handle->hspi->Init.BaudRatePrescaler = prescaler;
+        if (HAL_SPI_Init(sd_handle->hspi) != HAL_OK) {
+            return SD_ERROR;
+        }
+    }
+    sd_handle->bus_prescaler = prescaler;
+    return SD_OK;
 }
 
-static void SD_Deselect(SD_Handle_t *sd_handle) {
-    HAL_GPIO_WritePin(sd_handle->cs_port, sd_handle->cs_pin, GPIO_PIN_SET);
+/* Next slower prescaler (BR field steps by one), saturating at the init rate. */
+static uint32_t SD_SlowerPrescaler(uint32_t prescaler) {
+    if (prescaler >= SD_SPI_INIT_PRESCALER) {
+        return SD_SPI_INIT_PRESCALER;
+    }
+    return prescaler + (SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2);
 }
 
-static SD_Status SD_SPI_Transmit(SD_Handle_t *sd_handle, const uint8_t *buffer, uint16_t len, bool use_dma) {
-    if (use_dma) {
-#if defined(USE_FREERTOS)
-        if (sd_handle->dma_tx_sem == NULL) {
-            return SD_ERROR;
-        }
-        (void)xSemaphoreTake(sd_handle->dma_tx_sem, 0);
+#if (SD_CARD_INFO == 1)
+/* SPI clock divisor of a prescaler setting (2, 4, ... 256). */
+static uint32_t SD_PrescalerDivisor(uint32_t prescaler) {
+    return 2U << ((prescaler - SPI_BAUDRATEPRESCALER_2) /
+                  (SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2));
+}
 #endif
-        SD_CacheClean(buffer, len);
-        sd_handle->dma_tx_done = false;
-        sd_handle->dma_error = false;
-        if (HAL_SPI_Transmit_DMA(sd_handle->hspi, (uint8_t *)buffer, len) != HAL_OK) {
-            return SD_ERROR;
-        }
-#if defined(USE_FREERTOS)
-        if (xSemaphoreTake(sd_handle->dma_tx_sem, pdMS_TO_TICKS(SD_DMA_TIMEOUT_MS)) != pdTRUE) {
-            (void)HAL_SPI_Abort(sd_handle->hspi);
-            return SD_TIMEOUT;
-        }
-        if (sd_handle->dma_error) {
-            return SD_ERROR;
-        }
+
+#if (SD_CRC_ENABLED == 1)
+/* CRC7 (x^7 + x^3 + 1) kept in bits 7..1, one table lookup per byte. */
+static const uint8_t s_crc7_table[256] = {
+    0x00U, 0x12U, 0x24U, 0x36U, 0x48U, 0x5AU, 0x6CU, 0x7EU, 0x90U, 0x82U, 0xB4U, 0xA6U,
+    0xD8U, 0xCAU, 0xFCU, 0xEEU, 0x32U, 0x20U, 0x16U, 0x04U, 0x7AU, 0x68U, 0x5EU, 0x4CU,
+    0xA2U, 0xB0U, 0x86U, 0x94U, 0xEAU, 0xF8U, 0xCEU, 0xDCU, 0x64U, 0x76U, 0x40U, 0x52U,
+    0x2CU, 0x3EU, 0x08U, 0x1AU, 0xF4U, 0xE6U, 0xD0U, 0xC2U, 0xBCU, 0xAEU, 0x98U, 0x8AU,
+    0x56U, 0x44U, 0x72U, 0x60U, 0x1EU, 0x0CU, 0x3AU, 0x28U, 0xC6U, 0xD4U, 0xE2U, 0xF0U,
+    0x8EU, 0x9CU, 0xAAU, 0xB8U, 0xC8U, 0xDAU, 0xECU, 0xFEU, 0x80U, 0x92U, 0xA4U, 0xB6U,
+    0x58U, 0x4AU, 0x7CU, 0x6EU, 0x10U, 0x02U, 0x34U, 0x26U, 0xFAU, 0xE8U, 0xDEU, 0xCCU,
+    0xB2U, 0xA0U, 0x96U, 0x84U, 0x6AU, 0x78U, 0x4EU, 0x5CU, 0x22U, 0x30U, 0x06U, 0x14U,
+    0xACU, 0xBEU, 0x88U, 0x9AU, 0xE4U, 0xF6U, 0xC0U, 0xD2U, 0x3CU, 0x2EU, 0x18U, 0x0AU,
+    0x74U, 0x66U, 0x50U, 0x42U, 0x9EU, 0x8CU, 0xBAU, 0xA8U, 0xD6U, 0xC4U, 0xF2U, 0xE0U,
+    0x0EU, 0x1CU, 0x2AU, 0x38U, 0x46U, 0x54U, 0x62U, 0x70U, 0x82U, 0x90U, 0xA6U, 0xB4U,
+    0xCAU, 0xD8U, 0xEEU, 0xFCU, 0x12U, 0x00U, 0x36U, 0x24U, 0x5AU, 0x48U, 0x7EU, 0x6CU,
+    0xB0U, 0xA2U, 0x94U, 0x86U, 0xF8U, 0xEAU, 0xDCU, 0xCEU, 0x20U, 0x32U, 0x04U, 0x16U,
+    0x68U, 0x7AU, 0x4CU, 0x5EU, 0xE6U, 0xF4U, 0xC2U, 0xD0U, 0xAEU, 0xBCU, 0x8AU, 0x98U,
+    0x76U, 0x64U, 0x52U, 0x40U, 0x3EU, 0x2CU, 0x1AU, 0x08U, 0xD4U, 0xC6U, 0xF0U, 0xE2U,
+    0x9CU, 0x8EU, 0xB8U, 0xAAU, 0x44U, 0x56U, 0x60U, 0x72U, 0x0CU, 0x1EU, 0x28U, 0x3AU,
+    0x4AU, 0x58U, 0x6EU, 0x7CU, 0x02U, 0x10U, 0x26U, 0x34U, 0xDAU, 0xC8U, 0xFEU, 0xECU,
+    0x92U, 0x80U, 0xB6U, 0xA4U, 0x78U, 0x6AU, 0x5CU, 0x4EU, 0x30U, 0x22U, 0x14U, 0x06U,
+    0xE8U, 0xFAU, 0xCCU, 0xDEU, 0xA0U, 0xB2U, 0x84U, 0x96U, 0x2EU, 0x3CU, 0x0AU, 0x18U,
+    0x66U, 0x74U, 0x42U, 0x50U, 0xBEU, 0xACU, 0x9AU, 0x88U, 0xF6U, 0xE4U, 0xD2U, 0xC0U,
+    0x1CU, 0x0EU, 0x38U, 0x2AU, 0x54U, 0x46U, 0x70U, 0x62U, 0x8CU, 0x9EU, 0xA8U, 0xBAU,
+    0xC4U, 0xD6U, 0xE0U, 0xF2U,
+};
+
+/*
+ * Frame CRC byte (CRC7 and end bit) of every command index with a zero
+ * argument: CMD0, CMD9/10, CMD12, CMD13, CMD55, CMD58 and ACMD13/51 never
+ * compute one. CMD0 gives the 0x95 the spec lists.
+ */
+static const uint8_t s_cmd_crc_arg0[64] = {
+    0x95U, 0xF9U, 0x4DU, 0x21U, 0x37U, 0x5BU, 0xEFU, 0x83U, 0xC3U, 0xAFU, 0x1BU, 0x77U,
+    0x61U, 0x0DU, 0xB9U, 0xD5U, 0x39U, 0x55U, 0xE1U, 0x8DU, 0x9BU, 0xF7U, 0x43U, 0x2FU,
+    0x6FU, 0x03U, 0xB7U, 0xDBU, 0xCDU, 0xA1U, 0x15U, 0x79U, 0xDFU, 0xB3U, 0x07U, 0x6BU,
+    0x7DU, 0x11U, 0xA5U, 0xC9U, 0x89U, 0xE5U, 0x51U, 0x3DU, 0x2BU, 0x47U, 0xF3U, 0x9FU,
+    0x73U, 0x1FU, 0xABU, 0xC7U, 0xD1U, 0xBDU, 0x09U, 0x65U, 0x25U, 0x49U, 0xFDU, 0x91U,
+    0x87U, 0xEBU, 0x5FU, 0x33U,
+};
+
+static uint8_t SD_Crc7(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = s_crc7_table[crc ^ data[i]];
+    }
+    return crc >> 1;
+}
 #else
-        uint32_t dma_start = HAL_GetTick();
-        while (!sd_handle->dma_tx_done && (HAL_GetTick() - dma_start) < SD_DMA_TIMEOUT_MS) {
-            SD_BackoffDelay();
-        }
-        if (!sd_handle->dma_tx_done) {
-            (void)HAL_SPI_Abort(sd_handle->hspi);
-            return SD_TIMEOUT;
-        }
-        if (sd_handle->dma_error) {
-            return SD_ERROR;
+static uint8_t SD_Crc7(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+        for (uint8_t bit = 0; bit < 8U; bit++) {
+            crc <<= 1;
+            if (((byte ^ crc) & 0x80U) != 0U) {
+                crc ^= 0x09U;
+            }
+            byte <<= 1;
         }
-#endif
-        return SD_OK;
     }
-
-    return SD_FromHalStatus(HAL_SPI_Transmit(sd_handle->hspi, (uint8_t *)buffer, len, SD_SPI_IO_TIMEOUT_MS));
+    return crc & 0x7FU;
 }
+#endif
 
-static SD_Status SD_SPI_TransmitReceive(SD_Handle_t *sd_handle, const uint8_t *tx, uint8_t *rx, uint16_t len, bool use_dma) {
-    if (use_dma) {
-#if defined(USE_FREERTOS)
-        if (sd_handle->dma_rx_sem == NULL) {
-            return SD_ERROR;
-        }
-        (void)xSemaphoreTake(sd_handle->dma_rx_sem, 0);
+#if (SD_CRC_ENABLED == 1)
+/* CRC16-CCITT (x^16 + x^12 + x^5 + 1), one table lookup per byte. */
+static const uint16_t s_crc16_table[256] = {
+    0x0000U, 0x1021U, 0x2042U, 0x3063U, 0x4084U, 0x50A5U, 0x60C6U, 0x70E7U,
+    0x8108U, 0x9129U, 0xA14AU, 0xB16BU, 0xC18CU, 0xD1ADU, 0xE1CEU, 0xF1EFU,
+    0x1231U, 0x0210U, 0x3273U, 0x2252U, 0x52B5U, 0x4294U, 0x72F7U, 0x62D6U,
+    0x9339U, 0x8318U, 0xB37BU, 0xA35AU, 0xD3BDU, 0xC39CU, 0xF3FFU, 0xE3DEU,
+    0x2462U, 0x3443U, 0x0420U, 0x1401U, 0x64E6U, 0x74C7U, 0x44A4U, 0x5485U,
+    0xA56AU, 0xB54BU, 0x8528U, 0x9509U, 0xE5EEU, 0xF5CFU, 0xC5ACU, 0xD58DU,
+    0x3653U, 0x2672U, 0x1611U, 0x0630U, 0x76D7U, 0x66F6U, 0x5695U, 0x46B4U,
+    0xB75BU, 0xA77AU, 0x9719U, 0x8738U, 0xF7DFU, 0xE7FEU, 0xD79DU, 0xC7BCU,
+    0x48C4U, 0x58E5U, 0x6886U, 0x78A7U, 0x0840U, 0x1861U, 0x2802U, 0x3823U,
+    0xC9CCU, 0xD9EDU, 0xE98EU, 0xF9AFU, 0x8948U, 0x9969U, 0xA90AU, 0xB92BU,
+    0x5AF5U, 0x4AD4U, 0x7AB7U, 0x6A96U, 0x1A71U, 0x0A50U, 0x3A33U, 0x2A12U,
+    0xDBFDU, 0xCBDCU, 0xFBBFU, 0xEB9EU, 0x9B79U, 0x8B58U, 0xBB3BU, 0xAB1AU,
+    0x6CA6U, 0x7C87U, 0x4CE4U, 0x5CC5U, 0x2C22U, 0x3C03U, 0x0C60U, 0x1C41U,
+    0xEDAEU, 0xFD8FU, 0xCDECU, 0xDDCDU, 0xAD2AU, 0xBD0BU, 0x8D68U, 0x9D49U,
+    0x7E97U, 0x6EB6U, 0x5ED5U, 0x4EF4U, 0x3E13U, 0x2E32U, 0x1E51U, 0x0E70U,
+    0xFF9FU, 0xEFBEU, 0xDFDDU, 0xCFFCU, 0xBF1BU, 0xAF3AU, 0x9F59U, 0x8F78U,
+    0x9188U, 0x81A9U, 0xB1CAU, 0xA1EBU, 0xD10CU, 0xC12DU, 0xF14EU, 0xE16FU,
+    0x1080U, 0x00A1U, 0x30C2U, 0x20E3U, 0x5004U, 0x4025U, 0x7046U, 0x6067U,
+    0x83B9U, 0x9398U, 0xA3FBU, 0xB3DAU, 0xC33DU, 0xD31CU, 0xE37FU, 0xF35EU,
+    0x02B1U, 0x1290U, 0x22F3U, 0x32D2U, 0x4235U, 0x5214U, 0x6277U, 0x7256U,
+    0xB5EAU, 0xA5CBU, 0x95A8U, 0x8589U, 0xF56EU, 0xE54FU, 0xD52CU, 0xC50DU,
+    0x34E2U, 0x24C3U, 0x14A0U, 0x0481U, 0x7466U, 0x6447U, 0x5424U, 0x4405U,
+    0xA7DBU, 0xB7FAU, 0x8799U, 0x97B8U, 0xE75FU, 0xF77EU, 0xC71DU, 0xD73CU,
+    0x26D3U, 0x36F2U, 0x0691U, 0x16B0U, 0x6657U, 0x7676U, 0x4615U, 0x5634U,
+    0xD94CU, 0xC96DU, 0xF90EU, 0xE92FU, 0x99C8U, 0x89E9U, 0xB98AU, 0xA9ABU,
+    0x5844U, 0x4865U, 0x7806U, 0x6827U, 0x18C0U, 0x08E1U, 0x3882U, 0x28A3U,
+    0xCB7DU, 0xDB5CU, 0xEB3FU, 0xFB1EU, 0x8BF9U, 0x9BD8U, 0xABBBU, 0xBB9AU,
+    0x4A75U, 0x5A54U, 0x6A37U, 0x7A16U, 0x0AF1U, 0x1AD0U, 0x2AB3U, 0x3A92U,
+    0xFD2EU, 0xED0FU, 0xDD6CU, 0xCD4DU, 0xBDAAU, 0xAD8BU, 0x9DE8U, 0x8DC9U,
+    0x7C26U, 0x6C07U, 0x5C64U, 0x4C45U, 0x3CA2U, 0x2C83U, 0x1CE0U, 0x0CC1U,
+    0xEF1FU, 0xFF3EU, 0xCF5DU, 0xDF7CU, 0xAF9BU, 0xBFBAU, 0x8FD9U, 0x9FF8U,
+    0x6E17U, 0x7E36U, 0x4E55U, 0x5E74U, 0x2E93U, 0x3EB2U, 0x0ED1U, 0x1EF0U,
+};
+
+static uint16_t SD_Crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)((crc << 8) ^ s_crc16_table[((crc >> 8) ^ data[i]) & 0xFFU]);
+    }
+    return crc;
+}
 #endif
-        SD_CacheClean(tx, len);
-        SD_CacheInvalidate(rx, len);
-        sd_handle->dma_rx_done = false;
-        sd_handle->dma_error = false;
-        if (HAL_SPI_TransmitReceive_DMA(sd_handle->hspi, (uint8_t *)tx, rx, len) != HAL_OK) {
-            return SD_ERROR;
-        }
-#if defined(USE_FREERTOS)
-        if (xSemaphoreTake(sd_handle->dma_rx_sem, pdMS_TO_TICKS(SD_DMA_TIMEOUT_MS)) != pdTRUE) {
-            (void)HAL_SPI_Abort(sd_handle->hspi);
-            return SD_TIMEOUT;
-        }
-        if (sd_handle->dma_error) {
-            return SD_ERROR;
-        }
+
+/* CRC16 sent after a data block: computed in CRC mode, 0xFFFF (ignored by the card) otherwise. */
+static void SD_DataCrc(const SD_Handle_t *sd_handle, const uint8_t *block, uint8_t *crc) {
+    uint16_t value = 0xFFFFU;
+#if (SD_CRC_ENABLED == 1)
+    if (sd_handle->crc_on) {
+        value = SD_Crc16(block, SD_BLOCK_SIZE);
+    }
 #else
-        uint32_t dma_start = HAL_GetTick();
-        while (!sd_handle->dma_rx_done && (HAL_GetTick() - dma_start) < SD_DMA_TIMEOUT_MS) {
-            SD_BackoffDelay();
-        }
-        if (!sd_handle->dma_rx_done) {
-            (void)HAL_SPI_Abort(sd_handle->hspi);
-            return SD_TIMEOUT;
-        }
-        if (sd_handle->dma_error) {
-            return SD_ERROR;
-        }
+    (void)sd_handle;
+    (void)block;
 #endif
-        SD_CacheInvalidate(rx, len);
-        return SD_OK;
-    }
-
-    return SD_FromHalStatus(HAL_SPI_TransmitReceive(sd_handle->hspi, (uint8_t *)tx, rx, len, SD_SPI_IO_TIMEOUT_MS));
+    crc[0] = (uint8_t)(value >> 8);
+    crc[1] = (uint8_t)value;
 }
 
-static SD_Status SD_TransmitByte(SD_Handle_t *sd_handle, uint8_t data) {
-    return SD_SPI_Transmit(sd_handle, &data, 1, false);
+/* Verify the CRC16 that trailed a received block (always passes outside CRC mode). */
+static SD_Status SD_CheckDataCrc(SD_Handle_t *sd_handle, const uint8_t *block,
+                                 const uint8_t *crc) {
+#if (SD_CRC_ENABLED == 1)
+    if (sd_handle->crc_on &&
+        SD_Crc16(block, SD_BLOCK_SIZE) != (uint16_t)(((uint16_t)crc[0] << 8) | crc[1])) {
+        sd_handle->stats.crc_errors++;
+        return SD_CRC_ERROR;
+    }
+#else
+    (void)sd_handle;
+    (void)block;
+    (void)crc;
+#endif
+    return SD_OK;
 }
 
-static SD_Status SD_ReceiveByteTimeout(SD_Handle_t *sd_handle, uint8_t *data, uint32_t timeout_ms) {
-    uint8_t dummy = 0xFFU;
-    return SD_FromHalStatus(HAL_SPI_TransmitReceive(sd_handle->hspi, &dummy, data, 1, timeout_ms));
+#if (SD_LATENCY_STATS == 1)
+/*
+ * Bus utilization: cycles with a transfer in flight, and gaps between
+ * transfers while the card is selected. A DMA or IRQ transfer begins when
+ * it is armed and ends when its wait returns; a polled one spans the HAL or
+ * LL call. A transfer that never reaches its wait is dropped by the next.
+ */
+static SD_RAMFUNC void SD_BusBegin(SD_Handle_t *sd_handle) {
+    uint32_t now = DWT->CYCCNT;
+    if (sd_handle->bus_selected && !sd_handle->bus_active) {
+        uint32_t gap = now - sd_handle->bus_mark;
+        sd_handle->stats.bus_gap_cycles += gap;
+        if (gap > sd_handle->stats.bus_gap_max_cycles) {
+            sd_handle->stats.bus_gap_max_cycles = gap;
+        }
+    }
+    sd_handle->bus_mark = now;
+    sd_handle->bus_active = true;
 }
 
-static SD_Status SD_ReceiveByte(SD_Handle_t *sd_handle, uint8_t *data) {
-    return SD_ReceiveByteTimeout(sd_handle, data, SD_SPI_IO_TIMEOUT_MS);
+static SD_RAMFUNC void SD_BusEnd(SD_Handle_t *sd_handle) {
+    uint32_t now = DWT->CYCCNT;
+    if (sd_handle->bus_active) {
+        sd_handle->stats.bus_xfer_cycles += now - sd_handle->bus_mark;
+#if (SD_ENERGY_STATS == 1)
+        if (sd_handle->bus_selected && !sd_handle->energy_wait) {
+            sd_handle->stats.bus_data_cycles += now - sd_handle->bus_mark;
+        }
+#endif
+        sd_handle->bus_active = false;
+    }
+    sd_handle->bus_mark = now;
 }
+#else
+#define SD_BusBegin(sd_handle) ((void)(sd_handle))
+#define SD_BusEnd(sd_handle)   ((void)(sd_handle))
+#endif
 
-static SD_Status SD_WaitReady(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
-    uint32_t start = HAL_GetTick();
-    uint8_t resp = 0x00U;
-    uint32_t io_timeout = (timeout_ms < SD_SPI_IO_TIMEOUT_MS) ? timeout_ms : SD_SPI_IO_TIMEOUT_MS;
-    if (io_timeout == 0U) {
-        io_timeout = 1U;
+static void SD_Select(SD_Handle_t *sd_handle) {
+    HAL_GPIO_WritePin(sd_handle->cs_port, sd_handle->cs_pin, GPIO_PIN_RESET);
+#if (SD_ENERGY_STATS == 1)
+    if (!sd_handle->bus_selected) {
+        sd_handle->select_mark = DWT->CYCCNT;
     }
-
-    do {
-        if (SD_ReceiveByteTimeout(sd_handle, &resp, io_timeout) != SD_OK) {
-            return SD_ERROR;
-        }
-        if (resp == 0xFFU) {
-            return SD_OK;
-        }
-        SD_BackoffDelay();
-    } while ((HAL_GetTick() - start) < timeout_ms);
-
-    return SD_TIMEOUT;
+#endif
+#if (SD_LATENCY_STATS == 1)
+    sd_handle->bus_selected = true;
+    sd_handle->bus_active = false;
+    sd_handle->bus_mark = DWT->CYCCNT;
+#endif
 }
 
-static SD_Status SD_WaitDataToken(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
-    uint32_t start = HAL_GetTick();
-    uint8_t token = 0x00U;
-    uint32_t io_timeout = (timeout_ms < SD_SPI_IO_TIMEOUT_MS) ? timeout_ms : SD_SPI_IO_TIMEOUT_MS;
-    if (io_timeout == 0U) {
-        io_timeout = 1U;
+static void SD_Deselect(SD_Handle_t *sd_handle) {
+    HAL_GPIO_WritePin(sd_handle->cs_port, sd_handle->cs_pin, GPIO_PIN_SET);
+#if (SD_ENERGY_STATS == 1)
+    if (sd_handle->bus_selected) {
+        sd_handle->stats.selected_cycles += DWT->CYCCNT - sd_handle->select_mark;
     }
+#endif
+#if (SD_LATENCY_STATS == 1)
+    sd_handle->bus_selected = false;
+#endif
+}
 
-    do {
-        if (SD_ReceiveByteTimeout(sd_handle, &token, io_timeout) != SD_OK) {
-            return SD_ERROR;
-        }
-        if (token == SD_TOKEN_START_BLOCK) {
-            return SD_OK;
-        }
-        SD_BackoffDelay();
-    } while ((HAL_GetTick() - start) < timeout_ms);
+#if (SD_SPI_LL_FASTPATH == 1)
+/* Data-register access; 8-bit accesses keep FIFO parts (F0/F3/F7/L4) at one frame. */
+#ifndef SD_LL_WRITE_DR
+#define SD_LL_WRITE_DR(hspi, b)  (*(volatile uint8_t *)&(hspi)->Instance->DR = (uint8_t)(b))
+#define SD_LL_READ_DR(hspi)      (*(volatile uint8_t *)&(hspi)->Instance->DR)
+#define SD_LL_DISCARD_DR(hspi)   ((void)SD_LL_READ_DR(hspi))
+#endif
 
-    return SD_TIMEOUT;
+static SD_RAMFUNC bool SD_LL_WaitFlag(SPI_HandleTypeDef *hspi, uint32_t flag) {
+    for (uint32_t spin = SD_SPI_LL_SPIN_LIMIT; spin > 0U; spin--) {
+        if (__HAL_SPI_GET_FLAG(hspi, flag)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static SD_Status SD_SendCommand(SD_Handle_t *sd_handle, uint8_t cmd, uint32_t arg, uint8_t crc, uint8_t *response) {
-    SD_Status status = SD_WaitReady(sd_handle, SD_CMD_TIMEOUT_MS);
-    if (status != SD_OK) {
-        return status;
+/*
+ * Exchange len bytes by polling TXE/RXNE. One frame is in flight at a time,
+ * so RX never overruns; rx == NULL discards what the card returns. A stale
+ * RXNE left by an earlier transfer is drained first.
+ */
+static SD_RAMFUNC SD_Status SD_LL_Exchange(SD_Handle_t *sd_handle, const uint8_t *tx,
+                                           uint8_t *rx, uint16_t len) {
+    SPI_HandleTypeDef *hspi = sd_handle->hspi;
+    __HAL_SPI_ENABLE(hspi);
+    if (__HAL_SPI_GET_FLAG(hspi, SPI_FLAG_RXNE)) {
+        SD_LL_DISCARD_DR(hspi);
     }
-
-    if (SD_TransmitByte(sd_handle, 0xFFU) != SD_OK) return SD_ERROR;
-    if (SD_TransmitByte(sd_handle, 0x40U | cmd) != SD_OK) return SD_ERROR;
-    if (SD_TransmitByte(sd_handle, (uint8_t)(arg >> 24)) != SD_OK) return SD_ERROR;
-    if (SD_TransmitByte(sd_handle, (uint8_t)(arg >> 16)) != SD_OK) return SD_ERROR;
-    if (SD_TransmitByte(sd_handle, (uint8_t)(arg >> 8)) != SD_OK) return SD_ERROR;
-    if (SD_TransmitByte(sd_handle, (uint8_t)arg) != SD_OK) return SD_ERROR;
-    if (SD_TransmitByte(sd_handle, crc) != SD_OK) return SD_ERROR;
-
-    uint8_t resp = 0xFFU;
-    for (uint8_t retry = 0; retry < 10; retry++) {
-        if (SD_ReceiveByte(sd_handle, &resp) != SD_OK) {
-            return SD_ERROR;
+    for (uint16_t i = 0; i < len; i++) {
+        if (!SD_LL_WaitFlag(hspi, SPI_FLAG_TXE)) {
+            return SD_TIMEOUT;
         }
-        if ((resp & 0x80U) == 0U) {
-            if (response) {
-                *response = resp;
-            }
-            return SD_OK;
+        SD_LL_WRITE_DR(hspi, tx ? tx[i] : 0xFFU);
+        if (!SD_LL_WaitFlag(hspi, SPI_FLAG_RXNE)) {
+            return SD_TIMEOUT;
+        }
+        if (rx) {
+            rx[i] = SD_LL_READ_DR(hspi);
+        } else {
+            SD_LL_DISCARD_DR(hspi);
         }
     }
-
-    return SD_TIMEOUT;
+    return SD_OK;
 }
+#endif
 
-static SD_Status SD_ReadCSD(SD_Handle_t *sd_handle, uint8_t *csd) {
-    SD_Status status;
-    uint8_t response = 0xFFU;
-
-    SD_Select(sd_handle);
-    status = SD_SendCommand(sd_handle, SD_CMD9, 0, 0xFFU, &response);
-    if (status != SD_OK || response != 0x00U) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return SD_ERROR;
+/*
+ * Backend for one transfer. Transfers shorter than xfer_threshold are polled:
+ * a command frame or a CRC costs less on the CPU than a DMA or IRQ set-up.
+ * Longer ones use DMA when the caller allows it (handle in DMA mode, buffer
+ * aligned), else interrupts when the handle is in IRQ mode, else polling.
+ */
+static SD_XferMode SD_XferSelect(SD_Handle_t *sd_handle, uint16_t len, bool use_dma) {
+    SD_XferMode mode = SD_XFER_POLL;
+    if (len >= sd_handle->xfer_threshold) {
+        if (use_dma) {
+            mode = SD_XFER_DMA;
+        } else if (sd_handle->use_irq) {
+            mode = SD_XFER_IRQ;
+        }
     }
+    sd_handle->stats.xfers[mode]++;
+    return mode;
+}
 
-    status = SD_WaitDataToken(sd_handle, SD_DATA_TOKEN_TIMEOUT_MS);
-    if (status != SD_OK) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return status;
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 1)
+/*
+ * Sleep on the task notification until the completion flag is set. Wake-ups
+ * some other producer sent meanwhile are given back to the task afterwards.
+ */
+static bool SD_XferNotifyWait(SD_Handle_t *sd_handle, volatile bool *done) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(SD_DMA_TIMEOUT_MS);
+    uint32_t taken = 0;
+    while (!*done) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            break;
+        }
+        taken += ulTaskNotifyTake(pdTRUE, timeout - elapsed);
     }
-
-    SD_Status rx_status = SD_SPI_TransmitReceive(sd_handle, s_dummy_tx, csd, 16, false);
-    if (rx_status != SD_OK) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return rx_status;
+    sd_handle->xfer_task = NULL;
+    /* A give that landed after the last take is still pending; collect it too. */
+    taken += ulTaskNotifyTake(pdTRUE, 0);
+    uint32_t own = sd_handle->xfer_gives;
+    for (uint32_t i = own; i < taken; i++) {
+        (void)xTaskNotifyGive(xTaskGetCurrentTaskHandle());
     }
+    return *done;
+}
+#endif
 
-    (void)SD_ReceiveByte(sd_handle, &response);
-    (void)SD_ReceiveByte(sd_handle, &response);
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
-
+static SD_Status SD_XferPend(SD_Handle_t *sd_handle, bool tx) {
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 1)
+    if (!SD_XferNotifyWait(sd_handle, tx ? &sd_handle->dma_tx_done : &sd_handle->dma_rx_done)) {
+        (void)HAL_SPI_Abort(sd_handle->hspi);
+        return SD_TIMEOUT;
+    }
+#elif defined(USE_FREERTOS)
+    SemaphoreHandle_t sem = tx ? sd_handle->dma_tx_sem : sd_handle->dma_rx_sem;
+    if (xSemaphoreTake(sem, pdMS_TO_TICKS(SD_DMA_TIMEOUT_MS)) != pdTRUE) {
+        (void)HAL_SPI_Abort(sd_handle->hspi);
+        return SD_TIMEOUT;
+    }
+#else
+    volatile bool *done = tx ? &sd_handle->dma_tx_done : &sd_handle->dma_rx_done;
+    uint32_t dma_start = HAL_GetTick();
+    while (!*done && (HAL_GetTick() - dma_start) < SD_DMA_TIMEOUT_MS) {
+        SD_BackoffDelay();
+    }
+    if (!*done) {
+        (void)HAL_SPI_Abort(sd_handle->hspi);
+        return SD_TIMEOUT;
+    }
+#endif
+    if (sd_handle->dma_error) {
+        return SD_ERROR;
+    }
     return SD_OK;
 }
 
-static void SD_ParseCSD(SD_Handle_t *sd_handle, const uint8_t *csd) {
-    uint8_t csd_structure = (csd[0] >> 6) & 0x3U;
+/* Wait for the completion callback of a DMA or IRQ transfer. */
+static SD_Status SD_XferWait(SD_Handle_t *sd_handle, bool tx) {
+    uint32_t start = SD_LatencyStart();
+    SD_Status status = SD_XferPend(sd_handle, tx);
+    SD_LatencyRecord(sd_handle, SD_LAT_DMA, start);
+    SD_BusEnd(sd_handle);
+    return status;
+}
 
-    if (csd_structure == 1U) {
-        uint32_t c_size = ((uint32_t)(csd[7] & 0x3FU) << 16) |
-                          ((uint32_t)csd[8] << 8) |
-                          (uint32_t)csd[9];
-        sd_handle->capacity_blocks = (c_size + 1U) * 1024U;
-    } else if (csd_structure == 0U) {
-        uint32_t c_size = ((uint32_t)(csd[6] & 0x03U) << 10) |
-                          ((uint32_t)csd[7] << 2) |
-                          ((uint32_t)csd[8] >> 6);
-        uint32_t c_size_mult = ((uint32_t)(csd[9] & 0x03U) << 1) |
-                               ((uint32_t)(csd[10] >> 7) & 0x01U);
-        uint32_t read_bl_len = csd[5] & 0x0FU;
-        uint32_t block_len = 1UL << read_bl_len;
-        uint32_t mult = 1UL << (c_size_mult + 2U);
-        uint32_t blocknr = (c_size + 1U) * mult;
-        uint32_t capacity_bytes = blocknr * block_len;
-        sd_handle->capacity_blocks = capacity_bytes / SD_BLOCK_SIZE;
+/* Arm the completion flag and semaphore (or notification) before starting a DMA or IRQ transfer. */
+static SD_Status SD_XferArm(SD_Handle_t *sd_handle, bool tx) {
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 1)
+    sd_handle->xfer_gives = 0;
+    sd_handle->xfer_task = xTaskGetCurrentTaskHandle();
+#elif defined(USE_FREERTOS)
+    SemaphoreHandle_t sem = tx ? sd_handle->dma_tx_sem : sd_handle->dma_rx_sem;
+    if (sem == NULL) {
+        return SD_ERROR;
+    }
+    (void)xSemaphoreTake(sem, 0);
+#endif
+    if (tx) {
+        sd_handle->dma_tx_done = false;
     } else {
-        sd_handle->capacity_blocks = 0;
+        sd_handle->dma_rx_done = false;
     }
+    sd_handle->dma_error = false;
+#if (SD_TRACE_ENABLED == 1)
+    sd_handle->dma_start = SD_TraceNow();
+#endif
+    SD_BusBegin(sd_handle);
+    return SD_OK;
 }
 
-static SD_Status SD_SetBlockLength(SD_Handle_t *sd_handle) {
-    SD_Status status;
-    uint8_t response = 0xFFU;
+#if (SD_DMA_PROFILE == 1) || (SD_SPI_FRAME16 == 1) || (SD_DMA_FIXED_TX == 1)
+/* Stream layouts cached in dma_layout[]; 0 means unknown. */
+#define SD_DMA_LAYOUT_SET    0x01U
+#define SD_DMA_LAYOUT_WIDE   0x02U // Half-word peripheral side (16-bit frames)
+#define SD_DMA_LAYOUT_PACKED 0x04U // Word memory side through the FIFO
+#define SD_DMA_LAYOUT_FIXED  0x08U // Memory address held: one 0xFF beat repeated
 
-    SD_Select(sd_handle);
-    status = SD_SendCommand(sd_handle, SD_CMD16, SD_BLOCK_SIZE, 0xFFU, &response);
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+/* Bytes in one 4-beat word burst, which is also the FIFO depth. */
+#define SD_DMA_PACK_BYTES 16U
 
-    if (status != SD_OK || response != 0x00U) {
+static SD_Status SD_DmaSetLayout(SD_Handle_t *sd_handle, uint32_t idx, uint8_t layout) {
+    DMA_HandleTypeDef *hdma = idx ? sd_handle->hspi->hdmarx : sd_handle->hspi->hdmatx;
+    if (hdma == NULL || sd_handle->dma_layout[idx] == layout) {
+        return SD_OK;
+    }
+    bool wide = (layout & SD_DMA_LAYOUT_WIDE) != 0U;
+    hdma->Init.PeriphDataAlignment = wide ? DMA_PDATAALIGN_HALFWORD : DMA_PDATAALIGN_BYTE;
+    hdma->Init.MemDataAlignment = wide ? DMA_MDATAALIGN_HALFWORD : DMA_MDATAALIGN_BYTE;
+#if (SD_DMA_FIXED_TX == 1)
+    hdma->Init.MemInc = (layout & SD_DMA_LAYOUT_FIXED) ? DMA_MINC_DISABLE : DMA_MINC_ENABLE;
+#endif
+#if (SD_DMA_PROFILE == 1)
+    const SD_DmaProfile *p = &sd_handle->dma_profile;
+    bool packed = (layout & SD_DMA_LAYOUT_PACKED) != 0U;
+    hdma->Init.Priority = p->priority;
+    hdma->Init.FIFOMode = p->fifo ? DMA_FIFOMODE_ENABLE : DMA_FIFOMODE_DISABLE;
+    hdma->Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    hdma->Init.PeriphBurst = DMA_PBURST_SINGLE;
+    hdma->Init.MemBurst = packed ? p->mem_burst : DMA_MBURST_SINGLE;
+    if (packed) {
+        hdma->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    }
+#endif
+    sd_handle->dma_layout[idx] = 0U;
+#if (SD_DMA_DESCRIPTORS == 1)
+    sd_handle->dma_desc_ready = false;
+#endif
+    sd_handle->stats.dma_reconfigs++;
+    if (HAL_DMA_Init(hdma) != HAL_OK) {
         return SD_ERROR;
     }
-
+    sd_handle->dma_layout[idx] = layout;
     return SD_OK;
 }
 
-static SD_Status SD_ReadSingleBlockInternal(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t address) {
-    SD_Select(sd_handle);
-    uint8_t response = 0xFFU;
-    SD_Status status = SD_SendCommand(sd_handle, SD_CMD17, address, 0xFFU, &response);
-    if (status != SD_OK || response != 0x00U) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return SD_ERROR;
+static uint8_t SD_DmaLayoutFor(SD_Handle_t *sd_handle, const void *buf, uint32_t bytes, bool wide) {
+    uint8_t layout = SD_DMA_LAYOUT_SET | (wide ? SD_DMA_LAYOUT_WIDE : 0U);
+#if (SD_DMA_PROFILE == 1)
+    if (sd_handle->dma_profile.word_mem && SD_IsAligned(buf, SD_DMA_PACK_BYTES) &&
+        (bytes % SD_DMA_PACK_BYTES) == 0U) {
+        layout |= SD_DMA_LAYOUT_PACKED;
     }
+#else
+    (void)sd_handle;
+    (void)buf;
+    (void)bytes;
+#endif
+    return layout;
+}
 
-    status = SD_WaitDataToken(sd_handle, SD_DATA_TOKEN_TIMEOUT_MS);
-    if (status != SD_OK) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return status;
+/*
+ * Lay out the stream(s) of the next DMA transfer: tx feeds the TX stream (NULL
+ * for the all-0xFF source), rx (NULL for transmit-only) the RX stream; bytes
+ * counts wire bytes.
+ */
+static SD_Status SD_DmaPrepare(SD_Handle_t *sd_handle, const void *tx, const void *rx,
+                               uint32_t bytes, bool wide) {
+#if (SD_DMA_FIXED_TX == 1)
+    uint8_t tx_layout = tx ? SD_DmaLayoutFor(sd_handle, tx, bytes, wide)
+                           : (uint8_t)(SD_DMA_LAYOUT_SET | SD_DMA_LAYOUT_FIXED |
+                                       (wide ? SD_DMA_LAYOUT_WIDE : 0U));
+#else
+    uint8_t tx_layout = SD_DmaLayoutFor(sd_handle, tx ? tx : s_dummy_tx, bytes, wide);
+#endif
+    if (SD_DmaSetLayout(sd_handle, 0U, tx_layout) != SD_OK) {
+        return SD_ERROR;
     }
-
-    bool use_dma = sd_handle->use_dma && SD_IsAligned(buff, SD_DMA_ALIGNMENT);
-    status = SD_SPI_TransmitReceive(sd_handle, s_dummy_tx, buff, SD_BLOCK_SIZE, use_dma);
-    if (status != SD_OK) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return status;
+    bool packed = (tx_layout & SD_DMA_LAYOUT_PACKED) != 0U;
+    if (rx != NULL) {
+        uint8_t rx_layout = SD_DmaLayoutFor(sd_handle, rx, bytes, wide);
+        if (SD_DmaSetLayout(sd_handle, 1U, rx_layout) != SD_OK) {
+            return SD_ERROR;
+        }
+        packed = packed || (rx_layout & SD_DMA_LAYOUT_PACKED) != 0U;
+    }
+    if (packed) {
+        sd_handle->stats.dma_packed++;
     }
+    return SD_OK;
+}
 
-    uint8_t crc[2];
-    (void)SD_SPI_TransmitReceive(sd_handle, s_dummy_tx, crc, 2, false);
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+/* Forget the cached layouts, e.g. after MSP init has re-run HAL_DMA_Init. */
+static void SD_DmaInvalidate(SD_Handle_t *sd_handle) {
+    sd_handle->dma_layout[0] = 0U;
+    sd_handle->dma_layout[1] = 0U;
+#if (SD_DMA_DESCRIPTORS == 1)
+    sd_handle->dma_desc_ready = false;
+#endif
+}
 
+#if (SD_DMA_PROFILE == 1)
+/* Re-initialize both streams with the handle's profile, in the byte layout. */
+static SD_Status SD_DmaApplyProfile(SD_Handle_t *sd_handle) {
+    SD_DmaInvalidate(sd_handle);
+    for (uint32_t i = 0; i < 2U; i++) {
+        if (SD_DmaSetLayout(sd_handle, i, SD_DMA_LAYOUT_SET) != SD_OK) {
+            return SD_ERROR;
+        }
+    }
     return SD_OK;
 }
+#endif
+#else
+#define SD_DmaPrepare(sd_handle, tx, rx, bytes, wide) SD_OK
+#if (SD_DMA_DESCRIPTORS == 1)
+#define SD_DmaInvalidate(sd_handle) ((void)((sd_handle)->dma_desc_ready = false))
+#else
+#define SD_DmaInvalidate(sd_handle) ((void)0)
+#endif
+#endif
 
-static SD_Status SD_WriteSingleBlockInternal(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t address) {
-    SD_Select(sd_handle);
-    uint8_t response = 0xFFU;
-    SD_Status status = SD_SendCommand(sd_handle, SD_CMD24, address, 0xFFU, &response);
-    if (status != SD_OK || response != 0x00U) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return SD_ERROR;
-    }
+#if (SD_DMA_DESCRIPTORS == 1)
+#ifndef SD_DESC_ARM
+/* LISR/LIFCR or HISR/HIFCR of a stream's controller, as HAL_DMA_Init located them. */
+typedef struct {
+    volatile uint32_t ISR;
+    volatile uint32_t reserved;
+    volatile uint32_t IFCR;
+} SD_DmaFlagRegs;
+
+/* A stream's setup bits as HAL_DMA_Init left them; also points it at the SPI data register. */
+static uint32_t SD_DescCapture(DMA_HandleTypeDef *hdma, SPI_HandleTypeDef *hspi) {
+    hdma->Instance->PAR = (uint32_t)(uintptr_t)&hspi->Instance->DR;
+    return hdma->Instance->CR & ~(DMA_SxCR_EN | DMA_SxCR_TCIE | DMA_SxCR_HTIE | DMA_SxCR_TEIE |
+                                  DMA_SxCR_DMEIE | DMA_SxCR_DBM | DMA_SxCR_CT);
+}
 
-    (void)SD_TransmitByte(sd_handle, SD_TOKEN_START_BLOCK);
-    bool use_dma = sd_handle->use_dma && SD_IsAligned(buff, SD_DMA_ALIGNMENT);
-    status = SD_SPI_Transmit(sd_handle, buff, SD_BLOCK_SIZE, use_dma);
-    if (status != SD_OK) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return status;
+static SD_RAMFUNC void SD_DescStop(DMA_HandleTypeDef *hdma) {
+    CLEAR_BIT(hdma->Instance->CR, DMA_SxCR_EN);
+    /* The stream finishes its current beat before EN reads back clear. */
+    for (uint32_t spin = SD_SPI_LL_SPIN_LIMIT;
+         spin > 0U && READ_BIT(hdma->Instance->CR, DMA_SxCR_EN) != 0U; spin--) {
     }
+}
 
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+static SD_RAMFUNC void SD_DescArm(DMA_HandleTypeDef *hdma, uint32_t cr, void *mem, uint16_t len) {
+    ((SD_DmaFlagRegs *)(uintptr_t)hdma->StreamBaseAddress)->IFCR = 0x3FU << hdma->StreamIndex;
+    hdma->Instance->NDTR = len;
+    hdma->Instance->M0AR = (uint32_t)(uintptr_t)mem;
+    hdma->Instance->CR = cr | DMA_SxCR_EN;
+}
 
-    (void)SD_ReceiveByte(sd_handle, &response);
-    if ((response & SD_DATA_RESP_MASK) != SD_DATA_RESP_ACCEPTED) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        return (response == SD_DATA_RESP_CRC_ERR) ? SD_CRC_ERROR : SD_WRITE_ERROR;
+/* RX request before TX, so the first received frame already has a taker. */
+static SD_RAMFUNC void SD_DescRequests(SPI_HandleTypeDef *hspi, bool on) {
+    if (!on) {
+        CLEAR_BIT(hspi->Instance->CR2, SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+        return;
     }
+    if (__HAL_SPI_GET_FLAG(hspi, SPI_FLAG_RXNE)) {
+        (void)*(volatile uint8_t *)&hspi->Instance->DR; /* stale frame from a polled transmit */
+    }
+    SET_BIT(hspi->Instance->CR2, SPI_CR2_RXDMAEN);
+    __HAL_SPI_ENABLE(hspi);
+    SET_BIT(hspi->Instance->CR2, SPI_CR2_TXDMAEN);
+}
 
-    status = SD_WaitReady(sd_handle, SD_WRITE_BUSY_TIMEOUT_MS);
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+#define SD_DESC_CAPTURE(hdma, hspi)     SD_DescCapture((hdma), (hspi))
+#define SD_DESC_ARM(hdma, cr, mem, len) SD_DescArm((hdma), (cr), (mem), (len))
+#define SD_DESC_STOP(hdma)              SD_DescStop(hdma)
+#define SD_DESC_REQUESTS(hspi, on)      SD_DescRequests((hspi), (on))
+#endif
 
-    return status;
+/* Sink of transmit-only transfers: the RX stream drains into it with memory increment off. */
+static uint32_t s_desc_sink SD_DMA_BUF;
+
+static SD_RAMFUNC void SD_DmaDispatch(SPI_HandleTypeDef *hspi, bool tx, bool rx, bool error);
+
+static SD_RAMFUNC void SD_DescStopAll(SPI_HandleTypeDef *hspi) {
+    SD_DESC_REQUESTS(hspi, false);
+    SD_DESC_STOP(hspi->hdmatx);
+    SD_DESC_STOP(hspi->hdmarx);
 }
 
-static SD_Status SD_ReadMultiBlocksInternal(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count) {
-    if (!sd_handle || !buff || count == 0) {
-        return SD_PARAM;
-    }
-    if (!sd_handle->initialized) {
-        return SD_ERROR;
-    }
+/* RX stream complete (HAL_DMA_IRQHandler): every frame has been clocked, in either direction. */
+static SD_RAMFUNC void SD_DescDone(DMA_HandleTypeDef *hdma) {
+    SPI_HandleTypeDef *hspi = (SPI_HandleTypeDef *)hdma->Parent;
+    SD_DESC_REQUESTS(hspi, false);
+    SD_DmaDispatch(hspi, true, true, false);
+}
 
-    uint32_t address = sd_handle->is_sdhc ? sector : (sector * SD_BLOCK_SIZE);
-    SD_Select(sd_handle);
+static SD_RAMFUNC void SD_DescError(DMA_HandleTypeDef *hdma) {
+    SPI_HandleTypeDef *hspi = (SPI_HandleTypeDef *)hdma->Parent;
+    SD_DescStopAll(hspi);
+    SD_DmaDispatch(hspi, true, true, true);
+}
 
-    uint8_t response = 0xFFU;
-    SD_Status status = SD_SendCommand(sd_handle, SD_CMD18, address, 0xFFU, &response);
-    if (status != SD_OK || response != 0x00U) {
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
+/*
+ * Start a DMA transfer of len frames from the descriptors: tx is the source
+ * (never NULL here), rx the destination or NULL to discard what comes back.
+ * The descriptors are captured on first use after each stream (re)init and
+ * then reused for every block until the layout changes.
+ */
+static SD_RAMFUNC SD_Status SD_DescStart(SD_Handle_t *sd_handle, const uint8_t *tx, uint8_t *rx,
+                                         uint16_t len) {
+    SPI_HandleTypeDef *hspi = sd_handle->hspi;
+    DMA_HandleTypeDef *txs = hspi->hdmatx;
+    DMA_HandleTypeDef *rxs = hspi->hdmarx;
+    if (txs == NULL || rxs == NULL) {
         return SD_ERROR;
     }
+    if (!sd_handle->dma_desc_ready) {
+        sd_handle->dma_desc[0] = SD_DESC_CAPTURE(txs, hspi);
+        sd_handle->dma_desc[1] = SD_DESC_CAPTURE(rxs, hspi);
+        /* Same peripheral and memory width, single beats, held address. */
+        sd_handle->dma_desc[2] =
+            (sd_handle->dma_desc[1] & ~(DMA_SxCR_MINC | DMA_SxCR_MSIZE | DMA_SxCR_MBURST)) |
+            ((sd_handle->dma_desc[1] & DMA_SxCR_PSIZE) << 2);
+        sd_handle->dma_desc_ready = true;
+    }
+    /* HAL SPI DMA calls in between install their own stream callbacks. */
+    rxs->XferCpltCallback = SD_DescDone;
+    rxs->XferErrorCallback = SD_DescError;
+    txs->XferCpltCallback = NULL;
+    txs->XferErrorCallback = SD_DescError;
+    SD_DESC_ARM(rxs, sd_handle->dma_desc[rx ? 1U : 2U] | DMA_SxCR_TCIE | DMA_SxCR_TEIE,
+                rx ? (void *)rx : (void *)&s_desc_sink, len);
+    SD_DESC_ARM(txs, sd_handle->dma_desc[0] | DMA_SxCR_TEIE, (void *)tx, len);
+    sd_handle->stats.dma_desc_starts++;
+    SD_DESC_REQUESTS(hspi, true);
+    return SD_OK;
+}
+#endif
 
-    bool use_dma = sd_handle->use_dma && SD_IsAligned(buff, SD_DMA_ALIGNMENT);
-    for (uint32_t i = 0; i < count; i++) {
-        status = SD_WaitDataToken(sd_handle, SD_DATA_TOKEN_TIMEOUT_MS);
-        if (status != SD_OK) {
-            break;
+static SD_RAMFUNC SD_Status SD_SPI_Transmit(SD_Handle_t *sd_handle, const uint8_t *buffer, uint16_t len, bool use_dma) {
+    SD_XferMode mode = SD_XferSelect(sd_handle, len, use_dma);
+    if (mode == SD_XFER_POLL) {
+        SD_Status status;
+        SD_BusBegin(sd_handle);
+#if (SD_SPI_LL_FASTPATH == 1)
+        if (len <= SD_SPI_LL_MAX_BYTES) {
+            status = SD_LL_Exchange(sd_handle, buffer, NULL, len);
+        } else
+#endif
+        {
+            status = SD_FromHalStatus(HAL_SPI_Transmit(sd_handle->hspi, (uint8_t *)buffer, len, SD_SPI_IO_TIMEOUT_MS));
         }
+        SD_BusEnd(sd_handle);
+        return status;
+    }
 
-        if (use_dma) {
-            status = SD_SPI_TransmitReceive(sd_handle, s_dummy_tx, buff, SD_BLOCK_SIZE, true);
-        } else {
-            status = SD_SPI_TransmitReceive(sd_handle, s_dummy_tx, buff, SD_BLOCK_SIZE, false);
+    if (SD_XferArm(sd_handle, true) != SD_OK) {
+        return SD_ERROR;
+    }
+    HAL_StatusTypeDef hal;
+    if (mode == SD_XFER_DMA) {
+        if (SD_DmaPrepare(sd_handle, buffer, NULL, len, false) != SD_OK) {
+            return SD_ERROR;
+        }
+        SD_CacheClean(sd_handle, buffer, len);
+#if (SD_DMA_DESCRIPTORS == 1)
+        if (SD_DescStart(sd_handle, buffer, NULL, len) != SD_OK) {
+            return SD_ERROR;
         }
+        SD_Status status = SD_XferWait(sd_handle, true);
         if (status != SD_OK) {
-            break;
+            SD_DescStopAll(sd_handle->hspi);
         }
+        return status;
+#else
+        hal = HAL_SPI_Transmit_DMA(sd_handle->hspi, (uint8_t *)buffer, len);
+#endif
+    } else {
+        hal = HAL_SPI_Transmit_IT(sd_handle->hspi, (uint8_t *)buffer, len);
+    }
+    if (hal != HAL_OK) {
+        return SD_ERROR;
+    }
+    return SD_XferWait(sd_handle, true);
+}
+
+/* Start a full-duplex DMA transfer (tx NULL: all 0xFF); SD_SPI_RxDmaWait completes it. */
+static SD_Status SD_SPI_RxDmaStart(SD_Handle_t *sd_handle, const uint8_t *tx, uint8_t *rx, uint16_t len) {
+    if (SD_XferArm(sd_handle, false) != SD_OK) {
+        return SD_ERROR;
+    }
+    if (SD_DmaPrepare(sd_handle, tx, rx, len, false) != SD_OK) {
+        return SD_ERROR;
+    }
+    if (tx == NULL) {
+        tx = s_dummy_tx; /* cleaned once when filled */
+    } else {
+        SD_CacheClean(sd_handle, tx, len);
+    }
+    SD_CacheInvalidate(sd_handle, rx, len, false);
+#if (SD_DMA_DESCRIPTORS == 1)
+    return SD_DescStart(sd_handle, tx, rx, len);
+#else
+    if (HAL_SPI_TransmitReceive_DMA(sd_handle->hspi, (uint8_t *)tx, rx, len) != HAL_OK) {
+        return SD_ERROR;
+    }
+    return SD_OK;
+#endif
+}
+
+static SD_Status SD_SPI_RxDmaWait(SD_Handle_t *sd_handle, uint8_t *rx, uint16_t len) {
+    SD_Status status = SD_XferWait(sd_handle, false);
+    if (status != SD_OK) {
+#if (SD_DMA_DESCRIPTORS == 1)
+        SD_DescStopAll(sd_handle->hspi);
+#endif
+        return status;
+    }
+    SD_CacheInvalidate(sd_handle, rx, len, true);
+    return SD_OK;
+}
+
+static SD_RAMFUNC SD_Status SD_SPI_TransmitReceive(SD_Handle_t *sd_handle, const uint8_t *tx, uint8_t *rx, uint16_t len, bool use_dma) {
+    SD_XferMode mode = SD_XferSelect(sd_handle, len, use_dma);
+    if (mode == SD_XFER_DMA) {
+        SD_Status status = SD_SPI_RxDmaStart(sd_handle, tx, rx, len);
+        if (status != SD_OK) {
+            return status;
+        }
+        return SD_SPI_RxDmaWait(sd_handle, rx, len);
+    }
+#if (SD_SPI_LL_FASTPATH == 1)
+    if (mode == SD_XFER_POLL && len <= SD_SPI_LL_MAX_BYTES) {
+        SD_BusBegin(sd_handle);
+        SD_Status status = SD_LL_Exchange(sd_handle, tx, rx, len);
+        SD_BusEnd(sd_handle);
+        return status;
+    }
+#endif
+    if (tx == NULL) {
+#if (SD_DMA_FIXED_TX == 1)
+        /* Sent in place: each byte leaves before its slot is overwritten. */
+        memset(rx, 0xFF, len);
+        tx = rx;
+#else
+        tx = s_dummy_tx;
+#endif
+    }
+    if (mode == SD_XFER_IRQ) {
+        if (SD_XferArm(sd_handle, false) != SD_OK) {
+            return SD_ERROR;
+        }
+        if (HAL_SPI_TransmitReceive_IT(sd_handle->hspi, (uint8_t *)tx, rx, len) != HAL_OK) {
+            return SD_ERROR;
+        }
+        return SD_XferWait(sd_handle, false);
+    }
+    SD_BusBegin(sd_handle);
+    SD_Status status = SD_FromHalStatus(HAL_SPI_TransmitReceive(sd_handle->hspi, (uint8_t *)tx, rx, len, SD_SPI_IO_TIMEOUT_MS));
+    SD_BusEnd(sd_handle);
+    return status;
+}
+
+static SD_RAMFUNC SD_Status SD_TransmitByte(SD_Handle_t *sd_handle, uint8_t data) {
+    return SD_SPI_Transmit(sd_handle, &data, 1, false);
+}
+
+static SD_RAMFUNC SD_Status SD_ReceiveByteTimeout(SD_Handle_t *sd_handle, uint8_t *data, uint32_t timeout_ms) {
+    uint8_t dummy = 0xFFU;
+    sd_handle->stats.xfers[SD_XFER_POLL]++;
+    SD_BusBegin(sd_handle);
+#if (SD_SPI_LL_FASTPATH == 1)
+    (void)timeout_ms;
+    SD_Status status = SD_LL_Exchange(sd_handle, &dummy, data, 1U);
+#else
+    SD_Status status = SD_FromHalStatus(HAL_SPI_TransmitReceive(sd_handle->hspi, &dummy, data, 1, timeout_ms));
+#endif
+    SD_BusEnd(sd_handle);
+    return status;
+}
+
+static SD_RAMFUNC SD_Status SD_ReceiveByte(SD_Handle_t *sd_handle, uint8_t *data) {
+    return SD_ReceiveByteTimeout(sd_handle, data, SD_SPI_IO_TIMEOUT_MS);
+}
+
+/* Clock out len bytes of 0xFF and capture what the card returns. */
+static SD_RAMFUNC SD_Status SD_PollBytes(SD_Handle_t *sd_handle, uint8_t *rx, uint16_t len,
+                              uint32_t io_timeout) {
+    if (len == 1U) {
+        return SD_ReceiveByteTimeout(sd_handle, rx, io_timeout);
+    }
+    bool use_dma = sd_handle->use_dma && SD_IsAligned(rx, SD_DMA_ALIGNMENT);
+    return SD_SPI_TransmitReceive(sd_handle, NULL, rx, len, use_dma);
+}
+
+/* Spin for the first SD_POLL_SPIN_COUNT misses of a wait, then yield a tick per miss. */
+/* slept, if given, collects the cycles spent sleeping (SD_LATENCY_STATS). */
+static void SD_PollBackoff(uint32_t *spins, uint64_t *slept) {
+#if (SD_POLL_SPIN_COUNT > 0U)
+    if (*spins < SD_POLL_SPIN_COUNT) {
+        (*spins)++;
+        return;
+    }
+#else
+    (void)spins;
+#endif
+#if (SD_LATENCY_STATS == 1)
+    uint32_t start = SD_LatencyStart();
+    SD_BackoffDelay();
+    if (slept != NULL) {
+        *slept += DWT->CYCCNT - start;
+    }
+#else
+    (void)slept;
+    SD_BackoffDelay();
+#endif
+}
+
+#if (SD_LATENCY_STATS == 1)
+#define SD_BUSY_SLEPT(sd_handle) (&(sd_handle)->stats.busy_sleep_cycles)
+#else
+#define SD_BUSY_SLEPT(sd_handle) NULL
+#endif
+
+static uint32_t SD_PollIoTimeout(uint32_t timeout_ms) {
+    uint32_t io_timeout = (timeout_ms < SD_SPI_IO_TIMEOUT_MS) ? timeout_ms : SD_SPI_IO_TIMEOUT_MS;
+    return (io_timeout == 0U) ? 1U : io_timeout;
+}
+
+static SD_RAMFUNC SD_Status SD_PollReady(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+    uint32_t io_timeout = SD_PollIoTimeout(timeout_ms);
+    uint32_t spins = 0;
+    uint16_t len = 1U;
+    uint8_t window[SD_BUSY_POLL_BURST] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+    do {
+        if (SD_PollBytes(sd_handle, window, len, io_timeout) != SD_OK) {
+            return SD_ERROR;
+        }
+        /* DO stays high once busy is released, so the last byte decides. */
+        if (window[len - 1U] == 0xFFU) {
+            return SD_OK;
+        }
+        SD_PollBackoff(&spins, SD_BUSY_SLEPT(sd_handle));
+        len = SD_BUSY_POLL_BURST;
+    } while ((HAL_GetTick() - start) < timeout_ms);
+
+    return SD_TIMEOUT;
+}
+
+static SD_RAMFUNC SD_Status SD_PollDataToken(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+    uint32_t io_timeout = SD_PollIoTimeout(timeout_ms);
+    uint32_t spins = 0;
+    uint16_t len = 1U;
+    uint8_t window[SD_TOKEN_POLL_BURST] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+#if (SD_TOKEN_POLL_BURST > 1U)
+    sd_handle->rx_carry_len = 0;
+#endif
+    do {
+        if (SD_PollBytes(sd_handle, window, len, io_timeout) != SD_OK) {
+            return SD_ERROR;
+        }
+        for (uint16_t i = 0; i < len; i++) {
+            if (window[i] == SD_TOKEN_START_BLOCK) {
+#if (SD_TOKEN_POLL_BURST > 1U)
+                /* Anything after the token already belongs to the data block. */
+                sd_handle->rx_carry_len = (uint8_t)(len - i - 1U);
+                memcpy(sd_handle->rx_carry, &window[i + 1U], sd_handle->rx_carry_len);
+#endif
+                return SD_OK;
+            }
+        }
+        SD_PollBackoff(&spins, NULL);
+        len = SD_TOKEN_POLL_BURST;
+    } while ((HAL_GetTick() - start) < timeout_ms);
+
+    return SD_TIMEOUT;
+}
+
+/* Whether the card is known not busy (SD_READY_TRACKING); a no-op when not built in. */
+#if (SD_READY_TRACKING == 1)
+#define SD_SET_READY(h, ready) ((h)->card_ready = (ready))
+#else
+#define SD_SET_READY(h, ready) ((void)(h))
+#endif
+
+#if (SD_ENERGY_STATS == 1)
+/* Waits on the card: the polls they clock are card time, not bus time. */
+static void SD_EnergyWait(SD_Handle_t *sd_handle, bool begin, uint32_t start) {
+    sd_handle->energy_wait = begin;
+    if (!begin) {
+        sd_handle->stats.card_active_cycles += DWT->CYCCNT - start;
+    }
+}
+#else
+#define SD_EnergyWait(sd_handle, begin, start) ((void)(sd_handle), (void)(start))
+#endif
+
+static SD_RAMFUNC SD_Status SD_WaitReady(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
+    uint32_t start = SD_LatencyStart();
+    SD_EnergyWait(sd_handle, true, start);
+    SD_Status status = SD_PollReady(sd_handle, timeout_ms);
+    SD_EnergyWait(sd_handle, false, start);
+    SD_LatencyRecord(sd_handle, SD_LAT_BUSY, start);
+    SD_SET_READY(sd_handle, status == SD_OK);
+    return status;
+}
+
+static SD_RAMFUNC SD_Status SD_WaitDataToken(SD_Handle_t *sd_handle, uint32_t timeout_ms) {
+    uint32_t start = SD_LatencyStart();
+    SD_EnergyWait(sd_handle, true, start);
+    SD_Status status = SD_PollDataToken(sd_handle, timeout_ms);
+    SD_EnergyWait(sd_handle, false, start);
+    SD_LatencyRecord(sd_handle, SD_LAT_TOKEN, start);
+    return status;
+}
+
+/* Receive a data block that follows SD_WaitDataToken, draining any carried bytes first. */
+static SD_Status SD_ReceiveData(SD_Handle_t *sd_handle, uint8_t *buff, uint16_t len,
+                                bool use_dma) {
+#if (SD_TOKEN_POLL_BURST > 1U)
+    uint16_t carried = sd_handle->rx_carry_len;
+    if (carried > 0U) {
+        memcpy(buff, sd_handle->rx_carry, carried);
+        sd_handle->rx_carry_len = 0;
+        buff += carried;
+        len -= carried;
+        use_dma = use_dma && SD_IsAligned(buff, SD_DMA_ALIGNMENT);
+    }
+#endif
+    return SD_SPI_TransmitReceive(sd_handle, NULL, buff, len, use_dma);
+}
+
+#if (SD_SPLIT_BUSY == 1)
+static uint32_t SD_WriteTimeoutMs(const SD_Handle_t *sd_handle);
+
+/* Leave the program busy of an accepted write to whoever selects the card next. */
+static void SD_DeferBusy(SD_Handle_t *sd_handle) {
+    SD_SET_READY(sd_handle, false);
+    sd_handle->busy_pending = true;
+    sd_handle->busy_tick = HAL_GetTick();
+    sd_handle->stats.busy_deferred++;
+}
+
+/* With the card selected: wait out a deferred busy within what is left of the write timeout. */
+static SD_Status SD_WaitDeferredBusy(SD_Handle_t *sd_handle) {
+    uint8_t level = 0x00U;
+    sd_handle->busy_pending = false;
+    if (SD_ReceiveByte(sd_handle, &level) != SD_OK) {
+        return SD_ERROR;
+    }
+    if (level == 0xFFU) {
+        SD_SET_READY(sd_handle, true);
+        sd_handle->stats.busy_deferred_idle++;
+        return SD_OK;
+    }
+    uint32_t limit = SD_WriteTimeoutMs(sd_handle);
+    uint32_t spent = HAL_GetTick() - sd_handle->busy_tick;
+    return SD_WaitReady(sd_handle, (spent < limit) ? (limit - spent) : 1U);
+}
+#endif
+
+#if SD_SESSIONS
+#define SD_SESSION_NONE  0U
+#define SD_SESSION_READ  1U
+#define SD_SESSION_WRITE 2U
+
+static SD_RAMFUNC SD_Status SD_SendCommand(SD_Handle_t *sd_handle, uint8_t cmd, uint32_t arg,
+                                           uint8_t crc, uint8_t *response);
+#if (SD_WRITE_SESSION == 1)
+static void SD_StopTran(SD_Handle_t *sd_handle);
+#endif
+
+/*
+ * Card selected: stop an open session, for callers that talk to the card without a command.
+ * A read session takes CMD12, a write session the stop token.
+ */
+static void SD_SessionStop(SD_Handle_t *sd_handle) {
+#if (SD_WRITE_SESSION == 1)
+    if (sd_handle->session == SD_SESSION_WRITE) {
+        sd_handle->session = SD_SESSION_NONE;
+        sd_handle->stats.session_stops++;
+        SD_StopTran(sd_handle);
+        return;
+    }
+#endif
+    if (sd_handle->session != SD_SESSION_NONE) {
+        uint8_t response = 0xFFU;
+        (void)SD_SendCommand(sd_handle, SD_CMD12, 0, 0xFFU, &response);
+    }
+}
+
+static uint32_t SD_SessionIdleMs(const SD_Handle_t *sd_handle) {
+    return (sd_handle->session == SD_SESSION_WRITE) ? SD_WRITE_SESSION_IDLE_MS
+                                                    : SD_READ_SESSION_IDLE_MS;
+}
+
+/* A transfer of this kind at sector carries on the open session, not idle too long. */
+static bool SD_SessionResumes(const SD_Handle_t *sd_handle, uint8_t kind, uint32_t sector) {
+    return sd_handle->session == kind && sd_handle->session_next == sector &&
+           (HAL_GetTick() - sd_handle->session_tick) < SD_SessionIdleMs(sd_handle);
+}
+#endif
+
+#if (SD_READY_TRACKING == 1)
+/* Commands with neither a data block nor a busy after R1: the card stays as ready as it was. */
+static bool SD_CommandKeepsReady(uint8_t cmd) {
+    return cmd == SD_CMD8 || cmd == SD_CMD16 || cmd == SD_CMD55 || cmd == SD_CMD58 ||
+           cmd == SD_CMD59 || cmd == SD_ACMD41;
+}
+
+/* Ready wait ahead of a command, skipped while the card is known not busy. */
+static SD_RAMFUNC SD_Status SD_CommandReady(SD_Handle_t *sd_handle) {
+    if (sd_handle->card_ready) {
+        sd_handle->stats.ready_skips++;
+        return SD_OK;
+    }
+    return SD_WaitReady(sd_handle, SD_CMD_TIMEOUT_MS);
+}
+#else
+#define SD_CommandReady(h) SD_WaitReady((h), SD_CMD_TIMEOUT_MS)
+#endif
+
+static SD_RAMFUNC SD_Status SD_IssueCommand(SD_Handle_t *sd_handle, uint8_t cmd, uint32_t arg, uint8_t crc, uint8_t *response) {
+#if SD_SESSIONS
+    /* Any other command ends an open session; the card is still selected from it. */
+    if (sd_handle->session == SD_SESSION_READ && cmd == SD_CMD12) {
+        sd_handle->session = SD_SESSION_NONE; /* this is the stop */
+        sd_handle->stats.session_stops++;
+    } else if (sd_handle->session != SD_SESSION_NONE) {
+        SD_SessionStop(sd_handle);
+    }
+#endif
+#if (SD_SPLIT_BUSY == 1)
+    SD_Status status = sd_handle->busy_pending ? SD_WaitDeferredBusy(sd_handle)
+                                               : SD_CommandReady(sd_handle);
+#else
+    SD_Status status = SD_CommandReady(sd_handle);
+#endif
+    if (status != SD_OK) {
+        return status;
+    }
+#if (SD_READY_TRACKING == 1)
+    bool keeps_ready = SD_CommandKeepsReady(cmd);
+    sd_handle->card_ready = false; /* until R1 (or the command's data or busy) is through */
+#endif
+
+    /* Sync byte + 6-byte command packet, sent as a single SPI transfer. */
+    uint8_t frame[SD_CMD_FRAME_LEN];
+    frame[0] = 0xFFU;
+    frame[1] = (uint8_t)(0x40U | cmd);
+    frame[2] = (uint8_t)(arg >> 24);
+    frame[3] = (uint8_t)(arg >> 16);
+    frame[4] = (uint8_t)(arg >> 8);
+    frame[5] = (uint8_t)arg;
+#if (SD_CRC_ENABLED == 1)
+    (void)crc;
+    frame[6] = (arg == 0U) ? s_cmd_crc_arg0[cmd & 0x3FU]
+                           : (uint8_t)((SD_Crc7(&frame[1], 5) << 1) | 0x01U);
+#else
+    frame[6] = crc;
+#endif
+    if (SD_SPI_Transmit(sd_handle, frame, SD_CMD_FRAME_LEN, false) != SD_OK) {
+        return SD_ERROR;
+    }
+
+    /*
+     * R1 arrives within NCR (<= 8 bytes). It is polled byte-wise on purpose:
+     * reading ahead would swallow R3/R7 payload or a data token that can follow
+     * R1 immediately.
+     */
+    uint8_t resp = 0xFFU;
+    for (uint8_t retry = 0; retry < 10; retry++) {
+        if (SD_ReceiveByte(sd_handle, &resp) != SD_OK) {
+            return SD_ERROR;
+        }
+        if ((resp & 0x80U) == 0U) {
+            if (response) {
+                *response = resp;
+            }
+#if (SD_READY_TRACKING == 1)
+            sd_handle->card_ready = keeps_ready;
+#endif
+            return SD_OK;
+        }
+    }
+
+    return SD_TIMEOUT;
+}
+
+static SD_RAMFUNC SD_Status SD_SendCommand(SD_Handle_t *sd_handle, uint8_t cmd, uint32_t arg,
+                                           uint8_t crc, uint8_t *response) {
+#if (SD_TRACE_ENABLED == 1)
+    uint32_t start = SD_TRACE_START();
+    uint8_t r1 = 0xFFU;
+    SD_Status status = SD_IssueCommand(sd_handle, cmd, arg, crc, &r1);
+    SD_TRACE(SD_TRACE_CMD, sd_handle->instance, cmd, arg, status, r1, start);
+    if (response && status == SD_OK) {
+        *response = r1;
+    }
+    return status;
+#else
+    return SD_IssueCommand(sd_handle, cmd, arg, crc, response);
+#endif
+}
+
+/* Read a 16-byte register (CMD9 = CSD, CMD10 = CID) into reg. */
+static SD_Status SD_ReadRegister(SD_Handle_t *sd_handle, uint8_t cmd, uint8_t *reg) {
+    SD_Status status;
+    uint8_t response = 0xFFU;
+
+    SD_Select(sd_handle);
+    status = SD_SendCommand(sd_handle, cmd, 0, 0xFFU, &response);
+    if (status != SD_OK || response != 0x00U) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return SD_ERROR;
+    }
+
+    status = SD_WaitDataToken(sd_handle, SD_DATA_TOKEN_TIMEOUT_MS);
+    if (status != SD_OK) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return status;
+    }
+
+    SD_Status rx_status = SD_ReceiveData(sd_handle, reg, 16, false);
+    if (rx_status != SD_OK) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return rx_status;
+    }
+
+    (void)SD_ReceiveByte(sd_handle, &response);
+    (void)SD_ReceiveByte(sd_handle, &response);
+    SD_SET_READY(sd_handle, true); /* a register read leaves no busy */
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    return SD_OK;
+}
+
+/* AU_SIZE codes 1..15 of the SD Status register, in 512-byte blocks. */
+static const uint32_t s_au_blocks[16] = {
+    0U, 32U, 64U, 128U, 256U, 512U, 1024U, 2048U,
+    4096U, 8192U, 16384U, 24576U, 32768U, 49152U, 65536U, 131072U
+};
+
+/* ACMD13: read the 64-byte SD Status register into reg. */
+static SD_Status SD_ReadSdStatus(SD_Handle_t *sd_handle, uint8_t *reg) {
+    uint8_t r1 = 0xFFU;
+    uint8_t r2 = 0xFFU;
+
+    SD_Select(sd_handle);
+    SD_Status status = SD_SendCommand(sd_handle, SD_CMD55, 0, 0xFFU, &r1);
+    if (status == SD_OK && r1 == 0x00U) {
+        status = SD_SendCommand(sd_handle, SD_ACMD13, 0, 0xFFU, &r1);
+    }
+    if (status == SD_OK) {
+        status = SD_ReceiveByte(sd_handle, &r2); /* R2 */
+    }
+    if (status == SD_OK && (r1 != 0x00U || r2 != 0x00U)) {
+        status = SD_ERROR;
+    }
+    if (status == SD_OK) {
+        status = SD_WaitDataToken(sd_handle, SD_DATA_TOKEN_TIMEOUT_MS);
+    }
+    if (status == SD_OK) {
+        status = SD_ReceiveData(sd_handle, reg, 64U, false);
+    }
+    if (status == SD_OK) {
+        (void)SD_ReceiveByte(sd_handle, &r1);
+        (void)SD_ReceiveByte(sd_handle, &r1);
+    }
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+    return status;
+}
+
+/* ACMD13 for the AU alone, in blocks (0 = not defined). */
+static SD_Status SD_ReadAllocationUnit(SD_Handle_t *sd_handle, uint32_t *au_blocks) {
+    uint8_t reg[64];
+    SD_Status status = SD_ReadSdStatus(sd_handle, reg);
+    /* AU_SIZE is bits [431:428]: the high nibble of byte 10. */
+    *au_blocks = (status == SD_OK) ? s_au_blocks[reg[10] >> 4] : 0U;
+    return status;
+}
+
+/* A CSD read is trusted only if its embedded CRC7 matches and the structure is known. */
+static bool SD_CSDValid(const uint8_t *csd) {
+    uint8_t csd_structure = (csd[0] >> 6) & 0x3U;
+    if (csd_structure > 1U) {
+        return false;
+    }
+    return (csd[15] >> 1) == SD_Crc7(csd, 15);
+}
+
+#if (SD_INIT_CACHE == 1) || (SD_CARD_INFO == 1)
+static bool SD_CIDValid(const uint8_t *cid) {
+    return (cid[15] >> 1) == SD_Crc7(cid, 15);
+}
+#endif
+
+/* Command argument for a block: SDSC cards take byte addresses, SDHC/SDXC block numbers. */
+static uint32_t SD_CardAddress(const SD_Handle_t *sd_handle, uint32_t sector) {
+#if (SD_SUPPORT_SDSC == 1)
+    return sd_handle->is_sdhc ? sector : (sector * SD_BLOCK_SIZE);
+#else
+    (void)sd_handle;
+    return sector;
+#endif
+}
+
+static void SD_ParseCSD(SD_Handle_t *sd_handle, const uint8_t *csd) {
+    uint8_t csd_structure = (csd[0] >> 6) & 0x3U;
+
+    /* SECTOR_SIZE [45:39] in WRITE_BL_LEN [25:22] units; fixed at 64 KiB in CSD v2. */
+    sd_handle->erase_sector = (csd_structure == 1U) ? 128U : 0U;
+#if (SD_SUPPORT_SDSC == 1)
+    uint32_t sector_size = (((uint32_t)csd[10] & 0x3FU) << 1) | ((uint32_t)csd[11] >> 7);
+    uint32_t write_bl_len = (((uint32_t)csd[12] & 0x03U) << 2) | ((uint32_t)csd[13] >> 6);
+    if (csd_structure == 0U && write_bl_len >= 9U && write_bl_len <= 11U) {
+        sd_handle->erase_sector = (sector_size + 1U) << (write_bl_len - 9U);
+    }
+#endif
+    sd_handle->erase_block = 0;
+
+    if (csd_structure == 1U) {
+        uint32_t c_size = ((uint32_t)(csd[7] & 0x3FU) << 16) |
+                          ((uint32_t)csd[8] << 8) |
+                          (uint32_t)csd[9];
+        sd_handle->capacity_blocks = (c_size + 1U) * 1024U;
+#if (SD_SUPPORT_SDSC == 1)
+    } else if (csd_structure == 0U) {
+        uint32_t c_size = ((uint32_t)(csd[6] & 0x03U) << 10) |
+                          ((uint32_t)csd[7] << 2) |
+                          ((uint32_t)csd[8] >> 6);
+        uint32_t c_size_mult = ((uint32_t)(csd[9] & 0x03U) << 1) |
+                               ((uint32_t)(csd[10] >> 7) & 0x01U);
+        uint32_t read_bl_len = csd[5] & 0x0FU;
+        uint32_t block_len = 1UL << read_bl_len;
+        uint32_t mult = 1UL << (c_size_mult + 2U);
+        uint32_t blocknr = (c_size + 1U) * mult;
+        uint32_t capacity_bytes = blocknr * block_len;
+        sd_handle->capacity_blocks = capacity_bytes / SD_BLOCK_SIZE;
+#endif
+    } else {
+        sd_handle->capacity_blocks = 0;
+    }
+}
+
+#if (SD_CARD_INFO == 1)
+/* TAAC and TRAN_SPEED mantissas x10, by the 4-bit code (0 reserved). */
+static const uint8_t s_csd_mantissa[16] = {
+    0U, 10U, 12U, 13U, 15U, 20U, 25U, 30U, 35U, 40U, 45U, 50U, 55U, 60U, 70U, 80U
+};
+
+static void SD_ParseCID(SD_CardInfo *info, const uint8_t *cid) {
+    info->manufacturer_id = cid[0];
+    memcpy(info->oem_id, &cid[1], 2U);
+    info->oem_id[2] = '\0';
+    memcpy(info->product_name, &cid[3], 5U);
+    info->product_name[5] = '\0';
+    info->revision = cid[8];
+    info->serial = ((uint32_t)cid[9] << 24) | ((uint32_t)cid[10] << 16) |
+                   ((uint32_t)cid[11] << 8) | (uint32_t)cid[12];
+    /* MDT [19:8]: year offset in the low nibble of byte 13 and high nibble of 14. */
+    info->mfg_year = (uint16_t)(2000U + ((((uint32_t)cid[13] & 0x0FU) << 4) | (cid[14] >> 4)));
+    info->mfg_month = cid[14] & 0x0FU;
+    info->cid_valid = true;
+}
+
+static void SD_ParseCardCSD(SD_CardInfo *info, const uint8_t *csd) {
+    static const uint32_t taac_unit_ns[8] = {1U, 10U, 100U, 1000U, 10000U, 100000U,
+                                             1000000U, 10000000U};
+    static const uint32_t tran_unit_kbps[4] = {100U, 1000U, 10000U, 100000U};
+    info->csd_version = (uint8_t)(((csd[0] >> 6) & 0x3U) + 1U);
+    info->taac_ns = taac_unit_ns[csd[1] & 0x07U] * s_csd_mantissa[(csd[1] >> 3) & 0x0FU] / 10U;
+    info->nsac = csd[2];
+    info->tran_speed_kbps = ((csd[3] & 0x07U) < 4U)
+        ? tran_unit_kbps[csd[3] & 0x07U] * s_csd_mantissa[(csd[3] >> 3) & 0x0FU] / 10U : 0U;
+    info->ccc = (uint16_t)(((uint32_t)csd[4] << 4) | (csd[5] >> 4));
+    info->r2w_factor = (csd[12] >> 2) & 0x07U;
+    info->write_bl_len = (uint8_t)(((csd[12] & 0x03U) << 2) | (csd[13] >> 6));
+    info->csd_valid = true;
+}
+
+static void SD_ParseSdStatus(SD_CardInfo *info, const uint8_t *reg) {
+    static const uint8_t speed_class[5] = {0U, 2U, 4U, 6U, 10U};
+    /* SPEED_CLASS [447:440], UHS_SPEED_GRADE [399:396], VIDEO_SPEED_CLASS [391:384]. */
+    info->speed_class = (reg[8] < 5U) ? speed_class[reg[8]] : 0U;
+    info->uhs_grade = reg[14] >> 4;
+    info->video_class = reg[15];
+    info->au_blocks = s_au_blocks[reg[10] >> 4];
+    info->status_valid = true;
+}
+
+/* Worst-case access time the spec allows this card, scaled and clamped, in ms. */
+static uint32_t SD_TunedTimeout(uint32_t spec_us, uint32_t max_ms) {
+    uint32_t ms = (uint32_t)(((uint64_t)spec_us * SD_CARD_TIMEOUT_PCT + 99999U) / 100000U);
+    if (ms == 0U) {
+        ms = 1U;
+    }
+    return (ms < max_ms) ? ms : max_ms;
+}
+
+/* Read timeout 100 x (TAAC + NSAC x 100 clocks), cap 100 ms; write x 2^R2W, cap 250 ms. */
+static void SD_TuneTimeouts(SD_Handle_t *sd_handle) {
+    SD_CardInfo *info = &sd_handle->card_info;
+    uint32_t read_us = 100000U;
+    uint32_t write_us = 250000U;
+    if (info->csd_version == 2U) {
+        /* SDXC (over 32 GiB) may take up to 500 ms per write. */
+        if (sd_handle->capacity_blocks > 0x4000000U) {
+            write_us = 500000U;
+        }
+#if (SD_SUPPORT_SDSC == 1)
+    } else if (info->nsac == 0U || SD_SPI_CLOCK_HZ != 0U) {
+        uint64_t access_ns = info->taac_ns;
+        if (SD_SPI_CLOCK_HZ != 0U) {
+            uint32_t hz = SD_SPI_CLOCK_HZ / SD_PrescalerDivisor(sd_handle->bus_prescaler);
+            access_ns += (uint64_t)info->nsac * 100U * 1000000000U / hz;
+        }
+        uint64_t us = access_ns / 10U; /* x100, ns to us */
+        if (us < read_us) {
+            read_us = (uint32_t)((us > 0U) ? us : 1U);
+        }
+        us <<= info->r2w_factor;
+        if (us < write_us) {
+            write_us = (uint32_t)((us > 0U) ? us : 1U);
+        }
+#endif
+    }
+    info->read_timeout_ms = SD_TunedTimeout(read_us, SD_DATA_TOKEN_TIMEOUT_MS);
+    info->write_timeout_ms = SD_TunedTimeout(write_us, SD_WRITE_BUSY_TIMEOUT_MS);
+}
+
+/*
+ * Decode what identification left in cid/csd (NULL = not read: CMD10 is sent
+ * here, a missing CSD stays invalid), read the SD Status, then tune the
+ * timeouts and slow the bus to TRAN_SPEED if the negotiated clock is above it.
+ */
+static void SD_IdentifyCard(SD_Handle_t *sd_handle, const uint8_t *cid, const uint8_t *csd) {
+    SD_CardInfo *info = &sd_handle->card_info;
+    uint8_t reg[64];
+    if (cid == NULL && SD_ReadRegister(sd_handle, SD_CMD10, reg) == SD_OK && SD_CIDValid(reg)) {
+        cid = reg;
+    }
+    if (cid != NULL) {
+        SD_ParseCID(info, cid);
+    }
+    if (csd != NULL) {
+        SD_ParseCardCSD(info, csd);
+    }
+    if (SD_ReadSdStatus(sd_handle, reg) == SD_OK) {
+        SD_ParseSdStatus(info, reg);
+        if (info->au_blocks != 0U) {
+            sd_handle->erase_block = info->au_blocks;
+        }
+    }
+    if (SD_SPI_CLOCK_HZ != 0U && info->tran_speed_kbps != 0U) {
+        uint32_t prescaler = sd_handle->bus_prescaler;
+        while (prescaler < SD_SPI_INIT_PRESCALER &&
+               SD_SPI_CLOCK_HZ / SD_PrescalerDivisor(prescaler) > info->tran_speed_kbps * 1000U) {
+            prescaler = SD_SlowerPrescaler(prescaler);
+        }
+        (void)SD_ApplyBusPrescaler(sd_handle, prescaler);
+    }
+    if (info->csd_valid) {
+        SD_TuneTimeouts(sd_handle);
+    }
+}
+#endif
+
+/* CMD58: read the OCR into ocr and take the card capacity class (CCS) from it. */
+static SD_Status SD_ReadOCR(SD_Handle_t *sd_handle, uint8_t *ocr) {
+    uint8_t response = 0xFFU;
+    memset(ocr, 0, 4);
+    SD_Select(sd_handle);
+    SD_Status status = SD_SendCommand(sd_handle, SD_CMD58, 0, 0xFFU, &response);
+    if (status == SD_OK && response == 0x00U) {
+        for (uint8_t i = 0; i < 4; i++) {
+            (void)SD_ReceiveByte(sd_handle, &ocr[i]);
+        }
+        sd_handle->is_sdhc = (ocr[0] & 0x40U) != 0U;
+    } else if (status == SD_OK) {
+        status = SD_ERROR;
+    }
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+    return status;
+}
+
+/*
+ * Speed negotiation: switch to prescaler, the fastest rate to try, and prove
+ * the link with a CRC-checked register read (cmd = CMD9 or CMD10). On timeout
+ * or CRC mismatch step the clock down one notch at a time; if even the
+ * identification rate fails, stay there and return false (capacity stays
+ * unknown).
+ */
+static bool SD_NegotiateBus(SD_Handle_t *sd_handle, uint32_t prescaler, uint8_t cmd,
+                           uint8_t *reg) {
+    for (;;) {
+        if (SD_ApplyBusPrescaler(sd_handle, prescaler) != SD_OK) {
+            return false;
+        }
+        if (SD_ReadRegister(sd_handle, cmd, reg) == SD_OK) {
+#if (SD_INIT_CACHE == 1)
+            if ((cmd == SD_CMD10) ? SD_CIDValid(reg) : SD_CSDValid(reg)) {
+                return true;
+            }
+#else
+            if (SD_CSDValid(reg)) {
+                return true;
+            }
+#endif
+        }
+        if (prescaler >= SD_SPI_INIT_PRESCALER) {
+            return false;
+        }
+        SD_LOG("SD: register check failed at prescaler 0x%02lX, stepping down\r\n",
+               (unsigned long)prescaler);
+        prescaler = SD_SlowerPrescaler(prescaler);
+    }
+}
+
+#if (SD_HIGH_SPEED == 1)
+/* CMD6 argument: group 1 (access mode) to function 1 (high speed), other groups unchanged. */
+#define SD_SWITCH_HIGH_SPEED 0x00FFFFF1U
+#define SD_SWITCH_SET        0x80000000U /* mode 1: switch; mode 0 only checks */
+
+/* CMD6: send arg and read the 64-byte switch status into status. */
+static SD_Status SD_SwitchFunction(SD_Handle_t *sd_handle, uint32_t arg, uint8_t *status) {
+    uint8_t response = 0xFFU;
+    SD_Select(sd_handle);
+    SD_Status result = SD_SendCommand(sd_handle, SD_CMD6, arg, 0xFFU, &response);
+    if (result == SD_OK && response != 0x00U) {
+        result = SD_ERROR;
+    }
+    if (result == SD_OK) {
+        result = SD_WaitDataToken(sd_handle, SD_DATA_TOKEN_TIMEOUT_MS);
+    }
+    if (result == SD_OK) {
+        result = SD_ReceiveData(sd_handle, status, 64U, false);
+    }
+    if (result == SD_OK) {
+        (void)SD_ReceiveByte(sd_handle, &response);
+        (void)SD_ReceiveByte(sd_handle, &response);
+    }
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU); /* the switch takes effect within these 8 clocks */
+    return result;
+}
+
+/*
+ * Check for the high-speed function and switch to it, keeping the support
+ * bits of every group in the handle. The selection result for group 1 is the
+ * low nibble of status byte 16: 1 once the card can run (or runs) high speed.
+ */
+static bool SD_EnableHighSpeed(SD_Handle_t *sd_handle) {
+    uint8_t status[64];
+    sd_handle->high_speed = false;
+    memset(sd_handle->switch_support, 0, sizeof(sd_handle->switch_support));
+    if (SD_SwitchFunction(sd_handle, SD_SWITCH_HIGH_SPEED, status) != SD_OK) {
+        return false;
+    }
+    /* Support bits [495:400]: group 6 in bytes 2-3 down to group 1 in bytes 12-13. */
+    for (uint32_t g = 0; g < 6U; g++) {
+        sd_handle->switch_support[g] =
+            (uint16_t)(((uint16_t)status[12U - 2U * g] << 8) | status[13U - 2U * g]);
+    }
+    if ((sd_handle->switch_support[0] & 0x0002U) == 0U || (status[16] & 0x0FU) != 1U) {
+        return false;
+    }
+    if (SD_SwitchFunction(sd_handle, SD_SWITCH_SET | SD_SWITCH_HIGH_SPEED, status) != SD_OK ||
+        (status[16] & 0x0FU) != 1U) {
+        return false;
+    }
+    sd_handle->high_speed = true;
+    return true;
+}
+#endif
+
+/* Identification phase timing: microseconds from the cycle counter if built in, else the tick. */
+#if (SD_LATENCY_STATS == 1) || (SD_TRACE_ENABLED == 1)
+static uint32_t SD_InitClock(void) {
+    return DWT->CYCCNT;
+}
+
+static uint32_t SD_InitLapUs(uint32_t *mark) {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t per_us = SystemCoreClock / 1000000U;
+    uint32_t us = (now - *mark) / ((per_us != 0U) ? per_us : 1U);
+    *mark = now;
+    return us;
+}
+#else
+static uint32_t SD_InitClock(void) {
+    return HAL_GetTick();
+}
+
+static uint32_t SD_InitLapUs(uint32_t *mark) {
+    uint32_t now = HAL_GetTick();
+    uint32_t us = (now - *mark) * 1000U;
+    *mark = now;
+    return us;
+}
+#endif
+
+#if (SD_SUPPORT_SDSC == 1)
+static SD_Status SD_SetBlockLength(SD_Handle_t *sd_handle) {
+    SD_Status status;
+    uint8_t response = 0xFFU;
+
+    SD_Select(sd_handle);
+    status = SD_SendCommand(sd_handle, SD_CMD16, SD_BLOCK_SIZE, 0xFFU, &response);
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    if (status != SD_OK || response != 0x00U) {
+        return SD_ERROR;
+    }
+
+    return SD_OK;
+}
+#endif
+
+#if (SD_SPI_FRAME16 == 1)
+/*
+ * A 16-bit frame is shifted MSB first, i.e. the byte at the odd address of a
+ * little-endian half-word goes out (or comes in) first: swap each pair.
+ */
+static void SD_Swap16(uint8_t *dst, const uint8_t *src, size_t len) {
+    for (size_t i = 0; i < len; i += 4U) {
+        uint32_t w;
+        memcpy(&w, &src[i], sizeof(w));
+        w = ((w & 0x00FF00FFU) << 8) | ((w >> 8) & 0x00FF00FFU);
+        memcpy(&dst[i], &w, sizeof(w));
+    }
+}
+
+/* Switch the SPI between 8- and 16-bit frames; the DMA streams follow in SD_DmaPrepare. */
+static SD_Status SD_SetFrame16(SD_Handle_t *sd_handle, bool wide) {
+    SPI_HandleTypeDef *hspi = sd_handle->hspi;
+    hspi->Init.DataSize = wide ? SPI_DATASIZE_16BIT : SPI_DATASIZE_8BIT;
+    return (HAL_SPI_Init(hspi) == HAL_OK) ? SD_OK : SD_ERROR;
+}
+
+/*
+ * DMA data phase in 16-bit frames: half the DMA requests of byte frames.
+ * Received pairs are swapped back into block; the SPI returns to 8-bit
+ * frames before the CRC whatever the outcome. The streams stay half-word
+ * until a byte-frame DMA transfer needs them back.
+ */
+static SD_Status SD_ReceiveBlockWide(SD_Handle_t *sd_handle, uint8_t *block) {
+    bool direct = SD_IsAligned(block, SD_DMA_ALIGNMENT);
+    uint8_t *rx = direct ? block : s_bounce[sd_handle->instance];
+    if (SD_SetFrame16(sd_handle, true) != SD_OK) {
+        (void)SD_SetFrame16(sd_handle, false);
+        return SD_ERROR;
+    }
+    sd_handle->stats.xfers[SD_XFER_DMA]++;
+    SD_Status status = SD_XferArm(sd_handle, false);
+    if (status == SD_OK) {
+        status = SD_DmaPrepare(sd_handle, NULL, rx, SD_BLOCK_SIZE, true);
+    }
+    if (status == SD_OK) {
+        SD_CacheInvalidate(sd_handle, rx, SD_BLOCK_SIZE, false);
+        if (HAL_SPI_TransmitReceive_DMA(sd_handle->hspi, s_dummy_tx, rx, SD_BLOCK_SIZE / 2U) != HAL_OK) {
+            status = SD_ERROR;
+        } else {
+            status = SD_XferWait(sd_handle, false);
+        }
+    }
+    if (SD_SetFrame16(sd_handle, false) != SD_OK && status == SD_OK) {
+        status = SD_ERROR;
+    }
+    if (status != SD_OK) {
+        return status;
+    }
+    SD_CacheInvalidate(sd_handle, rx, SD_BLOCK_SIZE, true);
+    SD_Swap16(block, rx, SD_BLOCK_SIZE);
+    sd_handle->stats.frame16_blocks++;
+    if (direct) {
+        sd_handle->stats.dma_direct_blocks++;
+    } else {
+        sd_handle->stats.dma_bounced_blocks++;
+    }
+    return SD_OK;
+}
+
+/* Transmit counterpart: the block is pair-swapped into the bounce buffer first. */
+static SD_Status SD_TransmitBlockWide(SD_Handle_t *sd_handle, const uint8_t *block) {
+    uint8_t *tx = s_bounce[sd_handle->instance];
+    SD_Swap16(tx, block, SD_BLOCK_SIZE);
+    if (SD_SetFrame16(sd_handle, true) != SD_OK) {
+        (void)SD_SetFrame16(sd_handle, false);
+        return SD_ERROR;
+    }
+    sd_handle->stats.xfers[SD_XFER_DMA]++;
+    SD_Status status = SD_XferArm(sd_handle, true);
+    if (status == SD_OK) {
+        status = SD_DmaPrepare(sd_handle, tx, NULL, SD_BLOCK_SIZE, true);
+    }
+    if (status == SD_OK) {
+        SD_CacheClean(sd_handle, tx, SD_BLOCK_SIZE);
+        if (HAL_SPI_Transmit_DMA(sd_handle->hspi, tx, SD_BLOCK_SIZE / 2U) != HAL_OK) {
+            status = SD_ERROR;
+        } else {
+            status = SD_XferWait(sd_handle, true);
+        }
+    }
+    if (SD_SetFrame16(sd_handle, false) != SD_OK && status == SD_OK) {
+        status = SD_ERROR;
+    }
+    if (status == SD_OK) {
+        sd_handle->stats.frame16_blocks++;
+        sd_handle->stats.dma_bounced_blocks++;
+    }
+    return status;
+}
+#endif
+
+/* Receive one data block, by DMA when enabled; unaligned blocks bounce through RAM we own. */
+static SD_Status SD_ReceiveBlock(SD_Handle_t *sd_handle, uint8_t *block) {
+    if (!sd_handle->use_dma) {
+        return SD_ReceiveData(sd_handle, block, SD_BLOCK_SIZE, false);
+    }
+#if (SD_SPI_FRAME16 == 1)
+#if (SD_TOKEN_POLL_BURST > 1U)
+    if (sd_handle->rx_carry_len == 0U)
+#endif
+    {
+        return SD_ReceiveBlockWide(sd_handle, block);
+    }
+#endif
+    if (SD_IsAligned(block, SD_DMA_ALIGNMENT)) {
+        sd_handle->stats.dma_direct_blocks++;
+        return SD_ReceiveData(sd_handle, block, SD_BLOCK_SIZE, true);
+    }
+#if (SD_DMA_BOUNCE == 1)
+    uint8_t *bounce = s_bounce[sd_handle->instance];
+    sd_handle->stats.dma_bounced_blocks++;
+    SD_Status status = SD_ReceiveData(sd_handle, bounce, SD_BLOCK_SIZE, true);
+    if (status == SD_OK) {
+        memcpy(block, bounce, SD_BLOCK_SIZE);
+    }
+    return status;
+#else
+    return SD_ReceiveData(sd_handle, block, SD_BLOCK_SIZE, false);
+#endif
+}
+
+/* Send one data block, by DMA when enabled; unaligned blocks are copied to the bounce buffer. */
+static SD_Status SD_TransmitBlock(SD_Handle_t *sd_handle, const uint8_t *block) {
+    if (!sd_handle->use_dma) {
+        return SD_SPI_Transmit(sd_handle, block, SD_BLOCK_SIZE, false);
+    }
+#if (SD_SPI_FRAME16 == 1)
+    return SD_TransmitBlockWide(sd_handle, block);
+#else
+    if (SD_IsAligned(block, SD_DMA_ALIGNMENT)) {
+        sd_handle->stats.dma_direct_blocks++;
+        return SD_SPI_Transmit(sd_handle, block, SD_BLOCK_SIZE, true);
+    }
+#if (SD_DMA_BOUNCE == 1)
+    uint8_t *bounce = s_bounce[sd_handle->instance];
+    sd_handle->stats.dma_bounced_blocks++;
+    memcpy(bounce, block, SD_BLOCK_SIZE);
+    return SD_SPI_Transmit(sd_handle, bounce, SD_BLOCK_SIZE, true);
+#else
+    return SD_SPI_Transmit(sd_handle, block, SD_BLOCK_SIZE, false);
+#endif
+#endif
+}
+
+/* Data-token and write-busy waits: tuned per card with SD_CARD_INFO, else the configured ones. */
+static uint32_t SD_ReadTimeoutMs(const SD_Handle_t *sd_handle) {
+#if (SD_CARD_INFO == 1)
+    if (sd_handle->card_info.read_timeout_ms != 0U) {
+        return sd_handle->card_info.read_timeout_ms;
+    }
+#else
+    (void)sd_handle;
+#endif
+    return SD_DATA_TOKEN_TIMEOUT_MS;
+}
+
+static uint32_t SD_WriteTimeoutMs(const SD_Handle_t *sd_handle) {
+#if (SD_CARD_INFO == 1)
+    if (sd_handle->card_info.write_timeout_ms != 0U) {
+        return sd_handle->card_info.write_timeout_ms;
+    }
+#else
+    (void)sd_handle;
+#endif
+    return SD_WRITE_BUSY_TIMEOUT_MS;
+}
+
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+/* Upper edges (ms, exclusive) of the SD_AdaptTimer bands; the last band is open. */
+static const uint16_t s_adapt_edges[15] = {
+    1U, 2U, 3U, 4U, 6U, 8U, 12U, 16U, 24U, 32U, 48U, 64U, 128U, 256U, 512U
+};
+
+static void SD_AdaptRecord(SD_AdaptTimer *t, uint32_t ms, uint32_t limit) {
+    uint32_t band = 0;
+    while (band < 15U && ms >= s_adapt_edges[band]) {
+        band++;
+    }
+    t->hist[band]++;
+    if (++t->count >= SD_ADAPT_WINDOW) {
+        t->count = 0;
+        for (uint32_t i = 0; i < 16U; i++) {
+            t->hist[i] = (uint16_t)(t->hist[i] / 2U);
+            t->count = (uint16_t)(t->count + t->hist[i]);
+        }
+    }
+    t->timeout_ms = 0;
+    if (t->count < SD_ADAPT_MIN_SAMPLES) {
+        return;
+    }
+    /* First band whose running total reaches the percentile. */
+    uint32_t want = ((uint32_t)t->count * SD_ADAPT_PERMILLE + 999U) / 1000U;
+    uint32_t seen = 0;
+    for (band = 0; band < 15U; band++) {
+        seen += t->hist[band];
+        if (seen >= want) {
+            break;
+        }
+    }
+    if (band < 15U) {
+        uint32_t ms_limit = (s_adapt_edges[band] * SD_ADAPT_MARGIN_PCT + 99U) / 100U;
+        if (ms_limit < SD_ADAPT_FLOOR_MS) {
+            ms_limit = SD_ADAPT_FLOOR_MS;
+        }
+        t->timeout_ms = (ms_limit < limit) ? ms_limit : 0U;
+    }
+}
+
+/* Wait under the learned limit; learn from a success, forget after an early timeout. */
+static SD_Status SD_AdaptiveWait(SD_Handle_t *sd_handle, uint32_t kind, uint32_t limit) {
+    SD_AdaptTimer *t = &sd_handle->adapt[kind];
+    uint32_t timeout = (t->timeout_ms != 0U && t->timeout_ms < limit) ? t->timeout_ms : limit;
+    uint32_t start = HAL_GetTick();
+    SD_Status status = (kind == 0U) ? SD_WaitDataToken(sd_handle, timeout)
+                                    : SD_WaitReady(sd_handle, timeout);
+    if (status == SD_OK) {
+        SD_AdaptRecord(t, HAL_GetTick() - start, limit);
+    } else if (status == SD_TIMEOUT && timeout < limit) {
+        sd_handle->stats.early_timeouts++;
+        memset(t, 0, sizeof(*t));
+    }
+    return status;
+}
+#endif
+
+/* Data-token wait of a block read. */
+static SD_Status SD_WaitReadToken(SD_Handle_t *sd_handle) {
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+    return SD_AdaptiveWait(sd_handle, 0U, SD_ReadTimeoutMs(sd_handle));
+#else
+    return SD_WaitDataToken(sd_handle, SD_ReadTimeoutMs(sd_handle));
+#endif
+}
+
+/* Busy wait after a block write or stop token. */
+static SD_Status SD_WaitWriteBusy(SD_Handle_t *sd_handle) {
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+    return SD_AdaptiveWait(sd_handle, 1U, SD_WriteTimeoutMs(sd_handle));
+#else
+    return SD_WaitReady(sd_handle, SD_WriteTimeoutMs(sd_handle));
+#endif
+}
+
+static SD_Status SD_ReadSingleBlockInternal(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t address) {
+    SD_Select(sd_handle);
+    uint8_t response = 0xFFU;
+    SD_Status status = SD_SendCommand(sd_handle, SD_CMD17, address, 0xFFU, &response);
+    if (status != SD_OK || response != 0x00U) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return SD_ERROR;
+    }
+
+    status = SD_WaitReadToken(sd_handle);
+    if (status != SD_OK) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return status;
+    }
+
+    status = SD_ReceiveBlock(sd_handle, buff);
+    if (status != SD_OK) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return status;
+    }
+
+    uint8_t crc[2];
+    (void)SD_SPI_TransmitReceive(sd_handle, NULL, crc, 2, false);
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    status = SD_CheckDataCrc(sd_handle, buff, crc);
+    /* CMD17 is over with its CRC: no busy follows, the next command can go straight out. */
+    SD_SET_READY(sd_handle, status == SD_OK);
+    return status;
+}
+
+static SD_Status SD_WriteSingleBlockInternal(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t address) {
+    SD_Select(sd_handle);
+    uint8_t response = 0xFFU;
+    SD_Status status = SD_SendCommand(sd_handle, SD_CMD24, address, 0xFFU, &response);
+    if (status != SD_OK || response != 0x00U) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return SD_ERROR;
+    }
+
+    (void)SD_TransmitByte(sd_handle, SD_TOKEN_START_BLOCK);
+    status = SD_TransmitBlock(sd_handle, buff);
+    if (status != SD_OK) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return status;
+    }
+
+    uint8_t crc[2];
+    SD_DataCrc(sd_handle, buff, crc);
+    (void)SD_TransmitByte(sd_handle, crc[0]);
+    (void)SD_TransmitByte(sd_handle, crc[1]);
+
+    (void)SD_ReceiveByte(sd_handle, &response);
+    if ((response & SD_DATA_RESP_MASK) != SD_DATA_RESP_ACCEPTED) {
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        return (response == SD_DATA_RESP_CRC_ERR) ? SD_CRC_ERROR : SD_WRITE_ERROR;
+    }
+
+#if (SD_SPLIT_BUSY == 1)
+    SD_DeferBusy(sd_handle);
+    status = SD_OK;
+#else
+    status = SD_WaitWriteBusy(sd_handle);
+#endif
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    return status;
+}
+
+/* After block done of a count-block run: call the chunk hook at each chunk boundary. */
+static void SD_ChunkPoint(SD_Handle_t *sd_handle, uint32_t done, uint32_t count) {
+#if (SD_CHUNK_BLOCKS > 0U)
+    if ((sd_handle->chunk_fn != NULL) && (done < count) && ((done % SD_CHUNK_BLOCKS) == 0U)) {
+        sd_handle->chunk_fn(sd_handle->chunk_ctx, done, count);
+    }
+#else
+    (void)sd_handle;
+    (void)done;
+    (void)count;
+#endif
+}
+
+/* Block i of a read: into the scatter list when given, else into the contiguous buffer. */
+static uint8_t *SD_RxBlockAt(uint8_t *buff, uint8_t *const *blocks, uint32_t i) {
+    return blocks ? blocks[i] : (buff + (i * SD_BLOCK_SIZE));
+}
+
+static SD_Status SD_ReadMultiBlocksPolled(SD_Handle_t *sd_handle, uint8_t *buff,
+                                          uint8_t *const *blocks, uint32_t count,
+                                          uint32_t *done) {
+    SD_Status status = SD_OK;
+    SD_CacheRangeBegin(sd_handle, blocks ? NULL : buff, count, true);
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t *block = SD_RxBlockAt(buff, blocks, i);
+        status = SD_WaitReadToken(sd_handle);
+        if (status != SD_OK) {
+            break;
+        }
+
+        status = SD_ReceiveBlock(sd_handle, block);
+        if (status != SD_OK) {
+            break;
+        }
+
+        uint8_t crc[2];
+        (void)SD_SPI_TransmitReceive(sd_handle, NULL, crc, 2, false);
+        status = SD_CheckDataCrc(sd_handle, block, crc);
+        if (status != SD_OK) {
+            break;
+        }
+        *done = i + 1U;
+        SD_ChunkPoint(sd_handle, *done, count);
+    }
+    SD_CacheRangeEnd(sd_handle);
+    return status;
+}
+
+#if (SD_READ_PIPELINE == 1)
+/* DMA window of one CMD18 block: data and CRC, plus the token gap if another block follows. */
+static uint16_t SD_PipelineWindow(bool more) {
+    return (uint16_t)(SD_BLOCK_SIZE + 2U + (more ? SD_READ_STREAM_GAP : 0U));
+}
+
+/*
+ * Start the DMA for one CMD18 block into a staging slot. Bytes already clocked in
+ * behind the data token go straight to dest; the DMA fetches the rest of the window.
+ */
+static SD_Status SD_PipelineStart(SD_Handle_t *sd_handle, uint8_t slot, uint8_t *dest,
+                                  const uint8_t *carry, uint16_t carried, uint16_t window) {
+    if (carried > 0U) {
+        memcpy(dest, carry, carried);
+    }
+    sd_handle->stats.xfers[SD_XFER_DMA]++;
+    return SD_SPI_RxDmaStart(sd_handle, NULL, s_rx_stage[sd_handle->instance][slot],
+                             (uint16_t)(window - carried));
+}
+
+/* Poll for the next CMD18 data token, then start the DMA for its block. */
+static SD_Status SD_PipelineNext(SD_Handle_t *sd_handle, uint8_t slot, uint8_t *dest,
+                                 uint16_t window, uint16_t *carried) {
+    *carried = 0;
+    SD_Status status = SD_WaitReadToken(sd_handle);
+    if (status != SD_OK) {
+        return status;
+    }
+#if (SD_TOKEN_POLL_BURST > 1U)
+    *carried = sd_handle->rx_carry_len;
+    sd_handle->rx_carry_len = 0;
+    return SD_PipelineStart(sd_handle, slot, dest, sd_handle->rx_carry, *carried, window);
+#else
+    return SD_PipelineStart(sd_handle, slot, dest, NULL, 0U, window);
+#endif
+}
+
+#if (SD_READ_STREAM_GAP > 0U)
+/* Offset just past the data token in a streamed gap, or 0 if the token is not there yet. */
+static uint16_t SD_PipelineFindToken(const uint8_t *gap) {
+    for (uint16_t i = 0; i < SD_READ_STREAM_GAP; i++) {
+        if (gap[i] == SD_TOKEN_START_BLOCK) {
+            return (uint16_t)(i + 1U);
+        }
+    }
+    return 0U;
+}
+#endif
+
+/*
+ * Pipelined CMD18: while the DMA for block N+1 runs into one staging slot, block N
+ * is copied out of the other. Data and CRC arrive in a single transfer per block;
+ * with SD_READ_STREAM_GAP the same transfer usually brings the next token too.
+ */
+static SD_Status SD_ReadMultiBlocksPipelined(SD_Handle_t *sd_handle, uint8_t *buff,
+                                              uint8_t *const *blocks, uint32_t count,
+                                              uint32_t *done) {
+    uint16_t carried[2] = {0U, 0U};
+    uint16_t window[2] = {SD_PipelineWindow(count > 1U), 0U};
+    SD_Status crc_status = SD_OK;
+    SD_Status status = SD_PipelineNext(sd_handle, 0U, SD_RxBlockAt(buff, blocks, 0), window[0],
+                                       &carried[0]);
+
+    for (uint32_t i = 0; (i < count) && (status == SD_OK); i++) {
+        uint8_t slot = (uint8_t)(i & 1U);
+        uint8_t next = (uint8_t)(slot ^ 1U);
+        uint8_t *block = SD_RxBlockAt(buff, blocks, i);
+        uint8_t *stage = s_rx_stage[sd_handle->instance][slot];
+
+        status = SD_SPI_RxDmaWait(sd_handle, stage, (uint16_t)(window[slot] - carried[slot]));
+        if (status != SD_OK) {
+            break;
+        }
+        if ((i + 1U) < count) {
+            uint8_t *dest = SD_RxBlockAt(buff, blocks, i + 1U);
+            window[next] = SD_PipelineWindow((i + 2U) < count);
+#if (SD_READ_STREAM_GAP > 0U)
+            const uint8_t *gap = &stage[SD_BLOCK_SIZE + 2U - carried[slot]];
+            uint16_t at = SD_PipelineFindToken(gap);
+            if (at > 0U) {
+                sd_handle->stats.rx_stream_tokens++;
+                carried[next] = (uint16_t)(SD_READ_STREAM_GAP - at);
+                status = SD_PipelineStart(sd_handle, next, dest, &gap[at], carried[next],
+                                          window[next]);
+            } else {
+                status = SD_PipelineNext(sd_handle, next, dest, window[next], &carried[next]);
+            }
+#else
+            /* The token scan must own the bus, so it runs between the two DMAs. */
+            status = SD_PipelineNext(sd_handle, next, dest, window[next], &carried[next]);
+#endif
+        }
+        memcpy(block + carried[slot], stage, SD_BLOCK_SIZE - carried[slot]);
+        /* Checked while the next block's DMA runs; a mismatch is reported after the run. */
+        if (crc_status == SD_OK) {
+            crc_status = SD_CheckDataCrc(sd_handle, block, &stage[SD_BLOCK_SIZE - carried[slot]]);
+            if (crc_status == SD_OK) {
+                *done = i + 1U;
+            }
+        }
+        if (status == SD_OK) {
+            /* The next block's DMA runs meanwhile; the hook only delays its wait. */
+            SD_ChunkPoint(sd_handle, i + 1U, count);
+        }
+    }
+    return (status == SD_OK) ? crc_status : status;
+}
+#endif
+
+/*
+ * CMD18 run. *done (optional) is set to the number of leading blocks received
+ * with a good CRC, also when the run fails part-way.
+ */
+static SD_Status SD_ReadMultiBlocksInternal(SD_Handle_t *sd_handle, uint8_t *buff,
+                                            uint8_t *const *blocks, uint32_t sector,
+                                            uint32_t count, uint32_t *done) {
+    uint32_t local_done = 0;
+    if (!done) {
+        done = &local_done;
+    }
+    *done = 0;
+    if (!sd_handle || (!buff && !blocks) || count == 0) {
+        return SD_PARAM;
+    }
+    if (!sd_handle->initialized) {
+        return SD_ERROR;
+    }
+
+    uint8_t response = 0xFFU;
+    SD_Status status = SD_OK;
+    bool resume = false;
+#if (SD_READ_SESSION == 1)
+    resume = SD_SessionResumes(sd_handle, SD_SESSION_READ, sector);
+#endif
+    if (resume) {
+        sd_handle->stats.session_reads++;
+    } else {
+        SD_Select(sd_handle);
+        /* Stops an open session first (SD_IssueCommand). */
+        status = SD_SendCommand(sd_handle, SD_CMD18, SD_CardAddress(sd_handle, sector), 0xFFU,
+                                &response);
+        if (status != SD_OK || response != 0x00U) {
+            SD_Deselect(sd_handle);
+            (void)SD_TransmitByte(sd_handle, 0xFFU);
+            return SD_ERROR;
+        }
+    }
+
+#if (SD_READ_PIPELINE == 1)
+    if (sd_handle->use_dma) {
+        status = SD_ReadMultiBlocksPipelined(sd_handle, buff, blocks, count, done);
+    } else {
+        status = SD_ReadMultiBlocksPolled(sd_handle, buff, blocks, count, done);
+    }
+#else
+    status = SD_ReadMultiBlocksPolled(sd_handle, buff, blocks, count, done);
+#endif
+
+#if (SD_READ_SESSION == 1)
+    if (status == SD_OK) {
+        /* Left running, card selected: the next block is the card's to stream. */
+        sd_handle->session = SD_SESSION_READ;
+        sd_handle->session_next = sector + count;
+        sd_handle->session_tick = HAL_GetTick();
+        return SD_OK;
+    }
+#endif
+    (void)SD_SendCommand(sd_handle, SD_CMD12, 0, 0xFFU, &response);
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    return status;
+}
+
+/* Block i of a write: from the gather list when given, else from the contiguous buffer. */
+static const uint8_t *SD_BlockAt(const uint8_t *buff, const uint8_t *const *blocks, uint32_t i) {
+    return blocks ? blocks[i] : (buff + (i * SD_BLOCK_SIZE));
+}
+
+static SD_Status SD_WriteMultiBlocksPolled(SD_Handle_t *sd_handle, const uint8_t *buff,
+                                           const uint8_t *const *blocks, uint32_t count,
+                                           uint32_t *done) {
+    SD_Status status = SD_OK;
+    uint8_t response = 0xFFU;
+    SD_CacheRangeBegin(sd_handle, blocks ? NULL : buff, count, false);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *block = SD_BlockAt(buff, blocks, i);
+        (void)SD_TransmitByte(sd_handle, SD_TOKEN_START_MULTI_WRITE);
+        status = SD_TransmitBlock(sd_handle, block);
+        if (status != SD_OK) {
+            break;
+        }
+
+        uint8_t crc[2];
+        SD_DataCrc(sd_handle, block, crc);
+        (void)SD_TransmitByte(sd_handle, crc[0]);
+        (void)SD_TransmitByte(sd_handle, crc[1]);
+
+        (void)SD_ReceiveByte(sd_handle, &response);
+        if ((response & SD_DATA_RESP_MASK) != SD_DATA_RESP_ACCEPTED) {
+            status = (response == SD_DATA_RESP_CRC_ERR) ? SD_CRC_ERROR : SD_WRITE_ERROR;
+            break;
+        }
+
+        status = SD_WaitWriteBusy(sd_handle);
+        if (status != SD_OK) {
+            break;
+        }
+        *done = i + 1U;
+        SD_ChunkPoint(sd_handle, *done, count);
+    }
+    SD_CacheRangeEnd(sd_handle);
+    return status;
+}
+
+#if (SD_WRITE_PIPELINE == 1)
+/* Build the CMD25 frame for one block: start token, data, CRC16 (dummy outside CRC mode). */
+static void SD_WriteStagePrepare(SD_Handle_t *sd_handle, uint8_t *stage,
+                                 const uint8_t *block) {
+    stage[0] = SD_TOKEN_START_MULTI_WRITE;
+    memcpy(&stage[1], block, SD_BLOCK_SIZE);
+    SD_DataCrc(sd_handle, &stage[1], &stage[SD_BLOCK_SIZE + 1U]);
+    SD_CacheClean(sd_handle, stage, SD_TX_STAGE_LEN);
+}
+
+/*
+ * Pipelined CMD25: each block goes out as one DMA frame, and the frame for block
+ * N+1 is built while the card is still programming block N, so the next DMA
+ * starts as soon as the busy poll sees the card ready.
+ */
+static SD_Status SD_WriteMultiBlocksPipelined(SD_Handle_t *sd_handle, const uint8_t *buff,
+                                              const uint8_t *const *blocks, uint32_t count,
+                                              uint32_t *done) {
+    SD_Status status = SD_OK;
+    uint8_t response = 0xFFU;
+    uint8_t *stage = s_tx_stage[sd_handle->instance];
+
+    SD_WriteStagePrepare(sd_handle, stage, SD_BlockAt(buff, blocks, 0));
+    for (uint32_t i = 0; i < count; i++) {
+        status = SD_SPI_Transmit(sd_handle, stage, SD_TX_STAGE_LEN, true);
+        if (status != SD_OK) {
+            break;
+        }
+
+        (void)SD_ReceiveByte(sd_handle, &response);
+        if ((response & SD_DATA_RESP_MASK) != SD_DATA_RESP_ACCEPTED) {
+            status = (response == SD_DATA_RESP_CRC_ERR) ? SD_CRC_ERROR : SD_WRITE_ERROR;
+            break;
+        }
+
+        if ((i + 1U) < count) {
+            SD_WriteStagePrepare(sd_handle, stage, SD_BlockAt(buff, blocks, i + 1U));
+        }
+        status = SD_WaitWriteBusy(sd_handle);
+        if (status != SD_OK) {
+            break;
+        }
+        *done = i + 1U;
+        SD_ChunkPoint(sd_handle, *done, count);
+    }
+    return status;
+}
+#endif
+
+#if (SD_ACMD23_MIN_BLOCKS > 0U)
+/*
+ * Tell the card how many blocks the coming CMD25 will write so it can pre-erase.
+ * The hint is optional: failures are ignored, and a card that rejects the command
+ * as illegal is not asked again until it is re-initialized.
+ */
+static void SD_SendPreEraseHint(SD_Handle_t *sd_handle, uint32_t count) {
+    uint8_t response = 0xFFU;
+    if (SD_SendCommand(sd_handle, SD_CMD55, 0, 0xFFU, &response) == SD_OK && response == 0x00U) {
+        (void)SD_SendCommand(sd_handle, SD_ACMD23, count & SD_ACMD23_COUNT_MASK, 0xFFU, &response);
+    }
+    if ((response != 0xFFU) && ((response & SD_R1_ILLEGAL_CMD) != 0U)) {
+        sd_handle->acmd23_ok = false;
+    }
+}
+#endif
+
+/* Card selected: end a CMD25 with the stop token and wait out (or defer) the busy that follows. */
+static void SD_StopTran(SD_Handle_t *sd_handle) {
+    SD_SET_READY(sd_handle, false);
+    (void)SD_TransmitByte(sd_handle, SD_TOKEN_STOP_TRAN);
+#if (SD_SPLIT_BUSY == 1)
+    SD_DeferBusy(sd_handle);
+#else
+    (void)SD_WaitWriteBusy(sd_handle);
+#endif
+}
+
+/*
+ * CMD25 run. *done (optional) is set to the number of leading blocks the card
+ * accepted and finished programming, also when the run fails part-way.
+ */
+static SD_Status SD_WriteMultiBlocksInternal(SD_Handle_t *sd_handle, const uint8_t *buff,
+                                             const uint8_t *const *blocks, uint32_t sector,
+                                             uint32_t count, uint32_t *done) {
+    uint32_t local_done = 0;
+    if (!done) {
+        done = &local_done;
+    }
+    *done = 0;
+    if (!sd_handle || (!buff && !blocks) || count == 0) {
+        return SD_PARAM;
+    }
+    if (!sd_handle->initialized) {
+        return SD_ERROR;
+    }
+
+    SD_Status status = SD_OK;
+    bool resume = false;
+#if (SD_WRITE_SESSION == 1)
+    resume = SD_SessionResumes(sd_handle, SD_SESSION_WRITE, sector);
+#endif
+    if (resume) {
+#if (SD_WRITE_SESSION == 1)
+        sd_handle->session = SD_SESSION_NONE; /* open again below once the blocks are in */
+#endif
+        SD_SET_READY(sd_handle, false); /* the blocks below make it busy again */
+        sd_handle->stats.session_writes++;
+    } else {
+        SD_Select(sd_handle);
+
+#if (SD_ACMD23_MIN_BLOCKS > 0U)
+        if (sd_handle->acmd23_ok && (count >= SD_ACMD23_MIN_BLOCKS)) {
+            SD_SendPreEraseHint(sd_handle, count);
+        }
+#endif
+
+        /* Stops an open session first (SD_IssueCommand). */
+        uint8_t response = 0xFFU;
+        status = SD_SendCommand(sd_handle, SD_CMD25, SD_CardAddress(sd_handle, sector), 0xFFU,
+                                &response);
+        if (status != SD_OK || response != 0x00U) {
+            SD_Deselect(sd_handle);
+            (void)SD_TransmitByte(sd_handle, 0xFFU);
+            return SD_ERROR;
+        }
+    }
+
+#if (SD_WRITE_PIPELINE == 1)
+    if (sd_handle->use_dma) {
+        status = SD_WriteMultiBlocksPipelined(sd_handle, buff, blocks, count, done);
+    } else {
+        status = SD_WriteMultiBlocksPolled(sd_handle, buff, blocks, count, done);
+    }
+#else
+    status = SD_WriteMultiBlocksPolled(sd_handle, buff, blocks, count, done);
+#endif
+
+#if (SD_WRITE_SESSION == 1)
+    if (status == SD_OK) {
+        /* Left open, card selected: the stop token waits for whatever comes next. */
+        sd_handle->session = SD_SESSION_WRITE;
+        sd_handle->session_next = sector + count;
+        sd_handle->session_tick = HAL_GetTick();
+        return SD_OK;
+    }
+#endif
+    SD_StopTran(sd_handle);
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    return status;
+}
+
+static int SD_InstanceSlot(const SD_Handle_t *sd_handle) {
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES; i++) {
+        if (s_instances[i] == sd_handle) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static SD_RAMFUNC void SD_DmaComplete(SD_Handle_t *sd_handle, bool tx, bool rx, bool error) {
+    if (error) {
+        sd_handle->dma_error = true;
+    }
+#if (SD_TRACE_ENABLED == 1)
+    SD_TRACE(SD_TRACE_DMA, sd_handle->instance,
+             (tx ? SD_TRACE_DMA_TX : 0U) | (rx ? SD_TRACE_DMA_RX : 0U) |
+                 (error ? SD_TRACE_DMA_ERROR : 0U),
+             0U, error ? SD_ERROR : SD_OK, 0U, sd_handle->dma_start);
+#endif
+#if defined(USE_FREERTOS)
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+#endif
+    if (tx) {
+        sd_handle->dma_tx_done = true;
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 0)
+        if (sd_handle->dma_tx_sem) {
+            xSemaphoreGiveFromISR(sd_handle->dma_tx_sem, &xHigherPriorityTaskWoken);
+        }
+#endif
+    }
+    if (rx) {
+        sd_handle->dma_rx_done = true;
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 0)
+        if (sd_handle->dma_rx_sem) {
+            xSemaphoreGiveFromISR(sd_handle->dma_rx_sem, &xHigherPriorityTaskWoken);
+        }
+#endif
+    }
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 1)
+    TaskHandle_t task = sd_handle->xfer_task;
+    if (task != NULL) {
+        sd_handle->xfer_gives++;
+        vTaskNotifyGiveFromISR(task, &xHigherPriorityTaskWoken);
+    }
+#endif
+#if defined(USE_FREERTOS)
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+#endif
+}
+
+/*
+ * DMA callbacks: signal every instance on the interrupting bus. Flags and
+ * semaphores are reset before each transfer, so an instance sharing the bus
+ * without a transfer in flight ignores the event. On a shared bus object only
+ * the device holding it is signalled.
+ */
+static SD_RAMFUNC void SD_DmaDispatch(SPI_HandleTypeDef *hspi, bool tx, bool rx, bool error) {
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES; i++) {
+        if (s_instances[i] && s_instances[i]->hspi == hspi) {
+#if (SD_SHARED_BUS == 1)
+            SD_Bus_t *bus = s_instances[i]->bus;
+            if (bus != NULL) {
+                if (bus->owner_is_sd) {
+                    SD_DmaComplete((SD_Handle_t *)bus->owner, tx, rx, error);
+                } else if (bus->done != NULL) {
+                    bus->done(bus->owner, tx, rx, error);
+                }
+                return;
+            }
+#endif
+            SD_DmaComplete(s_instances[i], tx, rx, error);
+        }
+    }
+}
+
+SD_RAMFUNC void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+    SD_DmaDispatch(hspi, true, false, false);
+}
+
+SD_RAMFUNC void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
+    SD_DmaDispatch(hspi, false, true, false);
+}
+
+SD_RAMFUNC void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    HAL_SPI_RxCpltCallback(hspi);
+}
+
+SD_RAMFUNC void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    SD_DmaDispatch(hspi, true, true, true);
+}
+
+#if (SD_SHARED_BUS == 1)
+/* Leave the shared bus; the next device to take it sets the SPI up again. */
+static void SD_BusDetach(SD_Handle_t *sd_handle) {
+    SD_Bus_t *bus = sd_handle->bus;
+    if (bus != NULL && bus->owner == sd_handle) {
+        bus->owner = NULL;
+        bus->owner_is_sd = false;
+    }
+    sd_handle->bus = NULL;
+}
+#endif
+
+SD_Status SD_Init(SD_Handle_t *sd_handle, SPI_HandleTypeDef *hspi,
+                  GPIO_TypeDef *cs_port, uint16_t cs_pin, bool use_dma) {
+    if (!sd_handle || !hspi || !cs_port) {
+        return SD_PARAM;
+    }
+
+    /* Re-initializing a registered handle keeps its slot and its static buffers. */
+    int slot = SD_InstanceSlot(sd_handle);
+    if (slot < 0) {
+        slot = SD_InstanceSlot(NULL);
+        if (slot < 0) {
+            return SD_ERROR;
+        }
+    }
+#if defined(USE_FREERTOS)
+    if (s_instances[slot] == sd_handle) {
+        SD_DeInit(sd_handle);
+    }
+#elif (SD_SHARED_BUS == 1)
+    if (s_instances[slot] == sd_handle) {
+        SD_BusDetach(sd_handle);
+    }
+#endif
+
+    memset(sd_handle, 0, sizeof(SD_Handle_t));
+    sd_handle->instance = (uint8_t)slot;
+    sd_handle->hspi = hspi;
+    sd_handle->cs_port = cs_port;
+    sd_handle->cs_pin = cs_pin;
+    sd_handle->use_dma = use_dma;
+    sd_handle->use_irq = false;
+    sd_handle->xfer_threshold = SD_XFER_THRESHOLD;
+#if (SD_IDLE_GATE_MS > 0U)
+    sd_handle->last_io_tick = HAL_GetTick();
+#endif
+#if (SD_LATENCY_STATS == 1)
+    sd_handle->stats_tick = HAL_GetTick();
+#endif
+    sd_handle->acmd23_ok = false;
+    sd_handle->initialized = false;
+    sd_handle->is_sdhc = false;
+    sd_handle->block_size = SD_BLOCK_SIZE;
+    sd_handle->bus_prescaler = SD_SPI_INIT_PRESCALER;
+    sd_handle->last_status = SD_OK;
+
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 1)
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    sd_handle->mutex = xSemaphoreCreateMutexStatic(&sd_mutex_buffer[slot]);
+#else
+    sd_handle->mutex = xSemaphoreCreateMutex();
+#endif
+    sd_handle->xfer_task = NULL;
+    if (sd_handle->mutex == NULL) {
+        return SD_RecordStatus(sd_handle, SD_ERROR);
+    }
+#elif defined(USE_FREERTOS)
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    sd_handle->mutex = xSemaphoreCreateMutexStatic(&sd_mutex_buffer[slot]);
+    sd_handle->dma_tx_sem = xSemaphoreCreateBinaryStatic(&sd_dma_tx_buffer[slot]);
+    sd_handle->dma_rx_sem = xSemaphoreCreateBinaryStatic(&sd_dma_rx_buffer[slot]);
+#else
+    sd_handle->mutex = xSemaphoreCreateMutex();
+    sd_handle->dma_tx_sem = xSemaphoreCreateBinary();
+    sd_handle->dma_rx_sem = xSemaphoreCreateBinary();
+#endif
+    if (sd_handle->mutex == NULL || sd_handle->dma_tx_sem == NULL || sd_handle->dma_rx_sem == NULL) {
+        return SD_RecordStatus(sd_handle, SD_ERROR);
+    }
+    (void)xSemaphoreTake(sd_handle->dma_tx_sem, 0);
+    (void)xSemaphoreTake(sd_handle->dma_rx_sem, 0);
+#endif
+
+#if (SD_DMA_PROFILE == 1)
+    sd_handle->dma_profile.priority = SD_DMA_PRIORITY;
+    sd_handle->dma_profile.fifo = (SD_DMA_FIFO == 1);
+    sd_handle->dma_profile.word_mem = (SD_DMA_WORD_MEM == 1);
+    sd_handle->dma_profile.mem_burst = SD_DMA_MEM_BURST;
+    if (SD_DmaApplyProfile(sd_handle) != SD_OK) {
+        return SD_RecordStatus(sd_handle, SD_ERROR);
+    }
+#endif
+
+    SD_CycleCounterInit();
+    s_instances[slot] = sd_handle;
+    return SD_OK;
+}
+
+void SD_DeInit(SD_Handle_t *sd_handle) {
+    if (!sd_handle) {
+        return;
+    }
+
+#if defined(USE_FREERTOS)
+    if (sd_handle->mutex) {
+        vSemaphoreDelete(sd_handle->mutex);
+        sd_handle->mutex = NULL;
+    }
+#if (SD_DMA_NOTIFY == 0)
+    if (sd_handle->dma_tx_sem) {
+        vSemaphoreDelete(sd_handle->dma_tx_sem);
+        sd_handle->dma_tx_sem = NULL;
+    }
+    if (sd_handle->dma_rx_sem) {
+        vSemaphoreDelete(sd_handle->dma_rx_sem);
+        sd_handle->dma_rx_sem = NULL;
+    }
+#endif
+#endif
+
+    sd_handle->initialized = false;
+#if SD_SESSIONS
+    if (sd_handle->session != SD_SESSION_NONE) {
+        if (sd_handle->session == SD_SESSION_WRITE) {
+            SD_SessionStop(sd_handle); /* the stop token, so the card leaves its receive state */
+        }
+        sd_handle->session = SD_SESSION_NONE;
+        SD_Deselect(sd_handle);
+    }
+#endif
+#if (SD_SHARED_BUS == 1)
+    SD_BusDetach(sd_handle);
+#endif
+    int slot = SD_InstanceSlot(sd_handle);
+    if (slot >= 0) {
+        s_instances[slot] = NULL;
+    }
+}
+
+#if (SD_SHARED_BUS == 1)
+/* Bus lock held: set the SPI up for this card if another device had it. */
+static SD_Status SD_BusTake(SD_Handle_t *sd_handle) {
+    SD_Bus_t *bus = sd_handle->bus;
+    if (bus->owner == sd_handle) {
+        return SD_OK;
+    }
+    bus->owner = sd_handle;
+    bus->owner_is_sd = true;
+    bus->done = NULL;
+    bus->handoffs++;
+#if (SD_DMA_PROFILE == 1) || (SD_SPI_FRAME16 == 1) || (SD_DMA_FIXED_TX == 1) || \
+    (SD_DMA_DESCRIPTORS == 1)
+    SD_DmaInvalidate(sd_handle); /* the streams were laid out for someone else */
+#endif
+    if (bus->hspi->Init.BaudRatePrescaler != sd_handle->bus_prescaler) {
+        bus->reclocks++;
+    }
+    return SD_ApplyBusPrescaler(sd_handle, sd_handle->bus_prescaler);
+}
+#endif
+
+SD_Status SD_BusInit(SD_Bus_t *bus, SPI_HandleTypeDef *hspi) {
+#if (SD_SHARED_BUS == 1)
+    if (!bus || !hspi) {
+        return SD_PARAM;
+    }
+    memset(bus, 0, sizeof(*bus));
+    bus->hspi = hspi;
+#if defined(USE_FREERTOS)
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    bus->mutex = xSemaphoreCreateMutexStatic(&bus->mutex_buffer);
+#else
+    bus->mutex = xSemaphoreCreateMutex();
+#endif
+    if (bus->mutex == NULL) {
+        return SD_ERROR;
+    }
+#endif
+    return SD_OK;
+#else
+    (void)bus;
+    (void)hspi;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+SD_Status SD_BusAttach(SD_Handle_t *sd_handle, SD_Bus_t *bus) {
+#if (SD_SHARED_BUS == 1)
+    if (!sd_handle || !bus || sd_handle->hspi != bus->hspi) {
+        return SD_PARAM;
+    }
+    sd_handle->bus = bus;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)bus;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+SD_Status SD_BusAcquire(SD_Bus_t *bus, void *owner, uint32_t prescaler, SD_BusDoneFn done,
+                        uint32_t timeout_ms) {
+#if (SD_SHARED_BUS == 1)
+    if (!bus || !owner) {
+        return SD_PARAM;
+    }
+#if defined(USE_FREERTOS)
+    if (SD_InISR()) {
+        return SD_BUSY;
+    }
+    if (bus->mutex == NULL) {
+        return SD_ERROR;
+    }
+    if (xSemaphoreTake(bus->mutex, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return SD_BUSY;
+    }
+#else
+    (void)timeout_ms;
+#endif
+    if (bus->owner != owner) {
+        bus->handoffs++;
+    }
+    bus->owner = owner;
+    bus->owner_is_sd = false;
+    bus->done = done;
+    if (bus->hspi->Init.BaudRatePrescaler != prescaler) {
+        bus->reclocks++;
+        bus->hspi->Init.BaudRatePrescaler = prescaler;
+        if (HAL_SPI_Init(bus->hspi) != HAL_OK) {
+            SD_BusRelease(bus);
+            return SD_ERROR;
+        }
+    }
+    return SD_OK;
+#else
+    (void)bus;
+    (void)owner;
+    (void)prescaler;
+    (void)done;
+    (void)timeout_ms;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+void SD_BusRelease(SD_Bus_t *bus) {
+#if (SD_SHARED_BUS == 1) && defined(USE_FREERTOS)
+    if (bus && bus->mutex) {
+        xSemaphoreGive(bus->mutex);
+    }
+#else
+    (void)bus;
+#endif
+}
+
+SD_Status SD_SetTransport(SD_Handle_t *sd_handle, SD_XferMode mode, uint16_t threshold) {
+    if (!sd_handle || mode >= SD_XFER_COUNT) {
+        return SD_PARAM;
+    }
+    SD_Status status = SD_Lock(sd_handle);
+    if (status != SD_OK) {
+        return status;
+    }
+    sd_handle->use_dma = (mode == SD_XFER_DMA);
+    sd_handle->use_irq = (mode == SD_XFER_IRQ);
+    sd_handle->xfer_threshold = threshold;
+    SD_Unlock(sd_handle);
+    return SD_OK;
+}
+
+SD_Status SD_SetDmaProfile(SD_Handle_t *sd_handle, const SD_DmaProfile *profile) {
+#if (SD_DMA_PROFILE == 1)
+    if (!sd_handle || !profile) {
+        return SD_PARAM;
+    }
+    bool priority_ok = profile->priority == DMA_PRIORITY_LOW ||
+                       profile->priority == DMA_PRIORITY_MEDIUM ||
+                       profile->priority == DMA_PRIORITY_HIGH ||
+                       profile->priority == DMA_PRIORITY_VERY_HIGH;
+    bool burst_ok = profile->mem_burst == DMA_MBURST_SINGLE ||
+                    (profile->mem_burst == DMA_MBURST_INC4 && profile->word_mem);
+    if (!priority_ok || !burst_ok || (profile->word_mem && !profile->fifo)) {
+        return SD_PARAM;
+    }
+    SD_Status status = SD_Lock(sd_handle);
+    if (status != SD_OK) {
+        return status;
+    }
+    sd_handle->dma_profile = *profile;
+    status = SD_DmaApplyProfile(sd_handle);
+    SD_Unlock(sd_handle);
+    return status;
+#else
+    (void)sd_handle;
+    (void)profile;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+SD_Status SD_GetDmaProfile(SD_Handle_t *sd_handle, SD_DmaProfile *out) {
+#if (SD_DMA_PROFILE == 1)
+    if (!sd_handle || !out) {
+        return SD_PARAM;
+    }
+    *out = sd_handle->dma_profile;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)out;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+SD_Status SD_DmaSetNoCache(void *base, size_t size, uint8_t mpu_region) {
+    if (size == 0U) {
+        s_nocache_lo = 0U;
+        s_nocache_hi = 0U;
+        return SD_OK;
+    }
+    if (!base) {
+        return SD_PARAM;
+    }
+    if (mpu_region != SD_MPU_REGION_NONE) {
+#if defined(__MPU_PRESENT) && (__MPU_PRESENT == 1U) && defined(HAL_CORTEX_MODULE_ENABLED)
+        /* One region of 2^n bytes (n >= 5) at a multiple of its size. */
+        uint32_t log2 = 5U;
+        while ((log2 < 31U) && (((size_t)1U << log2) < size)) {
+            log2++;
+        }
+        uint32_t regions = (MPU->TYPE & MPU_TYPE_DREGION_Msk) >> MPU_TYPE_DREGION_Pos;
+        if ((((size_t)1U << log2) != size) || (((uintptr_t)base & (size - 1U)) != 0U) ||
+            (mpu_region >= regions)) {
+            return SD_PARAM;
+        }
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+        SCB_CleanInvalidateDCache_by_Addr((uint32_t *)base, (int32_t)size);
+#endif
+        MPU_Region_InitTypeDef region = {0};
+        region.Enable = MPU_REGION_ENABLE;
+        region.Number = mpu_region;
+        region.BaseAddress = (uint32_t)(uintptr_t)base;
+        region.Size = (uint8_t)(log2 - 1U);
+        region.SubRegionDisable = 0x00U;
+        region.TypeExtField = MPU_TEX_LEVEL1; /* with C = B = 0: normal, non-cacheable */
+        region.AccessPermission = MPU_REGION_FULL_ACCESS;
+        region.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+        region.IsShareable = MPU_ACCESS_SHAREABLE;
+        region.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+        region.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+        uint32_t ctrl = MPU->CTRL & ~MPU_CTRL_ENABLE_Msk;
+        HAL_MPU_Disable();
+        HAL_MPU_ConfigRegion(&region);
+        HAL_MPU_Enable((ctrl != 0U) ? ctrl : MPU_PRIVILEGED_DEFAULT);
+#else
+        return SD_UNSUPPORTED;
+#endif
+    }
+    s_nocache_lo = (uintptr_t)base;
+    s_nocache_hi = (uintptr_t)base + size;
+    return SD_OK;
+}
+
+SD_Status SD_SetCardDetect(SD_Handle_t *sd_handle, GPIO_TypeDef *cd_port, uint16_t cd_pin, bool active_low) {
+    if (!sd_handle || !cd_port) {
+        return SD_PARAM;
+    }
+    sd_handle->cd_port = cd_port;
+    sd_handle->cd_pin = cd_pin;
+    sd_handle->cd_active_low = active_low;
+    sd_handle->has_cd = true;
+    return SD_OK;
+}
+
+static bool SD_ReadCardDetect(SD_Handle_t *sd_handle) {
+    GPIO_PinState state = HAL_GPIO_ReadPin(sd_handle->cd_port, sd_handle->cd_pin);
+    return sd_handle->cd_active_low ? (state == GPIO_PIN_RESET) : (state == GPIO_PIN_SET);
+}
+
+bool SD_IsCardPresent(SD_Handle_t *sd_handle) {
+    if (!sd_handle) {
+        return false;
+    }
+    if (!sd_handle->has_cd) {
+        return true;
+    }
+    if (sd_handle->cd_irq) {
+        return sd_handle->cd_present;
+    }
+    return SD_ReadCardDetect(sd_handle);
+}
+
+SD_Status SD_SetCardDetectIrq(SD_Handle_t *sd_handle, bool enable) {
+    if (!sd_handle || (enable && !sd_handle->has_cd)) {
+        return SD_PARAM;
+    }
+    sd_handle->cd_irq = false;
+    sd_handle->cd_pending = false;
+    sd_handle->cd_present = enable ? SD_ReadCardDetect(sd_handle) : false;
+    sd_handle->cd_irq = enable;
+    return SD_OK;
+}
+
+void SD_CardDetectIrq(SD_Handle_t *sd_handle) {
+    if (!sd_handle || !sd_handle->cd_irq) {
+        return;
+    }
+    sd_handle->cd_edge_tick = HAL_GetTick();
+    sd_handle->cd_pending = true;
+}
+
+void SD_CardDetectTick(SD_Handle_t *sd_handle) {
+    if (!sd_handle || !sd_handle->cd_irq || !sd_handle->cd_pending) {
+        return;
+    }
+    uint32_t edge = sd_handle->cd_edge_tick;
+    if ((HAL_GetTick() - edge) < SD_CD_DEBOUNCE_MS) {
+        return;
+    }
+    sd_handle->cd_pending = false;
+    if (sd_handle->cd_edge_tick != edge) {
+        sd_handle->cd_pending = true; /* bounced again while we looked */
+        return;
+    }
+    sd_handle->cd_present = SD_ReadCardDetect(sd_handle);
+    sd_handle->initialized = false;
+    sd_handle->cd_events++;
+}
+
+uint32_t SD_GetCardDetectEvents(SD_Handle_t *sd_handle) {
+    return sd_handle ? sd_handle->cd_events : 0U;
+}
+
+#if (SD_IDLE_GATE_MS > 0U)
+/* Bus lock held. The card keeps its state with CS high; only the host side powers down. */
+static void SD_Gate(SD_Handle_t *sd_handle) {
+#if SD_SESSIONS
+    SD_SessionStop(sd_handle);
+#endif
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU); /* card releases DO */
+    (void)HAL_SPI_DeInit(sd_handle->hspi);
+    if (sd_handle->clock_gate) {
+        sd_handle->clock_gate(sd_handle->clock_gate_ctx, false);
+    }
+    sd_handle->gate_tick = HAL_GetTick();
+    sd_handle->gated = true;
+    sd_handle->stats.idle_gates++;
+}
+
+/* Bus lock held. hspi->Init still holds the negotiated prescaler; MSP init restores pins and DMA. */
+static SD_Status SD_Ungate(SD_Handle_t *sd_handle) {
+    if (sd_handle->clock_gate) {
+        sd_handle->clock_gate(sd_handle->clock_gate_ctx, true);
+    }
+    if (HAL_SPI_Init(sd_handle->hspi) != HAL_OK) {
+        return SD_ERROR;
+    }
+    SD_DmaInvalidate(sd_handle);
+    sd_handle->gated = false;
+    sd_handle->stats.idle_gated_ms += HAL_GetTick() - sd_handle->gate_tick;
+    return SD_OK;
+}
+
+/* Gate if the idle window ends within ahead_ms; never waits for the bus. */
+static bool SD_IdleGateIf(SD_Handle_t *sd_handle, uint32_t ahead_ms) {
+    if (sd_handle->gated || sd_handle->hspi == NULL) {
+        return sd_handle->gated;
+    }
+#if defined(USE_FREERTOS)
+    if (sd_handle->mutex == NULL || xSemaphoreTake(sd_handle->mutex, 0) != pdTRUE) {
+        return false;
+    }
+#endif
+    if ((HAL_GetTick() - sd_handle->last_io_tick) + ahead_ms >= SD_IDLE_GATE_MS) {
+        SD_Gate(sd_handle);
+    }
+#if defined(USE_FREERTOS)
+    xSemaphoreGive(sd_handle->mutex);
+#endif
+    return sd_handle->gated;
+}
+#endif
+
+SD_Status SD_SetClockGateHook(SD_Handle_t *sd_handle, SD_ClockGateFn fn, void *context) {
+#if (SD_IDLE_GATE_MS > 0U)
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    sd_handle->clock_gate = fn;
+    sd_handle->clock_gate_ctx = context;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)fn;
+    (void)context;
+    return SD_UNSUPPORTED;
+#endif
+}
 
-        uint8_t crc[2];
-        (void)SD_SPI_TransmitReceive(sd_handle, s_dummy_tx, crc, 2, false);
-        buff += SD_BLOCK_SIZE;
-    }
-
-    (void)SD_SendCommand(sd_handle, SD_CMD12, 0, 0xFFU, &response);
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+SD_Status SD_SetChunkHook(SD_Handle_t *sd_handle, SD_ChunkFn fn, void *context) {
+#if (SD_CHUNK_BLOCKS > 0U)
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    sd_handle->chunk_fn = fn;
+    sd_handle->chunk_ctx = context;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)fn;
+    (void)context;
+    return SD_UNSUPPORTED;
+#endif
+}
 
-    return status;
+#if SD_SESSIONS
+/* Stop a session that has idled past its limit; never waits for the bus. */
+static void SD_SessionIdleStop(SD_Handle_t *sd_handle) {
+    if (sd_handle->session == SD_SESSION_NONE) {
+        return;
+    }
+#if defined(USE_FREERTOS)
+    if (sd_handle->mutex == NULL || xSemaphoreTake(sd_handle->mutex, 0) != pdTRUE) {
+        return;
+    }
+#endif
+    if (sd_handle->session != SD_SESSION_NONE &&
+        (HAL_GetTick() - sd_handle->session_tick) >= SD_SessionIdleMs(sd_handle)) {
+        SD_SessionStop(sd_handle);
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+    }
+#if defined(USE_FREERTOS)
+    xSemaphoreGive(sd_handle->mutex);
+#endif
 }
+#endif
 
-static SD_Status SD_WriteMultiBlocksInternal(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count) {
-    if (!sd_handle || !buff || count == 0) {
-        return SD_PARAM;
+bool SD_IdlePoll(SD_Handle_t *sd_handle) {
+#if SD_SESSIONS
+    if (sd_handle) {
+        SD_SessionIdleStop(sd_handle);
     }
-    if (!sd_handle->initialized) {
+#endif
+#if (SD_IDLE_GATE_MS > 0U)
+    return sd_handle ? SD_IdleGateIf(sd_handle, 0U) : false;
+#else
+    (void)sd_handle;
+    return false;
+#endif
+}
+
+void SD_IdlePreSleep(uint32_t expected_ms) {
+#if (SD_IDLE_GATE_MS > 0U)
+    for (uint32_t i = 0; i < SD_MAX_INSTANCES; i++) {
+        if (s_instances[i]) {
+            (void)SD_IdleGateIf(s_instances[i], expected_ms);
+        }
+    }
+#else
+    (void)expected_ms;
+#endif
+}
+
+bool SD_IsClockGated(SD_Handle_t *sd_handle) {
+#if (SD_IDLE_GATE_MS > 0U)
+    return sd_handle ? sd_handle->gated : false;
+#else
+    (void)sd_handle;
+    return false;
+#endif
+}
+
+/* Identify the card and negotiate the bus; bus lock held. */
+static SD_Status SD_SPI_InitLocked(SD_Handle_t *sd_handle) {
+    if (!s_dummy_init) {
+        memset(s_dummy_tx, 0xFF, sizeof(s_dummy_tx));
+#ifdef SD_DCACHE_CLEAN
+        SD_DCACHE_CLEAN(s_dummy_tx, sizeof(s_dummy_tx));
+#endif
+        s_dummy_init = 1;
+    }
+
+    sd_handle->initialized = false;
+    SD_SET_READY(sd_handle, false); /* the card may not be the one seen last */
+
+    /* The last identification's ACMD41 time predicts this one (same socket, usually same card). */
+    SD_InitTiming *timing = &sd_handle->init_timing;
+    uint32_t expect_ms = timing->acmd41_us / 1000U;
+    memset(timing, 0, sizeof(*timing));
+    uint32_t phase = SD_InitClock();
+    uint32_t init_clock = phase;
+
+    /* Identification must run at <= 400 kHz, even after a previous fast session. */
+    if (SD_ApplyBusPrescaler(sd_handle, SD_SPI_INIT_PRESCALER) != SD_OK) {
         return SD_ERROR;
     }
 
-    uint32_t address = sd_handle->is_sdhc ? sector : (sector * SD_BLOCK_SIZE);
-    SD_Select(sd_handle);
+#if SD_SESSIONS
+    /* CMD0 resets whatever a session left running; the card may not be the same one. */
+    sd_handle->session = SD_SESSION_NONE;
+    sd_handle->session_next = UINT32_MAX;
+#endif
+    SD_Deselect(sd_handle);
+    for (uint8_t i = 0; i < 10; i++) {
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+    }
 
+    SD_Status status = SD_ERROR;
     uint8_t response = 0xFFU;
-    SD_Status status = SD_SendCommand(sd_handle, SD_CMD25, address, 0xFFU, &response);
-    if (status != SD_OK || response != 0x00U) {
+    uint8_t r7[4] = {0};
+    uint32_t init_start = HAL_GetTick();
+
+    do {
+        SD_Select(sd_handle);
+        status = SD_SendCommand(sd_handle, SD_CMD0, 0, 0x95U, &response);
         SD_Deselect(sd_handle);
         (void)SD_TransmitByte(sd_handle, 0xFFU);
+        if (status == SD_OK && response == 0x01U) {
+            break;
+        }
+        SD_BackoffDelay();
+    } while ((HAL_GetTick() - init_start) < SD_INIT_TIMEOUT_MS);
+
+    if (response != 0x01U) {
         return SD_ERROR;
     }
+    timing->cmd0_us = SD_InitLapUs(&phase);
 
-    bool use_dma = sd_handle->use_dma && SD_IsAligned(buff, SD_DMA_ALIGNMENT);
-    for (uint32_t i = 0; i < count; i++) {
-        (void)SD_TransmitByte(sd_handle, SD_TOKEN_START_MULTI_WRITE);
-        status = SD_SPI_Transmit(sd_handle, buff, SD_BLOCK_SIZE, use_dma);
-        if (status != SD_OK) {
-            break;
+    SD_Select(sd_handle);
+    status = SD_SendCommand(sd_handle, SD_CMD8, 0x000001AAU, 0x87U, &response);
+    if (status == SD_OK) {
+        for (uint8_t i = 0; i < 4; i++) {
+            (void)SD_ReceiveByte(sd_handle, &r7[i]);
         }
+    }
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
 
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
+    bool sdv2 = (status == SD_OK && response == 0x01U && r7[2] == 0x01U && r7[3] == 0xAAU);
+    timing->cmd8_us = SD_InitLapUs(&phase);
+#if (SD_SUPPORT_SDSC == 0)
+    /* A v1 card (no CMD8) is always standard capacity. */
+    if (!sdv2) {
+        return SD_UNSUPPORTED;
+    }
+#endif
 
-        (void)SD_ReceiveByte(sd_handle, &response);
-        if ((response & SD_DATA_RESP_MASK) != SD_DATA_RESP_ACCEPTED) {
-            status = (response == SD_DATA_RESP_CRC_ERR) ? SD_CRC_ERROR : SD_WRITE_ERROR;
+    /*
+     * ACMD41 polling: the first retries follow each other after a few idle
+     * bytes (tens of microseconds, keeping the clock running as the card
+     * expects during power-up), the gap doubling per miss; past
+     * SD_INIT_POLL_GAP_MAX the loop sleeps 1 ms per retry. When the previous
+     * identification took expect_ms, the loop sleeps through most of that
+     * instead of polling a card that cannot be ready yet.
+     */
+    uint32_t gap = SD_INIT_POLL_GAP_BYTES;
+    init_start = HAL_GetTick();
+    do {
+        if (timing->acmd41_polls != 0U && (HAL_GetTick() - init_start) + 1U < expect_ms) {
+            SD_BackoffDelay();
+            continue;
+        }
+        SD_Select(sd_handle);
+        (void)SD_SendCommand(sd_handle, SD_CMD55, 0, 0xFFU, &response);
+        status = SD_SendCommand(sd_handle, SD_ACMD41, sdv2 ? 0x40000000U : 0, 0xFFU, &response);
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+        timing->acmd41_polls++;
+        if (status == SD_OK && response == 0x00U) {
             break;
         }
+        if (gap != 0U && gap <= SD_INIT_POLL_GAP_MAX) {
+            for (uint32_t left = gap; left > 0U;) {
+                uint16_t n = (uint16_t)((left < SD_IDLE_TX_LEN) ? left : SD_IDLE_TX_LEN);
+                (void)SD_SPI_Transmit(sd_handle, s_dummy_tx, n, false);
+                left -= n;
+            }
+            gap <<= 1;
+        } else {
+            SD_BackoffDelay();
+        }
+    } while ((HAL_GetTick() - init_start) < SD_INIT_TIMEOUT_MS);
+
+    if (response != 0x00U) {
+        return SD_TIMEOUT;
+    }
+    timing->acmd41_us = SD_InitLapUs(&phase);
+
+    /* ACMD41 identified an SD memory card; ACMD23 is mandatory for those. */
+    sd_handle->acmd23_ok = true;
+
+    sd_handle->crc_on = false;
+#if (SD_CRC_ENABLED == 1)
+    SD_Select(sd_handle);
+    status = SD_SendCommand(sd_handle, SD_CMD59, 1U, 0xFFU, &response);
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+    sd_handle->crc_on = (status == SD_OK && response == 0x00U);
+#endif
+    sd_handle->is_sdhc = false;
+    sd_handle->capacity_blocks = 0;
+    sd_handle->erase_sector = 0;
+    sd_handle->erase_block = 0;
+#if (SD_CARD_INFO == 1)
+    memset(&sd_handle->card_info, 0, sizeof(sd_handle->card_info));
+    const uint8_t *info_cid = NULL;
+    const uint8_t *info_csd = NULL;
+#endif
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+    memset(sd_handle->adapt, 0, sizeof(sd_handle->adapt));
+#endif
+
+#if (SD_INIT_CACHE == 1)
+    /*
+     * The CID read proves the fast link (it carries a CRC7 like the CSD). A
+     * CID matching the cached session means the same card: its OCR and CSD
+     * are reused and CMD58/CMD9 are skipped.
+     */
+    uint8_t cid[16];
+    bool link = SD_NegotiateBus(sd_handle, SD_SPI_FAST_PRESCALER, SD_CMD10, cid);
+    SD_InitCache *cache = &sd_handle->init_cache;
+    timing->regs_us = SD_InitLapUs(&phase);
+    uint8_t csd[16];
+    if (link && cache->valid && memcmp(cid, cache->cid, sizeof(cid)) == 0) {
+        timing->cache_hit = true;
+        sd_handle->is_sdhc = (cache->ocr[0] & 0x40U) != 0U;
+        SD_ParseCSD(sd_handle, cache->csd);
+#if (SD_CARD_INFO == 1)
+        info_csd = cache->csd;
+#endif
+    } else {
+        cache->valid = false;
+        bool ocr_ok = (SD_ReadOCR(sd_handle, cache->ocr) == SD_OK);
+        if (SD_ReadRegister(sd_handle, SD_CMD9, csd) == SD_OK && SD_CSDValid(csd)) {
+            SD_ParseCSD(sd_handle, csd);
+            memcpy(cache->csd, csd, sizeof(csd));
+            memcpy(cache->cid, cid, sizeof(cid));
+            cache->valid = link && ocr_ok;
+#if (SD_CARD_INFO == 1)
+            info_csd = csd;
+#endif
+        }
+    }
+#if (SD_CARD_INFO == 1)
+    if (link) {
+        info_cid = cid;
+    }
+#endif
+#if (SD_SUPPORT_SDSC == 1)
+    if (!sd_handle->is_sdhc) {
+        status = SD_SetBlockLength(sd_handle);
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+#else
+    if (!sd_handle->is_sdhc) {
+        return SD_UNSUPPORTED;
+    }
+#endif
+    timing->setup_us = SD_InitLapUs(&phase);
+#else
+    uint8_t ocr[4];
+    (void)SD_ReadOCR(sd_handle, ocr);
+
+#if (SD_SUPPORT_SDSC == 1)
+    if (!sd_handle->is_sdhc) {
+        status = SD_SetBlockLength(sd_handle);
+        if (status != SD_OK) {
+            return status;
+        }
+    }
+#else
+    if (!sd_handle->is_sdhc) {
+        return SD_UNSUPPORTED;
+    }
+#endif
+    timing->setup_us = SD_InitLapUs(&phase);
+
+    uint8_t csd[16];
+    if (SD_NegotiateBus(sd_handle, SD_SPI_FAST_PRESCALER, SD_CMD9, csd)) {
+        SD_ParseCSD(sd_handle, csd);
+#if (SD_CARD_INFO == 1)
+        info_csd = csd;
+#endif
+    }
+    timing->regs_us = SD_InitLapUs(&phase);
+#endif
+#if (SD_HIGH_SPEED == 1)
+    /* The faster clock is proven on a fresh CSD, which also carries the new TRAN_SPEED. */
+    uint8_t hs_csd[16];
+    if (SD_EnableHighSpeed(sd_handle) &&
+        SD_NegotiateBus(sd_handle, SD_SPI_HS_PRESCALER, SD_CMD9, hs_csd)) {
+#if (SD_CARD_INFO == 1)
+        info_csd = hs_csd;
+#endif
+    }
+    timing->regs_us += SD_InitLapUs(&phase);
+#endif
+#if (SD_CARD_INFO == 1)
+    SD_IdentifyCard(sd_handle, info_cid, info_csd);
+    timing->regs_us += SD_InitLapUs(&phase);
+#endif
+
+    timing->total_us = SD_InitLapUs(&init_clock);
+    sd_handle->initialized = true;
+    return SD_OK;
+}
+
+SD_Status SD_SPI_Init(SD_Handle_t *sd_handle) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+
+    if (!SD_IsCardPresent(sd_handle)) {
+        sd_handle->initialized = false;
+        return SD_RecordStatus(sd_handle, SD_NO_MEDIA);
+    }
+
+    sd_handle->stats.init_attempts++;
+
+    SD_Status lock_status = SD_Lock(sd_handle);
+    if (lock_status != SD_OK) {
+        return SD_RecordStatus(sd_handle, lock_status);
+    }
+
+    SD_Status status = SD_SPI_InitLocked(sd_handle);
+    SD_Unlock(sd_handle);
+    return SD_RecordStatus(sd_handle, status);
+}
+
+/*
+ * Bus lock held: drop what the driver knew about the card that was in the
+ * socket. Identification sets most of it again; what it only sets on success
+ * or on some paths must not survive from the old card. Card info and the init
+ * cache stay, so the same card re-inserted takes the short path.
+ */
+static void SD_ForgetCard(SD_Handle_t *sd_handle) {
+    sd_handle->initialized = false;
+    sd_handle->is_sdhc = false;
+    sd_handle->acmd23_ok = false;
+    sd_handle->crc_on = false;
+    sd_handle->capacity_blocks = 0;
+    sd_handle->erase_sector = 0;
+    sd_handle->erase_block = 0;
+    sd_handle->block_size = SD_BLOCK_SIZE;
+    sd_handle->dma_tx_done = false;
+    sd_handle->dma_rx_done = false;
+    sd_handle->dma_error = false;
+    sd_handle->dcache_lo = NULL;
+    sd_handle->dcache_hi = NULL;
+#if defined(USE_FREERTOS) && (SD_DMA_NOTIFY == 0)
+    /* A transfer cut off by the removal may have left a completion behind. */
+    (void)xSemaphoreTake(sd_handle->dma_tx_sem, 0);
+    (void)xSemaphoreTake(sd_handle->dma_rx_sem, 0);
+#endif
+#if (SD_TOKEN_POLL_BURST > 1U)
+    sd_handle->rx_carry_len = 0;
+#endif
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+    memset(sd_handle->adapt, 0, sizeof(sd_handle->adapt));
+#endif
+#if (SD_HIGH_SPEED == 1)
+    memset(sd_handle->switch_support, 0, sizeof(sd_handle->switch_support));
+    sd_handle->high_speed = false;
+#endif
+#if (SD_SPLIT_BUSY == 1)
+    sd_handle->busy_pending = false;
+#endif
+}
+
+SD_Status SD_Reattach(SD_Handle_t *sd_handle) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (SD_InstanceSlot(sd_handle) < 0) {
+        return SD_ERROR; /* never set up by SD_Init, or released by SD_DeInit */
+    }
+
+    if (!SD_IsCardPresent(sd_handle)) {
+        sd_handle->initialized = false;
+        return SD_RecordStatus(sd_handle, SD_NO_MEDIA);
+    }
+
+    sd_handle->stats.init_attempts++;
+
+    SD_Status lock_status = SD_Lock(sd_handle);
+    if (lock_status != SD_OK) {
+        return SD_RecordStatus(sd_handle, lock_status);
+    }
+
+    SD_ForgetCard(sd_handle);
+    SD_Status status = SD_SPI_InitLocked(sd_handle);
+    SD_Unlock(sd_handle);
+    return SD_RecordStatus(sd_handle, status);
+}
+
+#if (SD_RECOVERY == 1)
+/* CMD13 status as R1 << 8 | R2; SD_STATUS_SILENT if the card does not answer. */
+static uint16_t SD_ReadCardStatus(SD_Handle_t *sd_handle) {
+    uint8_t r1 = 0xFFU;
+    uint8_t r2 = 0xFFU;
+    if (SD_SendCommand(sd_handle, SD_CMD13, 0, 0xFFU, &r1) != SD_OK ||
+        SD_ReceiveByte(sd_handle, &r2) != SD_OK) {
+        return SD_STATUS_SILENT;
+    }
+    return (uint16_t)(((uint16_t)r1 << 8) | r2);
+}
+
+/*
+ * Bring the card back to a state a retry can use after a failed transfer;
+ * bus lock held. The cheap steps come first, so a glitch costs two commands
+ * and only a wedged card pays for re-identification.
+ */
+static SD_RecoverStep SD_Recover(SD_Handle_t *sd_handle, SD_Status cause) {
+    uint32_t start = HAL_GetTick();
+    uint8_t response = 0xFFU;
+
+    SD_Select(sd_handle);
+    (void)SD_SendCommand(sd_handle, SD_CMD12, 0, 0xFFU, &response);
+    uint16_t card = SD_ReadCardStatus(sd_handle);
+    if (card != SD_STATUS_SILENT && (card & SD_R2_WEDGED) != 0U) {
+        card = SD_ReadCardStatus(sd_handle);
+    }
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
+    SD_RecoverStep step;
+    if (card != SD_STATUS_SILENT && (card & ((SD_R1_IDLE << 8) | SD_R2_WEDGED)) == 0U) {
+        step = SD_RECOVER_STATUS;
+        uint32_t slower = SD_SlowerPrescaler(sd_handle->bus_prescaler);
+        if (cause == SD_CRC_ERROR && sd_handle->bus_prescaler < SD_SPI_INIT_PRESCALER &&
+            SD_ApplyBusPrescaler(sd_handle, slower) == SD_OK) {
+            step = SD_RECOVER_DOWNCLOCK;
+        }
+    } else {
+        sd_handle->stats.init_attempts++;
+        step = (SD_SPI_InitLocked(sd_handle) == SD_OK) ? SD_RECOVER_REINIT : SD_RECOVER_FAILED;
+    }
+
+    uint32_t elapsed = HAL_GetTick() - start;
+    sd_handle->stats.recoveries[step]++;
+    sd_handle->stats.recovery_ms += elapsed;
+    if (elapsed > sd_handle->stats.recovery_max_ms) {
+        sd_handle->stats.recovery_max_ms = elapsed;
+    }
+    sd_handle->stats.last_card_status = card;
+    return step;
+}
+#endif
+
+static SD_Status SD_ReadBlocksChecked(SD_Handle_t *sd_handle, uint8_t *buff, uint8_t *const *blocks,
+                                      uint32_t sector, uint32_t count, const uint32_t *deadline) {
+    if (!SD_IsCardPresent(sd_handle)) {
+        sd_handle->initialized = false;
+        return SD_RecordStatus(sd_handle, SD_NO_MEDIA);
+    }
+
+    SD_Status lock_status = SD_DeadlineGate(sd_handle, deadline);
+    if (lock_status != SD_OK) {
+        return SD_RecordStatus(sd_handle, lock_status);
+    }
 
-        status = SD_WaitReady(sd_handle, SD_WRITE_BUSY_TIMEOUT_MS);
-        if (status != SD_OK) {
-            break;
-        }
-        buff += SD_BLOCK_SIZE;
+    if (!sd_handle->initialized) {
+        SD_Unlock(sd_handle);
+        return SD_RecordStatus(sd_handle, SD_ERROR);
     }
 
-    (void)SD_TransmitByte(sd_handle, SD_TOKEN_STOP_TRAN);
-    (void)SD_WaitReady(sd_handle, SD_WRITE_BUSY_TIMEOUT_MS);
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+    if (sd_handle->capacity_blocks > 0 &&
+        (count > sd_handle->capacity_blocks || sector > sd_handle->capacity_blocks - count)) {
+        SD_Unlock(sd_handle);
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
 
-    return status;
-}
+    uint32_t address = SD_CardAddress(sd_handle, sector);
+    SD_Status status = SD_OK;
+    bool single = (count == 1U);
+#if (SD_READ_SESSION == 1)
+    /* A block that follows on from the last read goes through a session like a run would. */
+    single = single && sector != sd_handle->session_next;
+#endif
 
-/* DMA callbacks */
-void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
-    if (s_dma_owner && s_dma_owner->hspi == hspi) {
-        s_dma_owner->dma_tx_done = true;
-#if defined(USE_FREERTOS)
-        if (s_dma_owner->dma_tx_sem) {
-            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            xSemaphoreGiveFromISR(s_dma_owner->dma_tx_sem, &xHigherPriorityTaskWoken);
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    if (single) {
+        for (uint32_t attempt = 0; attempt <= SD_MAX_RETRIES; attempt++) {
+            uint32_t start = SD_LatencyStart();
+            SD_EnergyBegin(sd_handle);
+            status = SD_ReadSingleBlockInternal(sd_handle, SD_RxBlockAt(buff, blocks, 0), address);
+            SD_EnergyRecord(sd_handle, SD_LAT_CMD17, (status == SD_OK) ? 1U : 0U);
+            SD_LatencyRecord(sd_handle, SD_LAT_CMD17, start);
+            if (status == SD_OK || attempt == SD_MAX_RETRIES ||
+                (deadline && SD_DeadlineLeft(*deadline) == 0U)) {
+                break;
+            }
+#if (SD_RECOVERY == 1)
+            if (SD_Recover(sd_handle, status) == SD_RECOVER_FAILED) {
+                break;
+            }
+#endif
+            SD_Status relock = SD_RetryBackoff(sd_handle, SD_DeadlineLockMs(deadline),
+                                               SD_RetryDelayMs(attempt, deadline));
+            if (relock != SD_OK) {
+                SD_DeadlineRecord(sd_handle, deadline, true);
+                if (relock == SD_BUSY && deadline) {
+                    relock = SD_TIMEOUT;
+                }
+                return SD_RecordStatus(sd_handle, relock);
+            }
         }
+    } else {
+        uint32_t next = 0;
+        for (uint32_t attempt = 0; attempt <= SD_MAX_RETRIES; attempt++) {
+            uint32_t done = 0;
+            uint8_t *rest = buff ? SD_RxBlockAt(buff, NULL, next) : NULL;
+            uint32_t start = SD_LatencyStart();
+            SD_EnergyBegin(sd_handle);
+            status = SD_ReadMultiBlocksInternal(sd_handle, rest, blocks ? blocks + next : NULL,
+                                                sector + next, count - next, &done);
+            SD_EnergyRecord(sd_handle, SD_LAT_CMD18, done);
+            SD_LatencyRecord(sd_handle, SD_LAT_CMD18, start);
+            next += done;
+            if (status == SD_OK || attempt == SD_MAX_RETRIES ||
+                (deadline && SD_DeadlineLeft(*deadline) == 0U)) {
+                break;
+            }
+#if (SD_RECOVERY == 1)
+            if (SD_Recover(sd_handle, status) == SD_RECOVER_FAILED) {
+                break;
+            }
 #endif
+            if (next > 0U) {
+                sd_handle->stats.resumes++;
+                sd_handle->stats.resumed_bytes += (uint64_t)done * SD_BLOCK_SIZE;
+            }
+            SD_Status relock = SD_RetryBackoff(sd_handle, SD_DeadlineLockMs(deadline),
+                                               SD_RetryDelayMs(attempt, deadline));
+            if (relock != SD_OK) {
+                SD_DeadlineRecord(sd_handle, deadline, true);
+                if (relock == SD_BUSY && deadline) {
+                    relock = SD_TIMEOUT;
+                }
+                return SD_RecordStatus(sd_handle, relock);
+            }
+        }
     }
-}
 
-void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
-    if (s_dma_owner && s_dma_owner->hspi == hspi) {
-        s_dma_owner->dma_rx_done = true;
-#if defined(USE_FREERTOS)
-        if (s_dma_owner->dma_rx_sem) {
-            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            xSemaphoreGiveFromISR(s_dma_owner->dma_rx_sem, &xHigherPriorityTaskWoken);
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-        }
+    if (status == SD_OK) {
+        sd_handle->stats.read_ops++;
+        sd_handle->stats.read_blocks += count;
+        sd_handle->stats.read_bytes += (uint64_t)count * SD_BLOCK_SIZE;
+#if (SD_READ_SESSION == 1)
+        sd_handle->session_next = sector + count;
 #endif
     }
-}
+    SD_DeadlineRecord(sd_handle, deadline, false);
 
-void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
-    HAL_SPI_RxCpltCallback(hspi);
+    SD_Unlock(sd_handle);
+    return SD_RecordStatus(sd_handle, status);
 }
 
-void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
-    if (s_dma_owner && s_dma_owner->hspi == hspi) {
-        s_dma_owner->dma_error = true;
-        s_dma_owner->dma_tx_done = true;
-        s_dma_owner->dma_rx_done = true;
-#if defined(USE_FREERTOS)
-        if (s_dma_owner->dma_tx_sem) {
-            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            xSemaphoreGiveFromISR(s_dma_owner->dma_tx_sem, &xHigherPriorityTaskWoken);
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-        }
-        if (s_dma_owner->dma_rx_sem) {
-            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            xSemaphoreGiveFromISR(s_dma_owner->dma_rx_sem, &xHigherPriorityTaskWoken);
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-        }
-#endif
+SD_Status SD_ReadBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!buff || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
     }
+    return SD_ReadBlocksChecked(sd_handle, buff, NULL, sector, count, NULL);
 }
 
-SD_Status SD_Init(SD_Handle_t *sd_handle, SPI_HandleTypeDef *hspi,
-                  GPIO_TypeDef *cs_port, uint16_t cs_pin, bool use_dma) {
-    if (!sd_handle || !hspi || !cs_port) {
+SD_Status SD_ReadBlocksScatter(SD_Handle_t *sd_handle, uint8_t *const *blocks, uint32_t sector,
+                               uint32_t count) {
+    if (!sd_handle) {
         return SD_PARAM;
     }
-
-    memset(sd_handle, 0, sizeof(SD_Handle_t));
-    sd_handle->hspi = hspi;
-    sd_handle->cs_port = cs_port;
-    sd_handle->cs_pin = cs_pin;
-    sd_handle->use_dma = use_dma;
-    sd_handle->initialized = false;
-    sd_handle->is_sdhc = false;
-    sd_handle->block_size = SD_BLOCK_SIZE;
-    sd_handle->last_status = SD_OK;
-
-#if defined(USE_FREERTOS)
-#if (configSUPPORT_STATIC_ALLOCATION == 1)
-    if (s_static_alloc_used) {
-        return SD_ERROR;
+    if (!blocks || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
     }
-    s_static_alloc_used = true;
-    sd_handle->mutex = xSemaphoreCreateMutexStatic(&sd_mutex_buffer);
-    sd_handle->dma_tx_sem = xSemaphoreCreateBinaryStatic(&sd_dma_tx_buffer);
-    sd_handle->dma_rx_sem = xSemaphoreCreateBinaryStatic(&sd_dma_rx_buffer);
-#else
-    sd_handle->mutex = xSemaphoreCreateMutex();
-    sd_handle->dma_tx_sem = xSemaphoreCreateBinary();
-    sd_handle->dma_rx_sem = xSemaphoreCreateBinary();
-#endif
-    if (sd_handle->mutex == NULL || sd_handle->dma_tx_sem == NULL || sd_handle->dma_rx_sem == NULL) {
-        return SD_RecordStatus(sd_handle, SD_ERROR);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!blocks[i]) {
+            return SD_RecordStatus(sd_handle, SD_PARAM);
+        }
     }
-    (void)xSemaphoreTake(sd_handle->dma_tx_sem, 0);
-    (void)xSemaphoreTake(sd_handle->dma_rx_sem, 0);
-#endif
-
-    s_dma_owner = sd_handle;
-    return SD_OK;
+    return SD_ReadBlocksChecked(sd_handle, NULL, blocks, sector, count, NULL);
 }
 
-void SD_DeInit(SD_Handle_t *sd_handle) {
-    if (!sd_handle) {
-        return;
-    }
-
-#if defined(USE_FREERTOS)
-    if (sd_handle->mutex) {
-        vSemaphoreDelete(sd_handle->mutex);
-        sd_handle->mutex = NULL;
-    }
-    if (sd_handle->dma_tx_sem) {
-        vSemaphoreDelete(sd_handle->dma_tx_sem);
-        sd_handle->dma_tx_sem = NULL;
+/* Blocks in an iovec, or 0 if a segment is NULL, empty or not whole blocks. */
+static uint32_t SD_IoVecBlocks(const SD_IoVec *iov, uint32_t iovcnt) {
+    uint64_t total = 0;
+    if (!iov) {
+        return 0U;
     }
-    if (sd_handle->dma_rx_sem) {
-        vSemaphoreDelete(sd_handle->dma_rx_sem);
-        sd_handle->dma_rx_sem = NULL;
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        if (!iov[i].base || iov[i].len == 0U || (iov[i].len % SD_BLOCK_SIZE) != 0U) {
+            return 0U;
+        }
+        total += iov[i].len / SD_BLOCK_SIZE;
     }
-#if (configSUPPORT_STATIC_ALLOCATION == 1)
-    s_static_alloc_used = false;
-#endif
-#endif
+    return (total > UINT32_MAX) ? 0U : (uint32_t)total;
+}
 
-    sd_handle->initialized = false;
-    if (s_dma_owner == sd_handle) {
-        s_dma_owner = NULL;
+/* Next block of an iovec walk at segment *seg, byte *off; advances both. */
+static uint8_t *SD_IoVecNext(const SD_IoVec *iov, uint32_t *seg, uint32_t *off) {
+    uint8_t *block = (uint8_t *)iov[*seg].base + *off;
+    *off += SD_BLOCK_SIZE;
+    if (*off == iov[*seg].len) {
+        (*seg)++;
+        *off = 0;
     }
+    return block;
 }
 
-SD_Status SD_SetCardDetect(SD_Handle_t *sd_handle, GPIO_TypeDef *cd_port, uint16_t cd_pin, bool active_low) {
-    if (!sd_handle || !cd_port) {
+SD_Status SD_ReadBlocksV(SD_Handle_t *sd_handle, const SD_IoVec *iov, uint32_t iovcnt,
+                         uint32_t sector) {
+    uint8_t *blocks[SD_IOV_MAX_BLOCKS];
+    if (!sd_handle) {
         return SD_PARAM;
     }
-    sd_handle->cd_port = cd_port;
-    sd_handle->cd_pin = cd_pin;
-    sd_handle->cd_active_low = active_low;
-    sd_handle->has_cd = true;
-    return SD_OK;
+    uint32_t count = SD_IoVecBlocks(iov, iovcnt);
+    if (count == 0U) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
+    uint32_t seg = 0;
+    uint32_t off = 0;
+    SD_Status status = SD_OK;
+    while (count > 0U && status == SD_OK) {
+        uint32_t n = (count < SD_IOV_MAX_BLOCKS) ? count : SD_IOV_MAX_BLOCKS;
+        for (uint32_t i = 0; i < n; i++) {
+            blocks[i] = SD_IoVecNext(iov, &seg, &off);
+        }
+        status = SD_ReadBlocksChecked(sd_handle, NULL, blocks, sector, n, NULL);
+        sector += n;
+        count -= n;
+    }
+    return status;
 }
 
-bool SD_IsCardPresent(SD_Handle_t *sd_handle) {
+SD_Status SD_ReadBlocksDeadline(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector,
+                                uint32_t count, uint32_t deadline) {
     if (!sd_handle) {
-        return false;
+        return SD_PARAM;
     }
-    if (!sd_handle->has_cd) {
-        return true;
+    if (!buff || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
     }
-    GPIO_PinState state = HAL_GPIO_ReadPin(sd_handle->cd_port, sd_handle->cd_pin);
-    return sd_handle->cd_active_low ? (state == GPIO_PIN_RESET) : (state == GPIO_PIN_SET);
+    return SD_ReadBlocksChecked(sd_handle, buff, NULL, sector, count, &deadline);
 }
 
-SD_Status SD_SPI_Init(SD_Handle_t *sd_handle) {
+SD_Status SD_ReadMultiBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count) {
     if (!sd_handle) {
         return SD_PARAM;
     }
-
+    if (!buff || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
     if (!SD_IsCardPresent(sd_handle)) {
         sd_handle->initialized = false;
         return SD_RecordStatus(sd_handle, SD_NO_MEDIA);
     }
 
-    sd_handle->stats.init_attempts++;
-
     SD_Status lock_status = SD_Lock(sd_handle);
     if (lock_status != SD_OK) {
         return SD_RecordStatus(sd_handle, lock_status);
     }
 
-    if (!s_dummy_init) {
-        memset(s_dummy_tx, 0xFF, sizeof(s_dummy_tx));
-        s_dummy_init = 1;
+    if (!sd_handle->initialized) {
+        SD_Unlock(sd_handle);
+        return SD_RecordStatus(sd_handle, SD_ERROR);
     }
 
-    sd_handle->initialized = false;
-
-    SD_Deselect(sd_handle);
-    for (uint8_t i = 0; i < 10; i++) {
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
+    uint32_t start = SD_LatencyStart();
+    uint32_t done = 0;
+    SD_EnergyBegin(sd_handle);
+    SD_Status status = SD_ReadMultiBlocksInternal(sd_handle, buff, NULL, sector, count, &done);
+    SD_EnergyRecord(sd_handle, SD_LAT_CMD18, done);
+    SD_LatencyRecord(sd_handle, SD_LAT_CMD18, start);
+    if (status == SD_OK) {
+        sd_handle->stats.read_ops++;
+        sd_handle->stats.read_blocks += count;
+        sd_handle->stats.read_bytes += (uint64_t)count * SD_BLOCK_SIZE;
     }
+    SD_Unlock(sd_handle);
+    return SD_RecordStatus(sd_handle, status);
+}
 
-    SD_Status status = SD_ERROR;
-    uint8_t response = 0xFFU;
-    uint8_t r7[4] = {0};
-    uint32_t init_start = HAL_GetTick();
+static SD_Status SD_WriteBlocksChecked(SD_Handle_t *sd_handle, const uint8_t *buff,
+                                       const uint8_t *const *blocks, uint32_t sector,
+                                       uint32_t count, const uint32_t *deadline) {
+    if (!SD_IsCardPresent(sd_handle)) {
+        sd_handle->initialized = false;
+        return SD_RecordStatus(sd_handle, SD_NO_MEDIA);
+    }
 
-    do {
-        SD_Select(sd_handle);
-        status = SD_SendCommand(sd_handle, SD_CMD0, 0, 0x95U, &response);
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        if (status == SD_OK && response == 0x01U) {
-            break;
-        }
-        SD_BackoffDelay();
-    } while ((HAL_GetTick() - init_start) < SD_INIT_TIMEOUT_MS);
+    SD_Status lock_status = SD_DeadlineGate(sd_handle, deadline);
+    if (lock_status != SD_OK) {
+        return SD_RecordStatus(sd_handle, lock_status);
+    }
 
-    if (response != 0x01U) {
+    if (!sd_handle->initialized) {
         SD_Unlock(sd_handle);
         return SD_RecordStatus(sd_handle, SD_ERROR);
     }
 
-    SD_Select(sd_handle);
-    status = SD_SendCommand(sd_handle, SD_CMD8, 0x000001AAU, 0x87U, &response);
-    if (status == SD_OK) {
-        for (uint8_t i = 0; i < 4; i++) {
-            (void)SD_ReceiveByte(sd_handle, &r7[i]);
-        }
+    if (sd_handle->capacity_blocks > 0 &&
+        (count > sd_handle->capacity_blocks || sector > sd_handle->capacity_blocks - count)) {
+        SD_Unlock(sd_handle);
+        return SD_RecordStatus(sd_handle, SD_PARAM);
     }
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
 
-    bool sdv2 = (status == SD_OK && response == 0x01U && r7[2] == 0x01U && r7[3] == 0xAAU);
+    uint32_t address = SD_CardAddress(sd_handle, sector);
+    SD_Status status = SD_OK;
+    bool single = (count == 1U);
+#if (SD_WRITE_SESSION == 1)
+    /* A block that follows on from the last write goes through a session like a run would. */
+    single = single && sector != sd_handle->session_next;
+#endif
 
-    init_start = HAL_GetTick();
-    do {
-        SD_Select(sd_handle);
-        (void)SD_SendCommand(sd_handle, SD_CMD55, 0, 0xFFU, &response);
-        status = SD_SendCommand(sd_handle, SD_ACMD41, sdv2 ? 0x40000000U : 0, 0xFFU, &response);
-        SD_Deselect(sd_handle);
-        (void)SD_TransmitByte(sd_handle, 0xFFU);
-        if (status == SD_OK && response == 0x00U) {
-            break;
+    if (single) {
+        for (uint32_t attempt = 0; attempt <= SD_MAX_RETRIES; attempt++) {
+            uint32_t start = SD_LatencyStart();
+            SD_EnergyBegin(sd_handle);
+            status = SD_WriteSingleBlockInternal(sd_handle, SD_BlockAt(buff, blocks, 0), address);
+            SD_EnergyRecord(sd_handle, SD_LAT_CMD24, (status == SD_OK) ? 1U : 0U);
+            SD_LatencyRecord(sd_handle, SD_LAT_CMD24, start);
+            if (status == SD_OK || attempt == SD_MAX_RETRIES ||
+                (deadline && SD_DeadlineLeft(*deadline) == 0U)) {
+                break;
+            }
+#if (SD_RECOVERY == 1)
+            if (SD_Recover(sd_handle, status) == SD_RECOVER_FAILED) {
+                break;
+            }
+#endif
+            SD_Status relock = SD_RetryBackoff(sd_handle, SD_DeadlineLockMs(deadline),
+                                               SD_RetryDelayMs(attempt, deadline));
+            if (relock != SD_OK) {
+                SD_DeadlineRecord(sd_handle, deadline, true);
+                if (relock == SD_BUSY && deadline) {
+                    relock = SD_TIMEOUT;
+                }
+                return SD_RecordStatus(sd_handle, relock);
+            }
         }
-        SD_BackoffDelay();
-    } while ((HAL_GetTick() - init_start) < SD_INIT_TIMEOUT_MS);
+    } else {
+        uint32_t next = 0;
+        for (uint32_t attempt = 0; attempt <= SD_MAX_RETRIES; attempt++) {
+            uint32_t done = 0;
+            const uint8_t *rest = buff ? SD_BlockAt(buff, NULL, next) : NULL;
+            uint32_t start = SD_LatencyStart();
+            SD_EnergyBegin(sd_handle);
+            status = SD_WriteMultiBlocksInternal(sd_handle, rest, blocks ? blocks + next : NULL,
+                                                 sector + next, count - next, &done);
+            SD_EnergyRecord(sd_handle, SD_LAT_CMD25, done);
+            SD_LatencyRecord(sd_handle, SD_LAT_CMD25, start);
+            next += done;
+            if (status == SD_OK || attempt == SD_MAX_RETRIES ||
+                (deadline && SD_DeadlineLeft(*deadline) == 0U)) {
+                break;
+            }
+#if (SD_RECOVERY == 1)
+            if (SD_Recover(sd_handle, status) == SD_RECOVER_FAILED) {
+                break;
+            }
+#endif
+            if (next > 0U) {
+                sd_handle->stats.resumes++;
+                sd_handle->stats.resumed_bytes += (uint64_t)done * SD_BLOCK_SIZE;
+            }
+            SD_Status relock = SD_RetryBackoff(sd_handle, SD_DeadlineLockMs(deadline),
+                                               SD_RetryDelayMs(attempt, deadline));
+            if (relock != SD_OK) {
+                SD_DeadlineRecord(sd_handle, deadline, true);
+                if (relock == SD_BUSY && deadline) {
+                    relock = SD_TIMEOUT;
+                }
+                return SD_RecordStatus(sd_handle, relock);
+            }
+        }
+    }
 
-    if (response != 0x00U) {
-        SD_Unlock(sd_handle);
-        return SD_RecordStatus(sd_handle, SD_TIMEOUT);
+    if (status == SD_OK) {
+        sd_handle->stats.write_ops++;
+        sd_handle->stats.write_blocks += count;
+        sd_handle->stats.write_bytes += (uint64_t)count * SD_BLOCK_SIZE;
+#if (SD_WRITE_SESSION == 1)
+        sd_handle->session_next = sector + count;
+#endif
     }
+    SD_DeadlineRecord(sd_handle, deadline, false);
 
-    sd_handle->is_sdhc = false;
-    SD_Select(sd_handle);
-    status = SD_SendCommand(sd_handle, SD_CMD58, 0, 0xFFU, &response);
-    if (status == SD_OK && response == 0x00U) {
-        uint8_t ocr[4] = {0};
-        for (uint8_t i = 0; i < 4; i++) {
-            (void)SD_ReceiveByte(sd_handle, &ocr[i]);
-        }
-        if (ocr[0] & 0x40U) {
-            sd_handle->is_sdhc = true;
+    SD_Unlock(sd_handle);
+    return SD_RecordStatus(sd_handle, status);
+}
+
+SD_Status SD_WriteBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!buff || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
+    return SD_WriteBlocksChecked(sd_handle, buff, NULL, sector, count, NULL);
+}
+
+SD_Status SD_WriteBlocksGather(SD_Handle_t *sd_handle, const uint8_t *const *blocks, uint32_t sector,
+                               uint32_t count) {
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!blocks || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!blocks[i]) {
+            return SD_RecordStatus(sd_handle, SD_PARAM);
         }
     }
-    SD_Deselect(sd_handle);
-    (void)SD_TransmitByte(sd_handle, 0xFFU);
+    return SD_WriteBlocksChecked(sd_handle, NULL, blocks, sector, count, NULL);
+}
 
-    if (!sd_handle->is_sdhc) {
-        status = SD_SetBlockLength(sd_handle);
-        if (status != SD_OK) {
-            SD_Unlock(sd_handle);
-            return SD_RecordStatus(sd_handle, status);
+SD_Status SD_WriteBlocksV(SD_Handle_t *sd_handle, const SD_IoVec *iov, uint32_t iovcnt,
+                          uint32_t sector) {
+    const uint8_t *blocks[SD_IOV_MAX_BLOCKS];
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    uint32_t count = SD_IoVecBlocks(iov, iovcnt);
+    if (count == 0U) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
+    uint32_t seg = 0;
+    uint32_t off = 0;
+    SD_Status status = SD_OK;
+    while (count > 0U && status == SD_OK) {
+        uint32_t n = (count < SD_IOV_MAX_BLOCKS) ? count : SD_IOV_MAX_BLOCKS;
+        for (uint32_t i = 0; i < n; i++) {
+            blocks[i] = SD_IoVecNext(iov, &seg, &off);
         }
+        status = SD_WriteBlocksChecked(sd_handle, NULL, blocks, sector, n, NULL);
+        sector += n;
+        count -= n;
     }
+    return status;
+}
 
-    uint8_t csd[16];
-    if (SD_ReadCSD(sd_handle, csd) == SD_OK) {
-        SD_ParseCSD(sd_handle, csd);
-    } else {
-        sd_handle->capacity_blocks = 0;
+SD_Status SD_WriteBlocksDeadline(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector,
+                                 uint32_t count, uint32_t deadline) {
+    if (!sd_handle) {
+        return SD_PARAM;
     }
-
-    sd_handle->initialized = true;
-    SD_Unlock(sd_handle);
-    return SD_RecordStatus(sd_handle, SD_OK);
+    if (!buff || count == 0) {
+        return SD_RecordStatus(sd_handle, SD_PARAM);
+    }
+    return SD_WriteBlocksChecked(sd_handle, buff, NULL, sector, count, &deadline);
 }
 
-SD_Status SD_ReadBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count) {
+SD_Status SD_WriteMultiBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count) {
     if (!sd_handle) {
         return SD_PARAM;
     }
@@ -832,46 +4273,161 @@ SD_Status SD_ReadBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector,
         return SD_RecordStatus(sd_handle, lock_status);
     }
 
-    if (!sd_handle->initialized) {
-        SD_Unlock(sd_handle);
-        return SD_RecordStatus(sd_handle, SD_ERROR);
+    uint32_t start = SD_LatencyStart();
+    uint32_t done = 0;
+    SD_EnergyBegin(sd_handle);
+    SD_Status status = SD_WriteMultiBlocksInternal(sd_handle, buff, NULL, sector, count, &done);
+    SD_EnergyRecord(sd_handle, SD_LAT_CMD25, done);
+    SD_LatencyRecord(sd_handle, SD_LAT_CMD25, start);
+    if (status == SD_OK) {
+        sd_handle->stats.write_ops++;
+        sd_handle->stats.write_blocks += count;
+        sd_handle->stats.write_bytes += (uint64_t)count * SD_BLOCK_SIZE;
     }
+    SD_Unlock(sd_handle);
+    return SD_RecordStatus(sd_handle, status);
+}
 
-    if (sd_handle->capacity_blocks > 0 &&
-        (count > sd_handle->capacity_blocks || sector > sd_handle->capacity_blocks - count)) {
-        SD_Unlock(sd_handle);
-        return SD_RecordStatus(sd_handle, SD_PARAM);
+bool SD_IsSDHC(SD_Handle_t *sd_handle) {
+    return sd_handle ? sd_handle->is_sdhc : false;
+}
+
+bool SD_IsHighSpeed(SD_Handle_t *sd_handle) {
+#if (SD_HIGH_SPEED == 1)
+    return sd_handle ? sd_handle->high_speed : false;
+#else
+    (void)sd_handle;
+    return false;
+#endif
+}
+
+bool SD_IsInitialized(SD_Handle_t *sd_handle) {
+    return sd_handle ? sd_handle->initialized : false;
+}
+
+void SD_GetInitTiming(SD_Handle_t *sd_handle, SD_InitTiming *out) {
+    if (!out) {
+        return;
+    }
+    if (!sd_handle) {
+        memset(out, 0, sizeof(*out));
+        return;
     }
+    *out = sd_handle->init_timing;
+}
 
-    uint32_t address = sd_handle->is_sdhc ? sector : (sector * SD_BLOCK_SIZE);
-    SD_Status status = SD_OK;
+bool SD_GetInitCache(SD_Handle_t *sd_handle, SD_InitCache *out) {
+#if (SD_INIT_CACHE == 1)
+    if (!sd_handle || !out) {
+        return false;
+    }
+    *out = sd_handle->init_cache;
+    return out->valid;
+#else
+    (void)sd_handle;
+    if (out) {
+        memset(out, 0, sizeof(*out));
+    }
+    return false;
+#endif
+}
 
-    if (count == 1U) {
-        for (uint32_t attempt = 0; attempt <= SD_MAX_RETRIES; attempt++) {
-            status = SD_ReadSingleBlockInternal(sd_handle, buff, address);
-            if (status == SD_OK) {
-                break;
+SD_Status SD_SetInitCache(SD_Handle_t *sd_handle, const SD_InitCache *cache) {
+#if (SD_INIT_CACHE == 1)
+    if (!sd_handle || !cache || !cache->valid || !SD_CIDValid(cache->cid) ||
+        !SD_CSDValid(cache->csd)) {
+        return SD_PARAM;
+    }
+    sd_handle->init_cache = *cache;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)cache;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+void SD_GetDataTimeouts(SD_Handle_t *sd_handle, uint32_t *read_ms, uint32_t *write_ms) {
+    uint32_t limits[2] = {SD_DATA_TOKEN_TIMEOUT_MS, SD_WRITE_BUSY_TIMEOUT_MS};
+    if (sd_handle) {
+        limits[0] = SD_ReadTimeoutMs(sd_handle);
+        limits[1] = SD_WriteTimeoutMs(sd_handle);
+#if (SD_ADAPTIVE_TIMEOUTS == 1)
+        for (uint32_t i = 0; i < 2U; i++) {
+            uint32_t learned = sd_handle->adapt[i].timeout_ms;
+            if (learned != 0U && learned < limits[i]) {
+                limits[i] = learned;
             }
-            SD_BackoffDelay();
         }
-    } else {
-        status = SD_ReadMultiBlocksInternal(sd_handle, buff, sector, count);
+#endif
+    }
+    if (read_ms) {
+        *read_ms = limits[0];
+    }
+    if (write_ms) {
+        *write_ms = limits[1];
     }
+}
 
-    if (status == SD_OK) {
-        sd_handle->stats.read_ops++;
-        sd_handle->stats.read_blocks += count;
+SD_Status SD_GetCardInfo(SD_Handle_t *sd_handle, SD_CardInfo *out) {
+#if (SD_CARD_INFO == 1)
+    if (!sd_handle || !out) {
+        return SD_PARAM;
+    }
+    if (!sd_handle->initialized) {
+        return SD_ERROR;
     }
+    *out = sd_handle->card_info;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    if (out) {
+        memset(out, 0, sizeof(*out));
+    }
+    return SD_UNSUPPORTED;
+#endif
+}
+
+uint32_t SD_GetBusPrescaler(SD_Handle_t *sd_handle) {
+    return sd_handle ? sd_handle->bus_prescaler : SD_SPI_INIT_PRESCALER;
+}
 
+SD_Status SD_SetBusPrescaler(SD_Handle_t *sd_handle, uint32_t prescaler) {
+    bool valid = false;
+    for (uint32_t p = SD_SPI_FAST_PRESCALER; p <= SD_SPI_INIT_PRESCALER;
+         p = SD_SlowerPrescaler(p)) {
+        if (p == prescaler) {
+            valid = true;
+            break;
+        }
+        if (p == SD_SPI_INIT_PRESCALER) {
+            break;
+        }
+    }
+    if (!sd_handle || !valid) {
+        return SD_PARAM;
+    }
+    if (!sd_handle->initialized) {
+        return SD_ERROR;
+    }
+    SD_Status status = SD_Lock(sd_handle);
+    if (status != SD_OK) {
+        return status;
+    }
+    status = SD_ApplyBusPrescaler(sd_handle, prescaler);
     SD_Unlock(sd_handle);
-    return SD_RecordStatus(sd_handle, status);
+    return status;
 }
 
-SD_Status SD_ReadMultiBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sector, uint32_t count) {
+uint32_t SD_GetBlockCount(SD_Handle_t *sd_handle) {
+    return sd_handle ? sd_handle->capacity_blocks : 0U;
+}
+
+SD_Status SD_GetEraseBlockSize(SD_Handle_t *sd_handle, uint32_t *blocks) {
     if (!sd_handle) {
         return SD_PARAM;
     }
-    if (!buff || count == 0) {
+    if (!blocks) {
         return SD_RecordStatus(sd_handle, SD_PARAM);
     }
     if (!SD_IsCardPresent(sd_handle)) {
@@ -883,26 +4439,54 @@ SD_Status SD_ReadMultiBlocks(SD_Handle_t *sd_handle, uint8_t *buff, uint32_t sec
     if (lock_status != SD_OK) {
         return SD_RecordStatus(sd_handle, lock_status);
     }
-
     if (!sd_handle->initialized) {
         SD_Unlock(sd_handle);
         return SD_RecordStatus(sd_handle, SD_ERROR);
     }
 
-    SD_Status status = SD_ReadMultiBlocksInternal(sd_handle, buff, sector, count);
-    if (status == SD_OK) {
-        sd_handle->stats.read_ops++;
-        sd_handle->stats.read_blocks += count;
+    if (sd_handle->erase_block == 0U) {
+        uint32_t au = 0;
+        /* A card that rejects ACMD13 still has a usable CSD erase sector. */
+        (void)SD_ReadAllocationUnit(sd_handle, &au);
+        if (au == 0U) {
+            au = (sd_handle->erase_sector > 0U) ? sd_handle->erase_sector : 1U;
+        }
+        sd_handle->erase_block = au;
     }
+    *blocks = sd_handle->erase_block;
+
     SD_Unlock(sd_handle);
-    return SD_RecordStatus(sd_handle, status);
+    return SD_RecordStatus(sd_handle, SD_OK);
 }
 
-SD_Status SD_WriteBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count) {
+static SD_Status SD_EraseInternal(SD_Handle_t *sd_handle, uint32_t first, uint32_t last) {
+    uint8_t response = 0xFFU;
+    SD_Select(sd_handle);
+
+    SD_Status status = SD_SendCommand(sd_handle, SD_CMD32, first, 0xFFU, &response);
+    if (status == SD_OK && response == 0x00U) {
+        status = SD_SendCommand(sd_handle, SD_CMD33, last, 0xFFU, &response);
+    }
+    if (status == SD_OK && response == 0x00U) {
+        status = SD_SendCommand(sd_handle, SD_CMD38, 0, 0xFFU, &response);
+    }
+    if (status == SD_OK && response != 0x00U) {
+        status = SD_ERROR;
+    }
+    if (status == SD_OK) {
+        status = SD_WaitReady(sd_handle, SD_ERASE_TIMEOUT_MS);
+    }
+
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+    return status;
+}
+
+SD_Status SD_EraseBlocks(SD_Handle_t *sd_handle, uint32_t sector, uint32_t count) {
     if (!sd_handle) {
         return SD_PARAM;
     }
-    if (!buff || count == 0) {
+    if (count == 0) {
         return SD_RecordStatus(sd_handle, SD_PARAM);
     }
     if (!SD_IsCardPresent(sd_handle)) {
@@ -926,36 +4510,22 @@ SD_Status SD_WriteBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t s
         return SD_RecordStatus(sd_handle, SD_PARAM);
     }
 
-    uint32_t address = sd_handle->is_sdhc ? sector : (sector * SD_BLOCK_SIZE);
-    SD_Status status = SD_OK;
-
-    if (count == 1U) {
-        for (uint32_t attempt = 0; attempt <= SD_MAX_RETRIES; attempt++) {
-            status = SD_WriteSingleBlockInternal(sd_handle, buff, address);
-            if (status == SD_OK) {
-                break;
-            }
-            SD_BackoffDelay();
-        }
-    } else {
-        status = SD_WriteMultiBlocksInternal(sd_handle, buff, sector, count);
-    }
-
-    if (status == SD_OK) {
-        sd_handle->stats.write_ops++;
-        sd_handle->stats.write_blocks += count;
-    }
+    /* CMD32/CMD33 take the first and last block of the range, in bytes on SDSC. */
+    uint32_t last = sector + count - 1U;
+    uint32_t first_addr = SD_CardAddress(sd_handle, sector);
+    uint32_t last_addr = SD_CardAddress(sd_handle, last);
+    SD_Status status = SD_EraseInternal(sd_handle, first_addr, last_addr);
 
     SD_Unlock(sd_handle);
     return SD_RecordStatus(sd_handle, status);
 }
 
-SD_Status SD_WriteMultiBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint32_t sector, uint32_t count) {
+SD_Status SD_Sync(SD_Handle_t *sd_handle) {
     if (!sd_handle) {
         return SD_PARAM;
     }
-    if (!buff || count == 0) {
-        return SD_RecordStatus(sd_handle, SD_PARAM);
+    if (!sd_handle->initialized) {
+        return SD_RecordStatus(sd_handle, SD_ERROR);
     }
     if (!SD_IsCardPresent(sd_handle)) {
         sd_handle->initialized = false;
@@ -967,28 +4537,66 @@ SD_Status SD_WriteMultiBlocks(SD_Handle_t *sd_handle, const uint8_t *buff, uint3
         return SD_RecordStatus(sd_handle, lock_status);
     }
 
-    SD_Status status = SD_WriteMultiBlocksInternal(sd_handle, buff, sector, count);
-    if (status == SD_OK) {
-        sd_handle->stats.write_ops++;
-        sd_handle->stats.write_blocks += count;
-    }
+    SD_Select(sd_handle);
+#if SD_SESSIONS
+    SD_SessionStop(sd_handle); /* the busy wait below would clock a read stream */
+#endif
+#if (SD_SPLIT_BUSY == 1)
+    SD_Status status = sd_handle->busy_pending ? SD_WaitDeferredBusy(sd_handle)
+                                               : SD_WaitWriteBusy(sd_handle);
+#else
+    SD_Status status = SD_WaitWriteBusy(sd_handle);
+#endif
+    SD_Deselect(sd_handle);
+    (void)SD_TransmitByte(sd_handle, 0xFFU);
+
     SD_Unlock(sd_handle);
     return SD_RecordStatus(sd_handle, status);
 }
 
-bool SD_IsSDHC(SD_Handle_t *sd_handle) {
-    return sd_handle ? sd_handle->is_sdhc : false;
-}
+SD_Status SD_PollBusy(SD_Handle_t *sd_handle) {
+#if (SD_SPLIT_BUSY == 1)
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    if (!sd_handle->initialized || !sd_handle->busy_pending) {
+        return SD_OK;
+    }
 
-bool SD_IsInitialized(SD_Handle_t *sd_handle) {
-    return sd_handle ? sd_handle->initialized : false;
-}
+    SD_Status lock_status = SD_Lock(sd_handle);
+    if (lock_status != SD_OK) {
+        return SD_RecordStatus(sd_handle, lock_status);
+    }
 
-uint32_t SD_GetBlockCount(SD_Handle_t *sd_handle) {
-    return sd_handle ? sd_handle->capacity_blocks : 0U;
+    SD_Status status = SD_OK;
+    if (sd_handle->busy_pending) {
+        uint8_t level = 0x00U;
+        SD_Select(sd_handle);
+        if (SD_ReceiveByte(sd_handle, &level) != SD_OK) {
+            status = SD_ERROR;
+        } else if (level == 0xFFU) {
+            sd_handle->busy_pending = false;
+            SD_SET_READY(sd_handle, true);
+            sd_handle->stats.busy_deferred_idle++;
+        } else if ((HAL_GetTick() - sd_handle->busy_tick) >= SD_WriteTimeoutMs(sd_handle)) {
+            sd_handle->busy_pending = false;
+            status = SD_TIMEOUT;
+        } else {
+            status = SD_BUSY;
+        }
+        SD_Deselect(sd_handle);
+        (void)SD_TransmitByte(sd_handle, 0xFFU);
+    }
+
+    SD_Unlock(sd_handle);
+    return (status == SD_BUSY) ? SD_BUSY : SD_RecordStatus(sd_handle, status);
+#else
+    (void)sd_handle;
+    return SD_UNSUPPORTED;
+#endif
 }
 
-SD_Status SD_Sync(SD_Handle_t *sd_handle) {
+SD_Status SD_CheckStatus(SD_Handle_t *sd_handle) {
     if (!sd_handle) {
         return SD_PARAM;
     }
@@ -1005,10 +4613,19 @@ SD_Status SD_Sync(SD_Handle_t *sd_handle) {
         return SD_RecordStatus(sd_handle, lock_status);
     }
 
+    /* R2: R1 then the status byte; a card that lost power is back in SD mode and stays silent. */
+    uint8_t r1 = 0xFFU;
+    uint8_t r2 = 0xFFU;
     SD_Select(sd_handle);
-    SD_Status status = SD_WaitReady(sd_handle, SD_WRITE_BUSY_TIMEOUT_MS);
+    SD_Status status = SD_SendCommand(sd_handle, SD_CMD13, 0, 0xFFU, &r1);
+    if (status == SD_OK) {
+        status = SD_ReceiveByte(sd_handle, &r2);
+    }
     SD_Deselect(sd_handle);
     (void)SD_TransmitByte(sd_handle, 0xFFU);
+    if (status == SD_OK && (r1 != 0x00U || r2 != 0x00U)) {
+        status = SD_ERROR;
+    }
 
     SD_Unlock(sd_handle);
     return SD_RecordStatus(sd_handle, status);
@@ -1018,7 +4635,29 @@ void SD_GetStats(SD_Handle_t *sd_handle, SD_Stats *stats) {
     if (!sd_handle || !stats) {
         return;
     }
+#if (SD_STATS_SNAPSHOT == 1)
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&sd_handle->stats_seq, __ATOMIC_ACQUIRE);
+        *stats = sd_handle->stats_pub[seq & 1U];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&sd_handle->stats_seq, __ATOMIC_RELAXED) != seq);
+    /* Bumped outside the lock, so possibly newer than the last publish. */
+    stats->error_count = __atomic_load_n(&sd_handle->stats.error_count, __ATOMIC_RELAXED);
+    stats->timeout_count = __atomic_load_n(&sd_handle->stats.timeout_count, __ATOMIC_RELAXED);
+    stats->deadline_requests =
+        __atomic_load_n(&sd_handle->stats.deadline_requests, __ATOMIC_RELAXED);
+    stats->deadline_misses = __atomic_load_n(&sd_handle->stats.deadline_misses, __ATOMIC_RELAXED);
+    stats->readahead_hits = __atomic_load_n(&sd_handle->stats.readahead_hits, __ATOMIC_RELAXED);
+    stats->readahead_misses =
+        __atomic_load_n(&sd_handle->stats.readahead_misses, __ATOMIC_RELAXED);
+    stats->rmw_avoided = __atomic_load_n(&sd_handle->stats.rmw_avoided, __ATOMIC_RELAXED);
+#else
     *stats = sd_handle->stats;
+#endif
+#if (SD_LATENCY_STATS == 1)
+    stats->bus_window_ms = HAL_GetTick() - sd_handle->stats_tick;
+#endif
 }
 
 void SD_ResetStats(SD_Handle_t *sd_handle) {
@@ -1026,4 +4665,81 @@ void SD_ResetStats(SD_Handle_t *sd_handle) {
         return;
     }
     memset(&sd_handle->stats, 0, sizeof(sd_handle->stats));
+#if (SD_LATENCY_STATS == 1)
+    sd_handle->stats_tick = HAL_GetTick();
+#endif
+#if (SD_ENERGY_STATS == 1)
+    sd_handle->select_mark = DWT->CYCCNT; /* an open selection counts from here */
+#endif
+#if (SD_STATS_SNAPSHOT == 1)
+    SD_StatsPublish(sd_handle);
+#endif
+}
+
+SD_Status SD_SetLatencySlo(SD_Handle_t *sd_handle, SD_LatencyOp op, uint32_t limit_us) {
+#if (SD_SLO_ENABLED == 1)
+    if (!sd_handle || (uint32_t)op >= SD_LAT_COUNT) {
+        return SD_PARAM;
+    }
+    sd_handle->slo_us[op] = limit_us;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)op;
+    (void)limit_us;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+SD_Status SD_SetSloCallback(SD_Handle_t *sd_handle, SD_SloCallback fn, void *context) {
+#if (SD_SLO_ENABLED == 1)
+    if (!sd_handle) {
+        return SD_PARAM;
+    }
+    sd_handle->slo_fn = fn;
+    sd_handle->slo_ctx = context;
+    return SD_OK;
+#else
+    (void)sd_handle;
+    (void)fn;
+    (void)context;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+SD_Status SD_GetSloViolation(SD_Handle_t *sd_handle, SD_SloViolation *out) {
+#if (SD_SLO_ENABLED == 1)
+    if (!sd_handle || !out) {
+        return SD_PARAM;
+    }
+    *out = sd_handle->slo_last;
+    return (out->count != 0U) ? SD_OK : SD_ERROR;
+#else
+    (void)sd_handle;
+    (void)out;
+    return SD_UNSUPPORTED;
+#endif
+}
+
+uint32_t SD_BusUtilization(const SD_Stats *stats) {
+#if (SD_LATENCY_STATS == 1)
+    if (stats == NULL || stats->bus_window_ms == 0U) {
+        return 0U;
+    }
+    uint64_t window = (uint64_t)stats->bus_window_ms * (SystemCoreClock / 1000U);
+    uint64_t permille = stats->bus_xfer_cycles * 1000U / window;
+    return (permille > 1000U) ? 1000U : (uint32_t)permille;
+#else
+    (void)stats;
+    return 0U;
+#endif
+}
+
+uint64_t SD_SelectedCycles(SD_Handle_t *sd_handle) {
+#if (SD_ENERGY_STATS == 1)
+    return sd_handle ? SD_EnergySelected(sd_handle, DWT->CYCCNT) : 0U;
+#else
+    (void)sd_handle;
+    return 0U;
+#endif
 }
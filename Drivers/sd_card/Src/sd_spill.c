@@ -0,0 +1,301 @@
+/*
+ * sd_spill.c
+ *
+ * RAM spill buffer in front of one card. Extents are runs of sectors in
+ * the ring, queued in arrival order and released in that order once the
+ * card has them; they may complete out of order when the scheduler
+ * reorders them.
+ */
+
+#include "sd_spill.h"
+#include <string.h>
+
+#if defined(USE_FREERTOS)
+#include "sd_async.h"
+#include "task.h"
+#endif
+
+/* Extent states. */
+#define SD_SPILL_QUEUED   1U
+#define SD_SPILL_INFLIGHT 2U
+#define SD_SPILL_DONE     3U
+
+/* Events raised under the lock, reported after it is released. */
+typedef struct {
+    SD_SpillEvent event[2];
+    uint32_t used[2];
+    uint32_t n;
+} SD_SpillEvents;
+
+static void SD_SpillLock(SD_Spill *spill) {
+#if defined(USE_FREERTOS)
+    (void)xSemaphoreTake(spill->lock, portMAX_DELAY);
+#else
+    (void)spill;
+#endif
+}
+
+static void SD_SpillUnlock(SD_Spill *spill) {
+#if defined(USE_FREERTOS)
+    (void)xSemaphoreGive(spill->lock);
+#else
+    (void)spill;
+#endif
+}
+
+static void SD_SpillRaise(SD_SpillEvents *ev, SD_SpillEvent event, uint32_t used) {
+    if (ev->n < 2U) {
+        ev->event[ev->n] = event;
+        ev->used[ev->n] = used;
+        ev->n++;
+    }
+}
+
+static void SD_SpillReport(const SD_Spill *spill, const SD_SpillEvents *ev) {
+    for (uint32_t i = 0; i < ev->n; i++) {
+        if (spill->watermark) {
+            spill->watermark(ev->event[i], ev->used[i], spill->context);
+        }
+    }
+}
+
+static SD_SpillExtent *SD_SpillAt(SD_Spill *spill, uint32_t index) {
+    return &spill->ext[index % SD_SPILL_MAX_EXTENTS];
+}
+
+/* An older extent still in the ring overlaps this one: it has to reach the card first. */
+static bool SD_SpillBlocked(SD_Spill *spill, uint32_t index) {
+    const SD_SpillExtent *e = SD_SpillAt(spill, index);
+    for (uint32_t i = spill->ext_tail; i != index; i++) {
+        const SD_SpillExtent *o = SD_SpillAt(spill, i);
+        if (o->state != SD_SPILL_DONE && o->sector < e->sector + e->count &&
+            e->sector < o->sector + o->count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Release finished extents from the front, then check the low watermark. */
+static void SD_SpillRelease(SD_Spill *spill, SD_SpillEvents *ev) {
+    while (spill->ext_tail != spill->ext_head &&
+           SD_SpillAt(spill, spill->ext_tail)->state == SD_SPILL_DONE) {
+        spill->used -= SD_SpillAt(spill, spill->ext_tail)->count;
+        spill->ext_tail++;
+    }
+    if (spill->above && spill->used <= spill->low) {
+        spill->above = false;
+        SD_SpillRaise(ev, SD_SPILL_LOW, spill->used);
+    }
+}
+
+/* Completion of one extent: the async layer's callback, or called inline by SD_SpillPoll. */
+static void SD_SpillDone(SD_Status status, void *context) {
+    SD_SpillExtent *e = (SD_SpillExtent *)context;
+    SD_Spill *spill = e->spill;
+    SD_SpillEvents ev = {0};
+
+    SD_SpillLock(spill);
+    e->state = SD_SPILL_DONE;
+    e->status = status;
+    if (status != SD_OK) {
+        spill->stats.card_errors++;
+        spill->failed = true;
+        SD_SpillRaise(&ev, SD_SPILL_ERROR, spill->used);
+    }
+    SD_SpillRelease(spill, &ev);
+    SD_SpillUnlock(spill);
+    SD_SpillReport(spill, &ev);
+#if defined(USE_FREERTOS)
+    (void)SD_SpillPoll(spill); /* overlapping or refused extents may go now */
+#endif
+}
+
+/* Oldest waiting extent that may go to the card, marked in flight; NULL if none. */
+static SD_SpillExtent *SD_SpillTake(SD_Spill *spill) {
+    for (uint32_t i = spill->ext_tail; i != spill->ext_head; i++) {
+        SD_SpillExtent *e = SD_SpillAt(spill, i);
+        if (e->state == SD_SPILL_QUEUED && !SD_SpillBlocked(spill, i)) {
+            e->state = SD_SPILL_INFLIGHT;
+            spill->stats.card_writes++;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Append a piece that is contiguous in the ring, merging it into the newest extent if it can. */
+static void SD_SpillAppend(SD_Spill *spill, const uint8_t *buff, uint32_t sector,
+                           uint32_t count) {
+    memcpy(spill->ring[spill->ring_head], buff, count * SD_BLOCK_SIZE);
+    SD_SpillExtent *last = (spill->ext_head != spill->ext_tail)
+                               ? SD_SpillAt(spill, spill->ext_head - 1U)
+                               : NULL;
+    if (last && last->state == SD_SPILL_QUEUED && last->sector + last->count == sector &&
+        last->first + last->count == spill->ring_head) {
+        last->count += count;
+    } else {
+        SD_SpillExtent *e = SD_SpillAt(spill, spill->ext_head++);
+        e->spill = spill;
+        e->sector = sector;
+        e->count = count;
+        e->first = spill->ring_head;
+        e->state = SD_SPILL_QUEUED;
+        e->status = SD_OK;
+    }
+    spill->ring_head = (spill->ring_head + count) % SD_SPILL_SECTORS;
+    spill->used += count;
+}
+
+SD_Status SD_SpillInit(SD_Spill *spill, SD_Handle_t *sd, uint32_t high_sectors,
+                       uint32_t low_sectors, SD_SpillWatermarkFn watermark, void *context) {
+    if (!spill || !sd || high_sectors == 0U || high_sectors > SD_SPILL_SECTORS ||
+        low_sectors >= high_sectors) {
+        return SD_PARAM;
+    }
+#if defined(USE_FREERTOS)
+    /* The lock survives a re-init; everything else starts over. */
+    if (spill->lock == NULL) {
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        spill->lock = xSemaphoreCreateMutexStatic(&spill->lock_buffer);
+#else
+        spill->lock = xSemaphoreCreateMutex();
+#endif
+    }
+    if (spill->lock == NULL) {
+        return SD_ERROR;
+    }
+#endif
+    spill->sd = sd;
+    spill->watermark = watermark;
+    spill->context = context;
+    spill->high = high_sectors;
+    spill->low = low_sectors;
+    spill->above = false;
+    spill->failed = false;
+    spill->used = 0;
+    spill->ring_head = 0;
+    spill->ext_head = 0;
+    spill->ext_tail = 0;
+    memset(&spill->stats, 0, sizeof(spill->stats));
+    return SD_OK;
+}
+
+SD_Status SD_SpillWrite(SD_Spill *spill, const uint8_t *buff, uint32_t sector, uint32_t count) {
+    SD_SpillEvents ev = {0};
+
+    if (!spill || !spill->sd || !buff || count == 0U || count > SD_SPILL_SECTORS) {
+        return SD_PARAM;
+    }
+
+    SD_SpillLock(spill);
+    uint32_t to_end = SD_SPILL_SECTORS - spill->ring_head;
+    uint32_t extents = (count > to_end) ? 2U : 1U;
+    if (spill->used + count > SD_SPILL_SECTORS ||
+        (spill->ext_head - spill->ext_tail) + extents > SD_SPILL_MAX_EXTENTS) {
+        spill->stats.refused++;
+        spill->stats.refused_sectors += count;
+        SD_SpillRaise(&ev, SD_SPILL_FULL, spill->used);
+        SD_SpillUnlock(spill);
+        SD_SpillReport(spill, &ev);
+        return SD_BUSY;
+    }
+    if (count > to_end) {
+        SD_SpillAppend(spill, buff, sector, to_end);
+        SD_SpillAppend(spill, buff + to_end * SD_BLOCK_SIZE, sector + to_end, count - to_end);
+    } else {
+        SD_SpillAppend(spill, buff, sector, count);
+    }
+    spill->stats.writes++;
+    spill->stats.sectors += count;
+    if (spill->used > spill->stats.max_used) {
+        spill->stats.max_used = spill->used;
+    }
+    if (!spill->above && spill->used >= spill->high) {
+        spill->above = true;
+        spill->stats.high_events++;
+        SD_SpillRaise(&ev, SD_SPILL_HIGH, spill->used);
+    }
+    SD_SpillUnlock(spill);
+    SD_SpillReport(spill, &ev);
+
+#if defined(USE_FREERTOS)
+    (void)SD_SpillPoll(spill);
+#endif
+    return SD_OK;
+}
+
+SD_Status SD_SpillPoll(SD_Spill *spill) {
+    if (!spill || !spill->sd) {
+        return SD_PARAM;
+    }
+#if defined(USE_FREERTOS)
+    for (;;) {
+        SD_SpillLock(spill);
+        SD_SpillExtent *e = SD_SpillTake(spill);
+        SD_SpillUnlock(spill);
+        if (e == NULL) {
+            return SD_OK;
+        }
+        SD_IoRequest request = {
+            .sd_handle = spill->sd,
+            .buff = spill->ring[e->first],
+            .sector = e->sector,
+            .count = e->count,
+            .write = true,
+            .priority = SD_IO_PRIO_BULK,
+            .callback = SD_SpillDone,
+            .context = e,
+        };
+        if (SD_Submit(&request) != SD_OK) {
+            /* Queue full: the next completion or poll tries again. */
+            SD_SpillLock(spill);
+            e->state = SD_SPILL_QUEUED;
+            spill->stats.card_writes--;
+            SD_SpillUnlock(spill);
+            return SD_OK;
+        }
+    }
+#else
+    SD_SpillExtent *e = SD_SpillTake(spill);
+    if (e == NULL) {
+        return SD_OK;
+    }
+    SD_Status st = SD_WriteBlocks(spill->sd, spill->ring[e->first], e->sector, e->count);
+    SD_SpillDone(st, e);
+    return st;
+#endif
+}
+
+SD_Status SD_SpillFlush(SD_Spill *spill, uint32_t timeout_ms) {
+    if (!spill || !spill->sd) {
+        return SD_PARAM;
+    }
+    uint32_t start = HAL_GetTick();
+    while (SD_SpillUsed(spill) > 0U) {
+        if (HAL_GetTick() - start >= timeout_ms) {
+            return SD_TIMEOUT;
+        }
+        (void)SD_SpillPoll(spill);
+#if defined(USE_FREERTOS)
+        if (SD_SpillUsed(spill) > 0U) {
+            vTaskDelay(1);
+        }
+#endif
+    }
+    SD_SpillLock(spill);
+    bool failed = spill->failed;
+    spill->failed = false;
+    SD_SpillUnlock(spill);
+    return failed ? SD_ERROR : SD_OK;
+}
+
+uint32_t SD_SpillUsed(const SD_Spill *spill) {
+    return spill ? spill->used : 0U;
+}
+
+void SD_SpillGetStats(const SD_Spill *spill, SD_SpillStats *out) {
+    if (spill && out) {
+        *out = spill->stats;
+    }
+}
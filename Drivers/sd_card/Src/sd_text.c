@@ -0,0 +1,173 @@
+/*
+ * sd_text.c
+ *
+ * Buffered f_printf/f_puts. Text collects in tf->buf; once SD_TEXT_BUFFER
+ * bytes are in it, sd_text_drain writes up to the last point where the file
+ * position lands on a sector boundary and moves the remainder (less than a
+ * sector) to the front. The SD_TEXT_LINE_MAX bytes past SD_TEXT_BUFFER take
+ * the line that crossed it. sd_text_vprintf formats into the free space and
+ * widens the newlines in place from the back.
+ */
+
+#include "sd_text.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SD_TEXT_SS  ((uint32_t)_MAX_SS)
+#define SD_TEXT_CAP (SD_TEXT_BUFFER + SD_TEXT_LINE_MAX)
+
+static int sd_text_fail(SD_TextFile *tf, FRESULT res) {
+    tf->error = res;
+    return -1;
+}
+
+static FRESULT sd_text_write(SD_TextFile *tf, uint32_t n) {
+    UINT bw = 0;
+    if (((uint32_t)tf->fp->fptr % SD_TEXT_SS) == 0U && (n % SD_TEXT_SS) == 0U) {
+        tf->stats.aligned++;
+    }
+    tf->stats.writes++;
+    FRESULT res = f_write(tf->fp, tf->buf, n, &bw);
+    tf->stats.bytes += bw;
+    if (res == FR_OK && bw != n) {
+        res = FR_DENIED; /* volume full */
+    }
+    return res;
+}
+
+/* Once SD_TEXT_BUFFER bytes are queued, write them up to a sector boundary of the file. */
+static FRESULT sd_text_drain(SD_TextFile *tf) {
+    while (tf->used >= SD_TEXT_BUFFER) {
+        uint32_t n = tf->used - ((uint32_t)tf->fp->fptr + tf->used) % SD_TEXT_SS;
+        FRESULT res = sd_text_write(tf, n);
+        if (res != FR_OK) {
+            return res;
+        }
+        tf->used -= n;
+        memmove(tf->buf, tf->buf + n, tf->used);
+    }
+    return FR_OK;
+}
+
+/* Newlines in s[0..len) (0 without conversion). */
+static uint32_t sd_text_count_nl(const char *s, uint32_t len) {
+#if SD_TEXT_CRLF
+    uint32_t k = 0;
+    const char *end = s + len;
+    const char *nl;
+    while (s < end && (nl = memchr(s, '\n', (size_t)(end - s))) != NULL) {
+        k++;
+        s = nl + 1;
+    }
+    return k;
+#else
+    (void)s;
+    (void)len;
+    return 0;
+#endif
+}
+
+void sd_text_begin(SD_TextFile *tf, FIL *fp) {
+    tf->fp = fp;
+    tf->used = 0;
+    tf->error = FR_OK;
+    memset(&tf->stats, 0, sizeof(tf->stats));
+}
+
+int sd_text_vprintf(SD_TextFile *tf, const char *fmt, va_list ap) {
+    if (tf->error != FR_OK) {
+        return -1;
+    }
+    /* sd_text_drain leaves less than SD_TEXT_BUFFER queued, so the line always has room. */
+    char *dst = (char *)tf->buf + tf->used;
+    uint32_t room = SD_TEXT_CAP - tf->used;
+    int len = vsnprintf(dst, room, fmt, ap);
+    if (len < 0) {
+        return sd_text_fail(tf, FR_INVALID_PARAMETER);
+    }
+    if ((uint32_t)len >= SD_TEXT_LINE_MAX) {
+        return -1; /* nothing queued */
+    }
+    uint32_t k = sd_text_count_nl(dst, (uint32_t)len);
+    uint32_t total = (uint32_t)len + k;
+    if (total >= SD_TEXT_LINE_MAX) {
+        return -1;
+    }
+    tf->stats.newlines += k;
+    /* Widen from the back: each byte moves right by the newlines before it. */
+    for (uint32_t i = (uint32_t)len; k > 0U; i--) {
+        char c = dst[i - 1U];
+        dst[i - 1U + k] = c;
+        if (c == '\n') {
+            dst[i - 2U + k] = '\r';
+            k--;
+        }
+    }
+    tf->used += total;
+    FRESULT res = sd_text_drain(tf);
+    return (res == FR_OK) ? (int)total : sd_text_fail(tf, res);
+}
+
+int sd_text_printf(SD_TextFile *tf, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = sd_text_vprintf(tf, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+int sd_text_puts(SD_TextFile *tf, const char *str) {
+    if (tf->error != FR_OK) {
+        return -1;
+    }
+    uint32_t total = 0;
+    uint32_t len = (uint32_t)strlen(str);
+    while (len > 0U) {
+        /* Fill up to SD_TEXT_BUFFER; the line room past it takes the "\r\n". */
+        uint32_t room = SD_TEXT_BUFFER - tf->used;
+        uint32_t span = (len < room) ? len : room;
+        bool nl = false;
+#if SD_TEXT_CRLF
+        const char *p = memchr(str, '\n', span);
+        if (p != NULL) {
+            span = (uint32_t)(p - str);
+            nl = true;
+        }
+#endif
+        memcpy(tf->buf + tf->used, str, span);
+        tf->used += span;
+        total += span;
+        str += span;
+        len -= span;
+        if (nl) {
+            tf->buf[tf->used++] = '\r';
+            tf->buf[tf->used++] = '\n';
+            tf->stats.newlines++;
+            total += 2U;
+            str++;
+            len--;
+        }
+        FRESULT res = sd_text_drain(tf);
+        if (res != FR_OK) {
+            return sd_text_fail(tf, res);
+        }
+    }
+    return (int)total;
+}
+
+int sd_text_flush(SD_TextFile *tf) {
+    if (tf->error == FR_OK && tf->used > 0U) {
+        FRESULT res = sd_text_write(tf, tf->used);
+        if (res != FR_OK) {
+            tf->error = res;
+        } else {
+            tf->used = 0;
+        }
+    }
+    return tf->error;
+}
+
+void sd_text_get_stats(const SD_TextFile *tf, SD_TextStats *out) {
+    *out = tf->stats;
+}
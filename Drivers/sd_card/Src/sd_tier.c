@@ -0,0 +1,633 @@
+/*
+ * sd_tier.c
+ *
+ * Flash write tier in front of the card, plus its FatFs diskio glue. A ring
+ * of sequence-numbered records on the flash holds sectors until the drain
+ * has copied them to the card; a RAM index maps ring slots to sectors.
+ */
+
+#include "sd_tier.h"
+#include "sd_diskio_spi.h"
+#include <string.h>
+
+SD_Tier g_sd_tier;
+
+#define SD_TIER_NONE  UINT32_MAX
+#define SD_TIER_MAGIC 0x52495453UL /* "STIR" */
+
+/* Header field offsets. */
+#define SD_TIER_H_MAGIC  0U
+#define SD_TIER_H_SEQ    4U
+#define SD_TIER_H_SECTOR 8U
+#define SD_TIER_H_CRC    12U
+#define SD_TIER_H_DONE   16U
+
+#if defined(USE_FREERTOS)
+static TaskHandle_t s_task;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticTask_t s_task_buffer;
+static StackType_t s_task_stack[SD_TIER_TASK_STACK];
+#endif
+#endif
+
+static void sd_tier_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t sd_tier_get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+/* CRC-32 (IEEE, reflected), four bits per step from a 64-byte table. */
+static uint32_t sd_tier_crc(uint32_t crc, const uint8_t *p, uint32_t len) {
+    static const uint32_t table[16] = {
+        0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+        0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+        0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+        0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL,
+    };
+    while (len-- > 0U) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0x0FU];
+        crc = (crc >> 4) ^ table[crc & 0x0FU];
+    }
+    return crc;
+}
+
+/* Sequence and sector, then the data. */
+static uint32_t sd_tier_record_crc(const uint8_t *header, const uint8_t *data) {
+    uint32_t crc = sd_tier_crc(0xFFFFFFFFUL, header + SD_TIER_H_SEQ, 8U);
+    return sd_tier_crc(crc, data, SD_BLOCK_SIZE);
+}
+
+static void SD_TierLock(SD_Tier *tier) {
+#if defined(USE_FREERTOS)
+    (void)xSemaphoreTake(tier->lock, portMAX_DELAY);
+#else
+    (void)tier;
+#endif
+}
+
+static void SD_TierUnlock(SD_Tier *tier) {
+#if defined(USE_FREERTOS)
+    (void)xSemaphoreGive(tier->lock);
+#else
+    (void)tier;
+#endif
+}
+
+static SD_Status SD_TierFromDiskio(DRESULT res) {
+    if (res == RES_OK) {
+        return SD_OK;
+    }
+    if (res == RES_PARERR) {
+        return SD_PARAM;
+    }
+    return (res == RES_NOTRDY) ? SD_NO_MEDIA : SD_ERROR;
+}
+
+/* Flash address of a sequence's record: whole records per erase unit, none straddling. */
+static uint32_t SD_TierAddr(const SD_Tier *tier, uint32_t seq) {
+    uint32_t slot = seq % tier->capacity;
+    return (slot / tier->per_unit) * tier->flash.erase_size +
+           (slot % tier->per_unit) * SD_TIER_RECORD_SIZE;
+}
+
+static bool SD_TierFlashRead(SD_Tier *tier, uint32_t addr, void *buf, uint32_t len) {
+    if (tier->flash.read(addr, buf, len, tier->flash.context)) {
+        return true;
+    }
+    tier->stats.flash_errors++;
+    return false;
+}
+
+static bool SD_TierFlashProgram(SD_Tier *tier, uint32_t addr, const void *buf, uint32_t len) {
+    if (tier->flash.program(addr, buf, len, tier->flash.context)) {
+        return true;
+    }
+    tier->stats.flash_errors++;
+    return false;
+}
+
+static bool SD_TierErase(SD_Tier *tier, uint32_t seq) {
+    if (!tier->flash.erase(SD_TierAddr(tier, seq), tier->flash.context)) {
+        tier->stats.flash_errors++;
+        return false;
+    }
+    tier->stats.erases++;
+    return true;
+}
+
+/* Pending slot holding a sector, or SD_TIER_NONE. */
+static uint32_t SD_TierFind(const SD_Tier *tier, uint32_t sector) {
+    for (uint32_t slot = 0; slot < tier->capacity; slot++) {
+        if (tier->slot_sector[slot] == sector) {
+            return slot;
+        }
+    }
+    return SD_TIER_NONE;
+}
+
+/* Move the tail past records that were drained or superseded. */
+static void SD_TierAdvance(SD_Tier *tier) {
+    while (tier->tail != tier->head &&
+           tier->slot_sector[tier->tail % tier->capacity] == SD_TIER_NONE) {
+        tier->tail++;
+    }
+}
+
+/* Whole erase unit starting at seq is free to reuse. */
+static bool SD_TierUnitFree(const SD_Tier *tier, uint32_t seq) {
+    return seq + tier->per_unit - tier->tail <= tier->capacity;
+}
+
+/* Pre-erase the unit the writer enters next, once nothing in it is pending. */
+static void SD_TierEraseAhead(SD_Tier *tier) {
+    uint32_t next = ((tier->head + tier->per_unit - 1U) / tier->per_unit) * tier->per_unit;
+    if (tier->erased_next == next || !SD_TierUnitFree(tier, next)) {
+        return;
+    }
+    if (SD_TierErase(tier, next)) {
+        tier->erased_next = next;
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Recovery
+ * ----------------------------------------------------------------------- */
+
+/*
+ * Load the record in seq's slot into header and tier->buf. valid is set
+ * when it is whole: magic, a sequence that maps to this slot, and its CRC.
+ */
+static SD_Status SD_TierLoad(SD_Tier *tier, uint32_t seq, uint8_t *header, bool *valid) {
+    uint32_t addr = SD_TierAddr(tier, seq);
+    *valid = false;
+    if (!SD_TierFlashRead(tier, addr, header, SD_TIER_HEADER_SIZE)) {
+        return SD_ERROR;
+    }
+    if (sd_tier_get32(header + SD_TIER_H_MAGIC) != SD_TIER_MAGIC ||
+        sd_tier_get32(header + SD_TIER_H_SEQ) % tier->capacity != seq % tier->capacity) {
+        return SD_OK;
+    }
+    if (!SD_TierFlashRead(tier, addr + SD_TIER_HEADER_SIZE, tier->buf, SD_BLOCK_SIZE)) {
+        return SD_ERROR;
+    }
+    *valid = sd_tier_record_crc(header, tier->buf) == sd_tier_get32(header + SD_TIER_H_CRC);
+    return SD_OK;
+}
+
+/*
+ * Rebuild head, tail and the index from the ring. The newest record of a
+ * sector wins whether or not it was drained; a torn one counts as absent.
+ * The head starts at the next erase unit, past any partly programmed slot.
+ */
+static SD_Status SD_TierRecover(SD_Tier *tier) {
+    uint8_t header[SD_TIER_HEADER_SIZE];
+    bool found = false;
+    bool valid;
+    uint32_t newest = 0;
+
+    for (uint32_t slot = 0; slot < tier->capacity; slot++) {
+        tier->slot_sector[slot] = SD_TIER_NONE;
+        if (SD_TierLoad(tier, slot, header, &valid) != SD_OK) {
+            return SD_ERROR;
+        }
+        uint32_t seq = sd_tier_get32(header + SD_TIER_H_SEQ);
+        if (valid && (!found || (int32_t)(seq - newest) > 0)) {
+            newest = seq;
+            found = true;
+        }
+    }
+    if (!found) {
+        tier->head = 0;
+        tier->tail = 0;
+        return SD_OK;
+    }
+
+    /* What lies before head - capacity went with the erase of the newest record's unit. */
+    tier->head = ((newest + tier->per_unit) / tier->per_unit) * tier->per_unit;
+    tier->tail = (tier->head >= tier->capacity) ? tier->head - tier->capacity : 0U;
+    for (uint32_t seq = tier->tail; seq != newest + 1U; seq++) {
+        uint32_t slot = seq % tier->capacity;
+        if (SD_TierLoad(tier, seq, header, &valid) != SD_OK) {
+            return SD_ERROR;
+        }
+        if (!valid || sd_tier_get32(header + SD_TIER_H_SEQ) != seq) {
+            continue;
+        }
+    uint32_t sector = sd_tier_get32(header + SD_TIER_H_SECTOR);
+        uint32_t older = SD_TierFind(tier, sector);
+        if (older != SD_TIER_NONE) {
+            tier->slot_sector[older] = SD_TIER_NONE;
+            tier->pending--;
+        }
+        if (sd_tier_get32(header + SD_TIER_H_DONE) == 0xFFFFFFFFUL) {
+            tier->slot_sector[slot] = sector;
+            tier->pending++;
+        }
+    }
+
+    tier->stats.recovered = tier->pending;
+    SD_TierAdvance(tier);
+    return SD_OK;
+}
+
+/* -----------------------------------------------------------------------
+ * Drain task
+ * ----------------------------------------------------------------------- */
+
+#if defined(USE_FREERTOS)
+static void SD_TierTask(void *argument) {
+    SD_Tier *tier = (SD_Tier *)argument;
+    uint32_t drained;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SD_TIER_DRAIN_IDLE_MS));
+        while (SD_TierPending(tier) > 0U &&
+               SD_TierDrain(tier, SD_TIER_DRAIN_BATCH, &drained) == SD_OK && drained > 0U) {
+        }
+    }
+}
+
+static SD_Status SD_TierStart(SD_Tier *tier) {
+    if (s_task != NULL) {
+        return SD_OK;
+    }
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_task = xTaskCreateStatic(SD_TierTask, "sd_tier", SD_TIER_TASK_STACK, tier,
+                               SD_TIER_TASK_PRIORITY, s_task_stack, &s_task_buffer);
+#else
+    if (xTaskCreate(SD_TierTask, "sd_tier", SD_TIER_TASK_STACK, tier, SD_TIER_TASK_PRIORITY,
+                    &s_task) != pdPASS) {
+        s_task = NULL;
+    }
+#endif
+    return (s_task != NULL) ? SD_OK : SD_ERROR;
+}
+#endif
+
+/* -----------------------------------------------------------------------
+ * Public API
+ * ----------------------------------------------------------------------- */
+
+SD_Status SD_TierInit(SD_Tier *tier, const SD_TierFlash *flash, BYTE lun) {
+    if (tier == NULL || flash == NULL || flash->read == NULL || flash->program == NULL ||
+        flash->erase == NULL || lun >= SD_DISK_DRIVES ||
+        flash->erase_size < SD_TIER_RECORD_SIZE || flash->size % flash->erase_size != 0U) {
+        return SD_PARAM;
+    }
+    uint32_t per_unit = flash->erase_size / SD_TIER_RECORD_SIZE;
+    uint32_t units = flash->size / flash->erase_size;
+    if (units > SD_TIER_MAX_RECORDS / per_unit) {
+        units = SD_TIER_MAX_RECORDS / per_unit;
+    }
+    if (units < 2U) {
+        return SD_PARAM;
+    }
+
+#if defined(USE_FREERTOS)
+    /* The lock survives a re-init; everything else starts over. */
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    if (tier->lock == NULL) {
+        tier->lock = xSemaphoreCreateMutexStatic(&tier->lock_buffer);
+    }
+#else
+    if (tier->lock == NULL) {
+        tier->lock = xSemaphoreCreateMutex();
+    }
+#endif
+    if (tier->lock == NULL) {
+        return SD_ERROR;
+    }
+#endif
+    memset(&tier->stats, 0, sizeof(tier->stats));
+    tier->flash = *flash;
+    tier->lun = lun;
+    tier->per_unit = per_unit;
+    tier->capacity = units * per_unit;
+    tier->erased_next = SD_TIER_NONE;
+    tier->drain_gen = 0;
+    tier->pending = 0;
+
+    SD_TierLock(tier);
+    SD_Status st = SD_TierRecover(tier);
+    tier->stats.max_pending = tier->pending;
+    SD_TierUnlock(tier);
+    if (st != SD_OK) {
+        return st;
+    }
+#if defined(USE_FREERTOS)
+    if (tier == &g_sd_tier) {
+        st = SD_TierStart(tier);
+        if (st == SD_OK && tier->stats.recovered > 0U) {
+            (void)xTaskNotifyGive(s_task);
+        }
+    }
+#endif
+    return st;
+}
+
+/* Append one sector under the lock; false when the ring has no free unit to enter. */
+static SD_Status SD_TierAppend(SD_Tier *tier, const uint8_t *data, uint32_t sector, bool *full) {
+    uint32_t seq = tier->head;
+    uint32_t addr = SD_TierAddr(tier, seq);
+    uint8_t header[SD_TIER_HEADER_SIZE];
+
+    *full = false;
+    if (seq % tier->per_unit == 0U) {
+        if (!SD_TierUnitFree(tier, seq)) {
+            *full = true;
+            return SD_OK;
+        }
+        if (tier->erased_next != seq) {
+            tier->stats.inline_erases++;
+            if (!SD_TierErase(tier, seq)) {
+                return SD_ERROR;
+            }
+        }
+        tier->erased_next = SD_TIER_NONE;
+    }
+
+    memset(header, 0xFF, sizeof(header));
+    sd_tier_put32(header + SD_TIER_H_MAGIC, SD_TIER_MAGIC);
+    sd_tier_put32(header + SD_TIER_H_SEQ, seq);
+    sd_tier_put32(header + SD_TIER_H_SECTOR, sector);
+    sd_tier_put32(header + SD_TIER_H_CRC, sd_tier_record_crc(header, data));
+    /* Data first: the header commits the record. */
+    if (!SD_TierFlashProgram(tier, addr + SD_TIER_HEADER_SIZE, data, SD_BLOCK_SIZE) ||
+        !SD_TierFlashProgram(tier, addr, header, SD_TIER_HEADER_SIZE)) {
+        /* The slot is spent either way; its record is torn or unreadable. */
+        tier->head++;
+        SD_TierAdvance(tier);
+        return SD_ERROR;
+    }
+
+    uint32_t older = SD_TierFind(tier, sector);
+    if (older != SD_TIER_NONE) {
+        tier->slot_sector[older] = SD_TIER_NONE;
+        tier->stats.superseded++;
+    } else {
+        tier->pending++;
+    }
+    tier->slot_sector[seq % tier->capacity] = sector;
+    tier->head++;
+    SD_TierAdvance(tier);
+    tier->stats.writes++;
+    if (tier->pending > tier->stats.max_pending) {
+        tier->stats.max_pending = tier->pending;
+    }
+    return SD_OK;
+}
+
+SD_Status SD_TierWrite(SD_Tier *tier, const uint8_t *buff, uint32_t sector, uint32_t count) {
+    if (tier == NULL || tier->capacity == 0U || buff == NULL) {
+        return SD_PARAM;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        bool full;
+        SD_TierLock(tier);
+        SD_Status st = SD_TierAppend(tier, buff + i * SD_BLOCK_SIZE, sector + i, &full);
+        SD_TierUnlock(tier);
+        if (st != SD_OK) {
+            return st;
+        }
+        if (full) {
+            /* Ring full: copy the oldest records to the card here, then try again. */
+            uint32_t drained = 0;
+            tier->stats.full_stalls++;
+            st = SD_TierDrain(tier, SD_TIER_DRAIN_BATCH, &drained);
+            if (st != SD_OK) {
+                return st;
+            }
+            i--;
+        }
+    }
+#if defined(USE_FREERTOS)
+    if (tier == &g_sd_tier && s_task != NULL && count > 0U) {
+        (void)xTaskNotifyGive(s_task);
+    }
+#endif
+    return SD_OK;
+}
+
+SD_Status SD_TierRead(SD_Tier *tier, uint8_t *buff, uint32_t sector, uint32_t count) {
+    if (tier == NULL || tier->capacity == 0U || buff == NULL) {
+        return SD_PARAM;
+    }
+    for (;;) {
+        /*
+         * The card first, then the pending sectors over it. A record drained
+         * while the card was being read may have left the index since, in
+         * which case the card copy read may predate it: read again.
+         */
+        SD_TierLock(tier);
+        uint32_t gen = tier->drain_gen;
+        SD_TierUnlock(tier);
+
+        SD_Status st = SD_TierFromDiskio(SD_Driver.disk_read(tier->lun, buff, sector, count));
+        if (st != SD_OK) {
+            return st;
+        }
+
+        SD_TierLock(tier);
+        if (gen != tier->drain_gen) {
+            SD_TierUnlock(tier);
+            continue;
+        }
+        for (uint32_t seq = tier->tail; seq != tier->head && st == SD_OK; seq++) {
+            uint32_t s = tier->slot_sector[seq % tier->capacity];
+            if (s != SD_TIER_NONE && s - sector < count &&
+                !SD_TierFlashRead(tier, SD_TierAddr(tier, seq) + SD_TIER_HEADER_SIZE,
+                                  buff + (s - sector) * SD_BLOCK_SIZE, SD_BLOCK_SIZE)) {
+                st = SD_ERROR;
+            }
+        }
+        SD_TierUnlock(tier);
+        return st;
+    }
+}
+
+SD_Status SD_TierDrain(SD_Tier *tier, uint32_t max_records, uint32_t *drained) {
+    uint32_t seqs[SD_TIER_DRAIN_BATCH];
+    uint32_t sectors[SD_TIER_DRAIN_BATCH];
+    uint32_t n = 0;
+    SD_Status st = SD_OK;
+
+    if (drained) {
+        *drained = 0;
+    }
+    if (tier == NULL || tier->capacity == 0U) {
+        return SD_PARAM;
+    }
+    if (max_records > SD_TIER_DRAIN_BATCH) {
+        max_records = SD_TIER_DRAIN_BATCH;
+    }
+
+    /* Copy the oldest pending records, one sector buffer at a time, outside the lock. */
+    SD_TierLock(tier);
+    uint32_t seq = tier->tail;
+    while (n < max_records && st == SD_OK) {
+        while (seq != tier->head && tier->slot_sector[seq % tier->capacity] == SD_TIER_NONE) {
+            seq++;
+        }
+        if (seq == tier->head) {
+            break;
+        }
+        uint32_t sector = tier->slot_sector[seq % tier->capacity];
+        if (!SD_TierFlashRead(tier, SD_TierAddr(tier, seq) + SD_TIER_HEADER_SIZE, tier->buf,
+                              SD_BLOCK_SIZE)) {
+            st = SD_ERROR;
+            break;
+        }
+        SD_TierUnlock(tier);
+        st = SD_TierFromDiskio(SD_Driver.disk_write(tier->lun, tier->buf, sector, 1U));
+        SD_TierLock(tier);
+        if (st != SD_OK) {
+            tier->stats.card_errors++;
+            break;
+        }
+        seqs[n] = seq;
+        sectors[n] = sector;
+        n++;
+        seq++;
+    }
+    SD_TierUnlock(tier);
+
+    if (n > 0U) {
+        DRESULT res = SD_Driver.disk_ioctl(tier->lun, CTRL_SYNC, NULL);
+        if (res != RES_OK) {
+            tier->stats.card_errors++;
+            return SD_TierFromDiskio(res);
+        }
+    }
+
+    /*
+     * Retire what the card now holds. A superseded record is left unmarked:
+     * its slot may already be reused, and recovery lets the newer one win.
+     */
+    static const uint8_t zero[4] = {0};
+    SD_TierLock(tier);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t slot = seqs[i] % tier->capacity;
+        if (tier->slot_sector[slot] != sectors[i]) {
+            continue;
+        }
+        (void)SD_TierFlashProgram(tier, SD_TierAddr(tier, seqs[i]) + SD_TIER_H_DONE, zero,
+                                  sizeof(zero));
+        tier->slot_sector[slot] = SD_TIER_NONE;
+        tier->pending--;
+        tier->drain_gen++;
+        tier->stats.drained++;
+    }
+    SD_TierAdvance(tier);
+    if (st == SD_OK) {
+        SD_TierEraseAhead(tier);
+    }
+    SD_TierUnlock(tier);
+
+    if (drained) {
+        *drained = n;
+    }
+    return st;
+}
+
+SD_Status SD_TierFlush(SD_Tier *tier) {
+    uint32_t drained;
+    while (SD_TierPending(tier) > 0U) {
+        SD_Status st = SD_TierDrain(tier, SD_TIER_DRAIN_BATCH, &drained);
+        if (st != SD_OK) {
+            return st;
+        }
+    }
+    return SD_OK;
+}
+
+uint32_t SD_TierPending(const SD_Tier *tier) {
+    return (tier != NULL) ? tier->pending : 0U;
+}
+
+void SD_TierGetStats(const SD_Tier *tier, SD_TierStats *out) {
+    if (tier != NULL && out != NULL) {
+        *out = tier->stats;
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * FatFs diskio glue for g_sd_tier
+ * ----------------------------------------------------------------------- */
+
+static DRESULT SD_tier_result(SD_Status status) {
+    if (status == SD_OK) {
+        return RES_OK;
+    }
+    if (status == SD_PARAM) {
+        return RES_PARERR;
+    }
+    if (status == SD_NO_MEDIA || status == SD_BUSY) {
+        return RES_NOTRDY;
+    }
+    return RES_ERROR;
+}
+
+static DSTATUS SD_tier_status(BYTE pdrv) {
+    if (pdrv != 0 || g_sd_tier.capacity == 0U) {
+        return STA_NOINIT;
+    }
+    return SD_Driver.disk_status(g_sd_tier.lun);
+}
+
+static DSTATUS SD_tier_initialize(BYTE pdrv) {
+    if (pdrv != 0 || g_sd_tier.capacity == 0U) {
+        return STA_NOINIT;
+    }
+    return SD_Driver.disk_initialize(g_sd_tier.lun);
+}
+
+static DRESULT SD_tier_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    if (pdrv != 0) {
+        return RES_PARERR;
+    }
+    return SD_tier_result(SD_TierRead(&g_sd_tier, buff, sector, count));
+}
+
+#if _USE_WRITE
+static DRESULT SD_tier_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    if (pdrv != 0) {
+        return RES_PARERR;
+    }
+    if (SD_tier_status(pdrv) != 0) {
+        return RES_NOTRDY;
+    }
+    return SD_tier_result(SD_TierWrite(&g_sd_tier, (const uint8_t *)buff, sector, count));
+}
+#endif
+
+#if _USE_IOCTL
+static DRESULT SD_tier_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    if (pdrv != 0 || g_sd_tier.capacity == 0U) {
+        return RES_PARERR;
+    }
+    /* Pending sectors are already durable in flash. */
+    if (cmd == CTRL_SYNC) {
+        return RES_OK;
+    }
+    return SD_Driver.disk_ioctl(g_sd_tier.lun, cmd, buff);
+}
+#endif
+
+const Diskio_drvTypeDef SD_TierDriver = {
+    SD_tier_initialize,
+    SD_tier_status,
+    SD_tier_read,
+#if _USE_WRITE
+    SD_tier_write,
+#endif
+#if _USE_IOCTL
+    SD_tier_ioctl,
+#endif
+};
@@ -0,0 +1,141 @@
+/*
+ * sd_time.c
+ *
+ * s_now belongs to sd_time_tick; sd_time_set hands its time over through
+ * s_seed, so the only word shared with get_fattime callers is s_fattime.
+ */
+
+#include "sd_time.h"
+
+static volatile uint32_t s_fattime = SD_TIME_DEFAULT;
+static SD_TimeSource s_source;
+static SD_DateTime s_now;
+static bool s_valid;
+static SD_DateTime s_seed;
+static volatile bool s_seeded;
+
+static uint8_t sd_time_days(uint16_t year, uint8_t month) {
+    static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month == 2U && (year % 4U) == 0U && ((year % 100U) != 0U || (year % 400U) == 0U)) {
+        return 29U;
+    }
+    return days[month - 1U];
+}
+
+static bool sd_time_check(const SD_DateTime *t) {
+    return t->year >= 1980U && t->year <= 2107U && t->month >= 1U && t->month <= 12U &&
+           t->day >= 1U && t->day <= sd_time_days(t->year, t->month) && t->hour < 24U &&
+           t->minute < 60U && t->second < 60U;
+}
+
+static void sd_time_advance(SD_DateTime *t) {
+    if (++t->second < 60U) {
+        return;
+    }
+    t->second = 0U;
+    if (++t->minute < 60U) {
+        return;
+    }
+    t->minute = 0U;
+    if (++t->hour < 24U) {
+        return;
+    }
+    t->hour = 0U;
+    if (++t->day <= sd_time_days(t->year, t->month)) {
+        return;
+    }
+    t->day = 1U;
+    if (++t->month > 12U) {
+        t->month = 1U;
+        t->year++;
+    }
+}
+
+/* Take the source's time if it has one; false leaves s_now alone. */
+static bool sd_time_read(void) {
+    SD_DateTime t;
+    if (s_source == NULL || !s_source(&t) || !sd_time_check(&t)) {
+        return false;
+    }
+    s_now = t;
+    s_valid = true;
+    return true;
+}
+
+uint32_t sd_time_pack(const SD_DateTime *t) {
+    return SD_TIME_FAT(t->year, t->month, t->day, t->hour, t->minute, t->second);
+}
+
+void sd_time_set_source(SD_TimeSource source) {
+    s_source = source;
+    if (sd_time_read()) {
+        s_fattime = sd_time_pack(&s_now);
+    }
+}
+
+bool sd_time_set(const SD_DateTime *now) {
+    if (now == NULL || !sd_time_check(now)) {
+        return false;
+    }
+    s_seeded = false;
+    s_seed = *now;
+    s_seeded = true;
+    s_fattime = sd_time_pack(now);
+    return true;
+}
+
+void sd_time_tick(void) {
+    if (s_seeded) {
+        s_now = s_seed;
+        s_valid = true;
+        s_seeded = false;
+    } else if (s_valid) {
+        sd_time_advance(&s_now);
+    }
+    (void)sd_time_read();
+    if (s_valid) {
+        s_fattime = sd_time_pack(&s_now);
+    }
+}
+
+uint32_t sd_time_fattime(void) {
+    return s_fattime;
+}
+
+bool sd_time_now(SD_DateTime *out) {
+    if (out != NULL && s_valid) {
+        *out = s_now;
+    }
+    return s_valid;
+}
+
+#if defined(HAL_RTC_MODULE_ENABLED)
+
+static RTC_HandleTypeDef *s_hrtc;
+
+void sd_time_use_hal_rtc(RTC_HandleTypeDef *hrtc) {
+    s_hrtc = hrtc;
+    sd_time_set_source(sd_time_hal_rtc);
+}
+
+bool sd_time_hal_rtc(SD_DateTime *now) {
+    RTC_TimeTypeDef tm;
+    RTC_DateTypeDef dt;
+    if (s_hrtc == NULL || (s_hrtc->Instance->ISR & RTC_ISR_INITS) == 0U) {
+        return false;
+    }
+    /* GetDate must follow GetTime: it unlocks the shadow registers. */
+    if (HAL_RTC_GetTime(s_hrtc, &tm, RTC_FORMAT_BIN) != HAL_OK ||
+        HAL_RTC_GetDate(s_hrtc, &dt, RTC_FORMAT_BIN) != HAL_OK) {
+        return false;
+    }
+    now->year = (uint16_t)(2000U + dt.Year);
+    now->month = dt.Month;
+    now->day = dt.Date;
+    now->hour = tm.Hours;
+    now->minute = tm.Minutes;
+    now->second = tm.Seconds;
+    return true;
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * sd_trace.c
+ *
+ * Lock-free trace ring. A producer claims slot (head++ & mask), clears its
+ * sequence word, fills it and publishes seq = index + 1. The consumer accepts
+ * a slot only if seq matches before and after copying it, so a slot that was
+ * overwritten mid-read is detected and counted as dropped.
+ */
+
+#include "sd_trace.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SD_TRACE_MASK (SD_TRACE_ENTRIES - 1U)
+
+static SD_TraceEvent s_ring[SD_TRACE_ENTRIES];
+static uint32_t s_head; // Next index to claim (producers, atomic)
+static uint32_t s_tail; // Next index to read (consumer only)
+static uint32_t s_dropped;
+
+void SD_TraceRecord(uint8_t type, uint8_t instance, uint8_t code, uint32_t arg, uint8_t status,
+                    uint8_t resp, uint32_t start) {
+    uint32_t now = SD_TraceNow();
+    uint32_t index = __atomic_fetch_add(&s_head, 1U, __ATOMIC_RELAXED);
+    SD_TraceEvent *slot = &s_ring[index & SD_TRACE_MASK];
+
+    __atomic_store_n(&slot->seq, 0U, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->timestamp = start;
+    slot->duration = now - start;
+    slot->arg = arg;
+    slot->type = type;
+    slot->code = code;
+    slot->status = status;
+    slot->resp = resp;
+    slot->instance = instance;
+    __atomic_store_n(&slot->seq, index + 1U, __ATOMIC_RELEASE);
+}
+
+uint32_t SD_TraceRead(SD_TraceEvent *out, uint32_t max) {
+    uint32_t n = 0;
+    if (!out) {
+        return 0;
+    }
+
+    while (n < max) {
+        uint32_t head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+        if (s_tail == head) {
+            break;
+        }
+        if ((head - s_tail) > SD_TRACE_ENTRIES) {
+            /* Lapped: everything older than one ring behind head is gone. */
+            s_dropped += (head - s_tail) - SD_TRACE_ENTRIES;
+            s_tail = head - SD_TRACE_ENTRIES;
+        }
+
+        const SD_TraceEvent *slot = &s_ring[s_tail & SD_TRACE_MASK];
+        uint32_t expect = s_tail + 1U;
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq != expect) {
+            if (seq == 0U || (int32_t)(seq - expect) < 0) {
+                break; /* claimed but not yet published */
+            }
+            s_dropped++;
+            s_tail++;
+            continue;
+        }
+
+        out[n] = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != expect) {
+            s_dropped++; /* overwritten while copying */
+            s_tail++;
+            continue;
+        }
+        out[n].seq = s_tail;
+        n++;
+        s_tail++;
+    }
+    return n;
+}
+
+uint32_t SD_TraceLatest(SD_TraceEvent *out, uint32_t max) {
+    uint32_t n = 0;
+    if (!out) {
+        return 0;
+    }
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+    uint32_t span = (head < SD_TRACE_ENTRIES) ? head : SD_TRACE_ENTRIES;
+    if (max < span) {
+        span = max;
+    }
+
+    for (uint32_t index = head - span; index != head; index++) {
+        const SD_TraceEvent *slot = &s_ring[index & SD_TRACE_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1U) {
+            continue; /* not yet published, or already reused */
+        }
+        out[n] = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != index + 1U) {
+            continue;
+        }
+        out[n].seq = index;
+        n++;
+    }
+    return n;
+}
+
+uint32_t SD_TraceDrain(SD_TraceSink sink, void *context) {
+    SD_TraceEvent batch[8];
+    uint32_t total = 0;
+    uint32_t n;
+
+    if (!sink) {
+        return 0;
+    }
+    /* Bounded so a busy producer cannot keep the consumer here forever. */
+    while (total < SD_TRACE_ENTRIES &&
+           (n = SD_TraceRead(batch, sizeof(batch) / sizeof(batch[0]))) > 0U) {
+        for (uint32_t i = 0; i < n; i++) {
+            sink(&batch[i], context);
+        }
+        total += n;
+    }
+    return total;
+}
+
+static void SD_TracePrint(const SD_TraceEvent *event, void *context) {
+    (void)context;
+    printf("SDTRACE,%lu,%lu,%u,%u,%u,%lu,%u,%u,%lu\r\n", (unsigned long)event->seq,
+           (unsigned long)event->timestamp, event->type, event->instance, event->code,
+           (unsigned long)event->arg, event->status, event->resp,
+           (unsigned long)event->duration);
+}
+
+void SD_TraceDump(void) {
+    (void)SD_TraceDrain(SD_TracePrint, NULL);
+    if (s_dropped > 0U) {
+        printf("SDTRACE,dropped,%lu\r\n", (unsigned long)s_dropped);
+    }
+}
+
+uint32_t SD_TraceDropped(void) {
+    return s_dropped;
+}
+
+void SD_TraceReset(void) {
+    memset(s_ring, 0, sizeof(s_ring));
+    s_dropped = 0;
+    s_tail = 0;
+    __atomic_store_n(&s_head, 0U, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,452 @@
+/*
+ * sd_usbmsc.c
+ *
+ * USB mass-storage bridge: MSC storage callbacks over the multi-block card
+ * commands, FatFs hand-over, and under FreeRTOS the double-buffered read
+ * prefetch and write-behind.
+ */
+
+#include "sd_usbmsc.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include <string.h>
+
+/* The double-buffered path needs the two tasks, hence the PCD driver. */
+#if defined(USE_FREERTOS) && defined(HAL_PCD_MODULE_ENABLED)
+#define SD_USBMSC_TASKS 1
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#else
+#define SD_USBMSC_TASKS 0
+#endif
+
+#define SD_USBMSC_PDRV 0U
+
+static volatile bool s_attached;
+static SD_UsbMscStats s_stats;
+
+int8_t sd_usbmsc_inquiry[] = {
+    0x00, 0x80, 0x02, 0x02, 36 - 5, 0x00, 0x00, 0x00, /* removable direct-access, SPC-2 */
+    'S', 'D', 'S', 'P', 'I', ' ', ' ', ' ',             /* vendor (8) */
+    'S', 'D', ' ', 'C', 'a', 'r', 'd', ' ',             /* product (16) */
+    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    '1', '.', '0', '0',                                 /* revision (4) */
+};
+
+#if SD_USBMSC_TASKS
+/*
+ * Slots move FREE -> QUEUED (USB task) -> BUSY (I/O task) -> DONE (a read,
+ * until the USB task takes it) or FREE (a write). The I/O task runs queued
+ * slots in the order they were queued, so writes reach the card in order.
+ */
+typedef enum { SLOT_FREE = 0, SLOT_QUEUED, SLOT_BUSY, SLOT_DONE } SD_UsbMscSlotState;
+
+typedef struct {
+    uint8_t buf[SD_USBMSC_BUFFER_BLOCKS * SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    uint32_t sector;
+    uint32_t count;
+    uint32_t seq;
+    bool write;
+    SD_Status status;
+    uint8_t state; // SD_UsbMscSlotState
+} SD_UsbMscSlot;
+
+static SD_UsbMscSlot s_slot[2];
+static uint32_t s_seq;
+static uint32_t s_next_read = UINT32_MAX; // Block after the last read packet
+static volatile bool s_write_failed;      // A write-behind failed; reported once
+static SemaphoreHandle_t s_lock;          // Callbacks against attach/detach
+static SemaphoreHandle_t s_done;          // Given after every slot the I/O task finishes
+static TaskHandle_t s_usb_task;
+static TaskHandle_t s_io_task;
+static PCD_HandleTypeDef *s_hpcd;
+static IRQn_Type s_irq;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+static StaticSemaphore_t s_lock_buffer;
+static StaticSemaphore_t s_done_buffer;
+static StaticTask_t s_usb_task_buffer;
+static StackType_t s_usb_task_stack[SD_USBMSC_TASK_STACK];
+static StaticTask_t s_io_task_buffer;
+static StackType_t s_io_task_stack[SD_USBMSC_TASK_STACK];
+#endif
+
+static uint8_t sd_usbmsc_state(const SD_UsbMscSlot *slot) {
+    return __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+}
+
+static void sd_usbmsc_set_state(SD_UsbMscSlot *slot, uint8_t state) {
+    __atomic_store_n(&slot->state, state, __ATOMIC_RELEASE);
+}
+
+/* Wait until the I/O task is done with slot (DONE or FREE); false on timeout. */
+static bool sd_usbmsc_wait(const SD_UsbMscSlot *slot) {
+    TickType_t start = xTaskGetTickCount();
+    while (sd_usbmsc_state(slot) == SLOT_QUEUED || sd_usbmsc_state(slot) == SLOT_BUSY) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= pdMS_TO_TICKS(SD_USBMSC_TIMEOUT_MS)) {
+            return false;
+        }
+        (void)xSemaphoreTake(s_done, pdMS_TO_TICKS(SD_USBMSC_TIMEOUT_MS) - waited);
+    }
+    return true;
+}
+
+/* Wait for both slots and drop prefetched data; false on timeout. */
+static bool sd_usbmsc_drain(void) {
+    for (uint32_t i = 0; i < 2U; i++) {
+        if (!sd_usbmsc_wait(&s_slot[i])) {
+            return false;
+        }
+        sd_usbmsc_set_state(&s_slot[i], SLOT_FREE);
+    }
+    return true;
+}
+
+static void sd_usbmsc_queue(SD_UsbMscSlot *slot, uint32_t sector, uint32_t count, bool write) {
+    slot->sector = sector;
+    slot->count = count;
+    slot->write = write;
+    slot->seq = ++s_seq;
+    sd_usbmsc_set_state(slot, SLOT_QUEUED);
+    (void)xTaskNotifyGive(s_io_task);
+}
+
+static void sd_usbmsc_io_task(void *argument) {
+    (void)argument;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (;;) {
+            SD_UsbMscSlot *next = NULL;
+            for (uint32_t i = 0; i < 2U; i++) {
+                if (sd_usbmsc_state(&s_slot[i]) == SLOT_QUEUED &&
+                    (next == NULL || (int32_t)(s_slot[i].seq - next->seq) < 0)) {
+                    next = &s_slot[i];
+                }
+            }
+            if (next == NULL) {
+                break;
+            }
+            sd_usbmsc_set_state(next, SLOT_BUSY);
+            SD_Handle_t *sd = SD_DiskHandle(SD_USBMSC_PDRV);
+            if (next->write) {
+                next->status = SD_WriteMultiBlocks(sd, next->buf, next->sector, next->count);
+                if (next->status != SD_OK) {
+                    s_write_failed = true;
+                    s_stats.errors++;
+                }
+            } else {
+                next->status = SD_ReadMultiBlocks(sd, next->buf, next->sector, next->count);
+            }
+            sd_usbmsc_set_state(next, next->write ? SLOT_FREE : SLOT_DONE);
+            (void)xSemaphoreGive(s_done);
+        }
+    }
+}
+
+static void sd_usbmsc_usb_task(void *argument) {
+    (void)argument;
+    for (;;) {
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        HAL_PCD_IRQHandler(s_hpcd);
+        HAL_NVIC_EnableIRQ(s_irq);
+    }
+}
+
+void sd_usbmsc_irq(void) {
+    BaseType_t woken = pdFALSE;
+    HAL_NVIC_DisableIRQ(s_irq);
+    vTaskNotifyGiveFromISR(s_usb_task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+SD_Status sd_usbmsc_start(PCD_HandleTypeDef *hpcd, IRQn_Type irq) {
+    if (s_usb_task != NULL) {
+        return SD_OK;
+    }
+    if (hpcd == NULL) {
+        return SD_PARAM;
+    }
+    s_hpcd = hpcd;
+    s_irq = irq;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
+    s_done = xSemaphoreCreateBinaryStatic(&s_done_buffer);
+    s_io_task = xTaskCreateStatic(sd_usbmsc_io_task, "sd_usbio", SD_USBMSC_TASK_STACK, NULL,
+                                  SD_USBMSC_IO_PRIORITY, s_io_task_stack, &s_io_task_buffer);
+    s_usb_task = xTaskCreateStatic(sd_usbmsc_usb_task, "sd_usbmsc", SD_USBMSC_TASK_STACK, NULL,
+                                   SD_USBMSC_TASK_PRIORITY, s_usb_task_stack, &s_usb_task_buffer);
+#else
+    s_lock = xSemaphoreCreateMutex();
+    s_done = xSemaphoreCreateBinary();
+    if (xTaskCreate(sd_usbmsc_io_task, "sd_usbio", SD_USBMSC_TASK_STACK, NULL,
+                    SD_USBMSC_IO_PRIORITY, &s_io_task) != pdPASS) {
+        s_io_task = NULL;
+    }
+    if (xTaskCreate(sd_usbmsc_usb_task, "sd_usbmsc", SD_USBMSC_TASK_STACK, NULL,
+                    SD_USBMSC_TASK_PRIORITY, &s_usb_task) != pdPASS) {
+        s_usb_task = NULL;
+    }
+#endif
+    if (s_lock == NULL || s_done == NULL || s_io_task == NULL || s_usb_task == NULL) {
+        return SD_ERROR;
+    }
+    return SD_OK;
+}
+
+#define SD_USBMSC_LOCK()   ((s_lock != NULL) ? (void)xSemaphoreTake(s_lock, portMAX_DELAY) : (void)0)
+#define SD_USBMSC_UNLOCK() ((s_lock != NULL) ? (void)xSemaphoreGive(s_lock) : (void)0)
+#else
+#define SD_USBMSC_LOCK()   ((void)0)
+#define SD_USBMSC_UNLOCK() ((void)0)
+#endif
+
+/* Read packet: from the prefetch slot when it holds it, then prefetch the next one. */
+static int8_t sd_usbmsc_do_read(uint8_t *buf, uint32_t sector, uint32_t count) {
+    SD_Handle_t *sd = SD_DiskHandle(SD_USBMSC_PDRV);
+#if SD_USBMSC_TASKS
+    SD_UsbMscSlot *hit = NULL;
+    for (uint32_t i = 0; i < 2U; i++) {
+        SD_UsbMscSlot *slot = &s_slot[i];
+        if (!slot->write && sd_usbmsc_state(slot) != SLOT_FREE && slot->sector == sector &&
+            slot->count == count) {
+            hit = slot;
+        }
+    }
+    bool sequential = (sector == s_next_read);
+    s_next_read = sector + count;
+    if (hit != NULL) {
+        if (!sd_usbmsc_wait(hit)) {
+            return -1;
+        }
+        SD_Status status = hit->status;
+        if (status == SD_OK) {
+            memcpy(buf, hit->buf, count * SD_BLOCK_SIZE);
+        }
+        sd_usbmsc_set_state(hit, SLOT_FREE);
+        if (status != SD_OK) {
+            s_stats.errors++;
+            return -1;
+        }
+        s_stats.prefetch_hits++;
+    } else {
+        /* Queued writes first: the read must see them. */
+        if (!sd_usbmsc_drain()) {
+            return -1;
+        }
+        if (SD_ReadMultiBlocks(sd, buf, sector, count) != SD_OK) {
+            s_stats.errors++;
+            return -1;
+        }
+        s_stats.prefetch_misses++;
+    }
+    s_stats.read_blocks += count;
+    /* Sequential: fetch the next packet while the host takes this one. */
+    if ((hit != NULL || sequential) && count <= SD_USBMSC_BUFFER_BLOCKS &&
+        s_next_read + count <= SD_GetBlockCount(sd)) {
+        for (uint32_t i = 0; i < 2U; i++) {
+            if (sd_usbmsc_state(&s_slot[i]) == SLOT_FREE) {
+                sd_usbmsc_queue(&s_slot[i], s_next_read, count, false);
+                break;
+            }
+        }
+    }
+    return 0;
+#else
+    if (SD_ReadMultiBlocks(sd, buf, sector, count) != SD_OK) {
+        s_stats.errors++;
+        return -1;
+    }
+    s_stats.read_blocks += count;
+    s_stats.prefetch_misses++;
+    return 0;
+#endif
+}
+
+static int8_t sd_usbmsc_do_write(const uint8_t *buf, uint32_t sector, uint32_t count) {
+    SD_Handle_t *sd = SD_DiskHandle(SD_USBMSC_PDRV);
+#if SD_USBMSC_TASKS
+    SD_UsbMscSlot *free_slot = NULL;
+    s_next_read = UINT32_MAX;
+    /* Prefetched sectors may be about to change: drop them. */
+    for (uint32_t i = 0; i < 2U; i++) {
+        SD_UsbMscSlot *slot = &s_slot[i];
+        if (!slot->write) {
+            if (!sd_usbmsc_wait(slot)) {
+                return -1;
+            }
+            sd_usbmsc_set_state(slot, SLOT_FREE);
+        }
+    }
+#if SD_USBMSC_WRITE_BEHIND
+    if (count <= SD_USBMSC_BUFFER_BLOCKS) {
+        /* Both slots busy: wait for the older write. */
+        SD_UsbMscSlot *older =
+            ((int32_t)(s_slot[0].seq - s_slot[1].seq) < 0) ? &s_slot[0] : &s_slot[1];
+        if (sd_usbmsc_state(&s_slot[0]) != SLOT_FREE && sd_usbmsc_state(&s_slot[1]) != SLOT_FREE &&
+            !sd_usbmsc_wait(older)) {
+            return -1;
+        }
+        free_slot = (sd_usbmsc_state(&s_slot[0]) == SLOT_FREE) ? &s_slot[0] : &s_slot[1];
+    }
+#endif
+    if (s_write_failed) {
+        s_write_failed = false;
+        return -1;
+    }
+    if (free_slot != NULL) {
+        memcpy(free_slot->buf, buf, count * SD_BLOCK_SIZE);
+        sd_usbmsc_queue(free_slot, sector, count, true);
+        s_stats.write_behind++;
+        s_stats.write_blocks += count;
+        return 0;
+    }
+    if (!sd_usbmsc_drain()) {
+        return -1;
+    }
+    if (s_write_failed) {
+        s_write_failed = false;
+        return -1;
+    }
+#endif
+    if (SD_WriteMultiBlocks(sd, buf, sector, count) != SD_OK) {
+        s_stats.errors++;
+        return -1;
+    }
+    s_stats.write_blocks += count;
+    return 0;
+}
+
+int sd_usbmsc_attach(void) {
+    SD_Handle_t *sd = SD_DiskHandle(SD_USBMSC_PDRV);
+    if (s_attached) {
+        return FR_OK;
+    }
+    if (!SD_IsInitialized(sd)) {
+        return FR_NOT_READY;
+    }
+    (void)sd_unmount();
+    if (SD_DiskSetExternal(SD_USBMSC_PDRV, true) != SD_OK) {
+        (void)sd_mount();
+        return FR_DISK_ERR;
+    }
+    SD_USBMSC_LOCK();
+#if SD_USBMSC_TASKS
+    s_next_read = UINT32_MAX;
+    s_write_failed = false;
+#endif
+    s_attached = true;
+    SD_USBMSC_UNLOCK();
+    return FR_OK;
+}
+
+int sd_usbmsc_detach(void) {
+    bool failed = false;
+    if (!s_attached) {
+        return FR_OK;
+    }
+    SD_USBMSC_LOCK();
+    s_attached = false; /* from here the callbacks refuse, and the unit reports no medium */
+#if SD_USBMSC_TASKS
+    failed = !sd_usbmsc_drain() || s_write_failed;
+    s_write_failed = false;
+#endif
+    SD_USBMSC_UNLOCK();
+    if (SD_Sync(SD_DiskHandle(SD_USBMSC_PDRV)) != SD_OK) {
+        failed = true;
+    }
+    (void)SD_DiskSetExternal(SD_USBMSC_PDRV, false);
+    int res = sd_mount();
+    return (failed && res == FR_OK) ? FR_DISK_ERR : res;
+}
+
+bool sd_usbmsc_attached(void) {
+    return s_attached;
+}
+
+void sd_usbmsc_get_stats(SD_UsbMscStats *out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
+
+int8_t sd_usbmsc_init(uint8_t lun) {
+    return (lun == 0U) ? 0 : -1;
+}
+
+int8_t sd_usbmsc_get_capacity(uint8_t lun, uint32_t *block_num, uint16_t *block_size) {
+    SD_Handle_t *sd = SD_DiskHandle(SD_USBMSC_PDRV);
+    if (lun != 0U || !s_attached) {
+        return -1;
+    }
+    *block_num = SD_GetBlockCount(sd);
+    *block_size = SD_BLOCK_SIZE;
+    return (*block_num > 0U) ? 0 : -1;
+}
+
+int8_t sd_usbmsc_is_ready(uint8_t lun) {
+    int8_t ret;
+    if (lun != 0U || !s_attached) {
+        return -1;
+    }
+    SD_USBMSC_LOCK();
+    ret = (s_attached && SD_IsCardPresent(SD_DiskHandle(SD_USBMSC_PDRV))) ? 0 : -1;
+#if SD_USBMSC_TASKS
+    if (ret == 0 && s_write_failed) {
+        s_write_failed = false;
+        ret = -1;
+    }
+#endif
+    SD_USBMSC_UNLOCK();
+    return ret;
+}
+
+int8_t sd_usbmsc_is_write_protected(uint8_t lun) {
+    (void)lun;
+    return SD_DiskIsReadOnly(SD_USBMSC_PDRV) ? 1 : 0;
+}
+
+int8_t sd_usbmsc_read(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len) {
+    int8_t ret = -1;
+    if (lun != 0U || buf == NULL || blk_len == 0U) {
+        return -1;
+    }
+    SD_USBMSC_LOCK();
+    if (s_attached) {
+        ret = sd_usbmsc_do_read(buf, blk_addr, blk_len);
+    }
+    SD_USBMSC_UNLOCK();
+    return ret;
+}
+
+int8_t sd_usbmsc_write(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len) {
+    int8_t ret = -1;
+    if (lun != 0U || buf == NULL || blk_len == 0U || SD_DiskIsReadOnly(SD_USBMSC_PDRV)) {
+        return -1;
+    }
+    SD_USBMSC_LOCK();
+    if (s_attached) {
+        ret = sd_usbmsc_do_write(buf, blk_addr, blk_len);
+    }
+    SD_USBMSC_UNLOCK();
+    return ret;
+}
+
+int8_t sd_usbmsc_get_max_lun(void) {
+    return 0;
+}
+
+#if SD_USBMSC_CLASS
+USBD_StorageTypeDef SD_UsbMscStorage = {
+    sd_usbmsc_init,
+    sd_usbmsc_get_capacity,
+    sd_usbmsc_is_ready,
+    sd_usbmsc_is_write_protected,
+    sd_usbmsc_read,
+    sd_usbmsc_write,
+    sd_usbmsc_get_max_lun,
+    sd_usbmsc_inquiry,
+};
+#endif
@@ -0,0 +1,265 @@
+/*
+ * sd_writev.c
+ *
+ * sd_writev writes the head and tail with f_write. For the whole sectors in
+ * between, an f_lseek to the end of each cluster's share allocates the
+ * cluster and leaves it in fp->clust (ff.c's clust2sect then gives the
+ * sector), and the sectors are queued as a run until one is not consecutive.
+ * A run goes out with SD_disk_writev under the volume lock. fp->buf is marked
+ * empty (fp->sect = 0, as f_open leaves it) when it held an overwritten
+ * sector, so its old contents are neither read nor written back.
+ */
+
+#include "sd_writev.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+/* ff_gen_drv.c's table: which driver and lun serve a FatFs drive number. */
+extern Disk_drvTypeDef disk;
+
+/* ff.c's private FIL.flag bits (R0.12c values). */
+#define SD_FA_MODIFIED 0x40U
+#define SD_FA_DIRTY    0x80U
+
+#define SD_WRITEV_SS ((uint32_t)_MAX_SS)
+
+static SD_WritevStats s_stats;
+
+/* Position in the caller's list. */
+typedef struct {
+    const SD_IoVec *iov;
+    uint32_t n;
+    uint32_t seg;
+    uint32_t off;
+} sd_writev_cursor;
+
+static void sd_writev_skip(sd_writev_cursor *c) {
+    while (c->seg < c->n && c->off >= c->iov[c->seg].len) {
+        c->seg++;
+        c->off = 0;
+    }
+}
+
+/* f_write len bytes from the cursor; stops early, with FR_OK, when the volume is full. */
+static FRESULT sd_writev_copy(FIL *fp, sd_writev_cursor *c, uint32_t len, UINT *bw) {
+    while (len > 0U) {
+        sd_writev_skip(c);
+        uint32_t n = c->iov[c->seg].len - c->off;
+        if (n > len) {
+            n = len;
+        }
+        UINT done = 0;
+        FRESULT res = f_write(fp, (const uint8_t *)c->iov[c->seg].base + c->off, (UINT)n, &done);
+        *bw += done;
+        c->off += done;
+        len -= done;
+        if (res != FR_OK || done < n) {
+            return res;
+        }
+    }
+    return FR_OK;
+}
+
+#if (SD_WRITEV_DIRECT == 1)
+
+/* Consecutive sectors from sect, as pieces of the caller's buffers and bounce sectors. */
+typedef struct {
+    uint8_t bounce[SD_WRITEV_BOUNCE][SD_WRITEV_SS] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    SD_IoVec iov[SD_WRITEV_SEGMENTS];
+    uint32_t nseg;
+    uint32_t nbounce;
+    DWORD sect;
+    uint32_t count;
+} sd_writev_run;
+
+/* The checks ff.c's validate makes, less disk_status (f_lseek makes it). */
+static bool sd_writev_qualifies(const FIL *fp) {
+    const FATFS *fs = fp->obj.fs;
+    if (fs == NULL || fs->fs_type == 0U || fp->obj.id != fs->id || fp->err != 0U ||
+        (fp->flag & FA_WRITE) == 0U) {
+        return false;
+    }
+#if _FS_EXFAT
+    if (fs->fs_type == FS_EXFAT) {
+        return false;
+    }
+#endif
+#if _USE_FASTSEEK
+    if (fp->cltbl != NULL) {
+        return false; /* f_lseek cannot extend the file */
+    }
+#endif
+    return disk.drv[fs->drv] == &SD_Driver;
+}
+
+static FRESULT sd_writev_flush(FIL *fp, sd_writev_run *run, UINT *bw) {
+    if (run->count == 0U) {
+        return FR_OK;
+    }
+    FATFS *fs = fp->obj.fs;
+#if _FS_REENTRANT
+    if (!ff_req_grant(fs->sobj)) {
+        return FR_TIMEOUT;
+    }
+#endif
+    DRESULT dres = SD_disk_writev(disk.lun[fs->drv], run->iov, run->nseg, run->sect);
+#if _FS_REENTRANT
+    ff_rel_grant(fs->sobj);
+#endif
+    if (fp->sect - run->sect < run->count) {
+        fp->flag &= (BYTE)~SD_FA_DIRTY; /* superseded */
+        fp->sect = 0;
+    }
+    if (dres != RES_OK) {
+        fp->err = (BYTE)FR_DISK_ERR; /* f_write's ABORT: the file position is past the data */
+        return FR_DISK_ERR;
+    }
+    fp->flag |= SD_FA_MODIFIED;
+    *bw += (UINT)(run->count * SD_WRITEV_SS);
+    s_stats.runs++;
+    s_stats.sectors += run->count;
+    run->sect += run->count;
+    run->count = 0;
+    run->nseg = 0;
+    run->nbounce = 0;
+    return FR_OK;
+}
+
+/* Queue count sectors starting at sect, taking the data from the cursor. */
+static FRESULT sd_writev_queue(FIL *fp, sd_writev_run *run, sd_writev_cursor *c, DWORD sect,
+                               uint32_t count, UINT *bw) {
+    FRESULT res;
+    if (run->count > 0U && sect != run->sect + run->count) {
+        res = sd_writev_flush(fp, run, bw);
+        if (res != FR_OK) {
+            return res;
+        }
+    }
+    if (run->count == 0U) {
+        run->sect = sect;
+    }
+    while (count > 0U) {
+        sd_writev_skip(c);
+        const SD_IoVec *v = &c->iov[c->seg];
+        uint32_t whole = (v->len - c->off) / SD_WRITEV_SS;
+        if (whole > count) {
+            whole = count;
+        }
+        if (run->nseg == SD_WRITEV_SEGMENTS ||
+            (whole == 0U && run->nbounce == SD_WRITEV_BOUNCE)) {
+            res = sd_writev_flush(fp, run, bw);
+            if (res != FR_OK) {
+                return res;
+            }
+        }
+        SD_IoVec *out = &run->iov[run->nseg++];
+        if (whole > 0U) {
+            out->base = (uint8_t *)v->base + c->off;
+            out->len = whole * SD_WRITEV_SS;
+            c->off += out->len;
+        } else {
+            uint8_t *dst = run->bounce[run->nbounce++];
+            for (uint32_t got = 0; got < SD_WRITEV_SS;) {
+                sd_writev_skip(c);
+                uint32_t take = c->iov[c->seg].len - c->off;
+                if (take > SD_WRITEV_SS - got) {
+                    take = SD_WRITEV_SS - got;
+                }
+                memcpy(dst + got, (const uint8_t *)c->iov[c->seg].base + c->off, take);
+                got += take;
+                c->off += take;
+            }
+            out->base = dst;
+            out->len = SD_WRITEV_SS;
+            whole = 1U;
+            s_stats.bounced++;
+        }
+        run->count += whole;
+        count -= whole;
+    }
+    return FR_OK;
+}
+
+/* Whole sectors from fp->fptr (sector-aligned); a full volume ends them early with FR_OK. */
+static FRESULT sd_writev_direct(FIL *fp, sd_writev_cursor *c, uint32_t sectors, UINT *bw) {
+    FATFS *fs = fp->obj.fs;
+    sd_writev_run run;
+    run.nseg = 0;
+    run.nbounce = 0;
+    run.sect = 0;
+    run.count = 0;
+
+    FRESULT res = FR_OK;
+    while (sectors > 0U) {
+        uint32_t csect = (uint32_t)(fp->fptr / SD_WRITEV_SS) & (fs->csize - 1U);
+        uint32_t count = fs->csize - csect;
+        if (count > sectors) {
+            count = sectors;
+        }
+        FSIZE_t to = fp->fptr + (FSIZE_t)count * SD_WRITEV_SS;
+        res = f_lseek(fp, to);
+        if (res != FR_OK || fp->fptr != to) {
+            break; /* no free cluster: f_lseek left the position where it was */
+        }
+        if (fp->clust < 2U || fp->clust >= fs->n_fatent) {
+            res = FR_INT_ERR;
+            break;
+        }
+        DWORD sect = fs->database + (fp->clust - 2U) * fs->csize + csect;
+        res = sd_writev_queue(fp, &run, c, sect, count, bw);
+        if (res != FR_OK) {
+            return res;
+        }
+        sectors -= count;
+    }
+    FRESULT flush = sd_writev_flush(fp, &run, bw);
+    return (res != FR_OK) ? res : flush;
+}
+
+/* Head through f_write, whole sectors direct, tail (or what a full volume left) through f_write. */
+static FRESULT sd_writev_vectored(FIL *fp, sd_writev_cursor *c, uint32_t total, UINT *bw) {
+    uint32_t head = (SD_WRITEV_SS - (uint32_t)(fp->fptr % SD_WRITEV_SS)) % SD_WRITEV_SS;
+    if (head > total) {
+        head = total;
+    }
+    FRESULT res = sd_writev_copy(fp, c, head, bw);
+    if (res != FR_OK || *bw < head) {
+        return res;
+    }
+    res = sd_writev_direct(fp, c, (total - head) / SD_WRITEV_SS, bw);
+    if (res != FR_OK) {
+        return res;
+    }
+    return sd_writev_copy(fp, c, total - *bw, bw);
+}
+
+#endif
+
+FRESULT sd_writev(FIL *fp, const SD_IoVec *iov, uint32_t n, UINT *bw) {
+    if (fp == NULL || bw == NULL || (iov == NULL && n > 0U)) {
+        return FR_INVALID_PARAMETER;
+    }
+    *bw = 0;
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if ((iov[i].base == NULL && iov[i].len > 0U) || total + iov[i].len < total) {
+            return FR_INVALID_PARAMETER;
+        }
+        total += iov[i].len;
+    }
+    sd_writev_cursor c = {iov, n, 0, 0};
+#if (SD_WRITEV_DIRECT == 1)
+    if (sd_writev_qualifies(fp) && total <= 0xFFFFFFFFUL - (uint32_t)fp->fptr) {
+        s_stats.calls++;
+        return sd_writev_vectored(fp, &c, total, bw);
+    }
+#endif
+    s_stats.fallbacks++;
+    return sd_writev_copy(fp, &c, total, bw); /* f_write also clips at 4 GiB */
+}
+
+void sd_writev_get_stats(SD_WritevStats *out) {
+    if (out != NULL) {
+        *out = s_stats;
+    }
+}
@@ -181,6 +181,11 @@ void StartDefaultTask(void const * argument)
       printf("[ERROR] File write failed\r\n");
     }
     
+#ifdef SD_BENCH_FIRMWARE
+    /* sd_bench build: sweep file sizes, buffer sizes and DMA vs polling (SDBENCH lines) */
+    printf("[MAIN] Running benchmark suite...\r\n");
+    sd_benchmark_suite();
+#endif
     printf("[MAIN] Demo complete. LED blink shows system alive.\r\n");
     printf("[MAIN] Main task complete, sleeping...\r\n\r\n");
     sd_unmount();
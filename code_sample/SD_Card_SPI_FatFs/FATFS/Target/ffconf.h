@@ -53,7 +53,7 @@
 /  1: Enable without LF-CRLF conversion.
 /  2: Enable with LF-CRLF conversion. */
 
-#define _USE_FIND 0
+#define _USE_FIND 1
 /* This option switches filtered directory read functions, f_findfirst() and
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
@@ -63,7 +63,7 @@
 #define _USE_FASTSEEK 1
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
-#define _USE_EXPAND 0
+#define _USE_EXPAND 1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 #define _USE_CHMOD 0
@@ -203,7 +203,11 @@
 / System Configurations
 /----------------------------------------------------------------------------*/
 
+#ifdef SD_CONFIG_FS_TINY /* set with the driver profile (CMakePresets.json "low-ram") */
+#define _FS_TINY SD_CONFIG_FS_TINY
+#else
 #define _FS_TINY 0 /* 0:Normal or 1:Tiny */
+#endif
 /* This option switches tiny buffer configuration. (0:Normal or 1:Tiny)
 /  At the tiny configuration, size of file object (FIL) is reduced _MAX_SS bytes.
 /  Instead of private sector buffer eliminated from the file object, common sector
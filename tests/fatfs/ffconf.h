@@ -0,0 +1,81 @@
+/*
+ * tests/fatfs/ffconf.h
+ *
+ * FatFs R0.12c configuration for the host targets that link the real ff.c
+ * against the card emulator. It matches FATFS/Target/ffconf.h of the
+ * product build except where the host has no RTOS or clock: no re-entrancy
+ * (no osMutex), no RTC (fixed timestamps keep images reproducible) and a
+ * static LFN buffer (no ff_memalloc). _FS_TINY, _FS_MINIMIZE, _USE_STRFUNC,
+ * _USE_MKFS and _USE_LABEL follow the driver's SD_CONFIG_PROFILE (_FS_TINY
+ * unless set on the command line); _FS_EXFAT, _USE_EXPAND, _USE_LFN,
+ * _USE_FASTSEEK, the sector size (_MIN_SS/_MAX_SS), _VOLUMES and
+ * _MULTI_PARTITION can be set per target the same way.
+ */
+
+#ifndef _FFCONF
+#define _FFCONF 68300
+
+#include "sd_config.h"
+
+#define _FS_READONLY     0
+#define _FS_MINIMIZE     SD_CONFIG_FS_MINIMIZE
+#define _USE_STRFUNC     SD_CONFIG_FS_STRFUNC
+#define _USE_FIND        1
+#define _USE_MKFS        SD_CONFIG_FS_MKFS
+#ifndef _USE_FASTSEEK
+#define _USE_FASTSEEK    1
+#endif
+#ifndef _USE_EXPAND
+#define _USE_EXPAND      0
+#endif
+#define _USE_CHMOD       0
+#define _USE_LABEL       SD_CONFIG_FS_LABEL
+#define _USE_FORWARD     0
+
+#define _CODE_PAGE       850
+#ifndef _USE_LFN
+#define _USE_LFN         1
+#endif
+#define _MAX_LFN         255
+#define _LFN_UNICODE     0
+#define _STRF_ENCODE     3
+#define _FS_RPATH        0
+
+#ifndef _VOLUMES
+#define _VOLUMES         1
+#endif
+#define _STR_VOLUME_ID   0
+#define _VOLUME_STRS     "RAM", "NAND", "CF", "SD1", "SD2", "USB1", "USB2", "USB3"
+#ifndef _MULTI_PARTITION
+#define _MULTI_PARTITION 0
+#endif
+#ifndef _MIN_SS
+#define _MIN_SS          512
+#endif
+#ifndef _MAX_SS
+#define _MAX_SS          512
+#endif
+#ifndef _USE_TRIM
+#define _USE_TRIM        0
+#endif
+#define _FS_NOFSINFO     0
+
+#ifndef _FS_TINY
+#define _FS_TINY         SD_CONFIG_FS_TINY
+#endif
+#ifndef _FS_EXFAT
+#define _FS_EXFAT        0
+#endif
+#ifndef _FS_NORTC
+#define _FS_NORTC        1
+#endif
+#define _NORTC_MON       1
+#define _NORTC_MDAY      1
+#define _NORTC_YEAR      2026
+#define _FS_LOCK         2
+
+#define _FS_REENTRANT    0
+#define _FS_TIMEOUT      1000
+#define _SYNC_t          void *
+
+#endif /* _FFCONF */
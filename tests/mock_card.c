@@ -0,0 +1,533 @@
+/*
+ * tests/mock_card.c
+ *
+ * SD card emulator (SPI mode) over a disk image file. See mock_card.h.
+ *
+ * Every byte clocked by the driver is one call to card_exchange(): the card
+ * shifts out the next byte of its response buffer (0xFF when it has nothing
+ * to say) while it samples the byte the driver sends. Commands are parsed
+ * from the MOSI stream; data blocks sent after CMD24/CMD25 are collected
+ * and programmed when their CRC has arrived.
+ */
+
+#include "mock_card.h"
+#include "mock_hal.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CARD_BLOCK 512U
+
+typedef enum {
+    CARD_CMD = 0,    // Waiting for a command frame
+    CARD_READ_MULTI, // CMD18: streaming blocks until CMD12
+    CARD_WRITE_TOKEN, // CMD24/CMD25: waiting for a start (or stop) token
+    CARD_WRITE_DATA, // Collecting block + CRC
+} card_state_t;
+
+static FILE *s_img;
+static uint32_t s_blocks;
+static mock_card_stats_t s_stats;
+
+static bool s_selected;
+static bool s_idle = true;
+static bool s_app;
+static card_state_t s_state;
+static bool s_multi;
+static bool s_gap_sent;
+static bool s_streaming;           // s_out holds a CMD18 block
+static uint32_t s_addr;
+static uint32_t s_erase_first;
+static uint32_t s_erase_last;
+static uint8_t s_au_size = 9U;     // SD Status AU_SIZE (9 = 4 MiB)
+static uint8_t s_speed_class = 4U; // SD Status SPEED_CLASS (4 = Class 10)
+static uint8_t s_uhs_grade = 1U;   // UHS_SPEED_GRADE (U1)
+static uint8_t s_video = 30U;      // VIDEO_SPEED_CLASS (V30)
+static bool s_hs_supported = true; // CMD6 offers the high-speed access mode
+static bool s_high_speed;          // Switched to it (until CMD0)
+
+static uint8_t s_frame[6];
+static uint8_t s_frame_len;
+static uint8_t s_out[4U + 1U + CARD_BLOCK + 2U];
+static uint16_t s_out_len;
+static uint16_t s_out_pos;
+static uint8_t s_wbuf[CARD_BLOCK + 2U];
+static uint16_t s_wlen;
+
+/* -----------------------------------------------------------------------
+ * Image
+ * ----------------------------------------------------------------------- */
+
+static bool img_read(uint32_t block, uint8_t *buf) {
+    return fseek(s_img, (long)block * (long)CARD_BLOCK, SEEK_SET) == 0 &&
+           fread(buf, 1, CARD_BLOCK, s_img) == CARD_BLOCK;
+}
+
+static bool img_write(uint32_t block, const uint8_t *buf) {
+    return fseek(s_img, (long)block * (long)CARD_BLOCK, SEEK_SET) == 0 &&
+           fwrite(buf, 1, CARD_BLOCK, s_img) == CARD_BLOCK;
+}
+
+static long img_size(void) {
+    if (fseek(s_img, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    return ftell(s_img);
+}
+
+bool mock_card_open(const char *path, uint32_t blocks) {
+    mock_card_close();
+    s_img = fopen(path, "r+b");
+    if (!s_img) {
+        s_img = fopen(path, "w+b");
+    }
+    if (!s_img) {
+        return false;
+    }
+    long size = img_size();
+    if (size < 0) {
+        mock_card_close();
+        return false;
+    }
+    if (blocks == 0U) {
+        blocks = (uint32_t)(size / (long)CARD_BLOCK);
+    }
+    assert(blocks > 0U && (blocks % 1024U) == 0U && "card size must be a multiple of 512 KiB");
+    if (size < (long)blocks * (long)CARD_BLOCK) {
+        /* Extend with zeros: seek to the last byte and write it. */
+        if (fseek(s_img, (long)blocks * (long)CARD_BLOCK - 1L, SEEK_SET) != 0 ||
+            fputc(0, s_img) == EOF) {
+            mock_card_close();
+            return false;
+        }
+    }
+    s_blocks = blocks;
+    s_au_size = 9U;
+    s_speed_class = 4U;
+    s_uhs_grade = 1U;
+    s_video = 30U;
+    s_hs_supported = true;
+    s_high_speed = false;
+    s_idle = true;
+    s_app = false;
+    s_state = CARD_CMD;
+    s_frame_len = 0;
+    s_out_len = 0;
+    s_out_pos = 0;
+    mock_card_reset_stats();
+    return true;
+}
+
+bool mock_card_create(const char *path, uint32_t blocks) {
+    mock_card_close();
+    FILE *f = fopen(path, "wb"); /* truncate what an earlier run left */
+    if (!f) {
+        return false;
+    }
+    (void)fclose(f);
+    return mock_card_open(path, blocks);
+}
+
+void mock_card_close(void) {
+    if (s_img) {
+        fclose(s_img);
+        s_img = NULL;
+    }
+    s_blocks = 0;
+    mock_hal_set_spi_device(NULL);
+}
+
+uint32_t mock_card_blocks(void) {
+    return s_blocks;
+}
+
+void mock_card_get_stats(mock_card_stats_t *out) {
+    *out = s_stats;
+}
+
+void mock_card_set_au_size(uint8_t au_size) {
+    s_au_size = (uint8_t)(au_size & 0x0FU);
+}
+
+void mock_card_set_speed(uint8_t speed_class, uint8_t uhs_grade, uint8_t video_class) {
+    s_speed_class = speed_class;
+    s_uhs_grade = (uint8_t)(uhs_grade & 0x0FU);
+    s_video = video_class;
+}
+
+void mock_card_set_high_speed(bool supported) {
+    s_hs_supported = supported;
+}
+
+bool mock_card_high_speed(void) {
+    return s_high_speed;
+}
+
+void mock_card_reset_stats(void) {
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+/* -----------------------------------------------------------------------
+ * Registers and CRCs
+ * ----------------------------------------------------------------------- */
+
+static uint8_t crc7(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc <<= 1;
+            if ((byte ^ crc) & 0x80U) {
+                crc ^= 0x09U;
+            }
+            byte <<= 1;
+        }
+    }
+    return crc & 0x7FU;
+}
+
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000U) ? (uint16_t)((crc << 1) ^ 0x1021U) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void make_csd(uint8_t *csd) {
+    uint32_t c_size = s_blocks / 1024U - 1U;
+    static const uint8_t tmpl[16] = {
+        0x40U, 0x0EU, 0x00U, 0x32U, 0x5BU, 0x59U, 0x00U, 0x00U,
+        0x00U, 0x00U, 0x7FU, 0x80U, 0x0AU, 0x40U, 0x00U, 0x00U
+    };
+    memcpy(csd, tmpl, sizeof(tmpl));
+    if (s_high_speed) {
+        csd[3] = 0x5AU; /* TRAN_SPEED: 50 MHz */
+    }
+    csd[7] = (uint8_t)((c_size >> 16) & 0x3FU);
+    csd[8] = (uint8_t)(c_size >> 8);
+    csd[9] = (uint8_t)c_size;
+    csd[15] = (uint8_t)((crc7(csd, 15) << 1) | 0x01U);
+}
+
+static void make_cid(uint8_t *cid) {
+    static const uint8_t tmpl[16] = {
+        0x03U, 'S', 'D', 'E', 'M', 'U', '0', '1',
+        0x10U, 0x12U, 0x34U, 0x56U, 0x78U, 0x01U, 0xA1U, 0x00U
+    };
+    memcpy(cid, tmpl, sizeof(tmpl));
+    cid[15] = (uint8_t)((crc7(cid, 15) << 1) | 0x01U);
+}
+
+/* -----------------------------------------------------------------------
+ * Responses
+ * ----------------------------------------------------------------------- */
+
+static void out_reset(void) {
+    s_out_len = 0;
+    s_out_pos = 0;
+}
+
+static void out_byte(uint8_t b) {
+    assert(s_out_len < sizeof(s_out));
+    s_out[s_out_len++] = b;
+}
+
+/* Start token, payload, CRC16. */
+static void out_block(const uint8_t *data, uint16_t len) {
+    out_byte(0xFEU);
+    for (uint16_t i = 0; i < len; i++) {
+        out_byte(data[i]);
+    }
+    uint16_t crc = crc16(data, len);
+    out_byte((uint8_t)(crc >> 8));
+    out_byte((uint8_t)crc);
+}
+
+static bool out_sector(uint32_t block) {
+    uint8_t buf[CARD_BLOCK];
+    if (block >= s_blocks || !img_read(block, buf)) {
+        s_stats.errors++;
+        out_byte(0x08U); /* data error token: out of range */
+        return false;
+    }
+    out_block(buf, CARD_BLOCK);
+    return true;
+}
+
+static void card_erase(void) {
+    uint8_t zero[CARD_BLOCK];
+    memset(zero, 0, sizeof(zero));
+    for (uint32_t b = s_erase_first; b <= s_erase_last && b < s_blocks; b++) {
+        (void)img_write(b, zero);
+        s_stats.sectors_erased++;
+    }
+}
+
+static void card_execute(uint8_t cmd, uint32_t arg) {
+    bool app = s_app;
+    uint8_t r1 = s_idle ? 0x01U : 0x00U;
+    uint8_t reg[16];
+
+    s_app = false;
+    s_streaming = false;
+    out_reset();
+    out_byte(0xFFU); /* NCR: one byte before R1 */
+
+    if (app) {
+        s_stats.acmd[cmd]++;
+        if (cmd == 41U) {
+            s_idle = false;
+            out_byte(0x00U);
+        } else if (cmd == 23U) {
+            out_byte(r1);
+        } else if (cmd == 13U) {
+            uint8_t status[64];
+            memset(status, 0, sizeof(status));
+            status[8] = s_speed_class;
+            status[10] = (uint8_t)(s_au_size << 4);
+            status[14] = (uint8_t)(s_uhs_grade << 4);
+            status[15] = s_video;
+            out_byte(r1);
+            out_byte(0x00U); /* R2 status byte */
+            out_byte(0xFFU);
+            out_block(status, sizeof(status));
+        } else {
+            s_stats.errors++;
+            out_byte(r1 | 0x04U);
+        }
+        return;
+    }
+
+    s_stats.cmd[cmd]++;
+    switch (cmd) {
+    case 0U:
+        s_idle = true;
+        s_high_speed = false;
+        s_state = CARD_CMD;
+        out_byte(0x01U);
+        break;
+    case 8U:
+        out_byte(r1);
+        out_byte(0x00U);
+        out_byte(0x00U);
+        out_byte((uint8_t)((arg >> 8) & 0x0FU));
+        out_byte((uint8_t)arg);
+        break;
+    case 55U:
+        s_app = true;
+        out_byte(r1);
+        break;
+    case 58U:
+        out_byte(r1);
+        out_byte(0xC0U); /* powered up, CCS = SDHC */
+        out_byte(0xFFU);
+        out_byte(0x80U);
+        out_byte(0x00U);
+        break;
+    case 6U: {
+        /* Switch status: group 1 support bits in bytes 12-13, its selection in byte 16. */
+        uint8_t status[64];
+        uint32_t fn = arg & 0x0FU;
+        memset(status, 0, sizeof(status));
+        status[1] = 100U; /* maximum current, mA */
+        status[13] = s_hs_supported ? 0x03U : 0x01U;
+        status[12] = 0x80U;
+        uint8_t sel = s_high_speed ? 1U : 0U;
+        if (fn == 1U) {
+            sel = s_hs_supported ? 1U : 0x0FU;
+        } else if (fn != 0x0FU && fn != 0U) {
+            sel = 0x0FU;
+        }
+        status[16] = sel;
+        if ((arg & 0x80000000U) != 0U && sel == 1U) {
+            s_high_speed = true;
+        }
+        out_byte(r1);
+        out_byte(0xFFU);
+        out_block(status, sizeof(status));
+        break;
+    }
+    case 9U:
+    case 10U:
+        out_byte(r1);
+        out_byte(0xFFU);
+        if (cmd == 9U) {
+            make_csd(reg);
+        } else {
+            make_cid(reg);
+        }
+        out_block(reg, sizeof(reg));
+        break;
+    case 12U:
+        s_state = CARD_CMD;
+        out_byte(r1);
+        break;
+    case 13U:
+        out_byte(r1);
+        out_byte(0x00U);
+        break;
+    case 16U:
+    case 59U:
+        out_byte(r1);
+        break;
+    case 17U:
+    case 18U:
+    case 24U:
+    case 25U:
+        if (arg >= s_blocks) {
+            s_stats.errors++;
+            out_byte(r1 | 0x40U); /* parameter error */
+            break;
+        }
+        out_byte(r1);
+        s_addr = arg;
+        if (cmd == 17U) {
+            out_byte(0xFFU);
+            if (out_sector(arg)) {
+                s_stats.sectors_read++;
+            }
+        } else if (cmd == 18U) {
+            s_state = CARD_READ_MULTI;
+            s_gap_sent = true;
+        } else {
+            s_state = CARD_WRITE_TOKEN;
+            s_multi = (cmd == 25U);
+        }
+        break;
+    case 32U:
+        s_erase_first = arg;
+        out_byte(r1);
+        break;
+    case 33U:
+        s_erase_last = arg;
+        out_byte(r1);
+        break;
+    case 38U:
+        card_erase();
+        out_byte(r1);
+        break;
+    default:
+        s_stats.errors++;
+        out_byte(r1 | 0x04U); /* illegal command */
+        break;
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * MOSI side
+ * ----------------------------------------------------------------------- */
+
+static void card_parse(uint8_t tx) {
+    if (s_frame_len == 0U && (tx & 0xC0U) != 0x40U) {
+        return;
+    }
+    s_frame[s_frame_len++] = tx;
+    if (s_frame_len == sizeof(s_frame)) {
+        s_frame_len = 0;
+        uint32_t arg = ((uint32_t)s_frame[1] << 24) | ((uint32_t)s_frame[2] << 16) |
+                       ((uint32_t)s_frame[3] << 8) | (uint32_t)s_frame[4];
+        card_execute(s_frame[0] & 0x3FU, arg);
+    }
+}
+
+static void card_block_received(void) {
+    uint8_t resp = 0x05U; /* accepted */
+    if (s_addr >= s_blocks || !img_write(s_addr, s_wbuf)) {
+        s_stats.errors++;
+        resp = 0x0DU; /* write error */
+    } else {
+        s_stats.sectors_written++;
+    }
+    out_reset();
+    out_byte(resp);
+    s_addr++;
+    s_state = s_multi ? CARD_WRITE_TOKEN : CARD_CMD;
+}
+
+static void card_sample(uint8_t tx) {
+    switch (s_state) {
+    case CARD_WRITE_TOKEN:
+        if (tx == 0xFEU || tx == 0xFCU) {
+            s_state = CARD_WRITE_DATA;
+            s_wlen = 0;
+        } else if (tx == 0xFDU && s_multi) {
+            s_state = CARD_CMD;
+        } else {
+            card_parse(tx);
+        }
+        break;
+    case CARD_WRITE_DATA:
+        s_wbuf[s_wlen++] = tx;
+        if (s_wlen == sizeof(s_wbuf)) {
+            card_block_received();
+        }
+        break;
+    default:
+        card_parse(tx);
+        break;
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * SPI device
+ * ----------------------------------------------------------------------- */
+
+/*
+ * CMD18 blocks count as read once their CRC has been shifted out: the card
+ * starts streaming the block after the last one before it sees CMD12.
+ */
+static uint8_t card_next(void) {
+    if (s_out_pos < s_out_len) {
+        uint8_t b = s_out[s_out_pos++];
+        if (s_streaming && s_out_pos == s_out_len) {
+            s_streaming = false;
+            s_stats.sectors_read++;
+        }
+        return b;
+    }
+    if (s_state == CARD_READ_MULTI) {
+        /* One idle byte between blocks, then the next block. */
+        if (!s_gap_sent) {
+            s_gap_sent = true;
+            return 0xFFU;
+        }
+        s_gap_sent = false;
+        out_reset();
+        if (out_sector(s_addr++)) {
+            s_streaming = true;
+        } else {
+            s_state = CARD_CMD;
+        }
+        return s_out[s_out_pos++];
+    }
+    return 0xFFU;
+}
+
+static uint8_t card_exchange(uint8_t tx, void *ctx) {
+    (void)ctx;
+    if (!s_selected || !s_img) {
+        return 0xFFU;
+    }
+    uint8_t rx = card_next();
+    card_sample(tx);
+    return rx;
+}
+
+static void card_select(bool selected, void *ctx) {
+    (void)ctx;
+    s_selected = selected;
+    if (!selected) {
+        s_frame_len = 0;
+    }
+}
+
+static const mock_hal_spi_device_t s_device = { card_exchange, card_select, NULL };
+
+void mock_card_attach(void) {
+    s_selected = false;
+    mock_hal_set_spi_device(&s_device);
+}
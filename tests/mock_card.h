@@ -0,0 +1,70 @@
+/*
+ * tests/mock_card.h
+ *
+ * Byte-level SD card emulator in SPI mode, backed by a disk image file.
+ * Attached to the HAL mock (mock_hal_set_spi_device), it answers the
+ * driver's traffic the way a card would, so the real ff.c, sd_diskio_spi.c
+ * and sd_spi.c run end to end on the host.
+ *
+ * Supported: CMD0/6/8/9/10/12/13/16/17/18/24/25/32/33/38/55/58/59 and
+ * ACMD13/23/41. The card is SDHC (block addressing, CSD v2, OCR with CCS);
+ * other commands get R1 "illegal command". Erased blocks read as 0x00.
+ * Counters per command and per sector let tests check how much I/O a
+ * FatFs call costs. Timing is left to the mock_hal simulator.
+ */
+
+#ifndef __MOCK_CARD_H__
+#define __MOCK_CARD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t cmd[64];         // Commands received, by index
+    uint32_t acmd[64];        // Application commands (after CMD55), by index
+    uint32_t sectors_read;    // Blocks sent by CMD17/CMD18
+    uint32_t sectors_written; // Blocks programmed by CMD24/CMD25
+    uint32_t sectors_erased;  // Blocks cleared by CMD38
+    uint32_t errors;          // Illegal commands, out-of-range addresses, rejected blocks
+} mock_card_stats_t;
+
+/*
+ * Open the image at path as a card of blocks 512-byte blocks (a multiple of
+ * 1024, the CSD v2 capacity unit). An existing image of at least that size is
+ * reused as is; otherwise the file is created (or extended) zero-filled.
+ * blocks = 0 takes the size of an existing image. Returns false on I/O error.
+ */
+bool mock_card_open(const char *path, uint32_t blocks);
+
+/* As mock_card_open, on a new zero-filled image: nothing from an earlier run survives. */
+bool mock_card_create(const char *path, uint32_t blocks);
+
+/* Flush and close the image; detaches the card from the HAL mock. */
+void mock_card_close(void);
+
+/* Route the HAL mock's SPI traffic and chip select to the card. Call after mock_hal_reset. */
+void mock_card_attach(void);
+
+uint32_t mock_card_blocks(void);
+
+void mock_card_get_stats(mock_card_stats_t *out);
+void mock_card_reset_stats(void);
+
+/* AU_SIZE code reported by ACMD13 (default 9 = 4 MiB; 0 = not defined). Reset by open. */
+void mock_card_set_au_size(uint8_t au_size);
+
+/*
+ * Performance fields reported by ACMD13: SPEED_CLASS code (0..4, 4 = Class
+ * 10), UHS_SPEED_GRADE (0, 1, 3) and VIDEO_SPEED_CLASS (0..90). Default
+ * Class 10, U1, V30; reset by open.
+ */
+void mock_card_set_speed(uint8_t speed_class, uint8_t uhs_grade, uint8_t video_class);
+
+/*
+ * Whether CMD6 offers high speed (group 1, function 1; default true, reset by
+ * open). Once switched, the CSD reports TRAN_SPEED 50 MHz until CMD0.
+ */
+void mock_card_set_high_speed(bool supported);
+bool mock_card_high_speed(void);
+
+#endif /* __MOCK_CARD_H__ */
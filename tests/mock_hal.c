@@ -19,6 +19,39 @@ static uint8_t           s_queue[SPI_QUEUE_SIZE];
 static int               s_head  = 0;
 static int               s_count = 0;
 static HAL_StatusTypeDef s_spi_ret = HAL_OK;
+static uint8_t           s_idle_byte = 0xFFU;
+static bool              s_dma_enabled = false;
+
+typedef struct {
+    const DMA_HandleTypeDef *hdma;
+    uint32_t cr;
+    uint8_t *mem;
+    uint16_t len;
+    bool armed;
+} mock_desc_stream_t;
+
+static mock_desc_stream_t s_desc[2];
+
+static uint8_t           s_tx_log[SPI_QUEUE_SIZE];
+static size_t            s_tx_len = 0;
+
+static HAL_StatusTypeDef s_uart_ret = HAL_OK;
+static uint8_t           s_uart_log[SPI_QUEUE_SIZE];
+static size_t            s_uart_len = 0;
+
+static const mock_hal_spi_device_t *s_dev = NULL;
+
+static void (*s_bus_enter)(void) = NULL;
+static void (*s_bus_leave)(void) = NULL;
+
+#define BUS_ENTER()                                                                                \
+    do {                                                                                           \
+        if (s_bus_enter) s_bus_enter();                                                            \
+    } while (0)
+#define BUS_LEAVE()                                                                                \
+    do {                                                                                           \
+        if (s_bus_leave) s_bus_leave();                                                            \
+    } while (0)
 
 /* -----------------------------------------------------------------------
  * GPIO / Tick
@@ -27,6 +60,299 @@ static HAL_StatusTypeDef s_spi_ret = HAL_OK;
 static GPIO_PinState s_gpio_read = GPIO_PIN_RESET;
 static uint32_t      s_tick      = 0;
 
+/* -----------------------------------------------------------------------
+ * Cycle counter
+ * ----------------------------------------------------------------------- */
+
+DWT_Type       mock_dwt;
+CoreDebug_Type mock_core_debug;
+uint32_t       SystemCoreClock = MOCK_HAL_CORE_CLOCK;
+
+static uint32_t s_cycles_per_byte = 0;
+static bool     s_sim_on = false;
+
+static void advance_cycles(uint32_t bytes) {
+    if (!s_sim_on) {
+        mock_dwt.CYCCNT += bytes * s_cycles_per_byte;
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Timing simulator
+ * ----------------------------------------------------------------------- */
+
+static mock_hal_sim_config_t s_sim;
+static mock_hal_sim_report_t s_rep;
+static uint64_t s_now_ns;          // Simulated clock
+static uint64_t s_byte_ns;         // 8 SCK periods, rounded to ns
+static uint32_t s_rand;
+static uint8_t  s_cmd;             // Last command index framed by the driver
+static bool     s_await_r1;        // Next byte with bit 7 clear is s_cmd's R1
+static bool     s_await_resp;      // Next byte delivered is a write data response
+static bool     s_token_armed;     // Holding the data token until s_token_ns
+static uint64_t s_token_ns;
+static uint32_t s_block_left;      // CMD18: block + CRC bytes after the token, then a latency
+static uint64_t s_busy_until_ns;
+static uint32_t s_fault_rand;
+static bool     s_fault_mute;      // Token dropped: DO high until the next command frame
+static bool     s_fault_flip;      // Flip the next data byte of the block being read
+static uint32_t s_fault_block_left; // Data and CRC bytes left in the block being read
+static uint32_t s_wr_block;        // Block the next CMD24/25 data block lands in
+static uint32_t s_au_open;         // AU last written + 1 (0 = none yet)
+static uint64_t s_au_extra_ns;     // Busy added to the next data response (AU switch)
+
+static void sim_advance(uint64_t ns) {
+    uint64_t before = s_now_ns * (MOCK_HAL_CORE_CLOCK / 1000000U) / 1000U;
+    s_now_ns += ns;
+    uint64_t after = s_now_ns * (MOCK_HAL_CORE_CLOCK / 1000000U) / 1000U;
+    mock_dwt.CYCCNT += (uint32_t)(after - before);
+    s_rep.elapsed_ns = s_now_ns;
+}
+
+/* One byte on the wire: returns its bus time. */
+static uint64_t sim_clock_byte(void) {
+    sim_advance(s_byte_ns + s_sim.byte_gap_ns);
+    s_rep.bus_ns += s_byte_ns;
+    s_rep.bytes++;
+    return s_byte_ns;
+}
+
+static void sim_call(void) {
+    sim_advance(s_sim.call_overhead_ns);
+    s_rep.calls++;
+}
+
+static uint32_t sim_rand(void) {
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+/* One draw from the fault stream: true with probability permille/1000. */
+static bool fault_roll(uint32_t permille) {
+    if (permille == 0U) {
+        return false;
+    }
+    s_fault_rand ^= s_fault_rand << 13;
+    s_fault_rand ^= s_fault_rand >> 17;
+    s_fault_rand ^= s_fault_rand << 5;
+    return (s_fault_rand % 1000U) < permille;
+}
+
+/* Polled call whose end-of-transfer wait hangs: charge the stall and report it. */
+static bool fault_timeout(void) {
+    if (!s_sim_on || !fault_roll(s_sim.faults.timeout_permille)) {
+        return false;
+    }
+    sim_advance((uint64_t)s_sim.faults.timeout_us * 1000U);
+    s_rep.timeouts++;
+    return true;
+}
+
+static uint64_t sim_draw(const mock_hal_sim_dist_t *d) {
+    uint32_t tail = sim_rand() % 1000U;
+    uint32_t r = sim_rand();
+    if (tail < d->tail_permille) {
+        return (uint64_t)d->tail_us * 1000U;
+    }
+    uint32_t span = (d->max_us > d->min_us) ? (d->max_us - d->min_us) : 0U;
+    return ((uint64_t)d->min_us + (span ? r % (span + 1U) : 0U)) * 1000U;
+}
+
+static void sim_arm_token(void) {
+    uint64_t ns = sim_draw(&s_sim.read_latency);
+    s_token_armed = true;
+    s_token_ns = s_now_ns + ns;
+    s_rep.latency_ns += ns;
+    s_rep.tokens++;
+}
+
+static void sim_arm_busy(const mock_hal_sim_dist_t *d, uint32_t *counter) {
+    uint64_t ns = sim_draw(d);
+    s_busy_until_ns = s_now_ns + ns;
+    s_rep.card_busy_ns += ns;
+    (*counter)++;
+}
+
+/* Follow the driver's side of the protocol: command frames, data blocks, stop tokens. */
+static void sim_observe_tx(const uint8_t *pData, uint16_t Size) {
+    if (Size >= 7U && pData[0] == 0xFFU && (pData[1] & 0xC0U) == 0x40U) {
+        s_cmd = pData[1] & 0x3FU;
+        s_await_r1 = true;
+        s_await_resp = false;
+        s_token_armed = false;
+        s_block_left = 0;
+        s_fault_mute = false;
+        s_fault_flip = false;
+        s_fault_block_left = 0;
+        s_wr_block = ((uint32_t)pData[2] << 24) | ((uint32_t)pData[3] << 16) |
+                     ((uint32_t)pData[4] << 8) | pData[5];
+    } else if (Size >= 512U && (s_cmd == 24U || s_cmd == 25U)) {
+        s_await_resp = true;
+        if (s_sim.au_blocks != 0U) {
+            uint32_t au = s_wr_block / s_sim.au_blocks + 1U;
+            if (au != s_au_open) {
+                s_au_open = au;
+                s_au_extra_ns = (uint64_t)s_sim.au_open_us * 1000U;
+            }
+            s_wr_block++;
+        }
+    } else if (Size == 1U && pData[0] == 0xFDU && s_cmd == 25U && !s_await_resp) {
+        /* Not while the response is due: that 0xFD is a CRC byte. */
+        sim_arm_busy(&s_sim.program_busy, &s_rep.programs);
+    }
+}
+
+/* Card busy and read latency decide DO before the queue does. */
+static bool sim_fill(uint8_t *out, uint64_t bus_ns) {
+    if (s_now_ns < s_busy_until_ns) {
+        *out = 0x00U;
+        s_rep.busy_poll_ns += bus_ns;
+        return true;
+    }
+    if (s_token_armed) {
+        if (s_now_ns < s_token_ns) {
+            *out = 0xFFU;
+            s_rep.token_poll_ns += bus_ns;
+            return true;
+        }
+        s_token_armed = false;
+    }
+    return false;
+}
+
+/* Faults applied to a byte from the queue or the device, before the simulator sees it. */
+static uint8_t fault_rx(uint8_t b) {
+    if (s_fault_mute) {
+        return 0xFFU;
+    }
+    if (s_fault_block_left > 0U) {
+        s_fault_block_left--;
+        if (s_fault_flip) {
+            s_fault_flip = false;
+            b ^= 0x01U;
+        }
+        return b;
+    }
+    if (s_await_resp) {
+        if ((b & 0x1FU) == 0x05U && fault_roll(s_sim.faults.write_crc_permille)) {
+            s_rep.write_crc_faults++;
+            return (uint8_t)((b & 0xE0U) | 0x0BU);
+        }
+        return b;
+    }
+    if (b == 0xFEU && !s_await_r1 && (s_cmd == 17U || s_cmd == 18U)) {
+        if (fault_roll(s_sim.faults.token_drop_permille)) {
+            s_fault_mute = true;
+            s_rep.dropped_tokens++;
+            return 0xFFU;
+        }
+        s_fault_block_left = 512U + 2U;
+        if (fault_roll(s_sim.faults.read_crc_permille)) {
+            s_fault_flip = true;
+            s_rep.read_crc_faults++;
+        }
+    }
+    return b;
+}
+
+/* Card-side state changes caused by the byte just delivered from the queue. */
+static void sim_observe_rx(uint8_t b) {
+    if (s_await_resp) {
+        s_await_resp = false;
+        if ((b & 0x1FU) == 0x05U) {
+            sim_arm_busy(&s_sim.program_busy, &s_rep.programs);
+            s_busy_until_ns += s_au_extra_ns;
+            s_rep.card_busy_ns += s_au_extra_ns;
+        }
+        s_au_extra_ns = 0;
+    } else if (s_await_r1 && (b & 0x80U) == 0U) {
+        s_await_r1 = false;
+        if (b == 0x00U) {
+            if (s_cmd == 9U || s_cmd == 10U || s_cmd == 17U || s_cmd == 18U) {
+                sim_arm_token();
+            } else if (s_cmd == 38U) {
+                sim_arm_busy(&s_sim.erase_busy, &s_rep.erases);
+            }
+        }
+    } else if (s_block_left > 0U) {
+        if (--s_block_left == 0U) {
+            sim_arm_token();
+        }
+    } else if (b == 0xFEU && s_cmd == 18U && !s_await_r1) {
+        s_block_left = 512U + 2U; /* block, CRC */
+    }
+}
+
+void mock_hal_sim_defaults(mock_hal_sim_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->spi_hz = 25000000U;
+    cfg->byte_gap_ns = 40U;
+    cfg->call_overhead_ns = 1000U;
+    cfg->read_latency = (mock_hal_sim_dist_t){ 100U, 400U, 2000U, 10U };
+    cfg->program_busy = (mock_hal_sim_dist_t){ 250U, 750U, 50000U, 10U };
+    cfg->erase_busy   = (mock_hal_sim_dist_t){ 5000U, 20000U, 0U, 0U };
+    cfg->seed = 1U;
+}
+
+void mock_hal_sim_enable(const mock_hal_sim_config_t *cfg) {
+    memset(&s_rep, 0, sizeof(s_rep));
+    s_now_ns = 0;
+    s_cmd = 0xFFU;
+    s_await_r1 = false;
+    s_await_resp = false;
+    s_token_armed = false;
+    s_block_left = 0;
+    s_busy_until_ns = 0;
+    s_fault_mute = false;
+    s_fault_flip = false;
+    s_fault_block_left = 0;
+    s_au_open = 0;
+    s_au_extra_ns = 0;
+    s_sim_on = (cfg != NULL);
+    if (cfg == NULL) {
+        return;
+    }
+    s_sim = *cfg;
+    assert(s_sim.spi_hz > 0U && "sim needs an SPI clock");
+    s_byte_ns = (8000000000ULL + s_sim.spi_hz / 2U) / s_sim.spi_hz;
+    s_rand = (s_sim.seed != 0U) ? s_sim.seed : 1U;
+    s_fault_rand = (s_sim.faults.seed != 0U) ? s_sim.faults.seed : 1U;
+}
+
+void mock_hal_sim_report(mock_hal_sim_report_t *out) {
+    *out = s_rep;
+}
+
+uint32_t mock_hal_sim_utilization_permille(const mock_hal_sim_report_t *rep) {
+    if (rep->elapsed_ns == 0U) {
+        return 0;
+    }
+    return (uint32_t)(rep->bus_ns * 1000U / rep->elapsed_ns);
+}
+
+uint32_t mock_hal_sim_kib_per_s(const mock_hal_sim_report_t *rep, uint64_t payload_bytes) {
+    if (rep->elapsed_ns == 0U) {
+        return 0;
+    }
+    return (uint32_t)(payload_bytes * 1000000000ULL / 1024U / rep->elapsed_ns);
+}
+
+void mock_hal_sim_print(const char *label, uint64_t payload_bytes) {
+    uint32_t util = mock_hal_sim_utilization_permille(&s_rep);
+    uint32_t poll = (s_rep.bus_ns == 0U) ? 0U
+        : (uint32_t)((s_rep.busy_poll_ns + s_rep.token_poll_ns) * 1000U / s_rep.bus_ns);
+    printf("%s: %llu us, %u KiB/s, bus %u.%u%% (polling %u.%u%% of it), "
+           "%llu bytes / %u calls, busy %llu us, latency %llu us\n",
+           label, (unsigned long long)(s_rep.elapsed_ns / 1000U),
+           mock_hal_sim_kib_per_s(&s_rep, payload_bytes),
+           util / 10U, util % 10U, poll / 10U, poll % 10U,
+           (unsigned long long)s_rep.bytes, s_rep.calls,
+           (unsigned long long)(s_rep.card_busy_ns / 1000U),
+           (unsigned long long)(s_rep.latency_ns / 1000U));
+}
+
 /* -----------------------------------------------------------------------
  * Counters
  * ----------------------------------------------------------------------- */
@@ -34,6 +360,31 @@ static uint32_t      s_tick      = 0;
 int mock_hal_transmit_calls    = 0;
 int mock_hal_transmitrec_calls = 0;
 int mock_hal_gpio_write_calls  = 0;
+int mock_hal_gpio_read_calls   = 0;
+int mock_hal_gpio_toggle_calls = 0;
+int mock_hal_spi_init_calls    = 0;
+int mock_hal_spi_deinit_calls  = 0;
+int mock_hal_dma_rx_calls      = 0;
+int mock_hal_dma_tx_calls      = 0;
+int mock_hal_it_rx_calls       = 0;
+int mock_hal_it_tx_calls       = 0;
+int mock_hal_ll_bytes          = 0;
+int mock_hal_dma_init_calls    = 0;
+int mock_hal_frame16_calls     = 0;
+int mock_hal_dma_packed_streams = 0;
+int mock_hal_dma_fixed_tx_calls = 0;
+int mock_hal_dma_m2m_starts    = 0;
+int mock_hal_desc_captures     = 0;
+int mock_hal_desc_runs         = 0;
+int mock_hal_dcache_cleans     = 0;
+int mock_hal_dcache_invalidates = 0;
+int mock_hal_dcache_unaligned  = 0;
+int mock_hal_rx_busy_tx        = 0;
+int mock_hal_uart_tx_calls     = 0;
+
+static bool s_ll_pending;
+static bool s_ll_io; /* register access: no per-call HAL overhead in the simulator */
+static uint8_t s_ll_tx;
 
 /* -----------------------------------------------------------------------
  * Control API
@@ -44,11 +395,46 @@ void mock_hal_reset(void) {
     s_head     = 0;
     s_count    = 0;
     s_spi_ret  = HAL_OK;
+    s_idle_byte = 0xFFU;
+    s_dma_enabled = false;
+    s_tx_len   = 0;
+    s_dev      = NULL;
+    s_bus_enter = NULL;
+    s_bus_leave = NULL;
     s_gpio_read = GPIO_PIN_RESET;
     s_tick     = 0;
+    s_cycles_per_byte = 0;
+    mock_hal_sim_enable(NULL);
+    memset(&mock_dwt, 0, sizeof(mock_dwt));
+    memset(&mock_core_debug, 0, sizeof(mock_core_debug));
     mock_hal_transmit_calls    = 0;
     mock_hal_transmitrec_calls = 0;
     mock_hal_gpio_write_calls  = 0;
+    mock_hal_gpio_read_calls   = 0;
+    mock_hal_gpio_toggle_calls = 0;
+    mock_hal_spi_init_calls    = 0;
+    mock_hal_spi_deinit_calls  = 0;
+    mock_hal_dma_rx_calls      = 0;
+    mock_hal_dma_tx_calls      = 0;
+    mock_hal_it_rx_calls       = 0;
+    mock_hal_it_tx_calls       = 0;
+    mock_hal_ll_bytes          = 0;
+    mock_hal_dma_init_calls    = 0;
+    mock_hal_dma_m2m_starts    = 0;
+    mock_hal_desc_captures     = 0;
+    mock_hal_desc_runs         = 0;
+    mock_hal_dcache_cleans     = 0;
+    mock_hal_dcache_invalidates = 0;
+    mock_hal_dcache_unaligned  = 0;
+    memset(s_desc, 0, sizeof(s_desc));
+    mock_hal_frame16_calls     = 0;
+    mock_hal_dma_packed_streams = 0;
+    mock_hal_dma_fixed_tx_calls = 0;
+    mock_hal_rx_busy_tx        = 0;
+    mock_hal_uart_tx_calls     = 0;
+    s_uart_ret                 = HAL_OK;
+    s_uart_len                 = 0;
+    s_ll_pending               = false;
 }
 
 void mock_hal_push_byte(uint8_t b) {
@@ -64,6 +450,14 @@ void mock_hal_push_bytes(const uint8_t *data, size_t len) {
     }
 }
 
+void mock_hal_set_dma_enabled(bool enabled) {
+    s_dma_enabled = enabled;
+}
+
+void mock_hal_set_idle_byte(uint8_t b) {
+    s_idle_byte = b;
+}
+
 int mock_hal_queue_depth(void) {
     return s_count;
 }
@@ -72,60 +466,469 @@ void mock_hal_set_spi_return(HAL_StatusTypeDef status) {
     s_spi_ret = status;
 }
 
+void mock_hal_set_spi_device(const mock_hal_spi_device_t *dev) {
+    s_dev = dev;
+}
+
+void mock_hal_set_bus_hooks(void (*enter)(void), void (*leave)(void)) {
+    s_bus_enter = enter;
+    s_bus_leave = leave;
+}
+
+const uint8_t *mock_hal_tx_log(size_t *len) {
+    if (len) *len = s_tx_len;
+    return s_tx_log;
+}
+
+void mock_hal_set_uart_return(HAL_StatusTypeDef status) {
+    s_uart_ret = status;
+}
+
+const uint8_t *mock_hal_uart_log(size_t *len) {
+    if (len) *len = s_uart_len;
+    return s_uart_log;
+}
+
 void mock_hal_set_gpio_read(GPIO_PinState state) {
     s_gpio_read = state;
 }
 
+/* With the simulator on, the tick is s_tick plus the simulated milliseconds. */
 void mock_hal_set_tick(uint32_t tick) {
-    s_tick = tick;
+    s_tick = s_sim_on ? tick - (uint32_t)(s_now_ns / 1000000U) : tick;
 }
 
 uint32_t mock_hal_get_tick(void) {
-    return s_tick;
+    return HAL_GetTick();
+}
+
+void mock_hal_set_cycles_per_byte(uint32_t cycles) {
+    s_cycles_per_byte = cycles;
 }
 
 /* -----------------------------------------------------------------------
  * HAL function stubs
  * ----------------------------------------------------------------------- */
 
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+    mock_hal_spi_init_calls++;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma) {
+    (void)hdma;
+    mock_hal_dma_init_calls++;
+    return HAL_OK;
+}
+
+/* D-cache maintenance hooks (MOCK_DCACHE builds); the range must be whole lines. */
+static void mock_dcache_check(uintptr_t addr, int32_t size) {
+    if ((addr % 32U) != 0U || size <= 0 || ((uint32_t)size % 32U) != 0U) {
+        mock_hal_dcache_unaligned++;
+    }
+}
+
+void mock_hal_dcache_clean(uintptr_t addr, int32_t size) {
+    mock_dcache_check(addr, size);
+    mock_hal_dcache_cleans++;
+}
+
+void mock_hal_dcache_invalidate(uintptr_t addr, int32_t size) {
+    mock_dcache_check(addr, size);
+    mock_hal_dcache_invalidates++;
+}
+
+/*
+ * A host pointer does not fit the HAL's 32-bit addresses, so a started copy
+ * never moves data: the poll times out and the caller's CPU fallback copies.
+ */
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef *hdma, uint32_t SrcAddress, uint32_t DstAddress,
+                                uint32_t DataLength) {
+    (void)hdma;
+    (void)SrcAddress;
+    (void)DstAddress;
+    (void)DataLength;
+    mock_hal_dma_m2m_starts++;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_PollForTransfer(DMA_HandleTypeDef *hdma,
+                                          HAL_DMA_LevelCompleteTypeDef CompleteLevel,
+                                          uint32_t Timeout) {
+    (void)hdma;
+    (void)CompleteLevel;
+    (void)Timeout;
+    return HAL_TIMEOUT;
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma) {
+    (void)hdma;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_DeInit(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+    mock_hal_spi_deinit_calls++;
+    return HAL_OK;
+}
+
+static void log_tx(const uint8_t *pData, uint16_t Size) {
+    for (uint16_t i = 0; i < Size && s_tx_len < SPI_QUEUE_SIZE; i++) {
+        s_tx_log[s_tx_len++] = pData[i];
+    }
+    if (s_dev) {
+        for (uint16_t i = 0; i < Size; i++) {
+            (void)s_dev->exchange(pData[i], s_dev->ctx);
+        }
+    }
+    if (s_sim_on) {
+        if (!s_ll_io) {
+            sim_call();
+        }
+        for (uint16_t i = 0; i < Size; i++) {
+            (void)sim_clock_byte();
+        }
+        sim_observe_tx(pData, Size);
+    }
+}
+
+static void pop_rx(const uint8_t *pTxData, uint8_t *pRxData, uint16_t Size) {
+    if (s_sim_on && !s_ll_io) {
+        sim_call();
+    }
+    for (int i = 0; i < (int)Size; i++) {
+        if (pTxData && pTxData[i] != 0xFFU) {
+            mock_hal_rx_busy_tx++;
+        }
+        if (s_sim_on && sim_fill(&pRxData[i], sim_clock_byte())) {
+            continue;
+        }
+        if (s_dev) {
+            pRxData[i] = s_dev->exchange(pTxData ? pTxData[i] : 0xFFU, s_dev->ctx);
+        } else if (s_count > 0) {
+            pRxData[i] = s_queue[s_head];
+            s_head = (s_head + 1) % SPI_QUEUE_SIZE;
+            s_count--;
+        } else {
+            pRxData[i] = s_idle_byte; /* idle line default */
+        }
+        if (s_sim_on) {
+            pRxData[i] = fault_rx(pRxData[i]);
+            sim_observe_rx(pRxData[i]);
+        }
+    }
+}
+
 HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi,
                                     uint8_t *pData, uint16_t Size,
                                     uint32_t Timeout) {
-    (void)hspi; (void)pData; (void)Size; (void)Timeout;
+    (void)Timeout;
     mock_hal_transmit_calls++;
-    return s_spi_ret;
+    if (hspi->Init.DataSize != SPI_DATASIZE_8BIT) {
+        return HAL_ERROR;
+    }
+    BUS_ENTER();
+    log_tx(pData, Size);
+    advance_cycles(Size);
+    BUS_LEAVE();
+    return fault_timeout() ? HAL_TIMEOUT : s_spi_ret;
 }
 
 HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi,
                                            uint8_t *pTxData, uint8_t *pRxData,
                                            uint16_t Size, uint32_t Timeout) {
-    (void)hspi; (void)pTxData; (void)Timeout;
+    (void)Timeout;
     mock_hal_transmitrec_calls++;
+    if (hspi->Init.DataSize != SPI_DATASIZE_8BIT) {
+        return HAL_ERROR;
+    }
+    BUS_ENTER();
+    pop_rx(pTxData, pRxData, Size);
+    advance_cycles(Size);
+    BUS_LEAVE();
+    return fault_timeout() ? HAL_TIMEOUT : s_spi_ret;
+}
 
-    for (int i = 0; i < (int)Size; i++) {
-        if (s_count > 0) {
-            pRxData[i] = s_queue[s_head];
-            s_head = (s_head + 1) % SPI_QUEUE_SIZE;
-            s_count--;
-        } else {
-            pRxData[i] = 0xFFU; /* idle line default */
-        }
+/*
+ * 16-bit frames: Size counts half-words, each shifted MSB first, so the byte
+ * at the odd address of a pair is on the wire first.
+ */
+static uint8_t s_wire_tx[2 * SPI_QUEUE_SIZE];
+static uint8_t s_wire_rx[2 * SPI_QUEUE_SIZE];
+
+static bool frame16(const SPI_HandleTypeDef *hspi) {
+    return hspi->Init.DataSize == SPI_DATASIZE_16BIT;
+}
+
+static uint32_t mem_width(uint32_t align) {
+    return (align == DMA_MDATAALIGN_WORD) ? 4U : (align == DMA_MDATAALIGN_HALFWORD) ? 2U : 1U;
+}
+
+/*
+ * Stream checks the F4 DMA enforces (or silently gets wrong): the peripheral
+ * width must match the SPI frame; a memory width other than the peripheral's
+ * and memory bursts need FIFO mode; packed memory beats need aligned
+ * addresses, and the length must fill whole bursts, which may not exceed the
+ * 16-byte FIFO.
+ */
+static bool stream_ok(const DMA_HandleTypeDef *hdma, const void *buf, uint32_t bytes, bool wide) {
+    if (hdma == NULL) {
+        return true;
+    }
+    const DMA_InitTypeDef *in = &hdma->Init;
+    uint32_t pwidth = (in->PeriphDataAlignment == DMA_PDATAALIGN_HALFWORD) ? 2U : 1U;
+    uint32_t mwidth = mem_width(in->MemDataAlignment);
+    uint32_t beats = (in->MemBurst == DMA_MBURST_INC4) ? 4U : (in->MemBurst == DMA_MBURST_INC8) ? 8U
+                     : (in->MemBurst == DMA_MBURST_INC16) ? 16U : 1U;
+    uint32_t chunk = mwidth * beats;
+    if (pwidth != (wide ? 2U : 1U)) {
+        return false;
+    }
+    if (in->FIFOMode != DMA_FIFOMODE_ENABLE && (mwidth != pwidth || beats != 1U)) {
+        return false;
+    }
+    if (chunk > 16U || ((uintptr_t)buf % mwidth) != 0U) {
+        return false;
     }
-    return s_spi_ret;
+    /* A held memory address re-reads one beat; only incrementing streams walk the buffer. */
+    if (in->MemInc == DMA_MINC_ENABLE && ((bytes % chunk) != 0U || ((uintptr_t)buf % chunk) != 0U)) {
+        return false;
+    }
+    if (mwidth == 4U) {
+        mock_hal_dma_packed_streams++;
+    }
+    return true;
 }
 
-/* DMA stubs: return HAL_ERROR so the driver always falls back to polling. */
+/*
+ * TX source as the stream reads it: with memory increment off, the first
+ * peripheral-width beat of pData over and over.
+ */
+static uint8_t s_fixed_tx[2 * SPI_QUEUE_SIZE];
+
+static const uint8_t *dma_tx_source(const SPI_HandleTypeDef *hspi, const uint8_t *pData,
+                                    uint32_t bytes) {
+    const DMA_HandleTypeDef *hdma = hspi->hdmatx;
+    if (hdma == NULL || hdma->Init.MemInc != DMA_MINC_DISABLE) {
+        return pData;
+    }
+    uint32_t beat = frame16(hspi) ? 2U : 1U;
+    for (uint32_t i = 0; i < bytes; i++) {
+        s_fixed_tx[i] = pData[i % beat];
+    }
+    mock_hal_dma_fixed_tx_calls++;
+    return s_fixed_tx;
+}
+
+static bool dma_streams_ok(const SPI_HandleTypeDef *hspi, const void *tx, const void *rx,
+                           uint32_t bytes) {
+    bool wide = frame16(hspi);
+    if (wide) {
+        mock_hal_frame16_calls++;
+    }
+    return stream_ok(hspi->hdmatx, tx, bytes, wide) &&
+           (rx == NULL || stream_ok(hspi->hdmarx, rx, bytes, wide));
+}
+
+static void swap_pairs(uint8_t *dst, const uint8_t *src, uint32_t len) {
+    for (uint32_t i = 0; i + 1U < len; i += 2U) {
+        uint8_t lo = src[i];
+        dst[i] = src[i + 1U];
+        dst[i + 1U] = lo;
+    }
+}
+
+/*
+ * DMA stubs: return HAL_ERROR unless DMA is enabled via
+ * mock_hal_set_dma_enabled(). When enabled, the transfer completes
+ * synchronously and the driver's completion callback runs before return.
+ */
 HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi,
                                         uint8_t *pData, uint16_t Size) {
-    (void)hspi; (void)pData; (void)Size;
-    return HAL_ERROR;
+    if (!s_dma_enabled) {
+        return HAL_ERROR;
+    }
+    mock_hal_dma_tx_calls++;
+    if (!dma_streams_ok(hspi, pData, NULL, frame16(hspi) ? Size * 2U : Size)) {
+        return HAL_ERROR;
+    }
+    pData = (uint8_t *)dma_tx_source(hspi, pData, frame16(hspi) ? Size * 2U : Size);
+    BUS_ENTER();
+    if (frame16(hspi)) {
+        swap_pairs(s_wire_tx, pData, (uint32_t)Size * 2U);
+        log_tx(s_wire_tx, (uint16_t)(Size * 2U));
+        advance_cycles((uint32_t)Size * 2U);
+        BUS_LEAVE();
+        HAL_SPI_TxCpltCallback(hspi);
+        return HAL_OK;
+    }
+    log_tx(pData, Size);
+    advance_cycles(Size);
+    BUS_LEAVE();
+    HAL_SPI_TxCpltCallback(hspi);
+    return HAL_OK;
 }
 
 HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi,
                                                uint8_t *pTxData, uint8_t *pRxData,
                                                uint16_t Size) {
-    (void)hspi; (void)pTxData; (void)pRxData; (void)Size;
-    return HAL_ERROR;
+    if (!s_dma_enabled) {
+        return HAL_ERROR;
+    }
+    mock_hal_dma_rx_calls++;
+    if (!dma_streams_ok(hspi, pTxData, pRxData, frame16(hspi) ? Size * 2U : Size)) {
+        return HAL_ERROR;
+    }
+    pTxData = (uint8_t *)dma_tx_source(hspi, pTxData, frame16(hspi) ? Size * 2U : Size);
+    BUS_ENTER();
+    if (frame16(hspi)) {
+        swap_pairs(s_wire_tx, pTxData, (uint32_t)Size * 2U);
+        pop_rx(s_wire_tx, s_wire_rx, (uint16_t)(Size * 2U));
+        swap_pairs(pRxData, s_wire_rx, (uint32_t)Size * 2U);
+        advance_cycles((uint32_t)Size * 2U);
+        BUS_LEAVE();
+        HAL_SPI_TxRxCpltCallback(hspi);
+        return HAL_OK;
+    }
+    pop_rx(pTxData, pRxData, Size);
+    advance_cycles(Size);
+    BUS_LEAVE();
+    HAL_SPI_TxRxCpltCallback(hspi);
+    return HAL_OK;
+}
+
+/*
+ * Stream descriptors: a captured CR is the stream's Init as register bits;
+ * an armed stream keeps its CR, memory pointer and count until it runs or
+ * is stopped. The transfer needs both streams armed for the same count;
+ * without mock_hal_set_dma_enabled it ends in a transfer error.
+ */
+uint32_t mock_hal_desc_capture(DMA_HandleTypeDef *hdma, SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+    mock_hal_desc_captures++;
+    return (hdma->Init.MemInc == DMA_MINC_ENABLE) ? DMA_SxCR_MINC : 0U;
+}
+
+static mock_desc_stream_t *desc_slot(const DMA_HandleTypeDef *hdma) {
+    for (uint32_t i = 0; i < 2U; i++) {
+        if (s_desc[i].hdma == hdma) {
+            return &s_desc[i];
+        }
+    }
+    return (s_desc[0].hdma == NULL) ? &s_desc[0] : &s_desc[1];
+}
+
+void mock_hal_desc_arm(DMA_HandleTypeDef *hdma, uint32_t cr, void *mem, uint16_t len) {
+    mock_desc_stream_t *st = desc_slot(hdma);
+    st->hdma = hdma;
+    st->cr = cr;
+    st->mem = (uint8_t *)mem;
+    st->len = len;
+    st->armed = true;
+}
+
+void mock_hal_desc_stop(DMA_HandleTypeDef *hdma) {
+    desc_slot(hdma)->armed = false;
+}
+
+void mock_hal_desc_requests(SPI_HandleTypeDef *hspi, bool on) {
+    mock_desc_stream_t *tx = desc_slot(hspi->hdmatx);
+    mock_desc_stream_t *rx = desc_slot(hspi->hdmarx);
+    if (!on || tx == rx || !tx->armed || !rx->armed) {
+        return;
+    }
+    tx->armed = false;
+    rx->armed = false;
+    if (!s_dma_enabled || tx->len != rx->len || (rx->cr & DMA_SxCR_TCIE) == 0U) {
+        hspi->hdmarx->XferErrorCallback(hspi->hdmarx);
+        return;
+    }
+    mock_hal_desc_runs++;
+    /* A held TX address repeats one beat; a held RX address discards (a transmit). */
+    const uint8_t *src = tx->mem;
+    if ((tx->cr & DMA_SxCR_MINC) == 0U) {
+        memset(s_fixed_tx, src[0], tx->len);
+        src = s_fixed_tx;
+    }
+    BUS_ENTER();
+    if ((rx->cr & DMA_SxCR_MINC) == 0U) {
+        log_tx(src, tx->len);
+    } else {
+        pop_rx(src, rx->mem, tx->len);
+    }
+    advance_cycles(tx->len);
+    BUS_LEAVE();
+    hspi->hdmarx->XferCpltCallback(hspi->hdmarx);
+}
+
+/* Interrupt-driven transfers complete at once, like the DMA ones, but need no DMA enable. */
+HAL_StatusTypeDef HAL_SPI_Transmit_IT(SPI_HandleTypeDef *hspi,
+                                       uint8_t *pData, uint16_t Size) {
+    mock_hal_it_tx_calls++;
+    BUS_ENTER();
+    log_tx(pData, Size);
+    advance_cycles(Size);
+    BUS_LEAVE();
+    HAL_SPI_TxCpltCallback(hspi);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT(SPI_HandleTypeDef *hspi,
+                                              uint8_t *pTxData, uint8_t *pRxData,
+                                              uint16_t Size) {
+    mock_hal_it_rx_calls++;
+    BUS_ENTER();
+    pop_rx(pTxData, pRxData, Size);
+    advance_cycles(Size);
+    BUS_LEAVE();
+    HAL_SPI_TxRxCpltCallback(hspi);
+    return HAL_OK;
+}
+
+/* Register-level fast path: one frame at a time, exchanged when DR is read. */
+bool mock_hal_ll_flag(SPI_HandleTypeDef *hspi, uint32_t flag) {
+    (void)hspi;
+    if (flag == SPI_FLAG_RXNE) {
+        return s_ll_pending;
+    }
+    return flag == SPI_FLAG_TXE;
+}
+
+void mock_hal_ll_write(SPI_HandleTypeDef *hspi, uint8_t data) {
+    (void)hspi;
+    s_ll_tx = data;
+    s_ll_pending = true;
+    mock_hal_ll_bytes++;
+}
+
+uint8_t mock_hal_ll_read(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+    uint8_t rx = s_idle_byte;
+    if (s_ll_pending) {
+        s_ll_pending = false;
+        BUS_ENTER();
+        s_ll_io = true;
+        pop_rx(&s_ll_tx, &rx, 1);
+        s_ll_io = false;
+        advance_cycles(1);
+        BUS_LEAVE();
+    }
+    return rx;
+}
+
+/* A frame whose RX byte is dropped was a transmit, as with HAL_SPI_Transmit. */
+void mock_hal_ll_discard(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+    if (s_ll_pending) {
+        s_ll_pending = false;
+        BUS_ENTER();
+        s_ll_io = true;
+        log_tx(&s_ll_tx, 1);
+        s_ll_io = false;
+        advance_cycles(1);
+        BUS_LEAVE();
+    }
 }
 
 HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi) {
@@ -134,19 +937,54 @@ HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi) {
 }
 
 void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
-    (void)GPIOx; (void)GPIO_Pin; (void)PinState;
+    (void)GPIOx; (void)GPIO_Pin;
     mock_hal_gpio_write_calls++;
+    if (s_dev && s_dev->select) {
+        BUS_ENTER();
+        s_dev->select(PinState == GPIO_PIN_RESET, s_dev->ctx);
+        BUS_LEAVE();
+    }
 }
 
 GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
     (void)GPIOx; (void)GPIO_Pin;
+    mock_hal_gpio_read_calls++;
     return s_gpio_read;
 }
 
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+    (void)GPIOx; (void)GPIO_Pin;
+    mock_hal_gpio_toggle_calls++;
+}
+
+/* -----------------------------------------------------------------------
+ * UART
+ * ----------------------------------------------------------------------- */
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+    if (s_uart_ret != HAL_OK) {
+        return s_uart_ret;
+    }
+    if (huart->gState == HAL_UART_STATE_BUSY_TX) {
+        return HAL_BUSY;
+    }
+    for (uint16_t i = 0; i < Size && s_uart_len < SPI_QUEUE_SIZE; i++) {
+        s_uart_log[s_uart_len++] = pData[i];
+    }
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    mock_hal_uart_tx_calls++;
+    return HAL_OK;
+}
+
 uint32_t HAL_GetTick(void) {
-    return s_tick;
+    return s_sim_on ? s_tick + (uint32_t)(s_now_ns / 1000000U) : s_tick;
 }
 
 void HAL_Delay(uint32_t Delay) {
+    if (s_sim_on) {
+        sim_advance((uint64_t)Delay * 1000000U);
+        return;
+    }
     s_tick += Delay;
+    mock_dwt.CYCCNT += Delay * (SystemCoreClock / 1000U);
 }
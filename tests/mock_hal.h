@@ -16,6 +16,29 @@
  * HAL_GetTick returns a software counter; HAL_Delay advances it by the
  * requested number of milliseconds. Tests can teleport the tick via
  * mock_hal_set_tick() to trigger timeout paths without real sleeping.
+ *
+ * DWT->CYCCNT advances by a configurable number of cycles per byte clocked
+ * over SPI, and by one millisecond worth of SystemCoreClock per HAL_Delay ms.
+ *
+ * Timing simulator (opt-in, mock_hal_sim_enable)
+ * ----------------------------------------------
+ * Every SPI byte costs 8 SCK periods plus a per-byte gap, every HAL SPI call a
+ * fixed overhead, and HAL_Delay advances the same simulated clock; HAL_GetTick
+ * and DWT->CYCCNT follow it, so driver timeouts and latency histograms see
+ * simulated time. The simulator watches the command frames the driver sends
+ * and plays the card's timing on top of the queue:
+ *   - after the R1 of CMD9/10/17/18 (and between CMD18 blocks) the data token
+ *     is held back for a read latency, DO reading 0xFF;
+ *   - after an accepted data response, a CMD25 stop token or the R1 of CMD38
+ *     the card is busy for a program/erase time, DO reading 0x00.
+ * Those filler bytes do not consume the queue, so test scripts stay the same
+ * as without the simulator. Latencies are drawn from seeded distributions.
+ *
+ * The simulator can also inject faults at seeded random (cfg.faults): read
+ * blocks with a flipped bit, write data responses reporting a CRC error,
+ * data tokens that never come, and polled SPI calls that time out. Busy
+ * stretches are the program_busy tail. Faults draw from their own stream, so
+ * turning them on leaves the latency draws unchanged.
  */
 
 #ifndef __MOCK_HAL_H__
@@ -45,10 +68,48 @@ void mock_hal_push_bytes(const uint8_t *data, size_t len);
 /* How many bytes are left in the queue. */
 int mock_hal_queue_depth(void);
 
+/* Byte returned once the queue is empty. Default: 0xFF. Set to 0x00 to
+ * model a card that holds DO low (busy) indefinitely. */
+void mock_hal_set_idle_byte(uint8_t b);
+
+/* Let the DMA stubs succeed. Default: false (DMA calls return HAL_ERROR).
+ * Enabled transfers complete synchronously: queue bytes are popped and the
+ * driver's HAL_SPI_*CpltCallback runs before the stub returns. */
+void mock_hal_set_dma_enabled(bool enabled);
+
 /* Override the return status of HAL_SPI_TransmitReceive.
  * Default: HAL_OK. Set to HAL_TIMEOUT to simulate SPI bus hang. */
 void mock_hal_set_spi_return(HAL_StatusTypeDef status);
 
+/*
+ * Attach a byte-level SPI device (e.g. the card emulator in mock_card.h).
+ * While attached, every byte clocked in either direction goes through
+ * exchange() and the queue is bypassed; select() sees each GPIO write
+ * (RESET = CS asserted). NULL detaches. mock_hal_reset detaches too.
+ */
+typedef struct {
+    uint8_t (*exchange)(uint8_t tx, void *ctx);
+    void (*select)(bool selected, void *ctx);
+    void *ctx;
+} mock_hal_spi_device_t;
+
+void mock_hal_set_spi_device(const mock_hal_spi_device_t *dev);
+
+/* Bytes sent through HAL_SPI_Transmit since the last reset (oldest first).
+ * Returns a pointer to the log and stores its length in *len. */
+const uint8_t *mock_hal_tx_log(size_t *len);
+
+/* -----------------------------------------------------------------------
+ * UART
+ * ----------------------------------------------------------------------- */
+
+/* HAL_UART_Transmit_DMA appends to a log and leaves gState BUSY_TX; the test
+ * completes the transfer (gState READY plus the driver's callback). */
+void mock_hal_set_uart_return(HAL_StatusTypeDef status);
+
+/* Bytes passed to HAL_UART_Transmit_DMA since the last reset (oldest first). */
+const uint8_t *mock_hal_uart_log(size_t *len);
+
 /* -----------------------------------------------------------------------
  * GPIO
  * ----------------------------------------------------------------------- */
@@ -63,6 +124,99 @@ void mock_hal_set_gpio_read(GPIO_PinState state);
 void     mock_hal_set_tick(uint32_t tick);
 uint32_t mock_hal_get_tick(void);
 
+/* -----------------------------------------------------------------------
+ * Cycle counter
+ * ----------------------------------------------------------------------- */
+
+/* SystemCoreClock in the mock: 16 cycles per microsecond. */
+#define MOCK_HAL_CORE_CLOCK 16000000U
+
+/* Cycles DWT->CYCCNT advances per SPI byte. Default: 0 (counter frozen). */
+void mock_hal_set_cycles_per_byte(uint32_t cycles);
+
+/* -----------------------------------------------------------------------
+ * Timing simulator
+ * ----------------------------------------------------------------------- */
+
+/* Uniform in [min_us, max_us]; with probability tail_permille/1000 the draw is
+ * tail_us instead (occasional garbage-collection stall). */
+typedef struct {
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t tail_us;
+    uint32_t tail_permille;
+} mock_hal_sim_dist_t;
+
+/* Fault rates in permille of the opportunities for each; 0 turns a fault off. */
+typedef struct {
+    uint32_t seed;                // Fault stream seed (0 = 1)
+    uint32_t read_crc_permille;   // CMD17/18 blocks delivered with one data bit flipped
+    uint32_t write_crc_permille;  // Accepted write data responses turned into 0x0B (CRC error)
+    uint32_t token_drop_permille; // CMD17/18 data tokens swallowed: DO reads 0xFF until a command
+    uint32_t timeout_permille;    // Polled HAL SPI calls returning HAL_TIMEOUT after the bytes
+    uint32_t timeout_us;          // Simulated time such a call spends before it gives up
+} mock_hal_sim_faults_t;
+
+typedef struct {
+    uint32_t spi_hz;              // SCK frequency
+    uint32_t byte_gap_ns;         // Dead time between bytes (FIFO refill, polled HAL)
+    uint32_t call_overhead_ns;    // Cost of entering one HAL SPI call
+    mock_hal_sim_dist_t read_latency; // Command (or end of block) to data token
+    mock_hal_sim_dist_t program_busy; // Data response (or stop token) to end of busy
+    mock_hal_sim_dist_t erase_busy;   // CMD38 R1 to end of busy
+    uint32_t au_blocks;           // Allocation unit of a block-addressed card (0 = no AU model)
+    uint32_t au_open_us;          // Added to the busy of the first block written into another AU
+    uint32_t seed;                // Distribution seed (0 = 1)
+    mock_hal_sim_faults_t faults; // All zero: no faults
+} mock_hal_sim_config_t;
+
+typedef struct {
+    uint64_t elapsed_ns;    // Simulated time since mock_hal_sim_enable
+    uint64_t bus_ns;        // SCK running: bytes x 8 bit periods
+    uint64_t busy_poll_ns;  // Bus time spent clocking 0x00 while the card was busy
+    uint64_t token_poll_ns; // Bus time spent clocking 0xFF ahead of a data token
+    uint64_t card_busy_ns;  // Program/erase busy time drawn
+    uint64_t latency_ns;    // Read latency drawn
+    uint64_t bytes;         // Bytes clocked in either direction
+    uint32_t calls;         // HAL SPI calls (polled and DMA)
+    uint32_t tokens;        // Read latencies played
+    uint32_t programs;      // Program busy periods played
+    uint32_t erases;        // Erase busy periods played
+    uint32_t read_crc_faults;  // Faults injected, by kind
+    uint32_t write_crc_faults;
+    uint32_t dropped_tokens;
+    uint32_t timeouts;
+} mock_hal_sim_report_t;
+
+/* A 25 MHz card with typical class-10 latencies. */
+void mock_hal_sim_defaults(mock_hal_sim_config_t *cfg);
+
+/* Start simulating with cfg (copied), from time zero; NULL stops. mock_hal_reset stops too. */
+void mock_hal_sim_enable(const mock_hal_sim_config_t *cfg);
+
+void mock_hal_sim_report(mock_hal_sim_report_t *out);
+
+/* Bus utilisation (bus_ns / elapsed_ns) in permille; 0 before any time has passed. */
+uint32_t mock_hal_sim_utilization_permille(const mock_hal_sim_report_t *rep);
+
+/* Payload throughput over the simulated time, in KiB/s. */
+uint32_t mock_hal_sim_kib_per_s(const mock_hal_sim_report_t *rep, uint64_t payload_bytes);
+
+/* Print a one-line utilisation report to stdout. */
+void mock_hal_sim_print(const char *label, uint64_t payload_bytes);
+
+/* -----------------------------------------------------------------------
+ * Bus hooks
+ * ----------------------------------------------------------------------- */
+
+/*
+ * Called on entry to and exit from every SPI stub, chip-select write and LL
+ * frame exchange, so a host benchmark can stop its clock while the mock bus
+ * and the attached device run (sd_host_overhead.c). The driver's completion
+ * callbacks run outside the pair. NULL clears; mock_hal_reset clears too.
+ */
+void mock_hal_set_bus_hooks(void (*enter)(void), void (*leave)(void));
+
 /* -----------------------------------------------------------------------
  * Observability counters (reset by mock_hal_reset)
  * ----------------------------------------------------------------------- */
@@ -70,5 +224,26 @@ uint32_t mock_hal_get_tick(void);
 extern int mock_hal_transmit_calls;
 extern int mock_hal_transmitrec_calls;
 extern int mock_hal_gpio_write_calls;
+extern int mock_hal_gpio_read_calls;
+extern int mock_hal_gpio_toggle_calls; /* not routed to the bus device (an LED, not CS) */
+extern int mock_hal_spi_init_calls;
+extern int mock_hal_spi_deinit_calls;
+extern int mock_hal_dma_rx_calls;
+extern int mock_hal_dma_tx_calls;
+extern int mock_hal_it_rx_calls;
+extern int mock_hal_it_tx_calls;
+extern int mock_hal_ll_bytes;      // Frames sent by the register-level fast path
+extern int mock_hal_dma_init_calls;
+extern int mock_hal_frame16_calls; // DMA transfers made with 16-bit SPI frames
+extern int mock_hal_dma_packed_streams; // DMA streams run with a word memory side
+extern int mock_hal_dma_fixed_tx_calls; // DMA transfers whose TX stream held its address
+extern int mock_hal_rx_busy_tx;    // Non-0xFF bytes sent by full-duplex (receive) transfers
+extern int mock_hal_uart_tx_calls; // Accepted HAL_UART_Transmit_DMA calls
+extern int mock_hal_dma_m2m_starts; // HAL_DMA_Start calls (memory-to-memory copies)
+extern int mock_hal_desc_captures;  // Stream configurations read (SD_DMA_DESCRIPTORS)
+extern int mock_hal_desc_runs;      // Transfers run from armed stream descriptors
+extern int mock_hal_dcache_cleans;       // SD_DCACHE_CLEAN calls (MOCK_DCACHE)
+extern int mock_hal_dcache_invalidates;  // SD_DCACHE_INVALIDATE calls (MOCK_DCACHE)
+extern int mock_hal_dcache_unaligned;    // of those, not on whole 32-byte lines
 
 #endif /* __MOCK_HAL_H__ */
@@ -37,6 +37,9 @@ typedef enum {
 #define GET_BLOCK_SIZE   3
 #define CTRL_TRIM        4
 
+/* Provided by ff_gen_drv in the real tree; tests that read through FatFs define it. */
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+
 /* Feature enable flags expected by sd_diskio_spi.c */
 #define _USE_WRITE 1
 #define _USE_IOCTL 1
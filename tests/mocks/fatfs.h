@@ -0,0 +1,15 @@
+/*
+ * tests/mocks/fatfs.h
+ *
+ * Stand-in for the CubeMX fatfs.h so sd_functions.h can be included on host.
+ * FatFs headers come from the include path, so end-to-end targets get the real ones.
+ */
+
+#ifndef __MOCK_FATFS_H__
+#define __MOCK_FATFS_H__
+
+#include "main.h"
+#include <ff.h>
+#include <ff_gen_drv.h>
+
+#endif /* __MOCK_FATFS_H__ */
@@ -0,0 +1,104 @@
+/*
+ * tests/mocks/ff.h
+ *
+ * Minimal FatFs API surface (R0.12c names and values) for modules layered on
+ * FatFs. Tests that include it provide the f_* functions they exercise.
+ */
+
+#ifndef __MOCK_FF_H__
+#define __MOCK_FF_H__
+
+#include "diskio.h"
+
+#define _MIN_SS 512
+#define _MAX_SS 512
+
+typedef DWORD FSIZE_t;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+#define FS_FAT12 1
+#define FS_FAT16 2
+#define FS_FAT32 3
+#define FS_EXFAT 4
+
+typedef struct {
+    BYTE fs_type;
+    BYTE drv;
+    BYTE n_fats;
+    BYTE wflag;
+    BYTE fsi_flag;
+    WORD id;
+    WORD csize;
+    DWORD last_clst;
+    DWORD free_clst;
+    DWORD n_fatent;
+    DWORD fsize;
+    DWORD fatbase;
+    DWORD database;
+    DWORD winsect;
+    BYTE win[_MAX_SS];
+} FATFS;
+
+typedef struct {
+    FSIZE_t objsize;
+} _FDID;
+
+typedef struct {
+    _FDID obj;
+    FSIZE_t fptr;
+    BYTE flag;
+} FIL;
+
+typedef struct {
+    DWORD dptr;
+} DIR;
+
+typedef struct {
+    FSIZE_t fsize;
+    BYTE fattrib;
+    char fname[13];
+} FILINFO;
+
+#define AM_DIR 0x10
+
+#define FA_READ          0x01
+#define FA_WRITE         0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW    0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS   0x10
+#define FA_OPEN_APPEND   0x30
+
+#define f_size(fp) ((fp)->obj.objsize)
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_truncate(FIL *fp);
+FRESULT f_sync(FIL *fp);
+
+#endif /* __MOCK_FF_H__ */
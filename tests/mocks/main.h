@@ -28,9 +28,93 @@ typedef enum {
     GPIO_PIN_SET   = 1
 } GPIO_PinState;
 
-/* Minimal SPI handle — only existence as a pointer target matters */
+/* SPI baud-rate prescalers (CR1 BR[2:0] encoding, as in stm32f4xx_hal_spi.h) */
+#define SPI_BAUDRATEPRESCALER_2   0x00000000U
+#define SPI_BAUDRATEPRESCALER_4   0x00000008U
+#define SPI_BAUDRATEPRESCALER_8   0x00000010U
+#define SPI_BAUDRATEPRESCALER_16  0x00000018U
+#define SPI_BAUDRATEPRESCALER_32  0x00000020U
+#define SPI_BAUDRATEPRESCALER_64  0x00000028U
+#define SPI_BAUDRATEPRESCALER_128 0x00000030U
+#define SPI_BAUDRATEPRESCALER_256 0x00000038U
+
+/* Minimal SPI init block — only fields the driver reconfigures */
+typedef struct {
+    uint32_t BaudRatePrescaler;
+    uint32_t DataSize;
+} SPI_InitTypeDef;
+
+#define SPI_DATASIZE_8BIT  0x00000000U
+#define SPI_DATASIZE_16BIT 0x00000800U
+
+/* Minimal DMA stream handle: only the fields the driver sets (F4 stream layout). */
+typedef struct {
+    uint32_t PeriphDataAlignment;
+    uint32_t MemDataAlignment;
+    uint32_t Priority;
+    uint32_t FIFOMode;
+    uint32_t FIFOThreshold;
+    uint32_t MemBurst;
+    uint32_t PeriphBurst;
+    uint32_t MemInc;
+} DMA_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef {
+    DMA_InitTypeDef Init;
+    void *Parent; // SPI handle (__HAL_LINKDMA)
+    void (*XferCpltCallback)(struct __DMA_HandleTypeDef *hdma);
+    void (*XferErrorCallback)(struct __DMA_HandleTypeDef *hdma);
+} DMA_HandleTypeDef;
+
+#define DMA_PDATAALIGN_BYTE     0x00000000U
+#define DMA_PDATAALIGN_HALFWORD 0x00000800U
+#define DMA_MDATAALIGN_BYTE     0x00000000U
+#define DMA_MDATAALIGN_HALFWORD 0x00002000U
+#define DMA_MDATAALIGN_WORD     0x00004000U
+#define DMA_PRIORITY_LOW        0x00000000U
+#define DMA_PRIORITY_MEDIUM     0x00010000U
+#define DMA_PRIORITY_HIGH       0x00020000U
+#define DMA_PRIORITY_VERY_HIGH  0x00030000U
+#define DMA_FIFOMODE_DISABLE    0x00000000U
+#define DMA_FIFOMODE_ENABLE     0x00000004U
+#define DMA_FIFO_THRESHOLD_FULL 0x00000003U
+#define DMA_MBURST_SINGLE       0x00000000U
+#define DMA_MBURST_INC4         0x00800000U
+#define DMA_MBURST_INC8         0x01000000U
+#define DMA_MBURST_INC16        0x01800000U
+#define DMA_PBURST_SINGLE       0x00000000U
+#define DMA_MINC_DISABLE        0x00000000U
+#define DMA_MINC_ENABLE         0x00000400U
+
+typedef enum {
+    HAL_DMA_FULL_TRANSFER = 0x00U,
+    HAL_DMA_HALF_TRANSFER = 0x01U
+} HAL_DMA_LevelCompleteTypeDef;
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma);
+
+/* Memory-to-memory streams (sd_mem copies): accepted, but never finish (see mock_hal.c). */
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef *hdma, uint32_t SrcAddress, uint32_t DstAddress,
+                                uint32_t DataLength);
+HAL_StatusTypeDef HAL_DMA_PollForTransfer(DMA_HandleTypeDef *hdma,
+                                          HAL_DMA_LevelCompleteTypeDef CompleteLevel,
+                                          uint32_t Timeout);
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma);
+
+/* SPI registers used by the register-level fast path (SD_SPI_LL_FASTPATH). */
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t SR;
+    volatile uint32_t DR;
+} SPI_TypeDef;
+
+/* Minimal SPI handle */
 typedef struct {
     uint32_t instance;
+    SPI_TypeDef *Instance;
+    SPI_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmatx;
+    DMA_HandleTypeDef *hdmarx;
 } SPI_HandleTypeDef;
 
 /* Minimal GPIO peripheral type */
@@ -38,7 +122,26 @@ typedef struct {
     uint32_t instance;
 } GPIO_TypeDef;
 
+/* Minimal UART handle: the instance and the transmit state the log sink checks. */
+typedef enum {
+    HAL_UART_STATE_READY   = 0x20U,
+    HAL_UART_STATE_BUSY_TX = 0x21U
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+    uint32_t instance;
+    volatile HAL_UART_StateTypeDef gState;
+} UART_HandleTypeDef;
+
+#define HAL_UART_MODULE_ENABLED
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+
 /* HAL function declarations */
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_DeInit(SPI_HandleTypeDef *hspi);
+
 HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi,
                                     uint8_t *pData, uint16_t Size,
                                     uint32_t Timeout);
@@ -54,14 +157,91 @@ HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi,
                                                uint8_t *pTxData, uint8_t *pRxData,
                                                uint16_t Size);
 
+HAL_StatusTypeDef HAL_SPI_Transmit_IT(SPI_HandleTypeDef *hspi,
+                                       uint8_t *pData, uint16_t Size);
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_IT(SPI_HandleTypeDef *hspi,
+                                              uint8_t *pTxData, uint8_t *pRxData,
+                                              uint16_t Size);
+
 HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
 
+/*
+ * Register access for the fast path. Plain struct stores cannot be observed,
+ * so the driver's SD_LL_* hooks and the flag macro route to mock_hal.c: a
+ * DR write queues one frame, RXNE reports it, and a DR read exchanges it
+ * with the RX queue (or the attached device); a discard logs it as sent.
+ */
+#define SPI_FLAG_RXNE 0x0001U
+#define SPI_FLAG_TXE  0x0002U
+
+bool    mock_hal_ll_flag(SPI_HandleTypeDef *hspi, uint32_t flag);
+void    mock_hal_ll_write(SPI_HandleTypeDef *hspi, uint8_t data);
+uint8_t mock_hal_ll_read(SPI_HandleTypeDef *hspi);
+void    mock_hal_ll_discard(SPI_HandleTypeDef *hspi);
+
+#define __HAL_SPI_ENABLE(h)        ((void)(h))
+#define __HAL_SPI_GET_FLAG(h, f)   mock_hal_ll_flag((h), (f))
+#define SD_LL_WRITE_DR(h, b)       mock_hal_ll_write((h), (uint8_t)(b))
+#define SD_LL_READ_DR(h)           mock_hal_ll_read(h)
+#define SD_LL_DISCARD_DR(h)        mock_hal_ll_discard(h)
+
+/*
+ * Stream-descriptor DMA (SD_DMA_DESCRIPTORS): the hooks record each armed
+ * stream, and enabling the SPI requests runs the transfer and calls the RX
+ * stream's completion callback, as HAL_DMA_IRQHandler would.
+ */
+#define DMA_SxCR_EN     0x00000001U
+#define DMA_SxCR_DMEIE  0x00000002U
+#define DMA_SxCR_TEIE   0x00000004U
+#define DMA_SxCR_HTIE   0x00000008U
+#define DMA_SxCR_TCIE   0x00000010U
+#define DMA_SxCR_MINC   0x00000400U
+#define DMA_SxCR_PSIZE  0x00001800U
+#define DMA_SxCR_MSIZE  0x00006000U
+#define DMA_SxCR_MBURST 0x01800000U
+
+uint32_t mock_hal_desc_capture(DMA_HandleTypeDef *hdma, SPI_HandleTypeDef *hspi);
+void     mock_hal_desc_arm(DMA_HandleTypeDef *hdma, uint32_t cr, void *mem, uint16_t len);
+void     mock_hal_desc_stop(DMA_HandleTypeDef *hdma);
+void     mock_hal_desc_requests(SPI_HandleTypeDef *hspi, bool on);
+
+#define SD_DESC_CAPTURE(hdma, hspi)     mock_hal_desc_capture((hdma), (hspi))
+#define SD_DESC_ARM(hdma, cr, mem, len) mock_hal_desc_arm((hdma), (cr), (mem), (len))
+#define SD_DESC_STOP(hdma)              mock_hal_desc_stop(hdma)
+#define SD_DESC_REQUESTS(hspi, on)      mock_hal_desc_requests((hspi), (on))
+
+/* Completion callbacks (implemented by the driver). */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
+
 void          HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin,
                                 GPIO_PinState PinState);
 GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void          HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
 uint32_t      HAL_GetTick(void);
 void          HAL_Delay(uint32_t Delay);
 
+/* Minimal CMSIS core debug blocks for the DWT cycle counter (see mock_hal.h). */
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type       mock_dwt;
+extern CoreDebug_Type mock_core_debug;
+extern uint32_t       SystemCoreClock;
+
+#define DWT                        (&mock_dwt)
+#define CoreDebug                  (&mock_core_debug)
+#define DWT_CTRL_CYCCNTENA_Msk     (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
 /*
  * ARM Cortex-M IPSR register intrinsic.
  * Returns 0 on host → SD_InISR() always returns false.
@@ -71,6 +251,13 @@ static inline uint32_t __get_IPSR(void) { return 0U; }
 /*
  * __DCACHE_PRESENT is not defined for host builds, so SD_CacheClean /
  * SD_CacheInvalidate compile to no-ops via the #else branch in sd_spi.c.
+ * With MOCK_DCACHE the driver's maintenance hooks are counted instead.
  */
+#ifdef MOCK_DCACHE
+void mock_hal_dcache_clean(uintptr_t addr, int32_t size);
+void mock_hal_dcache_invalidate(uintptr_t addr, int32_t size);
+#define SD_DCACHE_CLEAN(addr, size)      mock_hal_dcache_clean((uintptr_t)(addr), (int32_t)(size))
+#define SD_DCACHE_INVALIDATE(addr, size) mock_hal_dcache_invalidate((uintptr_t)(addr), (int32_t)(size))
+#endif
 
 #endif /* __MOCK_MAIN_H__ */
@@ -0,0 +1,141 @@
+# tests/sd_fsconf_table.cmake
+#
+# Side-by-side table of sd_benchmark_fsconf_suite results, one column per
+# FatFs configuration: static RAM, then time, throughput, card sectors read
+# and written and commands per workload.
+#
+#   cmake -DEXES="a|b|..." -P sd_fsconf_table.cmake   run host variants ("fsconf" mode)
+#   cmake -DLOGS="a.log|b.log" -P sd_fsconf_table.cmake   captured SDBENCH_FSCONF output
+#
+# Both can be given; logs from a board and host runs end up in one table.
+# A column is labelled by the configuration line, so two logs of the same
+# build get the same label (the later one is shown).
+
+set(columns)
+set(ops)
+
+function(fsconf_pad out text width)
+    string(LENGTH "${text}" len)
+    set(padded "${text}")
+    while(len LESS width)
+        string(APPEND padded " ")
+        math(EXPR len "${len} + 1")
+    endwhile()
+    set(${out} "${padded}" PARENT_SCOPE)
+endfunction()
+
+# Parse one run's output into fsconf_<label>_<key> variables in the caller.
+macro(fsconf_parse text source)
+    string(REPLACE "\r" "" _fs_text "${text}")
+    string(REPLACE ";" "," _fs_text "${_fs_text}")
+    string(REPLACE "\n" ";" _fs_lines "${_fs_text}")
+    set(_fs_label "")
+    foreach(_fs_line ${_fs_lines})
+        if(NOT _fs_line MATCHES "^SDBENCH_FSCONF,")
+            continue()
+        endif()
+        string(REPLACE "," ";" _fs_f "${_fs_line}")
+        list(GET _fs_f 1 _fs_op)
+        if(_fs_op STREQUAL "config")
+            list(GET _fs_f 2 _fs_label)
+            list(FIND columns "${_fs_label}" _fs_at)
+            if(_fs_at LESS 0)
+                list(APPEND columns "${_fs_label}")
+            endif()
+            list(SUBLIST _fs_f 3 -1 _fs_pairs)
+            foreach(_fs_pair ${_fs_pairs})
+                if(_fs_pair MATCHES "^([a-z_]+)=(.*)$")
+                    set(fsconf_${_fs_label}_${CMAKE_MATCH_1} "${CMAKE_MATCH_2}")
+                endif()
+            endforeach()
+        elseif(_fs_op STREQUAL "error")
+            message(WARNING "${source}: ${_fs_line}")
+        elseif(NOT _fs_op STREQUAL "op" AND NOT _fs_op STREQUAL "done" AND NOT _fs_label STREQUAL "")
+            list(LENGTH _fs_f _fs_n)
+            if(_fs_n LESS 9)
+                continue()
+            endif()
+            list(FIND ops "${_fs_op}" _fs_at)
+            if(_fs_at LESS 0)
+                list(APPEND ops "${_fs_op}")
+            endif()
+            list(GET _fs_f 4 fsconf_${_fs_label}_${_fs_op}_us)
+            list(GET _fs_f 2 _fs_bytes)
+            if(NOT _fs_bytes STREQUAL "0") # directory workloads move no file data
+                list(GET _fs_f 5 fsconf_${_fs_label}_${_fs_op}_kbps)
+            endif()
+            list(GET _fs_f 6 _fs_rd)
+            list(GET _fs_f 7 _fs_wr)
+            set(fsconf_${_fs_label}_${_fs_op}_sectors "${_fs_rd}/${_fs_wr}")
+            list(GET _fs_f 8 fsconf_${_fs_label}_${_fs_op}_cmds)
+        endif()
+    endforeach()
+    if(_fs_label STREQUAL "")
+        message(WARNING "${source}: no SDBENCH_FSCONF,config line")
+    endif()
+endmacro()
+
+string(REPLACE "|" ";" exes "${EXES}")
+foreach(exe ${exes})
+    get_filename_component(name "${exe}" NAME_WE)
+    execute_process(COMMAND "${exe}" fsconf "${name}.img"
+                    OUTPUT_VARIABLE out RESULT_VARIABLE rc)
+    if(NOT rc EQUAL 0)
+        message(WARNING "${exe} exited with ${rc}")
+    endif()
+    fsconf_parse("${out}" "${exe}")
+endforeach()
+
+string(REPLACE "|" ";" logs "${LOGS}")
+foreach(log ${logs})
+    file(READ "${log}" out)
+    fsconf_parse("${out}" "${log}")
+endforeach()
+
+if(NOT columns)
+    message(FATAL_ERROR "No SDBENCH_FSCONF results (set EXES and/or LOGS)")
+endif()
+
+set(rows ram_fatfs ram_fil ram_lfn ram_cache ram_total)
+foreach(op ${ops})
+    set(op_rows ${op}_us ${op}_kbps ${op}_sectors ${op}_cmds)
+    foreach(label ${columns})
+        if(NOT DEFINED fsconf_${label}_${op}_kbps)
+            list(REMOVE_ITEM op_rows ${op}_kbps)
+        endif()
+    endforeach()
+    list(APPEND rows ${op_rows})
+endforeach()
+
+set(width 26)
+foreach(label ${columns})
+    string(LENGTH "${label}" len)
+    if(len GREATER width)
+        set(width ${len})
+    endif()
+endforeach()
+math(EXPR width "${width} + 2")
+
+fsconf_pad(line "metric" 24)
+foreach(label ${columns})
+    fsconf_pad(cell "${label}" ${width})
+    string(APPEND line "${cell}")
+endforeach()
+set(table "${line}\n")
+foreach(row ${rows})
+    string(REPLACE "_sectors" " sect rd/wr" title "${row}")
+    string(REPLACE "_kbps" " KB/s" title "${title}")
+    string(REPLACE "_us" " us" title "${title}")
+    string(REPLACE "_cmds" " cmds" title "${title}")
+    fsconf_pad(line "${title}" 24)
+    foreach(label ${columns})
+        set(value "${fsconf_${label}_${row}}")
+        if(value STREQUAL "")
+            set(value "-")
+        endif()
+        fsconf_pad(cell "${value}" ${width})
+        string(APPEND line "${cell}")
+    endforeach()
+    string(APPEND table "${line}\n")
+endforeach()
+message("${table}")
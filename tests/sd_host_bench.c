@@ -0,0 +1,133 @@
+/*
+ * tests/sd_host_bench.c
+ *
+ * Host-side benchmark: the real driver, sd_diskio_spi.c, sd_benchmark.c and
+ * FatFs against the card emulator, timed by the mock HAL simulator (25 MHz
+ * SCK with class-10 latencies, mock_hal_sim_defaults). Prints the firmware's
+ * SDBENCH lines in simulated time, so build variants can be compared
+ * without a board. Not a Unity test; CTest runs the quick pass as a smoke test.
+ * "fsconf" runs sd_benchmark_fsconf_suite instead, for the FatFs
+ * configuration variants (sd_host_fsconf_*, compared by sd_fsconf_table.cmake).
+ * "energy" runs sd_energy_suite (builds with SD_ENERGY_STATS, sd_host_bench_energy).
+ *
+ *   sd_host_bench [quick|fsconf|energy] [image]
+ *
+ * FatFs is kept on the first HOST_FS_BLOCKS sectors (SD_DiskSetSectorLimit);
+ * the raw and IOPS suites use the region behind them.
+ */
+
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "sd_benchmark.h"
+#include "sd_diskio_spi.h"
+#if (SD_ENERGY_STATS == 1)
+#include "sd_energy.h"
+#endif
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define HOST_IMAGE       "sd_host_bench.img"
+#define HOST_CARD_BLOCKS 32768U /* 16 MiB */
+#define HOST_FS_BLOCKS   28672U
+#define HOST_RAW_BLOCKS  (HOST_CARD_BLOCKS - HOST_FS_BLOCKS)
+#define HOST_QUICK_SPAN  64U
+#define HOST_ENERGY_BYTES 262144U
+
+static SPI_HandleTypeDef s_hspi;
+static GPIO_TypeDef s_cs;
+static FATFS s_fs;
+static char s_path[4];
+
+/* sd_functions.c is not linked; sd_benchmark uses these two. */
+int sd_mount(void) {
+    return f_mount(&s_fs, s_path, 1);
+}
+
+int sd_unmount(void) {
+    return f_mount(NULL, s_path, 0);
+}
+
+/* Fresh card, driver and FAT volume; the simulator starts after the format. */
+static bool host_setup(const char *image) {
+    static uint8_t work[_MAX_SS];
+    mock_hal_sim_config_t cfg;
+
+    (void)remove(image);
+    mock_hal_reset();
+    mock_hal_set_dma_enabled(true);
+    if (!mock_card_open(image, HOST_CARD_BLOCKS)) {
+        printf("SDBENCH,error,image,%s\r\n", image);
+        return false;
+    }
+    mock_card_attach();
+    SD_DiskSetSectorLimit(0, HOST_FS_BLOCKS);
+    if (SD_DiskIoInit(&s_hspi, &s_cs, 0, false) != SD_OK ||
+        FATFS_LinkDriver(&SD_Driver, s_path) != 0) {
+        printf("SDBENCH,error,init\r\n");
+        return false;
+    }
+    FRESULT res = f_mkfs(s_path, FM_FAT | FM_SFD, 0, work, sizeof(work));
+    if (res != FR_OK) {
+        printf("SDBENCH,error,mkfs,%d\r\n", (int)res);
+        return false;
+    }
+
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    return true;
+}
+
+static void host_teardown(const char *image) {
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+    (void)remove(image);
+}
+
+int main(int argc, char **argv) {
+    bool quick = (argc > 1 && strcmp(argv[1], "quick") == 0);
+    bool fsconf = (argc > 1 && strcmp(argv[1], "fsconf") == 0);
+    bool energy = (argc > 1 && strcmp(argv[1], "energy") == 0);
+    int first = (quick || fsconf || energy) ? 2 : 1;
+    int status = 0;
+    const char *image = (argc > first) ? argv[first] : HOST_IMAGE;
+
+    if (!host_setup(image)) {
+        host_teardown(image);
+        return 1;
+    }
+    printf("SDBENCH,host,profile=%d,spi_hz=25000000,%s\r\n", (int)SD_CONFIG_PROFILE,
+           energy ? "energy" : (fsconf ? "fsconf" : (quick ? "quick" : "full")));
+
+    if (energy) {
+#if (SD_ENERGY_STATS == 1)
+        int res = sd_mount();
+        if (res == FR_OK) {
+            res = sd_energy_suite(NULL, "0:/ENERGY.BIN", HOST_ENERGY_BYTES, 4096U);
+            (void)sd_unmount();
+        }
+        status = (res == FR_OK) ? 0 : 1;
+#else
+        printf("SDBENCH,error,energy,SD_ENERGY_STATS\r\n");
+        status = 2;
+#endif
+    } else if (fsconf) {
+        sd_benchmark_fsconf_suite();
+    } else if (quick) {
+        sd_benchmark_raw_suite(&g_sd_handle, HOST_FS_BLOCKS, HOST_QUICK_SPAN);
+        sd_benchmark();
+    } else {
+        sd_benchmark_raw_suite(&g_sd_handle, HOST_FS_BLOCKS, HOST_RAW_BLOCKS);
+        sd_benchmark_iops_suite(&g_sd_handle, HOST_FS_BLOCKS, HOST_RAW_BLOCKS);
+        sd_benchmark_suite();
+    }
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    printf("SDBENCH,sim,elapsed_us=%llu,bytes=%llu,calls=%lu,bus_permille=%lu\r\n",
+           (unsigned long long)(rep.elapsed_ns / 1000U), (unsigned long long)rep.bytes,
+           (unsigned long)rep.calls, (unsigned long)mock_hal_sim_utilization_permille(&rep));
+
+    host_teardown(image);
+    return status;
+}
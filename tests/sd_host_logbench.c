@@ -0,0 +1,157 @@
+/*
+ * tests/sd_host_logbench.c
+ *
+ * sd_logbench on the host simulator: the fixed-rate logger next to the UI
+ * reader, stat poller and LED load, through the real driver, FatFs and
+ * sd_logger against the card emulator in simulated time (mock HAL simulator
+ * defaults: 25 MHz SCK, class-10 latencies). Prints the SDLOGBENCH lines of
+ * sd_logbench_print. Not a Unity test; CTest runs a short pass as a smoke
+ * test.
+ *
+ *   sd_host_logbench [key=value ...] [image]
+ *
+ *   seconds=10    production time
+ *   period=5      ms between records
+ *   record=64     bytes per record
+ *   ui=50         ms between UI reads (0 = none)
+ *   uibytes=4096  bytes per UI read
+ *   stat=200      ms between stat polls (0 = none)
+ *   led=10        LED period in ms (0 = none)
+ */
+
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_logbench.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_IMAGE       "sd_host_logbench.img"
+#define HOST_CARD_BLOCKS 65536U /* 32 MiB */
+
+typedef struct {
+    uint32_t seconds;
+    uint32_t period;
+    uint32_t record;
+    uint32_t ui;
+    uint32_t uibytes;
+    uint32_t stat;
+    uint32_t led;
+} host_config_t;
+
+static SPI_HandleTypeDef s_hspi;
+static GPIO_TypeDef s_cs;
+static GPIO_TypeDef s_led;
+
+static bool host_args(int argc, char **argv, host_config_t *cfg, const char **image) {
+    struct {
+        const char *key;
+        uint32_t *value;
+    } keys[] = {
+        {"seconds", &cfg->seconds}, {"period", &cfg->period},   {"record", &cfg->record},
+        {"ui", &cfg->ui},           {"uibytes", &cfg->uibytes}, {"stat", &cfg->stat},
+        {"led", &cfg->led},
+    };
+    *cfg = (host_config_t){10U, 5U, 64U, 50U, 4096U, 200U, 10U};
+    for (int i = 1; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        if (eq == NULL) {
+            *image = argv[i];
+            continue;
+        }
+        bool known = false;
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            if (strncmp(argv[i], keys[k].key, (size_t)(eq - argv[i])) == 0 &&
+                keys[k].key[eq - argv[i]] == '\0') {
+                *keys[k].value = (uint32_t)strtoul(eq + 1, NULL, 10);
+                known = true;
+            }
+        }
+        if (!known) {
+            printf("SDLOGBENCH,error,arg,%s\r\n", argv[i]);
+            return false;
+        }
+    }
+    if (cfg->seconds == 0U || cfg->period == 0U) {
+        printf("SDLOGBENCH,error,config\r\n");
+        return false;
+    }
+    return true;
+}
+
+static bool host_setup(const char *image) {
+    static uint8_t work[_MAX_SS];
+    (void)remove(image);
+    mock_hal_reset();
+    mock_hal_set_dma_enabled(true);
+    if (!mock_card_open(image, HOST_CARD_BLOCKS)) {
+        printf("SDLOGBENCH,error,image,%s\r\n", image);
+        return false;
+    }
+    mock_card_attach();
+    if (sd_system_init(&s_hspi, &s_cs, 0, false) != 0 ||
+        FATFS_LinkDriver(&SD_Driver, sd_path) != 0 ||
+        f_mkfs(sd_path, FM_FAT | FM_SFD, 0, work, sizeof(work)) != FR_OK ||
+        sd_mount() != FR_OK) {
+        printf("SDLOGBENCH,error,init\r\n");
+        return false;
+    }
+    return true;
+}
+
+static void host_teardown(const char *image) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(sd_path);
+    mock_card_close();
+    (void)remove(image);
+}
+
+int main(int argc, char **argv) {
+    host_config_t cfg;
+    mock_hal_sim_config_t sim;
+    SD_LogBenchConfig bench;
+    static SD_LogBenchResult result;
+    const char *image = HOST_IMAGE;
+    if (!host_args(argc, argv, &cfg, &image)) {
+        return 2;
+    }
+    if (!host_setup(image)) {
+        host_teardown(image);
+        return 1;
+    }
+
+    sd_logbench_defaults(&bench);
+    bench.path = "0:/BENCH.LOG";
+    bench.ui_path = "0:/UI.BIN";
+    bench.duration_ms = cfg.seconds * 1000U;
+    bench.record_period_ms = cfg.period;
+    bench.record_bytes = cfg.record;
+    bench.ui_period_ms = cfg.ui;
+    bench.ui_read_bytes = cfg.uibytes;
+    bench.stat_period_ms = cfg.stat;
+    bench.led_period_ms = cfg.led;
+    bench.led_port = &s_led;
+    bench.led_pin = 1U;
+    printf("SDLOGBENCH,host,seconds=%lu,period=%lu,record=%lu,ui=%lu,uibytes=%lu,stat=%lu,"
+           "led=%lu\r\n",
+           (unsigned long)cfg.seconds, (unsigned long)cfg.period, (unsigned long)cfg.record,
+           (unsigned long)cfg.ui, (unsigned long)cfg.uibytes, (unsigned long)cfg.stat,
+           (unsigned long)cfg.led);
+
+    mock_hal_sim_defaults(&sim);
+    mock_hal_sim_enable(&sim);
+    int res = sd_logbench_run(&bench, &result);
+    mock_hal_sim_enable(NULL);
+    if (res != FR_OK) {
+        printf("SDLOGBENCH,error,run,%d\r\n", res);
+    } else {
+        sd_logbench_print(&result);
+    }
+
+    host_teardown(image);
+    return (res != FR_OK || result.load_errors != 0U || result.logger_error != FR_OK) ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * tests/sd_host_overhead.c
+ *
+ * Host microbenchmark of the driver's own CPU cost per SD_ReadBlocks and
+ * SD_WriteBlocks call: command framing, polling loops, dispatch, stats and
+ * (with USE_FREERTOS off, as in every host build) the lock stubs. The card
+ * emulator answers on the mock bus; the mock HAL's bus hooks stop the clock
+ * while a stub or the emulator runs, so what is left is driver code. The
+ * hook's own cost is calibrated and taken off.
+ *
+ *   sd_host_overhead [iterations] [image]
+ *
+ * One "SDOVH," line per case, figures per call: mean and lowest driver ns,
+ * bus ns (stubs and emulator, for scale), HAL calls, and driver instructions
+ * where Linux perf counters are available ("-" otherwise). Compare builds
+ * of the same host; the absolute figures say nothing about a Cortex-M.
+ */
+
+#define _GNU_SOURCE
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define OVH_IMAGE       "sd_host_overhead.img"
+#define OVH_CARD_BLOCKS 2048U
+#define OVH_SPAN        1024U /* blocks cycled through, so no case rereads one block */
+#define OVH_MAX_BLOCKS  8U
+#define OVH_CALIBRATE   100000U
+
+static SPI_HandleTypeDef s_hspi;
+static GPIO_TypeDef s_cs;
+static SD_Handle_t s_sd;
+static uint8_t s_buf[OVH_MAX_BLOCKS * SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+/* Bus time and hook pairs, accumulated by the hooks. */
+static uint64_t s_bus_ns;
+static uint64_t s_enter_ns;
+static uint64_t s_pairs;
+static int s_perf_fd = -1;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void bus_enter_time(void) {
+    s_enter_ns = now_ns();
+}
+
+static void bus_leave_time(void) {
+    s_bus_ns += now_ns() - s_enter_ns;
+    s_pairs++;
+}
+
+#if defined(__linux__)
+/* User-space instructions in this thread, or -1 when the kernel offers no counter. */
+static int perf_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t perf_read(void) {
+    uint64_t count = 0;
+    if (read(s_perf_fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+        return 0;
+    }
+    return count;
+}
+
+static void bus_enter_perf(void) {
+    ioctl(s_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+static void bus_leave_perf(void) {
+    ioctl(s_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    s_pairs++;
+}
+#endif
+
+typedef struct {
+    const char *op;
+    bool write;
+    uint32_t blocks;
+    bool use_dma;
+} ovh_case_t;
+
+typedef struct {
+    double drv_ns;
+    double min_ns;
+    double bus_ns;
+    double hal_calls;
+    double instr; // < 0: not measured
+} ovh_result_t;
+
+static int hal_calls(void) {
+    return mock_hal_transmit_calls + mock_hal_transmitrec_calls + mock_hal_dma_tx_calls +
+           mock_hal_dma_rx_calls + mock_hal_it_tx_calls + mock_hal_it_rx_calls +
+           mock_hal_ll_bytes;
+}
+
+static SD_Status run_one(const ovh_case_t *c, uint32_t i) {
+    uint32_t sector = (i * c->blocks) % OVH_SPAN;
+    return c->write ? SD_WriteBlocks(&s_sd, s_buf, sector, c->blocks)
+                    : SD_ReadBlocks(&s_sd, s_buf, sector, c->blocks);
+}
+
+/* Host ns a hook pair costs outside the bus window. */
+static double calibrate_time(void) {
+    s_bus_ns = 0;
+    s_pairs = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < OVH_CALIBRATE; i++) {
+        bus_enter_time();
+        bus_leave_time();
+    }
+    uint64_t total = now_ns() - start;
+    return (double)(total - s_bus_ns) / (double)OVH_CALIBRATE;
+}
+
+static bool measure_time(const ovh_case_t *c, uint32_t iterations, double pair_ns,
+                         ovh_result_t *out) {
+    double min_ns = 1e30;
+    uint64_t drv_total = 0;
+    uint64_t bus_total = 0;
+    int calls_before = hal_calls();
+
+    mock_hal_set_bus_hooks(bus_enter_time, bus_leave_time);
+    for (uint32_t i = 0; i < iterations; i++) {
+        s_bus_ns = 0;
+        s_pairs = 0;
+        uint64_t start = now_ns();
+        SD_Status st = run_one(c, i);
+        uint64_t total = now_ns() - start;
+        if (st != SD_OK) {
+            mock_hal_set_bus_hooks(NULL, NULL);
+            printf("SDOVH,error,%s,%d\r\n", c->op, (int)st);
+            return false;
+        }
+        double drv = (double)(total - s_bus_ns) - pair_ns * (double)s_pairs;
+        if (drv < 0.0) {
+            drv = 0.0;
+        }
+        if (drv < min_ns) {
+            min_ns = drv;
+        }
+        drv_total += (uint64_t)drv;
+        bus_total += s_bus_ns;
+    }
+    mock_hal_set_bus_hooks(NULL, NULL);
+
+    out->drv_ns = (double)drv_total / iterations;
+    out->min_ns = min_ns;
+    out->bus_ns = (double)bus_total / iterations;
+    out->hal_calls = (double)(hal_calls() - calls_before) / iterations;
+    return true;
+}
+
+static void measure_instructions(const ovh_case_t *c, uint32_t iterations, ovh_result_t *out) {
+    out->instr = -1.0;
+#if defined(__linux__)
+    if (s_perf_fd < 0) {
+        return;
+    }
+    /* Instructions one hook pair leaves on the counter. */
+    s_pairs = 0;
+    ioctl(s_perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(s_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    for (uint32_t i = 0; i < OVH_CALIBRATE; i++) {
+        bus_enter_perf();
+        bus_leave_perf();
+    }
+    ioctl(s_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    double pair_instr = (double)perf_read() / OVH_CALIBRATE;
+
+    s_pairs = 0;
+    mock_hal_set_bus_hooks(bus_enter_perf, bus_leave_perf);
+    ioctl(s_perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(s_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    for (uint32_t i = 0; i < iterations; i++) {
+        (void)run_one(c, i);
+    }
+    ioctl(s_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    mock_hal_set_bus_hooks(NULL, NULL);
+    double instr = (double)perf_read() - pair_instr * (double)s_pairs;
+    out->instr = (instr > 0.0) ? instr / iterations : 0.0;
+#else
+    (void)c;
+    (void)iterations;
+#endif
+}
+
+static bool setup(const char *image) {
+    (void)remove(image);
+    mock_hal_reset();
+    mock_hal_set_dma_enabled(true);
+    if (!mock_card_open(image, OVH_CARD_BLOCKS)) {
+        printf("SDOVH,error,image,%s\r\n", image);
+        return false;
+    }
+    mock_card_attach();
+    if (SD_Init(&s_sd, &s_hspi, &s_cs, 0, false) != SD_OK || SD_SPI_Init(&s_sd) != SD_OK) {
+        printf("SDOVH,error,init\r\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    static const ovh_case_t cases[] = {
+        {"read", false, 1U, false},  {"write", true, 1U, false},
+        {"read", false, 8U, false},  {"write", true, 8U, false},
+        {"read", false, 1U, true},   {"write", true, 1U, true},
+        {"read", false, 8U, true},   {"write", true, 8U, true},
+    };
+    uint32_t iterations = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 2000U;
+    const char *image = (argc > 2) ? argv[2] : OVH_IMAGE;
+    int rc = 0;
+
+    if (iterations == 0U) {
+        iterations = 1U;
+    }
+    if (!setup(image)) {
+        mock_card_close();
+        (void)remove(image);
+        return 1;
+    }
+#if defined(__linux__)
+    s_perf_fd = perf_open();
+#endif
+    memset(s_buf, 0x5A, sizeof(s_buf));
+    double pair_ns = calibrate_time();
+
+    printf("SDOVH,op,mode,blocks,calls,drv_ns,drv_min_ns,bus_ns,hal_calls,drv_instr\r\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const ovh_case_t *c = &cases[i];
+        ovh_result_t r;
+        s_sd.use_dma = c->use_dma;
+        (void)run_one(c, 0U); /* warm caches and the card's state */
+        if (!measure_time(c, iterations, pair_ns, &r)) {
+            rc = 1;
+            continue;
+        }
+        measure_instructions(c, iterations, &r);
+        char instr[24];
+        if (r.instr < 0.0) {
+            snprintf(instr, sizeof(instr), "-");
+        } else {
+            snprintf(instr, sizeof(instr), "%.0f", r.instr);
+        }
+        printf("SDOVH,%s,%s,%lu,%lu,%.0f,%.0f,%.0f,%.1f,%s\r\n", c->op,
+               c->use_dma ? "dma" : "poll", (unsigned long)c->blocks, (unsigned long)iterations,
+               r.drv_ns, r.min_ns, r.bus_ns, r.hal_calls, instr);
+    }
+
+#if defined(__linux__)
+    if (s_perf_fd >= 0) {
+        close(s_perf_fd);
+    }
+#endif
+    mock_card_close();
+    (void)remove(image);
+    return rc;
+}
@@ -0,0 +1,215 @@
+/*
+ * tests/sd_host_replay.c
+ *
+ * Host-side replay of a field I/O trace: reads the SDCAP lines a board
+ * printed (SD_DiskCaptureDump) or saved (sd_capture_save), replays every
+ * call against the card emulator through the real driver with
+ * SD_DiskCaptureReplay, timed by the mock HAL simulator (25 MHz SCK with
+ * class-10 latencies, mock_hal_sim_defaults), and prints per-operation
+ * latency next to what the board recorded. Driver changes can then be
+ * judged on the workload that matters. Not a Unity test; CTest runs the
+ * built-in "demo" trace as a smoke test.
+ *
+ *   sd_host_replay <trace.txt | demo> [image] [gaps]
+ *
+ * Every drive number is replayed on drive 0, on a card just large enough
+ * for the trace. "gaps" keeps the recorded idle time between calls, for
+ * drivers whose behaviour depends on it (background flushes, card GC).
+ */
+
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_IMAGE       "sd_host_replay.img"
+#define HOST_MAX_RECORDS 65536U
+#define HOST_BUF_SECTORS 64U
+#define HOST_MIN_BLOCKS  16384U /* 8 MiB */
+#define HOST_DEMO_BLOCKS 16384U
+
+static SPI_HandleTypeDef s_hspi;
+static GPIO_TypeDef s_cs;
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[HOST_BUF_SECTORS * 512U];
+static SD_DiskCaptureRecord s_rec[HOST_MAX_RECORDS];
+static uint32_t s_orig_duration[HOST_MAX_RECORDS];
+static uint32_t s_sorted[HOST_MAX_RECORDS];
+
+static const char *const s_op_name[] = {"read", "write", "sync", "trim", "ioctl"};
+
+static bool host_card(const char *image, uint32_t blocks) {
+    (void)remove(image);
+    mock_hal_reset();
+    mock_hal_set_dma_enabled(true);
+    if (!mock_card_open(image, blocks)) {
+        printf("SDREPLAY,error,image,%s\r\n", image);
+        return false;
+    }
+    mock_card_attach();
+    if (SD_DiskIoInit(&s_hspi, &s_cs, 0, false) != SD_OK ||
+        FATFS_LinkDriver(&SD_Driver, s_path) != 0) {
+        printf("SDREPLAY,error,init\r\n");
+        return false;
+    }
+    return true;
+}
+
+static void host_teardown(const char *image) {
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+    (void)remove(image);
+}
+
+/* A logger-like FatFs workload captured on the emulator, for the smoke test. */
+static uint32_t host_demo(const char *image, uint32_t *clock) {
+    static uint8_t work[_MAX_SS];
+    mock_hal_sim_config_t cfg;
+    UINT bw = 0;
+    uint32_t n = 0;
+    if (!host_card(image, HOST_DEMO_BLOCKS) ||
+        f_mkfs(s_path, FM_FAT | FM_SFD, 0, work, sizeof(work)) != FR_OK ||
+        f_mount(&s_fs, s_path, 1) != FR_OK) {
+        return 0;
+    }
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    memset(s_buf, 0x3C, sizeof(s_buf));
+    SD_DiskCaptureStart();
+    if (f_open(&s_fil, "0:/LOG.BIN", FA_WRITE | FA_CREATE_ALWAYS) == FR_OK) {
+        for (uint32_t i = 0; i < 32U; i++) {
+            (void)f_write(&s_fil, s_buf, 700U, &bw);
+            if ((i % 8U) == 7U) {
+                (void)f_sync(&s_fil);
+                HAL_Delay(2U);
+            }
+        }
+        (void)f_close(&s_fil);
+    }
+    if (f_open(&s_fil, "0:/LOG.BIN", FA_READ) == FR_OK) {
+        while (f_read(&s_fil, s_buf, 4096U, &bw) == FR_OK && bw > 0U) {
+        }
+        (void)f_close(&s_fil);
+    }
+    SD_DiskCaptureStop();
+    n = SD_DiskCaptureRead(s_rec, HOST_MAX_RECORDS);
+    *clock = SystemCoreClock;
+    (void)f_mount(NULL, s_path, 0);
+    host_teardown(image);
+    return n;
+}
+
+static uint32_t host_load(const char *trace, uint32_t *clock) {
+    char line[128];
+    uint32_t n = 0;
+    FILE *f = fopen(trace, "r");
+    if (!f) {
+        printf("SDREPLAY,error,trace,%s\r\n", trace);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL && n < HOST_MAX_RECORDS) {
+        if (strncmp(line, "SDCAP,clock,", 12) == 0) {
+            *clock = (uint32_t)strtoul(line + 12, NULL, 10);
+        } else if (SD_DiskCaptureParse(line, &s_rec[n])) {
+            s_rec[n].pdrv = 0;
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t cycles_to_us(uint64_t cycles, uint32_t clock) {
+    return (clock >= 1000000U) ? (uint32_t)(cycles / (clock / 1000000U)) : 0U;
+}
+
+static void host_report(uint32_t n, uint32_t clock) {
+    for (uint8_t op = SD_DISK_OP_READ; op <= SD_DISK_OP_TRIM; op++) {
+        uint32_t calls = 0;
+        uint64_t sectors = 0;
+        uint64_t total = 0;
+        uint64_t orig_total = 0;
+        uint32_t orig_max = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (s_rec[i].op != op) {
+                continue;
+            }
+            s_sorted[calls++] = s_rec[i].duration;
+            sectors += s_rec[i].count;
+            total += s_rec[i].duration;
+            orig_total += s_orig_duration[i];
+            if (s_orig_duration[i] > orig_max) {
+                orig_max = s_orig_duration[i];
+            }
+        }
+        if (calls == 0U) {
+            continue;
+        }
+        qsort(s_sorted, calls, sizeof(s_sorted[0]), cmp_u32);
+        printf("SDREPLAY,%s,%lu,%llu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", s_op_name[op],
+               (unsigned long)calls, (unsigned long long)sectors,
+               (unsigned long)cycles_to_us(total / calls, SystemCoreClock),
+               (unsigned long)cycles_to_us(s_sorted[calls / 2U], SystemCoreClock),
+               (unsigned long)cycles_to_us(s_sorted[(calls * 99U) / 100U], SystemCoreClock),
+               (unsigned long)cycles_to_us(s_sorted[calls - 1U], SystemCoreClock),
+               (unsigned long)cycles_to_us(orig_total / calls, clock),
+               (unsigned long)cycles_to_us(orig_max, clock));
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: sd_host_replay <trace.txt|demo> [image] [gaps]\r\n");
+        return 2;
+    }
+    const char *image = (argc > 2) ? argv[2] : HOST_IMAGE;
+    bool gaps = (argc > 3 && strcmp(argv[3], "gaps") == 0);
+    uint32_t clock = 0;
+    uint32_t n = (strcmp(argv[1], "demo") == 0) ? host_demo(image, &clock)
+                                                : host_load(argv[1], &clock);
+    if (n == 0U) {
+        printf("SDREPLAY,error,empty\r\n");
+        return 1;
+    }
+
+    uint32_t blocks = HOST_MIN_BLOCKS;
+    for (uint32_t i = 0; i < n; i++) {
+        s_orig_duration[i] = s_rec[i].duration;
+        if ((s_rec[i].op == SD_DISK_OP_READ || s_rec[i].op == SD_DISK_OP_WRITE ||
+             s_rec[i].op == SD_DISK_OP_TRIM) &&
+            s_rec[i].sector + s_rec[i].count > blocks) {
+            blocks = s_rec[i].sector + s_rec[i].count;
+        }
+    }
+    mock_hal_sim_config_t cfg;
+    if (!host_card(image, blocks) || SD_Driver.disk_initialize(0) != 0) {
+        host_teardown(image);
+        return 1;
+    }
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    printf("SDREPLAY,host,records=%lu,blocks=%lu,clock=%lu,%s\r\n", (unsigned long)n,
+           (unsigned long)blocks, (unsigned long)clock, gaps ? "gaps" : "back-to-back");
+    SD_Status status = SD_DiskCaptureReplay(s_rec, n, s_buf, HOST_BUF_SECTORS, gaps);
+    host_report(n, clock);
+
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    printf("SDREPLAY,sim,elapsed_us=%llu,bytes=%llu,bus_permille=%lu,status=%d\r\n",
+           (unsigned long long)(rep.elapsed_ns / 1000U), (unsigned long long)rep.bytes,
+           (unsigned long)mock_hal_sim_utilization_permille(&rep), (int)status);
+    host_teardown(image);
+    return (status == SD_OK) ? 0 : 1;
+}
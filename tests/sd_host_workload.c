@@ -0,0 +1,301 @@
+/*
+ * tests/sd_host_workload.c
+ *
+ * Synthetic application workload on the host simulator: N appenders adding
+ * text records to their own log files through sd_append_file, a periodic
+ * sd_file_cache_flush, random configuration reads through sd_read_file, and
+ * rotation that starts a new file once one reaches a size and deletes the
+ * oldest kept. Everything goes through sd_functions.c, FatFs and the real
+ * driver against the card emulator, timed by the mock HAL simulator (25 MHz
+ * SCK with class-10 latencies, mock_hal_sim_defaults). Prints throughput and
+ * per-operation latency so cache and driver configurations (one executable
+ * per configuration, see tests/CMakeLists.txt) can be compared without a
+ * board. Not a Unity test; CTest runs a short pass as a smoke test.
+ *
+ *   sd_host_workload [key=value ...] [image]
+ *
+ *   appenders=4   log writers, each with its own file (at most 16)
+ *   record=96     bytes per record, newline included
+ *   records=2000  records per appender
+ *   sync=16       flush the write handles every this many records (0 = never)
+ *   config=50     permille of records followed by a configuration file read
+ *   rotate=32     KiB per log file before the writer moves to a new one
+ *   keep=2        rotated files kept per writer; older ones are deleted
+ *   period=0      simulated ms between record rounds (0 = back to back)
+ *   seed=1
+ */
+
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_IMAGE       "sd_host_workload.img"
+#define HOST_CARD_BLOCKS 65536U /* 32 MiB */
+#define HOST_MAX_WRITERS 16U
+#define HOST_MAX_SAMPLES 65536U
+#define HOST_CONFIGS     4U
+#define HOST_CONFIG_SIZE 600U
+
+typedef enum { OP_APPEND = 0, OP_SYNC, OP_CONFIG, OP_ROTATE, OP_COUNT } host_op_t;
+
+static const char *const s_op_name[OP_COUNT] = {"append", "sync", "config", "rotate"};
+
+typedef struct {
+    uint32_t appenders;
+    uint32_t record;
+    uint32_t records;
+    uint32_t sync;
+    uint32_t config;
+    uint32_t rotate;
+    uint32_t keep;
+    uint32_t period;
+    uint32_t seed;
+} host_config_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t errors;
+    uint64_t total;
+    uint32_t samples[HOST_MAX_SAMPLES];
+} host_lat_t;
+
+typedef struct {
+    uint32_t generation;
+    uint32_t bytes;
+} host_writer_t;
+
+static SPI_HandleTypeDef s_hspi;
+static GPIO_TypeDef s_cs;
+static host_lat_t s_lat[OP_COUNT];
+static host_writer_t s_writer[HOST_MAX_WRITERS];
+static uint32_t s_rng;
+static char s_record[512];
+static char s_text[HOST_CONFIG_SIZE + 1U];
+
+static uint32_t host_rand(void) {
+    s_rng = s_rng * 1664525U + 1013904223U;
+    return s_rng >> 8;
+}
+
+static bool host_args(int argc, char **argv, host_config_t *cfg, const char **image) {
+    struct {
+        const char *key;
+        uint32_t *value;
+    } keys[] = {
+        {"appenders", &cfg->appenders}, {"record", &cfg->record}, {"records", &cfg->records},
+        {"sync", &cfg->sync},           {"config", &cfg->config}, {"rotate", &cfg->rotate},
+        {"keep", &cfg->keep},           {"period", &cfg->period}, {"seed", &cfg->seed},
+    };
+    *cfg = (host_config_t){4U, 96U, 2000U, 16U, 50U, 32U, 2U, 0U, 1U};
+    for (int i = 1; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        if (eq == NULL) {
+            *image = argv[i];
+            continue;
+        }
+        bool known = false;
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            if (strncmp(argv[i], keys[k].key, (size_t)(eq - argv[i])) == 0 &&
+                keys[k].key[eq - argv[i]] == '\0') {
+                *keys[k].value = (uint32_t)strtoul(eq + 1, NULL, 10);
+                known = true;
+            }
+        }
+        if (!known) {
+            printf("SDWORK,error,arg,%s\r\n", argv[i]);
+            return false;
+        }
+    }
+    if (cfg->appenders == 0U || cfg->appenders > HOST_MAX_WRITERS || cfg->record < 2U ||
+        cfg->record >= sizeof(s_record) || cfg->rotate == 0U) {
+        printf("SDWORK,error,config\r\n");
+        return false;
+    }
+    return true;
+}
+
+/* Fresh card, driver, FAT volume and configuration files; the simulator starts after. */
+static bool host_setup(const char *image) {
+    static uint8_t work[_MAX_SS];
+    (void)remove(image);
+    mock_hal_reset();
+    mock_hal_set_dma_enabled(true);
+    if (!mock_card_open(image, HOST_CARD_BLOCKS)) {
+        printf("SDWORK,error,image,%s\r\n", image);
+        return false;
+    }
+    mock_card_attach();
+    if (sd_system_init(&s_hspi, &s_cs, 0, false) != 0 ||
+        FATFS_LinkDriver(&SD_Driver, sd_path) != 0 ||
+        f_mkfs(sd_path, FM_FAT | FM_SFD, 0, work, sizeof(work)) != FR_OK ||
+        sd_mount() != FR_OK || f_mkdir("0:/CFG") != FR_OK || f_mkdir("0:/LOG") != FR_OK) {
+        printf("SDWORK,error,init\r\n");
+        return false;
+    }
+    memset(s_text, '#', HOST_CONFIG_SIZE);
+    s_text[HOST_CONFIG_SIZE] = '\0';
+    for (uint32_t i = 0; i < HOST_CONFIGS; i++) {
+        char path[24];
+        snprintf(path, sizeof(path), "0:/CFG/C%lu.CFG", (unsigned long)i);
+        if (sd_write_file(path, s_text) != FR_OK) {
+            printf("SDWORK,error,config_file\r\n");
+            return false;
+        }
+    }
+    (void)sd_file_cache_close(NULL);
+    return true;
+}
+
+static void host_teardown(const char *image) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(sd_path);
+    mock_card_close();
+    (void)remove(image);
+}
+
+static void log_path(char *path, size_t len, uint32_t writer, uint32_t generation) {
+    snprintf(path, len, "0:/LOG/W%02lu_%04lu.LOG", (unsigned long)writer,
+             (unsigned long)generation);
+}
+
+/* Time one call in DWT cycles (the simulator drives the counter). */
+static void host_timed(host_op_t op, int res, uint32_t start) {
+    host_lat_t *lat = &s_lat[op];
+    uint32_t cycles = DWT->CYCCNT - start;
+    if (lat->calls < HOST_MAX_SAMPLES) {
+        lat->samples[lat->calls] = cycles;
+    }
+    lat->calls++;
+    lat->total += cycles;
+    if (res != FR_OK) {
+        lat->errors++;
+    }
+}
+
+static void host_rotate(const host_config_t *cfg, uint32_t w) {
+    char path[32];
+    uint32_t start = DWT->CYCCNT;
+    host_writer_t *wr = &s_writer[w];
+    log_path(path, sizeof(path), w, wr->generation);
+    int res = sd_file_cache_close(path);
+    wr->generation++;
+    wr->bytes = 0;
+    if (res == FR_OK && wr->generation > cfg->keep) {
+        log_path(path, sizeof(path), w, wr->generation - cfg->keep - 1U);
+        res = sd_delete_file(path);
+    }
+    host_timed(OP_ROTATE, res, start);
+}
+
+static void host_run(const host_config_t *cfg) {
+    char path[32];
+    UINT n = 0;
+    for (uint32_t r = 0; r < cfg->records; r++) {
+        for (uint32_t w = 0; w < cfg->appenders; w++) {
+            int len = snprintf(s_record, sizeof(s_record), "%08lu,%02lu,",
+                               (unsigned long)r, (unsigned long)w);
+            memset(&s_record[len], 'a' + (char)(w % 26U), cfg->record - 1U - (uint32_t)len);
+            s_record[cfg->record - 1U] = '\n';
+            s_record[cfg->record] = '\0';
+            log_path(path, sizeof(path), w, s_writer[w].generation);
+            uint32_t start = DWT->CYCCNT;
+            host_timed(OP_APPEND, sd_append_file(path, s_record), start);
+            s_writer[w].bytes += cfg->record;
+            if (s_writer[w].bytes >= cfg->rotate * 1024U) {
+                host_rotate(cfg, w);
+            }
+            if (host_rand() % 1000U < cfg->config) {
+                snprintf(path, sizeof(path), "0:/CFG/C%lu.CFG",
+                         (unsigned long)(host_rand() % HOST_CONFIGS));
+                start = DWT->CYCCNT;
+                host_timed(OP_CONFIG, sd_read_file(path, s_text, sizeof(s_text), &n), start);
+            }
+        }
+        if (cfg->sync > 0U && (r + 1U) % cfg->sync == 0U) {
+            uint32_t start = DWT->CYCCNT;
+            host_timed(OP_SYNC, sd_file_cache_flush(), start);
+        }
+        if (cfg->period > 0U) {
+            HAL_Delay(cfg->period);
+        }
+    }
+    uint32_t start = DWT->CYCCNT;
+    host_timed(OP_SYNC, sd_file_cache_close(NULL), start);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long cycles_us(uint64_t cycles) {
+    return (unsigned long)(cycles / (SystemCoreClock / 1000000U));
+}
+
+static void host_report(const host_config_t *cfg) {
+    mock_hal_sim_report_t rep;
+    mock_card_stats_t cs;
+    uint64_t payload = (uint64_t)cfg->appenders * cfg->records * cfg->record;
+    mock_hal_sim_report(&rep);
+    mock_card_get_stats(&cs);
+
+    for (uint32_t op = 0; op < OP_COUNT; op++) {
+        host_lat_t *lat = &s_lat[op];
+        uint32_t kept = (lat->calls < HOST_MAX_SAMPLES) ? lat->calls : HOST_MAX_SAMPLES;
+        if (kept == 0U) {
+            continue;
+        }
+        qsort(lat->samples, kept, sizeof(lat->samples[0]), cmp_u32);
+        printf("SDWORK,%s,%lu,%lu,%lu,%lu,%lu,%lu\r\n", s_op_name[op],
+               (unsigned long)lat->calls, (unsigned long)lat->errors,
+               cycles_us(lat->total / lat->calls), cycles_us(lat->samples[kept / 2U]),
+               cycles_us(lat->samples[(kept * 99U) / 100U]), cycles_us(lat->samples[kept - 1U]));
+    }
+    printf("SDWORK,total,payload=%llu,elapsed_us=%llu,kib_per_s=%lu,bus_permille=%lu,"
+           "cmd17=%lu,cmd18=%lu,cmd24=%lu,cmd25=%lu\r\n",
+           (unsigned long long)payload, (unsigned long long)(rep.elapsed_ns / 1000U),
+           (unsigned long)mock_hal_sim_kib_per_s(&rep, payload),
+           (unsigned long)mock_hal_sim_utilization_permille(&rep), (unsigned long)cs.cmd[17],
+           (unsigned long)cs.cmd[18], (unsigned long)cs.cmd[24], (unsigned long)cs.cmd[25]);
+}
+
+int main(int argc, char **argv) {
+    host_config_t cfg;
+    mock_hal_sim_config_t sim;
+    const char *image = HOST_IMAGE;
+    if (!host_args(argc, argv, &cfg, &image)) {
+        return 2;
+    }
+    if (!host_setup(image)) {
+        host_teardown(image);
+        return 1;
+    }
+    s_rng = (cfg.seed != 0U) ? cfg.seed : 1U;
+    printf("SDWORK,host,appenders=%lu,record=%lu,records=%lu,sync=%lu,config=%lu,rotate=%lu,"
+           "keep=%lu,period=%lu,cache_lines=%lu\r\n",
+           (unsigned long)cfg.appenders, (unsigned long)cfg.record, (unsigned long)cfg.records,
+           (unsigned long)cfg.sync, (unsigned long)cfg.config, (unsigned long)cfg.rotate,
+           (unsigned long)cfg.keep, (unsigned long)cfg.period,
+           (unsigned long)(SD_CACHE_ENABLED ? SD_CACHE_LINES : 0U));
+    printf("SDWORK,op,calls,errors,mean_us,p50_us,p99_us,max_us\r\n");
+
+    mock_card_reset_stats();
+    mock_hal_sim_defaults(&sim);
+    mock_hal_sim_enable(&sim);
+    host_run(&cfg);
+    host_report(&cfg);
+
+    bool failed = false;
+    for (uint32_t op = 0; op < OP_COUNT; op++) {
+        failed = failed || (s_lat[op].errors > 0U);
+    }
+    host_teardown(image);
+    return failed ? 1 : 0;
+}
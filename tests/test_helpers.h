@@ -22,10 +22,17 @@
 #ifndef __TEST_HELPERS_H__
 #define __TEST_HELPERS_H__
 
+#include "unity.h"
 #include "mock_hal.h"
+#include "mock_card.h"
 #include "sd_spi.h"
 #include <stdint.h>
 #include <string.h>
+#ifdef SD_TEST_FATFS
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#endif
 
 /* Test SD handle and peripheral stubs used across all test files. */
 static SPI_HandleTypeDef g_test_hspi = {0};
@@ -81,6 +88,25 @@ static inline void push_crc(void) {
     mock_hal_push_byte(0xFFU);
 }
 
+/* CRC7 (x^7 + x^3 + 1) as carried in byte 15 of the CSD/CID registers. */
+static inline uint8_t test_crc7(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc <<= 1;
+            if ((byte ^ crc) & 0x80U) crc ^= 0x09U;
+            byte <<= 1;
+        }
+    }
+    return crc & 0x7FU;
+}
+
+/* Fill byte 15 of a 16-byte register with its CRC7 and end bit. */
+static inline void set_reg_crc7(uint8_t *reg) {
+    reg[15] = (uint8_t)((test_crc7(reg, 15) << 1) | 0x01U);
+}
+
 /*
  * Push a 16-byte SDHC (CSD v2) register encoding capacity_blocks blocks.
  *
@@ -100,6 +126,7 @@ static inline void push_csd_sdhc(uint32_t capacity_blocks) {
     csd[7] = (uint8_t)((c_size >> 16) & 0x3FU);
     csd[8] = (uint8_t)((c_size >>  8) & 0xFFU);
     csd[9] = (uint8_t)( c_size        & 0xFFU);
+    set_reg_crc7(csd);
     mock_hal_push_bytes(csd, 16);
 }
 
@@ -108,7 +135,7 @@ static inline void push_csd_sdhc(uint32_t capacity_blocks) {
  * Uses fixed parameters: READ_BL_LEN=9, C_SIZE=1023, C_SIZE_MULT=1 → 8192 blocks.
  */
 static inline void push_csd_sdsc_4mb(void) {
-    static const uint8_t csd[16] = {
+    uint8_t csd[16] = {
         0x00U, 0x00U, 0x00U, 0x00U, 0x00U,
         0x09U,        /* READ_BL_LEN = 9 */
         0x00U,        /* c_size[11:10] = 0 */
@@ -118,6 +145,7 @@ static inline void push_csd_sdsc_4mb(void) {
         0x80U,        /* c_size_mult[0]   = 1 (bit 7) */
         0x00U, 0x00U, 0x00U, 0x00U, 0x00U
     };
+    set_reg_crc7(csd);
     mock_hal_push_bytes(csd, 16);
 }
 
@@ -130,6 +158,22 @@ static inline void push_cmd_exchange(uint8_t r1) {
     push_r1(r1);
 }
 
+/*
+ * Count the CMD frames with index cmd in the transmit log: a 0xFF lead-in
+ * byte followed by the 0x40 | cmd start byte.
+ */
+static inline int count_cmd_frames(uint8_t cmd) {
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    int n = 0;
+    for (size_t i = 0; i + 6U < len; i++) {
+        if (tx[i] == 0xFFU && tx[i + 1U] == (uint8_t)(0x40U | cmd)) {
+            n++;
+        }
+    }
+    return n;
+}
+
 /* -----------------------------------------------------------------------
  * Composite initialization sequences
  * ----------------------------------------------------------------------- */
@@ -190,6 +234,22 @@ static inline void push_single_read(uint8_t fill_byte) {
     push_crc();
 }
 
+/*
+ * Push bytes for one CMD18 read of count blocks, terminated with a CMD12
+ * exchange. Block i is filled with (first + i), so each block is told apart.
+ */
+static inline void push_multi_read_distinct(uint32_t count, uint8_t first) {
+    uint8_t data[512];
+    push_cmd_exchange(0x00U);    /* CMD18 response */
+    for (uint32_t i = 0; i < count; i++) {
+        memset(data, (uint8_t)(first + i), sizeof(data));
+        push_data_token();
+        mock_hal_push_bytes(data, 512);
+        push_crc();
+    }
+    push_cmd_exchange(0x00U);    /* CMD12 */
+}
+
 /*
  * Push bytes for one CMD24 write that is accepted by the card.
  * Write data comes from the caller's buffer (transmit-only, not in queue).
@@ -233,4 +293,40 @@ static inline SD_Status do_sdsc_init(SD_Handle_t *sd) {
     return SD_SPI_Init(sd);
 }
 
+/* -----------------------------------------------------------------------
+ * Card emulator fixtures
+ * ----------------------------------------------------------------------- */
+
+/*
+ * Reset the HAL mock and attach a fresh zero-filled card image of blocks
+ * blocks, so no test sees what an earlier test or run left on it.
+ */
+static inline void test_card_fresh(const char *image, uint32_t blocks) {
+    mock_hal_reset();
+    TEST_ASSERT_TRUE(mock_card_create(image, blocks));
+    mock_card_attach();
+}
+
+/* The emulator's counters since the last mock_card_reset_stats, by value. */
+static inline mock_card_stats_t card_stats(void) {
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    return st;
+}
+
+#ifdef SD_TEST_FATFS
+/*
+ * Fresh card behind diskio drive 0, linked to FatFs at path and formatted
+ * with f_mkfs(opt, au); mount it afterwards (sd_mount or f_mount).
+ */
+static inline void test_fatfs_fresh(const char *image, uint32_t blocks, char *path, BYTE opt,
+                                    DWORD au) {
+    static uint8_t work[_MAX_SS];
+    test_card_fresh(image, blocks);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(path, opt, au, work, sizeof(work)));
+}
+#endif
+
 #endif /* __TEST_HELPERS_H__ */
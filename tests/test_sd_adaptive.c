@@ -0,0 +1,94 @@
+/*
+ * tests/test_sd_adaptive.c
+ *
+ * Adaptive data timeouts (SD_ADAPTIVE_TIMEOUTS=1, 16 samples minimum, see
+ * CMakeLists.txt) on the timing simulator: the fixed limits until enough
+ * waits are seen, a learned write-busy limit from a steady card, and the
+ * early timeout that drops it again when the card stalls longer.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+static mock_hal_sim_config_t cfg;
+
+static void write_n(uint32_t n) {
+    uint8_t buf[512] = {0};
+    for (uint32_t i = 0; i < n; i++) {
+        push_single_write_accepted();
+        TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, i, 1));
+    }
+}
+
+static uint32_t write_limit(void) {
+    uint32_t read_ms = 0;
+    uint32_t write_ms = 0;
+    SD_GetDataTimeouts(&sd, &read_ms, &write_ms);
+    TEST_ASSERT_EQUAL_UINT32(SD_DATA_TOKEN_TIMEOUT_MS, read_ms);
+    return write_ms;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.spi_hz = 10000000U;
+    cfg.seed = 3U;
+    cfg.program_busy = (mock_hal_sim_dist_t){ 1000U, 2500U, 0U, 0U };
+    mock_hal_sim_enable(&cfg);
+}
+
+void tearDown(void) {}
+
+void test_Adaptive_FixedLimitsUntilMinSamples(void) {
+    write_n(SD_ADAPT_MIN_SAMPLES - 1U);
+    TEST_ASSERT_EQUAL_UINT32(SD_WRITE_BUSY_TIMEOUT_MS, write_limit());
+
+    uint32_t read_ms = 0;
+    SD_GetDataTimeouts(NULL, &read_ms, NULL);
+    TEST_ASSERT_EQUAL_UINT32(SD_DATA_TOKEN_TIMEOUT_MS, read_ms);
+}
+
+/* 1..2.5 ms busy reads as at most 3 ticks: the [3,4) band, 4 ms x400 % = 16 ms. */
+void test_Adaptive_LearnsWriteLimitFromSteadyCard(void) {
+    write_n(SD_ADAPT_MIN_SAMPLES);
+    uint32_t limit = write_limit();
+    TEST_ASSERT_TRUE(limit >= SD_ADAPT_FLOOR_MS);
+    TEST_ASSERT_TRUE(limit <= 16U);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.early_timeouts);
+}
+
+void test_Adaptive_LongerStall_TimesOutEarly_AndForgets(void) {
+    uint8_t buf[512] = {0};
+    write_n(SD_ADAPT_MIN_SAMPLES);
+    uint32_t learned = write_limit();
+    TEST_ASSERT_TRUE(learned < SD_WRITE_BUSY_TIMEOUT_MS);
+
+    cfg.program_busy = (mock_hal_sim_dist_t){ 0U, 0U, 40000U, 1000U };
+    mock_hal_sim_enable(&cfg);
+    for (int attempt = 0; attempt < 3; attempt++) {
+        push_single_write_accepted();
+    }
+    uint32_t start = HAL_GetTick();
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.early_timeouts);
+    TEST_ASSERT_EQUAL_UINT32(SD_WRITE_BUSY_TIMEOUT_MS, write_limit());
+    TEST_ASSERT_TRUE(HAL_GetTick() - start >= 40U);
+    TEST_ASSERT_TRUE(HAL_GetTick() - start < SD_WRITE_BUSY_TIMEOUT_MS);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Adaptive_FixedLimitsUntilMinSamples);
+    RUN_TEST(test_Adaptive_LearnsWriteLimitFromSteadyCard);
+    RUN_TEST(test_Adaptive_LongerStall_TimesOutEarly_AndForgets);
+
+    return UNITY_END();
+}
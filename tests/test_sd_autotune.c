@@ -0,0 +1,153 @@
+/*
+ * tests/test_sd_autotune.c
+ *
+ * Boot-time auto-tuning against the card emulator (SD_CARD_INFO=1, 16 KB per
+ * candidate): the first run tunes, saves the emulator's CID in the file and
+ * removes the scratch file; a matching file is applied as saved; a file for
+ * another card or one that does not parse is replaced; the saved prescaler
+ * is never applied faster than the negotiated one; SD_SetBusPrescaler checks.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_autotune.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_autotune.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+#define CFG         "sdtune.cfg"
+#define STEP        (SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2)
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static char s_text[128];
+
+/* sd_functions.c is not linked; sd_benchmark.c refers to these two. */
+int sd_mount(void) {
+    return f_mount(&s_fs, s_path, 1);
+}
+
+int sd_unmount(void) {
+    return f_mount(NULL, s_path, 0);
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 0);
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static void write_cfg(const char *text) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, CFG, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, text, (UINT)strlen(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+static const char *read_cfg(void) {
+    UINT br = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, CFG, FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_text, sizeof(s_text) - 1U, &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    s_text[br] = '\0';
+    return s_text;
+}
+
+void test_AutoTune_FirstRunTunesAndSaves(void) {
+    SD_TuneConfig cfg;
+    FILINFO fno;
+    uint32_t negotiated = SD_GetBusPrescaler(&g_sd_handle);
+    TEST_ASSERT_EQUAL(FR_OK, sd_autotune(CFG, false, &cfg));
+
+    TEST_ASSERT_EQUAL_HEX8(0x03, cfg.mid);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678UL, cfg.psn);
+    TEST_ASSERT_EQUAL_UINT32(CARD_BLOCKS, cfg.blocks);
+    TEST_ASSERT_TRUE(cfg.chunk_bytes == 512U || cfg.chunk_bytes == 4096U ||
+                     cfg.chunk_bytes == 16384U);
+    TEST_ASSERT_TRUE(cfg.prescaler == negotiated || cfg.prescaler == negotiated + STEP);
+    TEST_ASSERT_TRUE(cfg.kb_per_s > 0U);
+    TEST_ASSERT_EQUAL(cfg.use_dma, g_sd_handle.use_dma);
+    TEST_ASSERT_EQUAL_UINT32(cfg.prescaler, SD_GetBusPrescaler(&g_sd_handle));
+
+    TEST_ASSERT_EQUAL_INT(0, strncmp(read_cfg(), "SDTUNE,1,0x03,0x12345678,16384,", 31));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_TUNE_SCRATCH, &fno));
+}
+
+void test_AutoTune_MatchingFileAppliedAsSaved(void) {
+    static const char saved[] = "SDTUNE,1,0x03,0x12345678,16384,1,0x10,4096,777\r\n";
+    SD_TuneConfig cfg;
+    write_cfg(saved);
+    TEST_ASSERT_EQUAL(FR_OK, sd_autotune(CFG, false, &cfg));
+
+    TEST_ASSERT_TRUE(cfg.use_dma);
+    TEST_ASSERT_EQUAL_HEX32(0x10U, cfg.prescaler);
+    TEST_ASSERT_EQUAL_UINT32(4096U, cfg.chunk_bytes);
+    TEST_ASSERT_EQUAL_UINT32(777U, cfg.kb_per_s);
+    TEST_ASSERT_TRUE(g_sd_handle.use_dma);
+    TEST_ASSERT_EQUAL_HEX32(0x10U, SD_GetBusPrescaler(&g_sd_handle));
+    TEST_ASSERT_EQUAL_STRING(saved, read_cfg());
+}
+
+void test_AutoTune_OtherCardOrBadFileRetunes(void) {
+    SD_TuneConfig cfg;
+    write_cfg("SDTUNE,1,0x03,0x0BADCAFE,16384,1,0x10,4096,777\r\n");
+    TEST_ASSERT_EQUAL(FR_OK, sd_autotune(CFG, false, &cfg));
+    TEST_ASSERT_EQUAL_HEX32(0x12345678UL, cfg.psn);
+    TEST_ASSERT_NOT_NULL(strstr(read_cfg(), ",0x12345678,"));
+
+    write_cfg("SDTUNE,1,garbage\r\n");
+    TEST_ASSERT_EQUAL(FR_OK, sd_autotune(CFG, false, &cfg));
+    TEST_ASSERT_EQUAL_INT(0, strncmp(read_cfg(), "SDTUNE,1,0x03,0x12345678,", 25));
+
+    write_cfg("SDTUNE,1,0x03,0x12345678,16384,1,0x10,4096,777\r\n");
+    TEST_ASSERT_EQUAL(FR_OK, sd_autotune(CFG, true, &cfg));
+    TEST_ASSERT_NULL(strstr(read_cfg(), ",777"));
+}
+
+void test_AutoTune_ApplyNeverFasterThanNegotiated(void) {
+    SD_TuneConfig cfg;
+    uint32_t negotiated = SD_GetBusPrescaler(&g_sd_handle);
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.prescaler = SPI_BAUDRATEPRESCALER_2;
+    cfg.chunk_bytes = 512U;
+    TEST_ASSERT_EQUAL(FR_OK, sd_autotune_apply(&cfg));
+    TEST_ASSERT_EQUAL_HEX32(negotiated, SD_GetBusPrescaler(&g_sd_handle));
+    TEST_ASSERT_FALSE(g_sd_handle.use_dma);
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_autotune_apply(NULL));
+}
+
+void test_SetBusPrescaler_RangeAndInit(void) {
+    SD_Handle_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetBusPrescaler(&g_sd_handle, SPI_BAUDRATEPRESCALER_2));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetBusPrescaler(&g_sd_handle, SD_SPI_FAST_PRESCALER + 1U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetBusPrescaler(NULL, SD_SPI_FAST_PRESCALER));
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_SetBusPrescaler(&fresh, SD_SPI_FAST_PRESCALER));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetBusPrescaler(&g_sd_handle, SD_SPI_INIT_PRESCALER));
+    TEST_ASSERT_EQUAL_HEX32(SD_SPI_INIT_PRESCALER, g_test_hspi.Init.BaudRatePrescaler);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_AutoTune_FirstRunTunesAndSaves);
+    RUN_TEST(test_AutoTune_MatchingFileAppliedAsSaved);
+    RUN_TEST(test_AutoTune_OtherCardOrBadFileRetunes);
+    RUN_TEST(test_AutoTune_ApplyNeverFasterThanNegotiated);
+    RUN_TEST(test_SetBusPrescaler_RangeAndInit);
+
+    return UNITY_END();
+}
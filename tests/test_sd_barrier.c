@@ -0,0 +1,179 @@
+/*
+ * tests/test_sd_barrier.c
+ *
+ * Ordered write-back through the diskio layer (SD_CACHE_ENABLED=1) against
+ * the card emulator: SD_CTRL_SYNC_DATA leaves metadata dirty, SD_CTRL_BARRIER
+ * puts every data sector on the card before the first metadata sector, both
+ * fall back to CTRL_SYNC without a region, and sd_flush_data_only writes no
+ * sector below fs->database.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_commit.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_barrier.img"
+#define CARD_BLOCKS 16384U
+#define META        64U /* sectors 0..63 are metadata in the raw tests */
+
+static uint8_t s_data[SD_BLOCK_SIZE];
+static uint8_t s_rd[SD_BLOCK_SIZE];
+static size_t s_mark;
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    SD_CacheReset();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    memset(s_data, 0xA5, sizeof(s_data));
+    (void)mock_hal_tx_log(&s_mark);
+}
+
+void tearDown(void) {
+    mock_card_close();
+}
+
+/* Write addresses (CMD24/CMD25 arguments) sent since setUp or the last call, in order. */
+static uint32_t written_since_mark(uint32_t *out, uint32_t max) {
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    uint32_t n = 0;
+    for (size_t i = s_mark; i + 6U < len && n < max; i++) {
+        if (tx[i] == 0xFFU && (tx[i + 1U] == 0x58U || tx[i + 1U] == 0x59U)) {
+            out[n++] = ((uint32_t)tx[i + 2U] << 24) | ((uint32_t)tx[i + 3U] << 16) |
+                       ((uint32_t)tx[i + 4U] << 8) | tx[i + 5U];
+            i += 5U;
+        }
+    }
+    s_mark = len;
+    return n;
+}
+
+/* The transmit log holds 8 KiB: empty it after bulk I/O such as f_mkfs. */
+static void restart_log(void) {
+    mock_hal_reset();
+    mock_card_attach();
+    s_mark = 0;
+}
+
+static void write_mixed(uint8_t tag) {
+    static const DWORD sectors[4] = {10, 100, 20, 200}; /* meta, data, meta, data */
+    for (int i = 0; i < 4; i++) {
+        s_data[0] = (uint8_t)(tag + i);
+        TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, s_data, sectors[i], 1));
+    }
+    TEST_ASSERT_EQUAL_UINT32(4U, SD_CacheDirtyCount());
+}
+
+static uint8_t first_byte_on_card(uint32_t sector) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(SD_DiskHandle(0), s_rd, sector, 1));
+    return s_rd[0];
+}
+
+void test_SyncData_LeavesMetadataDirty(void) {
+    uint32_t addr[8];
+    SD_DiskSetMetaRegion(0, 0, META);
+    write_mixed(0x10U);
+    (void)written_since_mark(addr, 8);
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, SD_CTRL_SYNC_DATA, NULL));
+    TEST_ASSERT_EQUAL_UINT32(2U, written_since_mark(addr, 8));
+    TEST_ASSERT_EQUAL_UINT32(100U, addr[0]);
+    TEST_ASSERT_EQUAL_UINT32(200U, addr[1]);
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_CacheDirtyCount());
+    TEST_ASSERT_EQUAL_HEX8(0x11U, first_byte_on_card(100));
+    TEST_ASSERT_NOT_EQUAL(0x10U, first_byte_on_card(10));
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+    TEST_ASSERT_EQUAL_HEX8(0x10U, first_byte_on_card(10));
+}
+
+void test_Barrier_WritesDataBeforeMetadata(void) {
+    uint32_t addr[8];
+    SD_DiskSetMetaRegion(0, 0, META);
+    write_mixed(0x20U);
+    (void)written_since_mark(addr, 8);
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, SD_CTRL_BARRIER, NULL));
+    TEST_ASSERT_EQUAL_UINT32(4U, written_since_mark(addr, 8));
+    TEST_ASSERT_TRUE(addr[0] >= META && addr[1] >= META);
+    TEST_ASSERT_TRUE(addr[2] < META && addr[3] < META);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+}
+
+/* A run of dirty sectors across the region edge is split there. */
+void test_Barrier_SplitsRunAtRegionEdge(void) {
+    uint32_t addr[8];
+    SD_DiskSetMetaRegion(0, 0, META);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, s_data, META - 1U, 1));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, s_data, META, 1));
+    (void)written_since_mark(addr, 8);
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, SD_CTRL_BARRIER, NULL));
+    TEST_ASSERT_EQUAL_UINT32(2U, written_since_mark(addr, 8));
+    TEST_ASSERT_EQUAL_UINT32(META, addr[0]);
+    TEST_ASSERT_EQUAL_UINT32(META - 1U, addr[1]);
+}
+
+void test_SyncData_WithoutRegionSyncsEverything(void) {
+    uint32_t addr[8];
+    write_mixed(0x30U);
+    (void)written_since_mark(addr, 8);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, SD_CTRL_SYNC_DATA, NULL));
+    TEST_ASSERT_EQUAL_UINT32(4U, written_since_mark(addr, 8));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+}
+
+void test_FlushDataOnly_WritesNothingBelowDataArea(void) {
+    static uint8_t work[_MAX_SS];
+    static FATFS fs;
+    static FIL fil;
+    static uint8_t buf[1200];
+    uint32_t addr[32];
+    char path[4];
+    UINT bw = 0;
+    SD_CommitStats st;
+
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(path, FM_FAT, 0, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&fs, path, 1));
+    SD_DiskSetMetaRegion(0, fs.volbase, fs.database - fs.volbase);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "data.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    memset(buf, 0x5AU, sizeof(buf));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, buf, sizeof(buf), &bw));
+    restart_log();
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_flush_data_only(&fil));
+    uint32_t n = written_since_mark(addr, 32);
+    TEST_ASSERT_TRUE(n >= 1U);
+    for (uint32_t i = 0; i < n; i++) {
+        TEST_ASSERT_TRUE(addr[i] >= fs.database);
+    }
+    sd_commit_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.data_flushes);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+    (void)f_mount(NULL, path, 0);
+    (void)FATFS_UnLinkDriver(path);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_SyncData_LeavesMetadataDirty);
+    RUN_TEST(test_Barrier_WritesDataBeforeMetadata);
+    RUN_TEST(test_Barrier_SplitsRunAtRegionEdge);
+    RUN_TEST(test_SyncData_WithoutRegionSyncsEverything);
+    RUN_TEST(test_FlushDataOnly_WritesNothingBelowDataArea);
+
+    return UNITY_END();
+}
@@ -0,0 +1,232 @@
+/*
+ * tests/test_sd_batch.c
+ *
+ * Diskio batch mode (SD_DiskBatchBegin/End) over the real FatFs and the card
+ * emulator: held single-sector writes, reads that see them, eviction when
+ * every slot is dirty, deferred CTRL_SYNC, and a log rotation (one delete and
+ * four renames in one directory of a FAT32 volume) against the same rotation
+ * run call by call.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_batch.img"
+#define CARD_BLOCKS 131072U /* 64 MiB */
+#define LOGS        5U
+#define SCRATCH     100000U /* data area, unused by the tests' files */
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[4 * 512] __attribute__((aligned(4)));
+static uint8_t s_back[4 * 512] __attribute__((aligned(4)));
+
+static uint32_t card_writes(const mock_card_stats_t *st) {
+    return st->cmd[24] + st->cmd[25];
+}
+
+static uint32_t card_reads(const mock_card_stats_t *st) {
+    return st->cmd[17] + st->cmd[18];
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT32, 512);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    SD_DiskSetFatRegion(0, s_fs.fatbase, s_fs.fsize * s_fs.n_fats);
+    mock_card_reset_stats();
+}
+
+void tearDown(void) {
+    while (SD_DiskBatchEnd(0) == SD_OK) {
+        /* unwind a batch left open by a failed assertion */
+    }
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Sector slots
+ * ----------------------------------------------------------------------- */
+
+void test_Batch_HeldWrite_ReadBack_OnCardAtEnd(void) {
+    memset(s_back, 0x00, 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&g_sd_handle, s_back, SCRATCH + 100U, 1));
+    mock_card_reset_stats();
+    memset(s_buf, 0xA5, 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 100U, 1));
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_stats().sectors_written);
+
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_back, SCRATCH + 100U, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, s_back, 512);
+    /* A multi-sector read gets the held sector laid over the card data. */
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_back, SCRATCH + 99U, 3));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, &s_back[512], 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, s_back, SCRATCH + 100U, 1));
+    TEST_ASSERT_EQUAL_UINT8(0x00, s_back[0]);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, s_back, SCRATCH + 100U, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, s_back, 512);
+}
+
+void test_Batch_Rewrites_OneCardWrite(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    for (uint8_t i = 0; i < 10U; i++) {
+        memset(s_buf, i, 512);
+        TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 200U, 1));
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, s_back, SCRATCH + 200U, 1));
+    TEST_ASSERT_EQUAL_UINT8(9U, s_back[0]);
+}
+
+void test_Batch_AllSlotsDirty_WritesBackBeforeNext(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    for (uint32_t i = 0; i < SD_DISK_BATCH_SECTORS; i++) {
+        memset(s_buf, (int)(i + 1U), 512);
+        TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 300U + 2U * i, 1));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0U, card_stats().sectors_written);
+    memset(s_buf, 0x77, 512);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 400U, 1));
+    TEST_ASSERT_EQUAL_UINT32(SD_DISK_BATCH_SECTORS, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    TEST_ASSERT_EQUAL_UINT32(SD_DISK_BATCH_SECTORS + 1U, card_stats().sectors_written);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, s_back, SCRATCH + 300U, 1));
+    TEST_ASSERT_EQUAL_UINT8(1U, s_back[0]);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, s_back, SCRATCH + 400U, 1));
+    TEST_ASSERT_EQUAL_UINT8(0x77, s_back[0]);
+}
+
+void test_Batch_MultiSectorWrite_SupersedesHeld(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    memset(s_buf, 0x11, 512);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 501U, 1));
+    memset(s_buf, 0x22, 3 * 512);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 500U, 3));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    TEST_ASSERT_EQUAL_UINT32(3U, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_back, SCRATCH + 501U, 1));
+    TEST_ASSERT_EQUAL_UINT8(0x22, s_back[0]);
+}
+
+void test_Batch_Nested_OutermostEndWrites(void) {
+    memset(s_buf, 0x3C, 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, SCRATCH + 600U, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskBatchEnd(0));
+}
+
+/* -----------------------------------------------------------------------
+ * Log rotation
+ * ----------------------------------------------------------------------- */
+
+static void make_logs(void) {
+    char name[16];
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("logs"));
+    for (uint32_t i = 0; i < LOGS; i++) {
+        snprintf(name, sizeof(name), "logs/log.%lu", (unsigned long)i);
+        memset(s_buf, (int)('0' + i), sizeof(s_buf));
+        TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, sizeof(s_buf), &n));
+        TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    }
+}
+
+/* log.4 is deleted, log.N becomes log.N+1, leaving log.0 free. */
+static void rotate(void) {
+    char from[16], to[16];
+    snprintf(from, sizeof(from), "logs/log.%lu", (unsigned long)(LOGS - 1U));
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink(from));
+    for (uint32_t i = LOGS - 1U; i > 0U; i--) {
+        snprintf(from, sizeof(from), "logs/log.%lu", (unsigned long)(i - 1U));
+        snprintf(to, sizeof(to), "logs/log.%lu", (unsigned long)i);
+        TEST_ASSERT_EQUAL(FR_OK, f_rename(from, to));
+    }
+}
+
+static void check_rotated(void) {
+    char name[16];
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    SD_DiskSetFatRegion(0, s_fs.fatbase, s_fs.fsize * s_fs.n_fats);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("logs/log.0", NULL));
+    for (uint32_t i = 1; i < LOGS; i++) {
+        snprintf(name, sizeof(name), "logs/log.%lu", (unsigned long)i);
+        TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_READ));
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_back, sizeof(s_back), &n));
+        TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+        TEST_ASSERT_EQUAL_UINT32(sizeof(s_back), n);
+        TEST_ASSERT_EQUAL_UINT8('0' + i - 1U, s_back[0]);
+    }
+}
+
+void test_Batch_LogRotation_FewerCardCommands(void) {
+    make_logs();
+    mock_card_reset_stats();
+    rotate();
+    mock_card_stats_t plain = card_stats();
+    check_rotated();
+
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("logs/log.1"));
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("logs/log.2"));
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("logs/log.3"));
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("logs/log.4"));
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("logs"));
+    make_logs();
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchBegin(0));
+    rotate();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskBatchEnd(0));
+    mock_card_stats_t batched = card_stats();
+    check_rotated();
+
+    printf("rotation card writes: plain %lu, batched %lu; card reads: plain %lu, batched %lu\n",
+           (unsigned long)card_writes(&plain), (unsigned long)card_writes(&batched),
+           (unsigned long)card_reads(&plain), (unsigned long)card_reads(&batched));
+    /* Directory sector, FAT sector of each copy and FSInfo, each written once. */
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(SD_DISK_BATCH_SECTORS, card_writes(&batched));
+    TEST_ASSERT_LESS_THAN_UINT32(card_writes(&plain), card_writes(&batched));
+    TEST_ASSERT_LESS_THAN_UINT32(card_reads(&plain), card_reads(&batched));
+    TEST_ASSERT_EQUAL_UINT32(0U, batched.errors);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Batch_HeldWrite_ReadBack_OnCardAtEnd);
+    RUN_TEST(test_Batch_Rewrites_OneCardWrite);
+    RUN_TEST(test_Batch_AllSlotsDirty_WritesBackBeforeNext);
+    RUN_TEST(test_Batch_MultiSectorWrite_SupersedesHeld);
+    RUN_TEST(test_Batch_Nested_OutermostEndWrites);
+
+    RUN_TEST(test_Batch_LogRotation_FewerCardCommands);
+
+    return UNITY_END();
+}
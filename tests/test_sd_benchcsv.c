@@ -0,0 +1,138 @@
+/*
+ * tests/test_sd_benchcsv.c
+ *
+ * Benchmark CSV export against the card emulator (SD_CARD_INFO=1,
+ * SD_SPI_CLOCK_HZ=90 MHz): the header is written once when the file is
+ * created, rows carry the tag, the emulator's CID and the result columns,
+ * later runs append, and nothing is written with no CSV set.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_benchmark.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_benchcsv.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+#define CSV         "bench.csv"
+#define HEADER      "tag,mid,oid,pnm,prv,psn,mdt,prescaler,spi_khz,op,mode,file_bytes," \
+                    "buf_bytes,calls,min_us,avg_us,p99_us,max_us,kb_per_s\r\n"
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static char s_text[2048];
+
+/* sd_functions.c is not linked; sd_benchmark uses these two. */
+int sd_mount(void) {
+    return f_mount(&s_fs, s_path, 1);
+}
+
+int sd_unmount(void) {
+    return f_mount(NULL, s_path, 0);
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 0);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    sd_benchmark_set_csv(NULL, NULL, NULL);
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* Read the CSV into s_text; returns its length. */
+static UINT read_csv(void) {
+    UINT br = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, CSV, FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_text, sizeof(s_text) - 1U, &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    s_text[br] = '\0';
+    return br;
+}
+
+static uint32_t count(const char *needle) {
+    uint32_t n = 0;
+    for (const char *p = strstr(s_text, needle); p != NULL; p = strstr(p + 1, needle)) {
+        n++;
+    }
+    return n;
+}
+
+void test_BenchCsv_HeaderThenRowWithCardAndResult(void) {
+    SD_BenchResult r;
+    char expect[160];
+    sd_benchmark_set_csv(SD_DiskHandle(0), CSV, "dev42");
+    TEST_ASSERT_EQUAL(FR_OK, sd_benchmark_file("bench.bin", true, 65536U, 4096U, &r));
+    sd_benchmark_print("write", &r);
+
+    read_csv();
+    TEST_ASSERT_EQUAL_INT(0, strncmp(s_text, HEADER, strlen(HEADER)));
+    const char *row = s_text + strlen(HEADER);
+    uint32_t prescaler = SD_GetBusPrescaler(SD_DiskHandle(0));
+    uint32_t divisor = 2U << ((prescaler - SPI_BAUDRATEPRESCALER_2) /
+                              (SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2));
+    snprintf(expect, sizeof(expect),
+             "dev42,0x03,SD,EMU01,1.0,0x12345678,2026-01,0x%02lX,%lu,write,poll,65536,4096,16,",
+             (unsigned long)prescaler, (unsigned long)(90000U / divisor));
+    TEST_ASSERT_EQUAL_INT(0, strncmp(row, expect, strlen(expect)));
+    TEST_ASSERT_EQUAL_UINT32(2U, count("\r\n"));
+}
+
+void test_BenchCsv_LaterRunsAppendWithoutSecondHeader(void) {
+    SD_BenchResult r;
+    sd_benchmark_set_csv(SD_DiskHandle(0), CSV, "boot1");
+    TEST_ASSERT_EQUAL(FR_OK, sd_benchmark_file("bench.bin", true, 8192U, 512U, &r));
+    TEST_ASSERT_EQUAL(FR_OK, sd_benchmark_csv_append("write", &r));
+
+    /* Next boot: remount and run the quick benchmark, which mounts itself. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    sd_benchmark_set_csv(SD_DiskHandle(0), CSV, "boot2");
+    sd_benchmark();
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+
+    read_csv();
+    TEST_ASSERT_EQUAL_UINT32(1U, count("tag,"));
+    TEST_ASSERT_EQUAL_UINT32(1U, count("boot1,"));
+    TEST_ASSERT_EQUAL_UINT32(2U, count("boot2,"));
+    TEST_ASSERT_EQUAL_UINT32(1U, count(",read,poll,512000,512,1000,"));
+}
+
+void test_BenchCsv_NothingWrittenWithoutPath(void) {
+    SD_BenchResult r;
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, sd_benchmark_file("bench.bin", true, 8192U, 512U, &r));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_benchmark_csv_append("write", &r));
+    sd_benchmark_print("write", &r);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(CSV, &fno));
+}
+
+void test_BenchCsv_TagTruncated(void) {
+    SD_BenchResult r;
+    sd_benchmark_set_csv(SD_DiskHandle(0), CSV, "0123456789012345678901234567890123456789");
+    TEST_ASSERT_EQUAL(FR_OK, sd_benchmark_file("bench.bin", true, 8192U, 512U, &r));
+    TEST_ASSERT_EQUAL(FR_OK, sd_benchmark_csv_append("write", &r));
+    read_csv();
+    TEST_ASSERT_EQUAL_UINT32(1U, count("\r\n0123456789012345678901234567890,0x03,"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_BenchCsv_HeaderThenRowWithCardAndResult);
+    RUN_TEST(test_BenchCsv_LaterRunsAppendWithoutSecondHeader);
+    RUN_TEST(test_BenchCsv_NothingWrittenWithoutPath);
+    RUN_TEST(test_BenchCsv_TagTruncated);
+
+    return UNITY_END();
+}
@@ -0,0 +1,189 @@
+/*
+ * tests/test_sd_binrec.c
+ *
+ * Binary record files over the card emulator: records logged through the
+ * streaming logger read back in place through a map window (one pass reads
+ * each sector once), appending checks the layout, a CSV file converts with
+ * its column-name row and a bad row skipped, and a damaged header is refused.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_binrec.h"
+#include "sd_functions.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stddef.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_binrec.img"
+#define CARD_BLOCKS 16384U
+#define RECORDS     1000U
+
+typedef struct {
+    uint32_t t;
+    int16_t temp;
+    uint16_t flags;
+    float volts;
+    char tag[4];
+} sample_t;
+
+static const SD_BinRecField s_fields[] = {
+    {"t", SD_BINREC_U32, 4, offsetof(sample_t, t)},
+    {"temp", SD_BINREC_I16, 2, offsetof(sample_t, temp)},
+    {"flags", SD_BINREC_U16, 2, offsetof(sample_t, flags)},
+    {"volts", SD_BINREC_F32, 4, offsetof(sample_t, volts)},
+    {"tag", SD_BINREC_CHAR, 4, offsetof(sample_t, tag)},
+};
+#define NFIELDS (sizeof(s_fields) / sizeof(s_fields[0]))
+
+static char s_path[4];
+static FIL s_fil;
+static SD_BinRecReader s_rd;
+static uint8_t s_win[2048] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static sample_t make(uint32_t i) {
+    sample_t s;
+    memset(&s, 0, sizeof(s));
+    s.t = 1000U + i * 10U;
+    s.temp = (int16_t)(i % 50U) - 20;
+    s.flags = (uint16_t)(i * 3U);
+    s.volts = 3.0f + (float)(i % 8U) * 0.125f;
+    memcpy(s.tag, "ok", 2);
+    return s;
+}
+
+static void log_records(uint32_t first, uint32_t count) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_binrec_logger_start("0:/s.bin", s_fields, NFIELDS,
+                                                    sizeof(sample_t)));
+    for (uint32_t i = first; i < first + count; i++) {
+        sample_t s = make(i);
+        TEST_ASSERT_TRUE(sd_logger_write(&s, sizeof(s)));
+        if (i % 100U == 99U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+static void put_file(const char *path, const char *text) {
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, text, (UINT)strlen(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_BinRec_LoggedRecordsReadInPlace(void) {
+    log_records(0U, RECORDS);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/s.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, sd_binrec_open(&s_rd, &s_fil, s_win, sizeof(s_win)));
+    TEST_ASSERT_EQUAL_UINT32(RECORDS, s_rd.count);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(sample_t), s_rd.record_size);
+
+    SD_BinRecField f;
+    TEST_ASSERT_EQUAL(FR_OK, sd_binrec_field(&s_rd, "volts", &f));
+    TEST_ASSERT_EQUAL(SD_BINREC_F32, f.type);
+    TEST_ASSERT_EQUAL_UINT32(offsetof(sample_t, volts), f.offset);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_binrec_field(&s_rd, "missing", &f));
+
+    mock_card_reset_stats();
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        const sample_t *s = sd_binrec_get(&s_rd, i);
+        TEST_ASSERT_NOT_NULL(s);
+        sample_t want = make(i);
+        TEST_ASSERT_EQUAL_MEMORY(&want, s, sizeof(want));
+    }
+    TEST_ASSERT_NULL(sd_binrec_get(&s_rd, RECORDS));
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    uint32_t file_sectors = (SD_BINREC_HEADER_BYTES + RECORDS * sizeof(sample_t) + 511U) / 512U;
+    TEST_ASSERT_TRUE(cs.sectors_read <= file_sectors);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_BinRec_AppendChecksLayout(void) {
+    log_records(0U, 300U);
+    log_records(300U, 200U);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/s.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, sd_binrec_open(&s_rd, &s_fil, s_win, sizeof(s_win)));
+    TEST_ASSERT_EQUAL_UINT32(500U, s_rd.count);
+    sample_t want = make(417U);
+    TEST_ASSERT_EQUAL_MEMORY(&want, sd_binrec_get(&s_rd, 417U), sizeof(want));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    /* Another layout does not get appended to the same file. */
+    TEST_ASSERT_EQUAL(FR_INVALID_OBJECT,
+                      sd_binrec_logger_start("0:/s.bin", s_fields, 3U, sizeof(sample_t)));
+    TEST_ASSERT_FALSE(sd_logger_running());
+    SD_BinRecField dup[2] = {s_fields[0], s_fields[0]};
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER,
+                      sd_binrec_logger_start("0:/t.bin", dup, 2U, sizeof(sample_t)));
+}
+
+void test_BinRec_ConvertsCsv(void) {
+    put_file("0:/in.csv", "t,temp,flags,volts,tag\r\n"
+                          "1000,-20,0,3.0,ok\r\n"
+                          "1010,-19,0x3,3.125,ok\r\n"
+                          "oops,1,2,3,x\r\n"
+                          "1020,-18,6\r\n"
+                          "1030,-17,9,3.375,ok\r\n");
+    SD_BinRecConvertStats st;
+    TEST_ASSERT_EQUAL(FR_OK, sd_binrec_from_csv("0:/in.csv", "0:/out.bin", s_fields, NFIELDS,
+                                                sizeof(sample_t), &st));
+    TEST_ASSERT_EQUAL_UINT32(3U, st.records);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.skipped); /* names, "oops", short row */
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/out.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, sd_binrec_open(&s_rd, &s_fil, s_win, sizeof(s_win)));
+    TEST_ASSERT_EQUAL_UINT32(3U, s_rd.count);
+    const uint32_t rows[3] = {0U, 1U, 3U};
+    for (uint32_t i = 0; i < 3U; i++) {
+        sample_t want = make(rows[i]);
+        TEST_ASSERT_EQUAL_MEMORY(&want, sd_binrec_get(&s_rd, i), sizeof(want));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_BinRec_DamagedHeaderRefused(void) {
+    log_records(0U, 10U);
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/s.bin", FA_WRITE | FA_OPEN_EXISTING));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 20U));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "X", 1U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/s.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_NO_FILESYSTEM, sd_binrec_open(&s_rd, &s_fil, s_win, sizeof(s_win)));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    put_file("0:/short.bin", "SDBR");
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/short.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_NO_FILESYSTEM, sd_binrec_open(&s_rd, &s_fil, s_win, sizeof(s_win)));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_BinRec_LoggedRecordsReadInPlace);
+    RUN_TEST(test_BinRec_AppendChecksLayout);
+    RUN_TEST(test_BinRec_ConvertsCsv);
+    RUN_TEST(test_BinRec_DamagedHeaderRefused);
+    return UNITY_END();
+}
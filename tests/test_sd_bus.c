@@ -0,0 +1,154 @@
+/*
+ * tests/test_sd_bus.c
+ *
+ * Shared SPI bus (SD_SHARED_BUS=1): two cards and a foreign device on one
+ * hspi. The SPI is re-clocked only when the bus changes hands, and DMA
+ * callbacks reach the device holding the bus and nobody else.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd_a;
+static SD_Handle_t sd_b;
+static GPIO_TypeDef cs_b;
+static SD_Bus_t bus;
+static uint8_t s_buf[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static int s_flash;             // Stand-in for an SPI flash driver's state
+static int s_flash_done_calls;
+static void *s_flash_done_owner;
+
+static void flash_done(void *owner, bool tx, bool rx, bool error) {
+    (void)tx;
+    (void)rx;
+    (void)error;
+    s_flash_done_calls++;
+    s_flash_done_owner = owner;
+}
+
+/* Identify a card on the bus, then give it its own data-phase clock. */
+static void init_card(SD_Handle_t *sd, GPIO_TypeDef *cs, uint32_t prescaler) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(sd, &g_test_hspi, cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_BusAttach(sd, &bus));
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(sd));
+    sd->bus_prescaler = prescaler;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd_a, 0, sizeof(sd_a));
+    memset(&sd_b, 0, sizeof(sd_b));
+    s_flash_done_calls = 0;
+    s_flash_done_owner = NULL;
+    g_test_hspi.Init.BaudRatePrescaler = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_BusInit(&bus, &g_test_hspi));
+    init_card(&sd_a, &g_test_cs, SPI_BAUDRATEPRESCALER_2);
+    init_card(&sd_b, &cs_b, SPI_BAUDRATEPRESCALER_8);
+    mock_hal_reset();
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd_a);
+    SD_DeInit(&sd_b);
+}
+
+void test_Bus_AttachRejectsOtherSpi(void) {
+    SPI_HandleTypeDef other = {0};
+    SD_Bus_t other_bus;
+    TEST_ASSERT_EQUAL(SD_OK, SD_BusInit(&other_bus, &other));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_BusAttach(&sd_a, &other_bus));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_BusAttach(NULL, &bus));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_BusInit(&other_bus, NULL));
+}
+
+void test_Bus_HandoffReclocksForEachCard(void) {
+    uint32_t handoffs = bus.handoffs;
+
+    push_single_read(0x11U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(SPI_BAUDRATEPRESCALER_2, g_test_hspi.Init.BaudRatePrescaler);
+    TEST_ASSERT_EQUAL_UINT8(0x11U, s_buf[0]);
+
+    push_single_read(0x22U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_b, s_buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(SPI_BAUDRATEPRESCALER_8, g_test_hspi.Init.BaudRatePrescaler);
+    TEST_ASSERT_EQUAL_UINT8(0x22U, s_buf[0]);
+    TEST_ASSERT_EQUAL(2, mock_hal_spi_init_calls);
+    TEST_ASSERT_EQUAL_UINT32(handoffs + 2U, bus.handoffs);
+    TEST_ASSERT_TRUE(bus.owner == &sd_b && bus.owner_is_sd);
+}
+
+void test_Bus_SameOwnerKeepsClock(void) {
+    push_single_read(0x11U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 0, 1));
+    uint32_t reclocks = bus.reclocks;
+    int inits = mock_hal_spi_init_calls;
+
+    push_single_read(0x33U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 1, 1));
+    TEST_ASSERT_EQUAL(inits, mock_hal_spi_init_calls);
+    TEST_ASSERT_EQUAL_UINT32(reclocks, bus.reclocks);
+}
+
+void test_Bus_ForeignDeviceGetsItsClockAndCallbacks(void) {
+    push_single_read(0x11U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 0, 1));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_BusAcquire(&bus, &s_flash, SPI_BAUDRATEPRESCALER_4, flash_done,
+                                           10U));
+    TEST_ASSERT_EQUAL_UINT32(SPI_BAUDRATEPRESCALER_4, g_test_hspi.Init.BaudRatePrescaler);
+    sd_a.dma_tx_done = false;
+    sd_b.dma_tx_done = false;
+    HAL_SPI_TxCpltCallback(&g_test_hspi);
+    TEST_ASSERT_EQUAL(1, s_flash_done_calls);
+    TEST_ASSERT_TRUE(s_flash_done_owner == &s_flash);
+    TEST_ASSERT_FALSE(sd_a.dma_tx_done);
+    TEST_ASSERT_FALSE(sd_b.dma_tx_done);
+    SD_BusRelease(&bus);
+
+    /* The card gets its own clock back on its next request. */
+    push_single_read(0x44U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(SPI_BAUDRATEPRESCALER_2, g_test_hspi.Init.BaudRatePrescaler);
+    TEST_ASSERT_EQUAL(1, s_flash_done_calls);
+}
+
+void test_Bus_DmaCompletionReachesOnlyTheOwner(void) {
+    mock_hal_set_dma_enabled(true);
+    sd_a.use_dma = true;
+    sd_b.use_dma = true;
+    sd_b.dma_rx_done = false;
+
+    push_single_read(0x55U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 0, 1));
+    TEST_ASSERT_TRUE(mock_hal_dma_rx_calls > 0);
+    TEST_ASSERT_EQUAL_UINT8(0x55U, s_buf[0]);
+    TEST_ASSERT_TRUE(sd_a.dma_rx_done);
+    TEST_ASSERT_FALSE(sd_b.dma_rx_done);
+}
+
+void test_Bus_DeInitForgetsOwner(void) {
+    push_single_read(0x11U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd_a, s_buf, 0, 1));
+    SD_DeInit(&sd_a);
+    TEST_ASSERT_NULL(bus.owner);
+    TEST_ASSERT_FALSE(bus.owner_is_sd);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Bus_AttachRejectsOtherSpi);
+    RUN_TEST(test_Bus_HandoffReclocksForEachCard);
+    RUN_TEST(test_Bus_SameOwnerKeepsClock);
+    RUN_TEST(test_Bus_ForeignDeviceGetsItsClockAndCallbacks);
+    RUN_TEST(test_Bus_DmaCompletionReachesOnlyTheOwner);
+    RUN_TEST(test_Bus_DeInitForgetsOwner);
+
+    return UNITY_END();
+}
@@ -0,0 +1,169 @@
+/*
+ * tests/test_sd_busutil.c
+ *
+ * SPI bus utilization on the card emulator, timed by the mock HAL simulator
+ * (25 MHz SCK, class-10 latencies): the transfer time SD_Stats accumulates
+ * tracks the simulator's own bus time, idle time between requests lowers
+ * the share without adding gaps, DMA transfers count from arming to
+ * completion, a reset restarts the window, and benchmark results carry the
+ * bus time of their run.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_benchmark.h"
+#include "ff.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_busutil.img"
+#define CARD_BLOCKS 8192U
+#define BASE        200U
+#define SPAN        64U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[SPAN * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+/* sd_functions.c is not linked; sd_benchmark.c refers to these. */
+int sd_mount(void) {
+    return FR_OK;
+}
+
+int sd_unmount(void) {
+    return FR_OK;
+}
+
+static uint64_t cycles_of_ns(uint64_t ns) {
+    return ns * (SystemCoreClock / 1000000U) / 1000U;
+}
+
+static void start(bool use_dma) {
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, use_dma));
+    mock_hal_set_dma_enabled(use_dma);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_ResetStats(&sd);
+}
+
+/* Reads the span four times; then takes the simulator's report. */
+static void read_span(mock_hal_sim_report_t *rep) {
+    for (uint32_t i = 0; i < 4U; i++) {
+        TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, BASE, SPAN));
+    }
+    mock_hal_sim_report(rep);
+}
+
+/* The driver's figures against the simulator's, which only counts SCK time. */
+static void check_against_sim(const SD_Stats *st, const mock_hal_sim_report_t *rep) {
+    uint64_t bus = cycles_of_ns(rep->bus_ns);
+    uint32_t sim = mock_hal_sim_utilization_permille(rep);
+    uint32_t permille = SD_BusUtilization(st);
+    TEST_ASSERT_TRUE(st->bus_xfer_cycles >= bus);
+    TEST_ASSERT_TRUE(st->bus_xfer_cycles < bus * 3U / 2U);
+    TEST_ASSERT_TRUE(st->bus_xfer_cycles + st->bus_gap_cycles <=
+                     cycles_of_ns(rep->elapsed_ns));
+    TEST_ASSERT_TRUE(permille >= sim);
+    TEST_ASSERT_TRUE(permille <= sim * 3U / 2U + 2U);
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    mock_card_close();
+}
+
+void test_BusUtil_Polled_TracksSimulatorBusTime(void) {
+    SD_Stats st;
+    mock_hal_sim_report_t rep;
+    start(false);
+    read_span(&rep);
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_TRUE(st.bus_window_ms > 0U);
+    check_against_sim(&st, &rep);
+
+    /* The token waits back off between polls with the card selected. */
+    TEST_ASSERT_TRUE(st.bus_gap_cycles > 0U);
+    TEST_ASSERT_TRUE(st.bus_gap_max_cycles > 0U);
+    TEST_ASSERT_TRUE(st.bus_gap_max_cycles <= st.bus_gap_cycles);
+}
+
+void test_BusUtil_IdleBetweenRequests_LowersShareOnly(void) {
+    SD_Stats busy;
+    SD_Stats idle;
+    mock_hal_sim_report_t rep;
+    start(false);
+    read_span(&rep);
+    SD_GetStats(&sd, &busy);
+    HAL_Delay(10U * busy.bus_window_ms);
+    SD_GetStats(&sd, &idle);
+
+    /* Deselected idle time is neither a transfer nor a gap. */
+    TEST_ASSERT_EQUAL_UINT64(busy.bus_xfer_cycles, idle.bus_xfer_cycles);
+    TEST_ASSERT_EQUAL_UINT64(busy.bus_gap_cycles, idle.bus_gap_cycles);
+    TEST_ASSERT_TRUE(idle.bus_window_ms >= 11U * busy.bus_window_ms);
+    TEST_ASSERT_TRUE(SD_BusUtilization(&idle) * 8U < SD_BusUtilization(&busy));
+}
+
+void test_BusUtil_Dma_CountsFromArmToCompletion(void) {
+    SD_Stats st;
+    mock_hal_sim_report_t rep;
+    start(true);
+    read_span(&rep);
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_TRUE(st.xfers[SD_XFER_DMA] > 0U);
+    check_against_sim(&st, &rep);
+}
+
+void test_BusUtil_Reset_RestartsWindow(void) {
+    SD_Stats st;
+    mock_hal_sim_report_t rep;
+    start(false);
+    read_span(&rep);
+    SD_ResetStats(&sd);
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT64(0U, st.bus_xfer_cycles);
+    TEST_ASSERT_EQUAL_UINT64(0U, st.bus_gap_cycles);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.bus_gap_max_cycles);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.bus_window_ms);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_BusUtilization(&st));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_BusUtilization(NULL));
+}
+
+void test_BusUtil_BenchmarkResult_CarriesBusTime(void) {
+    SD_BenchResult r;
+    SD_BenchRawConfig cfg = {.op = SD_BENCH_RAW_WRITE_MULTI, .first_lba = BASE,
+                             .span_blocks = SPAN, .total_blocks = SPAN, .blocks_per_cmd = 8U};
+    start(false);
+    TEST_ASSERT_EQUAL(SD_OK, sd_benchmark_raw(&sd, &cfg, &r));
+    TEST_ASSERT_TRUE(r.bus_cycles > 0U);
+    TEST_ASSERT_TRUE(r.bus_cycles <= r.total_cycles);
+
+    /* A second result counts its own run only. */
+    SD_BenchResult rd;
+    SD_Stats st;
+    SD_GetStats(&sd, &st);
+    cfg.op = SD_BENCH_RAW_READ_MULTI;
+    TEST_ASSERT_EQUAL(SD_OK, sd_benchmark_raw(&sd, &cfg, &rd));
+    TEST_ASSERT_TRUE(rd.bus_cycles > 0U);
+    TEST_ASSERT_TRUE(rd.bus_cycles <= rd.total_cycles);
+    uint64_t before = st.bus_xfer_cycles;
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT64(st.bus_xfer_cycles - before, rd.bus_cycles);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_BusUtil_Polled_TracksSimulatorBusTime);
+    RUN_TEST(test_BusUtil_IdleBetweenRequests_LowersShareOnly);
+    RUN_TEST(test_BusUtil_Dma_CountsFromArmToCompletion);
+    RUN_TEST(test_BusUtil_Reset_RestartsWindow);
+    RUN_TEST(test_BusUtil_BenchmarkResult_CarriesBusTime);
+    return UNITY_END();
+}
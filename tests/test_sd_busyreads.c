@@ -0,0 +1,138 @@
+/*
+ * tests/test_sd_busyreads.c
+ *
+ * Cache reads while a write-back programs the card (SD_CACHE_BUSY_READS=1
+ * with SD_SPLIT_BUSY=1), over the card emulator and the timing simulator
+ * with a fixed 20 ms program busy: hits are served without waiting and
+ * counted as busy hits, misses and multi-sector reads wait out the busy.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_cache.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_busyreads.img"
+#define CARD_BLOCKS 8192U
+#define BUSY_US     20000U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[2U * SD_BLOCK_SIZE] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_want[SD_BLOCK_SIZE];
+
+static uint64_t sim_now_ns(void) {
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    return rep.elapsed_ns;
+}
+
+static SD_CacheStats cache_stats(void) {
+    SD_CacheStats st;
+    SD_CacheGetStats(&st);
+    return st;
+}
+
+static void pattern(uint8_t *dst, uint32_t sector) {
+    for (uint32_t i = 0; i < SD_BLOCK_SIZE; i++) {
+        dst[i] = (uint8_t)(sector * 5U + i);
+    }
+}
+
+/* Sectors 10 and 11 dirty in the cache, 500 only on the card; then the write-back. */
+static void flush_with_busy(void) {
+    pattern(s_buf, 500U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, 500U, 1U));
+    for (uint32_t s = 10U; s < 12U; s++) {
+        pattern(s_buf, s);
+        TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(&sd, s_buf, s, 1U));
+    }
+
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    cfg.program_busy.min_us = BUSY_US;
+    cfg.program_busy.max_us = BUSY_US;
+    cfg.program_busy.tail_permille = 0U;
+    mock_hal_sim_enable(&cfg);
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(&sd));
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_PollBusy(&sd));
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_CacheReset();
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_BusyReads_HitIsServedWhileCardPrograms(void) {
+    flush_with_busy();
+    uint64_t flushed = sim_now_ns();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheRead(&sd, s_buf, 10U, 1U));
+    pattern(s_want, 10U);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, SD_BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_UINT64(flushed, sim_now_ns()); /* not a single byte on the bus */
+    TEST_ASSERT_EQUAL_UINT32(1, cache_stats().busy_hits);
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_PollBusy(&sd));
+}
+
+void test_BusyReads_MissWaitsOutTheBusy(void) {
+    flush_with_busy();
+    uint64_t flushed = sim_now_ns();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheRead(&sd, s_buf, 500U, 1U));
+    pattern(s_want, 500U);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, SD_BLOCK_SIZE);
+    TEST_ASSERT_TRUE(sim_now_ns() >= flushed + (uint64_t)BUSY_US * 900ULL);
+    TEST_ASSERT_EQUAL_UINT32(1, cache_stats().read_misses);
+    TEST_ASSERT_EQUAL_UINT32(0, cache_stats().busy_hits);
+}
+
+void test_BusyReads_MultiSectorReadWaitsAndIsPatched(void) {
+    flush_with_busy();
+    uint64_t flushed = sim_now_ns();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheRead(&sd, s_buf, 10U, 2U));
+    TEST_ASSERT_TRUE(sim_now_ns() >= flushed + (uint64_t)BUSY_US * 900ULL);
+    pattern(s_want, 10U);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, SD_BLOCK_SIZE);
+    pattern(s_want, 11U);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, &s_buf[SD_BLOCK_SIZE], SD_BLOCK_SIZE);
+}
+
+void test_BusyReads_HitsAfterTheBusyAreOrdinary(void) {
+    flush_with_busy();
+    HAL_Delay(BUSY_US / 1000U + 5U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_PollBusy(&sd));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheRead(&sd, s_buf, 11U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(0, cache_stats().busy_hits);
+    TEST_ASSERT_EQUAL_UINT32(1, cache_stats().writeback_runs);
+
+    /* The write-back reached the card. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 11U, 1U));
+    pattern(s_want, 11U);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, SD_BLOCK_SIZE);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_BusyReads_HitIsServedWhileCardPrograms);
+    RUN_TEST(test_BusyReads_MissWaitsOutTheBusy);
+    RUN_TEST(test_BusyReads_MultiSectorReadWaitsAndIsPatched);
+    RUN_TEST(test_BusyReads_HitsAfterTheBusyAreOrdinary);
+
+    return UNITY_END();
+}
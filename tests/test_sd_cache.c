@@ -0,0 +1,300 @@
+/*
+ * tests/test_sd_cache.c
+ *
+ * Tests for the write-back sector cache (sd_cache.c) as seen through the
+ * diskio layer. Built with SD_CACHE_ENABLED=1, SD_CACHE_LINES=4 and
+ * SD_CACHE_HOLD_LINES=2.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_cache.h"
+#include "sd_diskio_spi.h"
+#include <string.h>
+
+extern SD_Handle_t g_sd_handle;
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&g_sd_handle, 0, sizeof(g_sd_handle));
+    SD_CacheReset();
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+static void init_global_sdhc(void) {
+    SD_Init(&g_sd_handle, &g_test_hspi, &g_test_cs, 0, false);
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&g_sd_handle));
+    mock_hal_reset(); /* start each test with an empty transmit log */
+}
+
+/* Queue a CMD25 write of count blocks followed by SD_Sync's WaitReady. */
+static void push_multi_write(uint32_t count) {
+    push_cmd_exchange(0x00U);
+    for (uint32_t i = 0; i < count; i++) {
+        mock_hal_push_byte(0x05U);
+        push_wait_ready();
+    }
+    push_wait_ready();
+}
+
+static void fill_sector(uint8_t *buf, uint8_t value) {
+    memset(buf, value, 512);
+}
+
+/* -----------------------------------------------------------------------
+ * Write-back behaviour
+ * ----------------------------------------------------------------------- */
+
+void test_Cache_SingleWrite_StaysInRam(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    fill_sector(buf, 0x3CU);
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 10, 1));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(24));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_CacheDirtyCount());
+
+    uint8_t rd[512] = {0};
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, rd, 10, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(buf, rd, 512);
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(17));
+}
+
+void test_Cache_RepeatedWrite_SameSector_OneLine(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    for (int i = 0; i < 10; i++) {
+        fill_sector(buf, (uint8_t)i);
+        TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 5, 1));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_CacheDirtyCount());
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(24));
+}
+
+void test_Cache_Sync_CoalescesAdjacentSectors(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    /* Written out of order; the flush must still issue one run from 20 */
+    fill_sector(buf, 0x22U);
+    SD_disk_write(0, buf, 22, 1);
+    fill_sector(buf, 0x20U);
+    SD_disk_write(0, buf, 20, 1);
+    fill_sector(buf, 0x21U);
+    SD_disk_write(0, buf, 21, 1);
+
+    push_multi_write(3);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(25));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(24));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+
+    /* CMD25 argument is the lowest sector of the run */
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    const uint8_t cmd25[7] = {0xFF, 0x59, 0x00, 0x00, 0x00, 20, 0xFF};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd25, tx, 7);
+    TEST_ASSERT_EQUAL_HEX8(0x20U, tx[7 + 1]); /* first data byte of sector 20 */
+}
+
+void test_Cache_Eviction_WritesBackLeastRecentlyUsed(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    for (uint32_t s = 0; s < 4; s++) {
+        fill_sector(buf, (uint8_t)s);
+        SD_disk_write(0, buf, 100U + (s * 10U), 1); /* non-adjacent sectors */
+    }
+    /* Touch sector 100 so 110 becomes the LRU line */
+    SD_disk_read(0, buf, 100, 1);
+
+    push_single_write_accepted();
+    fill_sector(buf, 0xEEU);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 200, 1));
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    const uint8_t cmd24[7] = {0xFF, 0x58, 0x00, 0x00, 0x00, 110, 0xFF};
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(24));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd24, tx, 7);
+    TEST_ASSERT_EQUAL_UINT32(4U, SD_CacheDirtyCount());
+}
+
+void test_Cache_EvictionFails_KeepsDirtyData(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    for (uint32_t s = 0; s < 4; s++) {
+        fill_sector(buf, (uint8_t)s);
+        SD_disk_write(0, buf, 100U + (s * 10U), 1);
+    }
+    mock_hal_set_spi_return(HAL_TIMEOUT);
+    TEST_ASSERT_EQUAL(RES_ERROR, SD_disk_write(0, buf, 200, 1));
+    TEST_ASSERT_EQUAL_UINT32(4U, SD_CacheDirtyCount());
+}
+
+/* -----------------------------------------------------------------------
+ * Coherence with multi-sector transfers
+ * ----------------------------------------------------------------------- */
+
+void test_Cache_MultiRead_OverlaysDirtySector(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    fill_sector(buf, 0xABU);
+    SD_disk_write(0, buf, 31, 1);
+
+    uint8_t data[512];
+    memset(data, 0x11U, sizeof(data));
+    push_cmd_exchange(0x00U); /* CMD18 */
+    for (int i = 0; i < 3; i++) {
+        push_data_token();
+        mock_hal_push_bytes(data, 512);
+        push_crc();
+    }
+    push_cmd_exchange(0x00U); /* CMD12 */
+
+    static uint8_t rd[3 * 512];
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, rd, 30, 3));
+    TEST_ASSERT_EQUAL_HEX8(0x11U, rd[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xABU, rd[512]);
+    TEST_ASSERT_EQUAL_HEX8(0xABU, rd[1023]);
+    TEST_ASSERT_EQUAL_HEX8(0x11U, rd[1024]);
+}
+
+void test_Cache_MultiWrite_CleansOverlappingLine(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    fill_sector(buf, 0x01U);
+    SD_disk_write(0, buf, 41, 1);
+
+    static uint8_t wr[2 * 512];
+    memset(wr, 0x77U, sizeof(wr));
+    push_multi_write(2);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, wr, 40, 2));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 41, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x77U, buf[0]);
+}
+
+void test_Cache_Trim_DiscardsDirtySectors(void) {
+    init_global_sdhc();
+    uint8_t buf[512] = {0};
+    SD_disk_write(0, buf, 60, 1);
+    SD_disk_write(0, buf, 61, 1);
+
+    push_cmd_exchange(0x00U); /* CMD32 */
+    push_cmd_exchange(0x00U); /* CMD33 */
+    push_cmd_exchange(0x00U); /* CMD38 */
+    push_wait_ready();
+    DWORD range[2] = {60U, 61U};
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_TRIM, range));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+}
+
+void test_Cache_CardRemoved_DropsContents(void) {
+    init_global_sdhc();
+    uint8_t buf[512] = {0};
+    SD_disk_write(0, buf, 70, 1);
+    SD_SetCardDetect(&g_sd_handle, &g_test_cd, 0, true);
+    mock_hal_set_gpio_read(GPIO_PIN_SET); /* absent */
+    TEST_ASSERT_EQUAL(STA_NODISK | STA_NOINIT, SD_disk_status(0));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+}
+
+/* -----------------------------------------------------------------------
+ * Held sectors (shared-sector mode) and stats
+ * ----------------------------------------------------------------------- */
+
+void test_Cache_HeldSector_SurvivesEviction(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    for (uint32_t s = 0; s < 4; s++) {
+        fill_sector(buf, (uint8_t)s);
+        SD_disk_write(0, buf, 100U + (s * 10U), 1);
+    }
+    /* 100 is the LRU line, but an open file holds it: 110 goes instead. */
+    TEST_ASSERT_TRUE(SD_CacheHold(&g_sd_handle, 100));
+    push_single_write_accepted();
+    fill_sector(buf, 0xEEU);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 200, 1));
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    const uint8_t cmd24[7] = {0xFF, 0x58, 0x00, 0x00, 0x00, 110, 0xFF};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd24, tx, 7);
+
+    /* The file's next partial write re-reads its sector from RAM. */
+    mock_hal_reset();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 100, 1));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL_HEX8(0x00U, buf[0]);
+
+    SD_CacheStats st;
+    SD_CacheGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.held);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.hold_saves);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.writebacks);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.read_hits);
+}
+
+void test_Cache_Hold_RefCountedAndBounded(void) {
+    init_global_sdhc();
+    TEST_ASSERT_TRUE(SD_CacheHold(&g_sd_handle, 5));
+    TEST_ASSERT_TRUE(SD_CacheHold(&g_sd_handle, 5));
+    TEST_ASSERT_TRUE(SD_CacheHold(&g_sd_handle, 6));
+    TEST_ASSERT_FALSE(SD_CacheHold(&g_sd_handle, 7)); /* both slots busy */
+
+    SD_CacheRelease(&g_sd_handle, 5);
+    TEST_ASSERT_FALSE(SD_CacheHold(&g_sd_handle, 7)); /* 5 still has a reference */
+    SD_CacheRelease(&g_sd_handle, 5);
+    TEST_ASSERT_TRUE(SD_CacheHold(&g_sd_handle, 7));
+
+    SD_CacheStats st;
+    SD_CacheGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.held);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.hold_refused);
+}
+
+void test_Cache_HeldSector_StillWrittenBackOnSync(void) {
+    init_global_sdhc();
+    uint8_t buf[512];
+    fill_sector(buf, 0x42U);
+    SD_disk_write(0, buf, 80, 1);
+    TEST_ASSERT_TRUE(SD_CacheHold(&g_sd_handle, 80));
+
+    push_single_write_accepted();
+    push_wait_ready();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Cache_SingleWrite_StaysInRam);
+    RUN_TEST(test_Cache_RepeatedWrite_SameSector_OneLine);
+    RUN_TEST(test_Cache_Sync_CoalescesAdjacentSectors);
+    RUN_TEST(test_Cache_Eviction_WritesBackLeastRecentlyUsed);
+    RUN_TEST(test_Cache_EvictionFails_KeepsDirtyData);
+
+    RUN_TEST(test_Cache_MultiRead_OverlaysDirtySector);
+    RUN_TEST(test_Cache_MultiWrite_CleansOverlappingLine);
+    RUN_TEST(test_Cache_Trim_DiscardsDirtySectors);
+    RUN_TEST(test_Cache_CardRemoved_DropsContents);
+
+    RUN_TEST(test_Cache_HeldSector_SurvivesEviction);
+    RUN_TEST(test_Cache_Hold_RefCountedAndBounded);
+    RUN_TEST(test_Cache_HeldSector_StillWrittenBackOnSync);
+
+    return UNITY_END();
+}
@@ -0,0 +1,183 @@
+/*
+ * tests/test_sd_cacheclass.c
+ *
+ * Cache partitioned by sector class (SD_CACHE_ENABLED=1, SD_CACHE_CLASSES=1,
+ * 8 lines: 4 FAT, 4 directory FIFO, data uncached) against the card emulator:
+ * a FatFs file streamed in small writes leaves the FAT and root directory
+ * lines in place; each class replaces only its own lines, LRU or FIFO; data
+ * sectors go straight to the card; forgetting the regions restores the
+ * unclassified pool.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_cacheclass.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+#define FAT_FIRST   10U    /* block-level tests: FAT 10..19, directory 20..29, data 30.. */
+#define DIR_FIRST   20U
+#define DATA_FIRST  30U
+
+static SD_Handle_t *h;
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[SD_BLOCK_SIZE];
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    h = SD_DiskHandle(0);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    SD_CacheReset();
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    SD_CacheSetRegions(h, 0, 0, 0);
+    mock_card_close();
+}
+
+static SD_CacheStats stats(void) {
+    SD_CacheStats out;
+    memset(&out, 0, sizeof(out));
+    SD_CacheGetStats(&out);
+    return out;
+}
+
+/* Card blocks read by one single-sector cache read. */
+static uint32_t card_reads(uint32_t sector) {
+    mock_card_stats_t card;
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheRead(h, s_buf, sector, 1));
+    mock_card_get_stats(&card);
+    return card.sectors_read;
+}
+
+void test_CacheClass_StreamLeavesFatAndDirectoryResident(void) {
+    static uint8_t work[_MAX_SS];
+    static uint8_t chunk[100];
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT | FM_SFD, 1024U, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FS_FAT16, s_fs.fs_type);
+    SD_DiskSetCacheRegions(0, s_fs.fatbase, s_fs.dirbase, s_fs.database);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "log.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t pos = 0; pos < 64U * 1024U; pos += sizeof(chunk)) {
+        memset(chunk, (int)(pos / 512U), sizeof(chunk));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, chunk, sizeof(chunk), &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    /* Over a hundred data sectors went past eight lines without taking one. */
+    SD_CacheStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, st.data_lines);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(127U, st.bypassed);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1U, st.fat_lines);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1U, st.dir_lines);
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(s_fs.fatbase));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(s_fs.dirbase));
+
+    /* The data reached the card: read it back through the uncached path. */
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "log.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 100U * 512U + 7U));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, chunk, 1U, &bw));
+    TEST_ASSERT_EQUAL_HEX8(100U, chunk[0]);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+}
+
+void test_CacheClass_FatLinesReplaceEachOtherLru(void) {
+    SD_CacheSetRegions(h, FAT_FIRST, DIR_FIRST, DATA_FIRST);
+    for (uint32_t s = DIR_FIRST; s < DIR_FIRST + 4U; s++) {
+        TEST_ASSERT_EQUAL_UINT32(1U, card_reads(s));
+    }
+    for (uint32_t s = FAT_FIRST; s < FAT_FIRST + 5U; s++) {
+        TEST_ASSERT_EQUAL_UINT32(1U, card_reads(s));
+    }
+    SD_CacheStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(4U, st.fat_lines);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.dir_lines);
+
+    /* The fifth FAT sector took the oldest FAT line, not a directory line. */
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(DIR_FIRST));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(FAT_FIRST + 1U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(FAT_FIRST));     /* evicts FAT_FIRST + 2 */
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(FAT_FIRST + 1U)); /* refreshed by its hit */
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(FAT_FIRST + 2U));
+
+    /* A dirty FAT line stays in its class and writes back on flush. */
+    mock_card_stats_t card;
+    memset(s_buf, 0x5A, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_buf, FAT_FIRST + 6U, 1));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_CacheDirtyCount());
+    TEST_ASSERT_EQUAL_UINT32(4U, stats().fat_lines);
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(1U, card.sectors_written);
+}
+
+void test_CacheClass_DirectoryLinesAreFifo(void) {
+    SD_CacheSetRegions(h, FAT_FIRST, DIR_FIRST, DATA_FIRST);
+    /* Boot-area sectors before the FAT count as directory sectors. */
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(2U));
+    for (uint32_t s = DIR_FIRST; s < DIR_FIRST + 3U; s++) {
+        TEST_ASSERT_EQUAL_UINT32(1U, card_reads(s));
+    }
+    TEST_ASSERT_EQUAL_UINT32(4U, stats().dir_lines);
+
+    /* A hit does not rescue the first line filled. */
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(2U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(DIR_FIRST + 3U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(2U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(DIR_FIRST)); /* evicted by the re-read of 2 */
+    TEST_ASSERT_EQUAL_UINT32(0U, stats().fat_lines);
+}
+
+void test_CacheClass_DataBypassesUntilRegionsForgotten(void) {
+    mock_card_stats_t card;
+    SD_CacheSetRegions(h, FAT_FIRST, DIR_FIRST, DATA_FIRST);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(DATA_FIRST + 10U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(DATA_FIRST + 10U));
+
+    memset(s_buf, 0xC3, sizeof(s_buf));
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_buf, DATA_FIRST + 11U, 1));
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(1U, card.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+    SD_CacheStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(3U, st.bypassed);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.data_lines);
+
+    /* Unclassified, the card shares the whole pool again. */
+    SD_CacheSetRegions(h, 0, 0, 0);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(DATA_FIRST + 11U));
+    TEST_ASSERT_EQUAL_HEX8(0xC3, s_buf[0]);
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(DATA_FIRST + 11U));
+    TEST_ASSERT_EQUAL_UINT32(3U, stats().bypassed);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_CacheClass_StreamLeavesFatAndDirectoryResident);
+    RUN_TEST(test_CacheClass_FatLinesReplaceEachOtherLru);
+    RUN_TEST(test_CacheClass_DirectoryLinesAreFifo);
+    RUN_TEST(test_CacheClass_DataBypassesUntilRegionsForgotten);
+
+    return UNITY_END();
+}
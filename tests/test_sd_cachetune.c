@@ -0,0 +1,197 @@
+/*
+ * tests/test_sd_cachetune.c
+ *
+ * Cache statistics and run-time sizes of the diskio caches (SD_CACHE_ENABLED=1
+ * with 8 lines, SD_READAHEAD_SECTORS=4, 2 FAT groups of 2) against the card
+ * emulator: write-back runs, coalescing and evictions in SD_CacheStats;
+ * shrinking and disabling the sector cache, the read-ahead window and the FAT
+ * groups with SD_DiskSetCacheSize; resetting the counters.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_cachetune.img"
+#define CARD_BLOCKS 16384U
+#define FAT_FIRST   50U
+#define FAT_COUNT   40U
+
+static uint8_t s_buf[SD_BLOCK_SIZE];
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    SD_CacheReset();
+}
+
+/* Sizes survive re-initialization: put them back for the next test. */
+void tearDown(void) {
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, SD_CACHE_LINES);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, SD_READAHEAD_SECTORS);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, SD_FAT_CACHE_GROUPS);
+    mock_card_close();
+}
+
+static SD_DiskCacheStats stats(void) {
+    SD_DiskCacheStats out;
+    SD_DiskGetCacheStats(0, &out);
+    return out;
+}
+
+static uint32_t card_reads(uint32_t sector) {
+    mock_card_stats_t card;
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, s_buf, sector, 1));
+    mock_card_get_stats(&card);
+    return card.sectors_read;
+}
+
+static void write_one(uint32_t sector, uint8_t value) {
+    memset(s_buf, value, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, s_buf, sector, 1));
+}
+
+void test_CacheTune_StatsCountRunsCoalescingAndEvictions(void) {
+    write_one(100U, 1U);
+    write_one(101U, 2U);
+    write_one(102U, 3U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_SYNC, NULL));
+    write_one(200U, 4U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_SYNC, NULL));
+
+    SD_DiskCacheStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(4U, st.sectors.writebacks);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.sectors.writeback_runs);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.sectors.coalesced);
+    TEST_ASSERT_EQUAL_UINT32(20U, st.sectors.run_len_x10);
+    TEST_ASSERT_EQUAL_UINT32(SD_CACHE_LINES, st.sectors.lines);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.sectors.evictions);
+
+    /* Four lines hold 100..102 and 200; ten more sectors replace six of them. */
+    for (uint32_t s = 1000U; s < 1010U; s += 1U) {
+        TEST_ASSERT_EQUAL_UINT32(1U, card_reads(s * 10U));
+    }
+    st = stats();
+    TEST_ASSERT_EQUAL_UINT32(6U, st.sectors.evictions);
+    TEST_ASSERT_EQUAL_UINT32(10U, st.sectors.read_misses);
+
+    SD_DiskResetCacheStats(0);
+    st = stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, st.sectors.read_misses);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.sectors.writebacks);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.sectors.run_len_x10);
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(10090U)); /* contents kept */
+}
+
+void test_CacheTune_SectorCacheShrinksAndTurnsOff(void) {
+    mock_card_stats_t card;
+    for (uint32_t s = 0; s < 6U; s++) {
+        write_one(300U + (s * 2U), (uint8_t)(0x10U + s));
+    }
+    TEST_ASSERT_EQUAL_UINT32(6U, SD_CacheDirtyCount());
+
+    /* Giving up lines writes back what they held: nothing is lost. */
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, 2U));
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(4U, card.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_CacheDirtyCount());
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_CacheGetLines());
+    for (uint32_t s = 0; s < 6U; s++) {
+        TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, s_buf, 300U + (s * 2U), 1));
+        TEST_ASSERT_EQUAL_HEX8(0x10U + s, s_buf[0]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(2U, stats().sectors.lines);
+
+    /* Off: every single-sector read and write goes to the card. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, 0U));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(400U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(400U));
+    mock_card_reset_stats();
+    write_one(401U, 0x77U);
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(1U, card.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS,
+                                                    SD_CACHE_LINES + 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, SD_CACHE_LINES));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(400U));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(400U));
+}
+
+/* Sequential single-sector reads 5000..5008; returns the read-ahead hits. */
+static uint32_t sequential_hits(void) {
+    SD_DiskResetCacheStats(0);
+    for (uint32_t s = 5000U; s < 5009U; s++) {
+        TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, s_buf, s, 1));
+    }
+    return stats().readahead_hits;
+}
+
+void test_CacheTune_ReadAheadWindowResizes(void) {
+    TEST_ASSERT_EQUAL_UINT32(SD_READAHEAD_SECTORS, stats().readahead_window);
+    TEST_ASSERT_EQUAL_UINT32(6U, sequential_hits()); /* refills at 5001 and 5005 */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, 2U));
+    TEST_ASSERT_EQUAL_UINT32(2U, stats().readahead_window);
+    TEST_ASSERT_EQUAL_UINT32(4U, sequential_hits()); /* refills at 5001, 3, 5 and 7 */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, 0U));
+    SD_DiskCacheStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, sequential_hits());
+    TEST_ASSERT_EQUAL_UINT32(0U, st.readahead_window);
+    TEST_ASSERT_EQUAL_UINT32(0U, stats().readahead_misses);
+
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD,
+                                                    SD_READAHEAD_SECTORS + 1U));
+}
+
+void test_CacheTune_FatGroupsCountAndResize(void) {
+    SD_DiskSetFatRegion(0, FAT_FIRST, FAT_COUNT);
+    SD_CacheReset(); /* FAT reads below come from the card, not the sector cache */
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, 0U));
+    SD_DiskResetCacheStats(0);
+
+    TEST_ASSERT_EQUAL_UINT32(2U, card_reads(FAT_FIRST));       /* group of two */
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(FAT_FIRST + 1U));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_reads(FAT_FIRST + 10U));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_reads(FAT_FIRST + 20U)); /* replaces the first */
+    SD_DiskCacheStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(2U, st.fat_groups);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.fat_hits);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.fat_misses);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.fat_evictions);
+
+    /* One group: the second group (FAT_FIRST + 10) is dropped, and loads replace each other. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, 1U));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads(FAT_FIRST + 20U));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_reads(FAT_FIRST + 10U));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_reads(FAT_FIRST + 20U));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, 0U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_reads(FAT_FIRST + 10U));
+    TEST_ASSERT_EQUAL_UINT32(0U, stats().fat_groups);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT,
+                                                    SD_FAT_CACHE_GROUPS + 1U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetCacheSize(0, (SD_DiskCache)7, 0U));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_CacheTune_StatsCountRunsCoalescingAndEvictions);
+    RUN_TEST(test_CacheTune_SectorCacheShrinksAndTurnsOff);
+    RUN_TEST(test_CacheTune_ReadAheadWindowResizes);
+    RUN_TEST(test_CacheTune_FatGroupsCountAndResize);
+
+    return UNITY_END();
+}
@@ -0,0 +1,185 @@
+/*
+ * tests/test_sd_capture.c
+ *
+ * Diskio I/O capture on the card emulator: the ring records reads, writes,
+ * syncs and trims with their sectors and DWT times between start and stop,
+ * drops the oldest once full, round-trips through the SDCAP text lines,
+ * saves to a file with sd_capture_save, and replays against the card.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_capture.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_buf[4 * 512];
+static SD_DiskCaptureRecord s_rec[SD_DISK_CAPTURE_ENTRIES];
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    memset(s_rec, 0, sizeof(s_rec));
+}
+
+void tearDown(void) {
+    SD_DiskCaptureStop();
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Capture_RecordsDiskCalls(void) {
+    DWORD sectors = 0;
+    DWORD range[2] = {9000U, 9003U};
+    SD_DiskCaptureStart();
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, s_buf, 10U, 1U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_write(0, s_buf, 9100U, 2U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_ioctl(0, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_ioctl(0, GET_SECTOR_COUNT, &sectors));
+    (void)SD_Driver.disk_ioctl(0, CTRL_TRIM, range);
+    SD_DiskCaptureStop();
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, s_buf, 11U, 1U)); /* not recorded */
+
+    TEST_ASSERT_EQUAL_UINT32(5U, SD_DiskCaptureRead(s_rec, SD_DISK_CAPTURE_ENTRIES));
+    TEST_ASSERT_EQUAL_UINT8(SD_DISK_OP_READ, s_rec[0].op);
+    TEST_ASSERT_EQUAL_UINT32(10U, s_rec[0].sector);
+    TEST_ASSERT_EQUAL_UINT32(1U, s_rec[0].count);
+    TEST_ASSERT_EQUAL_UINT8(SD_DISK_OP_WRITE, s_rec[1].op);
+    TEST_ASSERT_EQUAL_UINT32(9100U, s_rec[1].sector);
+    TEST_ASSERT_EQUAL_UINT32(2U, s_rec[1].count);
+    TEST_ASSERT_EQUAL_UINT8(RES_OK, s_rec[1].result);
+    TEST_ASSERT_EQUAL_UINT8(SD_DISK_OP_SYNC, s_rec[2].op);
+    TEST_ASSERT_EQUAL_UINT8(SD_DISK_OP_IOCTL, s_rec[3].op);
+    TEST_ASSERT_EQUAL_UINT32(GET_SECTOR_COUNT, s_rec[3].sector);
+    TEST_ASSERT_EQUAL_UINT8(SD_DISK_OP_TRIM, s_rec[4].op);
+    TEST_ASSERT_EQUAL_UINT32(9000U, s_rec[4].sector);
+    TEST_ASSERT_EQUAL_UINT32(4U, s_rec[4].count);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_DiskCaptureRead(s_rec, SD_DISK_CAPTURE_ENTRIES));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_DiskCaptureDropped());
+}
+
+void test_Capture_FullRing_DropsOldest(void) {
+    SD_DiskCaptureStart();
+    for (uint32_t i = 0; i < SD_DISK_CAPTURE_ENTRIES + 6U; i++) {
+        TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, s_buf, 100U + i, 1U));
+    }
+    SD_DiskCaptureStop();
+    TEST_ASSERT_EQUAL_UINT32(SD_DISK_CAPTURE_ENTRIES,
+                             SD_DiskCaptureRead(s_rec, SD_DISK_CAPTURE_ENTRIES));
+    TEST_ASSERT_EQUAL_UINT32(6U, SD_DiskCaptureDropped());
+    TEST_ASSERT_EQUAL_UINT32(106U, s_rec[0].sector);
+    TEST_ASSERT_EQUAL_UINT32(100U + SD_DISK_CAPTURE_ENTRIES + 5U,
+                             s_rec[SD_DISK_CAPTURE_ENTRIES - 1U].sector);
+
+    /* Start empties the ring. */
+    SD_DiskCaptureStart();
+    SD_DiskCaptureStop();
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_DiskCaptureRead(s_rec, SD_DISK_CAPTURE_ENTRIES));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_DiskCaptureDropped());
+}
+
+void test_Capture_TextLines_RoundTrip(void) {
+    SD_DiskCaptureRecord rec = {.time = 4000000000U, .duration = 1234U, .sector = 7700U,
+                                .count = 16U, .op = SD_DISK_OP_WRITE, .pdrv = 1U,
+                                .result = RES_ERROR};
+    SD_DiskCaptureRecord back;
+    char line[96];
+    int len = SD_DiskCaptureFormat(&rec, line, sizeof(line));
+    TEST_ASSERT_EQUAL_STRING("SDCAP,1,1,7700,16,1,4000000000,1234\r\n", line);
+    TEST_ASSERT_EQUAL_INT((int)strlen(line), len);
+    TEST_ASSERT_TRUE(SD_DiskCaptureParse(line, &back));
+    TEST_ASSERT_EQUAL_MEMORY(&rec, &back, sizeof(rec));
+
+    TEST_ASSERT_FALSE(SD_DiskCaptureParse("SDCAP,clock,16000000\r\n", &back));
+    TEST_ASSERT_FALSE(SD_DiskCaptureParse("SDCAP,1,1,7700\r\n", &back));
+    TEST_ASSERT_FALSE(SD_DiskCaptureParse("SDCAP,9,0,0,0,0,0,0\r\n", &back));
+    TEST_ASSERT_FALSE(SD_DiskCaptureParse("SDBENCH,1,1,7700,16,1,0,0\r\n", &back));
+}
+
+void test_Capture_Save_WritesTrace(void) {
+    uint32_t records = 0;
+    uint32_t lines = 0;
+    uint32_t parsed = 0;
+    char line[96];
+    SD_DiskCaptureRecord rec;
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    SD_DiskCaptureStart();
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data.txt", "captured"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_capture_save("0:/trace.txt", &records));
+    TEST_ASSERT_TRUE(records > 0U);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/trace.txt", FA_READ));
+    while (f_gets(line, sizeof(line), &s_fil) != NULL) {
+        lines++;
+        if (SD_DiskCaptureParse(line, &rec)) {
+            parsed++;
+            TEST_ASSERT_EQUAL_UINT8(RES_OK, rec.result);
+        }
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT32(records + 1U, lines);
+    TEST_ASSERT_EQUAL_UINT32(records, parsed);
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_capture_save(NULL, NULL));
+}
+
+void test_Capture_Replay_ReissuesCalls(void) {
+    mock_hal_sim_config_t cfg;
+    mock_card_stats_t cs;
+    memset(s_buf, 0x5A, sizeof(s_buf));
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    SD_DiskCaptureStart();
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_write(0, s_buf, 9200U, 4U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_ioctl(0, CTRL_SYNC, NULL));
+    HAL_Delay(5U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, s_buf, 9200U, 4U));
+    SD_DiskCaptureStop();
+    uint32_t n = SD_DiskCaptureRead(s_rec, SD_DISK_CAPTURE_ENTRIES);
+    TEST_ASSERT_EQUAL_UINT32(3U, n);
+    TEST_ASSERT_TRUE(s_rec[0].duration > 0U);
+
+    /* Pieces of the buffer size; the recorded 5 ms idle is kept. */
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskCaptureReplay(s_rec, n, s_buf, 2U, true));
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(2U, cs.cmd[25] + cs.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(2U, cs.cmd[18] + cs.cmd[17]);
+    for (uint32_t i = 0; i < n; i++) {
+        TEST_ASSERT_EQUAL_UINT8(RES_OK, s_rec[i].result);
+        TEST_ASSERT_TRUE(s_rec[i].duration > 0U);
+    }
+    uint32_t idle = s_rec[2].time - (s_rec[1].time + s_rec[1].duration);
+    TEST_ASSERT_TRUE(idle >= 5U * (SystemCoreClock / 1000U));
+
+    /* Without gaps the calls follow back to back. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskCaptureReplay(s_rec, n, s_buf, 4U, false));
+    idle = s_rec[2].time - (s_rec[1].time + s_rec[1].duration);
+    TEST_ASSERT_TRUE(idle < SystemCoreClock / 1000U);
+
+    /* Failures are reported per record. */
+    s_rec[0].sector = CARD_BLOCKS + 8U;
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_DiskCaptureReplay(s_rec, 1U, s_buf, 4U, false));
+    TEST_ASSERT_NOT_EQUAL(RES_OK, s_rec[0].result);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskCaptureReplay(s_rec, n, s_buf, 0U, false));
+    mock_hal_sim_enable(NULL);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Capture_RecordsDiskCalls);
+    RUN_TEST(test_Capture_FullRing_DropsOldest);
+    RUN_TEST(test_Capture_TextLines_RoundTrip);
+    RUN_TEST(test_Capture_Save_WritesTrace);
+    RUN_TEST(test_Capture_Replay_ReissuesCalls);
+    return UNITY_END();
+}
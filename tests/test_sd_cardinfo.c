@@ -0,0 +1,103 @@
+/*
+ * tests/test_sd_cardinfo.c
+ *
+ * CID/CSD/SD Status decoding (SD_CARD_INFO=1) against the card emulator,
+ * built with a 90 MHz SPI clock and a /2 fast prescaler (see CMakeLists.txt):
+ * the decoded fields, the timeouts tuned from them, the AU taken from the
+ * init-time ACMD13, and the bus capped at the CSD's 25 MHz TRAN_SPEED.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_cardinfo.img"
+#define CARD_BLOCKS 8192U
+
+static SD_Handle_t sd;
+static SD_CardInfo info;
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    memset(&info, 0, sizeof(info));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetCardInfo(&sd, &info));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+}
+
+void test_CardInfo_DecodesCid(void) {
+    TEST_ASSERT_TRUE(info.cid_valid);
+    TEST_ASSERT_EQUAL_UINT8(0x03U, info.manufacturer_id);
+    TEST_ASSERT_EQUAL_STRING("SD", info.oem_id);
+    TEST_ASSERT_EQUAL_STRING("EMU01", info.product_name);
+    TEST_ASSERT_EQUAL_HEX32(0x10U, info.revision);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678U, info.serial);
+    TEST_ASSERT_EQUAL_UINT32(2026U, info.mfg_year);
+    TEST_ASSERT_EQUAL_UINT8(1U, info.mfg_month);
+}
+
+void test_CardInfo_DecodesCsd(void) {
+    TEST_ASSERT_TRUE(info.csd_valid);
+    TEST_ASSERT_EQUAL_UINT8(2U, info.csd_version);
+    TEST_ASSERT_EQUAL_HEX32(0x5B5U, info.ccc);
+    TEST_ASSERT_EQUAL_UINT32(1000000U, info.taac_ns);
+    TEST_ASSERT_EQUAL_UINT32(25000U, info.tran_speed_kbps);
+    TEST_ASSERT_EQUAL_UINT8(2U, info.r2w_factor);
+    TEST_ASSERT_EQUAL_UINT8(9U, info.write_bl_len);
+}
+
+void test_CardInfo_DecodesSdStatus_AndCachesAu(void) {
+    uint32_t blocks = 0;
+    mock_card_stats_t st;
+    TEST_ASSERT_TRUE(info.status_valid);
+    TEST_ASSERT_EQUAL_UINT8(10U, info.speed_class);
+    TEST_ASSERT_EQUAL_UINT8(1U, info.uhs_grade);
+    TEST_ASSERT_EQUAL_UINT8(30U, info.video_class);
+    TEST_ASSERT_EQUAL_UINT32(8192U, info.au_blocks); /* AU_SIZE 9 = 4 MiB */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetEraseBlockSize(&sd, &blocks));
+    TEST_ASSERT_EQUAL_UINT32(8192U, blocks);
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.acmd[13]);
+}
+
+/* SDHC: 100 ms read / 250 ms write, x150 %, under the 200 / 500 ms defaults. */
+void test_CardInfo_TunesTimeoutsFromSpec(void) {
+    TEST_ASSERT_EQUAL_UINT32(150U, info.read_timeout_ms);
+    TEST_ASSERT_EQUAL_UINT32(375U, info.write_timeout_ms);
+}
+
+/* 90 MHz / 2 = 45 MHz is above TRAN_SPEED; /4 = 22.5 MHz is not. */
+void test_CardInfo_CapsBusAtTranSpeed(void) {
+    TEST_ASSERT_EQUAL_HEX32(SPI_BAUDRATEPRESCALER_4, SD_GetBusPrescaler(&sd));
+    TEST_ASSERT_EQUAL_HEX32(SPI_BAUDRATEPRESCALER_4, g_test_hspi.Init.BaudRatePrescaler);
+}
+
+void test_CardInfo_NotAvailableBeforeInit(void) {
+    SD_Handle_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_GetCardInfo(&fresh, &info));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_GetCardInfo(&sd, NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_CardInfo_DecodesCid);
+    RUN_TEST(test_CardInfo_DecodesCsd);
+    RUN_TEST(test_CardInfo_DecodesSdStatus_AndCachesAu);
+    RUN_TEST(test_CardInfo_TunesTimeoutsFromSpec);
+    RUN_TEST(test_CardInfo_CapsBusAtTranSpeed);
+    RUN_TEST(test_CardInfo_NotAvailableBeforeInit);
+
+    return UNITY_END();
+}
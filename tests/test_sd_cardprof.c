@@ -0,0 +1,166 @@
+/*
+ * tests/test_sd_cardprof.c
+ *
+ * Card fingerprint over the card emulator in simulated time, with the
+ * simulator's AU model on (4 MiB AU, 20 ms extra busy on entering another
+ * AU) and GC stalls off: the walk finds the AU entry cost at offset 0, run
+ * lengths level off into a knee, pre-erase hints that buy nothing are turned
+ * off, profiles are kept per card in one file, and with
+ * SD_LOGGER_CARD_PROFILE the logger's chunk follows the applied profile.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_cardprof.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_cardprof.img"
+#define CARD_BLOCKS 65536U /* 32 MiB */
+#define RAW_FIRST   32768U /* upper half: free clusters of the fresh volume */
+#define RAW_SPAN    24576U
+#define AU_BLOCKS   8192U
+#define AU_OPEN_US  20000U
+#define PROF_PATH   "0:/sdprof.cfg"
+
+static char s_path[4];
+static SD_CardProfile s_prof;
+
+static void sim_on(void) {
+    mock_hal_sim_config_t sim;
+    mock_hal_sim_defaults(&sim);
+    sim.program_busy = (mock_hal_sim_dist_t){100U, 300U, 0U, 0U}; /* no GC stalls */
+    sim.au_blocks = AU_BLOCKS;
+    sim.au_open_us = AU_OPEN_US;
+    mock_hal_sim_enable(&sim);
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 32768U);
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    sim_on();
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    (void)sd_logger_stop();
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_CardProf_MapsAuRunsAndSizes(void) {
+    TEST_ASSERT_EQUAL(SD_OK, sd_cardprof_measure(&g_sd_handle, RAW_FIRST, RAW_SPAN, &s_prof));
+    sd_cardprof_print(&s_prof);
+
+    TEST_ASSERT_EQUAL_UINT32(AU_BLOCKS, s_prof.au_blocks); /* ACMD13 AU_SIZE 9 */
+    TEST_ASSERT_TRUE(s_prof.au_entry_us > AU_OPEN_US * 3U / 4U);
+    TEST_ASSERT_TRUE(s_prof.au_entry_us < AU_OPEN_US * 5U / 4U);
+    TEST_ASSERT_TRUE(s_prof.au_max_us[0] > AU_OPEN_US);
+    for (uint32_t i = 1; i < SD_CARDPROF_AU_POINTS; i++) {
+        TEST_ASSERT_TRUE(s_prof.au_max_us[i] < AU_OPEN_US);
+    }
+
+    /* Longer runs amortise the command and the stop busy, then level off. */
+    for (uint32_t i = 1; i < SD_CARDPROF_SIZES; i++) {
+        TEST_ASSERT_TRUE(s_prof.run_kb_per_s[i] * 100U >= s_prof.run_kb_per_s[i - 1U] * 98U);
+        TEST_ASSERT_TRUE(s_prof.size_mean_us[i] > s_prof.size_mean_us[i - 1U]);
+    }
+    TEST_ASSERT_TRUE(s_prof.run_kb_per_s[SD_CARDPROF_SIZES - 1U] > s_prof.run_kb_per_s[0] * 5U / 4U);
+    TEST_ASSERT_TRUE(s_prof.write_blocks > 1U && s_prof.write_blocks < 64U);
+    TEST_ASSERT_TRUE(s_prof.run_kb_per_s[SD_CARDPROF_SIZES - 1U] <= s_prof.peak_kb_per_s);
+    TEST_ASSERT_EQUAL_UINT32(s_prof.size_mean_us[0], s_prof.small_write_us);
+
+    /* The emulator accepts ACMD23 but does nothing with it. */
+    TEST_ASSERT_TRUE(s_prof.run_pre_kb_per_s[SD_CARDPROF_SIZES - 1U] > 0U);
+    TEST_ASSERT_FALSE(s_prof.pre_erase);
+    TEST_ASSERT_TRUE(g_sd_handle.acmd23_ok); /* measuring restores it */
+}
+
+void test_CardProf_RejectsRangeWithoutWholeAus(void) {
+    TEST_ASSERT_EQUAL(SD_PARAM, sd_cardprof_measure(&g_sd_handle, RAW_FIRST + 1U,
+                                                    2U * AU_BLOCKS, &s_prof));
+}
+
+void test_CardProf_SavedPerCardAndAppliedWithoutMeasuring(void) {
+    SD_CardProfile other;
+    memset(&other, 0, sizeof(other));
+    other.mid = 0x27U;
+    other.psn = 0xCAFEF00DU;
+    other.blocks = 123456U;
+    other.au_blocks = 8192U;
+    other.write_blocks = 16U;
+    other.pre_erase = true;
+    TEST_ASSERT_EQUAL(FR_OK, sd_cardprof_save(PROF_PATH, &other));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_cardprof(PROF_PATH, &g_sd_handle, RAW_FIRST, RAW_SPAN, false,
+                                         &s_prof));
+    TEST_ASSERT_FALSE(g_sd_handle.acmd23_ok);
+    const SD_CardProfile *active = sd_cardprof_active(&g_sd_handle);
+    TEST_ASSERT_NOT_NULL(active);
+    TEST_ASSERT_EQUAL_UINT32(s_prof.write_blocks, active->write_blocks);
+
+    /* Both cards are in the file; a second boot loads without touching the card. */
+    SD_CardProfile loaded;
+    TEST_ASSERT_EQUAL(FR_OK, sd_cardprof_load(PROF_PATH, &g_sd_handle, &loaded));
+    TEST_ASSERT_EQUAL_UINT32(s_prof.write_blocks, loaded.write_blocks);
+    TEST_ASSERT_EQUAL_UINT32(s_prof.au_entry_us, loaded.au_entry_us);
+    TEST_ASSERT_EQUAL_UINT32(s_prof.peak_kb_per_s, loaded.peak_kb_per_s);
+    TEST_ASSERT_EQUAL_UINT32(0, loaded.run_kb_per_s[0]);
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat(PROF_PATH, &fno));
+    TEST_ASSERT_TRUE(fno.fsize > 100U);
+
+    mock_hal_sim_report_t before;
+    mock_hal_sim_report_t after;
+    mock_hal_sim_report(&before);
+    TEST_ASSERT_EQUAL(FR_OK, sd_cardprof(PROF_PATH, &g_sd_handle, RAW_FIRST, RAW_SPAN, false,
+                                         &loaded));
+    mock_hal_sim_report(&after);
+    TEST_ASSERT_TRUE(after.programs - before.programs < 8U);
+
+    /* Saving the same card again replaces its line. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_cardprof_save(PROF_PATH, &s_prof));
+    FILINFO again;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat(PROF_PATH, &again));
+    TEST_ASSERT_EQUAL_UINT32(fno.fsize, again.fsize);
+
+    /* Another card's line is not applied here. */
+    TEST_ASSERT_EQUAL(SD_PARAM, sd_cardprof_apply(&g_sd_handle, &other));
+}
+
+void test_CardProf_NoMeasureWithoutSavedProfile(void) {
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_cardprof(PROF_PATH, &g_sd_handle, 0, 0, false, NULL));
+}
+
+void test_CardProf_LoggerChunkFollowsProfile(void) {
+    SD_LoggerStats st;
+    SD_CardProfile prof;
+    memset(&prof, 0, sizeof(prof));
+    TEST_ASSERT_EQUAL(SD_OK, sd_cardprof_measure(&g_sd_handle, RAW_FIRST, RAW_SPAN, &prof));
+    prof.write_blocks = 16U;
+    TEST_ASSERT_EQUAL(SD_OK, sd_cardprof_apply(&g_sd_handle, &prof));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/p.log"));
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(8192U, st.unit_bytes);
+    TEST_ASSERT_EQUAL_UINT32(8192U, st.chunk_bytes);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_CardProf_MapsAuRunsAndSizes);
+    RUN_TEST(test_CardProf_RejectsRangeWithoutWholeAus);
+    RUN_TEST(test_CardProf_SavedPerCardAndAppliedWithoutMeasuring);
+    RUN_TEST(test_CardProf_NoMeasureWithoutSavedProfile);
+    RUN_TEST(test_CardProf_LoggerChunkFollowsProfile);
+    return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/*
+ * tests/test_sd_chunkhook.c
+ *
+ * Chunked long transfers (SD_CHUNK_BLOCKS=8) on the card emulator: the hook
+ * runs at every chunk boundary of a CMD25 or CMD18 run, polled and through
+ * the DMA pipelines, while the run stays one command and the data comes back
+ * intact; short runs and single blocks never call it.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_chunkhook.img"
+#define CARD_BLOCKS 8192U
+#define RUN_BLOCKS  20U
+
+static SD_Handle_t sd;
+static uint8_t s_tx[RUN_BLOCKS * 512U];
+static uint8_t s_rx[RUN_BLOCKS * 512U];
+
+typedef struct {
+    uint32_t calls;
+    uint32_t done[8];
+    uint32_t count;
+} chunk_log_t;
+
+static chunk_log_t s_log;
+
+static void on_chunk(void *context, uint32_t done, uint32_t count) {
+    chunk_log_t *log = (chunk_log_t *)context;
+    if (log->calls < 8U) {
+        log->done[log->calls] = done;
+    }
+    log->calls++;
+    log->count = count;
+}
+
+static void fill(void) {
+    for (uint32_t i = 0; i < sizeof(s_tx); i++) {
+        s_tx[i] = (uint8_t)((i * 7U) ^ (i >> 9));
+    }
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    memset(&s_log, 0, sizeof(s_log));
+    fill();
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+}
+
+static void init(bool dma) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, dma));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetChunkHook(&sd, on_chunk, &s_log));
+}
+
+static void check_run(bool dma) {
+    mock_card_stats_t st;
+    init(dma);
+    mock_card_reset_stats();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteMultiBlocks(&sd, s_tx, 100U, RUN_BLOCKS));
+    TEST_ASSERT_EQUAL_UINT32(2U, s_log.calls);
+    TEST_ASSERT_EQUAL_UINT32(8U, s_log.done[0]);
+    TEST_ASSERT_EQUAL_UINT32(16U, s_log.done[1]);
+    TEST_ASSERT_EQUAL_UINT32(RUN_BLOCKS, s_log.count);
+
+    memset(&s_log, 0, sizeof(s_log));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadMultiBlocks(&sd, s_rx, 100U, RUN_BLOCKS));
+    TEST_ASSERT_EQUAL_UINT32(2U, s_log.calls);
+    TEST_ASSERT_EQUAL_UINT32(8U, s_log.done[0]);
+    TEST_ASSERT_EQUAL_UINT32(16U, s_log.done[1]);
+    TEST_ASSERT_EQUAL_MEMORY(s_tx, s_rx, sizeof(s_tx));
+
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[18]);
+    TEST_ASSERT_EQUAL_UINT32(RUN_BLOCKS, st.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(RUN_BLOCKS, st.sectors_read);
+    TEST_ASSERT_EQUAL_UINT32(0, st.errors);
+}
+
+void test_ChunkHook_PolledRunStaysOneCommand(void) {
+    check_run(false);
+}
+
+void test_ChunkHook_PipelinedRunStaysOneCommand(void) {
+    mock_hal_set_dma_enabled(true);
+    check_run(true);
+}
+
+void test_ChunkHook_NotCalledAtRunEnd(void) {
+    init(false);
+    /* Exactly two chunks: one boundary inside the run, none after the last block. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_tx, 0U, 16U));
+    TEST_ASSERT_EQUAL_UINT32(1U, s_log.calls);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_rx, 0U, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_tx, 0U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(1U, s_log.calls);
+}
+
+void test_ChunkHook_Cleared(void) {
+    init(false);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetChunkHook(&sd, NULL, NULL));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteMultiBlocks(&sd, s_tx, 0U, RUN_BLOCKS));
+    TEST_ASSERT_EQUAL_UINT32(0, s_log.calls);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetChunkHook(NULL, on_chunk, NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_ChunkHook_PolledRunStaysOneCommand);
+    RUN_TEST(test_ChunkHook_PipelinedRunStaysOneCommand);
+    RUN_TEST(test_ChunkHook_NotCalledAtRunEnd);
+    RUN_TEST(test_ChunkHook_Cleared);
+    return UNITY_END();
+}
@@ -0,0 +1,231 @@
+/*
+ * tests/test_sd_commit.c
+ *
+ * Deferred directory-entry updates over real FatFs and the card emulator
+ * (SD_COMMIT_FILES=1, SD_COMMIT_MS=500): data-only syncs, what a remount
+ * without a commit sees, explicit and timed commits, the full-list fallback,
+ * and the logger's SD_LOGGER_COMMIT_MS=1000 (SYNC_MS=100) mode.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_commit.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_commit.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     4096U
+
+static FATFS s_fs;
+static FIL s_fil[2]; /* _FS_LOCK 2 */
+static char s_path[4];
+static uint8_t s_buf[1024];
+
+/* sd_functions.c is not part of the host build; the logger appends without it. */
+int sd_preallocate_file(const char *filename, uint32_t bytes) {
+    (void)filename;
+    (void)bytes;
+    return FR_DENIED;
+}
+
+void sd_dirindex_add(const char *path) {
+    (void)path;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    memset(s_buf, 0x5A, sizeof(s_buf));
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+    for (int i = 0; i < 2; i++) {
+        sd_commit_forget(&s_fil[i]);
+    }
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static void open_write(FIL *fp, const char *name, uint32_t len) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(fp, name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(fp, s_buf, len, &bw));
+    TEST_ASSERT_EQUAL_UINT32(len, bw);
+}
+
+static void append(FIL *fp, uint32_t len) {
+    while (len > 0U) {
+        UINT n = (len < sizeof(s_buf)) ? len : sizeof(s_buf);
+        UINT bw = 0;
+        TEST_ASSERT_EQUAL(FR_OK, f_write(fp, s_buf, n, &bw));
+        TEST_ASSERT_EQUAL_UINT32(n, bw);
+        len -= n;
+    }
+}
+
+/* What the card says after a fresh mount, as after a power cut. */
+static uint32_t size_on_card(const char *name) {
+    static FATFS fs2;
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&fs2, s_path, 1)); /* drops every open FIL */
+    FRESULT res = f_stat(name, &fno);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    return (res == FR_OK) ? (uint32_t)fno.fsize : UINT32_MAX;
+}
+
+/* -----------------------------------------------------------------------
+ * sd_sync_data
+ * ----------------------------------------------------------------------- */
+
+void test_SyncData_SkipsDirectorySectorReadModifyWrite(void) {
+    open_write(&s_fil[0], "a.bin", 100);
+    TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil[0]));
+
+    /* A cluster's worth each time: the window moves to the FAT, as while logging. */
+    append(&s_fil[0], CLUSTER);
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_sync_data(&s_fil[0]));
+    mock_card_stats_t data = card_stats();
+
+    append(&s_fil[0], CLUSTER);
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil[0]));
+    mock_card_stats_t full = card_stats();
+
+    printf("sync data: %lu read %lu written, f_sync: %lu read %lu written\n",
+           (unsigned long)data.sectors_read, (unsigned long)data.sectors_written,
+           (unsigned long)full.sectors_read, (unsigned long)full.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(0U, data.sectors_read);
+    TEST_ASSERT_EQUAL_UINT32(1U, full.sectors_read);
+    TEST_ASSERT_EQUAL_UINT32(full.sectors_written - 1U, data.sectors_written);
+}
+
+void test_SyncData_EntryKeepsLastCommitUntilCommit(void) {
+    open_write(&s_fil[0], "a.bin", 100);
+    TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil[0]));
+    append(&s_fil[0], 900); /* crosses into the second sector */
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0]));
+    TEST_ASSERT_EQUAL_UINT32(100U, size_on_card("a.bin"));
+}
+
+void test_Commit_WritesPendingEntry(void) {
+    open_write(&s_fil[0], "a.bin", 300);
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0]));
+    append(&s_fil[0], 400);
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0])); /* already pending */
+
+    SD_CommitStats st;
+    sd_commit_get_stats(&st);
+    uint32_t commits = st.commits;
+    TEST_ASSERT_EQUAL_UINT32(1U, st.pending);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_commit());
+    sd_commit_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(commits + 1U, st.commits);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.pending);
+    TEST_ASSERT_EQUAL_UINT32(700U, size_on_card("a.bin"));
+}
+
+void test_CommitPoll_WaitsForInterval(void) {
+    open_write(&s_fil[0], "a.bin", 100);
+    TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil[0]));
+    append(&s_fil[0], 100);
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0]));
+
+    mock_hal_set_tick(HAL_GetTick() + SD_COMMIT_MS - 1U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_commit_poll());
+    TEST_ASSERT_EQUAL_UINT32(100U, size_on_card("a.bin"));
+
+    /* The remount dropped s_fil[0]; reopen and defer again. */
+    sd_commit_forget(&s_fil[0]);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[0], "a.bin", FA_OPEN_APPEND | FA_WRITE));
+    append(&s_fil[0], 100);
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0]));
+    mock_hal_set_tick(HAL_GetTick() + SD_COMMIT_MS);
+    TEST_ASSERT_EQUAL(FR_OK, sd_commit_poll());
+    TEST_ASSERT_EQUAL_UINT32(200U, size_on_card("a.bin"));
+}
+
+void test_DeferSync_FullListFallsBackToFSync(void) {
+    SD_CommitStats st;
+    sd_commit_get_stats(&st);
+    uint32_t full = st.full_syncs;
+
+    open_write(&s_fil[0], "a.bin", 10);
+    open_write(&s_fil[1], "b.bin", 20);
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0]));
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[1]));
+
+    sd_commit_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(full + 1U, st.full_syncs);
+    TEST_ASSERT_EQUAL_UINT32(20U, size_on_card("b.bin"));
+}
+
+void test_Commit_SkipsFilesClosedMeanwhile(void) {
+    open_write(&s_fil[0], "a.bin", 100);
+    TEST_ASSERT_EQUAL(FR_OK, sd_defer_sync(&s_fil[0]));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[0]));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_commit());
+    TEST_ASSERT_EQUAL_UINT32(100U, size_on_card("a.bin"));
+    TEST_ASSERT_EQUAL(FR_INVALID_OBJECT, sd_sync_data(&s_fil[0]));
+}
+
+/* -----------------------------------------------------------------------
+ * Logger
+ * ----------------------------------------------------------------------- */
+
+void test_Logger_SyncsBetweenCommitsAreDataOnly(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_TRUE(sd_logger_write(s_buf, 200));
+    mock_hal_set_tick(HAL_GetTick() + SD_LOGGER_SYNC_MS);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.syncs);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.data_syncs);
+
+    TEST_ASSERT_TRUE(sd_logger_write(s_buf, 200));
+    mock_hal_set_tick(HAL_GetTick() + SD_LOGGER_COMMIT_MS);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.syncs);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.data_syncs); /* this one wrote the entry */
+
+    TEST_ASSERT_TRUE(sd_logger_write(s_buf, 100));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_flush()); /* explicit flush always commits */
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.data_syncs);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_SyncData_SkipsDirectorySectorReadModifyWrite);
+    RUN_TEST(test_SyncData_EntryKeepsLastCommitUntilCommit);
+
+    RUN_TEST(test_Commit_WritesPendingEntry);
+    RUN_TEST(test_CommitPoll_WaitsForInterval);
+    RUN_TEST(test_DeferSync_FullListFallsBackToFSync);
+    RUN_TEST(test_Commit_SkipsFilesClosedMeanwhile);
+
+    RUN_TEST(test_Logger_SyncsBetweenCommitsAreDataOnly);
+
+    return UNITY_END();
+}
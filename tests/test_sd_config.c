@@ -0,0 +1,193 @@
+/*
+ * tests/test_sd_config.c
+ *
+ * Build profiles (sd_config.h). Compiled once per profile under test: the
+ * knobs must resolve to the profile's values, explicit -D overrides must
+ * win, ffconf.h must pick up the profile's FatFs options, and the resulting
+ * driver must still carry a FatFs round trip over the card emulator. The
+ * compact build formats with sd_format.c (no f_mkfs) and checks that the
+ * sd_functions.c helpers needing minimized FatFs calls refuse cleanly.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_config.h"
+#include "sd_cache.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#if (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT)
+#include "sd_format.h"
+#include "sd_functions.h"
+#endif
+#include <string.h>
+
+/* One image per profile target, so the targets can run in parallel. */
+#if (SD_CONFIG_PROFILE == SD_CONFIG_LOW_RAM)
+#define IMAGE "test_sd_config_low_ram.img"
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT)
+#define IMAGE "test_sd_config_compact.img"
+#else
+#define IMAGE "test_sd_config_throughput.img"
+#endif
+#define CARD_BLOCKS 16384U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[8192];
+
+void setUp(void) {
+    static uint8_t work[_MAX_SS];
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+#if _USE_MKFS
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT, 4096U, work, sizeof(work)));
+#else
+    const SD_FormatOptions opt = {SD_FS_AUTO, 8U, 0U, true, 0x5D00C0DEU, 0U, 0U};
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, work, sizeof(work), NULL));
+#endif
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Resolved values
+ * ----------------------------------------------------------------------- */
+
+#if (SD_CONFIG_PROFILE == SD_CONFIG_LOW_RAM)
+
+void test_Config_LowRam_Values(void) {
+    TEST_ASSERT_EQUAL_STRING("low-ram", SD_ConfigProfileName());
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_MAX_INSTANCES);
+    TEST_ASSERT_EQUAL(0, SD_READ_PIPELINE);
+    TEST_ASSERT_EQUAL(0, SD_WRITE_PIPELINE);
+    TEST_ASSERT_EQUAL(0, SD_DMA_BOUNCE);
+    TEST_ASSERT_EQUAL(0, SD_LATENCY_STATS);
+    TEST_ASSERT_EQUAL(0, SD_CACHE_ENABLED);
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_FAT_CACHE_GROUPS * SD_FAT_CACHE_SPAN);
+    TEST_ASSERT_EQUAL(1, _FS_TINY);
+}
+
+/* The target sets SD_TRACE_ENTRIES=64 on the command line. */
+void test_Config_Override_WinsOverProfile(void) {
+    TEST_ASSERT_EQUAL_UINT32(64U, SD_TRACE_ENTRIES);
+}
+
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_MAX_THROUGHPUT)
+
+void test_Config_MaxThroughput_Values(void) {
+    TEST_ASSERT_EQUAL_STRING("max-throughput", SD_ConfigProfileName());
+    TEST_ASSERT_EQUAL(1, SD_READ_PIPELINE);
+    TEST_ASSERT_EQUAL(1, SD_WRITE_PIPELINE);
+    TEST_ASSERT_EQUAL(1, SD_CACHE_ENABLED);
+    TEST_ASSERT_EQUAL_UINT32(8U, SD_READAHEAD_SECTORS);
+    TEST_ASSERT_EQUAL_UINT32(8U, SD_TOKEN_POLL_BURST);
+    TEST_ASSERT_EQUAL_UINT32(8U, SD_READ_STREAM_GAP);
+    TEST_ASSERT_EQUAL(0, _FS_TINY);
+}
+
+/* The target sets SD_CACHE_LINES=4 on the command line. */
+void test_Config_Override_WinsOverProfile(void) {
+    TEST_ASSERT_EQUAL_UINT32(4U, SD_CACHE_LINES);
+}
+
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT)
+
+void test_Config_Compact_Values(void) {
+    TEST_ASSERT_EQUAL_STRING("compact", SD_ConfigProfileName());
+    TEST_ASSERT_EQUAL(0, SD_WRITE_PIPELINE);
+    TEST_ASSERT_EQUAL(0, SD_LATENCY_STATS);
+    TEST_ASSERT_EQUAL(1, _FS_MINIMIZE);
+    TEST_ASSERT_EQUAL(0, _USE_STRFUNC);
+    TEST_ASSERT_EQUAL(0, _USE_LABEL);
+    TEST_ASSERT_EQUAL(0, _USE_MKFS);
+}
+
+/* The target sets SD_READ_PIPELINE=1 on the command line. */
+void test_Config_Override_WinsOverProfile(void) {
+    TEST_ASSERT_EQUAL(1, SD_READ_PIPELINE);
+}
+
+void test_Config_Compact_MinimizedHelpersRefuse(void) {
+    FILINFO fno;
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "keep.txt", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "x", 1U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_delete_file("keep.txt"));
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_rename_file("keep.txt", "gone.txt"));
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_create_directory("logs"));
+    static const char *const names[] = {"keep.txt"};
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_delete_files("", names, 1U));
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_get_space_kb());
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_stat("keep.txt", &fno));
+
+    /* Existence still answers, by opening the file or directory. */
+    TEST_ASSERT_TRUE(sd_file_exists("keep.txt"));
+    TEST_ASSERT_FALSE(sd_file_exists("gone.txt"));
+    TEST_ASSERT_FALSE(sd_file_exists("nodir/x.txt"));
+}
+
+#endif
+
+/* -----------------------------------------------------------------------
+ * End to end
+ * ----------------------------------------------------------------------- */
+
+void test_Config_FatFsRoundTrip(void) {
+    static uint8_t back[sizeof(s_buf)];
+    UINT bw = 0;
+    UINT br = 0;
+    for (UINT i = 0; i < sizeof(s_buf); i++) {
+        s_buf[i] = (uint8_t)(i * 13U + 5U);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "cfg.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, sizeof(s_buf), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    /* Small reads, so a read-ahead window (if any) serves most of them. */
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "cfg.bin", FA_READ));
+    for (UINT off = 0; off < sizeof(back); off += 512U) {
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, back + off, 512U, &br));
+        TEST_ASSERT_EQUAL_UINT32(512U, br);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, back, sizeof(back));
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+#if (SD_CONFIG_PROFILE == SD_CONFIG_LOW_RAM)
+    RUN_TEST(test_Config_LowRam_Values);
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_MAX_THROUGHPUT)
+    RUN_TEST(test_Config_MaxThroughput_Values);
+#elif (SD_CONFIG_PROFILE == SD_CONFIG_COMPACT)
+    RUN_TEST(test_Config_Compact_Values);
+    RUN_TEST(test_Config_Compact_MinimizedHelpersRefuse);
+#endif
+    RUN_TEST(test_Config_Override_WinsOverProfile);
+    RUN_TEST(test_Config_FatFsRoundTrip);
+
+    return UNITY_END();
+}
@@ -0,0 +1,148 @@
+/*
+ * tests/test_sd_copy.c
+ *
+ * sd_copy_file through sd_mount on the card emulator (_USE_EXPAND 1): the
+ * copy has the source's bytes, whole pieces go out as multi-block writes
+ * into a contiguous destination, an existing destination is replaced, an
+ * empty file copies, and a failed copy leaves no destination behind.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_fwload.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_copy.img"
+#define CARD_BLOCKS 16384U
+#define FILE_BYTES  (4U * SD_FWLOAD_CHUNK + 700U)
+
+static char s_path[4];
+static uint8_t s_data[SD_FWLOAD_CHUNK];
+static uint8_t s_back[SD_FWLOAD_CHUNK];
+
+static uint8_t pattern_at(uint32_t offset) {
+    return (uint8_t)(offset * 13U + (offset >> 10));
+}
+
+static void write_pattern(const char *path, uint32_t bytes) {
+    FIL fil;
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS));
+    for (uint32_t off = 0; off < bytes; off += sizeof(s_data)) {
+        uint32_t n = (bytes - off < sizeof(s_data)) ? bytes - off : sizeof(s_data);
+        for (uint32_t i = 0; i < n; i++) {
+            s_data[i] = pattern_at(off + i);
+        }
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, s_data, n, &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+}
+
+static void check_pattern(const char *path, uint32_t bytes) {
+    FIL fil;
+    UINT br;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, path, FA_READ));
+    TEST_ASSERT_EQUAL_UINT32(bytes, (uint32_t)f_size(&fil));
+    for (uint32_t off = 0; off < bytes; off += sizeof(s_back)) {
+        uint32_t n = (bytes - off < sizeof(s_back)) ? bytes - off : sizeof(s_back);
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&fil, s_back, n, &br));
+        TEST_ASSERT_EQUAL_UINT32(n, br);
+        for (uint32_t i = 0; i < n; i++) {
+            s_data[i] = pattern_at(off + i);
+        }
+        TEST_ASSERT_EQUAL_MEMORY(s_data, s_back, n);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+}
+
+/* Clusters of path that do not follow the previous one. */
+static uint32_t breaks_in(const char *path) {
+    static DWORD map[64];
+    FIL fil;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, path, FA_READ));
+    fil.cltbl = map;
+    map[0] = 64U;
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&fil, CREATE_LINKMAP));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    return (map[0] - 1U) / 2U - 1U;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    write_pattern("0:/log.bin", FILE_BYTES);
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/archive"));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Copy_BytesAndMultiBlockWrites(void) {
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_copy_file("0:/log.bin", "0:/archive/log.bin"));
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_TRUE(cs.cmd[25] >= 4U);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.errors);
+
+    check_pattern("0:/archive/log.bin", FILE_BYTES);
+    check_pattern("0:/log.bin", FILE_BYTES);
+    TEST_ASSERT_EQUAL_UINT32(0U, breaks_in("0:/archive/log.bin"));
+}
+
+void test_Copy_ReplacesContiguously(void) {
+    /* Interleave two files so free space is fragmented behind them. */
+    FIL a, b;
+    UINT bw;
+    memset(s_data, 0x55, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&a, "0:/archive/log.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&b, "0:/pad.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&a, s_data, 1024U, &bw));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&b, s_data, 1024U, &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&a));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&b));
+    TEST_ASSERT_TRUE(breaks_in("0:/archive/log.bin") > 0U);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_copy_file("0:/log.bin", "0:/archive/log.bin"));
+    check_pattern("0:/archive/log.bin", FILE_BYTES);
+    TEST_ASSERT_EQUAL_UINT32(0U, breaks_in("0:/archive/log.bin"));
+}
+
+void test_Copy_EmptyAndErrors(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/empty.txt", ""));
+    TEST_ASSERT_EQUAL(FR_OK, sd_copy_file("0:/empty.txt", "0:/archive/empty.txt"));
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/archive/empty.txt", &fno));
+    TEST_ASSERT_EQUAL_UINT32(0U, (uint32_t)fno.fsize);
+
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_copy_file("0:/none.bin", "0:/archive/none.bin"));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("0:/archive/none.bin", &fno));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_copy_file("0:/archive", "0:/x.bin"));
+    TEST_ASSERT_EQUAL(FR_NO_PATH, sd_copy_file("0:/log.bin", "0:/nodir/log.bin"));
+
+    /* Onto itself, under either name: refused before anything is truncated. */
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_copy_file("0:/log.bin", "0:/LOG.BIN"));
+    check_pattern("0:/log.bin", FILE_BYTES);
+    write_pattern("0:/sensor_log.bin", 1000U);
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_copy_file("0:/sensor_log.bin", "0:/SENSOR~1.BIN"));
+    check_pattern("0:/sensor_log.bin", 1000U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Copy_BytesAndMultiBlockWrites);
+    RUN_TEST(test_Copy_ReplacesContiguously);
+    RUN_TEST(test_Copy_EmptyAndErrors);
+    return UNITY_END();
+}
@@ -0,0 +1,163 @@
+/*
+ * tests/test_sd_cpp.cpp
+ *
+ * C++ wrapper (sd_functions.hpp) on the card emulator: SectorBuffer storage
+ * is DMA-aligned, File and Dir close on scope exit and hand ownership over
+ * on move, and the SectorBuffer overloads take the aligned path, refusing an
+ * unaligned file position the way sd_write_aligned does.
+ */
+
+extern "C" {
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+}
+#include "sd_diskio_spi.h"
+#include "sd_functions.hpp"
+#include "ff_gen_drv.h"
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+#define IMAGE       "test_sd_cpp.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     1024U
+
+static_assert(!std::is_copy_constructible<sd::File>::value, "File must be move-only");
+static_assert(!std::is_copy_assignable<sd::Dir>::value, "Dir must be move-only");
+static_assert(std::is_nothrow_move_constructible<sd::File>::value, "File moves cannot throw");
+static_assert(sd::SectorBuffer<4>::kBytes == 2048U, "four sectors");
+
+static char s_path[4];
+
+/* With _FS_LOCK, a file still open somewhere cannot be opened for writing. */
+static bool still_open(const char *path) {
+    FIL probe;
+    FRESULT res = f_open(&probe, path, FA_WRITE | FA_OPEN_EXISTING);
+    if (res == FR_OK) {
+        (void)f_close(&probe);
+    }
+    return res == FR_LOCKED;
+}
+
+void setUp(void) {
+    static uint8_t work[_MAX_SS];
+    mock_hal_reset();
+    TEST_ASSERT_TRUE(mock_card_open(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT | FM_SFD, CLUSTER, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Cpp_SectorBuffer_Aligned(void) {
+    sd::SectorBuffer<1> one;
+    struct {
+        char pad;
+        sd::SectorBuffer<3> buf;
+    } odd;
+    TEST_ASSERT_EQUAL_UINT32(0U, (uintptr_t)one.data() % SD_DMA_ALIGNMENT);
+    TEST_ASSERT_EQUAL_UINT32(0U, (uintptr_t)odd.buf.data() % SD_DMA_ALIGNMENT);
+    TEST_ASSERT_EQUAL_UINT32(1536U, odd.buf.size());
+    TEST_ASSERT_EQUAL_PTR(odd.buf.data() + 1024, odd.buf.sector(2));
+}
+
+void test_Cpp_File_AlignedRoundTrip(void) {
+    sd::SectorBuffer<4> out;
+    sd::SectorBuffer<4> in;
+    UINT n = 0;
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = (uint8_t)(i * 7U);
+    }
+    {
+        sd::File f;
+        TEST_ASSERT_EQUAL(FR_OK, f.open("0:/a.bin", FA_WRITE | FA_CREATE_ALWAYS));
+        TEST_ASSERT_EQUAL(FR_OK, f.write(out, &n));
+        TEST_ASSERT_EQUAL_UINT32(2048U, n);
+        TEST_ASSERT_EQUAL(FR_OK, f.write(out, 2U, &n));
+        TEST_ASSERT_EQUAL_UINT32(1024U, n);
+        TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, f.write(out, 5U, &n));
+        TEST_ASSERT_EQUAL_UINT32(3072U, (uint32_t)f.size());
+    } /* closed here */
+
+    sd::File f;
+    TEST_ASSERT_EQUAL(FR_OK, f.open("0:/a.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f.read(in, &n));
+    TEST_ASSERT_EQUAL_UINT32(2048U, n);
+    TEST_ASSERT_EQUAL_MEMORY(out.data(), in.data(), out.size());
+
+    /* Off a sector boundary the aligned path refuses instead of bouncing. */
+    TEST_ASSERT_EQUAL(FR_OK, f.seek(100U));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, f.read(in, &n));
+    char small[4];
+    TEST_ASSERT_EQUAL(FR_OK, f.read(small, sizeof(small), &n));
+    TEST_ASSERT_EQUAL_MEMORY(out.data() + 100, small, sizeof(small));
+}
+
+void test_Cpp_File_ClosesOnScopeExitAndMove(void) {
+    {
+        sd::File a;
+        TEST_ASSERT_EQUAL(FR_OK, a.open("0:/m.txt", FA_WRITE | FA_CREATE_ALWAYS));
+        TEST_ASSERT_TRUE(still_open("0:/m.txt"));
+
+        sd::File b(std::move(a));
+        TEST_ASSERT_FALSE(a.is_open());
+        TEST_ASSERT_TRUE(b.is_open());
+        UINT n = 0;
+        TEST_ASSERT_EQUAL(FR_OK, b.write("moved", 5U, &n));
+        TEST_ASSERT_EQUAL(FR_OK, a.close()); /* nothing left to close */
+        TEST_ASSERT_TRUE(still_open("0:/m.txt"));
+
+        sd::File c;
+        TEST_ASSERT_EQUAL(FR_OK, c.open("0:/n.txt", FA_WRITE | FA_CREATE_ALWAYS));
+        c = std::move(b); /* n.txt is closed, m.txt moves in */
+        TEST_ASSERT_FALSE(still_open("0:/n.txt"));
+        TEST_ASSERT_TRUE(still_open("0:/m.txt"));
+        TEST_ASSERT_EQUAL_UINT32(5U, (uint32_t)c.size());
+    }
+    TEST_ASSERT_FALSE(still_open("0:/m.txt"));
+
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/m.txt", &fno));
+    TEST_ASSERT_EQUAL_UINT32(5U, (uint32_t)fno.fsize);
+}
+
+void test_Cpp_Dir_ListsAndRewinds(void) {
+    {
+        sd::File f;
+        TEST_ASSERT_EQUAL(FR_OK, f.open("0:/one.txt", FA_WRITE | FA_CREATE_ALWAYS));
+        TEST_ASSERT_EQUAL(FR_OK, f.open("0:/two.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    }
+    sd::Dir d;
+    TEST_ASSERT_EQUAL(FR_OK, d.open("0:/"));
+    sd::Dir moved = std::move(d);
+    TEST_ASSERT_FALSE(d.is_open());
+
+    FILINFO fno;
+    uint32_t entries = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        entries = 0;
+        while (moved.read(fno) == FR_OK && fno.fname[0] != 0) {
+            entries++;
+        }
+        TEST_ASSERT_EQUAL(FR_OK, moved.rewind());
+    }
+    TEST_ASSERT_EQUAL_UINT32(2U, entries);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Cpp_SectorBuffer_Aligned);
+    RUN_TEST(test_Cpp_File_AlignedRoundTrip);
+    RUN_TEST(test_Cpp_File_ClosesOnScopeExitAndMove);
+    RUN_TEST(test_Cpp_Dir_ListsAndRewinds);
+    return UNITY_END();
+}
@@ -0,0 +1,277 @@
+/*
+ * tests/test_sd_crc.c
+ *
+ * Tests for CRC mode (CMD59, CRC7 on commands, CRC16 on data blocks).
+ * Built with SD_CRC_ENABLED=1.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+/* Bitwise reference CRC16-CCITT, independent of the driver's table. */
+static uint16_t ref_crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000U) ? (uint16_t)((crc << 1) ^ 0x1021U) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* push_sdhc_init with the CMD59 exchange that CRC mode adds after ACMD41. */
+static void push_sdhc_init_crc(uint8_t cmd59_r1) {
+    push_cmd_exchange(0x01U);             /* CMD0   */
+    push_cmd_exchange(0x01U);             /* CMD8   */
+    push_r7_sdv2();
+    push_cmd_exchange(0x01U);             /* CMD55  */
+    push_cmd_exchange(0x00U);             /* ACMD41 */
+    push_cmd_exchange(cmd59_r1);          /* CMD59  */
+    push_cmd_exchange(0x00U);             /* CMD58  */
+    push_ocr_sdhc();
+    push_cmd_exchange(0x00U);             /* CMD9   */
+    push_data_token();
+    push_csd_sdhc(8192U);
+    push_crc();
+}
+
+static void init_crc_card(uint8_t cmd59_r1) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    push_sdhc_init_crc(cmd59_r1);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    mock_hal_reset(); /* start each test with an empty transmit log */
+}
+
+/* Queue one data block of fill bytes with the given CRC16 trailer. */
+static void push_block(uint8_t fill, uint16_t crc) {
+    uint8_t data[512];
+    memset(data, fill, sizeof(data));
+    push_data_token();
+    mock_hal_push_bytes(data, sizeof(data));
+    mock_hal_push_byte((uint8_t)(crc >> 8));
+    mock_hal_push_byte((uint8_t)crc);
+}
+
+static uint16_t fill_crc(uint8_t fill) {
+    uint8_t data[512];
+    memset(data, fill, sizeof(data));
+    return ref_crc16(data, sizeof(data));
+}
+
+/* Offset of the first CMD frame with the given index in the transmit log (-1 if absent). */
+static int find_cmd(uint8_t cmd) {
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    for (size_t i = 0; i + 6U < len; i++) {
+        if (tx[i] == 0xFFU && tx[i + 1U] == (uint8_t)(0x40U | cmd)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* -----------------------------------------------------------------------
+ * Command CRC7 and CMD59
+ * ----------------------------------------------------------------------- */
+
+void test_Crc_Init_SendsCmd59WithValidCrc7(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    push_sdhc_init_crc(0x00U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_TRUE(sd.crc_on);
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    int at = find_cmd(59);
+    TEST_ASSERT_TRUE(at >= 0);
+    const uint8_t cmd59[7] = {0xFF, 0x7B, 0x00, 0x00, 0x00, 0x01, 0x83};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd59, &tx[at], 7);
+    TEST_ASSERT_EQUAL_HEX8(0x95U, tx[find_cmd(0) + 6]); /* CMD0 CRC unchanged */
+}
+
+void test_Crc_ReadCommand_CarriesComputedCrc7(void) {
+    init_crc_card(0x00U);
+    push_cmd_exchange(0x00U);
+    push_block(0x11U, fill_crc(0x11U));
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 5, 1));
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    TEST_ASSERT_EQUAL_HEX8(0x0FU, tx[find_cmd(17) + 6]);
+}
+
+/* Every init command, zero-argument (table) or not, against the bitwise reference. */
+void test_Crc_InitCommands_MatchReferenceCrc7(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    push_sdhc_init_crc(0x00U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    const uint8_t cmds[] = {0, 8, 55, 41, 59, 58, 9};
+    for (size_t i = 0; i < sizeof(cmds); i++) {
+        int at = find_cmd(cmds[i]);
+        TEST_ASSERT_TRUE(at >= 0);
+        TEST_ASSERT_EQUAL_HEX8((uint8_t)((test_crc7(&tx[at + 1], 5) << 1) | 0x01U), tx[at + 6]);
+    }
+    TEST_ASSERT_EQUAL_HEX8(0x87U, tx[find_cmd(8) + 6]);
+}
+
+void test_Crc_ZeroArgumentRead_UsesPrecomputedCrc(void) {
+    init_crc_card(0x00U);
+    push_cmd_exchange(0x00U);
+    push_block(0x33U, fill_crc(0x33U));
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    int at = find_cmd(17);
+    TEST_ASSERT_TRUE(at >= 0);
+    const uint8_t cmd17[7] = {0xFF, 0x51, 0x00, 0x00, 0x00, 0x00, 0x55};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd17, &tx[at], 7);
+}
+
+void test_Crc_Cmd59Rejected_CrcModeStaysOff(void) {
+    init_crc_card(0x04U);
+    TEST_ASSERT_FALSE(sd.crc_on);
+
+    push_cmd_exchange(0x00U);
+    push_block(0x22U, 0xFFFFU); /* wrong CRC is not checked */
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+}
+
+/* -----------------------------------------------------------------------
+ * Data CRC16
+ * ----------------------------------------------------------------------- */
+
+void test_Crc_SingleRead_BadCrc_ReturnsCrcError(void) {
+    init_crc_card(0x00U);
+    for (int i = 0; i < 3; i++) { /* every retry sees the same corruption */
+        push_cmd_exchange(0x00U);
+        push_block(0x33U, (uint16_t)(fill_crc(0x33U) ^ 0x0100U));
+    }
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_CRC_ERROR, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(3U, sd.stats.crc_errors);
+}
+
+void test_Crc_SingleRead_BadCrcThenGood_Retried(void) {
+    init_crc_card(0x00U);
+    push_cmd_exchange(0x00U);
+    push_block(0x44U, 0x0000U);
+    push_cmd_exchange(0x00U);
+    push_block(0x44U, fill_crc(0x44U));
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.crc_errors);
+}
+
+void test_Crc_SingleWrite_SendsDataCrc16(void) {
+    init_crc_card(0x00U);
+    push_single_write_accepted();
+    uint8_t buf[512];
+    for (int i = 0; i < 512; i++) {
+        buf[i] = (uint8_t)(i * 7);
+    }
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    int data = find_cmd(24) + 8; /* command frame, start token */
+    uint16_t crc = ref_crc16(buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)(crc >> 8), tx[data + 512]);
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)crc, tx[data + 513]);
+}
+
+void test_Crc_PipelinedRead_BadSecondBlock_DrainsRunAndResumes(void) {
+    init_crc_card(0x00U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_cmd_exchange(0x00U);
+    push_block(0x50U, fill_crc(0x50U));
+    push_block(0x51U, 0x1234U);
+    push_block(0x52U, fill_crc(0x52U));
+    push_cmd_exchange(0x00U); /* CMD12 */
+    /* The retry starts at the bad block. */
+    push_cmd_exchange(0x00U);
+    push_block(0x61U, fill_crc(0x61U));
+    push_block(0x62U, fill_crc(0x62U));
+    push_cmd_exchange(0x00U); /* CMD12 */
+
+    static uint8_t buf[3 * 512] __attribute__((aligned(32)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 3));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.crc_errors);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.resumes);
+    TEST_ASSERT_EQUAL_UINT64(512U, sd.stats.resumed_bytes);
+    TEST_ASSERT_EQUAL_UINT8(0x50U, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x61U, buf[512]);
+    TEST_ASSERT_EQUAL_UINT8(0x62U, buf[1024]);
+}
+
+void test_Crc_PipelinedWrite_FramesCarryCrc16(void) {
+    init_crc_card(0x00U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_cmd_exchange(0x00U); /* CMD25 */
+    for (int i = 0; i < 2; i++) {
+        mock_hal_push_byte(0x05U);
+        push_wait_ready();
+    }
+    push_wait_ready();
+    static uint8_t buf[2 * 512] __attribute__((aligned(32)));
+    memset(buf, 0x5AU, sizeof(buf));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 2));
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    int frame = find_cmd(25) + 7;
+    uint16_t crc = ref_crc16(buf, 512);
+    TEST_ASSERT_EQUAL_HEX8(0xFCU, tx[frame]);
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)(crc >> 8), tx[frame + 513]);
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)crc, tx[frame + 514]);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Crc_Init_SendsCmd59WithValidCrc7);
+    RUN_TEST(test_Crc_ReadCommand_CarriesComputedCrc7);
+    RUN_TEST(test_Crc_InitCommands_MatchReferenceCrc7);
+    RUN_TEST(test_Crc_ZeroArgumentRead_UsesPrecomputedCrc);
+    RUN_TEST(test_Crc_Cmd59Rejected_CrcModeStaysOff);
+
+    RUN_TEST(test_Crc_SingleRead_BadCrc_ReturnsCrcError);
+    RUN_TEST(test_Crc_SingleRead_BadCrcThenGood_Retried);
+    RUN_TEST(test_Crc_SingleWrite_SendsDataCrc16);
+    RUN_TEST(test_Crc_PipelinedRead_BadSecondBlock_DrainsRunAndResumes);
+    RUN_TEST(test_Crc_PipelinedWrite_FramesCarryCrc16);
+
+    return UNITY_END();
+}
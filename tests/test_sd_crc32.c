@@ -0,0 +1,152 @@
+/*
+ * tests/test_sd_crc32.c
+ *
+ * CRC-32 streams (software path) and sd_file_crc32 against the card
+ * emulator: the STM32 CRC unit's known vector, streams split at every kind
+ * of boundary matching one-shot SD_Crc32 and a bit-by-bit model, a stream
+ * begun twice starting over, and whole-file CRCs through sd_mount, including
+ * text still held by the helpers' file cache and files bigger than one
+ * loader piece.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_crc32.h"
+#include "sd_fwload.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_crc32.img"
+#define CARD_BLOCKS 16384U
+#define FILE_BYTES  (2U * SD_FWLOAD_CHUNK + 1234U)
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_data[FILE_BYTES];
+
+/* Bit by bit, as the CRC unit does it. */
+static uint32_t crc_ref(const uint8_t *p, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFFU;
+    for (uint32_t i = 0; i < len; i += 4U) {
+        uint32_t word = 0;
+        for (uint32_t k = 0; k < 4U && i + k < len; k++) {
+            word |= (uint32_t)p[i + k] << (8U * k);
+        }
+        crc ^= word;
+        for (uint32_t bit = 0; bit < 32U; bit++) {
+            crc = (crc & 0x80000000U) ? (crc << 1) ^ 0x04C11DB7U : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void write_file(const char *name, uint32_t len) {
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_data, len, &bw));
+    TEST_ASSERT_EQUAL(len, bw);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    for (uint32_t i = 0; i < FILE_BYTES; i++) {
+        s_data[i] = (uint8_t)(i * 131U + (i >> 9));
+    }
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Crc32_MatchesCrcUnit(void) {
+    const uint8_t word[4] = {0x78, 0x56, 0x34, 0x12};
+    TEST_ASSERT_EQUAL_HEX32(0xDF8A8A2BU, SD_Crc32(SD_CRC32_INIT, word, 4U));
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(s_data, 1001U), SD_Crc32(SD_CRC32_INIT, s_data, 1001U));
+    /* Continued in word-multiple pieces, then a tail. */
+    uint32_t crc = SD_Crc32(SD_CRC32_INIT, s_data, 512U);
+    crc = SD_Crc32(crc, &s_data[512], 489U);
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(s_data, 1001U), crc);
+}
+
+void test_Crc32Stream_AnySplitMatchesOneShot(void) {
+    static const uint32_t steps[] = {1U, 3U, 2U, 4U, 7U, 0U, 5U, 512U, 6U, 1U, 333U};
+    SD_Crc32Stream s;
+    uint32_t off = 0;
+    SD_Crc32Begin(&s);
+    for (uint32_t i = 0; off < 9000U; i = (i + 1U) % (sizeof(steps) / sizeof(steps[0]))) {
+        uint32_t n = (steps[i] > 9000U - off) ? 9000U - off : steps[i];
+        SD_Crc32Update(&s, &s_data[off], n);
+        off += n;
+    }
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(s_data, 9000U), SD_Crc32End(&s));
+
+    /* From an odd address, as one call. */
+    SD_Crc32Begin(&s);
+    SD_Crc32Update(&s, &s_data[1], 4095U);
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(&s_data[1], 4095U), SD_Crc32End(&s));
+}
+
+void test_Crc32Stream_EmptyAndRestart(void) {
+    SD_Crc32Stream s;
+    SD_Crc32Begin(&s);
+    TEST_ASSERT_EQUAL_HEX32(SD_CRC32_INIT, SD_Crc32End(&s));
+
+    /* Begin drops a stream's unfinished word. */
+    SD_Crc32Begin(&s);
+    SD_Crc32Update(&s, s_data, 3U);
+    SD_Crc32Begin(&s);
+    SD_Crc32Update(&s, &s_data[100], 10U);
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(&s_data[100], 10U), SD_Crc32End(&s));
+}
+
+void test_FileCrc32_MatchesReference(void) {
+    uint32_t crc = 0;
+    write_file("0:/big.bin", FILE_BYTES);
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_crc32("0:/big.bin", &crc));
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(s_data, FILE_BYTES), crc);
+
+    write_file("0:/small.bin", 3U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_crc32("0:/small.bin", &crc));
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(s_data, 3U), crc);
+
+    write_file("0:/empty.bin", 0U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_crc32("0:/empty.bin", &crc));
+    TEST_ASSERT_EQUAL_HEX32(SD_CRC32_INIT, crc);
+}
+
+void test_FileCrc32_SeesCachedAppends(void) {
+    uint32_t crc = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/log.txt", "first line\n"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/log.txt", "second\n"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_crc32("0:/log.txt", &crc));
+    const char *text = "first line\nsecond\n";
+    TEST_ASSERT_EQUAL_HEX32(crc_ref((const uint8_t *)text, (uint32_t)strlen(text)), crc);
+}
+
+void test_FileCrc32_Errors(void) {
+    uint32_t crc = 0x1234U;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_file_crc32("0:/missing.bin", &crc));
+    TEST_ASSERT_EQUAL_HEX32(0x1234U, crc);
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_file_crc32(NULL, &crc));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_file_crc32("0:/missing.bin", NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Crc32_MatchesCrcUnit);
+    RUN_TEST(test_Crc32Stream_AnySplitMatchesOneShot);
+    RUN_TEST(test_Crc32Stream_EmptyAndRestart);
+    RUN_TEST(test_FileCrc32_MatchesReference);
+    RUN_TEST(test_FileCrc32_SeesCachedAppends);
+    RUN_TEST(test_FileCrc32_Errors);
+    return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/*
+ * tests/test_sd_dcache.c
+ *
+ * D-cache maintenance of DMA buffers, counted through the driver's
+ * SD_DCACHE_* hooks (MOCK_DCACHE) over the card emulator: a CMD18/CMD25
+ * run into an aligned buffer is cleaned or invalidated once up front
+ * instead of per block, unaligned (bounced) blocks are still maintained
+ * block by block, and buffers in a declared non-cacheable region get no
+ * maintenance at all.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_dcache.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+static DMA_HandleTypeDef s_dma_tx;
+static DMA_HandleTypeDef s_dma_rx;
+static uint8_t s_out[8 * 512 + 32] __attribute__((aligned(32)));
+static uint8_t s_back[8 * 512 + 32] __attribute__((aligned(32)));
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(i * 7U + seed);
+    }
+}
+
+static void reset_counts(void) {
+    mock_hal_dcache_cleans = 0;
+    mock_hal_dcache_invalidates = 0;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    memset(&s_dma_tx, 0, sizeof(s_dma_tx));
+    memset(&s_dma_rx, 0, sizeof(s_dma_rx));
+    s_dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    s_dma_rx.Init.MemInc = DMA_MINC_ENABLE;
+    g_test_hspi.hdmatx = &s_dma_tx;
+    g_test_hspi.hdmarx = &s_dma_rx;
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    reset_counts();
+}
+
+void tearDown(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DmaSetNoCache(NULL, 0U, SD_MPU_REGION_NONE));
+    SD_DeInit(&sd);
+    mock_card_close();
+    g_test_hspi.hdmatx = NULL;
+    g_test_hspi.hdmarx = NULL;
+}
+
+void test_DCache_SingleBlock_InvalidatedBeforeAndAfter(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 3U, 1U));
+    TEST_ASSERT_EQUAL(2, mock_hal_dcache_invalidates);
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_cleans); /* the 0xFF source was cleaned when filled */
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_unaligned);
+}
+
+void test_DCache_MultiBlock_WholeRangeOnce(void) {
+    fill_pattern(s_out, 8U * 512U, 3U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_out, 40U, 8U));
+    TEST_ASSERT_EQUAL(1, mock_hal_dcache_cleans);
+
+    reset_counts();
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 40U, 8U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_out, s_back, 8U * 512U);
+    /* The run up front, then each block once its DMA is done. */
+    TEST_ASSERT_EQUAL(1 + 8, mock_hal_dcache_invalidates);
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_cleans);
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_unaligned);
+    TEST_ASSERT_TRUE(sd.stats.dcache_skips >= 16U);
+    TEST_ASSERT_NULL(sd.dcache_lo);
+}
+
+void test_DCache_UnalignedBuffer_MaintainedPerBlock(void) {
+    uint8_t *out = s_out + 4;
+    fill_pattern(out, 4U * 512U, 9U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 60U, 4U));
+    TEST_ASSERT_EQUAL(4, mock_hal_dcache_cleans);
+    TEST_ASSERT_EQUAL(4U, sd.stats.dma_bounced_blocks);
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_unaligned);
+}
+
+void test_DCache_NoCacheRegion_Skipped(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DmaSetNoCache(s_out, sizeof(s_out), SD_MPU_REGION_NONE));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DmaSetNoCache(s_back, sizeof(s_back), SD_MPU_REGION_NONE));
+    fill_pattern(s_back, 8U * 512U, 5U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_back, 80U, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 80U, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 80U, 8U));
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_cleans);
+    TEST_ASSERT_EQUAL(0, mock_hal_dcache_invalidates);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.dcache_ops);
+
+    /* Only the latest region counts. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_out, 80U, 1U));
+    TEST_ASSERT_EQUAL(2, mock_hal_dcache_invalidates);
+}
+
+void test_DCache_SetNoCache_Checks(void) {
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DmaSetNoCache(NULL, 512U, SD_MPU_REGION_NONE));
+    /* No MPU on the host. */
+    TEST_ASSERT_EQUAL(SD_UNSUPPORTED, SD_DmaSetNoCache(s_out, 4096U, 7U));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_DCache_SingleBlock_InvalidatedBeforeAndAfter);
+    RUN_TEST(test_DCache_MultiBlock_WholeRangeOnce);
+    RUN_TEST(test_DCache_UnalignedBuffer_MaintainedPerBlock);
+    RUN_TEST(test_DCache_NoCacheRegion_Skipped);
+    RUN_TEST(test_DCache_SetNoCache_Checks);
+    return UNITY_END();
+}
@@ -0,0 +1,268 @@
+/*
+ * tests/test_sd_defrag.c
+ *
+ * Background compaction over real FatFs and the card emulator
+ * (SD_DEFRAG_ENABLED=1, _USE_EXPAND=1, 2 KiB chunks, default pacing): two
+ * files written cluster by cluster in turn are moved into one run each with
+ * their data intact, contiguous files are left alone, a file held open by a
+ * reader or with no contiguous space stays where it is, a reset mid-move is
+ * recovered from the journal, and steps wait out card I/O and the bandwidth cap.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_defrag.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_defrag.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     512U
+#define PIECES      20U
+
+static FATFS s_fs;
+static FIL s_fil[2]; /* _FS_LOCK 2 */
+static char s_path[4];
+static uint8_t s_buf[CLUSTER];
+
+void setUp(void) {
+    (void)remove(IMAGE);
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+void tearDown(void) {
+    SD_DefragStop();
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+static uint8_t pattern(uint32_t file, uint32_t pos) {
+    return (uint8_t)(file * 101U + pos * 7U + (pos >> 9));
+}
+
+static void fill(uint32_t file, uint32_t pos, UINT len) {
+    for (UINT i = 0; i < len; i++) {
+        s_buf[i] = pattern(file, pos + i);
+    }
+}
+
+/* a.bin and b.bin, PIECES clusters each, written one cluster at a time in turn. */
+static void write_interleaved(void) {
+    static const char *const names[2] = {"a.bin", "b.bin"};
+    for (uint32_t f = 0; f < 2U; f++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[f], names[f], FA_CREATE_ALWAYS | FA_WRITE));
+    }
+    for (uint32_t k = 0; k < PIECES; k++) {
+        for (uint32_t f = 0; f < 2U; f++) {
+            UINT bw = 0;
+            UINT len = (k == PIECES - 1U) ? 300U : CLUSTER; /* a partial last cluster */
+            fill(f, k * CLUSTER, len);
+            TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil[f], s_buf, len, &bw));
+            TEST_ASSERT_EQUAL_UINT32(len, bw);
+            TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil[f])); /* allocate now, in turn */
+        }
+    }
+    for (uint32_t f = 0; f < 2U; f++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[f]));
+    }
+}
+
+static uint32_t runs_of(const char *name) {
+    DWORD tbl[64];
+    tbl[0] = 64U;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[0], name, FA_READ));
+    s_fil[0].cltbl = tbl;
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil[0], CREATE_LINKMAP));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[0]));
+    return (tbl[0] - 2U) / 2U;
+}
+
+static void check_data(const char *name, uint32_t file) {
+    const uint32_t size = (PIECES - 1U) * CLUSTER + 300U;
+    uint8_t want[CLUSTER];
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[0], name, FA_READ));
+    TEST_ASSERT_EQUAL_UINT32(size, f_size(&s_fil[0]));
+    for (uint32_t pos = 0; pos < size; pos += CLUSTER) {
+        UINT br = 0;
+        UINT len = (size - pos < CLUSTER) ? (UINT)(size - pos) : CLUSTER;
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil[0], s_buf, len, &br));
+        TEST_ASSERT_EQUAL_UINT32(len, br);
+        for (UINT i = 0; i < len; i++) {
+            want[i] = pattern(file, pos + i);
+        }
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(want, s_buf, len);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[0]));
+}
+
+/* Step the pass to its end, moving the tick over each wait. */
+static SD_DefragStats run_pass(void) {
+    SD_DefragStats st;
+    TEST_ASSERT_EQUAL(FR_OK, SD_DefragStart(s_path));
+    for (uint32_t n = 0; SD_DefragStep(); n++) {
+        TEST_ASSERT_TRUE(n < 10000U);
+        mock_hal_set_tick(mock_hal_get_tick() + SD_DefragWaitMs());
+    }
+    SD_DefragGetStats(&st);
+    TEST_ASSERT_FALSE(st.active);
+    return st;
+}
+
+static void write_small(const char *name, const char *text) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[0], name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil[0], text, (UINT)strlen(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[0]));
+}
+
+void test_Defrag_MovesFragmentedFilesIntoOneRun(void) {
+    write_interleaved();
+    TEST_ASSERT_EQUAL_UINT32(PIECES, runs_of("a.bin"));
+    TEST_ASSERT_EQUAL_UINT32(PIECES, runs_of("b.bin"));
+
+    SD_DefragStats st = run_pass();
+    TEST_ASSERT_EQUAL_UINT32(2, st.files);
+    TEST_ASSERT_EQUAL_UINT32(2, st.fragmented);
+    TEST_ASSERT_EQUAL_UINT32(2, st.moved);
+    TEST_ASSERT_EQUAL_UINT32(2U * (PIECES - 1U), st.runs_removed);
+    TEST_ASSERT_EQUAL_UINT32(0, st.errors);
+    TEST_ASSERT_EQUAL_UINT64(2ULL * ((PIECES - 1U) * CLUSTER + 300U), st.bytes_copied);
+
+    TEST_ASSERT_EQUAL_UINT32(1, runs_of("a.bin"));
+    TEST_ASSERT_EQUAL_UINT32(1, runs_of("b.bin"));
+    check_data("a.bin", 0U);
+    check_data("b.bin", 1U);
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_TMP_NAME, &fno));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_JOURNAL_NAME, &fno));
+}
+
+void test_Defrag_LeavesContiguousFilesAlone(void) {
+    write_small("note.txt", "contiguous");
+    SD_DefragStats st = run_pass();
+    TEST_ASSERT_EQUAL_UINT32(1, st.files);
+    TEST_ASSERT_EQUAL_UINT32(0, st.fragmented);
+    TEST_ASSERT_EQUAL_UINT32(0, st.moved);
+    TEST_ASSERT_EQUAL_UINT64(0, st.bytes_copied);
+}
+
+/* A reader holding a.bin keeps it from being removed; b.bin is still moved. */
+void test_Defrag_OpenFileIsLeftAlone(void) {
+    write_interleaved();
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[1], "a.bin", FA_READ));
+
+    SD_DefragStats st = run_pass();
+    TEST_ASSERT_EQUAL_UINT32(1, st.busy);
+    TEST_ASSERT_EQUAL_UINT32(1, st.moved);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[1]));
+    TEST_ASSERT_EQUAL_UINT32(PIECES, runs_of("a.bin"));
+    TEST_ASSERT_EQUAL_UINT32(1, runs_of("b.bin"));
+    check_data("a.bin", 0U);
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_TMP_NAME, &fno));
+}
+
+/* b.bin's clusters become one-cluster holes and a filler takes the rest. */
+void test_Defrag_NoContiguousRunLeavesFile(void) {
+    write_interleaved();
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("b.bin"));
+    DWORD free_clst = 0;
+    FATFS *fs = NULL;
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &free_clst, &fs));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil[0], "filler", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_expand(&s_fil[0], (free_clst - PIECES) * CLUSTER, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil[0]));
+
+    SD_DefragStats st = run_pass();
+    TEST_ASSERT_EQUAL_UINT32(1, st.no_space);
+    TEST_ASSERT_EQUAL_UINT32(0, st.moved);
+    TEST_ASSERT_EQUAL_UINT32(PIECES, runs_of("a.bin"));
+    check_data("a.bin", 0U);
+}
+
+void test_Defrag_RecoverRenamesCopyOfRemovedSource(void) {
+    write_small(SD_DEFRAG_TMP_NAME, "copy");
+    write_small(SD_DEFRAG_JOURNAL_NAME, "0:/log.txt");
+    TEST_ASSERT_EQUAL(FR_OK, SD_DefragRecover(s_path));
+
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("log.txt", &fno));
+    TEST_ASSERT_EQUAL_UINT32(4, fno.fsize);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_TMP_NAME, &fno));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_JOURNAL_NAME, &fno));
+}
+
+void test_Defrag_RecoverKeepsSourceStillThere(void) {
+    write_small("log.txt", "original");
+    write_small(SD_DEFRAG_TMP_NAME, "copy");
+    write_small(SD_DEFRAG_JOURNAL_NAME, "0:/log.txt");
+    TEST_ASSERT_EQUAL(FR_OK, SD_DefragRecover(s_path));
+
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("log.txt", &fno));
+    TEST_ASSERT_EQUAL_UINT32(8, fno.fsize);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_TMP_NAME, &fno));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_JOURNAL_NAME, &fno));
+
+    /* A copy with no journal was cut short: removed. */
+    write_small(SD_DEFRAG_TMP_NAME, "partial");
+    TEST_ASSERT_EQUAL(FR_OK, SD_DefragRecover(s_path));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_TMP_NAME, &fno));
+    TEST_ASSERT_EQUAL(FR_OK, SD_DefragRecover(s_path)); /* nothing to do */
+}
+
+void test_Defrag_StepsWaitForIdleCardAndBandwidth(void) {
+    write_interleaved();
+    TEST_ASSERT_EQUAL(FR_OK, SD_DefragStart(s_path));
+    TEST_ASSERT_TRUE(SD_DefragStep());
+    SD_DefragStats st;
+    SD_DefragGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1, st.idle_waits);
+    TEST_ASSERT_EQUAL_UINT32(0, st.files);
+    TEST_ASSERT_EQUAL_UINT32(SD_DEFRAG_IDLE_MS, SD_DefragWaitMs());
+
+    mock_hal_set_tick(mock_hal_get_tick() + SD_DEFRAG_IDLE_MS);
+    TEST_ASSERT_TRUE(SD_DefragStep()); /* a.bin found, its run reserved */
+    TEST_ASSERT_EQUAL_UINT32(0, SD_DefragWaitMs());
+    TEST_ASSERT_TRUE(SD_DefragStep()); /* first chunk */
+    SD_DefragGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT64(SD_DEFRAG_CHUNK, st.bytes_copied);
+    TEST_ASSERT_EQUAL_UINT32(SD_DEFRAG_CHUNK * 1000U / (SD_DEFRAG_KBPS * 1024U),
+                             SD_DefragWaitMs());
+
+    /* Card I/O by someone else restarts the idle wait. */
+    uint8_t block[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, block, 0U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(SD_DEFRAG_IDLE_MS, SD_DefragWaitMs());
+    TEST_ASSERT_TRUE(SD_DefragStep());
+    SD_DefragGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT64(SD_DEFRAG_CHUNK, st.bytes_copied);
+
+    /* Stopping drops the partial copy. */
+    SD_DefragStop();
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat(SD_DEFRAG_TMP_NAME, &fno));
+    TEST_ASSERT_EQUAL_UINT32(PIECES, runs_of("a.bin"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Defrag_MovesFragmentedFilesIntoOneRun);
+    RUN_TEST(test_Defrag_LeavesContiguousFilesAlone);
+    RUN_TEST(test_Defrag_OpenFileIsLeftAlone);
+    RUN_TEST(test_Defrag_NoContiguousRunLeavesFile);
+    RUN_TEST(test_Defrag_RecoverRenamesCopyOfRemovedSource);
+    RUN_TEST(test_Defrag_RecoverKeepsSourceStillThere);
+    RUN_TEST(test_Defrag_StepsWaitForIdleCardAndBandwidth);
+
+    return UNITY_END();
+}
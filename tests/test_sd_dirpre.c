@@ -0,0 +1,140 @@
+/*
+ * tests/test_sd_dirpre.c
+ *
+ * Directory preallocation (SD_DIRPRE_DIRS=2, SLACK=8, TEMPS=2) through
+ * sd_mount on an 8 MiB FAT16 card with 1 KiB clusters (32 entries per
+ * directory cluster): a designated directory near the end of its cluster is
+ * grown by sd_dirpre_poll, so the next creates allocate nothing, while an
+ * undesignated one grows during a create; deleted slots count as room and
+ * are not retried; missing directories and the fixed root are left alone.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_dirpre.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static FIL s_fil;
+
+/* Empty 8.3 files dir/F<first>.BIN .. F<first+count-1>.BIN, one entry each. */
+static void create_files(const char *dir, uint32_t first, uint32_t count) {
+    char name[32];
+    for (uint32_t i = first; i < first + count; i++) {
+        (void)snprintf(name, sizeof(name), "%s/F%02u.BIN", dir, (unsigned)i);
+        TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_WRITE | FA_CREATE_NEW));
+        TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    }
+}
+
+static DWORD free_clusters(void) {
+    DWORD fre;
+    FATFS *pfs;
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &fre, &pfs));
+    return fre;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/logs"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/other"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_add("0:/logs/"));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_DirPre_GrowsAheadOfCreates(void) {
+    SD_DirPreStats before, st;
+    sd_dirpre_get_stats(&before);
+    create_files("0:/logs", 0U, 24U);  /* with "." and "..": 6 entries left */
+    create_files("0:/other", 0U, 24U);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_poll());
+    sd_dirpre_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.grown + 1U, st.grown);
+
+    DWORD fre = free_clusters();
+    create_files("0:/logs", 24U, 10U);
+    TEST_ASSERT_EQUAL_UINT32(fre, free_clusters());
+    create_files("0:/other", 24U, 10U);
+    TEST_ASSERT_EQUAL_UINT32(fre - 1U, free_clusters());
+
+    /* The placeholders are gone. */
+    DIR dj;
+    FILINFO fno;
+    uint32_t entries = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_opendir(&dj, "0:/logs"));
+    while (f_readdir(&dj, &fno) == FR_OK && fno.fname[0] != '\0') {
+        TEST_ASSERT_TRUE(fno.fname[0] != '~');
+        entries++;
+    }
+    (void)f_closedir(&dj);
+    TEST_ASSERT_EQUAL_UINT32(34U, entries);
+
+    /* Room again: nothing to do. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_poll());
+    sd_dirpre_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.grown + 1U, st.grown);
+}
+
+void test_DirPre_DeletedSlotsAreRoom(void) {
+    SD_DirPreStats before, st;
+    char name[32];
+    sd_dirpre_get_stats(&before);
+    create_files("0:/logs", 0U, 24U);
+    for (uint32_t i = 0; i < 18U; i++) {
+        (void)snprintf(name, sizeof(name), "0:/logs/F%02u.BIN", (unsigned)i);
+        TEST_ASSERT_EQUAL(FR_OK, f_unlink(name));
+    }
+
+    DWORD fre = free_clusters();
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_poll());
+    sd_dirpre_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.grown, st.grown);
+    TEST_ASSERT_EQUAL_UINT32(before.holes + 1U, st.holes);
+    TEST_ASSERT_EQUAL_UINT32(fre, free_clusters());
+
+    /* Not retried while the directory's end stays put. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_poll());
+    sd_dirpre_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.holes + 1U, st.holes);
+    TEST_ASSERT_EQUAL_UINT32(before.checks + 2U, st.checks);
+}
+
+void test_DirPre_RootAndMissingLeftAlone(void) {
+    SD_DirPreStats before, st;
+    sd_dirpre_get_stats(&before);
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_add("0:/logs"));  /* already there */
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_add("0:"));
+    TEST_ASSERT_EQUAL(FR_NOT_ENOUGH_CORE, sd_dirpre_add("0:/other"));
+    TEST_ASSERT_EQUAL(FR_INVALID_NAME, sd_dirpre_add("/"));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("0:/logs"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_dirpre_poll());
+    sd_dirpre_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.grown, st.grown);
+    TEST_ASSERT_EQUAL_UINT32(before.errors, st.errors);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_DirPre_GrowsAheadOfCreates);
+    RUN_TEST(test_DirPre_DeletedSlotsAreRoom);
+    RUN_TEST(test_DirPre_RootAndMissingLeftAlone);
+    return UNITY_END();
+}
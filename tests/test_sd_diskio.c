@@ -22,6 +22,8 @@ extern SD_Handle_t g_sd_handle;
 void setUp(void) {
     mock_hal_reset();
     memset(&g_sd_handle, 0, sizeof(g_sd_handle));
+    SD_DiskSetFatRegion(0, 0, 0);
+    SD_DiskMarkUnwritten(0, 0, 0);
 }
 
 void tearDown(void) {}
@@ -93,6 +95,27 @@ void test_disk_initialize_HappyPath_ReturnsZero(void) {
     TEST_ASSERT_TRUE(g_sd_handle.initialized);
 }
 
+void test_disk_initialize_FastMount_CardAnswers_KeepsSession(void) {
+    init_global_sdhc(8192U);
+    push_cmd_exchange(0x00U); /* CMD13: R1 */
+    mock_hal_push_byte(0x00U); /* CMD13: R2 status byte */
+
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    TEST_ASSERT_EQUAL_UINT32(1U, g_sd_handle.stats.init_attempts);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_disk_initialize_FastMount_CardReset_Reidentifies(void) {
+    init_global_sdhc(8192U);
+    push_cmd_exchange(0x01U); /* CMD13: card back in idle state */
+    mock_hal_push_byte(0x00U);
+    push_sdhc_init(8192U);
+
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    TEST_ASSERT_EQUAL_UINT32(2U, g_sd_handle.stats.init_attempts);
+    TEST_ASSERT_TRUE(g_sd_handle.initialized);
+}
+
 /* -----------------------------------------------------------------------
  * SD_disk_read
  * ----------------------------------------------------------------------- */
@@ -239,11 +262,77 @@ void test_disk_ioctl_GET_SECTOR_COUNT_NullBuff_ReturnsParerr(void) {
     TEST_ASSERT_EQUAL(RES_PARERR, SD_disk_ioctl(0, GET_SECTOR_COUNT, NULL));
 }
 
-void test_disk_ioctl_GET_BLOCK_SIZE_Returns1(void) {
+/* CMD55 + ACMD13 (R2) + 64-byte SD Status carrying au_size. */
+static void push_sd_status(uint8_t au_size) {
+    uint8_t reg[64];
+    memset(reg, 0, sizeof(reg));
+    reg[10] = (uint8_t)(au_size << 4);
+    push_cmd_exchange(0x00U); /* CMD55 */
+    push_cmd_exchange(0x00U); /* ACMD13 R1 */
+    mock_hal_push_byte(0x00U); /* R2 status byte */
+    push_data_token();
+    mock_hal_push_bytes(reg, sizeof(reg));
+    push_crc();
+}
+
+void test_disk_ioctl_GET_BLOCK_SIZE_ReportsAllocationUnit(void) {
+    init_global_sdhc(8192U);
+    push_sd_status(9U); /* 4 MiB */
+    DWORD bs = 0;
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, GET_BLOCK_SIZE, &bs));
+    TEST_ASSERT_EQUAL_UINT32(8192U, bs);
+    TEST_ASSERT_EQUAL_UINT32(8192U, g_sd_handle.erase_block);
+
+    /* Cached: no second ACMD13. */
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, GET_BLOCK_SIZE, &bs));
+    TEST_ASSERT_EQUAL_UINT32(8192U, bs);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_disk_ioctl_GET_BLOCK_SIZE_UndefinedAu_UsesCsdEraseSector(void) {
     init_global_sdhc(8192U);
+    push_sd_status(0U);
     DWORD bs = 0;
     TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, GET_BLOCK_SIZE, &bs));
-    TEST_ASSERT_EQUAL_UINT32(1U, bs);
+    TEST_ASSERT_EQUAL_UINT32(128U, bs); /* CSD v2: 64 KiB */
+}
+
+/* 12 MiB is not a power of two; FatFs gets its 4 MiB factor. */
+void test_disk_ioctl_GET_BLOCK_SIZE_12MiBAu_ReportsPowerOfTwoFactor(void) {
+    init_global_sdhc(8192U);
+    push_sd_status(0xBU);
+    DWORD bs = 0;
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, GET_BLOCK_SIZE, &bs));
+    TEST_ASSERT_EQUAL_UINT32(24576U, g_sd_handle.erase_block);
+    TEST_ASSERT_EQUAL_UINT32(8192U, bs);
+}
+
+void test_disk_ioctl_GET_BLOCK_SIZE_NullBuff_ReturnsParerr(void) {
+    init_global_sdhc(8192U);
+    TEST_ASSERT_EQUAL(RES_PARERR, SD_disk_ioctl(0, GET_BLOCK_SIZE, NULL));
+}
+
+void test_disk_ioctl_CTRL_TRIM_ErasesRange(void) {
+    init_global_sdhc(8192U);
+    push_cmd_exchange(0x00U); /* CMD32 */
+    push_cmd_exchange(0x00U); /* CMD33 */
+    push_cmd_exchange(0x00U); /* CMD38 */
+    push_wait_ready();        /* erase complete */
+    DWORD range[2] = {100U, 163U};
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_TRIM, range));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_disk_ioctl_CTRL_TRIM_InvertedRange_ReturnsParerr(void) {
+    init_global_sdhc(8192U);
+    DWORD range[2] = {50U, 49U};
+    TEST_ASSERT_EQUAL(RES_PARERR, SD_disk_ioctl(0, CTRL_TRIM, range));
+}
+
+void test_disk_ioctl_CTRL_TRIM_PastEnd_ReturnsParerr(void) {
+    init_global_sdhc(8192U);
+    DWORD range[2] = {8000U, 8192U};
+    TEST_ASSERT_EQUAL(RES_PARERR, SD_disk_ioctl(0, CTRL_TRIM, range));
 }
 
 void test_disk_ioctl_UnknownCommand_ReturnsParerr(void) {
@@ -252,6 +341,190 @@ void test_disk_ioctl_UnknownCommand_ReturnsParerr(void) {
     TEST_ASSERT_EQUAL(RES_PARERR, SD_disk_ioctl(0, 0xFFU, &dummy));
 }
 
+/* -----------------------------------------------------------------------
+ * FAT-sector cache
+ * ----------------------------------------------------------------------- */
+
+void test_FatCache_Miss_LoadsLookaheadSector(void) {
+    init_global_sdhc(8192U);
+    SD_DiskSetFatRegion(0, 32U, 16U);
+    mock_hal_reset();
+
+    uint8_t buf[512];
+    push_multi_read_distinct(SD_FAT_CACHE_SPAN, 0xA0U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+    TEST_ASSERT_EQUAL_HEX8(0xA0U, buf[0]);
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(18));
+
+    /* The next FAT sector of the chain walk is already in RAM */
+    size_t before = 0;
+    (void)mock_hal_tx_log(&before);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 33, 1));
+    TEST_ASSERT_EQUAL_HEX8(0xA1U, buf[511]);
+    size_t after = 0;
+    (void)mock_hal_tx_log(&after);
+    TEST_ASSERT_EQUAL(before, after);
+}
+
+void test_FatCache_SurvivesDirectoryReads(void) {
+    init_global_sdhc(8192U);
+    SD_DiskSetFatRegion(0, 32U, 16U);
+    uint8_t buf[512];
+    push_multi_read_distinct(SD_FAT_CACHE_SPAN, 0x10U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+
+    push_single_read(0x00U); /* directory sector outside the FAT */
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 100, 1));
+
+    mock_hal_reset();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x10U, buf[0]);
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(18));
+}
+
+void test_FatCache_MissAtRegionEnd_ClampsLookahead(void) {
+    init_global_sdhc(8192U);
+    SD_DiskSetFatRegion(0, 32U, 16U);
+    mock_hal_reset();
+    uint8_t buf[512];
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 47, 1));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(18));
+}
+
+void test_FatCache_Write_UpdatesCachedCopy(void) {
+    init_global_sdhc(8192U);
+    SD_DiskSetFatRegion(0, 32U, 16U);
+    uint8_t buf[512];
+    push_multi_read_distinct(SD_FAT_CACHE_SPAN, 0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+
+    memset(buf, 0x5EU, sizeof(buf));
+    push_single_write_accepted();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 33, 1));
+
+    mock_hal_reset();
+    uint8_t rd[512] = {0};
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, rd, 33, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(buf, rd, sizeof(rd));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(17));
+}
+
+void test_FatCache_FailedWrite_DropsCachedCopy(void) {
+    init_global_sdhc(8192U);
+    SD_DiskSetFatRegion(0, 32U, 16U);
+    uint8_t buf[512];
+    push_multi_read_distinct(SD_FAT_CACHE_SPAN, 0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+
+    mock_hal_set_spi_return(HAL_TIMEOUT);
+    TEST_ASSERT_NOT_EQUAL(RES_OK, SD_disk_write(0, buf, 32, 1));
+    mock_hal_reset();
+
+    push_multi_read_distinct(SD_FAT_CACHE_SPAN, 0x40U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x40U, buf[0]);
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(18));
+}
+
+void test_FatCache_NoRegion_ReadsGoToCard(void) {
+    init_global_sdhc(8192U);
+    mock_hal_reset();
+    uint8_t buf[512];
+    push_single_read(0x00U);
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+    TEST_ASSERT_EQUAL(2, count_cmd_frames(17));
+}
+
+void test_FatCache_DiskInitialize_ClearsRegion(void) {
+    init_global_sdhc(8192U);
+    SD_DiskSetFatRegion(0, 32U, 16U);
+    uint8_t buf[512];
+    push_multi_read_distinct(SD_FAT_CACHE_SPAN, 0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+
+    SD_Init(&g_sd_handle, &g_test_hspi, &g_test_cs, 0, false);
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    mock_hal_reset();
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 32, 1));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+}
+
+/* -----------------------------------------------------------------------
+ * Unwritten ranges (SD_UNWRITTEN_RANGES=2): no read before a partial write
+ * ----------------------------------------------------------------------- */
+
+void test_Unwritten_Read_ZeroFilledWithoutCardIo(void) {
+    init_global_sdhc(8192U);
+    SD_DiskMarkUnwritten(0, 1000U, 64U);
+    mock_hal_reset();
+
+    uint8_t buf[512];
+    memset(buf, 0xCCU, sizeof(buf));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1010, 1));
+    static const uint8_t zero[512];
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(zero, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL_UINT32(1U, g_sd_handle.stats.rmw_avoided);
+
+    /* Outside the range, and multi-sector reads, still go to the card. */
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 999, 1));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+}
+
+void test_Unwritten_WrittenSector_ReadsFromCard(void) {
+    init_global_sdhc(8192U);
+    SD_DiskMarkUnwritten(0, 1000U, 64U);
+    uint8_t buf[512];
+    memset(buf, 0x5AU, sizeof(buf));
+    push_single_write_accepted();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 1000, 1));
+    mock_hal_reset();
+
+    push_single_read(0x5AU);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1000, 1));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1001, 1)); /* rest still unwritten */
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+}
+
+void test_Unwritten_WriteInMiddle_KeepsLargerRemainder(void) {
+    init_global_sdhc(8192U);
+    SD_DiskMarkUnwritten(0, 1000U, 64U);
+    uint8_t buf[512] = {0};
+    push_single_write_accepted();
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 1010, 1));
+    mock_hal_reset();
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1011, 1));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1063, 1));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(17));
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1005, 1)); /* front part dropped */
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+}
+
+void test_Unwritten_DiskInitialize_ForgetsRanges(void) {
+    init_global_sdhc(8192U);
+    SD_DiskMarkUnwritten(0, 1000U, 64U);
+
+    SD_Init(&g_sd_handle, &g_test_hspi, &g_test_cs, 0, false);
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    mock_hal_reset();
+    uint8_t buf[512];
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1000, 1));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+}
+
 /* -----------------------------------------------------------------------
  * SD_DiskIoInit
  * ----------------------------------------------------------------------- */
@@ -280,6 +553,8 @@ int main(void) {
     RUN_TEST(test_disk_initialize_NoCard_ReturnsNoinit);
     RUN_TEST(test_disk_initialize_InitFails_ReturnsNoinit);
     RUN_TEST(test_disk_initialize_HappyPath_ReturnsZero);
+    RUN_TEST(test_disk_initialize_FastMount_CardAnswers_KeepsSession);
+    RUN_TEST(test_disk_initialize_FastMount_CardReset_Reidentifies);
 
     RUN_TEST(test_disk_read_WrongDrive_ReturnsParerr);
     RUN_TEST(test_disk_read_NullBuffer_ReturnsParerr);
@@ -304,9 +579,28 @@ int main(void) {
     RUN_TEST(test_disk_ioctl_GET_SECTOR_COUNT_Valid_ReturnsOk);
     RUN_TEST(test_disk_ioctl_GET_SECTOR_COUNT_ZeroCapacity_ReturnsError);
     RUN_TEST(test_disk_ioctl_GET_SECTOR_COUNT_NullBuff_ReturnsParerr);
-    RUN_TEST(test_disk_ioctl_GET_BLOCK_SIZE_Returns1);
+    RUN_TEST(test_disk_ioctl_GET_BLOCK_SIZE_ReportsAllocationUnit);
+    RUN_TEST(test_disk_ioctl_GET_BLOCK_SIZE_UndefinedAu_UsesCsdEraseSector);
+    RUN_TEST(test_disk_ioctl_GET_BLOCK_SIZE_12MiBAu_ReportsPowerOfTwoFactor);
+    RUN_TEST(test_disk_ioctl_GET_BLOCK_SIZE_NullBuff_ReturnsParerr);
+    RUN_TEST(test_disk_ioctl_CTRL_TRIM_ErasesRange);
+    RUN_TEST(test_disk_ioctl_CTRL_TRIM_InvertedRange_ReturnsParerr);
+    RUN_TEST(test_disk_ioctl_CTRL_TRIM_PastEnd_ReturnsParerr);
     RUN_TEST(test_disk_ioctl_UnknownCommand_ReturnsParerr);
 
+    RUN_TEST(test_FatCache_Miss_LoadsLookaheadSector);
+    RUN_TEST(test_FatCache_SurvivesDirectoryReads);
+    RUN_TEST(test_FatCache_MissAtRegionEnd_ClampsLookahead);
+    RUN_TEST(test_FatCache_Write_UpdatesCachedCopy);
+    RUN_TEST(test_FatCache_FailedWrite_DropsCachedCopy);
+    RUN_TEST(test_FatCache_NoRegion_ReadsGoToCard);
+    RUN_TEST(test_FatCache_DiskInitialize_ClearsRegion);
+
+    RUN_TEST(test_Unwritten_Read_ZeroFilledWithoutCardIo);
+    RUN_TEST(test_Unwritten_WrittenSector_ReadsFromCard);
+    RUN_TEST(test_Unwritten_WriteInMiddle_KeepsLargerRemainder);
+    RUN_TEST(test_Unwritten_DiskInitialize_ForgetsRanges);
+
     RUN_TEST(test_DiskIoInit_ValidArgs_ReturnsOk);
 
     return UNITY_END();
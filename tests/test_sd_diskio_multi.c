@@ -0,0 +1,133 @@
+/*
+ * tests/test_sd_diskio_multi.c
+ *
+ * Tests for two cards behind one diskio driver (pdrv 0 and 1). Built with
+ * SD_DISK_DRIVES=2, SD_CACHE_ENABLED=1 and SD_CACHE_LINES=4.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_cache.h"
+#include "sd_diskio_spi.h"
+#include <string.h>
+
+static GPIO_TypeDef cs_b;
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(SD_DiskHandle(0), 0, sizeof(SD_Handle_t));
+    memset(SD_DiskHandle(1), 0, sizeof(SD_Handle_t));
+    SD_CacheReset();
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+static void init_drive_sdhc(BYTE pdrv, GPIO_TypeDef *cs_port) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInitDrive(pdrv, &g_test_hspi, cs_port, pdrv, false));
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(pdrv));
+    mock_hal_reset(); /* start each test with an empty transmit log */
+}
+
+/* -----------------------------------------------------------------------
+ * Drive numbers and handles
+ * ----------------------------------------------------------------------- */
+
+void test_Multi_DiskHandle_DistinctPerDrive(void) {
+    TEST_ASSERT_EQUAL_PTR(&g_sd_handle, SD_DiskHandle(0));
+    TEST_ASSERT_NOT_NULL(SD_DiskHandle(1));
+    TEST_ASSERT_TRUE(SD_DiskHandle(0) != SD_DiskHandle(1));
+    TEST_ASSERT_NULL(SD_DiskHandle(2));
+}
+
+void test_Multi_DriveOutOfRange_Rejected(void) {
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(STA_NOINIT, SD_disk_status(2));
+    TEST_ASSERT_EQUAL(RES_PARERR, SD_disk_read(2, buf, 0, 1));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskIoInitDrive(2, &g_test_hspi, &g_test_cs, 0, false));
+}
+
+void test_Multi_InitDrive_ConfiguresOwnHandle(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInitDrive(1, &g_test_hspi, &cs_b, 7, false));
+    TEST_ASSERT_EQUAL_PTR(&cs_b, SD_DiskHandle(1)->cs_port);
+    TEST_ASSERT_EQUAL_UINT16(7U, SD_DiskHandle(1)->cs_pin);
+    TEST_ASSERT_NULL(SD_DiskHandle(0)->cs_port);
+}
+
+void test_Multi_DrivesInitializeIndependently(void) {
+    init_drive_sdhc(1, &cs_b);
+    TEST_ASSERT_EQUAL(0, SD_disk_status(1));
+    TEST_ASSERT_BITS(STA_NOINIT, STA_NOINIT, SD_disk_status(0));
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(RES_NOTRDY, SD_disk_read(0, buf, 0, 1));
+    push_single_read(0x5AU);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(1, buf, 0, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x5AU, buf[0]);
+}
+
+/* -----------------------------------------------------------------------
+ * Shared cache pool
+ * ----------------------------------------------------------------------- */
+
+void test_Multi_Cache_SameSectorOnOtherDrive_Misses(void) {
+    init_drive_sdhc(0, &g_test_cs);
+    init_drive_sdhc(1, &cs_b);
+    uint8_t buf[512];
+    memset(buf, 0x11U, sizeof(buf));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 5, 1));
+
+    push_single_read(0x22U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(1, buf, 5, 1));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL_HEX8(0x22U, buf[0]);
+}
+
+void test_Multi_Cache_SyncFlushesOnlyThatDrive(void) {
+    init_drive_sdhc(0, &g_test_cs);
+    init_drive_sdhc(1, &cs_b);
+    uint8_t buf[512];
+    memset(buf, 0x33U, sizeof(buf));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 9, 1));
+
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(1, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(24));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_CacheDirtyCount());
+}
+
+void test_Multi_ReinitDrive_KeepsOtherDrivesLines(void) {
+    init_drive_sdhc(0, &g_test_cs);
+    init_drive_sdhc(1, &cs_b);
+    uint8_t buf[512];
+    memset(buf, 0x44U, sizeof(buf));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 3, 1));
+
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(1));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_CacheDirtyCount());
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Multi_DiskHandle_DistinctPerDrive);
+    RUN_TEST(test_Multi_DriveOutOfRange_Rejected);
+    RUN_TEST(test_Multi_InitDrive_ConfiguresOwnHandle);
+    RUN_TEST(test_Multi_DrivesInitializeIndependently);
+
+    RUN_TEST(test_Multi_Cache_SameSectorOnOtherDrive_Misses);
+    RUN_TEST(test_Multi_Cache_SyncFlushesOnlyThatDrive);
+    RUN_TEST(test_Multi_ReinitDrive_KeepsOtherDrivesLines);
+
+    return UNITY_END();
+}
@@ -0,0 +1,118 @@
+/*
+ * tests/test_sd_dmadesc.c
+ *
+ * DMA from stream descriptors (SD_DMA_DESCRIPTORS=1) over the card emulator:
+ * block I/O works with no HAL SPI DMA call, the stream configuration is read
+ * once and reused for every block of CMD18/CMD25, a re-laid-out stream is
+ * read again, and a transfer error stops the streams so the next transfer
+ * starts clean.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_dmadesc.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+static DMA_HandleTypeDef s_dma_tx;
+static DMA_HandleTypeDef s_dma_rx;
+static uint8_t s_out[8 * 512] __attribute__((aligned(32)));
+static uint8_t s_back[8 * 512] __attribute__((aligned(32)));
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(i * 7U + seed);
+    }
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    memset(&s_dma_tx, 0, sizeof(s_dma_tx));
+    memset(&s_dma_rx, 0, sizeof(s_dma_rx));
+    s_dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    s_dma_rx.Init.MemInc = DMA_MINC_ENABLE;
+    s_dma_tx.Parent = &g_test_hspi;
+    s_dma_rx.Parent = &g_test_hspi;
+    g_test_hspi.hdmatx = &s_dma_tx;
+    g_test_hspi.hdmarx = &s_dma_rx;
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+    g_test_hspi.hdmatx = NULL;
+    g_test_hspi.hdmarx = NULL;
+}
+
+void test_DmaDesc_SingleBlocks_NoHalDmaCalls(void) {
+    fill_pattern(s_out, 512U, 5U);
+    mock_hal_dma_rx_calls = 0;
+    mock_hal_dma_tx_calls = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_out, 7U, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 7U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_out, s_back, 512);
+
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_tx_calls);
+    TEST_ASSERT_TRUE(mock_hal_desc_runs >= 2);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)mock_hal_desc_runs, sd.stats.dma_desc_starts);
+
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.errors);
+}
+
+void test_DmaDesc_MultiBlock_ConfigurationReadOnce(void) {
+    fill_pattern(s_out, sizeof(s_out), 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_out, 100U, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 100U, 8U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_out, s_back, sizeof(s_out));
+
+    /* Both streams were read once, however many blocks moved. */
+    TEST_ASSERT_EQUAL(2, mock_hal_desc_captures);
+    TEST_ASSERT_TRUE(sd.stats.dma_desc_starts >= 16U);
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_tx_calls);
+}
+
+/* Re-initialized streams (MSP init after a clock gate, another bus owner) are read again. */
+void test_DmaDesc_Invalidated_Recaptured(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 0U, 1U));
+    int captures = mock_hal_desc_captures;
+    sd.dma_desc_ready = false;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 0U, 1U));
+    TEST_ASSERT_EQUAL(captures + 2, mock_hal_desc_captures);
+}
+
+void test_DmaDesc_TransferError_NextOneClean(void) {
+    fill_pattern(s_out, 512U, 11U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_out, 9U, 1U));
+
+    mock_hal_set_dma_enabled(false);
+    TEST_ASSERT_NOT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 9U, 1U));
+    mock_hal_set_dma_enabled(true);
+
+    memset(s_back, 0, 512U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_back, 9U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_out, s_back, 512);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_DmaDesc_SingleBlocks_NoHalDmaCalls);
+    RUN_TEST(test_DmaDesc_MultiBlock_ConfigurationReadOnce);
+    RUN_TEST(test_DmaDesc_Invalidated_Recaptured);
+    RUN_TEST(test_DmaDesc_TransferError_NextOneClean);
+    return UNITY_END();
+}
@@ -0,0 +1,229 @@
+/*
+ * tests/test_sd_dmaprofile.c
+ *
+ * Driver-owned DMA stream profile (SD_DMA_PROFILE=1). The mock HAL checks
+ * each DMA start against the stream rules of the F4 controller (FIFO needed
+ * for packing and bursts, aligned word beats, whole bursts), so a packed
+ * layout used on the wrong buffer fails the transfer.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_dmaprofile.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+static DMA_HandleTypeDef s_dma_tx;
+static DMA_HandleTypeDef s_dma_rx;
+static uint8_t raw[512 + 16] __attribute__((aligned(32)));
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(i * 3U + seed);
+    }
+}
+
+static void push_pattern_read(const uint8_t *data) {
+    push_cmd_exchange(0x00U);
+    push_data_token();
+    mock_hal_push_bytes(data, 512);
+    push_crc();
+}
+
+static void init_dma(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    mock_hal_dma_init_calls = 0;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    memset(&s_dma_tx, 0, sizeof(s_dma_tx));
+    memset(&s_dma_rx, 0, sizeof(s_dma_rx));
+    s_dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    s_dma_rx.Init.MemInc = DMA_MINC_ENABLE;
+    g_test_hspi.hdmatx = &s_dma_tx;
+    g_test_hspi.hdmarx = &s_dma_rx;
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    g_test_hspi.hdmatx = NULL;
+    g_test_hspi.hdmarx = NULL;
+}
+
+/* -----------------------------------------------------------------------
+ * Profile applied at SD_Init
+ * ----------------------------------------------------------------------- */
+
+void test_DmaProfile_AppliedAtInit(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_init_calls);
+    TEST_ASSERT_EQUAL_HEX32(DMA_PRIORITY_HIGH, s_dma_rx.Init.Priority);
+    TEST_ASSERT_EQUAL_HEX32(DMA_FIFOMODE_ENABLE, s_dma_tx.Init.FIFOMode);
+    TEST_ASSERT_EQUAL_HEX32(DMA_FIFO_THRESHOLD_FULL, s_dma_rx.Init.FIFOThreshold);
+    /* Byte layout until a transfer can be packed. */
+    TEST_ASSERT_EQUAL_HEX32(DMA_MDATAALIGN_BYTE, s_dma_rx.Init.MemDataAlignment);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MBURST_SINGLE, s_dma_rx.Init.MemBurst);
+
+    SD_DmaProfile p;
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetDmaProfile(&sd, &p));
+    TEST_ASSERT_TRUE(p.word_mem);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MBURST_INC4, p.mem_burst);
+}
+
+/* -----------------------------------------------------------------------
+ * Word packing
+ * ----------------------------------------------------------------------- */
+
+void test_DmaProfile_AlignedRead_PackedIntoWordBursts(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 9U);
+    init_dma();
+    push_pattern_read(wire);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw, 512);
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_packed_streams);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.dma_packed);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MDATAALIGN_WORD, s_dma_rx.Init.MemDataAlignment);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MBURST_INC4, s_dma_rx.Init.MemBurst);
+    TEST_ASSERT_EQUAL_HEX32(DMA_PDATAALIGN_BYTE, s_dma_rx.Init.PeriphDataAlignment);
+}
+
+/* Word-aligned but not burst-aligned: the RX stream stays in byte beats. */
+void test_DmaProfile_WordAlignedRead_RxStreamNotPacked(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 21U);
+    init_dma();
+    push_pattern_read(wire);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw + 4, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw + 4, 512);
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_packed_streams);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MDATAALIGN_BYTE, s_dma_rx.Init.MemDataAlignment);
+}
+
+void test_DmaProfile_RepeatedReads_NoStreamReinit(void) {
+    init_dma();
+    push_single_read(0x11U);
+    push_single_read(0x22U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    int inits = mock_hal_dma_init_calls;
+    uint32_t reconfigs = sd.stats.dma_reconfigs;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 1, 1));
+    TEST_ASSERT_EQUAL(inits, mock_hal_dma_init_calls);
+    TEST_ASSERT_EQUAL_UINT32(reconfigs, sd.stats.dma_reconfigs);
+    TEST_ASSERT_EQUAL_UINT8(0x22U, raw[511]);
+}
+
+void test_DmaProfile_AlignedWrite_PackedAndWireUnchanged(void) {
+    init_dma();
+    push_single_write_accepted();
+    fill_pattern(raw, 512, 5U);
+
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_packed_streams);
+
+    size_t log_len;
+    const uint8_t *log = mock_hal_tx_log(&log_len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(raw, &log[log_start + 8U], 512);
+}
+
+/* -----------------------------------------------------------------------
+ * SD_SetDmaProfile
+ * ----------------------------------------------------------------------- */
+
+void test_DmaProfile_Set_RejectsInconsistentProfiles(void) {
+    init_dma();
+    SD_DmaProfile p = { DMA_PRIORITY_HIGH, false, true, DMA_MBURST_SINGLE };
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetDmaProfile(&sd, &p));   /* packing without FIFO */
+    p.fifo = true;
+    p.mem_burst = DMA_MBURST_INC8;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetDmaProfile(&sd, &p));   /* 32-byte burst > FIFO */
+    p.word_mem = false;
+    p.mem_burst = DMA_MBURST_INC4;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetDmaProfile(&sd, &p));   /* byte bursts */
+    p.priority = 0x12345678U;
+    p.mem_burst = DMA_MBURST_SINGLE;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetDmaProfile(&sd, &p));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetDmaProfile(&sd, NULL));
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_init_calls);
+}
+
+/* The CubeMX-style profile: direct mode, byte beats, low priority. */
+void test_DmaProfile_Set_DirectModeNeverPacks(void) {
+    init_dma();
+    SD_DmaProfile p = { DMA_PRIORITY_LOW, false, false, DMA_MBURST_SINGLE };
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetDmaProfile(&sd, &p));
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_init_calls);
+    TEST_ASSERT_EQUAL_HEX32(DMA_PRIORITY_LOW, s_dma_tx.Init.Priority);
+    TEST_ASSERT_EQUAL_HEX32(DMA_FIFOMODE_DISABLE, s_dma_rx.Init.FIFOMode);
+
+    push_single_read(0x3CU);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_packed_streams);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.dma_packed);
+
+    SD_DmaProfile back;
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetDmaProfile(&sd, &back));
+    TEST_ASSERT_EQUAL_HEX32(DMA_PRIORITY_LOW, back.priority);
+    TEST_ASSERT_FALSE(back.fifo);
+}
+
+/* -----------------------------------------------------------------------
+ * Card emulator: pipelined stages (514/515 bytes) alternate with packed blocks
+ * ----------------------------------------------------------------------- */
+
+void test_DmaProfile_MixedTransfers_RoundTrip_OnEmulator(void) {
+    static uint8_t out[4 * 512] __attribute__((aligned(16)));
+    static uint8_t back[4 * 512] __attribute__((aligned(16)));
+    fill_pattern(out, sizeof(out), 1U);
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 40U, 4U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 60U, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, back, 40U, 4U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, sizeof(out));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, back, 60U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, 512);
+    TEST_ASSERT_TRUE(sd.stats.dma_packed >= 2U);
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_DmaProfile_AppliedAtInit);
+    RUN_TEST(test_DmaProfile_AlignedRead_PackedIntoWordBursts);
+    RUN_TEST(test_DmaProfile_WordAlignedRead_RxStreamNotPacked);
+    RUN_TEST(test_DmaProfile_RepeatedReads_NoStreamReinit);
+    RUN_TEST(test_DmaProfile_AlignedWrite_PackedAndWireUnchanged);
+    RUN_TEST(test_DmaProfile_Set_RejectsInconsistentProfiles);
+    RUN_TEST(test_DmaProfile_Set_DirectModeNeverPacks);
+    RUN_TEST(test_DmaProfile_MixedTransfers_RoundTrip_OnEmulator);
+
+    return UNITY_END();
+}
@@ -0,0 +1,159 @@
+/*
+ * tests/test_sd_energy.c
+ *
+ * Energy accounting (SD_ENERGY_STATS=1) on the card emulator in simulated
+ * time: a CMD25 run's card time covers the simulator's program busy and its
+ * bus time its data clocking, a CMD18 run's card time covers the read
+ * latency, the model turns cycles into the expected nanojoules, and a FatFs
+ * write and the transport x cache suite report energy per KB.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_cache.h"
+#include "sd_energy.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_energy.img"
+#define CARD_BLOCKS 16384U
+#define RAW_LBA     12288U /* free clusters at the end of the fresh volume */
+#define RUN_BLOCKS  64U
+
+static char s_path[4];
+static uint8_t s_buf[RUN_BLOCKS * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static uint64_t cycles_of_ns(uint64_t ns) {
+    return ns * (SystemCoreClock / 1000000U) / 1000U;
+}
+
+void setUp(void) {
+    mock_hal_sim_config_t sim;
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 0);
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    mock_hal_sim_defaults(&sim);
+    mock_hal_sim_enable(&sim);
+    SD_ResetStats(&g_sd_handle);
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* Parts of one operation kind never exceed its wall time, and the card is selected for most of it. */
+static void check_split(const SD_EnergyOp *e) {
+    uint64_t parts = e->card_cycles + e->bus_cycles + e->idle_cycles;
+    TEST_ASSERT_TRUE(parts <= e->total_cycles);
+    TEST_ASSERT_TRUE(parts >= e->total_cycles * 9U / 10U);
+}
+
+void test_Energy_WriteRunSplitTracksSimulator(void) {
+    mock_hal_sim_report_t rep;
+    memset(s_buf, 0x5A, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteMultiBlocks(&g_sd_handle, s_buf, RAW_LBA, RUN_BLOCKS));
+    mock_hal_sim_report(&rep);
+
+    const SD_EnergyOp *e = &g_sd_handle.stats.energy[SD_LAT_CMD25];
+    TEST_ASSERT_EQUAL_UINT32(1U, e->ops);
+    TEST_ASSERT_EQUAL_UINT64(RUN_BLOCKS * 512U, e->bytes);
+    check_split(e);
+
+    /* Every program busy is waited out; clocking excludes the busy polls. */
+    uint64_t busy = cycles_of_ns(rep.card_busy_ns);
+    uint64_t data = cycles_of_ns(rep.bus_ns - rep.busy_poll_ns - rep.token_poll_ns);
+    TEST_ASSERT_TRUE(e->card_cycles >= busy);
+    TEST_ASSERT_TRUE(e->bus_cycles >= data);
+    TEST_ASSERT_TRUE(e->bus_cycles < data * 3U / 2U);
+    TEST_ASSERT_TRUE(g_sd_handle.stats.bus_data_cycles < g_sd_handle.stats.bus_xfer_cycles);
+    TEST_ASSERT_EQUAL_UINT64(e->card_cycles, g_sd_handle.stats.card_active_cycles);
+    TEST_ASSERT_EQUAL_UINT32(0, g_sd_handle.stats.energy[SD_LAT_CMD18].ops);
+}
+
+void test_Energy_ReadRunCardTimeCoversLatency(void) {
+    mock_hal_sim_report_t before;
+    mock_hal_sim_report_t after;
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteMultiBlocks(&g_sd_handle, s_buf, RAW_LBA, RUN_BLOCKS));
+    SD_ResetStats(&g_sd_handle);
+    mock_hal_sim_report(&before);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadMultiBlocks(&g_sd_handle, s_buf, RAW_LBA, RUN_BLOCKS));
+    mock_hal_sim_report(&after);
+
+    const SD_EnergyOp *e = &g_sd_handle.stats.energy[SD_LAT_CMD18];
+    TEST_ASSERT_EQUAL_UINT32(1U, e->ops);
+    check_split(e);
+    TEST_ASSERT_TRUE(e->card_cycles >= cycles_of_ns(after.latency_ns - before.latency_ns));
+    TEST_ASSERT_TRUE(e->bus_cycles >= cycles_of_ns((after.bus_ns - after.token_poll_ns) -
+                                                   (before.bus_ns - before.token_poll_ns)));
+}
+
+void test_Energy_ModelArithmetic(void) {
+    SD_EnergyModel model;
+    SD_EnergyOp op;
+    SD_EnergyReport r;
+    sd_energy_defaults(&model);
+    memset(&op, 0, sizeof(op));
+    op.ops = 1U;
+    op.bytes = 2048U;
+    op.card_cycles = SystemCoreClock;      /* 1 s at 45 mA */
+    op.bus_cycles = SystemCoreClock / 10U; /* 100 ms at 30 mA */
+    op.idle_cycles = SystemCoreClock / 2U; /* 500 ms at 2 mA */
+    op.total_cycles = op.card_cycles + op.bus_cycles + op.idle_cycles;
+    sd_energy_of_op(&model, &op, &r);
+
+    TEST_ASSERT_EQUAL_UINT64(148500000U, r.card_nj);
+    TEST_ASSERT_EQUAL_UINT64(9900000U, r.bus_nj);
+    TEST_ASSERT_EQUAL_UINT64(3300000U, r.idle_nj);
+    TEST_ASSERT_EQUAL_UINT64(0U, r.standby_nj);
+    TEST_ASSERT_EQUAL_UINT64(161700000U, r.total_nj);
+    TEST_ASSERT_EQUAL_UINT32(80850000U, r.nj_per_kb);
+}
+
+void test_Energy_FileWritePerKb(void) {
+    SD_EnergyModel model;
+    SD_EnergyReport r;
+    sd_energy_defaults(&model);
+    TEST_ASSERT_EQUAL(FR_OK, sd_energy_write(&model, "0:/e.bin", 65536U, 4096U, &r));
+
+    TEST_ASSERT_EQUAL_UINT64(65536U, r.bytes);
+    TEST_ASSERT_TRUE(r.card_cycles > 0U);
+    TEST_ASSERT_TRUE(r.bus_cycles > 0U);
+    TEST_ASSERT_TRUE(r.card_cycles + r.bus_cycles + r.idle_cycles + r.standby_cycles <=
+                     r.total_cycles);
+    TEST_ASSERT_EQUAL_UINT64(r.card_nj + r.bus_nj + r.idle_nj + r.standby_nj, r.total_nj);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)(r.total_nj / 64U), r.nj_per_kb);
+    TEST_ASSERT_TRUE(g_sd_handle.stats.energy[SD_LAT_CMD25].ops > 0U);
+    sd_energy_print("write", &r);
+    sd_energy_print_ops(&model, g_sd_handle.stats.energy);
+}
+
+void test_Energy_SuiteRestoresTransportAndCache(void) {
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetTransport(&g_sd_handle, SD_XFER_DMA, 48U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheSetLines(SD_CACHE_LINES / 2U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_energy_suite(NULL, "0:/e.bin", 16384U, 2048U));
+
+    TEST_ASSERT_TRUE(g_sd_handle.use_dma);
+    TEST_ASSERT_FALSE(g_sd_handle.use_irq);
+    TEST_ASSERT_EQUAL_UINT16(48U, g_sd_handle.xfer_threshold);
+    TEST_ASSERT_EQUAL_UINT32(SD_CACHE_LINES / 2U, SD_CacheGetLines());
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("0:/e.bin", &fno));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Energy_WriteRunSplitTracksSimulator);
+    RUN_TEST(test_Energy_ReadRunCardTimeCoversLatency);
+    RUN_TEST(test_Energy_ModelArithmetic);
+    RUN_TEST(test_Energy_FileWritePerKb);
+    RUN_TEST(test_Energy_SuiteRestoresTransportAndCache);
+    return UNITY_END();
+}
@@ -0,0 +1,255 @@
+/*
+ * tests/test_sd_exfat.c
+ *
+ * exFAT over the card emulator (_FS_EXFAT=1, _USE_EXPAND=1): SD_FormatDrive
+ * through f_mkfs, contiguous files that never touch the FAT, cluster
+ * allocation from the bitmap, and a simulated recording benchmark against
+ * FAT32 with the same cluster size on the same 512 MiB card.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_format.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_exfat.img"
+#define CARD_BLOCKS 1048576U /* 512 MiB */
+#define CLUSTER     8U       /* 4 KiB, for both types in the benchmark */
+#define CHUNK       4096U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_work[4 * 512];
+static uint8_t s_buf[CHUNK] __attribute__((aligned(4)));
+
+static void card_up(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+}
+
+static void format_and_mount(SD_FsType type, SD_FormatLayout *l) {
+    SD_FormatOptions opt = {.fs_type = type, .cluster_sectors = CLUSTER, .quick = true};
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, s_work, sizeof(s_work), l));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    mock_card_reset_stats();
+}
+
+static void remount(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+static void write_file(const char *name, uint32_t bytes) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t done = 0; done < bytes; done += CHUNK) {
+        memset(s_buf, (int)(done / CHUNK), sizeof(s_buf));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, CHUNK, &bw));
+        TEST_ASSERT_EQUAL_UINT32(CHUNK, bw);
+    }
+}
+
+/* The FAT entry of a cluster, read straight from the card. */
+static uint32_t fat_entry(DWORD cluster) {
+    uint8_t sector[512];
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, sector, s_fs.fatbase + cluster / 128U, 1));
+    const uint8_t *p = &sector[(cluster % 128U) * 4U];
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+    card_up();
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Format and mount
+ * ----------------------------------------------------------------------- */
+
+void test_ExFat_Plan_SdxcGetsExFatWith128KiBClusters(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(124735488U, 8192U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_EXFAT, l.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(256U, l.cluster_sectors);
+    TEST_ASSERT_EQUAL_UINT32(63U, l.partition_start);
+    TEST_ASSERT_EQUAL_UINT32(0U, l.data_start % 8192U);
+}
+
+/* SDHC sizes stay on FAT32 unless exFAT is asked for. */
+void test_ExFat_Plan_SdhcStaysFat32(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(62521344U, 8192U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT32, l.fs_type);
+}
+
+void test_ExFat_Format_MountsWithHeapOnAllocationUnit(void) {
+    SD_FormatLayout l;
+    format_and_mount(SD_FS_EXFAT, &l);
+    TEST_ASSERT_EQUAL(FS_EXFAT, s_fs.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(l.partition_start, s_fs.volbase);
+    TEST_ASSERT_EQUAL_UINT32(l.partition_start + l.reserved_sectors, s_fs.fatbase);
+    TEST_ASSERT_EQUAL_UINT32(l.data_start, s_fs.database);
+    TEST_ASSERT_EQUAL_UINT32(l.clusters, s_fs.n_fatent - 2U);
+    TEST_ASSERT_EQUAL_UINT32(CLUSTER, s_fs.csize);
+    TEST_ASSERT_EQUAL_UINT32(0U, s_fs.database % 8192U); /* 4 MiB AU */
+}
+
+void test_ExFat_ClusterSizeAboveFatLimit_Accepted(void) {
+    SD_FormatOptions opt = {.fs_type = SD_FS_EXFAT, .cluster_sectors = 256U, .quick = true};
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, s_work, sizeof(s_work), NULL));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FS_EXFAT, s_fs.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(256U, s_fs.csize);
+}
+
+/* -----------------------------------------------------------------------
+ * Allocation
+ * ----------------------------------------------------------------------- */
+
+/* A file written in order stays contiguous: no FAT chain is ever written. */
+void test_ExFat_SequentialWrite_NoFatChain(void) {
+    format_and_mount(SD_FS_EXFAT, NULL);
+    write_file("rec.bin", 64U * CHUNK);
+    TEST_ASSERT_EQUAL_UINT8(2U, s_fil.obj.stat & 3U);
+    DWORD first = s_fil.obj.sclust;
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "rec.bin", FA_READ));
+    TEST_ASSERT_EQUAL_UINT8(2U, s_fil.obj.stat & 3U);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    for (DWORD c = first; c < first + 64U; c++) {
+        TEST_ASSERT_EQUAL_UINT32(0U, fat_entry(c));
+    }
+}
+
+/* After a remount the bitmap search starts at cluster 2 and finds the freed run. */
+void test_ExFat_FreedClusters_ReusedFromBitmap(void) {
+    DWORD free_before, free_after;
+    FATFS *pfs;
+    format_and_mount(SD_FS_EXFAT, NULL);
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &free_before, &pfs));
+
+    write_file("a.bin", 16U * CHUNK);
+    DWORD a_first = s_fil.obj.sclust;
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    write_file("b.bin", 16U * CHUNK);
+    TEST_ASSERT_TRUE(s_fil.obj.sclust > a_first);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("a.bin"));
+
+    remount();
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &free_after, &pfs));
+    TEST_ASSERT_EQUAL_UINT32(free_before - 16U, free_after);
+    write_file("c.bin", 16U * CHUNK);
+    TEST_ASSERT_EQUAL_UINT32(a_first, s_fil.obj.sclust);
+    TEST_ASSERT_EQUAL_UINT8(2U, s_fil.obj.stat & 3U);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* Preallocated with f_expand, a recording then writes data sectors only. */
+void test_ExFat_ExpandedFile_WritesWithoutMetadataReads(void) {
+    UINT bw = 0;
+    format_and_mount(SD_FS_EXFAT, NULL);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "pre.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_expand(&s_fil, 128U * CHUNK, 1));
+    TEST_ASSERT_EQUAL_UINT8(2U, s_fil.obj.stat & 3U);
+
+    mock_card_reset_stats();
+    for (uint32_t i = 0; i < 128U; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, CHUNK, &bw));
+    }
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, st.sectors_read);
+    TEST_ASSERT_EQUAL_UINT32(128U * CHUNK / 512U, st.sectors_written);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* -----------------------------------------------------------------------
+ * exFAT vs FAT32, 4 KiB clusters
+ * ----------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t meta_written; // Sectors written besides the payload
+    uint32_t write_reads;  // Sectors read while recording
+    uint32_t seek_reads;   // Sectors read by a seek to the end after reopening
+    uint64_t elapsed_ns;
+} bench_result;
+
+static void bench_recording(SD_FsType type, const char *label, bench_result *r) {
+    const uint32_t bytes = 256U * CHUNK;
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_report_t rep;
+    format_and_mount(type, NULL);
+
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    write_file("rec.bin", bytes);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    mock_hal_sim_report(&rep);
+    mock_hal_sim_print(label, bytes);
+    mock_hal_sim_enable(NULL);
+
+    mock_card_stats_t st = card_stats();
+    r->meta_written = st.sectors_written - bytes / 512U;
+    r->write_reads = st.sectors_read;
+    r->elapsed_ns = rep.elapsed_ns;
+
+    remount();
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "rec.bin", FA_READ));
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, bytes));
+    r->seek_reads = card_stats().sectors_read;
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+}
+
+void test_ExFat_RecordingVsFat32_Simulated(void) {
+    bench_result fat32, exfat;
+    bench_recording(SD_FS_FAT32, "FAT32 record 1 MiB", &fat32);
+    bench_recording(SD_FS_EXFAT, "exFAT record 1 MiB", &exfat);
+    printf("metadata sectors written: FAT32 %lu, exFAT %lu; seek reads: FAT32 %lu, exFAT %lu\n",
+           (unsigned long)fat32.meta_written, (unsigned long)exfat.meta_written,
+           (unsigned long)fat32.seek_reads, (unsigned long)exfat.seek_reads);
+
+    TEST_ASSERT_TRUE(exfat.meta_written < fat32.meta_written);
+    TEST_ASSERT_TRUE(exfat.write_reads <= fat32.write_reads);
+    TEST_ASSERT_TRUE(fat32.seek_reads > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0U, exfat.seek_reads); /* no chain to walk */
+    TEST_ASSERT_TRUE(exfat.elapsed_ns <= fat32.elapsed_ns);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_ExFat_Plan_SdxcGetsExFatWith128KiBClusters);
+    RUN_TEST(test_ExFat_Plan_SdhcStaysFat32);
+    RUN_TEST(test_ExFat_Format_MountsWithHeapOnAllocationUnit);
+    RUN_TEST(test_ExFat_ClusterSizeAboveFatLimit_Accepted);
+
+    RUN_TEST(test_ExFat_SequentialWrite_NoFatChain);
+    RUN_TEST(test_ExFat_FreedClusters_ReusedFromBitmap);
+    RUN_TEST(test_ExFat_ExpandedFile_WritesWithoutMetadataReads);
+
+    RUN_TEST(test_ExFat_RecordingVsFat32_Simulated);
+
+    return UNITY_END();
+}
@@ -0,0 +1,209 @@
+/*
+ * tests/test_sd_fatfs.c
+ *
+ * End-to-end tests over the real FatFs (ff.c), sd_diskio_spi.c and sd_spi.c,
+ * driven by the card emulator (mock_card.c) on a disk image in the build
+ * directory. Each test starts from a freshly formatted 8 MiB FAT16 volume
+ * with 4 KiB clusters. The benchmark at the end runs under the mock_hal
+ * timing simulator and prints simulated throughput and bus use.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_fatfs.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     4096U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[16384];
+
+static void card_up(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+}
+
+static void card_down(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static void fill(uint8_t *buf, UINT len, uint8_t seed) {
+    for (UINT i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed + i * 7U);
+    }
+}
+
+void setUp(void) {
+    static uint8_t work[_MAX_SS];
+    card_up();
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT, CLUSTER, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    mock_card_reset_stats();
+}
+
+void tearDown(void) {
+    card_down();
+}
+
+/* -----------------------------------------------------------------------
+ * Erase geometry
+ * ----------------------------------------------------------------------- */
+
+/* The emulator reports a 4 MiB AU; f_mkfs puts the data area on an AU boundary. */
+void test_FatFs_Mkfs_DataAreaOnAllocationUnit(void) {
+    DWORD au = 0;
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, GET_BLOCK_SIZE, &au));
+    TEST_ASSERT_EQUAL_UINT32(8192U, au);
+    TEST_ASSERT_EQUAL_UINT32(0U, s_fs.database % au);
+    TEST_ASSERT_EQUAL_UINT32(0U, card_stats().acmd[13]); /* read once, during mkfs */
+}
+
+/* -----------------------------------------------------------------------
+ * Round trips
+ * ----------------------------------------------------------------------- */
+
+void test_FatFs_WriteRemountRead_RoundTrip(void) {
+    UINT bw = 0;
+    UINT br = 0;
+    fill(s_buf, 3000U, 0x21U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "data.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, 3000U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT32(3000U, bw);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    static uint8_t back[3000];
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "data.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, back, sizeof(back), &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT32(3000U, br);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, back, sizeof(back));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_stats().errors);
+}
+
+void test_FatFs_Image_PersistsAcrossCardReopen(void) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "keep.txt", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "persist", 7U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    card_down();
+
+    /* Size taken from the image itself; no format this time. */
+    mock_hal_reset();
+    TEST_ASSERT_TRUE(mock_card_open(IMAGE, 0U));
+    TEST_ASSERT_EQUAL_UINT32(CARD_BLOCKS, mock_card_blocks());
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("keep.txt", &fno));
+    TEST_ASSERT_EQUAL_UINT32(7U, fno.fsize);
+}
+
+/* -----------------------------------------------------------------------
+ * I/O counts per FatFs call
+ * ----------------------------------------------------------------------- */
+
+void test_FatFs_ClusterRead_OneCmd18(void) {
+    UINT bw = 0;
+    UINT br = 0;
+    fill(s_buf, CLUSTER, 0x42U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "clu.bin", FA_CREATE_ALWAYS | FA_WRITE | FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, CLUSTER, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 0));
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_buf + CLUSTER, CLUSTER, &br));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, s_buf + CLUSTER, CLUSTER);
+
+    /* A whole-cluster read goes straight to the caller's buffer in one command. */
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[18]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[17]);
+    TEST_ASSERT_EQUAL_UINT32(CLUSTER / 512U, st.sectors_read);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.sectors_written);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_FatFs_ClusterWrite_OneCmd25_PlusMetadataOnClose(void) {
+    UINT bw = 0;
+    fill(s_buf, CLUSTER, 0x99U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "w.bin", FA_CREATE_ALWAYS | FA_WRITE));
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, CLUSTER, &bw));
+    /* The data goes in one CMD25; allocating the cluster may flush the dirty
+     * directory sector left by f_open first. */
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[25]);
+    TEST_ASSERT_TRUE(st.cmd[24] <= 1U);
+    TEST_ASSERT_EQUAL_UINT32(CLUSTER / 512U + st.cmd[24], st.sectors_written);
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    st = card_stats();
+    TEST_ASSERT_TRUE(st.sectors_written >= 2U); /* FAT entry and directory entry */
+    TEST_ASSERT_TRUE(st.sectors_written <= 4U);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+}
+
+/* -----------------------------------------------------------------------
+ * Simulated throughput
+ * ----------------------------------------------------------------------- */
+
+void test_FatFs_SequentialWriteBenchmark_Simulated(void) {
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+
+    UINT bw = 0;
+    fill(s_buf, sizeof(s_buf), 0x13U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "bench.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, sizeof(s_buf), &bw));
+        TEST_ASSERT_EQUAL_UINT32(sizeof(s_buf), bw);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_TRUE(st.sectors_written >= 8U * sizeof(s_buf) / 512U);
+    TEST_ASSERT_TRUE(rep.programs > 0U);
+    TEST_ASSERT_TRUE(mock_hal_sim_kib_per_s(&rep, 8U * sizeof(s_buf)) > 0U);
+    mock_hal_sim_print("f_write 128 KiB", 8U * sizeof(s_buf));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_FatFs_Mkfs_DataAreaOnAllocationUnit);
+    RUN_TEST(test_FatFs_WriteRemountRead_RoundTrip);
+    RUN_TEST(test_FatFs_Image_PersistsAcrossCardReopen);
+
+    RUN_TEST(test_FatFs_ClusterRead_OneCmd18);
+    RUN_TEST(test_FatFs_ClusterWrite_OneCmd25_PlusMetadataOnClose);
+
+    RUN_TEST(test_FatFs_SequentialWriteBenchmark_Simulated);
+
+    return UNITY_END();
+}
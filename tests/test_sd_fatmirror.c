@@ -0,0 +1,211 @@
+/*
+ * tests/test_sd_fatmirror.c
+ *
+ * Deferred FAT mirroring (SD_FAT_MIRROR_RANGES=2, SD_FAT_MIRROR_CHUNK=4)
+ * over the card emulator on an 8 MiB FAT16 volume with two FATs (built here:
+ * f_mkfs of R0.12c writes one) and 1 KiB clusters: FatFs's
+ * second-FAT writes become marks, f_sync copies them from the first FAT in
+ * multi-block runs, a read of a stale mirror copies first, SD_DiskMirrorPoll
+ * copies after the idle time, and a third range widens the nearest one.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_fatmirror.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     1024U
+#define FAT_SECTORS 32U /* 8143 clusters */
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_fat1[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_fat2[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_data[CLUSTER];
+
+/* FAT sector rel of both copies straight from the card, past the diskio layer. */
+static bool fats_equal(uint32_t rel) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, s_fat1, s_fs.fatbase + rel, 1U));
+    TEST_ASSERT_EQUAL(SD_OK,
+                      SD_ReadBlocks(&g_sd_handle, s_fat2, s_fs.fatbase + s_fs.fsize + rel, 1U));
+    return memcmp(s_fat1, s_fat2, sizeof(s_fat1)) == 0;
+}
+
+static bool all_fats_equal(void) {
+    for (uint32_t rel = 0; rel < s_fs.fsize; rel++) {
+        if (!fats_equal(rel)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Append clusters to an open file, one f_write each (FAT16: 256 entries per FAT sector). */
+static void append_clusters(uint32_t count) {
+    UINT bw = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        memset(s_data, (int)(i + 1U), sizeof(s_data));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_data, sizeof(s_data), &bw));
+        TEST_ASSERT_EQUAL_UINT32(sizeof(s_data), bw);
+    }
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+/* FAT16 boot sector with two FATs and a 512-entry root; the fresh image is all zeros otherwise. */
+static void format_two_fats(void) {
+    static uint8_t sector[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    memset(sector, 0, sizeof(sector));
+    memcpy(sector, "\xEB\x3C\x90MSDOS5.0", 11);
+    put16(&sector[11], 512U);           /* bytes per sector */
+    sector[13] = CLUSTER / 512U;        /* sectors per cluster */
+    put16(&sector[14], 1U);             /* reserved sectors */
+    sector[16] = 2U;                    /* FATs */
+    put16(&sector[17], 512U);           /* root entries */
+    put16(&sector[19], CARD_BLOCKS);    /* total sectors */
+    sector[21] = 0xF8U;
+    put16(&sector[22], FAT_SECTORS);
+    sector[38] = 0x29U;
+    memcpy(&sector[43], "NO NAME    FAT16   ", 19);
+    sector[510] = 0x55U;
+    sector[511] = 0xAAU;
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, sector, 0U, 1U));
+
+    memset(sector, 0, sizeof(sector));
+    memcpy(sector, "\xF8\xFF\xFF\xFF", 4);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, sector, 1U, 1U));
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, sector, 1U + FAT_SECTORS, 1U));
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(0, disk_initialize(0));
+    format_two_fats();
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FS_FAT16, s_fs.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(2U, s_fs.n_fats);
+    SD_DiskSetFatMirror(0, s_fs.fatbase, s_fs.fsize, s_fs.n_fats);
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_FatMirror_DeferredUntilSync(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "a.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    append_clusters(600U); /* the chain crosses three FAT sectors */
+
+    SD_DiskMirrorStats st;
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_TRUE(st.deferred >= 2U);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.stale);
+    TEST_ASSERT_FALSE(all_fats_equal());
+
+    SD_DiskMirrorStats before = st;
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.stale);
+    TEST_ASSERT_EQUAL_UINT32(before.copies + 1U, st.copies);
+    TEST_ASSERT_EQUAL_UINT32(before.copied + 3U, st.copied);
+    TEST_ASSERT_TRUE(all_fats_equal());
+
+    /* The three sectors go out as one CMD25. */
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.errors);
+}
+
+void test_FatMirror_StaleReadCopiesFirst(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "b.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    append_clusters(300U);
+    TEST_ASSERT_FALSE(fats_equal(0U));
+
+    static uint8_t sector[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, sector, s_fs.fatbase + s_fs.fsize, 1U));
+    TEST_ASSERT_TRUE(fats_equal(0U));
+    TEST_ASSERT_EQUAL_MEMORY(s_fat1, sector, sizeof(sector));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_FatMirror_PollCopiesAfterIdle(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "c.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    append_clusters(300U);
+
+    SD_DiskMirrorStats st;
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskMirrorPoll(0));
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_TRUE(st.stale > 0U);
+
+    mock_hal_set_tick(mock_hal_get_tick() + SD_FAT_MIRROR_IDLE_MS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskMirrorPoll(0));
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.stale);
+    TEST_ASSERT_TRUE(fats_equal(0U));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_TRUE(all_fats_equal());
+}
+
+void test_FatMirror_FullRangesWidenNearest(void) {
+    /* Direct mirror writes of FAT sectors 1, 3 and 6: the third joins the nearer range. */
+    static uint8_t sector[512] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    const uint32_t rel[3] = {1U, 3U, 6U};
+    SD_DiskMirrorStats before;
+    SD_DiskGetMirrorStats(0, &before);
+    for (uint32_t i = 0; i < 3U; i++) {
+        TEST_ASSERT_EQUAL(RES_OK, disk_read(0, sector, s_fs.fatbase + rel[i], 1U));
+        sector[0] ^= 0x5AU;
+        TEST_ASSERT_EQUAL(RES_OK, disk_write(0, sector, s_fs.fatbase + rel[i], 1U));
+        TEST_ASSERT_EQUAL(RES_OK, disk_write(0, sector, s_fs.fatbase + s_fs.fsize + rel[i], 1U));
+    }
+    SD_DiskMirrorStats st;
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(before.deferred + 3U, st.deferred);
+    TEST_ASSERT_EQUAL_UINT32(5U, st.stale); /* 1, then 3..6 */
+
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, CTRL_SYNC, NULL));
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(before.copied + 5U, st.copied);
+    TEST_ASSERT_TRUE(all_fats_equal());
+}
+
+void test_FatMirror_UnregisteredWritesThrough(void) {
+    SD_DiskMirrorStats before;
+    SD_DiskGetMirrorStats(0, &before);
+    SD_DiskSetFatMirror(0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "d.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    append_clusters(300U);
+    TEST_ASSERT_TRUE(all_fats_equal());
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    SD_DiskMirrorStats st;
+    SD_DiskGetMirrorStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(before.deferred, st.deferred);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_FatMirror_DeferredUntilSync);
+    RUN_TEST(test_FatMirror_StaleReadCopiesFirst);
+    RUN_TEST(test_FatMirror_PollCopiesAfterIdle);
+    RUN_TEST(test_FatMirror_FullRangesWidenNearest);
+    RUN_TEST(test_FatMirror_UnregisteredWritesThrough);
+    return UNITY_END();
+}
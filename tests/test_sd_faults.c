@@ -0,0 +1,221 @@
+/*
+ * tests/test_sd_faults.c
+ *
+ * Seeded fault injection against the card emulator (SD_CRC_ENABLED=1,
+ * SD_ADAPTIVE_TIMEOUTS=1, SD_RECOVERY=1; the simulator's 25 MHz defaults):
+ * read CRC errors, write CRC responses, dropped data tokens and polled SPI
+ * timeouts at low rates are absorbed by the retry and recovery paths. The
+ * data arrives intact and the simulated throughput stays within a bound of
+ * a fault-free run of the same workload instead of collapsing. The same
+ * seed gives the same run.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_faults.img"
+#define CARD_BLOCKS 4096U
+#define SPAN        512U  /* blocks the workload cycles through */
+#define PASSES      2U
+#define MULTI       8U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[MULTI * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+typedef struct {
+    uint64_t elapsed_ns;
+    uint32_t failures; // Calls that returned an error after all retries
+    uint32_t corrupt;  // Blocks read back with the wrong pattern
+    mock_hal_sim_report_t rep;
+} run_t;
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+}
+
+void tearDown(void) {
+    mock_card_close();
+}
+
+static void fill(uint32_t lba, uint32_t pass, uint8_t *dst) {
+    for (uint32_t i = 0; i < 512U; i++) {
+        dst[i] = (uint8_t)(lba * 7U + pass * 13U + i);
+    }
+}
+
+static bool check(uint32_t lba, uint32_t pass, const uint8_t *src) {
+    for (uint32_t i = 0; i < 512U; i++) {
+        if (src[i] != (uint8_t)(lba * 7U + pass * 13U + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Write then read SPAN blocks, one and then MULTI per call, under the given faults. */
+static run_t workload(const mock_hal_sim_faults_t *faults, bool use_dma) {
+    mock_hal_sim_config_t cfg;
+    run_t run;
+    memset(&run, 0, sizeof(run));
+    mock_hal_sim_defaults(&cfg);
+    if (faults != NULL) {
+        cfg.faults = *faults;
+    }
+    mock_hal_set_dma_enabled(use_dma);
+    sd.use_dma = use_dma;
+    mock_hal_sim_enable(&cfg);
+
+    for (uint32_t pass = 0; pass < PASSES; pass++) {
+        uint32_t per = (pass == 0U) ? 1U : MULTI;
+        for (uint32_t lba = 0; lba < SPAN; lba += per) {
+            for (uint32_t b = 0; b < per; b++) {
+                fill(lba + b, pass, &s_buf[b * 512U]);
+            }
+            if (SD_WriteBlocks(&sd, s_buf, lba, per) != SD_OK) {
+                run.failures++;
+            }
+        }
+        for (uint32_t lba = 0; lba < SPAN; lba += per) {
+            memset(s_buf, 0, per * 512U);
+            if (SD_ReadBlocks(&sd, s_buf, lba, per) != SD_OK) {
+                run.failures++;
+                continue;
+            }
+            for (uint32_t b = 0; b < per; b++) {
+                run.corrupt += check(lba + b, pass, &s_buf[b * 512U]) ? 0U : 1U;
+            }
+        }
+    }
+    mock_hal_sim_report(&run.rep);
+    run.elapsed_ns = run.rep.elapsed_ns;
+    mock_hal_sim_enable(NULL);
+    return run;
+}
+
+static mock_hal_sim_faults_t faults_none(uint32_t seed) {
+    mock_hal_sim_faults_t f;
+    memset(&f, 0, sizeof(f));
+    f.seed = seed;
+    f.timeout_us = 2000U;
+    return f;
+}
+
+/* Slower than the fault-free run by at most permille/1000. */
+static void assert_within(const run_t *base, const run_t *run, uint32_t permille) {
+    TEST_ASSERT_TRUE(run->elapsed_ns >= base->elapsed_ns);
+    TEST_ASSERT_TRUE(run->elapsed_ns * 1000U <= base->elapsed_ns * permille);
+}
+
+void test_Faults_NoneGiveCleanRun(void) {
+    run_t run = workload(NULL, false);
+    TEST_ASSERT_EQUAL_UINT32(0, run.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, run.corrupt);
+    TEST_ASSERT_EQUAL_UINT32(0, run.rep.read_crc_faults + run.rep.write_crc_faults +
+                                run.rep.dropped_tokens + run.rep.timeouts);
+    TEST_ASSERT_EQUAL_UINT32(0, sd.stats.crc_errors);
+}
+
+void test_Faults_SameSeedRepeatsRun(void) {
+    mock_hal_sim_faults_t f = faults_none(42U);
+    f.read_crc_permille = 10U;
+    f.write_crc_permille = 10U;
+    f.token_drop_permille = 5U;
+    f.timeout_permille = 2U;
+    run_t a = workload(&f, false);
+    tearDown(); /* fresh card and handle: learned timeouts and clocks carry over otherwise */
+    setUp();
+    run_t b = workload(&f, false);
+    TEST_ASSERT_TRUE(a.rep.read_crc_faults > 0U && a.rep.write_crc_faults > 0U);
+    TEST_ASSERT_TRUE(a.elapsed_ns == b.elapsed_ns);
+    TEST_ASSERT_EQUAL_UINT32(a.rep.read_crc_faults, b.rep.read_crc_faults);
+    TEST_ASSERT_EQUAL_UINT32(a.rep.write_crc_faults, b.rep.write_crc_faults);
+    TEST_ASSERT_EQUAL_UINT32(a.rep.dropped_tokens, b.rep.dropped_tokens);
+    TEST_ASSERT_EQUAL_UINT32(a.rep.timeouts, b.rep.timeouts);
+
+    f.seed = 43U;
+    tearDown();
+    setUp();
+    run_t c = workload(&f, false);
+    TEST_ASSERT_TRUE(c.elapsed_ns != a.elapsed_ns);
+}
+
+void test_Faults_ReadCrcErrorsAreRetried(void) {
+    run_t base = workload(NULL, false);
+    mock_hal_sim_faults_t f = faults_none(7U);
+    f.read_crc_permille = 20U;
+    run_t run = workload(&f, false);
+    TEST_ASSERT_TRUE(run.rep.read_crc_faults > 0U);
+    TEST_ASSERT_EQUAL_UINT32(run.rep.read_crc_faults, sd.stats.crc_errors);
+    TEST_ASSERT_EQUAL_UINT32(0, run.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, run.corrupt);
+    assert_within(&base, &run, 1100U);
+}
+
+void test_Faults_WriteCrcResponsesAreRetried(void) {
+    run_t base = workload(NULL, false);
+    mock_hal_sim_faults_t f = faults_none(7U);
+    f.write_crc_permille = 20U;
+    run_t run = workload(&f, false);
+    TEST_ASSERT_TRUE(run.rep.write_crc_faults > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0, run.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, run.corrupt);
+    assert_within(&base, &run, 1100U);
+}
+
+void test_Faults_DmaCrcErrorsAreRetried(void) {
+    run_t base = workload(NULL, true);
+    mock_hal_sim_faults_t f = faults_none(11U);
+    f.read_crc_permille = 20U;
+    f.write_crc_permille = 20U;
+    run_t run = workload(&f, true);
+    TEST_ASSERT_TRUE(run.rep.read_crc_faults > 0U && run.rep.write_crc_faults > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0, run.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, run.corrupt);
+    assert_within(&base, &run, 1100U);
+}
+
+/* Each lost token costs one learned read timeout, not the full SD_READ_TIMEOUT_MS. */
+void test_Faults_DroppedTokensCostBoundedWaits(void) {
+    run_t base = workload(NULL, false);
+    mock_hal_sim_faults_t f = faults_none(7U);
+    f.token_drop_permille = 10U;
+    run_t run = workload(&f, false);
+    TEST_ASSERT_TRUE(run.rep.dropped_tokens > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0, run.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, run.corrupt);
+    TEST_ASSERT_TRUE(sd.stats.early_timeouts > 0U);
+    assert_within(&base, &run, 1500U);
+}
+
+/* SPI timeouts in polled calls: SD_Recover resynchronizes the card before the retry. */
+void test_Faults_PolledTimeoutsAreRecovered(void) {
+    run_t base = workload(NULL, false);
+    mock_hal_sim_faults_t f = faults_none(7U);
+    f.timeout_permille = 5U;
+    run_t run = workload(&f, false);
+    TEST_ASSERT_TRUE(run.rep.timeouts > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0, run.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, run.corrupt);
+    assert_within(&base, &run, 2000U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Faults_NoneGiveCleanRun);
+    RUN_TEST(test_Faults_SameSeedRepeatsRun);
+    RUN_TEST(test_Faults_ReadCrcErrorsAreRetried);
+    RUN_TEST(test_Faults_WriteCrcResponsesAreRetried);
+    RUN_TEST(test_Faults_DmaCrcErrorsAreRetried);
+    RUN_TEST(test_Faults_DroppedTokensCostBoundedWaits);
+    RUN_TEST(test_Faults_PolledTimeoutsAreRecovered);
+
+    return UNITY_END();
+}
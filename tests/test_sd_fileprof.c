@@ -0,0 +1,193 @@
+/*
+ * tests/test_sd_fileprof.c
+ *
+ * Per-file I/O accounting (SD_PROFILE_ENABLED=1, SD_PROFILE_FILES=4) on the
+ * card emulator, timed by the mock HAL simulator: the sd_functions helpers
+ * charge bytes, sectors, syncs and time to the file they work on, a full
+ * table recycles the closed file with the least I/O, reset keeps open files,
+ * and the shell's files command lists the busiest first.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_profile.h"
+#include "sd_shell.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_fileprof.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static char s_text[3001];
+static char s_back[3001];
+static char s_out[2048];
+static uint32_t s_out_len;
+
+static void capture(const char *text, uint32_t len) {
+    if (s_out_len + len < sizeof(s_out)) {
+        memcpy(&s_out[s_out_len], text, len);
+        s_out_len += len;
+        s_out[s_out_len] = '\0';
+    }
+}
+
+static int run(const char *cmd) {
+    char line[SD_SHELL_LINE_MAX + 1U];
+    (void)snprintf(line, sizeof(line), "%s", cmd);
+    s_out_len = 0;
+    s_out[0] = '\0';
+    return sd_shell_exec(line);
+}
+
+static const SD_ProfFileStats *find(const char *name) {
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        const SD_ProfFileStats *f = SD_ProfFileGet(i);
+        if (f != NULL && strcmp(f->name, name) == 0) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static void text_of(uint32_t len, char c) {
+    memset(s_text, c, len);
+    s_text[len] = '\0';
+}
+
+void setUp(void) {
+    mock_hal_sim_config_t cfg;
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    SD_ProfReset();
+    sd_shell_set_output(capture);
+}
+
+void tearDown(void) {
+    sd_shell_set_output(NULL);
+    (void)sd_unmount();
+    SD_ProfReset();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_FileProf_HelpersChargeTheirFile(void) {
+    UINT n = 0;
+    text_of(3000U, 'a');
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/a.txt", s_text));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file("0:/a.txt", s_back, sizeof(s_back), &n));
+    TEST_ASSERT_EQUAL_UINT32(3000U, n);
+
+    const SD_ProfFileStats *f = find("0:/a.txt");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL_UINT32(2U, f->opens);
+    TEST_ASSERT_EQUAL_UINT32(0U, f->open_now);
+    TEST_ASSERT_EQUAL_UINT64(3000U, f->bytes_written);
+    TEST_ASSERT_EQUAL_UINT64(3000U, f->bytes_read);
+    TEST_ASSERT_TRUE(f->sectors_written >= 6U);
+    TEST_ASSERT_TRUE(f->sectors_read >= 6U);
+    TEST_ASSERT_TRUE(f->io_cycles > 0U);
+    TEST_ASSERT_TRUE(f->cycles >= f->io_cycles);
+}
+
+void test_FileProf_SyncsAndSeparateFiles(void) {
+    text_of(40U, 'l');
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/log.txt", s_text));
+        TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_flush());
+    }
+    TEST_ASSERT_EQUAL_UINT32(1U, find("0:/log.txt")->open_now); /* in the write-handle cache */
+    text_of(10U, 'c');
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/cfg.txt", s_text));
+
+    const SD_ProfFileStats *log = find("0:/log.txt");
+    const SD_ProfFileStats *cfg = find("0:/cfg.txt");
+    TEST_ASSERT_NOT_NULL(log);
+    TEST_ASSERT_NOT_NULL(cfg);
+    TEST_ASSERT_EQUAL_UINT64(120U, log->bytes_written);
+    TEST_ASSERT_EQUAL_UINT32(3U, log->syncs);
+    TEST_ASSERT_EQUAL_UINT64(10U, cfg->bytes_written);
+    TEST_ASSERT_EQUAL_UINT32(0U, cfg->syncs);
+
+    /* One cached write handle here (_FS_LOCK 2): cfg.txt took it from log.txt. */
+    TEST_ASSERT_EQUAL_UINT32(0U, log->open_now);
+    TEST_ASSERT_EQUAL_UINT32(1U, cfg->open_now);
+
+    /* Reset keeps open files, with their counters cleared. */
+    SD_ProfReset();
+    TEST_ASSERT_NULL(find("0:/log.txt"));
+    cfg = find("0:/cfg.txt");
+    TEST_ASSERT_NOT_NULL(cfg);
+    TEST_ASSERT_EQUAL_UINT64(0U, cfg->bytes_written);
+    TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/cfg.txt", "x"));
+    TEST_ASSERT_EQUAL_UINT64(1U, cfg->bytes_written);
+}
+
+void test_FileProf_FullTable_RecyclesQuietestClosedFile(void) {
+    char name[24];
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        snprintf(name, sizeof(name), "0:/f%lu.txt", (unsigned long)i);
+        text_of(100U + 600U * i, 'f');
+        TEST_ASSERT_EQUAL(FR_OK, sd_write_file(name, s_text));
+        TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    }
+    text_of(5U, 'n');
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/new.txt", s_text));
+    TEST_ASSERT_NOT_NULL(find("0:/new.txt"));
+    TEST_ASSERT_NULL(find("0:/f0.txt"));
+    TEST_ASSERT_NOT_NULL(find("0:/f3.txt"));
+
+    /* Long paths keep their tail. */
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/a_rather_long_directory"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/a_rather_long_directory/file_name.txt", "x"));
+    const char *tail = "ng_directory/file_name.txt";
+    TEST_ASSERT_TRUE(strlen(tail) < SD_PROFILE_NAME);
+    bool found = false;
+    for (uint32_t i = 0; i < SD_PROFILE_FILES; i++) {
+        const SD_ProfFileStats *f = SD_ProfFileGet(i);
+        if (f != NULL && strlen(f->name) == SD_PROFILE_NAME - 1U) {
+            found = strstr(f->name, tail) != NULL;
+        }
+    }
+    TEST_ASSERT_TRUE(found);
+}
+
+void test_FileProf_ShellListsBusiestFirst(void) {
+    text_of(200U, 's');
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/small.txt", s_text));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    text_of(3000U, 'b');
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/big.txt", s_text));
+    }
+
+    TEST_ASSERT_EQUAL(0, run("files"));
+    char *big = strstr(s_out, "0:/big.txt (open)");
+    char *small = strstr(s_out, "0:/small.txt\r\n");
+    TEST_ASSERT_NOT_NULL(big);
+    TEST_ASSERT_NOT_NULL(small);
+    TEST_ASSERT_TRUE(big < small);
+
+    TEST_ASSERT_EQUAL(-1, run("files now"));
+    TEST_ASSERT_EQUAL(0, run("files reset"));
+    TEST_ASSERT_NULL(find("0:/small.txt"));
+    TEST_ASSERT_NOT_NULL(find("0:/big.txt"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_FileProf_HelpersChargeTheirFile);
+    RUN_TEST(test_FileProf_SyncsAndSeparateFiles);
+    RUN_TEST(test_FileProf_FullTable_RecyclesQuietestClosedFile);
+    RUN_TEST(test_FileProf_ShellListsBusiestFirst);
+    return UNITY_END();
+}
@@ -0,0 +1,119 @@
+/*
+ * tests/test_sd_find.c
+ *
+ * Pattern enumeration (sd_find over f_findfirst/f_findnext, _USE_FIND 1 in
+ * the test ffconf.h) through sd_mount on the card emulator: only matching
+ * long names reach the visitor, case does not matter, directories match
+ * like files, the visitor can stop early, and sd_walk's filter agrees.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_find.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static char s_names[512];
+
+static bool collect(const char *name, const FILINFO *fno, void *context) {
+    (void)fno;
+    (void)context;
+    strcat(s_names, name);
+    strcat(s_names, ";");
+    return true;
+}
+
+static bool stop_at_two(const char *name, const FILINFO *fno, void *context) {
+    (void)name;
+    (void)fno;
+    return ++*(uint32_t *)context < 2U;
+}
+
+static sd_walk_action walk_count(const char *path, const FILINFO *fno, int depth,
+                                 void *context) {
+    (void)path;
+    (void)depth;
+    if ((fno->fattrib & AM_DIR) == 0U) {
+        ++*(uint32_t *)context;
+    }
+    return SD_WALK_CONTINUE;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/data"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/sensor_log_0001.csv", "a"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/sensor_log_0002.csv", "b"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/SENSOR_LOG_0003.CSV", "c"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/sensor_log_0004.txt", "d"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/config.ini", "e"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/data/sensor_archive"));
+    s_names[0] = '\0';
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Find_OnlyMatchesReachVisitor(void) {
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_find("0:/data", "sensor_log_*.csv", collect, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(3U, count);
+    TEST_ASSERT_EQUAL_STRING("sensor_log_0001.csv;sensor_log_0002.csv;SENSOR_LOG_0003.CSV;",
+                             s_names);
+
+    s_names[0] = '\0';
+    TEST_ASSERT_EQUAL(FR_OK, sd_find("0:/data", "*_000?.*", collect, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(4U, count);
+
+    /* The long name is matched, not the 8.3 alias. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_find("0:/data", "SENSOR~*", collect, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(0U, count);
+}
+
+void test_Find_DirectoriesAndStop(void) {
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_find("0:/data", "sensor_a*", collect, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(1U, count);
+    TEST_ASSERT_EQUAL_STRING("sensor_archive;", s_names);
+
+    uint32_t visits = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_find("0:/data", "*", stop_at_two, &visits, &count));
+    TEST_ASSERT_EQUAL_UINT32(2U, count);
+    TEST_ASSERT_EQUAL(FR_OK, sd_find("0:/data", "*", collect, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(6U, count);
+}
+
+void test_Find_ErrorsAndWalkAgrees(void) {
+    uint32_t count = 7U;
+    TEST_ASSERT_EQUAL(FR_NO_PATH, sd_find("0:/none", "*", collect, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(0U, count);
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_find("0:/data", NULL, collect, NULL, NULL));
+
+    uint32_t files = 0;
+    SD_WalkStats st;
+    TEST_ASSERT_EQUAL(FR_OK, sd_walk("0:/data", 0, "*.CSV", walk_count, &files, &st));
+    TEST_ASSERT_EQUAL_UINT32(3U, files);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.files);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.dirs);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Find_OnlyMatchesReachVisitor);
+    RUN_TEST(test_Find_DirectoriesAndStop);
+    RUN_TEST(test_Find_ErrorsAndWalkAgrees);
+    return UNITY_END();
+}
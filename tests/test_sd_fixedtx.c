@@ -0,0 +1,162 @@
+/*
+ * tests/test_sd_fixedtx.c
+ *
+ * Fixed 0xFF transmit source (SD_DMA_FIXED_TX=1). The mock HAL feeds a TX
+ * stream with memory increment off from the first beat of its buffer only,
+ * so the 16-byte idle source must still put 0xFF on the wire for a whole
+ * block (any other byte clocked during a receive is counted). Polled and IRQ
+ * receives send the pre-filled receive buffer in place.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_fixedtx.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+static DMA_HandleTypeDef s_dma_tx;
+static DMA_HandleTypeDef s_dma_rx;
+static uint8_t raw[512] __attribute__((aligned(32)));
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(i * 7U + seed);
+    }
+}
+
+static void push_pattern_read(const uint8_t *data) {
+    push_cmd_exchange(0x00U);
+    push_data_token();
+    mock_hal_push_bytes(data, 512);
+    push_crc();
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    memset(&s_dma_tx, 0, sizeof(s_dma_tx));
+    memset(&s_dma_rx, 0, sizeof(s_dma_rx));
+    s_dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    s_dma_rx.Init.MemInc = DMA_MINC_ENABLE;
+    g_test_hspi.hdmatx = &s_dma_tx;
+    g_test_hspi.hdmarx = &s_dma_rx;
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    g_test_hspi.hdmatx = NULL;
+    g_test_hspi.hdmarx = NULL;
+}
+
+/* -----------------------------------------------------------------------
+ * Receive paths
+ * ----------------------------------------------------------------------- */
+
+void test_FixedTx_DmaRead_HeldSourceSendsIdle(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 3U);
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_pattern_read(wire);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw, 512);
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_fixed_tx_calls);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MINC_DISABLE, s_dma_tx.Init.MemInc);
+    TEST_ASSERT_EQUAL_HEX32(DMA_MINC_ENABLE, s_dma_rx.Init.MemInc);
+    TEST_ASSERT_EQUAL(0, mock_hal_rx_busy_tx);
+}
+
+/* A DMA write after a read needs the incrementing layout back. */
+void test_FixedTx_DmaWriteAfterRead_SourceIncrementsAgain(void) {
+    uint8_t buf[512];
+    fill_pattern(buf, sizeof(buf), 9U);
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_single_read(0x3CU);
+    push_single_write_accepted();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_HEX32(DMA_MINC_ENABLE, s_dma_tx.Init.MemInc);
+
+    size_t log_len;
+    const uint8_t *log = mock_hal_tx_log(&log_len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(buf, &log[log_start + 8U], 512);
+}
+
+void test_FixedTx_PolledRead_SentInPlace(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 17U);
+    do_sdhc_init(&sd, 8192U);
+    push_pattern_read(wire);
+    memset(raw, 0x00, sizeof(raw));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw, 512);
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_rx_busy_tx);
+}
+
+void test_FixedTx_IrqRead_SentInPlace(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 29U);
+    do_sdhc_init(&sd, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetTransport(&sd, SD_XFER_IRQ, SD_XFER_THRESHOLD));
+    push_pattern_read(wire);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw, 512);
+    TEST_ASSERT_EQUAL(1, mock_hal_it_rx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_rx_busy_tx);
+}
+
+/* -----------------------------------------------------------------------
+ * Card emulator: pipelined CMD18 stages from the held source
+ * ----------------------------------------------------------------------- */
+
+void test_FixedTx_MultiBlockRoundTrip_OnEmulator(void) {
+    static uint8_t out[8 * 512];
+    static uint8_t back[8 * 512];
+    fill_pattern(out, sizeof(out), 1U);
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 100U, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, back, 100U, 8U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, sizeof(out));
+    TEST_ASSERT_TRUE(mock_hal_dma_fixed_tx_calls >= 8);
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_FixedTx_DmaRead_HeldSourceSendsIdle);
+    RUN_TEST(test_FixedTx_DmaWriteAfterRead_SourceIncrementsAgain);
+    RUN_TEST(test_FixedTx_PolledRead_SentInPlace);
+    RUN_TEST(test_FixedTx_IrqRead_SentInPlace);
+    RUN_TEST(test_FixedTx_MultiBlockRoundTrip_OnEmulator);
+
+    return UNITY_END();
+}
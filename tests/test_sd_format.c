@@ -0,0 +1,254 @@
+/*
+ * tests/test_sd_format.c
+ *
+ * Tests for the SD-aligned formatter (sd_format.c): layouts computed for
+ * typical card sizes against the SD Association table, and volumes written
+ * over the card emulator, then mounted and used by the real FatFs.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_format.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE "test_sd_format.img"
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_work[4 * 512];
+
+static void card_up(uint32_t blocks) {
+    test_card_fresh(IMAGE, blocks);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+}
+
+static void check_aligned(const SD_FormatLayout *l) {
+    TEST_ASSERT_EQUAL_UINT32(0U, l->partition_start % l->boundary);
+    TEST_ASSERT_EQUAL_UINT32(0U, (l->partition_start + l->reserved_sectors) % l->boundary);
+    TEST_ASSERT_EQUAL_UINT32(0U, l->data_start % l->boundary);
+}
+
+/* Write a file, remount and read it back. */
+static void round_trip(void) {
+    static const char text[] = "formatted by SD_FormatDrive\n";
+    char back[sizeof(text)];
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "probe.txt", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, text, sizeof(text), &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "probe.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, back, sizeof(back), &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_STRING(text, back);
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Layout plans
+ * ----------------------------------------------------------------------- */
+
+void test_Plan_32GiB_Fat32With32KiBClustersOn4MiBUnits(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(62521344U, 8192U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT32, l.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(64U, l.cluster_sectors);
+    TEST_ASSERT_EQUAL_UINT32(8192U, l.boundary);
+    TEST_ASSERT_EQUAL_UINT32(8192U, l.partition_start);
+    TEST_ASSERT_EQUAL_UINT32(0U, l.root_sectors);
+    check_aligned(&l);
+    TEST_ASSERT_TRUE(l.fat_sectors * 128U >= l.clusters + 2U);
+}
+
+void test_Plan_2GB_Fat16With32KiBClusters(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(3862528U, 8192U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT16, l.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(64U, l.cluster_sectors);
+    TEST_ASSERT_EQUAL_UINT32(32U, l.root_sectors);
+    check_aligned(&l);
+    TEST_ASSERT_TRUE(l.fat_sectors * 256U >= l.clusters + 2U);
+}
+
+void test_Plan_64GiB_Fat32With64KiBClusters(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(124735488U, 32768U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT32, l.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(128U, l.cluster_sectors);
+    TEST_ASSERT_EQUAL_UINT32(32768U, l.boundary);
+    check_aligned(&l);
+}
+
+/* Without an AU from the drive the table's boundary unit applies. */
+void test_Plan_UnknownAu_UsesTableBoundary(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(1048576U, 1U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT16, l.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(128U, l.boundary);
+    check_aligned(&l);
+}
+
+/* A 4 MiB AU on an 8 MiB card would leave no room: the unit is capped at 1/64. */
+void test_Plan_SmallCard_BoundaryCapped(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(16384U, 8192U, NULL, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT12, l.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(256U, l.boundary);
+    TEST_ASSERT_EQUAL_UINT32(16U, l.cluster_sectors);
+    check_aligned(&l);
+}
+
+/* The cluster count decides the type: exactly 2 GiB needs FAT32 at 64 sectors or less. */
+void test_Plan_2GiB_TypeFollowsClusterCount(void) {
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(4194304U, 8192U, NULL, &l));
+    if (l.fs_type == SD_FS_FAT16) {
+        TEST_ASSERT_TRUE(l.clusters < 65525U);
+    } else {
+        TEST_ASSERT_EQUAL(SD_FS_FAT32, l.fs_type);
+        TEST_ASSERT_TRUE(l.clusters > 65525U);
+    }
+    check_aligned(&l);
+}
+
+void test_Plan_ForcedFat32_TooFewClusters_Aborts(void) {
+    SD_FormatOptions opt = {.fs_type = SD_FS_FAT32, .cluster_sectors = 64U};
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_MKFS_ABORTED, SD_FormatPlan(524288U, 128U, &opt, &l));
+}
+
+void test_Plan_ForcedFat32_PicksFittingClusters(void) {
+    SD_FormatOptions opt = {.fs_type = SD_FS_FAT32};
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatPlan(524288U, 128U, &opt, &l));
+    TEST_ASSERT_EQUAL(SD_FS_FAT32, l.fs_type);
+    TEST_ASSERT_TRUE(l.clusters > 65525U);
+    check_aligned(&l);
+}
+
+void test_Plan_InvalidOptions_ReturnInvalidParameter(void) {
+    SD_FormatOptions opt = {.cluster_sectors = 3U};
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatPlan(524288U, 128U, &opt, &l));
+    opt.cluster_sectors = 256U;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatPlan(524288U, 128U, &opt, &l));
+    opt.cluster_sectors = 0U;
+    opt.boundary = 96U;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatPlan(524288U, 128U, &opt, &l));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatPlan(524288U, 128U, NULL, NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Formatting the emulated card
+ * ----------------------------------------------------------------------- */
+
+void test_Format_Quick_MountsAlignedFat12(void) {
+    SD_FormatOptions opt = {.quick = true, .volume_id = 0x1234ABCDU};
+    SD_FormatLayout l;
+    card_up(16384U);
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, s_work, sizeof(s_work), &l));
+
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[38]);     /* metadata only */
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    /* Zeroed FATs and root, then both FAT heads, the boot sector and the MBR */
+    TEST_ASSERT_EQUAL_UINT32(2U * l.fat_sectors + l.root_sectors + 4U, st.sectors_written);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FS_FAT12, s_fs.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(l.partition_start, s_fs.volbase);
+    TEST_ASSERT_EQUAL_UINT32(l.data_start, s_fs.database);
+    TEST_ASSERT_EQUAL_UINT32(l.clusters, s_fs.n_fatent - 2U);
+    TEST_ASSERT_EQUAL_UINT32(0U, s_fs.database % 256U);
+    round_trip();
+}
+
+void test_Format_Full_ErasesCardFirst(void) {
+    SD_FormatOptions opt = {.quick = false};
+    card_up(16384U);
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, s_work, sizeof(s_work), NULL));
+
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_TRUE(st.cmd[38] >= 1U);
+    TEST_ASSERT_EQUAL_UINT32(16384U, st.sectors_erased);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    round_trip();
+}
+
+void test_Format_Fat32_MountsWithFsInfoFreeCount(void) {
+    SD_FormatOptions opt = {.fs_type = SD_FS_FAT32, .cluster_sectors = 1U, .quick = true};
+    SD_FormatLayout l;
+    card_up(131072U);
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, s_work, sizeof(s_work), &l));
+    check_aligned(&l);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FS_FAT32, s_fs.fs_type);
+    TEST_ASSERT_EQUAL_UINT32(l.data_start, s_fs.database);
+    TEST_ASSERT_EQUAL_UINT32(l.clusters - 1U, s_fs.free_clst);
+    round_trip();
+}
+
+/* A volume made by f_mkfs is replaced, and its old files are gone. */
+void test_Format_ReplacesExistingVolume(void) {
+    static uint8_t mkfs_work[_MAX_SS];
+    SD_FormatOptions opt = {.quick = true};
+    card_up(16384U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT, 4096U, mkfs_work, sizeof(mkfs_work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "old.txt", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, s_work, sizeof(s_work), NULL));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_open(&s_fil, "old.txt", FA_READ));
+}
+
+void test_Format_SmallWorkBuffer_ReturnsInvalidParameter(void) {
+    card_up(16384U);
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatDrive(0, NULL, s_work, 256U, NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Plan_32GiB_Fat32With32KiBClustersOn4MiBUnits);
+    RUN_TEST(test_Plan_2GB_Fat16With32KiBClusters);
+    RUN_TEST(test_Plan_64GiB_Fat32With64KiBClusters);
+    RUN_TEST(test_Plan_UnknownAu_UsesTableBoundary);
+    RUN_TEST(test_Plan_SmallCard_BoundaryCapped);
+    RUN_TEST(test_Plan_2GiB_TypeFollowsClusterCount);
+    RUN_TEST(test_Plan_ForcedFat32_TooFewClusters_Aborts);
+    RUN_TEST(test_Plan_ForcedFat32_PicksFittingClusters);
+    RUN_TEST(test_Plan_InvalidOptions_ReturnInvalidParameter);
+
+    RUN_TEST(test_Format_Quick_MountsAlignedFat12);
+    RUN_TEST(test_Format_Full_ErasesCardFirst);
+    RUN_TEST(test_Format_Fat32_MountsWithFsInfoFreeCount);
+    RUN_TEST(test_Format_ReplacesExistingVolume);
+    RUN_TEST(test_Format_SmallWorkBuffer_ReturnsInvalidParameter);
+
+    return UNITY_END();
+}
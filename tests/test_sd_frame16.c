@@ -0,0 +1,192 @@
+/*
+ * tests/test_sd_frame16.c
+ *
+ * 16-bit SPI frames for DMA data phases (SD_SPI_FRAME16=1). The mock HAL
+ * shifts half-words MSB first and rejects DMA streams whose peripheral
+ * width does not match the SPI frame, so a missing swap, a missing
+ * reconfiguration or a command sent while the SPI is still in 16-bit mode all
+ * show up as wrong data or an error.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_frame16.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+static DMA_HandleTypeDef s_dma_tx;
+static DMA_HandleTypeDef s_dma_rx;
+static uint8_t raw[512 + 1] __attribute__((aligned(32)));
+
+static void fill_pattern(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(i * 5U + seed);
+    }
+}
+
+static void push_pattern_read(const uint8_t *data) {
+    push_cmd_exchange(0x00U);
+    push_data_token();
+    mock_hal_push_bytes(data, 512);
+    push_crc();
+}
+
+static void dma_init(void) {
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    mock_hal_dma_init_calls = 0;
+    mock_hal_spi_init_calls = 0;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    memset(&s_dma_tx, 0, sizeof(s_dma_tx));
+    memset(&s_dma_rx, 0, sizeof(s_dma_rx));
+    s_dma_tx.Init.MemInc = DMA_MINC_ENABLE;
+    s_dma_rx.Init.MemInc = DMA_MINC_ENABLE;
+    g_test_hspi.hdmatx = &s_dma_tx;
+    g_test_hspi.hdmarx = &s_dma_rx;
+    g_test_hspi.Init.DataSize = SPI_DATASIZE_8BIT;
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    g_test_hspi.hdmatx = NULL;
+    g_test_hspi.hdmarx = NULL;
+}
+
+/* -----------------------------------------------------------------------
+ * Byte order and reconfiguration
+ * ----------------------------------------------------------------------- */
+
+void test_Frame16_AlignedRead_KeepsByteOrder(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 3U);
+    do_sdhc_init(&sd, 8192U);
+    dma_init();
+    push_pattern_read(wire);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw, 512);
+    TEST_ASSERT_EQUAL(1, mock_hal_frame16_calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.frame16_blocks);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.dma_direct_blocks);
+}
+
+void test_Frame16_UnalignedRead_BouncedAndKeepsByteOrder(void) {
+    uint8_t wire[512];
+    fill_pattern(wire, sizeof(wire), 11U);
+    do_sdhc_init(&sd, 8192U);
+    dma_init();
+    push_pattern_read(wire);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw + 1, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(wire, raw + 1, 512);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.dma_bounced_blocks);
+}
+
+void test_Frame16_Write_WireMatchesCallerBuffer(void) {
+    uint8_t buf[512];
+    uint8_t copy[512];
+    fill_pattern(buf, sizeof(buf), 7U);
+    memcpy(copy, buf, sizeof(copy));
+    do_sdhc_init(&sd, 8192U);
+    dma_init();
+    push_single_write_accepted();
+
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_tx_calls);
+
+    size_t log_len;
+    const uint8_t *log = mock_hal_tx_log(&log_len);
+    TEST_ASSERT_EQUAL_HEX8(0xFEU, log[log_start + 7U]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(buf, &log[log_start + 8U], 512);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(copy, buf, 512);
+}
+
+void test_Frame16_RestoresByteFramesAfterBlock(void) {
+    do_sdhc_init(&sd, 8192U);
+    dma_init();
+    push_single_read(0x3CU);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL_HEX32(SPI_DATASIZE_8BIT, g_test_hspi.Init.DataSize);
+    /* Into 16-bit and back: two SPI re-inits, one per DMA stream. */
+    TEST_ASSERT_EQUAL(2, mock_hal_spi_init_calls);
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_init_calls);
+    TEST_ASSERT_EQUAL_HEX32(DMA_PDATAALIGN_HALFWORD, s_dma_rx.Init.PeriphDataAlignment);
+}
+
+/* The streams keep the half-word layout between wide blocks. */
+void test_Frame16_SecondBlock_NoDmaReinit(void) {
+    do_sdhc_init(&sd, 8192U);
+    dma_init();
+    push_single_read(0x3CU);
+    push_single_read(0x5AU);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    int dma_inits = mock_hal_dma_init_calls;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 1, 1));
+    TEST_ASSERT_EQUAL(dma_inits, mock_hal_dma_init_calls);
+    TEST_ASSERT_EQUAL_UINT8(0x5AU, raw[511]);
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.frame16_blocks);
+}
+
+void test_Frame16_Polled_NeverSwitches(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_single_read(0x3CU);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL(0, mock_hal_frame16_calls);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.frame16_blocks);
+}
+
+/* -----------------------------------------------------------------------
+ * Card emulator
+ * ----------------------------------------------------------------------- */
+
+void test_Frame16_MultiBlockRoundTrip_OnEmulator(void) {
+    static uint8_t out[4 * 512];
+    static uint8_t back[4 * 512];
+    fill_pattern(out, sizeof(out), 1U);
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    dma_init();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 40U, 4U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, back, 40U, 4U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, sizeof(out));
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Frame16_AlignedRead_KeepsByteOrder);
+    RUN_TEST(test_Frame16_UnalignedRead_BouncedAndKeepsByteOrder);
+    RUN_TEST(test_Frame16_Write_WireMatchesCallerBuffer);
+    RUN_TEST(test_Frame16_RestoresByteFramesAfterBlock);
+    RUN_TEST(test_Frame16_SecondBlock_NoDmaReinit);
+    RUN_TEST(test_Frame16_Polled_NeverSwitches);
+    RUN_TEST(test_Frame16_MultiBlockRoundTrip_OnEmulator);
+
+    return UNITY_END();
+}
@@ -0,0 +1,210 @@
+/*
+ * tests/test_sd_freemap.c
+ *
+ * Tests for the free-cluster map (SD_FREEMAP_GROUPS=4, SLICE=2). The volume
+ * is a fake FAT32 with 1024 entries: 8 FAT sectors at sector 100, so each
+ * group is 2 sectors / 256 clusters. disk_read serves the FAT from RAM.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_freemap.h"
+#include <string.h>
+
+#define FAT_BASE    100U
+#define FAT_SECTORS 8U
+#define N_FATENT    (FAT_SECTORS * 128U)
+
+static uint8_t s_fat[FAT_SECTORS][512];
+static int s_reads;
+static FATFS s_vol;
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    (void)pdrv;
+    TEST_ASSERT_EQUAL_UINT32(1U, count);
+    TEST_ASSERT_TRUE(sector >= FAT_BASE && sector < FAT_BASE + FAT_SECTORS);
+    memcpy(buff, s_fat[sector - FAT_BASE], 512);
+    s_reads++;
+    return RES_OK;
+}
+
+static void set_entry(uint32_t clst, uint32_t value) {
+    uint8_t *p = &s_fat[clst / 128U][(clst % 128U) * 4U];
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static void use_clusters(uint32_t first, uint32_t last) {
+    for (uint32_t c = first; c <= last; c++) {
+        set_entry(c, 0x0FFFFFFFU);
+    }
+}
+
+static int run_scan(void) {
+    int steps = 1;
+    while (SD_FreeMapStep()) {
+        steps++;
+    }
+    return steps;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(s_fat, 0, sizeof(s_fat));
+    set_entry(0, 0x0FFFFFF8U);
+    set_entry(1, 0x0FFFFFFFU);
+    s_reads = 0;
+
+    memset(&s_vol, 0, sizeof(s_vol));
+    s_vol.fs_type = FS_FAT32;
+    s_vol.id = 7;
+    s_vol.csize = 1;
+    s_vol.n_fatent = N_FATENT;
+    s_vol.fsize = FAT_SECTORS;
+    s_vol.fatbase = FAT_BASE;
+    s_vol.winsect = 0xFFFFFFFFU;
+    s_vol.free_clst = 0xFFFFFFFFU;
+    s_vol.last_clst = 0xFFFFFFFFU;
+    SD_FreeMapStart(&s_vol);
+}
+
+void tearDown(void) {
+    SD_FreeMapStop();
+}
+
+/* -----------------------------------------------------------------------
+ * Incremental scan
+ * ----------------------------------------------------------------------- */
+
+void test_FreeMap_ScanRunsInSlices_AndSeedsFreeCount(void) {
+    use_clusters(2, 300);
+
+    TEST_ASSERT_EQUAL(4, run_scan());
+    TEST_ASSERT_EQUAL(FAT_SECTORS, s_reads);
+
+    SD_FreeMapStats st;
+    SD_FreeMapGetStats(&st);
+    TEST_ASSERT_TRUE(st.done);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.groups);
+    TEST_ASSERT_EQUAL_UINT32(256U, st.group_clusters);
+    TEST_ASSERT_EQUAL_UINT32(N_FATENT - 301U, st.free_clusters);
+    TEST_ASSERT_EQUAL_UINT32(N_FATENT - 301U, s_vol.free_clst);
+    TEST_ASSERT_EQUAL_HEX8(0x01, s_vol.fsi_flag & 0x01U);
+}
+
+void test_FreeMap_ValidFatFsCount_LeftAlone(void) {
+    s_vol.free_clst = 5U;
+    (void)run_scan();
+
+    TEST_ASSERT_EQUAL_UINT32(5U, s_vol.free_clst);
+    TEST_ASSERT_EQUAL_HEX8(0x00, s_vol.fsi_flag);
+}
+
+void test_FreeMap_WindowSector_ReadFromFatFsBuffer(void) {
+    s_vol.winsect = FAT_BASE + 3U;
+    memset(s_vol.win, 0xFF, sizeof(s_vol.win)); /* FatFs holds newer entries: all used */
+    (void)run_scan();
+
+    SD_FreeMapStats st;
+    SD_FreeMapGetStats(&st);
+    TEST_ASSERT_EQUAL(FAT_SECTORS - 1U, s_reads);
+    TEST_ASSERT_EQUAL_UINT32(N_FATENT - 2U - 128U, st.free_clusters);
+}
+
+void test_FreeMap_FatWriteBehindScan_GroupRecounted(void) {
+    use_clusters(2, 100);
+    TEST_ASSERT_TRUE(SD_FreeMapStep()); /* group 0 counted */
+
+    /* FatFs frees the chain (and, for the mirror FAT, writes outside the first copy). */
+    for (uint32_t c = 2; c <= 100; c++) {
+        set_entry(c, 0);
+    }
+    SD_FreeMapFatWritten(0, FAT_BASE, 1);
+    SD_FreeMapFatWritten(0, FAT_BASE + FAT_SECTORS, 1);
+    (void)run_scan();
+
+    SD_FreeMapStats st;
+    SD_FreeMapGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.recounts);
+    TEST_ASSERT_EQUAL_UINT32(N_FATENT - 2U, s_vol.free_clst);
+}
+
+void test_FreeMap_FatWriteAfterScan_StepRecountsInBackground(void) {
+    (void)run_scan();
+    use_clusters(600, 700);
+    SD_FreeMapFatWritten(0, FAT_BASE + 4U, 2);
+
+    TEST_ASSERT_FALSE(SD_FreeMapStep());
+    SD_FreeMapStats st;
+    SD_FreeMapGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.recounts);
+    TEST_ASSERT_EQUAL_UINT32(N_FATENT - 2U - 101U, st.free_clusters);
+}
+
+/* -----------------------------------------------------------------------
+ * Allocation hints
+ * ----------------------------------------------------------------------- */
+
+void test_FreeMap_FindRun_SkipsFullAndPartialGroups(void) {
+    use_clusters(2, 300); /* group 0 full, group 1 partial; groups 2-3 free */
+    (void)run_scan();
+
+    TEST_ASSERT_EQUAL_UINT32(512U, SD_FreeMapFindRun(100U * 512U));
+    TEST_ASSERT_EQUAL_UINT32(512U, SD_FreeMapFindRun(512U * 512U));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_FreeMapFindRun(513U * 512U));
+}
+
+void test_FreeMap_Hint_SetsAllocatorStart(void) {
+    use_clusters(2, 300);
+    (void)run_scan();
+    s_vol.last_clst = 10U;
+
+    TEST_ASSERT_TRUE(SD_FreeMapHint(4096U));
+    TEST_ASSERT_EQUAL_UINT32(511U, s_vol.last_clst);
+}
+
+void test_FreeMap_Hint_NoWholeGroup_FallsBackToPartialGroup(void) {
+    use_clusters(2, 1000); /* only the tail of group 3 is free */
+    (void)run_scan();
+
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_FreeMapFindRun(512U));
+    TEST_ASSERT_TRUE(SD_FreeMapHint(512U));
+    TEST_ASSERT_EQUAL_UINT32(767U, s_vol.last_clst);
+}
+
+void test_FreeMap_Fat12OrStopped_Inactive(void) {
+    SD_FreeMapStop();
+    TEST_ASSERT_FALSE(SD_FreeMapStep());
+    TEST_ASSERT_FALSE(SD_FreeMapHint(512U));
+
+    s_vol.fs_type = FS_FAT12;
+    SD_FreeMapStart(&s_vol);
+    SD_FreeMapStats st;
+    SD_FreeMapGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.groups);
+    TEST_ASSERT_FALSE(SD_FreeMapStep());
+    TEST_ASSERT_EQUAL(0, s_reads);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_FreeMap_ScanRunsInSlices_AndSeedsFreeCount);
+    RUN_TEST(test_FreeMap_ValidFatFsCount_LeftAlone);
+    RUN_TEST(test_FreeMap_WindowSector_ReadFromFatFsBuffer);
+    RUN_TEST(test_FreeMap_FatWriteBehindScan_GroupRecounted);
+    RUN_TEST(test_FreeMap_FatWriteAfterScan_StepRecountsInBackground);
+
+    RUN_TEST(test_FreeMap_FindRun_SkipsFullAndPartialGroups);
+    RUN_TEST(test_FreeMap_Hint_SetsAllocatorStart);
+    RUN_TEST(test_FreeMap_Hint_NoWholeGroup_FallsBackToPartialGroup);
+    RUN_TEST(test_FreeMap_Fat12OrStopped_Inactive);
+
+    return UNITY_END();
+}
@@ -0,0 +1,164 @@
+/*
+ * tests/test_sd_freewear.c
+ *
+ * Wear cursor of the free-cluster map (SD_FREEMAP_GROUPS=8, SD_FREEMAP_WEAR=1)
+ * on a fake FAT32 with 1024 entries: 8 FAT sectors at sector 100, one per
+ * group of 128 clusters. A rotated log hinted through SD_FreeMapHint moves
+ * to a new group each time and wraps at the end of the volume, the cursor
+ * follows a file that grew past its hint, and it is seeded from the
+ * allocator's FSINFO position at start.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_freemap.h"
+#include <string.h>
+
+#define FAT_BASE    100U
+#define FAT_SECTORS 8U
+#define N_FATENT    (FAT_SECTORS * 128U)
+#define GROUP       128U
+
+static uint8_t s_fat[FAT_SECTORS][512];
+static FATFS s_vol;
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    (void)pdrv;
+    TEST_ASSERT_EQUAL_UINT32(1U, count);
+    TEST_ASSERT_TRUE(sector >= FAT_BASE && sector < FAT_BASE + FAT_SECTORS);
+    memcpy(buff, s_fat[sector - FAT_BASE], 512);
+    return RES_OK;
+}
+
+static void set_entry(uint32_t clst, uint32_t value) {
+    uint8_t *p = &s_fat[clst / 128U][(clst % 128U) * 4U];
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static void run_scan(void) {
+    while (SD_FreeMapStep()) {
+    }
+}
+
+/* What create_chain does: next-fit from last_clst, leaving it on the last cluster. */
+static DWORD allocate(uint32_t clusters) {
+    DWORD first = 0;
+    DWORD c = s_vol.last_clst;
+    for (uint32_t n = 0; n < clusters; n++) {
+        do {
+            c = (c + 1U >= N_FATENT) ? 2U : c + 1U;
+        } while (s_fat[c / 128U][(c % 128U) * 4U] != 0U);
+        set_entry(c, 0x0FFFFFFFU);
+        SD_FreeMapFatWritten(0, FAT_BASE + c / 128U, 1);
+        first = (first == 0U) ? c : first;
+    }
+    s_vol.last_clst = c;
+    run_scan();
+    return first;
+}
+
+/* What f_unlink does: free the chain and point the allocator back at the hole. */
+static void release(DWORD first, uint32_t clusters) {
+    for (uint32_t n = 0; n < clusters; n++) {
+        set_entry(first + n, 0U);
+        SD_FreeMapFatWritten(0, FAT_BASE + (first + n) / 128U, 1);
+    }
+    s_vol.last_clst = first - 1U;
+    run_scan();
+}
+
+static void start(DWORD last_clst) {
+    s_vol.last_clst = last_clst;
+    SD_FreeMapStart(&s_vol);
+    run_scan();
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(s_fat, 0, sizeof(s_fat));
+    set_entry(0, 0x0FFFFFF8U);
+    set_entry(1, 0x0FFFFFFFU);
+
+    memset(&s_vol, 0, sizeof(s_vol));
+    s_vol.fs_type = FS_FAT32;
+    s_vol.id = 7;
+    s_vol.csize = 1;
+    s_vol.n_fatent = N_FATENT;
+    s_vol.fsize = FAT_SECTORS;
+    s_vol.fatbase = FAT_BASE;
+    s_vol.winsect = 0xFFFFFFFFU;
+    s_vol.free_clst = 0xFFFFFFFFU;
+}
+
+void tearDown(void) {
+    SD_FreeMapStop();
+}
+
+void test_FreeWear_Rotation_MovesThroughTheVolume(void) {
+    SD_FreeMapStats st;
+    start(0xFFFFFFFFU);
+    for (uint32_t i = 0; i < 9U; i++) {
+        TEST_ASSERT_TRUE(SD_FreeMapHint(50U * 512U));
+        DWORD first = allocate(50U);
+        TEST_ASSERT_EQUAL_UINT32((i % 8U == 0U) ? 2U : (i % 8U) * GROUP, first);
+        release(first, 50U); /* rotated out: the hole must not be reused next time */
+    }
+    SD_FreeMapGetStats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.wear_laps);
+    TEST_ASSERT_EQUAL_UINT32(52U, st.wear_cursor);
+    TEST_ASSERT_EQUAL_UINT32(52U, SD_FreeMapCursor());
+}
+
+void test_FreeWear_FollowsFileGrownPastItsHint(void) {
+    start(0xFFFFFFFFU);
+    TEST_ASSERT_TRUE(SD_FreeMapHint(512U));
+    TEST_ASSERT_EQUAL_UINT32(2U, allocate(299U));
+    TEST_ASSERT_EQUAL_UINT32(300U, s_vol.last_clst);
+    SD_FreeMapStep();
+    TEST_ASSERT_EQUAL_UINT32(301U, SD_FreeMapCursor());
+
+    /* Deleting the file moves FatFs back to cluster 1; the cursor stays. */
+    release(2U, 299U);
+    TEST_ASSERT_EQUAL_UINT32(301U, SD_FreeMapCursor());
+    TEST_ASSERT_TRUE(SD_FreeMapHint(512U));
+    TEST_ASSERT_EQUAL_UINT32(3U * GROUP - 1U, s_vol.last_clst);
+}
+
+void test_FreeWear_NoWholeGroup_ContinuesAtCursor(void) {
+    /* Every group has a used cluster, so no group is wholly free. */
+    for (uint32_t g = 0; g < FAT_SECTORS; g++) {
+        set_entry(g * GROUP + 100U, 0x0FFFFFFFU);
+    }
+    start(0xFFFFFFFFU);
+    SD_FreeMapSetCursor(140U);
+    TEST_ASSERT_TRUE(SD_FreeMapHint(512U));
+    TEST_ASSERT_EQUAL_UINT32(139U, s_vol.last_clst);
+    TEST_ASSERT_EQUAL_UINT32(141U, SD_FreeMapCursor());
+}
+
+void test_FreeWear_SeededFromFsinfo_AndSettable(void) {
+    start(500U);
+    TEST_ASSERT_EQUAL_UINT32(501U, SD_FreeMapCursor());
+    TEST_ASSERT_TRUE(SD_FreeMapHint(512U));
+    TEST_ASSERT_EQUAL_UINT32(4U * GROUP - 1U, s_vol.last_clst);
+
+    SD_FreeMapSetCursor(700U);
+    TEST_ASSERT_EQUAL_UINT32(700U, SD_FreeMapCursor());
+    SD_FreeMapSetCursor(N_FATENT);
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_FreeMapCursor());
+
+    SD_FreeMapStop();
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_FreeMapCursor());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_FreeWear_Rotation_MovesThroughTheVolume);
+    RUN_TEST(test_FreeWear_FollowsFileGrownPastItsHint);
+    RUN_TEST(test_FreeWear_NoWholeGroup_ContinuesAtCursor);
+    RUN_TEST(test_FreeWear_SeededFromFsinfo_AndSettable);
+    return UNITY_END();
+}
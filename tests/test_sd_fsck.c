@@ -0,0 +1,326 @@
+/*
+ * tests/test_sd_fsck.c
+ *
+ * Incremental FAT check over real FatFs and the card emulator
+ * (SD_FSCK_WINDOW_CLUSTERS=512, SD_FSCK_SLICE=2, SD_FSCK_MAX_DEPTH=3): a
+ * clean tree on FAT16 and FAT32, the per-step read bound, lost chains and
+ * cross links made by raw FAT and directory edits, size mismatches, FAT
+ * writes while the check runs, and a tree too deep to walk.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_fsck.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE        "test_sd_fsck.img"
+#define SMALL_BLOCKS 16384U  /* 8 MiB: FAT16 at 512-byte clusters */
+#define BIG_BLOCKS   131072U /* 64 MiB: enough clusters for FAT32 */
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[4096];
+static uint8_t s_sect[512];
+
+void setUp(void) {
+    (void)remove(IMAGE);
+}
+
+void tearDown(void) {
+    SD_FsckStop();
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+static void volume(uint32_t blocks, BYTE opt) {
+    test_fatfs_fresh(IMAGE, blocks, s_path, opt, 512);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+static void write_file(const char *name, uint32_t len) {
+    memset(s_buf, 0x3C, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t pos = 0; pos < len;) {
+        UINT n = (len - pos < sizeof(s_buf)) ? (UINT)(len - pos) : (UINT)sizeof(s_buf);
+        UINT bw = 0;
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, n, &bw));
+        TEST_ASSERT_EQUAL_UINT32(n, bw);
+        pos += n;
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* Root files of 0, 100, 5000 and 20000 bytes, and /A/B with a file in each. */
+static void build_tree(void) {
+    write_file("empty.txt", 0U);
+    write_file("small.txt", 100U);
+    write_file("mid.bin", 5000U);
+    write_file("big.bin", 20000U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("A"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("A/B"));
+    write_file("A/a.bin", 1500U);
+    write_file("A/B/b.bin", 3000U);
+}
+
+static SD_FsckReport run_check(void) {
+    SD_FsckReport rep;
+    SD_FsckStart(&s_fs);
+    for (uint32_t n = 0; SD_FsckStep(); n++) {
+        TEST_ASSERT_TRUE(n < 100000U);
+    }
+    SD_FsckGetReport(&rep);
+    TEST_ASSERT_TRUE(rep.done);
+    TEST_ASSERT_FALSE(rep.error);
+    return rep;
+}
+
+static void assert_clean(const SD_FsckReport *rep) {
+    TEST_ASSERT_EQUAL_UINT32(0, rep->cross_linked);
+    TEST_ASSERT_EQUAL_UINT32(0, rep->lost_clusters);
+    TEST_ASSERT_EQUAL_UINT32(0, rep->lost_chains);
+    TEST_ASSERT_EQUAL_UINT32(0, rep->short_chains);
+    TEST_ASSERT_EQUAL_UINT32(0, rep->long_chains);
+    TEST_ASSERT_EQUAL_UINT32(0, rep->bad_chains);
+}
+
+static void remount(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+/* Raw FAT16 entry edit in every FAT copy; remount afterwards. */
+static void set_fat16(DWORD clst, WORD value) {
+    for (BYTE k = 0; k < s_fs.n_fats; k++) {
+        DWORD sect = s_fs.fatbase + k * s_fs.fsize + clst / 256U;
+        TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_sect, sect, 1));
+        s_sect[(clst % 256U) * 2U] = (BYTE)value;
+        s_sect[(clst % 256U) * 2U + 1U] = (BYTE)(value >> 8);
+        TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_sect, sect, 1));
+    }
+}
+
+/* Sector and offset of a root directory entry (FAT16), by its 8.3 name. */
+static void find_root_entry(const char *name11, DWORD *sect, uint32_t *off) {
+    for (DWORD s = 0; s < s_fs.n_rootdir / 16U; s++) {
+        TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_sect, s_fs.dirbase + s, 1));
+        for (uint32_t e = 0; e < 512U; e += 32U) {
+            if (memcmp(&s_sect[e], name11, 11) == 0) {
+                *sect = s_fs.dirbase + s;
+                *off = e;
+                return;
+            }
+        }
+    }
+    TEST_FAIL_MESSAGE("entry not found");
+}
+
+static WORD entry_cluster(const char *name11) {
+    DWORD sect;
+    uint32_t off;
+    find_root_entry(name11, &sect, &off);
+    return (WORD)(s_sect[off + 26U] | (s_sect[off + 27U] << 8));
+}
+
+/* Overwrite the first cluster and size of a root entry. */
+static void edit_entry(const char *name11, WORD clst, DWORD size) {
+    DWORD sect;
+    uint32_t off;
+    find_root_entry(name11, &sect, &off);
+    s_sect[off + 26U] = (BYTE)clst;
+    s_sect[off + 27U] = (BYTE)(clst >> 8);
+    for (uint32_t i = 0; i < 4U; i++) {
+        s_sect[off + 28U + i] = (BYTE)(size >> (8U * i));
+    }
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_sect, sect, 1));
+}
+
+void test_Fsck_CleanFat16TreeHasNoFindings(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    TEST_ASSERT_EQUAL(FS_FAT16, s_fs.fs_type);
+    build_tree();
+
+    SD_FsckReport rep = run_check();
+    assert_clean(&rep);
+    TEST_ASSERT_EQUAL_UINT32(6, rep.files);
+    TEST_ASSERT_EQUAL_UINT32(2, rep.dirs);
+    TEST_ASSERT_EQUAL_UINT32((s_fs.n_fatent + 511U) / 512U, rep.windows);
+    TEST_ASSERT_EQUAL_UINT32(rep.windows, rep.window);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.skipped);
+    TEST_ASSERT_FALSE(rep.partial);
+}
+
+void test_Fsck_EachStepReadsAtMostOneSlice(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+
+    SD_FsckReport rep;
+    uint32_t before = 0;
+    uint32_t steps = 0;
+    SD_FsckStart(&s_fs);
+    while (SD_FsckStep()) {
+        SD_FsckGetReport(&rep);
+        TEST_ASSERT_TRUE(rep.sectors_read - before <= SD_FSCK_SLICE);
+        before = rep.sectors_read;
+        steps++;
+    }
+    SD_FsckGetReport(&rep);
+    TEST_ASSERT_TRUE(rep.done);
+    TEST_ASSERT_TRUE(steps > 1U);
+    TEST_ASSERT_EQUAL_UINT32(steps + 1U, rep.steps);
+}
+
+void test_Fsck_FindsLostChain(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    set_fat16(1000U, 1001U);
+    set_fat16(1001U, 1700U); /* crosses into the next window */
+    set_fat16(1700U, 0xFFFFU);
+    set_fat16(3000U, 0xFFFFU);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    SD_FsckReport rep = run_check();
+    TEST_ASSERT_EQUAL_UINT32(4, rep.lost_clusters);
+    TEST_ASSERT_EQUAL_UINT32(3, rep.lost_chains); /* 1000-1001, 1700 on its own window, 3000 */
+    TEST_ASSERT_EQUAL_UINT32(0, rep.cross_linked);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.bad_chains);
+}
+
+void test_Fsck_FindsCrossLinkAndTheClusterItOrphans(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    /* small.txt now starts inside mid.bin's 10-cluster chain. */
+    edit_entry("SMALL   TXT", (WORD)(entry_cluster("MID     BIN") + 4U), 100U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    SD_FsckReport rep = run_check();
+    TEST_ASSERT_EQUAL_UINT32(6, rep.cross_linked);
+    TEST_ASSERT_EQUAL_UINT32(1, rep.lost_clusters);
+    TEST_ASSERT_EQUAL_UINT32(1, rep.lost_chains);
+    TEST_ASSERT_EQUAL_UINT32(1, rep.long_chains); /* 6 clusters for 100 bytes */
+}
+
+void test_Fsck_FindsSizeMismatches(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    edit_entry("MID     BIN", entry_cluster("MID     BIN"), 10000U); /* needs 20 */
+    edit_entry("BIG     BIN", entry_cluster("BIG     BIN"), 1000U);  /* holds 40 */
+    edit_entry("EMPTY   TXT", 0U, 1U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    SD_FsckReport rep = run_check();
+    TEST_ASSERT_EQUAL_UINT32(2, rep.short_chains);
+    TEST_ASSERT_EQUAL_UINT32(1, rep.long_chains);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.lost_clusters);
+}
+
+void test_Fsck_BadLinkIsReported(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    WORD mid = entry_cluster("MID     BIN");
+    set_fat16((DWORD)mid + 2U, 0U); /* chain runs into a free cluster */
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    SD_FsckReport rep = run_check();
+    TEST_ASSERT_EQUAL_UINT32(1, rep.bad_chains);
+    TEST_ASSERT_EQUAL_UINT32(7, rep.lost_clusters); /* the rest of mid.bin */
+    TEST_ASSERT_EQUAL_UINT32(1, rep.lost_chains);
+}
+
+/* Files written while the check runs: their FAT sectors are skipped, not reported. */
+void test_Fsck_WritesDuringCheckGiveNoFalseFindings(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+
+    SD_FsckStart(&s_fs);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(SD_FsckStep());
+    }
+    write_file("late.bin", 8000U);
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("mid.bin"));
+    while (SD_FsckStep()) {
+    }
+
+    SD_FsckReport rep;
+    SD_FsckGetReport(&rep);
+    TEST_ASSERT_TRUE(rep.done);
+    TEST_ASSERT_TRUE(rep.skipped > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.cross_linked);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.lost_clusters);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.bad_chains);
+
+    /* Another pass over the settled volume is clean. */
+    rep = run_check();
+    assert_clean(&rep);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.skipped);
+}
+
+void test_Fsck_TooDeepTreeIsPartial(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("D1"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("D1/D2"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("D1/D2/D3"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("D1/D2/D3/D4"));
+    write_file("D1/D2/D3/D4/deep.bin", 2000U);
+
+    SD_FsckReport rep = run_check();
+    TEST_ASSERT_TRUE(rep.partial);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.lost_clusters);
+    TEST_ASSERT_EQUAL_UINT32(4, rep.dirs);
+    TEST_ASSERT_EQUAL_UINT32(0, rep.files); /* D4 itself is not read */
+}
+
+void test_Fsck_CleanFat32Tree(void) {
+    volume(BIG_BLOCKS, FM_FAT32);
+    TEST_ASSERT_EQUAL(FS_FAT32, s_fs.fs_type);
+    build_tree();
+
+    SD_FsckReport rep = run_check();
+    assert_clean(&rep);
+    TEST_ASSERT_EQUAL_UINT32(6, rep.files);
+    TEST_ASSERT_EQUAL_UINT32(2, rep.dirs);
+    TEST_ASSERT_TRUE(rep.windows > 200U);
+}
+
+void test_Fsck_StopEndsTheCheck(void) {
+    volume(SMALL_BLOCKS, FM_FAT);
+    build_tree();
+    SD_FsckStart(&s_fs);
+    TEST_ASSERT_TRUE(SD_FsckStep());
+    SD_FsckStop();
+    TEST_ASSERT_FALSE(SD_FsckStep());
+
+    /* A remount invalidates a check nobody stopped. */
+    SD_FsckStart(&s_fs);
+    remount();
+    TEST_ASSERT_FALSE(SD_FsckStep());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Fsck_CleanFat16TreeHasNoFindings);
+    RUN_TEST(test_Fsck_EachStepReadsAtMostOneSlice);
+    RUN_TEST(test_Fsck_FindsLostChain);
+    RUN_TEST(test_Fsck_FindsCrossLinkAndTheClusterItOrphans);
+    RUN_TEST(test_Fsck_FindsSizeMismatches);
+    RUN_TEST(test_Fsck_BadLinkIsReported);
+    RUN_TEST(test_Fsck_WritesDuringCheckGiveNoFalseFindings);
+    RUN_TEST(test_Fsck_TooDeepTreeIsPartial);
+    RUN_TEST(test_Fsck_CleanFat32Tree);
+    RUN_TEST(test_Fsck_StopEndsTheCheck);
+
+    return UNITY_END();
+}
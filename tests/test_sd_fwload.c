@@ -0,0 +1,252 @@
+/*
+ * tests/test_sd_fwload.c
+ *
+ * SD_FwLoad against the card emulator on FAT16 with 1 KB clusters and the
+ * default 8 KB pieces: a contiguous image arrives in order as one CMD18 per
+ * piece; pieces end where a cluster run ends; a file with more runs than the
+ * link map holds is read with f_read; given and trailer CRCs, a mismatch,
+ * a callback that stops the load, verify-only runs and bad parameters. The
+ * CRC must match a bit-by-bit model of the STM32 CRC unit.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_fwload.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_fwload.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+#define CLUSTER     1024U
+#define FILE_BYTES  20003U
+
+static FATFS s_fs;
+static FIL s_fil;
+static FIL s_other;
+static char s_path[4];
+static uint8_t s_data[48000];
+static uint8_t s_flash[48000];
+static uint32_t s_programmed; // Next offset the callback expects
+static uint32_t s_calls;
+static uint32_t s_fail_at;    // Call that returns false (0 = none)
+
+static bool program(void *context, uint32_t offset, const uint8_t *data, uint32_t len) {
+    TEST_ASSERT_EQUAL_PTR(&s_flash, context);
+    TEST_ASSERT_EQUAL_UINT32(s_programmed, offset);
+    TEST_ASSERT_TRUE(offset + len <= sizeof(s_flash));
+    memcpy(&s_flash[offset], data, len);
+    s_programmed += len;
+    return ++s_calls != s_fail_at;
+}
+
+/* Bit by bit, as the CRC unit does it. */
+static uint32_t crc_ref(const uint8_t *p, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFFU;
+    for (uint32_t i = 0; i < len; i += 4U) {
+        uint32_t word = 0;
+        for (uint32_t k = 0; k < 4U && i + k < len; k++) {
+            word |= (uint32_t)p[i + k] << (8U * k);
+        }
+        crc ^= word;
+        for (uint32_t bit = 0; bit < 32U; bit++) {
+            crc = (crc & 0x80000000U) ? (crc << 1) ^ 0x04C11DB7U : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void fill(uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        s_data[i] = (uint8_t)((i * 13U) + (i >> 8));
+    }
+}
+
+static void write_file(const char *name, uint32_t len) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_data, len, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* name gets len bytes one cluster at a time, each followed by a cluster of a filler file. */
+static void write_fragmented(const char *name, uint32_t len) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_other, "filler.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t pos = 0; pos < len; pos += CLUSTER) {
+        uint32_t n = (len - pos < CLUSTER) ? len - pos : CLUSTER;
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, &s_data[pos], n, &bw));
+        TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_other, s_data, CLUSTER, &bw));
+        TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_other));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_other));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+static SD_FwLoadConfig config(SD_FwCrcMode mode, uint32_t crc) {
+    SD_FwLoadConfig cfg = {program, &s_flash, mode, crc, 0U};
+    return cfg;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    memset(s_flash, 0, sizeof(s_flash));
+    s_programmed = 0;
+    s_calls = 0;
+    s_fail_at = 0;
+    fill(sizeof(s_data));
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_FwLoad_ContiguousImageOneCmd18PerPiece(void) {
+    SD_FwLoadStats st;
+    mock_card_stats_t card;
+    write_file("fw.bin", FILE_BYTES);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_GIVEN, crc_ref(s_data, FILE_BYTES));
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(FILE_BYTES, st.image_bytes);
+    TEST_ASSERT_EQUAL_UINT32(FILE_BYTES, s_programmed);
+    TEST_ASSERT_EQUAL_MEMORY(s_data, s_flash, FILE_BYTES);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.runs);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.chunks); /* 8192 + 8192 + 3619 */
+    TEST_ASSERT_EQUAL_UINT32(3U, s_calls);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.overlapped); /* no SD I/O task on the host */
+    TEST_ASSERT_EQUAL_UINT32(3U, card.cmd[18]);
+    TEST_ASSERT_EQUAL_HEX32(cfg.crc, st.crc);
+}
+
+void test_FwLoad_PiecesEndWithTheirRun(void) {
+    SD_FwLoadStats st;
+    write_fragmented("fw.bin", 5U * CLUSTER + 100U);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_GIVEN, crc_ref(s_data, 5U * CLUSTER + 100U));
+
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(6U, st.runs);
+    TEST_ASSERT_EQUAL_UINT32(6U, st.chunks);
+    TEST_ASSERT_EQUAL_MEMORY(s_data, s_flash, 5U * CLUSTER + 100U);
+}
+
+void test_FwLoad_TooManyRunsFallsBackToFRead(void) {
+    SD_FwLoadStats st;
+    const uint32_t len = 20U * CLUSTER; /* 20 runs; the map holds 15 */
+    write_fragmented("fw.bin", len);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_GIVEN, crc_ref(s_data, len));
+
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(0U, st.runs);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.chunks);
+    TEST_ASSERT_EQUAL_UINT32(len, st.image_bytes);
+    TEST_ASSERT_EQUAL_MEMORY(s_data, s_flash, len);
+}
+
+void test_FwLoad_TrailerCrcIsCheckedAndNotProgrammed(void) {
+    SD_FwLoadStats st;
+    const uint32_t image = 16384U - 2U; /* the trailer straddles the second and third pieces */
+    uint32_t crc = crc_ref(s_data, image);
+    for (uint32_t i = 0; i < 4U; i++) {
+        s_data[image + i] = (uint8_t)(crc >> (8U * i));
+    }
+    write_file("fw.bin", image + 4U);
+    memset(&s_flash[image], 0xEE, 4U);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_TRAILER, 0U);
+
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(image, st.image_bytes);
+    TEST_ASSERT_EQUAL_UINT32(image, s_programmed);
+    TEST_ASSERT_EQUAL_HEX32(crc, st.crc);
+    TEST_ASSERT_EQUAL_MEMORY(s_data, s_flash, image);
+    TEST_ASSERT_EQUAL_HEX8(0xEE, s_flash[image]);
+
+    s_data[100] ^= 0x01U; /* one flipped bit */
+    write_file("fw.bin", image + 4U);
+    s_programmed = 0;
+    TEST_ASSERT_EQUAL(FR_INT_ERR, SD_FwLoad("fw.bin", &cfg, &st));
+}
+
+void test_FwLoad_CrcMismatchAndNoneMode(void) {
+    SD_FwLoadStats st;
+    write_file("fw.bin", FILE_BYTES);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_GIVEN, crc_ref(s_data, FILE_BYTES) ^ 1U);
+    TEST_ASSERT_EQUAL(FR_INT_ERR, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(FILE_BYTES, st.image_bytes);
+
+    cfg = config(SD_FWLOAD_CRC_NONE, 0U);
+    s_programmed = 0;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_HEX32(crc_ref(s_data, FILE_BYTES), st.crc);
+}
+
+void test_FwLoad_VerifyOnlyProgramsNothing(void) {
+    SD_FwLoadStats st;
+    write_file("fw.bin", FILE_BYTES);
+    SD_FwLoadConfig cfg = {NULL, NULL, SD_FWLOAD_CRC_GIVEN, crc_ref(s_data, FILE_BYTES), 0U};
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(0U, s_calls);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.chunks);
+}
+
+void test_FwLoad_CallbackStopsTheLoad(void) {
+    SD_FwLoadStats st;
+    write_file("fw.bin", FILE_BYTES);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_NONE, 0U);
+    s_fail_at = 2U;
+    TEST_ASSERT_EQUAL(FR_DENIED, SD_FwLoad("fw.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(2U, s_calls);
+    TEST_ASSERT_EQUAL_UINT32(SD_FWLOAD_CHUNK, st.image_bytes);
+
+    /* The file was closed: it can be loaded again. */
+    s_fail_at = 0;
+    s_calls = 0;
+    s_programmed = 0;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("fw.bin", &cfg, &st));
+}
+
+void test_FwLoad_Parameters(void) {
+    SD_FwLoadStats st;
+    write_file("fw.bin", FILE_BYTES);
+    write_file("tiny.bin", 3U);
+    write_file("empty.bin", 0U);
+    SD_FwLoadConfig cfg = config(SD_FWLOAD_CRC_NONE, 0U);
+
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FwLoad(NULL, &cfg, &st));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FwLoad("fw.bin", NULL, &st));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, SD_FwLoad("none.bin", &cfg, &st));
+    cfg.max_bytes = FILE_BYTES - 1U;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FwLoad("fw.bin", &cfg, &st));
+    cfg.max_bytes = 0;
+    cfg.crc_mode = SD_FWLOAD_CRC_TRAILER;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FwLoad("tiny.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL(0U, s_calls);
+
+    cfg.crc_mode = SD_FWLOAD_CRC_GIVEN;
+    cfg.crc = 0xFFFFFFFFU;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FwLoad("empty.bin", &cfg, &st));
+    TEST_ASSERT_EQUAL_UINT32(0U, st.chunks);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_FwLoad_ContiguousImageOneCmd18PerPiece);
+    RUN_TEST(test_FwLoad_PiecesEndWithTheirRun);
+    RUN_TEST(test_FwLoad_TooManyRunsFallsBackToFRead);
+    RUN_TEST(test_FwLoad_TrailerCrcIsCheckedAndNotProgrammed);
+    RUN_TEST(test_FwLoad_CrcMismatchAndNoneMode);
+    RUN_TEST(test_FwLoad_VerifyOnlyProgramsNothing);
+    RUN_TEST(test_FwLoad_CallbackStopsTheLoad);
+    RUN_TEST(test_FwLoad_Parameters);
+    return UNITY_END();
+}
@@ -0,0 +1,95 @@
+/*
+ * tests/test_sd_highspeed.c
+ *
+ * CMD6 high-speed switching (SD_HIGH_SPEED=1, SD_CARD_INFO=1) against the
+ * card emulator, built with a 100 MHz SPI clock (see CMakeLists.txt): a card
+ * offering high speed is checked, switched and run at /2 (50 MHz) with its
+ * new TRAN_SPEED; one without it keeps the /4 fast rate after a single
+ * check; re-initialization switches again after CMD0, and data moves at the
+ * higher rate.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_highspeed.img"
+#define CARD_BLOCKS 8192U
+
+static SD_Handle_t sd;
+static SD_CardInfo info;
+
+static uint32_t card_cmd(uint32_t index) {
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    return st.cmd[index];
+}
+
+static void init(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetCardInfo(&sd, &info));
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    memset(&info, 0, sizeof(info));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_HighSpeed_SwitchesAndRunsFaster(void) {
+    init();
+    TEST_ASSERT_TRUE(SD_IsHighSpeed(&sd));
+    TEST_ASSERT_TRUE(mock_card_high_speed());
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(6)); /* check, then switch */
+    TEST_ASSERT_EQUAL_HEX32(0x8003U, sd.switch_support[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x0000U, sd.switch_support[1]);
+    TEST_ASSERT_EQUAL_UINT32(50000U, info.tran_speed_kbps);
+    TEST_ASSERT_EQUAL_HEX32(SPI_BAUDRATEPRESCALER_2, SD_GetBusPrescaler(&sd));
+}
+
+void test_HighSpeed_UnsupportedKeepsDefaultSpeed(void) {
+    mock_card_set_high_speed(false);
+    init();
+    TEST_ASSERT_FALSE(SD_IsHighSpeed(&sd));
+    TEST_ASSERT_FALSE(mock_card_high_speed());
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(6)); /* the check alone */
+    TEST_ASSERT_EQUAL_HEX32(0x8001U, sd.switch_support[0]);
+    TEST_ASSERT_EQUAL_UINT32(25000U, info.tran_speed_kbps);
+    TEST_ASSERT_EQUAL_HEX32(SPI_BAUDRATEPRESCALER_4, SD_GetBusPrescaler(&sd));
+}
+
+void test_HighSpeed_ReinitSwitchesAgainAndMovesData(void) {
+    static uint8_t out[4U * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    static uint8_t in[4U * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    init();
+    init();
+    TEST_ASSERT_TRUE(SD_IsHighSpeed(&sd));
+    TEST_ASSERT_EQUAL_UINT32(4U, card_cmd(6));
+    TEST_ASSERT_EQUAL_HEX32(SPI_BAUDRATEPRESCALER_2, SD_GetBusPrescaler(&sd));
+
+    for (uint32_t i = 0; i < sizeof(out); i++) {
+        out[i] = (uint8_t)(i * 13U + 7U);
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 40U, 4U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, in, 40U, 4U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, in, sizeof(out));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_HighSpeed_SwitchesAndRunsFaster);
+    RUN_TEST(test_HighSpeed_UnsupportedKeepsDefaultSpeed);
+    RUN_TEST(test_HighSpeed_ReinitSwitchesAgainAndMovesData);
+    return UNITY_END();
+}
@@ -0,0 +1,106 @@
+/*
+ * tests/test_sd_idle.c
+ *
+ * Tests for idle clock gating. Built with SD_IDLE_GATE_MS=10 (see
+ * CMakeLists.txt): HAL_SPI_DeInit stands for the gated SPI clock.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+static int s_hook_on;
+static int s_hook_off;
+
+static void gate_hook(void *context, bool enable) {
+    TEST_ASSERT_EQUAL_PTR(&sd, context);
+    if (enable) {
+        s_hook_on++;
+    } else {
+        s_hook_off++;
+    }
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    s_hook_on = 0;
+    s_hook_off = 0;
+    mock_hal_set_tick(1000);
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+}
+
+void test_Idle_BeforeWindow_StaysUngated(void) {
+    mock_hal_set_tick(1000 + SD_IDLE_GATE_MS - 1U);
+    TEST_ASSERT_FALSE(SD_IdlePoll(&sd));
+    TEST_ASSERT_EQUAL(0, mock_hal_spi_deinit_calls);
+}
+
+void test_Idle_AfterWindow_GatesSpiAndCallsHook(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetClockGateHook(&sd, gate_hook, &sd));
+    mock_hal_set_tick(1000 + SD_IDLE_GATE_MS);
+
+    TEST_ASSERT_TRUE(SD_IdlePoll(&sd));
+    TEST_ASSERT_TRUE(SD_IsClockGated(&sd));
+    TEST_ASSERT_EQUAL(1, mock_hal_spi_deinit_calls);
+    TEST_ASSERT_EQUAL(1, s_hook_off);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.idle_gates);
+
+    TEST_ASSERT_TRUE(SD_IdlePoll(&sd)); /* already gated: nothing more */
+    TEST_ASSERT_EQUAL(1, mock_hal_spi_deinit_calls);
+}
+
+void test_Idle_NextRequest_RestoresTransparently(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetClockGateHook(&sd, gate_hook, &sd));
+    mock_hal_set_tick(1000 + SD_IDLE_GATE_MS);
+    TEST_ASSERT_TRUE(SD_IdlePoll(&sd));
+    int inits = mock_hal_spi_init_calls;
+
+    mock_hal_set_tick(5000);
+    push_single_read(0x5AU);
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x5AU, buf[511]);
+
+    TEST_ASSERT_FALSE(SD_IsClockGated(&sd));
+    TEST_ASSERT_EQUAL(inits + 1, mock_hal_spi_init_calls);
+    TEST_ASSERT_EQUAL(1, s_hook_on);
+    TEST_ASSERT_EQUAL_UINT32(5000U - 1000U - SD_IDLE_GATE_MS, sd.stats.idle_gated_ms);
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_FAST_PRESCALER, g_test_hspi.Init.BaudRatePrescaler);
+
+    /* The request restarted the idle window. */
+    mock_hal_set_tick(5000 + SD_IDLE_GATE_MS - 1U);
+    TEST_ASSERT_FALSE(SD_IdlePoll(&sd));
+}
+
+void test_Idle_PreSleep_GatesWhenSleepCoversWindow(void) {
+    mock_hal_set_tick(1002);
+    SD_IdlePreSleep(3U);
+    TEST_ASSERT_FALSE(SD_IsClockGated(&sd));
+
+    SD_IdlePreSleep(SD_IDLE_GATE_MS);
+    TEST_ASSERT_TRUE(SD_IsClockGated(&sd));
+    TEST_ASSERT_EQUAL(1, mock_hal_spi_deinit_calls);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Idle_BeforeWindow_StaysUngated);
+    RUN_TEST(test_Idle_AfterWindow_GatesSpiAndCallsHook);
+    RUN_TEST(test_Idle_NextRequest_RestoresTransparently);
+    RUN_TEST(test_Idle_PreSleep_GatesWhenSleepCoversWindow);
+
+    return UNITY_END();
+}
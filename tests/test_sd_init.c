@@ -1,7 +1,7 @@
 /*
  * tests/test_sd_init.c
  *
- * Tests for SD_Init, SD_SPI_Init, SD_DeInit, and SD_SetCardDetect.
+ * Tests for SD_Init, SD_SPI_Init, SD_DeInit, SD_SetCardDetect and the card-detect IRQ path.
  */
 
 #include "unity.h"
@@ -125,6 +125,87 @@ void test_SD_IsCardPresent_ActiveHigh_PinHigh_Present(void) {
     TEST_ASSERT_TRUE(SD_IsCardPresent(&sd));
 }
 
+/* -----------------------------------------------------------------------
+ * Card-detect interrupt mode
+ * ----------------------------------------------------------------------- */
+
+static void cd_irq_setup(GPIO_PinState pin) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    SD_SetCardDetect(&sd, &g_test_cd, 0, true);
+    mock_hal_set_gpio_read(pin);
+    mock_hal_set_tick(1000);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetCardDetectIrq(&sd, true));
+    sd.initialized = true;
+}
+
+void test_SD_SetCardDetectIrq_WithoutCardDetect_ReturnsParam(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetCardDetectIrq(&sd, true));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetCardDetectIrq(NULL, true));
+}
+
+void test_SD_CardDetectIrq_PresenceCached_NoGpioReadPerCall(void) {
+    cd_irq_setup(GPIO_PIN_RESET);
+    int reads = mock_hal_gpio_read_calls;
+
+    mock_hal_set_gpio_read(GPIO_PIN_SET); /* no edge reported: cached value stands */
+    TEST_ASSERT_TRUE(SD_IsCardPresent(&sd));
+    TEST_ASSERT_TRUE(SD_IsCardPresent(&sd));
+    TEST_ASSERT_EQUAL(reads, mock_hal_gpio_read_calls);
+}
+
+void test_SD_CardDetectTick_Removal_AfterDebounce_EndsSession(void) {
+    cd_irq_setup(GPIO_PIN_RESET);
+
+    mock_hal_set_gpio_read(GPIO_PIN_SET);
+    SD_CardDetectIrq(&sd);
+    mock_hal_set_tick(1000 + SD_CD_DEBOUNCE_MS - 1U);
+    SD_CardDetectTick(&sd);
+    TEST_ASSERT_TRUE(SD_IsCardPresent(&sd));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_GetCardDetectEvents(&sd));
+
+    mock_hal_set_tick(1000 + SD_CD_DEBOUNCE_MS);
+    SD_CardDetectTick(&sd);
+    TEST_ASSERT_FALSE(SD_IsCardPresent(&sd));
+    TEST_ASSERT_FALSE(SD_IsInitialized(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_GetCardDetectEvents(&sd));
+
+    SD_CardDetectTick(&sd); /* nothing pending: no new event */
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_GetCardDetectEvents(&sd));
+}
+
+void test_SD_CardDetectTick_Bounce_RestartsDebounce(void) {
+    cd_irq_setup(GPIO_PIN_SET);
+    TEST_ASSERT_FALSE(SD_IsCardPresent(&sd));
+
+    mock_hal_set_gpio_read(GPIO_PIN_RESET);
+    SD_CardDetectIrq(&sd);
+    mock_hal_set_tick(1000 + SD_CD_DEBOUNCE_MS - 5U);
+    SD_CardDetectIrq(&sd); /* contact bounce */
+    mock_hal_set_tick(1000 + SD_CD_DEBOUNCE_MS);
+    SD_CardDetectTick(&sd);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_GetCardDetectEvents(&sd));
+
+    mock_hal_set_tick(1000 + 2U * SD_CD_DEBOUNCE_MS);
+    SD_CardDetectTick(&sd);
+    TEST_ASSERT_TRUE(SD_IsCardPresent(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_GetCardDetectEvents(&sd));
+}
+
+void test_SD_CardDetectIrq_Disabled_IgnoredAndPinReadAgain(void) {
+    cd_irq_setup(GPIO_PIN_RESET);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetCardDetectIrq(&sd, false));
+
+    SD_CardDetectIrq(&sd);
+    mock_hal_set_tick(1000 + SD_CD_DEBOUNCE_MS);
+    SD_CardDetectTick(&sd);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_GetCardDetectEvents(&sd));
+    TEST_ASSERT_TRUE(sd.initialized);
+
+    mock_hal_set_gpio_read(GPIO_PIN_SET);
+    TEST_ASSERT_FALSE(SD_IsCardPresent(&sd));
+}
+
 /* -----------------------------------------------------------------------
  * SD_SPI_Init — parameter / pre-condition guards
  * ----------------------------------------------------------------------- */
@@ -255,6 +336,144 @@ void test_SD_SPI_Init_CSD_ReadFail_ZeroCapacity_StillOk(void) {
     TEST_ASSERT_EQUAL_UINT32(0U, sd.capacity_blocks);
 }
 
+void test_SD_SPI_Init_CSD_ReadFail_FallsBackToInitPrescaler(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    push_cmd_exchange(0x01U);   /* CMD0   */
+    push_cmd_exchange(0x01U);   /* CMD8   */
+    push_r7_sdv2();
+    push_cmd_exchange(0x01U);   /* CMD55  */
+    push_cmd_exchange(0x00U);   /* ACMD41 */
+    push_cmd_exchange(0x00U);   /* CMD58  */
+    push_ocr_sdhc();
+    /* No CSD at any speed: every CMD9 attempt sees an idle line. */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_INIT_PRESCALER, SD_GetBusPrescaler(&sd));
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_INIT_PRESCALER, g_test_hspi.Init.BaudRatePrescaler);
+}
+
+/* -----------------------------------------------------------------------
+ * Bus speed negotiation
+ * ----------------------------------------------------------------------- */
+
+void test_SD_Init_BusPrescaler_StartsAtInitRate(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_INIT_PRESCALER, SD_GetBusPrescaler(&sd));
+}
+
+void test_SD_SPI_Init_HappyPath_SwitchesToFastPrescaler(void) {
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_FAST_PRESCALER, SD_GetBusPrescaler(&sd));
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_FAST_PRESCALER, g_test_hspi.Init.BaudRatePrescaler);
+}
+
+void test_SD_SPI_Init_CSD_CrcError_StepsDownOneNotch(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    push_cmd_exchange(0x01U);   /* CMD0   */
+    push_cmd_exchange(0x01U);   /* CMD8   */
+    push_r7_sdv2();
+    push_cmd_exchange(0x01U);   /* CMD55  */
+    push_cmd_exchange(0x00U);   /* ACMD41 */
+    push_cmd_exchange(0x00U);   /* CMD58  */
+    push_ocr_sdhc();
+
+    /* First CSD read (fast clock) arrives with a corrupted CRC7 byte. */
+    uint8_t bad_csd[16] = {0x40U};
+    bad_csd[15] = 0x00U;
+    push_cmd_exchange(0x00U);
+    push_data_token();
+    mock_hal_push_bytes(bad_csd, 16);
+    push_crc();
+
+    /* Retry one notch slower succeeds. */
+    push_cmd_exchange(0x00U);
+    push_data_token();
+    push_csd_sdhc(8192U);
+    push_crc();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL_UINT32(8192U, sd.capacity_blocks);
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_FAST_PRESCALER + SPI_BAUDRATEPRESCALER_4,
+                             SD_GetBusPrescaler(&sd));
+}
+
+void test_SD_SPI_Init_ReInit_RestoresInitPrescalerFirst(void) {
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+    int init_calls = mock_hal_spi_init_calls;
+
+    /* Second identification must drop back to the slow clock before CMD0. */
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL(init_calls + 2, mock_hal_spi_init_calls);
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_FAST_PRESCALER, SD_GetBusPrescaler(&sd));
+}
+
+/* -----------------------------------------------------------------------
+ * Identification polling and phase timing
+ * ----------------------------------------------------------------------- */
+
+/* CMD0/CMD8, then misses ACMD41 misses before ready, then CMD58 + CSD (SDHC). */
+static void push_sdhc_init_slow_acmd41(int misses) {
+    push_cmd_exchange(0x01U);   /* CMD0   */
+    push_cmd_exchange(0x01U);   /* CMD8   */
+    push_r7_sdv2();
+    for (int i = 0; i < misses; i++) {
+        push_cmd_exchange(0x01U); /* CMD55  */
+        push_cmd_exchange(0x01U); /* ACMD41: still idle */
+    }
+    push_cmd_exchange(0x01U);   /* CMD55  */
+    push_cmd_exchange(0x00U);   /* ACMD41 */
+    push_cmd_exchange(0x00U);   /* CMD58  */
+    push_ocr_sdhc();
+    push_cmd_exchange(0x00U);   /* CMD9   */
+    push_data_token();
+    push_csd_sdhc(8192U);
+    push_crc();
+}
+
+void test_SD_SPI_Init_ACMD41_FirstRetries_NoMillisecondSleep(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    mock_hal_set_tick(500);
+    push_sdhc_init_slow_acmd41(3);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_InitTiming t;
+    SD_GetInitTiming(&sd, &t);
+    TEST_ASSERT_EQUAL_UINT32(4U, t.acmd41_polls);
+    TEST_ASSERT_EQUAL_UINT32(500U, mock_hal_get_tick()); /* gaps were idle clocks, not HAL_Delay */
+}
+
+void test_SD_SPI_Init_ReInit_SleepsThroughLearnedReadyTime(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    sd.init_timing.acmd41_us = 6000U; /* previous identification: ready after 6 ms */
+    mock_hal_set_tick(500);
+    push_sdhc_init_slow_acmd41(1); /* ready on the poll after the one that starts init */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_InitTiming t;
+    SD_GetInitTiming(&sd, &t);
+    TEST_ASSERT_EQUAL_UINT32(2U, t.acmd41_polls);
+    TEST_ASSERT_EQUAL_UINT32(505U, mock_hal_get_tick());
+}
+
+void test_SD_SPI_Init_PhaseTiming_Recorded(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    mock_hal_set_cycles_per_byte(16U * 20U); /* 20 us per byte, as at 400 kHz */
+    push_sdhc_init_slow_acmd41(1);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_InitTiming t;
+    SD_GetInitTiming(&sd, &t);
+    TEST_ASSERT_TRUE(t.cmd0_us > 0U);
+    TEST_ASSERT_TRUE(t.cmd8_us > 0U);
+    TEST_ASSERT_TRUE(t.acmd41_us > 0U);
+    TEST_ASSERT_TRUE(t.setup_us > 0U);
+    TEST_ASSERT_TRUE(t.regs_us > 0U);
+    TEST_ASSERT_EQUAL_UINT32(t.cmd0_us + t.cmd8_us + t.acmd41_us + t.setup_us + t.regs_us,
+                             t.total_us);
+    TEST_ASSERT_FALSE(t.cache_hit);
+}
+
 /* -----------------------------------------------------------------------
  * Tick overflow resilience
  * ----------------------------------------------------------------------- */
@@ -312,6 +531,76 @@ void test_SD_GetBlockCount_AfterInit_ReturnsCapacity(void) {
     TEST_ASSERT_EQUAL_UINT32(8192U, SD_GetBlockCount(&sd));
 }
 
+void test_SD_GetEraseBlockSize_SdhcCsd_FixedEraseSector(void) {
+    do_sdhc_init(&sd, 8192U);
+    TEST_ASSERT_EQUAL_UINT32(128U, sd.erase_sector);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.erase_block);
+}
+
+/* CSD v1 without SECTOR_SIZE/WRITE_BL_LEN and no ACMD13 answer: report single blocks. */
+void test_SD_GetEraseBlockSize_NoGeometry_ReportsOne(void) {
+    do_sdsc_init(&sd);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.erase_sector);
+    push_cmd_exchange(0x00U); /* CMD55 */
+    push_cmd_exchange(0x04U); /* ACMD13: illegal command */
+    mock_hal_push_byte(0x00U);
+
+    uint32_t blocks = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetEraseBlockSize(&sd, &blocks));
+    TEST_ASSERT_EQUAL_UINT32(1U, blocks);
+}
+
+void test_SD_GetEraseBlockSize_BeforeInit_ReturnsError(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    uint32_t blocks = 0;
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_GetEraseBlockSize(&sd, &blocks));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_GetEraseBlockSize(&sd, NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Instance registry (SD_MAX_INSTANCES = 2)
+ * ----------------------------------------------------------------------- */
+
+static SD_Handle_t sd_b;
+static SD_Handle_t sd_c;
+static SPI_HandleTypeDef hspi_b;
+
+void test_SD_Init_NoFreeSlot_ReturnsError(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd_b, &hspi_b, &g_test_cs, 1, false));
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_Init(&sd_c, &g_test_hspi, &g_test_cs, 2, false));
+    TEST_ASSERT_NOT_EQUAL(sd.instance, sd_b.instance);
+
+    SD_DeInit(&sd_b);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd_c, &g_test_hspi, &g_test_cs, 2, false));
+    SD_DeInit(&sd_c);
+}
+
+void test_SD_Init_ReInit_KeepsSlot(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd_b, &hspi_b, &g_test_cs, 1, false));
+    uint8_t slot = sd_b.instance;
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd_b, &hspi_b, &g_test_cs, 1, false));
+    TEST_ASSERT_EQUAL_UINT8(slot, sd_b.instance);
+    SD_DeInit(&sd_b);
+}
+
+void test_SD_DmaCallback_SignalsOnlyHandlesOnThatBus(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd_b, &hspi_b, &g_test_cs, 1, true));
+    sd.dma_rx_done = false;
+    sd_b.dma_rx_done = false;
+
+    HAL_SPI_RxCpltCallback(&hspi_b);
+    TEST_ASSERT_FALSE(sd.dma_rx_done);
+    TEST_ASSERT_TRUE(sd_b.dma_rx_done);
+
+    SD_DeInit(&sd_b);
+    sd_b.dma_rx_done = false;
+    HAL_SPI_RxCpltCallback(&hspi_b);
+    TEST_ASSERT_FALSE(sd_b.dma_rx_done); /* unregistered */
+}
+
 /* -----------------------------------------------------------------------
  * Main
  * ----------------------------------------------------------------------- */
@@ -338,6 +627,12 @@ int main(void) {
     RUN_TEST(test_SD_IsCardPresent_ActiveLow_PinHigh_Absent);
     RUN_TEST(test_SD_IsCardPresent_ActiveHigh_PinHigh_Present);
 
+    RUN_TEST(test_SD_SetCardDetectIrq_WithoutCardDetect_ReturnsParam);
+    RUN_TEST(test_SD_CardDetectIrq_PresenceCached_NoGpioReadPerCall);
+    RUN_TEST(test_SD_CardDetectTick_Removal_AfterDebounce_EndsSession);
+    RUN_TEST(test_SD_CardDetectTick_Bounce_RestartsDebounce);
+    RUN_TEST(test_SD_CardDetectIrq_Disabled_IgnoredAndPinReadAgain);
+
     RUN_TEST(test_SD_SPI_Init_NullHandle_ReturnsParam);
     RUN_TEST(test_SD_SPI_Init_NoMedia_ReturnsNoMedia);
     RUN_TEST(test_SD_SPI_Init_IncrementsInitAttempts);
@@ -347,6 +642,16 @@ int main(void) {
     RUN_TEST(test_SD_SPI_Init_CMD0_NoValidResponse_ReturnsError);
     RUN_TEST(test_SD_SPI_Init_ACMD41_Timeout_ReturnsTimeout);
     RUN_TEST(test_SD_SPI_Init_CSD_ReadFail_ZeroCapacity_StillOk);
+    RUN_TEST(test_SD_SPI_Init_CSD_ReadFail_FallsBackToInitPrescaler);
+
+    RUN_TEST(test_SD_Init_BusPrescaler_StartsAtInitRate);
+    RUN_TEST(test_SD_SPI_Init_HappyPath_SwitchesToFastPrescaler);
+    RUN_TEST(test_SD_SPI_Init_CSD_CrcError_StepsDownOneNotch);
+    RUN_TEST(test_SD_SPI_Init_ReInit_RestoresInitPrescalerFirst);
+
+    RUN_TEST(test_SD_SPI_Init_ACMD41_FirstRetries_NoMillisecondSleep);
+    RUN_TEST(test_SD_SPI_Init_ReInit_SleepsThroughLearnedReadyTime);
+    RUN_TEST(test_SD_SPI_Init_PhaseTiming_Recorded);
 
     RUN_TEST(test_SD_SPI_Init_TickOverflow_CMD0_TimesOutCorrectly);
 
@@ -354,6 +659,13 @@ int main(void) {
     RUN_TEST(test_SD_IsInitialized_BeforeInit_ReturnsFalse);
     RUN_TEST(test_SD_GetBlockCount_BeforeInit_ReturnsZero);
     RUN_TEST(test_SD_GetBlockCount_AfterInit_ReturnsCapacity);
+    RUN_TEST(test_SD_GetEraseBlockSize_SdhcCsd_FixedEraseSector);
+    RUN_TEST(test_SD_GetEraseBlockSize_NoGeometry_ReportsOne);
+    RUN_TEST(test_SD_GetEraseBlockSize_BeforeInit_ReturnsError);
+
+    RUN_TEST(test_SD_Init_NoFreeSlot_ReturnsError);
+    RUN_TEST(test_SD_Init_ReInit_KeepsSlot);
+    RUN_TEST(test_SD_DmaCallback_SignalsOnlyHandlesOnThatBus);
 
     return UNITY_END();
 }
@@ -0,0 +1,177 @@
+/*
+ * tests/test_sd_initcache.c
+ *
+ * Tests for the identification cache. Built with SD_INIT_CACHE=1 (see
+ * CMakeLists.txt): the CID read proves the fast clock, and a known CID
+ * replaces the CMD58 and CSD reads with the cached registers.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+}
+
+void tearDown(void) {}
+
+static void make_cid(uint8_t *cid, uint8_t serial) {
+    memset(cid, 0, 16);
+    cid[0] = 0x03U;   /* MID */
+    cid[1] = 'S';     /* OID */
+    cid[2] = 'D';
+    cid[12] = serial; /* PSN, low byte */
+    set_reg_crc7(cid);
+}
+
+/* CMD0 → CMD8 → CMD55+ACMD41 → CMD10 (CID) */
+static void push_identify(uint8_t serial) {
+    uint8_t cid[16];
+    make_cid(cid, serial);
+    push_cmd_exchange(0x01U);   /* CMD0   */
+    push_cmd_exchange(0x01U);   /* CMD8   */
+    push_r7_sdv2();
+    push_cmd_exchange(0x01U);   /* CMD55  */
+    push_cmd_exchange(0x00U);   /* ACMD41 */
+    push_cmd_exchange(0x00U);   /* CMD10  */
+    push_data_token();
+    mock_hal_push_bytes(cid, 16);
+    push_crc();
+}
+
+/* Known-card miss: CMD58 (OCR) → CMD9 (CSD) */
+static void push_registers(uint32_t capacity_blocks) {
+    push_cmd_exchange(0x00U);   /* CMD58  */
+    push_ocr_sdhc();
+    push_cmd_exchange(0x00U);   /* CMD9   */
+    push_data_token();
+    push_csd_sdhc(capacity_blocks);
+    push_crc();
+}
+
+/* True if a command frame for cmd (index byte, then a zero argument) was sent. */
+static bool sent_command(uint8_t cmd) {
+    size_t len;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    for (size_t i = 0; i + 4U < len; i++) {
+        if (tx[i] == (uint8_t)(0x40U | cmd) && tx[i + 1] == 0U && tx[i + 2] == 0U &&
+            tx[i + 3] == 0U && tx[i + 4] == 0U) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_InitCache_FirstInit_ReadsRegistersAndFillsCache(void) {
+    push_identify(1);
+    push_registers(8192U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_TRUE(SD_IsSDHC(&sd));
+    TEST_ASSERT_EQUAL_UINT32(8192U, SD_GetBlockCount(&sd));
+    TEST_ASSERT_EQUAL_UINT32(SD_SPI_FAST_PRESCALER, SD_GetBusPrescaler(&sd));
+
+    SD_InitCache cache;
+    TEST_ASSERT_TRUE(SD_GetInitCache(&sd, &cache));
+    SD_InitTiming t;
+    SD_GetInitTiming(&sd, &t);
+    TEST_ASSERT_FALSE(t.cache_hit);
+}
+
+void test_InitCache_SameCard_SkipsOcrAndCsd(void) {
+    push_identify(1);
+    push_registers(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    mock_hal_reset();
+    push_identify(1);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    TEST_ASSERT_TRUE(sent_command(SD_CMD0));
+    TEST_ASSERT_FALSE(sent_command(SD_CMD58));
+    TEST_ASSERT_FALSE(sent_command(9U));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+    TEST_ASSERT_TRUE(SD_IsSDHC(&sd));
+    TEST_ASSERT_EQUAL_UINT32(8192U, SD_GetBlockCount(&sd));
+    SD_InitTiming t;
+    SD_GetInitTiming(&sd, &t);
+    TEST_ASSERT_TRUE(t.cache_hit);
+}
+
+void test_InitCache_DifferentCard_RereadsRegisters(void) {
+    push_identify(1);
+    push_registers(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    mock_hal_reset();
+    push_identify(2);
+    push_registers(16384U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    TEST_ASSERT_TRUE(sent_command(9U));
+    TEST_ASSERT_EQUAL_UINT32(16384U, SD_GetBlockCount(&sd));
+    SD_InitCache cache;
+    TEST_ASSERT_TRUE(SD_GetInitCache(&sd, &cache));
+    TEST_ASSERT_EQUAL_HEX8(2U, cache.cid[12]);
+}
+
+void test_InitCache_ExportImport_SurvivesHandleReset(void) {
+    push_identify(1);
+    push_registers(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_InitCache saved;
+    TEST_ASSERT_TRUE(SD_GetInitCache(&sd, &saved));
+
+    /* Power-down: the handle starts from scratch, the entry comes back from backup RAM. */
+    SD_DeInit(&sd);
+    mock_hal_reset();
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    SD_InitCache none;
+    TEST_ASSERT_FALSE(SD_GetInitCache(&sd, &none));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetInitCache(&sd, &saved));
+
+    push_identify(1);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL_UINT32(8192U, SD_GetBlockCount(&sd));
+    TEST_ASSERT_FALSE(sent_command(SD_CMD58));
+}
+
+void test_InitCache_SetInitCache_RejectsCorruptEntry(void) {
+    SD_InitCache entry;
+    memset(&entry, 0, sizeof(entry));
+    make_cid(entry.cid, 1);
+    entry.csd[0] = 0x40U;
+    set_reg_crc7(entry.csd);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetInitCache(&sd, &entry)); /* not marked valid */
+
+    entry.valid = true;
+    entry.cid[3] ^= 0x01U;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetInitCache(&sd, &entry));
+
+    entry.cid[3] ^= 0x01U;
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetInitCache(&sd, &entry));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetInitCache(NULL, &entry));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_InitCache_FirstInit_ReadsRegistersAndFillsCache);
+    RUN_TEST(test_InitCache_SameCard_SkipsOcrAndCsd);
+    RUN_TEST(test_InitCache_DifferentCard_RereadsRegisters);
+    RUN_TEST(test_InitCache_ExportImport_SurvivesHandleReset);
+    RUN_TEST(test_InitCache_SetInitCache_RejectsCorruptEntry);
+
+    return UNITY_END();
+}
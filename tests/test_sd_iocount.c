@@ -0,0 +1,161 @@
+/*
+ * tests/test_sd_iocount.c
+ *
+ * I/O-count regression suite: canonical FatFs operations run over the card
+ * emulator and the sectors read, sectors written and SD commands they cost
+ * are checked against the budgets below. A change to ff.c, the diskio glue
+ * or a cache layer that makes any of them grow fails here. When a change
+ * makes an operation cheaper, lower its budget to the printed figure.
+ *
+ * The volume is a fresh 8 MiB FAT16 image with 4 KiB clusters; every
+ * measured call starts from a cold mount unless noted.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_iocount.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     4096U
+#define RECORD_LEN  32U
+
+typedef struct {
+    const char *name;
+    uint32_t reads;   // Sectors read
+    uint32_t writes;  // Sectors written
+    uint32_t cmds;    // Commands, ACMDs included
+} io_budget_t;
+
+/* Baseline figures for FatFs R0.12c with the default driver configuration. */
+static const io_budget_t k_mount      = { "mount",                      2U, 0U,   8U };
+static const io_budget_t k_open       = { "open existing",              1U, 0U,   1U };
+static const io_budget_t k_append     = { "append 100 x 32 B",          0U, 6U,   6U };
+static const io_budget_t k_sync       = { "sync",                       0U, 2U,   2U };
+static const io_budget_t k_create_big = { "create in 1000-entry dir", 141U, 1U, 142U };
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+
+static void remount(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+static void write_file(const char *name, const char *text) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, text, (UINT)strlen(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* Compare the I/O since the last mock_card_reset_stats() with a budget. */
+static void check_budget(const io_budget_t *b) {
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    uint32_t cmds = 0;
+    for (int i = 0; i < 64; i++) {
+        cmds += st.cmd[i] + st.acmd[i];
+    }
+    printf("iocount %-26s reads %3lu/%3lu  writes %3lu/%3lu  cmds %3lu/%3lu\n", b->name,
+           (unsigned long)st.sectors_read, (unsigned long)b->reads,
+           (unsigned long)st.sectors_written, (unsigned long)b->writes,
+           (unsigned long)cmds, (unsigned long)b->cmds);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(b->reads, st.sectors_read);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(b->writes, st.sectors_written);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(b->cmds, cmds);
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    write_file("log.csv", "t,value\n");
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Canonical operations
+ * ----------------------------------------------------------------------- */
+
+/* Power-up mount: card identification plus the FatFs volume probe. */
+void test_IoCount_Mount(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(0, FATFS_UnLinkDriver(s_path));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    check_budget(&k_mount);
+}
+
+void test_IoCount_OpenExisting(void) {
+    remount();
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "log.csv", FA_OPEN_EXISTING | FA_READ));
+    check_budget(&k_open);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_IoCount_Append100Records_ThenSync(void) {
+    char rec[RECORD_LEN + 1U];
+    UINT bw = 0;
+    remount();
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "log.csv", FA_OPEN_APPEND | FA_WRITE));
+
+    mock_card_reset_stats();
+    for (int i = 0; i < 100; i++) {
+        snprintf(rec, sizeof(rec), "%08d,%022d\n", i, i * 37);
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, rec, RECORD_LEN, &bw));
+        TEST_ASSERT_EQUAL_UINT32(RECORD_LEN, bw);
+    }
+    check_budget(&k_append);
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil));
+    check_budget(&k_sync);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_IoCount_CreateIn1000EntryDirectory(void) {
+    char name[16];
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("big"));
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "big/F%04d.TXT", i);
+        TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_NEW | FA_WRITE));
+        TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    }
+    remount();
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "big/NEW.TXT", FA_CREATE_NEW | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    check_budget(&k_create_big);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_IoCount_Mount);
+    RUN_TEST(test_IoCount_OpenExisting);
+    RUN_TEST(test_IoCount_Append100Records_ThenSync);
+    RUN_TEST(test_IoCount_CreateIn1000EntryDirectory);
+
+    return UNITY_END();
+}
@@ -0,0 +1,232 @@
+/*
+ * tests/test_sd_journal.c
+ *
+ * Metadata journal (SD_CACHE_ENABLED=1, SD_CACHE_JOURNAL=1, 8 lines) against
+ * the card emulator, with the region in the MBR gap at block 1: the extra
+ * CMD25 and retiring block per write-back, replay of an interrupted in-place
+ * write, no rollback of a later direct write, falling back past a torn
+ * record, voiding by an overlapping multi-sector write, and a FatFs volume
+ * that remounts cleanly.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_journal.img"
+#define CARD_BLOCKS 16384U
+#define JOURNAL     1U /* slot 0 at 1..9, slot 1 at 10..18; the volume starts at 63 */
+
+static SD_Handle_t *h;
+static uint8_t s_a[SD_BLOCK_SIZE];
+static uint8_t s_b[SD_BLOCK_SIZE];
+static uint8_t s_rd[SD_BLOCK_SIZE];
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    h = SD_DiskHandle(0);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalAttach(h, JOURNAL));
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    memset(s_a, 0xA5, sizeof(s_a));
+    memset(s_b, 0x3C, sizeof(s_b));
+}
+
+/* The image outlives the test: clear the region so records do not carry over. */
+void tearDown(void) {
+    static const uint8_t zero[SD_BLOCK_SIZE];
+    for (uint32_t i = 0; i < SD_CACHE_JOURNAL_BLOCKS; i++) {
+        (void)SD_WriteBlocks(h, zero, JOURNAL + i, 1);
+    }
+    (void)SD_CacheJournalAttach(h, 0U);
+    mock_card_close();
+}
+
+/*
+ * Power lost between the in-place writes and the retiring record: clear the
+ * header of the empty record the write-back ended with.
+ */
+static void lose_retire(void) {
+    static const uint8_t zero[SD_BLOCK_SIZE];
+    for (uint32_t slot = 0; slot < 2U; slot++) {
+        uint32_t base = JOURNAL + (slot * SD_CACHE_JOURNAL_SLOT);
+        TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(h, s_rd, base, 1));
+        if (memcmp(s_rd, "SDJL", 4) == 0 && s_rd[8] == 0U) {
+            TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, zero, base, 1));
+            return;
+        }
+    }
+    TEST_FAIL_MESSAGE("no retiring record");
+}
+
+static void assert_sector(uint32_t sector, const uint8_t *want) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(h, s_rd, sector, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(want, s_rd, SD_BLOCK_SIZE);
+}
+
+/* Record a (header + 3 images, one CMD25), three in-place CMD24s, one retiring CMD24. */
+void test_Journal_WriteBackCostsOneMultiBlockWrite(void) {
+    mock_card_stats_t st;
+    SD_CacheStats cs;
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 200, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 300, 1));
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(8U, st.sectors_written);
+    SD_CacheGetStats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.journal_commits);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.journal_retired);
+
+    /* Nothing dirty: no record. Detached: write-back alone. */
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalAttach(h, 0U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_b, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.sectors_written);
+}
+
+/* Power lost during the in-place writes: replay rewrites what did not land. */
+void test_Journal_ReplayRestoresInterruptedWriteBack(void) {
+    static const uint8_t zero[SD_BLOCK_SIZE];
+    uint32_t replayed = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 200, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    lose_retire();
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, zero, 200, 1)); /* the torn sector */
+
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0)); /* remount */
+    assert_sector(100, s_a);
+    assert_sector(200, s_a);
+
+    /* The replay voided the record: a later direct write stands. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, zero, 200, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalReplay(h, &replayed));
+    TEST_ASSERT_EQUAL_UINT32(0U, replayed);
+    assert_sector(200, zero);
+}
+
+/* A completed write-back leaves nothing to replay over the host's or a PC's writes. */
+void test_Journal_CommittedRecordDoesNotRollBackDirectWrite(void) {
+    uint32_t replayed = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, s_b, 100, 1));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalReplay(h, &replayed));
+    TEST_ASSERT_EQUAL_UINT32(0U, replayed);
+    assert_sector(100, s_b);
+}
+
+/* A record torn mid-write fails its check; the one before it is used. */
+void test_Journal_TornRecordFallsBackToPrevious(void) {
+    uint32_t replayed = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h)); /* record 1, slot 1; empty record 2, slot 0 */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, s_b, JOURNAL, 1)); /* record 2 torn */
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, s_b, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalReplay(h, &replayed));
+    TEST_ASSERT_EQUAL_UINT32(1U, replayed);
+    assert_sector(100, s_a);
+
+    /* The next record reuses the torn slot, not record 1's. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_b, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheFlush(h));
+    lose_retire();
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, s_a, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalReplay(h, &replayed));
+    TEST_ASSERT_EQUAL_UINT32(1U, replayed);
+    assert_sector(100, s_b);
+}
+
+/*
+ * A direct write over a sector of a record still in charge (its write-back
+ * failed part-way) must not be undone by a replay.
+ */
+void test_Journal_OverlappingWriteVoidsRecord(void) {
+    static uint8_t run[3 * SD_BLOCK_SIZE];
+    uint32_t replayed = 0;
+    SD_CacheStats cs;
+    memset(run, 0x77, sizeof(run));
+    SD_CacheResetStats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, 100, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, s_a, CARD_BLOCKS, 1)); /* past the end */
+    TEST_ASSERT_NOT_EQUAL(SD_OK, SD_CacheFlush(h));
+    SD_CacheDiscard(h, CARD_BLOCKS, 1);
+    SD_CacheGetStats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.journal_retired);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, run, 50, 3)); /* elsewhere: record kept */
+    SD_CacheGetStats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.journal_drops);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheWrite(h, run, 99, 3));
+    SD_CacheGetStats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.journal_drops);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalReplay(h, &replayed));
+    TEST_ASSERT_EQUAL_UINT32(0U, replayed);
+    assert_sector(100, run);
+}
+
+void test_Journal_FatFsVolumeRemountsClean(void) {
+    static uint8_t work[_MAX_SS];
+    static FATFS fs;
+    char path[4];
+    FIL fil;
+    UINT n = 0;
+    char text[16] = {0};
+    SD_CacheStats cs;
+    uint32_t replayed;
+
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(path, FM_FAT, 0, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&fs, path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "log.txt", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, "journaled", 9, &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    SD_CacheGetStats(&cs);
+    TEST_ASSERT_TRUE(cs.journal_commits >= 1U);
+    replayed = cs.journal_replayed;
+
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&fs, path, 1));
+    SD_CacheGetStats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(replayed, cs.journal_replayed); /* cumulative counter */
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "log.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&fil, text, sizeof(text) - 1U, &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    TEST_ASSERT_EQUAL_STRING("journaled", text);
+
+    (void)f_mount(NULL, path, 0);
+    (void)FATFS_UnLinkDriver(path);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Journal_WriteBackCostsOneMultiBlockWrite);
+    RUN_TEST(test_Journal_ReplayRestoresInterruptedWriteBack);
+    RUN_TEST(test_Journal_CommittedRecordDoesNotRollBackDirectWrite);
+    RUN_TEST(test_Journal_TornRecordFallsBackToPrevious);
+    RUN_TEST(test_Journal_OverlappingWriteVoidsRecord);
+    RUN_TEST(test_Journal_FatFsVolumeRemountsClean);
+
+    return UNITY_END();
+}
@@ -0,0 +1,124 @@
+/*
+ * tests/test_sd_lazymount.c
+ *
+ * Lazy mount on the card emulator: sd_mount_lazy sends the card nothing,
+ * the first FatFs call (helper or direct) identifies and mounts it, a call
+ * made without a card fails and the next one retries, and sd_mount_poll
+ * finishes the mount once, outside FatFs.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_lazymount.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static FIL s_fil;
+
+static uint32_t card_commands(void) {
+    mock_card_stats_t cs;
+    uint32_t total = 0;
+    mock_card_get_stats(&cs);
+    for (uint32_t i = 0; i < 64U; i++) {
+        total += cs.cmd[i];
+    }
+    return total;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    /* Start from a card that has not been identified, as after reset. */
+    TEST_ASSERT_EQUAL(0, FATFS_UnLinkDriver(s_path));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    mock_card_reset_stats();
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LazyMount_NoCardTrafficUntilFirstAccess(void) {
+    char text[8] = {0};
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_lazy());
+    TEST_ASSERT_EQUAL_UINT32(0U, card_commands());
+    TEST_ASSERT_FALSE(SD_IsInitialized(&g_sd_handle));
+    TEST_ASSERT_EQUAL(FR_NOT_READY, sd_mount_poll());
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/a.txt", "lazy"));
+    TEST_ASSERT_TRUE(SD_IsInitialized(&g_sd_handle));
+    TEST_ASSERT_TRUE(card_commands() > 0U);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file("0:/a.txt", text, sizeof(text), &n));
+    TEST_ASSERT_EQUAL_STRING("lazy", text);
+}
+
+void test_LazyMount_DirectFatFsCallMounts(void) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_lazy());
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/b.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "abc", 3U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    /* Finishing the mount leaves the volume FatFs mounted alone. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_poll());
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/b.bin", FA_READ));
+    TEST_ASSERT_EQUAL_UINT32(3U, (uint32_t)f_size(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_LazyMount_NoCard_RetriedOnNextCall(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_lazy());
+    mock_card_close();
+    TEST_ASSERT_EQUAL(FR_NOT_READY, f_open(&s_fil, "0:/c.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_NOT_READY, sd_mount_poll());
+
+    TEST_ASSERT_TRUE(mock_card_open(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/c.txt", "back"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_poll());
+}
+
+void test_LazyMount_SequenceNumbersMountOnDemand(void) {
+    uint32_t number = 0;
+    char name[32];
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_lazy());
+    TEST_ASSERT_EQUAL(FR_OK, sd_seq_register("0:", "REC_", ".bin", 4U));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_commands());
+    TEST_ASSERT_EQUAL(FR_OK, sd_seq_next("0:", "REC_", name, sizeof(name), &number));
+    TEST_ASSERT_EQUAL_UINT32(1U, number);
+    TEST_ASSERT_EQUAL_STRING("0:/REC_0001.bin", name);
+}
+
+void test_LazyMount_UnmountEndsIt(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_lazy());
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_NOT_READY, sd_mount_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_lazy()); /* already mounted */
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_poll());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LazyMount_NoCardTrafficUntilFirstAccess);
+    RUN_TEST(test_LazyMount_DirectFatFsCallMounts);
+    RUN_TEST(test_LazyMount_NoCard_RetriedOnNextCall);
+    RUN_TEST(test_LazyMount_SequenceNumbersMountOnDemand);
+    RUN_TEST(test_LazyMount_UnmountEndsIt);
+    return UNITY_END();
+}
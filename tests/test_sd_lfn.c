@@ -0,0 +1,115 @@
+/*
+ * tests/test_sd_lfn.c
+ *
+ * Tests for the fast ff_wtoupper (SD_LFN_FAST_UPPER=1, linked with
+ * -Wl,--wrap=ff_wtoupper) over real FatFs and the card emulator, and the
+ * directory cost of numbered short-name aliases that sd_lfn.h documents.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_lfn.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_lfn.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     4096U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static void create(const char *name) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_NEW | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* Sectors read to create name after a cold mount. */
+static uint32_t create_cost(const char *name) {
+    mock_card_stats_t st;
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    mock_card_reset_stats();
+    create(name);
+    mock_card_get_stats(&st);
+    return st.sectors_read;
+}
+
+/* -----------------------------------------------------------------------
+ * Case folding
+ * ----------------------------------------------------------------------- */
+
+void test_FastUpper_MatchesCcsbcsForEveryCharacter(void) {
+    for (uint32_t c = 0; c <= 0xFFFFU; c++) {
+        if (ff_wtoupper((WCHAR)c) != __real_ff_wtoupper((WCHAR)c)) {
+            char msg[32];
+            snprintf(msg, sizeof(msg), "U+%04lX", (unsigned long)c);
+            TEST_FAIL_MESSAGE(msg);
+        }
+    }
+}
+
+void test_FastUpper_LongNamesMatchIgnoringCase(void) {
+    FILINFO fno;
+    create("Sensor_Log_Alpha.csv");
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("SENSOR_LOG_ALPHA.CSV", &fno));
+    TEST_ASSERT_EQUAL_STRING("SENSOR~1.CSV", fno.altname);
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("sensor_log_alpha.csv", &fno));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("sensor_log_alphb.csv", &fno));
+    TEST_ASSERT_EQUAL(FR_EXIST, f_open(&s_fil, "SENSOR_log_ALPHA.csv", FA_CREATE_NEW | FA_WRITE));
+}
+
+/* -----------------------------------------------------------------------
+ * Numbered short-name aliases
+ * ----------------------------------------------------------------------- */
+
+void test_ShortNames_SkipAliasProbes(void) {
+    char name[32];
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("long"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("short"));
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "long/sensor_log_%04d.csv", i);
+        create(name);
+        snprintf(name, sizeof(name), "short/log%05d.csv", i);
+        create(name);
+    }
+
+    uint32_t alias = create_cost("long/sensor_log_0200.csv");
+    uint32_t plain = create_cost("short/log00200.csv");
+    printf("create 201st: alias %lu sectors, 8.3 %lu sectors\n", (unsigned long)alias,
+           (unsigned long)plain);
+    /* One scan of the directory against the LFN pass plus ~1..~5 and a hashed tail. */
+    TEST_ASSERT_TRUE(alias >= 4U * plain);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_FastUpper_MatchesCcsbcsForEveryCharacter);
+    RUN_TEST(test_FastUpper_LongNamesMatchIgnoringCase);
+
+    RUN_TEST(test_ShortNames_SkipAliasProbes);
+
+    return UNITY_END();
+}
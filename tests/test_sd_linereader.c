@@ -0,0 +1,149 @@
+/*
+ * tests/test_sd_linereader.c
+ *
+ * Line reader over the card emulator: lines come back as the same text
+ * f_gets returns (CRLF and LF endings, blank lines, a last line without a
+ * newline), lines cut by a small chunk are joined through the carry area,
+ * lines longer than max_line are skipped and counted, and sd_csv_parse on
+ * top of it reports line numbers and counts.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_linereader.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static FIL s_fil;
+static char s_buf[16 + 40 + 1] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static char s_text[4096];
+static uint32_t s_seen_lines[8];
+static uint32_t s_seen;
+
+static void put_file(const char *path, const char *text) {
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, text, (UINT)strlen(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+static bool keep_line(char **fields, int nfields, uint32_t line, void *context) {
+    (void)context;
+    TEST_ASSERT_TRUE(nfields >= 2);
+    TEST_ASSERT_TRUE(s_seen < 8U);
+    TEST_ASSERT_EQUAL_STRING("x", fields[0]);
+    s_seen_lines[s_seen++] = line;
+    return true;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    s_seen = 0;
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LineReader_MatchesFgets(void) {
+    /* 300 lines of varying length, CRLF and LF, some blank; no final newline. */
+    size_t n = 0;
+    for (uint32_t i = 0; i < 300U; i++) {
+        n += (size_t)snprintf(s_text + n, sizeof(s_text) - n, "%s%.*s%s",
+                              (i % 7U == 3U) ? "" : "line", (int)(i % 9U), "abcdefghi",
+                              (i % 2U) ? "\r\n" : "\n");
+        TEST_ASSERT_TRUE(n < sizeof(s_text) - 16U);
+    }
+    memcpy(s_text + n, "tail", 5);
+    put_file("0:/lines.txt", s_text);
+
+    static FIL gets_fil;
+    static char big[1024 + 256 + 1] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+    char want[64];
+    SD_LineReader lr;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&gets_fil, "0:/lines.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/lines.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, sd_line_reader_init(&lr, &s_fil, big, sizeof(big), 256U));
+
+    uint32_t count = 0;
+    for (;;) {
+        char *line;
+        uint32_t len;
+        TEST_ASSERT_EQUAL(FR_OK, sd_line_read(&lr, &line, &len));
+        if (f_gets(want, sizeof(want), &gets_fil) == NULL) {
+            TEST_ASSERT_NULL(line);
+            break;
+        }
+        want[strcspn(want, "\r\n")] = '\0';
+        TEST_ASSERT_NOT_NULL(line);
+        TEST_ASSERT_EQUAL_STRING(want, line);
+        TEST_ASSERT_EQUAL_UINT32(strlen(want), len);
+        count++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(301U, count);
+    TEST_ASSERT_EQUAL_UINT32(301U, lr.lines);
+    TEST_ASSERT_EQUAL_UINT32(0U, lr.long_lines);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&gets_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_LineReader_CarryAndLongLines(void) {
+    /* 40-byte chunks, 16-byte carry: lines cross chunks; the 30-byte one is skipped. */
+    put_file("0:/carry.txt", "first line here\n"
+                             "0123456789ABCDEFGHIJKLMNOPQRST\r\n"
+                             "after long\n"
+                             "\n"
+                             "end");
+    SD_LineReader lr;
+    char *line;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/carry.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, sd_line_reader_init(&lr, &s_fil, s_buf, sizeof(s_buf), 16U));
+    const char *want[] = {"first line here", "after long", "", "end"};
+    const uint32_t number[] = {1U, 3U, 4U, 5U};
+    for (uint32_t i = 0; i < 4U; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, sd_line_read(&lr, &line, NULL));
+        TEST_ASSERT_NOT_NULL(line);
+        TEST_ASSERT_EQUAL_STRING(want[i], line);
+        TEST_ASSERT_EQUAL_UINT32(number[i], lr.lines);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_line_read(&lr, &line, NULL));
+    TEST_ASSERT_NULL(line);
+    TEST_ASSERT_EQUAL_UINT32(1U, lr.long_lines);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER,
+                      sd_line_reader_init(&lr, &s_fil, s_buf, 17U, 16U));
+}
+
+void test_LineReader_CsvOnTop(void) {
+    put_file("0:/data.csv", "x,1,2\r\n\r\nx,\"a,b\",3\r\nx,4\r\n");
+    SD_CsvStats st;
+    TEST_ASSERT_EQUAL(FR_OK, sd_csv_parse("0:/data.csv", ',', keep_line, NULL, &st));
+    TEST_ASSERT_EQUAL_UINT32(4U, st.lines);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.records);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.long_lines);
+    TEST_ASSERT_EQUAL_UINT32(3U, s_seen);
+    TEST_ASSERT_EQUAL_UINT32(1U, s_seen_lines[0]);
+    TEST_ASSERT_EQUAL_UINT32(3U, s_seen_lines[1]);
+    TEST_ASSERT_EQUAL_UINT32(4U, s_seen_lines[2]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LineReader_MatchesFgets);
+    RUN_TEST(test_LineReader_CarryAndLongLines);
+    RUN_TEST(test_LineReader_CsvOnTop);
+    return UNITY_END();
+}
@@ -0,0 +1,98 @@
+/*
+ * tests/test_sd_llspi.c
+ *
+ * Register-level SPI fast path (SD_SPI_LL_FASTPATH=1), run against the card
+ * emulator: identification and block I/O must work unchanged, and only the
+ * bulk data phases may still go through HAL_SPI_* calls.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_llspi.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+}
+
+void test_LL_Identification_OverRegisters(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_TRUE(SD_IsInitialized(&sd));
+    TEST_ASSERT_EQUAL_UINT32(CARD_BLOCKS, SD_GetBlockCount(&sd));
+    TEST_ASSERT_TRUE(mock_hal_ll_bytes > 0);
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+}
+
+void test_LL_SingleBlockRead_OnlyDataPhaseThroughHal(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    mock_hal_transmit_calls = 0;
+    mock_hal_transmitrec_calls = 0;
+    mock_hal_ll_bytes = 0;
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 5U, 1U));
+    TEST_ASSERT_EQUAL(0, mock_hal_transmit_calls);
+    TEST_ASSERT_EQUAL(1, mock_hal_transmitrec_calls);
+    TEST_ASSERT_TRUE(mock_hal_ll_bytes >= 7 + 2);
+}
+
+void test_LL_MultiBlockWriteRead_RoundTrip(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    static uint8_t out[4 * 512];
+    static uint8_t back[4 * 512];
+    for (uint32_t i = 0; i < sizeof(out); i++) {
+        out[i] = (uint8_t)(i * 7U + 1U);
+    }
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 100U, 4U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, back, 100U, 4U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, sizeof(out));
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.sectors_written);
+}
+
+/* Under the timing simulator a CMD17 costs one HAL call: the 512-byte block. */
+void test_LL_Simulated_OneHalCallPerSingleBlockRead(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 9U, 1U));
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    TEST_ASSERT_EQUAL_UINT32(1U, rep.calls);
+    TEST_ASSERT_TRUE(rep.bytes > 512U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_LL_Identification_OverRegisters);
+    RUN_TEST(test_LL_SingleBlockRead_OnlyDataPhaseThroughHal);
+    RUN_TEST(test_LL_MultiBlockWriteRead_RoundTrip);
+    RUN_TEST(test_LL_Simulated_OneHalCallPerSingleBlockRead);
+
+    return UNITY_END();
+}
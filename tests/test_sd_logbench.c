@@ -0,0 +1,137 @@
+/*
+ * tests/test_sd_logbench.c
+ *
+ * Logger tail-latency benchmark over the card emulator in simulated time:
+ * every record of a comfortable run is committed and timed with ordered
+ * percentiles and all competing loads running, a ring the producer outruns
+ * reports drops, the histogram bucket bounds are monotonic, and bad
+ * configurations are rejected.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_logbench.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_logbench.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static SD_LogBenchResult s_result;
+static GPIO_TypeDef s_led;
+
+static void bench_config(SD_LogBenchConfig *cfg) {
+    sd_logbench_defaults(cfg);
+    cfg->path = "0:/b.log";
+    cfg->ui_path = "0:/ui.bin";
+    cfg->ui_file_bytes = 16384U;
+    cfg->duration_ms = 2000U;
+    cfg->led_port = &s_led;
+}
+
+void setUp(void) {
+    mock_hal_sim_config_t sim;
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 0);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    mock_hal_sim_defaults(&sim);
+    mock_hal_sim_enable(&sim);
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    (void)sd_logger_stop();
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LogBench_AllRecordsCommittedUnderLoad(void) {
+    SD_LogBenchConfig cfg;
+    bench_config(&cfg);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logbench_run(&cfg, &s_result));
+
+    TEST_ASSERT_EQUAL_UINT32(cfg.duration_ms / cfg.record_period_ms, s_result.records);
+    TEST_ASSERT_EQUAL_UINT32(0, s_result.dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, s_result.unmeasured);
+    TEST_ASSERT_EQUAL_UINT32(s_result.records, s_result.committed);
+    uint32_t hist_total = 0;
+    for (uint32_t b = 0; b < SD_LOGBENCH_BUCKETS; b++) {
+        hist_total += s_result.hist[b];
+    }
+    TEST_ASSERT_EQUAL_UINT32(s_result.committed, hist_total);
+    TEST_ASSERT_TRUE(s_result.p50_us > 0U);
+    TEST_ASSERT_TRUE(s_result.p50_us <= s_result.p90_us);
+    TEST_ASSERT_TRUE(s_result.p90_us <= s_result.p99_us);
+    TEST_ASSERT_TRUE(s_result.p99_us <= s_result.p999_us);
+    TEST_ASSERT_TRUE(s_result.p999_us <= s_result.max_us);
+
+    /* Loads run inside the window; the ones due at its very end do not. */
+    TEST_ASSERT_EQUAL_UINT32(cfg.duration_ms / cfg.ui_period_ms - 1U, s_result.ui_reads);
+    TEST_ASSERT_EQUAL_UINT32(cfg.duration_ms / cfg.stat_period_ms - 1U, s_result.stat_polls);
+    TEST_ASSERT_TRUE(s_result.led_toggles >= cfg.duration_ms / cfg.led_period_ms / 2U);
+    TEST_ASSERT_EQUAL(s_result.led_toggles, mock_hal_gpio_toggle_calls);
+    TEST_ASSERT_TRUE(s_result.ui_max_us > 0U);
+    TEST_ASSERT_TRUE(s_result.stat_max_us > 0U);
+    TEST_ASSERT_EQUAL_UINT32(0, s_result.load_errors);
+    TEST_ASSERT_EQUAL(FR_OK, s_result.logger_error);
+
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat(cfg.path, &fno));
+    TEST_ASSERT_EQUAL_UINT32(s_result.records * cfg.record_bytes, fno.fsize);
+    TEST_ASSERT_FALSE(sd_logger_running());
+}
+
+void test_LogBench_OutrunRingReportsDrops(void) {
+    SD_LogBenchConfig cfg;
+    bench_config(&cfg);
+    cfg.record_bytes = SD_LOGGER_MAX_RECORD;
+    cfg.record_period_ms = 1U;
+    cfg.ui_read_bytes = 4096U;
+    cfg.ui_period_ms = 2U;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logbench_run(&cfg, &s_result));
+
+    TEST_ASSERT_EQUAL_UINT32(cfg.duration_ms, s_result.records);
+    TEST_ASSERT_TRUE(s_result.dropped > 0U);
+    TEST_ASSERT_EQUAL_UINT32(s_result.records, s_result.dropped + s_result.committed +
+                                                   s_result.unmeasured);
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat(cfg.path, &fno));
+    TEST_ASSERT_EQUAL_UINT32((s_result.records - s_result.dropped) * cfg.record_bytes, fno.fsize);
+}
+
+void test_LogBench_BucketBoundsIncrease(void) {
+    TEST_ASSERT_EQUAL_UINT32(0, sd_logbench_bucket_us(0));
+    TEST_ASSERT_EQUAL_UINT32(4, sd_logbench_bucket_us(4));
+    TEST_ASSERT_EQUAL_UINT32(9, sd_logbench_bucket_us(8));
+    for (uint32_t b = 1; b < 4U * 30U + 4U; b++) {
+        TEST_ASSERT_TRUE(sd_logbench_bucket_us(b) > sd_logbench_bucket_us(b - 1U));
+    }
+}
+
+void test_LogBench_RejectsBadConfig(void) {
+    SD_LogBenchConfig cfg;
+    bench_config(&cfg);
+    cfg.record_bytes = 4U;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_logbench_run(&cfg, &s_result));
+    bench_config(&cfg);
+    cfg.ui_read_bytes = cfg.ui_file_bytes + 1U;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_logbench_run(&cfg, &s_result));
+    bench_config(&cfg);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/other.log"));
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_logbench_run(&cfg, &s_result));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LogBench_AllRecordsCommittedUnderLoad);
+    RUN_TEST(test_LogBench_OutrunRingReportsDrops);
+    RUN_TEST(test_LogBench_BucketBoundsIncrease);
+    RUN_TEST(test_LogBench_RejectsBadConfig);
+    return UNITY_END();
+}
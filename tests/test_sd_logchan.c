@@ -0,0 +1,187 @@
+/*
+ * tests/test_sd_logchan.c
+ *
+ * Logger channels (SD_LOGGER_CHANNELS=4) over the card emulator: records
+ * from four single-producer channels, the shared ring and a pushed buffer
+ * come out of one tagged file, each channel in its own order; a full channel
+ * drops only its own records; sd_logger_tag_next stops at a cut record.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_logchan.img"
+#define CARD_BLOCKS 16384U
+#define ROUNDS      400U
+
+typedef struct {
+    uint32_t channel;
+    uint32_t seq;
+    uint8_t fill[8];
+} rec_t;
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_file[65536];
+
+static uint32_t read_log(void) {
+    UINT br = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/m.log", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_file, sizeof(s_file), &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    return br;
+}
+
+static rec_t make(uint32_t channel, uint32_t seq) {
+    rec_t r;
+    memset(&r, (int)(channel * 16U + seq % 16U), sizeof(r));
+    r.channel = channel;
+    r.seq = seq;
+    return r;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LogChan_MergedIntoTaggedFile(void) {
+    static uint8_t pushed[40];
+    memset(pushed, 0x5A, sizeof(pushed));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/m.log"));
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        for (uint32_t ch = 0; ch < 4U; ch++) {
+            if (ch == 3U && (i % 2U) != 0U) {
+                continue; /* a slower producer */
+            }
+            rec_t r = make(ch, i);
+            TEST_ASSERT_TRUE(sd_logger_channel_write(ch, &r, sizeof(r)));
+        }
+        if (i % 10U == 0U) {
+            rec_t r = make(SD_LOGGER_SHARED_CHANNEL, i);
+            TEST_ASSERT_TRUE(sd_logger_write(&r, sizeof(r)));
+        }
+        if (i == 200U) {
+            TEST_ASSERT_TRUE(sd_logger_push_from_isr(pushed, sizeof(pushed), NULL, NULL));
+        }
+        if (i % 20U == 19U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    TEST_ASSERT_FALSE(sd_logger_channel_write(4U, pushed, 8U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_FALSE(sd_logger_channel_write(0U, pushed, 8U));
+
+    uint32_t n = read_log();
+    uint32_t next[4] = {0U, 0U, 0U, 0U};
+    uint32_t shared = 0, buffers = 0, pos = 0;
+    while (pos < n) {
+        uint32_t ch, len;
+        const uint8_t *p;
+        uint32_t step = sd_logger_tag_next(&s_file[pos], n - pos, &ch, &p, &len);
+        TEST_ASSERT_TRUE(step > 0U);
+        pos += step;
+        if (ch == SD_LOGGER_SHARED_CHANNEL && len == sizeof(pushed)) {
+            TEST_ASSERT_EQUAL_MEMORY(pushed, p, sizeof(pushed));
+            buffers++;
+            continue;
+        }
+        TEST_ASSERT_EQUAL_UINT32(sizeof(rec_t), len);
+        rec_t r;
+        memcpy(&r, p, sizeof(r));
+        TEST_ASSERT_EQUAL_UINT32(ch, r.channel);
+        if (ch == SD_LOGGER_SHARED_CHANNEL) {
+            TEST_ASSERT_EQUAL_UINT32(shared * 10U, r.seq);
+            shared++;
+        } else {
+            TEST_ASSERT_TRUE(ch < 4U);
+            rec_t want = make(ch, next[ch]);
+            TEST_ASSERT_EQUAL_MEMORY(&want, &r, sizeof(r));
+            next[ch] += (ch == 3U) ? 2U : 1U;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(n, pos);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS, next[0]);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS, next[1]);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS, next[2]);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS, next[3]);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS / 10U, shared);
+    TEST_ASSERT_EQUAL_UINT32(1U, buffers);
+
+    SD_LoggerChannelStats cs;
+    sd_logger_get_channel_stats(3U, &cs);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS / 2U, cs.records);
+    TEST_ASSERT_EQUAL_UINT32(ROUNDS / 2U * sizeof(rec_t), cs.bytes);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.dropped_records);
+    sd_logger_get_channel_stats(9U, &cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.records);
+}
+
+void test_LogChan_FullChannelDropsOnlyItsOwn(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/m.log"));
+    /* 1024-byte rings, 20 ring bytes per record: 51 fit, the rest drop. */
+    uint32_t accepted[2] = {0U, 0U};
+    for (uint32_t i = 0; i < 60U; i++) {
+        rec_t r = make(1U, i);
+        accepted[0] += sd_logger_channel_write(1U, &r, sizeof(r)) ? 1U : 0U;
+        if (i < 51U) {
+            r = make(2U, i);
+            accepted[1] += sd_logger_channel_write(2U, &r, sizeof(r)) ? 1U : 0U;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(51U, accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(51U, accepted[1]);
+    SD_LoggerChannelStats cs;
+    sd_logger_get_channel_stats(1U, &cs);
+    TEST_ASSERT_EQUAL_UINT32(51U, cs.records);
+    TEST_ASSERT_EQUAL_UINT32(9U, cs.dropped_records);
+    TEST_ASSERT_EQUAL_UINT32(51U * 20U, cs.high_water);
+    sd_logger_get_channel_stats(2U, &cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.dropped_records);
+    rec_t r = make(0U, 0U);
+    TEST_ASSERT_TRUE(sd_logger_channel_write(0U, &r, sizeof(r))); /* others unaffected */
+
+    /* Draining frees the channel again. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    r = make(1U, 60U);
+    TEST_ASSERT_TRUE(sd_logger_channel_write(1U, &r, sizeof(r)));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+
+    uint32_t n = read_log();
+    TEST_ASSERT_EQUAL_UINT32((51U + 51U + 1U + 1U) * (4U + sizeof(rec_t)), n);
+}
+
+void test_LogChan_TagNextStopsAtCut(void) {
+    uint8_t buf[16] = {5, 0, 0, 2, 'h', 'e', 'l', 'l', 'o', 9, 0, 0, 0xFF, 'x'};
+    uint32_t ch, len;
+    const uint8_t *p;
+    TEST_ASSERT_EQUAL_UINT32(9U, sd_logger_tag_next(buf, 14U, &ch, &p, &len));
+    TEST_ASSERT_EQUAL_UINT32(2U, ch);
+    TEST_ASSERT_EQUAL_UINT32(5U, len);
+    TEST_ASSERT_EQUAL_MEMORY("hello", p, 5);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd_logger_tag_next(&buf[9], 5U, &ch, &p, &len));
+    TEST_ASSERT_EQUAL_UINT32(0U, sd_logger_tag_next(buf, 3U, &ch, &p, &len));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LogChan_MergedIntoTaggedFile);
+    RUN_TEST(test_LogChan_FullChannelDropsOnlyItsOwn);
+    RUN_TEST(test_LogChan_TagNextStopsAtCut);
+    return UNITY_END();
+}
@@ -0,0 +1,378 @@
+/*
+ * tests/test_sd_logger.c
+ *
+ * Tests for the streaming logger (SD_LOGGER_RING_BYTES=1024, CHUNK=512,
+ * MAX_RECORD=64, SYNC_MS=100, PREALLOC_BYTES=2048, ISR_BUFS=2 x 600). FatFs is replaced by a
+ * one-file fake that records every f_write size.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_logger.h"
+#include "sd_functions.h"
+#include "sd_spi.h"
+#include <string.h>
+
+/* -----------------------------------------------------------------------
+ * Fake FatFs (single file)
+ * ----------------------------------------------------------------------- */
+
+static uint8_t s_disk[8192];
+static uint32_t s_disk_size;
+static UINT s_write_sizes[32];
+static int s_writes;
+static int s_syncs;
+static int s_truncates;
+static BYTE s_open_mode;
+static FRESULT s_prealloc_result;
+static uint32_t s_prealloc_bytes;
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode) {
+    (void)path;
+    s_open_mode = mode;
+    fp->fptr = 0;
+    fp->obj.objsize = s_disk_size;
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+    s_disk_size = fp->obj.objsize;
+    return FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+    if (fp->fptr + btw > sizeof(s_disk)) {
+        btw = (UINT)(sizeof(s_disk) - fp->fptr);
+    }
+    memcpy(&s_disk[fp->fptr], buff, btw);
+    fp->fptr += btw;
+    if (fp->fptr > fp->obj.objsize) {
+        fp->obj.objsize = fp->fptr;
+    }
+    if (s_writes < 32) {
+        s_write_sizes[s_writes] = btw;
+    }
+    s_writes++;
+    *bw = btw;
+    return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+    if (fp->fptr + btr > fp->obj.objsize) {
+        btr = (UINT)(fp->obj.objsize - fp->fptr);
+    }
+    memcpy(buff, &s_disk[fp->fptr], btr);
+    fp->fptr += btr;
+    *br = btr;
+    return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+    fp->fptr = ofs;
+    return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp) {
+    fp->obj.objsize = fp->fptr;
+    s_truncates++;
+    return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp) {
+    (void)fp;
+    s_syncs++;
+    return FR_OK;
+}
+
+int sd_preallocate_file(const char *filename, uint32_t bytes) {
+    (void)filename;
+    s_prealloc_bytes = bytes;
+    if (s_prealloc_result == FR_OK) {
+        s_disk_size = bytes;
+    }
+    return s_prealloc_result;
+}
+
+void sd_dirindex_add(const char *path) {
+    (void)path;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(s_disk, 0, sizeof(s_disk));
+    s_disk_size = 0;
+    s_writes = 0;
+    s_syncs = 0;
+    s_truncates = 0;
+    s_prealloc_result = FR_DENIED;
+    s_prealloc_bytes = 0;
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+static void log_records(int n, uint32_t len) {
+    uint8_t rec[SD_LOGGER_MAX_RECORD];
+    for (int i = 0; i < n; i++) {
+        memset(rec, (uint8_t)(i + 1), len);
+        TEST_ASSERT_TRUE(sd_logger_write(rec, len));
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Chunked writes
+ * ----------------------------------------------------------------------- */
+
+void test_Logger_PollBelowChunk_WritesNothing(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    log_records(4, 50);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(0, s_writes);
+}
+
+void test_Logger_PollAfterChunkFills_WritesWholeChunkInOrder(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    log_records(11, 50); /* 550 bytes */
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(1, s_writes);
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_CHUNK_BYTES, s_write_sizes[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, s_disk[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, s_disk[49]);
+    TEST_ASSERT_EQUAL_HEX8(0x02, s_disk[50]);
+    TEST_ASSERT_EQUAL_HEX8(0x0B, s_disk[511]);
+}
+
+void test_Logger_Stop_WritesTailAndCloses(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    log_records(11, 50);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_EQUAL_UINT32(550U, s_disk_size);
+    TEST_ASSERT_FALSE(sd_logger_running());
+    TEST_ASSERT_FALSE(sd_logger_write("x", 1));
+}
+
+/* -----------------------------------------------------------------------
+ * Sync interval and alignment
+ * ----------------------------------------------------------------------- */
+
+void test_Logger_SyncInterval_FlushesPartialThenRealigns(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    log_records(2, 50);
+    mock_hal_set_tick(SD_LOGGER_SYNC_MS);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(1, s_syncs);
+    TEST_ASSERT_EQUAL_UINT32(100U, s_write_sizes[0]);
+
+    log_records(10, 50); /* 500 more: the next write stops at the 512 boundary */
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(2, s_writes);
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_CHUNK_BYTES - 100U, s_write_sizes[1]);
+}
+
+void test_Logger_AppendStart_AlignsToExistingSize(void) {
+    s_disk_size = 200;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_EQUAL_UINT8(FA_OPEN_ALWAYS | FA_WRITE, s_open_mode);
+    log_records(7, 50);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(1, s_writes);
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_CHUNK_BYTES - 200U, s_write_sizes[0]);
+}
+
+/* -----------------------------------------------------------------------
+ * Preallocation
+ * ----------------------------------------------------------------------- */
+
+void test_Logger_Preallocated_WritesFromZeroAndTruncates(void) {
+    s_prealloc_result = FR_OK;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_PREALLOC_BYTES, s_prealloc_bytes);
+    TEST_ASSERT_EQUAL_UINT8(FA_OPEN_EXISTING | FA_WRITE, s_open_mode);
+    log_records(3, 40);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_EQUAL(1, s_truncates);
+    TEST_ASSERT_EQUAL_UINT32(120U, s_disk_size);
+}
+
+/* -----------------------------------------------------------------------
+ * Ring limits and metrics
+ * ----------------------------------------------------------------------- */
+
+void test_Logger_RingFull_DropsAndCountsHighWater(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    uint8_t rec[60] = {0};
+    int accepted = 0;
+    for (int i = 0; i < 20; i++) {
+        accepted += sd_logger_write(rec, sizeof(rec)) ? 1 : 0;
+    }
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL(SD_LOGGER_RING_BYTES / 64U, accepted);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)accepted, st.records);
+    TEST_ASSERT_EQUAL_UINT32(20U - (uint32_t)accepted, st.dropped_records);
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_RING_BYTES, st.ring_high_water);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_TRUE(sd_logger_write(rec, sizeof(rec)));
+}
+
+void test_Logger_RecordWrapsRingEnd_KeepsBytes(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    /* 15 x 64-byte slots, drained, leave the next record straddling the wrap. */
+    log_records(15, 60);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_flush());
+    uint8_t rec[64];
+    for (int i = 0; i < 64; i++) {
+        rec[i] = (uint8_t)(0x80 + i);
+    }
+    TEST_ASSERT_TRUE(sd_logger_write(rec, 36)); /* parks head 24 bytes before the end */
+    TEST_ASSERT_TRUE(sd_logger_write(rec, 64));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_flush());
+    TEST_ASSERT_EQUAL_MEMORY(rec, &s_disk[900 + 36], 64);
+}
+
+void test_Logger_BadRecord_Rejected(void) {
+    uint8_t rec[SD_LOGGER_MAX_RECORD + 1] = {0};
+    TEST_ASSERT_FALSE(sd_logger_write(rec, 1));  /* not started */
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_logger_start("log.bin"));
+    TEST_ASSERT_FALSE(sd_logger_write(rec, 0));
+    TEST_ASSERT_FALSE(sd_logger_write(rec, sizeof(rec)));
+    TEST_ASSERT_FALSE(sd_logger_write(NULL, 4));
+}
+
+/* -----------------------------------------------------------------------
+ * Buffers queued by reference
+ * ----------------------------------------------------------------------- */
+
+static void *s_released;
+static int s_release_calls;
+
+static void release_buf(void *buf, void *context) {
+    TEST_ASSERT_EQUAL_PTR(&s_release_calls, context);
+    s_released = buf;
+    s_release_calls++;
+}
+
+void test_Logger_PushBuffer_WritesAlignedRunInPlace(void) {
+    static uint8_t buf[1100];
+    for (uint32_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)i;
+    }
+    s_released = NULL;
+    s_release_calls = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_TRUE(sd_logger_push_from_isr(buf, sizeof(buf), release_buf, &s_release_calls));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(1, s_writes);
+    TEST_ASSERT_EQUAL_UINT32(2U * SD_LOGGER_CHUNK_BYTES, s_write_sizes[0]);
+    TEST_ASSERT_EQUAL(1, s_release_calls);
+    TEST_ASSERT_EQUAL_PTR(buf, s_released);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_EQUAL_UINT32(sizeof(buf), s_disk_size);
+    TEST_ASSERT_EQUAL_MEMORY(buf, s_disk, sizeof(buf));
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.buffers);
+    TEST_ASSERT_EQUAL_UINT32(2U * SD_LOGGER_CHUNK_BYTES, st.direct_bytes);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(buf), st.bytes);
+}
+
+void test_Logger_PoolBuffer_KeepsOrderWithRecords_AndReturnsToPool(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    log_records(2, 50);
+    uint8_t *buf = sd_logger_buf_get();
+    TEST_ASSERT_NOT_NULL(buf);
+    memset(buf, 0xAA, SD_LOGGER_ISR_BUF_BYTES);
+    TEST_ASSERT_TRUE(sd_logger_push_from_isr(buf, SD_LOGGER_ISR_BUF_BYTES, NULL, NULL));
+    log_records(1, 10);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_EQUAL_UINT32(100U + SD_LOGGER_ISR_BUF_BYTES + 10U, s_disk_size);
+    TEST_ASSERT_EQUAL_HEX8(0x02, s_disk[99]);
+    TEST_ASSERT_EQUAL_HEX8(0xAA, s_disk[100]);
+    TEST_ASSERT_EQUAL_HEX8(0xAA, s_disk[100 + SD_LOGGER_ISR_BUF_BYTES - 1]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, s_disk[100 + SD_LOGGER_ISR_BUF_BYTES]);
+
+    /* Both buffers are free again. */
+    void *a = sd_logger_buf_get();
+    void *b = sd_logger_buf_get();
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    sd_logger_buf_put(a);
+    sd_logger_buf_put(b);
+}
+
+void test_Logger_PoolExhausted_ReturnsNullAndCounts(void) {
+    SD_LoggerStats before;
+    sd_logger_get_stats(&before);
+    void *a = sd_logger_buf_get();
+    void *b = sd_logger_buf_get();
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_TRUE(a != b);
+    TEST_ASSERT_EQUAL_UINT32(0U, (uintptr_t)a % SD_DMA_ALIGNMENT);
+    TEST_ASSERT_NULL(sd_logger_buf_get());
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.pool_empty + 1U, st.pool_empty);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.pool_high_water);
+
+    sd_logger_buf_put(b);
+    TEST_ASSERT_EQUAL_PTR(b, sd_logger_buf_get());
+    sd_logger_buf_put(a);
+    sd_logger_buf_put(b);
+}
+
+void test_Logger_PushBuffer_RejectedWhenStopped(void) {
+    uint8_t buf[8];
+    TEST_ASSERT_FALSE(sd_logger_push_from_isr(buf, sizeof(buf), release_buf, NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_FALSE(sd_logger_push_from_isr(NULL, 8, release_buf, NULL));
+    TEST_ASSERT_FALSE(sd_logger_push_from_isr(buf, 0, release_buf, NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Logger_PollBelowChunk_WritesNothing);
+    RUN_TEST(test_Logger_PollAfterChunkFills_WritesWholeChunkInOrder);
+    RUN_TEST(test_Logger_Stop_WritesTailAndCloses);
+
+    RUN_TEST(test_Logger_SyncInterval_FlushesPartialThenRealigns);
+    RUN_TEST(test_Logger_AppendStart_AlignsToExistingSize);
+
+    RUN_TEST(test_Logger_Preallocated_WritesFromZeroAndTruncates);
+
+    RUN_TEST(test_Logger_RingFull_DropsAndCountsHighWater);
+    RUN_TEST(test_Logger_RecordWrapsRingEnd_KeepsBytes);
+    RUN_TEST(test_Logger_BadRecord_Rejected);
+
+    RUN_TEST(test_Logger_PushBuffer_WritesAlignedRunInPlace);
+    RUN_TEST(test_Logger_PoolBuffer_KeepsOrderWithRecords_AndReturnsToPool);
+    RUN_TEST(test_Logger_PoolExhausted_ReturnsNullAndCounts);
+    RUN_TEST(test_Logger_PushBuffer_RejectedWhenStopped);
+
+    return UNITY_END();
+}
@@ -0,0 +1,280 @@
+/*
+ * tests/test_sd_logger_compress.c
+ *
+ * Tests for the logger's compression stage (SD_LOGGER_COMPRESS=1, BLOCK=1024,
+ * RING_BYTES=4096, CHUNK=512, SYNC_MS=100) and sd_logger_unpack. FatFs is
+ * replaced by a one-file fake; the file is decoded back block by block.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_logger.h"
+#include "sd_functions.h"
+#include "sd_spi.h"
+#include <string.h>
+
+/* -----------------------------------------------------------------------
+ * Fake FatFs (single file)
+ * ----------------------------------------------------------------------- */
+
+static uint8_t s_disk[65536];
+static uint32_t s_disk_size;
+static int s_syncs;
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode) {
+    (void)path;
+    (void)mode;
+    fp->fptr = 0;
+    fp->obj.objsize = s_disk_size;
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+    s_disk_size = fp->obj.objsize;
+    return FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+    if (fp->fptr + btw > sizeof(s_disk)) {
+        btw = (UINT)(sizeof(s_disk) - fp->fptr);
+    }
+    memcpy(&s_disk[fp->fptr], buff, btw);
+    fp->fptr += btw;
+    if (fp->fptr > fp->obj.objsize) {
+        fp->obj.objsize = fp->fptr;
+    }
+    *bw = btw;
+    return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+    if (fp->fptr + btr > fp->obj.objsize) {
+        btr = (UINT)(fp->obj.objsize - fp->fptr);
+    }
+    memcpy(buff, &s_disk[fp->fptr], btr);
+    fp->fptr += btr;
+    *br = btr;
+    return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+    fp->fptr = ofs;
+    return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp) {
+    fp->obj.objsize = fp->fptr;
+    return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp) {
+    (void)fp;
+    s_syncs++;
+    return FR_OK;
+}
+
+int sd_preallocate_file(const char *filename, uint32_t bytes) {
+    (void)filename;
+    (void)bytes;
+    return FR_DENIED;
+}
+
+void sd_dirindex_add(const char *path) {
+    (void)path;
+}
+
+static uint8_t s_expect[32768];
+static uint8_t s_decoded[32768];
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(s_disk, 0, sizeof(s_disk));
+    s_disk_size = 0;
+    s_syncs = 0;
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+/* Text telemetry lines with a slowly changing counter; returns the bytes logged. */
+static uint32_t log_telemetry(uint32_t lines) {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < lines; i++) {
+        char line[48];
+        uint32_t len = (uint32_t)snprintf(line, sizeof(line), "T=%06lu,V=3.30,I=0.12,ST=OK\n",
+                                          (unsigned long)(1000U + i));
+        memcpy(&s_expect[total], line, len);
+        total += len;
+        TEST_ASSERT_TRUE(sd_logger_write(line, len));
+        if ((i % 32U) == 31U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    return total;
+}
+
+static uint32_t log_random(uint32_t bytes) {
+    uint32_t x = 0x12345678U;
+    for (uint32_t i = 0; i < bytes; i += 32U) {
+        uint8_t rec[32];
+        for (uint32_t k = 0; k < sizeof(rec); k++) {
+            x = x * 1103515245U + 12345U;
+            rec[k] = (uint8_t)(x >> 24);
+        }
+        memcpy(&s_expect[i], rec, sizeof(rec));
+        TEST_ASSERT_TRUE(sd_logger_write(rec, sizeof(rec)));
+        if ((i % 1024U) == 992U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    return bytes;
+}
+
+/* Decode the whole file; returns the number of blocks. */
+static int decode_file(uint32_t *out_total) {
+    uint32_t pos = 0, total = 0;
+    int blocks = 0;
+    while (pos < s_disk_size) {
+        uint32_t used = 0, n = 0;
+        TEST_ASSERT_EQUAL(FR_OK, sd_logger_unpack(&s_disk[pos], s_disk_size - pos,
+                                                  &s_decoded[total], SD_LOGGER_COMPRESS_BLOCK,
+                                                  &used, &n));
+        pos += used;
+        total += n;
+        blocks++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(s_disk_size, pos);
+    *out_total = total;
+    return blocks;
+}
+
+/* -----------------------------------------------------------------------
+ * Compression stage
+ * ----------------------------------------------------------------------- */
+
+void test_Compress_Telemetry_RoundTripsAndShrinks(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    uint32_t raw = log_telemetry(600);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+
+    uint32_t total = 0;
+    int blocks = decode_file(&total);
+    TEST_ASSERT_EQUAL_UINT32(raw, total);
+    TEST_ASSERT_EQUAL_MEMORY(s_expect, s_decoded, raw);
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)blocks, st.compress_blocks);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.compress_stored);
+    TEST_ASSERT_EQUAL_UINT32(raw, st.compress_in);
+    TEST_ASSERT_EQUAL_UINT32(s_disk_size, st.compress_out);
+    TEST_ASSERT_TRUE(st.compress_in > 3U * st.compress_out);
+}
+
+void test_Compress_RandomData_StoredRaw(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    uint32_t raw = log_random(4096);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.compress_blocks);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.compress_stored);
+    TEST_ASSERT_EQUAL_UINT32(raw + 4U * SD_LOGGER_BLOCK_HEADER, s_disk_size);
+    TEST_ASSERT_EQUAL_HEX8(0x84, s_disk[1]); /* 1024 | stored */
+
+    uint32_t total = 0;
+    (void)decode_file(&total);
+    TEST_ASSERT_EQUAL_UINT32(raw, total);
+    TEST_ASSERT_EQUAL_MEMORY(s_expect, s_decoded, raw);
+}
+
+void test_Compress_BlocksDecodeIndependently(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    uint32_t raw = log_telemetry(200);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_TRUE(raw > 2U * SD_LOGGER_COMPRESS_BLOCK);
+
+    /* Skip the first block and decode the second without it. */
+    uint32_t used = 0, n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_unpack(s_disk, s_disk_size, s_decoded,
+                                              SD_LOGGER_COMPRESS_BLOCK, &used, &n));
+    uint32_t first = used;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_unpack(&s_disk[first], s_disk_size - first, s_decoded,
+                                              SD_LOGGER_COMPRESS_BLOCK, &used, &n));
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_COMPRESS_BLOCK, n);
+    TEST_ASSERT_EQUAL_MEMORY(&s_expect[SD_LOGGER_COMPRESS_BLOCK], s_decoded, n);
+}
+
+void test_Compress_SyncEmitsShortBlock(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("log.bin"));
+    TEST_ASSERT_TRUE(sd_logger_write("T=000001,V=3.30\n", 16));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL_UINT32(0U, s_disk_size);
+
+    mock_hal_set_tick(HAL_GetTick() + SD_LOGGER_SYNC_MS);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    TEST_ASSERT_EQUAL(1, s_syncs);
+
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.compress_blocks);
+    TEST_ASSERT_EQUAL_UINT32(16U, st.compress_in);
+    TEST_ASSERT_EQUAL_UINT8(16U, s_disk[2]); /* raw length */
+}
+
+/* -----------------------------------------------------------------------
+ * sd_logger_unpack
+ * ----------------------------------------------------------------------- */
+
+void test_Unpack_HandWrittenLz4Block(void) {
+    /* "abcabcabcabc" + "XYZWV": 3 literals, match offset 3 length 9, 5 literals. */
+    static const uint8_t blk[] = {12, 0,  17,  0,   0x35, 'a', 'b', 'c', 3,
+                                  0,  0x50, 'X', 'Y', 'Z', 'W', 'V'};
+    uint8_t out[32];
+    uint32_t used = 0, n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_unpack(blk, sizeof(blk), out, sizeof(out), &used, &n));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(blk), used);
+    TEST_ASSERT_EQUAL_UINT32(17U, n);
+    TEST_ASSERT_EQUAL_MEMORY("abcabcabcabcXYZWV", out, 17);
+}
+
+void test_Unpack_MalformedBlocks_Rejected(void) {
+    uint8_t out[32];
+    uint32_t used = 0, n = 0;
+    /* Match offset reaching before the output. */
+    static const uint8_t far[] = {12, 0, 12, 0, 0x30, 'a', 'b', 'c', 9, 0, 0x50, 1, 2, 3, 4, 5};
+    /* Stored length past the input. */
+    static const uint8_t trunc[] = {20, 0x80, 20, 0, 1, 2, 3};
+    /* Raw length larger than out. */
+    static const uint8_t big[] = {1, 0x80, 0xFF, 0x7F, 0};
+
+    TEST_ASSERT_EQUAL(FR_INT_ERR, sd_logger_unpack(far, sizeof(far), out, sizeof(out), &used, &n));
+    TEST_ASSERT_EQUAL(FR_INT_ERR,
+                      sd_logger_unpack(trunc, sizeof(trunc), out, sizeof(out), &used, &n));
+    TEST_ASSERT_EQUAL(FR_INT_ERR, sd_logger_unpack(big, sizeof(big), out, sizeof(out), &used, &n));
+    TEST_ASSERT_EQUAL(FR_INT_ERR, sd_logger_unpack(far, 3, out, sizeof(out), &used, &n));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Compress_Telemetry_RoundTripsAndShrinks);
+    RUN_TEST(test_Compress_RandomData_StoredRaw);
+    RUN_TEST(test_Compress_BlocksDecodeIndependently);
+    RUN_TEST(test_Compress_SyncEmitsShortBlock);
+
+    RUN_TEST(test_Unpack_HandWrittenLz4Block);
+    RUN_TEST(test_Unpack_MalformedBlocks_Rejected);
+
+    return UNITY_END();
+}
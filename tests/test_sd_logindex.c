@@ -0,0 +1,190 @@
+/*
+ * tests/test_sd_logindex.c
+ *
+ * Logger sidecar index over the card emulator: one entry per N records with
+ * the record's key and offset, carried on across an append; a lookup through
+ * a fast-seek open lands on the right record with a handful of sector reads;
+ * keys before the first entry and entries past the end of the log are
+ * handled, and the index is recreated with a new log.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_logindex.img"
+#define CARD_BLOCKS 16384U
+#define EVERY       16U
+
+typedef struct {
+    uint32_t t;
+    uint32_t seq;
+    uint8_t payload[24];
+} rec_t;
+
+static char s_path[4];
+static FIL s_log;
+static FIL s_idx;
+
+static uint32_t rec_key(const void *record, uint32_t len, void *context) {
+    (void)context;
+    TEST_ASSERT_EQUAL_UINT32(sizeof(rec_t), len);
+    uint32_t t;
+    memcpy(&t, record, sizeof(t));
+    return t;
+}
+
+static void log_records(uint32_t first, uint32_t count) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/t.log"));
+    for (uint32_t i = first; i < first + count; i++) {
+        rec_t r;
+        memset(&r, (int)i, sizeof(r));
+        r.t = 1000U + i * 10U;
+        r.seq = i;
+        TEST_ASSERT_TRUE(sd_logger_write(&r, sizeof(r)));
+        if (i % 64U == 63U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+static void open_both(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_fastseek_open(&s_log, "0:/t.log"));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_idx, "0:/t.idx", FA_READ));
+}
+
+static void close_both(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_idx));
+    TEST_ASSERT_EQUAL(FR_OK, sd_fastseek_close(&s_log));
+}
+
+/* Seek to key, then read forward to the record with timestamp t. */
+static uint32_t find(uint32_t t, SD_LoggerIndexEntry *e) {
+    rec_t r;
+    UINT br;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_index_seek(&s_log, &s_idx, t, e));
+    TEST_ASSERT_EQUAL_UINT32(e->offset, (uint32_t)f_tell(&s_log));
+    for (uint32_t n = 0; n < EVERY; n++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_log, &r, sizeof(r), &br));
+        TEST_ASSERT_EQUAL_UINT32(sizeof(r), br);
+        if (r.t == t) {
+            return r.seq;
+        }
+    }
+    TEST_FAIL_MESSAGE("record not within EVERY records of its entry");
+    return 0;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_set_index("0:/t.idx", EVERY, rec_key, NULL));
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+    (void)sd_logger_set_index(NULL, 0U, NULL, NULL);
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LogIndex_LookupJumpsToRecord(void) {
+    log_records(0U, 3000U);
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32((3000U + EVERY - 1U) / EVERY, st.index_entries);
+
+    open_both();
+    TEST_ASSERT_EQUAL_UINT32(st.index_entries * sizeof(SD_LoggerIndexEntry),
+                             (uint32_t)f_size(&s_idx));
+    SD_LoggerIndexEntry e;
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_UINT32(2345U, find(1000U + 2345U * 10U, &e));
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    /* Index sectors for the search plus the log sectors read: no walk from the start. */
+    TEST_ASSERT_TRUE(cs.sectors_read <= 6U);
+    TEST_ASSERT_EQUAL_UINT32(1000U + 2336U * 10U, e.key);
+    TEST_ASSERT_EQUAL_UINT32(2336U * sizeof(rec_t), e.offset);
+
+    /* Between entries, on an entry, before the first, after the last. */
+    TEST_ASSERT_EQUAL_UINT32(17U, find(1170U, &e));
+    TEST_ASSERT_EQUAL_UINT32(16U * sizeof(rec_t), e.offset);
+    TEST_ASSERT_EQUAL_UINT32(0U, find(1000U, &e));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_index_seek(&s_log, &s_idx, 5U, &e));
+    TEST_ASSERT_EQUAL_UINT32(0U, e.offset);
+    TEST_ASSERT_EQUAL_UINT32(2999U, find(1000U + 2999U * 10U, &e));
+    TEST_ASSERT_EQUAL_UINT32(2992U * sizeof(rec_t), e.offset);
+    close_both();
+}
+
+void test_LogIndex_AppendAndRecreate(void) {
+    log_records(0U, 100U);
+    log_records(100U, 100U); /* appended: the index carries on */
+
+    SD_LoggerIndexEntry e;
+    open_both();
+    /* 7 entries from the first run (0..96), 7 from the second (100..196). */
+    TEST_ASSERT_EQUAL_UINT32(14U * sizeof(SD_LoggerIndexEntry), (uint32_t)f_size(&s_idx));
+    TEST_ASSERT_EQUAL_UINT32(150U, find(1000U + 1500U, &e));
+    TEST_ASSERT_EQUAL_UINT32(148U * sizeof(rec_t), e.offset);
+    close_both();
+
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("0:/t.log"));
+    log_records(500U, 20U); /* a new log: the stale index is replaced */
+    open_both();
+    TEST_ASSERT_EQUAL_UINT32(2U * sizeof(SD_LoggerIndexEntry), (uint32_t)f_size(&s_idx));
+    TEST_ASSERT_EQUAL_UINT32(519U, find(1000U + 5190U, &e));
+    TEST_ASSERT_EQUAL_UINT32(16U * sizeof(rec_t), e.offset);
+    close_both();
+}
+
+void test_LogIndex_EntriesPastLogIgnored(void) {
+    log_records(0U, 64U);
+    /* An entry whose record never reached the log, as after a power cut. */
+    UINT bw;
+    uint8_t stale[8] = {0xFF, 0xFF, 0, 0, 0x00, 0x10, 0, 0}; /* key 65535 @ 4096 */
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_idx, "0:/t.idx", FA_WRITE | FA_OPEN_APPEND));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_idx, stale, sizeof(stale), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_idx));
+
+    SD_LoggerIndexEntry e;
+    open_both();
+    TEST_ASSERT_EQUAL_UINT32(63U, find(1630U, &e));
+    TEST_ASSERT_EQUAL_UINT32(48U * sizeof(rec_t), e.offset);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_index_seek(&s_log, &s_idx, 70000U, &e));
+    TEST_ASSERT_EQUAL_UINT32(48U * sizeof(rec_t), e.offset);
+    close_both();
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_idx, "0:/e.idx", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_idx));
+    TEST_ASSERT_EQUAL(FR_OK, sd_fastseek_open(&s_log, "0:/t.log"));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_idx, "0:/e.idx", FA_READ));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_logger_index_seek(&s_log, &s_idx, 1000U, &e));
+    close_both();
+}
+
+void test_LogIndex_Parameters(void) {
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_logger_set_index("0:/t.idx", 0U, NULL, NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/t.log"));
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_logger_set_index(NULL, 0U, NULL, NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LogIndex_LookupJumpsToRecord);
+    RUN_TEST(test_LogIndex_AppendAndRecreate);
+    RUN_TEST(test_LogIndex_EntriesPastLogIgnored);
+    RUN_TEST(test_LogIndex_Parameters);
+    return UNITY_END();
+}
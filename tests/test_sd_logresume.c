@@ -0,0 +1,168 @@
+/*
+ * tests/test_sd_logresume.c
+ *
+ * Logger resume (SD_LOGGER_RESUME=1) over the card emulator, with an array
+ * standing in for the RTC backup registers: a restart appends from the
+ * checkpoint, mid-sector and on a cluster boundary, and the file reads back
+ * whole; a file changed behind the checkpoint, a damaged checkpoint or
+ * another path fall back to the seek and still append correctly.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_logresume.img"
+#define CARD_BLOCKS 16384U
+
+typedef struct {
+    uint32_t seq;
+    uint8_t fill[20];
+} rec_t;
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_file[65536];
+static uint32_t s_regs[SD_LOGGER_BACKUP_WORDS];
+static uint32_t s_writes;
+
+static uint32_t bkp_read(uint32_t index, void *context) {
+    TEST_ASSERT_EQUAL_PTR(s_regs, context);
+    TEST_ASSERT_TRUE(index < SD_LOGGER_BACKUP_WORDS);
+    return s_regs[index];
+}
+
+static void bkp_write(uint32_t index, uint32_t value, void *context) {
+    TEST_ASSERT_EQUAL_PTR(s_regs, context);
+    TEST_ASSERT_TRUE(index < SD_LOGGER_BACKUP_WORDS);
+    s_regs[index] = value;
+    s_writes++;
+}
+
+static rec_t make(uint32_t seq) {
+    rec_t r;
+    memset(&r, (int)seq, sizeof(r));
+    r.seq = seq;
+    return r;
+}
+
+/* Log records first..first+count-1 in one run; returns whether it resumed. */
+static uint32_t log_records(const char *path, uint32_t first, uint32_t count) {
+    SD_LoggerStats st;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start(path));
+    sd_logger_get_stats(&st);
+    for (uint32_t i = first; i < first + count; i++) {
+        rec_t r = make(i);
+        TEST_ASSERT_TRUE(sd_logger_write(&r, sizeof(r)));
+        if (i % 40U == 39U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    return st.resumed;
+}
+
+static void check_file(const char *path, uint32_t count) {
+    UINT br = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_file, sizeof(s_file), &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT32(count * sizeof(rec_t), br);
+    for (uint32_t i = 0; i < count; i++) {
+        rec_t want = make(i);
+        TEST_ASSERT_EQUAL_MEMORY(&want, &s_file[i * sizeof(rec_t)], sizeof(want));
+    }
+}
+
+void setUp(void) {
+    const SD_LoggerBackup backup = {bkp_read, bkp_write, s_regs};
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    memset(s_regs, 0, sizeof(s_regs));
+    s_writes = 0;
+    sd_logger_set_backup(&backup);
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+    sd_logger_set_backup(NULL);
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LogResume_AppendsFromCheckpoint(void) {
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/r.log", 0U, 700U));
+    TEST_ASSERT_TRUE(s_writes > 0U);
+    SD_LoggerStats st;
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_TRUE(st.checkpoint_seq > 0U);
+    uint32_t seq = st.checkpoint_seq;
+
+    /* 700 * 24 bytes ends mid-sector: the restart picks up that sector. */
+    TEST_ASSERT_EQUAL_UINT32(1U, log_records("0:/r.log", 700U, 333U));
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_TRUE(st.checkpoint_seq > seq);
+    TEST_ASSERT_EQUAL_UINT32(1U, log_records("0:/r.log", 1033U, 500U));
+    check_file("0:/r.log", 1533U);
+
+    /* A remount in between (as after a reset) changes nothing. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL_UINT32(1U, log_records("0:/r.log", 1533U, 100U));
+    check_file("0:/r.log", 1633U);
+}
+
+void test_LogResume_ClusterBoundary(void) {
+    /* 128 * 24 bytes = 3 clusters exactly: the next write starts a new cluster. */
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/b.log", 0U, 128U));
+    TEST_ASSERT_EQUAL_UINT32(1U, log_records("0:/b.log", 128U, 128U));
+    TEST_ASSERT_EQUAL_UINT32(1U, log_records("0:/b.log", 256U, 10U));
+    check_file("0:/b.log", 266U);
+}
+
+void test_LogResume_FallsBackWhenStale(void) {
+    UINT bw;
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/r.log", 0U, 100U));
+
+    /* Changed behind the checkpoint: a record appended by someone else. */
+    rec_t r = make(100U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/r.log", FA_WRITE | FA_OPEN_APPEND));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, &r, sizeof(r), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/r.log", 101U, 99U));
+    check_file("0:/r.log", 200U);
+
+    /* A damaged word. */
+    s_regs[3] ^= 1U;
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/r.log", 200U, 50U));
+    check_file("0:/r.log", 250U);
+
+    /* Another path does not take this file's checkpoint. */
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/s.log", 0U, 30U));
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/r.log", 250U, 50U));
+    check_file("0:/r.log", 300U);
+    check_file("0:/s.log", 30U);
+
+    /* Without a store nothing is kept. */
+    sd_logger_set_backup(NULL);
+    s_writes = 0;
+    TEST_ASSERT_EQUAL_UINT32(0U, log_records("0:/r.log", 300U, 10U));
+    TEST_ASSERT_EQUAL_UINT32(0U, s_writes);
+    check_file("0:/r.log", 310U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LogResume_AppendsFromCheckpoint);
+    RUN_TEST(test_LogResume_ClusterBoundary);
+    RUN_TEST(test_LogResume_FallsBackWhenStale);
+    return UNITY_END();
+}
@@ -0,0 +1,227 @@
+/*
+ * tests/test_sd_logsink.c
+ *
+ * Non-blocking log sink (SD_LOGSINK_ENABLED=1, 256-byte ring, 48-byte lines,
+ * 64-byte transmit blocks, SD_LOG_LEVEL=INFO): messages wait in the ring
+ * until a transport takes them one block at a time; run-time and compile-time
+ * level filtering; a full ring drops and counts; a busy transport is retried;
+ * the HAL UART DMA glue and its callbacks.
+ */
+
+/* Tests build with SD_LOG_ENABLED=0; turn the driver macros on for this file. */
+#undef SD_LOG_ENABLED
+#define SD_LOG_ENABLED 1
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_logsink.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static char s_sent[2048];   // Everything the transport accepted
+static uint32_t s_sent_len;
+static uint32_t s_calls;
+static uint32_t s_last_len;
+static bool s_accept;
+
+static bool capture(const uint8_t *data, uint32_t len, void *context) {
+    TEST_ASSERT_EQUAL_PTR(&s_calls, context);
+    if (!s_accept) {
+        return false;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(SD_LOGSINK_TX_BYTES, len);
+    memcpy(&s_sent[s_sent_len], data, len);
+    s_sent_len += len;
+    s_sent[s_sent_len] = '\0';
+    s_last_len = len;
+    s_calls++;
+    return true;
+}
+
+static SD_LogSinkStats stats(void) {
+    SD_LogSinkStats out;
+    sd_logsink_get_stats(&out);
+    return out;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    sd_logsink_set_sink(NULL, NULL);
+    sd_logsink_reset();
+    s_sent_len = 0;
+    s_sent[0] = '\0';
+    s_calls = 0;
+    s_last_len = 0;
+    s_accept = true;
+}
+
+void tearDown(void) {
+    sd_logsink_set_sink(NULL, NULL);
+}
+
+void test_LogSink_QueuesUntilSinkThenSendsBlockByBlock(void) {
+    /* No transport yet: nothing is lost, nothing waits. */
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "mount %s\r\n", "0:/");
+    sd_logsink_printf(SD_LOG_LEVEL_ERROR, "open failed: %d\r\n", 4);
+    TEST_ASSERT_EQUAL_UINT32(2U, stats().messages);
+
+    sd_logsink_set_sink(capture, &s_calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, s_calls);
+    TEST_ASSERT_EQUAL_STRING("mount 0:/\r\nopen failed: 4\r\n", s_sent);
+
+    /* While the block is in flight, new messages only queue. */
+    for (uint32_t i = 0; i < 6U; i++) {
+        sd_logsink_printf(SD_LOG_LEVEL_INFO, "wrote %03lu bytes\r\n", (unsigned long)(i * 100U));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1U, s_calls);
+
+    /* Each completion hands over the next block of whole messages. */
+    sd_logsink_tx_done();
+    TEST_ASSERT_EQUAL_UINT32(2U, s_calls);
+    TEST_ASSERT_EQUAL_UINT32(3U * 17U, s_last_len); /* three 17-byte lines fit in 64 */
+    sd_logsink_tx_done();
+    TEST_ASSERT_EQUAL_UINT32(3U, s_calls);
+    sd_logsink_tx_done();
+    TEST_ASSERT_EQUAL_UINT32(3U, s_calls);
+    TEST_ASSERT_NOT_NULL(strstr(s_sent, "wrote 000 bytes\r\nwrote 100 bytes\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(s_sent, "wrote 500 bytes\r\n"));
+    TEST_ASSERT_TRUE(sd_logsink_flush(0U));
+
+    SD_LogSinkStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(8U, st.messages);
+    TEST_ASSERT_EQUAL_UINT32(s_sent_len, st.bytes);
+    TEST_ASSERT_EQUAL_UINT32(s_sent_len, st.sent_bytes);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.transfers);
+}
+
+void test_LogSink_LevelFiltering(void) {
+    sd_logsink_set_sink(capture, &s_calls);
+    TEST_ASSERT_EQUAL_UINT8(SD_LOG_LEVEL_INFO, sd_logsink_get_level());
+
+    sd_logsink_set_level(SD_LOG_LEVEL_WARN);
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "chatter\r\n");
+    TEST_ASSERT_FALSE(sd_logsink_write(SD_LOG_LEVEL_INFO, "more\r\n", 6U));
+    TEST_ASSERT_TRUE(sd_logsink_write(SD_LOG_LEVEL_WARN, "slow\r\n", 6U));
+    TEST_ASSERT_FALSE(sd_logsink_write(SD_LOG_LEVEL_NONE, "none\r\n", 6U));
+    TEST_ASSERT_EQUAL_STRING("slow\r\n", s_sent);
+    TEST_ASSERT_EQUAL_UINT32(3U, stats().filtered);
+
+    /* The run-time filter cannot open levels that were compiled out. */
+    sd_logsink_set_level(SD_LOG_LEVEL_DEBUG);
+    TEST_ASSERT_EQUAL_UINT8(SD_LOG_LEVEL_INFO, sd_logsink_get_level());
+
+    /* Driver macros: SD_LOG is DEBUG (not compiled here), SD_LOG_ERROR is ERROR. */
+    sd_logsink_tx_done();
+    SD_LOG("SD: detail %d\r\n", 1);
+    SD_LOG_ERROR("SD: timeout on CMD%d\r\n", 17);
+    TEST_ASSERT_EQUAL_STRING("slow\r\nSD: timeout on CMD17\r\n", s_sent);
+    TEST_ASSERT_EQUAL_UINT32(3U, stats().filtered);
+
+    sd_logsink_set_level(SD_LOG_LEVEL_NONE);
+    SD_LOG_ERROR("SD: muted\r\n");
+    TEST_ASSERT_EQUAL_UINT32(4U, stats().filtered);
+}
+
+void test_LogSink_FullRingDropsAndLongLinesAreCut(void) {
+    static const char line[] = "0123456789012345678901234567890123456789012345\r\n"; /* 48 */
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < 10U; i++) {
+        accepted += sd_logsink_write(SD_LOG_LEVEL_ERROR, line, 48U) ? 1U : 0U;
+    }
+    /* 52 ring bytes per message: four fit in 256. */
+    SD_LogSinkStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(4U, accepted);
+    TEST_ASSERT_EQUAL_UINT32(6U, st.dropped);
+    TEST_ASSERT_EQUAL_UINT32(6U * 48U, st.dropped_bytes);
+    TEST_ASSERT_EQUAL_UINT32(4U * 52U, st.ring_high_water);
+
+    sd_logsink_set_sink(capture, &s_calls);
+    while (s_calls < 4U) {
+        sd_logsink_tx_done();
+    }
+    TEST_ASSERT_EQUAL_UINT32(4U * 48U, s_sent_len);
+
+    /* Formatted past SD_LOGSINK_LINE_MAX: the first 48 bytes go out. */
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "%s%s", line, "tail");
+    TEST_ASSERT_EQUAL_UINT32(1U, stats().truncated);
+    sd_logsink_tx_done();
+    TEST_ASSERT_EQUAL_MEMORY(line, &s_sent[4U * 48U], 48U);
+    TEST_ASSERT_EQUAL_UINT32(5U * 48U, s_sent_len);
+}
+
+void test_LogSink_BusyTransportIsOfferedAgain(void) {
+    s_accept = false;
+    sd_logsink_set_sink(capture, &s_calls);
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "first\r\n");
+    TEST_ASSERT_EQUAL_UINT32(0U, s_calls);
+    TEST_ASSERT_FALSE(sd_logsink_flush(0U));
+    sd_logsink_tx_done(); /* nothing in flight: ignored */
+
+    /* The staged block goes first; the message behind it follows on completion. */
+    s_accept = true;
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "second\r\n");
+    TEST_ASSERT_EQUAL_UINT32(1U, s_calls);
+    TEST_ASSERT_EQUAL_STRING("first\r\n", s_sent);
+    sd_logsink_tx_done();
+    TEST_ASSERT_EQUAL_STRING("first\r\nsecond\r\n", s_sent);
+    TEST_ASSERT_FALSE(sd_logsink_flush(0U)); /* still in flight */
+    sd_logsink_tx_done();
+    TEST_ASSERT_TRUE(sd_logsink_flush(0U));
+
+    sd_logsink_set_sink(NULL, NULL);
+    TEST_ASSERT_FALSE(sd_logsink_flush(10U));
+}
+
+void test_LogSink_UartDmaAndCallbacks(void) {
+    UART_HandleTypeDef huart = {2U, HAL_UART_STATE_READY};
+    UART_HandleTypeDef other = {1U, HAL_UART_STATE_READY};
+    size_t len = 0;
+    sd_logsink_use_uart(&huart);
+
+    SD_LOG_ERROR("SD: CRC error\r\n");
+    const uint8_t *log = mock_hal_uart_log(&len);
+    TEST_ASSERT_EQUAL_UINT32(15U, len);
+    TEST_ASSERT_EQUAL_MEMORY("SD: CRC error\r\n", log, 15U);
+    TEST_ASSERT_EQUAL(HAL_UART_STATE_BUSY_TX, huart.gState);
+
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "retry\r\n");
+    TEST_ASSERT_EQUAL_INT(1, mock_hal_uart_tx_calls);
+
+    /* Another UART's callback, or an RX error while TX runs, changes nothing. */
+    sd_logsink_uart_tx_cplt(&other);
+    sd_logsink_uart_error(&huart);
+    TEST_ASSERT_EQUAL_INT(1, mock_hal_uart_tx_calls);
+
+    huart.gState = HAL_UART_STATE_READY;
+    sd_logsink_uart_tx_cplt(&huart);
+    TEST_ASSERT_EQUAL_INT(2, mock_hal_uart_tx_calls);
+    (void)mock_hal_uart_log(&len);
+    TEST_ASSERT_EQUAL_UINT32(22U, len);
+
+    /* A TX error that aborted the transfer frees the block. */
+    huart.gState = HAL_UART_STATE_READY;
+    sd_logsink_uart_error(&huart);
+    TEST_ASSERT_TRUE(sd_logsink_flush(0U));
+    TEST_ASSERT_EQUAL_UINT32(22U, stats().sent_bytes);
+
+    /* A HAL refusal keeps the message for the next attempt. */
+    mock_hal_set_uart_return(HAL_ERROR);
+    sd_logsink_printf(SD_LOG_LEVEL_INFO, "later\r\n");
+    TEST_ASSERT_EQUAL_INT(2, mock_hal_uart_tx_calls);
+    mock_hal_set_uart_return(HAL_OK);
+    TEST_ASSERT_FALSE(sd_logsink_flush(0U));
+    TEST_ASSERT_EQUAL_INT(3, mock_hal_uart_tx_calls);
+    sd_logsink_use_uart(NULL);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_LogSink_QueuesUntilSinkThenSendsBlockByBlock);
+    RUN_TEST(test_LogSink_LevelFiltering);
+    RUN_TEST(test_LogSink_FullRingDropsAndLongLinesAreCut);
+    RUN_TEST(test_LogSink_BusyTransportIsOfferedAgain);
+    RUN_TEST(test_LogSink_UartDmaAndCallbacks);
+
+    return UNITY_END();
+}
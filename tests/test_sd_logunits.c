@@ -0,0 +1,131 @@
+/*
+ * tests/test_sd_logunits.c
+ *
+ * Logger chunks sized to the card's recording unit (SD_LOGGER_CARD_UNITS=1,
+ * SD_CARD_INFO=1, SD_LOGGER_CHUNK_BYTES=32768) over the card emulator: a
+ * Class 10 card takes the full chunk, a Class 4 card its 16 KiB unit, the
+ * cluster caps file-mode chunks, a card without a speed class keeps the
+ * compile-time size, and raw mode puts chunk boundaries on card addresses.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_logunits.img"
+#define CARD_BLOCKS 16384U
+#define RECORD      256U
+#define RAW_FIRST   13001U /* data from block 13002 = 10 blocks past a 16 KiB boundary */
+#define RAW_BLOCKS  1024U
+
+static char s_path[4];
+static FATFS *s_fs;
+
+static void mount(uint32_t cluster_bytes) {
+    static uint8_t work[_MAX_SS];
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT | FM_SFD, cluster_bytes, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    DWORD free_clusters;
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &free_clusters, &s_fs));
+}
+
+static void log_bytes(uint32_t bytes) {
+    uint8_t rec[RECORD];
+    for (uint32_t i = 0; i < bytes / RECORD; i++) {
+        memset(rec, (int)i, sizeof(rec));
+        TEST_ASSERT_TRUE(sd_logger_write(rec, sizeof(rec)));
+        if (i % 32U == 31U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+}
+
+static void check_file_session(uint32_t chunk, uint32_t unit) {
+    SD_LoggerStats st;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/u.log"));
+    log_bytes(4U * 32768U);
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(chunk, st.chunk_bytes);
+    TEST_ASSERT_EQUAL_UINT32(unit, st.unit_bytes);
+    TEST_ASSERT_EQUAL_UINT32(((uint64_t)s_fs->database * 512U) % chunk == 0U, st.unit_aligned);
+    TEST_ASSERT_EQUAL_UINT32(4U * 32768U / chunk, st.chunks);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_LogUnits_Class10_TakesFullChunk(void) {
+    mount(32768U);
+    check_file_session(32768U, 512U * 1024U);
+}
+
+void test_LogUnits_Class4_ChunkIsTheUnit(void) {
+    mock_card_set_speed(2U, 0U, 0U); /* Class 4 */
+    mount(32768U);
+    check_file_session(16384U, 16384U);
+}
+
+void test_LogUnits_SmallClusters_CapFileChunks(void) {
+    mount(4096U);
+    check_file_session(4096U, 512U * 1024U);
+}
+
+void test_LogUnits_NoSpeedClass_KeepsCompiledChunk(void) {
+    SD_LoggerStats st;
+    mock_card_set_speed(0U, 0U, 0U);
+    mount(32768U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start("0:/u.log"));
+    sd_logger_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(SD_LOGGER_CHUNK_BYTES, st.chunk_bytes);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.unit_bytes);
+}
+
+void test_LogUnits_Raw_ChunksEndOnCardBoundaries(void) {
+    SD_LoggerStats st;
+    mock_card_stats_t card;
+    mock_card_set_speed(2U, 0U, 0U);
+    mount(4096U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(SD_DiskHandle(0), RAW_FIRST, RAW_BLOCKS));
+
+    /* The first chunk only runs up to the next 16 KiB card address. */
+    uint32_t head = (32U - ((RAW_FIRST + 1U) % 32U)) * 512U;
+    mock_card_reset_stats();
+    log_bytes(head + 16384U);
+    sd_logger_get_stats(&st);
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(16384U, st.chunk_bytes);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.unit_aligned);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.chunks);
+    TEST_ASSERT_EQUAL_UINT32(head + 16384U, st.file_bytes);
+    TEST_ASSERT_EQUAL_UINT32((head + 16384U) / 512U, card.sectors_written);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_LogUnits_Class10_TakesFullChunk);
+    RUN_TEST(test_LogUnits_Class4_ChunkIsTheUnit);
+    RUN_TEST(test_LogUnits_SmallClusters_CapFileChunks);
+    RUN_TEST(test_LogUnits_NoSpeedClass_KeepsCompiledChunk);
+    RUN_TEST(test_LogUnits_Raw_ChunksEndOnCardBoundaries);
+    return UNITY_END();
+}
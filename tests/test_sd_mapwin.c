@@ -0,0 +1,145 @@
+/*
+ * tests/test_sd_mapwin.c
+ *
+ * sd_map_window against the card emulator on FAT16 with 4 KB clusters: a
+ * cluster-sized window serves lookups inside it without card traffic, moves
+ * cluster by cluster on a scan and slides for a range crossing its end; a
+ * three-sector buffer; the end of the file, oversized ranges and parameters.
+ * Every pointer must see the bytes f_write stored.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_mapwin.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_mapwin.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+#define CLUSTER     4096U
+#define FILE_BYTES  40000U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_window[2U * CLUSTER] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static uint8_t pattern(uint32_t i) {
+    return (uint8_t)((i * 11U) + (i >> 9));
+}
+
+void setUp(void) {
+    static uint8_t chunk[1000];
+    UINT bw = 0;
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "cal.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t pos = 0; pos < FILE_BYTES; pos += sizeof(chunk)) {
+        for (uint32_t i = 0; i < sizeof(chunk); i++) {
+            chunk[i] = pattern(pos + i);
+        }
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, chunk, sizeof(chunk), &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "cal.bin", FA_READ));
+}
+
+void tearDown(void) {
+    (void)f_close(&s_fil);
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static void assert_bytes(const uint8_t *p, uint32_t offset, uint32_t len) {
+    TEST_ASSERT_NOT_NULL(p);
+    for (uint32_t i = 0; i < len; i++) {
+        TEST_ASSERT_EQUAL_HEX8(pattern(offset + i), p[i]);
+    }
+}
+
+void test_MapWindow_HitsInsideClusterWithoutCardTraffic(void) {
+    SD_MapWindow map;
+    mock_card_stats_t card;
+    TEST_ASSERT_EQUAL(FR_OK, sd_map_init(&map, &s_fil, s_window, sizeof(s_window)));
+    TEST_ASSERT_EQUAL_UINT32(CLUSTER, map.size);
+
+    assert_bytes(sd_map_window(&map, 5000U, 16U), 5000U, 16U);
+    TEST_ASSERT_EQUAL_UINT32(CLUSTER, (uint32_t)map.start);
+    mock_card_reset_stats();
+    assert_bytes(sd_map_window(&map, 4096U, 4U), 4096U, 4U);
+    assert_bytes(sd_map_window(&map, 8191U, 1U), 8191U, 1U);
+    assert_bytes(sd_map_window(&map, 6000U, 100U), 6000U, 100U);
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(0U, card.sectors_read);
+    TEST_ASSERT_EQUAL_UINT32(3U, map.stats.hits);
+    TEST_ASSERT_EQUAL_UINT32(1U, map.stats.loads);
+
+    /* A jump back to the first cluster and on to the last, partial one. */
+    assert_bytes(sd_map_window(&map, 10U, 8U), 10U, 8U);
+    assert_bytes(sd_map_window(&map, FILE_BYTES - 8U, 8U), FILE_BYTES - 8U, 8U);
+    TEST_ASSERT_EQUAL_UINT32(FILE_BYTES % CLUSTER, map.valid);
+    TEST_ASSERT_EQUAL_UINT32(3U, map.stats.loads);
+    TEST_ASSERT_EQUAL_UINT32(0U, map.stats.slides);
+}
+
+void test_MapWindow_ScanReadsEverySectorOnceAndSlides(void) {
+    SD_MapWindow map;
+    mock_card_stats_t card;
+    TEST_ASSERT_EQUAL(FR_OK, sd_map_init(&map, &s_fil, s_window, CLUSTER));
+    mock_card_reset_stats();
+    for (uint32_t off = 0; off + 32U <= 3U * CLUSTER; off += 32U) {
+        assert_bytes(sd_map_window(&map, off, 32U), off, 32U);
+    }
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_UINT32(3U * CLUSTER / 512U + 1U, card.sectors_read); /* + one FAT sector */
+    TEST_ASSERT_EQUAL_UINT32(3U, map.stats.loads);
+
+    /* A record across the cluster boundary: the window slides to its sector. */
+    assert_bytes(sd_map_window(&map, 3U * CLUSTER - 10U, 20U), 3U * CLUSTER - 10U, 20U);
+    TEST_ASSERT_EQUAL_UINT32(3U * CLUSTER - 512U, (uint32_t)map.start);
+    TEST_ASSERT_EQUAL_UINT32(1U, map.stats.slides);
+    TEST_ASSERT_EQUAL_UINT32(3U * CLUSTER + CLUSTER - 512U, map.stats.bytes_read); /* kept 512 */
+}
+
+void test_MapWindow_SmallBufferAndLimits(void) {
+    SD_MapWindow map;
+    TEST_ASSERT_EQUAL(FR_OK, sd_map_init(&map, &s_fil, s_window, 1600U));
+    TEST_ASSERT_EQUAL_UINT32(1536U, map.size);
+    assert_bytes(sd_map_window(&map, 1600U, 300U), 1600U, 300U);
+    TEST_ASSERT_EQUAL_UINT32(1536U, (uint32_t)map.start);
+    assert_bytes(sd_map_window(&map, 1000U, 1000U), 1000U, 1000U);
+    TEST_ASSERT_EQUAL_UINT32(512U, (uint32_t)map.start);
+
+    /* Past the end, more than the window holds from offset's sector, zero length. */
+    TEST_ASSERT_NULL(sd_map_window(&map, FILE_BYTES - 4U, 8U));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, map.err);
+    TEST_ASSERT_NULL(sd_map_window(&map, 100U, 1500U));
+    TEST_ASSERT_NULL(sd_map_window(&map, 100U, 0U));
+    assert_bytes(sd_map_window(&map, 0U, 1536U), 0U, 1536U);
+    TEST_ASSERT_EQUAL(FR_OK, map.err);
+
+    sd_map_invalidate(&map);
+    uint32_t loads = map.stats.loads;
+    assert_bytes(sd_map_window(&map, 0U, 4U), 0U, 4U);
+    TEST_ASSERT_EQUAL_UINT32(loads + 1U, map.stats.loads);
+
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_map_init(&map, &s_fil, s_window, 511U));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_map_init(&map, NULL, s_window, 4096U));
+    TEST_ASSERT_NULL(sd_map_window(NULL, 0U, 4U));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_MapWindow_HitsInsideClusterWithoutCardTraffic);
+    RUN_TEST(test_MapWindow_ScanReadsEverySectorOnceAndSlides);
+    RUN_TEST(test_MapWindow_SmallBufferAndLimits);
+
+    return UNITY_END();
+}
@@ -0,0 +1,113 @@
+/*
+ * tests/test_sd_mem.c
+ *
+ * Tests for sd_mem copy/fill/compare, built once per SD_MEM_ROUTINES
+ * implementation: every destination and source alignment, lengths around
+ * the word and 16-byte steps, guard bytes either side.
+ */
+
+#include "unity.h"
+#include "sd_mem.h"
+#include <string.h>
+
+#define GUARD 0xEEU
+
+static uint8_t s_src[600];
+static uint8_t s_dst[600];
+
+static const uint32_t s_lengths[] = {0, 1, 2, 3, 4, 5, 7, 11, 15, 16, 17, 31, 32, 33, 63, 511, 512};
+
+void setUp(void) {
+    for (uint32_t i = 0; i < sizeof(s_src); i++) {
+        s_src[i] = (uint8_t)((i * 7U + 3U) & 0x7FU); /* +1 never wraps */
+    }
+    memset(s_dst, GUARD, sizeof(s_dst));
+}
+
+void tearDown(void) {
+}
+
+static void check_guards(uint32_t start, uint32_t len) {
+    for (uint32_t i = 0; i < start; i++) {
+        TEST_ASSERT_EQUAL_HEX8(GUARD, s_dst[i]);
+    }
+    for (uint32_t i = start + len; i < sizeof(s_dst); i++) {
+        TEST_ASSERT_EQUAL_HEX8(GUARD, s_dst[i]);
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * sd_mem_copy / sd_mem_set
+ * ----------------------------------------------------------------------- */
+
+void test_Copy_AllAlignmentsAndLengths(void) {
+    for (uint32_t d = 0; d < 4U; d++) {
+        for (uint32_t s = 0; s < 4U; s++) {
+            for (size_t k = 0; k < sizeof(s_lengths) / sizeof(s_lengths[0]); k++) {
+                uint32_t n = s_lengths[k];
+                memset(s_dst, GUARD, sizeof(s_dst));
+                sd_mem_copy(&s_dst[8 + d], &s_src[s], n);
+                if (n > 0U) {
+                    TEST_ASSERT_EQUAL_MEMORY(&s_src[s], &s_dst[8 + d], n);
+                }
+                check_guards(8 + d, n);
+            }
+        }
+    }
+}
+
+void test_Set_AllAlignmentsAndLengths(void) {
+    uint8_t ref[600];
+    memset(ref, 0xA5, sizeof(ref));
+    for (uint32_t d = 0; d < 4U; d++) {
+        for (size_t k = 0; k < sizeof(s_lengths) / sizeof(s_lengths[0]); k++) {
+            uint32_t n = s_lengths[k];
+            memset(s_dst, GUARD, sizeof(s_dst));
+            sd_mem_set(&s_dst[8 + d], 0x1A5, n); /* only the low byte counts */
+            if (n > 0U) {
+                TEST_ASSERT_EQUAL_MEMORY(ref, &s_dst[8 + d], n);
+            }
+            check_guards(8 + d, n);
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * sd_mem_cmp
+ * ----------------------------------------------------------------------- */
+
+void test_Cmp_EqualRegions_ReturnZero(void) {
+    memcpy(&s_dst[1], s_src, 512);
+    TEST_ASSERT_EQUAL_INT(0, sd_mem_cmp(&s_dst[1], s_src, 512));
+    TEST_ASSERT_EQUAL_INT(0, sd_mem_cmp(&s_dst[1], s_src, 0));
+    TEST_ASSERT_EQUAL_INT(0, sd_mem_cmp("EXFAT   ", "EXFAT   ", 8));
+}
+
+void test_Cmp_FindsEveryDifferencePosition_WithItsSign(void) {
+    for (uint32_t off = 0; off < 4U; off++) {
+        for (uint32_t pos = 0; pos < 40U; pos++) {
+            memcpy(&s_dst[off], s_src, 40);
+            s_dst[off + pos] = (uint8_t)(s_src[pos] + 1U);
+            TEST_ASSERT_TRUE(sd_mem_cmp(&s_dst[off], s_src, 40) > 0);
+            TEST_ASSERT_TRUE(sd_mem_cmp(s_src, &s_dst[off], 40) < 0);
+            /* A difference past cnt is not seen. */
+            TEST_ASSERT_EQUAL_INT(0, sd_mem_cmp(&s_dst[off], s_src, pos));
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Copy_AllAlignmentsAndLengths);
+    RUN_TEST(test_Set_AllAlignmentsAndLengths);
+
+    RUN_TEST(test_Cmp_EqualRegions_ReturnZero);
+    RUN_TEST(test_Cmp_FindsEveryDifferencePosition_WithItsSign);
+
+    return UNITY_END();
+}
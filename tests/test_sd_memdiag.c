@@ -0,0 +1,123 @@
+/*
+ * tests/test_sd_memdiag.c
+ *
+ * RAM diagnostics in a bare-metal build (SD_POOL_FILS=2, SD_POOL_DIRS=1,
+ * SD_CACHE_ENABLED=1 with 4 lines, logger ring 2048 bytes, 2 ISR buffers of
+ * 256 bytes): pool sizes and peaks in bytes, the logger ring's high-water
+ * mark, the cache counted as full, truncation to max, and no tasks or heap
+ * without FreeRTOS.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_logger.h"
+#include "sd_memdiag.h"
+#include "sd_pool.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_memdiag.img"
+#define CARD_BLOCKS 1024U
+#define RAW_FIRST   100U
+#define RAW_BLOCKS  9U
+
+static SD_MemPool s_pools[SD_MEMDIAG_POOLS];
+
+/* sd_functions.c is not linked; the logger's file mode calls this. */
+void sd_dirindex_add(const char *path) {
+    (void)path;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    sd_pool_reset_stats();
+}
+
+void tearDown(void) {
+}
+
+static const SD_MemPool *pool(const char *name) {
+    TEST_ASSERT_EQUAL_UINT32(SD_MEMDIAG_POOLS, sd_memdiag_pools(s_pools, SD_MEMDIAG_POOLS));
+    for (uint32_t i = 0; i < SD_MEMDIAG_POOLS; i++) {
+        if (strcmp(s_pools[i].name, name) == 0) {
+            return &s_pools[i];
+        }
+    }
+    TEST_FAIL_MESSAGE("pool not listed");
+    return NULL;
+}
+
+void test_MemDiag_PoolPeakFollowsHighWater(void) {
+    FIL *a = sd_pool_fil_get();
+    FIL *b = sd_pool_fil_get();
+    TEST_ASSERT_NOT_NULL(b);
+    sd_pool_fil_put(a);
+    sd_pool_fil_put(b);
+
+    const SD_MemPool *fil = pool("fil");
+    TEST_ASSERT_EQUAL_UINT32(2U * sizeof(FIL), fil->bytes);
+    TEST_ASSERT_EQUAL_UINT32(2U * sizeof(FIL), fil->peak);
+    const SD_MemPool *dir = pool("dir");
+    TEST_ASSERT_EQUAL_UINT32(sizeof(DIR), dir->bytes);
+    TEST_ASSERT_EQUAL_UINT32(0U, dir->peak);
+    TEST_ASSERT_EQUAL_UINT32(0U, pool("filinfo")->bytes);
+}
+
+void test_MemDiag_LoggerRingHighWater(void) {
+    static uint8_t rec[200];
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(SD_DiskHandle(0), RAW_FIRST, RAW_BLOCKS));
+    memset(rec, 0x5A, sizeof(rec));
+    TEST_ASSERT_TRUE(sd_logger_write(rec, sizeof(rec)));
+    TEST_ASSERT_TRUE(sd_logger_write(rec, sizeof(rec)));
+
+    const SD_MemPool *ring = pool("log_ring");
+    TEST_ASSERT_EQUAL_UINT32(2048U, ring->bytes);
+    TEST_ASSERT_TRUE(ring->peak >= 2U * sizeof(rec));
+    TEST_ASSERT_TRUE(ring->peak < 2048U);
+    TEST_ASSERT_EQUAL_UINT32(512U, pool("log_bufs")->bytes);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    mock_card_close();
+}
+
+void test_MemDiag_CacheCountedAsFull(void) {
+    const SD_MemPool *cache = pool("cache");
+    TEST_ASSERT_EQUAL_UINT32(4U * SD_BLOCK_SIZE, cache->bytes);
+    TEST_ASSERT_EQUAL_UINT32(cache->bytes, cache->peak);
+}
+
+void test_MemDiag_TruncatesToMax(void) {
+    SD_MemPool two[2];
+    TEST_ASSERT_EQUAL_UINT32(2U, sd_memdiag_pools(two, 2));
+    TEST_ASSERT_EQUAL_STRING("fil", two[0].name);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd_memdiag_pools(NULL, 2));
+}
+
+void test_MemDiag_BareMetalHasNoTasksOrHeap(void) {
+    SD_MemTask tasks[SD_MEMDIAG_MAX_TASKS];
+    SD_MemHeap heap;
+    memset(&heap, 0xFF, sizeof(heap));
+    TEST_ASSERT_EQUAL_UINT32(0U, sd_memdiag_tasks(tasks, SD_MEMDIAG_MAX_TASKS));
+    sd_memdiag_heap(&heap);
+    TEST_ASSERT_EQUAL_UINT32(0U, heap.total);
+    TEST_ASSERT_EQUAL_UINT32(0U, heap.free_min);
+    sd_memdiag_report(); /* prints; must not fault */
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_MemDiag_PoolPeakFollowsHighWater);
+    RUN_TEST(test_MemDiag_LoggerRingHighWater);
+    RUN_TEST(test_MemDiag_CacheCountedAsFull);
+    RUN_TEST(test_MemDiag_TruncatesToMax);
+    RUN_TEST(test_MemDiag_BareMetalHasNoTasksOrHeap);
+
+    return UNITY_END();
+}
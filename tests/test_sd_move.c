@@ -0,0 +1,124 @@
+/*
+ * tests/test_sd_move.c
+ *
+ * Moves between directories through sd_mount on the card emulator:
+ * sd_rename_file into another directory keeps the data where it is and
+ * writes only directory and FAT-side sectors, and sd_move_files moves every
+ * matching file in one batch, leaves directories and name clashes behind,
+ * and reports a missing destination.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_move.img"
+#define CARD_BLOCKS 16384U
+#define LOGS        12U
+#define BIG_BYTES   (64U * 1024U)
+
+static char s_path[4];
+static char s_buf[64];
+static uint8_t s_data[4096];
+
+static uint32_t card_writes(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.sectors_written;
+}
+
+static void read_expect(const char *path, const char *want) {
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file(path, s_buf, sizeof(s_buf), &n));
+    TEST_ASSERT_EQUAL_STRING(want, s_buf);
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/logs"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/logs/keep"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/archive"));
+    for (uint32_t i = 0; i < LOGS; i++) {
+        char name[32];
+        char text[16];
+        (void)snprintf(name, sizeof(name), "0:/logs/run_%02u.log", (unsigned)i);
+        (void)snprintf(text, sizeof(text), "run %u", (unsigned)i);
+        TEST_ASSERT_EQUAL(FR_OK, sd_write_file(name, text));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/logs/config.ini", "cfg"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Move_RenameAcrossDirectoriesLeavesData(void) {
+    FIL fil;
+    UINT bw;
+    memset(s_data, 0xA5, sizeof(s_data));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "0:/logs/big.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    for (uint32_t off = 0; off < BIG_BYTES; off += sizeof(s_data)) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, s_data, sizeof(s_data), &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_rename_file("0:/logs/big.bin", "0:/archive/big.bin"));
+    TEST_ASSERT_TRUE(card_writes() <= 4U); /* two directory sectors, not 128 data sectors */
+
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/logs/big.bin", NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/archive/big.bin", &fno));
+    TEST_ASSERT_EQUAL_UINT32(BIG_BYTES, (uint32_t)fno.fsize);
+}
+
+void test_Move_MatchingFilesInOneBatch(void) {
+    uint32_t moved = 0;
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_move_files("0:/logs", "0:/archive", "run_*.LOG", &moved));
+    TEST_ASSERT_EQUAL_UINT32(LOGS, moved);
+    TEST_ASSERT_TRUE(card_writes() <= 6U);
+
+    read_expect("0:/archive/run_07.log", "run 7");
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/logs/run_07.log", NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/logs/config.ini", NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/logs/keep", NULL));
+
+    /* Nothing left to match. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_move_files("0:/logs", "0:/archive", "run_*", &moved));
+    TEST_ASSERT_EQUAL_UINT32(0U, moved);
+}
+
+void test_Move_ClashesStayAndErrors(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/archive/run_03.log", "old"));
+    uint32_t moved = 0;
+    TEST_ASSERT_EQUAL(FR_EXIST, sd_move_files("0:/logs", "0:/archive", NULL, &moved));
+    TEST_ASSERT_EQUAL_UINT32(LOGS, moved); /* eleven logs and config.ini */
+    read_expect("0:/archive/run_03.log", "old");
+    read_expect("0:/logs/run_03.log", "run 3");
+    read_expect("0:/archive/config.ini", "cfg");
+
+    TEST_ASSERT_EQUAL(FR_NO_PATH, sd_move_files("0:/logs", "0:/nowhere", NULL, &moved));
+    TEST_ASSERT_EQUAL_UINT32(0U, moved);
+    TEST_ASSERT_EQUAL(FR_NO_PATH, sd_move_files("0:/nowhere", "0:/archive", NULL, &moved));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_move_files(NULL, "0:/archive", NULL, NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Move_RenameAcrossDirectoriesLeavesData);
+    RUN_TEST(test_Move_MatchingFilesInOneBatch);
+    RUN_TEST(test_Move_ClashesStayAndErrors);
+    return UNITY_END();
+}
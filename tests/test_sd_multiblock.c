@@ -117,11 +117,11 @@ void test_ReadBlocks_MultiBlock_CMD18_ErrorResponse_ReturnsError(void) {
     TEST_ASSERT_EQUAL(SD_ERROR, SD_ReadBlocks(&sd, buf, 0, 2));
 }
 
-void test_ReadBlocks_MultiBlock_SecondBlockTokenFail_ReturnsTimeout(void) {
+void test_ReadBlocks_MultiBlock_SecondBlockTokenFail_ResumesAtSecondBlock(void) {
     /*
-     * First block succeeds; second block's data token never arrives
-     * (queue empties → 0xFF returned, which is never 0xFE).
-     * CMD12 is still sent after the loop (stop token).
+     * First block succeeds; second block's data token never arrives (the
+     * wait clocks in busy bytes until it times out). CMD12 is still sent
+     * after the loop, and the retry reads only the second block.
      */
     do_sdhc_init(&sd, 8192U);
 
@@ -135,15 +135,39 @@ void test_ReadBlocks_MultiBlock_SecondBlockTokenFail_ReturnsTimeout(void) {
     push_crc();
 
     /* Block 2: no token — WaitDataToken will time out */
-    /* (CMD12 WaitReady+response still needed after the loop) */
+    for (int j = 0; j < 200; j++) {
+        mock_hal_push_byte(0x00U);
+    }
     push_cmd_exchange(0x00U); /* CMD12 */
+    push_multi_read(1, 0x22U);
 
     uint8_t buf[1024];
-    SD_Status result = SD_ReadBlocks(&sd, buf, 0, 2);
-    TEST_ASSERT_EQUAL(SD_TIMEOUT, result);
-
-    /* First block was successfully read */
+    uint32_t before = HAL_GetTick();
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
     TEST_ASSERT_EQUAL_UINT8(0x11U, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x22U, buf[512]);
+    TEST_ASSERT_EQUAL_UINT8(0x22U, buf[1023]);
+    TEST_ASSERT_TRUE(HAL_GetTick() - before >= SD_DATA_TOKEN_TIMEOUT_MS + SD_RETRY_BACKOFF_MS);
+
+    SD_Stats s;
+    SD_GetStats(&sd, &s);
+    TEST_ASSERT_EQUAL_UINT32(1U, s.resumes);
+    TEST_ASSERT_EQUAL_UINT64(512U, s.resumed_bytes);
+    TEST_ASSERT_EQUAL_UINT32(1U, s.read_ops);
+    TEST_ASSERT_EQUAL_UINT32(2U, s.read_blocks);
+}
+
+void test_ReadBlocks_MultiBlock_CommandRejected_RetriesWholeRun(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_wait_ready();
+    push_r1(0x04U); /* CMD18 rejected */
+    push_multi_read(2, 0x33U);
+
+    uint8_t buf[1024];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL_UINT8(0x33U, buf[0]);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.resumes);
+    TEST_ASSERT_EQUAL_UINT64(0U, sd.stats.resumed_bytes);
 }
 
 void test_ReadBlocks_MultiBlock_SDSC_HappyPath(void) {
@@ -155,6 +179,115 @@ void test_ReadBlocks_MultiBlock_SDSC_HappyPath(void) {
     TEST_ASSERT_EQUAL_UINT8(0x44U, buf[0]);
 }
 
+/* -----------------------------------------------------------------------
+ * Multi-block read — pipelined DMA path (use_dma = true)
+ * ----------------------------------------------------------------------- */
+
+void test_ReadBlocks_MultiBlock_Dma_PipelinesDataAndCrc(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_distinct(3, 0x20U);
+
+    uint8_t buf[1536] __attribute__((aligned(4)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 3));
+    TEST_ASSERT_EQUAL_UINT8(0x20U, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x20U, buf[511]);
+    TEST_ASSERT_EQUAL_UINT8(0x21U, buf[512]);
+    TEST_ASSERT_EQUAL_UINT8(0x22U, buf[1535]);
+    /* One DMA per block carries data + CRC; no trailing bytes left over */
+    TEST_ASSERT_EQUAL(3, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_ReadBlocks_MultiBlock_Dma_UnalignedBufferStillPipelined(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_distinct(2, 0x50U);
+
+    static uint8_t raw[1024 + 1] __attribute__((aligned(4)));
+    uint8_t *buf = raw + 1;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL_UINT8(0x50U, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x51U, buf[1023]);
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_rx_calls);
+}
+
+void test_ReadBlocks_MultiBlock_Dma_StartFails_ReturnsError(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true; /* mock DMA left disabled: HAL_*_DMA returns HAL_ERROR */
+    for (int attempt = 0; attempt <= (int)SD_MAX_RETRIES; attempt++) {
+        push_multi_read_distinct(2, 0x00U);
+    }
+
+    uint8_t buf[1024];
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_ReadBlocks(&sd, buf, 0, 2));
+}
+
+void test_ReadBlocksScatter_FillsSeparateBuffers(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_multi_read_distinct(3, 0x30U);
+
+    uint8_t a[512], b[512], c[512];
+    uint8_t *const blocks[3] = {b, c, a};
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocksScatter(&sd, blocks, 0, 3));
+    TEST_ASSERT_EQUAL_UINT8(0x30U, b[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x31U, c[511]);
+    TEST_ASSERT_EQUAL_UINT8(0x32U, a[0]);
+    TEST_ASSERT_EQUAL_UINT32(3U, sd.stats.read_blocks);
+}
+
+void test_ReadBlocksScatter_Dma_PipelinesIntoSeparateBuffers(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_distinct(2, 0x60U);
+
+    static uint8_t a[512] __attribute__((aligned(4)));
+    static uint8_t b[512] __attribute__((aligned(4)));
+    uint8_t *const blocks[2] = {b, a};
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocksScatter(&sd, blocks, 0, 2));
+    TEST_ASSERT_EQUAL_UINT8(0x60U, b[511]);
+    TEST_ASSERT_EQUAL_UINT8(0x61U, a[0]);
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_rx_calls);
+}
+
+void test_ReadBlocksScatter_NullEntry_ReturnsParam(void) {
+    do_sdhc_init(&sd, 8192U);
+    uint8_t a[512];
+    uint8_t *const blocks[2] = {a, NULL};
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocksScatter(&sd, blocks, 0, 2));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocksScatter(&sd, NULL, 0, 2));
+}
+
+void test_ReadBlocksV_FillsSegmentsWithOneCmd18(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_multi_read_distinct(3, 0x40U);
+
+    uint8_t header[512], payload[1024];
+    const SD_IoVec iov[2] = {{header, sizeof(header)}, {payload, sizeof(payload)}};
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocksV(&sd, iov, 2, 0));
+    TEST_ASSERT_EQUAL_UINT8(0x40U, header[511]);
+    TEST_ASSERT_EQUAL_UINT8(0x41U, payload[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x42U, payload[1023]);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.read_ops);
+    TEST_ASSERT_EQUAL_UINT32(3U, sd.stats.read_blocks);
+}
+
+void test_BlocksV_BadSegment_ReturnsParam(void) {
+    do_sdhc_init(&sd, 8192U);
+    uint8_t a[1024];
+    const SD_IoVec partial[2] = {{a, 512}, {a + 512, 100}};
+    const SD_IoVec empty[1] = {{a, 0}};
+    const SD_IoVec null_base[1] = {{NULL, 512}};
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocksV(&sd, partial, 2, 0));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_WriteBlocksV(&sd, empty, 1, 0));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_WriteBlocksV(&sd, null_base, 1, 0));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_WriteBlocksV(&sd, partial, 0, 0));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocksV(NULL, partial, 1, 0));
+}
+
 /* -----------------------------------------------------------------------
  * Multi-block write via SD_WriteBlocks (count > 1)
  * ----------------------------------------------------------------------- */
@@ -184,16 +317,20 @@ void test_WriteBlocks_MultiBlock_StatsUpdated(void) {
 void test_WriteBlocks_MultiBlock_FirstBlockCrcError_ReturnsError(void) {
     do_sdhc_init(&sd, 8192U);
 
-    push_cmd_exchange(0x00U);   /* CMD25 response */
-    mock_hal_push_byte(0x0BU);  /* block 1 data response: CRC error */
-    /* loop breaks — stop token is still sent, then WaitReady */
-    push_wait_ready();
+    for (int attempt = 0; attempt <= (int)SD_MAX_RETRIES; attempt++) {
+        push_cmd_exchange(0x00U);   /* CMD25 response */
+        mock_hal_push_byte(0x0BU);  /* block 1 data response: CRC error */
+        /* loop breaks — stop token is still sent, then WaitReady */
+        push_wait_ready();
+    }
 
     uint8_t buf[1024];
     TEST_ASSERT_EQUAL(SD_CRC_ERROR, SD_WriteBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.resumes);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.write_ops);
 }
 
-void test_WriteBlocks_MultiBlock_SecondBlockWriteError(void) {
+void test_WriteBlocks_MultiBlock_SecondBlockWriteError_ResumesAtSecondBlock(void) {
     do_sdhc_init(&sd, 8192U);
 
     push_cmd_exchange(0x00U);   /* CMD25 response */
@@ -201,9 +338,151 @@ void test_WriteBlocks_MultiBlock_SecondBlockWriteError(void) {
     push_wait_ready();
     mock_hal_push_byte(0x0DU);  /* block 2 write error */
     push_wait_ready();          /* stop token WaitReady */
+    push_multi_write(1);        /* retry from block 2 */
+
+    uint8_t buf[1024];
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+
+    SD_Stats s;
+    SD_GetStats(&sd, &s);
+    TEST_ASSERT_EQUAL_UINT32(1U, s.resumes);
+    TEST_ASSERT_EQUAL_UINT64(512U, s.resumed_bytes);
+    TEST_ASSERT_EQUAL_UINT32(2U, s.write_blocks);
+}
+
+/* -----------------------------------------------------------------------
+ * Multi-block write — ACMD23 pre-erase hint
+ * ----------------------------------------------------------------------- */
+
+void test_WriteBlocks_MultiBlock_AtThreshold_SendsAcmd23(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    push_cmd_exchange(0x00U);          /* CMD55 */
+    push_cmd_exchange(0x00U);          /* ACMD23 */
+    push_multi_write(SD_ACMD23_MIN_BLOCKS);
+
+    static uint8_t buf[SD_ACMD23_MIN_BLOCKS * 512U];
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, SD_ACMD23_MIN_BLOCKS));
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    const uint8_t acmd23[7] = {0xFF, 0x57, 0x00, 0x00, 0x00, (uint8_t)SD_ACMD23_MIN_BLOCKS, 0xFF};
+    TEST_ASSERT_EQUAL_HEX8(0x77U, tx[1]); /* CMD55 first */
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(acmd23, tx + 7, 7);
+    TEST_ASSERT_EQUAL_HEX8(0x59U, tx[15]); /* then CMD25 */
+    TEST_ASSERT_TRUE(sd.acmd23_ok);
+}
+
+void test_WriteBlocks_MultiBlock_BelowThreshold_NoAcmd23(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    push_multi_write(2);
+
+    uint8_t buf[1024] = {0};
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(55));
+}
+
+void test_WriteBlocks_MultiBlock_Acmd23Illegal_DisablesHint(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    push_cmd_exchange(0x00U);          /* CMD55 */
+    push_cmd_exchange(0x04U);          /* ACMD23: illegal command */
+    push_multi_write(SD_ACMD23_MIN_BLOCKS);
+
+    static uint8_t buf[SD_ACMD23_MIN_BLOCKS * 512U];
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, SD_ACMD23_MIN_BLOCKS));
+    TEST_ASSERT_FALSE(sd.acmd23_ok);
+
+    /* Next long write goes straight to CMD25 */
+    mock_hal_reset();
+    push_multi_write(SD_ACMD23_MIN_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, SD_ACMD23_MIN_BLOCKS));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(55));
+}
+
+/* -----------------------------------------------------------------------
+ * Multi-block write — pipelined DMA path (use_dma = true)
+ * ----------------------------------------------------------------------- */
+
+void test_WriteBlocks_MultiBlock_Dma_SendsOneFramePerBlock(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_write(2);
 
     uint8_t buf[1024];
-    TEST_ASSERT_EQUAL(SD_WRITE_ERROR, SD_WriteBlocks(&sd, buf, 0, 2));
+    memset(buf, 0x11U, 512);
+    memset(buf + 512, 0x22U, 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 2));
+
+    /* CMD25 frame (7) + two 515-byte block frames + stop token + deselect */
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    TEST_ASSERT_EQUAL(7U + 2U * 515U + 2U, len);
+    const uint8_t *frame = tx + 7;
+    for (int blk = 0; blk < 2; blk++, frame += 515) {
+        TEST_ASSERT_EQUAL_HEX8(0xFCU, frame[0]);
+        TEST_ASSERT_EQUAL_HEX8(blk ? 0x22U : 0x11U, frame[1]);
+        TEST_ASSERT_EQUAL_HEX8(blk ? 0x22U : 0x11U, frame[512]);
+        TEST_ASSERT_EQUAL_HEX8(0xFFU, frame[513]);
+        TEST_ASSERT_EQUAL_HEX8(0xFFU, frame[514]);
+    }
+    TEST_ASSERT_EQUAL_HEX8(0xFDU, frame[0]); /* stop tran token */
+}
+
+void test_WriteBlocksV_HeaderAndPayload_OneCmd25(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_write(3);
+
+    static uint8_t header[512] __attribute__((aligned(4)));
+    static uint8_t payload[1024] __attribute__((aligned(4)));
+    memset(header, 0x11U, sizeof(header));
+    memset(payload, 0x22U, 512);
+    memset(payload + 512, 0x33U, 512);
+    const SD_IoVec iov[2] = {{header, sizeof(header)}, {payload, sizeof(payload)}};
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocksV(&sd, iov, 2, 0));
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(25));
+    TEST_ASSERT_EQUAL(7U + 3U * 515U + 2U, len);
+    static const uint8_t fill[3] = {0x11U, 0x22U, 0x33U};
+    const uint8_t *frame = tx + 7;
+    for (int blk = 0; blk < 3; blk++, frame += 515) {
+        TEST_ASSERT_EQUAL_HEX8(0xFCU, frame[0]);
+        TEST_ASSERT_EQUAL_HEX8(fill[blk], frame[1]);
+        TEST_ASSERT_EQUAL_HEX8(fill[blk], frame[512]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.write_ops);
+}
+
+void test_WriteBlocks_MultiBlock_Dma_SecondBlockCrcError(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+
+    push_cmd_exchange(0x00U);   /* CMD25 response */
+    mock_hal_push_byte(0x05U);  /* block 1 accepted */
+    push_wait_ready();
+    mock_hal_push_byte(0x0BU);  /* block 2 CRC error */
+    push_wait_ready();          /* stop token WaitReady */
+    for (int attempt = 0; attempt < (int)SD_MAX_RETRIES; attempt++) {
+        push_cmd_exchange(0x00U);   /* CMD25 from block 2 */
+        mock_hal_push_byte(0x0BU);  /* CRC error again */
+        push_wait_ready();
+    }
+
+    uint8_t buf[1024] = {0};
+    TEST_ASSERT_EQUAL(SD_CRC_ERROR, SD_WriteBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+    TEST_ASSERT_EQUAL_UINT32(SD_MAX_RETRIES, sd.stats.resumes);
+    TEST_ASSERT_EQUAL_UINT64(512U, sd.stats.resumed_bytes);
 }
 
 /* -----------------------------------------------------------------------
@@ -276,13 +555,28 @@ int main(void) {
     RUN_TEST(test_ReadBlocks_MultiBlock_ThreeBlocks_HappyPath);
     RUN_TEST(test_ReadBlocks_MultiBlock_StatsUpdated);
     RUN_TEST(test_ReadBlocks_MultiBlock_CMD18_ErrorResponse_ReturnsError);
-    RUN_TEST(test_ReadBlocks_MultiBlock_SecondBlockTokenFail_ReturnsTimeout);
+    RUN_TEST(test_ReadBlocks_MultiBlock_SecondBlockTokenFail_ResumesAtSecondBlock);
+    RUN_TEST(test_ReadBlocks_MultiBlock_CommandRejected_RetriesWholeRun);
     RUN_TEST(test_ReadBlocks_MultiBlock_SDSC_HappyPath);
+    RUN_TEST(test_ReadBlocks_MultiBlock_Dma_PipelinesDataAndCrc);
+    RUN_TEST(test_ReadBlocks_MultiBlock_Dma_UnalignedBufferStillPipelined);
+    RUN_TEST(test_ReadBlocks_MultiBlock_Dma_StartFails_ReturnsError);
+    RUN_TEST(test_ReadBlocksScatter_FillsSeparateBuffers);
+    RUN_TEST(test_ReadBlocksScatter_Dma_PipelinesIntoSeparateBuffers);
+    RUN_TEST(test_ReadBlocksScatter_NullEntry_ReturnsParam);
+    RUN_TEST(test_ReadBlocksV_FillsSegmentsWithOneCmd18);
+    RUN_TEST(test_BlocksV_BadSegment_ReturnsParam);
 
     RUN_TEST(test_WriteBlocks_MultiBlock_TwoBlocks_HappyPath);
     RUN_TEST(test_WriteBlocks_MultiBlock_StatsUpdated);
     RUN_TEST(test_WriteBlocks_MultiBlock_FirstBlockCrcError_ReturnsError);
-    RUN_TEST(test_WriteBlocks_MultiBlock_SecondBlockWriteError);
+    RUN_TEST(test_WriteBlocks_MultiBlock_SecondBlockWriteError_ResumesAtSecondBlock);
+    RUN_TEST(test_WriteBlocks_MultiBlock_AtThreshold_SendsAcmd23);
+    RUN_TEST(test_WriteBlocks_MultiBlock_BelowThreshold_NoAcmd23);
+    RUN_TEST(test_WriteBlocks_MultiBlock_Acmd23Illegal_DisablesHint);
+    RUN_TEST(test_WriteBlocks_MultiBlock_Dma_SendsOneFramePerBlock);
+    RUN_TEST(test_WriteBlocksV_HeaderAndPayload_OneCmd25);
+    RUN_TEST(test_WriteBlocks_MultiBlock_Dma_SecondBlockCrcError);
 
     RUN_TEST(test_ReadMultiBlocks_NotInitialized_ReturnsError);
     RUN_TEST(test_ReadMultiBlocks_NullHandle_ReturnsParam);
@@ -0,0 +1,200 @@
+/*
+ * tests/test_sd_partition.c
+ *
+ * Two volumes on one card (_MULTI_PARTITION) over the card emulator: the
+ * formatter adds a FAT12 configuration partition after the data volume,
+ * both mount separately, the configuration volume is then served from RAM
+ * after one load, and the data volume streams past the sector cache with
+ * read-ahead kept to it.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_format.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_partition.img"
+#define CARD_BLOCKS 16384U
+#define CFG_SECTORS 256U
+
+/* "0:" is the data volume (MBR entry 1), "1:" the configuration volume (entry 2). */
+PARTITION VolToPart[_VOLUMES] = {{0, 1}, {0, 2}};
+
+static char s_path[4];
+static FATFS s_cfg_fs;
+static FIL s_fil;
+static SD_FormatLayout s_layout;
+static uint8_t s_cfg_ram[CFG_SECTORS * 512U];
+
+static uint32_t card_reads(void) {
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    return cs.cmd[17] + cs.cmd[18];
+}
+
+static void write_text(const char *path, const char *text) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, text, (UINT)strlen(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+static void read_text(const char *path, char *text, UINT size) {
+    UINT br = 0;
+    memset(text, 0, size);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, text, size - 1U, &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void setUp(void) {
+    static uint8_t work[4 * 512];
+    SD_FormatOptions opt = {.boundary = 64U, .quick = true, .config_sectors = CFG_SECTORS};
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, work, sizeof(work), &s_layout));
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_cfg_fs, "1:", 1));
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, "1:", 0);
+    (void)sd_unmount();
+    (void)SD_DiskSetPolicy(0, s_layout.config_start, 0U, SD_DISK_POLICY_DEFAULT, NULL, 0U);
+    (void)SD_DiskSetPolicy(0, s_layout.partition_start, 0U, SD_DISK_POLICY_DEFAULT, NULL, 0U);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Partition_FormatAddsConfigVolume(void) {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL_UINT32(CFG_SECTORS, s_layout.config_sectors);
+    TEST_ASSERT_EQUAL_UINT32(s_layout.partition_start + s_layout.partition_sectors,
+                             s_layout.config_start);
+    TEST_ASSERT_EQUAL(FS_FAT12, s_cfg_fs.fs_type);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_volume_extent("1:", &first, &count));
+    TEST_ASSERT_EQUAL_UINT32(s_layout.config_start, first);
+    TEST_ASSERT_TRUE(count > 0U && count <= CFG_SECTORS);
+    TEST_ASSERT_EQUAL(FR_OK, sd_volume_extent(sd_path, &first, &count));
+    TEST_ASSERT_EQUAL_UINT32(s_layout.partition_start, first);
+    TEST_ASSERT_TRUE(count <= s_layout.partition_sectors);
+
+    /* Separate volumes: the same name holds different files. */
+    char text[16];
+    write_text("0:/id.txt", "data");
+    write_text("1:/id.txt", "config");
+    read_text("0:/id.txt", text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("data", text);
+    read_text("1:/id.txt", text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("config", text);
+}
+
+void test_Partition_ResidentConfig_ServedFromRam(void) {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    char text[16];
+    SD_DiskPolicyStats st;
+    write_text("1:/net.cfg", "dhcp=1");
+    TEST_ASSERT_EQUAL(FR_OK, sd_volume_extent("1:", &first, &count));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, first, count, SD_DISK_POLICY_RESIDENT,
+                                              s_cfg_ram, sizeof(s_cfg_ram)));
+
+    read_text("1:/net.cfg", text, sizeof(text)); /* loads the volume */
+    TEST_ASSERT_EQUAL_STRING("dhcp=1", text);
+    SD_DiskGetPolicyStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.resident_loads);
+
+    mock_card_reset_stats();
+    read_text("1:/net.cfg", text, sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+
+    /* Writes reach the card and the RAM copy alike. */
+    write_text("1:/net.cfg", "dhcp=0");
+    read_text("1:/net.cfg", text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("dhcp=0", text);
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, first, 0U, SD_DISK_POLICY_DEFAULT, NULL, 0U));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, "1:", 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_cfg_fs, "1:", 1));
+    read_text("1:/net.cfg", text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("dhcp=0", text);
+    SD_DiskGetPolicyStats(0, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.resident_loads);
+}
+
+void test_Partition_StreamData_SkipsSectorCache(void) {
+    static uint8_t block[4096];
+    uint32_t first = 0;
+    uint32_t count = 0;
+    UINT n = 0;
+    SD_DiskPolicyStats st;
+    SD_DiskCacheStats cache;
+    for (uint32_t i = 0; i < sizeof(block); i++) {
+        block[i] = (uint8_t)(i * 13U);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_volume_extent(sd_path, &first, &count));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, first, count, SD_DISK_POLICY_STREAM, NULL, 0U));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/rec.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, block, sizeof(block), &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    SD_DiskResetCacheStats(0);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/rec.bin", FA_READ));
+    for (uint32_t off = 0; off < sizeof(block); off += 100U) {
+        uint8_t chunk[100];
+        UINT want = (sizeof(block) - off < sizeof(chunk)) ? sizeof(block) - off : sizeof(chunk);
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, chunk, want, &n));
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(&block[off], chunk, want);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    SD_DiskGetPolicyStats(0, &st);
+    SD_DiskGetCacheStats(0, &cache);
+    TEST_ASSERT_TRUE(st.stream_direct > 0U);
+    TEST_ASSERT_TRUE(cache.readahead_hits > 0U);
+
+    /* Reads elsewhere on the card no longer prefetch. */
+    mock_card_reset_stats();
+    uint8_t sector[512];
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, sector, s_layout.config_start, 1U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, sector, s_layout.config_start + 1U, 1U));
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.cmd[18]);
+}
+
+void test_Partition_SetPolicy_Checks(void) {
+    uint32_t start = s_layout.config_start;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetPolicy(0, start, 16U, SD_DISK_POLICY_RESIDENT, NULL, 0U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetPolicy(0, start, 16U, SD_DISK_POLICY_RESIDENT,
+                                                 s_cfg_ram, 15U * 512U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, start, 16U, SD_DISK_POLICY_STREAM, NULL, 0U));
+    /* Overlaps are refused; the same first sector replaces the range. */
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetPolicy(0, start + 8U, 16U, SD_DISK_POLICY_STREAM, NULL,
+                                                 0U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, start, 32U, SD_DISK_POLICY_RESIDENT, s_cfg_ram,
+                                              sizeof(s_cfg_ram)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, 0U, 8U, SD_DISK_POLICY_STREAM, NULL, 0U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskSetPolicy(0, 100U, 8U, SD_DISK_POLICY_STREAM, NULL, 0U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, 0U, 0U, SD_DISK_POLICY_DEFAULT, NULL, 0U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, 100U, 8U, SD_DISK_POLICY_STREAM, NULL, 0U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetPolicy(0, 100U, 0U, SD_DISK_POLICY_DEFAULT, NULL, 0U));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Partition_FormatAddsConfigVolume);
+    RUN_TEST(test_Partition_ResidentConfig_ServedFromRam);
+    RUN_TEST(test_Partition_StreamData_SkipsSectorCache);
+    RUN_TEST(test_Partition_SetPolicy_Checks);
+    return UNITY_END();
+}
@@ -0,0 +1,179 @@
+/*
+ * tests/test_sd_polling.c
+ *
+ * Tests for burst busy/token polling. Built with SD_BUSY_POLL_BURST=8,
+ * SD_TOKEN_POLL_BURST=8 and SD_POLL_SPIN_COUNT=4 (see CMakeLists.txt).
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+}
+
+void tearDown(void) {}
+
+static void fill_pattern(uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)(i * 7U + 3U);
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * SD_WaitDataToken (via SD_ReadBlocks)
+ * ----------------------------------------------------------------------- */
+
+void test_Read_TokenMidWindow_CarriesDataBytes(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+
+    uint8_t data[512];
+    fill_pattern(data, sizeof(data));
+    push_cmd_exchange(0x00U);          /* CMD17 response */
+    mock_hal_push_byte(0xFFU);         /* single-byte first probe: no token */
+    mock_hal_push_byte(0xFFU);         /* burst window: two idle bytes ... */
+    mock_hal_push_byte(0xFFU);
+    push_data_token();                 /* ... token, then 5 data bytes */
+    mock_hal_push_bytes(data, sizeof(data));
+    push_crc();
+
+    uint8_t buf[512];
+    memset(buf, 0, sizeof(buf));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_Read_TokenLastInWindow_NoCarry(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+
+    uint8_t data[512];
+    fill_pattern(data, sizeof(data));
+    push_cmd_exchange(0x00U);
+    for (int i = 0; i < 8; i++) {
+        mock_hal_push_byte(0xFFU);     /* probe + 7 idle bytes of the window */
+    }
+    push_data_token();                 /* last byte of the burst window */
+    mock_hal_push_bytes(data, sizeof(data));
+    push_crc();
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_Read_TokenNeverArrives_Timeout(void) {
+    /*
+     * Per attempt: probe byte, SD_POLL_SPIN_COUNT - 1 spinning windows, then
+     * one window per 1 ms backoff until SD_DATA_TOKEN_TIMEOUT_MS elapses.
+     */
+    const int busy_bytes =
+        1 + (int)(SD_POLL_SPIN_COUNT - 1U + SD_DATA_TOKEN_TIMEOUT_MS) * SD_TOKEN_POLL_BURST;
+    do_sdhc_init(&sd, 8192U);
+    for (int attempt = 0; attempt <= (int)SD_MAX_RETRIES; attempt++) {
+        push_cmd_exchange(0x00U);      /* CMD17 accepted, then no token */
+        for (int i = 0; i < busy_bytes; i++) {
+            mock_hal_push_byte(0x00U);
+        }
+    }
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_ReadBlocks(&sd, buf, 0, 1));
+}
+
+void test_ReadMulti_DmaPipeline_CarriesDataBytes(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+
+    uint8_t data[2][512];
+    fill_pattern(data[0], 512);
+    memset(data[1], 0x5AU, 512);
+    push_cmd_exchange(0x00U);          /* CMD18 response */
+    mock_hal_push_byte(0xFFU);         /* block 0: probe misses ... */
+    push_data_token();                 /* ... token opens the burst window */
+    mock_hal_push_bytes(data[0], 512);
+    push_crc();
+    mock_hal_push_byte(0xFFU);         /* block 1: probe misses ... */
+    mock_hal_push_bytes((const uint8_t[]){0xFF, 0xFF, 0xFF, 0xFF}, 4);
+    push_data_token();                 /* ... token at offset 4 of the window */
+    mock_hal_push_bytes(data[1], 512);
+    push_crc();
+    push_cmd_exchange(0x00U);          /* CMD12 */
+
+    static uint8_t buf[1024] __attribute__((aligned(4)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data[0], buf, 512);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data[1], buf + 512, 512);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+/* -----------------------------------------------------------------------
+ * SD_WaitReady (via SD_Sync)
+ * ----------------------------------------------------------------------- */
+
+void test_Sync_BusyWithinSpinBudget_NoBackoff(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    mock_hal_push_byte(0x00U);         /* probe: busy */
+    for (int i = 0; i < 3 * 8; i++) {
+        mock_hal_push_byte(0x00U);     /* three busy windows */
+    }
+    /* fourth window ends with the line released; queue then idles at 0xFF */
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    TEST_ASSERT_EQUAL_UINT32(0U, HAL_GetTick());
+}
+
+void test_Sync_BusyPastSpinBudget_BacksOff(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    mock_hal_push_byte(0x00U);         /* probe: busy (spin 1) */
+    for (int i = 0; i < 5 * 8; i++) {
+        mock_hal_push_byte(0x00U);     /* windows: spins 2-4, then two backoffs */
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    TEST_ASSERT_EQUAL_UINT32(2U, HAL_GetTick());
+}
+
+void test_Sync_ReadyMidWindow_WaitsForLastByte(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    const uint8_t window[8] = {0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00};
+    mock_hal_push_byte(0x00U);
+    mock_hal_push_bytes(window, sizeof(window));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    TEST_ASSERT_EQUAL(3, mock_hal_transmitrec_calls);
+}
+
+void test_Sync_CardHoldsBusy_Timeout(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_reset();
+    mock_hal_set_idle_byte(0x00U);
+    TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_Sync(&sd));
+    TEST_ASSERT_TRUE(HAL_GetTick() >= SD_WRITE_BUSY_TIMEOUT_MS);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Read_TokenMidWindow_CarriesDataBytes);
+    RUN_TEST(test_Read_TokenLastInWindow_NoCarry);
+    RUN_TEST(test_Read_TokenNeverArrives_Timeout);
+    RUN_TEST(test_ReadMulti_DmaPipeline_CarriesDataBytes);
+
+    RUN_TEST(test_Sync_BusyWithinSpinBudget_NoBackoff);
+    RUN_TEST(test_Sync_BusyPastSpinBudget_BacksOff);
+    RUN_TEST(test_Sync_ReadyMidWindow_WaitsForLastByte);
+    RUN_TEST(test_Sync_CardHoldsBusy_Timeout);
+
+    return UNITY_END();
+}
@@ -0,0 +1,250 @@
+/*
+ * tests/test_sd_pool.c
+ *
+ * Tests for the FatFs object pools (SD_POOL_FILS=3, DIRS=1, FILINFOS=32) and
+ * the LFN block pool (LFN_BUFS=2 x 512 bytes), and the async request pools
+ * (IOREQS=2, IOBUFS=3 x 1024 bytes).
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_pool.h"
+#include <string.h>
+
+static FIL *s_fils[3];
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(s_fils, 0, sizeof(s_fils));
+    sd_pool_reset_stats();
+}
+
+void tearDown(void) {
+    for (int i = 0; i < 3; i++) {
+        sd_pool_fil_put(s_fils[i]);
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Acquire / release
+ * ----------------------------------------------------------------------- */
+
+void test_Pool_AcquireAll_DistinctThenEmpty(void) {
+    for (int i = 0; i < 3; i++) {
+        s_fils[i] = sd_pool_fil_get();
+        TEST_ASSERT_NOT_NULL(s_fils[i]);
+    }
+    TEST_ASSERT_TRUE(s_fils[0] != s_fils[1] && s_fils[1] != s_fils[2]);
+    TEST_ASSERT_NULL(sd_pool_fil_get());
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.size);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.in_use);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.high_water);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.acquires);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.misses);
+}
+
+void test_Pool_Release_ObjectReused(void) {
+    s_fils[0] = sd_pool_fil_get();
+    s_fils[1] = sd_pool_fil_get();
+    FIL *freed = s_fils[0];
+    sd_pool_fil_put(freed);
+    s_fils[0] = sd_pool_fil_get();
+
+    TEST_ASSERT_EQUAL_PTR(freed, s_fils[0]);
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.in_use);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.high_water);
+}
+
+void test_Pool_ForeignOrDoubleRelease_Ignored(void) {
+    FIL stack_fil;
+    s_fils[0] = sd_pool_fil_get();
+    sd_pool_fil_put(&stack_fil);
+    sd_pool_fil_put(NULL);
+    sd_pool_fil_put((FIL *)((uint8_t *)s_fils[0] + 1));
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.in_use);
+
+    sd_pool_fil_put(s_fils[0]);
+    sd_pool_fil_put(s_fils[0]);
+    s_fils[0] = NULL;
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.in_use);
+}
+
+/* -----------------------------------------------------------------------
+ * Kinds and declaration helpers
+ * ----------------------------------------------------------------------- */
+
+void test_Pool_KindsIndependent_FullWidthBitmap(void) {
+    FILINFO *fno[32];
+    for (int i = 0; i < 32; i++) {
+        fno[i] = sd_pool_filinfo_get();
+        TEST_ASSERT_NOT_NULL(fno[i]);
+    }
+    TEST_ASSERT_NULL(sd_pool_filinfo_get());
+
+    DIR *dp = sd_pool_dir_get();
+    TEST_ASSERT_NOT_NULL(dp);
+    TEST_ASSERT_NULL(sd_pool_dir_get());
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_FILINFO, &st);
+    TEST_ASSERT_EQUAL_UINT32(32U, st.high_water);
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.acquires);
+
+    for (int i = 0; i < 32; i++) {
+        sd_pool_filinfo_put(fno[i]);
+    }
+    sd_pool_dir_put(dp);
+    sd_pool_get_stats(SD_POOL_FILINFO, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.in_use);
+}
+
+void test_Pool_Decl_TakesFromPool(void) {
+    SD_POOL_FIL_DECL(fp);
+    TEST_ASSERT_NOT_NULL(fp);
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.in_use);
+    sd_pool_fil_put(fp);
+}
+
+void test_Pool_ResetStats_KeepsInUse(void) {
+    s_fils[0] = sd_pool_fil_get();
+    s_fils[1] = sd_pool_fil_get();
+    sd_pool_fil_put(s_fils[1]);
+    s_fils[1] = NULL;
+    sd_pool_reset_stats();
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_FIL, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.in_use);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.high_water);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.acquires);
+
+    sd_pool_get_stats(SD_POOL_KINDS, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.size);
+}
+
+/* -----------------------------------------------------------------------
+ * LFN working buffers (ff_memalloc / ff_memfree)
+ * ----------------------------------------------------------------------- */
+
+void test_Pool_Lfn_BlocksAlignedAndBounded(void) {
+    void *a = sd_pool_lfn_get(512);
+    void *b = sd_pool_lfn_get(100);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_EQUAL_UINT32(0U, (uintptr_t)a % 4U);
+    TEST_ASSERT_TRUE((uint8_t *)b - (uint8_t *)a >= 512 || (uint8_t *)a - (uint8_t *)b >= 512);
+    memset(a, 0x5A, 512); /* whole block usable */
+
+    TEST_ASSERT_NULL(sd_pool_lfn_get(2));
+    sd_pool_lfn_put(a);
+    TEST_ASSERT_EQUAL_PTR(a, sd_pool_lfn_get(2));
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_LFN, &st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.size);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.acquires);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.misses);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.high_water);
+    sd_pool_lfn_put(a);
+    sd_pool_lfn_put(b);
+}
+
+void test_Pool_Lfn_OversizeRequest_Refused(void) {
+    TEST_ASSERT_NULL(sd_pool_lfn_get(513));
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_LFN, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.misses);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.in_use);
+}
+
+/* -----------------------------------------------------------------------
+ * Async request descriptors and data buffers
+ * ----------------------------------------------------------------------- */
+
+void test_Pool_IoReq_ExhaustedThenReused(void) {
+    SD_IoRequest *a = sd_pool_ioreq_get();
+    SD_IoRequest *b = sd_pool_ioreq_get();
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_TRUE(a != b);
+    TEST_ASSERT_NULL(sd_pool_ioreq_get());
+
+    SD_IoRequest local;
+    sd_pool_ioreq_put(&local);
+    sd_pool_ioreq_put(a);
+    TEST_ASSERT_EQUAL_PTR(a, sd_pool_ioreq_get());
+
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_IOREQ, &st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.size);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.in_use);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.acquires);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.misses);
+    sd_pool_ioreq_put(a);
+    sd_pool_ioreq_put(b);
+}
+
+void test_Pool_IoBuf_DmaAlignedWholeBuffers(void) {
+    uint8_t *buf[3];
+    for (int i = 0; i < 3; i++) {
+        buf[i] = sd_pool_iobuf_get();
+        TEST_ASSERT_NOT_NULL(buf[i]);
+        TEST_ASSERT_EQUAL_UINT32(0U, (uintptr_t)buf[i] % SD_DMA_ALIGNMENT);
+        memset(buf[i], i, SD_POOL_IOBUF_BYTES);
+    }
+    TEST_ASSERT_NULL(sd_pool_iobuf_get());
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_UINT8(i, buf[i][0]);
+        TEST_ASSERT_EQUAL_UINT8(i, buf[i][SD_POOL_IOBUF_BYTES - 1U]);
+    }
+
+    sd_pool_iobuf_put(buf[1] + 512); /* inside a buffer, not its start */
+    SD_PoolStats st;
+    sd_pool_get_stats(SD_POOL_IOBUF, &st);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.in_use);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.high_water);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.misses);
+
+    for (int i = 0; i < 3; i++) {
+        sd_pool_iobuf_put(buf[i]);
+    }
+    sd_pool_get_stats(SD_POOL_IOBUF, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.in_use);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Pool_AcquireAll_DistinctThenEmpty);
+    RUN_TEST(test_Pool_Release_ObjectReused);
+    RUN_TEST(test_Pool_ForeignOrDoubleRelease_Ignored);
+
+    RUN_TEST(test_Pool_KindsIndependent_FullWidthBitmap);
+    RUN_TEST(test_Pool_Decl_TakesFromPool);
+    RUN_TEST(test_Pool_ResetStats_KeepsInUse);
+
+    RUN_TEST(test_Pool_Lfn_BlocksAlignedAndBounded);
+    RUN_TEST(test_Pool_Lfn_OversizeRequest_Refused);
+
+    RUN_TEST(test_Pool_IoReq_ExhaustedThenReused);
+    RUN_TEST(test_Pool_IoBuf_DmaAlignedWholeBuffers);
+
+    return UNITY_END();
+}
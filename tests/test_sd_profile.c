@@ -0,0 +1,156 @@
+/*
+ * tests/test_sd_profile.c
+ *
+ * Tests for the FatFs operation profiler (SD_PROFILE_ENABLED=1). The FatFs
+ * calls are stood in for by local functions that issue diskio traffic the way
+ * ff.c would, so attribution is checked without linking ff.c.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_diskio_spi.h"
+#include "sd_profile.h"
+#include <string.h>
+
+/* Layout used by every test: FAT at 10..13, directory area 14..31, data from 32. */
+#define FAT_FIRST  10U
+#define FAT_COUNT  4U
+#define DATA_FIRST 32U
+
+static uint8_t s_buf[512];
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&g_sd_handle, 0, sizeof(g_sd_handle));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInitDrive(0, &g_test_hspi, &g_test_cs, 0, false));
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    SD_ProfSetRegions(0, FAT_FIRST, FAT_COUNT, DATA_FIRST);
+    SD_ProfReset();
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Stand-ins for FatFs calls
+ * ----------------------------------------------------------------------- */
+
+static int fake_slow_call(uint32_t cycles, int result) {
+    mock_dwt.CYCCNT += cycles;
+    return result;
+}
+
+/* An f_write that updates a FAT sector, the directory entry and one data sector. */
+static int fake_write(void) {
+    push_single_read(0x00U);
+    if (SD_disk_read(0, s_buf, FAT_FIRST + 1U, 1) != RES_OK) return 1;
+    push_single_write_accepted();
+    if (SD_disk_write(0, s_buf, FAT_FIRST + 1U, 1) != RES_OK) return 1;
+    push_single_write_accepted();
+    if (SD_disk_write(0, s_buf, 20U, 1) != RES_OK) return 1;
+    push_single_write_accepted();
+    if (SD_disk_write(0, s_buf, DATA_FIRST + 5U, 1) != RES_OK) return 1;
+    return 0;
+}
+
+static int fake_nested(void) {
+    (void)SD_PROF_CALL(SD_PROF_SYNC, fake_slow_call(50U, 0));
+    return fake_slow_call(25U, 0);
+}
+
+/* -----------------------------------------------------------------------
+ * Call timing
+ * ----------------------------------------------------------------------- */
+
+void test_Prof_Call_CountsCyclesAndErrors(void) {
+    TEST_ASSERT_EQUAL(0, SD_PROF_CALL(SD_PROF_OPEN, fake_slow_call(300U, 0)));
+    TEST_ASSERT_EQUAL(4, SD_PROF_CALL(SD_PROF_OPEN, fake_slow_call(100U, 4)));
+
+    const SD_ProfStats *p = SD_ProfGet(SD_PROF_OPEN);
+    TEST_ASSERT_EQUAL_UINT32(2U, p->calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->errors);
+    TEST_ASSERT_EQUAL_UINT32(400U, (uint32_t)p->cycles);
+    TEST_ASSERT_EQUAL_UINT32(300U, p->max_cycles);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_ProfGet(SD_PROF_CLOSE)->calls);
+}
+
+void test_Prof_NestedCall_ChargedToOutermost(void) {
+    TEST_ASSERT_EQUAL(0, SD_PROF_CALL(SD_PROF_CLOSE, fake_nested()));
+
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_ProfGet(SD_PROF_CLOSE)->calls);
+    TEST_ASSERT_EQUAL_UINT32(75U, (uint32_t)SD_ProfGet(SD_PROF_CLOSE)->cycles);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_ProfGet(SD_PROF_SYNC)->calls);
+}
+
+/* -----------------------------------------------------------------------
+ * Sector attribution
+ * ----------------------------------------------------------------------- */
+
+void test_Prof_DiskIo_AttributedByRegionToRunningCall(void) {
+    mock_hal_set_cycles_per_byte(1U);
+    TEST_ASSERT_EQUAL(0, SD_PROF_CALL(SD_PROF_WRITE, fake_write()));
+
+    const SD_ProfStats *p = SD_ProfGet(SD_PROF_WRITE);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->sectors_read[SD_PROF_REGION_FAT]);
+    TEST_ASSERT_EQUAL_UINT32(0U, p->sectors_read[SD_PROF_REGION_DATA]);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->sectors_written[SD_PROF_REGION_FAT]);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->sectors_written[SD_PROF_REGION_DIR]);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->sectors_written[SD_PROF_REGION_DATA]);
+    TEST_ASSERT_TRUE(p->io_cycles > 0U);
+    TEST_ASSERT_TRUE(p->io_cycles <= p->cycles);
+}
+
+void test_Prof_DiskIoOutsideCall_ChargedToOther(void) {
+    push_single_read(0x00U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, s_buf, DATA_FIRST, 1));
+
+    const SD_ProfStats *p = SD_ProfGet(SD_PROF_OTHER);
+    TEST_ASSERT_EQUAL_UINT32(0U, p->calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->sectors_read[SD_PROF_REGION_DATA]);
+}
+
+void test_Prof_TransferAcrossBoundary_SplitPerSector(void) {
+    SD_ProfDiskIo(0, true, FAT_FIRST + FAT_COUNT - 1U, 3U, mock_dwt.CYCCNT);
+
+    const SD_ProfStats *p = SD_ProfGet(SD_PROF_OTHER);
+    TEST_ASSERT_EQUAL_UINT32(1U, p->sectors_written[SD_PROF_REGION_FAT]);
+    TEST_ASSERT_EQUAL_UINT32(2U, p->sectors_written[SD_PROF_REGION_DIR]);
+}
+
+void test_Prof_UnregisteredDrive_CountsAsData(void) {
+    SD_ProfDiskIo(1, false, FAT_FIRST, 1U, mock_dwt.CYCCNT);
+
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_ProfGet(SD_PROF_OTHER)->sectors_read[SD_PROF_REGION_DATA]);
+}
+
+void test_Prof_Reset_ClearsFigures(void) {
+    (void)SD_PROF_CALL(SD_PROF_READ, fake_slow_call(10U, 0));
+    SD_ProfReset();
+
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_ProfGet(SD_PROF_READ)->calls);
+    TEST_ASSERT_EQUAL_UINT32(0U, (uint32_t)SD_ProfGet(SD_PROF_READ)->cycles);
+    TEST_ASSERT_NULL(SD_ProfGet(SD_PROF_COUNT));
+    TEST_ASSERT_EQUAL_STRING("read", SD_ProfName(SD_PROF_READ));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Prof_Call_CountsCyclesAndErrors);
+    RUN_TEST(test_Prof_NestedCall_ChargedToOutermost);
+
+    RUN_TEST(test_Prof_DiskIo_AttributedByRegionToRunningCall);
+    RUN_TEST(test_Prof_DiskIoOutsideCall_ChargedToOther);
+    RUN_TEST(test_Prof_TransferAcrossBoundary_SplitPerSector);
+    RUN_TEST(test_Prof_UnregisteredDrive_CountsAsData);
+    RUN_TEST(test_Prof_Reset_ClearsFigures);
+
+    return UNITY_END();
+}
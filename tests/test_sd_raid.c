@@ -0,0 +1,249 @@
+/*
+ * tests/test_sd_raid.c
+ *
+ * Tests for the striped / mirrored virtual device (sd_raid.c). Without
+ * FreeRTOS the first card's part runs before the second card's, so the
+ * mock SPI queue is scripted card A first, then card B.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_raid.h"
+#include <string.h>
+
+static SD_Handle_t card_a;
+static SD_Handle_t card_b;
+static SPI_HandleTypeDef hspi_b;
+static SD_RaidDevice raid;
+static uint8_t buf[8 * 512];
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&card_a, 0, sizeof(card_a));
+    memset(&card_b, 0, sizeof(card_b));
+    memset(&raid, 0, sizeof(raid));
+    memset(buf, 0, sizeof(buf));
+}
+
+void tearDown(void) {
+    SD_DeInit(&card_a);
+    SD_DeInit(&card_b);
+}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+static void init_cards(uint32_t blocks_a, uint32_t blocks_b) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&card_a, &g_test_hspi, &g_test_cs, 0, false));
+    push_sdhc_init(blocks_a);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&card_a));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&card_b, &hspi_b, &g_test_cs, 1, false));
+    push_sdhc_init(blocks_b);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&card_b));
+    mock_hal_reset(); /* start each test with an empty transmit log */
+}
+
+/* Queue a CMD25 write of count blocks followed by the stop token's busy wait. */
+static void push_multi_write(uint32_t count) {
+    push_cmd_exchange(0x00U);
+    for (uint32_t i = 0; i < count; i++) {
+        mock_hal_push_byte(0x05U);
+        push_wait_ready();
+    }
+    push_wait_ready();
+}
+
+/* Argument of the n-th CMD frame with the given index (-1 if absent). */
+static long cmd_arg(uint8_t cmd, int n) {
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    for (size_t i = 0; i + 6U < len; i++) {
+        if (tx[i] == 0xFFU && tx[i + 1U] == (uint8_t)(0x40U | cmd) && n-- == 0) {
+            return ((long)tx[i + 2U] << 24) | ((long)tx[i + 3U] << 16) |
+                   ((long)tx[i + 4U] << 8) | tx[i + 5U];
+        }
+    }
+    return -1;
+}
+
+/* -----------------------------------------------------------------------
+ * Setup and geometry
+ * ----------------------------------------------------------------------- */
+
+void test_Raid_Init_InvalidArgs_ReturnsParam(void) {
+    card_a.hspi = &g_test_hspi;
+    card_b.hspi = &g_test_hspi;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_a, 4));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_b, 4));
+    card_b.hspi = &hspi_b;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_b, 0));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_RaidInit(&raid, SD_RAID_STRIPE, NULL, &card_b, 4));
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+}
+
+void test_Raid_BlockCount_StripeAndMirror(void) {
+    init_cards(8192U, 16384U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_b, 8));
+    TEST_ASSERT_EQUAL_UINT32(16384U, SD_RaidGetBlockCount(&raid));
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+    TEST_ASSERT_EQUAL_UINT32(8192U, SD_RaidGetBlockCount(&raid));
+}
+
+void test_Raid_OutOfRange_ReturnsParam(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_RaidRead(&raid, buf, 8191U, 2));
+    TEST_ASSERT_EQUAL(0, mock_hal_transmit_calls + mock_hal_transmitrec_calls);
+}
+
+/* -----------------------------------------------------------------------
+ * Striped mode
+ * ----------------------------------------------------------------------- */
+
+void test_Raid_Stripe_Read_MapsUnitsToAlternateCards(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_b, 2));
+    push_multi_read_distinct(4, 0x10U); /* card A: virtual 0,1,4,5 */
+    push_multi_read_distinct(4, 0x20U); /* card B: virtual 2,3,6,7 */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidRead(&raid, buf, 0, 8));
+    TEST_ASSERT_EQUAL_INT(0, cmd_arg(18, 0));
+    TEST_ASSERT_EQUAL_INT(0, cmd_arg(18, 1));
+    const uint8_t expect[8] = {0x10, 0x11, 0x20, 0x21, 0x12, 0x13, 0x22, 0x23};
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL_HEX8(expect[i], buf[i * 512]);
+    }
+}
+
+void test_Raid_Stripe_Write_UnalignedStart(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_b, 2));
+    for (int i = 0; i < 4; i++) {
+        memset(&buf[i * 512], 0xA0 + i, 512);
+    }
+    push_multi_write(2); /* card A: virtual 4,5 -> card sectors 2,3 */
+    push_multi_write(2); /* card B: virtual 2,3 -> card sectors 0,1 */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidWrite(&raid, buf, 2, 4));
+    TEST_ASSERT_EQUAL_INT(2, cmd_arg(25, 0));
+    TEST_ASSERT_EQUAL_INT(0, cmd_arg(25, 1));
+}
+
+void test_Raid_Stripe_SingleUnit_TouchesOneCard(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_STRIPE, &card_a, &card_b, 4));
+    push_single_read(0x5AU);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidRead(&raid, buf, 13, 1)); /* unit 3 -> card B */
+    TEST_ASSERT_EQUAL_INT(5, cmd_arg(17, 0));              /* (3 >> 1) * 4 + 1 */
+    TEST_ASSERT_EQUAL_INT(-1, cmd_arg(17, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x5AU, buf[0]);
+}
+
+/* -----------------------------------------------------------------------
+ * Mirrored mode
+ * ----------------------------------------------------------------------- */
+
+void test_Raid_Mirror_Write_GoesToBothCards(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+    push_single_write_accepted();
+    push_single_write_accepted();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidWrite(&raid, buf, 40, 1));
+    TEST_ASSERT_EQUAL_INT(40, cmd_arg(24, 0));
+    TEST_ASSERT_EQUAL_INT(40, cmd_arg(24, 1));
+}
+
+void test_Raid_Mirror_Read_SplitsAcrossCards(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+    push_multi_read_distinct(2, 0x30U);
+    push_multi_read_distinct(2, 0x32U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidRead(&raid, buf, 100, 4));
+    TEST_ASSERT_EQUAL_INT(100, cmd_arg(18, 0));
+    TEST_ASSERT_EQUAL_INT(102, cmd_arg(18, 1));
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_HEX8(0x30 + i, buf[i * 512]);
+    }
+}
+
+void test_Raid_Mirror_SingleReads_Alternate(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+    push_single_read(0x01U);
+    push_single_read(0x02U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidRead(&raid, buf, 7, 1));
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidRead(&raid, buf, 7, 1));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_a.stats.read_ops);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_b.stats.read_ops);
+}
+
+void test_Raid_Mirror_FailedRead_RetriedOnOtherCard(void) {
+    init_cards(8192U, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&raid, SD_RAID_MIRROR, &card_a, &card_b, 0));
+    for (int i = 0; i < 3; i++) { /* card A: CMD17 rejected on every retry */
+        push_wait_ready();
+        push_r1(0x04U);
+    }
+    push_single_read(0x77U);      /* card B */
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidRead(&raid, buf, 9, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x77U, buf[0]);
+}
+
+/* -----------------------------------------------------------------------
+ * FatFs driver
+ * ----------------------------------------------------------------------- */
+
+void test_RaidDriver_WrongDrive_ReturnsParerr(void) {
+    TEST_ASSERT_EQUAL(RES_PARERR, SD_RaidDriver.disk_read(1, buf, 0, 1));
+    TEST_ASSERT_EQUAL(STA_NOINIT, SD_RaidDriver.disk_status(1));
+}
+
+void test_RaidDriver_InitializesBothCards(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&card_a, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&card_b, &hspi_b, &g_test_cs, 1, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_RaidInit(&g_sd_raid, SD_RAID_STRIPE, &card_a, &card_b, 8));
+    TEST_ASSERT_BITS(STA_NOINIT, STA_NOINIT, SD_RaidDriver.disk_status(0));
+
+    push_sdhc_init(8192U);
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_RaidDriver.disk_initialize(0));
+    TEST_ASSERT_EQUAL(0, SD_RaidDriver.disk_status(0));
+
+    DWORD sectors = 0;
+    TEST_ASSERT_EQUAL(RES_OK, SD_RaidDriver.disk_ioctl(0, GET_SECTOR_COUNT, &sectors));
+    TEST_ASSERT_EQUAL_UINT32(16384U, sectors);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Raid_Init_InvalidArgs_ReturnsParam);
+    RUN_TEST(test_Raid_BlockCount_StripeAndMirror);
+    RUN_TEST(test_Raid_OutOfRange_ReturnsParam);
+
+    RUN_TEST(test_Raid_Stripe_Read_MapsUnitsToAlternateCards);
+    RUN_TEST(test_Raid_Stripe_Write_UnalignedStart);
+    RUN_TEST(test_Raid_Stripe_SingleUnit_TouchesOneCard);
+
+    RUN_TEST(test_Raid_Mirror_Write_GoesToBothCards);
+    RUN_TEST(test_Raid_Mirror_Read_SplitsAcrossCards);
+    RUN_TEST(test_Raid_Mirror_SingleReads_Alternate);
+    RUN_TEST(test_Raid_Mirror_FailedRead_RetriedOnOtherCard);
+
+    RUN_TEST(test_RaidDriver_WrongDrive_ReturnsParerr);
+    RUN_TEST(test_RaidDriver_InitializesBothCards);
+
+    return UNITY_END();
+}
@@ -0,0 +1,252 @@
+/*
+ * tests/test_sd_rawlog.c
+ *
+ * Raw-region logging over the card emulator (SD_LOGGER_CHUNK_BYTES=2048,
+ * SYNC_MS=100): an SD_FormatDrive raw region found in the MBR, the diskio
+ * sector limit that keeps FatFs in front of it, chunk writes with
+ * SD_WriteMultiBlocks, header checkpoints with the partial block rewritten,
+ * resuming a region, readback across the wrap and overwritten data.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_format.h"
+#include "sd_logger.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_rawlog.img"
+#define CARD_BLOCKS 131072U /* 64 MiB */
+#define RAW_FIRST   100000U
+#define RAW_BLOCKS  65U /* header + 64 data blocks */
+
+static FATFS s_fs;
+static char s_path[4];
+static uint8_t s_buf[8192] __attribute__((aligned(4)));
+static uint8_t s_back[8192] __attribute__((aligned(4)));
+
+/* sd_functions.c is not part of the host build; file mode is not used here. */
+int sd_preallocate_file(const char *filename, uint32_t bytes) {
+    (void)filename;
+    (void)bytes;
+    return FR_DENIED;
+}
+
+void sd_dirindex_add(const char *path) {
+    (void)path;
+}
+
+static void fill(uint8_t *buf, uint32_t len, uint32_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)((seed + i) * 31U + ((seed + i) >> 8));
+    }
+}
+
+/* Stream bytes [from, from + len) of the fill pattern, in records of 100 bytes. */
+static void log_bytes(uint32_t from, uint32_t len) {
+    fill(s_buf, len, from);
+    for (uint32_t off = 0; off < len; off += 100U) {
+        uint32_t n = (len - off < 100U) ? len - off : 100U;
+        TEST_ASSERT_TRUE(sd_logger_write(&s_buf[off], n));
+        if ((off % 1000U) == 0U) {
+            TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+        }
+    }
+}
+
+static void check_bytes(uint64_t from, uint32_t len) {
+    uint32_t got = 0;
+    fill(s_buf, len, (uint32_t)from);
+    memset(s_back, 0, len);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_raw_read(&g_sd_handle, RAW_FIRST, RAW_BLOCKS, from, s_back,
+                                                len, &got));
+    TEST_ASSERT_EQUAL_UINT32(len, got);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, s_back, len);
+}
+
+static SD_LoggerRawInfo raw_info(void) {
+    SD_LoggerRawInfo info;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_raw_info(&g_sd_handle, RAW_FIRST, RAW_BLOCKS, &info));
+    return info;
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(0, disk_initialize(0));
+
+    memset(s_buf, 0, 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&g_sd_handle, s_buf, RAW_FIRST, 1)); /* no header */
+    mock_card_reset_stats();
+}
+
+void tearDown(void) {
+    (void)sd_logger_stop();
+    SD_DiskSetSectorLimit(0, 0);
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Region in the MBR, FatFs kept in front of it
+ * ----------------------------------------------------------------------- */
+
+void test_RawLog_Format_RawRegionInMbr_FatFsLimited(void) {
+    static uint8_t work[4096];
+    SD_FormatOptions opt = {.quick = true, .raw_sectors = 5000U};
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, work, sizeof(work), &l));
+    TEST_ASSERT_EQUAL_UINT32(0U, l.raw_start % l.boundary); /* rounded up to the boundary */
+    TEST_ASSERT_EQUAL_UINT32(CARD_BLOCKS, l.raw_start + l.raw_sectors);
+    TEST_ASSERT_EQUAL_UINT32(5000U + l.boundary - 5000U % l.boundary, l.raw_sectors);
+    TEST_ASSERT_TRUE(l.partition_start + l.partition_sectors <= l.raw_start);
+
+    uint32_t start = 0, sectors = 0;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatFindRaw(0, work, &start, &sectors));
+    TEST_ASSERT_EQUAL_UINT32(l.raw_start, start);
+    TEST_ASSERT_EQUAL_UINT32(l.raw_sectors, sectors);
+
+    SD_DiskSetSectorLimit(0, start);
+    DWORD count = 0;
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, GET_SECTOR_COUNT, &count));
+    TEST_ASSERT_EQUAL_UINT32(start, count);
+    TEST_ASSERT_EQUAL(RES_PARERR, disk_write(0, work, start, 1));
+    TEST_ASSERT_EQUAL(RES_PARERR, disk_write(0, work, start - 1U, 2));
+    DWORD range[2] = {start - 8U, start};
+    TEST_ASSERT_EQUAL(RES_PARERR, disk_ioctl(0, CTRL_TRIM, range));
+
+    /* The limit survives the re-initialization of a mount. */
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, GET_SECTOR_COUNT, &count));
+    TEST_ASSERT_EQUAL_UINT32(start, count);
+}
+
+void test_RawLog_FindRaw_PlainVolume_NoFile(void) {
+    static uint8_t work[4096];
+    uint32_t start = 0, sectors = 0;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &(SD_FormatOptions){.quick = true}, work,
+                                            sizeof(work), NULL));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, SD_FormatFindRaw(0, work, &start, &sectors));
+}
+
+void test_RawLog_Format_RawRegionTooLarge_Rejected(void) {
+    static uint8_t work[4096];
+    SD_FormatOptions opt = {.quick = true, .raw_sectors = CARD_BLOCKS / 2U};
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatDrive(0, &opt, work, sizeof(work), NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Logging
+ * ----------------------------------------------------------------------- */
+
+void test_RawLog_FullChunks_OneMultiBlockWriteEach(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    TEST_ASSERT_EQUAL_UINT32(0U, raw_info().total); /* new header */
+    mock_card_reset_stats();
+
+    log_bytes(0, 3U * SD_LOGGER_CHUNK_BYTES + 100U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(3U, st.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(3U * SD_LOGGER_CHUNK_BYTES / 512U, st.sectors_written);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_EQUAL_UINT64(3U * SD_LOGGER_CHUNK_BYTES + 100U, raw_info().total);
+    check_bytes(0, 3U * SD_LOGGER_CHUNK_BYTES + 100U);
+}
+
+/* A sync checkpoints a partial block; the block is written again as it fills. */
+void test_RawLog_Sync_CheckpointsPartialBlock(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    log_bytes(0, 700U);
+    mock_hal_set_tick(HAL_GetTick() + SD_LOGGER_SYNC_MS);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_poll());
+    SD_LoggerRawInfo info = raw_info();
+    TEST_ASSERT_EQUAL_UINT64(700U, info.total);
+    TEST_ASSERT_EQUAL_UINT32(2U, info.checkpoints);
+    check_bytes(0, 700U);
+
+    log_bytes(700U, 400U); /* not checkpointed yet */
+    TEST_ASSERT_EQUAL_UINT64(700U, raw_info().total);
+    uint32_t got = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_raw_read(&g_sd_handle, RAW_FIRST, RAW_BLOCKS, 600U,
+                                                s_back, 400U, &got));
+    TEST_ASSERT_EQUAL_UINT32(100U, got);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_flush());
+    check_bytes(0, 1100U);
+}
+
+void test_RawLog_Restart_ContinuesAfterCheckpoint(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    log_bytes(0, 1300U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    log_bytes(1300U, 5000U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+    TEST_ASSERT_EQUAL_UINT64(6300U, raw_info().total);
+    check_bytes(0, 6300U);
+}
+
+void test_RawLog_Wrap_OldestOverwritten(void) {
+    const uint32_t total = 70U * 512U + 300U; /* 64 data blocks */
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    for (uint32_t off = 0; off < total; off += 4000U) {
+        log_bytes(off, (total - off < 4000U) ? total - off : 4000U);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_stop());
+
+    SD_LoggerRawInfo info = raw_info();
+    TEST_ASSERT_EQUAL_UINT64(total, info.total);
+    TEST_ASSERT_EQUAL_UINT64(7U * 512U, info.oldest); /* block 70 reuses block 6's slot */
+    check_bytes(info.oldest, 8192U);                  /* across the end of the region */
+    check_bytes(total - 3000U, 3000U);
+
+    uint32_t got = 0;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_logger_raw_read(&g_sd_handle, RAW_FIRST, RAW_BLOCKS,
+                                                     info.oldest - 1U, s_back, 16U, &got));
+}
+
+void test_RawLog_BadArguments_Rejected(void) {
+    SD_LoggerRawInfo info;
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, 1U));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_logger_start_raw(NULL, RAW_FIRST, RAW_BLOCKS));
+    TEST_ASSERT_EQUAL(FR_NO_FILESYSTEM,
+                      sd_logger_raw_info(&g_sd_handle, RAW_FIRST, RAW_BLOCKS, &info));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_logger_start_raw(&g_sd_handle, RAW_FIRST, RAW_BLOCKS));
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_logger_start("log.bin"));
+    /* Another region's bounds do not match the header. */
+    TEST_ASSERT_EQUAL(FR_NO_FILESYSTEM,
+                      sd_logger_raw_info(&g_sd_handle, RAW_FIRST, RAW_BLOCKS + 1U, &info));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_RawLog_Format_RawRegionInMbr_FatFsLimited);
+    RUN_TEST(test_RawLog_FindRaw_PlainVolume_NoFile);
+    RUN_TEST(test_RawLog_Format_RawRegionTooLarge_Rejected);
+
+    RUN_TEST(test_RawLog_FullChunks_OneMultiBlockWriteEach);
+    RUN_TEST(test_RawLog_Sync_CheckpointsPartialBlock);
+    RUN_TEST(test_RawLog_Restart_ContinuesAfterCheckpoint);
+    RUN_TEST(test_RawLog_Wrap_OldestOverwritten);
+    RUN_TEST(test_RawLog_BadArguments_Rejected);
+
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+/*
+ * tests/test_sd_readahead.c
+ *
+ * Tests for sequential read-ahead in SD_disk_read. Built with
+ * SD_READAHEAD_SECTORS=4 (see CMakeLists.txt), and again with
+ * SD_MEM_DMA_THRESHOLD=512 so the copy out of the window takes the DMA path.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_diskio_spi.h"
+#include "sd_mem.h"
+#include <string.h>
+
+extern SD_Handle_t g_sd_handle;
+
+#if (SD_MEM_DMA_THRESHOLD > 0U)
+static DMA_HandleTypeDef s_m2m;
+#endif
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&g_sd_handle, 0, sizeof(g_sd_handle));
+#if (SD_MEM_DMA_THRESHOLD > 0U)
+    sd_mem_set_dma(&s_m2m);
+#endif
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+/* Initialize through SD_disk_initialize so the read-ahead state is reset. */
+static void init_global_sdhc(uint32_t capacity_blocks) {
+    SD_Init(&g_sd_handle, &g_test_hspi, &g_test_cs, 0, false);
+    push_sdhc_init(capacity_blocks);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    mock_hal_reset();
+}
+
+/* -----------------------------------------------------------------------
+ * Tests
+ * ----------------------------------------------------------------------- */
+
+void test_ReadAhead_SequentialReads_ServedFromWindow(void) {
+    init_global_sdhc(8192U);
+    uint8_t buf[512];
+
+    push_single_read(0x08U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 8, 1)); /* first access: plain CMD17 */
+
+    push_multi_read_distinct(4, 0x09U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 9, 1)); /* sequential: prefetch 9..12 */
+    TEST_ASSERT_EQUAL_HEX8(0x09U, buf[0]);
+
+    for (uint32_t s = 10; s <= 12; s++) {
+        TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, s, 1));
+        TEST_ASSERT_EQUAL_HEX8((uint8_t)s, buf[0]);
+        TEST_ASSERT_EQUAL_HEX8((uint8_t)s, buf[511]);
+    }
+
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(18));
+    TEST_ASSERT_EQUAL_UINT32(3U, g_sd_handle.stats.readahead_hits);
+    TEST_ASSERT_EQUAL_UINT32(2U, g_sd_handle.stats.readahead_misses);
+}
+
+void test_ReadAhead_RandomReads_NoPrefetch(void) {
+    init_global_sdhc(8192U);
+    uint8_t buf[512];
+
+    push_single_read(0x01U);
+    SD_disk_read(0, buf, 100, 1);
+    push_single_read(0x02U);
+    SD_disk_read(0, buf, 50, 1);
+
+    TEST_ASSERT_EQUAL(2, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL(0, count_cmd_frames(18));
+    TEST_ASSERT_EQUAL_UINT32(0U, g_sd_handle.stats.readahead_hits);
+}
+
+void test_ReadAhead_WriteInsideWindow_Invalidates(void) {
+    init_global_sdhc(8192U);
+    uint8_t buf[512];
+
+    push_single_read(0x00U);
+    SD_disk_read(0, buf, 20, 1);
+    push_multi_read_distinct(4, 0x21U);
+    SD_disk_read(0, buf, 21, 1); /* window 21..24 */
+
+    push_single_write_accepted();
+    memset(buf, 0x99U, sizeof(buf));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, buf, 23, 1));
+
+    /* 22 was in the window, but the window is gone: back to the card */
+    push_multi_read_distinct(4, 0x40U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 22, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x40U, buf[0]);
+    TEST_ASSERT_EQUAL(2, count_cmd_frames(18));
+}
+
+void test_ReadAhead_Window_ClampedAtCardEnd(void) {
+    init_global_sdhc(8192U);
+    uint8_t buf[512];
+
+    push_single_read(0x00U);
+    SD_disk_read(0, buf, 8189, 1);
+    push_multi_read_distinct(2, 0x10U); /* only 8190 and 8191 remain */
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 8190, 1));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 8191, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x11U, buf[0]);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+void test_ReadAhead_LargeRequest_BypassesWindow(void) {
+    init_global_sdhc(8192U);
+    static uint8_t buf[4 * 512];
+
+    push_single_read(0x00U);
+    SD_disk_read(0, buf, 0, 1);
+    push_multi_read_distinct(4, 0x01U);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 1, 4));
+    TEST_ASSERT_EQUAL_HEX8(0x04U, buf[3 * 512]);
+
+    /* Nothing was prefetched, so the next sequential read refills */
+    push_multi_read_distinct(4, 0x05U);
+    SD_disk_read(0, buf, 5, 1);
+    TEST_ASSERT_EQUAL(2, count_cmd_frames(18));
+}
+
+void test_ReadAhead_PartialHit_ReadsOnlyTheRest(void) {
+    init_global_sdhc(8192U);
+    static uint8_t buf[4 * 512] __attribute__((aligned(4)));
+
+    push_single_read(0x08U);
+    SD_disk_read(0, buf, 8, 1);
+    push_multi_read_distinct(4, 0x09U);
+    SD_disk_read(0, buf, 9, 1); /* window 9..12 */
+
+    /* 11 and 12 come from the window while the card sends 13 and 14 */
+    push_multi_read_distinct(2, 0x0DU);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 11, 4));
+    for (uint32_t i = 0; i < 4U; i++) {
+        TEST_ASSERT_EQUAL_HEX8((uint8_t)(11U + i), buf[i * 512U]);
+        TEST_ASSERT_EQUAL_HEX8((uint8_t)(11U + i), buf[i * 512U + 511U]);
+    }
+    TEST_ASSERT_EQUAL(2, count_cmd_frames(18));
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+#if (SD_MEM_DMA_THRESHOLD > 0U)
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_m2m_starts);
+#else
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_m2m_starts);
+#endif
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_ReadAhead_SequentialReads_ServedFromWindow);
+    RUN_TEST(test_ReadAhead_RandomReads_NoPrefetch);
+    RUN_TEST(test_ReadAhead_WriteInsideWindow_Invalidates);
+    RUN_TEST(test_ReadAhead_Window_ClampedAtCardEnd);
+    RUN_TEST(test_ReadAhead_LargeRequest_BypassesWindow);
+    RUN_TEST(test_ReadAhead_PartialHit_ReadsOnlyTheRest);
+
+    return UNITY_END();
+}
@@ -0,0 +1,198 @@
+/*
+ * tests/test_sd_readonly.c
+ *
+ * Read-only mounts (sd_mount_readonly) against the card emulator, with the
+ * sector cache split by class (2 FAT lines, 2 directory lines, none for data
+ * out of 8), a 4-sector read-ahead window and 2 FAT groups: the drive flag
+ * refuses writes and trims and writes back dirty lines when set, FatFs
+ * writes fail with FR_WRITE_PROTECTED, nothing reaches the card while
+ * mounted, every cache is raised to its build size and data takes the lines
+ * left over, and sd_unmount or a writable sd_mount puts everything back.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_readonly.img"
+#define CARD_BLOCKS 16384U
+#define FILE_BYTES  6000U
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_buf[FILE_BYTES];
+
+static void fill(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed + i * 7U);
+    }
+}
+
+static uint32_t card_writes(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.sectors_written + card.sectors_erased;
+}
+
+void setUp(void) {
+    UINT bw;
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT, 512U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    fill(s_buf, FILE_BYTES, 0x21U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/data.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, FILE_BYTES, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/logs"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_drive_flag_refuses_writes(void) {
+    uint8_t sector[SD_DISK_SECTOR_SIZE];
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    memset(sector, 0x5A, sizeof(sector));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, sector, 9000U, 1));
+
+    /* The dirty line goes to the card before the flag is set. */
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetReadOnly(0, true));
+    TEST_ASSERT_EQUAL(1U, card_writes());
+    TEST_ASSERT_TRUE(SD_DiskIsReadOnly(0));
+    TEST_ASSERT_EQUAL(STA_PROTECT, SD_disk_status(0) & STA_PROTECT);
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(RES_WRPRT, SD_disk_write(0, sector, 9001U, 1));
+    SD_IoVec iov = {sector, sizeof(sector)};
+    TEST_ASSERT_EQUAL(RES_WRPRT, SD_disk_writev(0, &iov, 1U, 9002U));
+    DWORD range[2] = {9000U, 9007U};
+    TEST_ASSERT_EQUAL(RES_WRPRT, SD_disk_ioctl(0, CTRL_TRIM, range));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_ioctl(0, CTRL_SYNC, NULL));
+    TEST_ASSERT_EQUAL(0U, card_writes());
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, sector, 9000U, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x5A, sector[0]);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetReadOnly(0, false));
+    TEST_ASSERT_EQUAL(0, SD_disk_status(0) & STA_PROTECT);
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, sector, 9001U, 1));
+}
+
+void test_readonly_mount_refuses_writes_and_reads(void) {
+    static uint8_t back[FILE_BYTES];
+    FILINFO fno;
+    UINT br;
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_readonly());
+    mock_card_reset_stats();
+
+    TEST_ASSERT_EQUAL(FR_WRITE_PROTECTED,
+                      f_open(&s_fil, "0:/new.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_WRITE_PROTECTED, f_open(&s_fil, "0:/data.bin", FA_READ | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_WRITE_PROTECTED, f_mkdir("0:/more"));
+    TEST_ASSERT_EQUAL(FR_WRITE_PROTECTED, f_unlink("0:/data.bin"));
+    TEST_ASSERT_EQUAL(FR_WRITE_PROTECTED, f_rename("0:/data.bin", "0:/moved.bin"));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/logs", &fno));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/data.bin", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, back, FILE_BYTES, &br));
+    TEST_ASSERT_EQUAL(FILE_BYTES, br);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_MEMORY(s_buf, back, FILE_BYTES);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(0U, card_writes());
+}
+
+/* No free-space scan on FAT16 (no FSINFO): the count stays unknown. */
+void test_readonly_mount_skips_free_scan(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_readonly());
+    TEST_ASSERT_FALSE(sd_free_space_get(NULL, NULL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_TRUE(sd_free_space_get(NULL, NULL));
+}
+
+void test_readonly_mount_raises_caches_and_unmount_restores(void) {
+    SD_DiskCacheStats st;
+    uint32_t fat, dir, data;
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, 3U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, 0U));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_readonly());
+    SD_DiskGetCacheStats(0, &st);
+    TEST_ASSERT_EQUAL(SD_CACHE_LINES, st.sectors.lines);
+    TEST_ASSERT_EQUAL(SD_READAHEAD_SECTORS, st.readahead_window);
+    TEST_ASSERT_EQUAL(SD_FAT_CACHE_GROUPS, st.fat_groups);
+    SD_CacheGetClassLines(&fat, &dir, &data);
+    TEST_ASSERT_EQUAL(2U, fat);
+    TEST_ASSERT_EQUAL(2U, dir);
+    TEST_ASSERT_EQUAL(SD_CACHE_LINES - 4U, data);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_FALSE(SD_DiskIsReadOnly(0));
+    SD_DiskGetCacheStats(0, &st);
+    TEST_ASSERT_EQUAL(3U, st.sectors.lines);
+    TEST_ASSERT_EQUAL(1U, st.readahead_window);
+    TEST_ASSERT_EQUAL(0U, st.fat_groups);
+    SD_CacheGetClassLines(&fat, &dir, &data);
+    TEST_ASSERT_EQUAL(0U, data);
+
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, SD_CACHE_LINES);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_READAHEAD, SD_READAHEAD_SECTORS);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_FAT, SD_FAT_CACHE_GROUPS);
+}
+
+/* Rereading a file once it is in the data lines and the window costs no card reads. */
+void test_readonly_data_reads_served_from_ram(void) {
+    uint8_t back[SD_DISK_SECTOR_SIZE];
+    mock_card_stats_t card;
+    UINT br;
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_readonly());
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/data.bin", FA_READ));
+    for (uint32_t i = 0; i < 4U; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, back, sizeof(back), &br));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 0));
+    mock_card_reset_stats();
+    for (uint32_t i = 0; i < 4U; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, back, sizeof(back), &br));
+        TEST_ASSERT_EQUAL_MEMORY(&s_buf[i * sizeof(back)], back, sizeof(back));
+    }
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL(0U, card.sectors_read);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* sd_mount over a read-only mount that was never unmounted is writable again. */
+void test_writable_mount_clears_readonly(void) {
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_readonly());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_FALSE(SD_DiskIsReadOnly(0));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/new.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "ok", 2U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_drive_flag_refuses_writes);
+    RUN_TEST(test_readonly_mount_refuses_writes_and_reads);
+    RUN_TEST(test_readonly_mount_skips_free_scan);
+    RUN_TEST(test_readonly_mount_raises_caches_and_unmount_restores);
+    RUN_TEST(test_readonly_data_reads_served_from_ram);
+    RUN_TEST(test_writable_mount_clears_readonly);
+    return UNITY_END();
+}
@@ -0,0 +1,180 @@
+/*
+ * tests/test_sd_readsession.c
+ *
+ * Read sessions (SD_READ_SESSION=1) over the card emulator: sequential
+ * single-block reads share one open CMD18 with no chip-select traffic, runs
+ * carry on runs, and the session is stopped with one CMD12 by a jump, a
+ * write, SD_Sync, a status query or the idle limit, with SD_IdlePoll
+ * releasing the card. Data must match the image throughout, polled and with
+ * the DMA read pipeline.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_readsession.img"
+#define CARD_BLOCKS 8192U
+#define BASE        100U
+#define SPAN        32U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[SPAN * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_want[SPAN * 512U];
+
+static void fill(uint8_t *dst, uint32_t count, uint8_t seed) {
+    for (uint32_t i = 0; i < count * 512U; i++) {
+        dst[i] = (uint8_t)(seed + i * 7U + (i >> 9));
+    }
+}
+
+static uint32_t card_cmd(uint32_t index) {
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    return st.cmd[index];
+}
+
+static void start(bool use_dma) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, use_dma));
+    mock_hal_set_dma_enabled(use_dma);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    fill(s_want, SPAN, 0x31U);
+    memcpy(s_buf, s_want, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, BASE, SPAN));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    memset(s_buf, 0, sizeof(s_buf));
+    mock_card_reset_stats();
+    SD_ResetStats(&sd);
+}
+
+/* Read blocks first..first+count-1 one call each and check them. */
+static void read_singles(uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; i++) {
+        TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, &s_buf[i * 512U], BASE + i, 1U));
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(&s_want[i * 512U], &s_buf[i * 512U], 512);
+    }
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_Session_SequentialSinglesShareOneCmd18(void) {
+    start(false);
+    read_singles(0U, 1U); /* nothing to follow on from: CMD17 */
+    int selects = mock_hal_gpio_write_calls;
+    read_singles(1U, 1U); /* follows on: opens the session */
+    read_singles(2U, 14U);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(17));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(18));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_cmd(12));
+    TEST_ASSERT_EQUAL_UINT32(14U, sd.stats.session_reads);
+    /* One select for the CMD18; the card stays selected after it. */
+    TEST_ASSERT_EQUAL(selects + 1, mock_hal_gpio_write_calls);
+
+    /* A jump stops it and is a plain CMD17. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, BASE + 20U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&s_want[20U * 512U], s_buf, 512);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(12));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(17));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.session_stops);
+}
+
+void test_Session_RunsCarryOnRuns(void) {
+    start(false);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, BASE, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, &s_buf[8U * 512U], BASE + 8U, 8U));
+    read_singles(16U, 2U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, &s_buf[18U * 512U], BASE + 18U, 14U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, sizeof(s_buf));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(18));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_cmd(17));
+    TEST_ASSERT_EQUAL_UINT32(4U, sd.stats.session_reads);
+}
+
+void test_Session_DmaPipelineCarriesOn(void) {
+    start(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, BASE, 4U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, &s_buf[4U * 512U], BASE + 4U, 4U));
+    read_singles(8U, 4U);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, 12U * 512U);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(18));
+    TEST_ASSERT_EQUAL_UINT32(5U, sd.stats.session_reads);
+}
+
+void test_Session_WriteStopsItAndReadsSeeTheNewData(void) {
+    start(false);
+    read_singles(0U, 4U);
+    fill(&s_want[4U * 512U], 1U, 0xA5U);
+    memcpy(&s_buf[4U * 512U], &s_want[4U * 512U], 512U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, &s_buf[4U * 512U], BASE + 4U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(12));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.session_stops);
+
+    /* The write ended where the last read did, so block 4 opens a new session. */
+    memset(s_buf, 0, sizeof(s_buf));
+    read_singles(4U, 1U);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(17));
+    read_singles(5U, 3U);
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(18));
+}
+
+void test_Session_SyncAndStatusStopIt(void) {
+    start(false);
+    read_singles(0U, 3U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(12));
+    read_singles(3U, 2U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_CheckStatus(&sd));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(12));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(13));
+    read_singles(5U, 2U);
+    TEST_ASSERT_EQUAL_UINT32(3U, card_cmd(18));
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.session_stops);
+}
+
+void test_Session_IdleLimitStopsIt(void) {
+    start(false);
+    read_singles(0U, 3U);
+    HAL_Delay(SD_READ_SESSION_IDLE_MS);
+    read_singles(3U, 1U); /* too late to carry on: a new CMD18 */
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(18));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(12));
+
+    /* SD_IdlePoll leaves a fresh session alone, then releases the card. */
+    int selects = mock_hal_gpio_write_calls;
+    TEST_ASSERT_FALSE(SD_IdlePoll(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(12));
+    TEST_ASSERT_EQUAL(selects, mock_hal_gpio_write_calls);
+    HAL_Delay(SD_READ_SESSION_IDLE_MS);
+    TEST_ASSERT_FALSE(SD_IdlePoll(&sd));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(12));
+    TEST_ASSERT_EQUAL(selects + 1, mock_hal_gpio_write_calls);
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.session_stops);
+
+    /* Following on still opens a session again. */
+    read_singles(4U, 2U);
+    TEST_ASSERT_EQUAL_UINT32(3U, card_cmd(18));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Session_SequentialSinglesShareOneCmd18);
+    RUN_TEST(test_Session_RunsCarryOnRuns);
+    RUN_TEST(test_Session_DmaPipelineCarriesOn);
+    RUN_TEST(test_Session_WriteStopsItAndReadsSeeTheNewData);
+    RUN_TEST(test_Session_SyncAndStatusStopIt);
+    RUN_TEST(test_Session_IdleLimitStopsIt);
+    return UNITY_END();
+}
@@ -1,7 +1,8 @@
 /*
  * tests/test_sd_readwrite.c
  *
- * Tests for SD_ReadBlocks and SD_WriteBlocks (single-block path).
+ * Tests for SD_ReadBlocks and SD_WriteBlocks (single-block path), and their
+ * deadline variants.
  */
 
 #include "unity.h"
@@ -127,6 +128,27 @@ void test_ReadBlocks_SDHC_SectorPassedDirectly(void) {
     TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 100U, 1));
 }
 
+void test_ReadBlocks_CMD17_FramedAsSingleTransmit(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_single_read(0x99U);
+
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+    int tx_calls = mock_hal_transmit_calls;
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 100U, 1));
+
+    /* One transfer for the command frame, one for the trailing deselect clock. */
+    TEST_ASSERT_EQUAL(tx_calls + 2, mock_hal_transmit_calls);
+
+    size_t log_len;
+    const uint8_t *log = mock_hal_tx_log(&log_len);
+    static const uint8_t expected[] = {0xFFU, 0x51U, 0x00U, 0x00U, 0x00U, 0x64U, 0xFFU};
+    TEST_ASSERT_EQUAL(log_start + sizeof(expected) + 1U, log_len);
+    TEST_ASSERT_EQUAL(0, memcmp(expected, &log[log_start], sizeof(expected)));
+}
+
 /* -----------------------------------------------------------------------
  * SD_ReadBlocks — CMD17 error conditions
  * ----------------------------------------------------------------------- */
@@ -387,10 +409,216 @@ void test_WriteBlocks_Stats_NotIncrementedOnFailure(void) {
     TEST_ASSERT_EQUAL_UINT32(0U, s.write_blocks);
 }
 
+/* -----------------------------------------------------------------------
+ * DMA with unaligned buffers (bounce buffer)
+ * ----------------------------------------------------------------------- */
+
+static uint8_t raw[512 + 1] __attribute__((aligned(32)));
+
+void test_ReadBlocks_Dma_AlignedBuffer_CountedDirect(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_single_read(0x3CU);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.dma_direct_blocks);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.dma_bounced_blocks);
+}
+
+void test_ReadBlocks_Dma_UnalignedBuffer_BouncedThroughDma(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_single_read(0x3CU);
+    uint8_t *buf = raw + 1;
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT8(0x3CU, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x3CU, buf[511]);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.dma_direct_blocks);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.dma_bounced_blocks);
+}
+
+void test_WriteBlocks_Dma_UnalignedBuffer_BouncedThroughDma(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_single_write_accepted();
+    uint8_t *buf = raw + 1;
+    for (int i = 0; i < 512; i++) {
+        buf[i] = (uint8_t)i;
+    }
+
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_tx_calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.dma_bounced_blocks);
+
+    /* Command frame, start token, then the caller's data unchanged */
+    size_t log_len;
+    const uint8_t *log = mock_hal_tx_log(&log_len);
+    TEST_ASSERT_EQUAL_HEX8(0xFEU, log[log_start + 7U]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(buf, &log[log_start + 8U], 512);
+}
+
+/* -----------------------------------------------------------------------
+ * Transport backends (SD_SetTransport)
+ * ----------------------------------------------------------------------- */
+
+void test_ReadBlocks_Dma_ShortTransfersPolled(void) {
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_single_read(0x3CU);
+    SD_ResetStats(&sd);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    /* Only the block itself pays for DMA set-up; frame, R1, token and CRC are polled. */
+    TEST_ASSERT_EQUAL(1, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.xfers[SD_XFER_DMA]);
+    TEST_ASSERT_TRUE(sd.stats.xfers[SD_XFER_POLL] >= 4U);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.xfers[SD_XFER_IRQ]);
+}
+
+void test_ReadBlocks_Dma_ThresholdAboveBlock_Polled(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetTransport(&sd, SD_XFER_DMA, 1024U));
+    push_single_read(0x3CU);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw, 0, 1));
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT8(0x3CU, raw[511]);
+}
+
+void test_ReadBlocks_Irq_UnalignedBuffer_NoBounce(void) {
+    do_sdhc_init(&sd, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetTransport(&sd, SD_XFER_IRQ, SD_XFER_THRESHOLD));
+    push_single_read(0x5AU);
+    uint8_t *buf = raw + 1;
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_it_rx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT8(0x5AU, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x5AU, buf[511]);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.dma_bounced_blocks);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.xfers[SD_XFER_IRQ]);
+}
+
+void test_WriteBlocks_Irq_DataSentByInterrupt(void) {
+    do_sdhc_init(&sd, 8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetTransport(&sd, SD_XFER_IRQ, SD_XFER_THRESHOLD));
+    push_single_write_accepted();
+    uint8_t buf[512];
+    for (int i = 0; i < 512; i++) {
+        buf[i] = (uint8_t)(i * 3);
+    }
+
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL(1, mock_hal_it_tx_calls);
+    TEST_ASSERT_EQUAL(0, mock_hal_dma_tx_calls);
+
+    size_t log_len;
+    const uint8_t *log = mock_hal_tx_log(&log_len);
+    TEST_ASSERT_EQUAL_HEX8(0xFEU, log[log_start + 7U]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(buf, &log[log_start + 8U], 512);
+}
+
+void test_SetTransport_InvalidMode_ReturnsParam(void) {
+    do_sdhc_init(&sd, 8192U);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetTransport(&sd, SD_XFER_COUNT, 0U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetTransport(NULL, SD_XFER_POLL, 0U));
+}
+
 /* -----------------------------------------------------------------------
  * Main
  * ----------------------------------------------------------------------- */
 
+/* -----------------------------------------------------------------------
+ * SD_ReadBlocksDeadline / SD_WriteBlocksDeadline
+ * ----------------------------------------------------------------------- */
+
+void test_ReadBlocksDeadline_WithinDeadline_CountedNotMissed(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_set_tick(1000U);
+    push_single_read(0x5AU);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocksDeadline(&sd, buf, 0, 1, 1050U));
+    TEST_ASSERT_EQUAL_UINT8(0x5AU, buf[0]);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.deadline_requests);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.deadline_misses);
+}
+
+void test_ReadBlocksDeadline_AlreadyPassed_TimeoutWithoutIo(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_set_tick(1000U);
+    push_single_read(0x5AU);
+    int depth = mock_hal_queue_depth();
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_ReadBlocksDeadline(&sd, buf, 0, 1, 1000U));
+    TEST_ASSERT_EQUAL(depth, mock_hal_queue_depth());
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.deadline_misses);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.read_ops);
+}
+
+/* Each backoff costs 1 ms, so a deadline 1 ms away leaves room for one retry. */
+void test_ReadBlocksDeadline_NoRetryAfterDeadline(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_set_tick(1000U);
+    for (int i = 0; i < 3; i++) {
+        push_wait_ready();
+        push_r1(0x04U);
+    }
+    int attempt_bytes = mock_hal_queue_depth() / 3;
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_ReadBlocksDeadline(&sd, buf, 0, 1, 1001U));
+    TEST_ASSERT_EQUAL(attempt_bytes, mock_hal_queue_depth());
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.deadline_requests);
+}
+
+void test_ReadBlocksDeadline_RetryWithinDeadline_Succeeds(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_set_tick(1000U);
+    push_wait_ready();
+    push_r1(0x04U);
+    push_single_read(0x5AU);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocksDeadline(&sd, buf, 0, 1, 1001U));
+    TEST_ASSERT_EQUAL_UINT8(0x5AU, buf[0]);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.deadline_misses);
+}
+
+void test_WriteBlocksDeadline_AlreadyPassed_TimeoutWithoutIo(void) {
+    do_sdhc_init(&sd, 8192U);
+    mock_hal_set_tick(500U);
+    size_t log_start;
+    (void)mock_hal_tx_log(&log_start);
+
+    uint8_t buf[512] = {0};
+    TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_WriteBlocksDeadline(&sd, buf, 0, 1, 499U));
+    size_t log_len;
+    (void)mock_hal_tx_log(&log_len);
+    TEST_ASSERT_EQUAL(log_start, log_len);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.deadline_misses);
+}
+
+void test_ReadBlocksDeadline_NullBuffer_ReturnsParam(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocksDeadline(&sd, NULL, 0, 1, 100U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_WriteBlocksDeadline(NULL, NULL, 0, 1, 100U));
+}
+
 int main(void) {
     UNITY_BEGIN();
 
@@ -406,6 +634,7 @@ int main(void) {
     RUN_TEST(test_ReadBlocks_SingleBlock_SDHC_HappyPath);
     RUN_TEST(test_ReadBlocks_SingleBlock_SDSC_AddressNotShifted);
     RUN_TEST(test_ReadBlocks_SDHC_SectorPassedDirectly);
+    RUN_TEST(test_ReadBlocks_CMD17_FramedAsSingleTransmit);
 
     RUN_TEST(test_ReadBlocks_CMD17_ErrorResponse_ReturnsError);
     RUN_TEST(test_ReadBlocks_DataTokenTimeout_ReturnsTimeout);
@@ -435,5 +664,22 @@ int main(void) {
     RUN_TEST(test_WriteBlocks_Stats_IncrementedOnSuccess);
     RUN_TEST(test_WriteBlocks_Stats_NotIncrementedOnFailure);
 
+    RUN_TEST(test_ReadBlocks_Dma_AlignedBuffer_CountedDirect);
+    RUN_TEST(test_ReadBlocks_Dma_UnalignedBuffer_BouncedThroughDma);
+    RUN_TEST(test_WriteBlocks_Dma_UnalignedBuffer_BouncedThroughDma);
+
+    RUN_TEST(test_ReadBlocks_Dma_ShortTransfersPolled);
+    RUN_TEST(test_ReadBlocks_Dma_ThresholdAboveBlock_Polled);
+    RUN_TEST(test_ReadBlocks_Irq_UnalignedBuffer_NoBounce);
+    RUN_TEST(test_WriteBlocks_Irq_DataSentByInterrupt);
+    RUN_TEST(test_SetTransport_InvalidMode_ReturnsParam);
+
+    RUN_TEST(test_ReadBlocksDeadline_WithinDeadline_CountedNotMissed);
+    RUN_TEST(test_ReadBlocksDeadline_AlreadyPassed_TimeoutWithoutIo);
+    RUN_TEST(test_ReadBlocksDeadline_NoRetryAfterDeadline);
+    RUN_TEST(test_ReadBlocksDeadline_RetryWithinDeadline_Succeeds);
+    RUN_TEST(test_WriteBlocksDeadline_AlreadyPassed_TimeoutWithoutIo);
+    RUN_TEST(test_ReadBlocksDeadline_NullBuffer_ReturnsParam);
+
     return UNITY_END();
 }
@@ -0,0 +1,103 @@
+/*
+ * tests/test_sd_ready.c
+ *
+ * Ready tracking (SD_READY_TRACKING, on by default) over the card emulator,
+ * timed by the mock HAL simulator with a fixed program busy: a command
+ * after a CMD17 goes out without a ready wait, while CMD12 after a CMD18
+ * and the busy of a write are still waited out before the next command.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_ready.img"
+#define CARD_BLOCKS 8192U
+#define BUSY_US     5000U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[4U * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_want[4U * 512U];
+
+static void fill(uint8_t *dst, uint32_t count, uint8_t seed) {
+    for (uint32_t i = 0; i < count * 512U; i++) {
+        dst[i] = (uint8_t)(seed + i * 11U);
+    }
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    fill(s_want, 4U, 0x21U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_want, 40U, 4U));
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_Ready_ReadAfterReadSkipsWait(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 40U, 1U));
+    uint32_t skips = sd.stats.ready_skips;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf + 512U, 41U, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf + 1024U, 42U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(skips + 2U, sd.stats.ready_skips);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, 3U * 512U);
+}
+
+void test_Ready_MultiBlockStopIsWaitedOut(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 40U, 3U));
+    uint32_t skips = sd.stats.ready_skips;
+    /* CMD12 is R1b: the read after it waits for ready first. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf + 1536U, 43U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(skips, sd.stats.ready_skips);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, 4U * 512U);
+}
+
+void test_Ready_WriteBusyStillWaited(void) {
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    cfg.program_busy.min_us = BUSY_US;
+    cfg.program_busy.max_us = BUSY_US;
+    cfg.program_busy.tail_permille = 0U;
+    mock_hal_sim_enable(&cfg);
+
+    fill(s_want, 1U, 0x77U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 41U, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_want, 40U, 1U));
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    TEST_ASSERT_TRUE(rep.elapsed_ns >= (uint64_t)BUSY_US * 1000ULL);
+
+    /* The write waited its busy out in place, so the next command need not. */
+    uint32_t skips = sd.stats.ready_skips;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 40U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(skips + 1U, sd.stats.ready_skips);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, 512U);
+}
+
+void test_Ready_ReinitWaitsAgain(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 40U, 1U));
+    TEST_ASSERT_TRUE(sd.card_ready);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 40U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, 512U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Ready_ReadAfterReadSkipsWait);
+    RUN_TEST(test_Ready_MultiBlockStopIsWaitedOut);
+    RUN_TEST(test_Ready_WriteBusyStillWaited);
+    RUN_TEST(test_Ready_ReinitWaitsAgain);
+    return UNITY_END();
+}
@@ -0,0 +1,115 @@
+/*
+ * tests/test_sd_reattach.c
+ *
+ * Hot swap with SD_Reattach (SD_CARD_INFO=1) on the card emulator: a second,
+ * larger card put in the socket is identified on the same handle, which keeps
+ * its slot, transport setting and statistics while the capacity and card info
+ * follow the new card; handles SD_Init never registered are refused.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE_A  "test_sd_reattach_a.img"
+#define IMAGE_B  "test_sd_reattach_b.img"
+#define BLOCKS_A 8192U
+#define BLOCKS_B 16384U
+
+static SD_Handle_t sd;
+static uint8_t s_block[512];
+
+static void insert(const char *image, uint32_t blocks) {
+    TEST_ASSERT_TRUE(mock_card_open(image, blocks));
+    mock_card_attach();
+}
+
+/* Pull the card and put the other one in; the handle is left as it was. */
+static void swap(const char *image, uint32_t blocks) {
+    mock_card_close();
+    insert(image, blocks);
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    insert(IMAGE_A, BLOCKS_A);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+}
+
+void test_Reattach_NewCard_KeepsHandleSettings(void) {
+    SD_Stats st;
+    uint8_t instance = sd.instance;
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetTransport(&sd, SD_XFER_POLL, 64U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_block, 10U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS_A, SD_GetBlockCount(&sd));
+
+    swap(IMAGE_B, BLOCKS_B);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Reattach(&sd));
+    TEST_ASSERT_TRUE(SD_IsInitialized(&sd));
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS_B, SD_GetBlockCount(&sd));
+    TEST_ASSERT_EQUAL_UINT8(instance, sd.instance);
+    TEST_ASSERT_EQUAL_UINT16(64U, sd.xfer_threshold);
+
+    /* The new card is usable past the old one's end. */
+    memset(s_block, 0x5A, sizeof(s_block));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_block, BLOCKS_A + 100U, 1U));
+    memset(s_block, 0, sizeof(s_block));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_block, BLOCKS_A + 100U, 1U));
+    TEST_ASSERT_EQUAL_HEX8(0x5AU, s_block[511]);
+
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.write_ops);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.init_attempts);
+}
+
+void test_Reattach_RefreshesCardInfo(void) {
+    SD_CardInfo info;
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetCardInfo(&sd, &info));
+    TEST_ASSERT_EQUAL_UINT8(10U, info.speed_class);
+
+    mock_card_close();
+    insert(IMAGE_B, BLOCKS_B);
+    mock_card_set_speed(2U, 0U, 0U); /* Class 4 */
+    TEST_ASSERT_EQUAL(SD_OK, SD_Reattach(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetCardInfo(&sd, &info));
+    TEST_ASSERT_EQUAL_UINT8(4U, info.speed_class);
+}
+
+void test_Reattach_EmptySocket_LeavesHandleUninitialized(void) {
+    mock_card_close();
+    TEST_ASSERT_NOT_EQUAL(SD_OK, SD_Reattach(&sd));
+    TEST_ASSERT_FALSE(SD_IsInitialized(&sd));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_GetBlockCount(&sd));
+
+    insert(IMAGE_A, BLOCKS_A);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Reattach(&sd));
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS_A, SD_GetBlockCount(&sd));
+}
+
+void test_Reattach_UnregisteredHandle_Refused(void) {
+    SD_Handle_t other;
+    memset(&other, 0, sizeof(other));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_Reattach(NULL));
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_Reattach(&other));
+    SD_DeInit(&sd);
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_Reattach(&sd));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Reattach_NewCard_KeepsHandleSettings);
+    RUN_TEST(test_Reattach_RefreshesCardInfo);
+    RUN_TEST(test_Reattach_EmptySocket_LeavesHandleUninitialized);
+    RUN_TEST(test_Reattach_UnregisteredHandle_Refused);
+    return UNITY_END();
+}
@@ -0,0 +1,161 @@
+/*
+ * tests/test_sd_recovery.c
+ *
+ * Error recovery between retries (SD_RECOVERY=1, see CMakeLists.txt): the
+ * CMD12/CMD13 probe, the down-clock after a CRC error, re-identification of
+ * a card that reports idle or a stuck error, and giving up on a silent card.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+
+/* CMD12 (response ignored), then CMD13 answering R1/R2. */
+static void push_recovery_probe(uint8_t r1, uint8_t r2) {
+    push_cmd_exchange(0x00U); /* CMD12 */
+    push_cmd_exchange(r1);    /* CMD13 R1 */
+    mock_hal_push_byte(r2);   /* CMD13 R2 */
+}
+
+static void push_read_rejected(void) {
+    push_wait_ready();
+    push_r1(0x04U); /* CMD17 illegal command */
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+}
+
+void tearDown(void) {}
+
+void test_Recovery_CardReady_RetriesAfterStatusProbe(void) {
+    push_read_rejected();
+    push_recovery_probe(0x00U, 0x00U);
+    push_single_read(0xA5U);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8(0xA5U, buf[0]);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(12));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(13));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_STATUS]);
+    TEST_ASSERT_EQUAL_HEX32(0x0000U, sd.stats.last_card_status);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.init_attempts);
+}
+
+void test_Recovery_CrcError_StepsBusDownOneNotch(void) {
+    uint32_t before = SD_GetBusPrescaler(&sd);
+    push_single_write_crc_error();
+    push_recovery_probe(0x00U, 0x00U);
+    push_single_write_accepted();
+
+    uint8_t buf[512] = {0};
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_DOWNCLOCK]);
+    TEST_ASSERT_EQUAL_HEX32(before + (SPI_BAUDRATEPRESCALER_4 - SPI_BAUDRATEPRESCALER_2),
+                            SD_GetBusPrescaler(&sd));
+}
+
+void test_Recovery_IdleCard_Reidentified(void) {
+    push_read_rejected();
+    push_recovery_probe(0x01U, 0x00U); /* back in idle: it lost power */
+    push_sdhc_init(8192U);
+    push_single_read(0x5AU);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8(0x5AU, buf[511]);
+    TEST_ASSERT_TRUE(SD_IsInitialized(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_REINIT]);
+    TEST_ASSERT_EQUAL_HEX32(0x0100U, sd.stats.last_card_status);
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.init_attempts);
+}
+
+/* A CC error that survives the clearing status read means a wedged controller. */
+void test_Recovery_StuckError_Reidentified(void) {
+    push_read_rejected();
+    push_recovery_probe(0x00U, 0x08U);
+    push_cmd_exchange(0x00U); /* second CMD13 */
+    mock_hal_push_byte(0x08U);
+    push_sdhc_init(8192U);
+    push_single_read(0x11U);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL(2, count_cmd_frames(13));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_REINIT]);
+    TEST_ASSERT_EQUAL_HEX32(0x0008U, sd.stats.last_card_status);
+}
+
+void test_Recovery_TransientError_ClearedByStatusRead(void) {
+    push_read_rejected();
+    push_recovery_probe(0x00U, 0x04U);
+    push_cmd_exchange(0x00U); /* second CMD13: cleared */
+    mock_hal_push_byte(0x00U);
+    push_single_read(0x22U);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_STATUS]);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.recoveries[SD_RECOVER_REINIT]);
+}
+
+void test_Recovery_SilentCard_GivesUpWithoutRetrying(void) {
+    push_read_rejected();
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_FALSE(SD_IsInitialized(&sd));
+    TEST_ASSERT_EQUAL(1, count_cmd_frames(17));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_FAILED]);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFU, sd.stats.last_card_status);
+    TEST_ASSERT_TRUE(sd.stats.recovery_max_ms <= sd.stats.recovery_ms);
+}
+
+void test_Recovery_MultiBlock_ResumesAfterProbe(void) {
+    uint8_t data[512];
+    memset(data, 0x31U, sizeof(data));
+    push_cmd_exchange(0x00U); /* CMD18 */
+    push_data_token();
+    mock_hal_push_bytes(data, sizeof(data));
+    push_crc();
+    for (int j = 0; j < 200; j++) {
+        mock_hal_push_byte(0x00U); /* no second token */
+    }
+    push_cmd_exchange(0x00U); /* CMD12 of the run */
+    push_recovery_probe(0x00U, 0x00U);
+    push_cmd_exchange(0x00U); /* CMD18 from block 1 */
+    memset(data, 0x32U, sizeof(data));
+    push_data_token();
+    mock_hal_push_bytes(data, sizeof(data));
+    push_crc();
+    push_cmd_exchange(0x00U); /* CMD12 */
+
+    uint8_t buf[1024];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    TEST_ASSERT_EQUAL_UINT8(0x31U, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x32U, buf[512]);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.recoveries[SD_RECOVER_STATUS]);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.resumes);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Recovery_CardReady_RetriesAfterStatusProbe);
+    RUN_TEST(test_Recovery_CrcError_StepsBusDownOneNotch);
+    RUN_TEST(test_Recovery_IdleCard_Reidentified);
+    RUN_TEST(test_Recovery_StuckError_Reidentified);
+    RUN_TEST(test_Recovery_TransientError_ClearedByStatusRead);
+    RUN_TEST(test_Recovery_SilentCard_GivesUpWithoutRetrying);
+    RUN_TEST(test_Recovery_MultiBlock_ResumesAfterProbe);
+
+    return UNITY_END();
+}
@@ -0,0 +1,317 @@
+/*
+ * tests/test_sd_recstore.c
+ *
+ * Record store (sd_recstore.h) over the real FatFs and the card emulator,
+ * built with SD_RECSTORE_HEADER_PAGES=4: round trip across pages, appends
+ * that cost one block write per page and none in the FAT or directory,
+ * lookup by timestamp in log2(pages) reads, reopening after close and after
+ * a crash, a torn page, wrap-around and a full non-wrapping store.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_recstore.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_recstore.img"
+#define CARD_BLOCKS 131072U /* 64 MiB */
+#define REC         16U
+#define PER_PAGE    24U /* (512 - 28) / (4 + 16) */
+#define PAGES       64U
+#define STORE_BYTES ((PAGES + 1U) * 512U)
+
+static FATFS s_fs;
+static char s_path[4];
+static SD_RecStore s_rs;
+
+static SD_RecStoreStats stats(void) {
+    SD_RecStoreStats st;
+    sd_recstore_get_stats(&s_rs, &st);
+    return st;
+}
+
+static void make_record(uint32_t i, uint8_t *rec) {
+    for (uint32_t k = 0; k < REC; k++) {
+        rec[k] = (uint8_t)(i * 7U + k);
+    }
+}
+
+/* Record i has timestamp 10 * i. */
+static void append_from(uint32_t first, uint32_t count) {
+    uint8_t rec[REC];
+    for (uint32_t i = first; i < first + count; i++) {
+        make_record(i, rec);
+        TEST_ASSERT_EQUAL(FR_OK, sd_recstore_append(&s_rs, 10U * i, rec));
+    }
+}
+
+static void check_record(uint32_t i) {
+    uint8_t rec[REC], want[REC];
+    uint32_t ts = 0;
+    make_record(i, want);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_read(&s_rs, i, &ts, rec));
+    TEST_ASSERT_EQUAL_UINT32(10U * i, ts);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(want, rec, REC);
+}
+
+static void remount(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT32, 512);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+void tearDown(void) {
+    if (s_rs.open) {
+        (void)sd_recstore_close(&s_rs);
+    }
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Appends and reads
+ * ----------------------------------------------------------------------- */
+
+void test_RecStore_Create_PreallocatesContiguousFile(void) {
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("rec.dat", &fno));
+    TEST_ASSERT_EQUAL_UINT32(STORE_BYTES, fno.fsize);
+
+    SD_RecStoreStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(PAGES, st.pages);
+    TEST_ASSERT_EQUAL_UINT32(PER_PAGE, st.per_page);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.records);
+}
+
+void test_RecStore_AppendRead_RoundTripAcrossPages(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 3U * PER_PAGE + 5U);
+    for (uint32_t i = 0; i < 3U * PER_PAGE + 5U; i++) {
+        check_record(i);
+    }
+    SD_RecStoreStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(3U * PER_PAGE + 5U, st.records);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.page_writes);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_recstore_read(&s_rs, 3U * PER_PAGE + 5U, NULL, NULL));
+}
+
+/* The hot path: one single-block write per page, all of them inside the file. */
+void test_RecStore_Append_OneBlockPerPage_NoFatOrDirectory(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    mock_card_reset_stats();
+    append_from(0, 10U * PER_PAGE);
+
+    mock_card_stats_t st = card_stats();
+    SD_RecStoreStats rs = stats();
+    TEST_ASSERT_EQUAL_UINT32(10U, rs.page_writes);
+    TEST_ASSERT_EQUAL_UINT32(3U, rs.header_writes); /* creation, pages 4 and 8 */
+    TEST_ASSERT_EQUAL_UINT32(12U, st.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(12U, st.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[17] + st.cmd[18]);
+    TEST_ASSERT_TRUE(s_rs.first_sector >= s_fs.database);
+}
+
+void test_RecStore_DecreasingTimestamp_Rejected(void) {
+    uint8_t rec[REC] = {0};
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_append(&s_rs, 100U, rec));
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_append(&s_rs, 100U, rec));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_recstore_append(&s_rs, 99U, rec));
+    TEST_ASSERT_EQUAL_UINT32(2U, stats().records);
+}
+
+void test_RecStore_RecordTooLarge_Rejected(void) {
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER,
+                      sd_recstore_open(&s_rs, "rec.dat", 512U - 31U, STORE_BYTES, false));
+    TEST_ASSERT_FALSE(s_rs.open);
+}
+
+/* -----------------------------------------------------------------------
+ * Lookup by timestamp
+ * ----------------------------------------------------------------------- */
+
+void test_RecStore_Find_BinarySearchOverPages(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 40U * PER_PAGE + 3U);
+
+    uint32_t index = 0;
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_find(&s_rs, 10U * 500U + 5U, &index));
+    TEST_ASSERT_EQUAL_UINT32(501U, index);
+    TEST_ASSERT_TRUE(card_stats().cmd[17] <= 7U); /* log2(41) + 1 */
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_find(&s_rs, 0U, &index));
+    TEST_ASSERT_EQUAL_UINT32(0U, index);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_find(&s_rs, 10U * 963U, &index));
+    TEST_ASSERT_EQUAL_UINT32(963U, index); /* in the page being filled */
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_find(&s_rs, 10U * 963U + 1U, &index));
+    TEST_ASSERT_EQUAL_UINT32(40U * PER_PAGE + 3U, index);
+    check_record(index - 1U);
+}
+
+/* -----------------------------------------------------------------------
+ * Reopen and recovery
+ * ----------------------------------------------------------------------- */
+
+void test_RecStore_CloseReopen_ContinuesWithoutScan(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 6U * PER_PAGE + 2U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_close(&s_rs));
+    remount();
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, 1024U, true));
+    SD_RecStoreStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(PAGES, st.pages); /* keeps its size and mode */
+    TEST_ASSERT_FALSE(s_rs.wrap);
+    TEST_ASSERT_EQUAL_UINT32(6U * PER_PAGE + 2U, st.records);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.recovered_pages); /* the partial page itself */
+
+    append_from(6U * PER_PAGE + 2U, PER_PAGE);
+    for (uint32_t i = 0; i < 7U * PER_PAGE + 2U; i++) {
+        check_record(i);
+    }
+}
+
+/* Power lost after a flush: the header is behind, the scan is bounded by the interval. */
+void test_RecStore_Crash_RecoveryScanBounded(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 11U * PER_PAGE + 7U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_flush(&s_rs));
+    s_rs.open = false; /* abandoned, never closed */
+    remount();
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    SD_RecStoreStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(11U * PER_PAGE + 7U, st.records);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.recovered_pages); /* pages 8..11 */
+    check_record(11U * PER_PAGE + 6U);
+
+    uint8_t rec[REC] = {0};
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_recstore_append(&s_rs, 1U, rec));
+    append_from(11U * PER_PAGE + 7U, PER_PAGE);
+    check_record(12U * PER_PAGE + 6U);
+}
+
+/* A page torn by power loss fails its CRC; recovery keeps everything before it. */
+void test_RecStore_TornPage_RecoveryStopsBeforeIt(void) {
+    uint8_t block[512];
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 5U * PER_PAGE + 7U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_flush(&s_rs));
+    uint32_t torn = s_rs.first_sector + 1U + 5U;
+    s_rs.open = false;
+    remount();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, block, torn, 1));
+    block[300] ^= 0x40U;
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&g_sd_handle, block, torn, 1));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    TEST_ASSERT_EQUAL_UINT32(5U * PER_PAGE, stats().records);
+    check_record(5U * PER_PAGE - 1U);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_recstore_read(&s_rs, 5U * PER_PAGE, NULL, NULL));
+}
+
+void test_RecStore_CorruptedPage_ReadFails(void) {
+    uint8_t block[512];
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 3U * PER_PAGE);
+    uint32_t sector = s_rs.first_sector + 1U + 1U;
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, block, sector, 1));
+    block[100] ^= 0x01U;
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&g_sd_handle, block, sector, 1));
+
+    TEST_ASSERT_EQUAL(FR_DISK_ERR, sd_recstore_read(&s_rs, PER_PAGE + 3U, NULL, NULL));
+    check_record(3U);
+    check_record(2U * PER_PAGE + 3U);
+}
+
+void test_RecStore_OtherRecordSize_Recreated(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, STORE_BYTES, false));
+    append_from(0, 2U * PER_PAGE);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_close(&s_rs));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", 28U, 9U * 512U, false));
+    SD_RecStoreStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, st.records);
+    TEST_ASSERT_EQUAL_UINT32(8U, st.pages);
+    TEST_ASSERT_EQUAL_UINT32(15U, st.per_page); /* 484 / 32 */
+}
+
+/* -----------------------------------------------------------------------
+ * Capacity
+ * ----------------------------------------------------------------------- */
+
+void test_RecStore_Wrap_OverwritesOldestPage(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "ring.dat", REC, 5U * 512U, true));
+    append_from(0, 6U * PER_PAGE + 1U);
+
+    SD_RecStoreStats st = stats();
+    TEST_ASSERT_EQUAL_UINT32(3U * PER_PAGE, st.first_index);
+    TEST_ASSERT_EQUAL_UINT32(3U * PER_PAGE + 1U, st.records);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_recstore_read(&s_rs, 3U * PER_PAGE - 1U, NULL, NULL));
+    check_record(3U * PER_PAGE);
+    check_record(6U * PER_PAGE);
+
+    uint32_t index = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_find(&s_rs, 0U, &index));
+    TEST_ASSERT_EQUAL_UINT32(3U * PER_PAGE, index);
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_find(&s_rs, 10U * (4U * PER_PAGE + 2U), &index));
+    TEST_ASSERT_EQUAL_UINT32(4U * PER_PAGE + 2U, index);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_close(&s_rs));
+    remount();
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "ring.dat", REC, 5U * 512U, true));
+    TEST_ASSERT_EQUAL_UINT32(3U * PER_PAGE, stats().first_index);
+    check_record(6U * PER_PAGE);
+}
+
+void test_RecStore_NoWrap_FullStoreDenied(void) {
+    uint8_t rec[REC] = {0};
+    TEST_ASSERT_EQUAL(FR_OK, sd_recstore_open(&s_rs, "rec.dat", REC, 3U * 512U, false));
+    append_from(0, 2U * PER_PAGE);
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_recstore_append(&s_rs, 1000000U, rec));
+    check_record(0);
+    check_record(2U * PER_PAGE - 1U);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_RecStore_Create_PreallocatesContiguousFile);
+    RUN_TEST(test_RecStore_AppendRead_RoundTripAcrossPages);
+    RUN_TEST(test_RecStore_Append_OneBlockPerPage_NoFatOrDirectory);
+    RUN_TEST(test_RecStore_DecreasingTimestamp_Rejected);
+    RUN_TEST(test_RecStore_RecordTooLarge_Rejected);
+
+    RUN_TEST(test_RecStore_Find_BinarySearchOverPages);
+
+    RUN_TEST(test_RecStore_CloseReopen_ContinuesWithoutScan);
+    RUN_TEST(test_RecStore_Crash_RecoveryScanBounded);
+    RUN_TEST(test_RecStore_TornPage_RecoveryStopsBeforeIt);
+    RUN_TEST(test_RecStore_CorruptedPage_ReadFails);
+    RUN_TEST(test_RecStore_OtherRecordSize_Recreated);
+
+    RUN_TEST(test_RecStore_Wrap_OverwritesOldestPage);
+    RUN_TEST(test_RecStore_NoWrap_FullStoreDenied);
+
+    return UNITY_END();
+}
@@ -0,0 +1,175 @@
+/*
+ * tests/test_sd_rxstream.c
+ *
+ * Streamed CMD18 tokens (SD_READ_STREAM_GAP=8). Each pipelined DMA clocks
+ * eight bytes past the CRC; the next data token is picked out of them and the
+ * bytes behind it are carried into the next block. A gap longer than the
+ * window must fall back to the polled token wait without losing data.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_rxstream.img"
+#define CARD_BLOCKS 2048U
+
+static SD_Handle_t sd;
+
+static void fill_block(uint8_t *buf, uint32_t n) {
+    for (uint32_t i = 0; i < 512U; i++) {
+        buf[i] = (uint8_t)(i * 3U + n * 17U + 1U);
+    }
+}
+
+/* CMD18 reply with idle_gap 0xFF bytes ahead of every token but the first. */
+static void push_multi_read_gap(uint32_t count, uint32_t idle_gap) {
+    uint8_t data[512];
+    push_cmd_exchange(0x00U);
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t g = 0; (i > 0U) && (g < idle_gap); g++) {
+            mock_hal_push_byte(0xFFU);
+        }
+        fill_block(data, i);
+        push_data_token();
+        mock_hal_push_bytes(data, 512);
+        push_crc();
+    }
+    push_cmd_exchange(0x00U); /* CMD12 */
+}
+
+static void check_blocks(const uint8_t *buf, uint32_t count) {
+    uint8_t expect[512];
+    for (uint32_t i = 0; i < count; i++) {
+        fill_block(expect, i);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(expect, &buf[i * 512U], 512);
+    }
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+}
+
+/* -----------------------------------------------------------------------
+ * Token found in the streamed gap
+ * ----------------------------------------------------------------------- */
+
+void test_Stream_ShortGap_OneDmaPerBlockAndCarriesData(void) {
+    static uint8_t buf[3 * 512] __attribute__((aligned(4)));
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_gap(3, 1U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 3));
+    check_blocks(buf, 3);
+    TEST_ASSERT_EQUAL(3, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.rx_stream_tokens);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+/* The token sits in the last gap byte: nothing is carried. */
+void test_Stream_TokenAtEndOfGap_NoCarry(void) {
+    static uint8_t buf[2 * 512] __attribute__((aligned(4)));
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_gap(2, SD_READ_STREAM_GAP - 1U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    check_blocks(buf, 2);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.rx_stream_tokens);
+}
+
+void test_Stream_UnalignedBuffer_CarriedBytesLandInPlace(void) {
+    static uint8_t raw[2 * 512 + 1] __attribute__((aligned(4)));
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_gap(2, 2U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, raw + 1, 0, 2));
+    check_blocks(raw + 1, 2);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.rx_stream_tokens);
+}
+
+/* -----------------------------------------------------------------------
+ * Fallback to the polled token wait
+ * ----------------------------------------------------------------------- */
+
+void test_Stream_LongGap_FallsBackToPolling(void) {
+    static uint8_t buf[2 * 512] __attribute__((aligned(4)));
+    do_sdhc_init(&sd, 8192U);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_multi_read_gap(2, SD_READ_STREAM_GAP + 12U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    check_blocks(buf, 2);
+    TEST_ASSERT_EQUAL(2, mock_hal_dma_rx_calls);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.rx_stream_tokens);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+}
+
+/* Polled CMD18 never reads ahead of the CRC. */
+void test_Stream_Polled_Untouched(void) {
+    static uint8_t buf[2 * 512];
+    do_sdhc_init(&sd, 8192U);
+    push_multi_read_gap(2, 1U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 2));
+    check_blocks(buf, 2);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.rx_stream_tokens);
+}
+
+/* -----------------------------------------------------------------------
+ * Card emulator
+ * ----------------------------------------------------------------------- */
+
+void test_Stream_MultiBlockRoundTrip_OnEmulator(void) {
+    static uint8_t out[8 * 512];
+    static uint8_t back[8 * 512] __attribute__((aligned(4)));
+    for (uint32_t i = 0; i < 8U; i++) {
+        fill_block(&out[i * 512U], i);
+    }
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, true));
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, out, 100U, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, back, 100U, 8U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, sizeof(out));
+    TEST_ASSERT_EQUAL_UINT32(7U, sd.stats.rx_stream_tokens);
+
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Stream_ShortGap_OneDmaPerBlockAndCarriesData);
+    RUN_TEST(test_Stream_TokenAtEndOfGap_NoCarry);
+    RUN_TEST(test_Stream_UnalignedBuffer_CarriedBytesLandInPlace);
+    RUN_TEST(test_Stream_LongGap_FallsBackToPolling);
+    RUN_TEST(test_Stream_Polled_Untouched);
+    RUN_TEST(test_Stream_MultiBlockRoundTrip_OnEmulator);
+
+    return UNITY_END();
+}
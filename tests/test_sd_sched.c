@@ -0,0 +1,302 @@
+/*
+ * tests/test_sd_sched.c
+ *
+ * Tests for the async request scheduler (sd_sched.c). Built with
+ * SD_SCHED_SLOTS=8, SD_SCHED_MAX_MERGE=4, SD_SCHED_STARVE_LIMIT=2 and the
+ * default SD_SCHED_URGENT_MS; deadlines run against the mock HAL tick.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "sd_sched.h"
+#include <string.h>
+
+static SD_Scheduler sched;
+static SD_Handle_t card_a;
+static SD_Handle_t card_b;
+static uint8_t buf[8][512];
+static SD_IoRequest batch[SD_SCHED_SLOTS];
+
+void setUp(void) {
+    mock_hal_reset();
+    SD_SchedInit(&sched, NULL);
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+static void add(SD_Handle_t *card, uint32_t sector, uint32_t count, bool write,
+                SD_IoPriority priority, int tag) {
+    SD_IoRequest request = {
+        .sd_handle = card,
+        .buff = buf[tag],
+        .sector = sector,
+        .count = count,
+        .write = write,
+        .priority = priority,
+    };
+    TEST_ASSERT_EQUAL(SD_OK, SD_SchedAdd(&sched, &request));
+}
+
+static void add_read(uint32_t sector, int tag) {
+    add(&card_a, sector, 1, false, SD_IO_PRIO_NORMAL, tag);
+}
+
+static void add_write(uint32_t sector, int tag) {
+    add(&card_a, sector, 1, true, SD_IO_PRIO_NORMAL, tag);
+}
+
+static void add_due(uint32_t sector, SD_IoPriority priority, uint32_t deadline, int tag) {
+    SD_IoRequest request = {
+        .sd_handle = &card_a,
+        .buff = buf[tag],
+        .sector = sector,
+        .count = 1,
+        .priority = priority,
+        .has_deadline = true,
+        .deadline = deadline,
+    };
+    TEST_ASSERT_EQUAL(SD_OK, SD_SchedAdd(&sched, &request));
+}
+
+/* Dispatch one run and return the tag (buffer index) of its first request. */
+static int next_tag(uint32_t *count) {
+    uint32_t n = SD_SchedNext(&sched, batch, SD_SCHED_SLOTS);
+    if (count) {
+        *count = n;
+    }
+    TEST_ASSERT_TRUE(n > 0U);
+    return (int)((batch[0].buff - buf[0]) / 512);
+}
+
+/* -----------------------------------------------------------------------
+ * Merging
+ * ----------------------------------------------------------------------- */
+
+void test_Sched_AdjacentReads_MergeInSectorOrder(void) {
+    add_read(12, 2);
+    add_read(10, 0);
+    add_read(11, 1);
+
+    uint32_t n = SD_SchedNext(&sched, batch, SD_SCHED_SLOTS);
+    TEST_ASSERT_EQUAL_UINT32(3U, n);
+    TEST_ASSERT_EQUAL_UINT32(10U, batch[0].sector);
+    TEST_ASSERT_EQUAL_UINT32(11U, batch[1].sector);
+    TEST_ASSERT_EQUAL_UINT32(12U, batch[2].sector);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_SchedPending(&sched));
+}
+
+void test_Sched_MixedDirections_NotMerged(void) {
+    add_read(20, 0);
+    add_write(21, 1);
+
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedNext(&sched, batch, SD_SCHED_SLOTS));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedPending(&sched));
+}
+
+void test_Sched_DifferentCards_NotMerged(void) {
+    add(&card_a, 30, 1, false, SD_IO_PRIO_NORMAL, 0);
+    add(&card_b, 31, 1, false, SD_IO_PRIO_NORMAL, 1);
+
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedNext(&sched, batch, SD_SCHED_SLOTS));
+}
+
+void test_Sched_Merge_StopsAtMaxMergeBlocks(void) {
+    add(&card_a, 40, 2, true, SD_IO_PRIO_NORMAL, 0);
+    add(&card_a, 42, 2, true, SD_IO_PRIO_NORMAL, 1);
+    add(&card_a, 44, 1, true, SD_IO_PRIO_NORMAL, 2);
+
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_SchedNext(&sched, batch, SD_SCHED_SLOTS));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedPending(&sched));
+}
+
+void test_Sched_Merge_RespectsBatchCapacity(void) {
+    add_read(50, 0);
+    add_read(51, 1);
+    add_read(52, 2);
+
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_SchedNext(&sched, batch, 2));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedPending(&sched));
+}
+
+/* -----------------------------------------------------------------------
+ * Ordering
+ * ----------------------------------------------------------------------- */
+
+void test_Sched_HighPriority_JumpsAheadOfBulk(void) {
+    add(&card_a, 100, 1, true, SD_IO_PRIO_BULK, 0);
+    add(&card_a, 300, 1, true, SD_IO_PRIO_BULK, 1);
+    add(&card_a, 900, 1, false, SD_IO_PRIO_HIGH, 2);
+
+    TEST_ASSERT_EQUAL(2, next_tag(NULL));
+}
+
+void test_Sched_SameClass_AscendingFromHead(void) {
+    add_read(70, 0);
+    add_read(5, 1);
+    add_read(40, 2);
+
+    TEST_ASSERT_EQUAL(1, next_tag(NULL)); /* head starts at 0 */
+    TEST_ASSERT_EQUAL(2, next_tag(NULL));
+    add_read(6, 3);                       /* behind the head: waits for the wrap */
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+    TEST_ASSERT_EQUAL(3, next_tag(NULL));
+}
+
+void test_Sched_StarvedRequest_IsPromoted(void) {
+    add(&card_a, 500, 1, true, SD_IO_PRIO_BULK, 0);
+    add(&card_a, 10, 1, false, SD_IO_PRIO_HIGH, 1);
+    TEST_ASSERT_EQUAL(1, next_tag(NULL)); /* bulk passed over once */
+    add(&card_a, 20, 1, false, SD_IO_PRIO_HIGH, 2);
+    TEST_ASSERT_EQUAL(2, next_tag(NULL)); /* twice: now at the limit */
+    add(&card_a, 30, 1, false, SD_IO_PRIO_HIGH, 3);
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+    TEST_ASSERT_EQUAL(3, next_tag(NULL));
+}
+
+void test_Sched_UrgentDeadline_JumpsAheadOfHighPriority(void) {
+    mock_hal_set_tick(1000U);
+    add(&card_a, 10, 1, false, SD_IO_PRIO_HIGH, 0);
+    add_due(800, SD_IO_PRIO_BULK, 1000U + SD_SCHED_URGENT_MS + 50U, 1); /* not yet urgent */
+    add_due(500, SD_IO_PRIO_BULK, 1000U + SD_SCHED_URGENT_MS, 2);
+    add_due(600, SD_IO_PRIO_BULK, 1005U, 3);
+
+    TEST_ASSERT_EQUAL(3, next_tag(NULL)); /* earliest deadline first */
+    TEST_ASSERT_EQUAL(2, next_tag(NULL));
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+    mock_hal_set_tick(1060U);
+    TEST_ASSERT_EQUAL(1, next_tag(NULL));
+}
+
+void test_Sched_TakeExpired_RemovesOnlyLateRequests(void) {
+    add_due(10, SD_IO_PRIO_NORMAL, 100U, 0);
+    add_due(20, SD_IO_PRIO_NORMAL, 300U, 1);
+    add_read(30, 2);
+
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedTakeExpired(&sched, 200U, batch, SD_SCHED_SLOTS));
+    TEST_ASSERT_EQUAL_PTR(buf[0], batch[0].buff);
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_SchedPending(&sched));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_SchedTakeExpired(&sched, 300U, batch, SD_SCHED_SLOTS));
+}
+
+/* A late read behind an older overlapping write stays until the write is out. */
+void test_Sched_TakeExpired_KeepsBlockedRequest(void) {
+    add_write(40, 0);
+    add_due(40, SD_IO_PRIO_NORMAL, 100U, 1);
+
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_SchedTakeExpired(&sched, 200U, batch, SD_SCHED_SLOTS));
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_SchedTakeExpired(&sched, 200U, batch, SD_SCHED_SLOTS));
+}
+
+void test_Sched_OverlappingWrites_KeepArrivalOrder(void) {
+    add(&card_a, 200, 1, true, SD_IO_PRIO_BULK, 0);
+    add(&card_a, 200, 1, true, SD_IO_PRIO_HIGH, 1);
+
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+    TEST_ASSERT_EQUAL(1, next_tag(NULL));
+}
+
+void test_Sched_ReadAfterWrite_NotReordered(void) {
+    add(&card_a, 80, 2, true, SD_IO_PRIO_BULK, 0);
+    add(&card_a, 81, 1, false, SD_IO_PRIO_HIGH, 1);
+
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+    TEST_ASSERT_EQUAL(1, next_tag(NULL));
+}
+
+void test_Sched_OverlappingReads_MayReorder(void) {
+    add(&card_a, 90, 1, false, SD_IO_PRIO_BULK, 0);
+    add(&card_a, 90, 1, false, SD_IO_PRIO_HIGH, 1);
+
+    TEST_ASSERT_EQUAL(1, next_tag(NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Pool and policy
+ * ----------------------------------------------------------------------- */
+
+void test_Sched_Full_ReturnsBusy(void) {
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        add_read(i * 10U, 0);
+    }
+    SD_IoRequest extra = {.sd_handle = &card_a, .buff = buf[1], .sector = 999, .count = 1};
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_SchedAdd(&sched, &extra));
+}
+
+void test_Sched_InvalidRequest_ReturnsParam(void) {
+    SD_IoRequest request = {.sd_handle = &card_a, .buff = NULL, .sector = 1, .count = 1};
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SchedAdd(&sched, &request));
+    request.buff = buf[0];
+    request.count = 0;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SchedAdd(&sched, &request));
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_SchedNext(&sched, batch, SD_SCHED_SLOTS));
+}
+
+/* Always pick the highest sector: exercises the policy hook. */
+static uint32_t highest_sector_policy(const SD_Scheduler *s) {
+    uint32_t best = SD_SCHED_SLOTS;
+    for (uint32_t i = 0; i < SD_SCHED_SLOTS; i++) {
+        if (SD_SchedEligible(s, i) &&
+            (best == SD_SCHED_SLOTS || s->req[i].sector > s->req[best].sector)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void test_Sched_CustomPolicy_SelectsLead(void) {
+    SD_SchedInit(&sched, highest_sector_policy);
+    add_read(1, 0);
+    add_read(700, 1);
+
+    TEST_ASSERT_EQUAL(1, next_tag(NULL));
+}
+
+/* A policy returning an ineligible slot falls back to the oldest request. */
+static uint32_t bad_policy(const SD_Scheduler *s) {
+    (void)s;
+    return SD_SCHED_SLOTS;
+}
+
+void test_Sched_InvalidPolicyChoice_FallsBackToOldest(void) {
+    SD_SchedInit(&sched, bad_policy);
+    add_read(600, 0);
+    add_read(3, 1);
+
+    TEST_ASSERT_EQUAL(0, next_tag(NULL));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Sched_AdjacentReads_MergeInSectorOrder);
+    RUN_TEST(test_Sched_MixedDirections_NotMerged);
+    RUN_TEST(test_Sched_DifferentCards_NotMerged);
+    RUN_TEST(test_Sched_Merge_StopsAtMaxMergeBlocks);
+    RUN_TEST(test_Sched_Merge_RespectsBatchCapacity);
+
+    RUN_TEST(test_Sched_HighPriority_JumpsAheadOfBulk);
+    RUN_TEST(test_Sched_SameClass_AscendingFromHead);
+    RUN_TEST(test_Sched_StarvedRequest_IsPromoted);
+    RUN_TEST(test_Sched_UrgentDeadline_JumpsAheadOfHighPriority);
+    RUN_TEST(test_Sched_TakeExpired_RemovesOnlyLateRequests);
+    RUN_TEST(test_Sched_TakeExpired_KeepsBlockedRequest);
+    RUN_TEST(test_Sched_OverlappingWrites_KeepArrivalOrder);
+    RUN_TEST(test_Sched_ReadAfterWrite_NotReordered);
+    RUN_TEST(test_Sched_OverlappingReads_MayReorder);
+
+    RUN_TEST(test_Sched_Full_ReturnsBusy);
+    RUN_TEST(test_Sched_InvalidRequest_ReturnsParam);
+    RUN_TEST(test_Sched_CustomPolicy_SelectsLead);
+    RUN_TEST(test_Sched_InvalidPolicyChoice_FallsBackToOldest);
+
+    return UNITY_END();
+}
@@ -0,0 +1,89 @@
+/*
+ * tests/test_sd_sdhc_only.c
+ *
+ * SDHC-only build (SD_SUPPORT_SDSC=0): an SDHC card initializes and takes
+ * unscaled block addresses; a v1 card is turned away after CMD8 and a v2
+ * standard-capacity card after CMD58, both without CMD16.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+
+static SD_Handle_t sd;
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+}
+
+void tearDown(void) {}
+
+/* Offset of the first CMD frame with the given index in the transmit log (-1 if absent). */
+static int find_cmd(uint8_t cmd) {
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    for (size_t i = 0; i + 6U < len; i++) {
+        if (tx[i] == 0xFFU && tx[i + 1U] == (uint8_t)(0x40U | cmd)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void test_SdhcOnly_SdhcCard_BlockAddressesUnscaled(void) {
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+    TEST_ASSERT_TRUE(sd.is_sdhc);
+    TEST_ASSERT_EQUAL_UINT32(8192U, sd.capacity_blocks);
+    TEST_ASSERT_EQUAL(-1, find_cmd(16));
+
+    uint8_t buf[512];
+    push_single_read(0xA5U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 5, 1));
+    TEST_ASSERT_EQUAL_HEX8(0xA5U, buf[0]);
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    int at = find_cmd(17);
+    TEST_ASSERT_TRUE(at >= 0);
+    const uint8_t arg[4] = {0x00U, 0x00U, 0x00U, 0x05U};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(arg, &tx[at + 2], 4);
+}
+
+void test_SdhcOnly_V1Card_UnsupportedBeforeAcmd41(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    push_cmd_exchange(0x01U); /* CMD0 */
+    push_cmd_exchange(0x05U); /* CMD8: illegal command */
+    push_r7_sdv1();
+    TEST_ASSERT_EQUAL(SD_UNSUPPORTED, SD_SPI_Init(&sd));
+    TEST_ASSERT_FALSE(sd.initialized);
+    TEST_ASSERT_EQUAL(SD_UNSUPPORTED, sd.last_status);
+    TEST_ASSERT_EQUAL(-1, find_cmd(55));
+}
+
+void test_SdhcOnly_V2StandardCapacity_UnsupportedWithoutCmd16(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    push_cmd_exchange(0x01U); /* CMD0 */
+    push_cmd_exchange(0x01U); /* CMD8 */
+    push_r7_sdv2();
+    push_cmd_exchange(0x01U); /* CMD55 */
+    push_cmd_exchange(0x00U); /* ACMD41: ready */
+    push_cmd_exchange(0x00U); /* CMD58 */
+    push_ocr_sdsc();          /* CCS clear */
+    TEST_ASSERT_EQUAL(SD_UNSUPPORTED, SD_SPI_Init(&sd));
+    TEST_ASSERT_FALSE(sd.initialized);
+    TEST_ASSERT_FALSE(sd.is_sdhc);
+    TEST_ASSERT_EQUAL(-1, find_cmd(16));
+    TEST_ASSERT_EQUAL(-1, find_cmd(9));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_SdhcOnly_SdhcCard_BlockAddressesUnscaled);
+    RUN_TEST(test_SdhcOnly_V1Card_UnsupportedBeforeAcmd41);
+    RUN_TEST(test_SdhcOnly_V2StandardCapacity_UnsupportedWithoutCmd16);
+
+    return UNITY_END();
+}
@@ -0,0 +1,187 @@
+/*
+ * tests/test_sd_sector4k.c
+ *
+ * 4096-byte logical sectors (SD_DISK_SECTOR_SIZE=4096, _MIN_SS=_MAX_SS=4096)
+ * over the card emulator: each FatFs sector is eight card blocks moved by one
+ * CMD18/CMD25, geometry ioctls report logical units, and volumes made by
+ * f_mkfs and SD_FormatDrive mount and round-trip files.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_format.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_sector4k.img"
+#define CARD_BLOCKS 131072U /* 64 MiB */
+#define SS          4096U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[4 * SS] __attribute__((aligned(4)));
+static uint8_t s_back[4 * SS] __attribute__((aligned(4)));
+
+static void fill(uint8_t *buf, uint32_t len, uint8_t seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed + i * 13U);
+    }
+}
+
+static void round_trip(void) {
+    UINT n = 0;
+    fill(s_buf, sizeof(s_buf), 0x21U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "data.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, sizeof(s_buf), &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "tail", 4, &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "data.bin", FA_READ));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(s_buf) + 4U, f_size(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_back, sizeof(s_back), &n));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, s_back, sizeof(s_buf));
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(0, disk_initialize(0));
+    mock_card_reset_stats();
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+/* -----------------------------------------------------------------------
+ * diskio translation
+ * ----------------------------------------------------------------------- */
+
+void test_Sector4k_Geometry_InLogicalSectors(void) {
+    WORD size = 0;
+    DWORD count = 0, block = 0;
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, GET_SECTOR_SIZE, &size));
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, GET_SECTOR_COUNT, &count));
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, GET_BLOCK_SIZE, &block));
+    TEST_ASSERT_EQUAL_UINT16(SS, size);
+    TEST_ASSERT_EQUAL_UINT32(CARD_BLOCKS / 8U, count);
+    TEST_ASSERT_EQUAL_UINT32(8192U / 8U, block); /* 4 MiB AU */
+}
+
+void test_Sector4k_OneSector_IsOneMultiBlockTransfer(void) {
+    fill(s_buf, SS, 0x5AU);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, 3, 1));
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_back, 3, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, s_back, SS);
+
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[18]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[17]);
+    TEST_ASSERT_EQUAL_UINT32(8U, st.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(8U, st.sectors_read);
+}
+
+/* Logical sector 3 is card blocks 24..31. */
+void test_Sector4k_SectorNumbers_ScaleToCardBlocks(void) {
+    uint8_t block[512];
+    fill(s_buf, 2U * SS, 0x33U);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, 3, 2));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, block, 24U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_buf, block, 512);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, block, 39U, 1U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&s_buf[2U * SS - 512U], block, 512);
+}
+
+void test_Sector4k_Trim_ErasesWholeSectors(void) {
+    DWORD range[2] = {2U, 3U};
+    fill(s_buf, 2U * SS, 0x77U);
+    TEST_ASSERT_EQUAL(RES_OK, disk_write(0, s_buf, 2, 2));
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(RES_OK, disk_ioctl(0, CTRL_TRIM, range));
+    TEST_ASSERT_EQUAL_UINT32(16U, card_stats().sectors_erased);
+}
+
+/* -----------------------------------------------------------------------
+ * FatFs volumes
+ * ----------------------------------------------------------------------- */
+
+void test_Sector4k_Mkfs_AllTransfersMultiBlock(void) {
+    static uint8_t work[SS];
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT | FM_FAT32, 0, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    mock_card_reset_stats();
+    round_trip();
+
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[17]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+}
+
+void test_Sector4k_FormatDrive_MountsAligned(void) {
+    static uint8_t work[2 * SS];
+    SD_FormatOptions opt = {.quick = true};
+    SD_FormatLayout l;
+    TEST_ASSERT_EQUAL(FR_OK, SD_FormatDrive(0, &opt, work, sizeof(work), &l));
+    TEST_ASSERT_EQUAL_UINT32(SS, l.sector_size);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL_UINT32(l.data_start, s_fs.database);
+    TEST_ASSERT_EQUAL_UINT32(l.clusters, s_fs.n_fatent - 2U);
+    TEST_ASSERT_EQUAL_UINT32(0U, s_fs.database % l.boundary);
+    TEST_ASSERT_EQUAL_UINT32(0U, (s_fs.fatbase * 8U) % (l.boundary * 8U));
+    round_trip();
+}
+
+void test_Sector4k_FormatDrive_WorkBufferBelowOneSector_Rejected(void) {
+    static uint8_t work[2048];
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, SD_FormatDrive(0, NULL, work, sizeof(work), NULL));
+}
+
+/* The FAT-sector cache holds logical sectors: a repeat read costs no card I/O. */
+void test_Sector4k_FatCache_ServesRepeatReads(void) {
+    static uint8_t work[SS];
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT, 0, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    SD_DiskSetFatRegion(0, s_fs.fatbase, s_fs.fsize * s_fs.n_fats);
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_back, s_fs.fatbase, 1));
+    TEST_ASSERT_EQUAL(RES_OK, disk_read(0, s_buf, s_fs.fatbase, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_back, s_buf, SS);
+    mock_card_stats_t st = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(1U, st.cmd[18]);
+    TEST_ASSERT_EQUAL_UINT32(SD_FAT_CACHE_SPAN * 8U, st.sectors_read);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Sector4k_Geometry_InLogicalSectors);
+    RUN_TEST(test_Sector4k_OneSector_IsOneMultiBlockTransfer);
+    RUN_TEST(test_Sector4k_SectorNumbers_ScaleToCardBlocks);
+    RUN_TEST(test_Sector4k_Trim_ErasesWholeSectors);
+
+    RUN_TEST(test_Sector4k_Mkfs_AllTransfersMultiBlock);
+    RUN_TEST(test_Sector4k_FormatDrive_MountsAligned);
+    RUN_TEST(test_Sector4k_FormatDrive_WorkBufferBelowOneSector_Rejected);
+    RUN_TEST(test_Sector4k_FatCache_ServesRepeatReads);
+
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+/*
+ * tests/test_sd_seq.c
+ *
+ * Sequence-numbered names (SD_SEQ_SLOTS=2) through sd_mount on the card
+ * emulator: registering reads the directory once for the highest number,
+ * sd_seq_next hands out the following ones without card reads, sd_mount
+ * reads it again, and creates, deletes and renames through the helpers keep
+ * the figure right (only removing the highest name costs a new read).
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_seq.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static char s_name[40];
+
+static uint32_t card_reads(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.sectors_read;
+}
+
+static void touch(const char *path) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file(path, "x"));
+}
+
+/* The number sd_seq_next hands out next, and its path. */
+static uint32_t next_number(void) {
+    uint32_t n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_seq_next("logs", "LOG_", s_name, sizeof(s_name), &n));
+    return n;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/logs"));
+    touch("0:/logs/LOG_0003.BIN");
+    touch("0:/logs/LOG_0010.BIN");
+    touch("0:/logs/log_0007.bin");
+    touch("0:/logs/LOG_0099.TXT");
+    touch("0:/logs/LOG_X.BIN");
+    touch("0:/LOG_0500.BIN");
+    TEST_ASSERT_EQUAL(FR_OK, sd_seq_register("0:/logs/", "LOG_", ".BIN", 4U));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Seq_NextFollowsHighestWithoutReads(void) {
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_UINT32(11U, next_number());
+    TEST_ASSERT_EQUAL_STRING("0:/LOGS/LOG_0011.BIN", s_name);
+    TEST_ASSERT_EQUAL_UINT32(12U, next_number()); /* 11 is reserved */
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+}
+
+void test_Seq_MountReadsDirectoryAgain(void) {
+    TEST_ASSERT_EQUAL_UINT32(11U, next_number());
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+
+    /* Changed behind the helpers' back while unmounted. */
+    FATFS vol;
+    FIL fil;
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&vol, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "0:/logs/LOG_0040.BIN", FA_WRITE | FA_CREATE_NEW));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_UINT32(41U, next_number());
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+}
+
+void test_Seq_HelpersKeepFigureCurrent(void) {
+    touch("0:/logs/LOG_0020.BIN");
+    TEST_ASSERT_EQUAL(FR_OK, sd_rename_file("0:/logs/LOG_0003.BIN", "0:/logs/LOG_0030.BIN"));
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_UINT32(31U, next_number());
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+
+    /* A lower name leaves the figure; removing the highest has the next call read. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/logs/LOG_0010.BIN"));
+    touch(s_name);
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_UINT32(32U, next_number());
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/logs/LOG_0031.BIN"));
+    TEST_ASSERT_EQUAL_UINT32(33U, next_number()); /* 32 is still handed out */
+
+    touch("0:/logs/LOG_0033.BIN");
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/logs/LOG_0033.BIN"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/logs/LOG_0030.BIN"));
+    TEST_ASSERT_EQUAL_UINT32(21U, next_number());
+}
+
+void test_Seq_WidthAndUnknownPrefix(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_seq_register("0:/", "LOG_", ".BIN", 2U));
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_seq_next("", "LOG_", s_name, sizeof(s_name), NULL));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_seq_next("logs", "DAT_", s_name, sizeof(s_name), NULL));
+    TEST_ASSERT_EQUAL(FR_NOT_ENOUGH_CORE, sd_seq_register("0:/", "DAT_", ".BIN", 4U));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_seq_register("0:/", "DAT_", ".BIN", 10U));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER,
+                      sd_seq_next("logs", "LOG_", s_name, 8U, NULL)); /* too short */
+    TEST_ASSERT_EQUAL_UINT32(11U, next_number());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Seq_NextFollowsHighestWithoutReads);
+    RUN_TEST(test_Seq_MountReadsDirectoryAgain);
+    RUN_TEST(test_Seq_HelpersKeepFigureCurrent);
+    RUN_TEST(test_Seq_WidthAndUnknownPrefix);
+    return UNITY_END();
+}
@@ -0,0 +1,147 @@
+/*
+ * tests/test_sd_shard.c
+ *
+ * Sharded flat names (SD_SHARD_BUCKETS=4) through sd_mount on the card
+ * emulator: 40 files spread over the four bucket directories, lookups are
+ * case-insensitive like FAT, enumeration sees every file once, deletes
+ * remove the file from its bucket, and bad names are refused.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_shard.img"
+#define CARD_BLOCKS 16384U
+#define FILES       40U
+
+static char s_path[4];
+static FIL s_fil;
+static uint32_t s_seen[FILES];
+
+static void name_of(uint32_t i, char *name, size_t len) {
+    (void)snprintf(name, len, "REC_%03u.DAT", (unsigned)i);
+}
+
+static void create_all(void) {
+    char name[16];
+    UINT bw;
+    for (uint32_t i = 0; i < FILES; i++) {
+        name_of(i, name, sizeof(name));
+        TEST_ASSERT_EQUAL(FR_OK, sd_shard_open(&s_fil, "0:/recs", name, FA_WRITE | FA_CREATE_NEW));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, &i, sizeof(i), &bw));
+        TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    }
+}
+
+static uint32_t entries_in(const char *dir) {
+    DIR dj;
+    FILINFO fno;
+    uint32_t n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_opendir(&dj, dir));
+    while (f_readdir(&dj, &fno) == FR_OK && fno.fname[0] != '\0') {
+        n++;
+    }
+    (void)f_closedir(&dj);
+    return n;
+}
+
+static bool mark_seen(const char *name, const FILINFO *fno, void *context) {
+    unsigned i = 0;
+    (void)context;
+    TEST_ASSERT_EQUAL(1, sscanf(name, "REC_%3u.DAT", &i));
+    TEST_ASSERT_TRUE(i < FILES);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(uint32_t), (uint32_t)fno->fsize);
+    s_seen[i]++;
+    return true;
+}
+
+static bool stop_at_three(const char *name, const FILINFO *fno, void *context) {
+    (void)name;
+    (void)fno;
+    return ++*(uint32_t *)context < 3U;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    memset(s_seen, 0, sizeof(s_seen));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Shard_FilesSpreadOverBuckets(void) {
+    create_all();
+    TEST_ASSERT_EQUAL_UINT32(4U, entries_in("0:/recs"));
+    uint32_t total = 0;
+    const char *buckets[4] = {"0:/recs/00", "0:/recs/01", "0:/recs/02", "0:/recs/03"};
+    for (uint32_t b = 0; b < 4U; b++) {
+        uint32_t n = entries_in(buckets[b]);
+        TEST_ASSERT_TRUE(n > 0U && n < FILES / 2U);
+        total += n;
+    }
+    TEST_ASSERT_EQUAL_UINT32(FILES, total);
+
+    char path[32];
+    TEST_ASSERT_EQUAL(FR_OK, sd_shard_path("0:/recs/", "REC_007.DAT", path, sizeof(path)));
+    TEST_ASSERT_EQUAL(0, strncmp(path, "0:/recs/0", 9));
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat(path, &fno));
+}
+
+void test_Shard_LookupAndList(void) {
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_shard_stat("0:/recs", "REC_001.DAT", &fno));
+    create_all();
+    TEST_ASSERT_EQUAL(FR_OK, sd_shard_stat("0:/recs", "rec_013.dat", &fno));
+    TEST_ASSERT_EQUAL_STRING("REC_013.DAT", fno.fname);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_shard_stat("0:/recs", "REC_999.DAT", &fno));
+
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_shard_list("0:/recs", mark_seen, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(FILES, count);
+    for (uint32_t i = 0; i < FILES; i++) {
+        TEST_ASSERT_EQUAL_UINT32(1U, s_seen[i]);
+    }
+
+    uint32_t visits = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_shard_list("0:/recs", stop_at_three, &visits, &count));
+    TEST_ASSERT_EQUAL_UINT32(3U, count);
+}
+
+void test_Shard_DeleteAndBadNames(void) {
+    create_all();
+    TEST_ASSERT_EQUAL(FR_OK, sd_shard_delete("0:/recs", "REC_020.DAT"));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_shard_delete("0:/recs", "REC_020.DAT"));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_shard_stat("0:/recs", "REC_020.DAT", NULL));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_shard_delete("0:/other", "REC_020.DAT"));
+
+    uint32_t count = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_shard_list("0:/recs", mark_seen, NULL, &count));
+    TEST_ASSERT_EQUAL_UINT32(FILES - 1U, count);
+    TEST_ASSERT_EQUAL_UINT32(0U, s_seen[20]);
+
+    TEST_ASSERT_EQUAL(FR_INVALID_NAME,
+                      sd_shard_open(&s_fil, "0:/recs", "a/b", FA_WRITE | FA_CREATE_NEW));
+    TEST_ASSERT_EQUAL(FR_INVALID_NAME, sd_shard_stat("0:/recs", "..", NULL));
+    TEST_ASSERT_EQUAL(FR_INVALID_NAME, sd_shard_delete("0:/recs", ""));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Shard_FilesSpreadOverBuckets);
+    RUN_TEST(test_Shard_LookupAndList);
+    RUN_TEST(test_Shard_DeleteAndBadNames);
+    return UNITY_END();
+}
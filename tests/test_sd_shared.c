@@ -0,0 +1,175 @@
+/*
+ * tests/test_sd_shared.c
+ *
+ * sd_read_shared against the card emulator with the write-back cache
+ * (SD_CACHE_ENABLED=1): multi-cluster files on FAT12 (entries straddling a
+ * FAT sector), FAT16 and FAT32 read in uneven pieces, mixing with
+ * f_lseek/f_read on the same FIL, end of file, and the f_read fallback for a
+ * file open for writing. Concurrency itself needs the target; here the
+ * reads must match f_read byte for byte.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_shared.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE_SMALL "test_sd_shared.img"
+#define IMAGE_BIG   "test_sd_shared_big.img"
+#define SMALL_BLOCKS 16384U  /* 8 MiB */
+#define BIG_BLOCKS   131072U /* 64 MiB, enough clusters for FAT32 */
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static uint8_t s_buf[4096];
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static uint8_t pattern(uint32_t i) {
+    return (uint8_t)((i * 7U) + (i >> 9));
+}
+
+/* Format, mount and write name with len pattern bytes. */
+static void volume_with_file(const char *image, uint32_t blocks, BYTE opt, DWORD au,
+                             const char *name, uint32_t len) {
+    test_fatfs_fresh(image, blocks, s_path, opt, au);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t pos = 0; pos < len;) {
+        UINT n = (len - pos < sizeof(s_buf)) ? (UINT)(len - pos) : (UINT)sizeof(s_buf);
+        UINT bw = 0;
+        for (UINT i = 0; i < n; i++) {
+            s_buf[i] = pattern(pos + i);
+        }
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_buf, n, &bw));
+        TEST_ASSERT_EQUAL_UINT32(n, bw);
+        pos += n;
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* Read the whole file with sd_read_shared in uneven pieces and check every byte. */
+static void read_all_shared(const char *name, uint32_t len) {
+    static const UINT sizes[] = {1, 100, 511, 512, 513, 1536, 3000, 4096};
+    UINT br = 0;
+    uint32_t pos = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_READ));
+    for (uint32_t k = 0; pos < len; k++) {
+        UINT want = sizes[k % (sizeof(sizes) / sizeof(sizes[0]))];
+        TEST_ASSERT_EQUAL(FR_OK, sd_read_shared(&s_fil, s_buf, want, &br));
+        TEST_ASSERT_TRUE(br > 0U);
+        for (UINT i = 0; i < br; i++) {
+            if (s_buf[i] != pattern(pos + i)) {
+                TEST_FAIL_MESSAGE("data mismatch");
+            }
+        }
+        pos += br;
+    }
+    TEST_ASSERT_EQUAL_UINT32(len, pos);
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_shared(&s_fil, s_buf, 10, &br));
+    TEST_ASSERT_EQUAL_UINT32(0U, br); /* at end of file */
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* 2 KiB clusters: the chain passes cluster 341, whose entry spans two FAT sectors. */
+void test_Shared_ReadsFat12Chain(void) {
+    SD_SharedStats st;
+    volume_with_file(IMAGE_SMALL, SMALL_BLOCKS, FM_FAT, 2048, "f12.bin", 1024U * 1024U);
+    TEST_ASSERT_EQUAL(FS_FAT12, s_fs.fs_type);
+    sd_shared_get_stats(&st);
+    uint32_t fallbacks = st.fallbacks;
+    read_all_shared("f12.bin", 1024U * 1024U);
+    sd_shared_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(fallbacks, st.fallbacks);
+}
+
+void test_Shared_ReadsFat16Chain(void) {
+    volume_with_file(IMAGE_SMALL, SMALL_BLOCKS, FM_FAT, 512, "f16.bin", 200000U);
+    TEST_ASSERT_EQUAL(FS_FAT16, s_fs.fs_type);
+    read_all_shared("f16.bin", 200000U);
+}
+
+void test_Shared_ReadsFat32Chain(void) {
+    volume_with_file(IMAGE_BIG, BIG_BLOCKS, FM_FAT32, 512, "f32.bin", 200000U);
+    TEST_ASSERT_EQUAL(FS_FAT32, s_fs.fs_type);
+    read_all_shared("f32.bin", 200000U);
+}
+
+/* The FIL stays an ordinary one: f_lseek and f_read carry on where sd_read_shared left. */
+void test_Shared_MixesWithFRead(void) {
+    UINT br = 0;
+    volume_with_file(IMAGE_SMALL, SMALL_BLOCKS, FM_FAT, 512, "mix.bin", 10000U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "mix.bin", FA_READ));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_shared(&s_fil, s_buf, 700, &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_buf, 10, &br));
+    TEST_ASSERT_EQUAL_HEX8(pattern(700), s_buf[0]);
+    TEST_ASSERT_EQUAL_HEX8(pattern(709), s_buf[9]);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 5000));
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_shared(&s_fil, s_buf, 20, &br));
+    TEST_ASSERT_EQUAL_UINT32(20U, br);
+    TEST_ASSERT_EQUAL_HEX8(pattern(5000), s_buf[0]);
+    TEST_ASSERT_EQUAL_UINT32(5020U, (uint32_t)f_tell(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 9990));
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_shared(&s_fil, s_buf, 100, &br));
+    TEST_ASSERT_EQUAL_UINT32(10U, br);
+    TEST_ASSERT_EQUAL_HEX8(pattern(9999), s_buf[9]);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+/* Open for writing: f_read under the volume lock, including data not yet written back. */
+void test_Shared_FallsBackForWritableFile(void) {
+    SD_SharedStats st;
+    UINT br = 0;
+    UINT bw = 0;
+    volume_with_file(IMAGE_SMALL, SMALL_BLOCKS, FM_FAT, 512, "rw.bin", 3000U);
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "rw.bin", FA_READ | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 3000));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "tail", 4, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 2998));
+
+    sd_shared_get_stats(&st);
+    uint32_t fallbacks = st.fallbacks;
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_shared(&s_fil, s_buf, 16, &br));
+    TEST_ASSERT_EQUAL_UINT32(6U, br);
+    TEST_ASSERT_EQUAL_MEMORY("tail", &s_buf[2], 4);
+    sd_shared_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(fallbacks + 1U, st.fallbacks);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_Shared_RejectsClosedFile(void) {
+    UINT br = 7;
+    volume_with_file(IMAGE_SMALL, SMALL_BLOCKS, FM_FAT, 512, "c.bin", 100U);
+    TEST_ASSERT_EQUAL(FR_INVALID_OBJECT, sd_read_shared(&s_fil, s_buf, 10, &br));
+    TEST_ASSERT_EQUAL_UINT32(0U, br);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Shared_ReadsFat12Chain);
+    RUN_TEST(test_Shared_ReadsFat16Chain);
+    RUN_TEST(test_Shared_ReadsFat32Chain);
+    RUN_TEST(test_Shared_MixesWithFRead);
+    RUN_TEST(test_Shared_FallsBackForWritableFile);
+    RUN_TEST(test_Shared_RejectsClosedFile);
+
+    return UNITY_END();
+}
@@ -0,0 +1,230 @@
+/*
+ * tests/test_sd_shell.c
+ *
+ * Diagnostics shell against the card emulator with real FatFs and the sector
+ * cache (SD_CACHE_ENABLED=1): line editing, echo and the prompt; unknown
+ * commands and bad arguments; stats, cache metrics and resizing, ls, df,
+ * sync and a small bench run on the mounted volume.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_shell.h"
+#include "sd_spi.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_shell.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+
+/* sd_functions.c is not linked: its volume, path and the helpers the shell calls. */
+FATFS fs;
+char sd_path[4];
+static uint32_t s_flushes;
+
+int sd_mount(void) {
+    return f_mount(&fs, sd_path, 1);
+}
+
+int sd_unmount(void) {
+    return f_mount(NULL, sd_path, 0);
+}
+
+int sd_file_cache_flush(void) {
+    s_flushes++;
+    return FR_OK;
+}
+
+bool sd_free_space_get(uint32_t *free_kb, uint32_t *total_kb) {
+    *free_kb = 1234U;
+    *total_kb = 8000U;
+    return true;
+}
+
+static char s_out[4096];
+static uint32_t s_out_len;
+
+static void capture(const char *text, uint32_t len) {
+    if (s_out_len + len < sizeof(s_out)) {
+        memcpy(&s_out[s_out_len], text, len);
+        s_out_len += len;
+        s_out[s_out_len] = '\0';
+    }
+}
+
+static void clear_output(void) {
+    s_out_len = 0;
+    s_out[0] = '\0';
+}
+
+/* Run one command line through sd_shell_exec (it edits the line in place). */
+static int run(const char *cmd) {
+    char line[SD_SHELL_LINE_MAX + 1U];
+    (void)snprintf(line, sizeof(line), "%s", cmd);
+    clear_output();
+    return sd_shell_exec(line);
+}
+
+static void type(const char *text) {
+    while (*text != '\0') {
+        sd_shell_input(*text++);
+    }
+}
+
+static void write_file(const char *name, uint32_t bytes) {
+    static uint8_t data[1000];
+    FIL fil;
+    UINT bw = 0;
+    memset(data, 0x3C, sizeof(data));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, data, bytes, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, sd_path, FM_FAT | FM_SFD, 0);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    sd_shell_set_output(capture);
+    s_flushes = 0;
+    clear_output();
+}
+
+void tearDown(void) {
+    sd_shell_set_output(NULL);
+    (void)SD_DiskSetCacheSize(0, SD_DISK_CACHE_SECTORS, SD_CACHE_LINES);
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(sd_path);
+    mock_card_close();
+}
+
+void test_Shell_LineEditingEchoAndPrompt(void) {
+    /* Typo erased with BS and DEL; CR LF runs the line once. */
+    type("hxy\b\x7F" "elp\r\n");
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "hxy\b \b\b \belp\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "stats"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "sync"));
+    const char *prompt = strstr(s_out, SD_SHELL_PROMPT);
+    TEST_ASSERT_NOT_NULL(prompt);
+    TEST_ASSERT_NULL(strstr(prompt + 1, SD_SHELL_PROMPT));
+
+    /* Backspace on an empty line echoes nothing; a bare LF is a line of its own. */
+    clear_output();
+    type("\b\n");
+    TEST_ASSERT_EQUAL_STRING("\r\n" SD_SHELL_PROMPT, s_out);
+
+    /* Control characters are dropped, and so is the tail of an overlong line. */
+    clear_output();
+    type("bogus\x01");
+    for (uint32_t i = 0; i < SD_SHELL_LINE_MAX; i++) {
+        sd_shell_input('z');
+    }
+    type("\r");
+    TEST_ASSERT_NOT_NULL(strstr(s_out, ": unknown command, try help\r\n"));
+    TEST_ASSERT_NULL(strstr(s_out, "\x01"));
+}
+
+void test_Shell_UnknownCommandsAndBadArguments(void) {
+    TEST_ASSERT_EQUAL(1, run("   "));
+    TEST_ASSERT_EQUAL(-1, run("format"));
+    TEST_ASSERT_EQUAL_STRING("format: unknown command, try help\r\n", s_out);
+    TEST_ASSERT_EQUAL(-1, run("stats now"));
+    TEST_ASSERT_EQUAL_STRING("usage: stats [reset]\r\n", s_out);
+    TEST_ASSERT_EQUAL(-1, run("cache sectors two"));
+    TEST_ASSERT_EQUAL(-1, run("cache victims 2"));
+    TEST_ASSERT_EQUAL(-1, run("bench 8 0"));
+    TEST_ASSERT_EQUAL(-1, run("bench -1"));
+    TEST_ASSERT_EQUAL(-1, run("ls a b"));
+    TEST_ASSERT_EQUAL(-1, run("a b c d e f g"));
+    TEST_ASSERT_EQUAL_STRING("too many arguments\r\n", s_out);
+}
+
+void test_Shell_StatsAndCacheCommands(void) {
+    write_file("a.txt", 700U);
+    TEST_ASSERT_EQUAL(0, run("stats"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "writes "));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "errors 0 timeouts 0"));
+
+    TEST_ASSERT_EQUAL(0, run("stats reset"));
+    SD_Stats st;
+    SD_GetStats(&g_sd_handle, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.write_ops);
+
+    /* Resize the sector cache from the console and see it in the report. */
+    TEST_ASSERT_EQUAL(0, run("cache sectors 2"));
+    TEST_ASSERT_EQUAL_STRING("cache sectors 2\r\n", s_out);
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_CacheGetLines());
+    TEST_ASSERT_EQUAL(0, run("cache"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "sectors lines 2 "));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "readahead window "));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "fat groups "));
+
+    TEST_ASSERT_EQUAL(SD_PARAM, run("cache sectors 9999"));
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_CacheGetLines());
+    TEST_ASSERT_EQUAL(0, run("cache reset"));
+    SD_DiskCacheStats cs;
+    SD_DiskGetCacheStats(0, &cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.sectors.read_misses);
+
+    TEST_ASSERT_EQUAL(0, run("trace"));
+    TEST_ASSERT_EQUAL_STRING("trace not built (SD_TRACE_ENABLED=0)\r\n", s_out);
+}
+
+void test_Shell_LsDfAndSync(void) {
+    write_file("data.bin", 1000U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("logs"));
+    write_file("logs/x.txt", 12U);
+
+    TEST_ASSERT_EQUAL(0, run("ls"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "      1000  data.bin\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "     <DIR>  logs/\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "2 entries\r\n"));
+    TEST_ASSERT_EQUAL(0, run("ls logs"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "        12  x.txt\r\n"));
+    TEST_ASSERT_EQUAL(FR_NO_PATH, run("ls nope"));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, "ls nope: error"));
+
+    TEST_ASSERT_EQUAL(0, run("df"));
+    TEST_ASSERT_EQUAL_STRING("1234 KB free of 8000 KB\r\n", s_out);
+
+    /* A dirty cached sector reaches the card on sync. */
+    static uint8_t sector[SD_BLOCK_SIZE];
+    mock_card_stats_t card;
+    memset(sector, 0x5A, sizeof(sector));
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_write(0, sector, 9000U, 1));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1U, SD_CacheDirtyCount());
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(0, run("sync"));
+    mock_card_get_stats(&card);
+    TEST_ASSERT_EQUAL_STRING("synced\r\n", s_out);
+    TEST_ASSERT_EQUAL_UINT32(1U, s_flushes);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_CacheDirtyCount());
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1U, card.sectors_written);
+}
+
+void test_Shell_BenchRunsAndRemovesItsFile(void) {
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(0, run("bench 8 1024"));
+    TEST_ASSERT_EQUAL_STRING("", s_out); /* results go to printf */
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("bench.bin", &fno));
+    SD_Stats st;
+    SD_GetStats(&g_sd_handle, &st);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(16U, st.read_blocks);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Shell_LineEditingEchoAndPrompt);
+    RUN_TEST(test_Shell_UnknownCommandsAndBadArguments);
+    RUN_TEST(test_Shell_StatsAndCacheCommands);
+    RUN_TEST(test_Shell_LsDfAndSync);
+    RUN_TEST(test_Shell_BenchRunsAndRemovesItsFile);
+
+    return UNITY_END();
+}
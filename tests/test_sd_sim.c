@@ -0,0 +1,236 @@
+/*
+ * tests/test_sd_sim.c
+ *
+ * Tests for the mock HAL timing simulator: bus cost, read latency, program
+ * and erase busy, and the utilisation report. The card is initialised
+ * before the simulator starts, so each test times only the operation under
+ * test.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+static SD_Handle_t sd;
+static mock_hal_sim_config_t cfg;
+
+/* 1 MHz SCK (8 us per byte), no overheads, no card latencies. */
+static void sim_plain(void) {
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.spi_hz = 1000000U;
+    cfg.seed = 7U;
+}
+
+static mock_hal_sim_report_t sim_report(void) {
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    return rep;
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, do_sdhc_init(&sd, 8192U));
+    sim_plain();
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Bus cost
+ * ----------------------------------------------------------------------- */
+
+void test_Sim_Off_TickFrozen(void) {
+    push_single_read(0x11U);
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(0U, HAL_GetTick());
+    TEST_ASSERT_EQUAL_UINT32(0U, sim_report().bytes);
+}
+
+void test_Sim_NoLatency_BusFullyUtilised(void) {
+    mock_hal_sim_enable(&cfg);
+    push_single_read(0x22U);
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+
+    mock_hal_sim_report_t rep = sim_report();
+    TEST_ASSERT_TRUE(rep.bytes > 512U);
+    TEST_ASSERT_EQUAL_UINT64(rep.bytes * 8000U, rep.elapsed_ns);
+    TEST_ASSERT_EQUAL_UINT32(1000U, mock_hal_sim_utilization_permille(&rep));
+    TEST_ASSERT_EQUAL_UINT32(1U, rep.tokens);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)(rep.elapsed_ns / 1000U) * (MOCK_HAL_CORE_CLOCK / 1000000U),
+                             mock_dwt.CYCCNT);
+}
+
+void test_Sim_Overheads_LowerUtilisation_FasterClock_HigherThroughput(void) {
+    uint8_t buf[512];
+    cfg.call_overhead_ns = 2000U;
+    mock_hal_sim_enable(&cfg);
+    push_single_read(0x33U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    mock_hal_sim_report_t slow = sim_report();
+
+    cfg.spi_hz = 16000000U;
+    mock_hal_sim_enable(&cfg);
+    push_single_read(0x33U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    mock_hal_sim_report_t fast = sim_report();
+
+    TEST_ASSERT_EQUAL_UINT64(slow.bytes, fast.bytes);
+    TEST_ASSERT_EQUAL_UINT64(slow.bus_ns / 16U, fast.bus_ns);
+    TEST_ASSERT_TRUE(mock_hal_sim_utilization_permille(&slow) < 1000U);
+    TEST_ASSERT_TRUE(mock_hal_sim_utilization_permille(&fast) <
+                     mock_hal_sim_utilization_permille(&slow));
+    TEST_ASSERT_TRUE(mock_hal_sim_kib_per_s(&fast, 512U) > mock_hal_sim_kib_per_s(&slow, 512U));
+    mock_hal_sim_print("CMD17 @16MHz", 512U);
+}
+
+/* -----------------------------------------------------------------------
+ * Card latencies
+ * ----------------------------------------------------------------------- */
+
+void test_Sim_ReadLatency_HoldsToken_WithoutExtraQueueBytes(void) {
+    cfg.read_latency = (mock_hal_sim_dist_t){ 400U, 400U, 0U, 0U };
+    mock_hal_sim_enable(&cfg);
+    push_single_read(0x44U);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT8(0x44U, buf[511]);
+    TEST_ASSERT_EQUAL(0, mock_hal_queue_depth());
+
+    mock_hal_sim_report_t rep = sim_report();
+    TEST_ASSERT_EQUAL_UINT64(400000U, rep.latency_ns);
+    TEST_ASSERT_TRUE(rep.token_poll_ns > 0U);
+    TEST_ASSERT_TRUE(rep.elapsed_ns >= 400000U + 515U * 8000U);
+}
+
+void test_Sim_MultiBlockRead_LatencyBeforeEachBlock(void) {
+    cfg.read_latency = (mock_hal_sim_dist_t){ 100U, 100U, 0U, 0U };
+    mock_hal_sim_enable(&cfg);
+
+    uint8_t data[512];
+    memset(data, 0x55, sizeof(data));
+    push_cmd_exchange(0x00U); /* CMD18 */
+    for (int i = 0; i < 3; i++) {
+        push_data_token();
+        mock_hal_push_bytes(data, sizeof(data));
+        push_crc();
+    }
+    push_cmd_exchange(0x00U); /* CMD12 */
+
+    uint8_t buf[3 * 512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 3));
+    TEST_ASSERT_EQUAL_UINT8(0x55U, buf[2 * 512]);
+
+    /* The latency armed after the third block is cut short by CMD12. */
+    mock_hal_sim_report_t rep = sim_report();
+    TEST_ASSERT_EQUAL_UINT32(4U, rep.tokens);
+    TEST_ASSERT_TRUE(rep.token_poll_ns > 0U);
+    TEST_ASSERT_TRUE(rep.elapsed_ns >= 3U * (100000U + 515U * 8000U));
+}
+
+void test_Sim_ProgramBusy_DrivesWaitReadyAndTick(void) {
+    cfg.program_busy = (mock_hal_sim_dist_t){ 25000U, 25000U, 0U, 0U };
+    mock_hal_sim_enable(&cfg);
+    push_single_write_accepted();
+
+    uint8_t buf[512] = {0};
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, 0, 1));
+
+    mock_hal_sim_report_t rep = sim_report();
+    TEST_ASSERT_EQUAL_UINT32(1U, rep.programs);
+    TEST_ASSERT_EQUAL_UINT64(25000000U, rep.card_busy_ns);
+    TEST_ASSERT_TRUE(rep.busy_poll_ns > 0U);
+    TEST_ASSERT_TRUE(rep.elapsed_ns >= 25000000U);
+    TEST_ASSERT_TRUE(HAL_GetTick() >= 25U);
+    /* The driver yields a tick per busy miss, so the bus idles for most of it. */
+    TEST_ASSERT_TRUE(mock_hal_sim_utilization_permille(&rep) < 500U);
+}
+
+void test_Sim_Erase_BusyFromCmd38(void) {
+    cfg.erase_busy = (mock_hal_sim_dist_t){ 9000U, 9000U, 0U, 0U };
+    mock_hal_sim_enable(&cfg);
+    push_cmd_exchange(0x00U); /* CMD32 */
+    push_cmd_exchange(0x00U); /* CMD33 */
+    push_cmd_exchange(0x00U); /* CMD38 */
+    push_wait_ready();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_EraseBlocks(&sd, 2U, 3U));
+    mock_hal_sim_report_t rep = sim_report();
+    TEST_ASSERT_EQUAL_UINT32(1U, rep.erases);
+    TEST_ASSERT_EQUAL_UINT32(0U, rep.programs);
+    TEST_ASSERT_TRUE(HAL_GetTick() >= 9U);
+}
+
+void test_Sim_BusyPastTimeout_WriteFails(void) {
+    cfg.program_busy = (mock_hal_sim_dist_t){ 0U, 0U, SD_WRITE_BUSY_TIMEOUT_MS * 2000U, 1000U };
+    mock_hal_sim_enable(&cfg);
+    for (int attempt = 0; attempt < 3; attempt++) {
+        push_single_write_accepted();
+    }
+
+    uint8_t buf[512] = {0};
+    /* The retries find the card still busy at CMD24 and give up. */
+    SD_Status result = SD_WriteBlocks(&sd, buf, 0, 1);
+    TEST_ASSERT_TRUE(result != SD_OK);
+    TEST_ASSERT_TRUE(HAL_GetTick() >= SD_WRITE_BUSY_TIMEOUT_MS);
+    TEST_ASSERT_EQUAL_UINT32(1U, sim_report().programs);
+}
+
+/* -----------------------------------------------------------------------
+ * Distributions
+ * ----------------------------------------------------------------------- */
+
+static uint64_t run_writes(int n) {
+    uint8_t buf[512] = {0};
+    mock_hal_sim_enable(&cfg);
+    for (int i = 0; i < n; i++) {
+        push_single_write_accepted();
+        TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, buf, (uint32_t)i, 1));
+    }
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)n, sim_report().programs);
+    return sim_report().card_busy_ns;
+}
+
+void test_Sim_ProgramBusy_UniformBoundedAndSeeded(void) {
+    cfg.program_busy = (mock_hal_sim_dist_t){ 100U, 900U, 0U, 0U };
+    uint64_t first = run_writes(8);
+    TEST_ASSERT_TRUE(first >= 8U * 100000U && first <= 8U * 900000U);
+    TEST_ASSERT_TRUE(first != 8U * 100000U && first != 8U * 900000U);
+
+    TEST_ASSERT_EQUAL_UINT64(first, run_writes(8));
+    cfg.seed = 8U;
+    TEST_ASSERT_TRUE(first != run_writes(8));
+}
+
+void test_Sim_ProgramBusy_TailReplacesDraw(void) {
+    cfg.program_busy = (mock_hal_sim_dist_t){ 100U, 200U, 3000U, 1000U };
+    TEST_ASSERT_EQUAL_UINT64(4U * 3000000U, run_writes(4));
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Sim_Off_TickFrozen);
+    RUN_TEST(test_Sim_NoLatency_BusFullyUtilised);
+    RUN_TEST(test_Sim_Overheads_LowerUtilisation_FasterClock_HigherThroughput);
+
+    RUN_TEST(test_Sim_ReadLatency_HoldsToken_WithoutExtraQueueBytes);
+    RUN_TEST(test_Sim_MultiBlockRead_LatencyBeforeEachBlock);
+    RUN_TEST(test_Sim_ProgramBusy_DrivesWaitReadyAndTick);
+    RUN_TEST(test_Sim_Erase_BusyFromCmd38);
+    RUN_TEST(test_Sim_BusyPastTimeout_WriteFails);
+
+    RUN_TEST(test_Sim_ProgramBusy_UniformBoundedAndSeeded);
+    RUN_TEST(test_Sim_ProgramBusy_TailReplacesDraw);
+
+    return UNITY_END();
+}
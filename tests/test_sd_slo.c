@@ -0,0 +1,154 @@
+/*
+ * tests/test_sd_slo.c
+ *
+ * Latency objectives (SD_SLO_ENABLED=1, SD_TRACE_ENABLED=1) on the card
+ * emulator, timed by the mock HAL simulator with a card that stalls some
+ * writes: samples over a per-operation limit are counted, reported to the
+ * callback with the trace leading up to them, kept for SD_GetSloViolation,
+ * and leave the trace ring to its consumer.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_trace.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_slo.img"
+#define CARD_BLOCKS 8192U
+#define BASE        300U
+#define WRITES      16U
+
+static SD_Handle_t sd;
+static uint8_t s_block[512];
+static uint32_t s_calls;
+static SD_SloViolation s_seen;
+
+static void on_violation(void *context, const SD_SloViolation *v) {
+    TEST_ASSERT_EQUAL_PTR(&s_calls, context);
+    s_calls++;
+    s_seen = *v;
+}
+
+/* One write in four stalls for 40 ms (garbage collection on a worn card). */
+static void start(void) {
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    cfg.program_busy = (mock_hal_sim_dist_t){300U, 300U, 40000U, 250U};
+    mock_hal_sim_enable(&cfg);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_ResetStats(&sd);
+    SD_TraceReset();
+}
+
+static void write_blocks(void) {
+    for (uint32_t i = 0; i < WRITES; i++) {
+        memset(s_block, (int)i, sizeof(s_block));
+        TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_block, BASE + i, 1U));
+    }
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    s_calls = 0;
+    memset(&s_seen, 0, sizeof(s_seen));
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    mock_card_close();
+}
+
+void test_Slo_SlowWrites_CallBackWithTrace(void) {
+    SD_Stats st;
+    start();
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetLatencySlo(&sd, SD_LAT_CMD24, 10000U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetSloCallback(&sd, on_violation, &s_calls));
+    write_blocks();
+
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_TRUE(s_calls > 0U);
+    TEST_ASSERT_TRUE(s_calls < WRITES);
+    TEST_ASSERT_EQUAL_UINT32(s_calls, st.slo_violations[SD_LAT_CMD24]);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.slo_violations[SD_LAT_BUSY]);
+    TEST_ASSERT_EQUAL(SD_LAT_CMD24, s_seen.op);
+    TEST_ASSERT_EQUAL_UINT32(10000U, s_seen.limit_us);
+    TEST_ASSERT_TRUE(s_seen.latency_us > 10000U);
+    TEST_ASSERT_EQUAL_UINT32(s_calls, s_seen.count);
+
+    /* The snapshot ends with the slow write's own command. */
+    TEST_ASSERT_TRUE(s_seen.events > 0U);
+    TEST_ASSERT_TRUE(s_seen.events <= SD_SLO_TRACE_EVENTS);
+    bool cmd24 = false;
+    for (uint32_t i = 0; i < s_seen.events; i++) {
+        if (i > 0U) {
+            TEST_ASSERT_EQUAL_UINT32(s_seen.trace[i - 1U].seq + 1U, s_seen.trace[i].seq);
+        }
+        if (s_seen.trace[i].type == SD_TRACE_CMD && s_seen.trace[i].code == 24U) {
+            cmd24 = true;
+        }
+    }
+    TEST_ASSERT_TRUE(cmd24);
+
+    SD_SloViolation last;
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetSloViolation(&sd, &last));
+    TEST_ASSERT_EQUAL_MEMORY(&s_seen, &last, sizeof(last));
+
+    /* The snapshot did not consume the ring. */
+    SD_TraceEvent ev[4];
+    TEST_ASSERT_EQUAL_UINT32(4U, SD_TraceRead(ev, 4U));
+    TEST_ASSERT_EQUAL_UINT32(0U, ev[0].seq);
+}
+
+void test_Slo_WithinLimits_NoViolation(void) {
+    SD_SloViolation last;
+    SD_Stats st;
+    start();
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_GetSloViolation(&sd, &last));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetLatencySlo(&sd, SD_LAT_CMD24, 100000U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetLatencySlo(&sd, SD_LAT_CMD17, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetLatencySlo(&sd, SD_LAT_CMD17, 0U)); /* cleared */
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetSloCallback(&sd, on_violation, &s_calls));
+    write_blocks();
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_block, BASE, 1U));
+
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, s_calls);
+    for (uint32_t op = 0; op < SD_LAT_COUNT; op++) {
+        TEST_ASSERT_EQUAL_UINT32(0U, st.slo_violations[op]);
+    }
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_GetSloViolation(&sd, &last));
+}
+
+void test_Slo_NoCallback_StillKeepsLastViolation(void) {
+    SD_SloViolation last;
+    start();
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetLatencySlo(&sd, SD_LAT_BUSY, 10000U));
+    write_blocks();
+    TEST_ASSERT_EQUAL(SD_OK, SD_GetSloViolation(&sd, &last));
+    TEST_ASSERT_EQUAL(SD_LAT_BUSY, last.op);
+    TEST_ASSERT_TRUE(last.latency_us > 10000U);
+    TEST_ASSERT_TRUE(last.count > 0U);
+}
+
+void test_Slo_BadArguments(void) {
+    SD_SloViolation last;
+    start();
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetLatencySlo(&sd, SD_LAT_COUNT, 100U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetLatencySlo(NULL, SD_LAT_CMD24, 100U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SetSloCallback(NULL, on_violation, NULL));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_GetSloViolation(&sd, NULL));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_GetSloViolation(NULL, &last));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Slo_SlowWrites_CallBackWithTrace);
+    RUN_TEST(test_Slo_WithinLimits_NoViolation);
+    RUN_TEST(test_Slo_NoCallback_StillKeepsLastViolation);
+    RUN_TEST(test_Slo_BadArguments);
+    return UNITY_END();
+}
@@ -0,0 +1,153 @@
+/*
+ * tests/test_sd_smallfile.c
+ *
+ * Small-file cache (SD_SMALLFILE_POOL=1024, SD_SMALLFILE_MAX=512,
+ * SD_SMALLFILE_SLOTS=3) through sd_mount on the card emulator: a second
+ * sd_read_file of a small file reads nothing from the card, sd_write_file
+ * and delete drop the copy, files over the limit or read in part are not
+ * kept, the least recently read files make room and the survivors keep
+ * their contents, and unmount empties the pool.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_smallfile.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+static char s_buf[1024];
+static char s_text[4][401];
+
+static uint32_t card_reads(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.sectors_read;
+}
+
+static void read_expect(const char *path, const char *want) {
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file(path, s_buf, sizeof(s_buf), &n));
+    TEST_ASSERT_EQUAL_UINT32(strlen(want), n);
+    TEST_ASSERT_EQUAL_STRING(want, s_buf);
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    for (int i = 0; i < 4; i++) {
+        memset(s_text[i], 'a' + i, 400);
+        s_text[i][400] = '\0';
+        char name[16];
+        (void)snprintf(name, sizeof(name), "0:/f%d.cfg", i);
+        TEST_ASSERT_EQUAL(FR_OK, sd_write_file(name, s_text[i]));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/app.cfg", "rate=10\n"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_SmallFile_RepeatReadFromRam(void) {
+    read_expect("0:/app.cfg", "rate=10\n");
+    mock_card_reset_stats();
+    for (int i = 0; i < 5; i++) {
+        read_expect("0:/APP.CFG", "rate=10\n");
+    }
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+
+    SD_SmallFileStats st;
+    sd_smallfile_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(5U, st.hits);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.misses);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.files);
+    TEST_ASSERT_EQUAL_UINT32(8U, st.bytes);
+
+    /* A short buffer gets the start, as from the card. */
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file("0:/app.cfg", s_buf, 5U, &n));
+    TEST_ASSERT_EQUAL_STRING("rate", s_buf);
+}
+
+void test_SmallFile_WriteAndDeleteDropCopy(void) {
+    read_expect("0:/app.cfg", "rate=10\n");
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/app.cfg", "rate=20\n"));
+    read_expect("0:/app.cfg", "rate=20\n");
+    TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/app.cfg", "mode=1\n"));
+    read_expect("0:/app.cfg", "rate=20\nmode=1\n");
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/app.cfg"));
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_read_file("0:/app.cfg", s_buf, sizeof(s_buf), &n));
+}
+
+void test_SmallFile_LargeOrPartialNotKept(void) {
+    static char big[600];
+    memset(big, 'z', sizeof(big) - 1U);
+    big[sizeof(big) - 1U] = '\0';
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/big.cfg", big));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    read_expect("0:/big.cfg", big);
+
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file("0:/f0.cfg", s_buf, 100U, &n));
+    TEST_ASSERT_EQUAL_UINT32(99U, n);
+
+    SD_SmallFileStats st;
+    sd_smallfile_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.files);
+}
+
+void test_SmallFile_LruMakesRoom(void) {
+    read_expect("0:/f0.cfg", s_text[0]);
+    read_expect("0:/f1.cfg", s_text[1]);
+    read_expect("0:/f0.cfg", s_text[0]); /* f1 is now the oldest */
+    read_expect("0:/f2.cfg", s_text[2]); /* 1200 bytes > 1024: f1 goes */
+
+    SD_SmallFileStats st;
+    sd_smallfile_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.evictions);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.files);
+    TEST_ASSERT_EQUAL_UINT32(800U, st.bytes);
+
+    mock_card_reset_stats();
+    read_expect("0:/f0.cfg", s_text[0]);
+    read_expect("0:/f2.cfg", s_text[2]);
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+
+    /* Slots run out before bytes do. */
+    read_expect("0:/app.cfg", "rate=10\n");
+    read_expect("0:/f3.cfg", s_text[3]); /* drops f0, the oldest */
+    sd_smallfile_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(3U, st.files);
+    mock_card_reset_stats();
+    read_expect("0:/f2.cfg", s_text[2]);
+    read_expect("0:/f3.cfg", s_text[3]);
+    read_expect("0:/app.cfg", "rate=10\n");
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    sd_smallfile_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.files);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_SmallFile_RepeatReadFromRam);
+    RUN_TEST(test_SmallFile_WriteAndDeleteDropCopy);
+    RUN_TEST(test_SmallFile_LargeOrPartialNotKept);
+    RUN_TEST(test_SmallFile_LruMakesRoom);
+    return UNITY_END();
+}
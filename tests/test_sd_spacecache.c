@@ -0,0 +1,133 @@
+/*
+ * tests/test_sd_spacecache.c
+ *
+ * Cached free space (SD_SPACE_CACHE=1) through sd_mount on an 8 MiB FAT16
+ * card with 1 KiB clusters: the mount leaves the count to the background
+ * (FAT16 has no FSINFO), sd_free_space_poll recounts it, sd_get_space_cached
+ * answers without card I/O and follows allocations and deletes, and a wrong
+ * mount-time figure is served until the recount corrects it.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_spacecache.img"
+#define CARD_BLOCKS 16384U
+#define FILE_BYTES  (8U * 1024U)
+
+extern FATFS fs;
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_data[FILE_BYTES];
+
+static uint32_t card_reads(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.sectors_read;
+}
+
+/* Free clusters counted from the FAT itself. */
+static uint32_t scan_free_kb(void) {
+    DWORD saved = fs.free_clst;
+    DWORD fre_clust;
+    FATFS *pfs;
+    fs.free_clst = 0xFFFFFFFFU;
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &fre_clust, &pfs));
+    fs.free_clst = saved;
+    return (uint32_t)fre_clust * fs.csize / 2U;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    memset(s_data, 0x3C, sizeof(s_data));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_SpaceCache_MountDefersRecount(void) {
+    SD_SpaceInfo info;
+    TEST_ASSERT_EQUAL(FR_NOT_READY, sd_get_space_cached(&info));
+    TEST_ASSERT_TRUE(info.total_kb > 0U);
+    TEST_ASSERT_FALSE(info.reconciled);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_free_space_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&info));
+    TEST_ASSERT_TRUE(info.reconciled);
+    TEST_ASSERT_EQUAL_INT(0, info.drift_kb);
+    TEST_ASSERT_EQUAL_UINT32(scan_free_kb(), info.free_kb);
+}
+
+void test_SpaceCache_FollowsAllocationWithoutIo(void) {
+    SD_SpaceInfo before, info;
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, sd_free_space_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&before));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/a.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_data, FILE_BYTES, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&info));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+    TEST_ASSERT_EQUAL_UINT32(before.free_kb - FILE_BYTES / 1024U, info.free_kb);
+    TEST_ASSERT_EQUAL_UINT32(scan_free_kb(), info.free_kb);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("0:/a.bin"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&info));
+    TEST_ASSERT_EQUAL_UINT32(before.free_kb, info.free_kb);
+}
+
+void test_SpaceCache_RecountCorrectsMountFigure(void) {
+    /* A stale FSINFO-style figure 10 clusters short of the truth. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    uint32_t true_kb = scan_free_kb();
+    fs.free_clst = true_kb * 2U / fs.csize - 10U;
+
+    SD_SpaceInfo info;
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&info));
+    TEST_ASSERT_EQUAL_UINT32(true_kb - 10U, info.free_kb);
+    TEST_ASSERT_FALSE(info.reconciled);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_free_space_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&info));
+    TEST_ASSERT_TRUE(info.reconciled);
+    TEST_ASSERT_EQUAL_UINT32(true_kb, info.free_kb);
+    TEST_ASSERT_EQUAL_INT(10, info.drift_kb);
+
+    /* Only one recount per mount. */
+    fs.free_clst -= 1U;
+    TEST_ASSERT_EQUAL(FR_OK, sd_free_space_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_get_space_cached(&info));
+    TEST_ASSERT_EQUAL_UINT32(true_kb - 1U, info.free_kb);
+}
+
+void test_SpaceCache_NotMounted(void) {
+    SD_SpaceInfo info;
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_NOT_ENABLED, sd_get_space_cached(&info));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_get_space_cached(NULL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_SpaceCache_MountDefersRecount);
+    RUN_TEST(test_SpaceCache_FollowsAllocationWithoutIo);
+    RUN_TEST(test_SpaceCache_RecountCorrectsMountFigure);
+    RUN_TEST(test_SpaceCache_NotMounted);
+    return UNITY_END();
+}
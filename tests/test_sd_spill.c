@@ -0,0 +1,241 @@
+/*
+ * tests/test_sd_spill.c
+ *
+ * RAM spill buffer (sd_spill.h) over the card emulator, drained with
+ * SD_SpillPoll as in a build without FreeRTOS: writes held until polled
+ * and merged into one command, the watermark and full events, extents
+ * split at the ring's wrap, rewrites, a failed extent, and a 100 KB/s
+ * producer riding out 250 ms card busy stalls without losing a sector
+ * (built with SD_SPILL_SECTORS=128, room for two stalls back to back).
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spill.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_spill.img"
+#define CARD_BLOCKS 8192U
+
+static SD_Handle_t sd;
+static SD_Spill s_spill;
+static uint8_t s_buf[8U * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static SD_SpillEvent s_events[64];
+static uint32_t s_event_used[64];
+static uint32_t s_event_count;
+
+static void on_event(SD_SpillEvent event, uint32_t used_sectors, void *context) {
+    (void)context;
+    if (s_event_count < 64U) {
+        s_events[s_event_count] = event;
+        s_event_used[s_event_count] = used_sectors;
+    }
+    s_event_count++;
+}
+
+static uint32_t count_events(SD_SpillEvent event) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < s_event_count && i < 64U; i++) {
+        n += (s_events[i] == event) ? 1U : 0U;
+    }
+    return n;
+}
+
+static SD_SpillStats stats(void) {
+    SD_SpillStats st;
+    SD_SpillGetStats(&s_spill, &st);
+    return st;
+}
+
+static void fill(uint8_t *dst, uint32_t sector, uint32_t version) {
+    for (uint32_t i = 0; i < 512U; i++) {
+        dst[i] = (uint8_t)(sector * 3U + version * 17U + i);
+    }
+}
+
+static void write_run(uint32_t sector, uint32_t count, uint32_t version) {
+    for (uint32_t k = 0; k < count; k++) {
+        fill(&s_buf[k * 512U], sector + k, version);
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillWrite(&s_spill, s_buf, sector, count));
+}
+
+static void expect_card(uint32_t sector, uint32_t version) {
+    uint8_t want[512];
+    fill(want, sector, version);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, sector, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(want, s_buf, 512);
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    s_event_count = 0;
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillInit(&s_spill, &sd, 8U, 2U, on_event, NULL));
+}
+
+void tearDown(void) {
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_Spill_InitRejectsBadWatermarks(void) {
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SpillInit(&s_spill, &sd, 0U, 0U, NULL, NULL));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SpillInit(&s_spill, &sd, 4U, 4U, NULL, NULL));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SpillInit(&s_spill, &sd, SD_SPILL_SECTORS + 1U, 1U, NULL,
+                                             NULL));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_SpillInit(&s_spill, NULL, 8U, 2U, NULL, NULL));
+}
+
+void test_Spill_WritesWaitForPollAndMerge(void) {
+    uint32_t before = card_stats().sectors_written;
+    write_run(100U, 2U, 1U);
+    write_run(102U, 2U, 1U);
+    TEST_ASSERT_EQUAL_UINT32(before, card_stats().sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(4, SD_SpillUsed(&s_spill));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillPoll(&s_spill));
+    TEST_ASSERT_EQUAL_UINT32(0, SD_SpillUsed(&s_spill));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().card_writes);
+    TEST_ASSERT_EQUAL_UINT32(before + 4U, card_stats().sectors_written);
+    for (uint32_t s = 100U; s < 104U; s++) {
+        expect_card(s, 1U);
+    }
+}
+
+void test_Spill_WatermarksAndFullRing(void) {
+    for (uint32_t s = 0; s < SD_SPILL_SECTORS; s += 8U) {
+        write_run(s, 8U, 2U);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, count_events(SD_SPILL_HIGH));
+    TEST_ASSERT_EQUAL_UINT32(8, s_event_used[0]);
+
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_SpillWrite(&s_spill, s_buf, SD_SPILL_SECTORS, 1U));
+    TEST_ASSERT_EQUAL_UINT32(1, count_events(SD_SPILL_FULL));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().refused);
+    TEST_ASSERT_EQUAL_UINT32(SD_SPILL_SECTORS, stats().max_used);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+    TEST_ASSERT_EQUAL_UINT32(1, count_events(SD_SPILL_LOW));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillWrite(&s_spill, s_buf, SD_SPILL_SECTORS, 1U));
+}
+
+void test_Spill_ExtentTableLimitsScatteredWrites(void) {
+    for (uint32_t i = 0; i < SD_SPILL_MAX_EXTENTS; i++) {
+        write_run(i * 10U, 1U, 1U);
+    }
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_SpillWrite(&s_spill, s_buf, 5000U, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillPoll(&s_spill));
+    write_run(5000U, 1U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+    TEST_ASSERT_EQUAL_UINT32(SD_SPILL_MAX_EXTENTS + 1U, stats().card_writes);
+    expect_card(0U, 1U);
+    expect_card(5000U, 1U);
+}
+
+void test_Spill_WrapSplitsWrite(void) {
+    for (uint32_t s = 0; s < SD_SPILL_SECTORS - 4U; s += 4U) {
+        write_run(1000U + s, 4U, 1U);
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+    uint32_t writes = stats().card_writes;
+
+    write_run(2000U, 8U, 3U); /* 4 sectors before the wrap, 4 after */
+    TEST_ASSERT_EQUAL_UINT32(8, SD_SpillUsed(&s_spill));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+    TEST_ASSERT_EQUAL_UINT32(writes + 2U, stats().card_writes);
+    for (uint32_t s = 2000U; s < 2008U; s++) {
+        expect_card(s, 3U);
+    }
+}
+
+void test_Spill_RewriteLeavesNewestOnCard(void) {
+    write_run(7U, 1U, 1U);
+    write_run(7U, 1U, 2U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+    expect_card(7U, 2U);
+}
+
+void test_Spill_CardErrorDropsExtent(void) {
+    write_run(CARD_BLOCKS + 16U, 1U, 1U); /* past the end: the card refuses it */
+    write_run(50U, 1U, 1U);
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_SpillFlush(&s_spill, 1000U));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().card_errors);
+    TEST_ASSERT_EQUAL_UINT32(1, count_events(SD_SPILL_ERROR));
+    TEST_ASSERT_EQUAL_UINT32(0, SD_SpillUsed(&s_spill));
+    expect_card(50U, 1U);
+
+    write_run(51U, 1U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+}
+
+/*
+ * Sector k is produced at k * 5.12 ms of simulated time (100 KB/s); the
+ * main loop polls between productions. One block program in two hundred
+ * is a 250 ms busy stall. The ring fills up meanwhile and catches up in
+ * one multi-block write, which may stall again while it still holds them.
+ */
+void test_Spill_AbsorbsBusyStalls(void) {
+    const uint32_t total = 3000U;
+    const uint64_t period_ns = 5120000ULL;
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_report_t rep;
+    uint32_t produced = 0;
+    uint32_t refused = 0;
+
+    mock_hal_sim_defaults(&cfg);
+    cfg.program_busy.tail_us = 250000U;
+    cfg.program_busy.tail_permille = 5U;
+    mock_hal_sim_enable(&cfg);
+
+    while (produced < total) {
+        mock_hal_sim_report(&rep);
+        while (produced < total && (uint64_t)produced * period_ns <= rep.elapsed_ns) {
+            fill(s_buf, produced, 5U);
+            if (SD_SpillWrite(&s_spill, s_buf, produced, 1U) != SD_OK) {
+                refused++;
+            }
+            produced++;
+        }
+        if (SD_SpillUsed(&s_spill) > 0U) {
+            TEST_ASSERT_EQUAL(SD_OK, SD_SpillPoll(&s_spill));
+        } else {
+            HAL_Delay(1);
+        }
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_SpillFlush(&s_spill, 1000U));
+    mock_hal_sim_report(&rep);
+    mock_hal_sim_enable(NULL);
+
+    TEST_ASSERT_TRUE(rep.card_busy_ns >= 5ULL * 250000000ULL); /* several stalls played */
+    TEST_ASSERT_EQUAL_UINT32(0, refused);
+    TEST_ASSERT_TRUE(stats().max_used >= 45U);
+    TEST_ASSERT_TRUE(stats().max_used < SD_SPILL_SECTORS);
+    TEST_ASSERT_TRUE(count_events(SD_SPILL_HIGH) > 0U);
+    TEST_ASSERT_EQUAL_UINT32(count_events(SD_SPILL_HIGH), count_events(SD_SPILL_LOW));
+    for (uint32_t s = 0; s < total; s += 97U) {
+        expect_card(s, 5U);
+    }
+    expect_card(total - 1U, 5U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Spill_InitRejectsBadWatermarks);
+    RUN_TEST(test_Spill_WritesWaitForPollAndMerge);
+    RUN_TEST(test_Spill_WatermarksAndFullRing);
+    RUN_TEST(test_Spill_ExtentTableLimitsScatteredWrites);
+    RUN_TEST(test_Spill_WrapSplitsWrite);
+    RUN_TEST(test_Spill_RewriteLeavesNewestOnCard);
+    RUN_TEST(test_Spill_CardErrorDropsExtent);
+    RUN_TEST(test_Spill_AbsorbsBusyStalls);
+
+    return UNITY_END();
+}
@@ -0,0 +1,136 @@
+/*
+ * tests/test_sd_splitbusy.c
+ *
+ * Split busy waits (SD_SPLIT_BUSY=1) over the card emulator, timed by the
+ * mock HAL simulator with a fixed 20 ms program busy: writes return before
+ * the busy ends, SD_PollBusy watches it without waiting, and the next
+ * command, SD_Sync or an expired write timeout settle it.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_splitbusy.img"
+#define CARD_BLOCKS 8192U
+#define BUSY_US     20000U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[8U * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_want[8U * 512U];
+
+static void sim_start(uint32_t busy_us) {
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    cfg.program_busy.min_us = busy_us;
+    cfg.program_busy.max_us = busy_us;
+    cfg.program_busy.tail_permille = 0U;
+    mock_hal_sim_enable(&cfg);
+}
+
+static uint64_t sim_now_ns(void) {
+    mock_hal_sim_report_t rep;
+    mock_hal_sim_report(&rep);
+    return rep.elapsed_ns;
+}
+
+static void fill(uint8_t *dst, uint32_t count, uint8_t seed) {
+    for (uint32_t i = 0; i < count * 512U; i++) {
+        dst[i] = (uint8_t)(seed + i * 7U);
+    }
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_SplitBusy_WriteReturnsBeforeBusyEnds(void) {
+    sim_start(BUSY_US);
+    fill(s_buf, 1U, 0x10U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, 40U, 1U));
+    TEST_ASSERT_TRUE(sim_now_ns() < (uint64_t)BUSY_US * 1000ULL / 4ULL);
+    TEST_ASSERT_EQUAL_UINT32(1, sd.stats.busy_deferred);
+
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_PollBusy(&sd));
+    HAL_Delay(BUSY_US / 1000U + 5U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_PollBusy(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1, sd.stats.busy_deferred_idle);
+
+    /* Nothing pending: answered without touching the bus. */
+    int selects = mock_hal_gpio_write_calls;
+    TEST_ASSERT_EQUAL(SD_OK, SD_PollBusy(&sd));
+    TEST_ASSERT_EQUAL(selects, mock_hal_gpio_write_calls);
+}
+
+void test_SplitBusy_ReadAfterWriteWaitsOutBusy(void) {
+    fill(s_want, 1U, 0x20U);
+    memcpy(s_buf, s_want, 512U);
+    sim_start(BUSY_US);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, 41U, 1U));
+    uint64_t written = sim_now_ns();
+
+    memset(s_buf, 0, 512U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 41U, 1U));
+    TEST_ASSERT_TRUE(sim_now_ns() >= written + (uint64_t)BUSY_US * 900ULL);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, 512);
+    TEST_ASSERT_EQUAL_UINT32(0, sd.stats.busy_deferred_idle);
+}
+
+void test_SplitBusy_IdleCardIsNotWaitedFor(void) {
+    sim_start(BUSY_US);
+    fill(s_buf, 1U, 0x30U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, 42U, 1U));
+    HAL_Delay(BUSY_US / 1000U + 5U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 42U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(1, sd.stats.busy_deferred_idle);
+}
+
+void test_SplitBusy_MultiBlockDefersOnlyTheStopBusy(void) {
+    fill(s_want, 8U, 0x40U);
+    memcpy(s_buf, s_want, sizeof(s_buf));
+    sim_start(BUSY_US);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, 100U, 8U));
+    TEST_ASSERT_EQUAL_UINT32(1, sd.stats.busy_deferred);
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_PollBusy(&sd));
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_PollBusy(&sd));
+    memset(s_buf, 0, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, 100U, 8U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_want, s_buf, sizeof(s_buf));
+}
+
+void test_SplitBusy_PollReportsExpiredWriteTimeout(void) {
+    sim_start(2000000U);
+    fill(s_buf, 1U, 0x50U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_buf, 43U, 1U));
+    TEST_ASSERT_EQUAL(SD_BUSY, SD_PollBusy(&sd));
+    HAL_Delay(SD_WRITE_BUSY_TIMEOUT_MS + 10U);
+    TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_PollBusy(&sd));
+    TEST_ASSERT_EQUAL(SD_OK, SD_PollBusy(&sd)); /* reported once */
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_SplitBusy_WriteReturnsBeforeBusyEnds);
+    RUN_TEST(test_SplitBusy_ReadAfterWriteWaitsOutBusy);
+    RUN_TEST(test_SplitBusy_IdleCardIsNotWaitedFor);
+    RUN_TEST(test_SplitBusy_MultiBlockDefersOnlyTheStopBusy);
+    RUN_TEST(test_SplitBusy_PollReportsExpiredWriteTimeout);
+
+    return UNITY_END();
+}
@@ -0,0 +1,154 @@
+/*
+ * tests/test_sd_statcache.c
+ *
+ * Stat cache (SD_STAT_CACHE_SLOTS=4) through sd_mount on the card emulator:
+ * repeated sd_stat of the same paths reads nothing from the card, writes,
+ * flushes, deletes, renames and directory removal drop the entries they
+ * affect, paths match regardless of case and drive prefix, the least
+ * recently used entry makes room, and unmount forgets everything.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_statcache.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+
+static uint32_t card_reads(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.sectors_read;
+}
+
+static uint32_t size_of(const char *path) {
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat(path, &fno));
+    return (uint32_t)fno.fsize;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_create_directory("0:/data"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/a.txt", "12345"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/data/b.txt", "12"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/top.txt", "1"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_StatCache_RepeatsStayInRam(void) {
+    SD_StatCacheStats before, st;
+    sd_stat_cache_get_stats(&before);
+    TEST_ASSERT_EQUAL_UINT32(5U, size_of("0:/data/a.txt"));
+    TEST_ASSERT_EQUAL_UINT32(2U, size_of("0:/data/b.txt"));
+
+    mock_card_reset_stats();
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL_UINT32(5U, size_of("0:/data/a.txt"));
+        TEST_ASSERT_EQUAL_UINT32(2U, size_of("DATA/B.TXT"));
+        TEST_ASSERT_TRUE(sd_file_exists("/data/A.txt"));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+    sd_stat_cache_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.misses + 2U, st.misses);
+    TEST_ASSERT_EQUAL_UINT32(before.hits + 30U, st.hits);
+
+    /* Missing names are not cached. */
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/data/none.txt", NULL));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/data/none.txt", NULL));
+    sd_stat_cache_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.misses + 4U, st.misses);
+}
+
+void test_StatCache_WritesDropEntry(void) {
+    TEST_ASSERT_EQUAL_UINT32(5U, size_of("0:/data/a.txt"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/data/a.txt", "678"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_flush());
+    TEST_ASSERT_EQUAL_UINT32(8U, size_of("0:/data/a.txt"));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/DATA/A.TXT", "x"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    TEST_ASSERT_EQUAL_UINT32(1U, size_of("0:/data/a.txt"));
+
+    /* A change behind the helpers' back, reported like for the directory index. */
+    FIL fil;
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "0:/top.txt", FA_WRITE | FA_OPEN_APPEND));
+    TEST_ASSERT_EQUAL_UINT32(1U, size_of("0:/top.txt"));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, "23", 2U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    TEST_ASSERT_EQUAL_UINT32(1U, size_of("0:/top.txt"));
+    sd_dirindex_invalidate("0:/top.txt");
+    TEST_ASSERT_EQUAL_UINT32(3U, size_of("0:/top.txt"));
+}
+
+void test_StatCache_DeleteRenameAndDirectories(void) {
+    TEST_ASSERT_EQUAL_UINT32(5U, size_of("0:/data/a.txt"));
+    TEST_ASSERT_EQUAL_UINT32(2U, size_of("0:/data/b.txt"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/data/b.txt"));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/data/b.txt", NULL));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_rename_file("0:/data/a.txt", "0:/data/c.txt"));
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/data/a.txt", NULL));
+    TEST_ASSERT_EQUAL_UINT32(5U, size_of("0:/data/c.txt"));
+
+    /* Dropping a directory drops what was cached under it. */
+    TEST_ASSERT_EQUAL_UINT32(1U, size_of("0:/top.txt"));
+    SD_StatCacheStats before, st;
+    sd_stat_cache_get_stats(&before);
+    sd_dirindex_invalidate("0:/data/");
+    sd_stat_cache_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.invalidations + 1U, st.invalidations);
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_UINT32(1U, size_of("0:/top.txt"));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+}
+
+void test_StatCache_LruAndUnmount(void) {
+    const char *paths[5] = {"0:/data", "0:/data/a.txt", "0:/data/b.txt", "0:/top.txt",
+                            "0:/data/a.txt"};
+    SD_StatCacheStats before, st;
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/e.txt", "e"));
+    sd_stat_cache_get_stats(&before);
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, sd_stat(paths[i], NULL));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/e.txt", NULL)); /* replaces "0:/data" */
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/data/b.txt", NULL));
+    sd_stat_cache_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.misses + 5U, st.misses);
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/data", NULL));
+    sd_stat_cache_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.misses + 6U, st.misses);
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    sd_stat_cache_get_stats(&before);
+    TEST_ASSERT_EQUAL(FR_OK, sd_stat("0:/top.txt", NULL));
+    sd_stat_cache_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(before.misses + 1U, st.misses);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_StatCache_RepeatsStayInRam);
+    RUN_TEST(test_StatCache_WritesDropEntry);
+    RUN_TEST(test_StatCache_DeleteRenameAndDirectories);
+    RUN_TEST(test_StatCache_LruAndUnmount);
+    return UNITY_END();
+}
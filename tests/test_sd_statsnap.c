@@ -0,0 +1,119 @@
+/*
+ * tests/test_sd_statsnap.c
+ *
+ * Lock-free stats snapshots (SD_STATS_SNAPSHOT=1, SD_SLO_ENABLED=1) on the
+ * card emulator, timed by the mock HAL simulator: each bus operation publishes a consistent copy, a read
+ * taken while an operation is still running (from its SLO callback) sees
+ * the previous operation's counters, counters bumped outside the lock are
+ * read live, and a reset publishes the zeroed counters.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_statsnap.img"
+#define CARD_BLOCKS 8192U
+#define BASE        300U
+#define WRITES      8U
+
+static SD_Handle_t sd;
+static uint8_t s_block[512];
+static uint32_t s_done;    /* writes returned to the test so far */
+static uint32_t s_calls;
+static bool s_consistent;
+
+/* Runs inside a write, with the bus held and the counters half updated. */
+static void mid_write(void *context, const SD_SloViolation *v) {
+    SD_Stats st;
+    (void)context;
+    (void)v;
+    SD_GetStats(&sd, &st);
+    s_calls++;
+    s_consistent = s_consistent && st.write_ops == s_done && st.write_blocks == s_done &&
+                   st.write_bytes == (uint64_t)s_done * 512U &&
+                   st.latency[SD_LAT_CMD24].count == s_done; /* live count is one ahead */
+}
+
+static void start(void) {
+    mock_hal_sim_config_t cfg;
+    mock_hal_sim_defaults(&cfg);
+    mock_hal_sim_enable(&cfg);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    SD_ResetStats(&sd);
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    s_done = 0;
+    s_calls = 0;
+    s_consistent = true;
+}
+
+void tearDown(void) {
+    mock_hal_sim_enable(NULL);
+    mock_card_close();
+}
+
+void test_StatSnap_EachOperationPublishes(void) {
+    SD_Stats st;
+    start();
+    uint32_t seq = sd.stats_seq;
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_block, BASE, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_block, BASE, 1U));
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.write_ops);
+    TEST_ASSERT_EQUAL_UINT32(1U, st.read_ops);
+    TEST_ASSERT_EQUAL_UINT64(512U, st.read_bytes);
+    TEST_ASSERT_EQUAL_MEMORY(&sd.stats.latency, &st.latency, sizeof(st.latency));
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats_seq & 1U);
+    TEST_ASSERT_TRUE(sd.stats_seq >= seq + 4U);
+}
+
+void test_StatSnap_ReadDuringOperation_SeesLastCompleted(void) {
+    start();
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetLatencySlo(&sd, SD_LAT_CMD24, 1U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_SetSloCallback(&sd, mid_write, NULL));
+    for (uint32_t i = 0; i < WRITES; i++) {
+        TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_block, BASE + i, 1U));
+        s_done++;
+    }
+    TEST_ASSERT_TRUE(s_calls >= WRITES);
+    TEST_ASSERT_TRUE(s_consistent);
+}
+
+void test_StatSnap_UnlockedCountersReadLive(void) {
+    SD_Stats st;
+    start();
+    uint32_t seq = sd.stats_seq;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocks(&sd, s_block, CARD_BLOCKS, 1U));
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_ReadBlocks(&sd, NULL, 0U, 1U));
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT32(2U, st.error_count);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.read_ops);
+    TEST_ASSERT_TRUE(sd.stats_seq - seq <= 2U); /* the NULL buffer never took the bus */
+}
+
+void test_StatSnap_ResetPublishesZeros(void) {
+    SD_Stats st;
+    start();
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_block, BASE, 1U));
+    SD_ResetStats(&sd);
+    SD_GetStats(&sd, &st);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.write_ops);
+    TEST_ASSERT_EQUAL_UINT64(0U, st.write_bytes);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.latency[SD_LAT_CMD24].count);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_StatSnap_EachOperationPublishes);
+    RUN_TEST(test_StatSnap_ReadDuringOperation_SeesLastCompleted);
+    RUN_TEST(test_StatSnap_UnlockedCountersReadLive);
+    RUN_TEST(test_StatSnap_ResetPublishesZeros);
+    return UNITY_END();
+}
@@ -0,0 +1,139 @@
+/*
+ * tests/test_sd_stream.c
+ *
+ * sd_read_file_stream through sd_mount on the card emulator: a file larger
+ * than any buffer here arrives in order in SD_FWLOAD_CHUNK pieces with the
+ * right bytes, each piece is one multi-block read, the callback can stop
+ * the stream, a handle still cached by sd_append_file is written back first,
+ * and a missing file is reported.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_fwload.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_stream.img"
+#define CARD_BLOCKS 16384U
+#define FILE_BYTES  (5U * SD_FWLOAD_CHUNK + 300U)
+
+static char s_path[4];
+static uint8_t s_data[SD_FWLOAD_CHUNK];
+
+typedef struct {
+    uint32_t next;   // Offset the next piece should start at
+    uint32_t pieces;
+    uint32_t stop_after;
+    bool bad;
+} stream_check;
+
+static uint8_t pattern_at(uint32_t offset) {
+    return (uint8_t)(offset * 7U + (offset >> 9));
+}
+
+static bool check_piece(const uint8_t *data, uint32_t len, uint32_t offset, void *context) {
+    stream_check *c = (stream_check *)context;
+    if (offset != c->next || len == 0U || len > SD_FWLOAD_CHUNK) {
+        c->bad = true;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] != pattern_at(offset + i)) {
+            c->bad = true;
+            break;
+        }
+    }
+    c->next = offset + len;
+    c->pieces++;
+    return c->stop_after == 0U || c->pieces < c->stop_after;
+}
+
+static char s_text[16];
+static uint32_t s_text_len;
+
+static bool collect_text(const uint8_t *data, uint32_t len, uint32_t offset, void *context) {
+    (void)context;
+    if (offset + len <= sizeof(s_text)) {
+        memcpy(&s_text[offset], data, len);
+        s_text_len = offset + len;
+    }
+    return true;
+}
+
+static void write_pattern(const char *path, uint32_t bytes) {
+    FIL fil;
+    UINT bw;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS));
+    for (uint32_t off = 0; off < bytes; off += sizeof(s_data)) {
+        uint32_t n = (bytes - off < sizeof(s_data)) ? bytes - off : sizeof(s_data);
+        for (uint32_t i = 0; i < n; i++) {
+            s_data[i] = pattern_at(off + i);
+        }
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, s_data, n, &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    write_pattern("0:/big.bin", FILE_BYTES);
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Stream_WholeFileInOrder(void) {
+    stream_check c = {0};
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file_stream("0:/big.bin", check_piece, &c));
+    TEST_ASSERT_FALSE(c.bad);
+    TEST_ASSERT_EQUAL_UINT32(FILE_BYTES, c.next);
+    TEST_ASSERT_EQUAL_UINT32(6U, c.pieces);
+
+    /* Contiguous file: one CMD18 per whole piece; the 300-byte tail is one sector. */
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(5U, cs.cmd[18]);
+}
+
+void test_Stream_CallbackStops(void) {
+    stream_check c = {0};
+    c.stop_after = 2U;
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_read_file_stream("0:/big.bin", check_piece, &c));
+    TEST_ASSERT_FALSE(c.bad);
+    TEST_ASSERT_EQUAL_UINT32(2U, c.pieces);
+}
+
+void test_Stream_CachedAppendIsWrittenFirst(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/log.txt", "abc"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_append_file("0:/log.txt", "def"));
+    s_text_len = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file_stream("0:/log.txt", collect_text, NULL));
+    TEST_ASSERT_EQUAL_UINT32(6U, s_text_len);
+    TEST_ASSERT_EQUAL_MEMORY("abcdef", s_text, 6U);
+}
+
+void test_Stream_Errors(void) {
+    stream_check c = {0};
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_read_file_stream("0:/none.bin", check_piece, &c));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_read_file_stream("0:/big.bin", NULL, &c));
+    TEST_ASSERT_EQUAL_UINT32(0U, c.pieces);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Stream_WholeFileInOrder);
+    RUN_TEST(test_Stream_CallbackStops);
+    RUN_TEST(test_Stream_CachedAppendIsWrittenFirst);
+    RUN_TEST(test_Stream_Errors);
+    return UNITY_END();
+}
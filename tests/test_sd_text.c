@@ -0,0 +1,144 @@
+/*
+ * tests/test_sd_text.c
+ *
+ * Buffered text output (SD_TEXT_BUFFER=1024, _USE_STRFUNC 2) over the card
+ * emulator: the file matches what f_printf writes, in fewer and wider card
+ * writes; an append that starts mid-sector realigns after the first f_write;
+ * sd_text_puts takes text of any length and a line too long for
+ * sd_text_printf queues nothing.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_text.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_text.img"
+#define CARD_BLOCKS 16384U
+#define LINES       800U
+
+static FATFS s_fs;
+static FIL s_fil;
+static char s_path[4];
+static SD_TextFile s_text;
+static char s_a[32768];
+static char s_b[32768];
+
+static uint32_t card_write_cmds(void) {
+    mock_card_stats_t card;
+    mock_card_get_stats(&card);
+    return card.cmd[24] + card.cmd[25];
+}
+
+static uint32_t read_all(const char *path, char *buf, uint32_t cap) {
+    UINT br = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, buf, cap, &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    return br;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 4096U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Text_MatchesPrintfWithFewerWrites(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/a.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    mock_card_reset_stats();
+    for (uint32_t i = 0; i < LINES; i++) {
+        TEST_ASSERT_TRUE(f_printf(&s_fil, "%lu,temp=%d.%02d,ok\n", (unsigned long)i,
+                                  (int)(20 + i % 7U), (int)(i % 100U)) > 0);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    uint32_t plain = card_write_cmds();
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/b.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    sd_text_begin(&s_text, &s_fil);
+    mock_card_reset_stats();
+    for (uint32_t i = 0; i < LINES; i++) {
+        TEST_ASSERT_TRUE(sd_text_printf(&s_text, "%lu,temp=%d.%02d,ok\n", (unsigned long)i,
+                                        (int)(20 + i % 7U), (int)(i % 100U)) > 0);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, sd_text_flush(&s_text));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    uint32_t buffered = card_write_cmds();
+
+    uint32_t na = read_all("0:/a.txt", s_a, sizeof(s_a));
+    uint32_t nb = read_all("0:/b.txt", s_b, sizeof(s_b));
+    TEST_ASSERT_EQUAL_UINT32(na, nb);
+    TEST_ASSERT_EQUAL_MEMORY(s_a, s_b, na);
+    TEST_ASSERT_EQUAL_MEMORY("0,temp=20.00,ok\r\n1,", s_b, 19);
+
+    SD_TextStats st;
+    sd_text_get_stats(&s_text, &st);
+    TEST_ASSERT_EQUAL_UINT32(LINES, st.newlines);
+    TEST_ASSERT_EQUAL_UINT32(nb, st.bytes);
+    TEST_ASSERT_EQUAL_UINT32(st.writes - 1U, st.aligned); /* all but the final flush */
+    /* One command per two data sectors instead of one per sector; metadata is the same. */
+    TEST_ASSERT_TRUE(buffered * 3U <= plain * 2U);
+}
+
+void test_Text_AppendRealignsAfterFirstWrite(void) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/c.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_TRUE(f_puts("header line\n", &s_fil) > 0);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/c.txt", FA_WRITE | FA_OPEN_APPEND));
+    sd_text_begin(&s_text, &s_fil);
+    for (uint32_t i = 0; i < 400U; i++) {
+        TEST_ASSERT_TRUE(sd_text_printf(&s_text, "row %03lu\n", (unsigned long)i) > 0);
+    }
+    SD_TextStats st;
+    sd_text_get_stats(&s_text, &st);
+    TEST_ASSERT_TRUE(st.writes >= 2U);
+    TEST_ASSERT_EQUAL_UINT32(st.writes - 1U, st.aligned); /* the first ends on a boundary */
+    TEST_ASSERT_EQUAL_UINT32(0U, (uint32_t)f_tell(&s_fil) % 512U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_text_flush(&s_text));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    uint32_t n = read_all("0:/c.txt", s_a, sizeof(s_a));
+    TEST_ASSERT_EQUAL_UINT32(13U + 400U * 9U, n);
+    TEST_ASSERT_EQUAL_MEMORY("header line\r\nrow 000\r\n", s_a, 22);
+    TEST_ASSERT_EQUAL_MEMORY("row 399\r\n", s_a + n - 9U, 9);
+}
+
+void test_Text_PutsAnyLengthAndLongPrintfRefused(void) {
+    static char big[3000];
+    for (uint32_t i = 0; i < sizeof(big) - 1U; i++) {
+        big[i] = (i % 100U == 99U) ? '\n' : (char)('a' + i % 26U);
+    }
+    big[sizeof(big) - 1U] = '\0';
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/d.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    sd_text_begin(&s_text, &s_fil);
+    TEST_ASSERT_EQUAL_INT(2999 + 29, sd_text_puts(&s_text, big));
+    TEST_ASSERT_EQUAL_INT(-1, sd_text_printf(&s_text, "%s", big));
+    TEST_ASSERT_EQUAL_INT(5, sd_text_puts(&s_text, "end\n"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_text_flush(&s_text));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    uint32_t n = read_all("0:/d.txt", s_a, sizeof(s_a));
+    TEST_ASSERT_EQUAL_UINT32(2999U + 29U + 5U, n);
+    TEST_ASSERT_EQUAL_MEMORY("qrstu\r\n", s_a + 94, 7);
+    TEST_ASSERT_EQUAL_MEMORY("end\r\n", s_a + n - 5U, 5);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Text_MatchesPrintfWithFewerWrites);
+    RUN_TEST(test_Text_AppendRealignsAfterFirstWrite);
+    RUN_TEST(test_Text_PutsAnyLengthAndLongPrintfRefused);
+    return UNITY_END();
+}
@@ -0,0 +1,334 @@
+/*
+ * tests/test_sd_tier.c
+ *
+ * Flash write tier (sd_tier.h) over a RAM NOR model and the card emulator:
+ * writes that stay off the card until drained, reads of the newest copy,
+ * supersede on rewrite, recovery of pending records after a reset, a torn
+ * record, a full ring that drains inline, erase-ahead, and FatFs on
+ * SD_TierDriver with the volume intact on the card after a flush.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_tier.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_tier.img"
+#define CARD_BLOCKS 131072U /* 64 MiB */
+#define ERASE       4096U
+#define PER_UNIT    (ERASE / SD_TIER_RECORD_SIZE)
+#define UNITS       8U
+
+/* NOR model: programming clears bits, erasing sets a unit to 0xFF. */
+static uint8_t s_nor[UNITS * ERASE];
+static uint32_t s_nor_programs;
+static uint32_t s_nor_erases;
+
+static bool nor_read(uint32_t addr, void *buf, uint32_t len, void *context) {
+    (void)context;
+    if (addr + len > sizeof(s_nor)) {
+        return false;
+    }
+    memcpy(buf, &s_nor[addr], len);
+    return true;
+}
+
+static bool nor_program(uint32_t addr, const void *buf, uint32_t len, void *context) {
+    const uint8_t *src = (const uint8_t *)buf;
+    (void)context;
+    if (addr + len > sizeof(s_nor)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        s_nor[addr + i] &= src[i];
+    }
+    s_nor_programs++;
+    return true;
+}
+
+static bool nor_erase(uint32_t addr, void *context) {
+    (void)context;
+    if (addr % ERASE != 0U || addr >= sizeof(s_nor)) {
+        return false;
+    }
+    memset(&s_nor[addr], 0xFF, ERASE);
+    s_nor_erases++;
+    return true;
+}
+
+static FATFS s_fs;
+static char s_path[4];
+static uint8_t s_buf[4U * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static SD_TierFlash flash(uint32_t units) {
+    SD_TierFlash f = {nor_read, nor_program, nor_erase, NULL, units * ERASE, ERASE};
+    return f;
+}
+
+static void tier_init(uint32_t units) {
+    SD_TierFlash f = flash(units);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierInit(&g_sd_tier, &f, 0));
+}
+
+static SD_TierStats stats(void) {
+    SD_TierStats st;
+    SD_TierGetStats(&g_sd_tier, &st);
+    return st;
+}
+
+static uint32_t card_written(void) {
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    return st.sectors_written;
+}
+
+static void fill(uint8_t *dst, uint32_t sector, uint32_t version) {
+    for (uint32_t i = 0; i < 512U; i++) {
+        dst[i] = (uint8_t)(sector * 5U + version * 31U + i);
+    }
+}
+
+static void write_one(uint32_t sector, uint32_t version) {
+    fill(s_buf, sector, version);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierWrite(&g_sd_tier, s_buf, sector, 1));
+}
+
+static void expect_tier(uint32_t sector, uint32_t version) {
+    uint8_t want[512];
+    fill(want, sector, version);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierRead(&g_sd_tier, s_buf, sector, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(want, s_buf, 512);
+}
+
+static void expect_card(uint32_t sector, uint32_t version) {
+    uint8_t want[512];
+    fill(want, sector, version);
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, s_buf, sector, 1));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(want, s_buf, 512);
+}
+
+void setUp(void) {
+    memset(&s_fs, 0, sizeof(s_fs));
+    memset(s_nor, 0x00, sizeof(s_nor)); /* not erased: the tier must erase before use */
+    s_nor_programs = 0;
+    s_nor_erases = 0;
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, SD_Driver.disk_initialize(0));
+    tier_init(UNITS);
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_Tier_InitRejectsBadGeometry(void) {
+    SD_TierFlash f = flash(1U);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_TierInit(&g_sd_tier, &f, 0));
+    f = flash(UNITS);
+    f.erase_size = 256U;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_TierInit(&g_sd_tier, &f, 0));
+    f = flash(UNITS);
+    f.size += 512U;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_TierInit(&g_sd_tier, &f, 0));
+    f = flash(UNITS);
+    f.program = NULL;
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_TierInit(&g_sd_tier, &f, 0));
+}
+
+void test_Tier_WritesStayOffTheCard(void) {
+    uint32_t before = card_written();
+    for (uint32_t s = 0; s < 4U; s++) {
+        write_one(100U + s, 1U);
+    }
+    TEST_ASSERT_EQUAL_UINT32(before, card_written());
+    TEST_ASSERT_EQUAL_UINT32(4, SD_TierPending(&g_sd_tier));
+    TEST_ASSERT_EQUAL_UINT32(4, stats().writes);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().inline_erases);
+}
+
+void test_Tier_ReadOverlaysPendingSectors(void) {
+    uint8_t zero[512];
+    memset(zero, 0, sizeof(zero));
+    write_one(10U, 1U);
+    write_one(12U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierRead(&g_sd_tier, s_buf, 9U, 4U));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(zero, &s_buf[0], 512);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(zero, &s_buf[1024], 512);
+    expect_tier(10U, 1U);
+    expect_tier(12U, 1U);
+}
+
+void test_Tier_FlushCopiesToCardAndMarksDone(void) {
+    uint32_t before = card_written();
+    for (uint32_t s = 0; s < 5U; s++) {
+        write_one(200U + s, 2U);
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    TEST_ASSERT_EQUAL_UINT32(0, SD_TierPending(&g_sd_tier));
+    TEST_ASSERT_EQUAL_UINT32(5, stats().drained);
+    TEST_ASSERT_EQUAL_UINT32(before + 5U, card_written());
+    for (uint32_t s = 0; s < 5U; s++) {
+        expect_card(200U + s, 2U);
+        expect_tier(200U + s, 2U);
+    }
+
+    /* Nothing is pending after a reset either. */
+    tier_init(UNITS);
+    TEST_ASSERT_EQUAL_UINT32(0, stats().recovered);
+    TEST_ASSERT_EQUAL_UINT32(0, SD_TierPending(&g_sd_tier));
+}
+
+void test_Tier_RewriteSupersedesPendingRecord(void) {
+    write_one(3U, 1U);
+    write_one(3U, 2U);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().superseded);
+    expect_tier(3U, 2U);
+    uint32_t before = card_written();
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().drained);
+    TEST_ASSERT_EQUAL_UINT32(before + 1U, card_written());
+    expect_card(3U, 2U);
+}
+
+void test_Tier_ReinitRecoversPendingRecords(void) {
+    uint32_t drained = 0;
+    write_one(20U, 1U);
+    write_one(21U, 1U);
+    write_one(22U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierDrain(&g_sd_tier, 1U, &drained));
+    TEST_ASSERT_EQUAL_UINT32(1, drained);
+
+    tier_init(UNITS); /* a reset with two records still pending */
+    TEST_ASSERT_EQUAL_UINT32(2, stats().recovered);
+    TEST_ASSERT_EQUAL_UINT32(2, SD_TierPending(&g_sd_tier));
+    expect_tier(21U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    expect_card(20U, 1U);
+    expect_card(21U, 1U);
+    expect_card(22U, 1U);
+
+    /* New records after recovery keep going where the ring left off. */
+    write_one(23U, 1U);
+    tier_init(UNITS);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().recovered);
+    expect_tier(23U, 1U);
+}
+
+void test_Tier_ReinitKeepsNewestCopy(void) {
+    write_one(7U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    write_one(7U, 2U);
+    write_one(8U, 1U);
+    write_one(8U, 2U);
+
+    tier_init(UNITS);
+    TEST_ASSERT_EQUAL_UINT32(2, stats().recovered);
+    expect_tier(7U, 2U);
+    expect_tier(8U, 2U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    expect_card(7U, 2U);
+    expect_card(8U, 2U);
+}
+
+void test_Tier_TornRecordIsIgnored(void) {
+    write_one(5U, 1U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    write_one(5U, 2U); /* record 1: slot 1 of the first unit */
+    s_nor[SD_TIER_RECORD_SIZE + SD_TIER_HEADER_SIZE + 100U] ^= 0x10U;
+
+    tier_init(UNITS);
+    TEST_ASSERT_EQUAL_UINT32(0, stats().recovered);
+    TEST_ASSERT_EQUAL_UINT32(0, SD_TierPending(&g_sd_tier));
+    expect_tier(5U, 1U);
+}
+
+void test_Tier_FullRingDrainsInline(void) {
+    tier_init(2U); /* two erase units */
+    uint32_t n = 5U * PER_UNIT;
+    for (uint32_t s = 0; s < n; s++) {
+        write_one(300U + s, 3U);
+    }
+    TEST_ASSERT_TRUE(stats().full_stalls > 0U);
+    TEST_ASSERT_TRUE(SD_TierPending(&g_sd_tier) <= 2U * PER_UNIT);
+    TEST_ASSERT_TRUE(stats().max_pending <= 2U * PER_UNIT);
+    for (uint32_t s = 0; s < n; s++) {
+        expect_tier(300U + s, 3U);
+    }
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    TEST_ASSERT_EQUAL_UINT32(n, stats().drained);
+    for (uint32_t s = 0; s < n; s++) {
+        expect_card(300U + s, 3U);
+    }
+}
+
+void test_Tier_DrainErasesAhead(void) {
+    for (uint32_t s = 0; s < PER_UNIT; s++) {
+        write_one(400U + s, 1U);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, stats().inline_erases);
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    uint32_t erases = s_nor_erases;
+    TEST_ASSERT_TRUE(erases >= 2U);
+
+    for (uint32_t s = 0; s < PER_UNIT; s++) {
+        write_one(500U + s, 1U);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, stats().inline_erases);
+    TEST_ASSERT_EQUAL_UINT32(erases, s_nor_erases);
+}
+
+void test_Tier_FatFsVolumeLandsOnCardAfterFlush(void) {
+    static uint8_t work[_MAX_SS];
+    static const char text[] = "tiered through flash";
+    char got[sizeof(text)];
+    FIL fil;
+    UINT bw, br;
+
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_TierDriver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT32, 512, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "tier.txt", FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, text, sizeof(text), &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    TEST_ASSERT_TRUE(SD_TierPending(&g_sd_tier) > 0U);
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(NULL, s_path, 0));
+    TEST_ASSERT_EQUAL(SD_OK, SD_TierFlush(&g_sd_tier));
+    TEST_ASSERT_EQUAL(0, FATFS_UnLinkDriver(s_path));
+
+    /* The card alone now holds the volume. */
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "tier.txt", FA_READ));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&fil, got, sizeof(got), &br));
+    TEST_ASSERT_EQUAL(sizeof(text), br);
+    TEST_ASSERT_EQUAL_STRING(text, got);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Tier_InitRejectsBadGeometry);
+    RUN_TEST(test_Tier_WritesStayOffTheCard);
+    RUN_TEST(test_Tier_ReadOverlaysPendingSectors);
+    RUN_TEST(test_Tier_FlushCopiesToCardAndMarksDone);
+    RUN_TEST(test_Tier_RewriteSupersedesPendingRecord);
+    RUN_TEST(test_Tier_ReinitRecoversPendingRecords);
+    RUN_TEST(test_Tier_ReinitKeepsNewestCopy);
+    RUN_TEST(test_Tier_TornRecordIsIgnored);
+    RUN_TEST(test_Tier_FullRingDrainsInline);
+    RUN_TEST(test_Tier_DrainErasesAhead);
+    RUN_TEST(test_Tier_FatFsVolumeLandsOnCardAfterFlush);
+
+    return UNITY_END();
+}
@@ -0,0 +1,173 @@
+/*
+ * tests/test_sd_time.c
+ *
+ * Cached FAT timestamps: packing, the running clock's carries, that only the
+ * tick reads the source, and the stamps FatFs (_FS_NORTC 0) writes through a
+ * get_fattime that returns sd_time_fattime.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_time.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_time.img"
+#define CARD_BLOCKS 16384U
+
+static FATFS s_fs;
+static char s_path[4];
+
+static SD_DateTime s_rtc;
+static bool s_rtc_ok;
+static uint32_t s_rtc_reads;
+
+/* The CubeMX fatfs.c hook. */
+DWORD get_fattime(void) {
+    return sd_time_fattime();
+}
+
+static bool fake_rtc(SD_DateTime *now) {
+    s_rtc_reads++;
+    if (s_rtc_ok) {
+        *now = s_rtc;
+    }
+    return s_rtc_ok;
+}
+
+static SD_DateTime dt(uint16_t y, uint8_t mo, uint8_t d, uint8_t h, uint8_t mi, uint8_t s) {
+    SD_DateTime t = {y, mo, d, h, mi, s};
+    return t;
+}
+
+static void assert_now(SD_DateTime want) {
+    SD_DateTime got;
+    TEST_ASSERT_TRUE(sd_time_now(&got));
+    TEST_ASSERT_EQUAL_UINT32(sd_time_pack(&want), sd_time_pack(&got));
+    TEST_ASSERT_EQUAL_UINT8(want.second, got.second);
+}
+
+void setUp(void) {
+    mock_hal_reset();
+    s_rtc_ok = false;
+    s_rtc_reads = 0;
+    sd_time_set_source(NULL);
+}
+
+void tearDown(void) {
+}
+
+void test_Pack_MatchesFatLayout(void) {
+    SD_DateTime t = dt(2026, 10, 14, 13, 45, 31);
+    uint32_t v = sd_time_pack(&t);
+    TEST_ASSERT_EQUAL_UINT32(46U, v >> 25);
+    TEST_ASSERT_EQUAL_UINT32(10U, (v >> 21) & 0xFU);
+    TEST_ASSERT_EQUAL_UINT32(14U, (v >> 16) & 0x1FU);
+    TEST_ASSERT_EQUAL_UINT32(13U, (v >> 11) & 0x1FU);
+    TEST_ASSERT_EQUAL_UINT32(45U, (v >> 5) & 0x3FU);
+    TEST_ASSERT_EQUAL_UINT32(15U, v & 0x1FU);
+}
+
+void test_Set_RejectsOutOfRangeFields(void) {
+    SD_DateTime bad[] = {dt(1979, 1, 1, 0, 0, 0), dt(2025, 2, 29, 0, 0, 0),
+                         dt(2026, 13, 1, 0, 0, 0), dt(2026, 1, 1, 24, 0, 0)};
+    uint32_t before = sd_time_fattime();
+    for (unsigned i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        TEST_ASSERT_FALSE(sd_time_set(&bad[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT32(before, sd_time_fattime());
+}
+
+void test_Tick_AdvancesTimeSetOnce(void) {
+    SD_DateTime t = dt(2024, 2, 28, 23, 59, 59);
+    TEST_ASSERT_TRUE(sd_time_set(&t));
+    TEST_ASSERT_EQUAL_UINT32(sd_time_pack(&t), sd_time_fattime());
+
+    sd_time_tick(); /* takes the set time */
+    sd_time_tick();
+    assert_now(dt(2024, 2, 29, 0, 0, 0));
+
+    t = dt(2100, 2, 28, 23, 59, 59); /* not a leap year */
+    TEST_ASSERT_TRUE(sd_time_set(&t));
+    sd_time_tick();
+    sd_time_tick();
+    assert_now(dt(2100, 3, 1, 0, 0, 0));
+
+    t = dt(2026, 12, 31, 23, 59, 59);
+    TEST_ASSERT_TRUE(sd_time_set(&t));
+    sd_time_tick();
+    sd_time_tick();
+    assert_now(dt(2027, 1, 1, 0, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(SD_TIME_FAT(2027, 1, 1, 0, 0, 0), sd_time_fattime());
+}
+
+void test_Fattime_ReadsSourceOnlyOnTick(void) {
+    s_rtc = dt(2026, 6, 1, 8, 0, 0);
+    s_rtc_ok = true;
+    sd_time_set_source(fake_rtc);
+    TEST_ASSERT_EQUAL_UINT32(1U, s_rtc_reads);
+
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_UINT32(SD_TIME_FAT(2026, 6, 1, 8, 0, 0), get_fattime());
+    }
+    TEST_ASSERT_EQUAL_UINT32(1U, s_rtc_reads);
+
+    s_rtc.second = 2;
+    sd_time_tick();
+    TEST_ASSERT_EQUAL_UINT32(2U, s_rtc_reads);
+    TEST_ASSERT_EQUAL_UINT32(SD_TIME_FAT(2026, 6, 1, 8, 0, 2), get_fattime());
+}
+
+void test_Tick_KeepsRunningWhenSourceFails(void) {
+    s_rtc = dt(2026, 6, 1, 8, 0, 58);
+    s_rtc_ok = true;
+    sd_time_set_source(fake_rtc);
+    s_rtc_ok = false;
+    sd_time_tick();
+    sd_time_tick();
+    assert_now(dt(2026, 6, 1, 8, 1, 0));
+}
+
+void test_FatFs_StampsEntriesWithCachedTime(void) {
+    static uint8_t work[_MAX_SS];
+    FIL fil;
+    FILINFO fno;
+    UINT bw = 0;
+
+    TEST_ASSERT_TRUE(mock_card_create(IMAGE, CARD_BLOCKS));
+    mock_card_attach();
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT, 0, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+
+    SD_DateTime t = dt(2026, 10, 14, 9, 30, 20);
+    TEST_ASSERT_TRUE(sd_time_set(&t));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "stamp.txt", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, "x", 1, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("stamp.txt", &fno));
+    TEST_ASSERT_EQUAL_HEX32((46U << 9) | (10U << 5) | 14U, fno.fdate);
+    TEST_ASSERT_EQUAL_HEX32((9U << 11) | (30U << 5) | 10U, fno.ftime);
+
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Pack_MatchesFatLayout);
+    RUN_TEST(test_Set_RejectsOutOfRangeFields);
+    RUN_TEST(test_Tick_AdvancesTimeSetOnce);
+    RUN_TEST(test_Fattime_ReadsSourceOnlyOnTick);
+    RUN_TEST(test_Tick_KeepsRunningWhenSourceFails);
+    RUN_TEST(test_FatFs_StampsEntriesWithCachedTime);
+
+    return UNITY_END();
+}
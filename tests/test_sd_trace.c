@@ -0,0 +1,178 @@
+/*
+ * tests/test_sd_trace.c
+ *
+ * Tests for the driver trace ring (SD_TRACE_ENABLED=1, SD_TRACE_ENTRIES=16).
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include "sd_diskio_spi.h"
+#include "sd_trace.h"
+#include <string.h>
+
+void setUp(void) {
+    mock_hal_reset();
+    memset(&g_sd_handle, 0, sizeof(g_sd_handle));
+    SD_TraceReset();
+}
+
+void tearDown(void) {}
+
+/* -----------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------- */
+
+static void init_disk0(bool use_dma) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInitDrive(0, &g_test_hspi, &g_test_cs, 0, use_dma));
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0));
+    SD_TraceReset();
+}
+
+static void count_sink(const SD_TraceEvent *event, void *context) {
+    (void)event;
+    (*(int *)context)++;
+}
+
+/* -----------------------------------------------------------------------
+ * Ring
+ * ----------------------------------------------------------------------- */
+
+void test_Trace_RecordThenRead_ReturnsEventInOrder(void) {
+    mock_dwt.CYCCNT = 100U;
+    uint32_t start = SD_TraceNow();
+    mock_dwt.CYCCNT = 250U;
+    SD_TraceRecord(SD_TRACE_CMD, 1U, 17U, 0x1234U, SD_OK, 0x00U, start);
+    SD_TraceRecord(SD_TRACE_CMD, 1U, 12U, 0U, SD_OK, 0x00U, SD_TraceNow());
+
+    SD_TraceEvent ev[4];
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_TraceRead(ev, 4));
+    TEST_ASSERT_EQUAL_UINT32(0U, ev[0].seq);
+    TEST_ASSERT_EQUAL_UINT8(17U, ev[0].code);
+    TEST_ASSERT_EQUAL_UINT32(0x1234U, ev[0].arg);
+    TEST_ASSERT_EQUAL_UINT32(100U, ev[0].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(150U, ev[0].duration);
+    TEST_ASSERT_EQUAL_UINT8(1U, ev[0].instance);
+    TEST_ASSERT_EQUAL_UINT32(1U, ev[1].seq);
+    TEST_ASSERT_EQUAL_UINT8(12U, ev[1].code);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_TraceRead(ev, 4));
+}
+
+void test_Trace_Overrun_KeepsNewestAndCountsDropped(void) {
+    for (uint32_t i = 0; i < SD_TRACE_ENTRIES + 5U; i++) {
+        SD_TraceRecord(SD_TRACE_CMD, 0U, 0U, i, SD_OK, 0U, 0U);
+    }
+
+    SD_TraceEvent ev[SD_TRACE_ENTRIES];
+    TEST_ASSERT_EQUAL_UINT32(SD_TRACE_ENTRIES, SD_TraceRead(ev, SD_TRACE_ENTRIES));
+    TEST_ASSERT_EQUAL_UINT32(5U, ev[0].seq);
+    TEST_ASSERT_EQUAL_UINT32(5U, ev[0].arg);
+    TEST_ASSERT_EQUAL_UINT32(SD_TRACE_ENTRIES + 4U, ev[SD_TRACE_ENTRIES - 1U].arg);
+    TEST_ASSERT_EQUAL_UINT32(5U, SD_TraceDropped());
+}
+
+void test_Trace_PartialReadThenDrain_DeliversRest(void) {
+    SD_TraceRecord(SD_TRACE_CMD, 0U, 0U, 1U, SD_OK, 0U, 0U);
+    SD_TraceRecord(SD_TRACE_CMD, 0U, 0U, 2U, SD_OK, 0U, 0U);
+
+    SD_TraceEvent ev[4];
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_TraceRead(ev, 1));
+    int seen = 0;
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_TraceDrain(count_sink, &seen));
+    TEST_ASSERT_EQUAL(1, seen);
+}
+
+void test_Trace_Latest_CopiesNewestWithoutConsuming(void) {
+    for (uint32_t i = 0; i < SD_TRACE_ENTRIES + 4U; i++) {
+        SD_TraceRecord(SD_TRACE_CMD, 0U, 0U, i, SD_OK, 0U, 0U);
+    }
+
+    SD_TraceEvent ev[SD_TRACE_ENTRIES + 4U];
+    TEST_ASSERT_EQUAL_UINT32(3U, SD_TraceLatest(ev, 3U));
+    TEST_ASSERT_EQUAL_UINT32(SD_TRACE_ENTRIES + 1U, ev[0].seq);
+    TEST_ASSERT_EQUAL_UINT32(SD_TRACE_ENTRIES + 3U, ev[2].arg);
+    TEST_ASSERT_EQUAL_UINT32(SD_TRACE_ENTRIES, SD_TraceLatest(ev, SD_TRACE_ENTRIES + 4U));
+    TEST_ASSERT_EQUAL_UINT32(4U, ev[0].arg);
+
+    TEST_ASSERT_EQUAL_UINT32(SD_TRACE_ENTRIES, SD_TraceRead(ev, SD_TRACE_ENTRIES + 4U));
+    TEST_ASSERT_EQUAL_UINT32(4U, ev[0].seq);
+    TEST_ASSERT_EQUAL_UINT32(0U, SD_TraceLatest(NULL, 4U));
+}
+
+/* -----------------------------------------------------------------------
+ * Driver hooks
+ * ----------------------------------------------------------------------- */
+
+void test_Trace_SendCommand_RecordsCmdArgAndR1(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&g_sd_handle, &g_test_hspi, &g_test_cs, 0, false));
+    push_sdhc_init(8192U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&g_sd_handle));
+
+    SD_TraceEvent ev[SD_TRACE_ENTRIES];
+    uint32_t n = SD_TraceRead(ev, SD_TRACE_ENTRIES);
+    TEST_ASSERT_TRUE(n >= 5U);
+    TEST_ASSERT_EQUAL_UINT8(SD_TRACE_CMD, ev[0].type);
+    TEST_ASSERT_EQUAL_UINT8(0U, ev[0].code);       /* CMD0 */
+    TEST_ASSERT_EQUAL_UINT8(0x01U, ev[0].resp);    /* idle */
+    TEST_ASSERT_EQUAL_UINT8(8U, ev[1].code);       /* CMD8 */
+    TEST_ASSERT_EQUAL_UINT32(0x1AAU, ev[1].arg);
+}
+
+void test_Trace_DiskRead_RecordsCommandThenEntryPoint(void) {
+    init_disk0(false);
+    push_single_read(0x11U);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(RES_OK, SD_disk_read(0, buf, 7, 1));
+    SD_TraceEvent ev[4];
+    TEST_ASSERT_EQUAL_UINT32(2U, SD_TraceRead(ev, 4));
+    TEST_ASSERT_EQUAL_UINT8(SD_TRACE_CMD, ev[0].type);
+    TEST_ASSERT_EQUAL_UINT8(17U, ev[0].code);
+    TEST_ASSERT_EQUAL_UINT32(7U, ev[0].arg);
+    TEST_ASSERT_EQUAL_UINT8(SD_TRACE_DISK_READ, ev[1].type);
+    TEST_ASSERT_EQUAL_UINT32(7U, ev[1].arg);
+    TEST_ASSERT_EQUAL_UINT8(1U, ev[1].resp);
+    TEST_ASSERT_EQUAL_UINT8(RES_OK, ev[1].status);
+}
+
+void test_Trace_DmaRead_RecordsCompletion(void) {
+    init_disk0(true);
+    mock_hal_set_dma_enabled(true);
+    mock_hal_set_cycles_per_byte(2U);
+    push_single_read(0x22U);
+
+    static uint8_t buf[512] __attribute__((aligned(32)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&g_sd_handle, buf, 0, 1));
+    SD_TraceEvent ev[8];
+    uint32_t n = SD_TraceRead(ev, 8);
+    bool found = false;
+    for (uint32_t i = 0; i < n; i++) {
+        if (ev[i].type == SD_TRACE_DMA) {
+            TEST_ASSERT_BITS(SD_TRACE_DMA_RX, SD_TRACE_DMA_RX, ev[i].code);
+            TEST_ASSERT_EQUAL_UINT32(512U * 2U, ev[i].duration);
+            found = true;
+        }
+    }
+    TEST_ASSERT_TRUE(found);
+}
+
+/* -----------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------- */
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Trace_RecordThenRead_ReturnsEventInOrder);
+    RUN_TEST(test_Trace_Overrun_KeepsNewestAndCountsDropped);
+    RUN_TEST(test_Trace_PartialReadThenDrain_DeliversRest);
+    RUN_TEST(test_Trace_Latest_CopiesNewestWithoutConsuming);
+
+    RUN_TEST(test_Trace_SendCommand_RecordsCmdArgAndR1);
+    RUN_TEST(test_Trace_DiskRead_RecordsCommandThenEntryPoint);
+    RUN_TEST(test_Trace_DmaRead_RecordsCompletion);
+
+    return UNITY_END();
+}
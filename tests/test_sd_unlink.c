@@ -0,0 +1,195 @@
+/*
+ * tests/test_sd_unlink.c
+ *
+ * sd_delete_file of large files through sd_mount on the card emulator
+ * (_USE_TRIM 1): the chain is released in batch mode, with fewer card
+ * writes than a plain f_unlink of the same layout, every freed run is
+ * erased with one CMD38, and the free count comes back. The incremental
+ * delete (SD_DELETE_STEP_CLUSTERS=100) frees a step at a time, leaves a
+ * valid shorter file between steps that other file operations can run in,
+ * and falls back to plain seeks for a chain too fragmented to map.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_unlink.img"
+#define CARD_BLOCKS 16384U
+#define CLUSTER     1024U
+#define RUN         16U /* clusters per piece when interleaved */
+#define PIECES      40U /* 640 clusters per file, five FAT sectors interleaved */
+
+static char s_path[4];
+static uint8_t s_data[RUN * CLUSTER];
+
+static uint32_t free_clusters(void) {
+    DWORD fre;
+    FATFS *pfs;
+    TEST_ASSERT_EQUAL(FR_OK, f_getfree(s_path, &fre, &pfs));
+    return (uint32_t)fre;
+}
+
+/* Two files written a piece at a time each, so their runs alternate. */
+static void write_interleaved(const char *a, const char *b) {
+    FIL fa, fb;
+    UINT bw;
+    memset(s_data, 0x6B, sizeof(s_data));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fa, a, FA_WRITE | FA_CREATE_ALWAYS));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fb, b, FA_WRITE | FA_CREATE_ALWAYS));
+    for (uint32_t i = 0; i < PIECES; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fa, s_data, sizeof(s_data), &bw));
+        TEST_ASSERT_EQUAL(FR_OK, f_sync(&fa));
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fb, s_data, sizeof(s_data), &bw));
+        TEST_ASSERT_EQUAL(FR_OK, f_sync(&fb));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fa));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fb));
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, CLUSTER);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Unlink_FragmentedNoMoreWritesThanPlain(void) {
+    write_interleaved("0:/a.bin", "0:/b.bin");
+    mock_card_stats_t plain, batched;
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, f_unlink("0:/b.bin"));
+    plain = card_stats();
+
+    uint32_t before = free_clusters();
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/a.bin"));
+    batched = card_stats();
+    TEST_ASSERT_TRUE(batched.sectors_written <= plain.sectors_written);
+    /* The five FAT sectors the chain spans and the root directory sector, each once. */
+    TEST_ASSERT_EQUAL_UINT32(6U, batched.sectors_written);
+    TEST_ASSERT_EQUAL_UINT32(0U, batched.errors);
+
+    /* One erase per freed run. */
+    TEST_ASSERT_EQUAL_UINT32(PIECES, batched.cmd[38]);
+    TEST_ASSERT_EQUAL_UINT32(PIECES * RUN * (CLUSTER / 512U), batched.sectors_erased);
+    TEST_ASSERT_EQUAL_UINT32(before + PIECES * RUN, free_clusters());
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_stat("0:/a.bin", NULL));
+}
+
+void test_Unlink_ContiguousIsOneErase(void) {
+    FIL fil;
+    UINT bw;
+    memset(s_data, 0x3D, sizeof(s_data));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, "0:/c.bin", FA_WRITE | FA_CREATE_ALWAYS));
+    for (uint32_t i = 0; i < PIECES; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, s_data, sizeof(s_data), &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_file("0:/c.bin"));
+    mock_card_stats_t cs = card_stats();
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.cmd[38]);
+    TEST_ASSERT_EQUAL_UINT32(PIECES * RUN * (CLUSTER / 512U), cs.sectors_erased);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_delete_file("0:/c.bin"));
+}
+
+static void write_contiguous(const char *name) {
+    FIL fil;
+    UINT bw;
+    memset(s_data, 0x3D, sizeof(s_data));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&fil, name, FA_WRITE | FA_CREATE_ALWAYS));
+    for (uint32_t i = 0; i < PIECES; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_write(&fil, s_data, sizeof(s_data), &bw));
+    }
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&fil));
+}
+
+/* Steps until done; returns the number of steps that left work behind. */
+static uint32_t delete_in_steps(const char *name) {
+    uint32_t steps = 0;
+    int res;
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_begin(name));
+    while ((res = sd_delete_step()) == FR_NOT_READY) {
+        steps++;
+        TEST_ASSERT_TRUE(steps <= PIECES * RUN);
+    }
+    TEST_ASSERT_EQUAL(FR_OK, res);
+    return steps;
+}
+
+void test_Unlink_Steps_FreeAStepAtATime(void) {
+    FILINFO fno;
+    write_contiguous("0:/c.bin");
+    uint32_t before = free_clusters();
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_begin("0:/c.bin"));
+    TEST_ASSERT_EQUAL(FR_LOCKED, sd_delete_begin("0:/c.bin"));
+    TEST_ASSERT_EQUAL(FR_NOT_READY, sd_delete_step());
+
+    /* Between steps the file is valid, shorter, and the volume is free to use. */
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/c.bin", &fno));
+    TEST_ASSERT_EQUAL_UINT32((PIECES * RUN - 100U) * CLUSTER, (uint32_t)fno.fsize);
+    TEST_ASSERT_EQUAL_UINT32(before + 100U, free_clusters());
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/other.txt", "between steps"));
+
+    uint32_t steps = 1;
+    int res;
+    while ((res = sd_delete_step()) == FR_NOT_READY) {
+        steps++;
+    }
+    TEST_ASSERT_EQUAL(FR_OK, res);
+    TEST_ASSERT_EQUAL_UINT32((PIECES * RUN + 99U) / 100U, steps);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("0:/c.bin", &fno));
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/other.txt", &fno));
+    TEST_ASSERT_EQUAL(FR_INVALID_OBJECT, sd_delete_step());
+}
+
+void test_Unlink_Steps_FragmentedChain(void) {
+    write_interleaved("0:/a.bin", "0:/b.bin");
+    uint32_t before = free_clusters();
+    TEST_ASSERT_EQUAL_UINT32((PIECES * RUN + 99U) / 100U, delete_in_steps("0:/a.bin"));
+    TEST_ASSERT_EQUAL_UINT32(before + PIECES * RUN, free_clusters());
+
+    /* The other file's interleaved runs are untouched. */
+    FILINFO fno;
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/b.bin", &fno));
+    TEST_ASSERT_EQUAL_UINT32(PIECES * sizeof(s_data), (uint32_t)fno.fsize);
+    TEST_ASSERT_EQUAL(FR_NO_FILE, sd_delete_begin("0:/a.bin"));
+}
+
+void test_Unlink_Steps_CancelLeavesShorterFile(void) {
+    FILINFO fno;
+    write_contiguous("0:/c.bin");
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_begin("0:/c.bin"));
+    TEST_ASSERT_EQUAL(FR_NOT_READY, sd_delete_step());
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_cancel());
+    TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/c.bin", &fno));
+    TEST_ASSERT_EQUAL_UINT32((PIECES * RUN - 100U) * CLUSTER, (uint32_t)fno.fsize);
+    TEST_ASSERT_EQUAL(FR_OK, sd_delete_cancel());
+
+    /* A new delete picks up where the file now ends. */
+    TEST_ASSERT_EQUAL_UINT32((PIECES * RUN - 100U + 99U) / 100U, delete_in_steps("0:/c.bin"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Unlink_FragmentedNoMoreWritesThanPlain);
+    RUN_TEST(test_Unlink_ContiguousIsOneErase);
+    RUN_TEST(test_Unlink_Steps_FreeAStepAtATime);
+    RUN_TEST(test_Unlink_Steps_FragmentedChain);
+    RUN_TEST(test_Unlink_Steps_CancelLeavesShorterFile);
+    return UNITY_END();
+}
@@ -0,0 +1,198 @@
+/*
+ * tests/test_sd_usbmsc.c
+ *
+ * USB mass-storage bridge over the card emulator, calling the MSC storage
+ * callbacks as the class would: no medium until attach, FatFs locked out
+ * while the host owns the card, a packet is one multi-block command, a
+ * file the host rewrote reads back through FatFs after detach, and with the
+ * metadata journal (SD_CACHE_JOURNAL=1) the remount does not replay a record
+ * over the host's FAT and directory writes.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_functions.h"
+#include "sd_usbmsc.h"
+#include "sd_cache.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_usbmsc.img"
+#define CARD_BLOCKS 16384U
+#define JOURNAL     1U /* MBR gap of the partitioned volume the journal test formats */
+
+static char s_path[4];
+static FIL s_fil;
+static uint8_t s_packet[16 * 512];
+
+/* First card block of a file's data. */
+static uint32_t data_block(const char *path) {
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, path, FA_READ));
+    FATFS *fs = s_fil.obj.fs;
+    uint32_t block = fs->database + (s_fil.obj.sclust - 2U) * fs->csize;
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    return block;
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+}
+
+void tearDown(void) {
+    (void)sd_usbmsc_detach();
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_UsbMsc_NoMediumUntilAttached(void) {
+    uint32_t blocks;
+    uint16_t size;
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_init(0U));
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_get_max_lun());
+    TEST_ASSERT_EQUAL_INT(-1, sd_usbmsc_is_ready(0U));
+    TEST_ASSERT_EQUAL_INT(-1, sd_usbmsc_read(0U, s_packet, 0U, 1U));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_attach());
+    TEST_ASSERT_TRUE(sd_usbmsc_attached());
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_is_ready(0U));
+    TEST_ASSERT_EQUAL_INT(-1, sd_usbmsc_is_ready(1U));
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_get_capacity(0U, &blocks, &size));
+    TEST_ASSERT_EQUAL_UINT32(CARD_BLOCKS, blocks);
+    TEST_ASSERT_EQUAL_UINT16(512U, size);
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_is_write_protected(0U));
+    TEST_ASSERT_EQUAL_HEX8(0x80, (uint8_t)sd_usbmsc_inquiry[1]); /* removable */
+
+    /* The volume is the host's now: FatFs cannot mount it behind its back. */
+    TEST_ASSERT_NOT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(RES_NOTRDY, SD_Driver.disk_read(0, s_packet, 0U, 1U));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_detach());
+    TEST_ASSERT_FALSE(sd_usbmsc_attached());
+    TEST_ASSERT_EQUAL_INT(-1, sd_usbmsc_is_ready(0U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/after.txt", "ok"));
+}
+
+void test_UsbMsc_PacketIsOneCommand(void) {
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_attach());
+    for (uint32_t i = 0; i < sizeof(s_packet); i++) {
+        s_packet[i] = (uint8_t)(i * 7U);
+    }
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_write(0U, s_packet, 8000U, 16U));
+    memset(s_packet, 0, sizeof(s_packet));
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_read(0U, s_packet, 8000U, 16U));
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.cmd[25]);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.cmd[18]);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.cmd[17]);
+    for (uint32_t i = 0; i < sizeof(s_packet); i++) {
+        TEST_ASSERT_EQUAL_UINT8((uint8_t)(i * 7U), s_packet[i]);
+    }
+    SD_UsbMscStats st;
+    sd_usbmsc_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(16U, st.read_blocks);
+    TEST_ASSERT_EQUAL_UINT32(16U, st.write_blocks);
+    TEST_ASSERT_EQUAL_UINT32(0U, st.errors);
+}
+
+void test_UsbMsc_HostChangesSeenAfterDetach(void) {
+    char text[16] = {0};
+    UINT n = 0;
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/log.txt", "hello, card"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    uint32_t block = data_block("0:/log.txt");
+    /* Pull the sector into the driver's RAM copies first. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file("0:/log.txt", text, sizeof(text), &n));
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_attach());
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_read(0U, s_packet, block, 1U));
+    TEST_ASSERT_EQUAL_MEMORY("hello, card", s_packet, 11);
+    memcpy(s_packet, "HELLO, HOST", 11);
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_write(0U, s_packet, block, 1U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_detach());
+
+    memset(text, 0, sizeof(text));
+    TEST_ASSERT_EQUAL(FR_OK, sd_read_file("0:/log.txt", text, sizeof(text), &n));
+    TEST_ASSERT_EQUAL_STRING("HELLO, HOST", text);
+}
+
+/* Clear the empty record the last write-back ended with, as if power had gone first. */
+static void lose_retire(SD_Handle_t *h) {
+    static const uint8_t zero[SD_BLOCK_SIZE];
+    for (uint32_t slot = 0; slot < 2U; slot++) {
+        uint32_t base = JOURNAL + (slot * SD_CACHE_JOURNAL_SLOT);
+        TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(h, s_packet, base, 1));
+        if (memcmp(s_packet, "SDJL", 4) == 0 && s_packet[8] == 0U) {
+            TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(h, zero, base, 1));
+            return;
+        }
+    }
+    TEST_FAIL_MESSAGE("no retiring record");
+}
+
+void test_UsbMsc_HostFatWritesNotReplayedOver(void) {
+    static uint8_t work[_MAX_SS];
+    static uint8_t fat[SD_BLOCK_SIZE];
+    static uint8_t dir[SD_BLOCK_SIZE];
+    SD_Handle_t *h = SD_DiskHandle(0);
+    FILINFO fno;
+
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT, 1024U, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalAttach(h, JOURNAL));
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/log.txt", "journaled"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "0:/log.txt", FA_READ));
+    uint32_t fat_sector = s_fil.obj.fs->fatbase;
+    uint32_t dir_sector = s_fil.obj.fs->dirbase;
+    uint32_t sclust = s_fil.obj.sclust;
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    /* The FAT and directory record of that write stays live on the card. */
+    lose_retire(h);
+
+    /* The host deletes the file: directory entry and FAT chain. */
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_attach());
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_read(0U, dir, dir_sector, 1U));
+    TEST_ASSERT_EQUAL_MEMORY("LOG     TXT", dir, 11);
+    dir[0] = 0xE5U;
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_read(0U, fat, fat_sector, 1U));
+    fat[(sclust * 2U) % SD_BLOCK_SIZE] = 0U;
+    fat[((sclust * 2U) % SD_BLOCK_SIZE) + 1U] = 0U;
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_write(0U, dir, dir_sector, 1U));
+    TEST_ASSERT_EQUAL_INT(0, sd_usbmsc_write(0U, fat, fat_sector, 1U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_detach());
+    TEST_ASSERT_EQUAL(0, SD_disk_initialize(0)); /* as at the next power-up: replays */
+
+    TEST_ASSERT_EQUAL(FR_NO_FILE, f_stat("0:/log.txt", &fno));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(h, s_packet, fat_sector, 1));
+    TEST_ASSERT_EQUAL_MEMORY(fat, s_packet, SD_BLOCK_SIZE);
+    TEST_ASSERT_EQUAL(SD_OK, SD_CacheJournalAttach(h, 0U));
+}
+
+void test_UsbMsc_ReadOnlyDrive(void) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetReadOnly(0, true));
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_attach());
+    TEST_ASSERT_EQUAL_INT(1, sd_usbmsc_is_write_protected(0U));
+    TEST_ASSERT_EQUAL_INT(-1, sd_usbmsc_write(0U, s_packet, 8000U, 1U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_usbmsc_detach());
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskSetReadOnly(0, false));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_UsbMsc_NoMediumUntilAttached);
+    RUN_TEST(test_UsbMsc_PacketIsOneCommand);
+    RUN_TEST(test_UsbMsc_HostChangesSeenAfterDetach);
+    RUN_TEST(test_UsbMsc_HostFatWritesNotReplayedOver);
+    RUN_TEST(test_UsbMsc_ReadOnlyDrive);
+    return UNITY_END();
+}
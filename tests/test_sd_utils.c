@@ -62,6 +62,61 @@ void test_Sync_CardBusy_Timeout(void) {
     TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_Sync(&sd));
 }
 
+/* -----------------------------------------------------------------------
+ * SD_EraseBlocks
+ * ----------------------------------------------------------------------- */
+
+void test_Erase_NullHandle_ReturnsParam(void) {
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_EraseBlocks(NULL, 0, 1));
+}
+
+void test_Erase_CountZero_ReturnsParam(void) {
+    do_sdhc_init(&sd, 8192U);
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_EraseBlocks(&sd, 0, 0));
+}
+
+void test_Erase_NotInitialized_ReturnsError(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_EraseBlocks(&sd, 0, 1));
+}
+
+void test_Erase_SDSC_UsesByteAddresses(void) {
+    do_sdsc_init(&sd);
+    mock_hal_reset();
+    push_cmd_exchange(0x00U); /* CMD32 */
+    push_cmd_exchange(0x00U); /* CMD33 */
+    push_cmd_exchange(0x00U); /* CMD38 */
+    push_wait_ready();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_EraseBlocks(&sd, 2U, 3U));
+
+    size_t len = 0;
+    const uint8_t *tx = mock_hal_tx_log(&len);
+    const uint8_t cmd32[7] = {0xFF, 0x60, 0x00, 0x00, 0x04, 0x00, 0xFF}; /* 2 * 512 */
+    const uint8_t cmd33[7] = {0xFF, 0x61, 0x00, 0x00, 0x08, 0x00, 0xFF}; /* 4 * 512 */
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd32, tx, 7);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(cmd33, tx + 7, 7);
+    TEST_ASSERT_EQUAL_HEX8(0x66U, tx[15]); /* CMD38 */
+}
+
+void test_Erase_CMD38_Rejected_ReturnsError(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_cmd_exchange(0x00U); /* CMD32 */
+    push_cmd_exchange(0x00U); /* CMD33 */
+    push_cmd_exchange(0x20U); /* CMD38: erase sequence error */
+    TEST_ASSERT_EQUAL(SD_ERROR, SD_EraseBlocks(&sd, 0, 8U));
+}
+
+void test_Erase_CardBusy_Timeout(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_cmd_exchange(0x00U);
+    push_cmd_exchange(0x00U);
+    push_cmd_exchange(0x00U);
+    mock_hal_set_idle_byte(0x00U); /* card never finishes erasing */
+    TEST_ASSERT_EQUAL(SD_TIMEOUT, SD_EraseBlocks(&sd, 0, 8U));
+    TEST_ASSERT_TRUE(mock_hal_get_tick() >= SD_ERASE_TIMEOUT_MS);
+}
+
 /* -----------------------------------------------------------------------
  * SD_GetStats / SD_ResetStats
  * ----------------------------------------------------------------------- */
@@ -197,6 +252,76 @@ void test_InitAttempts_TrackedAcrossMultipleCalls(void) {
     TEST_ASSERT_EQUAL_UINT32(2U, s.init_attempts);
 }
 
+/* -----------------------------------------------------------------------
+ * Latency histograms
+ * ----------------------------------------------------------------------- */
+
+void test_Latency_Init_EnablesCycleCounter(void) {
+    SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, false);
+    TEST_ASSERT_BITS(CoreDebug_DEMCR_TRCENA_Msk, CoreDebug_DEMCR_TRCENA_Msk,
+                     mock_core_debug.DEMCR);
+    TEST_ASSERT_BITS(DWT_CTRL_CYCCNTENA_Msk, DWT_CTRL_CYCCNTENA_Msk, mock_dwt.CTRL);
+}
+
+void test_Latency_SingleRead_RecordsCmd17TokenAndBytes(void) {
+    do_sdhc_init(&sd, 8192U);
+    SD_ResetStats(&sd);
+    mock_hal_set_cycles_per_byte(MOCK_HAL_CORE_CLOCK / 1000000U); /* 1 us per byte */
+    push_single_read(0x00U);
+
+    uint8_t buf[512];
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    const SD_LatencyHist *cmd17 = &sd.stats.latency[SD_LAT_CMD17];
+    TEST_ASSERT_EQUAL_UINT32(1U, cmd17->count);
+    TEST_ASSERT_EQUAL_UINT32(1U, cmd17->hist[9]); /* 512..1023 us: one block plus framing */
+    TEST_ASSERT_TRUE(cmd17->max_cycles >= 514U * 16U);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.latency[SD_LAT_TOKEN].count);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.latency[SD_LAT_CMD24].count);
+    TEST_ASSERT_EQUAL_UINT32(512U, (uint32_t)sd.stats.read_bytes);
+}
+
+void test_Latency_LongBusy_LandsInHighBucket(void) {
+    do_sdhc_init(&sd, 8192U);
+    SD_ResetStats(&sd);
+    for (int i = 0; i < 100; i++) {
+        mock_hal_push_byte(0x00U); /* each miss backs off 1 ms */
+    }
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    const SD_LatencyHist *busy = &sd.stats.latency[SD_LAT_BUSY];
+    TEST_ASSERT_EQUAL_UINT32(1U, busy->count);
+    TEST_ASSERT_EQUAL_UINT32(1U, busy->hist[16]); /* 65.5..131 ms */
+    TEST_ASSERT_EQUAL_UINT32(100U * (MOCK_HAL_CORE_CLOCK / 1000U), busy->max_cycles);
+    /* All of it was backoff sleeps: no spinning between them (SD_POLL_SPIN_COUNT 0). */
+    TEST_ASSERT_EQUAL_UINT32(busy->max_cycles, (uint32_t)sd.stats.busy_sleep_cycles);
+}
+
+void test_Latency_DmaRead_RecordsTransferWait(void) {
+    static uint8_t buf[512] __attribute__((aligned(32)));
+    do_sdhc_init(&sd, 8192U);
+    SD_ResetStats(&sd);
+    sd.use_dma = true;
+    mock_hal_set_dma_enabled(true);
+    push_single_read(0x00U);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, buf, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.latency[SD_LAT_DMA].count);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.latency[SD_LAT_DMA].hist[0]); /* completes at once */
+    TEST_ASSERT_EQUAL_UINT32(0U, (uint32_t)sd.stats.busy_sleep_cycles);
+}
+
+void test_Latency_ResetStats_ClearsHistograms(void) {
+    do_sdhc_init(&sd, 8192U);
+    push_single_read(0x00U);
+    uint8_t buf[512];
+    SD_ReadBlocks(&sd, buf, 0, 1);
+
+    SD_ResetStats(&sd);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.latency[SD_LAT_CMD17].count);
+    TEST_ASSERT_EQUAL_UINT32(0U, sd.stats.latency[SD_LAT_TOKEN].hist[0]);
+    TEST_ASSERT_EQUAL_UINT32(0U, (uint32_t)sd.stats.read_bytes);
+}
+
 /* -----------------------------------------------------------------------
  * Accessor functions
  * ----------------------------------------------------------------------- */
@@ -298,6 +423,13 @@ int main(void) {
     RUN_TEST(test_Sync_CardReady_ReturnsOk);
     RUN_TEST(test_Sync_CardBusy_Timeout);
 
+    RUN_TEST(test_Erase_NullHandle_ReturnsParam);
+    RUN_TEST(test_Erase_CountZero_ReturnsParam);
+    RUN_TEST(test_Erase_NotInitialized_ReturnsError);
+    RUN_TEST(test_Erase_SDSC_UsesByteAddresses);
+    RUN_TEST(test_Erase_CMD38_Rejected_ReturnsError);
+    RUN_TEST(test_Erase_CardBusy_Timeout);
+
     RUN_TEST(test_GetStats_NullHandle_NoCrash);
     RUN_TEST(test_GetStats_NullStats_NoCrash);
     RUN_TEST(test_GetStats_ReturnsSnapshot);
@@ -323,5 +455,11 @@ int main(void) {
 
     RUN_TEST(test_Sync_TickOverflow_StillTimesOut);
 
+    RUN_TEST(test_Latency_Init_EnablesCycleCounter);
+    RUN_TEST(test_Latency_SingleRead_RecordsCmd17TokenAndBytes);
+    RUN_TEST(test_Latency_LongBusy_LandsInHighBucket);
+    RUN_TEST(test_Latency_DmaRead_RecordsTransferWait);
+    RUN_TEST(test_Latency_ResetStats_ClearsHistograms);
+
     return UNITY_END();
 }
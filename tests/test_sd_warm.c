@@ -0,0 +1,187 @@
+/*
+ * tests/test_sd_warm.c
+ *
+ * Cache warm-up across reboots on the card emulator: the drive samples the
+ * sectors read, sd_unmount saves the hottest to WARM.BIN, and after the next
+ * mount sd_warm_poll prefetches them with multi-block reads so the first
+ * lookup of a deep path needs no card read. Read-only mounts save nothing.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_cache.h"
+#include "sd_functions.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_warm.img"
+#define CARD_BLOCKS 16384U
+
+static char s_path[4];
+extern FATFS fs;
+
+static uint32_t card_reads(void) {
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    return cs.cmd[17] + cs.cmd[18];
+}
+
+/* Power cycle: the drive forgets its caches and histogram. */
+static void reboot(void) {
+    TEST_ASSERT_EQUAL(0, FATFS_UnLinkDriver(s_path));
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, false));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+}
+
+static void lookups(void) {
+    FILINFO fno;
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/LOGS/2026/DAY.TXT", &fno));
+        TEST_ASSERT_EQUAL(FR_OK, f_stat("0:/CFG/NET.CFG", &fno));
+    }
+}
+
+static void warm_up(void) {
+    SD_WarmStats st;
+    for (int i = 0; i < 32; i++) {
+        TEST_ASSERT_EQUAL(FR_OK, sd_warm_poll());
+        sd_warm_get_stats(&st);
+        if (st.pending == 0U) {
+            return;
+        }
+    }
+    TEST_FAIL_MESSAGE("warm-up did not finish");
+}
+
+void setUp(void) {
+    test_fatfs_fresh(IMAGE, CARD_BLOCKS, s_path, FM_FAT | FM_SFD, 1024U);
+    reboot();
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/LOGS"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/LOGS/2026"));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkdir("0:/CFG"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/LOGS/2026/DAY.TXT", "day"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_write_file("0:/CFG/NET.CFG", "dhcp=1"));
+    TEST_ASSERT_EQUAL(FR_OK, sd_file_cache_close(NULL));
+}
+
+void tearDown(void) {
+    (void)sd_unmount();
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+void test_Warm_SavedAtUnmount_PrefetchedAfterMount(void) {
+    SD_WarmStats st;
+    lookups();
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    sd_warm_get_stats(&st);
+    TEST_ASSERT_TRUE(st.saved > 0U);
+    uint32_t saved = st.saved;
+
+    reboot();
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    sd_warm_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(saved, st.loaded);
+    TEST_ASSERT_EQUAL_UINT32(saved, st.pending);
+
+    mock_card_reset_stats();
+    warm_up();
+    sd_warm_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(saved, st.prefetched);
+    TEST_ASSERT_TRUE(st.reads < saved); /* neighbours shared a read */
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_TRUE(cs.cmd[18] > 0U);
+
+    mock_card_reset_stats();
+    lookups();
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+    TEST_ASSERT_EQUAL(FR_OK, sd_warm_poll()); /* nothing left */
+}
+
+void test_Warm_WithoutPoll_FirstLookupReadsCard(void) {
+    lookups();
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    reboot();
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount());
+    mock_card_reset_stats();
+    lookups();
+    TEST_ASSERT_TRUE(card_reads() > 0U);
+}
+
+void test_Warm_ReadOnlyMount_SavesNothing(void) {
+    mock_card_stats_t cs;
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(FR_NOT_ENABLED, sd_warm_poll());
+    TEST_ASSERT_EQUAL(FR_OK, sd_mount_readonly());
+    lookups();
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(0U, cs.cmd[24] + cs.cmd[25]);
+}
+
+void test_Warm_DiskList_HottestFirst(void) {
+    uint8_t sector[512];
+    uint32_t list[4];
+    TEST_ASSERT_EQUAL(FR_OK, sd_unmount());
+    TEST_ASSERT_EQUAL(0, SD_Driver.disk_initialize(0)); /* starts a fresh histogram */
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, sector, 300U, 1U));
+    }
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, sector, 200U, 1U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, sector, 200U, 1U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, sector, 100U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(3U, SD_DiskWarmList(0, list, 4U));
+    TEST_ASSERT_EQUAL_UINT32(300U, list[0]);
+    TEST_ASSERT_EQUAL_UINT32(200U, list[1]);
+    TEST_ASSERT_EQUAL_UINT32(100U, list[2]);
+    TEST_ASSERT_EQUAL_UINT32(1U, SD_DiskWarmList(0, list, 1U));
+}
+
+void test_Warm_DiskRun_JoinsNeighbours(void) {
+    static uint8_t buf[8 * 512];
+    /* Data sectors: the FAT cache has sectors of its own. */
+    uint32_t base = (uint32_t)fs.database + 100U;
+    const uint32_t list[] = {base, base + 3U, base + 40U, CARD_BLOCKS + 5U};
+    uint32_t used = 0;
+    SD_CacheStats before;
+    SD_CacheStats after;
+    SD_CacheGetStats(&before);
+    mock_card_reset_stats();
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskWarmRun(0, list, 4U, buf, 8U, &used));
+    TEST_ASSERT_EQUAL_UINT32(2U, used);
+    mock_card_stats_t cs;
+    mock_card_get_stats(&cs);
+    TEST_ASSERT_EQUAL_UINT32(1U, cs.cmd[18]);
+    SD_CacheGetStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.filled + 2U, after.filled);
+
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskWarmRun(0, &list[2], 2U, buf, 8U, &used));
+    TEST_ASSERT_EQUAL_UINT32(1U, used);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskWarmRun(0, &list[3], 1U, buf, 8U, &used));
+    TEST_ASSERT_EQUAL_UINT32(1U, used); /* past the card: skipped */
+
+    /* Prefetched sectors are now hits. */
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, buf, base, 1U));
+    TEST_ASSERT_EQUAL(RES_OK, SD_Driver.disk_read(0, buf, base + 40U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_reads());
+    TEST_ASSERT_EQUAL(SD_PARAM, SD_DiskWarmRun(0, list, 0U, buf, 8U, &used));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Warm_SavedAtUnmount_PrefetchedAfterMount);
+    RUN_TEST(test_Warm_WithoutPoll_FirstLookupReadsCard);
+    RUN_TEST(test_Warm_ReadOnlyMount_SavesNothing);
+    RUN_TEST(test_Warm_DiskList_HottestFirst);
+    RUN_TEST(test_Warm_DiskRun_JoinsNeighbours);
+    return UNITY_END();
+}
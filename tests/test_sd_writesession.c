@@ -0,0 +1,180 @@
+/*
+ * tests/test_sd_writesession.c
+ *
+ * Write sessions (SD_WRITE_SESSION=1) over the card emulator: sequential
+ * single-block writes share one open CMD25 with no chip-select traffic, runs
+ * carry on runs, and the stop token goes out at a read, a jump, SD_Sync, a
+ * status query or the idle limit, with SD_IdlePoll releasing the card. What
+ * the card holds must match what was written, polled and with the DMA write
+ * pipeline.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_spi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE       "test_sd_writesession.img"
+#define CARD_BLOCKS 8192U
+#define BASE        100U
+#define SPAN        32U
+
+static SD_Handle_t sd;
+static uint8_t s_buf[SPAN * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+static uint8_t s_want[SPAN * 512U] __attribute__((aligned(SD_DMA_ALIGNMENT)));
+
+static void fill(uint8_t *dst, uint32_t count, uint8_t seed) {
+    for (uint32_t i = 0; i < count * 512U; i++) {
+        dst[i] = (uint8_t)(seed + i * 5U + (i >> 9));
+    }
+}
+
+static uint32_t card_cmd(uint32_t index) {
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    return st.cmd[index];
+}
+
+static void start(bool use_dma) {
+    TEST_ASSERT_EQUAL(SD_OK, SD_Init(&sd, &g_test_hspi, &g_test_cs, 0, use_dma));
+    mock_hal_set_dma_enabled(use_dma);
+    TEST_ASSERT_EQUAL(SD_OK, SD_SPI_Init(&sd));
+    fill(s_want, SPAN, 0x5BU);
+    mock_card_reset_stats();
+    SD_ResetStats(&sd);
+}
+
+/* Write blocks first..first+count-1 one call each. */
+static void write_singles(uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; i++) {
+        TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, &s_want[i * 512U], BASE + i, 1U));
+    }
+}
+
+/* Read blocks first..first+count-1 back in one request and compare. */
+static void check(uint32_t first, uint32_t count) {
+    memset(s_buf, 0, sizeof(s_buf));
+    TEST_ASSERT_EQUAL(SD_OK, SD_ReadBlocks(&sd, s_buf, BASE + first, count));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(&s_want[first * 512U], s_buf, count * 512U);
+}
+
+void setUp(void) {
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    memset(&sd, 0, sizeof(sd));
+}
+
+void tearDown(void) {
+    SD_DeInit(&sd);
+    mock_card_close();
+    (void)remove(IMAGE);
+}
+
+void test_Session_SequentialSinglesShareOneCmd25(void) {
+    start(false);
+    write_singles(0U, 1U); /* nothing to follow on from: CMD24 */
+    int selects = mock_hal_gpio_write_calls;
+    write_singles(1U, 1U); /* follows on: opens the session */
+    write_singles(2U, 14U);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(24));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(25));
+    TEST_ASSERT_EQUAL_UINT32(14U, sd.stats.session_writes);
+    TEST_ASSERT_EQUAL(selects + 1, mock_hal_gpio_write_calls);
+
+    /* A jump stops it and is a plain CMD24. */
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, &s_want[20U * 512U], BASE + 20U, 1U));
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(24));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.session_stops);
+    check(0U, 16U);
+    check(20U, 1U);
+}
+
+void test_Session_RunsCarryOnRuns(void) {
+    start(false);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_want, BASE, 8U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, &s_want[8U * 512U], BASE + 8U, 8U));
+    write_singles(16U, 2U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, &s_want[18U * 512U], BASE + 18U, 14U));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(25));
+    TEST_ASSERT_EQUAL_UINT32(0U, card_cmd(24));
+    TEST_ASSERT_EQUAL_UINT32(4U, sd.stats.session_writes);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    check(0U, SPAN);
+}
+
+void test_Session_DmaPipelineCarriesOn(void) {
+    start(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, s_want, BASE, 4U));
+    TEST_ASSERT_EQUAL(SD_OK, SD_WriteBlocks(&sd, &s_want[4U * 512U], BASE + 4U, 4U));
+    write_singles(8U, 4U);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(25));
+    TEST_ASSERT_EQUAL_UINT32(5U, sd.stats.session_writes);
+    check(0U, 12U);
+}
+
+void test_Session_ReadStopsItAndSeesTheData(void) {
+    start(false);
+    write_singles(0U, 4U);
+    check(0U, 4U);
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.session_stops);
+    mock_card_stats_t st;
+    mock_card_get_stats(&st);
+    TEST_ASSERT_EQUAL_UINT32(4U, st.sectors_written);
+
+    /* The read does not break the chain: block 4 opens a new session. */
+    write_singles(4U, 3U);
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(25));
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(24));
+    check(0U, 7U);
+}
+
+void test_Session_SyncAndStatusStopIt(void) {
+    start(false);
+    write_singles(0U, 3U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.session_stops);
+    write_singles(3U, 2U);
+    TEST_ASSERT_EQUAL(SD_OK, SD_CheckStatus(&sd));
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.session_stops);
+    TEST_ASSERT_EQUAL_UINT32(1U, card_cmd(13));
+    write_singles(5U, 2U);
+    TEST_ASSERT_EQUAL_UINT32(3U, card_cmd(25));
+    TEST_ASSERT_EQUAL(SD_OK, SD_Sync(&sd));
+    check(0U, 7U);
+}
+
+void test_Session_IdleLimitStopsIt(void) {
+    start(false);
+    write_singles(0U, 3U);
+    HAL_Delay(SD_WRITE_SESSION_IDLE_MS);
+    write_singles(3U, 1U); /* too late to carry on: a new CMD25 */
+    TEST_ASSERT_EQUAL_UINT32(2U, card_cmd(25));
+    TEST_ASSERT_EQUAL_UINT32(1U, sd.stats.session_stops);
+
+    /* SD_IdlePoll leaves a fresh session alone, then releases the card. */
+    int selects = mock_hal_gpio_write_calls;
+    TEST_ASSERT_FALSE(SD_IdlePoll(&sd));
+    TEST_ASSERT_EQUAL(selects, mock_hal_gpio_write_calls);
+    HAL_Delay(SD_WRITE_SESSION_IDLE_MS);
+    TEST_ASSERT_FALSE(SD_IdlePoll(&sd));
+    TEST_ASSERT_EQUAL(selects + 1, mock_hal_gpio_write_calls);
+    TEST_ASSERT_EQUAL_UINT32(2U, sd.stats.session_stops);
+
+    /* Following on still opens a session again. */
+    write_singles(4U, 2U);
+    TEST_ASSERT_EQUAL_UINT32(3U, card_cmd(25));
+    check(0U, 6U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_Session_SequentialSinglesShareOneCmd25);
+    RUN_TEST(test_Session_RunsCarryOnRuns);
+    RUN_TEST(test_Session_DmaPipelineCarriesOn);
+    RUN_TEST(test_Session_ReadStopsItAndSeesTheData);
+    RUN_TEST(test_Session_SyncAndStatusStopIt);
+    RUN_TEST(test_Session_IdleLimitStopsIt);
+    return UNITY_END();
+}
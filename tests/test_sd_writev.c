@@ -0,0 +1,214 @@
+/*
+ * tests/test_sd_writev.c
+ *
+ * sd_writev against the card emulator over DMA, on FAT16 with 4 KB clusters:
+ * a header + payload + trailer record goes out as one CMD25 with only the
+ * split sector bounced; an unaligned start over several clusters with
+ * another file's cluster in between; overwriting sectors the FIL's buffer holds, clean or
+ * dirty; the f_write fallback and parameter checks. Every result must match
+ * the same bytes written with f_write.
+ */
+
+#include "unity.h"
+#include "mock_hal.h"
+#include "mock_card.h"
+#include "test_helpers.h"
+#include "sd_diskio_spi.h"
+#include "sd_writev.h"
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include <string.h>
+
+#define IMAGE       "test_sd_writev.img"
+#define CARD_BLOCKS 16384U /* 8 MiB */
+#define CLUSTER     4096U
+
+static FATFS s_fs;
+static FIL s_fil;
+static FIL s_other;
+static char s_path[4];
+static uint8_t s_data[5U * CLUSTER];
+static uint8_t s_back[6U * CLUSTER];
+
+void setUp(void) {
+    static uint8_t work[_MAX_SS];
+    test_card_fresh(IMAGE, CARD_BLOCKS);
+    mock_hal_set_dma_enabled(true);
+    TEST_ASSERT_EQUAL(SD_OK, SD_DiskIoInit(&g_test_hspi, &g_test_cs, 0, true));
+    TEST_ASSERT_EQUAL(0, FATFS_LinkDriver(&SD_Driver, s_path));
+    TEST_ASSERT_EQUAL(FR_OK, f_mkfs(s_path, FM_FAT | FM_SFD, CLUSTER, work, sizeof(work)));
+    TEST_ASSERT_EQUAL(FR_OK, f_mount(&s_fs, s_path, 1));
+    for (uint32_t i = 0; i < sizeof(s_data); i++) {
+        s_data[i] = (uint8_t)((i * 13U) + (i >> 8));
+    }
+}
+
+void tearDown(void) {
+    (void)f_mount(NULL, s_path, 0);
+    (void)FATFS_UnLinkDriver(s_path);
+    mock_card_close();
+}
+
+static void stats(SD_WritevStats *out) {
+    sd_writev_get_stats(out);
+}
+
+/* Read name back into s_back and compare it with expect. */
+static void assert_file(const char *name, const uint8_t *expect, UINT len) {
+    UINT br = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_READ));
+    TEST_ASSERT_EQUAL_UINT32(len, f_size(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_back, len, &br));
+    TEST_ASSERT_EQUAL_UINT32(len, br);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    TEST_ASSERT_EQUAL_MEMORY(expect, s_back, len);
+}
+
+static void write_plain(const char *name, const void *data, UINT len) {
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, name, FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, data, len, &bw));
+    TEST_ASSERT_EQUAL_UINT32(len, bw);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+}
+
+void test_Writev_RecordIsOneCmd25WithSplitSectorBounced(void) {
+    SD_WritevStats before;
+    SD_WritevStats after;
+    mock_card_stats_t card;
+    SD_IoVec iov[3] = {
+        {s_data, 16U},              /* header */
+        {s_data + 16U, 4096U},      /* payload */
+        {s_data + 16U + 4096U, 8U}, /* trailer */
+    };
+    UINT bw = 0;
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "rec.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    stats(&before);
+    mock_card_reset_stats();
+    TEST_ASSERT_EQUAL(FR_OK, sd_writev(&s_fil, iov, 3U, &bw));
+    mock_card_get_stats(&card);
+    stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(4120U, bw);
+    TEST_ASSERT_EQUAL_UINT32(4120U, f_tell(&s_fil));
+
+    /* Sectors 0..7 in one CMD25: sector 0 is header + payload (bounced), 1..7 payload. */
+    TEST_ASSERT_EQUAL_UINT32(1U, after.calls - before.calls);
+    TEST_ASSERT_EQUAL_UINT32(1U, after.runs - before.runs);
+    TEST_ASSERT_EQUAL_UINT32(8U, after.sectors - before.sectors);
+    TEST_ASSERT_EQUAL_UINT32(1U, after.bounced - before.bounced);
+    TEST_ASSERT_EQUAL_UINT32(1U, card.cmd[25]);
+    /* The CMD24 is f_open's directory sector, written back when the FAT is loaded. */
+    TEST_ASSERT_EQUAL_UINT32(1U, card.cmd[24]);
+    TEST_ASSERT_EQUAL_UINT32(9U, card.sectors_written);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    assert_file("rec.bin", s_data, 4120U);
+}
+
+void test_Writev_UnalignedStartAcrossClustersAndHole(void) {
+    SD_WritevStats before;
+    SD_WritevStats after;
+    SD_IoVec iov[4];
+    UINT bw = 0;
+    /* big's first cluster, then b's, so big continues past b. */
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "big.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, s_data, 100U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_sync(&s_fil));
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_other, "b.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_other, s_data, CLUSTER, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_other));
+
+    iov[0].base = s_data + 100U;
+    iov[0].len = 1000U;
+    iov[1].base = s_data + 1100U;
+    iov[1].len = 0U;
+    iov[2].base = s_data + 1100U;
+    iov[2].len = 2U * CLUSTER + 777U;
+    iov[3].base = s_data + 1100U + 2U * CLUSTER + 777U;
+    iov[3].len = 3000U;
+    stats(&before);
+    TEST_ASSERT_EQUAL(FR_OK, sd_writev(&s_fil, iov, 4U, &bw));
+    stats(&after);
+    const UINT total = 1000U + 2U * CLUSTER + 777U + 3000U;
+    TEST_ASSERT_EQUAL_UINT32(total, bw);
+
+    /* 412 head bytes, the rest of big's first cluster, then the clusters after b. */
+    TEST_ASSERT_EQUAL_UINT32(2U, after.runs - before.runs);
+    TEST_ASSERT_EQUAL_UINT32((100U + total) / 512U - 1U, after.sectors - before.sectors);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    assert_file("big.bin", s_data, 100U + total);
+    assert_file("b.bin", s_data, CLUSTER);
+}
+
+void test_Writev_OverwritesBufferedSectors(void) {
+    static uint8_t fresh[2U * 512U];
+    SD_IoVec iov[2] = {{fresh, 700U}, {fresh + 700U, 324U}};
+    UINT bw = 0;
+    UINT br = 0;
+    memset(fresh, 0xA5, sizeof(fresh));
+    write_plain("over.bin", s_data, 4U * 512U);
+
+    /* Clean buffer: sector 1 was read into fp->buf before being overwritten. */
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "over.bin", FA_READ | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 600U));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_back, 10U, &br));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 512U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_writev(&s_fil, iov, 2U, &bw));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(fresh), bw);
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 600U));
+    TEST_ASSERT_EQUAL(FR_OK, f_read(&s_fil, s_back, 10U, &br));
+    TEST_ASSERT_EQUAL_HEX8(0xA5, s_back[0]);
+
+    /* Dirty buffer: bytes f_write left in sector 3 must not be written back over it. */
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 3U * 512U));
+    TEST_ASSERT_EQUAL(FR_OK, f_write(&s_fil, "stale", 5U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_lseek(&s_fil, 2U * 512U));
+    TEST_ASSERT_EQUAL(FR_OK, sd_writev(&s_fil, iov, 2U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    memcpy(s_data + 512U, fresh, sizeof(fresh));
+    memcpy(s_data + 1024U, fresh, sizeof(fresh));
+    assert_file("over.bin", s_data, 4U * 512U);
+}
+
+void test_Writev_FallbackAndParams(void) {
+    SD_WritevStats before;
+    SD_WritevStats after;
+    SD_IoVec iov[2] = {{s_data, 1024U}, {NULL, 0U}};
+    SD_IoVec bad[1] = {{NULL, 4U}};
+    UINT bw = 7;
+    write_plain("ro.bin", s_data, 1024U);
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "ro.bin", FA_READ));
+    stats(&before);
+    TEST_ASSERT_EQUAL(FR_DENIED, sd_writev(&s_fil, iov, 2U, &bw));
+    stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(0U, bw);
+    TEST_ASSERT_EQUAL_UINT32(1U, after.fallbacks - before.fallbacks);
+    TEST_ASSERT_EQUAL_UINT32(0U, after.calls - before.calls);
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_writev(&s_fil, bad, 1U, &bw));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_writev(&s_fil, NULL, 1U, &bw));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_writev(NULL, iov, 1U, &bw));
+    TEST_ASSERT_EQUAL(FR_INVALID_PARAMETER, sd_writev(&s_fil, iov, 1U, NULL));
+
+    TEST_ASSERT_EQUAL(FR_OK, f_open(&s_fil, "ro.bin", FA_OPEN_APPEND | FA_WRITE));
+    TEST_ASSERT_EQUAL(FR_OK, sd_writev(&s_fil, iov, 0U, &bw));
+    TEST_ASSERT_EQUAL_UINT32(0U, bw);
+    TEST_ASSERT_EQUAL(FR_OK, sd_writev(&s_fil, iov, 2U, &bw));
+    TEST_ASSERT_EQUAL(FR_OK, f_close(&s_fil));
+    memcpy(s_data + 1024U, s_data, 1024U);
+    assert_file("ro.bin", s_data, 2048U);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_Writev_RecordIsOneCmd25WithSplitSectorBounced);
+    RUN_TEST(test_Writev_UnalignedStartAcrossClustersAndHole);
+    RUN_TEST(test_Writev_OverwritesBufferedSectors);
+    RUN_TEST(test_Writev_FallbackAndParams);
+
+    return UNITY_END();
+}